@@ -26,6 +26,7 @@
 #include <linux/filter.h>
 
 #include "bpf_helpers.h"
+#include "skb_decap.h"
 
 #define LINUX_VERSION_CODE 263682
 
@@ -199,9 +200,12 @@ static __always_inline int ipv6_filter(struct __sk_buff *skb)
  */
 int SEC("filter") hashfilter(struct __sk_buff *skb) {
     __u32 nhoff = BPF_LL_OFF + ETH_HLEN;
+    __u16 proto = skb->protocol;
 
+    /* use the inner flow of tunnels */
+    skb_decap(skb, &nhoff, &proto);
     skb->cb[0] = nhoff;
-    switch (skb->protocol) {
+    switch (proto) {
         case __constant_htons(ETH_P_IP):
             return ipv4_filter(skb);
         case __constant_htons(ETH_P_IPV6):
@@ -26,6 +26,7 @@
 #include <linux/filter.h>
 
 #include "bpf_helpers.h"
+#include "skb_decap.h"
 
 #define LINUX_VERSION_CODE 263682
 
@@ -79,10 +80,13 @@ static __always_inline int ipv6_hash(struct __sk_buff *skb)
 
 int  __section("loadbalancer") lb(struct __sk_buff *skb) {
     __u32 nhoff = BPF_LL_OFF + ETH_HLEN;
+    __u16 proto = skb->protocol;
 
+    /* use the inner flow of tunnels */
+    skb_decap(skb, &nhoff, &proto);
     skb->cb[0] = nhoff;
 
-    switch (skb->protocol) {
+    switch (proto) {
         case __constant_htons(ETH_P_IP):
             return ipv4_hash(skb);
         case __constant_htons(ETH_P_IPV6):
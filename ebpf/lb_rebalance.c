@@ -0,0 +1,164 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/* Load balancer with the IP pair hashing of lb.c, plus per flow overrides
+ * written by Suricata to move flows away from overloaded sockets.
+ *
+ * - lb_config holds the number of sockets in the fanout group
+ * - lb_busy has a flag per socket, set while its ring is filling up
+ * - lb_flows maps a symmetric 5-tuple hash to a socket
+ *
+ * A TCP SYN for a busy socket picks the next socket that is not busy and
+ * adds the flow to lb_flows, so the rest of the session follows. Suricata
+ * also adds the hot flows of a busy socket to lb_flows. Without a config
+ * this behaves like lb.c.
+ *
+ * The flow hash has to match EBPFLbFlowHash() in src/util-ebpf.c.
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/in6.h>
+#include <linux/ipv6.h>
+#include <linux/filter.h>
+
+#include "bpf_helpers.h"
+
+#define LINUX_VERSION_CODE 263682
+
+#ifndef __section
+# define __section(x)  __attribute__((section(x), used))
+#endif
+
+#define LB_MAX_SOCKETS  64
+/* sockets tried after a busy one */
+#define LB_PROBES       4
+
+struct lb_config {
+    __u32 nb_sockets;
+};
+
+struct bpf_map_def SEC("maps") lb_config = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct lb_config),
+    .max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") lb_busy = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = LB_MAX_SOCKETS,
+};
+
+struct bpf_map_def SEC("maps") lb_flows = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = 32768,
+};
+
+static __always_inline __u32 lb_flow_hash(__u32 pair, __u32 ports, __u32 proto)
+{
+    __u32 h = pair + ports + (proto << 24);
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    return h;
+}
+
+static __always_inline int lb_is_busy(__u32 idx)
+{
+    __u32 *busy = bpf_map_lookup_elem(&lb_busy, &idx);
+    return busy != NULL && *busy != 0;
+}
+
+int  __section("loadbalancer") lb(struct __sk_buff *skb) {
+    __u32 nhoff = BPF_LL_OFF + ETH_HLEN;
+    __u32 pair = 0, proto = 0, l4 = 0;
+    int has_ports = 0;
+    int syn = 0;
+
+    switch (skb->protocol) {
+        case __constant_htons(ETH_P_IP):
+            pair = load_word(skb, nhoff + offsetof(struct iphdr, saddr)) +
+                load_word(skb, nhoff + offsetof(struct iphdr, daddr));
+            proto = load_byte(skb, nhoff + offsetof(struct iphdr, protocol));
+            /* only the first fragment has the ports */
+            if ((load_half(skb, nhoff + offsetof(struct iphdr, frag_off)) & 0x3fff) == 0) {
+                l4 = nhoff + ((load_byte(skb, nhoff) & 0x0f) << 2);
+                has_ports = 1;
+            }
+            break;
+        case __constant_htons(ETH_P_IPV6):
+#pragma unroll
+            for (int i = 0; i < 4; i++) {
+                pair += load_word(skb, nhoff + offsetof(struct ipv6hdr, saddr) + 4 * i);
+                pair += load_word(skb, nhoff + offsetof(struct ipv6hdr, daddr) + 4 * i);
+            }
+            proto = load_byte(skb, nhoff + offsetof(struct ipv6hdr, nexthdr));
+            l4 = nhoff + sizeof(struct ipv6hdr);
+            has_ports = 1;
+            break;
+        default:
+            /* hash on proto by default */
+            return skb->protocol;
+    }
+
+    __u32 zero = 0;
+    struct lb_config *cfg = bpf_map_lookup_elem(&lb_config, &zero);
+    if (cfg == NULL || cfg->nb_sockets == 0)
+        return pair;
+    if (!has_ports || (proto != IPPROTO_TCP && proto != IPPROTO_UDP))
+        return pair;
+
+    __u32 ports = load_half(skb, l4) + load_half(skb, l4 + 2);
+    __u32 key = lb_flow_hash(pair, ports, proto);
+    __u32 *sock = bpf_map_lookup_elem(&lb_flows, &key);
+    if (sock != NULL)
+        return *sock;
+
+    __u32 nb = cfg->nb_sockets;
+    __u32 idx = pair % nb;
+    if (proto == IPPROTO_TCP) {
+        /* SYN without ACK: a new session */
+        syn = (load_byte(skb, l4 + 13) & 0x12) == 0x02;
+    }
+    if (!syn || !lb_is_busy(idx))
+        return idx;
+
+#pragma unroll
+    for (int i = 1; i <= LB_PROBES; i++) {
+        __u32 alt = (idx + i) % nb;
+        if (!lb_is_busy(alt)) {
+            bpf_map_update_elem(&lb_flows, &key, &alt, BPF_NOEXIST);
+            return alt;
+        }
+    }
+    return idx;
+}
+
+char __license[] __section("license") = "GPL";
+
+/* libbpf needs version section to check sync of eBPF code and kernel
+ * but socket filter don't need it */
+__u32 __version __section("version") = LINUX_VERSION_CODE;
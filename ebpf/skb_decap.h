@@ -0,0 +1,142 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/* GRE, ERSPAN and VXLAN decapsulation for the socket filters, so they
+ * hash and bypass the inner flow like Suricata sees it. This is the skb
+ * version of decap() in xdp_filter.c, the supported tunnels have to match
+ * EBPFBypassTupleSupported() in src/util-ebpf.c.
+ *
+ * Offsets are relative to BPF_LL_OFF, as in the filters. A load past the
+ * end of the packet ends the filter, so lengths are checked first.
+ */
+
+#ifndef __SKB_DECAP_H__
+#define __SKB_DECAP_H__
+
+#ifndef ETH_P_TEB
+#define ETH_P_TEB           0x6558
+#endif
+#ifndef ETH_P_ERSPAN
+#define ETH_P_ERSPAN        0x88BE
+#endif
+
+#define DECAP_GRE_CSUM      0x8000
+#define DECAP_GRE_ROUTING   0x4000
+#define DECAP_GRE_KEY       0x2000
+#define DECAP_GRE_SEQ       0x1000
+#define DECAP_GRE_VERSION   0x0007
+/* ERSPAN type II header, after the GRE one */
+#define DECAP_ERSPAN_II_HLEN 8
+/* has to match EBPF_VXLAN_PORT in src/util-ebpf.h */
+#define DECAP_VXLAN_PORT    4789
+#define DECAP_VXLAN_HLEN    8
+
+/* the packet has size bytes at off */
+#define SKB_HAS(skb, off, size) ((off) - BPF_LL_OFF + (size) <= (skb)->len)
+
+/* skip an ethernet header and a VLAN tag, returns the ethertype in host
+ * byte order or 0 if the packet is too short */
+static __always_inline __u16 skb_parse_eth(struct __sk_buff *skb, __u32 *off)
+{
+    __u16 proto;
+
+    if (!SKB_HAS(skb, *off, ETH_HLEN))
+        return 0;
+    proto = load_half(skb, *off + offsetof(struct ethhdr, h_proto));
+    *off += ETH_HLEN;
+    if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+        if (!SKB_HAS(skb, *off, 4))
+            return 0;
+        proto = load_half(skb, *off + 2);
+        *off += 4;
+    }
+    return proto;
+}
+
+/* Move nhoff and proto (network byte order, as skb->protocol) to the
+ * inner IP header of a GRE, ERSPAN or VXLAN packet. Anything else is left
+ * untouched. */
+static __always_inline void skb_decap(struct __sk_buff *skb, __u32 *nhoff,
+                                      __u16 *proto)
+{
+    __u32 off = *nhoff;
+    __u32 l4proto;
+    __u16 inner;
+
+    if (*proto == __constant_htons(ETH_P_IP)) {
+        if (!SKB_HAS(skb, off, sizeof(struct iphdr)))
+            return;
+        /* only the first fragment has the tunnel header */
+        if (load_half(skb, off + offsetof(struct iphdr, frag_off)) & 0x3fff)
+            return;
+        l4proto = load_byte(skb, off + offsetof(struct iphdr, protocol));
+        off += (load_byte(skb, off) & 0x0f) << 2;
+    } else if (*proto == __constant_htons(ETH_P_IPV6)) {
+        if (!SKB_HAS(skb, off, sizeof(struct ipv6hdr)))
+            return;
+        l4proto = load_byte(skb, off + offsetof(struct ipv6hdr, nexthdr));
+        off += sizeof(struct ipv6hdr);
+    } else {
+        return;
+    }
+
+    if (l4proto == IPPROTO_GRE) {
+        if (!SKB_HAS(skb, off, 4))
+            return;
+        __u16 flags = load_half(skb, off);
+        __u16 gre_proto = load_half(skb, off + 2);
+        if (flags & (DECAP_GRE_VERSION | DECAP_GRE_ROUTING))
+            return;
+        off += 4;
+        if (flags & DECAP_GRE_CSUM)
+            off += 4;
+        if (flags & DECAP_GRE_KEY)
+            off += 4;
+        if (flags & DECAP_GRE_SEQ)
+            off += 4;
+        if (gre_proto == ETH_P_IP || gre_proto == ETH_P_IPV6) {
+            inner = gre_proto;
+        } else if (gre_proto == ETH_P_ERSPAN) {
+            off += DECAP_ERSPAN_II_HLEN;
+            inner = skb_parse_eth(skb, &off);
+        } else if (gre_proto == ETH_P_TEB) {
+            inner = skb_parse_eth(skb, &off);
+        } else {
+            return;
+        }
+    } else if (l4proto == IPPROTO_UDP) {
+        if (!SKB_HAS(skb, off, 8))
+            return;
+        if (load_half(skb, off + 2) != DECAP_VXLAN_PORT)
+            return;
+        off += 8 + DECAP_VXLAN_HLEN;
+        inner = skb_parse_eth(skb, &off);
+    } else {
+        return;
+    }
+
+    if (inner == ETH_P_IP) {
+        *proto = __constant_htons(ETH_P_IP);
+    } else if (inner == ETH_P_IPV6) {
+        *proto = __constant_htons(ETH_P_IPV6);
+    } else {
+        return;
+    }
+    *nhoff = off;
+}
+
+#endif /* __SKB_DECAP_H__ */
@@ -42,11 +42,56 @@
 /* Increase CPUMAP_MAX_CPUS if ever you have more than 64 CPUs */
 #define CPUMAP_MAX_CPUS     64
 
+/* Set BUILD_XSKMAP to 0 if you want to run XDP bypass on kernel
+ * older than 4.18 (no AF_XDP support) */
+#define BUILD_XSKMAP        1
+/* Increase XSKMAP_MAX_QUEUES if ever you have more than 64 RX queues */
+#define XSKMAP_MAX_QUEUES   64
+
+/* Set BUILD_DROPMAP to 0 to remove the source drop/rate-limit maps
+ * filled by the ebpf-drop keyword */
+#define BUILD_DROPMAP       1
+/* Increase DROPMAP_MAX_ENTRIES to track more sources, the least recently
+ * seen ones are evicted first */
+#define DROPMAP_MAX_ENTRIES 16384
+
+/* Set BUILD_DECAP to 0 to use the outer headers of GRE, ERSPAN and VXLAN
+ * packets for bypass and CPU redirect, like Suricata did before it could
+ * bypass the flows inside these tunnels */
+#define BUILD_DECAP         1
+/* VXLAN port, has to match EBPF_VXLAN_PORT in src/util-ebpf.h */
+#define VXLAN_PORT          4789
+
 struct vlan_hdr {
     __u16	h_vlan_TCI;
     __u16	h_vlan_encapsulated_proto;
 };
 
+#ifndef ETH_P_TEB
+#define ETH_P_TEB           0x6558
+#endif
+#ifndef ETH_P_ERSPAN
+#define ETH_P_ERSPAN        0x88BE
+#endif
+
+#define GRE_CSUM            0x8000
+#define GRE_ROUTING         0x4000
+#define GRE_KEY             0x2000
+#define GRE_SEQ             0x1000
+#define GRE_VERSION         0x0007
+/* ERSPAN type II header, after the GRE one */
+#define ERSPAN_II_HLEN      8
+
+struct gre_hdr {
+    __u16 flags;
+    __u16 proto;
+};
+
+struct vxlan_hdr {
+    __u32 flags;
+    __u32 vni;
+};
+
 struct flowv4_keys {
     __u32 src;
     __u32 dst;
@@ -87,6 +132,35 @@ struct bpf_map_def SEC("maps") flow_table_v6 = {
     .max_entries = 32768,
 };
 
+#if BUILD_DROPMAP
+/* Sources added by Suricata. time and timeout are set by Suricata, which
+ * removes the entry once time + timeout is behind the monotonic clock.
+ * A rate of 0 drops everything, else rate packets per second pass. */
+struct drop_info {
+    __u64 time;
+    __u64 timeout;
+    __u64 rate;
+    __u64 window_start;
+    __u64 window_pkts;
+    __u64 packets;
+    __u64 bytes;
+};
+
+struct bpf_map_def SEC("maps") drop_src_v4 = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct drop_info),
+    .max_entries = DROPMAP_MAX_ENTRIES,
+};
+
+struct bpf_map_def SEC("maps") drop_src_v6 = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(__u32) * 4,
+    .value_size = sizeof(struct drop_info),
+    .max_entries = DROPMAP_MAX_ENTRIES,
+};
+#endif
+
 #if BUILD_CPUMAP
 /* Special map type that can XDP_REDIRECT frames to another CPU */
 struct bpf_map_def SEC("maps") cpu_map = {
@@ -111,6 +185,25 @@ struct bpf_map_def SEC("maps") cpus_count = {
 };
 #endif
 
+#if BUILD_XSKMAP
+/* AF_XDP sockets indexed by RX queue: non bypassed packets received on
+ * a queue with an attached socket are redirected to Suricata af-xdp capture */
+struct bpf_map_def SEC("maps") xsks_map = {
+	.type		= BPF_MAP_TYPE_XSKMAP,
+	.key_size	= sizeof(__u32),
+	.value_size	= sizeof(__u32),
+	.max_entries	= XSKMAP_MAX_QUEUES,
+};
+
+/* Set to 1 by userspace for each RX queue with a socket in xsks_map */
+struct bpf_map_def SEC("maps") xsks_queues = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(__u32),
+	.value_size	= sizeof(__u32),
+	.max_entries	= XSKMAP_MAX_QUEUES,
+};
+#endif
+
 struct bpf_map_def SEC("maps") tx_peer = {
 	.type = BPF_MAP_TYPE_DEVMAP,
 	.key_size = sizeof(int),
@@ -169,7 +262,41 @@ static __always_inline int get_dport(void *trans_data, void *data_end,
     }
 }
 
-static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end)
+static int __always_inline xsk_redirect_or_pass(__u32 rx_queue)
+{
+#if BUILD_XSKMAP
+    __u32 *active = bpf_map_lookup_elem(&xsks_queues, &rx_queue);
+
+    if (active && *active)
+        return bpf_redirect_map(&xsks_map, rx_queue, 0);
+#endif
+    return XDP_PASS;
+}
+
+#if BUILD_DROPMAP
+/* returns 1 if the packet of a listed source has to be dropped */
+static int __always_inline drop_source(struct drop_info *info, __u64 len)
+{
+    __u64 now;
+
+    if (info->rate) {
+        now = bpf_ktime_get_ns();
+        /* the window is shared by the CPUs, so the rate is approximate */
+        if (now - info->window_start >= 1000000000ULL) {
+            info->window_start = now;
+            info->window_pkts = 0;
+        }
+        if (__sync_fetch_and_add(&info->window_pkts, 1) < info->rate)
+            return 0;
+    }
+    __sync_fetch_and_add(&info->packets, 1);
+    __sync_fetch_and_add(&info->bytes, len);
+    return 1;
+}
+#endif
+
+static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end,
+                                       __u32 rx_queue)
 {
     struct iphdr *iph = data + nh_off;
     int dport;
@@ -185,9 +312,23 @@ static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end)
 #endif
     int *iface_peer;
     int tx_port = 0;
+#if BUILD_XSKMAP
+    int rc;
+#endif
+#if BUILD_DROPMAP
+    struct drop_info *drop;
+    __u32 drop_key;
+#endif
 
     if ((void *)(iph + 1) > data_end)
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
+
+#if BUILD_DROPMAP
+    drop_key = iph->saddr;
+    drop = bpf_map_lookup_elem(&drop_src_v4, &drop_key);
+    if (drop && drop_source(drop, data_end - data))
+        return XDP_DROP;
+#endif
 
     tuple.ip_proto = (__u32) iph->protocol;
     tuple.src = iph->saddr;
@@ -195,11 +336,11 @@ static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end)
 
     dport = get_dport(iph + 1, data_end, iph->protocol);
     if (dport == -1)
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
 
     sport = get_sport(iph + 1, data_end, iph->protocol);
     if (sport == -1)
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
 
     tuple.port16[0] = (__u16)sport;
     tuple.port16[1] = (__u16)dport;
@@ -231,6 +372,13 @@ static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end)
         }
     }
 
+#if BUILD_XSKMAP
+    /* Flow is not bypassed: a queue served by an AF_XDP socket gets it */
+    rc = xsk_redirect_or_pass(rx_queue);
+    if (rc != XDP_PASS)
+        return rc;
+#endif
+
 #if BUILD_CPUMAP
     /* IP-pairs + protocol (UDP/TCP/ICMP) hit same CPU */
     cpu_hash = tuple.src + tuple.dst;
@@ -251,7 +399,8 @@ static int __always_inline filter_ipv4(void *data, __u64 nh_off, void *data_end)
 #endif
 }
 
-static int __always_inline filter_ipv6(void *data, __u64 nh_off, void *data_end)
+static int __always_inline filter_ipv6(void *data, __u64 nh_off, void *data_end,
+                                       __u32 rx_queue)
 {
     struct ipv6hdr *ip6h = data + nh_off;
     int dport;
@@ -267,19 +416,33 @@ static int __always_inline filter_ipv6(void *data, __u64 nh_off, void *data_end)
 #endif
     int tx_port = 0;
     int *iface_peer;
+#if BUILD_XSKMAP
+    int rc;
+#endif
+#if BUILD_DROPMAP
+    struct drop_info *drop;
+    __u32 drop_key[4];
+#endif
 
     if ((void *)(ip6h + 1) > data_end)
         return 0;
+
+#if BUILD_DROPMAP
+    __builtin_memcpy(drop_key, ip6h->saddr.s6_addr32, sizeof(drop_key));
+    drop = bpf_map_lookup_elem(&drop_src_v6, drop_key);
+    if (drop && drop_source(drop, data_end - data))
+        return XDP_DROP;
+#endif
     if (!((ip6h->nexthdr == IPPROTO_UDP) || (ip6h->nexthdr == IPPROTO_TCP)))
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
 
     dport = get_dport(ip6h + 1, data_end, ip6h->nexthdr);
     if (dport == -1)
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
 
     sport = get_sport(ip6h + 1, data_end, ip6h->nexthdr);
     if (sport == -1)
-        return XDP_PASS;
+        return xsk_redirect_or_pass(rx_queue);
 
     tuple.ip_proto = ip6h->nexthdr;
     __builtin_memcpy(tuple.src, ip6h->saddr.s6_addr32, sizeof(tuple.src));
@@ -305,6 +468,13 @@ static int __always_inline filter_ipv6(void *data, __u64 nh_off, void *data_end)
         }
     }
 
+#if BUILD_XSKMAP
+    /* Flow is not bypassed: a queue served by an AF_XDP socket gets it */
+    rc = xsk_redirect_or_pass(rx_queue);
+    if (rc != XDP_PASS)
+        return rc;
+#endif
+
 #if BUILD_CPUMAP
     /* IP-pairs + protocol (UDP/TCP/ICMP) hit same CPU */
     cpu_hash  = tuple.src[0] + tuple.dst[0];
@@ -328,6 +498,110 @@ static int __always_inline filter_ipv6(void *data, __u64 nh_off, void *data_end)
 #endif
 }
 
+#if BUILD_DECAP
+/* skip an ethernet header and up to two VLAN tags, returns the ethertype
+ * or 0 if the packet is too short */
+static __always_inline __u16 parse_eth(void *data, void *data_end, __u64 *nh_off)
+{
+    struct ethhdr *eth = data + *nh_off;
+    struct vlan_hdr *vhdr;
+    __u16 h_proto;
+
+    if ((void *)(eth + 1) > data_end)
+        return 0;
+    h_proto = eth->h_proto;
+    *nh_off += sizeof(*eth);
+
+#pragma unroll
+    for (int i = 0; i < 2; i++) {
+        if (h_proto != __constant_htons(ETH_P_8021Q) &&
+                h_proto != __constant_htons(ETH_P_8021AD))
+            break;
+        vhdr = data + *nh_off;
+        if ((void *)(vhdr + 1) > data_end)
+            return 0;
+        h_proto = vhdr->h_vlan_encapsulated_proto;
+        *nh_off += sizeof(*vhdr);
+    }
+    return h_proto;
+}
+
+/* Move nh_off and h_proto to the inner IP header of a GRE, ERSPAN or VXLAN
+ * packet, so the bypass keys and the CPU hash use the tuple Suricata sees
+ * for the inner flow. Anything else is left untouched. */
+static __always_inline void decap(void *data, void *data_end, __u64 *nh_off,
+                                  __u16 *h_proto)
+{
+    __u64 off = *nh_off;
+    __u16 proto;
+    __u8 l4proto;
+
+    if (*h_proto == __constant_htons(ETH_P_IP)) {
+        struct iphdr *iph = data + off;
+        if ((void *)(iph + 1) > data_end)
+            return;
+        /* only the first fragment has the tunnel header */
+        if (iph->frag_off & __constant_htons(0x3fff))
+            return;
+        l4proto = iph->protocol;
+        off += iph->ihl << 2;
+    } else if (*h_proto == __constant_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6h = data + off;
+        if ((void *)(ip6h + 1) > data_end)
+            return;
+        l4proto = ip6h->nexthdr;
+        off += sizeof(*ip6h);
+    } else {
+        return;
+    }
+
+    if (l4proto == IPPROTO_GRE) {
+        struct gre_hdr *greh = data + off;
+        if ((void *)(greh + 1) > data_end)
+            return;
+        if (greh->flags & __constant_htons(GRE_VERSION | GRE_ROUTING))
+            return;
+        off += sizeof(*greh);
+        if (greh->flags & __constant_htons(GRE_CSUM))
+            off += 4;
+        if (greh->flags & __constant_htons(GRE_KEY))
+            off += 4;
+        if (greh->flags & __constant_htons(GRE_SEQ))
+            off += 4;
+        switch (greh->proto) {
+            case __constant_htons(ETH_P_IP):
+            case __constant_htons(ETH_P_IPV6):
+                proto = greh->proto;
+                break;
+            case __constant_htons(ETH_P_ERSPAN):
+                off += ERSPAN_II_HLEN;
+                proto = parse_eth(data, data_end, &off);
+                break;
+            case __constant_htons(ETH_P_TEB):
+                proto = parse_eth(data, data_end, &off);
+                break;
+            default:
+                return;
+        }
+    } else if (l4proto == IPPROTO_UDP) {
+        struct udphdr *udph = data + off;
+        if ((void *)(udph + 1) > data_end)
+            return;
+        if (udph->dest != __constant_htons(VXLAN_PORT))
+            return;
+        off += sizeof(*udph) + sizeof(struct vxlan_hdr);
+        proto = parse_eth(data, data_end, &off);
+    } else {
+        return;
+    }
+
+    if (proto == __constant_htons(ETH_P_IP) || proto == __constant_htons(ETH_P_IPV6)) {
+        *nh_off = off;
+        *h_proto = proto;
+    }
+}
+#endif
+
 int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
 {
     void *data_end = (void *)(long)ctx->data_end;
@@ -362,12 +636,16 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
 		h_proto = vhdr->h_vlan_encapsulated_proto;
 	}
 
+#if BUILD_DECAP
+	decap(data, data_end, &nh_off, &h_proto);
+#endif
+
 	if (h_proto == __constant_htons(ETH_P_IP))
-		return filter_ipv4(data, nh_off, data_end);
+		return filter_ipv4(data, nh_off, data_end, ctx->rx_queue_index);
 	else if (h_proto == __constant_htons(ETH_P_IPV6))
-		return filter_ipv6(data, nh_off, data_end);
+		return filter_ipv6(data, nh_off, data_end, ctx->rx_queue_index);
 	else
-		rc = XDP_PASS;
+		rc = xsk_redirect_or_pass(ctx->rx_queue_index);
 
     return rc;
 }
@@ -166,4 +166,82 @@ argsd = {
             "required": 1,
         },
     ],
+    "stream-memuse-top": [
+        {
+            "name": "count",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "flow-cost-top": [
+        {
+            "name": "count",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "worker-add": [
+        {
+            "name": "iface",
+            "required": 1,
+        },
+    ],
+    "worker-remove": [
+        {
+            "name": "iface",
+            "required": 1,
+        },
+    ],
+    "fast-pattern-stats": [
+        {
+            "name": "count",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "ruleset-profile-sample": [
+        {
+            "name": "rate",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "ruleset-profile-sample-top": [
+        {
+            "name": "count",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "dataset-reload": [
+        {
+            "name": "setname",
+            "required": 1,
+        },
+    ],
+    "iprep-update": [
+        {
+            "name": "ip",
+            "required": 1,
+        },
+        {
+            "name": "category",
+            "required": 1,
+        },
+        {
+            "name": "value",
+            "type": int,
+            "required": 0,
+        },
+    ],
+    "iprep-lookup": [
+        {
+            "name": "ip",
+            "required": 1,
+        },
+        {
+            "name": "category",
+            "required": 1,
+        },
+    ],
     }
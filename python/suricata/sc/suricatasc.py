@@ -90,6 +90,7 @@ class SuricataSC:
                 "pcap-last-processed",
                 "pcap-interrupt",
                 "iface-list",
+                "iprep-reload",
                 ]
         self.fn_commands = [
                 "pcap-file",
@@ -106,6 +107,16 @@ class SuricataSC:
                 "list-hostbit",
                 "memcap-set",
                 "memcap-show",
+                "stream-memuse-top",
+                "flow-cost-top",
+                "worker-add",
+                "worker-remove",
+                "fast-pattern-stats",
+                "ruleset-profile-sample",
+                "ruleset-profile-sample-top",
+                "dataset-reload",
+                "iprep-update",
+                "iprep-lookup",
                 ]
         self.cmd_list = self.basic_commands + self.fn_commands
         self.sck_path = sck_path
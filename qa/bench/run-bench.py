@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+# Copyright(C) 2019 Open Information Security Foundation
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 2 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+
+"""Full pipeline benchmark.
+
+Runs suricata in the pcap file runmode on the pcap and ruleset of each
+suite in suites.json and writes the results as json:
+
+- startup time, from exec to "engine started"
+- packets and Mpps, the packets over the time from "engine started" to
+  the end of the pcap
+- the peak of each *.memuse counter, from stats.log written every second
+- ticks per thread module and flow worker stage, from packet_stats.log
+  when suricata was built with --enable-profiling
+
+Each suite is run --runs times, the median of each value is kept. With
+--compare the results are compared to those of an earlier run, and the
+exit code is 1 if the Mpps of a suite dropped more than --threshold
+percent.
+"""
+
+import argparse
+import datetime
+import hashlib
+import json
+import os
+import platform
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+RESULT_VERSION = 1
+
+STARTED_RE = re.compile(r"engine started")
+STOPPING_RE = re.compile(r"Signal Received\.\s+Stopping engine")
+READ_RE = re.compile(r"Pcap-file module read (\d+) files?, (\d+) packets, (\d+) bytes")
+STATS_RE = re.compile(r"^(\S+)\s+\|\s+(.+?)\s+\|\s+(\d+)\s*$")
+PROF_RE = re.compile(r"^(\S+)\s+IPv[46]\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)\s")
+
+
+def sha256(path):
+    h = hashlib.sha256()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(1 << 20), b""):
+            h.update(block)
+    return h.hexdigest()
+
+
+def parse_stats_log(path):
+    """Return the peak value of each memuse counter."""
+    peaks = {}
+    if not os.path.exists(path):
+        return peaks
+    with open(path) as f:
+        for line in f:
+            m = STATS_RE.match(line)
+            if m is None or not m.group(1).endswith("memuse"):
+                continue
+            name, value = m.group(1), int(m.group(3))
+            peaks[name] = max(peaks.get(name, 0), value)
+    return peaks
+
+
+def parse_packet_stats(path):
+    """Return the ticks per thread module and per flow worker stage.
+
+    The tables list cnt, min, max and avg per ip version and protocol,
+    the ticks are summed as cnt * avg."""
+    modules = {}
+    flowworker = {}
+    if not os.path.exists(path):
+        return None
+    table = None
+    with open(path) as f:
+        for line in f:
+            if line.startswith("Flow Worker"):
+                table = flowworker
+                continue
+            if line.startswith("Thread Module"):
+                table = modules
+                continue
+            if line.startswith("Per App layer") or line.startswith("Logger/output"):
+                table = None
+                continue
+            if table is None:
+                continue
+            m = PROF_RE.match(line)
+            if m is None:
+                continue
+            name = m.group(1)
+            ticks = int(m.group(3)) * int(m.group(6))
+            table[name] = table.get(name, 0) + ticks
+    return {"modules": modules, "flow_worker": flowworker}
+
+
+def run_once(args, suite, pcap, rules, logdir):
+    cmd = [args.suricata, "-c", args.config, "-v", "-k", "none",
+           "-r", pcap, "-S", rules, "-l", logdir,
+           "--set", "stats.enabled=yes",
+           "--set", "stats.interval=1",
+           "--set", "profiling.packets.enabled=yes",
+           "--set", "profiling.packets.filename=packet_stats.log",
+           "--set", "profiling.packets.append=no"]
+    runmode = suite.get("runmode", args.runmode)
+    if runmode:
+        cmd += ["--runmode", runmode]
+    for opt in suite.get("set", []) + args.set:
+        cmd += ["--set", opt]
+
+    result = {}
+    start = time.monotonic()
+    started = stopped = None
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    output = []
+    for line in proc.stdout:
+        now = time.monotonic()
+        output.append(line)
+        if started is None and STARTED_RE.search(line):
+            started = now
+        elif stopped is None and STOPPING_RE.search(line):
+            stopped = now
+        m = READ_RE.search(line)
+        if m is not None:
+            result["packets"] = int(m.group(2))
+            result["bytes"] = int(m.group(3))
+    proc.wait()
+    end = time.monotonic()
+
+    if proc.returncode != 0 or started is None:
+        sys.stderr.write("".join(output[-20:]))
+        raise RuntimeError("suricata failed with exit code %d: %s" %
+                           (proc.returncode, " ".join(cmd)))
+    if stopped is None:
+        stopped = end
+
+    result["startup_s"] = started - start
+    result["runtime_s"] = stopped - started
+    result["total_s"] = end - start
+    if result.get("packets") and result["runtime_s"] > 0:
+        result["mpps"] = result["packets"] / result["runtime_s"] / 1e6
+    result["memuse_peak"] = parse_stats_log(os.path.join(logdir, "stats.log"))
+    prof = parse_packet_stats(os.path.join(logdir, "packet_stats.log"))
+    if prof is not None:
+        result["ticks"] = prof
+    return result
+
+
+def median_of(runs):
+    """Median of each value over the runs, recursing into dicts."""
+    out = {}
+    for key in runs[0]:
+        values = [r[key] for r in runs if key in r]
+        if isinstance(values[0], dict):
+            out[key] = median_of(values)
+        elif all(isinstance(v, int) for v in values):
+            out[key] = statistics.median_low(values)
+        else:
+            out[key] = statistics.median(values)
+    return out
+
+
+def run_suite(args, name, suite):
+    pcap = os.path.join(args.data, suite["pcap"])
+    if not os.path.exists(pcap):
+        print("%s: skipped, %s not found" % (name, pcap), file=sys.stderr)
+        return {"skipped": "pcap not found: %s" % suite["pcap"]}
+    rules = os.path.join(BENCH_DIR, suite["rules"])
+
+    runs = []
+    for i in range(args.runs):
+        logdir = tempfile.mkdtemp(prefix="suricata-bench-%s-" % name)
+        try:
+            runs.append(run_once(args, suite, pcap, rules, logdir))
+        finally:
+            if args.keep_logs:
+                print("%s: run %d logs in %s" % (name, i, logdir), file=sys.stderr)
+            else:
+                shutil.rmtree(logdir, ignore_errors=True)
+
+    result = median_of(runs)
+    result["runs"] = len(runs)
+    result["pcap"] = suite["pcap"]
+    result["pcap_sha256"] = sha256(pcap)
+    result["rules"] = suite["rules"]
+    result["rules_sha256"] = sha256(rules)
+    print("%s: %.3f Mpps, startup %.2fs, %d packets" % (
+        name, result.get("mpps", 0), result["startup_s"],
+        result.get("packets", 0)), file=sys.stderr)
+    return result
+
+
+def suricata_version(path):
+    try:
+        out = subprocess.check_output([path, "-V"], universal_newlines=True)
+        return out.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def pct(old, new):
+    if not old:
+        return None
+    return (new - old) * 100.0 / old
+
+
+def compare(old, new, threshold):
+    """Print the changes between two result files. Returns False if the
+    Mpps of a suite dropped more than threshold percent."""
+    ok = True
+    print("%-8s %-28s %16s %16s %8s" % ("suite", "value", "old", "new", "change"))
+    for name, res in sorted(new["suites"].items()):
+        prev = old.get("suites", {}).get(name)
+        if prev is None or "skipped" in res or "skipped" in prev:
+            continue
+        if prev.get("pcap_sha256") != res.get("pcap_sha256") or \
+                prev.get("rules_sha256") != res.get("rules_sha256"):
+            print("%-8s dataset or ruleset changed, not compared" % name)
+            continue
+        rows = [(k, prev.get(k), res.get(k)) for k in ("mpps", "startup_s", "runtime_s")]
+        for k, v in sorted(res.get("memuse_peak", {}).items()):
+            rows.append((k, prev.get("memuse_peak", {}).get(k), v))
+        for k, v in sorted(res.get("ticks", {}).get("flow_worker", {}).items()):
+            rows.append((k, prev.get("ticks", {}).get("flow_worker", {}).get(k), v))
+        for key, a, b in rows:
+            if a is None or b is None:
+                continue
+            change = pct(a, b)
+            print("%-8s %-28s %16.3f %16.3f %7s%%" % (
+                name, key, a, b, "-" if change is None else "%+.1f" % change))
+        change = pct(prev.get("mpps"), res.get("mpps", 0))
+        if change is not None and change < -threshold:
+            print("%s: Mpps dropped %.1f%%" % (name, -change))
+            ok = False
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Suricata pipeline benchmark")
+    parser.add_argument("--suricata", required=True, help="suricata binary")
+    parser.add_argument("--config", required=True, help="suricata.yaml to use")
+    parser.add_argument("--data", required=True,
+                        help="directory with the pcaps of the suites")
+    parser.add_argument("--suites", default=os.path.join(BENCH_DIR, "suites.json"),
+                        help="suite definitions")
+    parser.add_argument("--suite", action="append", default=[],
+                        help="run only this suite, can be repeated")
+    parser.add_argument("--runs", type=int, default=3,
+                        help="runs per suite, the median is kept")
+    parser.add_argument("--runmode", help="runmode, default from the config")
+    parser.add_argument("--set", action="append", default=[],
+                        help="extra --set option for suricata")
+    parser.add_argument("--output", help="write the results to this file")
+    parser.add_argument("--compare", help="compare to these earlier results")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="Mpps drop in percent that fails --compare")
+    parser.add_argument("--keep-logs", action="store_true",
+                        help="keep the log directory of each run")
+    args = parser.parse_args()
+    if args.runs < 1:
+        parser.error("--runs must be at least 1")
+
+    with open(args.suites) as f:
+        suites = json.load(f)
+    names = args.suite or sorted(suites)
+    for name in names:
+        if name not in suites:
+            parser.error("unknown suite %s, have %s" % (name, ", ".join(sorted(suites))))
+
+    results = {
+        "version": RESULT_VERSION,
+        "date": datetime.datetime.utcnow().strftime("%Y-%m-%dT%H:%M:%SZ"),
+        "suricata": suricata_version(args.suricata),
+        "host": {
+            "name": platform.node(),
+            "machine": platform.machine(),
+            "cpus": os.cpu_count(),
+        },
+        "suites": {},
+    }
+    for name in names:
+        results["suites"][name] = run_suite(args, name, suites[name])
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+    else:
+        json.dump(results, sys.stdout, indent=2, sort_keys=True)
+        print()
+
+    if args.compare:
+        with open(args.compare) as f:
+            old = json.load(f)
+        if not compare(old, results, args.threshold):
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
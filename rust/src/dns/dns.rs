@@ -20,8 +20,10 @@ extern crate nom;
 
 use std;
 use std::mem::transmute;
+use std::collections::VecDeque;
 
 use log::*;
+use applayer;
 use applayer::LoggerFlags;
 use core;
 use dns::parser;
@@ -247,8 +249,9 @@ pub struct DNSState {
     // Internal transaction ID.
     pub tx_id: u64,
 
-    // Transactions.
-    pub transactions: Vec<DNSTransaction>,
+    // Transactions, oldest first. A ring buffer as they are freed and
+    // purged from the front, and its storage is reused for new ones.
+    pub transactions: VecDeque<DNSTransaction>,
 
     pub events: u16,
 
@@ -263,7 +266,7 @@ impl DNSState {
     pub fn new() -> DNSState {
         return DNSState{
             tx_id: 0,
-            transactions: Vec::new(),
+            transactions: VecDeque::new(),
             events: 0,
             request_buffer: Vec::new(),
             response_buffer: Vec::new(),
@@ -276,7 +279,7 @@ impl DNSState {
     pub fn new_tcp() -> DNSState {
         return DNSState{
             tx_id: 0,
-            transactions: Vec::new(),
+            transactions: VecDeque::new(),
             events: 0,
             request_buffer: Vec::with_capacity(0xffff),
             response_buffer: Vec::with_capacity(0xffff),
@@ -321,7 +324,7 @@ impl DNSState {
                 return;
             }
             SCLogDebug!("Purging DNS TX with ID {}", self.transactions[0].id);
-            self.transactions.remove(0);
+            self.transactions.pop_front();
         }
     }
 
@@ -338,6 +341,33 @@ impl DNSState {
         return None;
     }
 
+    // for use with the C API call StateGetTxIterator
+    pub fn get_tx_iterator(&mut self, min_tx_id: u64, state: &mut u64) ->
+        Option<(&DNSTransaction, u64, bool)>
+    {
+        // state holds the index of the last returned tx plus one, so
+        // 0 means this is the first call of an iteration
+        if *state == 0 {
+            self.purge(min_tx_id);
+        }
+        let mut index = if *state > 0 { *state as usize - 1 } else { 0 };
+        let len = self.transactions.len();
+
+        // find tx that is >= min_tx_id
+        while index < len {
+            let tx = &self.transactions[index];
+            if tx.id < min_tx_id + 1 {
+                index += 1;
+                continue;
+            }
+            // store the current index and not the next, as the current
+            // tx might be freed before the next call.
+            *state = index as u64 + 1;
+            return Some((tx, tx.id - 1, (len - index) > 1));
+        }
+        return None;
+    }
+
     /// Set an event. The event is set on the most recent transaction.
     pub fn set_event(&mut self, event: DNSEvent) {
         let len = self.transactions.len();
@@ -368,7 +398,7 @@ impl DNSState {
 
                 let mut tx = self.new_tx();
                 tx.request = Some(request);
-                self.transactions.push(tx);
+                self.transactions.push_back(tx);
                 return true;
             }
             Err(nom::Err::Incomplete(_)) => {
@@ -405,7 +435,7 @@ impl DNSState {
 
                 let mut tx = self.new_tx();
                 tx.response = Some(response);
-                self.transactions.push(tx);
+                self.transactions.push_back(tx);
                 return true;
             }
             Err(nom::Err::Incomplete(_)) => {
@@ -423,11 +453,45 @@ impl DNSState {
         }
     }
 
+    /// Parse the length prefixed messages of a TCP stream.
+    ///
+    /// Returns the number of bytes consumed, the remainder is an
+    /// incomplete message, and the number of messages parsed.
+    fn parse_tcp_messages(&mut self, input: &[u8], request: bool) -> (usize, i8) {
+        let mut consumed = 0;
+        let mut count = 0;
+        while consumed < input.len() {
+            let cur = &input[consumed..];
+            let size = match nom::be_u16(cur) {
+                Ok((_, len)) => len,
+                _ => 0
+            } as usize;
+            SCLogDebug!("Have {} bytes, need {} to parse",
+                        cur.len(), size);
+            if size > 0 && cur.len() >= size + 2 {
+                let msg = &cur[2..(size + 2)];
+                let parsed = if request {
+                    self.parse_request(msg)
+                } else {
+                    self.parse_response(msg)
+                };
+                if parsed {
+                    count += 1;
+                }
+                consumed += size + 2;
+            } else {
+                SCLogDebug!("Not enough DNS traffic to parse.");
+                break;
+            }
+        }
+        return (consumed, count);
+    }
+
     /// TCP variation of response request parser to handle the length
     /// prefix as well as buffering.
     ///
-    /// Always buffer and read from the buffer. Should optimize to skip
-    /// the buffer if not needed.
+    /// Complete messages are parsed straight from the input, only an
+    /// incomplete message at the end is buffered.
     ///
     /// Returns the number of messages parsed.
     pub fn parse_request_tcp(&mut self, input: &[u8]) -> i8 {
@@ -439,35 +503,27 @@ impl DNSState {
             }
         }
 
-        self.request_buffer.extend_from_slice(input);
-
-        let mut count = 0;
-        while self.request_buffer.len() > 0 {
-            let size = match nom::be_u16(&self.request_buffer) {
-                Ok((_, len)) => len,
-                _ => 0
-            } as usize;
-            SCLogDebug!("Have {} bytes, need {} to parse",
-                        self.request_buffer.len(), size);
-            if size > 0 && self.request_buffer.len() >= size + 2 {
-                let msg: Vec<u8> = self.request_buffer.drain(0..(size + 2))
-                    .collect();
-                if self.parse_request(&msg[2..]) {
-                    count += 1
-                }
-            } else {
-                SCLogDebug!("Not enough DNS traffic to parse.");
-                break;
-            }
+        if self.request_buffer.len() == 0 {
+            let (consumed, count) = self.parse_tcp_messages(input, true);
+            self.request_buffer.extend_from_slice(&input[consumed..]);
+            return count;
         }
+
+        // Take the buffer out of the state while parsing from it, it
+        // keeps its capacity when put back.
+        let mut buffer = std::mem::replace(&mut self.request_buffer, Vec::new());
+        buffer.extend_from_slice(input);
+        let (consumed, count) = self.parse_tcp_messages(&buffer, true);
+        buffer.drain(0..consumed);
+        self.request_buffer = buffer;
         return count;
     }
 
     /// TCP variation of the response parser to handle the length
     /// prefix as well as buffering.
     ///
-    /// Always buffer and read from the buffer. Should optimize to skip
-    /// the buffer if not needed.
+    /// Complete messages are parsed straight from the input, only an
+    /// incomplete message at the end is buffered.
     ///
     /// Returns the number of messages parsed.
     pub fn parse_response_tcp(&mut self, input: &[u8]) -> i8 {
@@ -479,24 +535,17 @@ impl DNSState {
             }
         }
 
-        self.response_buffer.extend_from_slice(input);
-
-        let mut count = 0;
-        while self.response_buffer.len() > 0 {
-            let size = match nom::be_u16(&self.response_buffer) {
-                Ok((_, len)) => len,
-                _ => 0
-            } as usize;
-            if size > 0 && self.response_buffer.len() >= size + 2 {
-                let msg: Vec<u8> = self.response_buffer.drain(0..(size + 2))
-                    .collect();
-                if self.parse_response(&msg[2..]) {
-                    count += 1;
-                }
-            } else {
-                break;
-            }
+        if self.response_buffer.len() == 0 {
+            let (consumed, count) = self.parse_tcp_messages(input, false);
+            self.response_buffer.extend_from_slice(&input[consumed..]);
+            return count;
         }
+
+        let mut buffer = std::mem::replace(&mut self.response_buffer, Vec::new());
+        buffer.extend_from_slice(input);
+        let (consumed, count) = self.parse_tcp_messages(&buffer, false);
+        buffer.drain(0..consumed);
+        self.response_buffer = buffer;
         return count;
     }
 
@@ -721,6 +770,26 @@ pub extern "C" fn rs_dns_state_get_tx(state: &mut DNSState,
     }
 }
 
+// for use with the C API call StateGetTxIterator
+#[no_mangle]
+pub extern "C" fn rs_dns_state_get_tx_iterator(
+                                      state: &mut DNSState,
+                                      min_tx_id: libc::uint64_t,
+                                      istate: &mut libc::uint64_t)
+                                      -> applayer::AppLayerGetTxIterTuple
+{
+    match state.get_tx_iterator(min_tx_id, istate) {
+        Some((tx, out_tx_id, has_next)) => {
+            let c_tx = unsafe { transmute(tx) };
+            let ires = applayer::AppLayerGetTxIterTuple::with_values(c_tx, out_tx_id, has_next);
+            return ires;
+        }
+        None => {
+            return applayer::AppLayerGetTxIterTuple::not_found();
+        }
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn rs_dns_state_set_tx_detect_state(
     tx: &mut DNSTransaction,
@@ -995,4 +1064,44 @@ mod tests {
         let mut state = DNSState::new();
         assert_eq!(0, state.parse_response_tcp(&request));
     }
+
+    // Test that messages split over, or packed into, TCP payloads are
+    // parsed, with only the incomplete message buffered.
+    #[test]
+    fn test_dns_parse_request_tcp_split() {
+        // The DNS payload of the request in test_dns_parse_request_tcp_valid.
+        let dns_payload: &[u8] = &[
+            0x8d, 0x32, 0x01, 0x20, 0x00, 0x01, 0x00, 0x00, /* .2. .... */
+            0x00, 0x00, 0x00, 0x01, 0x03, 0x77, 0x77, 0x77, /* .....www */
+            0x0c, 0x73, 0x75, 0x72, 0x69, 0x63, 0x61, 0x74, /* .suricat */
+            0x61, 0x2d, 0x69, 0x64, 0x73, 0x03, 0x6f, 0x72, /* a-ids.or */
+            0x67, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, /* g....... */
+            0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* )....... */
+            0x00,                                           /* . */
+        ];
+
+        // Three length prefixed requests back to back.
+        let mut stream = Vec::new();
+        for _ in 0..3 {
+            stream.push(((dns_payload.len() as u16) >> 8) as u8);
+            stream.push(((dns_payload.len() as u16) & 0xff) as u8);
+            stream.extend(dns_payload);
+        }
+
+        let mut state = DNSState::new();
+
+        // Part of the first request.
+        assert_eq!(0, state.parse_request_tcp(&stream[..10]));
+        assert_eq!(10, state.request_buffer.len());
+
+        // The rest of the first and part of the second request.
+        let second = dns_payload.len() + 2 + 5;
+        assert_eq!(1, state.parse_request_tcp(&stream[10..second]));
+        assert_eq!(5, state.request_buffer.len());
+
+        // The rest of the second and all of the third request.
+        assert_eq!(2, state.parse_request_tcp(&stream[second..]));
+        assert_eq!(0, state.request_buffer.len());
+        assert_eq!(3, state.transactions.len());
+    }
 }
@@ -89,6 +89,10 @@ pub const LOG_URI        : u64 = BIT_U64!(59);
 pub const LOG_FORMAT_GROUPED  : u64 = BIT_U64!(60);
 pub const LOG_FORMAT_DETAILED : u64 = BIT_U64!(61);
 
+// Optional fields of the version 2 answer.
+pub const LOG_FLAGS           : u64 = BIT_U64!(62);
+pub const LOG_AUTHORITIES     : u64 = BIT_U64!(63);
+
 fn dns_log_rrtype_enabled(rtype: u16, flags: u64) -> bool
 {
     if flags == !0 {
@@ -455,21 +459,23 @@ fn dns_log_json_answer(response: &DNSResponse, flags: u64) -> Json
     js.set_integer("version", 2);
     js.set_string("type", "answer");
     js.set_integer("id", header.tx_id as u64);
-    js.set_string("flags", format!("{:x}", header.flags).as_str());
-    if header.flags & 0x8000 != 0 {
-        js.set_boolean("qr", true);
-    }
-    if header.flags & 0x0400 != 0 {
-        js.set_boolean("aa", true);
-    }
-    if header.flags & 0x0200 != 0 {
-        js.set_boolean("tc", true);
-    }
-    if header.flags & 0x0100 != 0 {
-        js.set_boolean("rd", true);
-    }
-    if header.flags & 0x0080 != 0 {
-        js.set_boolean("ra", true);
+    if flags & LOG_FLAGS != 0 {
+        js.set_string("flags", format!("{:x}", header.flags).as_str());
+        if header.flags & 0x8000 != 0 {
+            js.set_boolean("qr", true);
+        }
+        if header.flags & 0x0400 != 0 {
+            js.set_boolean("aa", true);
+        }
+        if header.flags & 0x0200 != 0 {
+            js.set_boolean("tc", true);
+        }
+        if header.flags & 0x0100 != 0 {
+            js.set_boolean("rd", true);
+        }
+        if header.flags & 0x0080 != 0 {
+            js.set_boolean("ra", true);
+        }
     }
 
     for query in &response.queries {
@@ -547,7 +553,7 @@ fn dns_log_json_answer(response: &DNSResponse, flags: u64) -> Json
 
     }
 
-    if response.authorities.len() > 0 {
+    if flags & LOG_AUTHORITIES != 0 && response.authorities.len() > 0 {
         let js_auth = Json::array();
         for auth in &response.authorities {
             js_auth.array_append(dns_log_json_answer_detail(auth));
@@ -17,6 +17,7 @@
 
 //! Nom parsers for DNS.
 
+use std;
 use nom::{IResult, be_u8, be_u16, be_u32};
 use nom;
 use dns::dns::*;
@@ -136,7 +137,11 @@ pub fn dns_parse_name<'a, 'b>(start: &'b [u8],
 fn dns_parse_answer<'a>(slice: &'a [u8], message: &'a [u8], count: usize)
                         -> IResult<&'a [u8], Vec<DNSAnswerEntry>> {
 
-    let mut answers = Vec::new();
+    // Most records expand to one answer. The count comes from the
+    // header, so bound it by the smallest record size: a root name
+    // plus 10 bytes.
+    let mut answers = Vec::with_capacity(
+        std::cmp::min(count, slice.len() / 11));
     let mut input = slice;
 
     for _ in 0..count {
@@ -183,7 +188,10 @@ fn dns_parse_answer<'a>(slice: &'a [u8], message: &'a [u8], count: usize)
                             >> (rdata)
                     ))(data);
                 match result {
-                    Ok((_, rdatas)) => {
+                    Ok((_, mut rdatas)) => {
+                        // The name is moved into the last answer, so it
+                        // is only copied for the extra TXT strings.
+                        let last = rdatas.pop();
                         for rdata in rdatas {
                             answers.push(DNSAnswerEntry{
                                 name: name.clone(),
@@ -193,6 +201,15 @@ fn dns_parse_answer<'a>(slice: &'a [u8], message: &'a [u8], count: usize)
                                 data: rdata,
                             });
                         }
+                        if let Some(rdata) = last {
+                            answers.push(DNSAnswerEntry{
+                                name: name,
+                                rrtype: rrtype,
+                                rrclass: rrclass,
+                                ttl: ttl,
+                                data: rdata,
+                            });
+                        }
                     }
                     Err(e) => { return Err(e); }
                 }
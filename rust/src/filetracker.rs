@@ -26,19 +26,35 @@
  * GAP handling. If a data gap is encountered, the file is truncated
  * and new data is no longer pushed down to the lower level APIs.
  * The tracker does continue to follow the file.
+ *
+ * In order data is passed straight to the file API. Only out of order
+ * chunks are copied, into a queue sorted by offset from which they are
+ * appended once the data before them is in. Once the file is truncated
+ * or closed the queue is dropped and nothing is queued anymore.
+ *
+ * If a spill size is set, complete out of order chunks are moved to a
+ * temporary file once more than that is queued in memory, and read back
+ * when their turn comes.
  */
 
 extern crate libc;
 use log::*;
 use core::*;
-use std::collections::HashMap;
-use std::collections::hash_map::Entry::{Occupied, Vacant};
+use std;
+use std::collections::BTreeMap;
+use std::collections::btree_map::Entry::{Occupied, Vacant};
+use std::fs::{File, OpenOptions};
+use std::io::{Read, Seek, SeekFrom, Write};
+use std::sync::atomic::{AtomicUsize, Ordering};
 use filecontainer::*;
 
 #[derive(Debug)]
 pub struct FileChunk {
     contains_gap: bool,
     chunk: Vec<u8>,
+    /// offset of the data in the spill file, if moved there
+    spilled: Option<u64>,
+    len: usize,
 }
 
 impl FileChunk {
@@ -46,10 +62,50 @@ impl FileChunk {
         FileChunk {
             contains_gap: false,
             chunk: Vec::with_capacity(size as usize),
+            spilled: None,
+            len: 0,
         }
     }
 }
 
+static FILE_SPILL_ID: AtomicUsize = AtomicUsize::new(0);
+
+/// Temporary file holding the out of order chunks of a tracker. It is
+/// unlinked right away, so it goes when the tracker drops it.
+#[derive(Debug)]
+struct FileSpill {
+    file: File,
+    size: u64,
+}
+
+impl FileSpill {
+    fn new() -> std::io::Result<FileSpill> {
+        let mut path = std::env::temp_dir();
+        path.push(format!("suricata-file-ooo-{}-{}", std::process::id(),
+                FILE_SPILL_ID.fetch_add(1, Ordering::Relaxed)));
+        let file = OpenOptions::new().read(true).write(true)
+            .create_new(true).open(&path)?;
+        let _ = std::fs::remove_file(&path);
+        Ok(FileSpill { file: file, size: 0 })
+    }
+
+    /// append data, returns its offset in the file
+    fn write(&mut self, data: &[u8]) -> std::io::Result<u64> {
+        let pos = self.size;
+        self.file.seek(SeekFrom::Start(pos))?;
+        self.file.write_all(data)?;
+        self.size += data.len() as u64;
+        Ok(pos)
+    }
+
+    fn read(&mut self, pos: u64, len: usize) -> std::io::Result<Vec<u8>> {
+        let mut data = vec![0; len];
+        self.file.seek(SeekFrom::Start(pos))?;
+        self.file.read_exact(&mut data)?;
+        Ok(data)
+    }
+}
+
 #[derive(Debug)]
 pub struct FileTransferTracker {
     file_size: u64,
@@ -66,8 +122,12 @@ pub struct FileTransferTracker {
     chunk_is_ooo: bool,
     file_is_truncated: bool,
 
-    chunks: HashMap<u64, FileChunk>,
+    chunks: BTreeMap<u64, FileChunk>,
     cur_ooo_chunk_offset: u64,
+
+    /// move complete ooo chunks to disk past this much queued, 0 to never
+    ooo_spill_size: u64,
+    spill: Option<FileSpill>,
 }
 
 impl FileTransferTracker {
@@ -85,10 +145,18 @@ impl FileTransferTracker {
             chunk_is_ooo:false,
             file_is_truncated:false,
             cur_ooo_chunk_offset:0,
-            chunks:HashMap::new(),
+            chunks:BTreeMap::new(),
+            ooo_spill_size:0,
+            spill:None,
         }
     }
 
+    /// Set how much out of order data may be queued in memory before
+    /// complete chunks are moved to a temporary file. 0 disables this.
+    pub fn set_ooo_spill_size(&mut self, size: u64) {
+        self.ooo_spill_size = size;
+    }
+
     pub fn is_done(&self) -> bool {
         self.file_open == false
     }
@@ -111,10 +179,13 @@ impl FileTransferTracker {
         }
         self.file_open = false;
         self.tracked = 0;
+        self.drop_queued();
         files.files_prune();
     }
 
     pub fn trunc (&mut self, files: &mut FileContainer, flags: u16) {
+        // the queued chunks can no longer be appended
+        self.drop_queued();
         if self.file_is_truncated || !self.file_open {
             return;
         }
@@ -125,6 +196,88 @@ impl FileTransferTracker {
         self.file_is_truncated = true;
     }
 
+    fn drop_queued(&mut self) {
+        self.chunks.clear();
+        self.cur_ooo = 0;
+        self.spill = None;
+    }
+
+    /// move a complete ooo chunk to the spill file, if too much is
+    /// queued in memory. On error the chunk stays where it is.
+    fn spill_chunk(&mut self, offset: u64) {
+        if self.ooo_spill_size == 0 || self.cur_ooo <= self.ooo_spill_size {
+            return;
+        }
+        if self.spill.is_none() {
+            match FileSpill::new() {
+                Ok(spill) => { self.spill = Some(spill); },
+                Err(e) => {
+                    SCLogDebug!("could not create spill file: {}", e);
+                    return;
+                }
+            }
+        }
+        let c = match self.chunks.get_mut(&offset) {
+            Some(c) => c,
+            None => { return; },
+        };
+        if let Some(ref mut spill) = self.spill {
+            match spill.write(&c.chunk) {
+                Ok(pos) => {
+                    SCLogDebug!("spilled ooo chunk at offset {} len {}", offset, c.len);
+                    self.cur_ooo -= c.len as u64;
+                    c.spilled = Some(pos);
+                    c.chunk = Vec::new();
+                }
+                Err(e) => {
+                    SCLogDebug!("could not spill ooo chunk: {}", e);
+                }
+            }
+        }
+    }
+
+    /// get the data of a queued chunk, reading it back if it was spilled
+    fn chunk_data(&mut self, c: FileChunk) -> Option<Vec<u8>> {
+        match c.spilled {
+            None => Some(c.chunk),
+            Some(pos) => {
+                match self.spill {
+                    Some(ref mut spill) => spill.read(pos, c.len).ok(),
+                    None => None,
+                }
+            }
+        }
+    }
+
+    /// pass in order data to the file API, truncating the file on error
+    fn append(&mut self, files: &mut FileContainer, data: &[u8], is_gap: bool) {
+        if self.file_is_truncated {
+            return;
+        }
+        let res = files.file_append(&self.track_id, data, is_gap);
+        if res != 0 {
+            SCLogDebug!("got error {} so truncing file", res);
+            self.file_is_truncated = true;
+        }
+    }
+
+    /// queue out of order data of the current chunk. The chunk is
+    /// allocated at the size of what is left of it, so it is never grown.
+    fn queue(&mut self, data: &[u8], is_gap: bool) {
+        if self.file_is_truncated {
+            return;
+        }
+        self.cur_ooo += data.len() as u64;
+        let chunk_left = self.chunk_left;
+        let c = match self.chunks.entry(self.cur_ooo_chunk_offset) {
+            Vacant(entry) => entry.insert(FileChunk::new(chunk_left)),
+            Occupied(entry) => entry.into_mut(),
+        };
+        c.contains_gap |= is_gap;
+        c.chunk.extend(data);
+        c.len += data.len();
+    }
+
     pub fn create(&mut self, name: &[u8], file_size: u64) {
         if self.file_open == true { panic!("close existing file first"); }
 
@@ -209,31 +362,15 @@ impl FileTransferTracker {
                 let d = &data[0..self.chunk_left as usize];
 
                 if self.chunk_is_ooo == false {
-                    let res = files.file_append(&self.track_id, d, is_gap);
-                    match res {
-                        0   => { },
-                        -2  => {
-                            self.file_is_truncated = true;
-                        },
-                        _ => {
-                            SCLogDebug!("got error so truncing file");
-                            self.file_is_truncated = true;
-                        },
-                    }
-
+                    self.append(files, d, is_gap);
                     self.tracked += self.chunk_left as u64;
                 } else {
                     SCLogDebug!("UPDATE: appending data {} to ooo chunk at offset {}/{}",
                             d.len(), self.cur_ooo_chunk_offset, self.tracked);
-                    let c = match self.chunks.entry(self.cur_ooo_chunk_offset) {
-                        Vacant(entry) => {
-                            entry.insert(FileChunk::new(self.chunk_left))
-                        },
-                        Occupied(entry) => entry.into_mut(),
-                    };
-                    self.cur_ooo += d.len() as u64;
-                    c.contains_gap |= is_gap;
-                    c.chunk.extend(d);
+                    self.queue(d, is_gap);
+                    // the chunk is complete
+                    let offset = self.cur_ooo_chunk_offset;
+                    self.spill_chunk(offset);
                 }
 
                 consumed += self.chunk_left as usize;
@@ -253,32 +390,26 @@ impl FileTransferTracker {
                     self.chunk_left = 0;
 
                     if self.chunk_is_ooo == false {
-                        loop {
+                        // the queue is sorted, so only its head can follow
+                        while let Some(c) = self.chunks.remove(&self.tracked) {
                             let offset = self.tracked;
-                            match self.chunks.remove(&self.tracked) {
-                                Some(c) => {
-                                    let res = files.file_append(&self.track_id, &c.chunk, c.contains_gap);
-                                    match res {
-                                        0   => { },
-                                        -2  => {
-                                            self.file_is_truncated = true;
-                                        },
-                                        _ => {
-                                            SCLogDebug!("got error so truncing file");
-                                            self.file_is_truncated = true;
-                                        },
-                                    }
-
-                                    self.tracked += c.chunk.len() as u64;
-                                    self.cur_ooo -= c.chunk.len() as u64;
-
-                                    SCLogDebug!("STORED OOO CHUNK at offset {}, tracked now {}, stored len {}", offset, self.tracked, c.chunk.len());
-                                },
-                                _ => {
-                                    SCLogDebug!("NO STORED CHUNK found at offset {}", self.tracked);
+                            let len = c.len;
+                            let contains_gap = c.contains_gap;
+                            if c.spilled.is_none() {
+                                self.cur_ooo -= len as u64;
+                            }
+                            let chunk = match self.chunk_data(c) {
+                                Some(chunk) => chunk,
+                                None => {
+                                    SCLogDebug!("could not read back spilled chunk at offset {}", offset);
+                                    self.trunc(files, flags);
                                     break;
-                                },
+                                }
                             };
+                            self.append(files, &chunk, contains_gap);
+                            self.tracked += len as u64;
+
+                            SCLogDebug!("STORED OOO CHUNK at offset {}, tracked now {}, stored len {}", offset, self.tracked, len);
                         }
                     } else {
                         SCLogDebug!("UPDATE: complete ooo chunk. Offset {}", self.cur_ooo_chunk_offset);
@@ -297,26 +428,10 @@ impl FileTransferTracker {
 
             } else {
                 if self.chunk_is_ooo == false {
-                    let res = files.file_append(&self.track_id, data, is_gap);
-                    match res {
-                        0   => { },
-                        -2  => {
-                            self.file_is_truncated = true;
-                        },
-                        _ => {
-                            SCLogDebug!("got error so truncing file");
-                            self.file_is_truncated = true;
-                        },
-                    }
+                    self.append(files, data, is_gap);
                     self.tracked += data.len() as u64;
                 } else {
-                    let c = match self.chunks.entry(self.cur_ooo_chunk_offset) {
-                        Vacant(entry) => entry.insert(FileChunk::new(32768)),
-                        Occupied(entry) => entry.into_mut(),
-                    };
-                    c.chunk.extend(data);
-                    c.contains_gap |= is_gap;
-                    self.cur_ooo += data.len() as u64;
+                    self.queue(data, is_gap);
                 }
 
                 self.chunk_left -= data.len() as u32;
@@ -327,7 +442,45 @@ impl FileTransferTracker {
         consumed as u32
     }
 
+    /// out of order data queued in memory, spilled chunks not included
     pub fn get_queued_size(&self) -> u64 {
         self.cur_ooo
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_file_spill() {
+        let mut spill = FileSpill::new().unwrap();
+        assert_eq!(spill.write(b"abcd").unwrap(), 0);
+        assert_eq!(spill.write(b"efgh").unwrap(), 4);
+        assert_eq!(spill.read(4, 4).unwrap(), b"efgh");
+        assert_eq!(spill.read(0, 4).unwrap(), b"abcd");
+        assert!(spill.read(6, 4).is_err());
+    }
+
+    #[test]
+    fn test_queue_ooo() {
+        let mut ft = FileTransferTracker::new();
+        ft.chunk_left = 8;
+        ft.cur_ooo_chunk_offset = 100;
+        ft.queue(b"abcd", false);
+        ft.queue(b"efgh", true);
+        ft.cur_ooo_chunk_offset = 50;
+        ft.chunk_left = 2;
+        ft.queue(b"ij", false);
+        assert_eq!(ft.get_queued_size(), 10);
+        // sorted by offset, so the lowest is released first
+        assert_eq!(*ft.chunks.keys().next().unwrap(), 50);
+        let c = ft.chunks.remove(&100).unwrap();
+        assert_eq!(c.chunk, b"abcdefgh");
+        assert!(c.contains_gap);
+        // truncating a file that isn't open only drops the queue
+        ft.trunc(&mut FileContainer::default(), 0);
+        assert_eq!(ft.get_queued_size(), 0);
+        assert!(ft.chunks.is_empty());
+    }
+}
@@ -0,0 +1,435 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+// HPACK header decompression, RFC 7541.
+
+use std::collections::VecDeque;
+use http2::huffman::huffman_decode;
+
+/// Default SETTINGS_HEADER_TABLE_SIZE.
+pub const HPACK_DEFAULT_TABLE_SIZE: usize = 4096;
+
+/// Overhead per dynamic table entry that counts against the table size.
+const HPACK_ENTRY_OVERHEAD: usize = 32;
+
+static HPACK_STATIC_TABLE: [(&'static [u8], &'static [u8]); 61] = [
+    (b":authority", b""),
+    (b":method", b"GET"),
+    (b":method", b"POST"),
+    (b":path", b"/"),
+    (b":path", b"/index.html"),
+    (b":scheme", b"http"),
+    (b":scheme", b"https"),
+    (b":status", b"200"),
+    (b":status", b"204"),
+    (b":status", b"206"),
+    (b":status", b"304"),
+    (b":status", b"400"),
+    (b":status", b"404"),
+    (b":status", b"500"),
+    (b"accept-charset", b""),
+    (b"accept-encoding", b"gzip, deflate"),
+    (b"accept-language", b""),
+    (b"accept-ranges", b""),
+    (b"accept", b""),
+    (b"access-control-allow-origin", b""),
+    (b"age", b""),
+    (b"allow", b""),
+    (b"authorization", b""),
+    (b"cache-control", b""),
+    (b"content-disposition", b""),
+    (b"content-encoding", b""),
+    (b"content-language", b""),
+    (b"content-length", b""),
+    (b"content-location", b""),
+    (b"content-range", b""),
+    (b"content-type", b""),
+    (b"cookie", b""),
+    (b"date", b""),
+    (b"etag", b""),
+    (b"expect", b""),
+    (b"expires", b""),
+    (b"from", b""),
+    (b"host", b""),
+    (b"if-match", b""),
+    (b"if-modified-since", b""),
+    (b"if-none-match", b""),
+    (b"if-range", b""),
+    (b"if-unmodified-since", b""),
+    (b"last-modified", b""),
+    (b"link", b""),
+    (b"location", b""),
+    (b"max-forwards", b""),
+    (b"proxy-authenticate", b""),
+    (b"proxy-authorization", b""),
+    (b"range", b""),
+    (b"referer", b""),
+    (b"refresh", b""),
+    (b"retry-after", b""),
+    (b"server", b""),
+    (b"set-cookie", b""),
+    (b"strict-transport-security", b""),
+    (b"transfer-encoding", b""),
+    (b"user-agent", b""),
+    (b"vary", b""),
+    (b"via", b""),
+    (b"www-authenticate", b""),
+];
+
+#[derive(Debug,PartialEq)]
+pub enum HPACKError {
+    /// The block ends in the middle of a representation.
+    Truncated,
+    /// Integer that does not fit in 32 bits.
+    IntegerOverflow,
+    /// Index 0, or past the end of the tables. Also the result of
+    /// entries the memcap made us evict early.
+    InvalidIndex,
+    /// Invalid Huffman encoded string.
+    InvalidHuffman,
+    /// Dynamic table size update over the size allowed by the settings.
+    InvalidTableSize,
+}
+
+/// The decoded header list of a header block.
+///
+/// All names and values live in one buffer, the fields only point into
+/// it. This saves an allocation per header, and nothing but slices are
+/// handed out until a consumer asks for a specific header.
+pub struct HPACKHeaders {
+    data: Vec<u8>,
+    fields: Vec<(u32, u32, u32)>, // offset, name length, value length
+}
+
+impl HPACKHeaders {
+    pub fn new() -> HPACKHeaders {
+        HPACKHeaders {
+            data: Vec::new(),
+            fields: Vec::new(),
+        }
+    }
+
+    fn push(&mut self, name: &[u8], value: &[u8]) {
+        let offset = self.data.len() as u32;
+        self.data.extend_from_slice(name);
+        self.data.extend_from_slice(value);
+        self.fields.push((offset, name.len() as u32, value.len() as u32));
+    }
+
+    pub fn len(&self) -> usize {
+        self.fields.len()
+    }
+
+    /// Get the name and value of the header at position `idx`.
+    pub fn get(&self, idx: usize) -> Option<(&[u8], &[u8])> {
+        match self.fields.get(idx) {
+            Some(&(offset, nlen, vlen)) => {
+                let n = offset as usize;
+                let v = n + nlen as usize;
+                Some((&self.data[n..v], &self.data[v..v + vlen as usize]))
+            }
+            None => None,
+        }
+    }
+
+    /// Get the value of the first header called `name`. Header names
+    /// are lowercase in HTTP/2, so this is a plain compare.
+    pub fn get_value(&self, name: &[u8]) -> Option<&[u8]> {
+        for i in 0..self.fields.len() {
+            if let Some((n, v)) = self.get(i) {
+                if n == name {
+                    return Some(v);
+                }
+            }
+        }
+        None
+    }
+}
+
+struct HPACKEntry {
+    data: Vec<u8>,
+    name_len: usize,
+}
+
+impl HPACKEntry {
+    fn size(&self) -> usize {
+        self.data.len() + HPACK_ENTRY_OVERHEAD
+    }
+}
+
+/// The decoder of one direction of a connection, so it holds the
+/// dynamic table the encoder of the peer builds.
+pub struct HPACKDecoder {
+    table: VecDeque<HPACKEntry>,
+    /// bytes in the table, counted as the RFC does
+    size: usize,
+    /// the table size the encoder last set
+    max_size: usize,
+    /// the limit the encoder has to respect, from our SETTINGS
+    settings_max_size: usize,
+    /// what we are willing to keep. The table is evicted at this size,
+    /// even if the encoder may use more, making references to the
+    /// entries that are gone fail.
+    memcap: usize,
+}
+
+impl HPACKDecoder {
+    pub fn new(memcap: usize) -> HPACKDecoder {
+        HPACKDecoder {
+            table: VecDeque::new(),
+            size: 0,
+            max_size: HPACK_DEFAULT_TABLE_SIZE,
+            settings_max_size: HPACK_DEFAULT_TABLE_SIZE,
+            memcap: memcap,
+        }
+    }
+
+    /// SETTINGS_HEADER_TABLE_SIZE of the side that decodes.
+    pub fn set_settings_max_size(&mut self, size: usize) {
+        self.settings_max_size = size;
+        if self.max_size > size {
+            self.max_size = size;
+            self.evict(0);
+        }
+    }
+
+    fn limit(&self) -> usize {
+        if self.max_size < self.memcap {
+            self.max_size
+        } else {
+            self.memcap
+        }
+    }
+
+    /// Evict entries until `needed` more bytes fit.
+    fn evict(&mut self, needed: usize) {
+        let limit = self.limit();
+        while self.size + needed > limit {
+            match self.table.pop_back() {
+                Some(e) => {
+                    self.size -= e.size();
+                }
+                None => {
+                    break;
+                }
+            }
+        }
+    }
+
+    fn insert(&mut self, name: &[u8], value: &[u8]) {
+        let size = name.len() + value.len() + HPACK_ENTRY_OVERHEAD;
+        self.evict(size);
+        // an entry larger than the table empties it (RFC 7541 4.4)
+        if size > self.limit() {
+            return;
+        }
+        let mut data = Vec::with_capacity(name.len() + value.len());
+        data.extend_from_slice(name);
+        data.extend_from_slice(value);
+        self.table.push_front(HPACKEntry {
+            data: data,
+            name_len: name.len(),
+        });
+        self.size += size;
+    }
+
+    fn lookup(&self, index: usize) -> Result<(&[u8], &[u8]), HPACKError> {
+        if index == 0 {
+            return Err(HPACKError::InvalidIndex);
+        }
+        if index <= HPACK_STATIC_TABLE.len() {
+            let (n, v) = HPACK_STATIC_TABLE[index - 1];
+            return Ok((n, v));
+        }
+        match self.table.get(index - HPACK_STATIC_TABLE.len() - 1) {
+            Some(e) => {
+                Ok((&e.data[..e.name_len], &e.data[e.name_len..]))
+            }
+            None => Err(HPACKError::InvalidIndex),
+        }
+    }
+
+    /// Decode a complete header block, appending the header list to
+    /// `headers`. The dynamic table is updated as the block says, so
+    /// the blocks of a direction have to be decoded in order, even if
+    /// the headers are of no interest.
+    pub fn decode(&mut self, input: &[u8], headers: &mut HPACKHeaders)
+                  -> Result<(), HPACKError>
+    {
+        let mut i = input;
+        // scratch buffers for the literals, reused over the block
+        let mut name = Vec::new();
+        let mut value = Vec::new();
+
+        while i.len() > 0 {
+            let b = i[0];
+            if b & 0x80 != 0 {
+                // indexed header field
+                let (rem, index) = decode_int(i, 7)?;
+                i = rem;
+                let (n, v) = self.lookup(index as usize)?;
+                headers.push(n, v);
+            } else if b & 0xe0 == 0x20 {
+                // dynamic table size update
+                let (rem, size) = decode_int(i, 5)?;
+                i = rem;
+                if size as usize > self.settings_max_size {
+                    return Err(HPACKError::InvalidTableSize);
+                }
+                self.max_size = size as usize;
+                self.evict(0);
+            } else {
+                // literal header field, with incremental indexing (6 bit
+                // index), without indexing or never indexed (4 bits)
+                let indexing = b & 0xc0 == 0x40;
+                let prefix = if indexing { 6 } else { 4 };
+                let (rem, index) = decode_int(i, prefix)?;
+                i = rem;
+                name.clear();
+                if index == 0 {
+                    i = decode_string(i, &mut name)?;
+                } else {
+                    let (n, _) = self.lookup(index as usize)?;
+                    name.extend_from_slice(n);
+                }
+                value.clear();
+                i = decode_string(i, &mut value)?;
+                headers.push(&name, &value);
+                if indexing {
+                    self.insert(&name, &value);
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Decode an integer with a `prefix` bit prefix (RFC 7541 5.1).
+fn decode_int(input: &[u8], prefix: u8) -> Result<(&[u8], u32), HPACKError> {
+    if input.len() == 0 {
+        return Err(HPACKError::Truncated);
+    }
+    let max = ((1u16 << prefix) - 1) as u32;
+    let mut value = input[0] as u32 & max;
+    if value < max {
+        return Ok((&input[1..], value));
+    }
+    let mut shift = 0;
+    for i in 1..input.len() {
+        let b = input[i];
+        // 4 continuation bytes hold 28 bits, enough for any sane
+        // length or index
+        if shift > 21 {
+            return Err(HPACKError::IntegerOverflow);
+        }
+        value += ((b & 0x7f) as u32) << shift;
+        shift += 7;
+        if b & 0x80 == 0 {
+            return Ok((&input[i + 1..], value));
+        }
+    }
+    Err(HPACKError::Truncated)
+}
+
+/// Decode a string literal (RFC 7541 5.2) into `out`.
+fn decode_string<'a>(input: &'a [u8], out: &mut Vec<u8>)
+                     -> Result<&'a [u8], HPACKError>
+{
+    if input.len() == 0 {
+        return Err(HPACKError::Truncated);
+    }
+    let huffman = input[0] & 0x80 != 0;
+    let (rem, len) = decode_int(input, 7)?;
+    let len = len as usize;
+    if rem.len() < len {
+        return Err(HPACKError::Truncated);
+    }
+    if huffman {
+        if !huffman_decode(&rem[..len], out) {
+            return Err(HPACKError::InvalidHuffman);
+        }
+    } else {
+        out.extend_from_slice(&rem[..len]);
+    }
+    Ok(&rem[len..])
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_decode_int() {
+        // RFC 7541 C.1
+        assert_eq!(decode_int(&[0x0a], 5), Ok((&[][..], 10)));
+        assert_eq!(decode_int(&[0x1f, 0x9a, 0x0a], 5), Ok((&[][..], 1337)));
+        assert_eq!(decode_int(&[0x2a], 8), Ok((&[][..], 42)));
+        assert_eq!(decode_int(&[0x1f, 0x9a], 5), Err(HPACKError::Truncated));
+        assert_eq!(decode_int(&[0x1f, 0xff, 0xff, 0xff, 0xff, 0x0f], 5),
+                   Err(HPACKError::IntegerOverflow));
+    }
+
+    #[test]
+    fn test_decode_requests() {
+        let mut dec = HPACKDecoder::new(HPACK_DEFAULT_TABLE_SIZE);
+
+        // RFC 7541 C.4.1
+        let buf = [0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5,
+                   0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff];
+        let mut headers = HPACKHeaders::new();
+        assert_eq!(dec.decode(&buf, &mut headers), Ok(()));
+        assert_eq!(headers.len(), 4);
+        assert_eq!(headers.get(0), Some((&b":method"[..], &b"GET"[..])));
+        assert_eq!(headers.get_value(b":authority"), Some(&b"www.example.com"[..]));
+        assert_eq!(dec.size, 57);
+
+        // RFC 7541 C.4.2, uses the dynamic table entry of the first
+        let buf = [0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10,
+                   0x64, 0x9c, 0xbf];
+        let mut headers = HPACKHeaders::new();
+        assert_eq!(dec.decode(&buf, &mut headers), Ok(()));
+        assert_eq!(headers.len(), 5);
+        assert_eq!(headers.get_value(b":authority"), Some(&b"www.example.com"[..]));
+        assert_eq!(headers.get_value(b"cache-control"), Some(&b"no-cache"[..]));
+        assert_eq!(dec.size, 110);
+    }
+
+    #[test]
+    fn test_decode_memcap() {
+        // no room for www.example.com, so the second request cannot
+        // find its :authority
+        let mut dec = HPACKDecoder::new(32);
+        let buf = [0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5,
+                   0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff];
+        let mut headers = HPACKHeaders::new();
+        assert_eq!(dec.decode(&buf, &mut headers), Ok(()));
+        assert_eq!(dec.size, 0);
+        let buf = [0x82, 0x86, 0x84, 0xbe];
+        let mut headers = HPACKHeaders::new();
+        assert_eq!(dec.decode(&buf, &mut headers), Err(HPACKError::InvalidIndex));
+    }
+
+    #[test]
+    fn test_decode_table_size_update() {
+        let mut dec = HPACKDecoder::new(HPACK_DEFAULT_TABLE_SIZE);
+        let mut headers = HPACKHeaders::new();
+        // size 0 clears the table, then 4097 is over the settings
+        assert_eq!(dec.decode(&[0x20], &mut headers), Ok(()));
+        assert_eq!(dec.decode(&[0x3f, 0xe2, 0x1f], &mut headers),
+                   Err(HPACKError::InvalidTableSize));
+    }
+}
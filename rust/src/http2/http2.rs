@@ -0,0 +1,919 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+use std;
+use std::cmp::min;
+use std::ffi::{CStr,CString};
+use std::mem::transmute;
+use core::{self, ALPROTO_UNKNOWN, AppProto, Flow, IPPROTO_TCP};
+use libc;
+use log::*;
+use applayer;
+use parser::*;
+use http2::hpack::*;
+use http2::parser::*;
+
+static mut ALPROTO_HTTP2: AppProto = ALPROTO_UNKNOWN;
+
+/// Bytes the dynamic table of a decoder may use, see
+/// rs_http2_set_hpack_memcap.
+static mut HTTP2_HPACK_MEMCAP: usize = 65536;
+
+/// Largest header block, over all its CONTINUATION frames, and largest
+/// frame of the other types of which we need the payload.
+const HTTP2_MAX_HEADER_BLOCK: usize = 256 * 1024;
+
+/// Transaction progress, per direction. Keep in sync with
+/// app-layer-http2.h.
+pub const HTTP2_STATE_IDLE: u8 = 0;
+pub const HTTP2_STATE_HEADERS: u8 = 1;
+pub const HTTP2_STATE_CLOSED: u8 = 2;
+
+#[repr(u32)]
+pub enum HTTP2Event {
+    InvalidFrameLength = 0,
+    InvalidFrame,
+    InvalidContinuation,
+    HeaderBlockTooLong,
+    CompressionError,
+}
+
+/// A transaction is a stream, so a request and its response.
+pub struct HTTP2Transaction {
+    tx_id: u64,
+    pub stream_id: u32,
+
+    pub request: HPACKHeaders,
+    pub response: HPACKHeaders,
+    pub request_state: u8,
+    pub response_state: u8,
+
+    /// lowercase :authority, made when detection asks for it
+    host: Option<Vec<u8>>,
+
+    logged: applayer::LoggerFlags,
+    de_state: Option<*mut core::DetectEngineState>,
+    events: *mut core::AppLayerDecoderEvents,
+}
+
+impl HTTP2Transaction {
+    pub fn new(stream_id: u32) -> HTTP2Transaction {
+        HTTP2Transaction {
+            tx_id: 0,
+            stream_id: stream_id,
+            request: HPACKHeaders::new(),
+            response: HPACKHeaders::new(),
+            request_state: HTTP2_STATE_IDLE,
+            response_state: HTTP2_STATE_IDLE,
+            host: None,
+            logged: applayer::LoggerFlags::new(),
+            de_state: None,
+            events: std::ptr::null_mut(),
+        }
+    }
+
+    pub fn free(&mut self) {
+        if self.events != std::ptr::null_mut() {
+            core::sc_app_layer_decoder_events_free_events(&mut self.events);
+        }
+        if let Some(state) = self.de_state {
+            core::sc_detect_engine_state_free(state);
+        }
+    }
+
+    fn set_event(&mut self, event: HTTP2Event) {
+        core::sc_app_layer_decoder_events_set_event_raw(&mut self.events,
+                                                        event as u8);
+    }
+
+    /// The host the request is for, lowercased as http_host expects.
+    fn get_host(&mut self) -> Option<&[u8]> {
+        if self.host.is_none() {
+            let value = match self.request.get_value(b":authority") {
+                Some(v) => Some(v),
+                None => self.request.get_value(b"host"),
+            };
+            if let Some(v) = value {
+                self.host = Some(v.to_ascii_lowercase());
+            }
+        }
+        match self.host {
+            Some(ref h) => Some(h),
+            None => None,
+        }
+    }
+}
+
+impl Drop for HTTP2Transaction {
+    fn drop(&mut self) {
+        self.free();
+    }
+}
+
+/// Parsing state of one direction of the connection.
+struct HTTP2Direction {
+    /// frame we do not have all of yet
+    buffer: Vec<u8>,
+    /// payload bytes still to skip of a frame we do not need
+    skip: u32,
+    decoder: HPACKDecoder,
+    /// set when a header block could not be decoded. The dynamic table
+    /// is out of sync from then on, the later blocks are not decoded.
+    decoder_failed: bool,
+
+    /// header block assembled over CONTINUATION frames, for
+    /// block_stream, 0 if none
+    block: Vec<u8>,
+    block_stream: u32,
+    block_end_stream: bool,
+    /// the stream a PUSH_PROMISE block is the request of, or 0
+    block_promised: u32,
+}
+
+impl HTTP2Direction {
+    fn new() -> HTTP2Direction {
+        HTTP2Direction {
+            buffer: Vec::new(),
+            skip: 0,
+            decoder: HPACKDecoder::new(unsafe { HTTP2_HPACK_MEMCAP }),
+            decoder_failed: false,
+            block: Vec::new(),
+            block_stream: 0,
+            block_end_stream: false,
+            block_promised: 0,
+        }
+    }
+}
+
+pub struct HTTP2State {
+    tx_id: u64,
+    transactions: Vec<HTTP2Transaction>,
+    preface_done: bool,
+    /// 0 for the data of the client, 1 for the server
+    dirs: [HTTP2Direction; 2],
+}
+
+impl HTTP2State {
+    pub fn new() -> HTTP2State {
+        HTTP2State {
+            tx_id: 0,
+            transactions: Vec::new(),
+            preface_done: false,
+            dirs: [HTTP2Direction::new(), HTTP2Direction::new()],
+        }
+    }
+
+    pub fn get_tx(&mut self, tx_id: u64) -> Option<&mut HTTP2Transaction> {
+        for tx in &mut self.transactions {
+            if tx.tx_id == tx_id + 1 {
+                return Some(tx);
+            }
+        }
+        return None;
+    }
+
+    fn free_tx(&mut self, tx_id: u64) {
+        let len = self.transactions.len();
+        let mut found = false;
+        let mut index = 0;
+        for i in 0..len {
+            let tx = &self.transactions[i];
+            if tx.tx_id == tx_id + 1 {
+                found = true;
+                index = i;
+                break;
+            }
+        }
+        if found {
+            self.transactions.remove(index);
+        }
+    }
+
+    /// Index of the transaction of stream `stream_id`, created if
+    /// `create` is set and there is none.
+    fn find_stream(&mut self, stream_id: u32, create: bool) -> Option<usize> {
+        // the stream is most likely one of the recent ones
+        for i in (0..self.transactions.len()).rev() {
+            if self.transactions[i].stream_id == stream_id {
+                return Some(i);
+            }
+        }
+        if !create || stream_id == 0 {
+            return None;
+        }
+        let mut tx = HTTP2Transaction::new(stream_id);
+        self.tx_id += 1;
+        tx.tx_id = self.tx_id;
+        self.transactions.push(tx);
+        Some(self.transactions.len() - 1)
+    }
+
+    /// Set an event on the transaction of the stream, or on the last one
+    /// for frames of the connection.
+    fn set_event(&mut self, stream_id: u32, event: HTTP2Event) {
+        let idx = match self.find_stream(stream_id, false) {
+            Some(idx) => idx,
+            None => {
+                if self.transactions.len() == 0 {
+                    return;
+                }
+                self.transactions.len() - 1
+            }
+        };
+        self.transactions[idx].set_event(event);
+    }
+
+    fn close_stream(&mut self, dir: usize, stream_id: u32) {
+        if let Some(idx) = self.find_stream(stream_id, false) {
+            let tx = &mut self.transactions[idx];
+            if dir == 0 {
+                tx.request_state = HTTP2_STATE_CLOSED;
+            } else {
+                tx.response_state = HTTP2_STATE_CLOSED;
+            }
+        }
+    }
+
+    /// Decode the header block assembled in the direction into the
+    /// transaction of its stream.
+    fn handle_header_block(&mut self, dir: usize) {
+        let stream_id;
+        let promised;
+        let end_stream;
+        {
+            let d = &mut self.dirs[dir];
+            stream_id = d.block_stream;
+            promised = d.block_promised;
+            end_stream = d.block_end_stream;
+            d.block_stream = 0;
+        }
+
+        // a PUSH_PROMISE is the request of the promised stream
+        let (target, request) = if promised != 0 {
+            (promised, true)
+        } else {
+            (stream_id, dir == 0)
+        };
+        let idx = match self.find_stream(target, true) {
+            Some(idx) => idx,
+            None => {
+                return;
+            }
+        };
+
+        let mut failed = false;
+        {
+            let d = &mut self.dirs[dir];
+            let tx = &mut self.transactions[idx];
+            if !d.decoder_failed {
+                let headers = if request {
+                    &mut tx.request
+                } else {
+                    &mut tx.response
+                };
+                if let Err(_e) = d.decoder.decode(&d.block, headers) {
+                    SCLogDebug!("stream {}: hpack error {:?}", target, _e);
+                    d.decoder_failed = true;
+                    failed = true;
+                }
+            }
+            d.block.clear();
+
+            let state = if request {
+                &mut tx.request_state
+            } else {
+                &mut tx.response_state
+            };
+            // a second block on the stream are the trailers, they were
+            // added to the headers
+            if *state == HTTP2_STATE_IDLE {
+                *state = HTTP2_STATE_HEADERS;
+            }
+            if end_stream || promised != 0 {
+                *state = HTTP2_STATE_CLOSED;
+            }
+        }
+        if failed {
+            self.transactions[idx].set_event(HTTP2Event::CompressionError);
+        }
+    }
+
+    fn handle_settings(&mut self, dir: usize, payload: &[u8]) {
+        for s in http2_parse_settings(payload) {
+            // limits the encoder of the peer, so the decoder of
+            // the other direction
+            if s.id == HTTP2_SETTINGS_HEADER_TABLE_SIZE {
+                self.dirs[dir ^ 1].decoder.set_settings_max_size(
+                    s.value as usize);
+            }
+        }
+    }
+
+    fn handle_frame(&mut self, dir: usize, hdr: &HTTP2FrameHeader, payload: &[u8]) {
+        match hdr.ftype {
+            HTTP2_FRAME_HEADERS | HTTP2_FRAME_PUSHPROMISE => {
+                match http2_header_block(hdr.ftype, hdr.flags, payload) {
+                    Some((block, promised)) => {
+                        {
+                            let d = &mut self.dirs[dir];
+                            d.block.clear();
+                            d.block.extend_from_slice(block);
+                            d.block_stream = hdr.stream_id;
+                            d.block_promised = promised;
+                            d.block_end_stream = hdr.ftype == HTTP2_FRAME_HEADERS &&
+                                hdr.flags & HTTP2_FLAG_END_STREAM != 0;
+                        }
+                        if hdr.flags & HTTP2_FLAG_END_HEADERS != 0 {
+                            self.handle_header_block(dir);
+                        }
+                    }
+                    None => {
+                        // the block is lost, and with it the table sync
+                        self.dirs[dir].decoder_failed = true;
+                        self.set_event(hdr.stream_id, HTTP2Event::InvalidFrame);
+                    }
+                }
+            }
+            HTTP2_FRAME_CONTINUATION => {
+                let too_long;
+                {
+                    let d = &mut self.dirs[dir];
+                    d.block.extend_from_slice(payload);
+                    too_long = d.block.len() > HTTP2_MAX_HEADER_BLOCK;
+                    if too_long {
+                        d.block.clear();
+                        d.block_stream = 0;
+                        d.decoder_failed = true;
+                    }
+                }
+                if too_long {
+                    self.set_event(hdr.stream_id, HTTP2Event::HeaderBlockTooLong);
+                } else if hdr.flags & HTTP2_FLAG_END_HEADERS != 0 {
+                    self.handle_header_block(dir);
+                }
+            }
+            HTTP2_FRAME_SETTINGS => {
+                if hdr.flags & HTTP2_FLAG_SETTINGS_ACK == 0 {
+                    self.handle_settings(dir, payload);
+                }
+            }
+            HTTP2_FRAME_RSTSTREAM => {
+                self.close_stream(0, hdr.stream_id);
+                self.close_stream(1, hdr.stream_id);
+            }
+            _ => {}
+        }
+    }
+
+    /// Does the frame with this header need its payload?
+    fn frame_needs_payload(&self, dir: usize, hdr: &HTTP2FrameHeader) -> bool {
+        match hdr.ftype {
+            HTTP2_FRAME_HEADERS | HTTP2_FRAME_PUSHPROMISE |
+            HTTP2_FRAME_SETTINGS => true,
+            // without a block we lost sync anyway
+            HTTP2_FRAME_CONTINUATION => self.dirs[dir].block_stream != 0,
+            _ => false,
+        }
+    }
+
+    fn parse(&mut self, input: &[u8], dir: usize) -> bool {
+        let mut tmp: Vec<u8>;
+        let mut cur = if self.dirs[dir].buffer.len() > 0 {
+            tmp = std::mem::replace(&mut self.dirs[dir].buffer, Vec::new());
+            tmp.extend_from_slice(input);
+            tmp.as_slice()
+        } else {
+            input
+        };
+
+        while cur.len() > 0 {
+            // rest of a frame we are not interested in
+            if self.dirs[dir].skip > 0 {
+                let n = min(self.dirs[dir].skip as usize, cur.len());
+                cur = &cur[n..];
+                self.dirs[dir].skip -= n as u32;
+                continue;
+            }
+
+            if dir == 0 && !self.preface_done {
+                if cur.len() < HTTP2_PREFACE.len() {
+                    if !HTTP2_PREFACE.starts_with(cur) {
+                        return false;
+                    }
+                    break;
+                }
+                if !cur.starts_with(HTTP2_PREFACE) {
+                    return false;
+                }
+                cur = &cur[HTTP2_PREFACE.len()..];
+                self.preface_done = true;
+                continue;
+            }
+
+            let (rem, hdr) = match http2_parse_frame_header(cur) {
+                Some((rem, hdr)) => (rem, hdr),
+                None => {
+                    break;
+                }
+            };
+
+            // a header block has to be continued right away
+            if self.dirs[dir].block_stream != 0 &&
+                (hdr.ftype != HTTP2_FRAME_CONTINUATION ||
+                 hdr.stream_id != self.dirs[dir].block_stream)
+            {
+                {
+                    let d = &mut self.dirs[dir];
+                    d.block.clear();
+                    d.block_stream = 0;
+                    d.decoder_failed = true;
+                }
+                self.set_event(hdr.stream_id, HTTP2Event::InvalidContinuation);
+            }
+
+            if hdr.ftype == HTTP2_FRAME_DATA &&
+                hdr.flags & HTTP2_FLAG_END_STREAM != 0
+            {
+                self.close_stream(dir, hdr.stream_id);
+            }
+
+            if !self.frame_needs_payload(dir, &hdr) {
+                cur = rem;
+                self.dirs[dir].skip = hdr.length;
+                continue;
+            }
+
+            let len = hdr.length as usize;
+            if len > HTTP2_MAX_HEADER_BLOCK {
+                if hdr.ftype != HTTP2_FRAME_SETTINGS {
+                    let d = &mut self.dirs[dir];
+                    d.block.clear();
+                    d.block_stream = 0;
+                    d.decoder_failed = true;
+                }
+                self.set_event(hdr.stream_id, HTTP2Event::InvalidFrameLength);
+                cur = rem;
+                self.dirs[dir].skip = hdr.length;
+                continue;
+            }
+            if rem.len() < len {
+                break;
+            }
+            self.handle_frame(dir, &hdr, &rem[..len]);
+            cur = &rem[len..];
+        }
+
+        // keep the incomplete frame for the next data
+        if cur.len() > 0 {
+            self.dirs[dir].buffer.extend_from_slice(cur);
+        }
+        return true;
+    }
+
+    fn tx_iterator(&mut self, min_tx_id: u64, state: &mut u64)
+                   -> Option<(&HTTP2Transaction, u64, bool)>
+    {
+        let mut index = *state as usize;
+        let len = self.transactions.len();
+
+        while index < len {
+            let tx = &self.transactions[index];
+            if tx.tx_id < min_tx_id + 1 {
+                index += 1;
+                continue;
+            }
+            *state = index as u64;
+            return Some((tx, tx.tx_id - 1, (len - index) > 1));
+        }
+
+        return None;
+    }
+}
+
+/// Probe for the client preface, or a SETTINGS frame from the server.
+fn probe(input: &[u8], direction: u8) -> bool {
+    if direction & core::STREAM_TOSERVER != 0 {
+        return input.starts_with(HTTP2_PREFACE);
+    }
+    match http2_parse_frame_header(input) {
+        Some((_, hdr)) => {
+            hdr.ftype == HTTP2_FRAME_SETTINGS && hdr.stream_id == 0 &&
+                hdr.flags == 0 && hdr.length % 6 == 0
+        }
+        _ => false,
+    }
+}
+
+// C exports.
+
+export_tx_get_detect_state!(rs_http2_tx_get_detect_state, HTTP2Transaction);
+export_tx_set_detect_state!(rs_http2_tx_set_detect_state, HTTP2Transaction);
+
+#[no_mangle]
+pub extern "C" fn rs_http2_probing_parser(_flow: *const Flow,
+                                          direction: u8,
+                                          input: *const libc::uint8_t,
+                                          input_len: u32,
+                                          _rdir: *mut u8) -> AppProto
+{
+    if input_len >= HTTP2_PREFACE.len() as u32 && input != std::ptr::null_mut() {
+        let slice = build_slice!(input, input_len as usize);
+        if probe(slice, direction) {
+            return unsafe { ALPROTO_HTTP2 };
+        }
+    }
+    return ALPROTO_UNKNOWN;
+}
+
+/// Set the size the HPACK dynamic table of a decoder may grow to, for
+/// the states created from now on.
+#[no_mangle]
+pub extern "C" fn rs_http2_set_hpack_memcap(memcap: u32) {
+    unsafe {
+        HTTP2_HPACK_MEMCAP = memcap as usize;
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_new() -> *mut libc::c_void {
+    let state = HTTP2State::new();
+    let boxed = Box::new(state);
+    return unsafe { transmute(boxed) };
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_free(state: *mut libc::c_void) {
+    // Just unbox...
+    let _drop: Box<HTTP2State> = unsafe { transmute(state) };
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_tx_free(state: *mut libc::c_void,
+                                         tx_id: libc::uint64_t)
+{
+    let state = cast_pointer!(state, HTTP2State);
+    state.free_tx(tx_id);
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_parse_ts(_flow: *const Flow,
+                                    state: *mut libc::c_void,
+                                    _pstate: *mut libc::c_void,
+                                    input: *const libc::uint8_t,
+                                    input_len: u32,
+                                    _data: *const libc::c_void,
+                                    _flags: u8) -> i32
+{
+    if input_len == 0 || input == std::ptr::null_mut() {
+        return 1;
+    }
+    let state = cast_pointer!(state, HTTP2State);
+    let buf = build_slice!(input, input_len as usize);
+    if state.parse(buf, 0) {
+        return 1;
+    }
+    return -1;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_parse_tc(_flow: *const Flow,
+                                    state: *mut libc::c_void,
+                                    _pstate: *mut libc::c_void,
+                                    input: *const libc::uint8_t,
+                                    input_len: u32,
+                                    _data: *const libc::c_void,
+                                    _flags: u8) -> i32
+{
+    if input_len == 0 || input == std::ptr::null_mut() {
+        return 1;
+    }
+    let state = cast_pointer!(state, HTTP2State);
+    let buf = build_slice!(input, input_len as usize);
+    if state.parse(buf, 1) {
+        return 1;
+    }
+    return -1;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_get_tx(state: *mut libc::c_void,
+                                        tx_id: libc::uint64_t)
+                                        -> *mut libc::c_void
+{
+    let state = cast_pointer!(state, HTTP2State);
+    match state.get_tx(tx_id) {
+        Some(tx) => {
+            return unsafe { transmute(tx) };
+        }
+        None => {
+            return std::ptr::null_mut();
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_get_tx_count(state: *mut libc::c_void)
+                                              -> libc::uint64_t
+{
+    let state = cast_pointer!(state, HTTP2State);
+    return state.tx_id;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_progress_completion_status(
+    _direction: libc::uint8_t) -> libc::c_int
+{
+    return HTTP2_STATE_CLOSED as libc::c_int;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_get_alstate_progress(tx: *mut libc::c_void,
+                                                   direction: libc::uint8_t)
+                                                   -> libc::c_int
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    if direction & core::STREAM_TOSERVER != 0 {
+        return tx.request_state as libc::c_int;
+    }
+    return tx.response_state as libc::c_int;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_get_logged(_state: *mut libc::c_void,
+                                         tx: *mut libc::c_void) -> u32
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    return tx.logged.get();
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_set_logged(_state: *mut libc::c_void,
+                                         tx: *mut libc::c_void,
+                                         logged: libc::uint32_t)
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    tx.logged.set(logged);
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_get_events(state: *mut libc::c_void,
+                                            tx_id: libc::uint64_t)
+                                            -> *mut core::AppLayerDecoderEvents
+{
+    let state = cast_pointer!(state, HTTP2State);
+    match state.get_tx(tx_id) {
+        Some(tx) => tx.events,
+        _ => std::ptr::null_mut(),
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_get_event_info(
+    event_name: *const libc::c_char,
+    event_id: *mut libc::c_int,
+    event_type: *mut core::AppLayerEventType)
+    -> libc::c_int
+{
+    if event_name == std::ptr::null() {
+        return -1;
+    }
+    let c_event_name: &CStr = unsafe { CStr::from_ptr(event_name) };
+    let event = match c_event_name.to_str() {
+        Ok(s) => {
+            match s {
+                "invalid_frame_length" => HTTP2Event::InvalidFrameLength as i32,
+                "invalid_frame" => HTTP2Event::InvalidFrame as i32,
+                "invalid_continuation" => HTTP2Event::InvalidContinuation as i32,
+                "header_block_too_long" => HTTP2Event::HeaderBlockTooLong as i32,
+                "compression_error" => HTTP2Event::CompressionError as i32,
+                _ => -1, // unknown event
+            }
+        },
+        Err(_) => -1, // UTF-8 conversion failed
+    };
+    unsafe {
+        *event_type = core::APP_LAYER_EVENT_TYPE_TRANSACTION;
+        *event_id = event as libc::c_int;
+    };
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn rs_http2_state_get_tx_iterator(
+    _ipproto: libc::uint8_t,
+    _alproto: AppProto,
+    state: *mut libc::c_void,
+    min_tx_id: libc::uint64_t,
+    _max_tx_id: libc::uint64_t,
+    istate: &mut libc::uint64_t)
+    -> applayer::AppLayerGetTxIterTuple
+{
+    let state = cast_pointer!(state, HTTP2State);
+    match state.tx_iterator(min_tx_id, istate) {
+        Some((tx, out_tx_id, has_next)) => {
+            let c_tx = unsafe { transmute(tx) };
+            let ires = applayer::AppLayerGetTxIterTuple::with_values(
+                c_tx, out_tx_id, has_next);
+            return ires;
+        }
+        None => {
+            return applayer::AppLayerGetTxIterTuple::not_found();
+        }
+    }
+}
+
+fn http2_set_buffer(value: Option<&[u8]>, buf: *mut *const libc::uint8_t,
+                    len: *mut libc::uint32_t) -> libc::uint8_t
+{
+    if let Some(value) = value {
+        if value.len() > 0 {
+            unsafe {
+                *buf = value.as_ptr();
+                *len = value.len() as libc::uint32_t;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Get a request header by name, for the detection buffers. The
+/// pseudo headers (":method", ":path", ...) work as well.
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_get_request_header(tx: *mut libc::c_void,
+                                                 name: *const libc::c_char,
+                                                 buf: *mut *const libc::uint8_t,
+                                                 len: *mut libc::uint32_t)
+                                                 -> libc::uint8_t
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    let name = unsafe { CStr::from_ptr(name) }.to_bytes();
+    http2_set_buffer(tx.request.get_value(name), buf, len)
+}
+
+/// Get a response header by name.
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_get_response_header(tx: *mut libc::c_void,
+                                                  name: *const libc::c_char,
+                                                  buf: *mut *const libc::uint8_t,
+                                                  len: *mut libc::uint32_t)
+                                                  -> libc::uint8_t
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    let name = unsafe { CStr::from_ptr(name) }.to_bytes();
+    http2_set_buffer(tx.response.get_value(name), buf, len)
+}
+
+/// Get the host of the request, lowercase.
+#[no_mangle]
+pub extern "C" fn rs_http2_tx_get_host(tx: *mut libc::c_void,
+                                       buf: *mut *const libc::uint8_t,
+                                       len: *mut libc::uint32_t)
+                                       -> libc::uint8_t
+{
+    let tx = cast_pointer!(tx, HTTP2Transaction);
+    http2_set_buffer(tx.get_host(), buf, len)
+}
+
+const PARSER_NAME: &'static [u8] = b"http2\0";
+
+#[no_mangle]
+pub unsafe extern "C" fn rs_http2_register_parser() {
+    let default_port = CString::new("[80]").unwrap();
+    let parser = RustParser {
+        name: PARSER_NAME.as_ptr() as *const libc::c_char,
+        default_port: default_port.as_ptr(),
+        ipproto: IPPROTO_TCP,
+        probe_ts: rs_http2_probing_parser,
+        probe_tc: rs_http2_probing_parser,
+        min_depth: 0,
+        max_depth: HTTP2_PREFACE.len() as u16,
+        state_new: rs_http2_state_new,
+        state_free: rs_http2_state_free,
+        tx_free: rs_http2_state_tx_free,
+        parse_ts: rs_http2_parse_ts,
+        parse_tc: rs_http2_parse_tc,
+        get_tx_count: rs_http2_state_get_tx_count,
+        get_tx: rs_http2_state_get_tx,
+        tx_get_comp_st: rs_http2_state_progress_completion_status,
+        tx_get_progress: rs_http2_tx_get_alstate_progress,
+        get_tx_logged: Some(rs_http2_tx_get_logged),
+        set_tx_logged: Some(rs_http2_tx_set_logged),
+        get_de_state: rs_http2_tx_get_detect_state,
+        set_de_state: rs_http2_tx_set_detect_state,
+        get_events: Some(rs_http2_state_get_events),
+        get_eventinfo: Some(rs_http2_state_get_event_info),
+        localstorage_new: None,
+        localstorage_free: None,
+        get_tx_mpm_id: None,
+        set_tx_mpm_id: None,
+        get_files: None,
+        get_tx_iterator: Some(rs_http2_state_get_tx_iterator),
+    };
+
+    let ip_proto_str = CString::new("tcp").unwrap();
+
+    if AppLayerProtoDetectConfProtoDetectionEnabled(ip_proto_str.as_ptr(),
+                                                    parser.name) != 0
+    {
+        let alproto = AppLayerRegisterProtocolDetection(&parser, 1);
+        ALPROTO_HTTP2 = alproto;
+        if AppLayerParserConfParserEnabled(ip_proto_str.as_ptr(),
+                                           parser.name) != 0
+        {
+            let _ = AppLayerRegisterParser(&parser, alproto);
+        }
+        SCLogDebug!("Rust http2 parser registered.");
+    } else {
+        SCLogDebug!("Protocol detector and parser disabled for HTTP2.");
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(ftype: u8, flags: u8, stream_id: u32, payload: &[u8]) -> Vec<u8> {
+        let len = payload.len();
+        let mut v = vec![(len >> 16) as u8, (len >> 8) as u8, len as u8,
+                         ftype, flags,
+                         (stream_id >> 24) as u8, (stream_id >> 16) as u8,
+                         (stream_id >> 8) as u8, stream_id as u8];
+        v.extend_from_slice(payload);
+        v
+    }
+
+    // RFC 7541 C.4.1 and C.4.2
+    const REQ1: &'static [u8] = &[0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3,
+        0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff];
+    const REQ2: &'static [u8] = &[0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8,
+        0xeb, 0x10, 0x64, 0x9c, 0xbf];
+
+    #[test]
+    fn test_http2_streams() {
+        let mut state = HTTP2State::new();
+        let mut buf = HTTP2_PREFACE.to_vec();
+        buf.extend(frame(HTTP2_FRAME_SETTINGS, 0, 0, &[]));
+        buf.extend(frame(HTTP2_FRAME_HEADERS, HTTP2_FLAG_END_HEADERS, 1, REQ1));
+        // stream 3 sends its block in two parts
+        buf.extend(frame(HTTP2_FRAME_HEADERS, HTTP2_FLAG_END_STREAM, 3, &REQ2[..5]));
+        buf.extend(frame(HTTP2_FRAME_CONTINUATION, HTTP2_FLAG_END_HEADERS, 3, &REQ2[5..]));
+        buf.extend(frame(HTTP2_FRAME_DATA, HTTP2_FLAG_END_STREAM, 1, b"body"));
+
+        // one byte at a time, to go through the buffering
+        for i in 0..buf.len() {
+            assert!(state.parse(&buf[i..i + 1], 0));
+        }
+        assert_eq!(state.transactions.len(), 2);
+
+        let tx = &mut state.transactions[0];
+        assert_eq!(tx.stream_id, 1);
+        assert_eq!(tx.request_state, HTTP2_STATE_CLOSED);
+        assert_eq!(tx.request.get_value(b":method"), Some(&b"GET"[..]));
+        assert_eq!(tx.get_host(), Some(&b"www.example.com"[..]));
+
+        let tx = &state.transactions[1];
+        assert_eq!(tx.stream_id, 3);
+        assert_eq!(tx.request_state, HTTP2_STATE_CLOSED);
+        assert_eq!(tx.request.get_value(b"cache-control"), Some(&b"no-cache"[..]));
+
+        // response on stream 3, status 404 from the static table
+        let buf = frame(HTTP2_FRAME_HEADERS,
+                        HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 3, &[0x8d]);
+        assert!(state.parse(&buf, 1));
+        let tx = &state.transactions[1];
+        assert_eq!(tx.response_state, HTTP2_STATE_CLOSED);
+        assert_eq!(tx.response.get_value(b":status"), Some(&b"404"[..]));
+    }
+
+    #[test]
+    fn test_http2_bad_preface() {
+        let mut state = HTTP2State::new();
+        assert!(state.parse(b"PRI * HTTP/2", 0));
+        assert!(!state.parse(b".1\r\n", 0));
+    }
+
+    #[test]
+    fn test_http2_probe() {
+        let mut buf = HTTP2_PREFACE.to_vec();
+        assert!(probe(&buf, core::STREAM_TOSERVER));
+        buf[0] = b'G';
+        assert!(!probe(&buf, core::STREAM_TOSERVER));
+        let buf = frame(HTTP2_FRAME_SETTINGS, 0, 0, &[0, 1, 0, 0, 0x10, 0]);
+        assert!(probe(&buf, core::STREAM_TOCLIENT));
+    }
+}
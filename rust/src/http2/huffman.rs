@@ -0,0 +1,151 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+// HPACK Huffman decoding, RFC 7541 appendix B.
+//
+// The code is canonical: the codes of one length are consecutive and
+// longer codes follow the shorter ones. So a symbol is found from the
+// first code and the number of codes of each length, there is no need
+// for a tree.
+
+const HUFFMAN_EOS: u16 = 256;
+const HUFFMAN_MIN_LEN: usize = 5;
+const HUFFMAN_MAX_LEN: usize = 30;
+
+// Per code length: first code, number of codes, index of the first
+// symbol in HUFFMAN_SYMBOLS.
+static HUFFMAN_LIMITS: [(u32, u32, usize); HUFFMAN_MAX_LEN + 1] = [
+    (0, 0, 0),
+    (0, 0, 0),
+    (0, 0, 0),
+    (0, 0, 0),
+    (0, 0, 0),
+    (0x0, 10, 0),
+    (0x14, 26, 10),
+    (0x5c, 32, 36),
+    (0xf8, 6, 68),
+    (0, 0, 0),
+    (0x3f8, 5, 74),
+    (0x7fa, 3, 79),
+    (0xffa, 2, 82),
+    (0x1ff8, 6, 84),
+    (0x3ffc, 2, 90),
+    (0x7ffc, 3, 92),
+    (0, 0, 0),
+    (0, 0, 0),
+    (0, 0, 0),
+    (0x7fff0, 3, 95),
+    (0xfffe6, 8, 98),
+    (0x1fffdc, 13, 106),
+    (0x3fffd2, 26, 119),
+    (0x7fffd8, 29, 145),
+    (0xffffea, 12, 174),
+    (0x1ffffec, 4, 186),
+    (0x3ffffe0, 15, 190),
+    (0x7ffffde, 19, 205),
+    (0xfffffe2, 29, 224),
+    (0, 0, 0),
+    (0x3ffffffc, 4, 253),
+];
+
+// Symbols ordered by code.
+static HUFFMAN_SYMBOLS: [u16; 257] = [
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51, 52,
+    53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110,
+    112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78,
+    79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120,
+    121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35,
+    62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92, 195, 208, 128,
+    130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177, 179,
+    209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156,
+    160, 163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196,
+    198, 228, 232, 233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182, 183, 188,
+    191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171, 206, 215, 225, 236,
+    237, 199, 207, 234, 235, 192, 193, 200, 201, 202, 205, 210, 213, 218,
+    219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214, 221, 222, 223,
+    241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5, 6, 7,
+    8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28, 29,
+    30, 31, 127, 220, 249, 10, 13, 22, 256,
+];
+
+/// Decode the Huffman encoded string `input`, appending to `out`.
+///
+/// Returns false on an invalid encoding: the EOS symbol in the data or
+/// padding that is longer than 7 bits or not all ones (RFC 7541 5.2).
+pub fn huffman_decode(input: &[u8], out: &mut Vec<u8>) -> bool {
+    let mut code: u32 = 0;
+    let mut len: usize = 0;
+
+    out.reserve(input.len() + input.len() / 2);
+    for &byte in input {
+        for shift in (0..8).rev() {
+            code = (code << 1) | ((byte >> shift) & 1) as u32;
+            len += 1;
+            if len < HUFFMAN_MIN_LEN {
+                continue;
+            }
+            let (first, count, offset) = HUFFMAN_LIMITS[len];
+            let idx = code.wrapping_sub(first);
+            if idx < count {
+                let sym = HUFFMAN_SYMBOLS[offset + idx as usize];
+                if sym == HUFFMAN_EOS {
+                    return false;
+                }
+                out.push(sym as u8);
+                code = 0;
+                len = 0;
+            } else if len == HUFFMAN_MAX_LEN {
+                return false;
+            }
+        }
+    }
+
+    len < 8 && code == (1 << len) - 1
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_huffman_decode() {
+        // RFC 7541 C.4.1, www.example.com
+        let buf = [0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab,
+                   0x90, 0xf4, 0xff];
+        let mut out = Vec::new();
+        assert!(huffman_decode(&buf, &mut out));
+        assert_eq!(out, b"www.example.com");
+
+        // RFC 7541 C.4.2, no-cache
+        let buf = [0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf];
+        let mut out = Vec::new();
+        assert!(huffman_decode(&buf, &mut out));
+        assert_eq!(out, b"no-cache");
+    }
+
+    #[test]
+    fn test_huffman_decode_invalid() {
+        let mut out = Vec::new();
+        // padding of more than 7 bits
+        assert!(!huffman_decode(&[0xff], &mut out));
+        // padding that is not all ones, '0' is 00000
+        assert!(!huffman_decode(&[0x00], &mut out));
+        // EOS, 30 bits of ones
+        assert!(!huffman_decode(&[0xff, 0xff, 0xff, 0xfc], &mut out));
+    }
+}
@@ -0,0 +1,180 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/// The client connection preface, RFC 7540 3.5.
+pub const HTTP2_PREFACE: &'static [u8] = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+pub const HTTP2_FRAME_HEADER_LEN: usize = 9;
+
+pub const HTTP2_FRAME_DATA: u8 = 0;
+pub const HTTP2_FRAME_HEADERS: u8 = 1;
+pub const HTTP2_FRAME_PRIORITY: u8 = 2;
+pub const HTTP2_FRAME_RSTSTREAM: u8 = 3;
+pub const HTTP2_FRAME_SETTINGS: u8 = 4;
+pub const HTTP2_FRAME_PUSHPROMISE: u8 = 5;
+pub const HTTP2_FRAME_PING: u8 = 6;
+pub const HTTP2_FRAME_GOAWAY: u8 = 7;
+pub const HTTP2_FRAME_WINDOWUPDATE: u8 = 8;
+pub const HTTP2_FRAME_CONTINUATION: u8 = 9;
+
+pub const HTTP2_FLAG_END_STREAM: u8 = 0x1;
+pub const HTTP2_FLAG_SETTINGS_ACK: u8 = 0x1;
+pub const HTTP2_FLAG_END_HEADERS: u8 = 0x4;
+pub const HTTP2_FLAG_PADDED: u8 = 0x8;
+pub const HTTP2_FLAG_PRIORITY: u8 = 0x20;
+
+pub const HTTP2_SETTINGS_HEADER_TABLE_SIZE: u16 = 1;
+
+pub struct HTTP2FrameHeader {
+    pub length: u32,
+    pub ftype: u8,
+    pub flags: u8,
+    pub stream_id: u32,
+}
+
+fn http2_be_u32(b: &[u8]) -> u32 {
+    (b[0] as u32) << 24 | (b[1] as u32) << 16 | (b[2] as u32) << 8 | b[3] as u32
+}
+
+/// Parse a frame header, RFC 7540 4.1. Any 9 bytes make a header, so
+/// None means more data is needed.
+pub fn http2_parse_frame_header(input: &[u8]) -> Option<(&[u8], HTTP2FrameHeader)>
+{
+    if input.len() < HTTP2_FRAME_HEADER_LEN {
+        return None;
+    }
+    let hdr = HTTP2FrameHeader{
+        length: (input[0] as u32) << 16 | (input[1] as u32) << 8 | input[2] as u32,
+        ftype: input[3],
+        flags: input[4],
+        stream_id: http2_be_u32(&input[5..9]) & 0x7fff_ffff,
+    };
+    Some((&input[HTTP2_FRAME_HEADER_LEN..], hdr))
+}
+
+pub struct HTTP2Setting {
+    pub id: u16,
+    pub value: u32,
+}
+
+/// Parse the settings of a SETTINGS frame payload, RFC 7540 6.5.1.
+/// A trailing partial setting is ignored.
+pub fn http2_parse_settings(input: &[u8]) -> Vec<HTTP2Setting>
+{
+    input.chunks(6).filter(|c| c.len() == 6).map(|c| {
+        HTTP2Setting{
+            id: (c[0] as u16) << 8 | c[1] as u16,
+            value: http2_be_u32(&c[2..6]),
+        }
+    }).collect()
+}
+
+/// Get the header block fragment of a HEADERS or PUSH_PROMISE frame
+/// payload, without the padding, priority and promised stream id.
+/// Returns the promised stream id for PUSH_PROMISE.
+pub fn http2_header_block(ftype: u8, flags: u8, payload: &[u8])
+                          -> Option<(&[u8], u32)>
+{
+    let mut block = payload;
+    let mut pad = 0;
+    let mut promised = 0;
+
+    if flags & HTTP2_FLAG_PADDED != 0 {
+        if block.len() < 1 {
+            return None;
+        }
+        pad = block[0] as usize;
+        block = &block[1..];
+    }
+    if ftype == HTTP2_FRAME_HEADERS && flags & HTTP2_FLAG_PRIORITY != 0 {
+        // stream dependency and weight
+        if block.len() < 5 {
+            return None;
+        }
+        block = &block[5..];
+    } else if ftype == HTTP2_FRAME_PUSHPROMISE {
+        if block.len() < 4 {
+            return None;
+        }
+        promised = http2_be_u32(block) & 0x7fff_ffff;
+        block = &block[4..];
+    }
+    if block.len() < pad {
+        return None;
+    }
+    Some((&block[..block.len() - pad], promised))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_http2_parse_frame_header() {
+        // SETTINGS, 18 bytes, stream 0
+        let buf = [0x00, 0x00, 0x12, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00];
+        let (rem, hdr) = http2_parse_frame_header(&buf).unwrap();
+        assert_eq!(rem.len(), 0);
+        assert_eq!(hdr.length, 18);
+        assert_eq!(hdr.ftype, HTTP2_FRAME_SETTINGS);
+        assert_eq!(hdr.stream_id, 0);
+
+        // the reserved bit is not part of the stream id
+        let buf = [0x01, 0x00, 0x00, 0x01, 0x05, 0x80, 0x00, 0x00, 0x01];
+        let (_, hdr) = http2_parse_frame_header(&buf).unwrap();
+        assert_eq!(hdr.length, 65536);
+        assert_eq!(hdr.flags, HTTP2_FLAG_END_STREAM | HTTP2_FLAG_END_HEADERS);
+        assert_eq!(hdr.stream_id, 1);
+
+        assert!(http2_parse_frame_header(&buf[..8]).is_none());
+    }
+
+    #[test]
+    fn test_http2_parse_settings() {
+        // HEADER_TABLE_SIZE 4096, MAX_CONCURRENT_STREAMS 100, then a
+        // truncated setting
+        let buf = [0x00, 0x01, 0x00, 0x00, 0x10, 0x00,
+                   0x00, 0x03, 0x00, 0x00, 0x00, 0x64,
+                   0x00, 0x04, 0x00];
+        let settings = http2_parse_settings(&buf);
+        assert_eq!(settings.len(), 2);
+        assert_eq!(settings[0].id, HTTP2_SETTINGS_HEADER_TABLE_SIZE);
+        assert_eq!(settings[0].value, 4096);
+        assert_eq!(settings[1].id, 3);
+        assert_eq!(settings[1].value, 100);
+
+        assert_eq!(http2_parse_settings(&[]).len(), 0);
+    }
+
+    #[test]
+    fn test_http2_header_block() {
+        // padded, with priority
+        let buf = [0x02, 0x00, 0x00, 0x00, 0x03, 0x10, 0x82, 0x86, 0x00, 0x00];
+        let flags = HTTP2_FLAG_PADDED | HTTP2_FLAG_PRIORITY;
+        let (block, _) = http2_header_block(HTTP2_FRAME_HEADERS, flags, &buf).unwrap();
+        assert_eq!(block, &[0x82, 0x86]);
+
+        // padding longer than the frame
+        let buf = [0x08, 0x82];
+        assert!(http2_header_block(HTTP2_FRAME_HEADERS, HTTP2_FLAG_PADDED, &buf).is_none());
+
+        let buf = [0x00, 0x00, 0x00, 0x02, 0x82];
+        let (block, promised) = http2_header_block(HTTP2_FRAME_PUSHPROMISE, 0, &buf).unwrap();
+        assert_eq!(block, &[0x82]);
+        assert_eq!(promised, 2);
+    }
+}
@@ -46,6 +46,9 @@ pub mod kerberos;
 #[cfg(feature = "lua")]
 pub mod lua;
 
+#[cfg(feature = "unittests")]
+pub mod mem;
+
 pub mod dns;
 pub mod nfs;
 pub mod ftp;
@@ -57,4 +60,6 @@ pub mod ikev2;
 pub mod ntp;
 pub mod tftp;
 pub mod dhcp;
+pub mod http2;
+pub mod quic;
 pub mod applayertemplate;
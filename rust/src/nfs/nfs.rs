@@ -41,6 +41,10 @@ use nfs::nfs3_records::*;
 
 pub static mut SURICATA_NFS_FILE_CONFIG: Option<&'static SuricataFileContext> = None;
 
+/// Out of order file data a file keeps in memory before complete chunks
+/// go to a temporary file. 0 keeps all in memory.
+static mut NFS_CFG_FILE_OOO_SPILL_SIZE: u64 = 0;
+
 /*
  * Record parsing.
  *
@@ -287,6 +291,7 @@ pub fn filetracker_newchunk(ft: &mut FileTransferTracker, files: &mut FileContai
 {
     match unsafe {SURICATA_NFS_FILE_CONFIG} {
         Some(sfcm) => {
+            ft.set_ooo_spill_size(unsafe { NFS_CFG_FILE_OOO_SPILL_SIZE });
             ft.new_chunk(sfcm, files, flags, &name, data, chunk_offset,
                     chunk_size, fill_bytes, is_last, xid); }
         None => panic!("BUG"),
@@ -1454,6 +1459,26 @@ pub extern "C" fn rs_nfs_state_get_tx_count(state: &mut NFSState)
     return state.tx_id;
 }
 
+/// Estimate of the memory held by the state, for the app-layer memcap:
+/// the record buffers, the transactions, the out of order file data they
+/// queue and the entries of the lookup maps.
+#[no_mangle]
+pub extern "C" fn rs_nfs_state_get_memuse(state: &NFSState) -> u64
+{
+    let mut size = std::mem::size_of::<NFSState>()
+        + state.tcp_buffer_ts.capacity()
+        + state.tcp_buffer_tc.capacity()
+        + state.transactions.capacity() * std::mem::size_of::<NFSTransaction>();
+    for tx in &state.transactions {
+        if let Some(NFSTransactionTypeData::FILE(ref tdf)) = tx.type_data {
+            size += tdf.file_tracker.get_queued_size() as usize;
+        }
+    }
+    size += state.requestmap.len() * std::mem::size_of::<(u32, NFSRequestXidMap)>()
+        + state.namemap.len() * std::mem::size_of::<(Vec<u8>, Vec<u8>)>();
+    return size as u64;
+}
+
 #[no_mangle]
 pub extern "C" fn rs_nfs_state_get_tx(state: &mut NFSState,
                                       tx_id: libc::uint64_t)
@@ -1681,6 +1706,14 @@ pub extern "C" fn rs_nfs_init(context: &'static mut SuricataFileContext)
     }
 }
 
+#[no_mangle]
+pub extern "C" fn rs_nfs_set_file_ooo_spill_size(size: u64)
+{
+    unsafe {
+        NFS_CFG_FILE_OOO_SPILL_SIZE = size;
+    }
+}
+
 fn nfs_probe_dir(i: &[u8], rdir: *mut u8) -> i8 {
     match parse_rpc_packet_header(i) {
         Ok((_, ref hdr)) => {
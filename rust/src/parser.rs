@@ -163,11 +163,11 @@ extern {
 }
 
 // Defined in app-layer-parser.h
-pub const APP_LAYER_PARSER_EOF : u8 = 0b0;
-pub const APP_LAYER_PARSER_NO_INSPECTION : u8 = 0b1;
-pub const APP_LAYER_PARSER_NO_REASSEMBLY : u8 = 0b10;
-pub const APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD : u8 = 0b100;
-pub const APP_LAYER_PARSER_BYPASS_READY : u8 = 0b1000;
+pub const APP_LAYER_PARSER_EOF : u8 = 0b1;
+pub const APP_LAYER_PARSER_NO_INSPECTION : u8 = 0b10;
+pub const APP_LAYER_PARSER_NO_REASSEMBLY : u8 = 0b100;
+pub const APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD : u8 = 0b1000;
+pub const APP_LAYER_PARSER_BYPASS_READY : u8 = 0b10000;
 
 extern {
     pub fn AppLayerParserStateSetFlag(state: *mut c_void, flag: u8);
@@ -0,0 +1,55 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+use json::*;
+use quic::parser::quic_version_is_gquic;
+use quic::quic::*;
+
+/// Google versions read as text, "Q043", the others as hex.
+fn quic_version_string(version: u32) -> String {
+    if quic_version_is_gquic(version) {
+        let b = [(version >> 24) as u8, (version >> 16) as u8,
+                 (version >> 8) as u8, version as u8];
+        return String::from_utf8_lossy(&b).into_owned();
+    }
+    format!("0x{:08x}", version)
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_logger_log(tx: &mut QuicTransaction) -> *mut JsonT
+{
+    let js = Json::object();
+    js.set_string("version", &quic_version_string(tx.version));
+    if let Some(ref sni) = tx.sni {
+        js.set_string_from_bytes("sni", sni);
+    }
+    if let Some(ref ua) = tx.ua {
+        js.set_string_from_bytes("ua", ua);
+    }
+    js.unwrap()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_quic_version_string() {
+        assert_eq!(quic_version_string(0x5130_3433), "Q043");
+        assert_eq!(quic_version_string(0xff00_0017), "0xff000017");
+    }
+}
@@ -0,0 +1,318 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+//! QUIC packet headers, IETF and Google QUIC, and the cleartext client
+//! hello of Google QUIC.
+
+/// Clients pad the packets of their first flight to this size, so the
+/// path is known to carry them.
+pub const QUIC_MIN_INITIAL_SIZE: usize = 1200;
+
+/// Longest connection id any version allows.
+pub const QUIC_MAX_CID_LEN: usize = 20;
+
+#[derive(Debug,PartialEq,Clone,Copy)]
+pub enum QuicForm {
+    /// IETF long header, also used by Google QUIC from Q046 on
+    Long,
+    /// IETF short header, only used once the handshake is done
+    Short,
+    /// public header of Google QUIC up to Q043
+    GooglePublic,
+}
+
+pub struct QuicHeader<'a> {
+    pub form: QuicForm,
+    /// 0 for short headers and public headers without version
+    pub version: u32,
+    /// long header packet type, as the version encodes it
+    pub ptype: u8,
+    pub dcid: &'a [u8],
+}
+
+fn be_u32(i: &[u8]) -> u32 {
+    (i[0] as u32) << 24 | (i[1] as u32) << 16 | (i[2] as u32) << 8 | i[3] as u32
+}
+
+fn le_u16(i: &[u8]) -> usize {
+    (i[0] as usize) | (i[1] as usize) << 8
+}
+
+fn le_u32(i: &[u8]) -> usize {
+    (i[0] as usize) | (i[1] as usize) << 8 | (i[2] as usize) << 16 |
+        (i[3] as usize) << 24
+}
+
+/// Google QUIC, "Q0xx"
+pub fn quic_version_is_gquic(version: u32) -> bool {
+    version >> 16 == 0x5130
+}
+
+/// Google QUIC versions that send the client hello in the clear, with
+/// NULL encryption: up to Q046.
+fn quic_version_has_cleartext_chlo(version: u32) -> bool {
+    if !quic_version_is_gquic(version) {
+        return false;
+    }
+    let d1 = ((version >> 8) & 0xff) as u8;
+    let d2 = (version & 0xff) as u8;
+    if d1 < b'0' || d1 > b'9' || d2 < b'0' || d2 > b'9' {
+        return false;
+    }
+    (d1 - b'0') * 10 + (d2 - b'0') <= 46
+}
+
+/// Versions we know the header layout of.
+pub fn quic_version_is_known(version: u32) -> bool {
+    version == 0x0000_0001 ||                   // RFC version
+        version >> 8 == 0x00ff_0000 ||          // IETF drafts
+        version >> 16 == 0x5130 ||              // Google, Q0xx
+        version >> 16 == 0x5430 ||              // Google with TLS, T0xx
+        version >> 4 == 0x0fac_eb00             // mvfst
+}
+
+/// The long header of these versions has the connection id lengths in
+/// one byte, 4 bits each, encoded as length - 3.
+fn quic_version_has_cil_nibbles(version: u32) -> bool {
+    (version >= 0xff00_0011 && version <= 0xff00_0015) ||
+        version == 0x5130_3436                  // Q046
+}
+
+/// Parse the header of a packet, up to and including the connection
+/// ids. `client` selects the layout of Google QUIC public headers, which
+/// differs per direction.
+pub fn quic_parse_header(i: &[u8], client: bool) -> Option<(&[u8], QuicHeader)> {
+    if i.len() < 1 {
+        return None;
+    }
+    let first = i[0];
+
+    if first & 0x80 != 0 {
+        if i.len() < 6 {
+            return None;
+        }
+        let version = be_u32(&i[1..5]);
+        let (dcid, rem) = if quic_version_has_cil_nibbles(version) {
+            let dcil = (i[5] >> 4) as usize;
+            let scil = (i[5] & 0x0f) as usize;
+            let dcil = if dcil > 0 { dcil + 3 } else { 0 };
+            let scil = if scil > 0 { scil + 3 } else { 0 };
+            if i.len() < 6 + dcil + scil {
+                return None;
+            }
+            (&i[6..6 + dcil], &i[6 + dcil + scil..])
+        } else {
+            let dcil = i[5] as usize;
+            if dcil > QUIC_MAX_CID_LEN || i.len() < 7 + dcil {
+                return None;
+            }
+            let scil = i[6 + dcil] as usize;
+            if scil > QUIC_MAX_CID_LEN || i.len() < 7 + dcil + scil {
+                return None;
+            }
+            (&i[6..6 + dcil], &i[7 + dcil + scil..])
+        };
+        // the packet type bits moved between the drafts, keep them raw
+        return Some((rem, QuicHeader {
+            form: QuicForm::Long,
+            version: version,
+            ptype: first & 0x7f,
+            dcid: dcid,
+        }));
+    }
+
+    if first & 0x40 != 0 {
+        // the short header does not say how long the dcid is
+        return Some((&i[1..], QuicHeader {
+            form: QuicForm::Short,
+            version: 0,
+            ptype: 0,
+            dcid: &[],
+        }));
+    }
+
+    // Google QUIC public header: flags, connection id, version, the
+    // nonce of the server and the packet number
+    let mut pos = 1;
+    let mut dcid: &[u8] = &[];
+    if first & 0x08 != 0 {
+        if i.len() < pos + 8 {
+            return None;
+        }
+        dcid = &i[pos..pos + 8];
+        pos += 8;
+    }
+    let mut version = 0;
+    if first & 0x01 != 0 && client {
+        if i.len() < pos + 4 {
+            return None;
+        }
+        version = be_u32(&i[pos..pos + 4]);
+        pos += 4;
+    }
+    if first & 0x04 != 0 && !client {
+        pos += 32;
+    }
+    pos += match (first >> 4) & 0x03 {
+        0 => 1,
+        1 => 2,
+        2 => 4,
+        _ => 6,
+    };
+    if i.len() < pos {
+        return None;
+    }
+    Some((&i[pos..], QuicHeader {
+        form: QuicForm::GooglePublic,
+        version: version,
+        ptype: 0,
+        dcid: dcid,
+    }))
+}
+
+/// The tags of a client hello we keep.
+pub struct QuicClientHello {
+    pub sni: Option<Vec<u8>>,
+    pub ua: Option<Vec<u8>>,
+}
+
+/// Find and parse the CHLO handshake message in the payload of a
+/// cleartext Google QUIC client packet.
+///
+/// The message is in a STREAM frame behind a 12 byte hash. Rather than
+/// parse the frames of each version, look for the message tag, then
+/// check the message is complete.
+pub fn quic_parse_gquic_chlo(version: u32, payload: &[u8]) -> Option<QuicClientHello> {
+    if !quic_version_has_cleartext_chlo(version) {
+        return None;
+    }
+    let start = match payload.windows(4).position(|w| w == b"CHLO") {
+        Some(pos) => pos,
+        None => {
+            return None;
+        }
+    };
+    let msg = &payload[start..];
+    if msg.len() < 8 {
+        return None;
+    }
+    let count = le_u16(&msg[4..6]);
+    let values_off = 8 + count * 8;
+    if msg.len() < values_off {
+        return None;
+    }
+    let values = &msg[values_off..];
+
+    let mut hello = QuicClientHello { sni: None, ua: None };
+    let mut prev_end = 0;
+    for n in 0..count {
+        let entry = &msg[8 + n * 8..16 + n * 8];
+        let end = le_u32(&entry[4..8]);
+        // the end offsets only grow
+        if end < prev_end || end > values.len() {
+            return None;
+        }
+        let value = &values[prev_end..end];
+        match &entry[0..4] {
+            b"SNI\0" => {
+                hello.sni = Some(value.to_vec());
+            }
+            b"UAID" => {
+                hello.ua = Some(value.to_vec());
+            }
+            _ => {}
+        }
+        prev_end = end;
+    }
+    Some(hello)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn chlo(tags: &[(&[u8], &[u8])]) -> Vec<u8> {
+        let mut v = b"CHLO".to_vec();
+        v.extend_from_slice(&[tags.len() as u8, 0, 0, 0]);
+        let mut end = 0;
+        for &(tag, value) in tags {
+            end += value.len();
+            v.extend_from_slice(tag);
+            v.extend_from_slice(&[end as u8, (end >> 8) as u8, 0, 0]);
+        }
+        for &(_, value) in tags {
+            v.extend_from_slice(value);
+        }
+        v
+    }
+
+    #[test]
+    fn test_quic_parse_header_long() {
+        // draft-23 Initial, 8 byte dcid, no scid
+        let buf = [0xc3, 0xff, 0x00, 0x00, 0x17, 0x08,
+                   1, 2, 3, 4, 5, 6, 7, 8, 0x00, 0xaa];
+        let (rem, hdr) = quic_parse_header(&buf, true).unwrap();
+        assert_eq!(hdr.form, QuicForm::Long);
+        assert_eq!(hdr.version, 0xff00_0017);
+        assert_eq!(hdr.dcid, &[1, 2, 3, 4, 5, 6, 7, 8]);
+        assert_eq!(rem, &[0xaa]);
+        assert!(quic_version_is_known(hdr.version));
+
+        // Q046, lengths as nibbles: dcid 8, no scid
+        let buf = [0xc3, b'Q', b'0', b'4', b'6', 0x50,
+                   1, 2, 3, 4, 5, 6, 7, 8, 0xaa];
+        let (rem, hdr) = quic_parse_header(&buf, true).unwrap();
+        assert_eq!(hdr.version, 0x5130_3436);
+        assert_eq!(hdr.dcid.len(), 8);
+        assert_eq!(rem, &[0xaa]);
+
+        // cid longer than any version allows
+        let buf = [0xc3, 0x00, 0x00, 0x00, 0x01, 0x15, 0, 0];
+        assert!(quic_parse_header(&buf, true).is_none());
+    }
+
+    #[test]
+    fn test_quic_parse_header_gquic() {
+        // version and cid, 1 byte packet number
+        let buf = [0x09, 1, 2, 3, 4, 5, 6, 7, 8, b'Q', b'0', b'4', b'3', 0x01, 0xaa];
+        let (rem, hdr) = quic_parse_header(&buf, true).unwrap();
+        assert_eq!(hdr.form, QuicForm::GooglePublic);
+        assert_eq!(hdr.version, 0x5130_3433);
+        assert_eq!(rem, &[0xaa]);
+
+        // short header
+        let (_, hdr) = quic_parse_header(&[0x40, 0x00], false).unwrap();
+        assert_eq!(hdr.form, QuicForm::Short);
+    }
+
+    #[test]
+    fn test_quic_parse_gquic_chlo() {
+        let mut payload = vec![0u8; 16];
+        payload.extend(chlo(&[(b"PAD\0", b"...."), (b"SNI\0", b"www.example.com"),
+                              (b"UAID", b"Chrome/72")]));
+        let hello = quic_parse_gquic_chlo(0x5130_3433, &payload).unwrap();
+        assert_eq!(hello.sni.unwrap(), b"www.example.com");
+        assert_eq!(hello.ua.unwrap(), b"Chrome/72");
+
+        // encrypted from Q050 on
+        assert!(quic_parse_gquic_chlo(0x5130_3530, &payload).is_none());
+
+        // values cut short
+        let len = payload.len();
+        assert!(quic_parse_gquic_chlo(0x5130_3433, &payload[..len - 4]).is_none());
+    }
+}
@@ -0,0 +1,526 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+use std;
+use std::ffi::{CStr,CString};
+use std::mem::transmute;
+use core::{self, ALPROTO_UNKNOWN, AppProto, Flow, IPPROTO_UDP};
+use libc;
+use log::*;
+use applayer;
+use parser::*;
+use quic::parser::*;
+
+static mut ALPROTO_QUIC: AppProto = ALPROTO_UNKNOWN;
+
+/// Bypass the flow once the handshake is done, rather than only stop
+/// inspecting it. See rs_quic_set_bypass.
+static mut QUIC_BYPASS: bool = false;
+
+#[repr(u32)]
+pub enum QuicEvent {
+    InvalidHeader = 0,
+}
+
+/// A transaction is a client hello, or the first Initial packet of the
+/// client if the hello can not be read.
+pub struct QuicTransaction {
+    tx_id: u64,
+    pub version: u32,
+    pub sni: Option<Vec<u8>>,
+    pub ua: Option<Vec<u8>>,
+
+    logged: applayer::LoggerFlags,
+    de_state: Option<*mut core::DetectEngineState>,
+    events: *mut core::AppLayerDecoderEvents,
+}
+
+impl QuicTransaction {
+    pub fn new(version: u32) -> QuicTransaction {
+        QuicTransaction {
+            tx_id: 0,
+            version: version,
+            sni: None,
+            ua: None,
+            logged: applayer::LoggerFlags::new(),
+            de_state: None,
+            events: std::ptr::null_mut(),
+        }
+    }
+
+    pub fn free(&mut self) {
+        if self.events != std::ptr::null_mut() {
+            core::sc_app_layer_decoder_events_free_events(&mut self.events);
+        }
+        if let Some(state) = self.de_state {
+            core::sc_detect_engine_state_free(state);
+        }
+    }
+}
+
+impl Drop for QuicTransaction {
+    fn drop(&mut self) {
+        self.free();
+    }
+}
+
+pub struct QuicState {
+    tx_id: u64,
+    transactions: Vec<QuicTransaction>,
+    /// the handshake is over, the rest of the flow is encrypted
+    pub handshake_done: bool,
+}
+
+impl QuicState {
+    pub fn new() -> QuicState {
+        QuicState {
+            tx_id: 0,
+            transactions: Vec::new(),
+            handshake_done: false,
+        }
+    }
+
+    pub fn get_tx(&mut self, tx_id: u64) -> Option<&mut QuicTransaction> {
+        for tx in &mut self.transactions {
+            if tx.tx_id == tx_id + 1 {
+                return Some(tx);
+            }
+        }
+        return None;
+    }
+
+    fn free_tx(&mut self, tx_id: u64) {
+        let len = self.transactions.len();
+        let mut found = false;
+        let mut index = 0;
+        for i in 0..len {
+            let tx = &self.transactions[i];
+            if tx.tx_id == tx_id + 1 {
+                found = true;
+                index = i;
+                break;
+            }
+        }
+        if found {
+            self.transactions.remove(index);
+        }
+    }
+
+    fn new_tx(&mut self, version: u32) -> &mut QuicTransaction {
+        let mut tx = QuicTransaction::new(version);
+        self.tx_id += 1;
+        tx.tx_id = self.tx_id;
+        self.transactions.push(tx);
+        self.transactions.last_mut().unwrap()
+    }
+
+    fn set_event(&mut self, event: QuicEvent) {
+        if let Some(tx) = self.transactions.last_mut() {
+            core::sc_app_layer_decoder_events_set_event_raw(&mut tx.events,
+                                                            event as u8);
+        }
+    }
+
+    /// Parse a datagram, as a single QUIC packet. Coalesced packets
+    /// after the first are not looked at, the first one is the Initial
+    /// that carries the hello.
+    fn parse(&mut self, input: &[u8], client: bool) -> bool {
+        let (rem, hdr) = match quic_parse_header(input, client) {
+            Some(r) => r,
+            None => {
+                self.set_event(QuicEvent::InvalidHeader);
+                return false;
+            }
+        };
+
+        match hdr.form {
+            QuicForm::Short => {
+                self.handshake_done = true;
+            }
+            QuicForm::Long | QuicForm::GooglePublic if client => {
+                if let Some(hello) = quic_parse_gquic_chlo(hdr.version, rem) {
+                    let version = hdr.version;
+                    let tx = self.new_tx(version);
+                    tx.sni = hello.sni;
+                    tx.ua = hello.ua;
+                } else if hdr.form == QuicForm::GooglePublic {
+                    // the version was agreed on and the client is past
+                    // its hello, the rest is encrypted
+                    if hdr.version == 0 && self.transactions.len() > 0 {
+                        self.handshake_done = true;
+                    }
+                } else if self.transactions.len() == 0 && hdr.version != 0 {
+                    // the hello is encrypted, only keep the version
+                    self.new_tx(hdr.version);
+                }
+            }
+            _ => {}
+        }
+        return true;
+    }
+
+    fn tx_iterator(&mut self, min_tx_id: u64, state: &mut u64)
+                   -> Option<(&QuicTransaction, u64, bool)>
+    {
+        let mut index = *state as usize;
+        let len = self.transactions.len();
+
+        while index < len {
+            let tx = &self.transactions[index];
+            if tx.tx_id < min_tx_id + 1 {
+                index += 1;
+                continue;
+            }
+            *state = index as u64;
+            return Some((tx, tx.tx_id - 1, (len - index) > 1));
+        }
+
+        return None;
+    }
+}
+
+/// Probe for the first packet of a handshake. The client pads it to the
+/// minimum size, which keeps other UDP on the port from passing as QUIC.
+fn probe(input: &[u8], direction: u8) -> bool {
+    let client = direction & core::STREAM_TOSERVER != 0;
+    if client && input.len() < QUIC_MIN_INITIAL_SIZE {
+        return false;
+    }
+    match quic_parse_header(input, client) {
+        Some((_, hdr)) => {
+            hdr.form != QuicForm::Short && quic_version_is_known(hdr.version)
+        }
+        None => false,
+    }
+}
+
+// C exports.
+
+export_tx_get_detect_state!(rs_quic_tx_get_detect_state, QuicTransaction);
+export_tx_set_detect_state!(rs_quic_tx_set_detect_state, QuicTransaction);
+
+#[no_mangle]
+pub extern "C" fn rs_quic_probing_parser(_flow: *const Flow,
+                                         direction: u8,
+                                         input: *const libc::uint8_t,
+                                         input_len: u32,
+                                         _rdir: *mut u8) -> AppProto
+{
+    if input_len > 0 && input != std::ptr::null_mut() {
+        let slice = build_slice!(input, input_len as usize);
+        if probe(slice, direction) {
+            return unsafe { ALPROTO_QUIC };
+        }
+    }
+    return ALPROTO_UNKNOWN;
+}
+
+/// Bypass the flows once the handshake is done, rather than only
+/// disable their inspection.
+#[no_mangle]
+pub extern "C" fn rs_quic_set_bypass(bypass: bool) {
+    unsafe {
+        QUIC_BYPASS = bypass;
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_new() -> *mut libc::c_void {
+    let state = QuicState::new();
+    let boxed = Box::new(state);
+    return unsafe { transmute(boxed) };
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_free(state: *mut libc::c_void) {
+    // Just unbox...
+    let _drop: Box<QuicState> = unsafe { transmute(state) };
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_tx_free(state: *mut libc::c_void,
+                                        tx_id: libc::uint64_t)
+{
+    let state = cast_pointer!(state, QuicState);
+    state.free_tx(tx_id);
+}
+
+fn quic_parse(state: *mut libc::c_void, pstate: *mut libc::c_void,
+              input: *const libc::uint8_t, input_len: u32, client: bool) -> i32
+{
+    if input_len == 0 || input == std::ptr::null_mut() {
+        return 1;
+    }
+    let state = cast_pointer!(state, QuicState);
+    let buf = build_slice!(input, input_len as usize);
+    if !state.parse(buf, client) {
+        return -1;
+    }
+    if state.handshake_done {
+        let mut flags = APP_LAYER_PARSER_NO_INSPECTION;
+        if unsafe { QUIC_BYPASS } {
+            flags |= APP_LAYER_PARSER_BYPASS_READY;
+        }
+        unsafe {
+            AppLayerParserStateSetFlag(pstate, flags);
+        }
+    }
+    return 1;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_parse_ts(_flow: *const Flow,
+                                   state: *mut libc::c_void,
+                                   pstate: *mut libc::c_void,
+                                   input: *const libc::uint8_t,
+                                   input_len: u32,
+                                   _data: *const libc::c_void,
+                                   _flags: u8) -> i32
+{
+    quic_parse(state, pstate, input, input_len, true)
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_parse_tc(_flow: *const Flow,
+                                   state: *mut libc::c_void,
+                                   pstate: *mut libc::c_void,
+                                   input: *const libc::uint8_t,
+                                   input_len: u32,
+                                   _data: *const libc::c_void,
+                                   _flags: u8) -> i32
+{
+    quic_parse(state, pstate, input, input_len, false)
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_get_tx(state: *mut libc::c_void,
+                                       tx_id: libc::uint64_t)
+                                       -> *mut libc::c_void
+{
+    let state = cast_pointer!(state, QuicState);
+    match state.get_tx(tx_id) {
+        Some(tx) => {
+            return unsafe { transmute(tx) };
+        }
+        None => {
+            return std::ptr::null_mut();
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_get_tx_count(state: *mut libc::c_void)
+                                             -> libc::uint64_t
+{
+    let state = cast_pointer!(state, QuicState);
+    return state.tx_id;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_progress_completion_status(
+    _direction: libc::uint8_t) -> libc::c_int
+{
+    return 1;
+}
+
+/// A transaction is complete as soon as it is made.
+#[no_mangle]
+pub extern "C" fn rs_quic_tx_get_alstate_progress(_tx: *mut libc::c_void,
+                                                  _direction: libc::uint8_t)
+                                                  -> libc::c_int
+{
+    return 1;
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_tx_get_logged(_state: *mut libc::c_void,
+                                        tx: *mut libc::c_void) -> u32
+{
+    let tx = cast_pointer!(tx, QuicTransaction);
+    return tx.logged.get();
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_tx_set_logged(_state: *mut libc::c_void,
+                                        tx: *mut libc::c_void,
+                                        logged: libc::uint32_t)
+{
+    let tx = cast_pointer!(tx, QuicTransaction);
+    tx.logged.set(logged);
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_get_events(state: *mut libc::c_void,
+                                           tx_id: libc::uint64_t)
+                                           -> *mut core::AppLayerDecoderEvents
+{
+    let state = cast_pointer!(state, QuicState);
+    match state.get_tx(tx_id) {
+        Some(tx) => tx.events,
+        _ => std::ptr::null_mut(),
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_get_event_info(
+    event_name: *const libc::c_char,
+    event_id: *mut libc::c_int,
+    event_type: *mut core::AppLayerEventType)
+    -> libc::c_int
+{
+    if event_name == std::ptr::null() {
+        return -1;
+    }
+    let c_event_name: &CStr = unsafe { CStr::from_ptr(event_name) };
+    let event = match c_event_name.to_str() {
+        Ok(s) => {
+            match s {
+                "invalid_header" => QuicEvent::InvalidHeader as i32,
+                _ => -1, // unknown event
+            }
+        },
+        Err(_) => -1, // UTF-8 conversion failed
+    };
+    unsafe {
+        *event_type = core::APP_LAYER_EVENT_TYPE_TRANSACTION;
+        *event_id = event as libc::c_int;
+    };
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn rs_quic_state_get_tx_iterator(
+    _ipproto: libc::uint8_t,
+    _alproto: AppProto,
+    state: *mut libc::c_void,
+    min_tx_id: libc::uint64_t,
+    _max_tx_id: libc::uint64_t,
+    istate: &mut libc::uint64_t)
+    -> applayer::AppLayerGetTxIterTuple
+{
+    let state = cast_pointer!(state, QuicState);
+    match state.tx_iterator(min_tx_id, istate) {
+        Some((tx, out_tx_id, has_next)) => {
+            let c_tx = unsafe { transmute(tx) };
+            let ires = applayer::AppLayerGetTxIterTuple::with_values(
+                c_tx, out_tx_id, has_next);
+            return ires;
+        }
+        None => {
+            return applayer::AppLayerGetTxIterTuple::not_found();
+        }
+    }
+}
+
+const PARSER_NAME: &'static [u8] = b"quic\0";
+
+#[no_mangle]
+pub unsafe extern "C" fn rs_quic_register_parser() {
+    let default_port = CString::new("[443]").unwrap();
+    let parser = RustParser {
+        name: PARSER_NAME.as_ptr() as *const libc::c_char,
+        default_port: default_port.as_ptr(),
+        ipproto: IPPROTO_UDP,
+        probe_ts: rs_quic_probing_parser,
+        probe_tc: rs_quic_probing_parser,
+        min_depth: 0,
+        max_depth: 16,
+        state_new: rs_quic_state_new,
+        state_free: rs_quic_state_free,
+        tx_free: rs_quic_state_tx_free,
+        parse_ts: rs_quic_parse_ts,
+        parse_tc: rs_quic_parse_tc,
+        get_tx_count: rs_quic_state_get_tx_count,
+        get_tx: rs_quic_state_get_tx,
+        tx_get_comp_st: rs_quic_state_progress_completion_status,
+        tx_get_progress: rs_quic_tx_get_alstate_progress,
+        get_tx_logged: Some(rs_quic_tx_get_logged),
+        set_tx_logged: Some(rs_quic_tx_set_logged),
+        get_de_state: rs_quic_tx_get_detect_state,
+        set_de_state: rs_quic_tx_set_detect_state,
+        get_events: Some(rs_quic_state_get_events),
+        get_eventinfo: Some(rs_quic_state_get_event_info),
+        localstorage_new: None,
+        localstorage_free: None,
+        get_tx_mpm_id: None,
+        set_tx_mpm_id: None,
+        get_files: None,
+        get_tx_iterator: Some(rs_quic_state_get_tx_iterator),
+    };
+
+    let ip_proto_str = CString::new("udp").unwrap();
+
+    if AppLayerProtoDetectConfProtoDetectionEnabled(ip_proto_str.as_ptr(),
+                                                    parser.name) != 0
+    {
+        let alproto = AppLayerRegisterProtocolDetection(&parser, 1);
+        ALPROTO_QUIC = alproto;
+        if AppLayerParserConfParserEnabled(ip_proto_str.as_ptr(),
+                                           parser.name) != 0
+        {
+            let _ = AppLayerRegisterParser(&parser, alproto);
+        }
+        SCLogDebug!("Rust quic parser registered.");
+    } else {
+        SCLogDebug!("Protocol detector and parser disabled for QUIC.");
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_quic_gquic_handshake() {
+        let mut state = QuicState::new();
+
+        // Q043 client hello, padded
+        let mut buf = vec![0x09, 1, 2, 3, 4, 5, 6, 7, 8, b'Q', b'0', b'4', b'3', 0x01];
+        buf.extend_from_slice(&[0u8; 16]);
+        buf.extend_from_slice(b"CHLO\x01\x00\x00\x00SNI\x00\x0b\x00\x00\x00example.com");
+        buf.resize(QUIC_MIN_INITIAL_SIZE, 0);
+        assert!(probe(&buf, core::STREAM_TOSERVER));
+        assert!(state.parse(&buf, true));
+        assert_eq!(state.transactions.len(), 1);
+        assert_eq!(state.transactions[0].sni, Some(b"example.com".to_vec()));
+        assert!(!state.handshake_done);
+
+        // server reply, then the client drops the version
+        assert!(state.parse(&[0x08, 1, 2, 3, 4, 5, 6, 7, 8, 0x01, 0xaa], false));
+        assert!(!state.handshake_done);
+        assert!(state.parse(&[0x08, 1, 2, 3, 4, 5, 6, 7, 8, 0x02, 0xaa], true));
+        assert!(state.handshake_done);
+    }
+
+    #[test]
+    fn test_quic_ietf_handshake() {
+        let mut state = QuicState::new();
+        let mut buf = vec![0xc3, 0xff, 0x00, 0x00, 0x17, 0x08,
+                           1, 2, 3, 4, 5, 6, 7, 8, 0x00];
+        assert!(!probe(&buf, core::STREAM_TOSERVER));
+        buf.resize(QUIC_MIN_INITIAL_SIZE, 0);
+        assert!(probe(&buf, core::STREAM_TOSERVER));
+        assert!(state.parse(&buf, true));
+        assert_eq!(state.transactions.len(), 1);
+        assert_eq!(state.transactions[0].version, 0xff00_0017);
+        assert_eq!(state.transactions[0].sni, None);
+
+        // 1-RTT packet from the server
+        assert!(state.parse(&[0x41, 1, 2, 3, 4, 5, 6, 7, 8, 0xaa], false));
+        assert!(state.handshake_done);
+    }
+}
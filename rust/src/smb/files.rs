@@ -15,6 +15,8 @@
  * 02110-1301, USA.
  */
 
+use std::sync::atomic::{AtomicUsize, Ordering};
+
 use core::*;
 use log::*;
 use filetracker::*;
@@ -22,6 +24,82 @@ use filecontainer::*;
 
 use smb::smb::*;
 
+/// Default memcap for the out of order file data queued by all SMB flows.
+pub const SMB_DEFAULT_FILE_OOO_MEMCAP: u64 = 64 * 1024 * 1024;
+
+static mut SMB_CFG_FILE_OOO_MEMCAP: u64 = SMB_DEFAULT_FILE_OOO_MEMCAP;
+static SMB_FILE_OOO_MEMUSE: AtomicUsize = AtomicUsize::new(0);
+
+/// Out of order file data a file keeps in memory before complete chunks
+/// go to a temporary file. 0 keeps all in memory.
+static mut SMB_CFG_FILE_OOO_SPILL_SIZE: u64 = 0;
+
+#[no_mangle]
+pub extern "C" fn rs_smb_set_file_ooo_memcap(memcap: u64)
+{
+    unsafe {
+        SMB_CFG_FILE_OOO_MEMCAP = memcap;
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn rs_smb_set_file_ooo_spill_size(size: u64)
+{
+    unsafe {
+        SMB_CFG_FILE_OOO_SPILL_SIZE = size;
+    }
+}
+
+/// After a gap in the session the holes in a file may never be filled, so
+/// its queue may never be released. Such a file may then only queue this
+/// part of the memcap, 2mb with the default memcap, before it's truncated,
+/// so that a few files on a gappy session can't take all of it.
+const SMB_FILE_OOO_GAP_MEMCAP_DIV: u64 = 32;
+
+/// Out of order data a file may queue once its session had a gap.
+fn filetracker_gap_limit(memcap: u64) -> u64 {
+    memcap / SMB_FILE_OOO_GAP_MEMCAP_DIV
+}
+
+/// Account for the out of order data of a tracker going from 'before'
+/// to 'after' bytes. Returns false if this put the data queued by all
+/// flows over the memcap. The caller then truncates the file, which
+/// drops its queue, and gives all of 'after' back.
+fn filetracker_memcap_account(memuse: &AtomicUsize, memcap: u64,
+        before: usize, after: usize) -> bool
+{
+    if after < before {
+        memuse.fetch_sub(before - after, Ordering::Relaxed);
+    } else if after > before {
+        let total = memuse.fetch_add(after - before, Ordering::Relaxed)
+            + (after - before);
+        if total as u64 > memcap {
+            SCLogDebug!("SMB file ooo memuse {} over memcap {}", total, memcap);
+            return false;
+        }
+    }
+    true
+}
+
+/// Run 'f' on a file tracker and account for the change in the out of
+/// order data it has queued. If the data queued by all SMB flows is over
+/// the memcap after the tracker queued more, its file is truncated, which
+/// drops its queue.
+fn filetracker_memcap_run<F>(ft: &mut FileTransferTracker,
+        files: &mut FileContainer, flags: u16, f: F) -> u32
+    where F: FnOnce(&mut FileTransferTracker, &mut FileContainer) -> u32
+{
+    let before = ft.get_queued_size() as usize;
+    let r = f(ft, files);
+    let after = ft.get_queued_size() as usize;
+    let memcap = unsafe { SMB_CFG_FILE_OOO_MEMCAP };
+    if !filetracker_memcap_account(&SMB_FILE_OOO_MEMUSE, memcap, before, after) {
+        ft.trunc(files, flags);
+        SMB_FILE_OOO_MEMUSE.fetch_sub(after, Ordering::Relaxed);
+    }
+    r
+}
+
 /// File tracking transaction. Single direction only.
 #[derive(Debug)]
 pub struct SMBTransactionFile {
@@ -44,6 +122,15 @@ impl SMBTransactionFile {
     }
 }
 
+impl Drop for SMBTransactionFile {
+    fn drop(&mut self) {
+        let queued = self.file_tracker.get_queued_size() as usize;
+        if queued > 0 {
+            SMB_FILE_OOO_MEMUSE.fetch_sub(queued, Ordering::Relaxed);
+        }
+    }
+}
+
 /// Wrapper around Suricata's internal file container logic.
 #[derive(Debug)]
 pub struct SMBFiles {
@@ -84,12 +171,26 @@ pub fn filetracker_newchunk(ft: &mut FileTransferTracker, files: &mut FileContai
 {
     match unsafe {SURICATA_SMB_FILE_CONFIG} {
         Some(sfcm) => {
-            ft.new_chunk(sfcm, files, flags, &name, data, chunk_offset,
-                    chunk_size, fill_bytes, is_last, xid); }
+            ft.set_ooo_spill_size(unsafe { SMB_CFG_FILE_OOO_SPILL_SIZE });
+            filetracker_memcap_run(ft, files, flags, |ft, files| {
+                ft.new_chunk(sfcm, files, flags, &name, data, chunk_offset,
+                        chunk_size, fill_bytes, is_last, xid)
+            });
+        }
         None => panic!("BUG"),
     }
 }
 
+/// little wrapper around the FileTransferTracker::close method
+pub fn filetracker_close(ft: &mut FileTransferTracker, files: &mut FileContainer,
+        flags: u16)
+{
+    filetracker_memcap_run(ft, files, flags, |ft, files| {
+        ft.close(files, flags);
+        0
+    });
+}
+
 impl SMBState {
     pub fn new_file_tx(&mut self, fuid: &Vec<u8>, file_name: &Vec<u8>, direction: u8)
         -> (&mut SMBTransaction, &mut FileContainer, u16)
@@ -193,17 +294,18 @@ impl SMBState {
         let consumed = match self.get_file_tx_by_fuid(&file_handle, direction) {
             Some((tx, files, flags)) => {
                 if let Some(SMBTransactionTypeData::FILE(ref mut tdf)) = tx.type_data {
-                    if ssn_gap {
-                        let queued_data = tdf.file_tracker.get_queued_size();
-                        if queued_data > 2000000 { // TODO should probably be configurable
-                            SCLogDebug!("QUEUED size {} while we've seen GAPs. Truncating file.", queued_data);
-                            tdf.file_tracker.trunc(files, flags);
-                        }
-                    }
-
                     let file_data = &data[0..data_to_handle_len];
-                    let cs = tdf.file_tracker.update(files, flags, file_data, gap_size);
-                    cs
+                    filetracker_memcap_run(&mut tdf.file_tracker, files, flags, |ft, files| {
+                        if ssn_gap {
+                            let queued_data = ft.get_queued_size();
+                            let limit = filetracker_gap_limit(unsafe { SMB_CFG_FILE_OOO_MEMCAP });
+                            if queued_data > limit {
+                                SCLogDebug!("QUEUED size {} while we've seen GAPs. Truncating file.", queued_data);
+                                ft.trunc(files, flags);
+                            }
+                        }
+                        ft.update(files, flags, file_data, gap_size)
+                    })
                 } else {
                     0
                 }
@@ -231,3 +333,49 @@ pub extern "C" fn rs_smb_setfileflags(direction: u8, ptr: *mut SMBState, flags:
     SCLogDebug!("direction {} flags {}", direction, flags);
     parser.setfileflags(direction, flags)
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_file_ooo_memcap_insert_release() {
+        let memuse = AtomicUsize::new(0);
+        // two files queue out of order chunks
+        assert!(filetracker_memcap_account(&memuse, 100, 0, 30));
+        assert!(filetracker_memcap_account(&memuse, 100, 0, 40));
+        assert_eq!(memuse.load(Ordering::Relaxed), 70);
+        // the first file gets the data in front of its queue
+        assert!(filetracker_memcap_account(&memuse, 100, 30, 10));
+        assert_eq!(memuse.load(Ordering::Relaxed), 50);
+        // no change
+        assert!(filetracker_memcap_account(&memuse, 100, 10, 10));
+        assert_eq!(memuse.load(Ordering::Relaxed), 50);
+        // both queues released
+        assert!(filetracker_memcap_account(&memuse, 100, 10, 0));
+        assert!(filetracker_memcap_account(&memuse, 100, 40, 0));
+        assert_eq!(memuse.load(Ordering::Relaxed), 0);
+    }
+
+    #[test]
+    fn test_file_ooo_memcap_trunc() {
+        let memuse = AtomicUsize::new(0);
+        assert!(filetracker_memcap_account(&memuse, 100, 0, 60));
+        // right at the cap is still ok
+        assert!(filetracker_memcap_account(&memuse, 100, 0, 40));
+        assert_eq!(memuse.load(Ordering::Relaxed), 100);
+        // one over it is not, the caller truncates and gives it all back
+        assert!(!filetracker_memcap_account(&memuse, 100, 40, 41));
+        memuse.fetch_sub(41, Ordering::Relaxed);
+        assert_eq!(memuse.load(Ordering::Relaxed), 60);
+        // releasing data never fails, even when over the cap
+        assert!(filetracker_memcap_account(&memuse, 50, 60, 20));
+        assert_eq!(memuse.load(Ordering::Relaxed), 20);
+    }
+
+    #[test]
+    fn test_file_ooo_gap_limit() {
+        assert_eq!(filetracker_gap_limit(SMB_DEFAULT_FILE_OOO_MEMCAP), 2 * 1024 * 1024);
+        assert_eq!(filetracker_gap_limit(0), 0);
+    }
+}
@@ -1958,6 +1958,29 @@ pub extern "C" fn rs_smb_state_get_tx_count(state: &mut SMBState)
     return state.tx_id;
 }
 
+/// Estimate of the memory held by the state, for the app-layer memcap:
+/// the record buffers, the transactions, the out of order file data they
+/// queue and the entries of the lookup maps.
+#[no_mangle]
+pub extern "C" fn rs_smb_state_get_memuse(state: &SMBState) -> u64
+{
+    let mut size = std::mem::size_of::<SMBState>()
+        + state.tcp_buffer_ts.capacity()
+        + state.tcp_buffer_tc.capacity()
+        + state.transactions.capacity() * std::mem::size_of::<SMBTransaction>();
+    for tx in &state.transactions {
+        if let Some(SMBTransactionTypeData::FILE(ref tdf)) = tx.type_data {
+            size += tdf.file_tracker.get_queued_size() as usize;
+        }
+    }
+    size += state.ssn2vec_map.len() * std::mem::size_of::<(SMBCommonHdr, Vec<u8>)>()
+        + state.guid2name_map.len() * std::mem::size_of::<(Vec<u8>, Vec<u8>)>()
+        + state.ssn2vecoffset_map.len() * std::mem::size_of::<(SMBCommonHdr, SMBFileGUIDOffset)>()
+        + state.ssn2tree_map.len() * std::mem::size_of::<(SMBCommonHdr, SMBTree)>()
+        + state.ssnguid2vec_map.len() * std::mem::size_of::<(SMBHashKeyHdrGuid, Vec<u8>)>();
+    return size as u64;
+}
+
 #[no_mangle]
 pub extern "C" fn rs_smb_state_get_tx(state: &mut SMBState,
                                       tx_id: libc::uint64_t)
@@ -156,7 +156,7 @@ fn smb1_close_file(state: &mut SMBState, fid: &Vec<u8>)
             if let Some(SMBTransactionTypeData::FILE(ref mut tdf)) = tx.type_data {
                 if !tx.request_done {
                     SCLogDebug!("closing file tx {} FID {:?}", tx.id, fid);
-                    tdf.file_tracker.close(files, flags);
+                    filetracker_close(&mut tdf.file_tracker, files, flags);
                     tx.request_done = true;
                     tx.response_done = true;
                     SCLogDebug!("tx {} is done", tx.id);
@@ -171,7 +171,7 @@ fn smb1_close_file(state: &mut SMBState, fid: &Vec<u8>)
             if let Some(SMBTransactionTypeData::FILE(ref mut tdf)) = tx.type_data {
                 if !tx.request_done {
                     SCLogDebug!("closing file tx {} FID {:?}", tx.id, fid);
-                    tdf.file_tracker.close(files, flags);
+                    filetracker_close(&mut tdf.file_tracker, files, flags);
                     tx.request_done = true;
                     tx.response_done = true;
                     SCLogDebug!("tx {} is done", tx.id);
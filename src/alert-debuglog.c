@@ -79,11 +79,13 @@ static void AlertDebugLogFlowVars(AlertDebugLogThread *aft, const Packet *p)
     uint16_t i;
     while (gv != NULL) {
         if (gv->type == DETECT_FLOWBITS) {
-            FlowBit *fb = (FlowBit *)gv;
-            const char *fbname = VarNameStoreLookupById(fb->idx, VAR_TYPE_FLOW_BIT);
-            if (fbname) {
-                MemBufferWriteString(aft->buffer, "FLOWBIT:           %s\n",
-                        fbname);
+            const FlowBit *fb = (const FlowBit *)gv;
+            for (uint32_t idx = 0; FlowBitNext(fb, &idx) == 1; idx++) {
+                const char *fbname = VarNameStoreLookupById(idx, VAR_TYPE_FLOW_BIT);
+                if (fbname) {
+                    MemBufferWriteString(aft->buffer, "FLOWBIT:           %s\n",
+                            fbname);
+                }
             }
         } else if (gv->type == DETECT_FLOWVAR || gv->type == DETECT_FLOWINT) {
             FlowVar *fv = (FlowVar *) gv;
@@ -131,6 +131,11 @@ typedef struct DCERPCHdrUdp_ {
 
 #define DCERPC_UDP_HDR_LEN 80
 
+/** max size of the stub data buffered for a request or response */
+#define DCERPC_STUB_DATA_MAX        (1024 * 1024)
+/** first allocation of a stub data buffer, it doubles from there */
+#define DCERPC_STUB_DATA_MIN_SIZE   4096
+
 #define DCERPC_UUID_ENTRY_FLAG_FF       0x0001  /**< FIRST flag set on the packet
                                                   that contained this uuid entry */
 
@@ -172,6 +177,8 @@ typedef struct DCERPCRequest_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     uint8_t first_request_seen;
     bool stub_data_buffer_reset;
 } DCERPCRequest;
@@ -181,6 +188,8 @@ typedef struct DCERPCResponse_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     bool stub_data_buffer_reset;
 } DCERPCResponse;
 
@@ -236,6 +245,8 @@ typedef struct DCERPCUDP_ {
 #define NO_PSAP_AVAILABLE               7 /* not used */
 
 int32_t DCERPCParser(DCERPC *, uint8_t *, uint32_t);
+int DCERPCStubDataAppend(uint8_t **, uint32_t *, uint32_t *,
+        const uint8_t *, uint32_t);
 void hexdump(const void *buf, size_t len);
 void printUUID(const char *type, DCERPCUuidEntry *uuid);
 
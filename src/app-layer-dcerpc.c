@@ -1168,6 +1168,55 @@ static uint32_t DCERPCParseREQUEST(DCERPC *dcerpc, uint8_t *input, uint32_t inpu
     SCReturnUInt((uint32_t)(p - input));
 }
 
+/**
+ * \brief Append data to a stub data buffer.
+ *
+ * The buffer grows by doubling its size, so a stub that comes in many
+ * fragments isn't copied over on every fragment. After a reset of the
+ * length to 0 the allocation is reused for the next stub.
+ *
+ * \param buf      the buffer, NULL if not yet allocated
+ * \param len      length of the data in the buffer
+ * \param size     allocated size of the buffer
+ * \param data     data to append
+ * \param data_len length of data
+ *
+ * \retval 0 on success
+ * \retval -1 if the stub would exceed DCERPC_STUB_DATA_MAX or on allocation
+ *         failure, the buffer is freed in that case
+ */
+int DCERPCStubDataAppend(uint8_t **buf, uint32_t *len, uint32_t *size,
+        const uint8_t *data, uint32_t data_len)
+{
+    if (data_len > DCERPC_STUB_DATA_MAX - *len)
+        goto error;
+
+    const uint32_t needed = *len + data_len;
+    if (needed > *size) {
+        uint32_t new_size = *size ? *size : DCERPC_STUB_DATA_MIN_SIZE;
+        while (new_size < needed)
+            new_size *= 2;
+        new_size = MIN(new_size, DCERPC_STUB_DATA_MAX);
+
+        uint8_t *ptmp = SCRealloc(*buf, new_size);
+        if (ptmp == NULL)
+            goto error;
+        *buf = ptmp;
+        *size = new_size;
+    }
+
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+
+error:
+    SCFree(*buf);
+    *buf = NULL;
+    *len = 0;
+    *size = 0;
+    return -1;
+}
+
 /** \internal
  *  \retval stub_len or 0 in case of error */
 static uint32_t StubDataParser(DCERPC *dcerpc, const uint8_t *input, uint32_t input_len)
@@ -1175,6 +1224,7 @@ static uint32_t StubDataParser(DCERPC *dcerpc, const uint8_t *input, uint32_t in
     SCEnter();
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
 
     SCLogDebug("input_len %u", input_len);
 
@@ -1182,6 +1232,7 @@ static uint32_t StubDataParser(DCERPC *dcerpc, const uint8_t *input, uint32_t in
     if (dcerpc->dcerpchdr.type == REQUEST) {
         stub_data_buffer = &dcerpc->dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcrequest.stub_data_buffer_size;
 
         SCLogDebug("REQUEST stub_data_buffer_len %u", *stub_data_buffer_len);
 
@@ -1189,14 +1240,10 @@ static uint32_t StubDataParser(DCERPC *dcerpc, const uint8_t *input, uint32_t in
     } else {
         stub_data_buffer = &dcerpc->dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcresponse.stub_data_buffer_size;
 
         SCLogDebug("RESPONSE stub_data_buffer_len %u", *stub_data_buffer_len);
     }
-    if (*stub_data_buffer_len > (1024 * 1024)) {
-        SCFree(*stub_data_buffer);
-        *stub_data_buffer = NULL;
-        SCReturnUInt(0);
-    }
 
     uint32_t stub_len = MIN(dcerpc->padleft, input_len);
     if (stub_len == 0) {
@@ -1218,18 +1265,11 @@ static uint32_t StubDataParser(DCERPC *dcerpc, const uint8_t *input, uint32_t in
         }
     }
 
-    void *ptmp = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
-    if (ptmp == NULL) {
-        SCFree(*stub_data_buffer);
-        *stub_data_buffer = NULL;
+    if (DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                stub_data_buffer_size, input, stub_len) != 0) {
+        SCLogDebug("stub data over %u bytes or alloc failure", DCERPC_STUB_DATA_MAX);
         SCReturnUInt(0);
     }
-    *stub_data_buffer = ptmp;
-
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
-
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
     /* To see the total reassembled stubdata */
     //hexdump(*stub_data_buffer, *stub_data_buffer_len);
 
@@ -1978,14 +2018,37 @@ void DCERPCCleanup(DCERPC *dcerpc)
         SCFree(dcerpc->dcerpcrequest.stub_data_buffer);
         dcerpc->dcerpcrequest.stub_data_buffer = NULL;
         dcerpc->dcerpcrequest.stub_data_buffer_len = 0;
+        dcerpc->dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (dcerpc->dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(dcerpc->dcerpcresponse.stub_data_buffer);
         dcerpc->dcerpcresponse.stub_data_buffer = NULL;
         dcerpc->dcerpcresponse.stub_data_buffer_len = 0;
+        dcerpc->dcerpcresponse.stub_data_buffer_size = 0;
     }
 }
 
+/** \internal
+ *  \brief estimate of the memory held by the state: the buffered stub data
+ *         and the interface uuids of the binds
+ */
+static uint64_t DCERPCStateGetMemuse(void *alstate)
+{
+    const DCERPC *dcerpc = &((DCERPCState *)alstate)->dcerpc;
+    uint64_t size = sizeof(DCERPCState) +
+        dcerpc->dcerpcrequest.stub_data_buffer_size +
+        dcerpc->dcerpcresponse.stub_data_buffer_size;
+
+    const DCERPCUuidEntry *uuid_entry;
+    TAILQ_FOREACH(uuid_entry, &dcerpc->dcerpcbindbindack.uuid_list, next) {
+        size += sizeof(*uuid_entry);
+    }
+    TAILQ_FOREACH(uuid_entry, &dcerpc->dcerpcbindbindack.accepted_uuid_list, next) {
+        size += sizeof(*uuid_entry);
+    }
+    return size;
+}
+
 static void DCERPCStateFree(void *s)
 {
     DCERPCState *sstate = (DCERPCState *) s;
@@ -2092,6 +2155,10 @@ void RegisterDCERPCParsers(void)
 
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_DCERPC,
                                                                DCERPCGetAlstateProgressCompletionStatus);
+
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_DCERPC,
+                DCERPCStateGetMemuse);
+        AppLayerParserRegisterMemcap(IPPROTO_TCP, ALPROTO_DCERPC);
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -5066,6 +5133,48 @@ end:
     return result;
 }
 
+/**
+ * \test Stub data buffer growth, reuse after a reset and the size cap.
+ */
+static int DCERPCParserTest20(void)
+{
+    uint8_t frag[1000];
+    uint8_t *buf = NULL;
+    uint32_t len = 0;
+    uint32_t size = 0;
+
+    memset(frag, 0x42, sizeof(frag));
+
+    FAIL_IF(DCERPCStubDataAppend(&buf, &len, &size, frag, sizeof(frag)) != 0);
+    FAIL_IF_NULL(buf);
+    FAIL_IF(len != 1000);
+    FAIL_IF(size != DCERPC_STUB_DATA_MIN_SIZE);
+
+    for (int i = 0; i < 9; i++) {
+        FAIL_IF(DCERPCStubDataAppend(&buf, &len, &size, frag, sizeof(frag)) != 0);
+    }
+    FAIL_IF(len != 10000);
+    FAIL_IF(size != 4 * DCERPC_STUB_DATA_MIN_SIZE);
+    FAIL_IF(buf[9999] != 0x42);
+
+    /* a new stub reuses the buffer */
+    uint8_t *old = buf;
+    len = 0;
+    FAIL_IF(DCERPCStubDataAppend(&buf, &len, &size, frag, sizeof(frag)) != 0);
+    FAIL_IF(buf != old);
+    FAIL_IF(len != 1000);
+
+    /* the stub is dropped if it gets over the max */
+    while (len + sizeof(frag) <= DCERPC_STUB_DATA_MAX) {
+        FAIL_IF(DCERPCStubDataAppend(&buf, &len, &size, frag, sizeof(frag)) != 0);
+    }
+    FAIL_IF(size != DCERPC_STUB_DATA_MAX);
+    FAIL_IF(DCERPCStubDataAppend(&buf, &len, &size, frag, sizeof(frag)) != -1);
+    FAIL_IF_NOT_NULL(buf);
+    FAIL_IF(len != 0 || size != 0);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DCERPCParserRegisterTests(void)
@@ -5089,6 +5198,7 @@ void DCERPCParserRegisterTests(void)
     UtRegisterTest("DCERPCParserTest17", DCERPCParserTest17);
     UtRegisterTest("DCERPCParserTest18", DCERPCParserTest18);
     UtRegisterTest("DCERPCParserTest19", DCERPCParserTest19);
+    UtRegisterTest("DCERPCParserTest20", DCERPCParserTest20);
 #endif /* UNITTESTS */
 
     return;
@@ -0,0 +1,353 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Cache of the detected protocol per server endpoint.
+ *
+ * Most servers speak the same protocol on a port for every flow. The
+ * protocol detected for a flow is stored under its server ip, port,
+ * ipproto and vlan. The next flow to the same endpoint only has the
+ * patterns and probing parser of the cached protocol checked against its
+ * first data; if they don't agree the entry is dropped and the full
+ * detection runs.
+ *
+ * The table has a fixed size and is split in sets of ALPD_CACHE_WAYS
+ * entries, each with its own lock. A new entry replaces the least
+ * recently used one of its set.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "flow.h"
+#include "app-layer-protos.h"
+#include "app-layer-detect-proto-cache.h"
+#include "util-hash-lookup3.h"
+#include "util-random.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+typedef struct AlpdCacheEntry_ {
+    uint32_t addr[4];
+    uint16_t port;
+    uint16_t vlan;
+    uint8_t ipproto;
+    uint8_t ipv6;
+    AppProto alproto;   /**< ALPROTO_UNKNOWN if unused */
+    uint32_t used;      /**< set tick of last use */
+} AlpdCacheEntry;
+
+typedef struct AlpdCacheSet_ {
+    SCSpinlock lock;
+    uint32_t tick;
+    AlpdCacheEntry e[ALPD_CACHE_WAYS];
+} AlpdCacheSet;
+
+typedef struct AlpdCache_ {
+    AlpdCacheSet *sets;
+    uint32_t nsets;
+    uint32_t seed;
+} AlpdCache;
+
+static AlpdCache alpd_cache = { NULL, 0, 0 };
+
+SC_ATOMIC_DECLARE(uint64_t, alpd_cache_hits);
+SC_ATOMIC_DECLARE(uint64_t, alpd_cache_misses);
+SC_ATOMIC_DECLARE(uint64_t, alpd_cache_invalidated);
+
+static int AlpdCacheInit(uint32_t size)
+{
+    uint32_t nsets = (size + ALPD_CACHE_WAYS - 1) / ALPD_CACHE_WAYS;
+    if (nsets == 0)
+        nsets = 1;
+
+    AlpdCacheSet *sets = SCCalloc(nsets, sizeof(AlpdCacheSet));
+    if (sets == NULL)
+        return -1;
+    for (uint32_t i = 0; i < nsets; i++) {
+        SCSpinInit(&sets[i].lock, 0);
+    }
+    alpd_cache.sets = sets;
+    alpd_cache.nsets = nsets;
+    alpd_cache.seed = (uint32_t)RandomGet();
+    return 0;
+}
+
+void AppLayerProtoDetectCacheSetup(void)
+{
+    SC_ATOMIC_INIT(alpd_cache_hits);
+    SC_ATOMIC_INIT(alpd_cache_misses);
+    SC_ATOMIC_INIT(alpd_cache_invalidated);
+
+    int enabled = 0;
+    if (ConfGetBool("app-layer.detection-cache.enabled", &enabled) != 1 ||
+            !enabled)
+        return;
+
+    intmax_t size = ALPD_CACHE_SIZE_DEFAULT;
+    if (ConfGetInt("app-layer.detection-cache.size", &size) == 1) {
+        if (size <= 0 || size > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid value for "
+                    "app-layer.detection-cache.size: %"PRIdMAX
+                    ", using default %u", size, ALPD_CACHE_SIZE_DEFAULT);
+            size = ALPD_CACHE_SIZE_DEFAULT;
+        }
+    }
+
+    if (AlpdCacheInit((uint32_t)size) < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc protocol detection "
+                "cache, running without it");
+        return;
+    }
+    SCLogConfig("app-layer protocol detection cache: %u entries",
+            alpd_cache.nsets * ALPD_CACHE_WAYS);
+}
+
+void AppLayerProtoDetectCacheDeSetup(void)
+{
+    if (alpd_cache.sets == NULL)
+        return;
+    for (uint32_t i = 0; i < alpd_cache.nsets; i++) {
+        SCSpinDestroy(&alpd_cache.sets[i].lock);
+    }
+    SCFree(alpd_cache.sets);
+    alpd_cache.sets = NULL;
+    alpd_cache.nsets = 0;
+}
+
+bool AppLayerProtoDetectCacheEnabled(void)
+{
+    return alpd_cache.sets != NULL;
+}
+
+/** \internal
+ *  \brief fill the key of the flow's server endpoint */
+static void AlpdCacheKey(const Flow *f, AlpdCacheEntry *k)
+{
+    memset(k, 0, sizeof(*k));
+    k->addr[0] = f->dst.addr_data32[0];
+    if (FLOW_IS_IPV6(f)) {
+        k->addr[1] = f->dst.addr_data32[1];
+        k->addr[2] = f->dst.addr_data32[2];
+        k->addr[3] = f->dst.addr_data32[3];
+        k->ipv6 = 1;
+    }
+    k->port = f->protodetect_dp ? f->protodetect_dp : f->dp;
+    k->vlan = f->vlan_id[0];
+    k->ipproto = f->proto;
+}
+
+static inline bool AlpdCacheKeyEqual(const AlpdCacheEntry *a, const AlpdCacheEntry *b)
+{
+    return a->alproto != ALPROTO_UNKNOWN &&
+        a->port == b->port && a->ipproto == b->ipproto &&
+        a->vlan == b->vlan && a->ipv6 == b->ipv6 &&
+        memcmp(a->addr, b->addr, sizeof(a->addr)) == 0;
+}
+
+static AlpdCacheSet *AlpdCacheGetSet(const AlpdCacheEntry *k)
+{
+    const uint32_t key[5] = {
+        k->addr[0], k->addr[1], k->addr[2], k->addr[3],
+        ((uint32_t)k->port << 16) | ((uint32_t)k->ipproto << 8) | k->ipv6,
+    };
+    uint32_t hash = hashword(key, 5, alpd_cache.seed ^ k->vlan);
+    return &alpd_cache.sets[hash % alpd_cache.nsets];
+}
+
+/**
+ *  \brief get the cached protocol of the flow's server endpoint
+ *
+ *  \retval alproto or ALPROTO_UNKNOWN if not cached
+ */
+AppProto AppLayerProtoDetectCacheLookup(const Flow *f)
+{
+    if (alpd_cache.sets == NULL)
+        return ALPROTO_UNKNOWN;
+
+    AlpdCacheEntry k;
+    AlpdCacheKey(f, &k);
+    AlpdCacheSet *set = AlpdCacheGetSet(&k);
+
+    AppProto alproto = ALPROTO_UNKNOWN;
+    SCSpinLock(&set->lock);
+    for (int i = 0; i < ALPD_CACHE_WAYS; i++) {
+        if (AlpdCacheKeyEqual(&set->e[i], &k)) {
+            set->e[i].used = ++set->tick;
+            alproto = set->e[i].alproto;
+            break;
+        }
+    }
+    SCSpinUnlock(&set->lock);
+
+    if (alproto == ALPROTO_UNKNOWN)
+        SC_ATOMIC_ADD(alpd_cache_misses, 1);
+    return alproto;
+}
+
+void AppLayerProtoDetectCacheStore(const Flow *f, AppProto alproto)
+{
+    if (alpd_cache.sets == NULL || !AppProtoIsValid(alproto))
+        return;
+
+    AlpdCacheEntry k;
+    AlpdCacheKey(f, &k);
+    AlpdCacheSet *set = AlpdCacheGetSet(&k);
+
+    SCSpinLock(&set->lock);
+    AlpdCacheEntry *e = NULL;
+    for (int i = 0; i < ALPD_CACHE_WAYS; i++) {
+        if (AlpdCacheKeyEqual(&set->e[i], &k)) {
+            e = &set->e[i];
+            break;
+        }
+        /* unused entries have used 0 so they go first */
+        if (e == NULL || set->e[i].used < e->used)
+            e = &set->e[i];
+    }
+    *e = k;
+    e->alproto = alproto;
+    e->used = ++set->tick;
+    SCSpinUnlock(&set->lock);
+}
+
+void AppLayerProtoDetectCacheRemove(const Flow *f)
+{
+    if (alpd_cache.sets == NULL)
+        return;
+
+    AlpdCacheEntry k;
+    AlpdCacheKey(f, &k);
+    AlpdCacheSet *set = AlpdCacheGetSet(&k);
+
+    SCSpinLock(&set->lock);
+    for (int i = 0; i < ALPD_CACHE_WAYS; i++) {
+        if (AlpdCacheKeyEqual(&set->e[i], &k)) {
+            memset(&set->e[i], 0, sizeof(set->e[i]));
+            break;
+        }
+    }
+    SCSpinUnlock(&set->lock);
+}
+
+void AppLayerProtoDetectCacheCountHit(void)
+{
+    SC_ATOMIC_ADD(alpd_cache_hits, 1);
+}
+
+void AppLayerProtoDetectCacheCountInvalidated(void)
+{
+    SC_ATOMIC_ADD(alpd_cache_invalidated, 1);
+}
+
+uint64_t AppLayerProtoDetectCacheGetHits(void)
+{
+    return SC_ATOMIC_GET(alpd_cache_hits);
+}
+
+uint64_t AppLayerProtoDetectCacheGetMisses(void)
+{
+    return SC_ATOMIC_GET(alpd_cache_misses);
+}
+
+uint64_t AppLayerProtoDetectCacheGetInvalidated(void)
+{
+    return SC_ATOMIC_GET(alpd_cache_invalidated);
+}
+
+/***** Unittests *****/
+
+#ifdef UNITTESTS
+
+static void AlpdCacheTestFlow(Flow *f, uint32_t dst, uint16_t dp)
+{
+    memset(f, 0, sizeof(*f));
+    f->flags |= FLOW_IPV4;
+    f->proto = IPPROTO_TCP;
+    f->dst.addr_data32[0] = dst;
+    f->dp = dp;
+}
+
+/** \test store, lookup and remove */
+static int AppLayerProtoDetectCacheTest01(void)
+{
+    AlpdCache backup = alpd_cache;
+    FAIL_IF(AlpdCacheInit(64) < 0);
+
+    Flow f;
+    AlpdCacheTestFlow(&f, 0x01020304, 8443);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f) != ALPROTO_UNKNOWN);
+    AppLayerProtoDetectCacheStore(&f, ALPROTO_TLS);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f) != ALPROTO_TLS);
+
+    /* other port, other ipproto */
+    Flow f2;
+    AlpdCacheTestFlow(&f2, 0x01020304, 8444);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f2) != ALPROTO_UNKNOWN);
+    AlpdCacheTestFlow(&f2, 0x01020304, 8443);
+    f2.proto = IPPROTO_UDP;
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f2) != ALPROTO_UNKNOWN);
+
+    AppLayerProtoDetectCacheStore(&f, ALPROTO_HTTP);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f) != ALPROTO_HTTP);
+    AppLayerProtoDetectCacheRemove(&f);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f) != ALPROTO_UNKNOWN);
+
+    AppLayerProtoDetectCacheDeSetup();
+    alpd_cache = backup;
+    PASS;
+}
+
+/** \test a full set evicts its least recently used entry */
+static int AppLayerProtoDetectCacheTest02(void)
+{
+    AlpdCache backup = alpd_cache;
+    FAIL_IF(AlpdCacheInit(ALPD_CACHE_WAYS) < 0);
+    FAIL_IF(alpd_cache.nsets != 1);
+
+    Flow f[ALPD_CACHE_WAYS + 1];
+    for (int i = 0; i < ALPD_CACHE_WAYS + 1; i++) {
+        AlpdCacheTestFlow(&f[i], 0x0a000001 + i, 80);
+    }
+    for (int i = 0; i < ALPD_CACHE_WAYS; i++) {
+        AppLayerProtoDetectCacheStore(&f[i], ALPROTO_HTTP);
+    }
+    /* touch the first so the second is the oldest */
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f[0]) != ALPROTO_HTTP);
+    AppLayerProtoDetectCacheStore(&f[ALPD_CACHE_WAYS], ALPROTO_HTTP);
+
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f[0]) != ALPROTO_HTTP);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f[1]) != ALPROTO_UNKNOWN);
+    FAIL_IF(AppLayerProtoDetectCacheLookup(&f[ALPD_CACHE_WAYS]) != ALPROTO_HTTP);
+
+    AppLayerProtoDetectCacheDeSetup();
+    alpd_cache = backup;
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void AppLayerProtoDetectCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerProtoDetectCacheTest01",
+            AppLayerProtoDetectCacheTest01);
+    UtRegisterTest("AppLayerProtoDetectCacheTest02",
+            AppLayerProtoDetectCacheTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Cache of the detected protocol per server endpoint.
+ */
+
+#ifndef __APP_LAYER_DETECT_PROTO_CACHE_H__
+#define __APP_LAYER_DETECT_PROTO_CACHE_H__
+
+#include "flow.h"
+
+/** entries per set, a set is searched linearly and evicts its LRU entry */
+#define ALPD_CACHE_WAYS             4
+#define ALPD_CACHE_SIZE_DEFAULT     4096
+
+void AppLayerProtoDetectCacheSetup(void);
+void AppLayerProtoDetectCacheDeSetup(void);
+bool AppLayerProtoDetectCacheEnabled(void);
+
+AppProto AppLayerProtoDetectCacheLookup(const Flow *f);
+void AppLayerProtoDetectCacheStore(const Flow *f, AppProto alproto);
+void AppLayerProtoDetectCacheRemove(const Flow *f);
+
+uint64_t AppLayerProtoDetectCacheGetHits(void);
+uint64_t AppLayerProtoDetectCacheGetMisses(void);
+uint64_t AppLayerProtoDetectCacheGetInvalidated(void);
+void AppLayerProtoDetectCacheCountHit(void);
+void AppLayerProtoDetectCacheCountInvalidated(void);
+
+void AppLayerProtoDetectCacheRegisterTests(void);
+
+#endif /* __APP_LAYER_DETECT_PROTO_CACHE_H__ */
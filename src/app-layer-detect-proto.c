@@ -56,6 +56,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-detect-proto.h"
 #include "app-layer-expectation.h"
+#include "app-layer-detect-proto-cache.h"
 
 #include "conf.h"
 #include "util-memcmp.h"
@@ -108,6 +109,19 @@ typedef struct AppLayerProtoDetectProbingParser_ {
     struct AppLayerProtoDetectProbingParser_ *next;
 } AppLayerProtoDetectProbingParser;
 
+/**
+ * \brief Compiled port lookup for the probing parsers of one ipproto.
+ *
+ * For each port 'map' holds the 1 based index into 'ports' of the entry
+ * the list walk in AppLayerProtoDetectGetProbingParsers returns, or 0 if
+ * it returns none. Built in AppLayerProtoDetectPrepareState.
+ */
+typedef struct AppLayerProtoDetectPPPortMap_ {
+    uint8_t ipproto;
+    uint16_t *map;
+    AppLayerProtoDetectProbingParserPort **ports;
+} AppLayerProtoDetectPPPortMap;
+
 typedef struct AppLayerProtoDetectPMSignature_ {
     AppProto alproto;
     uint8_t direction;  /**< direction for midstream */
@@ -155,6 +169,12 @@ typedef struct AppLayerProtoDetectCtx_ {
 
     AppLayerProtoDetectProbingParser *ctx_pp;
 
+    /* Compiled port lookup for ctx_pp, per flow proto. Only used while
+     * pp_map_valid is set: registering a parser invalidates it until the
+     * next AppLayerProtoDetectPrepareState. */
+    AppLayerProtoDetectPPPortMap pp_map[FLOW_PROTO_DEFAULT];
+    bool pp_map_valid;
+
     /* Indicates the protocols that have registered themselves
      * for protocol detection.  This table is independent of the
      * ipproto. */
@@ -426,6 +446,22 @@ static AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectGetProbingParser
     SCReturnPtr(pp_port, "AppLayerProtoDetectProbingParserPort *");
 }
 
+/** \internal
+ *  \brief get the probing parsers for a port, using the compiled port
+ *         map if there is one for the ipproto */
+static inline const AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectPPLookup(
+        uint8_t ipproto, uint16_t port)
+{
+    const uint8_t proto_map = FlowGetProtoMapping(ipproto);
+    if (likely(alpd_ctx.pp_map_valid) && proto_map < FLOW_PROTO_DEFAULT) {
+        const AppLayerProtoDetectPPPortMap *m = &alpd_ctx.pp_map[proto_map];
+        if (m->map != NULL && m->ipproto == ipproto) {
+            const uint16_t idx = m->map[port];
+            return idx ? m->ports[idx - 1] : NULL;
+        }
+    }
+    return AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, port);
+}
 
 /**
  * \brief Call the probing expectation to see if there is some for this flow.
@@ -509,7 +545,7 @@ again_midstream:
 
     if (dir == STREAM_TOSERVER) {
         /* first try the destination port */
-        pp_port_dp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, dp);
+        pp_port_dp = AppLayerProtoDetectPPLookup(ipproto, dp);
         alproto_masks = &f->probing_parser_toserver_alproto_masks;
         if (pp_port_dp != NULL) {
             SCLogDebug("toserver - Probing parser found for destination port %"PRIu16, dp);
@@ -520,7 +556,7 @@ again_midstream:
             SCLogDebug("toserver - No probing parser registered for dest port %"PRIu16, dp);
         }
 
-        pp_port_sp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, sp);
+        pp_port_sp = AppLayerProtoDetectPPLookup(ipproto, sp);
         if (pp_port_sp != NULL) {
             SCLogDebug("toserver - Probing parser found for source port %"PRIu16, sp);
 
@@ -531,7 +567,7 @@ again_midstream:
         }
     } else {
         /* first try the destination port */
-        pp_port_dp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, dp);
+        pp_port_dp = AppLayerProtoDetectPPLookup(ipproto, dp);
         alproto_masks = &f->probing_parser_toclient_alproto_masks;
         if (pp_port_dp != NULL) {
             SCLogDebug("toclient - Probing parser found for destination port %"PRIu16, dp);
@@ -542,7 +578,7 @@ again_midstream:
             SCLogDebug("toclient - No probing parser registered for dest port %"PRIu16, dp);
         }
 
-        pp_port_sp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, sp);
+        pp_port_sp = AppLayerProtoDetectPPLookup(ipproto, sp);
         if (pp_port_sp != NULL) {
             SCLogDebug("toclient - Probing parser found for source port %"PRIu16, sp);
 
@@ -1481,6 +1517,76 @@ static int AppLayerProtoDetectPMRegisterPattern(uint8_t ipproto, AppProto alprot
 
 /***** Protocol Retrieval *****/
 
+/** \internal
+ *  \brief check the data against the patterns and the dp probing
+ *         parsers of a cached protocol only
+ *
+ *  \retval alproto the data is of the cached protocol
+ *  \retval ALPROTO_FAILED the data is not of the cached protocol
+ *  \retval ALPROTO_UNKNOWN not enough data to tell, or nothing to check
+ *          the protocol with
+ */
+static AppProto AppLayerProtoDetectCacheVerify(AppLayerProtoDetectThreadCtx *tctx,
+        Flow *f, AppProto alproto, uint8_t *buf, uint32_t buflen,
+        uint8_t ipproto, uint8_t direction)
+{
+    bool checked = false;
+    bool inconclusive = false;
+
+    if (f->protomap < FLOW_PROTO_DEFAULT) {
+        const AppLayerProtoDetectPMCtx *pm_ctx =
+            &alpd_ctx.ctx_ipp[f->protomap].ctx_pm[(direction & STREAM_TOSERVER) ? 0 : 1];
+        const uint16_t searchlen = MIN(buflen, pm_ctx->mpm_ctx.maxdepth);
+
+        for (SigIntId id = 0; id < pm_ctx->max_sig_id; id++) {
+            for (const AppLayerProtoDetectPMSignature *s = pm_ctx->map[id];
+                    s != NULL; s = s->next)
+            {
+                if (s->alproto != alproto)
+                    continue;
+                checked = true;
+                bool rflow = false;
+                AppProto r = AppLayerProtoDetectPMMatchSignature(s, tctx, f,
+                        direction, buf, buflen, searchlen, &rflow);
+                if (r == alproto && !rflow)
+                    return alproto;
+            }
+        }
+        if (checked && buflen < pm_ctx->mpm_ctx.maxdepth)
+            inconclusive = true;
+    }
+
+    /* FLOW_GET_DP() ends in a ';', so it can't be an argument */
+    const uint16_t dp = f->protodetect_dp ? f->protodetect_dp : FLOW_GET_DP(f);
+    const AppLayerProtoDetectProbingParserPort *pp_port =
+        AppLayerProtoDetectPPLookup(ipproto, dp);
+    if (pp_port != NULL) {
+        for (const AppLayerProtoDetectProbingParserElement *pe = pp_port->dp;
+                pe != NULL; pe = pe->next)
+        {
+            if (pe->alproto != alproto || pe->ProbingParserTs == NULL)
+                continue;
+            checked = true;
+            if (buflen < pe->min_depth) {
+                inconclusive = true;
+                continue;
+            }
+            const uint8_t dir = direction & (STREAM_TOSERVER|STREAM_TOCLIENT);
+            uint8_t rdir = 0;
+            AppProto r = pe->ProbingParserTs(f, dir, buf, buflen, &rdir);
+            if (r == alproto && (rdir == 0 || rdir == dir))
+                return alproto;
+            if (r == ALPROTO_UNKNOWN &&
+                    (pe->max_depth == 0 || buflen <= pe->max_depth))
+                inconclusive = true;
+        }
+    }
+
+    if (!checked || inconclusive)
+        return ALPROTO_UNKNOWN;
+    return ALPROTO_FAILED;
+}
+
 AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
                                      Flow *f,
                                      uint8_t *buf, uint32_t buflen,
@@ -1494,6 +1600,28 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     AppProto alproto = ALPROTO_UNKNOWN;
     AppProto pm_alproto = ALPROTO_UNKNOWN;
 
+    /* server endpoint cache: only the toserver side of a flow that hasn't
+     * been through a full detection yet */
+    const bool use_cache = AppLayerProtoDetectCacheEnabled() &&
+        (direction & STREAM_TOSERVER) &&
+        !FLOW_IS_PM_DONE(f, direction) && !FLOW_IS_PP_DONE(f, direction);
+    if (use_cache) {
+        AppProto cached = AppLayerProtoDetectCacheLookup(f);
+        if (cached != ALPROTO_UNKNOWN) {
+            AppProto r = AppLayerProtoDetectCacheVerify(tctx, f, cached,
+                    buf, buflen, ipproto, direction);
+            if (r == cached) {
+                SCLogDebug("cached %s verified", AppProtoToString(cached));
+                AppLayerProtoDetectCacheCountHit();
+                SCReturnUInt(cached);
+            } else if (r == ALPROTO_FAILED) {
+                SCLogDebug("cached %s mismatch", AppProtoToString(cached));
+                AppLayerProtoDetectCacheRemove(f);
+                AppLayerProtoDetectCacheCountInvalidated();
+            }
+        }
+    }
+
     if (!FLOW_IS_PM_DONE(f, direction)) {
         AppProto pm_results[ALPROTO_MAX];
         uint16_t pm_matches = AppLayerProtoDetectPMGetProto(tctx, f,
@@ -1527,12 +1655,18 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     /* Look if flow can be found in expectation list */
     if (!FLOW_IS_PE_DONE(f, direction)) {
         alproto = AppLayerProtoDetectPEGetProto(f, ipproto, direction);
+        /* expected flows are not cached, their server port is dynamic */
+        if (AppProtoIsValid(alproto))
+            SCReturnUInt(alproto);
     }
 
  end:
     if (!AppProtoIsValid(alproto))
         alproto = pm_alproto;
 
+    if (use_cache && AppProtoIsValid(alproto) && !*reverse_flow)
+        AppLayerProtoDetectCacheStore(f, alproto);
+
     SCReturnUInt(alproto);
 }
 
@@ -1555,6 +1689,85 @@ static void AppLayerProtoDetectFreeProbingParsers(AppLayerProtoDetectProbingPars
     SCReturn;
 }
 
+static void AppLayerProtoDetectPPMapFree(void)
+{
+    alpd_ctx.pp_map_valid = false;
+    for (int i = 0; i < FLOW_PROTO_DEFAULT; i++) {
+        AppLayerProtoDetectPPPortMap *m = &alpd_ctx.pp_map[i];
+        if (m->map != NULL)
+            SCFree(m->map);
+        if (m->ports != NULL)
+            SCFree(m->ports);
+        memset(m, 0, sizeof(*m));
+    }
+}
+
+/** \internal
+ *  \brief compile the port list of a ipproto into a port map
+ *
+ *  Ports are matched in list order and the first 'any' (port 0) entry
+ *  ends the walk, so only the entries before it are reachable and it
+ *  is the result for every port they don't cover.
+ */
+static int AppLayerProtoDetectPPMapCompile(AppLayerProtoDetectPPPortMap *m,
+        const AppLayerProtoDetectProbingParser *pp)
+{
+    uint32_t cnt = 0;
+    for (AppLayerProtoDetectProbingParserPort *p = pp->port; p != NULL; p = p->next)
+        cnt++;
+    if (cnt == 0 || cnt >= UINT16_MAX)
+        return 0;
+
+    m->map = SCCalloc(65536, sizeof(uint16_t));
+    m->ports = SCCalloc(cnt, sizeof(AppLayerProtoDetectProbingParserPort *));
+    if (m->map == NULL || m->ports == NULL)
+        return -1;
+    m->ipproto = pp->ipproto;
+
+    uint16_t idx = 0;
+    uint16_t any_idx = 0;
+    for (AppLayerProtoDetectProbingParserPort *p = pp->port; p != NULL; p = p->next) {
+        m->ports[idx++] = p;
+        if (p->port == 0) {
+            any_idx = idx;
+            break;
+        }
+        if (m->map[p->port] == 0)
+            m->map[p->port] = idx;
+    }
+    if (any_idx != 0) {
+        for (uint32_t port = 0; port < 65536; port++) {
+            if (m->map[port] == 0)
+                m->map[port] = any_idx;
+        }
+    }
+    return 0;
+}
+
+static int AppLayerProtoDetectPPMapSetup(void)
+{
+    AppLayerProtoDetectPPMapFree();
+
+    for (const AppLayerProtoDetectProbingParser *pp = alpd_ctx.ctx_pp;
+            pp != NULL; pp = pp->next)
+    {
+        const uint8_t proto_map = FlowGetProtoMapping(pp->ipproto);
+        if (proto_map >= FLOW_PROTO_DEFAULT)
+            continue;
+        /* ipprotos sharing a mapping: first one gets the map, the others
+         * use the list */
+        AppLayerProtoDetectPPPortMap *m = &alpd_ctx.pp_map[proto_map];
+        if (m->map != NULL)
+            continue;
+        if (AppLayerProtoDetectPPMapCompile(m, pp) < 0) {
+            AppLayerProtoDetectPPMapFree();
+            return -1;
+        }
+    }
+    alpd_ctx.pp_map_valid = true;
+    return 0;
+}
+
 /***** State Preparation *****/
 
 int AppLayerProtoDetectPrepareState(void)
@@ -1582,6 +1795,9 @@ int AppLayerProtoDetectPrepareState(void)
         }
     }
 
+    if (AppLayerProtoDetectPPMapSetup() < 0)
+        goto error;
+
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         AppLayerProtoDetectPrintProbingParsers(alpd_ctx.ctx_pp);
@@ -1611,6 +1827,9 @@ void AppLayerProtoDetectPPRegister(uint8_t ipproto,
 {
     SCEnter();
 
+    /* port map is recompiled in AppLayerProtoDetectPrepareState */
+    alpd_ctx.pp_map_valid = false;
+
     DetectPort *head = NULL;
     DetectPortParse(NULL,&head, portstr);
     DetectPort *temp_dp = head;
@@ -1811,6 +2030,7 @@ int AppLayerProtoDetectDeSetup(void)
 
     SpmDestroyGlobalThreadCtx(alpd_ctx.spm_global_thread_ctx);
 
+    AppLayerProtoDetectPPMapFree();
     AppLayerProtoDetectFreeProbingParsers(alpd_ctx.ctx_pp);
 
     SCReturnInt(0);
@@ -3611,6 +3831,49 @@ static int AppLayerProtoDetectTest19(void)
     return result;
 }
 
+/** \test compiled port map returns what the probing parser list walk does */
+static int AppLayerProtoDetectTest20(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80", ALPROTO_HTTP, 5, 8,
+            STREAM_TOSERVER, ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "[81,8080]", ALPROTO_FTP, 7, 10,
+            STREAM_TOSERVER, ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "0", ALPROTO_SMTP, 12, 0,
+            STREAM_TOSERVER, ProbingParserDummyForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "53", ALPROTO_DNS, 12, 0,
+            STREAM_TOSERVER, ProbingParserDummyForTesting, NULL);
+
+    FAIL_IF(alpd_ctx.pp_map_valid);
+    AppLayerProtoDetectPrepareState();
+    FAIL_IF_NOT(alpd_ctx.pp_map_valid);
+    FAIL_IF_NULL(alpd_ctx.pp_map[FLOW_PROTO_TCP].map);
+    FAIL_IF_NULL(alpd_ctx.pp_map[FLOW_PROTO_UDP].map);
+
+    for (uint32_t port = 0; port < 65536; port++) {
+        FAIL_IF(AppLayerProtoDetectPPLookup(IPPROTO_TCP, (uint16_t)port) !=
+                AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                    IPPROTO_TCP, (uint16_t)port));
+        FAIL_IF(AppLayerProtoDetectPPLookup(IPPROTO_UDP, (uint16_t)port) !=
+                AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                    IPPROTO_UDP, (uint16_t)port));
+    }
+    FAIL_IF_NULL(AppLayerProtoDetectPPLookup(IPPROTO_TCP, 1234));
+    FAIL_IF_NOT_NULL(AppLayerProtoDetectPPLookup(IPPROTO_UDP, 1234));
+    FAIL_IF(AppLayerProtoDetectPPLookup(IPPROTO_TCP, 8080)->port != 8080);
+
+    /* new registration falls back to the list until prepared again */
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "1234", ALPROTO_DNS, 12, 0,
+            STREAM_TOSERVER, ProbingParserDummyForTesting, NULL);
+    FAIL_IF_NULL(AppLayerProtoDetectPPLookup(IPPROTO_UDP, 1234));
+
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
 void AppLayerProtoDetectUnittestsRegister(void)
 {
     SCEnter();
@@ -3634,6 +3897,7 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest17", AppLayerProtoDetectTest17);
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
+    UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
 
     SCReturn;
 }
@@ -97,6 +97,10 @@ SCEnumCharMap dnp3_decoder_event_table[] = {
     {NULL, -1},
 };
 
+/* Application objects are only decoded if something uses them: the
+ * object keyword, the unknown object event or a logger. */
+static int dnp3_decode_objects = 0;
+
 /* Some DNP3 servers start with a banner. */
 static const char banner[] = "DNP3";
 
@@ -434,6 +438,7 @@ static void *DNP3StateAlloc(void)
         return NULL;
     }
     TAILQ_INIT(&dnp3->tx_list);
+    TAILQ_INIT(&dnp3->tx_pool);
 
     SCReturnPtr(dnp3, "void");
 }
@@ -469,9 +474,16 @@ static void DNP3SetEventTx(DNP3Transaction *tx, uint8_t event)
  */
 static DNP3Transaction *DNP3TxAlloc(DNP3State *dnp3)
 {
-    DNP3Transaction *tx = SCCalloc(1, sizeof(DNP3Transaction));
-    if (unlikely(tx == NULL)) {
-        return NULL;
+    DNP3Transaction *tx = TAILQ_FIRST(&dnp3->tx_pool);
+    if (tx != NULL) {
+        TAILQ_REMOVE(&dnp3->tx_pool, tx, next);
+        dnp3->tx_pool_cnt--;
+    }
+    else {
+        tx = SCCalloc(1, sizeof(DNP3Transaction));
+        if (unlikely(tx == NULL)) {
+            return NULL;
+        }
     }
     dnp3->transaction_max++;
     dnp3->unreplied++;
@@ -919,6 +931,10 @@ static void DNP3HandleUserDataRequest(DNP3State *dnp3, const uint8_t *input,
             break;
     }
 
+    if (!dnp3_decode_objects) {
+        return;
+    }
+
     if (DNP3DecodeApplicationObjects(
             tx, tx->request_buffer + sizeof(DNP3ApplicationHeader),
                 tx->request_buffer_len - sizeof(DNP3ApplicationHeader),
@@ -1021,6 +1037,10 @@ static void DNP3HandleUserDataResponse(DNP3State *dnp3, const uint8_t *input,
 
     tx->response_done = 1;
 
+    if (!dnp3_decode_objects) {
+        return;
+    }
+
     offset = sizeof(DNP3ApplicationHeader) + sizeof(DNP3InternalInd);
     if (DNP3DecodeApplicationObjects(tx, tx->response_buffer + offset,
             tx->response_buffer_len - offset,
@@ -1349,6 +1369,37 @@ static void *DNP3GetTx(void *alstate, uint64_t tx_id)
     SCReturnPtr(NULL, "void");
 }
 
+/** \brief tx iterator walking the tx list
+ *
+ *  The iterator state points to the tx following the one returned, so
+ *  the returned tx can be freed before the next call.
+ */
+static AppLayerGetTxIterTuple DNP3GetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    DNP3State *dnp3 = (DNP3State *)alstate;
+    DNP3Transaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&dnp3->tx_list);
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_num < min_tx_id + 1)
+            continue;
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        AppLayerGetTxIterTuple tuple = {
+            .tx_ptr = tx,
+            .tx_id = tx->tx_num - 1,
+            .has_next = (state->un.ptr != NULL),
+        };
+        return tuple;
+    }
+
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+    return no_tuple;
+}
+
 static uint64_t DNP3GetTxCnt(void *state)
 {
     SCEnter();
@@ -1370,12 +1421,10 @@ static void DNP3TxFreeObjectList(DNP3ObjectList *objects)
 }
 
 /**
- * \brief Free a DNP3 transaction.
+ * \brief Free the data of a DNP3 transaction.
  */
-static void DNP3TxFree(DNP3Transaction *tx)
+static void DNP3TxCleanup(DNP3Transaction *tx)
 {
-    SCEnter();
-
     if (tx->request_buffer != NULL) {
         SCFree(tx->request_buffer);
     }
@@ -1392,11 +1441,38 @@ static void DNP3TxFree(DNP3Transaction *tx)
 
     DNP3TxFreeObjectList(&tx->request_objects);
     DNP3TxFreeObjectList(&tx->response_objects);
+}
 
+/**
+ * \brief Free a DNP3 transaction.
+ */
+static void DNP3TxFree(DNP3Transaction *tx)
+{
+    SCEnter();
+    DNP3TxCleanup(tx);
     SCFree(tx);
     SCReturn;
 }
 
+/**
+ * \brief Release a DNP3 transaction.
+ *
+ * The transaction is kept in the pool of the state for reuse by the
+ * next request, unless the pool is full.
+ */
+static void DNP3TxRelease(DNP3State *dnp3, DNP3Transaction *tx)
+{
+    if (dnp3->tx_pool_cnt >= DNP3_TX_POOL_SIZE) {
+        DNP3TxFree(tx);
+        return;
+    }
+
+    DNP3TxCleanup(tx);
+    memset(tx, 0, sizeof(*tx));
+    TAILQ_INSERT_HEAD(&dnp3->tx_pool, tx, next);
+    dnp3->tx_pool_cnt++;
+}
+
 /**
  * \brief Free a transaction by ID on a specific DNP3 state.
  *
@@ -1436,7 +1512,7 @@ static void DNP3StateTxFree(void *state, uint64_t tx_id)
         }
 
         TAILQ_REMOVE(&dnp3->tx_list, tx, next);
-        DNP3TxFree(tx);
+        DNP3TxRelease(dnp3, tx);
         break;
     }
 
@@ -1456,6 +1532,10 @@ static void DNP3StateFree(void *state)
             TAILQ_REMOVE(&dnp3->tx_list, tx, next);
             DNP3TxFree(tx);
         }
+        while ((tx = TAILQ_FIRST(&dnp3->tx_pool)) != NULL) {
+            TAILQ_REMOVE(&dnp3->tx_pool, tx, next);
+            SCFree(tx);
+        }
         if (dnp3->request_buffer.buffer != NULL) {
             SCFree(dnp3->request_buffer.buffer);
         }
@@ -1516,6 +1596,11 @@ static int DNP3StateGetEventInfo(const char *event_name, int *event_id,
 
     *event_type = APP_LAYER_EVENT_TYPE_TRANSACTION;
 
+    /* The event is raised by the object decoder. */
+    if (*event_id == DNP3_DECODER_EVENT_UNKNOWN_OBJECT) {
+        DNP3EnableObjectDecoding();
+    }
+
     return 0;
 }
 
@@ -1568,6 +1653,17 @@ int DNP3PrefixIsSize(uint8_t prefix_code)
     }
 }
 
+/**
+ * \brief Enable the decoding of the application objects.
+ *
+ * Called from the setup of the keywords and loggers that use the
+ * objects, without them only the headers of a PDU are parsed.
+ */
+void DNP3EnableObjectDecoding(void)
+{
+    dnp3_decode_objects = 1;
+}
+
 static uint64_t DNP3GetTxDetectFlags(void *vtx, uint8_t dir)
 {
     DNP3Transaction *tx = (DNP3Transaction *)vtx;
@@ -1643,6 +1739,8 @@ void RegisterDNP3Parsers(void)
             DNP3GetTxDetectFlags, DNP3SetTxDetectFlags);
 
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_DNP3, DNP3GetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_DNP3,
+                DNP3GetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_DNP3, DNP3GetTxCnt);
         AppLayerParserRegisterTxFreeFunc(IPPROTO_TCP, ALPROTO_DNP3,
             DNP3StateTxFree);
@@ -2526,12 +2624,29 @@ static int DNP3ParserTestParsePDU01(void)
         0xe1, 0xc8, 0x01, 0x01, 0x00, 0x06, 0x77, 0x6e
     };
 
+    /* Without a user of the objects only the headers are parsed. */
+    dnp3_decode_objects = 0;
+
     DNP3State *dnp3state = DNP3StateAlloc();
     int pdus = DNP3HandleRequestLinkLayer(dnp3state, pkt, sizeof(pkt));
     FAIL_IF(pdus < 1);
     DNP3Transaction *dnp3tx = DNP3GetTx(dnp3state, 0);
     FAIL_IF_NULL(dnp3tx);
     FAIL_IF(!dnp3tx->has_request);
+    FAIL_IF(dnp3tx->request_ah.function_code != DNP3_APP_FC_READ);
+    FAIL_IF(!TAILQ_EMPTY(&dnp3tx->request_objects));
+
+    /* The freed transaction is reused for the next request. */
+    DNP3StateTxFree(dnp3state, 0);
+    FAIL_IF(dnp3state->tx_pool_cnt != 1);
+
+    DNP3EnableObjectDecoding();
+    pdus = DNP3HandleRequestLinkLayer(dnp3state, pkt, sizeof(pkt));
+    FAIL_IF(pdus < 1);
+    FAIL_IF(dnp3state->tx_pool_cnt != 0);
+    FAIL_IF(DNP3GetTx(dnp3state, 1) != dnp3tx);
+    FAIL_IF(dnp3tx->tx_num != 2);
+    FAIL_IF(!dnp3tx->has_request);
     FAIL_IF(TAILQ_EMPTY(&dnp3tx->request_objects));
     DNP3Object *object = TAILQ_FIRST(&dnp3tx->request_objects);
     FAIL_IF(object->group != 1 || object->variation != 0);
@@ -2565,6 +2680,8 @@ static int DNP3ParserDecodeG70V3Test(void)
         0xc4, 0x8b
     };
 
+    DNP3EnableObjectDecoding();
+
     DNP3State *dnp3state = DNP3StateAlloc();
     FAIL_IF_NULL(dnp3state);
     int bytes = DNP3HandleRequestLinkLayer(dnp3state, pkt, sizeof(pkt));
@@ -2625,6 +2742,7 @@ static int DNP3ParserUnknownEventAlertTest(void)
     };
 
     DNP3FixCrc(pkt + 10, sizeof(pkt) - 10);
+    DNP3EnableObjectDecoding();
 
     DNP3State *dnp3state = DNP3StateAlloc();
     FAIL_IF_NULL(dnp3state);
@@ -27,6 +27,9 @@
  */
 #define DNP3_MAX_LINK_PDU_LEN 292
 
+/* Number of freed transactions kept per flow for reuse. */
+#define DNP3_TX_POOL_SIZE 4
+
 /* DNP3 application request function codes. */
 #define DNP3_APP_FC_CONFIRM                0x00
 #define DNP3_APP_FC_READ                   0x01
@@ -259,6 +262,9 @@ TAILQ_HEAD(TxListHead, DNP3Transaction_);
  */
 typedef struct DNP3State_ {
     TAILQ_HEAD(, DNP3Transaction_) tx_list;
+    TAILQ_HEAD(, DNP3Transaction_) tx_pool; /**< Freed transactions
+                                             * for reuse. */
+    uint8_t tx_pool_cnt;
     DNP3Transaction *curr;     /**< Current transaction. */
     uint64_t transaction_max;
     uint16_t events;
@@ -277,5 +283,6 @@ typedef struct DNP3State_ {
 void RegisterDNP3Parsers(void);
 void DNP3ParserRegisterTests(void);
 int DNP3PrefixIsSize(uint8_t);
+void DNP3EnableObjectDecoding(void);
 
 #endif /* __APP_LAYER_DNP3_H__ */
@@ -80,6 +80,14 @@ static void *RustDNSGetTx(void *alstate, uint64_t tx_id)
     return rs_dns_state_get_tx(alstate, tx_id);
 }
 
+static AppLayerGetTxIterTuple RustDNSGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *istate)
+{
+    return rs_dns_state_get_tx_iterator(alstate, min_tx_id, (uint64_t *)istate);
+}
+
 static void RustDNSSetTxLogged(void *alstate, void *tx, LoggerId logged)
 {
     rs_dns_tx_set_logged(alstate, tx, logged);
@@ -172,6 +180,8 @@ void RegisterRustDNSUDPParsers(void)
                 RustDNSGetDetectFlags, RustDNSSetDetectFlags);
 
         AppLayerParserRegisterGetTx(IPPROTO_UDP, ALPROTO_DNS, RustDNSGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_UDP, ALPROTO_DNS,
+                RustDNSGetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_UDP, ALPROTO_DNS,
                 RustDNSGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_UDP, ALPROTO_DNS,
@@ -31,6 +31,9 @@
 
 #define MAX_ENIP_CMD    65535
 
+/** number of freed transactions kept per flow for reuse */
+#define ENIP_TX_POOL_SIZE   4
+
 // EtherNet/IP commands
 #define NOP                0x0000
 #define LIST_SERVICES      0x0004
@@ -216,6 +219,8 @@ typedef struct ENIPTransaction_
 typedef struct ENIPState_
 {
     TAILQ_HEAD(, ENIPTransaction_) tx_list; /**< transaction list */
+    TAILQ_HEAD(, ENIPTransaction_) tx_pool; /**< freed tx for reuse */
+    uint32_t tx_pool_cnt;
     ENIPTransaction *curr;                  /**< ptr to current tx */
     ENIPTransaction *iter;
     uint64_t transaction_max;
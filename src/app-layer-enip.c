@@ -160,16 +160,15 @@ static void *ENIPStateAlloc(void)
     ENIPState *enip_state = (ENIPState *) s;
 
     TAILQ_INIT(&enip_state->tx_list);
+    TAILQ_INIT(&enip_state->tx_pool);
     return s;
 }
 
 /** \internal
- *  \brief Free a ENIP TX
- *  \param tx ENIP TX to free */
-static void ENIPTransactionFree(ENIPTransaction *tx, ENIPState *state)
+ *  \brief Free the data of a ENIP TX
+ *  \param tx ENIP TX to clean up */
+static void ENIPTransactionCleanup(ENIPTransaction *tx, ENIPState *state)
 {
-    SCEnter();
-    SCLogDebug("ENIPTransactionFree");
     CIPServiceEntry *svc = NULL;
     while ((svc = TAILQ_FIRST(&tx->service_list)))
     {
@@ -203,11 +202,36 @@ static void ENIPTransactionFree(ENIPTransaction *tx, ENIPState *state)
 
     if (state->iter == tx)
         state->iter = NULL;
+}
 
+/** \internal
+ *  \brief Free a ENIP TX
+ *  \param tx ENIP TX to free */
+static void ENIPTransactionFree(ENIPTransaction *tx, ENIPState *state)
+{
+    SCEnter();
+    SCLogDebug("ENIPTransactionFree");
+    ENIPTransactionCleanup(tx, state);
     SCFree(tx);
     SCReturn;
 }
 
+/** \internal
+ *  \brief Release a ENIP TX, it is kept in the pool of the state for the
+ *         next request unless the pool is full
+ *  \param tx ENIP TX to release */
+static void ENIPTransactionRelease(ENIPTransaction *tx, ENIPState *state)
+{
+    if (state->tx_pool_cnt >= ENIP_TX_POOL_SIZE) {
+        ENIPTransactionFree(tx, state);
+        return;
+    }
+
+    ENIPTransactionCleanup(tx, state);
+    TAILQ_INSERT_HEAD(&state->tx_pool, tx, next);
+    state->tx_pool_cnt++;
+}
+
 /** \brief Free enip state
  *
  */
@@ -225,6 +249,11 @@ static void ENIPStateFree(void *s)
             TAILQ_REMOVE(&enip_state->tx_list, tx, next);
             ENIPTransactionFree(tx, enip_state);
         }
+        while ((tx = TAILQ_FIRST(&enip_state->tx_pool)))
+        {
+            TAILQ_REMOVE(&enip_state->tx_pool, tx, next);
+            SCFree(tx);
+        }
 
         if (enip_state->buffer != NULL)
         {
@@ -242,10 +271,15 @@ static void ENIPStateFree(void *s)
 static ENIPTransaction *ENIPTransactionAlloc(ENIPState *state)
 {
     SCLogDebug("ENIPStateTransactionAlloc");
-    ENIPTransaction *tx = (ENIPTransaction *) SCCalloc(1,
-            sizeof(ENIPTransaction));
-    if (unlikely(tx == NULL))
-        return NULL;
+    ENIPTransaction *tx = TAILQ_FIRST(&state->tx_pool);
+    if (tx != NULL) {
+        TAILQ_REMOVE(&state->tx_pool, tx, next);
+        state->tx_pool_cnt--;
+    } else {
+        tx = (ENIPTransaction *) SCCalloc(1, sizeof(ENIPTransaction));
+        if (unlikely(tx == NULL))
+            return NULL;
+    }
 
     state->curr = tx;
     state->transaction_max++;
@@ -291,7 +325,7 @@ static void ENIPStateTransactionFree(void *state, uint64_t tx_id)
         }
 
         TAILQ_REMOVE(&enip_state->tx_list, tx, next);
-        ENIPTransactionFree(tx, state);
+        ENIPTransactionRelease(tx, enip_state);
         break;
     }
     SCReturn;
@@ -44,6 +44,12 @@
  * parent connection and could be useful in the parent connection. For instance
  * this is used by the FTP protocol to propagate information such as file name
  * and ftp operation to the FTP data connection.
+ *
+ * Expectations are kept in a hash table of their own, indexed by the address
+ * pair and the destination port of the expected flow, each row with its own
+ * lock. Expectations for any destination port are hashed with port 0. The
+ * flow manager times out expectations older than EXPECTATION_TIMEOUT, so
+ * when none are pending new flows skip the lookup on the global counter.
  */
 
 /**
@@ -55,22 +61,33 @@
 #include "suricata-common.h"
 #include "debug.h"
 
-#include "ippair-storage.h"
 #include "flow-storage.h"
 
 #include "app-layer-expectation.h"
 
+#include "util-hash-lookup3.h"
 #include "util-print.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
 
-static int g_expectation_id = -1;
 static int g_expectation_data_id = -1;
 
 SC_ATOMIC_DECLARE(uint32_t, expectation_count);
+/** expectations for any destination port, they need a second lookup */
+SC_ATOMIC_DECLARE(uint32_t, expectation_any_dp_count);
 
-#define EXPECTATION_TIMEOUT 30
+#define EXPECTATION_TIMEOUT     30
+#define EXPECTATION_HASH_SIZE   4096
+/** limit on the pending expectations, as they don't count against a memcap */
+#define EXPECTATION_MAX         65536
 
 typedef struct Expectation_ {
     struct timeval ts;
+    /** addresses of the flow the expectation was created from, the expected
+     *  flow can be in either direction */
+    FlowAddress src;
+    FlowAddress dst;
+    bool ipv6;
     Port sp;
     Port dp;
     AppProto alproto;
@@ -79,6 +96,13 @@ typedef struct Expectation_ {
     struct Expectation_ *next;
 } Expectation;
 
+typedef struct ExpectationRow_ {
+    SCSpinlock lock;
+    Expectation *head;
+} ExpectationRow;
+
+static ExpectationRow *expectation_hash = NULL;
+
 typedef struct ExpectationData_ {
     /** Start of Expectation Data structure must be a pointer
      *  to free function. Set to NULL to use SCFree() */
@@ -96,23 +120,12 @@ static void ExpectationDataFree(void *e)
     }
 }
 
-static void ExpectationListFree(void *e)
+static void ExpectationFree(Expectation *exp)
 {
-    Expectation *exp = (Expectation *)e;
-    Expectation *lexp;
-    while (exp) {
-        lexp = exp->next;
-        if (exp->data) {
-            ExpectationData *expdata = (ExpectationData *) exp->data;
-            if (expdata->DFree) {
-                expdata->DFree(exp->data);
-            } else {
-                SCFree(exp->data);
-            }
-        }
-        SCFree(exp);
-        exp = lexp;
+    if (exp->data) {
+        ExpectationDataFree(exp->data);
     }
+    SCFree(exp);
 }
 
 uint64_t ExpectationGetCounter(void)
@@ -123,38 +136,90 @@ uint64_t ExpectationGetCounter(void)
 
 void AppLayerExpectationSetup(void)
 {
-    g_expectation_id = IPPairStorageRegister("expectation", sizeof(void *), NULL, ExpectationListFree);
-    g_expectation_data_id = FlowStorageRegister("expectation", sizeof(void *), NULL, ExpectationDataFree);
-    SC_ATOMIC_INIT(expectation_count);
+    /* called again by the protocol detection unittests */
+    if (g_expectation_data_id == -1) {
+        g_expectation_data_id = FlowStorageRegister("expectation", sizeof(void *), NULL,
+                ExpectationDataFree, FLOW_STORAGE_LATE);
+        SC_ATOMIC_INIT(expectation_count);
+        SC_ATOMIC_INIT(expectation_any_dp_count);
+    }
+    if (expectation_hash != NULL)
+        return;
+
+    expectation_hash = SCCalloc(EXPECTATION_HASH_SIZE, sizeof(ExpectationRow));
+    if (expectation_hash == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to alloc expectation table");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < EXPECTATION_HASH_SIZE; i++) {
+        SCSpinInit(&expectation_hash[i].lock, 0);
+    }
 }
 
-static inline int GetFlowAddresses(Flow *f, Address *ip_src, Address *ip_dst)
+void AppLayerExpectationDeSetup(void)
 {
-    memset(ip_src, 0, sizeof(*ip_src));
-    memset(ip_dst, 0, sizeof(*ip_dst));
-    if (FLOW_IS_IPV4(f)) {
-        FLOW_COPY_IPV4_ADDR_TO_PACKET(&f->src, ip_src);
-        FLOW_COPY_IPV4_ADDR_TO_PACKET(&f->dst, ip_dst);
-    } else if (FLOW_IS_IPV6(f)) {
-        FLOW_COPY_IPV6_ADDR_TO_PACKET(&f->src, ip_src);
-        FLOW_COPY_IPV6_ADDR_TO_PACKET(&f->dst, ip_dst);
-    } else {
-        return -1;
+    if (expectation_hash == NULL)
+        return;
+
+    for (uint32_t i = 0; i < EXPECTATION_HASH_SIZE; i++) {
+        ExpectationRow *row = &expectation_hash[i];
+        Expectation *exp = row->head;
+        while (exp) {
+            Expectation *next = exp->next;
+            ExpectationFree(exp);
+            exp = next;
+        }
+        SCSpinDestroy(&row->lock);
     }
-    return 0;
+    SCFree(expectation_hash);
+    expectation_hash = NULL;
+    SC_ATOMIC_SET(expectation_count, 0);
+    SC_ATOMIC_SET(expectation_any_dp_count, 0);
 }
 
-static Expectation *AppLayerExpectationLookup(Flow *f, int direction, IPPair **ipp)
+/** \internal
+ *  \brief row of an address pair and destination port, the same for both
+ *         directions of the address pair */
+static inline ExpectationRow *ExpectationGetRow(const FlowAddress *a,
+        const FlowAddress *b, Port dp)
 {
-    Address ip_src, ip_dst;
-    if (GetFlowAddresses(f, &ip_src, &ip_dst) == -1)
-        return NULL;
-    *ipp = IPPairLookupIPPairFromHash(&ip_src, &ip_dst);
-    if (*ipp == NULL) {
-        return NULL;
+    uint32_t key[9];
+    const FlowAddress *lo = a, *hi = b;
+    if (memcmp(a, b, sizeof(*a)) > 0) {
+        lo = b;
+        hi = a;
     }
+    memcpy(&key[0], lo->addr_data32, 16);
+    memcpy(&key[4], hi->addr_data32, 16);
+    key[8] = dp;
+    return &expectation_hash[hashword(key, 9, 0) % EXPECTATION_HASH_SIZE];
+}
 
-    return IPPairGetStorageById(*ipp, g_expectation_id);
+static inline bool ExpectationMatchAddresses(const Expectation *exp,
+        const Flow *f)
+{
+    if (exp->ipv6 != (FLOW_IS_IPV6(f) != 0))
+        return false;
+    if (memcmp(&exp->src, &f->src, sizeof(exp->src)) == 0 &&
+            memcmp(&exp->dst, &f->dst, sizeof(exp->dst)) == 0)
+        return true;
+    return memcmp(&exp->src, &f->dst, sizeof(exp->src)) == 0 &&
+        memcmp(&exp->dst, &f->src, sizeof(exp->dst)) == 0;
+}
+
+/** \internal
+ *  \brief unlink an expectation and update the counters, the row is locked */
+static void ExpectationRemove(ExpectationRow *row, Expectation *pexp,
+        Expectation *exp)
+{
+    if (pexp == NULL) {
+        row->head = exp->next;
+    } else {
+        pexp->next = exp->next;
+    }
+    (void) SC_ATOMIC_SUB(expectation_count, 1);
+    if (exp->dp == 0)
+        (void) SC_ATOMIC_SUB(expectation_any_dp_count, 1);
 }
 
 /**
@@ -176,13 +241,20 @@ static Expectation *AppLayerExpectationLookup(Flow *f, int direction, IPPair **i
 int AppLayerExpectationCreate(Flow *f, int direction, Port src, Port dst,
                               AppProto alproto, void *data)
 {
-    Expectation *iexp = NULL;
-    IPPair *ipp;
-    Address ip_src, ip_dst;
+    if (expectation_hash == NULL || !(FLOW_IS_IPV4(f) || FLOW_IS_IPV6(f)))
+        return -1;
+
+    if (SC_ATOMIC_ADD(expectation_count, 1) > EXPECTATION_MAX) {
+        (void) SC_ATOMIC_SUB(expectation_count, 1);
+        SCLogDebug("too many pending expectations");
+        return -1;
+    }
 
     Expectation *exp = SCCalloc(1, sizeof(*exp));
-    if (exp == NULL)
+    if (exp == NULL) {
+        (void) SC_ATOMIC_SUB(expectation_count, 1);
         return -1;
+    }
 
     exp->sp = src;
     exp->dp = dst;
@@ -190,27 +262,18 @@ int AppLayerExpectationCreate(Flow *f, int direction, Port src, Port dst,
     exp->ts = f->lastts;
     exp->data = data;
     exp->direction = direction;
-
-    if (GetFlowAddresses(f, &ip_src, &ip_dst) == -1)
-        goto error;
-    ipp = IPPairGetIPPairFromHash(&ip_src, &ip_dst);
-    if (ipp == NULL)
-        goto error;
-
-    iexp = IPPairGetStorageById(ipp, g_expectation_id);
-    exp->next = iexp;
-    IPPairSetStorageById(ipp, g_expectation_id, exp);
-
-    SC_ATOMIC_ADD(expectation_count, 1);
-    /* As we are creating the expectation, we release lock on IPPair without
-     * setting the ref count to 0. This way the IPPair will be kept till
-     * cleanup */
-    IPPairUnlock(ipp);
+    exp->src = f->src;
+    exp->dst = f->dst;
+    exp->ipv6 = FLOW_IS_IPV6(f) != 0;
+    if (dst == 0)
+        (void) SC_ATOMIC_ADD(expectation_any_dp_count, 1);
+
+    ExpectationRow *row = ExpectationGetRow(&f->src, &f->dst, dst);
+    SCSpinLock(&row->lock);
+    exp->next = row->head;
+    row->head = exp;
+    SCSpinUnlock(&row->lock);
     return 0;
-
-error:
-    SCFree(exp);
-    return -1;
 }
 
 /**
@@ -223,40 +286,52 @@ int AppLayerExpectationGetDataId(void)
     return g_expectation_data_id;
 }
 
-/**
- *
- * Remove expectation and return next one
+/** \internal
+ *  \brief look for an expectation of the flow in a row, removing it and
+ *         the expired entries of the row
  *
- * \param ipp an IPPair
- * \param pexp pointer to previous Expectation
- * \param exp pointer to Expectation to remove
- * \param lexp pointer to head of Expectation ist
- * \return expectation
+ *  \param exp_data set to the data of the matching expectation, owned by
+ *         the caller
  */
-static Expectation * RemoveExpectationAndGetNext(IPPair *ipp,
-                                Expectation *pexp, Expectation *exp,
-                                Expectation *lexp)
+static AppProto ExpectationRowHandle(ExpectationRow *row, const Flow *f,
+        int direction, void **exp_data)
 {
-    /* we remove the object so we get ref count down by 1 to remove reference
-     * hold by the expectation
-     */
-    (void) IPPairDecrUsecnt(ipp);
-    SC_ATOMIC_SUB(expectation_count, 1);
-    if (pexp == NULL) {
-        IPPairSetStorageById(ipp, g_expectation_id, lexp);
-    } else {
-        pexp->next = lexp;
-    }
-    if (exp->data) {
-        ExpectationData *expdata = (ExpectationData *)exp->data;
-        if (expdata->DFree) {
-            expdata->DFree(exp->data);
-        } else {
-            SCFree(exp->data);
+    AppProto alproto = ALPROTO_UNKNOWN;
+    Expectation *free_list = NULL;
+    const time_t ctime = f->lastts.tv_sec;
+
+    SCSpinLock(&row->lock);
+    Expectation *pexp = NULL;
+    Expectation *exp = row->head;
+    while (exp) {
+        Expectation *next = exp->next;
+        if (alproto == ALPROTO_UNKNOWN &&
+             (exp->direction & direction) &&
+             ((exp->sp == 0) || (exp->sp == f->sp)) &&
+             ((exp->dp == 0) || (exp->dp == f->dp)) &&
+             ExpectationMatchAddresses(exp, f)) {
+            alproto = exp->alproto;
+            *exp_data = exp->data;
+            exp->data = NULL;
+        } else if (ctime <= exp->ts.tv_sec + EXPECTATION_TIMEOUT) {
+            pexp = exp;
+            exp = next;
+            continue;
         }
+        ExpectationRemove(row, pexp, exp);
+        exp->next = free_list;
+        free_list = exp;
+        exp = next;
     }
-    SCFree(exp);
-    return lexp;
+    SCSpinUnlock(&row->lock);
+
+    /* the data free functions are called without the row lock */
+    while (free_list) {
+        Expectation *next = free_list->next;
+        ExpectationFree(free_list);
+        free_list = next;
+    }
+    return alproto;
 }
 
 /**
@@ -271,59 +346,173 @@ static Expectation * RemoveExpectationAndGetNext(IPPair *ipp,
  */
 AppProto AppLayerExpectationHandle(Flow *f, int direction)
 {
-    AppProto alproto = ALPROTO_UNKNOWN;
-    IPPair *ipp = NULL;
-    Expectation *lexp = NULL;
-    Expectation *pexp = NULL;
-
-    int x = SC_ATOMIC_GET(expectation_count);
-    if (x == 0) {
+    /* nothing pending, the common case */
+    if (SC_ATOMIC_GET(expectation_count) == 0) {
         return ALPROTO_UNKNOWN;
     }
+    if (expectation_hash == NULL || !(FLOW_IS_IPV4(f) || FLOW_IS_IPV6(f)))
+        return ALPROTO_UNKNOWN;
 
-    /* Call will take reference of the ip pair in 'ipp' */
-    Expectation *exp = AppLayerExpectationLookup(f, direction, &ipp);
-    if (exp == NULL)
-        goto out;
+    void *data = NULL;
+    AppProto alproto = ExpectationRowHandle(
+            ExpectationGetRow(&f->src, &f->dst, f->dp), f, direction, &data);
+    if (alproto == ALPROTO_UNKNOWN && f->dp != 0 &&
+            SC_ATOMIC_GET(expectation_any_dp_count) > 0) {
+        alproto = ExpectationRowHandle(
+                ExpectationGetRow(&f->src, &f->dst, 0), f, direction, &data);
+    }
+    if (alproto == ALPROTO_UNKNOWN)
+        return ALPROTO_UNKNOWN;
 
-    time_t ctime = f->lastts.tv_sec;
+    f->alproto_ts = alproto;
+    f->alproto_tc = alproto;
+    if (data) {
+        void *fdata = FlowGetStorageById(f, g_expectation_data_id);
+        if (fdata) {
+            /* We already have an expectation so let's clean this one */
+            ExpectationDataFree(data);
+        } else {
+            /* Transfer ownership of Expectation data to the Flow */
+            if (FlowSetStorageById(f, g_expectation_data_id, data) != 0) {
+                SCLogDebug("Unable to set flow storage");
+                ExpectationDataFree(data);
+            }
+        }
+    }
+    return alproto;
+}
 
-    pexp = NULL;
-    while (exp) {
-        lexp = exp->next;
-        if ( (exp->direction & direction) &&
-             ((exp->sp == 0) || (exp->sp == f->sp)) &&
-             ((exp->dp == 0) || (exp->dp == f->dp))) {
-            alproto = exp->alproto;
-            f->alproto_ts = alproto;
-            f->alproto_tc = alproto;
-            void *fdata = FlowGetStorageById(f, g_expectation_id);
-            if (fdata) {
-                /* We already have an expectation so let's clean this one */
-                ExpectationDataFree(exp->data);
+/**
+ * Time out the expectations that were not used.
+ *
+ * Called by the flow manager, so that stale expectations don't keep every
+ * new flow doing a lookup.
+ *
+ * \param ts current time
+ *
+ * \return number of expectations timed out
+ */
+uint32_t AppLayerExpectationTimeout(const struct timeval *ts)
+{
+    uint32_t cnt = 0;
+
+    if (expectation_hash == NULL || SC_ATOMIC_GET(expectation_count) == 0)
+        return 0;
+
+    for (uint32_t i = 0; i < EXPECTATION_HASH_SIZE; i++) {
+        ExpectationRow *row = &expectation_hash[i];
+        Expectation *free_list = NULL;
+
+        SCSpinLock(&row->lock);
+        Expectation *pexp = NULL;
+        Expectation *exp = row->head;
+        while (exp) {
+            Expectation *next = exp->next;
+            if (ts->tv_sec > exp->ts.tv_sec + EXPECTATION_TIMEOUT) {
+                ExpectationRemove(row, pexp, exp);
+                exp->next = free_list;
+                free_list = exp;
             } else {
-                /* Transfer ownership of Expectation data to the Flow */
-                if (FlowSetStorageById(f, g_expectation_data_id, exp->data) != 0) {
-                    SCLogDebug("Unable to set flow storage");
-                }
+                pexp = exp;
             }
-            exp->data = NULL;
-            exp = RemoveExpectationAndGetNext(ipp, pexp, exp, lexp);
-            continue;
+            exp = next;
         }
-        /* Cleaning remove old entries */
-        if (exp && (ctime > exp->ts.tv_sec + EXPECTATION_TIMEOUT)) {
-            exp = RemoveExpectationAndGetNext(ipp, pexp, exp, lexp);
-            continue;
+        SCSpinUnlock(&row->lock);
+
+        while (free_list) {
+            Expectation *next = free_list->next;
+            ExpectationFree(free_list);
+            free_list = next;
+            cnt++;
         }
-        pexp = exp;
-        exp = lexp;
     }
+    return cnt;
+}
 
-out:
-    if (ipp)
-        IPPairRelease(ipp);
-    return alproto;
+#ifdef UNITTESTS
+
+/** \test expected flow in the other direction of the address pair gets the
+ *        protocol and the data, once */
+static int AppLayerExpectationTest01(void)
+{
+    AppLayerExpectationSetup();
+    FAIL_IF_NULL(expectation_hash);
+    const uint32_t cnt = SC_ATOMIC_GET(expectation_count);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 21);
+    FAIL_IF_NULL(f);
+    f->lastts.tv_sec = 1000;
+    ExpectationData *data = SCCalloc(1, sizeof(*data));
+    FAIL_IF_NULL(data);
+    FAIL_IF(AppLayerExpectationCreate(f, STREAM_TOSERVER, 0, 2000,
+                ALPROTO_FTPDATA, data) != 0);
+    FAIL_IF(SC_ATOMIC_GET(expectation_count) != cnt + 1);
+
+    /* wrong port */
+    Flow *f2 = UTHBuildFlow(AF_INET, "1.2.3.5", "1.2.3.4", 20, 2001);
+    FAIL_IF_NULL(f2);
+    f2->lastts.tv_sec = 1001;
+    FAIL_IF(AppLayerExpectationHandle(f2, STREAM_TOSERVER) != ALPROTO_UNKNOWN);
+    UTHFreeFlow(f2);
+
+    f2 = UTHBuildFlow(AF_INET, "1.2.3.5", "1.2.3.4", 20, 2000);
+    FAIL_IF_NULL(f2);
+    f2->lastts.tv_sec = 1001;
+    FAIL_IF(AppLayerExpectationHandle(f2, STREAM_TOSERVER) != ALPROTO_FTPDATA);
+    FAIL_IF(f2->alproto_ts != ALPROTO_FTPDATA);
+    FAIL_IF(FlowGetStorageById(f2, g_expectation_data_id) != data);
+    FAIL_IF(SC_ATOMIC_GET(expectation_count) != cnt);
+    FAIL_IF(AppLayerExpectationHandle(f2, STREAM_TOSERVER) != ALPROTO_UNKNOWN);
+
+    UTHFreeFlow(f2);
+    UTHFreeFlow(f);
+    PASS;
+}
+
+/** \test expectations time out, for any port too */
+static int AppLayerExpectationTest02(void)
+{
+    AppLayerExpectationSetup();
+    FAIL_IF_NULL(expectation_hash);
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 21);
+    FAIL_IF_NULL(f);
+    f->lastts.tv_sec = 1;
+    FAIL_IF(AppLayerExpectationCreate(f, STREAM_TOSERVER, 0, 2000,
+                ALPROTO_FTPDATA, NULL) != 0);
+    FAIL_IF(AppLayerExpectationCreate(f, STREAM_TOSERVER, 0, 0,
+                ALPROTO_FTPDATA, NULL) != 0);
+    FAIL_IF(SC_ATOMIC_GET(expectation_any_dp_count) < 1);
+
+    /* not yet, only expectations other tests left without a timestamp */
+    struct timeval ts = { .tv_sec = 1 + EXPECTATION_TIMEOUT, .tv_usec = 0 };
+    (void)AppLayerExpectationTimeout(&ts);
+    const uint32_t cnt = SC_ATOMIC_GET(expectation_count);
+    FAIL_IF(cnt < 2);
+
+    ts.tv_sec++;
+    const uint32_t timedout = AppLayerExpectationTimeout(&ts);
+    FAIL_IF(timedout < 2);
+    FAIL_IF(SC_ATOMIC_GET(expectation_count) != cnt - timedout);
+
+    Flow *f2 = UTHBuildFlow(AF_INET, "1.2.3.5", "1.2.3.4", 20, 2000);
+    FAIL_IF_NULL(f2);
+    f2->lastts.tv_sec = 1;
+    FAIL_IF(AppLayerExpectationHandle(f2, STREAM_TOSERVER) != ALPROTO_UNKNOWN);
+    UTHFreeFlow(f2);
+
+    UTHFreeFlow(f);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void AppLayerExpectationRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerExpectationTest01", AppLayerExpectationTest01);
+    UtRegisterTest("AppLayerExpectationTest02", AppLayerExpectationTest02);
+#endif /* UNITTESTS */
 }
 
 /**
@@ -25,11 +25,16 @@
 #define __APP_LAYER_EXPECTATION__H__
 
 void AppLayerExpectationSetup(void);
+void AppLayerExpectationDeSetup(void);
 int AppLayerExpectationCreate(Flow *f, int direction, Port src, Port dst,
                               AppProto alproto, void *data);
 AppProto AppLayerExpectationHandle(Flow *f, int direction);
 int AppLayerExpectationGetDataId(void);
 
+uint32_t AppLayerExpectationTimeout(const struct timeval *ts);
+
 uint64_t ExpectationGetCounter(void);
 
+void AppLayerExpectationRegisterTests(void);
+
 #endif /* __APP_LAYER_EXPECTATION__H__ */
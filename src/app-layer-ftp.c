@@ -190,109 +190,31 @@ static void FTPFree(void *ptr, size_t size)
     FTPDecrMemuse((uint64_t)size);
 }
 
-static int FTPGetLineForDirection(FtpState *state, FtpLineState *line_state)
-{
-    void *ptmp;
-    if (line_state->current_line_lf_seen == 1) {
-        /* we have seen the lf for the previous line.  Clear the parser
-         * details to parse new line */
-        line_state->current_line_lf_seen = 0;
-        if (line_state->current_line_db == 1) {
-            line_state->current_line_db = 0;
-            FTPFree(line_state->db, line_state->db_len);
-            line_state->db = NULL;
-            line_state->db_len = 0;
-            state->current_line = NULL;
-            state->current_line_len = 0;
-        }
-    }
-
-    uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-    if (lf_idx == NULL) {
-        /* fragmented lines.  Decoder event for special cases.  Not all
-         * fragmented lines should be treated as a possible evasion
-         * attempt.  With multi payload ftp chunks we can have valid
-         * cases of fragmentation.  But within the same segment chunk
-         * if we see fragmentation then it's definitely something you
-         * should alert about */
-        if (line_state->current_line_db == 0) {
-            line_state->db = FTPMalloc(state->input_len);
-            if (line_state->db == NULL) {
-                return -1;
-            }
-            line_state->current_line_db = 1;
-            memcpy(line_state->db, state->input, state->input_len);
-            line_state->db_len = state->input_len;
-        } else {
-            ptmp = FTPRealloc(line_state->db, line_state->db_len,
-                             (line_state->db_len + state->input_len));
-            if (ptmp == NULL) {
-                FTPFree(line_state->db, line_state->db_len);
-                line_state->db = NULL;
-                line_state->db_len = 0;
-                return -1;
-            }
-            line_state->db = ptmp;
-
-            memcpy(line_state->db + line_state->db_len,
-                   state->input, state->input_len);
-            line_state->db_len += state->input_len;
-        }
-        state->input += state->input_len;
-        state->input_len = 0;
+/** fragmented lines are buffered with the FTP memcap accounting */
+static const LineBufferConfig ftp_line_config = {
+    .max_len = 0,
+    .Realloc = FTPRealloc,
+    .Free = FTPFree,
+};
 
+static int FTPGetLineForDirection(FtpState *state, LineBuffer *line_state)
+{
+    /* fragmented lines.  Decoder event for special cases.  Not all
+     * fragmented lines should be treated as a possible evasion
+     * attempt.  With multi payload ftp chunks we can have valid
+     * cases of fragmentation.  But within the same segment chunk
+     * if we see fragmentation then it's definitely something you
+     * should alert about */
+    LineBufferLine line;
+    if (LineBufferGetLine(line_state, &ftp_line_config,
+                &state->input, &state->input_len, &line) < 0) {
         return -1;
-
-    } else {
-        line_state->current_line_lf_seen = 1;
-
-        if (line_state->current_line_db == 1) {
-            ptmp = FTPRealloc(line_state->db, line_state->db_len,
-                             (line_state->db_len + (lf_idx + 1 - state->input)));
-            if (ptmp == NULL) {
-                FTPFree(line_state->db, line_state->db_len);
-                line_state->db = NULL;
-                line_state->db_len = 0;
-                return -1;
-            }
-            line_state->db = ptmp;
-
-            memcpy(line_state->db + line_state->db_len,
-                   state->input, (lf_idx + 1 - state->input));
-            line_state->db_len += (lf_idx + 1 - state->input);
-
-            if (line_state->db_len > 1 &&
-                line_state->db[line_state->db_len - 2] == 0x0D) {
-                line_state->db_len -= 2;
-                state->current_line_delimiter_len = 2;
-            } else {
-                line_state->db_len -= 1;
-                state->current_line_delimiter_len = 1;
-            }
-
-            state->current_line = line_state->db;
-            state->current_line_len = line_state->db_len;
-
-        } else {
-            state->current_line = state->input;
-            state->current_line_len = lf_idx - state->input;
-
-            if (state->input != lf_idx &&
-                *(lf_idx - 1) == 0x0D) {
-                state->current_line_len--;
-                state->current_line_delimiter_len = 2;
-            } else {
-                state->current_line_delimiter_len = 1;
-            }
-        }
-
-        state->input_len -= (lf_idx - state->input) + 1;
-        state->input = (lf_idx + 1);
-
-        return 0;
     }
 
+    state->current_line = line.line;
+    state->current_line_len = line.len;
+    state->current_line_delimiter_len = line.delimiter_len;
+    return 0;
 }
 
 static int FTPGetLine(FtpState *state)
@@ -670,10 +592,8 @@ static void FTPStateFree(void *s)
     FtpState *fstate = (FtpState *) s;
     if (fstate->port_line != NULL)
         FTPFree(fstate->port_line, fstate->port_line_size);
-    if (fstate->line_state[0].db)
-        FTPFree(fstate->line_state[0].db, fstate->line_state[0].db_len);
-    if (fstate->line_state[1].db)
-        FTPFree(fstate->line_state[1].db, fstate->line_state[1].db_len);
+    LineBufferFree(&fstate->line_state[0], &ftp_line_config);
+    LineBufferFree(&fstate->line_state[1], &ftp_line_config);
 
     //AppLayerDecoderEventsFreeEvents(&s->decoder_events);
 
@@ -808,7 +728,9 @@ static int FTPDataParse(Flow *f, FtpDataState *ftpdata_state,
         ftpdata_state->file_len = data->file_len;
         data->file_name = NULL;
         data->file_len = 0;
-        f->parent_id = data->flow_id;
+        FlowExt *ext = FlowGetExt(f);
+        if (ext != NULL)
+            ext->parent_id = data->flow_id;
         ftpdata_state->command = data->cmd;
         switch (data->cmd) {
             case FTP_COMMAND_STOR:
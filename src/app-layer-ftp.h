@@ -24,6 +24,8 @@
 #ifndef __APP_LAYER_FTP_H__
 #define __APP_LAYER_FTP_H__
 
+#include "util-line.h"
+
 enum {
     FTP_STATE_IN_PROGRESS,
     FTP_STATE_PORT_DONE,
@@ -100,17 +102,6 @@ enum {
     FTP_FIELD_MAX,
 };
 
-/** used to hold the line state when we have fragmentation. */
-typedef struct FtpLineState_ {
-    /** used to indicate if the current_line buffer is a malloced buffer.  We
-     * use a malloced buffer, if a line is fragmented */
-    uint8_t *db;
-    uint32_t db_len;
-    uint8_t current_line_db;
-    /** we have see LF for the currently parsed line */
-    uint8_t current_line_lf_seen;
-} FtpLineState;
-
 /** FTP State for app layer parser */
 typedef struct FtpState_ {
     uint8_t *input;
@@ -126,7 +117,7 @@ typedef struct FtpState_ {
     uint8_t current_line_delimiter_len;
 
     /* 0 for toserver, 1 for toclient */
-    FtpLineState line_state[2];
+    LineBuffer line_state[2];
 
     FtpRequestCommand command;
     FtpRequestCommandArgOfs arg_offset;
@@ -50,6 +50,7 @@
 #include "util-debug.h"
 #include "app-layer-htp-file.h"
 #include "util-time.h"
+#include "util-file-decompression.h"
 
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -169,6 +170,9 @@ void HtpBodyFree(HtpBody *body)
     body->first = body->last = NULL;
 
     StreamingBufferFree(body->sb);
+
+    FileSwfDecompressionStreamFree(body->swf);
+    body->swf = NULL;
 }
 
 /**
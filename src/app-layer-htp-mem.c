@@ -35,11 +35,12 @@
 #include "conf.h"
 #include "util-mem.h"
 #include "util-misc.h"
+#include "util-memcap.h"
 
 #include "app-layer-htp-mem.h"
 
 SC_ATOMIC_DECLARE(uint64_t, htp_config_memcap);
-SC_ATOMIC_DECLARE(uint64_t, htp_memuse);
+static MemcapCounter htp_memuse;
 SC_ATOMIC_DECLARE(uint64_t, htp_memcap);
 
 void HTPParseMemcap()
@@ -66,25 +67,25 @@ void HTPParseMemcap()
         SC_ATOMIC_SET(htp_config_memcap, 0);
     }
 
-    SC_ATOMIC_INIT(htp_memuse);
+    MemcapCounterInit(&htp_memuse, 0);
     SC_ATOMIC_INIT(htp_memcap);
 }
 
 static void HTPIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(htp_memuse, size);
+    MemcapCounterIncr(&htp_memuse, size);
     return;
 }
 
 static void HTPDecrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_SUB(htp_memuse, size);
+    MemcapCounterDecr(&htp_memuse, size);
     return;
 }
 
 uint64_t HTPMemuseGlobalCounter(void)
 {
-    uint64_t tmpval = SC_ATOMIC_GET(htp_memuse);
+    uint64_t tmpval = MemcapCounterGet(&htp_memuse);
     return tmpval;
 }
 
@@ -103,7 +104,7 @@ uint64_t HTPMemcapGlobalCounter(void)
 static int HTPCheckMemcap(uint64_t size)
 {
     uint64_t memcapcopy = SC_ATOMIC_GET(htp_config_memcap);
-    if (memcapcopy == 0 || size + SC_ATOMIC_GET(htp_memuse) <= memcapcopy)
+    if (memcapcopy == 0 || MemcapCounterCheck(&htp_memuse, size, memcapcopy))
         return 1;
     (void) SC_ATOMIC_ADD(htp_memcap, 1);
     return 0;
@@ -116,7 +117,7 @@ static int HTPCheckMemcap(uint64_t size)
  */
 int HTPSetMemcap(uint64_t size)
 {
-    if (size == 0 || (uint64_t)SC_ATOMIC_GET(htp_memuse) < size) {
+    if (size == 0 || MemcapCounterGet(&htp_memuse) < size) {
         SC_ATOMIC_SET(htp_config_memcap, size);
         return 1;
     }
@@ -199,7 +200,7 @@ void HTPDestroyMemcap(void)
 {
     SC_ATOMIC_DESTROY(htp_config_memcap);
     SC_ATOMIC_DESTROY(htp_memcap);
-    SC_ATOMIC_DESTROY(htp_memuse);
+    MemcapCounterDestroy(&htp_memuse);
 }
 
 /**
@@ -461,9 +461,26 @@ void AppLayerHtpNeedFileInspection(void)
     SCEnter();
     AppLayerHtpNeedMultipartHeader();
     AppLayerHtpEnableRequestBodyCallback();
-    AppLayerHtpEnableResponseBodyCallback();
 
-    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_REQUEST_FILE);
+    /* response files are stored from the body callback directly, the
+     * body is only buffered if AppLayerHtpEnableResponseBodyCallback()
+     * was called as well */
+    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_REQUEST_FILE|HTP_REQUIRE_RESPONSE_FILE);
+    SCReturn;
+}
+
+/**
+ * \brief Sets a flag that informs the HTP app layer that some module in the
+ *        engine needs the raw request and response headers. Without it the
+ *        header data is not copied into the tx user data.
+ *
+ * \initonly
+ */
+void AppLayerHtpNeedRawHeaders(void)
+{
+    SCEnter();
+
+    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_RAW_HEADERS);
     SCReturn;
 }
 
@@ -1825,7 +1842,8 @@ static int HTPCallbackResponseBodyData(htp_tx_data_t *d)
 {
     SCEnter();
 
-    if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_RESPONSE_BODY))
+    const uint32_t flags = SC_ATOMIC_GET(htp_config_flags);
+    if (!(flags & (HTP_REQUIRE_RESPONSE_BODY|HTP_REQUIRE_RESPONSE_FILE)))
         SCReturnInt(HTP_OK);
 
     if (d->data == NULL || d->len == 0)
@@ -1873,7 +1891,13 @@ static int HTPCallbackResponseBodyData(htp_tx_data_t *d)
         }
         SCLogDebug("len %u", len);
 
-        HtpBodyAppendChunk(&hstate->cfg->response, &tx_ud->response_body, d->data, len);
+        /* only keep a copy of the body if something inspects or logs it,
+         * otherwise it's just accounted for the limit */
+        if (flags & HTP_REQUIRE_RESPONSE_BODY) {
+            HtpBodyAppendChunk(&hstate->cfg->response, &tx_ud->response_body, d->data, len);
+        } else {
+            tx_ud->response_body.content_len_so_far += len;
+        }
 
         HtpResponseBodyHandle(hstate, tx_ud, d->tx, (uint8_t *)d->data, (uint32_t)d->len);
     } else {
@@ -2159,10 +2183,15 @@ static int HTPCallbackDoubleDecodePath(htp_tx_t *tx)
 static int HTPCallbackRequestHeaderData(htp_tx_data_t *tx_data)
 {
     void *ptmp;
+    HtpTxUserData *tx_ud;
     if (tx_data->len == 0 || tx_data->tx == NULL)
         return HTP_OK;
 
-    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx_data->tx);
+    /* only keep a copy of the raw headers if something will look at it */
+    if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_RAW_HEADERS))
+        goto end;
+
+    tx_ud = htp_tx_get_user_data(tx_data->tx);
     if (tx_ud == NULL) {
         tx_ud = HTPMalloc(sizeof(*tx_ud));
         if (unlikely(tx_ud == NULL))
@@ -2186,6 +2215,7 @@ static int HTPCallbackRequestHeaderData(htp_tx_data_t *tx_data)
            tx_data->data, tx_data->len);
     tx_ud->request_headers_raw_len += tx_data->len;
 
+end:
     if (tx_data->tx && tx_data->tx->flags) {
         HtpState *hstate = htp_connp_get_user_data(tx_data->tx->connp);
         HTPErrorCheckTxRequestFlags(hstate, tx_data->tx);
@@ -2199,6 +2229,9 @@ static int HTPCallbackResponseHeaderData(htp_tx_data_t *tx_data)
     if (tx_data->len == 0 || tx_data->tx == NULL)
         return HTP_OK;
 
+    if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_RAW_HEADERS))
+        return HTP_OK;
+
     HtpTxUserData *tx_ud = htp_tx_get_user_data(tx_data->tx);
     if (tx_ud == NULL) {
         tx_ud = HTPMalloc(sizeof(*tx_ud));
@@ -2795,6 +2828,39 @@ static void *HTPStateGetTx(void *alstate, uint64_t tx_id)
         return NULL;
 }
 
+static uint64_t HtpBodyMemuse(const HtpBody *body)
+{
+    uint64_t size = 0;
+    if (body->sb != NULL)
+        size += sizeof(StreamingBuffer) + StreamingBufferGetMemuse(body->sb);
+    for (const HtpBodyChunk *chunk = body->first; chunk != NULL; chunk = chunk->next)
+        size += sizeof(*chunk);
+    return size;
+}
+
+/** \brief get the memory of the state and the tx bodies, libhtp's own
+ *         memory is not included */
+static uint64_t HTPStateGetMemuse(void *alstate)
+{
+    HtpState *http_state = (HtpState *)alstate;
+    uint64_t size = sizeof(*http_state);
+
+    const uint64_t total_txs = HTPStateGetTxCnt(alstate);
+    for (uint64_t tx_id = 0; tx_id < total_txs; tx_id++) {
+        htp_tx_t *tx = HTPStateGetTx(alstate, tx_id);
+        if (tx == NULL)
+            continue;
+        HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+        if (htud == NULL)
+            continue;
+        size += sizeof(*htud);
+        size += HtpBodyMemuse(&htud->request_body);
+        size += HtpBodyMemuse(&htud->response_body);
+        size += htud->request_headers_raw_len + htud->response_headers_raw_len;
+    }
+    return size;
+}
+
 static void HTPStateSetTxLogged(void *alstate, void *vtx, LoggerId bits)
 {
     htp_tx_t *tx = (htp_tx_t *)vtx;
@@ -2842,6 +2908,33 @@ static void HTPStateTruncate(void *state, uint8_t direction)
     }
 }
 
+/** \internal
+ *  \brief prune the bodies of the transactions of an idle state and
+ *         shrink their buffers */
+static void HTPStateCompact(void *state)
+{
+    HtpState *s = (HtpState *)state;
+    if (s->conn == NULL)
+        return;
+
+    const uint64_t total_txs = HTPStateGetTxCnt(state);
+    for (uint64_t tx_id = 0; tx_id < total_txs; tx_id++) {
+        htp_tx_t *tx = HTPStateGetTx(s, tx_id);
+        if (tx == NULL)
+            continue;
+        HtpTxUserData *htud = (HtpTxUserData *) htp_tx_get_user_data(tx);
+        if (htud == NULL)
+            continue;
+
+        HtpBodyPrune(s, &htud->request_body, STREAM_TOSERVER);
+        HtpBodyPrune(s, &htud->response_body, STREAM_TOCLIENT);
+        if (htud->request_body.sb != NULL)
+            StreamingBufferShrink(htud->request_body.sb);
+        if (htud->response_body.sb != NULL)
+            StreamingBufferShrink(htud->response_body.sb);
+    }
+}
+
 static DetectEngineState *HTPGetTxDetectState(void *vtx)
 {
     htp_tx_t *tx = (htp_tx_t *)vtx;
@@ -2981,6 +3074,9 @@ void RegisterHTPParsers(void)
         AppLayerParserRegisterGetEventInfo(IPPROTO_TCP, ALPROTO_HTTP, HTPStateGetEventInfo);
 
         AppLayerParserRegisterTruncateFunc(IPPROTO_TCP, ALPROTO_HTTP, HTPStateTruncate);
+        AppLayerParserRegisterCompactFunc(IPPROTO_TCP, ALPROTO_HTTP, HTPStateCompact);
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_HTTP,
+                HTPStateGetMemuse);
         AppLayerParserRegisterDetectStateFuncs(IPPROTO_TCP, ALPROTO_HTTP,
                                                HTPGetTxDetectState, HTPSetTxDetectState);
         AppLayerParserRegisterDetectFlagsFuncs(IPPROTO_TCP, ALPROTO_HTTP,
@@ -7044,6 +7140,179 @@ static int HTPParserTest25(void)
 
 #endif /* UNITTESTS */
 
+/** \internal
+ *  \brief parse a request and a response with an 8 byte body and check
+ *         whether the body was buffered in the tx */
+static int HTPParserTestResponseBody(const bool buffered)
+{
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    StreamTcpInitConfig(TRUE);
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 80);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_HTTP;
+
+    const char *str = "GET / HTTP/1.1\r\nHost: www.google.com\r\n\r\n";
+    int r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_HTTP,
+                                STREAM_TOSERVER | STREAM_START, (uint8_t *)str, strlen(str));
+    FAIL_IF_NOT(r == 0);
+    str = "HTTP/1.1 200 OK\r\nServer: Suricata/1.0\r\nContent-Length: 8\r\n\r\nSuricata";
+    r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_HTTP,
+                                STREAM_TOCLIENT | STREAM_START, (uint8_t *)str, strlen(str));
+    FAIL_IF_NOT(r == 0);
+
+    HtpState *http_state = f->alstate;
+    FAIL_IF_NULL(http_state);
+    htp_tx_t *tx = HTPStateGetTx(http_state, 0);
+    FAIL_IF_NULL(tx);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(htud);
+
+    /* the body is accounted for the limit either way */
+    FAIL_IF_NOT(htud->response_body.content_len_so_far == 8);
+    if (buffered) {
+        FAIL_IF_NULL(htud->response_body.first);
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+        uint64_t offset = 0;
+        StreamingBufferGetData(htud->response_body.sb, &data, &data_len, &offset);
+        FAIL_IF_NOT(data_len == 8);
+        FAIL_IF(memcmp(data, "Suricata", 8) != 0);
+    } else {
+        FAIL_IF_NOT_NULL(htud->response_body.first);
+        FAIL_IF_NOT_NULL(htud->response_body.sb);
+    }
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(f);
+    PASS;
+}
+
+/** \test response bodies are only buffered if something uses them, like a
+ *        rule with file_data. File tracking alone doesn't need them. */
+static int HTPParserTest26(void)
+{
+    const uint32_t flags = SC_ATOMIC_GET(htp_config_flags);
+    SC_ATOMIC_SET(htp_config_flags, HTP_REQUIRE_RESPONSE_FILE);
+
+    int result = HTPParserTestResponseBody(false);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (result == 1 && de_ctx != NULL) {
+        if (DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                    "(flow:to_client; file_data; content:\"Suricata\"; sid:1;)") == NULL) {
+            result = 0;
+        } else if (!(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_RESPONSE_BODY)) {
+            result = 0;
+        } else {
+            result = HTPParserTestResponseBody(true);
+        }
+    }
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    SC_ATOMIC_SET(htp_config_flags, flags);
+    FAIL_IF_NULL(de_ctx);
+    FAIL_IF_NOT(result == 1);
+    PASS;
+}
+
+/** \test raw headers are only copied into the tx once a rule uses
+ *        http_raw_header, and that rule then matches on them */
+static int HTPParserTest27(void)
+{
+    const uint32_t flags = SC_ATOMIC_GET(htp_config_flags);
+    SC_ATOMIC_SET(htp_config_flags, flags & ~HTP_REQUIRE_RAW_HEADERS);
+
+    uint8_t httpbuf[] = "GET /index.html HTTP/1.0\r\n"
+                        "Host: www.onetwothreefourfivesixseven.org\r\n\r\n";
+    uint32_t httplen = sizeof(httpbuf) - 1; /* minus the \0 */
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    StreamTcpInitConfig(TRUE);
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+
+    /* nothing uses the raw headers yet */
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 80);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_HTTP;
+
+    int r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_HTTP,
+                                STREAM_TOSERVER | STREAM_START, httpbuf, httplen);
+    FAIL_IF_NOT(r == 0);
+    HtpState *http_state = f->alstate;
+    FAIL_IF_NULL(http_state);
+    htp_tx_t *tx = HTPStateGetTx(http_state, 0);
+    FAIL_IF_NULL(tx);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF(htud != NULL && htud->request_headers_raw != NULL);
+    UTHFreeFlow(f);
+
+    /* loading the rule requests them */
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(flow:to_server; content:\"Host|3a| www.one\"; http_raw_header; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF_NOT(SC_ATOMIC_GET(htp_config_flags) & HTP_REQUIRE_RAW_HEADERS);
+    SigGroupBuild(de_ctx);
+
+    ThreadVars th_v;
+    memset(&th_v, 0, sizeof(th_v));
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    memset(&ssn, 0, sizeof(ssn));
+    f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 80);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_HTTP;
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    p->flowflags |= FLOW_PKT_TOSERVER | FLOW_PKT_ESTABLISHED;
+    p->flags |= PKT_HAS_FLOW | PKT_STREAM_EST;
+
+    r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_HTTP,
+                            STREAM_TOSERVER | STREAM_START, httpbuf, httplen);
+    FAIL_IF_NOT(r == 0);
+    http_state = f->alstate;
+    FAIL_IF_NULL(http_state);
+    tx = HTPStateGetTx(http_state, 0);
+    FAIL_IF_NULL(tx);
+    htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(htud);
+    FAIL_IF_NULL(htud->request_headers_raw);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+
+    UTHFreePackets(&p, 1);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(f);
+
+    SC_ATOMIC_SET(htp_config_flags, flags);
+    PASS;
+}
+
 /**
  *  \brief  Register the Unit tests for the HTTP protocol
  */
@@ -7099,6 +7368,8 @@ void HTPParserRegisterTests(void)
     UtRegisterTest("HTPParserTest23", HTPParserTest23);
     UtRegisterTest("HTPParserTest24", HTPParserTest24);
     UtRegisterTest("HTPParserTest25", HTPParserTest25);
+    UtRegisterTest("HTPParserTest26", HTPParserTest26);
+    UtRegisterTest("HTPParserTest27", HTPParserTest27);
 
     HTPFileParserRegisterTests();
     HTPXFFParserRegisterTests();
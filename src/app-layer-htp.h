@@ -170,6 +170,10 @@ typedef struct HtpBody_ {
     uint64_t body_parsed;
     /* inspection tracker */
     uint64_t body_inspected;
+
+    /** swf decompression of the body, kept so that each inspection only
+     *  decompresses the new data */
+    struct FileSwfStream_ *swf;
 } HtpBody;
 
 #define HTP_CONTENTTYPE_SET     0x01    /**< We have the content type */
@@ -238,6 +242,9 @@ typedef struct HtpState_ {
     uint32_t file_track_id;             /**< used to assign file track ids to files */
     uint64_t last_request_data_stamp;
     uint64_t last_response_data_stamp;
+    /** per direction, the txs before this one are done for the body
+     *  streaming loggers */
+    uint64_t body_log_tx_id[2];
 } HtpState;
 
 /** part of the engine needs the request body (e.g. http_client_body keyword) */
@@ -247,8 +254,14 @@ typedef struct HtpState_ {
 #define HTP_REQUIRE_REQUEST_MULTIPART   (1 << 1)
 /** part of the engine needs the request file (e.g. log-file module) */
 #define HTP_REQUIRE_REQUEST_FILE        (1 << 2)
-/** part of the engine needs the request body (e.g. file_data keyword) */
+/** part of the engine needs the response body (e.g. file_data keyword) */
 #define HTP_REQUIRE_RESPONSE_BODY       (1 << 3)
+/** part of the engine needs the response file (e.g. file logging), but
+ *  not the buffered body */
+#define HTP_REQUIRE_RESPONSE_FILE       (1 << 4)
+/** part of the engine needs the raw header data (e.g. http_raw_header
+ *  keyword or lua scripts) */
+#define HTP_REQUIRE_RAW_HEADERS         (1 << 5)
 
 SC_ATOMIC_DECLARE(uint32_t, htp_config_flags);
 
@@ -264,6 +277,7 @@ void HTPStateFree(void *);
 void AppLayerHtpEnableRequestBodyCallback(void);
 void AppLayerHtpEnableResponseBodyCallback(void);
 void AppLayerHtpNeedFileInspection(void);
+void AppLayerHtpNeedRawHeaders(void);
 void AppLayerHtpPrintStats(void);
 
 void HTPConfigure(void);
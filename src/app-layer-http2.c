@@ -0,0 +1,74 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * HTTP/2 parser registration. The parser is implemented in rust, see
+ * rust/src/http2.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-unittest.h"
+#include "util-misc.h"
+#include "app-layer-parser.h"
+#include "app-layer-http2.h"
+
+#ifdef HAVE_RUST
+#include "rust-http2-http2-gen.h"
+
+/** default for app-layer.protocols.http2.hpack-memcap */
+#define HTTP2_DEFAULT_HPACK_MEMCAP  65536
+
+static void HTTP2ParseConfig(void)
+{
+    const char *conf_val;
+    uint32_t memcap = HTTP2_DEFAULT_HPACK_MEMCAP;
+
+    /* each direction of a flow keeps a HPACK table of up to this size */
+    if ((ConfGet("app-layer.protocols.http2.hpack-memcap", &conf_val)) == 1) {
+        if (ParseSizeStringU32(conf_val, &memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing http2.hpack-memcap "
+                       "from conf file - %s.  Killing engine", conf_val);
+            exit(EXIT_FAILURE);
+        }
+    }
+    SCLogConfig("HTTP2 hpack-memcap: %"PRIu32, memcap);
+    rs_http2_set_hpack_memcap(memcap);
+}
+#endif /* HAVE_RUST */
+
+void RegisterHTTP2Parsers(void)
+{
+#ifdef HAVE_RUST
+    rs_http2_register_parser();
+    if (AppLayerParserConfParserEnabled("tcp", "http2")) {
+        HTTP2ParseConfig();
+    }
+#endif /* HAVE_RUST */
+#ifdef UNITTESTS
+    AppLayerParserRegisterProtocolUnittests(IPPROTO_TCP, ALPROTO_HTTP2,
+        HTTP2ParserRegisterTests);
+#endif
+}
+
+void HTTP2ParserRegisterTests(void)
+{
+#ifdef UNITTESTS
+#endif
+}
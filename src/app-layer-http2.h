@@ -0,0 +1,40 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * HTTP/2 parser, implemented in rust/src/http2.
+ */
+
+#ifndef __APP_LAYER_HTTP2_H__
+#define __APP_LAYER_HTTP2_H__
+
+/** progress of a transaction, per direction. Keep in sync with
+ *  HTTP2_STATE_* in rust/src/http2/http2.rs. */
+enum {
+    HTTP2_STATE_IDLE = 0,
+    /** the headers are in, more headers may come as trailers */
+    HTTP2_STATE_HEADERS,
+    /** the stream is closed in this direction */
+    HTTP2_STATE_CLOSED,
+};
+
+void RegisterHTTP2Parsers(void);
+void HTTP2ParserRegisterTests(void);
+
+#endif /* __APP_LAYER_HTTP2_H__ */
@@ -256,6 +256,37 @@ static void *ModbusGetTx(void *alstate, uint64_t tx_id)
     return NULL;
 }
 
+/** \brief tx iterator walking the tx list
+ *
+ *  The iterator state points to the tx following the one returned, so
+ *  the returned tx can be freed before the next call.
+ */
+static AppLayerGetTxIterTuple ModbusGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    ModbusState *modbus = (ModbusState *)alstate;
+    ModbusTransaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&modbus->tx_list);
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_num < min_tx_id + 1)
+            continue;
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        AppLayerGetTxIterTuple tuple = {
+            .tx_ptr = tx,
+            .tx_id = tx->tx_num - 1,
+            .has_next = (state->un.ptr != NULL),
+        };
+        return tuple;
+    }
+
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+    return no_tuple;
+}
+
 static void ModbusSetTxLogged(void *alstate, void *vtx, LoggerId logged)
 {
     ModbusTransaction *tx = (ModbusTransaction *)vtx;
@@ -316,9 +347,15 @@ static ModbusTransaction *ModbusTxFindByTransaction(const ModbusState   *modbus,
 static ModbusTransaction *ModbusTxAlloc(ModbusState *modbus) {
     ModbusTransaction *tx;
 
-    tx = (ModbusTransaction *) SCCalloc(1, sizeof(ModbusTransaction));
-    if (unlikely(tx == NULL))
-        return NULL;
+    tx = TAILQ_FIRST(&modbus->tx_pool);
+    if (tx != NULL) {
+        TAILQ_REMOVE(&modbus->tx_pool, tx, next);
+        modbus->tx_pool_cnt--;
+    } else {
+        tx = (ModbusTransaction *) SCCalloc(1, sizeof(ModbusTransaction));
+        if (unlikely(tx == NULL))
+            return NULL;
+    }
 
     modbus->transaction_max++;
     modbus->unreplied_cnt++;
@@ -342,12 +379,9 @@ static ModbusTransaction *ModbusTxAlloc(ModbusState *modbus) {
 }
 
 /** \internal
- *  \brief Free a Modbus Transaction
- *
- *  \retval Pointer to Transaction or NULL pointer
+ *  \brief Free the data of a Modbus Transaction
  */
-static void ModbusTxFree(ModbusTransaction *tx) {
-    SCEnter();
+static void ModbusTxCleanup(ModbusTransaction *tx) {
     if (tx->data != NULL)
         SCFree(tx->data);
 
@@ -355,11 +389,34 @@ static void ModbusTxFree(ModbusTransaction *tx) {
 
     if (tx->de_state != NULL)
         DetectEngineStateFree(tx->de_state);
+}
 
+/** \internal
+ *  \brief Free a Modbus Transaction
+ */
+static void ModbusTxFree(ModbusTransaction *tx) {
+    SCEnter();
+    ModbusTxCleanup(tx);
     SCFree(tx);
     SCReturn;
 }
 
+/** \internal
+ *  \brief Release a Modbus Transaction, it is kept in the pool of the
+ *          state for the next request unless the pool is full
+ */
+static void ModbusTxRelease(ModbusState *modbus, ModbusTransaction *tx) {
+    if (modbus->tx_pool_cnt >= MODBUS_TX_POOL_SIZE) {
+        ModbusTxFree(tx);
+        return;
+    }
+
+    ModbusTxCleanup(tx);
+    memset(tx, 0x00, sizeof(*tx));
+    TAILQ_INSERT_HEAD(&modbus->tx_pool, tx, next);
+    modbus->tx_pool_cnt++;
+}
+
 /**
  *  \brief Modbus transaction cleanup callback
  */
@@ -396,7 +453,7 @@ static void ModbusStateTxFree(void *state, uint64_t tx_id)
             modbus->givenup = 0;
 
         TAILQ_REMOVE(&modbus->tx_list, tx, next);
-        ModbusTxFree(tx);
+        ModbusTxRelease(modbus, tx);
         break;
     }
     SCReturn;
@@ -1403,6 +1460,7 @@ static void *ModbusStateAlloc(void)
         return NULL;
 
     TAILQ_INIT(&modbus->tx_list);
+    TAILQ_INIT(&modbus->tx_pool);
 
     return (void *) modbus;
 }
@@ -1420,6 +1478,9 @@ static void ModbusStateFree(void *state)
         TAILQ_FOREACH_SAFE(tx, &modbus->tx_list, next, ttx) {
             ModbusTxFree(tx);
         }
+        TAILQ_FOREACH_SAFE(tx, &modbus->tx_pool, next, ttx) {
+            SCFree(tx);
+        }
 
         SCFree(state);
     }
@@ -1528,6 +1589,8 @@ void RegisterModbusParsers(void)
                                                ModbusGetTxDetectState, ModbusSetTxDetectState);
 
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_MODBUS,
+                ModbusGetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTxLogged,
                                           ModbusSetTxLogged);
@@ -3022,6 +3085,121 @@ static int ModbusParserTest19(void) {
     UTHFreePackets(&p, 1);
     PASS;
 }
+
+/** \test Walk the Modbus transactions with the tx iterator, freeing the
+ *        returned tx in between like the tx cleanup does. */
+static int ModbusParserTest20(void) {
+    uint8_t input[sizeof(readCoilsReq) + sizeof(writeMultipleRegistersReq)];
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    Flow f;
+    TcpSession ssn;
+
+    FAIL_IF_NULL(alp_tctx);
+
+    memcpy(input, readCoilsReq, sizeof(readCoilsReq));
+    memcpy(input + sizeof(readCoilsReq), writeMultipleRegistersReq,
+            sizeof(writeMultipleRegistersReq));
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx  = (void *)&ssn;
+    f.proto     = IPPROTO_TCP;
+    f.alproto   = ALPROTO_MODBUS;
+
+    StreamTcpInitConfig(TRUE);
+
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_MODBUS,
+                                STREAM_TOSERVER, input, sizeof(input));
+    FAIL_IF_NOT(r == 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    ModbusState    *modbus_state = f.alstate;
+    FAIL_IF_NULL(modbus_state);
+    FAIL_IF_NOT(modbus_state->transaction_max == 2);
+
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+    AppLayerGetTxIterTuple ires = ModbusGetTxIterator(IPPROTO_TCP,
+            ALPROTO_MODBUS, modbus_state, 0, 2, &state);
+    FAIL_IF_NOT(ires.tx_ptr == ModbusGetTx(modbus_state, 0));
+    FAIL_IF_NOT(ires.tx_id == 0);
+    FAIL_IF_NOT(ires.has_next);
+
+    ModbusStateTxFree(modbus_state, 0);
+
+    ires = ModbusGetTxIterator(IPPROTO_TCP, ALPROTO_MODBUS, modbus_state,
+            1, 2, &state);
+    FAIL_IF_NOT(ires.tx_ptr == ModbusGetTx(modbus_state, 1));
+    FAIL_IF_NOT(ires.tx_id == 1);
+    FAIL_IF(ires.has_next);
+
+    /* a new iteration skips the txs below the minimum */
+    memset(&state, 0, sizeof(state));
+    ires = ModbusGetTxIterator(IPPROTO_TCP, ALPROTO_MODBUS, modbus_state,
+            2, 2, &state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
+/** \test A freed Modbus transaction is reused for the next request. */
+static int ModbusParserTest21(void) {
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    Flow f;
+    TcpSession ssn;
+
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx  = (void *)&ssn;
+    f.proto     = IPPROTO_TCP;
+    f.alproto   = ALPROTO_MODBUS;
+
+    StreamTcpInitConfig(TRUE);
+
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_MODBUS,
+                                STREAM_TOSERVER, readCoilsReq,
+                                sizeof(readCoilsReq));
+    FAIL_IF_NOT(r == 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    ModbusState    *modbus_state = f.alstate;
+    FAIL_IF_NULL(modbus_state);
+    ModbusTransaction *tx = ModbusGetTx(modbus_state, 0);
+    FAIL_IF_NULL(tx);
+
+    ModbusStateTxFree(modbus_state, 0);
+    FAIL_IF_NOT(modbus_state->tx_pool_cnt == 1);
+    FAIL_IF_NOT(TAILQ_EMPTY(&modbus_state->tx_list));
+
+    FLOWLOCK_WRLOCK(&f);
+    r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_MODBUS,
+                            STREAM_TOSERVER, writeMultipleRegistersReq,
+                            sizeof(writeMultipleRegistersReq));
+    FAIL_IF_NOT(r == 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    FAIL_IF_NOT(modbus_state->tx_pool_cnt == 0);
+    FAIL_IF_NOT(ModbusGetTx(modbus_state, 1) == tx);
+    FAIL_IF_NOT(tx->tx_num == 2);
+    FAIL_IF_NOT(tx->function == 16);
+    FAIL_IF_NULL(tx->data);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void ModbusParserRegisterTests(void) {
@@ -3064,5 +3242,9 @@ void ModbusParserRegisterTests(void) {
                    ModbusParserTest18);
     UtRegisterTest("ModbusParserTest19 - Modbus invalid Function code",
                    ModbusParserTest19);
+    UtRegisterTest("ModbusParserTest20 - Modbus tx iterator",
+                   ModbusParserTest20);
+    UtRegisterTest("ModbusParserTest21 - Modbus tx reuse",
+                   ModbusParserTest21);
 #endif /* UNITTESTS */
 }
@@ -81,6 +81,9 @@ enum {
 /* Modbus Function Code. */
 #define MODBUS_FUNC_NONE                0x00
 
+/** number of freed transactions kept per flow for reuse */
+#define MODBUS_TX_POOL_SIZE             4
+
 /* Modbus Transaction Structure, request/response. */
 typedef struct ModbusTransaction_ {
     struct ModbusState_ *modbus;
@@ -121,11 +124,13 @@ typedef struct ModbusTransaction_ {
 /* Modbus State Structure. */
 typedef struct ModbusState_ {
     TAILQ_HEAD(, ModbusTransaction_)    tx_list;    /**< transaction list */
+    TAILQ_HEAD(, ModbusTransaction_)    tx_pool;    /**< freed tx for reuse */
     ModbusTransaction                   *curr;      /**< ptr to current tx */
     uint64_t                            transaction_max;
     uint32_t                            unreplied_cnt;  /**< number of unreplied requests */
     uint16_t                            events;
     uint8_t                             givenup;    /**< bool indicating flood. */
+    uint8_t                             tx_pool_cnt;
 } ModbusState;
 
 void RegisterModbusParsers(void);
@@ -31,6 +31,7 @@
 #include "conf.h"
 
 #include "util-unittest.h"
+#include "util-misc.h"
 
 #include "app-layer-detect-proto.h"
 #include "app-layer-parser.h"
@@ -195,6 +196,11 @@ static uint64_t NFSTCPGetTxCnt(void *state)
     return rs_nfs_state_get_tx_count(state);
 }
 
+static uint64_t NFSTCPStateGetMemuse(void *state)
+{
+    return rs_nfs_state_get_memuse(state);
+}
+
 static void *NFSTCPGetTx(void *state, uint64_t tx_id)
 {
     return rs_nfs_state_get_tx(state, tx_id);
@@ -384,9 +390,25 @@ void RegisterNFSTCPParsers(void)
         AppLayerParserRegisterDetectFlagsFuncs(IPPROTO_TCP, ALPROTO_NFS,
                                                NFSTCPGetDetectFlags, NFSTCPSetDetectFlags);
 
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_NFS,
+                NFSTCPStateGetMemuse);
+        AppLayerParserRegisterMemcap(IPPROTO_TCP, ALPROTO_NFS);
+
         /* This parser accepts gaps. */
         AppLayerParserRegisterOptionFlags(IPPROTO_TCP, ALPROTO_NFS,
                 APP_LAYER_PARSER_OPT_ACCEPT_GAPS);
+
+        ConfNode *p = ConfGetNode("app-layer.protocols.nfs.file-ooo-spill-size");
+        if (p != NULL) {
+            uint64_t value;
+            if (ParseSizeStringU64(p->val, &value) < 0) {
+                SCLogError(SC_ERR_INVALID_VALUE, "invalid value for "
+                        "file-ooo-spill-size %s", p->val);
+            } else {
+                rs_nfs_set_file_ooo_spill_size(value);
+                SCLogConfig("NFS file out of order spill size: %"PRIu64, value);
+            }
+        }
     }
     else {
         SCLogDebug("NFSTCP protocol parsing disabled.");
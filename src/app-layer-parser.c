@@ -66,11 +66,15 @@
 #include "app-layer-ikev2.h"
 #include "app-layer-krb5.h"
 #include "app-layer-dhcp.h"
+#include "app-layer-http2.h"
+#include "app-layer-quic.h"
 #include "app-layer-template.h"
 #include "app-layer-template-rust.h"
 
 #include "conf.h"
 #include "util-spm.h"
+#include "util-misc.h"
+#include "util-memcap.h"
 
 #include "util-debug.h"
 #include "decode-events.h"
@@ -83,6 +87,32 @@ struct AppLayerParserThreadCtx_ {
     void *alproto_local_storage[FLOW_PROTO_MAX][ALPROTO_MAX];
 };
 
+/** what to do with a flow that brings its protocol over the memcap */
+enum AppLayerParserMemcapPolicy {
+    /** stop parsing the flow, raw stream inspection continues */
+    APP_LAYER_MEMCAP_POLICY_DISABLE_PARSER = 0,
+    /** stop storing, hashing and tracking the files of the flow */
+    APP_LAYER_MEMCAP_POLICY_DROP_FILES,
+    /** drop the files and let the parser stop buffering body data */
+    APP_LAYER_MEMCAP_POLICY_DROP_BODY,
+};
+
+/**
+ * \brief Per protocol memcap, see AppLayerParserRegisterMemcap().
+ *
+ * The memory use of a flow is what the StateGetMemuse callback reports
+ * after each call to the parser, the difference to the previous value is
+ * added to the protocol's counter.
+ */
+typedef struct AppLayerParserMemcap_ {
+    MemcapCounter memuse;
+    /** memcap for all flows of the protocol, 0 for unlimited */
+    uint64_t memcap;
+    /** memcap for a single flow, 0 for unlimited */
+    uint64_t flow_memcap;
+    enum AppLayerParserMemcapPolicy policy;
+} AppLayerParserMemcap;
+
 
 /**
  * \brief App layer protocol parser context.
@@ -101,6 +131,11 @@ typedef struct AppLayerParserProtoCtx_
     void (*LocalStorageFree)(void *);
 
     void (*Truncate)(void *, uint8_t);
+    /* give back memory held by an idle state */
+    void (*StateCompact)(void *alstate);
+    uint64_t (*StateGetMemuse)(void *alstate);
+    /* memcap, NULL if the protocol has none */
+    AppLayerParserMemcap *memcap;
     FileContainer *(*StateGetFiles)(void *, uint8_t);
     AppLayerDecoderEvents *(*StateGetEvents)(void *, uint64_t);
 
@@ -159,6 +194,13 @@ struct AppLayerParserState_ {
 
     uint64_t min_id;
 
+    /* reassembly still needed, see AppLayerParserStateSetStreamDepthLimit */
+    uint32_t stream_depth_limit;
+
+    /* memory of the app-layer state accounted to the memcap */
+    uint64_t memuse;
+    AppLayerParserMemcap *memcap;
+
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
 };
@@ -202,6 +244,8 @@ void AppLayerParserStateFree(AppLayerParserState *pstate)
 {
     SCEnter();
 
+    if (pstate->memcap != NULL)
+        MemcapCounterDecr(&pstate->memcap->memuse, pstate->memuse);
     if (pstate->decoder_events != NULL)
         AppLayerDecoderEventsFreeEvents(&pstate->decoder_events);
     SCFree(pstate);
@@ -237,6 +281,17 @@ int AppLayerParserDeSetup(void)
 {
     SCEnter();
 
+    for (int flow_proto = 0; flow_proto < FLOW_PROTO_DEFAULT; flow_proto++) {
+        for (AppProto alproto = 0; alproto < ALPROTO_MAX; alproto++) {
+            AppLayerParserMemcap *mc = alp_ctx.ctxs[flow_proto][alproto].memcap;
+            if (mc != NULL) {
+                MemcapCounterDestroy(&mc->memuse);
+                SCFreeAligned(mc);
+                alp_ctx.ctxs[flow_proto][alproto].memcap = NULL;
+            }
+        }
+    }
+
     SMTPParserCleanup();
 
     SCReturnInt(0);
@@ -483,6 +538,111 @@ void AppLayerParserRegisterTruncateFunc(uint8_t ipproto, AppProto alproto,
     SCReturn;
 }
 
+void AppLayerParserRegisterCompactFunc(uint8_t ipproto, AppProto alproto,
+                                       void (*StateCompact)(void *alstate))
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateCompact = StateCompact;
+
+    SCReturn;
+}
+
+void AppLayerParserRegisterGetStateMemuseFunc(uint8_t ipproto, AppProto alproto,
+                                        uint64_t (*StateGetMemuse)(void *alstate))
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateGetMemuse =
+        StateGetMemuse;
+
+    SCReturn;
+}
+
+static AppLayerParserMemcap *AppLayerParserMemcapAlloc(uint64_t memcap,
+        uint64_t flow_memcap, enum AppLayerParserMemcapPolicy policy)
+{
+    AppLayerParserMemcap *mc = SCMallocAligned(sizeof(*mc), CLS);
+    if (unlikely(mc == NULL))
+        return NULL;
+    MemcapCounterInit(&mc->memuse, 0);
+    mc->memcap = memcap;
+    mc->flow_memcap = flow_memcap;
+    mc->policy = policy;
+    return mc;
+}
+
+static void AppLayerParserMemcapGetSize(const char *proto_name,
+        const char *name, uint64_t *res)
+{
+    char param[128];
+    const char *str = NULL;
+
+    snprintf(param, sizeof(param), "app-layer.protocols.%s.%s", proto_name, name);
+    if (ConfGet(param, &str) != 1 || str == NULL)
+        return;
+    if (ParseSizeStringU64(str, res) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing %s from conf file - %s.  "
+                "Killing engine", param, str);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * \brief Set up the memcap of a protocol from its
+ *        app-layer.protocols.<proto>.memcap, flow-memcap and memcap-policy
+ *        settings. Nothing is set up if neither memcap is configured.
+ *
+ * The protocol has to register a StateGetMemuse callback as well, that is
+ * what the memory use of its flows is taken from.
+ *
+ * \initonly
+ */
+void AppLayerParserRegisterMemcap(uint8_t ipproto, AppProto alproto)
+{
+    SCEnter();
+
+    const char *proto_name = AppLayerGetProtoName(alproto);
+    uint64_t memcap = 0;
+    uint64_t flow_memcap = 0;
+    enum AppLayerParserMemcapPolicy policy = APP_LAYER_MEMCAP_POLICY_DISABLE_PARSER;
+
+    AppLayerParserMemcapGetSize(proto_name, "memcap", &memcap);
+    AppLayerParserMemcapGetSize(proto_name, "flow-memcap", &flow_memcap);
+    if (memcap == 0 && flow_memcap == 0)
+        SCReturn;
+
+    char param[128];
+    const char *str = NULL;
+    snprintf(param, sizeof(param), "app-layer.protocols.%s.memcap-policy", proto_name);
+    if (ConfGet(param, &str) == 1 && str != NULL) {
+        if (strcmp(str, "drop-files") == 0) {
+            policy = APP_LAYER_MEMCAP_POLICY_DROP_FILES;
+        } else if (strcmp(str, "drop-body") == 0) {
+            policy = APP_LAYER_MEMCAP_POLICY_DROP_BODY;
+        } else if (strcmp(str, "disable-parser") != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid value for %s: %s, "
+                    "using disable-parser", param, str);
+        }
+    }
+
+    AppLayerParserProtoCtx *ctx = &alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto];
+    if (ctx->memcap == NULL) {
+        ctx->memcap = AppLayerParserMemcapAlloc(memcap, flow_memcap, policy);
+        if (ctx->memcap == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate %s memcap", proto_name);
+            SCReturn;
+        }
+    }
+    SCLogConfig("%s memcap: %"PRIu64", flow-memcap: %"PRIu64", policy: %s",
+            proto_name, memcap, flow_memcap,
+            policy == APP_LAYER_MEMCAP_POLICY_DROP_FILES ? "drop-files" :
+            policy == APP_LAYER_MEMCAP_POLICY_DROP_BODY ? "drop-body" :
+            "disable-parser");
+
+    SCReturn;
+}
+
 void AppLayerParserRegisterGetStateProgressFunc(uint8_t ipproto, AppProto alproto,
     int (*StateGetProgress)(void *alstate, uint8_t direction))
 {
@@ -1127,6 +1287,81 @@ void AppLayerParserSetTxDetectFlags(uint8_t ipproto, AppProto alproto, void *tx,
 
 /***** General *****/
 
+/** \internal
+ *  \brief apply the memcap policy to a flow that went over the memcap */
+static void AppLayerParserMemcapDegrade(ThreadVars *tv, Flow *f,
+        const AppLayerParserMemcap *mc, AppLayerParserState *pstate)
+{
+    SCLogDebug("flow %p over the %s memcap, flow memuse %"PRIu64, f,
+            AppLayerGetProtoName(f->alproto), pstate->memuse);
+
+    pstate->flags |= APP_LAYER_PARSER_MEMCAP;
+    AppLayerIncMemcapCounter(tv, f);
+
+    switch (mc->policy) {
+        case APP_LAYER_MEMCAP_POLICY_DISABLE_PARSER:
+            if (f->proto == IPPROTO_TCP) {
+                StreamTcpDisableAppLayer(f);
+            }
+            AppLayerParserSetEOF(pstate);
+            break;
+        case APP_LAYER_MEMCAP_POLICY_DROP_BODY:
+        case APP_LAYER_MEMCAP_POLICY_DROP_FILES:
+            for (uint8_t direction = STREAM_TOSERVER; direction <= STREAM_TOCLIENT;
+                    direction <<= 1) {
+                FileDisableStoring(f, direction);
+                FileDisableMagic(f, direction);
+                FileDisableMd5(f, direction);
+                FileDisableSha1(f, direction);
+                FileDisableSha256(f, direction);
+                FileDisableFilesize(f, direction);
+            }
+            break;
+    }
+}
+
+/** \internal
+ *  \brief account the change in memory use of the app-layer state of a
+ *         flow, degrade the flow if it brings its protocol over the memcap
+ *
+ *  Only a flow that grows is degraded, and a flow memcap stops a single
+ *  flow before it can use up the memcap shared by all flows.
+ */
+static void AppLayerParserMemcapUpdate(ThreadVars *tv, Flow *f,
+        const AppLayerParserProtoCtx *p, AppLayerParserState *pstate,
+        void *alstate)
+{
+    AppLayerParserMemcap *mc = p->memcap;
+
+    /* the protocol of the flow changed */
+    if (unlikely(pstate->memcap != mc)) {
+        if (pstate->memcap != NULL)
+            MemcapCounterDecr(&pstate->memcap->memuse, pstate->memuse);
+        pstate->memcap = mc;
+        pstate->memuse = 0;
+    }
+    if (mc == NULL || p->StateGetMemuse == NULL)
+        return;
+
+    const uint64_t memuse = p->StateGetMemuse(alstate);
+    if (memuse == pstate->memuse) {
+        return;
+    } else if (memuse < pstate->memuse) {
+        MemcapCounterDecr(&mc->memuse, pstate->memuse - memuse);
+        pstate->memuse = memuse;
+        return;
+    }
+    MemcapCounterIncr(&mc->memuse, memuse - pstate->memuse);
+    pstate->memuse = memuse;
+
+    if (pstate->flags & APP_LAYER_PARSER_MEMCAP)
+        return;
+    if ((mc->flow_memcap > 0 && memuse > mc->flow_memcap) ||
+            (mc->memcap > 0 && !MemcapCounterCheck(&mc->memuse, 0, mc->memcap))) {
+        AppLayerParserMemcapDegrade(tv, f, mc, pstate);
+    }
+}
+
 int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alproto,
                         uint8_t flags, uint8_t *input, uint32_t input_len)
 {
@@ -1193,6 +1428,16 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
         }
     }
 
+    AppLayerParserMemcapUpdate(tv, f, p, pstate, alstate);
+
+    /* the parser needs less than the reassembly depth */
+    if (pstate->flags & APP_LAYER_PARSER_STREAM_DEPTH_LIMIT) {
+        pstate->flags &= ~APP_LAYER_PARSER_STREAM_DEPTH_LIMIT;
+        if (f->proto == IPPROTO_TCP && f->protoctx != NULL) {
+            TcpSessionLimitReassemblyDepth(f->protoctx, pstate->stream_depth_limit);
+        }
+    }
+
     /* set the packets to no inspection and reassembly if required */
     if (pstate->flags & APP_LAYER_PARSER_NO_INSPECTION) {
         AppLayerParserSetEOF(pstate);
@@ -1237,6 +1482,13 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
         }
     }
 
+    /* handshake is done, the raw payload is of no use to the mpm */
+    if (!(f->flags & FLOW_PAYLOAD_ENCRYPTED) &&
+            pstate->flags & APP_LAYER_PARSER_PAYLOAD_ENCRYPTED) {
+        SCLogDebug("flow %p: payload is encrypted from here", f);
+        f->flags |= FLOW_PAYLOAD_ENCRYPTED;
+    }
+
     if (AppLayerParserProtocolIsTxAware(f->proto, alproto)) {
         if (likely(tv)) {
             uint64_t cur_tx_cnt = AppLayerParserGetTxCnt(f, f->alstate);
@@ -1325,6 +1577,14 @@ int AppLayerParserProtocolSupportsTxs(uint8_t ipproto, AppProto alproto)
     SCReturnInt(r);
 }
 
+int AppLayerParserProtocolHasMemcap(uint8_t ipproto, AppProto alproto)
+{
+    SCEnter();
+    int ipproto_map = FlowGetProtoMapping(ipproto);
+    int r = (alp_ctx.ctxs[ipproto_map][alproto].memcap != NULL) ? 1 : 0;
+    SCReturnInt(r);
+}
+
 int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto)
 {
     SCEnter();
@@ -1368,6 +1628,19 @@ uint32_t AppLayerParserGetStreamDepth(const Flow *f)
     SCReturnInt(alp_ctx.ctxs[f->protomap][f->alproto].stream_depth);
 }
 
+/**
+ *  \brief get the memory held by the app-layer state of a flow
+ *
+ *  \retval bytes held, 0 if the parser can't tell
+ */
+uint64_t AppLayerParserGetStateMemuse(const Flow *f)
+{
+    if (f->alstate == NULL ||
+            alp_ctx.ctxs[f->protomap][f->alproto].StateGetMemuse == NULL)
+        return 0;
+    return alp_ctx.ctxs[f->protomap][f->alproto].StateGetMemuse(f->alstate);
+}
+
 /***** Cleanup *****/
 
 void AppLayerParserStateCleanup(const Flow *f, void *alstate,
@@ -1499,6 +1772,8 @@ void AppLayerParserRegisterProtocolParsers(void)
     RegisterIKEV2Parsers();
     RegisterKRB5Parsers();
     RegisterDHCPParsers();
+    RegisterHTTP2Parsers();
+    RegisterQuicParsers();
     RegisterTemplateRustParsers();
     RegisterTemplateParsers();
 
@@ -1542,6 +1817,18 @@ void AppLayerParserStateSetFlag(AppLayerParserState *pstate, uint8_t flag)
     SCReturn;
 }
 
+/**
+ *  \brief Let a parser tell that it only needs size more bytes of the
+ *         stream, so that the reassembly depth of a TCP session is lowered
+ */
+void AppLayerParserStateSetStreamDepthLimit(AppLayerParserState *pstate, uint32_t size)
+{
+    SCEnter();
+    pstate->flags |= APP_LAYER_PARSER_STREAM_DEPTH_LIMIT;
+    pstate->stream_depth_limit = size;
+    SCReturn;
+}
+
 int AppLayerParserStateIssetFlag(AppLayerParserState *pstate, uint8_t flag)
 {
     SCEnter();
@@ -1561,6 +1848,31 @@ void AppLayerParserStreamTruncated(uint8_t ipproto, AppProto alproto, void *alst
     SCReturn;
 }
 
+/**
+ *  \brief free what an idle flow's app-layer state can do without
+ *
+ *  Frees the transactions that are done, then lets the parser give back
+ *  the memory it can, like buffered bodies.
+ *
+ *  \param f *locked* flow
+ */
+void AppLayerParserStateCompact(Flow *f)
+{
+    SCEnter();
+    DEBUG_ASSERT_FLOW_LOCKED(f);
+
+    if (f->alstate == NULL || f->alparser == NULL)
+        SCReturn;
+
+    AppLayerParserTransactionsCleanup(f);
+
+    AppLayerParserProtoCtx *p = &alp_ctx.ctxs[f->protomap][f->alproto];
+    if (p->StateCompact != NULL)
+        p->StateCompact(f->alstate);
+
+    SCReturn;
+}
+
 #ifdef DEBUG
 void AppLayerParserStatePrintDetails(AppLayerParserState *pstate)
 {
@@ -1945,6 +2257,7 @@ static AppLayerParserCtx alp_ctx_backup_unittest;
 
 typedef struct TestState_ {
     uint8_t test;
+    uint64_t memuse;
 } TestState;
 
 /**
@@ -1959,6 +2272,22 @@ static int TestProtocolParser(Flow *f, void *test_state, AppLayerParserState *ps
     SCReturnInt(-1);
 }
 
+/**
+ *  \brief Test parser function that grows the state by the size of the input
+ */
+static int TestProtocolParserGrow(Flow *f, void *test_state, AppLayerParserState *pstate,
+                              uint8_t *input, uint32_t input_len,
+                              void *local_data, const uint8_t flags)
+{
+    ((TestState *)test_state)->memuse += input_len;
+    return 0;
+}
+
+static uint64_t TestProtocolStateGetMemuse(void *s)
+{
+    return ((TestState *)s)->memuse;
+}
+
 /** \brief Function to allocates the Test protocol state memory
  */
 static void *TestProtocolStateAlloc(void)
@@ -2109,6 +2438,70 @@ static int AppLayerParserTest02(void)
     return result;
 }
 
+/**
+ * \test A flow that goes over the flow memcap has its parser disabled, and
+ *       its memory use is released when the parser state is freed.
+ */
+static int AppLayerParserTest03(void)
+{
+    AppLayerParserBackupParserTable();
+
+    uint8_t testbuf[16] = { 0 };
+    TcpSession ssn;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+    memset(&ssn, 0, sizeof(ssn));
+
+    AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_TEST, STREAM_TOSERVER,
+                      TestProtocolParserGrow);
+    AppLayerParserRegisterStateFuncs(IPPROTO_TCP, ALPROTO_TEST,
+                          TestProtocolStateAlloc, TestProtocolStateFree);
+    AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_TEST,
+                          TestProtocolStateGetMemuse);
+    AppLayerParserMemcap *mc = AppLayerParserMemcapAlloc(0, 16,
+            APP_LAYER_MEMCAP_POLICY_DISABLE_PARSER);
+    FAIL_IF_NULL(mc);
+    alp_ctx.ctxs[FlowGetProtoMapping(IPPROTO_TCP)][ALPROTO_TEST].memcap = mc;
+    FAIL_IF_NOT(AppLayerParserProtocolHasMemcap(IPPROTO_TCP, ALPROTO_TEST));
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "4.3.2.1", 20, 40);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->alproto = ALPROTO_TEST;
+    f->proto = IPPROTO_TCP;
+    f->protomap = FlowGetProtoMapping(f->proto);
+
+    StreamTcpInitConfig(TRUE);
+
+    FLOWLOCK_WRLOCK(f);
+    int r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_TEST,
+                                STREAM_TOSERVER, testbuf, 8);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
+    FAIL_IF(AppLayerParserStateIssetFlag(f->alparser, APP_LAYER_PARSER_MEMCAP));
+    FAIL_IF(MemcapCounterGet(&mc->memuse) != 8);
+
+    r = AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_TEST,
+                            STREAM_TOSERVER, testbuf, 16);
+    FAIL_IF(r != 0);
+    FAIL_IF_NOT(ssn.flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
+    FAIL_IF_NOT(AppLayerParserStateIssetFlag(f->alparser, APP_LAYER_PARSER_MEMCAP));
+    FAIL_IF(MemcapCounterGet(&mc->memuse) != 24);
+    FLOWLOCK_UNLOCK(f);
+
+    AppLayerParserStateCleanup(f, f->alstate, f->alparser);
+    f->alstate = NULL;
+    f->alparser = NULL;
+    FAIL_IF(MemcapCounterGet(&mc->memuse) != 0);
+
+    MemcapCounterDestroy(&mc->memuse);
+    SCFreeAligned(mc);
+    AppLayerParserRestoreParserTable();
+    StreamTcpFreeConfig(TRUE);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    UTHFreeFlow(f);
+    PASS;
+}
 
 void AppLayerParserRegisterUnittests(void)
 {
@@ -2129,6 +2522,7 @@ void AppLayerParserRegisterUnittests(void)
 
     UtRegisterTest("AppLayerParserTest01", AppLayerParserTest01);
     UtRegisterTest("AppLayerParserTest02", AppLayerParserTest02);
+    UtRegisterTest("AppLayerParserTest03", AppLayerParserTest03);
 
     SCReturn;
 }
@@ -36,6 +36,12 @@
 #define APP_LAYER_PARSER_NO_REASSEMBLY          BIT_U8(2)
 #define APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD  BIT_U8(3)
 #define APP_LAYER_PARSER_BYPASS_READY           BIT_U8(4)
+#define APP_LAYER_PARSER_STREAM_DEPTH_LIMIT     BIT_U8(5)
+/** the flow went over the memcap of its protocol and was degraded, the
+ *  parser should stop buffering body data */
+#define APP_LAYER_PARSER_MEMCAP                 BIT_U8(6)
+/** handshake is done, the rest of the session is encrypted */
+#define APP_LAYER_PARSER_PAYLOAD_ENCRYPTED      BIT_U8(7)
 
 /* Flags for AppLayerParserProtoCtx. */
 #define APP_LAYER_PARSER_OPT_ACCEPT_GAPS        BIT_U32(0)
@@ -146,6 +152,11 @@ void AppLayerParserRegisterLogger(uint8_t ipproto, AppProto alproto);
 void AppLayerParserRegisterLoggerBits(uint8_t ipproto, AppProto alproto, LoggerId bits);
 void AppLayerParserRegisterTruncateFunc(uint8_t ipproto, AppProto alproto,
                              void (*Truncate)(void *, uint8_t));
+void AppLayerParserRegisterCompactFunc(uint8_t ipproto, AppProto alproto,
+                             void (*StateCompact)(void *alstate));
+void AppLayerParserRegisterGetStateMemuseFunc(uint8_t ipproto, AppProto alproto,
+                             uint64_t (*StateGetMemuse)(void *alstate));
+void AppLayerParserRegisterMemcap(uint8_t ipproto, AppProto alproto);
 void AppLayerParserRegisterGetStateProgressFunc(uint8_t ipproto, AppProto alproto,
     int (*StateGetStateProgress)(void *alstate, uint8_t direction));
 void AppLayerParserRegisterTxFreeFunc(uint8_t ipproto, AppProto alproto,
@@ -233,10 +244,12 @@ int AppLayerParserProtocolIsTxAware(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolIsTxEventAware(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolSupportsTxs(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto);
+int AppLayerParserProtocolHasMemcap(uint8_t ipproto, AppProto alproto);
 LoggerId AppLayerParserProtocolGetLoggerBits(uint8_t ipproto, AppProto alproto);
 void AppLayerParserTriggerRawStreamReassembly(Flow *f, int direction);
 void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto, uint32_t stream_depth);
 uint32_t AppLayerParserGetStreamDepth(const Flow *f);
+uint64_t AppLayerParserGetStateMemuse(const Flow *f);
 
 /***** Cleanup *****/
 
@@ -247,9 +260,11 @@ void AppLayerParserRegisterProtocolParsers(void);
 
 void AppLayerParserStateSetFlag(AppLayerParserState *pstate, uint8_t flag);
 int AppLayerParserStateIssetFlag(AppLayerParserState *pstate, uint8_t flag);
+void AppLayerParserStateSetStreamDepthLimit(AppLayerParserState *pstate, uint32_t size);
 
 void AppLayerParserStreamTruncated(uint8_t ipproto, AppProto alproto, void *alstate,
                         uint8_t direction);
+void AppLayerParserStateCompact(Flow *f);
 
 
 
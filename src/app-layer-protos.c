@@ -99,6 +99,12 @@ const char *AppProtoToString(AppProto alproto)
         case ALPROTO_DHCP:
             proto_name = "dhcp";
             break;
+        case ALPROTO_HTTP2:
+            proto_name = "http2";
+            break;
+        case ALPROTO_QUIC:
+            proto_name = "quic";
+            break;
         case ALPROTO_TEMPLATE:
             proto_name = "template";
             break;
@@ -143,6 +149,8 @@ AppProto StringToAppProto(const char *proto_name)
     if (strcmp(proto_name,"ikev2")==0) return ALPROTO_IKEV2;
     if (strcmp(proto_name,"krb5")==0) return ALPROTO_KRB5;
     if (strcmp(proto_name,"dhcp")==0) return ALPROTO_DHCP;
+    if (strcmp(proto_name,"http2")==0) return ALPROTO_HTTP2;
+    if (strcmp(proto_name,"quic")==0) return ALPROTO_QUIC;
     if (strcmp(proto_name,"template")==0) return ALPROTO_TEMPLATE;
     if (strcmp(proto_name,"template-rust")==0) return ALPROTO_TEMPLATE_RUST;
     if (strcmp(proto_name,"failed")==0) return ALPROTO_FAILED;
@@ -50,6 +50,8 @@ enum AppProtoEnum {
     ALPROTO_IKEV2,
     ALPROTO_KRB5,
     ALPROTO_DHCP,
+    ALPROTO_HTTP2,
+    ALPROTO_QUIC,
     ALPROTO_TEMPLATE,
     ALPROTO_TEMPLATE_RUST,
 
@@ -72,6 +74,19 @@ static inline bool AppProtoIsValid(AppProto a)
     return ((a > ALPROTO_UNKNOWN && a < ALPROTO_FAILED));
 }
 
+/**
+ * \brief see if a rule for sigproto applies to a flow of alproto
+ *
+ * Rules for http also inspect http2 flows, through the http2
+ * engines of the http buffers.
+ */
+static inline bool AppProtoEquals(AppProto sigproto, AppProto alproto)
+{
+    if (sigproto == alproto)
+        return true;
+    return (sigproto == ALPROTO_HTTP && alproto == ALPROTO_HTTP2);
+}
+
 /**
  * \brief Maps the ALPROTO_*, to its string equivalent.
  *
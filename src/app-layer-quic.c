@@ -0,0 +1,71 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * QUIC parser registration. The parser is implemented in rust, see
+ * rust/src/quic.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-unittest.h"
+#include "app-layer-parser.h"
+#include "app-layer-quic.h"
+
+#ifdef HAVE_RUST
+#include "rust-quic-quic-gen.h"
+
+static void QuicParseConfig(void)
+{
+    /* past the handshake the flow is encrypted: by default only its
+     * inspection is stopped, with 'bypass' the flow is bypassed too */
+    ConfNode *enc_handle = ConfGetNode("app-layer.protocols.quic.encryption-handling");
+    if (enc_handle != NULL && enc_handle->val != NULL) {
+        SCLogDebug("have app-layer.protocols.quic.encryption-handling = %s",
+                enc_handle->val);
+        if (strcmp(enc_handle->val, "bypass") == 0) {
+            rs_quic_set_bypass(true);
+        } else if (strcmp(enc_handle->val, "default") != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "unknown value for "
+                    "app-layer.protocols.quic.encryption-handling: %s, "
+                    "using default", enc_handle->val);
+        }
+    }
+}
+#endif /* HAVE_RUST */
+
+void RegisterQuicParsers(void)
+{
+#ifdef HAVE_RUST
+    rs_quic_register_parser();
+    if (AppLayerParserConfParserEnabled("udp", "quic")) {
+        QuicParseConfig();
+    }
+#endif /* HAVE_RUST */
+#ifdef UNITTESTS
+    AppLayerParserRegisterProtocolUnittests(IPPROTO_UDP, ALPROTO_QUIC,
+        QuicParserRegisterTests);
+#endif
+}
+
+void QuicParserRegisterTests(void)
+{
+#ifdef UNITTESTS
+#endif
+}
@@ -212,6 +212,11 @@ static void SMBStateTruncate(void *state, uint8_t direction)
     return rs_smb_state_truncate(state, direction);
 }
 
+static uint64_t SMBStateGetMemuse(void *state)
+{
+    return rs_smb_state_get_memuse(state);
+}
+
 static int SMBRegisterPatternsForProtocolDetection(void)
 {
     int r = 0;
@@ -320,6 +325,9 @@ void RegisterSMBParsers(void)
         AppLayerParserRegisterTruncateFunc(IPPROTO_TCP, ALPROTO_SMB,
                                           SMBStateTruncate);
         AppLayerParserRegisterGetFilesFunc(IPPROTO_TCP, ALPROTO_SMB, SMBGetFiles);
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_SMB,
+                SMBStateGetMemuse);
+        AppLayerParserRegisterMemcap(IPPROTO_TCP, ALPROTO_SMB);
 
         /* This parser accepts gaps. */
         AppLayerParserRegisterOptionFlags(IPPROTO_TCP, ALPROTO_SMB,
@@ -336,6 +344,28 @@ void RegisterSMBParsers(void)
         }
         SCLogConfig("SMB stream depth: %u", stream_depth);
 
+        p = ConfGetNode("app-layer.protocols.smb.file-ooo-memcap");
+        if (p != NULL) {
+            uint64_t value;
+            if (ParseSizeStringU64(p->val, &value) < 0) {
+                SCLogError(SC_ERR_SMB_CONFIG, "invalid value for file-ooo-memcap %s", p->val);
+            } else {
+                rs_smb_set_file_ooo_memcap(value);
+                SCLogConfig("SMB file out of order memcap: %"PRIu64, value);
+            }
+        }
+
+        p = ConfGetNode("app-layer.protocols.smb.file-ooo-spill-size");
+        if (p != NULL) {
+            uint64_t value;
+            if (ParseSizeStringU64(p->val, &value) < 0) {
+                SCLogError(SC_ERR_SMB_CONFIG, "invalid value for file-ooo-spill-size %s", p->val);
+            } else {
+                rs_smb_set_file_ooo_spill_size(value);
+                SCLogConfig("SMB file out of order spill size: %"PRIu64, value);
+            }
+        }
+
         AppLayerParserSetStreamDepth(IPPROTO_TCP, ALPROTO_SMB, stream_depth);
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
@@ -146,6 +146,8 @@ SCEnumCharMap smtp_decoder_event_table[ ] = {
       SMTP_DECODER_EVENT_MIME_LONG_HEADER_VALUE },
     { "MIME_LONG_BOUNDARY",
       SMTP_DECODER_EVENT_MIME_BOUNDARY_TOO_LONG },
+    { "MIME_DECODED_LIMIT",
+      SMTP_DECODER_EVENT_MIME_DECODED_LIMIT },
 
     /* Invalid behavior or content */
     { "DUPLICATE_FIELDS",
@@ -233,7 +235,7 @@ SCEnumCharMap smtp_reply_map[ ] = {
 };
 
 /* Create SMTP config structure */
-SMTPConfig smtp_config = { 0, { 0, 0, 0, 0, 0 }, 0, 0, 0, 0, STREAMING_BUFFER_CONFIG_INITIALIZER};
+SMTPConfig smtp_config = { 0, { 0, 0, 0, 0, 0, 0 }, 0, 0, 0, 0, STREAMING_BUFFER_CONFIG_INITIALIZER};
 
 static SMTPString *SMTPStringAlloc(void);
 
@@ -284,6 +286,15 @@ static void SMTPConfigure(void) {
         if (ret) {
             smtp_config.mime_config.body_md5 = val;
         }
+
+        const char *str = NULL;
+        if (ConfGetChildValue(config, "decoded-limit", &str) == 1) {
+            if (ParseSizeStringU32(str, &smtp_config.mime_config.decoded_limit) < 0) {
+                SCLogWarning(SC_ERR_SIZE_PARSE,
+                        "parsing decoded-limit %s failed", str);
+                smtp_config.mime_config.decoded_limit = 0;
+            }
+        }
     }
 
     /* Pass mime config data to MimeDec API */
@@ -527,6 +538,13 @@ int SMTPProcessDataChunk(const uint8_t *chunk, uint32_t len,
     SCReturnInt(ret);
 }
 
+/** line lengths are validated by the parser, not the line buffer */
+static const LineBufferConfig smtp_line_config = {
+    .max_len = 0,
+    .Realloc = NULL,
+    .Free = NULL,
+};
+
 /**
  * \internal
  * \brief Get the next line from input.  It doesn't do any length validation.
@@ -540,217 +558,24 @@ int SMTPProcessDataChunk(const uint8_t *chunk, uint32_t len,
 static int SMTPGetLine(SMTPState *state)
 {
     SCEnter();
-    void *ptmp;
-
-    /* we have run out of input */
-    if (state->input_len <= 0)
-        return -1;
-
-    /* toserver */
-    if (state->direction == 0) {
-        if (state->ts_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->ts_current_line_lf_seen = 0;
-            if (state->ts_current_line_db == 1) {
-                state->ts_current_line_db = 0;
-                SCFree(state->ts_db);
-                state->ts_db = NULL;
-                state->ts_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
-        }
-
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->ts_current_line_db == 0) {
-                state->ts_db = SCMalloc(state->input_len);
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                state->ts_current_line_db = 1;
-                memcpy(state->ts_db, state->input, state->input_len);
-                state->ts_db_len = state->input_len;
-            } else {
-                ptmp = SCRealloc(state->ts_db,
-                                 (state->ts_db_len + state->input_len));
-                if (ptmp == NULL) {
-                    SCFree(state->ts_db);
-                    state->ts_db = NULL;
-                    state->ts_db_len = 0;
-                    return -1;
-                }
-                state->ts_db = ptmp;
-
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, state->input_len);
-                state->ts_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
-
-            return -1;
-
-        } else {
-            state->ts_current_line_lf_seen = 1;
-
-            if (state->ts_current_line_db == 1) {
-                ptmp = SCRealloc(state->ts_db,
-                                 (state->ts_db_len + (lf_idx + 1 - state->input)));
-                if (ptmp == NULL) {
-                    SCFree(state->ts_db);
-                    state->ts_db = NULL;
-                    state->ts_db_len = 0;
-                    return -1;
-                }
-                state->ts_db = ptmp;
-
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->ts_db_len += (lf_idx + 1 - state->input);
-
-                if (state->ts_db_len > 1 &&
-                    state->ts_db[state->ts_db_len - 2] == 0x0D) {
-                    state->ts_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->ts_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->ts_db;
-                state->current_line_len = state->ts_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
-
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
-
-            return 0;
-        }
-
-        /* toclient */
-    } else {
-        if (state->tc_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->tc_current_line_lf_seen = 0;
-            if (state->tc_current_line_db == 1) {
-                state->tc_current_line_db = 0;
-                SCFree(state->tc_db);
-                state->tc_db = NULL;
-                state->tc_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
-        }
-
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->tc_current_line_db == 0) {
-                state->tc_db = SCMalloc(state->input_len);
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                state->tc_current_line_db = 1;
-                memcpy(state->tc_db, state->input, state->input_len);
-                state->tc_db_len = state->input_len;
-            } else {
-                ptmp = SCRealloc(state->tc_db,
-                                 (state->tc_db_len + state->input_len));
-                if (ptmp == NULL) {
-                    SCFree(state->tc_db);
-                    state->tc_db = NULL;
-                    state->tc_db_len = 0;
-                    return -1;
-                }
-                state->tc_db = ptmp;
-
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, state->input_len);
-                state->tc_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
 
-            return -1;
-
-        } else {
-            state->tc_current_line_lf_seen = 1;
-
-            if (state->tc_current_line_db == 1) {
-                ptmp = SCRealloc(state->tc_db,
-                                 (state->tc_db_len + (lf_idx + 1 - state->input)));
-                if (ptmp == NULL) {
-                    SCFree(state->tc_db);
-                    state->tc_db = NULL;
-                    state->tc_db_len = 0;
-                    return -1;
-                }
-                state->tc_db = ptmp;
-
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->tc_db_len += (lf_idx + 1 - state->input);
-
-                if (state->tc_db_len > 1 &&
-                    state->tc_db[state->tc_db_len - 2] == 0x0D) {
-                    state->tc_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->tc_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->tc_db;
-                state->current_line_len = state->tc_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
-
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
-
-            return 0;
-        } /* else - if (lf_idx == NULL) */
+    /* fragmented lines.  Decoder event for special cases.  Not all
+     * fragmented lines should be treated as a possible evasion
+     * attempt.  With multi payload smtp chunks we can have valid
+     * cases of fragmentation.  But within the same segment chunk
+     * if we see fragmentation then it's definitely something you
+     * should alert about */
+    LineBuffer *lb = state->direction == 0 ? &state->ts_line : &state->tc_line;
+    LineBufferLine line;
+    if (LineBufferGetLine(lb, &smtp_line_config,
+                &state->input, &state->input_len, &line) < 0) {
+        SCReturnInt(-1);
     }
 
+    state->current_line = line.line;
+    state->current_line_len = line.len;
+    state->current_line_delimiter_len = line.delimiter_len;
+    SCReturnInt(0);
 }
 
 static int SMTPInsertCommandIntoCommandBuffer(uint8_t command, SMTPState *state, Flow *f)
@@ -848,6 +673,9 @@ static void SetMimeEvents(SMTPState *state)
     if (msg->anomaly_flags & ANOM_LONG_BOUNDARY) {
         SMTPSetEvent(state, SMTP_DECODER_EVENT_MIME_BOUNDARY_TOO_LONG);
     }
+    if (msg->anomaly_flags & ANOM_DECODED_LIMIT) {
+        SMTPSetEvent(state, SMTP_DECODER_EVENT_MIME_DECODED_LIMIT);
+    }
 }
 
 /**
@@ -888,6 +716,9 @@ static int SMTPProcessCommandDATA(SMTPState *state, Flow *f,
         }
         state->curr_tx->done = 1;
         SCLogDebug("marked tx as done");
+    } else if (AppLayerParserStateIssetFlag(pstate, APP_LAYER_PARSER_MEMCAP)) {
+        /* over the memcap: the rest of the message is not buffered */
+        return 0;
     } else if (smtp_config.raw_extraction) {
         // message not over, store the line. This is a substitution of
         // ProcessDataChunk
@@ -1395,6 +1226,30 @@ void *SMTPStateAlloc(void)
     return smtp_state;
 }
 
+/** \internal
+ *  \brief estimate of the memory held by the state: the line and command
+ *         buffers, the transactions and the file data buffered for them
+ */
+static uint64_t SMTPStateGetMemuse(void *alstate)
+{
+    const SMTPState *state = alstate;
+    uint64_t size = sizeof(*state) + state->cmds_buffer_len + state->helo_len;
+
+    size += state->ts_line.size + state->tc_line.size;
+
+    const SMTPTransaction *tx;
+    TAILQ_FOREACH(tx, &state->tx_list, next) {
+        size += sizeof(*tx);
+    }
+    if (state->files_ts != NULL) {
+        for (const File *ff = state->files_ts->head; ff != NULL; ff = ff->next) {
+            if (ff->sb != NULL)
+                size += ff->sb->buf_size;
+        }
+    }
+    return size;
+}
+
 static SMTPString *SMTPStringAlloc(void)
 {
     SMTPString *smtp_string = SCMalloc(sizeof(SMTPString));
@@ -1498,12 +1353,8 @@ static void SMTPStateFree(void *p)
     if (smtp_state->cmds != NULL) {
         SCFree(smtp_state->cmds);
     }
-    if (smtp_state->ts_current_line_db) {
-        SCFree(smtp_state->ts_db);
-    }
-    if (smtp_state->tc_current_line_db) {
-        SCFree(smtp_state->tc_db);
-    }
+    LineBufferFree(&smtp_state->ts_line, &smtp_line_config);
+    LineBufferFree(&smtp_state->tc_line, &smtp_line_config);
 
     if (smtp_state->helo) {
         SCFree(smtp_state->helo);
@@ -1642,6 +1493,37 @@ static void *SMTPStateGetTx(void *state, uint64_t id)
 
 }
 
+/** \brief tx iterator walking the tx list
+ *
+ *  The iterator state points to the tx following the one returned, so
+ *  the returned tx can be freed before the next call.
+ */
+static AppLayerGetTxIterTuple SMTPStateGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    SMTPState *smtp_state = (SMTPState *)alstate;
+    SMTPTransaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&smtp_state->tx_list);
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_id < min_tx_id)
+            continue;
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        AppLayerGetTxIterTuple tuple = {
+            .tx_ptr = tx,
+            .tx_id = tx->tx_id,
+            .has_next = (state->un.ptr != NULL),
+        };
+        return tuple;
+    }
+
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+    return no_tuple;
+}
+
 static void SMTPStateSetTxLogged(void *state, void *vtx, LoggerId logged)
 {
     SMTPTransaction *tx = vtx;
@@ -1774,11 +1656,16 @@ void RegisterSMTPParsers(void)
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetAlstateProgress);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxCnt);
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+                SMTPStateGetTxIterator);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxLogged,
                                           SMTPStateSetTxLogged);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_SMTP,
                                                                SMTPStateGetAlstateProgressCompletionStatus);
         AppLayerParserRegisterTruncateFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateTruncate);
+        AppLayerParserRegisterGetStateMemuseFunc(IPPROTO_TCP, ALPROTO_SMTP,
+                SMTPStateGetMemuse);
+        AppLayerParserRegisterMemcap(IPPROTO_TCP, ALPROTO_SMTP);
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -3752,10 +3639,8 @@ static int SMTPParserTest07(void)
     }
     if (smtp_state->current_line != NULL ||
         smtp_state->current_line_len != 0 ||
-        smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != request1_1_len ||
-        memcmp(smtp_state->ts_db, request1_1, request1_1_len) != 0) {
+        smtp_state->ts_line.len != (uint32_t)request1_1_len ||
+        memcmp(smtp_state->ts_line.buf, request1_1, request1_1_len) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -3769,12 +3654,9 @@ static int SMTPParserTest07(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != (int32_t)strlen(request1_str) ||
-        memcmp(smtp_state->ts_db, request1_str, strlen(request1_str)) != 0 ||
-        smtp_state->current_line != smtp_state->ts_db ||
-        smtp_state->current_line_len != smtp_state->ts_db_len) {
+    if (smtp_state->current_line != smtp_state->ts_line.buf ||
+        smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
+        memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -3788,9 +3670,7 @@ static int SMTPParserTest07(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+    if (smtp_state->ts_line.len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
         memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
@@ -3867,10 +3747,8 @@ static int SMTPParserTest08(void)
     }
     if (smtp_state->current_line != NULL ||
         smtp_state->current_line_len != 0 ||
-        smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != request1_1_len ||
-        memcmp(smtp_state->ts_db, request1_1, request1_1_len) != 0) {
+        smtp_state->ts_line.len != (uint32_t)request1_1_len ||
+        memcmp(smtp_state->ts_line.buf, request1_1, request1_1_len) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -3884,12 +3762,9 @@ static int SMTPParserTest08(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != (int32_t)strlen(request1_str) ||
-        memcmp(smtp_state->ts_db, request1_str, strlen(request1_str)) != 0 ||
-        smtp_state->current_line != smtp_state->ts_db ||
-        smtp_state->current_line_len != smtp_state->ts_db_len) {
+    if (smtp_state->current_line != smtp_state->ts_line.buf ||
+        smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
+        memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -3903,9 +3778,7 @@ static int SMTPParserTest08(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+    if (smtp_state->ts_line.len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
         memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
@@ -3982,10 +3855,8 @@ static int SMTPParserTest09(void)
     }
     if (smtp_state->current_line != NULL ||
         smtp_state->current_line_len != 0 ||
-        smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != request1_1_len ||
-        memcmp(smtp_state->ts_db, request1_1, request1_1_len) != 0) {
+        smtp_state->ts_line.len != (uint32_t)request1_1_len ||
+        memcmp(smtp_state->ts_line.buf, request1_1, request1_1_len) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -3999,12 +3870,9 @@ static int SMTPParserTest09(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != (int32_t)strlen(request1_str) ||
-        memcmp(smtp_state->ts_db, request1_str, strlen(request1_str)) != 0 ||
-        smtp_state->current_line != smtp_state->ts_db ||
-        smtp_state->current_line_len != smtp_state->ts_db_len) {
+    if (smtp_state->current_line != smtp_state->ts_line.buf ||
+        smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
+        memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -4018,9 +3886,7 @@ static int SMTPParserTest09(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+    if (smtp_state->ts_line.len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
         memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
@@ -4097,10 +3963,8 @@ static int SMTPParserTest10(void)
     }
     if (smtp_state->current_line != NULL ||
         smtp_state->current_line_len != 0 ||
-        smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != request1_1_len ||
-        memcmp(smtp_state->ts_db, request1_1, request1_1_len) != 0) {
+        smtp_state->ts_line.len != (uint32_t)request1_1_len ||
+        memcmp(smtp_state->ts_line.buf, request1_1, request1_1_len) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -4114,12 +3978,9 @@ static int SMTPParserTest10(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 1 ||
-        smtp_state->ts_db == NULL ||
-        smtp_state->ts_db_len != (int32_t)strlen(request1_str) ||
-        memcmp(smtp_state->ts_db, request1_str, strlen(request1_str)) != 0 ||
-        smtp_state->current_line != smtp_state->ts_db ||
-        smtp_state->current_line_len != smtp_state->ts_db_len) {
+    if (smtp_state->current_line != smtp_state->ts_line.buf ||
+        smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
+        memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
     }
@@ -4133,9 +3994,7 @@ static int SMTPParserTest10(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+    if (smtp_state->ts_line.len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request2_str) ||
         memcmp(smtp_state->current_line, request2_str, strlen(request2_str)) != 0) {
@@ -4206,9 +4065,7 @@ static int SMTPParserTest11(void)
     }
     if (smtp_state->current_line == NULL ||
         smtp_state->current_line_len != 0 ||
-        smtp_state->ts_current_line_db == 1 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+        smtp_state->ts_line.len != 0 ||
         memcmp(smtp_state->current_line, request1_str, strlen(request1_str)) != 0) {
         printf("smtp parser in inconsistent state\n");
         goto end;
@@ -4223,9 +4080,7 @@ static int SMTPParserTest11(void)
         goto end;
     }
     FLOWLOCK_UNLOCK(&f);
-    if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
-        smtp_state->ts_db_len != 0 ||
+    if (smtp_state->ts_line.len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request2_str) ||
         memcmp(smtp_state->current_line, request2_str, strlen(request2_str)) != 0) {
@@ -28,6 +28,7 @@
 #include "util-decode-mime.h"
 #include "queue.h"
 #include "util-streaming-buffer.h"
+#include "util-line.h"
 
 enum {
     SMTP_DECODER_EVENT_INVALID_REPLY,
@@ -50,6 +51,7 @@ enum {
     SMTP_DECODER_EVENT_MIME_LONG_HEADER_NAME,
     SMTP_DECODER_EVENT_MIME_LONG_HEADER_VALUE,
     SMTP_DECODER_EVENT_MIME_BOUNDARY_TOO_LONG,
+    SMTP_DECODER_EVENT_MIME_DECODED_LIMIT,
 
     /* Invalid behavior or content */
     SMTP_DECODER_EVENT_DUPLICATE_FIELDS,
@@ -122,21 +124,9 @@ typedef struct SMTPState_ {
     int32_t current_line_len;
     uint8_t current_line_delimiter_len;
 
-    /** used to indicate if the current_line buffer is a malloced buffer.  We
-     * use a malloced buffer, if a line is fragmented */
-    uint8_t *tc_db;
-    int32_t tc_db_len;
-    uint8_t tc_current_line_db;
-    /** we have see LF for the currently parsed line */
-    uint8_t tc_current_line_lf_seen;
-
-    /** used to indicate if the current_line buffer is a malloced buffer.  We
-     * use a malloced buffer, if a line is fragmented */
-    uint8_t *ts_db;
-    int32_t ts_db_len;
-    uint8_t ts_current_line_db;
-    /** we have see LF for the currently parsed line */
-    uint8_t ts_current_line_lf_seen;
+    /** fragmented lines of each direction */
+    LineBuffer tc_line;
+    LineBuffer ts_line;
 
     /** var to indicate parser state */
     uint8_t parser_state;
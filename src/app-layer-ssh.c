@@ -440,6 +440,7 @@ static int SSHParseRequest(Flow *f, void *state, AppLayerParserState *pstate,
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_PAYLOAD_ENCRYPTED);
     }
 
     SCReturnInt(r);
@@ -465,6 +466,7 @@ static int SSHParseResponse(Flow *f, void *state, AppLayerParserState *pstate,
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_PAYLOAD_ENCRYPTED);
     }
 
     SCReturnInt(r);
@@ -2218,6 +2220,11 @@ static int SSHParserTest18(void)
         goto end;
     }
 
+    if (!(f.flags & FLOW_PAYLOAD_ENCRYPTED)) {
+        printf("payload not flagged as encrypted: ");
+        goto end;
+    }
+
     result = 1;
 end:
     if (alp_tctx != NULL)
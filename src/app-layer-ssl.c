@@ -52,6 +52,7 @@
 #include "util-pool.h"
 #include "util-byte.h"
 #include "util-ja3.h"
+#include "util-misc.h"
 #include "flow-util.h"
 #include "flow-private.h"
 
@@ -90,15 +91,22 @@ enum SslConfigEncryptHandling {
     SSL_CNF_ENC_HANDLE_DEFAULT = 0, /**< disable raw content, continue tracking */
     SSL_CNF_ENC_HANDLE_BYPASS = 1,  /**< skip processing of flow, bypass if possible */
     SSL_CNF_ENC_HANDLE_FULL = 2,    /**< handle fully like any other proto */
+    SSL_CNF_ENC_HANDLE_HANDSHAKE_ONLY = 3, /**< bypass, unless rules need the
+                                                encrypted records, then default */
 };
 
 typedef struct SslConfig_ {
     enum SslConfigEncryptHandling encrypt_mode;
     int enable_ja3;
+    /** stream to still reassemble once encrypted, 0 for no limit */
+    uint32_t encrypted_stream_depth;
 } SslConfig;
 
 SslConfig ssl_config;
 
+/** set if a loaded rule needs the records after the handshake */
+static SC_ATOMIC_DECLARE(int, ssl_encrypted_inspection);
+
 /* SSLv3 record types */
 #define SSLV3_CHANGE_CIPHER_SPEC       20
 #define SSLV3_ALERT_PROTOCOL           21
@@ -211,6 +219,41 @@ static LoggerId SSLGetTxLogged(void *state, void *tx)
     return 0;
 }
 
+/**
+ * \brief Sets a flag that informs the TLS app layer that a rule needs the
+ *        records that follow the handshake, like the heartbeat events.
+ * \initonly
+ */
+void SSLEnableEncryptedInspection(void)
+{
+    SC_ATOMIC_SET(ssl_encrypted_inspection, 1);
+}
+
+/** \internal
+ *  \brief get the encryption handling, resolving 'handshake-only' */
+static inline enum SslConfigEncryptHandling SSLGetEncryptMode(void)
+{
+    if (ssl_config.encrypt_mode == SSL_CNF_ENC_HANDLE_HANDSHAKE_ONLY) {
+        return SC_ATOMIC_GET(ssl_encrypted_inspection) ?
+            SSL_CNF_ENC_HANDLE_DEFAULT : SSL_CNF_ENC_HANDLE_BYPASS;
+    }
+    return ssl_config.encrypt_mode;
+}
+
+/** \internal
+ *  \brief stop tracking the session once it is encrypted
+ *
+ *  Without any use for the encrypted records, neither the parser nor the
+ *  reassembly has to see them. The flow is bypassed if possible.
+ */
+static void SSLSetBypass(AppLayerParserState *pstate)
+{
+    SCLogDebug("setting APP_LAYER_PARSER_NO_REASSEMBLY");
+    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
+    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
+    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+}
+
 static int SSLGetAlstateProgressCompletionStatus(uint8_t direction)
 {
     return TLS_STATE_FINISHED;
@@ -632,7 +675,8 @@ static inline int TLSDecodeValueIsGREASE(const uint16_t value)
 
 static inline int TLSDecodeHSHelloVersion(SSLState *ssl_state,
                                           const uint8_t * const initial_input,
-                                          const uint32_t input_len)
+                                          const uint32_t input_len,
+                                          JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *input = (uint8_t *)initial_input;
 
@@ -668,14 +712,8 @@ static inline int TLSDecodeHSHelloVersion(SSLState *ssl_state,
         ssl_state->curr_connp->version = TLS_VERSION_13_PRE_DRAFT16;
     }
 
-    if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3 && ssl_state->ja3_str == NULL) {
-
-        ssl_state->ja3_str = Ja3BufferInit();
-        if (ssl_state->ja3_str == NULL)
-            return -1;
-
-        int rc = Ja3BufferAddValue(&ssl_state->ja3_str, version);
+    if (ja3_ctx != NULL) {
+        int rc = Ja3AddValue(ja3_ctx, JA3_FIELD_VERSION, version);
         if (rc != 0)
             return -1;
     }
@@ -754,7 +792,8 @@ invalid_length:
 
 static inline int TLSDecodeHSHelloCipherSuites(SSLState *ssl_state,
                                            const uint8_t * const initial_input,
-                                           const uint32_t input_len)
+                                           const uint32_t input_len,
+                                           JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *input = (uint8_t *)initial_input;
 
@@ -762,6 +801,12 @@ static inline int TLSDecodeHSHelloCipherSuites(SSLState *ssl_state,
         goto invalid_length;
 
     if (ssl_state->current_flags & SSL_AL_FLAG_STATE_SERVER_HELLO) {
+        if (ja3_ctx != NULL) {
+            uint16_t cipher_suite = *input << 8 | *(input + 1);
+            if (Ja3AddValue(ja3_ctx, JA3_FIELD_CIPHERS, cipher_suite) != 0)
+                return -1;
+        }
+
         /* Skip cipher suite */
         input += 2;
     } else {
@@ -776,40 +821,27 @@ static inline int TLSDecodeHSHelloCipherSuites(SSLState *ssl_state,
             goto invalid_length;
         }
 
-        if (ssl_config.enable_ja3) {
-            int rc;
-
-            JA3Buffer *ja3_cipher_suites = Ja3BufferInit();
-            if (ja3_cipher_suites == NULL)
-                return -1;
-
+        if (ja3_ctx != NULL) {
             uint16_t processed_len = 0;
             /* coverity[tainted_data] */
             while (processed_len < cipher_suites_length)
             {
-                if (!(HAS_SPACE(2))) {
-                    Ja3BufferFree(&ja3_cipher_suites);
+                if (!(HAS_SPACE(2)))
                     goto invalid_length;
-                }
 
                 uint16_t cipher_suite = *input << 8 | *(input + 1);
                 input += 2;
 
                 if (TLSDecodeValueIsGREASE(cipher_suite) != 1) {
-                    rc = Ja3BufferAddValue(&ja3_cipher_suites, cipher_suite);
-                    if (rc != 0) {
+                    int rc = Ja3AddValue(ja3_ctx, JA3_FIELD_CIPHERS,
+                                         cipher_suite);
+                    if (rc != 0)
                         return -1;
-                    }
                 }
 
                 processed_len += 2;
             }
 
-            rc = Ja3BufferAppendBuffer(&ssl_state->ja3_str, &ja3_cipher_suites);
-            if (rc == -1) {
-                return -1;
-            }
-
         } else {
             /* Skip cipher suites */
             input += cipher_suites_length;
@@ -995,7 +1027,7 @@ invalid_length:
 static inline int TLSDecodeHSHelloExtensionEllipticCurves(SSLState *ssl_state,
                                           const uint8_t * const initial_input,
                                           const uint32_t input_len,
-                                          JA3Buffer *ja3_elliptic_curves)
+                                          JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *input = (uint8_t *)initial_input;
 
@@ -1013,7 +1045,7 @@ static inline int TLSDecodeHSHelloExtensionEllipticCurves(SSLState *ssl_state,
         goto invalid_length;
 
     if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3) {
+            ja3_ctx != NULL) {
         uint16_t ec_processed_len = 0;
         /* coverity[tainted_data] */
         while (ec_processed_len < elliptic_curves_len)
@@ -1022,8 +1054,8 @@ static inline int TLSDecodeHSHelloExtensionEllipticCurves(SSLState *ssl_state,
             input += 2;
 
             if (TLSDecodeValueIsGREASE(elliptic_curve) != 1) {
-                int rc = Ja3BufferAddValue(&ja3_elliptic_curves,
-                                           elliptic_curve);
+                int rc = Ja3AddValue(ja3_ctx, JA3_FIELD_CURVES,
+                                     elliptic_curve);
                 if (rc != 0)
                     return -1;
             }
@@ -1049,7 +1081,7 @@ invalid_length:
 static inline int TLSDecodeHSHelloExtensionEllipticCurvePF(SSLState *ssl_state,
                                             const uint8_t * const initial_input,
                                             const uint32_t input_len,
-                                            JA3Buffer *ja3_elliptic_curves_pf)
+                                            JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *input = (uint8_t *)initial_input;
 
@@ -1067,7 +1099,7 @@ static inline int TLSDecodeHSHelloExtensionEllipticCurvePF(SSLState *ssl_state,
         goto invalid_length;
 
     if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3) {
+            ja3_ctx != NULL) {
         uint8_t ec_pf_processed_len = 0;
         /* coverity[tainted_data] */
         while (ec_pf_processed_len < ec_pf_len)
@@ -1076,8 +1108,8 @@ static inline int TLSDecodeHSHelloExtensionEllipticCurvePF(SSLState *ssl_state,
             input += 1;
 
             if (TLSDecodeValueIsGREASE(elliptic_curve_pf) != 1) {
-                int rc = Ja3BufferAddValue(&ja3_elliptic_curves_pf,
-                                           elliptic_curve_pf);
+                int rc = Ja3AddValue(ja3_ctx, JA3_FIELD_POINT_FORMATS,
+                                     elliptic_curve_pf);
                 if (rc != 0)
                     return -1;
             }
@@ -1102,26 +1134,12 @@ invalid_length:
 
 static inline int TLSDecodeHSHelloExtensions(SSLState *ssl_state,
                                          const uint8_t * const initial_input,
-                                         const uint32_t input_len)
+                                         const uint32_t input_len,
+                                         JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *input = (uint8_t *)initial_input;
 
     int ret;
-    int rc;
-
-    JA3Buffer *ja3_extensions = NULL;
-    JA3Buffer *ja3_elliptic_curves = NULL;
-    JA3Buffer *ja3_elliptic_curves_pf = NULL;
-
-    if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3) {
-        ja3_extensions = Ja3BufferInit();
-        ja3_elliptic_curves = Ja3BufferInit();
-        ja3_elliptic_curves_pf = Ja3BufferInit();
-        if (ja3_extensions == NULL || ja3_elliptic_curves == NULL ||
-                ja3_elliptic_curves_pf == NULL)
-            goto error;
-    }
 
     /* Extensions are optional (RFC5246 section 7.4.1.2) */
     if (!(HAS_SPACE(2)))
@@ -1171,7 +1189,7 @@ static inline int TLSDecodeHSHelloExtensions(SSLState *ssl_state,
                 /* coverity[tainted_data] */
                 ret = TLSDecodeHSHelloExtensionEllipticCurves(ssl_state, input,
                                                               ext_len,
-                                                              ja3_elliptic_curves);
+                                                              ja3_ctx);
                 if (ret < 0)
                     goto end;
 
@@ -1185,7 +1203,7 @@ static inline int TLSDecodeHSHelloExtensions(SSLState *ssl_state,
                 /* coverity[tainted_data] */
                 ret = TLSDecodeHSHelloExtensionEllipticCurvePF(ssl_state, input,
                                                                ext_len,
-                                                               ja3_elliptic_curves_pf);
+                                                               ja3_ctx);
                 if (ret < 0)
                     goto end;
 
@@ -1239,35 +1257,15 @@ static inline int TLSDecodeHSHelloExtensions(SSLState *ssl_state,
             }
         }
 
-        if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-                ssl_config.enable_ja3) {
-            if (TLSDecodeValueIsGREASE(ext_type) != 1) {
-                rc = Ja3BufferAddValue(&ja3_extensions, ext_type);
-                if (rc != 0)
-                    goto error;
-            }
+        if (ja3_ctx != NULL && TLSDecodeValueIsGREASE(ext_type) != 1) {
+            if (Ja3AddValue(ja3_ctx, JA3_FIELD_EXTENSIONS, ext_type) != 0)
+                return -1;
         }
 
         processed_len += ext_len + 4;
     }
 
 end:
-    if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3) {
-        rc = Ja3BufferAppendBuffer(&ssl_state->ja3_str, &ja3_extensions);
-        if (rc == -1)
-            goto error;
-
-        rc = Ja3BufferAppendBuffer(&ssl_state->ja3_str, &ja3_elliptic_curves);
-        if (rc == -1)
-            goto error;
-
-        rc = Ja3BufferAppendBuffer(&ssl_state->ja3_str,
-                                   &ja3_elliptic_curves_pf);
-        if (rc == -1)
-            goto error;
-    }
-
     return (input - initial_input);
 
 invalid_length:
@@ -1275,25 +1273,28 @@ invalid_length:
     SSLSetEvent(ssl_state,
                 TLS_DECODER_EVENT_HANDSHAKE_INVALID_LENGTH);
 
-error:
-    if (ja3_extensions != NULL)
-        Ja3BufferFree(&ja3_extensions);
-    if (ja3_elliptic_curves != NULL)
-        Ja3BufferFree(&ja3_elliptic_curves);
-    if (ja3_elliptic_curves_pf != NULL)
-        Ja3BufferFree(&ja3_elliptic_curves_pf);
-
     return -1;
 }
 
 static int TLSDecodeHandshakeHello(SSLState *ssl_state,
                                    const uint8_t * const input,
-                                   const uint32_t input_len)
+                                   const uint32_t input_len,
+                                   JA3ThreadCtx *ja3_ctx)
 {
     int ret;
     uint32_t parsed = 0;
 
-    ret = TLSDecodeHSHelloVersion(ssl_state, input, input_len);
+    /* fingerprint only the first client hello and server hello */
+    if (ja3_ctx != NULL) {
+        if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) ?
+                ssl_state->ja3_str != NULL : ssl_state->ja3s_str != NULL) {
+            ja3_ctx = NULL;
+        } else {
+            Ja3Reset(ja3_ctx);
+        }
+    }
+
+    ret = TLSDecodeHSHelloVersion(ssl_state, input, input_len, ja3_ctx);
     if (ret < 0)
         goto end;
 
@@ -1319,7 +1320,7 @@ static int TLSDecodeHandshakeHello(SSLState *ssl_state,
     }
 
     ret = TLSDecodeHSHelloCipherSuites(ssl_state, input + parsed,
-                                       input_len - parsed);
+                                       input_len - parsed, ja3_ctx);
     if (ret < 0)
         goto end;
 
@@ -1339,13 +1340,20 @@ static int TLSDecodeHandshakeHello(SSLState *ssl_state,
     }
 
     ret = TLSDecodeHSHelloExtensions(ssl_state, input + parsed,
-                                     input_len - parsed);
+                                     input_len - parsed, ja3_ctx);
     if (ret < 0)
         goto end;
 
-    if ((ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) &&
-            ssl_config.enable_ja3 && ssl_state->ja3_hash == NULL) {
-        ssl_state->ja3_hash = Ja3GenerateHash(ssl_state->ja3_str);
+    if (ja3_ctx != NULL) {
+        if (ssl_state->current_flags & SSL_AL_FLAG_STATE_CLIENT_HELLO) {
+            ssl_state->ja3_str = Ja3Finish(ja3_ctx, JA3_FIELD_MAX);
+            if (ssl_state->ja3_str != NULL)
+                ssl_state->ja3_hash = ssl_state->ja3_str->hash;
+        } else {
+            ssl_state->ja3s_str = Ja3Finish(ja3_ctx, JA3S_FIELD_MAX);
+            if (ssl_state->ja3s_str != NULL)
+                ssl_state->ja3s_hash = ssl_state->ja3s_str->hash;
+        }
     }
 
 end:
@@ -1354,7 +1362,8 @@ end:
 }
 
 static int SSLv3ParseHandshakeType(SSLState *ssl_state, uint8_t *input,
-                                   uint32_t input_len, uint8_t direction)
+                                   uint32_t input_len, uint8_t direction,
+                                   JA3ThreadCtx *ja3_ctx)
 {
     void *ptmp;
     uint8_t *initial_input = input;
@@ -1372,7 +1381,8 @@ static int SSLv3ParseHandshakeType(SSLState *ssl_state, uint8_t *input,
             /* Only parse the message if it is complete */
             if (input_len >= ssl_state->curr_connp->message_length &&
                       input_len >= 40) {
-                rc = TLSDecodeHandshakeHello(ssl_state, input, input_len);
+                rc = TLSDecodeHandshakeHello(ssl_state, input, input_len,
+                                             ja3_ctx);
 
                 if (rc < 0)
                     return rc;
@@ -1387,7 +1397,8 @@ static int SSLv3ParseHandshakeType(SSLState *ssl_state, uint8_t *input,
             if (input_len >= ssl_state->curr_connp->message_length &&
                     input_len >= 40) {
                 rc = TLSDecodeHandshakeHello(ssl_state, input,
-                                             ssl_state->curr_connp->message_length);
+                                             ssl_state->curr_connp->message_length,
+                                             ja3_ctx);
 
                 if (rc < 0)
                     return rc;
@@ -1552,7 +1563,8 @@ static int SSLv3ParseHandshakeType(SSLState *ssl_state, uint8_t *input,
 }
 
 static int SSLv3ParseHandshakeProtocol(SSLState *ssl_state, uint8_t *input,
-                                       uint32_t input_len, uint8_t direction)
+                                       uint32_t input_len, uint8_t direction,
+                                       JA3ThreadCtx *ja3_ctx)
 {
     uint8_t *initial_input = input;
     int retval;
@@ -1605,7 +1617,8 @@ static int SSLv3ParseHandshakeProtocol(SSLState *ssl_state, uint8_t *input,
             /* fall through */
     }
 
-    retval = SSLv3ParseHandshakeType(ssl_state, input, input_len, direction);
+    retval = SSLv3ParseHandshakeType(ssl_state, input, input_len, direction,
+                                     ja3_ctx);
     if (retval < 0) {
         return retval;
     }
@@ -2136,14 +2149,17 @@ static int SSLv2Decode(uint8_t direction, SSLState *ssl_state,
                 if ((ssl_state->flags & SSL_AL_FLAG_SSL_CLIENT_SSN_ENCRYPTED) &&
                     (ssl_state->flags & SSL_AL_FLAG_SSL_SERVER_SSN_ENCRYPTED))
                 {
-                    if (ssl_config.encrypt_mode != SSL_CNF_ENC_HANDLE_FULL) {
+                    AppLayerParserStateSetFlag(pstate,
+                            APP_LAYER_PARSER_PAYLOAD_ENCRYPTED);
+
+                    const enum SslConfigEncryptHandling mode = SSLGetEncryptMode();
+                    if (mode != SSL_CNF_ENC_HANDLE_FULL) {
                         AppLayerParserStateSetFlag(pstate,
                                 APP_LAYER_PARSER_NO_INSPECTION);
                     }
 
-                    if (ssl_config.encrypt_mode == SSL_CNF_ENC_HANDLE_BYPASS) {
-                        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
-                        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+                    if (mode == SSL_CNF_ENC_HANDLE_BYPASS) {
+                        SSLSetBypass(pstate);
                     }
                     SCLogDebug("SSLv2 No reassembly & inspection has been set");
                 }
@@ -2183,7 +2199,7 @@ static int SSLv2Decode(uint8_t direction, SSLState *ssl_state,
 
 static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
                        AppLayerParserState *pstate, uint8_t *input,
-                       uint32_t input_len)
+                       uint32_t input_len, JA3ThreadCtx *ja3_ctx)
 {
     int retval = 0;
     uint32_t parsed = 0;
@@ -2222,6 +2238,17 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
                 ssl_state->flags |= SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC;
             }
 
+            /* after the server hello and both ChangeCipherSpec records
+               everything is encrypted, so with 'bypass' there is no
+               reason to wait for the first application data record */
+            if ((ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC) &&
+                    (ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
+                    (ssl_state->flags & SSL_AL_FLAG_STATE_SERVER_HELLO) &&
+                    SSLGetEncryptMode() == SSL_CNF_ENC_HANDLE_BYPASS) {
+                ssl_state->flags |= SSL_AL_FLAG_HANDSHAKE_DONE;
+                SSLSetBypass(pstate);
+            }
+
             break;
 
         case SSLV3_ALERT_PROTOCOL:
@@ -2239,23 +2266,27 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
             /* if we see (encrypted) aplication data, then this means the
                handshake must be done */
             ssl_state->flags |= SSL_AL_FLAG_HANDSHAKE_DONE;
+            AppLayerParserStateSetFlag(pstate,
+                    APP_LAYER_PARSER_PAYLOAD_ENCRYPTED);
 
-            if (ssl_config.encrypt_mode != SSL_CNF_ENC_HANDLE_FULL) {
+            const enum SslConfigEncryptHandling mode = SSLGetEncryptMode();
+            if (mode != SSL_CNF_ENC_HANDLE_FULL) {
                 SCLogDebug("setting APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD");
                 AppLayerParserStateSetFlag(pstate,
                         APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
             }
 
+            /* keep tracking the records, but only for a while */
+            if (mode == SSL_CNF_ENC_HANDLE_DEFAULT &&
+                    ssl_config.encrypted_stream_depth != 0) {
+                AppLayerParserStateSetStreamDepthLimit(pstate,
+                        ssl_config.encrypted_stream_depth);
+            }
+
             /* Encrypted data, reassembly not asked, bypass asked, let's sacrifice
              * heartbeat lke inspection to be able to be able to bypass the flow */
-            if (ssl_config.encrypt_mode == SSL_CNF_ENC_HANDLE_BYPASS) {
-                SCLogDebug("setting APP_LAYER_PARSER_NO_REASSEMBLY");
-                AppLayerParserStateSetFlag(pstate,
-                        APP_LAYER_PARSER_NO_REASSEMBLY);
-                AppLayerParserStateSetFlag(pstate,
-                        APP_LAYER_PARSER_NO_INSPECTION);
-                AppLayerParserStateSetFlag(pstate,
-                        APP_LAYER_PARSER_BYPASS_READY);
+            if (mode == SSL_CNF_ENC_HANDLE_BYPASS) {
+                SSLSetBypass(pstate);
             }
 
             break;
@@ -2279,7 +2310,7 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
             }
 
             retval = SSLv3ParseHandshakeProtocol(ssl_state, input + parsed,
-                                                 input_len, direction);
+                                                 input_len, direction, ja3_ctx);
             if (retval < 0) {
                 SSLSetEvent(ssl_state,
                         TLS_DECODER_EVENT_INVALID_HANDSHAKE_MESSAGE);
@@ -2380,7 +2411,7 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
  * \retval >=0 On success.
  */
 static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserState *pstate,
-                     uint8_t *input, uint32_t ilen)
+                     uint8_t *input, uint32_t ilen, void *local_data)
 {
     SSLState *ssl_state = (SSLState *)alstate;
     int retval = 0;
@@ -2446,7 +2477,7 @@ static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserSt
                 } else {
                     SCLogDebug("SSLv3.x detected");
                     retval = SSLv3Decode(direction, ssl_state, pstate, input,
-                                         input_len);
+                                         input_len, local_data);
                     if (retval < 0) {
                         SCLogDebug("Error parsing SSLv3.x. Reseting parser "
                                    "state. Let's get outta here");
@@ -2488,7 +2519,7 @@ static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserSt
                     SCLogDebug("Continuing parsing SSLv3.x record from where we "
                                "previously left off");
                     retval = SSLv3Decode(direction, ssl_state, pstate, input,
-                                         input_len);
+                                         input_len, local_data);
                     if (retval < 0) {
                         SCLogDebug("Error parsing SSLv3.x.  Reseting parser "
                                    "state.  Let's get outta here");
@@ -2532,14 +2563,32 @@ static int SSLParseClientRecord(Flow *f, void *alstate, AppLayerParserState *pst
                          uint8_t *input, uint32_t input_len,
                          void *local_data, const uint8_t flags)
 {
-    return SSLDecode(f, 0 /* toserver */, alstate, pstate, input, input_len);
+    return SSLDecode(f, 0 /* toserver */, alstate, pstate, input, input_len,
+                     local_data);
 }
 
 static int SSLParseServerRecord(Flow *f, void *alstate, AppLayerParserState *pstate,
                          uint8_t *input, uint32_t input_len,
                          void *local_data, const uint8_t flags)
 {
-    return SSLDecode(f, 1 /* toclient */, alstate, pstate, input, input_len);
+    return SSLDecode(f, 1 /* toclient */, alstate, pstate, input, input_len,
+                     local_data);
+}
+
+/**
+ * \internal
+ * \brief Allocate the per thread JA3 scratch space, if JA3 is enabled.
+ */
+static void *SSLLocalStorageAlloc(void)
+{
+    if (!ssl_config.enable_ja3)
+        return NULL;
+    return Ja3ThreadCtxAlloc();
+}
+
+static void SSLLocalStorageFree(void *ptr)
+{
+    Ja3ThreadCtxFree(ptr);
 }
 
 /**
@@ -2596,10 +2645,11 @@ static void SSLStateFree(void *p)
     if (ssl_state->server_connp.session_id)
         SCFree(ssl_state->server_connp.session_id);
 
+    /* the hashes are part of the JA3 buffers */
     if (ssl_state->ja3_str)
         Ja3BufferFree(&ssl_state->ja3_str);
-    if (ssl_state->ja3_hash)
-        SCFree(ssl_state->ja3_hash);
+    if (ssl_state->ja3s_str)
+        Ja3BufferFree(&ssl_state->ja3s_str);
 
     AppLayerDecoderEventsFreeEvents(&ssl_state->decoder_events);
 
@@ -2867,6 +2917,8 @@ void RegisterSSLParsers(void)
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_TLS,
                                                                SSLGetAlstateProgressCompletionStatus);
 
+        SC_ATOMIC_INIT(ssl_encrypted_inspection);
+
         ConfNode *enc_handle = ConfGetNode("app-layer.protocols.tls.encryption-handling");
         if (enc_handle != NULL && enc_handle->val != NULL) {
             SCLogDebug("have app-layer.protocols.tls.encryption-handling = %s", enc_handle->val);
@@ -2874,6 +2926,8 @@ void RegisterSSLParsers(void)
                 ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_FULL;
             } else if (strcmp(enc_handle->val, "bypass") == 0) {
                 ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_BYPASS;
+            } else if (strcmp(enc_handle->val, "handshake-only") == 0) {
+                ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_HANDSHAKE_ONLY;
             } else if (strcmp(enc_handle->val, "default") == 0) {
                 ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_DEFAULT;
             } else {
@@ -2893,6 +2947,16 @@ void RegisterSSLParsers(void)
         }
         SCLogDebug("ssl_config.encrypt_mode %u", ssl_config.encrypt_mode);
 
+        ConfNode *p = ConfGetNode("app-layer.protocols.tls.encrypted-stream-depth");
+        if (p != NULL && p->val != NULL) {
+            if (ParseSizeStringU32(p->val, &ssl_config.encrypted_stream_depth) < 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                        "app-layer.protocols.tls.encrypted-stream-depth "
+                        "from conf file - %s.", p->val);
+                ssl_config.encrypted_stream_depth = 0;
+            }
+        }
+
         /* Check if we should generate JA3 fingerprints */
         if (ConfGetBool("app-layer.protocols.tls.ja3-fingerprints",
                         &ssl_config.enable_ja3) != 1) {
@@ -2911,6 +2975,10 @@ void RegisterSSLParsers(void)
         }
 #endif
 
+        AppLayerParserRegisterLocalStorageFunc(IPPROTO_TCP, ALPROTO_TLS,
+                                               SSLLocalStorageAlloc,
+                                               SSLLocalStorageFree);
+
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -4750,6 +4818,7 @@ static int SSLParserTest23(void)
     FAIL_IF((app_state->flags & SSL_AL_FLAG_CHANGE_CIPHER_SPEC) == 0);
 
     FAIL_IF_NOT(f.flags & FLOW_NOPAYLOAD_INSPECTION);
+    FAIL_IF_NOT(f.flags & FLOW_PAYLOAD_ENCRYPTED);
 
     if (alp_tctx != NULL)
         AppLayerParserThreadCtxFree(alp_tctx);
@@ -5205,7 +5274,10 @@ static int SSLParserTest25(void)
     PASS;
 }
 
-static int SSLParserTest26(void)
+/** \internal
+ *  \brief resumed session, with 'handshake_only' the client
+ *         ChangeCipherSpec is added, after which the flow is bypassed */
+static int SSLParserResumedSession(bool handshake_only)
 {
     Flow f;
     uint8_t client_hello[] = {
@@ -5336,6 +5408,39 @@ static int SSLParserTest26(void)
     FAIL_IF((ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC) == 0);
     FAIL_IF((ssl_state->flags & SSL_AL_FLAG_SESSION_RESUMED) == 0);
 
+#ifdef HAVE_NSS
+    /* JA3S: version, selected cipher and the extensions */
+    FAIL_IF_NULL(ssl_state->ja3s_str);
+    FAIL_IF(strcmp(ssl_state->ja3s_str->data, "771,49195,65281-11") != 0);
+    FAIL_IF_NULL(ssl_state->ja3s_hash);
+#endif
+
+    if (handshake_only) {
+        uint8_t client_change_cipher_spec[] = {
+            0x14, 0x03, 0x03, 0x00, 0x01, 0x01
+        };
+        const enum SslConfigEncryptHandling mode = ssl_config.encrypt_mode;
+        const int inspection = SC_ATOMIC_GET(ssl_encrypted_inspection);
+        ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_HANDSHAKE_ONLY;
+        SC_ATOMIC_SET(ssl_encrypted_inspection, 0);
+
+        FLOWLOCK_WRLOCK(&f);
+        r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_TLS,
+                                STREAM_TOSERVER, client_change_cipher_spec,
+                                sizeof(client_change_cipher_spec));
+        FLOWLOCK_UNLOCK(&f);
+
+        ssl_config.encrypt_mode = mode;
+        SC_ATOMIC_SET(ssl_encrypted_inspection, inspection);
+        FAIL_IF(r != 0);
+
+        /* bypassed without waiting for application data */
+        FAIL_IF((ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) == 0);
+        FAIL_IF((ssl_state->flags & SSL_AL_FLAG_HANDSHAKE_DONE) == 0);
+        FAIL_IF_NOT(f.flags & FLOW_NOPAYLOAD_INSPECTION);
+        FAIL_IF_NOT(ssn.flags & STREAMTCP_FLAG_BYPASS);
+    }
+
     AppLayerParserThreadCtxFree(alp_tctx);
     StreamTcpFreeConfig(TRUE);
     FLOW_DESTROY(&f);
@@ -5343,6 +5448,21 @@ static int SSLParserTest26(void)
     PASS;
 }
 
+static int SSLParserTest26(void)
+{
+    return SSLParserResumedSession(false);
+}
+
+/**
+ * \test With 'handshake-only' encryption handling and no rules that need
+ *       the encrypted records, the flow is bypassed once both sides sent
+ *       their ChangeCipherSpec.
+ */
+static int SSLParserTest27(void)
+{
+    return SSLParserResumedSession(true);
+}
+
 #endif /* UNITTESTS */
 
 void SSLParserRegisterTests(void)
@@ -5376,6 +5496,7 @@ void SSLParserRegisterTests(void)
     UtRegisterTest("SSLParserTest24", SSLParserTest24);
     UtRegisterTest("SSLParserTest25", SSLParserTest25);
     UtRegisterTest("SSLParserTest26", SSLParserTest26);
+    UtRegisterTest("SSLParserTest27", SSLParserTest27);
 
     UtRegisterTest("SSLParserMultimsgTest01", SSLParserMultimsgTest01);
     UtRegisterTest("SSLParserMultimsgTest02", SSLParserMultimsgTest02);
@@ -240,8 +240,12 @@ typedef struct SSLState_ {
 
     uint32_t current_flags;
 
+    /* client hello (JA3) and server hello (JA3S) fingerprints, the
+     * hashes point into the buffers */
     JA3Buffer *ja3_str;
     char *ja3_hash;
+    JA3Buffer *ja3s_str;
+    char *ja3s_hash;
 
     SSLStateConnp *curr_connp;
 
@@ -256,5 +260,6 @@ void RegisterSSLParsers(void);
 void SSLParserRegisterTests(void);
 void SSLSetEvent(SSLState *ssl_state, uint8_t event);
 void SSLVersionToString(uint16_t, char *);
+void SSLEnableEncryptedInspection(void);
 
 #endif /* __APP_LAYER_SSL_H__ */
@@ -30,6 +30,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-protos.h"
 #include "app-layer-expectation.h"
+#include "app-layer-detect-proto-cache.h"
 #include "app-layer-ftp.h"
 #include "app-layer-detect-proto.h"
 #include "stream-tcp-reassemble.h"
@@ -45,6 +46,7 @@
 #include "util-print.h"
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-trace.h"
 #include "decode-events.h"
 
 #include "app-layer-htp-mem.h"
@@ -75,11 +77,13 @@ struct AppLayerThreadCtx_ {
 typedef struct AppLayerCounterNames_ {
     char name[MAX_COUNTER_SIZE];
     char tx_name[MAX_COUNTER_SIZE];
+    char memcap_name[MAX_COUNTER_SIZE];
 } AppLayerCounterNames;
 
 typedef struct AppLayerCounters_ {
     uint16_t counter_id;
     uint16_t counter_tx_id;
+    uint16_t counter_memcap_id;
 } AppLayerCounters;
 
 /* counter names. Only used at init. */
@@ -104,6 +108,8 @@ static inline int ProtoDetectDone(const Flow *f, const TcpSession *ssn, uint8_t
  */
 static void AppLayerIncFlowCounter(ThreadVars *tv, Flow *f)
 {
+    SCTrace2(app_detect, f, f->alproto);
+
     const uint16_t id = applayer_counters[f->protomap][f->alproto].counter_id;
     if (likely(tv && id > 0)) {
         StatsIncr(tv, id);
@@ -118,6 +124,15 @@ void AppLayerIncTxCounter(ThreadVars *tv, Flow *f, uint64_t step)
     }
 }
 
+/** \brief count a flow degraded by the memcap of its protocol */
+void AppLayerIncMemcapCounter(ThreadVars *tv, Flow *f)
+{
+    const uint16_t id = applayer_counters[f->protomap][f->alproto].counter_memcap_id;
+    if (likely(tv && id > 0)) {
+        StatsIncr(tv, id);
+    }
+}
+
 /* in IDS mode protocol detection is done in reverse order:
  * when TCP data is ack'd. We want to flag the correct packet,
  * so in this case we set a flag in the flow so that the first
@@ -734,6 +749,13 @@ int AppLayerHandleUdp(ThreadVars *tv, AppLayerThreadCtx *tctx, Packet *p, Flow *
         PACKET_PROFILING_APP_STORE(tctx, p);
     }
 
+    /* UDP has no session to carry the bypass to, so the parser asking
+     * for it bypasses the flow right away */
+    if (f->alparser != NULL &&
+            AppLayerParserStateIssetFlag(f->alparser, APP_LAYER_PARSER_BYPASS_READY)) {
+        PacketBypassCallback(p);
+    }
+
     SCReturnInt(r);
 }
 
@@ -782,6 +804,7 @@ int AppLayerSetup(void)
 
     AppLayerParserRegisterProtocolParsers();
     AppLayerProtoDetectPrepareState();
+    AppLayerProtoDetectCacheSetup();
 
     AppLayerSetupCounters();
 
@@ -792,7 +815,9 @@ int AppLayerDeSetup(void)
 {
     SCEnter();
 
+    AppLayerProtoDetectCacheDeSetup();
     AppLayerProtoDetectDeSetup();
+    AppLayerExpectationDeSetup();
     AppLayerParserDeSetup();
 
     AppLayerDeSetupCounters();
@@ -857,6 +882,12 @@ void AppLayerRegisterGlobalCounters(void)
     StatsRegisterGlobalCounter("ftp.memuse", FTPMemuseGlobalCounter);
     StatsRegisterGlobalCounter("ftp.memcap", FTPMemcapGlobalCounter);
     StatsRegisterGlobalCounter("app_layer.expectations", ExpectationGetCounter);
+    StatsRegisterGlobalCounter("app_layer.detect_cache.hits",
+            AppLayerProtoDetectCacheGetHits);
+    StatsRegisterGlobalCounter("app_layer.detect_cache.misses",
+            AppLayerProtoDetectCacheGetMisses);
+    StatsRegisterGlobalCounter("app_layer.detect_cache.invalidated",
+            AppLayerProtoDetectCacheGetInvalidated);
 }
 
 #define IPPROTOS_MAX 2
@@ -878,6 +909,7 @@ void AppLayerSetupCounters()
         for (alproto = 0; alproto < ALPROTO_MAX; alproto++) {
             if (alprotos[alproto] == 1) {
                 const char *tx_str = "app_layer.tx.";
+                const char *memcap_str = "app_layer.memcap.";
                 const char *alproto_str = AppLayerGetProtoName(alproto);
 
                 if (AppLayerParserProtoIsRegistered(ipprotos[ipproto], alproto) &&
@@ -891,6 +923,11 @@ void AppLayerSetupCounters()
                                 sizeof(applayer_counter_names[ipproto_map][alproto].tx_name),
                                 "%s%s%s", tx_str, alproto_str, ipproto_suffix);
                     }
+                    if (AppLayerParserProtocolHasMemcap(ipprotos[ipproto], alproto)) {
+                        snprintf(applayer_counter_names[ipproto_map][alproto].memcap_name,
+                                sizeof(applayer_counter_names[ipproto_map][alproto].memcap_name),
+                                "%s%s%s", memcap_str, alproto_str, ipproto_suffix);
+                    }
                 } else {
                     snprintf(applayer_counter_names[ipproto_map][alproto].name,
                             sizeof(applayer_counter_names[ipproto_map][alproto].name),
@@ -900,6 +937,11 @@ void AppLayerSetupCounters()
                                 sizeof(applayer_counter_names[ipproto_map][alproto].tx_name),
                                 "%s%s", tx_str, alproto_str);
                     }
+                    if (AppLayerParserProtocolHasMemcap(ipprotos[ipproto], alproto)) {
+                        snprintf(applayer_counter_names[ipproto_map][alproto].memcap_name,
+                                sizeof(applayer_counter_names[ipproto_map][alproto].memcap_name),
+                                "%s%s", memcap_str, alproto_str);
+                    }
                 }
             } else if (alproto == ALPROTO_FAILED) {
                 snprintf(applayer_counter_names[ipproto_map][alproto].name,
@@ -931,6 +973,10 @@ void AppLayerRegisterThreadCounters(ThreadVars *tv)
                     applayer_counters[ipproto_map][alproto].counter_tx_id =
                         StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].tx_name, tv);
                 }
+                if (AppLayerParserProtocolHasMemcap(ipprotos[ipproto], alproto)) {
+                    applayer_counters[ipproto_map][alproto].counter_memcap_id =
+                        StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].memcap_name, tv);
+                }
             } else if (alproto == ALPROTO_FAILED) {
                 applayer_counters[ipproto_map][alproto].counter_id =
                     StatsRegisterCounter(applayer_counter_names[ipproto_map][alproto].name, tv);
@@ -144,5 +144,6 @@ void AppLayerUnittestsRegister(void);
 #endif
 
 void AppLayerIncTxCounter(ThreadVars *tv, Flow *f, uint64_t step);
+void AppLayerIncMemcapCounter(ThreadVars *tv, Flow *f);
 
 #endif
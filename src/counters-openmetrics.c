@@ -0,0 +1,477 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Stats exporter in the OpenMetrics text format.
+ *
+ * The counters are only collected when the exporter is scraped, so
+ * there is no cost between scrapes. Counter names are prefixed with
+ * 'suricata_' and have the '.' replaced by '_', e.g. decoder.pkts
+ * becomes suricata_decoder_pkts. With 'threads' enabled each thread's
+ * value is added with a 'thread' label.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "counters.h"
+#include "counters-openmetrics.h"
+#include "conf.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "runmodes.h"
+#include "util-debug.h"
+#include "util-privs.h"
+#include "util-unittest.h"
+
+#ifndef OS_WIN32
+#include <poll.h>
+#include <sys/un.h>
+#include <netdb.h>
+#endif
+
+#define OPENMETRICS_DEFAULT_LISTEN      "127.0.0.1:9091"
+/** requests are read up to the end of the header, not larger than this */
+#define OPENMETRICS_MAX_REQUEST         4096
+/** time a client has to send its request */
+#define OPENMETRICS_REQUEST_TIMEOUT_MS  1000
+
+static struct OpenMetricsConfig_ {
+    bool enabled;
+    bool threads;               /**< add per thread values */
+    const char *listen;         /**< host:port or path of a unix socket */
+} om_config = { false, false, OPENMETRICS_DEFAULT_LISTEN };
+
+/** table of the last scrape, so StatsCollect() only sets it up once */
+static StatsTable om_table;
+
+void StatsOpenMetricsInitConfig(void)
+{
+    int b;
+    if (ConfGetBool("stats.openmetrics.enabled", &b) != 1 || b == 0)
+        return;
+#ifdef OS_WIN32
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "stats.openmetrics is not "
+            "supported on this platform");
+    return;
+#endif
+    om_config.enabled = true;
+
+    if (ConfGetBool("stats.openmetrics.threads", &b) == 1)
+        om_config.threads = (b == 1);
+
+    const char *address = NULL;
+    if (ConfGet("stats.openmetrics.listen", &address) == 1 && address != NULL)
+        om_config.listen = address;
+
+    SCLogConfig("stats: openmetrics exporter on %s%s", om_config.listen,
+            om_config.threads ? ", with thread values" : "");
+}
+
+int StatsOpenMetricsEnabled(void)
+{
+    return om_config.enabled;
+}
+
+/** \internal
+ *  \brief append to the buffer, expanding it as needed */
+static int OpenMetricsAppend(MemBuffer **buffer, const char *fmt, ...)
+{
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0 || (size_t)len >= sizeof(line))
+        return -1;
+
+    MemBuffer *b = *buffer;
+    if (MEMBUFFER_OFFSET(b) + len + 1 > MEMBUFFER_SIZE(b)) {
+        uint32_t expand = MAX(MEMBUFFER_SIZE(b), (uint32_t)len + 1);
+        if (MemBufferExpand(buffer, expand) < 0)
+            return -1;
+        b = *buffer;
+    }
+    MemBufferWriteRaw(b, (const uint8_t *)line, (uint32_t)len);
+    return 0;
+}
+
+/** \internal
+ *  \brief metric name of a counter: [a-zA-Z0-9_] only */
+static void OpenMetricsName(const char *counter, char *out, size_t out_size)
+{
+    size_t n = strlcpy(out, "suricata_", out_size);
+    for (const char *c = counter; *c != '\0' && n + 1 < out_size; c++) {
+        out[n++] = isalnum((unsigned char)*c) ? *c : '_';
+    }
+    out[n] = '\0';
+}
+
+/** \internal
+ *  \brief label value, with \ " and newline escaped */
+static void OpenMetricsLabel(const char *value, char *out, size_t out_size)
+{
+    size_t n = 0;
+    for (const char *c = value; *c != '\0' && n + 3 < out_size; c++) {
+        if (*c == '\\' || *c == '"') {
+            out[n++] = '\\';
+            out[n++] = *c;
+        } else if (*c == '\n') {
+            out[n++] = '\\';
+            out[n++] = 'n';
+        } else {
+            out[n++] = *c;
+        }
+    }
+    out[n] = '\0';
+}
+
+/**
+ * \brief format a stats table in the OpenMetrics text format
+ *
+ * The counters don't tell if they count or hold a value, so all are
+ * exposed with type 'unknown'.
+ *
+ * \param threads add the values per thread
+ *
+ * \retval 0 on success, -1 if the buffer couldn't be expanded
+ */
+int StatsOpenMetricsFormat(const StatsTable *st, MemBuffer **buffer,
+        bool threads)
+{
+    char name[256];
+    char label[256];
+
+    for (uint32_t u = 0; u < st->nstats; u++) {
+        if (st->stats[u].name == NULL)
+            continue;
+        OpenMetricsName(st->stats[u].name, name, sizeof(name));
+
+        if (OpenMetricsAppend(buffer, "# TYPE %s unknown\n", name) < 0 ||
+                OpenMetricsAppend(buffer, "%s %"PRIu64"\n", name,
+                    st->stats[u].value) < 0)
+            return -1;
+
+        if (!threads || st->tstats == NULL)
+            continue;
+        for (uint32_t t = 0; t < st->ntstats; t++) {
+            const StatsRecord *r = &st->tstats[(t * st->nstats) + u];
+            if (r->name == NULL || r->tm_name == NULL)
+                continue;
+            OpenMetricsLabel(r->tm_name, label, sizeof(label));
+            if (OpenMetricsAppend(buffer, "%s{thread=\"%s\"} %"PRIu64"\n",
+                        name, label, r->value) < 0)
+                return -1;
+        }
+    }
+    return OpenMetricsAppend(buffer, "# EOF\n");
+}
+
+#ifndef OS_WIN32
+/** \internal
+ *  \brief open the listening socket: a unix socket if the address
+ *         starts with '/', host:port otherwise
+ *
+ *  \retval fd or -1 on error
+ */
+static int OpenMetricsListen(const char *address)
+{
+    int fd = -1;
+
+    if (address[0] == '/') {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlcpy(sun.sun_path, address, sizeof(sun.sun_path)) >=
+                sizeof(sun.sun_path)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "openmetrics: socket path "
+                    "%s too long", address);
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto error;
+        (void)unlink(address);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+            goto error;
+    } else {
+        char host[256];
+        if (strlcpy(host, address, sizeof(host)) >= sizeof(host)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "openmetrics: address %s "
+                    "too long", address);
+            return -1;
+        }
+        char *port = strrchr(host, ':');
+        if (port == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "openmetrics: listen address "
+                    "%s is not host:port or a socket path", address);
+            return -1;
+        }
+        *port++ = '\0';
+        /* [::1]:9091 */
+        char *h = host;
+        if (h[0] == '[' && port - host >= 3 && *(port - 2) == ']') {
+            *(port - 2) = '\0';
+            h++;
+        }
+
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int r = getaddrinfo(h[0] != '\0' ? h : NULL, port, &hints, &res);
+        if (r != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "openmetrics: can't resolve "
+                    "%s: %s", address, gai_strerror(r));
+            return -1;
+        }
+        fd = socket(res->ai_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            freeaddrinfo(res);
+            goto error;
+        }
+        int on = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        r = bind(fd, res->ai_addr, res->ai_addrlen);
+        freeaddrinfo(res);
+        if (r != 0)
+            goto error;
+    }
+
+    if (listen(fd, 8) != 0)
+        goto error;
+    return fd;
+
+error:
+    SCLogError(SC_ERR_SOCKET, "openmetrics: can't listen on %s: %s",
+            address, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/** \internal
+ *  \brief read the request up to the end of its header
+ *
+ *  The request itself isn't looked at: any request gets the metrics.
+ */
+static int OpenMetricsReadRequest(int fd)
+{
+    char req[OPENMETRICS_MAX_REQUEST + 1];
+    size_t len = 0;
+
+    while (len < OPENMETRICS_MAX_REQUEST) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, OPENMETRICS_REQUEST_TIMEOUT_MS) <= 0)
+            return -1;
+        ssize_t r = recv(fd, req + len, OPENMETRICS_MAX_REQUEST - len, 0);
+        if (r <= 0)
+            return -1;
+        len += (size_t)r;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            return 0;
+    }
+    return -1;
+}
+
+static void OpenMetricsSendAll(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t r = send(fd, data, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return;
+        data += r;
+        len -= (size_t)r;
+    }
+}
+
+/** \internal
+ *  \brief answer a scrape: collect the counters and send them */
+static void OpenMetricsHandleClient(int fd, MemBuffer **buffer)
+{
+    if (OpenMetricsReadRequest(fd) < 0)
+        return;
+
+    MemBufferReset(*buffer);
+
+    int r;
+    StatsLock();
+    r = StatsCollect(&om_table);
+    if (r > 0)
+        r = StatsOpenMetricsFormat(&om_table, buffer, om_config.threads);
+    StatsUnlock();
+
+    char header[256];
+    int hlen;
+    if (r < 0) {
+        hlen = snprintf(header, sizeof(header), "HTTP/1.0 503 Service "
+                "Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        OpenMetricsSendAll(fd, (const uint8_t *)header, (size_t)hlen);
+        return;
+    }
+
+    hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; "
+            "charset=utf-8\r\nContent-Length: %"PRIu32"\r\n"
+            "Connection: close\r\n\r\n", MEMBUFFER_OFFSET(*buffer));
+    OpenMetricsSendAll(fd, (const uint8_t *)header, (size_t)hlen);
+    OpenMetricsSendAll(fd, MEMBUFFER_BUFFER(*buffer),
+            MEMBUFFER_OFFSET(*buffer));
+}
+
+/**
+ * \brief exporter thread: answers scrapes until it is killed
+ */
+static void *StatsOpenMetricsThread(void *arg)
+{
+    ThreadVars *tv_local = (ThreadVars *)arg;
+
+    /* Set the thread name */
+    if (SCSetThreadName(tv_local->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    if (tv_local->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv_local);
+
+    /* Set the threads capability */
+    tv_local->cap_flags = 0;
+
+    SCDropCaps(tv_local);
+
+    int lfd = OpenMetricsListen(om_config.listen);
+    MemBuffer *buffer = MemBufferCreateNew(64 * 1024);
+    if (lfd < 0 || buffer == NULL) {
+        if (lfd >= 0)
+            close(lfd);
+        if (buffer != NULL)
+            MemBufferFree(buffer);
+        TmThreadsSetFlag(tv_local, THV_CLOSED | THV_RUNNING_DONE);
+        return NULL;
+    }
+
+    TmThreadsSetFlag(tv_local, THV_INIT_DONE);
+    while (!TmThreadsCheckFlag(tv_local, THV_KILL)) {
+        if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
+            TmThreadsSetFlag(tv_local, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv_local);
+            TmThreadsUnsetFlag(tv_local, THV_PAUSED);
+        }
+
+        /* wake up regularly to check for shutdown */
+        struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0)
+            continue;
+        OpenMetricsHandleClient(cfd, &buffer);
+        close(cfd);
+    }
+
+    close(lfd);
+    if (om_config.listen[0] == '/')
+        (void)unlink(om_config.listen);
+    MemBufferFree(buffer);
+
+    TmThreadsSetFlag(tv_local, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv_local, THV_DEINIT);
+
+    StatsLock();
+    StatsTableFree(&om_table);
+    StatsUnlock();
+
+    TmThreadsSetFlag(tv_local, THV_CLOSED);
+    return NULL;
+}
+#endif /* !OS_WIN32 */
+
+void StatsOpenMetricsSpawnThread(void)
+{
+#ifndef OS_WIN32
+    if (!om_config.enabled)
+        return;
+
+    ThreadVars *tv = TmThreadCreateMgmtThread(thread_name_counter_exporter,
+            StatsOpenMetricsThread, 1);
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread "
+                   "failed");
+        exit(EXIT_FAILURE);
+    }
+    if (TmThreadSpawn(tv) != 0) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
+                   "StatsOpenMetricsThread");
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+#ifdef UNITTESTS
+static int StatsOpenMetricsTest01(void)
+{
+    StatsRecord stats[2] = {
+        { "decoder.pkts", "Total", 10, 0 },
+        { "tcp.memuse", "Total", 4096, 0 },
+    };
+    StatsRecord tstats[4] = {
+        { "decoder.pkts", "W#01", 4, 0 },
+        { "tcp.memuse", "W#01", 4096, 0 },
+        { "decoder.pkts", "W\"2", 6, 0 },
+        { NULL, NULL, 0, 0 },
+    };
+    StatsTable st = { stats, tstats, 2, 2, 0, { 0, 0 } };
+
+    MemBuffer *buffer = MemBufferCreateNew(16);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(StatsOpenMetricsFormat(&st, &buffer, false) != 0);
+    FAIL_IF(strcmp((char *)MEMBUFFER_BUFFER(buffer),
+                "# TYPE suricata_decoder_pkts unknown\n"
+                "suricata_decoder_pkts 10\n"
+                "# TYPE suricata_tcp_memuse unknown\n"
+                "suricata_tcp_memuse 4096\n"
+                "# EOF\n") != 0);
+
+    MemBufferReset(buffer);
+    FAIL_IF(StatsOpenMetricsFormat(&st, &buffer, true) != 0);
+    FAIL_IF(strcmp((char *)MEMBUFFER_BUFFER(buffer),
+                "# TYPE suricata_decoder_pkts unknown\n"
+                "suricata_decoder_pkts 10\n"
+                "suricata_decoder_pkts{thread=\"W#01\"} 4\n"
+                "suricata_decoder_pkts{thread=\"W\\\"2\"} 6\n"
+                "# TYPE suricata_tcp_memuse unknown\n"
+                "suricata_tcp_memuse 4096\n"
+                "suricata_tcp_memuse{thread=\"W#01\"} 4096\n"
+                "# EOF\n") != 0);
+
+    MemBufferFree(buffer);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void StatsOpenMetricsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StatsOpenMetricsTest01", StatsOpenMetricsTest01);
+#endif
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Stats exporter in the OpenMetrics text format. A management thread
+ * answers each HTTP request on the configured TCP address or unix
+ * socket with the current counters, collected at that moment.
+ */
+
+#ifndef __COUNTERS_OPENMETRICS_H__
+#define __COUNTERS_OPENMETRICS_H__
+
+#include "util-buffer.h"
+#include "output.h"
+
+void StatsOpenMetricsInitConfig(void);
+int StatsOpenMetricsEnabled(void);
+void StatsOpenMetricsSpawnThread(void);
+
+int StatsOpenMetricsFormat(const StatsTable *st, MemBuffer **buffer,
+        bool threads);
+
+void StatsOpenMetricsRegisterTests(void);
+
+#endif /* __COUNTERS_OPENMETRICS_H__ */
@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "counters.h"
+#include "counters-openmetrics.h"
 #include "threadvars.h"
 #include "tm-threads.h"
 #include "conf.h"
@@ -61,6 +62,16 @@ enum {
     STATS_TYPE_MAX = 5,
 };
 
+/**
+ * \brief counter values of a thread, as merged into the stats table
+ */
+typedef struct CountersMergeTable_ {
+    int type;
+    const char *name;
+    uint64_t value;
+    uint64_t updates;
+} CountersMergeTable;
+
 /**
  * \brief per thread store of counters
  */
@@ -73,6 +84,14 @@ typedef struct StatsThreadStore_ {
     StatsPublicThreadContext **head;
     uint32_t size;
 
+    /** values of the thread's counters at the last collection, reused
+     *  while StatsPublicThreadContext::gen doesn't change. Not used if
+     *  the thread has function counters, as those change by themselves. */
+    CountersMergeTable *cache;
+    uint16_t cache_size;
+    uint64_t cache_gen;
+    bool has_func;
+
     struct StatsThreadStore_ *next;
 } StatsThreadStore;
 
@@ -115,6 +134,9 @@ static SCMutex stats_table_mutex = SCMUTEX_INITIALIZER;
 static int stats_loggers_active = 1;
 
 static uint16_t counters_global_id = 0;
+/** the global counters are added to the thread stores at the first
+ *  collection, when all counters are registered */
+static bool stats_global_registered = false;
 
 static void StatsPublicThreadContextInit(StatsPublicThreadContext *t)
 {
@@ -254,6 +276,8 @@ static void StatsInitCtxPreOutput(void)
             stats_stream_events = (b == 1);
         }
 
+        StatsOpenMetricsInitConfig();
+
         const char *prefix = NULL;
         if (ConfGet("stats.decoder-events-prefix", &prefix) != 1) {
             prefix = "decoder";
@@ -284,8 +308,9 @@ static void StatsInitCtxPostOutput(void)
         stats_loggers_active = 0;
 
         /* if the unix command socket is enabled we do the background
-         * stats sync just in case someone runs 'dump-counters' */
-        if (!ConfUnixSocketIsEnable()) {
+         * stats sync just in case someone runs 'dump-counters', the
+         * same for scrapes of the openmetrics exporter */
+        if (!ConfUnixSocketIsEnable() && !StatsOpenMetricsEnabled()) {
             SCLogWarning(SC_WARN_NO_STATS_LOGGERS, "stats are enabled but no loggers are active");
             stats_enabled = FALSE;
             SCReturn;
@@ -313,6 +338,8 @@ static void StatsReleaseCtx(void)
     while (sts != NULL) {
         if (sts->head != NULL)
             SCFree(sts->head);
+        if (sts->cache != NULL)
+            SCFree(sts->cache);
 
         temp = sts->next;
         SCFree(sts);
@@ -324,23 +351,14 @@ static void StatsReleaseCtx(void)
         stats_ctx->counters_id_hash = NULL;
         counters_global_id = 0;
     }
+    stats_global_registered = false;
 
     StatsPublicThreadContextCleanup(&stats_ctx->global_counter_ctx);
     SCFree(stats_ctx);
     stats_ctx = NULL;
 
     SCMutexLock(&stats_table_mutex);
-    /* free stats table */
-    if (stats_table.tstats != NULL) {
-        SCFree(stats_table.tstats);
-        stats_table.tstats = NULL;
-    }
-
-    if (stats_table.stats != NULL) {
-        SCFree(stats_table.stats);
-        stats_table.stats = NULL;
-    }
-    memset(&stats_table, 0, sizeof(stats_table));
+    StatsTableFree(&stats_table);
     SCMutexUnlock(&stats_table_mutex);
 
     return;
@@ -613,114 +631,218 @@ static uint16_t StatsRegisterQualifiedCounter(const char *name, const char *tm_n
  *
  * \param pcae     Pointer to the StatsPrivateThreadContext which holds the local
  *                 versions of the counters
+ *
+ * \retval true if the value changed
  */
-static void StatsCopyCounterValue(StatsLocalCounter *pcae)
+static bool StatsCopyCounterValue(StatsLocalCounter *pcae)
 {
     StatsCounter *pc = pcae->pc;
 
-    pc->value = pcae->value;
-    pc->updates = pcae->updates;
-    return;
+    /* only this thread writes, so the plain reads are safe */
+    if (pc->value == pcae->value && pc->updates == pcae->updates)
+        return false;
+    __atomic_store_n(&pc->value, pcae->value, __ATOMIC_RELAXED);
+    __atomic_store_n(&pc->updates, pcae->updates, __ATOMIC_RELAXED);
+    return true;
 }
 
-/**
- * \brief The output interface for the Stats API
+/** \brief free the records of a stats table */
+void StatsTableFree(StatsTable *st)
+{
+    if (st->tstats != NULL) {
+        SCFree(st->tstats);
+    }
+    if (st->stats != NULL) {
+        SCFree(st->stats);
+    }
+    memset(st, 0, sizeof(*st));
+}
+
+/** \brief lock for StatsCollect(), taken by the callers so they can use
+ *         the table they filled before the next collection */
+void StatsLock(void)
+{
+    SCMutexLock(&stats_table_mutex);
+}
+
+void StatsUnlock(void)
+{
+    SCMutexUnlock(&stats_table_mutex);
+}
+
+/** \internal
+ *  \brief get the counter values of a thread store
+ *
+ *  Threads whose counters didn't change since the last collection are
+ *  not walked, the values of that collection are reused.
+ *
+ *  \retval table with the values indexed by counter gid, or NULL
  */
-static int StatsOutput(ThreadVars *tv)
+static const CountersMergeTable *StatsThreadStoreValues(StatsThreadStore *sts,
+        const uint16_t max_id)
 {
-    const StatsThreadStore *sts = NULL;
-    const StatsCounter *pc = NULL;
-    void *td = stats_thread_data;
+    bool use_cache = !sts->has_func;
+    if (sts->cache == NULL || sts->cache_size < max_id) {
+        if (sts->cache != NULL)
+            SCFree(sts->cache);
+        sts->cache_size = 0;
+        sts->cache = SCCalloc(max_id, sizeof(CountersMergeTable));
+        if (sts->cache == NULL)
+            return NULL;
+        sts->cache_size = max_id;
+        use_cache = false;
+    }
 
+    CountersMergeTable *thread_table = sts->cache;
+    StatsPublicThreadContext *ctx = sts->ctx;
+    uint32_t seq1, seq2;
+
+    /* seqlock read side, see StatsUpdateCounterArray(): retry while the
+     * thread is publishing or if it published during the read */
+    do {
+        seq1 = __atomic_load_n(&ctx->seq, __ATOMIC_ACQUIRE);
+        if (seq1 & 1) {
+            seq2 = seq1 + 1;
+            continue;
+        }
+        const uint64_t gen = __atomic_load_n(&ctx->gen, __ATOMIC_RELAXED);
+        if (use_cache && gen == sts->cache_gen) {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            seq2 = __atomic_load_n(&ctx->seq, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        const StatsCounter *pc = ctx->head;
+        while (pc != NULL) {
+            if (pc->gid >= max_id) {
+                pc = pc->next;
+                continue;
+            }
+
+            CountersMergeTable *e = &thread_table[pc->gid];
+            e->type = pc->type;
+            e->name = pc->name;
+            switch (pc->type) {
+                case STATS_TYPE_FUNC:
+                    if (pc->Func != NULL)
+                        e->value = pc->Func();
+                    break;
+                case STATS_TYPE_AVERAGE:
+                default:
+                    e->value = __atomic_load_n(&pc->value, __ATOMIC_RELAXED);
+                    break;
+            }
+            e->updates = __atomic_load_n(&pc->updates, __ATOMIC_RELAXED);
+
+            pc = pc->next;
+        }
+        sts->cache_gen = gen;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&ctx->seq, __ATOMIC_RELAXED);
+    } while (seq1 != seq2);
+
+    return thread_table;
+}
+
+/**
+ * \brief Collect the counters of all threads into a stats table
+ *
+ * The table is set up at the first call. A table that is kept between
+ * calls gets the values of the previous call in StatsRecord::pvalue.
+ *
+ * NOTE: must be called with StatsLock() held
+ *
+ * \retval 1 on success, -1 if there are no counters (yet)
+ */
+int StatsCollect(StatsTable *st)
+{
     if (counters_global_id == 0)
         return -1;
 
-    if (stats_table.nstats == 0) {
+    if (!stats_global_registered) {
         StatsThreadRegister("Global", &stats_ctx->global_counter_ctx);
+        stats_global_registered = true;
+    }
 
+    if (st->nstats == 0) {
         uint32_t nstats = counters_global_id;
 
-        stats_table.nstats = nstats;
-        stats_table.stats = SCCalloc(stats_table.nstats, sizeof(StatsRecord));
-        if (stats_table.stats == NULL) {
-            stats_table.nstats = 0;
+        st->nstats = nstats;
+        st->stats = SCCalloc(st->nstats, sizeof(StatsRecord));
+        if (st->stats == NULL) {
+            st->nstats = 0;
             SCLogError(SC_ERR_MEM_ALLOC, "could not alloc memory for stats");
             return -1;
         }
 
-        stats_table.ntstats = stats_ctx->sts_cnt;
-        uint32_t array_size = stats_table.nstats * sizeof(StatsRecord);
-        stats_table.tstats = SCCalloc(stats_table.ntstats, array_size);
-        if (stats_table.tstats == NULL) {
-            stats_table.ntstats = 0;
+        st->ntstats = stats_ctx->sts_cnt;
+        uint32_t array_size = st->nstats * sizeof(StatsRecord);
+        st->tstats = SCCalloc(st->ntstats, array_size);
+        if (st->tstats == NULL) {
+            st->ntstats = 0;
             SCLogError(SC_ERR_MEM_ALLOC, "could not alloc memory for stats");
             return -1;
         }
 
-        stats_table.start_time = stats_start_time;
+        st->start_time = stats_start_time;
     }
 
-    const uint16_t max_id = counters_global_id;
+    /* counters registered after the table was set up are left out */
+    const uint16_t max_id = (uint16_t)MIN(counters_global_id, st->nstats);
     if (max_id == 0)
         return -1;
 
+    /* packet threads can be added at runtime. Their stores are put at
+     * the head of the list, so the list from this head holds sts_cnt
+     * stores however many are added meanwhile. */
+    SCMutexLock(&stats_ctx->sts_lock);
+    const int sts_cnt = stats_ctx->sts_cnt;
+    StatsThreadStore *sts = stats_ctx->sts;
+    SCMutexUnlock(&stats_ctx->sts_lock);
+
+    if ((uint32_t)sts_cnt > st->ntstats) {
+        uint32_t array_size = st->nstats * sizeof(StatsRecord);
+        StatsRecord *tstats = SCRealloc(st->tstats, sts_cnt * array_size);
+        if (tstats == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "could not alloc memory for stats");
+            return -1;
+        }
+        memset((uint8_t *)tstats + st->ntstats * array_size, 0,
+                (sts_cnt - st->ntstats) * array_size);
+        st->tstats = tstats;
+        st->ntstats = sts_cnt;
+    }
+
     /** temporary local table to merge the per thread counters,
      *  especially needed for the average counters */
-    struct CountersMergeTable {
-        int type;
-        uint64_t value;
-        uint64_t updates;
-    } merge_table[max_id];
+    CountersMergeTable merge_table[max_id];
     memset(&merge_table, 0x00,
-           max_id * sizeof(struct CountersMergeTable));
+           max_id * sizeof(CountersMergeTable));
 
-    int thread = stats_ctx->sts_cnt - 1;
-    StatsRecord *table = stats_table.stats;
+    int thread = sts_cnt - 1;
+    StatsRecord *table = st->stats;
 
     /* Loop through the thread counter stores. The global counters
      * are in a separate store inside this list. */
-    sts = stats_ctx->sts;
     SCLogDebug("sts %p", sts);
     while (sts != NULL) {
         BUG_ON(thread < 0);
 
         SCLogDebug("Thread %d %s ctx %p", thread, sts->name, sts->ctx);
 
-        /* temporay table for quickly storing the counters for this
-         * thread store, so that we can post process them outside
-         * of the thread store lock */
-        struct CountersMergeTable thread_table[max_id];
-        memset(&thread_table, 0x00,
-                max_id * sizeof(struct CountersMergeTable));
-
-        SCMutexLock(&sts->ctx->m);
-        pc = sts->ctx->head;
-        while (pc != NULL) {
-            SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
-                    pc->name, pc->id, pc->gid, pc->value);
-
-            thread_table[pc->gid].type = pc->type;
-            switch (pc->type) {
-                case STATS_TYPE_FUNC:
-                    if (pc->Func != NULL)
-                        thread_table[pc->gid].value = pc->Func();
-                    break;
-                case STATS_TYPE_AVERAGE:
-                default:
-                    thread_table[pc->gid].value = pc->value;
-                    break;
-            }
-            thread_table[pc->gid].updates = pc->updates;
-            table[pc->gid].name = pc->name;
-
-            pc = pc->next;
+        const CountersMergeTable *thread_table =
+            StatsThreadStoreValues(sts, max_id);
+        if (thread_table == NULL) {
+            sts = sts->next;
+            thread--;
+            continue;
         }
-        SCMutexUnlock(&sts->ctx->m);
 
         /* update merge table */
         uint16_t c;
         for (c = 0; c < max_id; c++) {
-            struct CountersMergeTable *e = &thread_table[c];
+            const CountersMergeTable *e = &thread_table[c];
             /* thread only sets type if it has a counter
              * of this type. */
             if (e->type == 0)
@@ -741,18 +863,19 @@ static int StatsOutput(ThreadVars *tv)
             }
             merge_table[c].updates += e->updates;
             merge_table[c].type = e->type;
+            table[c].name = e->name;
         }
 
         /* update per thread stats table */
         for (c = 0; c < max_id; c++) {
-            struct CountersMergeTable *e = &thread_table[c];
+            const CountersMergeTable *e = &thread_table[c];
             /* thread only sets type if it has a counter
              * of this type. */
             if (e->type == 0)
                 continue;
 
-            uint32_t offset = (thread * stats_table.nstats) + c;
-            StatsRecord *r = &stats_table.tstats[offset];
+            uint32_t offset = (thread * st->nstats) + c;
+            StatsRecord *r = &st->tstats[offset];
             /* xfer previous value to pvalue and reset value */
             r->pvalue = r->value;
             r->value = 0;
@@ -783,7 +906,7 @@ static int StatsOutput(ThreadVars *tv)
         table[x].value = 0;
         table[x].tm_name = "Total";
 
-        struct CountersMergeTable *m = &merge_table[x];
+        CountersMergeTable *m = &merge_table[x];
         switch (m->type) {
             case STATS_TYPE_MAXIMUM:
                 if (m->value > table[x].value)
@@ -799,6 +922,18 @@ static int StatsOutput(ThreadVars *tv)
                 break;
         }
     }
+    return 1;
+}
+
+/**
+ * \brief The output interface for the Stats API
+ */
+static int StatsOutput(ThreadVars *tv)
+{
+    void *td = stats_thread_data;
+
+    if (StatsCollect(&stats_table) < 0)
+        return -1;
 
     /* invoke logger(s) */
     if (stats_loggers_active) {
@@ -923,6 +1058,8 @@ void StatsSpawnThreads(void)
         exit(EXIT_FAILURE);
     }
 
+    StatsOpenMetricsSpawnThread();
+
     SCReturn;
 }
 
@@ -1107,6 +1244,11 @@ static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext
         pc->gid = id->id;
         pc = pc->next;
     }
+    bool has_func = false;
+    for (pc = pctx->head; pc != NULL; pc = pc->next) {
+        if (pc->type == STATS_TYPE_FUNC)
+            has_func = true;
+    }
 
 
     if ( (temp = SCMalloc(sizeof(StatsThreadStore))) == NULL) {
@@ -1117,6 +1259,7 @@ static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext
 
     temp->ctx = pctx;
     temp->name = thread_name;
+    temp->has_func = has_func;
 
     temp->next = stats_ctx->sts;
     stats_ctx->sts = temp;
@@ -1228,11 +1371,21 @@ int StatsUpdateCounterArray(StatsPrivateThreadContext *pca, StatsPublicThreadCon
 
     pcae = pca->head;
 
-    SCMutexLock(&pctx->m);
+    /* seqlock write side: the thread is the only writer of its public
+     * context, so it never waits. An odd seq tells the stats thread the
+     * values are being updated, a changed seq that it has to read again. */
+    const uint32_t seq = pctx->seq;
+    __atomic_store_n(&pctx->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    bool changed = false;
     for (i = 1; i <= pca->size; i++) {
-        StatsCopyCounterValue(&pcae[i]);
+        changed |= StatsCopyCounterValue(&pcae[i]);
     }
-    SCMutexUnlock(&pctx->m);
+    if (changed)
+        __atomic_store_n(&pctx->gen, pctx->gen + 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&pctx->seq, seq + 2, __ATOMIC_RELEASE);
 
     pctx->perf_flag = 0;
 
@@ -1571,6 +1724,111 @@ static int StatsTestCounterValues11(void)
     return result;
 }
 
+/**
+ * \test a sync only bumps the generation if a counter changed, and
+ *       leaves the seqlock unlocked
+ */
+static int StatsTestSyncGen12(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    FAIL_IF(id == 0);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF(tv.perf_public_ctx.gen != 0);
+
+    StatsIncr(&tv, id);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF(tv.perf_public_ctx.gen != 1);
+    FAIL_IF(tv.perf_public_ctx.head->value != 1);
+
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF(tv.perf_public_ctx.gen != 1);
+    /* three syncs, each leaving the seqlock even */
+    FAIL_IF(tv.perf_public_ctx.seq != 6);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+    PASS;
+}
+
+#define STATS_TEST_SEQLOCK_SYNCS 100000
+
+typedef struct StatsTestSeqlockCtx_ {
+    ThreadVars tv;
+    uint16_t id1;
+    uint16_t id2;
+    int done;
+} StatsTestSeqlockCtx;
+
+/** \internal writer side of StatsTestSeqlock13, updates both counters
+ *  between each sync */
+static void *StatsTestSeqlockWriter(void *arg)
+{
+    StatsTestSeqlockCtx *ctx = arg;
+    for (int i = 0; i < STATS_TEST_SEQLOCK_SYNCS; i++) {
+        StatsIncr(&ctx->tv, ctx->id1);
+        StatsIncr(&ctx->tv, ctx->id2);
+        StatsUpdateCounterArray(&ctx->tv.perf_private_ctx,
+                &ctx->tv.perf_public_ctx);
+    }
+    __atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ * \test a collection running while the thread syncs its counters only
+ *       sees the values of complete syncs
+ */
+static int StatsTestSeqlock13(void)
+{
+    StatsTestSeqlockCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+
+    ctx.id1 = RegisterCounter("t1", "c1", &ctx.tv.perf_public_ctx);
+    FAIL_IF(ctx.id1 == 0);
+    ctx.id2 = RegisterCounter("t2", "c1", &ctx.tv.perf_public_ctx);
+    FAIL_IF(ctx.id2 == 0);
+    StatsGetAllCountersArray(&ctx.tv.perf_public_ctx, &ctx.tv.perf_private_ctx);
+
+    /* the gids are normally set by StatsThreadRegister() */
+    for (StatsCounter *pc = ctx.tv.perf_public_ctx.head; pc != NULL; pc = pc->next)
+        pc->gid = pc->id - 1;
+
+    StatsThreadStore sts;
+    memset(&sts, 0, sizeof(sts));
+    sts.ctx = &ctx.tv.perf_public_ctx;
+
+    pthread_t writer;
+    FAIL_IF(pthread_create(&writer, NULL, StatsTestSeqlockWriter, &ctx) != 0);
+
+    uint64_t last = 0;
+    int failed = 0;
+    int done;
+    do {
+        done = __atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE);
+        const CountersMergeTable *t = StatsThreadStoreValues(&sts, 2);
+        if (t == NULL || t[0].value != t[1].value || t[0].value < last) {
+            failed = 1;
+            break;
+        }
+        last = t[0].value;
+    } while (!done);
+    pthread_join(writer, NULL);
+
+    FAIL_IF(failed);
+    /* the last read started after the final sync */
+    FAIL_IF(last != STATS_TEST_SEQLOCK_SYNCS);
+    FAIL_IF(ctx.tv.perf_public_ctx.seq & 1);
+
+    SCFree(sts.cache);
+    StatsReleaseCounters(ctx.tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&ctx.tv.perf_private_ctx);
+    PASS;
+}
 #endif
 
 void StatsRegisterTests(void)
@@ -1587,5 +1845,9 @@ void StatsRegisterTests(void)
     UtRegisterTest("StatsTestUpdateGlobalCounter10",
                    StatsTestUpdateGlobalCounter10);
     UtRegisterTest("StatsTestCounterValues11", StatsTestCounterValues11);
+    UtRegisterTest("StatsTestSyncGen12", StatsTestSyncGen12);
+    UtRegisterTest("StatsTestSeqlock13", StatsTestSeqlock13);
+
+    StatsOpenMetricsRegisterTests();
 #endif
 }
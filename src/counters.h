@@ -68,7 +68,15 @@ typedef struct StatsPublicThreadContext_ {
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
 
-    /* mutex to prevent simultaneous access during update_counter/output_stat */
+    /* bumped by each sync that changed a counter, so the stats collection
+     * can skip threads that didn't change since the last time */
+    uint64_t gen;
+
+    /* seqlock for publishing the counter values: odd while the thread
+     * copies its values in, see StatsUpdateCounterArray() */
+    uint32_t seq;
+
+    /* mutex to protect the counter list at setup and cleanup */
     SCMutex m;
 } StatsPublicThreadContext;
 
@@ -141,6 +149,12 @@ void StatsThreadCleanup(struct ThreadVars_ *);
         }                                                                       \
     } while (0)
 
+struct StatsTable_;
+int StatsCollect(struct StatsTable_ *);
+void StatsTableFree(struct StatsTable_ *);
+void StatsLock(void);
+void StatsUnlock(void);
+
 #ifdef BUILD_UNIX_SOCKET
 TmEcode StatsOutputCounterSocket(json_t *cmd,
                                  json_t *answer, void *data);
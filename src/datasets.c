@@ -0,0 +1,746 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Datasets.
+ *
+ * A dataset is a named set of strings, md5 or sha256 hashes, loaded from
+ * a file with one entry per line. Hashes are in hex. Sets are defined in
+ * the 'datasets' section of the yaml or by the first rule using them, and
+ * are global: all tenants and detect engines share them and they are kept
+ * over rule reloads.
+ *
+ * The entries are stored in a read only open addressing hash table that
+ * is built once per load. A reload builds a new table and swaps it in,
+ * so lookups don't need locks.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "datasets.h"
+#include "util-path.h"
+#include "util-hash-lookup3.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+/** one slot of the open addressing table */
+typedef struct DatasetSlot_ {
+    uint32_t hash;
+    uint32_t idx;   /**< entry index + 1, 0 for an empty slot */
+} DatasetSlot;
+
+struct DatasetSet_ {
+    /** length of the keys, 0 for strings */
+    uint32_t key_len;
+    /** number of entries, duplicates included */
+    uint32_t cnt;
+    /** number of unique entries */
+    uint32_t unique;
+
+    /** slots - 1, the number of slots is a power of 2 */
+    uint32_t mask;
+    DatasetSlot *slots;
+
+    /** entries, back to back */
+    uint8_t *keys;
+    uint32_t keys_size;
+    uint32_t keys_alloc;
+    /** start of each entry in keys, cnt + 1 of them. Strings only. */
+    uint32_t *offsets;
+    uint32_t offsets_alloc;
+};
+
+static Dataset *sets = NULL;
+static SCMutex sets_lock = SCMUTEX_INITIALIZER;
+/** epoch of the next detect thread sync, protected by sets_lock */
+static uint32_t sets_epoch = 0;
+
+enum DatasetTypes DatasetGetTypeFromString(const char *s)
+{
+    if (strcasecmp("string", s) == 0)
+        return DATASET_TYPE_STRING;
+    if (strcasecmp("md5", s) == 0)
+        return DATASET_TYPE_MD5;
+    if (strcasecmp("sha256", s) == 0)
+        return DATASET_TYPE_SHA256;
+    return DATASET_TYPE_NOTSET;
+}
+
+static const char *DatasetTypeToString(enum DatasetTypes type)
+{
+    switch (type) {
+        case DATASET_TYPE_STRING:
+            return "string";
+        case DATASET_TYPE_MD5:
+            return "md5";
+        case DATASET_TYPE_SHA256:
+            return "sha256";
+        default:
+            return "unknown";
+    }
+}
+
+static uint32_t DatasetTypeKeyLen(enum DatasetTypes type)
+{
+    switch (type) {
+        case DATASET_TYPE_MD5:
+            return 16;
+        case DATASET_TYPE_SHA256:
+            return 32;
+        default:
+            return 0;
+    }
+}
+
+static void DatasetSetFree(DatasetSet *set)
+{
+    if (set == NULL)
+        return;
+    SCFree(set->slots);
+    SCFree(set->keys);
+    SCFree(set->offsets);
+    SCFree(set);
+}
+
+static DatasetSet *DatasetSetAlloc(enum DatasetTypes type)
+{
+    DatasetSet *set = SCCalloc(1, sizeof(*set));
+    if (set == NULL)
+        return NULL;
+    set->key_len = DatasetTypeKeyLen(type);
+    if (set->key_len == 0) {
+        set->offsets_alloc = 1024;
+        set->offsets = SCCalloc(set->offsets_alloc, sizeof(uint32_t));
+        if (set->offsets == NULL) {
+            SCFree(set);
+            return NULL;
+        }
+    }
+    return set;
+}
+
+static inline const uint8_t *DatasetSetKey(const DatasetSet *set, uint32_t idx,
+        uint32_t *len)
+{
+    if (set->key_len) {
+        *len = set->key_len;
+        return set->keys + (idx * set->key_len);
+    }
+    *len = set->offsets[idx + 1] - set->offsets[idx];
+    return set->keys + set->offsets[idx];
+}
+
+/** \internal
+ *  \brief add an entry to the set, the table is built by DatasetSetFinalize
+ */
+static int DatasetSetAppend(DatasetSet *set, const uint8_t *data, uint32_t len)
+{
+    if (set->cnt == UINT32_MAX - 1 || (uint64_t)set->keys_size + len > UINT32_MAX)
+        return -1;
+
+    if (set->keys_size + len > set->keys_alloc) {
+        uint64_t alloc = set->keys_alloc ? (uint64_t)set->keys_alloc * 2 : 65536;
+        while (alloc < set->keys_size + len)
+            alloc *= 2;
+        if (alloc > UINT32_MAX)
+            alloc = UINT32_MAX;
+        uint8_t *keys = SCRealloc(set->keys, alloc);
+        if (keys == NULL)
+            return -1;
+        set->keys = keys;
+        set->keys_alloc = (uint32_t)alloc;
+    }
+
+    if (set->key_len == 0) {
+        if (set->cnt + 2 > set->offsets_alloc) {
+            uint32_t *offsets = SCRealloc(set->offsets,
+                    (size_t)set->offsets_alloc * 2 * sizeof(uint32_t));
+            if (offsets == NULL)
+                return -1;
+            set->offsets = offsets;
+            set->offsets_alloc *= 2;
+        }
+        set->offsets[set->cnt + 1] = set->keys_size + len;
+    }
+
+    if (len > 0)
+        memcpy(set->keys + set->keys_size, data, len);
+    set->keys_size += len;
+    set->cnt++;
+    return 0;
+}
+
+/** \internal
+ *  \brief build the hash table, size it for a load factor of at most 3/4
+ */
+static int DatasetSetFinalize(DatasetSet *set)
+{
+    uint64_t want = ((uint64_t)set->cnt * 4) / 3 + 1;
+    uint64_t size = 16;
+    while (size < want)
+        size *= 2;
+    if (size > ((uint64_t)1 << 31))
+        return -1;
+
+    set->slots = SCCalloc(size, sizeof(DatasetSlot));
+    if (set->slots == NULL)
+        return -1;
+    set->mask = (uint32_t)(size - 1);
+
+    for (uint32_t i = 0; i < set->cnt; i++) {
+        uint32_t len;
+        const uint8_t *key = DatasetSetKey(set, i, &len);
+        const uint32_t hash = hashlittle_safe(key, len, 0);
+
+        uint32_t s = hash & set->mask;
+        while (set->slots[s].idx != 0) {
+            if (set->slots[s].hash == hash) {
+                uint32_t elen;
+                const uint8_t *ekey = DatasetSetKey(set, set->slots[s].idx - 1, &elen);
+                if (elen == len && memcmp(ekey, key, len) == 0)
+                    break;
+            }
+            s = (s + 1) & set->mask;
+        }
+        if (set->slots[s].idx == 0) {
+            set->slots[s].hash = hash;
+            set->slots[s].idx = i + 1;
+            set->unique++;
+        }
+    }
+    return 0;
+}
+
+static int DatasetSetContains(const DatasetSet *set, const uint8_t *key, uint32_t len)
+{
+    const uint32_t hash = hashlittle_safe(key, len, 0);
+    uint32_t s = hash & set->mask;
+    while (set->slots[s].idx != 0) {
+        if (set->slots[s].hash == hash) {
+            uint32_t elen;
+            const uint8_t *ekey = DatasetSetKey(set, set->slots[s].idx - 1, &elen);
+            if (elen == len && memcmp(ekey, key, len) == 0)
+                return 1;
+        }
+        s = (s + 1) & set->mask;
+    }
+    return 0;
+}
+
+static inline int HexValue(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/** \internal
+ *  \brief decode 'len' bytes of hex
+ *  \retval 0 ok
+ *  \retval -1 invalid hex
+ */
+static int DatasetHexDecode(uint8_t *out, const uint8_t *hex, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        int hi = HexValue(hex[i * 2]);
+        int lo = HexValue(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0)
+            return -1;
+        out[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief load a set from its file
+ *  \retval set or NULL on error
+ */
+static DatasetSet *DatasetLoad(const Dataset *ds)
+{
+    DatasetSet *set = DatasetSetAlloc(ds->type);
+    if (set == NULL)
+        return NULL;
+
+    FILE *fp = fopen(ds->load, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "dataset %s: opening %s failed: %s",
+                ds->name, ds->load, strerror(errno));
+        DatasetSetFree(set);
+        return NULL;
+    }
+
+    char line[8192];
+    int line_no = 0;
+    while (fgets(line, (int)sizeof(line), fp) != NULL) {
+        line_no++;
+        size_t len = strlen(line);
+        /* a full buffer without a newline is only fine for the last line */
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            int c = fgetc(fp);
+            if (c != EOF && c != '\n') {
+                SCLogError(SC_ERR_INVALID_VALUE, "dataset %s: %s:%d is too long, "
+                        "entries are limited to %u bytes", ds->name, ds->load,
+                        line_no, (uint32_t)sizeof(line) - 1);
+                goto error;
+            }
+        }
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        int r;
+        if (set->key_len) {
+            uint8_t hash[32];
+            if (len != set->key_len * 2 ||
+                    DatasetHexDecode(hash, (const uint8_t *)line, set->key_len) != 0) {
+                SCLogError(SC_ERR_INVALID_HASH, "dataset %s: %s:%d is not a %s hash",
+                        ds->name, ds->load, line_no, DatasetTypeToString(ds->type));
+                goto error;
+            }
+            r = DatasetSetAppend(set, hash, set->key_len);
+        } else {
+            r = DatasetSetAppend(set, (const uint8_t *)line, (uint32_t)len);
+        }
+        if (r != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "dataset %s: failed to add %s:%d",
+                    ds->name, ds->load, line_no);
+            goto error;
+        }
+    }
+    fclose(fp);
+    fp = NULL;
+
+    if (DatasetSetFinalize(set) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "dataset %s: failed to set up table", ds->name);
+        goto error;
+    }
+
+    SCLogConfig("dataset %s: %u entries loaded from %s (%"PRIu64" bytes)",
+            ds->name, set->unique, ds->load,
+            (uint64_t)(set->mask + 1) * sizeof(DatasetSlot) + set->keys_size +
+            (set->key_len ? 0 : (uint64_t)(set->cnt + 1) * sizeof(uint32_t)));
+    return set;
+
+error:
+    if (fp != NULL)
+        fclose(fp);
+    DatasetSetFree(set);
+    return NULL;
+}
+
+static Dataset *DatasetSearchByName(const char *name)
+{
+    for (Dataset *ds = sets; ds != NULL; ds = ds->next) {
+        if (strcmp(ds->name, name) == 0)
+            return ds;
+    }
+    return NULL;
+}
+
+/**
+ *  \brief get a dataset, loading it if it doesn't exist yet
+ *
+ *  \param name name of the set
+ *  \param type type of the set, or DATASET_TYPE_NOTSET for an existing set
+ *  \param load file to load the set from, or NULL for an existing set
+ *
+ *  \retval set or NULL on error
+ */
+Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *load)
+{
+    if (strlen(name) > DATASET_NAME_MAX_LEN) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset name too long: %s", name);
+        return NULL;
+    }
+
+    SCMutexLock(&sets_lock);
+    Dataset *ds = DatasetSearchByName(name);
+    if (ds != NULL) {
+        if (type != DATASET_TYPE_NOTSET && type != ds->type) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset %s is of type %s, not %s",
+                    name, DatasetTypeToString(ds->type), DatasetTypeToString(type));
+            ds = NULL;
+        } else if (load != NULL && strcmp(load, ds->load) != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset %s is already loaded "
+                    "from %s", name, ds->load);
+            ds = NULL;
+        }
+        SCMutexUnlock(&sets_lock);
+        return ds;
+    }
+
+    if (type == DATASET_TYPE_NOTSET || load == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset %s is not defined, "
+                "it needs a type and a file to load", name);
+        SCMutexUnlock(&sets_lock);
+        return NULL;
+    }
+
+    ds = SCCalloc(1, sizeof(*ds));
+    if (ds == NULL) {
+        SCMutexUnlock(&sets_lock);
+        return NULL;
+    }
+    strlcpy(ds->name, name, sizeof(ds->name));
+    ds->type = type;
+    strlcpy(ds->load, load, sizeof(ds->load));
+
+    ds->set = DatasetLoad(ds);
+    if (ds->set == NULL) {
+        SCFree(ds);
+        SCMutexUnlock(&sets_lock);
+        return NULL;
+    }
+
+    ds->next = sets;
+    sets = ds;
+    SCMutexUnlock(&sets_lock);
+    return ds;
+}
+
+/**
+ *  \brief load the set again from its file
+ *
+ *  On failure the current entries are kept. The replaced set can still be
+ *  in use by the detect threads, it is only freed after their next sync
+ *  (a rule reload). Until then the set can't be reloaded again.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int DatasetReload(Dataset *ds)
+{
+    SCMutexLock(&sets_lock);
+    if (ds->retired != NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "dataset %s: the set replaced by "
+                "the previous reload is still in use, reload the rules first",
+                ds->name);
+        SCMutexUnlock(&sets_lock);
+        return -1;
+    }
+    DatasetSet *set = DatasetLoad(ds);
+    if (set == NULL) {
+        SCMutexUnlock(&sets_lock);
+        return -1;
+    }
+    ds->retired = ds->set;
+    ds->retired_epoch = sets_epoch;
+    __atomic_store_n(&ds->set, set, __ATOMIC_RELEASE);
+    SCMutexUnlock(&sets_lock);
+    return 0;
+}
+
+/**
+ *  \brief detect threads are about to be synced, e.g. by a rule reload
+ *
+ *  \retval epoch to pass to DatasetsThreadSyncDone()
+ */
+uint32_t DatasetsThreadSyncStart(void)
+{
+    SCMutexLock(&sets_lock);
+    const uint32_t epoch = sets_epoch++;
+    SCMutexUnlock(&sets_lock);
+    return epoch;
+}
+
+/**
+ *  \brief all detect threads have synced, the sets retired before the
+ *         sync started are no longer used
+ */
+void DatasetsThreadSyncDone(uint32_t epoch)
+{
+    SCMutexLock(&sets_lock);
+    for (Dataset *ds = sets; ds != NULL; ds = ds->next) {
+        if (ds->retired != NULL && (int32_t)(ds->retired_epoch - epoch) <= 0) {
+            DatasetSetFree(ds->retired);
+            ds->retired = NULL;
+        }
+    }
+    SCMutexUnlock(&sets_lock);
+}
+
+/** \brief number of unique entries in the set */
+uint32_t DatasetCount(Dataset *ds)
+{
+    const DatasetSet *set = __atomic_load_n(&ds->set, __ATOMIC_ACQUIRE);
+    return set ? set->unique : 0;
+}
+
+/**
+ *  \brief look up a buffer in the set
+ *
+ *  For hash sets the buffer can hold the raw hash or its hex form.
+ *
+ *  \retval 1 found
+ *  \retval 0 not found
+ */
+int DatasetLookup(Dataset *ds, const uint8_t *data, const uint32_t data_len)
+{
+    const DatasetSet *set = __atomic_load_n(&ds->set, __ATOMIC_ACQUIRE);
+    if (set == NULL)
+        return 0;
+
+    if (set->key_len == 0)
+        return DatasetSetContains(set, data, data_len);
+
+    if (data_len == set->key_len)
+        return DatasetSetContains(set, data, data_len);
+    if (data_len != set->key_len * 2)
+        return 0;
+
+    uint8_t hash[32];
+    if (DatasetHexDecode(hash, data, set->key_len) != 0)
+        return 0;
+    return DatasetSetContains(set, hash, set->key_len);
+}
+
+/**
+ *  \brief set up the datasets from the 'datasets' section of the yaml
+ *
+ *  Relative 'load' paths are relative to the default-rule-path.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int DatasetsInit(void)
+{
+    ConfNode *datasets = ConfGetNode("datasets");
+    if (datasets == NULL)
+        return 0;
+
+    ConfNode *node;
+    TAILQ_FOREACH(node, &datasets->head, next) {
+        const char *type_str = ConfNodeLookupChildValue(node, "type");
+        const char *load = ConfNodeLookupChildValue(node, "load");
+        if (type_str == NULL || load == NULL) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "dataset %s needs "
+                    "'type' and 'load' settings", node->name);
+            return -1;
+        }
+        enum DatasetTypes type = DatasetGetTypeFromString(type_str);
+        if (type == DATASET_TYPE_NOTSET) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "dataset %s: unknown "
+                    "type %s", node->name, type_str);
+            return -1;
+        }
+
+        char path[PATH_MAX];
+        const char *dir = NULL;
+        if (PathIsRelative(load) && ConfGet("default-rule-path", &dir) == 1) {
+            snprintf(path, sizeof(path), "%s/%s", dir, load);
+        } else {
+            strlcpy(path, load, sizeof(path));
+        }
+
+        if (DatasetGet(node->name, type, path) == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+void DatasetsDestroy(void)
+{
+    SCMutexLock(&sets_lock);
+    Dataset *ds = sets;
+    while (ds != NULL) {
+        Dataset *next = ds->next;
+        DatasetSetFree(ds->set);
+        DatasetSetFree(ds->retired);
+        SCFree(ds);
+        ds = next;
+    }
+    sets = NULL;
+    SCMutexUnlock(&sets_lock);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ *  \brief unix socket command to reload a dataset from its file
+ */
+TmEcode DatasetReloadCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "setname");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("setname is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    const char *name = json_string_value(jarg);
+
+    SCMutexLock(&sets_lock);
+    Dataset *ds = DatasetSearchByName(name);
+    SCMutexUnlock(&sets_lock);
+    if (ds == NULL) {
+        json_object_set_new(answer, "message", json_string("set not found"));
+        return TM_ECODE_FAILED;
+    }
+
+    if (DatasetReload(ds) != 0) {
+        json_object_set_new(answer, "message", json_string("reload failed"));
+        return TM_ECODE_FAILED;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "set %s reloaded: %u entries", ds->name, DatasetCount(ds));
+    json_object_set_new(answer, "message", json_string(msg));
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+static int DatasetsTest01(void)
+{
+    char filename[] = "/tmp/suricata-dataset-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "# comment\nexample.com\nexample.net\r\n\nexample.com\n");
+    fclose(fp);
+
+    Dataset *ds = DatasetGet("datasets-test01", DATASET_TYPE_STRING, filename);
+    FAIL_IF_NULL(ds);
+    FAIL_IF_NOT(DatasetCount(ds) == 2);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.com", 11) == 1);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.net", 11) == 1);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.org", 11) == 0);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.co", 10) == 0);
+
+    /* same name, different type */
+    FAIL_IF_NOT_NULL(DatasetGet("datasets-test01", DATASET_TYPE_MD5, NULL));
+    FAIL_IF_NOT(DatasetGet("datasets-test01", DATASET_TYPE_NOTSET, NULL) == ds);
+
+    /* reload swaps in the new entries */
+    fp = fopen(filename, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "example.org\n");
+    fclose(fp);
+    FAIL_IF_NOT(DatasetReload(ds) == 0);
+    FAIL_IF_NOT(DatasetCount(ds) == 1);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.com", 11) == 0);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.org", 11) == 1);
+
+    /* the replaced set is kept until the detect threads synced */
+    FAIL_IF_NULL(ds->retired);
+    FAIL_IF_NOT(DatasetReload(ds) == -1);
+    uint32_t epoch = DatasetsThreadSyncStart();
+    DatasetsThreadSyncDone(epoch);
+    FAIL_IF_NOT_NULL(ds->retired);
+
+    /* a set retired while a sync is going on waits for the next one */
+    epoch = DatasetsThreadSyncStart();
+    FAIL_IF_NOT(DatasetReload(ds) == 0);
+    DatasetsThreadSyncDone(epoch);
+    FAIL_IF_NULL(ds->retired);
+    DatasetsThreadSyncDone(DatasetsThreadSyncStart());
+    FAIL_IF_NOT_NULL(ds->retired);
+
+    /* failed reload keeps the old entries */
+    unlink(filename);
+    FAIL_IF_NOT(DatasetReload(ds) == -1);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"example.org", 11) == 1);
+
+    DatasetsDestroy();
+    PASS;
+}
+
+static int DatasetsTest02(void)
+{
+    char filename[] = "/tmp/suricata-dataset-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    for (int i = 0; i < 5000; i++)
+        fprintf(fp, "%032x\n", i);
+    fclose(fp);
+
+    Dataset *ds = DatasetGet("datasets-test02", DATASET_TYPE_MD5, filename);
+    unlink(filename);
+    FAIL_IF_NULL(ds);
+    FAIL_IF_NOT(DatasetCount(ds) == 5000);
+
+    const char *hex = "0000000000000000000000000000123A";
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)hex, 32) == 1);
+    uint8_t raw[16] = { 0 };
+    raw[14] = 0x12;
+    raw[15] = 0x3a;
+    FAIL_IF_NOT(DatasetLookup(ds, raw, 16) == 1);
+    raw[15] = 0xff;
+    raw[14] = 0xff;
+    FAIL_IF_NOT(DatasetLookup(ds, raw, 16) == 0);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"00000000000000000000000000001389", 32) == 0);
+    FAIL_IF_NOT(DatasetLookup(ds, (const uint8_t *)"zz", 2) == 0);
+
+    DatasetsDestroy();
+    PASS;
+}
+
+/** \test a line that doesn't fit the line buffer is rejected, not split */
+static int DatasetsTest03(void)
+{
+    char filename[] = "/tmp/suricata-dataset-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "example.com\n");
+    for (int i = 0; i < 9000; i++)
+        fputc('a', fp);
+    fprintf(fp, "\nexample.net\n");
+    fclose(fp);
+
+    FAIL_IF_NOT_NULL(DatasetGet("datasets-test03", DATASET_TYPE_STRING, filename));
+
+    /* the longest entry that fits is fine, also without a final newline */
+    fp = fopen(filename, "w");
+    FAIL_IF_NULL(fp);
+    for (int i = 0; i < 8191; i++)
+        fputc('a', fp);
+    fprintf(fp, "\nexample.com\n");
+    for (int i = 0; i < 8191; i++)
+        fputc('b', fp);
+    fclose(fp);
+
+    Dataset *ds = DatasetGet("datasets-test03", DATASET_TYPE_STRING, filename);
+    unlink(filename);
+    FAIL_IF_NULL(ds);
+    FAIL_IF_NOT(DatasetCount(ds) == 3);
+
+    DatasetsDestroy();
+    PASS;
+}
+#endif
+
+void DatasetsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DatasetsTest01", DatasetsTest01);
+    UtRegisterTest("DatasetsTest02", DatasetsTest02);
+    UtRegisterTest("DatasetsTest03", DatasetsTest03);
+#endif
+}
@@ -0,0 +1,70 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Datasets: named sets of strings or hashes loaded from a file, used by
+ * the dataset keyword to match a buffer against large lists.
+ */
+
+#ifndef __DATASETS_H__
+#define __DATASETS_H__
+
+enum DatasetTypes {
+    DATASET_TYPE_NOTSET = 0,
+    DATASET_TYPE_STRING,
+    DATASET_TYPE_MD5,
+    DATASET_TYPE_SHA256,
+};
+
+#define DATASET_NAME_MAX_LEN 63
+
+typedef struct DatasetSet_ DatasetSet;
+
+typedef struct Dataset_ {
+    char name[DATASET_NAME_MAX_LEN + 1];
+    enum DatasetTypes type;
+    char load[PATH_MAX];
+
+    /** set used by the lookups, replaced on reload */
+    DatasetSet *set;
+    /** set replaced by the last reload. Freed once all detect threads
+     *  have synced after it was retired, see DatasetsThreadSyncDone(). */
+    DatasetSet *retired;
+    uint32_t retired_epoch;
+
+    struct Dataset_ *next;
+} Dataset;
+
+enum DatasetTypes DatasetGetTypeFromString(const char *s);
+int DatasetsInit(void);
+void DatasetsDestroy(void);
+Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *load);
+int DatasetReload(Dataset *set);
+uint32_t DatasetsThreadSyncStart(void);
+void DatasetsThreadSyncDone(uint32_t epoch);
+uint32_t DatasetCount(Dataset *set);
+int DatasetLookup(Dataset *set, const uint8_t *data, const uint32_t data_len);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DatasetReloadCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void DatasetsRegisterTests(void);
+
+#endif /* __DATASETS_H__ */
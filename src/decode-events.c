@@ -248,5 +248,7 @@ const struct DecodeEvents_ DEvents[] = {
     { "stream.reassembly_seq_gap", STREAM_REASSEMBLY_SEQ_GAP, },
     { "stream.reassembly_overlap_different_data", STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA, },
 
+    { "detect.inspection_budget_exceeded", DETECT_INSPECTION_BUDGET_EXCEEDED, },
+
     { NULL, 0 },
 };
@@ -258,6 +258,8 @@ enum {
     STREAM_REASSEMBLY_SEQ_GAP,
     STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA,
 
+    DETECT_INSPECTION_BUDGET_EXCEEDED,
+
     /* should always be last! */
     DECODE_EVENT_MAX,
 };
@@ -0,0 +1,245 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decode Geneve, RFC 8926.
+ *
+ * Only tried on the configured destination ports. The variable length
+ * options are skipped, the payload is decoded as ethernet, ipv4 or ipv6
+ * depending on the protocol type.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-events.h"
+#include "decode-geneve.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include "flow.h"
+#include "pkt-var.h"
+#include "util-profiling.h"
+
+#define GENEVE_MAX_PORTS 4
+
+static bool g_geneve_enabled = true;
+static uint16_t g_geneve_ports[GENEVE_MAX_PORTS] = { GENEVE_DEFAULT_PORT };
+static int g_geneve_ports_cnt = 1;
+
+void DecodeGeneveConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.geneve.enabled", &enabled) == 1) {
+        g_geneve_enabled = enabled ? true : false;
+    }
+
+    const char *ports = NULL;
+    if (ConfGet("decoder.geneve.ports", &ports) == 1 && ports != NULL) {
+        uint16_t list[GENEVE_MAX_PORTS];
+        int cnt = DecodeTunnelPortsParse(ports, list, GENEVE_MAX_PORTS);
+        if (cnt < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid decoder.geneve.ports "
+                    "'%s', at most %d ports. Using %u", ports, GENEVE_MAX_PORTS,
+                    GENEVE_DEFAULT_PORT);
+        } else {
+            memcpy(g_geneve_ports, list, cnt * sizeof(list[0]));
+            g_geneve_ports_cnt = cnt;
+        }
+    }
+}
+
+int DecodeGeneveEnabledForPort(const uint16_t dp)
+{
+    if (!g_geneve_enabled)
+        return 0;
+    for (int i = 0; i < g_geneve_ports_cnt; i++) {
+        if (g_geneve_ports[i] == dp)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Function to decode Geneve packets
+ *
+ * \param pkt udp payload
+ *
+ * \retval TM_ECODE_FAILED if packet is not a Geneve packet, TM_ECODE_OK if it is
+ */
+int DecodeGeneve(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (len < GENEVE_HEADER_LEN)
+        return TM_ECODE_FAILED;
+
+    const GeneveHdr *hdr = (const GeneveHdr *)pkt;
+    if (GENEVE_GET_VERSION(hdr) != 0)
+        return TM_ECODE_FAILED;
+
+    const uint16_t hlen = GENEVE_HEADER_LEN + GENEVE_GET_OPT_LEN(hdr);
+    if (len <= hlen)
+        return TM_ECODE_FAILED;
+
+    enum DecodeTunnelProto proto;
+    switch (GENEVE_GET_PROTO(hdr)) {
+        case GENEVE_PROTO_ETHERNET:
+            proto = DECODE_TUNNEL_ETHERNET;
+            break;
+        case ETHERNET_TYPE_IP:
+            proto = DECODE_TUNNEL_IPV4;
+            break;
+        case ETHERNET_TYPE_IPV6:
+            proto = DECODE_TUNNEL_IPV6;
+            break;
+        default:
+            SCLogDebug("Geneve protocol type 0x%04x not supported",
+                    GENEVE_GET_PROTO(hdr));
+            return TM_ECODE_FAILED;
+    }
+
+    /* the inner packets carry the vni, for tenant selection, and as part
+     * of the domain it keeps the flows of different overlays apart */
+    const uint32_t vni = GENEVE_GET_VNI(hdr);
+    const uint32_t outer_vni = p->vni;
+    const uint64_t outer_domain_id = p->domain_id;
+    p->vni = vni;
+    DOMAIN_ID_SET_VNI(p, vni);
+
+    SCLogDebug("Geneve vni %u options %u", vni, GENEVE_GET_OPT_LEN(hdr));
+
+    pkt += hlen;
+    len -= hlen;
+
+    if (PacketTunnelDecodeInPlace(tv, dtv, p, pkt, len, proto, pq) == 1) {
+        StatsIncr(tv, dtv->counter_geneve);
+        return TM_ECODE_OK;
+    }
+
+    int ret = TM_ECODE_FAILED;
+    if (pq != NULL) {
+        Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len, proto, pq);
+        if (tp != NULL) {
+            PKT_SET_SRC(tp, PKT_SRC_DECODER_GENEVE);
+            PacketEnqueue(pq, tp);
+            StatsIncr(tv, dtv->counter_geneve);
+            ret = TM_ECODE_OK;
+        }
+    }
+    /* the outer packet is not part of the overlay */
+    p->vni = outer_vni;
+    p->domain_id = outer_domain_id;
+    return ret;
+}
+
+#ifdef UNITTESTS
+
+/** \test geneve with an option and an ipv4 payload */
+static int DecodeGeneveTest01(void)
+{
+    uint8_t raw[] = {
+        /* ipv4 10.0.0.1 -> 10.0.0.2, udp */
+        0x45, 0x00, 0x00, 0x4c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* udp 49152 -> 6081 */
+        0xc0, 0x00, 0x17, 0xc1, 0x00, 0x38, 0x00, 0x00,
+        /* geneve, 8 bytes of options, ipv4, vni 0xabcdef */
+        0x02, 0x00, 0x08, 0x00, 0xab, 0xcd, 0xef, 0x00,
+        0x01, 0x02, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00,
+        /* ipv4 192.168.0.1 -> 192.168.0.2, udp 1234 -> 53 */
+        0x45, 0x00, 0x00, 0x20, 0x00, 0x02, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01,
+        0xc0, 0xa8, 0x00, 0x02,
+        0x04, 0xd2, 0x00, 0x35, 0x00, 0x0c, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FlowInitConfig(FLOW_QUIET);
+
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF_NOT(IS_TUNNEL_PKT(p));
+    FAIL_IF(p->vni != 0);
+    FAIL_IF(pq.len != 1);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF(tp->vni != 0xabcdef);
+    FAIL_IF_NOT(PKT_IS_IPV4(tp));
+    FAIL_IF_NOT(PKT_IS_UDP(tp));
+    FAIL_IF(tp->dp != 53);
+    FAIL_IF(tp->pkt_src != PKT_SRC_DECODER_GENEVE);
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+
+    /* unknown protocol type: plain udp */
+    PACKET_RECYCLE(p);
+    raw[30] = 0x88;
+    raw[31] = 0x47;
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF(IS_TUNNEL_PKT(p));
+    FAIL_IF(pq.len != 0);
+
+    /* options longer than the packet */
+    PACKET_RECYCLE(p);
+    raw[30] = 0x08;
+    raw[31] = 0x00;
+    raw[28] = 0x3f;
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF(IS_TUNNEL_PKT(p));
+    FAIL_IF(pq.len != 0);
+
+    PACKET_RECYCLE(p);
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void DecodeGeneveRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeGeneveTest01", DecodeGeneveTest01);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
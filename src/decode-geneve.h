@@ -0,0 +1,56 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Geneve, RFC 8926.
+ */
+
+#ifndef __DECODE_GENEVE_H__
+#define __DECODE_GENEVE_H__
+
+#define GENEVE_HEADER_LEN       8
+#define GENEVE_DEFAULT_PORT     6081
+
+/** protocol type of an ethernet payload, ethertypes for the others */
+#define GENEVE_PROTO_ETHERNET   0x6558
+
+typedef struct GeneveHdr_ {
+    /** version (2 bits) and options length in 4 byte words (6 bits) */
+    uint8_t ver_optlen;
+    /** OAM, critical options present and reserved bits */
+    uint8_t flags;
+    uint16_t proto;
+    uint8_t vni[3];
+    uint8_t reserved;
+} __attribute__((__packed__)) GeneveHdr;
+
+#define GENEVE_GET_VERSION(hdr)     ((hdr)->ver_optlen >> 6)
+#define GENEVE_GET_OPT_LEN(hdr)     (((hdr)->ver_optlen & 0x3f) * 4)
+#define GENEVE_GET_PROTO(hdr)       SCNtohs((hdr)->proto)
+#define GENEVE_GET_VNI(hdr) \
+    (((uint32_t)(hdr)->vni[0] << 16) | ((uint32_t)(hdr)->vni[1] << 8) | \
+     (uint32_t)(hdr)->vni[2])
+
+void DecodeGeneveConfig(void);
+int DecodeGeneveEnabledForPort(const uint16_t dp);
+int DecodeGeneve(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq);
+void DecodeGeneveRegisterTests(void);
+
+#endif /* __DECODE_GENEVE_H__ */
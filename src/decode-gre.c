@@ -39,6 +39,26 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 
+#include "flow.h"
+#include "pkt-var.h"
+#include "util-profiling.h"
+
+static void DecodeGRETunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto, PacketQueue *pq)
+{
+    if (pq == NULL)
+        return;
+
+    if (PacketTunnelDecodeInPlace(tv, dtv, p, pkt, len, proto, pq) == 1)
+        return;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len, proto, pq);
+    if (tp != NULL) {
+        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
+        PacketEnqueue(pq,tp);
+    }
+}
+
 /**
  * \brief Function to decode GRE packets
  */
@@ -199,79 +219,43 @@ int DecodeGRE(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, ui
     {
         case ETHERNET_TYPE_IP:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_IPV4, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_IPV4, pq);
                 break;
             }
 
         case GRE_PROTO_PPP:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_PPP, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_PPP, pq);
                 break;
             }
 
         case ETHERNET_TYPE_IPV6:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_IPV6, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_IPV6, pq);
                 break;
             }
 
         case ETHERNET_TYPE_VLAN:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_VLAN, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_VLAN, pq);
                 break;
             }
 
         case ETHERNET_TYPE_ERSPAN:
         {
-            if (pq != NULL) {
-                Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                        len - header_len, DECODE_TUNNEL_ERSPAN, pq);
-                if (tp != NULL) {
-                    PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                    PacketEnqueue(pq,tp);
-                }
-            }
+            DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                    DECODE_TUNNEL_ERSPAN, pq);
             break;
         }
 
         case ETHERNET_TYPE_BRIDGE:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_ETHERNET, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGRETunnel(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_ETHERNET, pq);
                 break;
             }
 
@@ -394,6 +378,82 @@ static int DecodeGREtest03 (void)
     SCFree(p);
     return 1;
 }
+
+/**
+ * \test GRE tunnel decoded in place: no tunnel packet, the packet itself
+ *       is the inner UDP packet and the outer layer is kept aside.
+ */
+static int DecodeGREtest04(void)
+{
+    uint8_t raw_gre[] = {
+        /* outer ipv4, 10.0.0.1 -> 10.0.0.2, proto gre */
+        0x45, 0x00, 0x00, 0x38, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x2f, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* gre, ipv4 */
+        0x00, 0x00, 0x08, 0x00,
+        /* inner ipv4, 192.168.0.1 -> 192.168.0.2, udp */
+        0x45, 0x00, 0x00, 0x20, 0x00, 0x02, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01,
+        0xc0, 0xa8, 0x00, 0x02,
+        /* udp 1234 -> 53 */
+        0x04, 0xd2, 0x00, 0x35, 0x00, 0x0c, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FlowInitConfig(FLOW_QUIET);
+
+    dtv.tunnel_in_place = 1;
+    PacketCopyData(p, raw_gre, sizeof(raw_gre));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF(pq.len != 0);
+    FAIL_IF(!(p->flags & PKT_TUNNEL_IN_PLACE));
+    FAIL_IF(IS_TUNNEL_PKT(p));
+    FAIL_IF(p->recursion_level != 1);
+    FAIL_IF_NULL(p->ip4h);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF(p->greh != NULL);
+    FAIL_IF(p->proto != IPPROTO_UDP);
+    FAIL_IF(p->sp != 1234 || p->dp != 53);
+    FAIL_IF(p->payload_len != 4);
+    FAIL_IF(p->src.addr_data32[0] != htonl(0xc0a80001));
+    FAIL_IF(p->tunnel_outer.proto != IPPROTO_GRE);
+    FAIL_IF(p->tunnel_outer.src.family != AF_INET);
+    FAIL_IF(p->tunnel_outer.src.addr_data32[0] != htonl(0x0a000001));
+    FAIL_IF(p->tunnel_outer.dst.addr_data32[0] != htonl(0x0a000002));
+    PACKET_RECYCLE(p);
+
+    /* default: a new packet for the inner layer */
+    dtv.tunnel_in_place = 0;
+    PacketCopyData(p, raw_gre, sizeof(raw_gre));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF(pq.len != 1);
+    FAIL_IF(p->flags & PKT_TUNNEL_IN_PLACE);
+    FAIL_IF_NOT(IS_TUNNEL_PKT(p));
+    FAIL_IF(p->udph != NULL);
+    FAIL_IF_NULL(p->greh);
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF_NULL(tp->udph);
+    FAIL_IF(tp->recursion_level != 1);
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+
+    PACKET_RECYCLE(p);
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -406,6 +466,7 @@ void DecodeGRERegisterTests(void)
     UtRegisterTest("DecodeGREtest01", DecodeGREtest01);
     UtRegisterTest("DecodeGREtest02", DecodeGREtest02);
     UtRegisterTest("DecodeGREtest03", DecodeGREtest03);
+    UtRegisterTest("DecodeGREtest04", DecodeGREtest04);
 #endif /* UNITTESTS */
 }
 /**
@@ -60,6 +60,11 @@ static void DecodeIPv4inIPv6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, u
     }
     if (IP_GET_RAW_VER(pkt) == 4) {
         if (pq != NULL) {
+            if (PacketTunnelDecodeInPlace(tv, dtv, p, pkt, plen,
+                        DECODE_TUNNEL_IPV4, pq) == 1) {
+                StatsIncr(tv, dtv->counter_ipv4inipv6);
+                return;
+            }
             Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, plen, DECODE_TUNNEL_IPV4, pq);
             if (tp != NULL) {
                 PKT_SET_SRC(tp, PKT_SRC_DECODER_IPV6);
@@ -88,6 +93,11 @@ static int DecodeIP6inIP6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint
     }
     if (IP_GET_RAW_VER(pkt) == 6) {
         if (unlikely(pq != NULL)) {
+            if (PacketTunnelDecodeInPlace(tv, dtv, p, pkt, plen,
+                        DECODE_TUNNEL_IPV6, pq) == 1) {
+                StatsIncr(tv, dtv->counter_ipv6inipv6);
+                return TM_ECODE_OK;
+            }
             Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, plen, DECODE_TUNNEL_IPV6, pq);
             if (tp != NULL) {
                 PKT_SET_SRC(tp, PKT_SRC_DECODER_IPV6);
@@ -584,6 +594,7 @@ static int DecodeIPV6Packet (ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, u
 int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
 {
     int ret;
+    const uint8_t recursion_level = p->recursion_level;
 
     StatsIncr(tv, dtv->counter_ipv6);
 
@@ -629,9 +640,11 @@ int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
             DecodeIPv4inIPv6(tv, dtv, p, pkt + IPV6_HEADER_LEN, IPV6_GET_PLEN(p), pq);
             return TM_ECODE_OK;
         case IPPROTO_IPV6:
+            IPV6_SET_L4PROTO(p, IPPROTO_IPV6);
             DecodeIP6inIP6(tv, dtv, p, pkt + IPV6_HEADER_LEN, IPV6_GET_PLEN(p), pq);
             return TM_ECODE_OK;
         case IPPROTO_GRE:
+            IPV6_SET_L4PROTO(p, IPPROTO_GRE);
             DecodeGRE(tv, dtv, p, pkt + IPV6_HEADER_LEN, IPV6_GET_PLEN(p), pq);
             break;
         case IPPROTO_FRAGMENT:
@@ -654,6 +667,11 @@ int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
             IPV6_SET_L4PROTO (p, IPV6_GET_NH(p));
             break;
     }
+
+    /* a tunnel was decoded in place, the packet is the inner one now */
+    if (unlikely(p->recursion_level != recursion_level))
+        return TM_ECODE_OK;
+
     p->proto = IPV6_GET_L4PROTO (p);
 
     /* Pass to defragger if a fragment. */
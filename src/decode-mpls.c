@@ -25,6 +25,9 @@
 
 #include "suricata-common.h"
 #include "decode.h"
+#include "conf.h"
+#include "conf-yaml-loader.h"
+#include "util-byte.h"
 #include "util-unittest.h"
 
 #define MPLS_HEADER_LEN         4
@@ -44,6 +47,156 @@
 #define MPLS_PROTO_IPV4         4
 #define MPLS_PROTO_IPV6         6
 
+#define MPLS_LABEL_MAX          0xfffff
+
+typedef struct MPLSDomainMap_ {
+    uint32_t label;
+    uint32_t domain;
+} MPLSDomainMap;
+
+/** fold the bottom label into the flow tracking */
+static bool g_mpls_tracking = false;
+/** label to domain map from decoder.mpls.domains, sorted by label */
+static MPLSDomainMap *g_mpls_domains = NULL;
+static uint32_t g_mpls_domains_cnt = 0;
+
+static int MPLSDomainMapCompare(const void *a, const void *b)
+{
+    const MPLSDomainMap *ma = a;
+    const MPLSDomainMap *mb = b;
+    if (ma->label < mb->label)
+        return -1;
+    return ma->label > mb->label;
+}
+
+static int MPLSDomainMapAdd(uint32_t label, uint32_t domain)
+{
+    if (label > MPLS_LABEL_MAX) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "decoder.mpls.domains: label %u "
+                "is out of range", label);
+        return -1;
+    }
+    for (uint32_t i = 0; i < g_mpls_domains_cnt; i++) {
+        if (g_mpls_domains[i].label == label) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "decoder.mpls.domains: label "
+                    "%u is mapped more than once", label);
+            return -1;
+        }
+    }
+    MPLSDomainMap *m = SCRealloc(g_mpls_domains,
+            (g_mpls_domains_cnt + 1) * sizeof(MPLSDomainMap));
+    if (m == NULL)
+        return -1;
+    g_mpls_domains = m;
+    g_mpls_domains[g_mpls_domains_cnt].label = label;
+    g_mpls_domains[g_mpls_domains_cnt].domain = domain;
+    g_mpls_domains_cnt++;
+    return 0;
+}
+
+static int MPLSDomainParseLabel(const char *str, uint32_t *label)
+{
+    if (ByteExtractStringUint32(label, 10, strlen(str), str) != (int)strlen(str))
+        return -1;
+    return 0;
+}
+
+/**
+ *  \brief read decoder.mpls
+ *
+ *  With use-for-tracking the bottom label of the stack becomes part of the
+ *  flow, so overlapping address space in different VRFs is tracked
+ *  separately. The 'domains' list maps labels to a domain, for example the
+ *  labels both directions of a VRF use, as the labels are usually not the
+ *  same in both directions. Labels that are not mapped are their own
+ *  domain.
+ */
+void DecodeMPLSConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.mpls.use-for-tracking", &enabled) == 1) {
+        g_mpls_tracking = enabled ? true : false;
+    }
+    if (!g_mpls_tracking)
+        return;
+
+    ConfNode *domains = ConfGetNode("decoder.mpls.domains");
+    if (domains == NULL)
+        return;
+
+    ConfNode *entry;
+    TAILQ_FOREACH(entry, &domains->head, next) {
+        const char *dstr = ConfNodeLookupChildValue(entry, "domain");
+        ConfNode *labels = ConfNodeLookupChild(entry, "labels");
+        uint32_t domain = 0;
+        if (dstr == NULL || labels == NULL ||
+                MPLSDomainParseLabel(dstr, &domain) < 0)
+        {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "decoder.mpls.domains: "
+                    "entries need a numeric domain and a list of labels, "
+                    "skipping");
+            continue;
+        }
+        /* the domain shares Packet::domain_id with the PPPoE session and
+         * the VNI */
+        if (domain > DOMAIN_ID_MPLS_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "decoder.mpls.domains: "
+                    "domain %u is out of range, the maximum is %u, skipping",
+                    domain, DOMAIN_ID_MPLS_MAX);
+            continue;
+        }
+
+        if (labels->val != NULL) {
+            uint32_t label;
+            if (MPLSDomainParseLabel(labels->val, &label) < 0 ||
+                    MPLSDomainMapAdd(label, domain) < 0)
+            {
+                SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "decoder.mpls.domains: "
+                        "invalid label '%s' for domain %u", labels->val, domain);
+            }
+            continue;
+        }
+        ConfNode *l;
+        TAILQ_FOREACH(l, &labels->head, next) {
+            uint32_t label;
+            if (l->val == NULL || MPLSDomainParseLabel(l->val, &label) < 0 ||
+                    MPLSDomainMapAdd(label, domain) < 0)
+            {
+                SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "decoder.mpls.domains: "
+                        "invalid label '%s' for domain %u",
+                        l->val ? l->val : "", domain);
+            }
+        }
+    }
+
+    if (g_mpls_domains_cnt > 0) {
+        qsort(g_mpls_domains, g_mpls_domains_cnt, sizeof(MPLSDomainMap),
+                MPLSDomainMapCompare);
+    }
+    SCLogConfig("mpls labels used for flow tracking, %u labels mapped to "
+            "domains", g_mpls_domains_cnt);
+}
+
+void DecodeMPLSConfigFree(void)
+{
+    SCFree(g_mpls_domains);
+    g_mpls_domains = NULL;
+    g_mpls_domains_cnt = 0;
+    g_mpls_tracking = false;
+}
+
+/** \brief domain of a label, the label itself if it isn't mapped */
+uint32_t DecodeMPLSDomain(uint32_t label)
+{
+    const MPLSDomainMap key = { .label = label, .domain = 0 };
+    const MPLSDomainMap *m = NULL;
+    if (g_mpls_domains_cnt > 0) {
+        m = bsearch(&key, g_mpls_domains, g_mpls_domains_cnt,
+                sizeof(MPLSDomainMap), MPLSDomainMapCompare);
+    }
+    return m != NULL ? m->domain : label;
+}
+
 int DecodeMPLS(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt,
     uint32_t len, PacketQueue *pq)
 {
@@ -64,6 +217,11 @@ int DecodeMPLS(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt,
     } while (MPLS_BOTTOM(shim) == 0);
 
     label = MPLS_LABEL(shim);
+    /* the bottom label is the one that identifies the VPN, the ones above
+     * it change from hop to hop */
+    if (g_mpls_tracking && label > MPLS_MAX_RESERVED_LABEL) {
+        DOMAIN_ID_SET_MPLS(p, DecodeMPLSDomain(label));
+    }
     if (label == MPLS_LABEL_IPV4) {
         if (len > USHRT_MAX) {
             return TM_ECODE_FAILED;
@@ -373,6 +531,66 @@ static int DecodeMPLSTestUnknownPayloadType(void)
     return ret;
 }
 
+/** \test the bottom label sets the domain, mapped labels share one */
+static int DecodeMPLSTestDomain(void)
+{
+    /* label 100, then bottom labels 1000, 1001 and 1002 */
+    uint8_t pkt[] = {
+        0x00, 0x06, 0x40, 0xff, 0x00, 0x3e, 0x81, 0xff,
+        0x45, 0x00, 0x00, 0x14, 0x00, 0x0a, 0x00, 0x00,
+        0x40, 0x01, 0x00, 0x00, 0x0a, 0x01, 0x02, 0x01,
+        0x0a, 0x01, 0x02, 0x02
+    };
+    const char conf[] = "\
+%YAML 1.1\n\
+---\n\
+decoder:\n\
+  mpls:\n\
+    use-for-tracking: yes\n\
+    domains:\n\
+      - labels: [ 1000, 1001 ]\n\
+        domain: 7\n\
+";
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&tv,  0, sizeof(ThreadVars));
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF_NULL(p);
+
+    /* disabled by default */
+    memset(p, 0, SIZE_OF_PACKET);
+    DecodeMPLS(&tv, &dtv, p, pkt, sizeof(pkt), NULL);
+    FAIL_IF(p->domain_id != 0);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(conf, strlen(conf));
+    DecodeMPLSConfig();
+    FAIL_IF(g_mpls_domains_cnt != 2);
+
+    memset(p, 0, SIZE_OF_PACKET);
+    DecodeMPLS(&tv, &dtv, p, pkt, sizeof(pkt), NULL);
+    FAIL_IF(p->domain_id != 7);
+
+    pkt[6] = 0x91;
+    memset(p, 0, SIZE_OF_PACKET);
+    DecodeMPLS(&tv, &dtv, p, pkt, sizeof(pkt), NULL);
+    FAIL_IF(p->domain_id != 7);
+
+    /* not mapped, the label is the domain */
+    pkt[6] = 0xa1;
+    memset(p, 0, SIZE_OF_PACKET);
+    DecodeMPLS(&tv, &dtv, p, pkt, sizeof(pkt), NULL);
+    FAIL_IF(p->domain_id != 1002);
+
+    DecodeMPLSConfigFree();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    SCFree(p);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DecodeMPLSRegisterTests(void)
@@ -390,5 +608,6 @@ void DecodeMPLSRegisterTests(void)
                    DecodeMPLSTestBadLabelReserved);
     UtRegisterTest("DecodeMPLSTestUnknownPayloadType",
                    DecodeMPLSTestUnknownPayloadType);
+    UtRegisterTest("DecodeMPLSTestDomain", DecodeMPLSTestDomain);
 #endif /* UNITTESTS */
 }
@@ -29,6 +29,9 @@
 #define ETHERNET_TYPE_MPLS_UNICAST   0x8847
 #define ETHERNET_TYPE_MPLS_MULTICAST 0x8848
 
+void DecodeMPLSConfig(void);
+void DecodeMPLSConfigFree(void);
+uint32_t DecodeMPLSDomain(uint32_t label);
 void DecodeMPLSRegisterTests(void);
 
 #endif /* !__DECODE_MPLS_H__ */
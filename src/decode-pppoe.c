@@ -40,10 +40,31 @@
 #include "decode-events.h"
 
 #include "flow.h"
+#include "conf.h"
 
 #include "util-unittest.h"
 #include "util-debug.h"
 
+/** fold the session id into the flow tracking */
+static bool g_pppoe_tracking = false;
+
+/**
+ * \brief read decoder.pppoe
+ *
+ * A session id is assigned per subscriber, so with use-for-tracking the
+ * flows of subscribers that share (CGNAT or private) addresses are kept
+ * apart.
+ */
+void DecodePPPOEConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.pppoe.use-for-tracking", &enabled) == 1) {
+        g_pppoe_tracking = enabled ? true : false;
+    }
+    SCLogDebug("pppoe session tracking is %s",
+            g_pppoe_tracking ? "enabled" : "disabled");
+}
+
 /**
  * \brief Main decoding function for PPPOE Discovery packets
  */
@@ -142,6 +163,10 @@ int DecodePPPOESession(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t
     SCLogDebug("PPPOE VERSION %" PRIu32 " TYPE %" PRIu32 " CODE %" PRIu32 " SESSIONID %" PRIu32 " LENGTH %" PRIu32 "",
            PPPOE_SESSION_GET_VERSION(p->pppoesh),  PPPOE_SESSION_GET_TYPE(p->pppoesh),  p->pppoesh->pppoe_code,  SCNtohs(p->pppoesh->session_id),  SCNtohs(p->pppoesh->pppoe_length));
 
+    if (g_pppoe_tracking) {
+        DOMAIN_ID_SET_PPPOE(p, SCNtohs(p->pppoesh->session_id));
+    }
+
     /* can't use DecodePPP() here because we only get a single 2-byte word to indicate protocol instead of the full PPP header */
 
     if (SCNtohs(p->pppoesh->pppoe_length) > 0) {
@@ -76,6 +76,7 @@ typedef struct PPPOEDiscoveryHdr_
 #define PPPOE_TAG_AC_SYS_ERROR        0x0202 /* AC-System Error */
 #define PPPOE_TAG_GEN_ERROR           0x0203 /* Generic-Error */
 
+void DecodePPPOEConfig(void);
 void DecodePPPOERegisterTests(void);
 
 #endif /* __DECODE_PPPOE_H__ */
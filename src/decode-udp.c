@@ -34,6 +34,8 @@
 #include "decode.h"
 #include "decode-udp.h"
 #include "decode-teredo.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "decode-events.h"
 #include "util-unittest.h"
 #include "util-debug.h"
@@ -82,6 +84,26 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, ui
     SCLogDebug("UDP sp: %" PRIu32 " -> dp: %" PRIu32 " - HLEN: %" PRIu32 " LEN: %" PRIu32 "",
         UDP_GET_SRC_PORT(p), UDP_GET_DST_PORT(p), UDP_HEADER_LEN, p->payload_len);
 
+    /* decoded in place, p becomes the inner packet one level down, and the
+     * inner decoder already set up its flow hash */
+    const uint8_t recursion_level = p->recursion_level;
+
+    if (DecodeVXLANEnabledForPort(p->dp) &&
+            unlikely(DecodeVXLAN(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
+        /* Here we have a VXLAN packet and don't need to handle app
+         * layer */
+        if (p->recursion_level == recursion_level)
+            FlowSetupPacket(p);
+        return TM_ECODE_OK;
+    }
+
+    if (DecodeGeneveEnabledForPort(p->dp) &&
+            unlikely(DecodeGeneve(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
+        if (p->recursion_level == recursion_level)
+            FlowSetupPacket(p);
+        return TM_ECODE_OK;
+    }
+
     if (unlikely(DecodeTeredo(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
         /* Here we have a Teredo packet and don't need to handle app
          * layer */
@@ -0,0 +1,357 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decode VXLAN, RFC 7348.
+ *
+ * VXLAN has no magic of its own, so it is only tried on the configured
+ * destination ports and the reserved bits of the header must be 0.
+ * The inner frame is always ethernet.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-events.h"
+#include "decode-vxlan.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include "flow.h"
+#include "pkt-var.h"
+#include "util-profiling.h"
+
+#define VXLAN_MAX_PORTS 4
+
+static bool g_vxlan_enabled = true;
+static uint16_t g_vxlan_ports[VXLAN_MAX_PORTS] = { VXLAN_DEFAULT_PORT };
+static int g_vxlan_ports_cnt = 1;
+
+void DecodeVXLANConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.vxlan.enabled", &enabled) == 1) {
+        g_vxlan_enabled = enabled ? true : false;
+    }
+
+    const char *ports = NULL;
+    if (ConfGet("decoder.vxlan.ports", &ports) == 1 && ports != NULL) {
+        uint16_t list[VXLAN_MAX_PORTS];
+        int cnt = DecodeTunnelPortsParse(ports, list, VXLAN_MAX_PORTS);
+        if (cnt < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid decoder.vxlan.ports "
+                    "'%s', at most %d ports. Using %u", ports, VXLAN_MAX_PORTS,
+                    VXLAN_DEFAULT_PORT);
+        } else {
+            memcpy(g_vxlan_ports, list, cnt * sizeof(list[0]));
+            g_vxlan_ports_cnt = cnt;
+        }
+    }
+}
+
+int DecodeVXLANEnabledForPort(const uint16_t dp)
+{
+    if (!g_vxlan_enabled)
+        return 0;
+    for (int i = 0; i < g_vxlan_ports_cnt; i++) {
+        if (g_vxlan_ports[i] == dp)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Function to decode VXLAN packets
+ *
+ * \param pkt udp payload
+ *
+ * \retval TM_ECODE_FAILED if packet is not a VXLAN packet, TM_ECODE_OK if it is
+ */
+int DecodeVXLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (len < VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN)
+        return TM_ECODE_FAILED;
+
+    const VXLANHdr *hdr = (const VXLANHdr *)pkt;
+    if (hdr->flags != VXLAN_FLAG_VNI || hdr->reserved1[0] != 0 ||
+            hdr->reserved1[1] != 0 || hdr->reserved1[2] != 0 ||
+            hdr->reserved2 != 0)
+        return TM_ECODE_FAILED;
+
+    /* the inner packets carry the vni, for tenant selection, and as part
+     * of the domain it keeps the flows of different overlays apart */
+    const uint32_t vni = VXLAN_GET_VNI(hdr);
+    const uint32_t outer_vni = p->vni;
+    const uint64_t outer_domain_id = p->domain_id;
+    p->vni = vni;
+    DOMAIN_ID_SET_VNI(p, vni);
+
+    SCLogDebug("VXLAN vni %u", vni);
+
+    pkt += VXLAN_HEADER_LEN;
+    len -= VXLAN_HEADER_LEN;
+
+    if (PacketTunnelDecodeInPlace(tv, dtv, p, pkt, len,
+                DECODE_TUNNEL_ETHERNET, pq) == 1) {
+        StatsIncr(tv, dtv->counter_vxlan);
+        return TM_ECODE_OK;
+    }
+
+    int ret = TM_ECODE_FAILED;
+    if (pq != NULL) {
+        Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len,
+                DECODE_TUNNEL_ETHERNET, pq);
+        if (tp != NULL) {
+            PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
+            PacketEnqueue(pq, tp);
+            StatsIncr(tv, dtv->counter_vxlan);
+            ret = TM_ECODE_OK;
+        }
+    }
+    /* the outer packet is not part of the overlay */
+    p->vni = outer_vni;
+    p->domain_id = outer_domain_id;
+    return ret;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief ipv4 10.0.0.1 -> 10.0.0.2, udp 49152 -> 'dp', vxlan vni 0x123456,
+ *         ethernet, ipv4 192.168.0.1 -> 192.168.0.2, udp 1234 -> 53 */
+static uint16_t VXLANTestBuildPacket(uint8_t *buf, uint16_t dp, uint8_t flags)
+{
+    const uint8_t raw[] = {
+        0x45, 0x00, 0x00, 0x52, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0xc0, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x12, 0x34, 0x56, 0x00,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+        0x00, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x20, 0x00, 0x02, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01,
+        0xc0, 0xa8, 0x00, 0x02,
+        0x04, 0xd2, 0x00, 0x35, 0x00, 0x0c, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef };
+    memcpy(buf, raw, sizeof(raw));
+    buf[22] = dp >> 8;
+    buf[23] = dp & 0xff;
+    buf[28] = flags;
+    return sizeof(raw);
+}
+
+/** \test vxlan on the default port spawns a tunnel packet with the vni */
+static int DecodeVXLANTest01(void)
+{
+    uint8_t raw[128];
+    uint16_t len = VXLANTestBuildPacket(raw, VXLAN_DEFAULT_PORT, VXLAN_FLAG_VNI);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FlowInitConfig(FLOW_QUIET);
+
+    PacketCopyData(p, raw, len);
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF(p->vni != 0);
+    FAIL_IF_NOT(IS_TUNNEL_PKT(p));
+    FAIL_IF(pq.len != 1);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF(tp->vni != 0x123456);
+    FAIL_IF_NULL(tp->ethh);
+    FAIL_IF_NOT(PKT_IS_UDP(tp));
+    FAIL_IF(tp->dp != 53);
+    FAIL_IF(tp->recursion_level != 1);
+    FAIL_IF(tp->pkt_src != PKT_SRC_DECODER_VXLAN);
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+
+    /* reserved flags set: not vxlan */
+    PACKET_RECYCLE(p);
+    len = VXLANTestBuildPacket(raw, VXLAN_DEFAULT_PORT, VXLAN_FLAG_VNI | 0x01);
+    PacketCopyData(p, raw, len);
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF(IS_TUNNEL_PKT(p));
+    FAIL_IF(pq.len != 0);
+
+    /* other port: not vxlan */
+    PACKET_RECYCLE(p);
+    len = VXLANTestBuildPacket(raw, 4790, VXLAN_FLAG_VNI);
+    PacketCopyData(p, raw, len);
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF(IS_TUNNEL_PKT(p));
+    FAIL_IF(pq.len != 0);
+
+    PACKET_RECYCLE(p);
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
+
+/** \test vxlan decoded in place */
+static int DecodeVXLANTest02(void)
+{
+    uint8_t raw[128];
+    uint16_t len = VXLANTestBuildPacket(raw, VXLAN_DEFAULT_PORT, VXLAN_FLAG_VNI);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FlowInitConfig(FLOW_QUIET);
+
+    dtv.tunnel_in_place = 1;
+    PacketCopyData(p, raw, len);
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF(pq.len != 0);
+    FAIL_IF_NOT(p->flags & PKT_TUNNEL_IN_PLACE);
+    FAIL_IF(p->vni != 0x123456);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF(p->sp != 1234 || p->dp != 53);
+    FAIL_IF(p->src.addr_data32[0] != htonl(0xc0a80001));
+    FAIL_IF(p->tunnel_outer.proto != IPPROTO_UDP);
+    FAIL_IF(p->tunnel_outer.src.addr_data32[0] != htonl(0x0a000001));
+
+    PACKET_RECYCLE(p);
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
+
+/** \test port list parsing */
+static int DecodeVXLANTest03(void)
+{
+    uint16_t ports[VXLAN_MAX_PORTS];
+
+    FAIL_IF(DecodeTunnelPortsParse("4789", ports, VXLAN_MAX_PORTS) != 1);
+    FAIL_IF(ports[0] != 4789);
+    FAIL_IF(DecodeTunnelPortsParse("[4789, 8472]", ports, VXLAN_MAX_PORTS) != 2);
+    FAIL_IF(ports[0] != 4789 || ports[1] != 8472);
+    FAIL_IF(DecodeTunnelPortsParse(" 1,2 ,3,4 ", ports, VXLAN_MAX_PORTS) != 4);
+    FAIL_IF(ports[3] != 4);
+    FAIL_IF(DecodeTunnelPortsParse("1,2,3,4,5", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("[4789", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("4789x", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("65536", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("0", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("", ports, VXLAN_MAX_PORTS) != -1);
+    FAIL_IF(DecodeTunnelPortsParse("4789,,8472", ports, VXLAN_MAX_PORTS) != -1);
+    PASS;
+}
+
+/** \internal
+ *  \brief decode a vxlan packet with vni 'vni' and look up the flow of
+ *         the inner packet */
+static Flow *VXLANTestInnerFlow(uint32_t vni)
+{
+    uint8_t raw[128];
+    uint16_t len = VXLANTestBuildPacket(raw, VXLAN_DEFAULT_PORT, VXLAN_FLAG_VNI);
+    raw[32] = (uint8_t)(vni >> 16);
+    raw[33] = (uint8_t)(vni >> 8);
+    raw[34] = (uint8_t)vni;
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    if (p == NULL)
+        return NULL;
+    PacketCopyData(p, raw, len);
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    Flow *f = NULL;
+    Packet *tp = PacketDequeue(&pq);
+    if (tp != NULL) {
+        FlowHandlePacket(NULL, NULL, tp);
+        f = tp->flow;
+        if (f != NULL) {
+            SC_ATOMIC_RESET(f->use_cnt);
+            FLOWLOCK_UNLOCK(f);
+        }
+        PACKET_RECYCLE(tp);
+        SCFree(tp);
+    }
+    PACKET_RECYCLE(p);
+    SCFree(p);
+    return f;
+}
+
+/** \test the same inner 5-tuple in two vnis is two flows */
+static int DecodeVXLANTest04(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    Flow *f1 = VXLANTestInnerFlow(0x123456);
+    FAIL_IF_NULL(f1);
+    Flow *f2 = VXLANTestInnerFlow(0x654321);
+    FAIL_IF_NULL(f2);
+    FAIL_IF(f1 == f2);
+    FAIL_IF(f1->domain_id == f2->domain_id);
+
+    /* the first vni again finds its flow */
+    FAIL_IF(VXLANTestInnerFlow(0x123456) != f1);
+
+    FlowShutdown();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void DecodeVXLANRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeVXLANTest01", DecodeVXLANTest01);
+    UtRegisterTest("DecodeVXLANTest02", DecodeVXLANTest02);
+    UtRegisterTest("DecodeVXLANTest03", DecodeVXLANTest03);
+    UtRegisterTest("DecodeVXLANTest04", DecodeVXLANTest04);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,49 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * VXLAN, RFC 7348.
+ */
+
+#ifndef __DECODE_VXLAN_H__
+#define __DECODE_VXLAN_H__
+
+#define VXLAN_HEADER_LEN        8
+#define VXLAN_DEFAULT_PORT      4789
+/** the I flag, the VNI is valid. All other flags are reserved. */
+#define VXLAN_FLAG_VNI          0x08
+
+typedef struct VXLANHdr_ {
+    uint8_t flags;
+    uint8_t reserved1[3];
+    uint8_t vni[3];
+    uint8_t reserved2;
+} __attribute__((__packed__)) VXLANHdr;
+
+#define VXLAN_GET_VNI(hdr) \
+    (((uint32_t)(hdr)->vni[0] << 16) | ((uint32_t)(hdr)->vni[1] << 8) | \
+     (uint32_t)(hdr)->vni[2])
+
+void DecodeVXLANConfig(void);
+int DecodeVXLANEnabledForPort(const uint16_t dp);
+int DecodeVXLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq);
+void DecodeVXLANRegisterTests(void);
+
+#endif /* __DECODE_VXLAN_H__ */
@@ -52,6 +52,8 @@
 #include "conf.h"
 #include "decode.h"
 #include "decode-teredo.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "util-debug.h"
 #include "util-mem.h"
 #include "app-layer-detect-proto.h"
@@ -66,6 +68,14 @@
 #include "util-hash-string.h"
 #include "output.h"
 #include "output-flow.h"
+#include "flow-queue.h"
+#include "flow-private.h"
+#include "util-cpu.h"
+#include "util-byte.h"
+#include "defrag-hash.h"
+#include "util-early-filter.h"
+#include "flow-sample.h"
+#include "flow-cost.h"
 
 extern bool stats_decoder_events;
 const char *stats_decoder_events_prefix;
@@ -116,6 +126,9 @@ void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     if (p->flags & PKT_IS_INVALID) {
         StatsIncr(tv, dtv->counter_invalid);
     }
+    if (unlikely(g_early_filter_enabled)) {
+        EarlyFilterPacket(tv, dtv, p);
+    }
 }
 
 void PacketUpdateEngineEventCounters(ThreadVars *tv,
@@ -248,6 +261,38 @@ inline int PacketCopyDataOffset(Packet *p, uint32_t offset, uint8_t *data, uint3
     return 0;
 }
 
+/**
+ *  \brief Make sure the Packet can hold 'size' bytes of data
+ *
+ * Sets up Packet::ext_pkt up front if 'size' is larger than
+ * default_packet_size, so that building the packet piece by piece
+ * with PacketCopyDataOffset() doesn't first fill the direct buffer
+ * and then has to move it.
+ *
+ *  \param Pointer to the Packet to modify
+ *  \param Maximum size of the data that will be copied in
+ *
+ *  \retval 0 ok
+ *  \retval -1 too big or out of memory
+ */
+int PacketReserveData(Packet *p, uint32_t size)
+{
+    if (unlikely(size > MAX_PAYLOAD_SIZE))
+        return -1;
+    if (size <= default_packet_size || p->ext_pkt != NULL)
+        return 0;
+
+    p->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+    if (unlikely(p->ext_pkt == NULL))
+        return -1;
+    /* keep whatever was already copied in */
+    if (GET_PKT_LEN(p) > 0) {
+        memcpy(p->ext_pkt, GET_PKT_DIRECT_DATA(p),
+                MIN(GET_PKT_LEN(p), GET_PKT_DIRECT_MAX_SIZE(p)));
+    }
+    return 0;
+}
+
 /**
  *  \brief Copy data to Packet payload and set packet length
  *
@@ -292,6 +337,11 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     p->ts.tv_usec = parent->ts.tv_usec;
     p->datalink = DLT_RAW;
     p->tenant_id = parent->tenant_id;
+    p->vni = parent->vni;
+    /* the capture of the root packet bypasses the inner flows, if its
+     * filter can decapsulate them */
+    p->livedev = parent->livedev;
+    p->BypassPacketsFlow = parent->BypassPacketsFlow;
 
     /* set the root ptr to the lowest layer */
     if (parent->root != NULL)
@@ -331,6 +381,233 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     SCReturnPtr(p, "Packet");
 }
 
+/** \internal
+ *  \brief outer layer state of a packet, restored if the inner packet of
+ *         a tunnel decoded in place turns out not to be valid */
+typedef struct PacketTunnelSave_ {
+    Address src;
+    Address dst;
+    uint8_t proto;
+    uint8_t recursion_level;
+    uint8_t vlan_idx;
+    uint8_t events_cnt;
+    uint16_t vlan_id[2];
+    uint64_t domain_id;
+    uint32_t flags;
+    int32_t level3_comp_csum;
+    int32_t level4_comp_csum;
+    Port sp;
+    Port dp;
+    EthernetHdr *ethh;
+    IPV4Hdr *ip4h;
+    IPV6Hdr *ip6h;
+    IPV4Vars ip4vars;
+    IPV6Vars ip6vars;
+    IPV6ExtHdrs ip6eh;
+    PPPHdr *ppph;
+    PPPOESessionHdr *pppoesh;
+    PPPOEDiscoveryHdr *pppoedh;
+    GREHdr *greh;
+    VLANHdr *vlanh[2];
+    UDPHdr *udph;
+    uint8_t *payload;
+    uint16_t payload_len;
+} PacketTunnelSave;
+
+/**
+ *  \brief Decode a tunnel in the packet itself
+ *
+ *  Instead of setting up a new packet with a copy of the inner data like
+ *  PacketTunnelPktSetup() does, the packet is re-pointed at the inner
+ *  headers. The outer addresses and protocol are kept in
+ *  Packet::tunnel_outer. This saves a packet and a copy for each tunneled
+ *  packet, at the cost of the outer layer not being inspected on its own.
+ *
+ *  Only used if decoder.tunnel.in-place is enabled, and not for Teredo,
+ *  as its outer UDP packet is part of a flow that needs inspection.
+ *
+ *  \retval 1 decoded in place
+ *  \retval 0 not decoded, caller should use PacketTunnelPktSetup()
+ */
+int PacketTunnelDecodeInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto, PacketQueue *pq)
+{
+    if (dtv->tunnel_in_place == 0 || proto == DECODE_TUNNEL_IPV6_TEREDO)
+        return 0;
+    /* the outer packet is broken, inspect it as it is */
+    if (p->flags & PKT_IS_INVALID)
+        return 0;
+
+    PacketTunnelSave save = {
+        .src = p->src, .dst = p->dst, .proto = p->proto,
+        .recursion_level = p->recursion_level,
+        .vlan_idx = p->vlan_idx, .events_cnt = p->events.cnt,
+        .vlan_id = { p->vlan_id[0], p->vlan_id[1] },
+        .domain_id = p->domain_id,
+        .flags = p->flags, .level3_comp_csum = p->level3_comp_csum,
+        .level4_comp_csum = p->level4_comp_csum, .sp = p->sp, .dp = p->dp,
+        .ethh = p->ethh, .ip4h = p->ip4h, .ip6h = p->ip6h,
+        .ppph = p->ppph, .pppoesh = p->pppoesh, .pppoedh = p->pppoedh,
+        .greh = p->greh, .vlanh = { p->vlanh[0], p->vlanh[1] },
+        .udph = p->udph,
+        .payload = p->payload, .payload_len = p->payload_len,
+    };
+    if (p->ip4h != NULL) {
+        save.ip4vars = p->ip4vars;
+    } else if (p->ip6h != NULL) {
+        save.ip6vars = p->ip6vars;
+        save.ip6eh = p->ip6eh;
+    }
+
+    /* only the lowest layer is kept if tunnels are nested */
+    if (!(p->flags & PKT_TUNNEL_IN_PLACE)) {
+        COPY_ADDRESS(&p->src, &p->tunnel_outer.src);
+        COPY_ADDRESS(&p->dst, &p->tunnel_outer.dst);
+        p->tunnel_outer.proto = p->ip6h != NULL ? IPV6_GET_L4PROTO(p) : p->proto;
+    }
+
+    /* reset the packet to what a new tunnel packet would look like */
+    CLEAR_ADDR(&p->src);
+    CLEAR_ADDR(&p->dst);
+    p->sp = 0;
+    p->dp = 0;
+    p->proto = 0;
+    p->recursion_level++;
+    p->vlan_idx = 0;
+    p->vlan_id[0] = 0;
+    p->vlan_id[1] = 0;
+    p->domain_id = 0;
+    p->ethh = NULL;
+    if (p->ip4h != NULL) {
+        CLEAR_IPV4_PACKET(p);
+    }
+    if (p->ip6h != NULL) {
+        CLEAR_IPV6_PACKET(p);
+    }
+    p->ppph = NULL;
+    p->pppoesh = NULL;
+    p->pppoedh = NULL;
+    p->greh = NULL;
+    p->vlanh[0] = NULL;
+    p->vlanh[1] = NULL;
+    /* UDP based tunnels */
+    if (p->udph != NULL) {
+        CLEAR_UDP_PACKET(p);
+    }
+    p->payload = NULL;
+    p->payload_len = 0;
+
+    int ret = DecodeTunnel(tv, dtv, p, pkt, len, pq, proto);
+    if (likely(ret == TM_ECODE_OK)) {
+        p->flags |= PKT_TUNNEL_IN_PLACE;
+        return 1;
+    }
+
+    /* Not a (valid) tunnel packet, undo it */
+    SCLogDebug("tunnel packet is invalid");
+
+    if (p->tcph != NULL) {
+        CLEAR_TCP_PACKET(p);
+    }
+    if (p->udph != NULL) {
+        CLEAR_UDP_PACKET(p);
+    }
+    if (p->sctph != NULL) {
+        CLEAR_SCTP_PACKET(p);
+    }
+    if (p->icmpv4h != NULL) {
+        CLEAR_ICMPV4_PACKET(p);
+    }
+    if (p->icmpv6h != NULL) {
+        CLEAR_ICMPV6_PACKET(p);
+    }
+    p->src = save.src;
+    p->dst = save.dst;
+    p->sp = save.sp;
+    p->dp = save.dp;
+    p->proto = save.proto;
+    p->recursion_level = save.recursion_level;
+    p->vlan_idx = save.vlan_idx;
+    p->vlan_id[0] = save.vlan_id[0];
+    p->vlan_id[1] = save.vlan_id[1];
+    p->domain_id = save.domain_id;
+    p->events.cnt = save.events_cnt;
+    p->flags = save.flags;
+    p->level3_comp_csum = save.level3_comp_csum;
+    p->level4_comp_csum = save.level4_comp_csum;
+    p->ethh = save.ethh;
+    p->ip4h = save.ip4h;
+    p->ip6h = save.ip6h;
+    if (save.ip4h != NULL) {
+        p->ip4vars = save.ip4vars;
+    } else if (save.ip6h != NULL) {
+        p->ip6vars = save.ip6vars;
+        p->ip6eh = save.ip6eh;
+    }
+    p->ppph = save.ppph;
+    p->pppoesh = save.pppoesh;
+    p->pppoedh = save.pppoedh;
+    p->greh = save.greh;
+    p->vlanh[0] = save.vlanh[0];
+    p->vlanh[1] = save.vlanh[1];
+    p->udph = save.udph;
+    p->payload = save.payload;
+    p->payload_len = save.payload_len;
+    return 0;
+}
+
+/**
+ *  \brief Parse the udp ports of a tunnel decoder
+ *
+ *  Takes a single port or a comma separated list, optionally in
+ *  brackets: "4789" or "[4789, 8472]".
+ *
+ *  \retval cnt number of ports
+ *  \retval -1 on error
+ */
+int DecodeTunnelPortsParse(const char *str, uint16_t *ports, int max)
+{
+    char buf[256];
+    if (strlcpy(buf, str, sizeof(buf)) >= sizeof(buf))
+        return -1;
+
+    char *s = buf;
+    while (isspace((unsigned char)*s))
+        s++;
+    if (*s == '[') {
+        s++;
+        char *end = strrchr(s, ']');
+        if (end == NULL)
+            return -1;
+        *end = '\0';
+    }
+
+    int cnt = 0;
+    char *next = s;
+    while (next != NULL) {
+        char *tok = next;
+        next = strchr(tok, ',');
+        if (next != NULL)
+            *next++ = '\0';
+
+        while (isspace((unsigned char)*tok))
+            tok++;
+        size_t len = strlen(tok);
+        while (len > 0 && isspace((unsigned char)tok[len - 1]))
+            tok[--len] = '\0';
+
+        uint16_t port = 0;
+        if (len == 0 || cnt == max ||
+                ByteExtractStringUint16(&port, 10, len, tok) != (int)len ||
+                port == 0)
+        {
+            return -1;
+        }
+        ports[cnt++] = port;
+    }
+    return cnt;
+}
+
 /**
  *  \brief Setup a pseudo packet (reassembled frags)
  *
@@ -375,6 +652,7 @@ Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint32_t len, uint8_t
     p->vlan_id[0] = parent->vlan_id[0];
     p->vlan_id[1] = parent->vlan_id[1];
     p->vlan_idx = parent->vlan_idx;
+    p->domain_id = parent->domain_id;
 
     SCReturnPtr(p, "Packet");
 }
@@ -474,6 +752,8 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_vlan_qinq = StatsRegisterCounter("decoder.vlan_qinq", tv);
     dtv->counter_ieee8021ah = StatsRegisterCounter("decoder.ieee8021ah", tv);
     dtv->counter_teredo = StatsRegisterCounter("decoder.teredo", tv);
+    dtv->counter_vxlan = StatsRegisterCounter("decoder.vxlan", tv);
+    dtv->counter_geneve = StatsRegisterCounter("decoder.geneve", tv);
     dtv->counter_ipv4inipv6 = StatsRegisterCounter("decoder.ipv4_in_ipv6", tv);
     dtv->counter_ipv6inipv6 = StatsRegisterCounter("decoder.ipv6_in_ipv6", tv);
     dtv->counter_mpls = StatsRegisterCounter("decoder.mpls", tv);
@@ -481,6 +761,17 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_max_pkt_size = StatsRegisterMaxCounter("decoder.max_pkt_size", tv);
     dtv->counter_erspan = StatsRegisterMaxCounter("decoder.erspan", tv);
     dtv->counter_flow_memcap = StatsRegisterCounter("flow.memcap", tv);
+    dtv->counter_flow_evict_bypassed =
+        StatsRegisterCounter("flow.evicted.bypassed", tv);
+    dtv->counter_flow_evict_no_app_state =
+        StatsRegisterCounter("flow.evicted.no_app_state", tv);
+    dtv->counter_flow_evict_oldest =
+        StatsRegisterCounter("flow.evicted.oldest", tv);
+    dtv->counter_flow_evict_bytes =
+        StatsRegisterCounter("flow.evicted.bytes", tv);
+    EarlyFilterRegisterCounters(tv, dtv);
+    FlowSampleRegisterCounters(tv, dtv);
+    FlowCostRegisterCounters(tv, dtv);
 
     dtv->counter_flow_tcp = StatsRegisterCounter("flow.tcp", tv);
     dtv->counter_flow_udp = StatsRegisterCounter("flow.udp", tv);
@@ -612,6 +903,15 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     }
     SCLogDebug("vlan tracking is %s", dtv->vlan_disabled == 0 ? "enabled" : "disabled");
 
+    int inplace = 0;
+    if (ConfGetBool("decoder.tunnel.in-place", &inplace) == 1 && inplace == 1) {
+        dtv->tunnel_in_place = 1;
+    }
+
+    dtv->flow_spare_batch = flow_config.spare_batch;
+
+    dtv->defrag_table = DefragThreadTableAlloc();
+
     return dtv;
 }
 
@@ -624,6 +924,20 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
+        /* hand the cached spare flows back to the global spare queue */
+        while (dtv->flow_spare != NULL) {
+            Flow *f = dtv->flow_spare;
+            dtv->flow_spare = f->lnext;
+            FlowMoveToSpare(f);
+        }
+        dtv->flow_spare_cnt = 0;
+
+        DefragThreadTableFree(dtv->defrag_table);
+        dtv->defrag_table = NULL;
+
+        if (dtv->counter_early_filter != NULL)
+            SCFree(dtv->counter_early_filter);
+
         SCFree(dtv);
     }
 }
@@ -666,6 +980,12 @@ const char *PktSrcToString(enum PktSrcEnum pkt_src)
         case PKT_SRC_DECODER_TEREDO:
             pkt_src_str = "teredo tunnel";
             break;
+        case PKT_SRC_DECODER_VXLAN:
+            pkt_src_str = "vxlan tunnel";
+            break;
+        case PKT_SRC_DECODER_GENEVE:
+            pkt_src_str = "geneve tunnel";
+            break;
         case PKT_SRC_DEFRAG:
             pkt_src_str = "defrag";
             break;
@@ -703,9 +1023,206 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s)
     s->counter_ips_replaced = StatsRegisterCounter("ips.replaced", tv);
 }
 
+enum CaptureCongestionPolicy {
+    CAPTURE_CONGESTION_NONE = 0,
+    /** skip payload inspection for packets read from a congested ring */
+    CAPTURE_CONGESTION_NO_PAYLOAD_INSPECTION,
+};
+
+/** ring fill level in percent that marks the ring as congested, 0 to
+ *  disable */
+static uint32_t capture_ring_high_water = 0;
+static enum CaptureCongestionPolicy capture_congestion_policy =
+    CAPTURE_CONGESTION_NONE;
+
+static void CaptureRingStatsConfig(void)
+{
+    intmax_t value = 0;
+    const char *str = NULL;
+
+    if (ConfGetInt("capture.ring-high-water-mark", &value) == 1) {
+        if (value > 0 && value <= 100) {
+            capture_ring_high_water = (uint32_t)value;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT,
+                    "capture.ring-high-water-mark must be between 1 and 100");
+        }
+    }
+    if (ConfGet("capture.congestion-policy", &str) == 1 && str != NULL) {
+        if (strcmp(str, "none") == 0) {
+            capture_congestion_policy = CAPTURE_CONGESTION_NONE;
+        } else if (strcmp(str, "no-payload-inspection") == 0) {
+            capture_congestion_policy = CAPTURE_CONGESTION_NO_PAYLOAD_INSPECTION;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value \"%s\" for "
+                    "capture.congestion-policy", str);
+        }
+    }
+    if (capture_congestion_policy != CAPTURE_CONGESTION_NONE &&
+            capture_ring_high_water == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "capture.congestion-policy "
+                "needs capture.ring-high-water-mark to be set");
+    }
+}
+
+void CaptureRingStatsSetup(ThreadVars *tv, CaptureRingStats *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->counter_poll_ticks = StatsRegisterCounter("capture.ring.poll_ticks", tv);
+    s->counter_pipeline_ticks = StatsRegisterCounter("capture.ring.pipeline_ticks", tv);
+    s->counter_pkts_per_poll = StatsRegisterAvgCounter("capture.ring.pkts_per_poll", tv);
+    s->counter_fill_avg = StatsRegisterAvgCounter("capture.ring.fill_avg", tv);
+    s->counter_fill_max = StatsRegisterMaxCounter("capture.ring.fill_max", tv);
+    s->counter_high_water = StatsRegisterCounter("capture.ring.high_water", tv);
+}
+
+void CaptureRingStatsPollStart(CaptureRingStats *s)
+{
+    s->poll_start = UtilCpuGetTicks();
+}
+
+/**
+ *  \param used slots (or blocks) of the ring holding packets
+ *  \param size total slots in the ring, 0 if the source can't tell
+ */
+void CaptureRingStatsPollEnd(ThreadVars *tv, CaptureRingStats *s,
+        uint32_t used, uint32_t size)
+{
+    const uint64_t now = UtilCpuGetTicks();
+    if (s->poll_start != 0) {
+        StatsAddUI64(tv, s->counter_poll_ticks, now - s->poll_start);
+    }
+    s->pipeline_start = now;
+
+    if (size == 0)
+        return;
+
+    const uint32_t fill = (uint32_t)(((uint64_t)used * 100) / size);
+    StatsAddUI64(tv, s->counter_fill_avg, fill);
+    StatsSetUI64(tv, s->counter_fill_max, fill);
+
+    if (capture_ring_high_water == 0)
+        return;
+
+    /* leave the congested state only once the ring drained to half the
+     * high water mark, so we don't flap around it */
+    if (fill >= capture_ring_high_water) {
+        StatsIncr(tv, s->counter_high_water);
+        s->congested = true;
+    } else if (fill < capture_ring_high_water / 2) {
+        s->congested = false;
+    }
+}
+
+void CaptureRingStatsBatchEnd(ThreadVars *tv, CaptureRingStats *s, uint64_t pkts)
+{
+    if (s->pipeline_start == 0)
+        return;
+
+    StatsAddUI64(tv, s->counter_pipeline_ticks,
+            UtilCpuGetTicks() - s->pipeline_start);
+    StatsAddUI64(tv, s->counter_pkts_per_poll, pkts);
+    s->pipeline_start = 0;
+}
+
+/** \brief apply the congestion policy to a packet */
+void CaptureRingStatsPacket(const CaptureRingStats *s, Packet *p)
+{
+    if (likely(!s->congested))
+        return;
+
+    /* lets flow sampling adapt its rate */
+    p->flags |= PKT_RING_CONGESTED;
+
+    if (capture_congestion_policy == CAPTURE_CONGESTION_NO_PAYLOAD_INSPECTION) {
+        DecodeSetNoPayloadInspectionFlag(p);
+    }
+}
+
+/**
+ *  \brief parse a poll-mode setting
+ *  \retval 0 on success, -1 if str is not a valid mode
+ */
+int CapturePollParseMode(const char *str, enum CapturePollMode *mode)
+{
+    if (strcmp(str, "blocking") == 0) {
+        *mode = CAPTURE_POLL_BLOCKING;
+    } else if (strcmp(str, "hybrid") == 0) {
+        *mode = CAPTURE_POLL_HYBRID;
+    } else if (strcmp(str, "busy") == 0) {
+        *mode = CAPTURE_POLL_BUSY;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void CapturePollSetup(ThreadVars *tv, CapturePoll *c,
+        enum CapturePollMode mode, uint32_t spin_usec)
+{
+    memset(c, 0, sizeof(*c));
+    c->mode = mode;
+    c->spin_usec = spin_usec;
+    if (mode != CAPTURE_POLL_BLOCKING) {
+        c->counter_spin_hits = StatsRegisterCounter("capture.poll.spin_hits", tv);
+        c->counter_blocking = StatsRegisterCounter("capture.poll.blocking", tv);
+    }
+}
+
+static inline uint64_t CapturePollNowUsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ *  \brief wait for packets according to the poll mode
+ *
+ *  Same as poll(). In busy mode it returns 0 once 'timeout' expired, so
+ *  the capture loop still handles its timeout work, like injecting
+ *  pseudo packets, at the same pace as in blocking mode.
+ *
+ *  \param timeout timeout in milliseconds
+ */
+int CapturePollWait(ThreadVars *tv, CapturePoll *c,
+        struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if (c->mode == CAPTURE_POLL_BLOCKING)
+        return poll(fds, nfds, timeout);
+
+    const uint64_t start = CapturePollNowUsec();
+    const uint64_t budget = (c->mode == CAPTURE_POLL_BUSY) ?
+        (uint64_t)timeout * 1000 : c->spin_usec;
+    while (1) {
+        int r = poll(fds, nfds, 0);
+        if (r != 0) {
+            if (r > 0)
+                StatsIncr(tv, c->counter_spin_hits);
+            return r;
+        }
+        if (suricata_ctl_flags != 0)
+            return 0;
+        if (CapturePollNowUsec() - start >= budget)
+            break;
+    }
+
+    if (c->mode == CAPTURE_POLL_BUSY)
+        return 0;
+
+    StatsIncr(tv, c->counter_blocking);
+    return poll(fds, nfds, timeout);
+}
+
 void DecodeGlobalConfig(void)
 {
     DecodeTeredoConfig();
+    DecodeVXLANConfig();
+    DecodeGeneveConfig();
+    DecodeMPLSConfig();
+    DecodePPPOEConfig();
+    CaptureRingStatsConfig();
+    EarlyFilterInitConfig();
 }
 
 /**
@@ -51,6 +51,8 @@ enum PktSrcEnum {
     PKT_SRC_DECODER_IPV4,
     PKT_SRC_DECODER_IPV6,
     PKT_SRC_DECODER_TEREDO,
+    PKT_SRC_DECODER_VXLAN,
+    PKT_SRC_DECODER_GENEVE,
     PKT_SRC_DEFRAG,
     PKT_SRC_STREAM_TCP_STREAM_END_PSEUDO,
     PKT_SRC_FFR,
@@ -61,7 +63,10 @@ enum PktSrcEnum {
 #include "source-nfq.h"
 #include "source-ipfw.h"
 #include "source-pcap.h"
+#include "source-erf-file.h"
 #include "source-af-packet.h"
+#include "source-af-xdp.h"
+#include "source-dpdk.h"
 #include "source-netmap.h"
 #include "source-windivert.h"
 #ifdef HAVE_PF_RING_FLOW_OFFLOAD
@@ -70,6 +75,8 @@ enum PktSrcEnum {
 
 #include "action-globals.h"
 
+#include "util-checksum-simd.h"
+
 #include "decode-erspan.h"
 #include "decode-ethernet.h"
 #include "decode-gre.h"
@@ -289,10 +296,13 @@ typedef struct PacketAlert_ {
 
 typedef struct PacketAlerts_ {
     uint16_t cnt;
-    PacketAlert alerts[PACKET_ALERT_MAX];
+    /** alerts that didn't fit in 'alerts' */
+    uint16_t discarded;
     /* single pa used when we're dropping,
-     * so we can log it out in the drop log. */
+     * so we can log it out in the drop log. Kept next to cnt so that
+     * resetting an unused alert array touches a single cache line. */
     PacketAlert drop;
+    PacketAlert alerts[PACKET_ALERT_MAX];
 } PacketAlerts;
 
 /** number of decoder events we support per packet. Power of 2 minus 1
@@ -402,6 +412,14 @@ struct PacketQueue_;
  *
  * sum of above 44/48 bytes
  */
+/** \brief outer layer of a tunnel that was decoded in the packet itself,
+ *         see PacketTunnelDecodeInPlace() */
+typedef struct PacketTunnelOuter_ {
+    Address src;
+    Address dst;
+    uint8_t proto;
+} PacketTunnelOuter;
+
 typedef struct Packet_
 {
     /* Addresses, Ports and protocol
@@ -433,6 +451,10 @@ typedef struct Packet_
     uint16_t vlan_id[2];
     uint8_t vlan_idx;
 
+    /** MPLS domain and PPPoE session for flow tracking, only set if
+     *  enabled in the decoder config. See DOMAIN_ID_SET_MPLS. */
+    uint64_t domain_id;
+
     /* flow */
     uint8_t flowflags;
     /* coccinelle: Packet:flowflags:FLOW_PKT_ */
@@ -448,35 +470,19 @@ typedef struct Packet_
 
     struct timeval ts;
 
-    union {
-        /* nfq stuff */
-#ifdef HAVE_NFLOG
-        NFLOGPacketVars nflog_v;
-#endif /* HAVE_NFLOG */
-#ifdef NFQ
-        NFQPacketVars nfq_v;
-#endif /* NFQ */
-#ifdef IPFW
-        IPFWPacketVars ipfw_v;
-#endif /* IPFW */
-#ifdef AF_PACKET
-        AFPPacketVars afp_v;
-#endif
-#ifdef HAVE_NETMAP
-        NetmapPacketVars netmap_v;
-#endif
-#ifdef HAVE_PFRING
-#ifdef HAVE_PF_RING_FLOW_OFFLOAD
-        PfringPacketVars pfring_v;
-#endif
-#endif
-#ifdef WINDIVERT
-        WinDivertPacketVars windivert_v;
-#endif /* WINDIVERT */
+    /* ptr to the payload of the packet
+     * with it's length. */
+    uint8_t *payload;
+    uint16_t payload_len;
 
-        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
-        PcapPacketVars pcap_v;
-    };
+    /* IPS action to take */
+    uint8_t action;
+
+    uint8_t pkt_src;
+
+    /* storage: set to pointer to heap and extended via allocation if necessary */
+    uint32_t pktlen;
+    uint8_t *ext_pkt;
 
     /** The release function for packet structure and data */
     void (*ReleasePacket)(struct Packet_ *);
@@ -484,9 +490,6 @@ typedef struct Packet_
      * Return 1 for success and 0 on error */
     int (*BypassPacketsFlow)(struct Packet_ *);
 
-    /* pkt vars */
-    PktVar *pktvar;
-
     /* header pointers */
     EthernetHdr *ethh;
 
@@ -535,25 +538,9 @@ typedef struct Packet_
 
     VLANHdr *vlanh[2];
 
-    /* ptr to the payload of the packet
-     * with it's length. */
-    uint8_t *payload;
-    uint16_t payload_len;
-
-    /* IPS action to take */
-    uint8_t action;
-
-    uint8_t pkt_src;
-
-    /* storage: set to pointer to heap and extended via allocation if necessary */
-    uint32_t pktlen;
-    uint8_t *ext_pkt;
-
     /* Incoming interface */
     struct LiveDevice_ *livedev;
 
-    PacketAlerts alerts;
-
     struct Host_ *host_src;
     struct Host_ *host_dst;
 
@@ -561,11 +548,6 @@ typedef struct Packet_
     uint64_t pcap_cnt;
 
 
-    /* engine events */
-    PacketEngineEvents events;
-
-    AppLayerDecoderEvents *app_layer_events;
-
     /* double linked list ptrs */
     struct Packet_ *next;
     struct Packet_ *prev;
@@ -580,24 +562,87 @@ typedef struct Packet_
                            * It should always point to the lowest
                            * packet in a encapsulated packet */
 
-    /** mutex to protect access to:
-     *  - tunnel_rtv_cnt
-     *  - tunnel_tpr_cnt
-     */
-    SCMutex tunnel_mutex;
-    /* ready to set verdict counter, only set in root */
-    uint16_t tunnel_rtv_cnt;
-    /* tunnel packet ref count */
-    uint16_t tunnel_tpr_cnt;
-
     /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
     uint32_t tenant_id;
 
+    /** VNI of the VXLAN or Geneve overlay the packet was carried in, 0 if
+     *  none */
+    uint32_t vni;
+
+    /** action of the early filter rule the packet matched, see
+     *  util-early-filter.h */
+    uint8_t early_filter;
+
     /* The Packet pool from which this packet was allocated. Used when returning
      * the packet to its owner's stack. If NULL, then allocated with malloc.
      */
     struct PktPool_ *pool;
 
+    /* Fields below are only used by some packets (alerts, events, tunnels,
+     * pkt vars, capture method specific data). They are kept after
+     * the fields that are used for every packet, with the counters that
+     * PACKET_REINIT resets grouped together at the start. */
+
+    /* ready to set verdict counter, only set in root */
+    uint16_t tunnel_rtv_cnt;
+    /* tunnel packet ref count */
+    uint16_t tunnel_tpr_cnt;
+
+    /* engine events */
+    PacketEngineEvents events;
+
+    AppLayerDecoderEvents *app_layer_events;
+
+    /* pkt vars */
+    PktVar *pktvar;
+
+    PacketAlerts alerts;
+
+    /** outer layer if a tunnel was decoded in place (PKT_TUNNEL_IN_PLACE) */
+    PacketTunnelOuter tunnel_outer;
+
+    union {
+        /* nfq stuff */
+#ifdef HAVE_NFLOG
+        NFLOGPacketVars nflog_v;
+#endif /* HAVE_NFLOG */
+#ifdef NFQ
+        NFQPacketVars nfq_v;
+#endif /* NFQ */
+#ifdef IPFW
+        IPFWPacketVars ipfw_v;
+#endif /* IPFW */
+#ifdef AF_PACKET
+        AFPPacketVars afp_v;
+#endif
+#ifdef HAVE_AF_XDP
+        AFXDPPacketVars afxdp_v;
+#endif
+#ifdef HAVE_DPDK
+        DPDKPacketVars dpdk_v;
+#endif
+#ifdef HAVE_NETMAP
+        NetmapPacketVars netmap_v;
+#endif
+#ifdef HAVE_PFRING
+#ifdef HAVE_PF_RING_FLOW_OFFLOAD
+        PfringPacketVars pfring_v;
+#endif
+#endif
+#ifdef WINDIVERT
+        WinDivertPacketVars windivert_v;
+#endif /* WINDIVERT */
+
+        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
+        PcapPacketVars pcap_v;
+        ErfFilePacketVars erf_v;
+    };
+
+    /** mutex to protect access to:
+     *  - tunnel_rtv_cnt
+     *  - tunnel_tpr_cnt
+     */
+    SCMutex tunnel_mutex;
 #ifdef PROFILING
     PktProfiling *profile;
 #endif
@@ -635,6 +680,8 @@ typedef struct DecodeThreadVars_
     AppLayerThreadCtx *app_tctx;
 
     int vlan_disabled;
+    /** decode GRE and IP-in-IP tunnels in the packet itself */
+    int tunnel_in_place;
 
     /** stats/counters */
     uint16_t counter_pkts;
@@ -663,6 +710,8 @@ typedef struct DecodeThreadVars_
     uint16_t counter_ieee8021ah;
     uint16_t counter_pppoe;
     uint16_t counter_teredo;
+    uint16_t counter_vxlan;
+    uint16_t counter_geneve;
     uint16_t counter_mpls;
     uint16_t counter_ipv4inipv6;
     uint16_t counter_ipv6inipv6;
@@ -679,6 +728,12 @@ typedef struct DecodeThreadVars_
 
     uint16_t counter_flow_memcap;
 
+    /* flows evicted at memcap, per eviction class, and their bytes */
+    uint16_t counter_flow_evict_bypassed;
+    uint16_t counter_flow_evict_no_app_state;
+    uint16_t counter_flow_evict_oldest;
+    uint16_t counter_flow_evict_bytes;
+
     uint16_t counter_flow_tcp;
     uint16_t counter_flow_udp;
     uint16_t counter_flow_icmp4;
@@ -690,6 +745,34 @@ typedef struct DecodeThreadVars_
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
+    /* thread local cache of spare flows, refilled in batches of
+     * flow_spare_batch from the global spare queue or allocator.
+     * Linked through Flow::lnext. Disabled if flow_spare_batch is 0. */
+    struct Flow_ *flow_spare;
+    uint32_t flow_spare_cnt;
+    uint32_t flow_spare_batch;
+
+    /* defrag trackers of this thread, NULL if the global defrag hash
+     * is used (defrag.thread-local) */
+    struct DefragThreadTable_ *defrag_table;
+
+    /* private flow table of a flow worker thread, NULL if the global flow
+     * hash is used (flow.thread-local) */
+    struct FlowThreadTable_ *flow_table;
+
+    /* match counters of the early filter rules, NULL if not in use */
+    uint16_t *counter_early_filter;
+
+    /* flow sampling (flow.sampling): current rate of this thread and the
+     * packet second it was last updated */
+    uint32_t flow_sample_rate;
+    uint32_t flow_sample_ts;
+    uint16_t counter_flow_sampled_out;
+    uint16_t counter_flow_sample_rate;
+
+    /* flows bypassed by flow.cpu-cost.bypass-ticks */
+    uint16_t counter_flow_cost_bypassed;
+
 } DecodeThreadVars;
 
 typedef struct CaptureStats_ {
@@ -704,6 +787,59 @@ typedef struct CaptureStats_ {
 void CaptureStatsUpdate(ThreadVars *tv, CaptureStats *s, const Packet *p);
 void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
 
+/** \brief per ring stats of a live capture thread
+ *
+ *  A capture loop calls CaptureRingStatsPollStart before waiting for
+ *  packets, CaptureRingStatsPollEnd with the ring fill level once
+ *  packets are available and CaptureRingStatsBatchEnd after handing
+ *  them to the pipeline.
+ */
+typedef struct CaptureRingStats_ {
+    uint64_t poll_start;
+    uint64_t pipeline_start;
+    /** ring is above the high water mark */
+    bool congested;
+
+    uint16_t counter_poll_ticks;
+    uint16_t counter_pipeline_ticks;
+    uint16_t counter_pkts_per_poll;
+    uint16_t counter_fill_avg;
+    uint16_t counter_fill_max;
+    uint16_t counter_high_water;
+} CaptureRingStats;
+
+void CaptureRingStatsSetup(ThreadVars *tv, CaptureRingStats *s);
+void CaptureRingStatsPollStart(CaptureRingStats *s);
+void CaptureRingStatsPollEnd(ThreadVars *tv, CaptureRingStats *s,
+        uint32_t used, uint32_t size);
+void CaptureRingStatsBatchEnd(ThreadVars *tv, CaptureRingStats *s, uint64_t pkts);
+void CaptureRingStatsPacket(const CaptureRingStats *s, Packet *p);
+
+/** \brief how a live capture thread waits for packets */
+enum CapturePollMode {
+    /** block in poll() until packets arrive or it times out (default) */
+    CAPTURE_POLL_BLOCKING = 0,
+    /** spin with non blocking polls for a budget, then block */
+    CAPTURE_POLL_HYBRID,
+    /** never block, spin until packets arrive or the timeout expires */
+    CAPTURE_POLL_BUSY,
+};
+
+typedef struct CapturePoll_ {
+    enum CapturePollMode mode;
+    /** spin budget in usec for the hybrid mode */
+    uint32_t spin_usec;
+
+    uint16_t counter_spin_hits;
+    uint16_t counter_blocking;
+} CapturePoll;
+
+int CapturePollParseMode(const char *str, enum CapturePollMode *mode);
+void CapturePollSetup(ThreadVars *tv, CapturePoll *c,
+        enum CapturePollMode mode, uint32_t spin_usec);
+int CapturePollWait(ThreadVars *tv, CapturePoll *c,
+        struct pollfd *fds, nfds_t nfds, int timeout);
+
 #define PACKET_CLEAR_L4VARS(p) do {                         \
         memset(&(p)->l4vars, 0x00, sizeof((p)->l4vars));    \
     } while (0)
@@ -758,6 +894,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->vlan_id[0] = 0;                    \
         (p)->vlan_id[1] = 0;                    \
         (p)->vlan_idx = 0;                      \
+        (p)->domain_id = 0;                     \
         (p)->ts.tv_sec = 0;                     \
         (p)->ts.tv_usec = 0;                    \
         (p)->datalink = 0;                      \
@@ -799,6 +936,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->BypassPacketsFlow = NULL;          \
         (p)->pktlen = 0;                        \
         (p)->alerts.cnt = 0;                    \
+        (p)->alerts.discarded = 0;              \
         (p)->alerts.drop.action = 0;            \
         (p)->pcap_cnt = 0;                      \
         (p)->tunnel_rtv_cnt = 0;                \
@@ -812,6 +950,8 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         PACKET_RESET_CHECKSUMS((p));            \
         PACKET_PROFILING_RESET((p));            \
         p->tenant_id = 0;                       \
+        p->vni = 0;                             \
+        p->early_filter = 0;                    \
     } while (0)
 
 #define PACKET_RECYCLE(p) do { \
@@ -889,6 +1029,20 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
 #define IS_TUNNEL_PKT_VERDICTED(p)  (((p)->flags & PKT_TUNNEL_VERDICTED))
 #define SET_TUNNEL_PKT_VERDICTED(p) ((p)->flags |= PKT_TUNNEL_VERDICTED)
 
+/* Packet::domain_id holds the MPLS domain in the low 24 bits, the PPPoE
+ * session id in the 16 bits above it and the VXLAN or Geneve VNI in the
+ * top 24 bits, so none of them can alias another. */
+#define DOMAIN_ID_MPLS_MAX  0xffffffU
+#define DOMAIN_ID_SET_MPLS(p, d) \
+    ((p)->domain_id = ((p)->domain_id & ~0xffffffULL) | \
+                      ((uint64_t)(d) & 0xffffffULL))
+#define DOMAIN_ID_SET_PPPOE(p, s) \
+    ((p)->domain_id = ((p)->domain_id & ~(0xffffULL << 24)) | \
+                      ((uint64_t)(uint16_t)(s) << 24))
+#define DOMAIN_ID_SET_VNI(p, v) \
+    ((p)->domain_id = ((p)->domain_id & ~(0xffffffULL << 40)) | \
+                      (((uint64_t)(v) & 0xffffffULL) << 40))
+
 enum DecodeTunnelProto {
     DECODE_TUNNEL_ETHERNET,
     DECODE_TUNNEL_ERSPAN,
@@ -902,6 +1056,7 @@ enum DecodeTunnelProto {
 Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *parent,
                              uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto, PacketQueue *pq);
 Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint32_t len, uint8_t proto);
+int DecodeTunnelPortsParse(const char *str, uint16_t *ports, int max);
 void PacketDefragPktSetupParent(Packet *parent);
 void DecodeRegisterPerfCounters(DecodeThreadVars *, ThreadVars *);
 Packet *PacketGetFromQueueOrAlloc(void);
@@ -915,6 +1070,7 @@ int PacketCallocExtPkt(Packet *p, int datalen);
 int PacketCopyData(Packet *p, uint8_t *pktdata, uint32_t pktlen);
 int PacketSetData(Packet *p, uint8_t *pktdata, uint32_t pktlen);
 int PacketCopyDataOffset(Packet *p, uint32_t offset, uint8_t *data, uint32_t datalen);
+int PacketReserveData(Packet *p, uint32_t size);
 const char *PktSrcToString(enum PktSrcEnum pkt_src);
 void PacketBypassCallback(Packet *p);
 void PacketSwap(Packet *p);
@@ -930,6 +1086,8 @@ int DecodeSll(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, P
 int DecodePPP(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *);
 int DecodePPPOESession(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *);
 int DecodePPPOEDiscovery(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *);
+int PacketTunnelDecodeInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto, PacketQueue *pq);
 int DecodeTunnel(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *, enum DecodeTunnelProto) __attribute__ ((warn_unused_result));
 int DecodeNull(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *);
 int DecodeRaw(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint32_t, PacketQueue *);
@@ -1126,6 +1284,13 @@ void DecodeUnregisterCounters(void);
  *  so flag it for not setting stream events */
 #define PKT_STREAM_NO_EVENTS            (1<<28)
 
+/** Packet was re-pointed at the inner headers of a tunnel, the outer layer
+ *  is in Packet::tunnel_outer */
+#define PKT_TUNNEL_IN_PLACE             (1<<30)
+
+/** Packet was read while the capture ring was above its high water mark */
+#define PKT_RING_CONGESTED              BIT_U32(31)
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) \
     ((p)->flags & (PKT_PSEUDO_STREAM_END|PKT_PSEUDO_DETECTLOG_FLUSH))
@@ -24,6 +24,7 @@
 #include "util-byte.h"
 #include "util-misc.h"
 #include "util-hash-lookup3.h"
+#include "util-pages.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
@@ -37,7 +38,7 @@ static DefragTrackerQueue defragtracker_spare_q;
  */
 int DefragTrackerSetMemcap(uint64_t size)
 {
-    if ((uint64_t)SC_ATOMIC_GET(defrag_memuse) < size) {
+    if (MemcapCounterGet(&defrag_memuse) < size) {
         SC_ATOMIC_SET(defrag_config.memcap, size);
         return 1;
     }
@@ -63,7 +64,7 @@ uint64_t DefragTrackerGetMemcap(void)
  */
 uint64_t DefragTrackerGetMemuse(void)
 {
-    uint64_t memusecopy = (uint64_t)SC_ATOMIC_GET(defrag_memuse);
+    uint64_t memusecopy = MemcapCounterGet(&defrag_memuse);
     return memusecopy;
 }
 
@@ -84,7 +85,7 @@ static DefragTracker *DefragTrackerAlloc(void)
         return NULL;
     }
 
-    (void) SC_ATOMIC_ADD(defrag_memuse, sizeof(DefragTracker));
+    MemcapCounterIncr(&defrag_memuse, sizeof(DefragTracker));
 
     DefragTracker *dt = SCMalloc(sizeof(DefragTracker));
     if (unlikely(dt == NULL))
@@ -107,7 +108,7 @@ static void DefragTrackerFree(DefragTracker *dt)
 
         SCMutexDestroy(&dt->lock);
         SCFree(dt);
-        (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragTracker));
+        MemcapCounterDecr(&defrag_memuse, sizeof(DefragTracker));
     }
 }
 
@@ -132,6 +133,7 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p)
     dt->proto = IP_GET_IPPROTO(p);
     dt->vlan_id[0] = p->vlan_id[0];
     dt->vlan_id[1] = p->vlan_id[1];
+    dt->domain_id = p->domain_id;
     dt->policy = DefragGetOsPolicy(p);
     dt->host_timeout = DefragPolicyGetHostTimeout(p);
     dt->remove = 0;
@@ -155,6 +157,10 @@ void DefragTrackerClearMemory(DefragTracker *dt)
 #define DEFRAG_DEFAULT_HASHSIZE 4096
 #define DEFRAG_DEFAULT_MEMCAP 16777216
 #define DEFRAG_DEFAULT_PREALLOC 1000
+#define DEFRAG_DEFAULT_THREAD_HASHSIZE 1024
+/** trackers kept in a thread table's spare list, the rest go back to the
+ *  global spare queue */
+#define DEFRAG_THREAD_SPARE_MAX 64
 
 /** \brief initialize the configuration
  *  \warning Not thread safe */
@@ -165,7 +171,7 @@ void DefragInitConfig(char quiet)
     memset(&defrag_config,  0, sizeof(defrag_config));
     //SC_ATOMIC_INIT(flow_flags);
     SC_ATOMIC_INIT(defragtracker_counter);
-    SC_ATOMIC_INIT(defrag_memuse);
+    MemcapCounterInit(&defrag_memuse, 0);
     SC_ATOMIC_INIT(defragtracker_prune_idx);
     SC_ATOMIC_INIT(defrag_config.memcap);
     DefragTrackerQueueInit(&defragtracker_spare_q);
@@ -174,6 +180,7 @@ void DefragInitConfig(char quiet)
     defrag_config.hash_rand   = (uint32_t)RandomGet();
     defrag_config.hash_size   = DEFRAG_DEFAULT_HASHSIZE;
     defrag_config.prealloc    = DEFRAG_DEFAULT_PREALLOC;
+    defrag_config.thread_hash_size = DEFRAG_DEFAULT_THREAD_HASHSIZE;
     SC_ATOMIC_SET(defrag_config.memcap, DEFRAG_DEFAULT_MEMCAP);
 
     /* Check if we have memcap and hash_size defined at config */
@@ -213,6 +220,22 @@ void DefragInitConfig(char quiet)
             WarnInvalidConfEntry("defrag.trackers", "%"PRIu32, defrag_config.prealloc);
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("defrag.thread-local.enabled", &thread_local) == 1 &&
+            thread_local == 1) {
+        defrag_config.thread_local = 1;
+    }
+    if ((ConfGet("defrag.thread-local.hash-size", &conf_val)) == 1)
+    {
+        if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) > 0 && configval > 0) {
+            defrag_config.thread_hash_size = configval;
+        } else {
+            WarnInvalidConfEntry("defrag.thread-local.hash-size", "%"PRIu32,
+                    defrag_config.thread_hash_size);
+        }
+    }
+
     SCLogDebug("DefragTracker config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, SC_ATOMIC_GET(defrag_config.memcap),
                defrag_config.hash_size, defrag_config.prealloc);
@@ -228,23 +251,22 @@ void DefragInitConfig(char quiet)
                 (uintmax_t)sizeof(DefragTrackerHashRow));
         exit(EXIT_FAILURE);
     }
-    defragtracker_hash = SCCalloc(defrag_config.hash_size, sizeof(DefragTrackerHashRow));
+    defragtracker_hash = PageAllocTable(defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     if (unlikely(defragtracker_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
-    memset(defragtracker_hash, 0, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
 
     uint32_t i = 0;
     for (i = 0; i < defrag_config.hash_size; i++) {
         DRLOCK_INIT(&defragtracker_hash[i]);
     }
-    (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
+    MemcapCounterIncr(&defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the defrag hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
-                  SC_ATOMIC_GET(defrag_memuse), defrag_config.hash_size,
+                  MemcapCounterGet(&defrag_memuse), defrag_config.hash_size,
                   (uintmax_t)sizeof(DefragTrackerHashRow));
     }
 
@@ -257,7 +279,7 @@ void DefragInitConfig(char quiet)
                     SCLogError(SC_ERR_DEFRAG_INIT, "preallocating defrag trackers failed: "
                             "max defrag memcap reached. Memcap %"PRIu64", "
                             "Memuse %"PRIu64".", SC_ATOMIC_GET(defrag_config.memcap),
-                            ((uint64_t)SC_ATOMIC_GET(defrag_memuse) + (uint64_t)sizeof(DefragTracker)));
+                            (MemcapCounterGet(&defrag_memuse) + (uint64_t)sizeof(DefragTracker)));
                     exit(EXIT_FAILURE);
                 }
 
@@ -275,9 +297,14 @@ void DefragInitConfig(char quiet)
         }
     }
 
+    if (quiet == FALSE && defrag_config.thread_local) {
+        SCLogConfig("defrag uses per thread tables of %"PRIu32" buckets",
+                defrag_config.thread_hash_size);
+    }
+
     if (quiet == FALSE) {
         SCLogConfig("defrag memory usage: %"PRIu64" bytes, maximum: %"PRIu64,
-                SC_ATOMIC_GET(defrag_memuse), SC_ATOMIC_GET(defrag_config.memcap));
+                MemcapCounterGet(&defrag_memuse), SC_ATOMIC_GET(defrag_config.memcap));
     }
 
     return;
@@ -317,14 +344,14 @@ void DefragHashShutdown(void)
 
             DRLOCK_DESTROY(&defragtracker_hash[u]);
         }
-        SCFree(defragtracker_hash);
+        PageFreeTable(defragtracker_hash, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
         defragtracker_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
+    MemcapCounterDecr(&defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
-    SC_ATOMIC_DESTROY(defrag_memuse);
+    MemcapCounterDestroy(&defrag_memuse);
     SC_ATOMIC_DESTROY(defragtracker_counter);
     SC_ATOMIC_DESTROY(defrag_config.memcap);
     //SC_ATOMIC_DESTROY(flow_flags);
@@ -377,7 +404,7 @@ typedef struct DefragHashKey6_ {
     };
 } DefragHashKey6;
 
-/* calculate the hash key for this packet
+/* calculate the hash for this packet
  *
  * we're using:
  *  hash_rand -- set at init time
@@ -386,9 +413,9 @@ typedef struct DefragHashKey6_ {
  *  id
  *  vlan_id
  */
-static inline uint32_t DefragHashGetKey(Packet *p)
+static inline uint32_t DefragHashGetHash(Packet *p)
 {
-    uint32_t key;
+    uint32_t hash;
 
     if (p->ip4h != NULL) {
         DefragHashKey4 dhk;
@@ -403,8 +430,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
         if (DefragHashRawAddressIPv6GtU32(p->src.addr_data32, p->dst.addr_data32)) {
@@ -430,12 +456,16 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
     } else
-        key = 0;
+        hash = 0;
 
-    return key;
+    return hash;
+}
+
+static inline uint32_t DefragHashGetKey(Packet *p)
+{
+    return DefragHashGetHash(p) % defrag_config.hash_size;
 }
 
 /* Since two or more trackers can have the same hash key, we need to compare
@@ -448,7 +478,8 @@ static inline uint32_t DefragHashGetKey(Packet *p)
      (d1)->proto == IP_GET_IPPROTO(d2) &&   \
      (d1)->id == (id) && \
      (d1)->vlan_id[0] == (d2)->vlan_id[0] && \
-     (d1)->vlan_id[1] == (d2)->vlan_id[1])
+     (d1)->vlan_id[1] == (d2)->vlan_id[1] && \
+     (d1)->domain_id == (d2)->domain_id)
 
 static inline int DefragTrackerCompare(DefragTracker *t, Packet *p)
 {
@@ -755,3 +786,230 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void)
 }
 
 
+
+/**
+ *  \brief Allocate the tracker table of a decoder thread
+ *
+ *  \retval t table or NULL if per thread tables are disabled or the
+ *          memcap doesn't allow it, in which case the global hash is used
+ */
+DefragThreadTable *DefragThreadTableAlloc(void)
+{
+    if (!defrag_config.thread_local)
+        return NULL;
+
+    const uint64_t rows_size =
+        (uint64_t)defrag_config.thread_hash_size * sizeof(DefragThreadTableRow);
+    if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragThreadTable) + rows_size))) {
+        SCLogWarning(SC_ERR_DEFRAG_INIT, "defrag memcap reached, thread "
+                "will use the global defrag hash");
+        return NULL;
+    }
+
+    DefragThreadTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    t->rows = SCCalloc(defrag_config.thread_hash_size, sizeof(DefragThreadTableRow));
+    if (unlikely(t->rows == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    t->size = defrag_config.thread_hash_size;
+    MemcapCounterIncr(&defrag_memuse, sizeof(DefragThreadTable) + rows_size);
+    return t;
+}
+
+void DefragThreadTableFree(DefragThreadTable *t)
+{
+    if (t == NULL)
+        return;
+
+    for (uint32_t u = 0; u < t->size; u++) {
+        DefragTracker *dt = t->rows[u].head;
+        while (dt) {
+            DefragTracker *n = dt->hnext;
+            DefragTrackerFree(dt);
+            dt = n;
+        }
+    }
+    while (t->spare != NULL) {
+        DefragTracker *dt = t->spare;
+        t->spare = dt->lnext;
+        DefragTrackerFree(dt);
+    }
+
+    MemcapCounterDecr(&defrag_memuse, sizeof(DefragThreadTable) +
+            (uint64_t)t->size * sizeof(DefragThreadTableRow));
+    SCFree(t->rows);
+    SCFree(t);
+}
+
+static inline void DefragThreadTableUnlink(DefragThreadTableRow *row,
+        DefragTracker *dt)
+{
+    if (dt->hprev != NULL)
+        dt->hprev->hnext = dt->hnext;
+    if (dt->hnext != NULL)
+        dt->hnext->hprev = dt->hprev;
+    if (row->head == dt)
+        row->head = dt->hnext;
+    if (row->tail == dt)
+        row->tail = dt->hprev;
+    dt->hnext = NULL;
+    dt->hprev = NULL;
+}
+
+static inline void DefragThreadTableLinkHead(DefragThreadTableRow *row,
+        DefragTracker *dt)
+{
+    dt->hprev = NULL;
+    dt->hnext = row->head;
+    if (row->head != NULL)
+        row->head->hprev = dt;
+    else
+        row->tail = dt;
+    row->head = dt;
+}
+
+/** \internal
+ *  \brief take the oldest tracker of a row for reuse at memcap
+ *
+ *  Like DefragTrackerGetUsedDefragTracker(), but on our own table, so
+ *  the reused tracker was never in use by another thread. */
+static DefragTracker *DefragThreadTableGetUsed(DefragThreadTable *t)
+{
+    uint32_t idx = t->prune_idx;
+
+    for (uint32_t cnt = 0; cnt < t->size; cnt++) {
+        if (++idx >= t->size)
+            idx = 0;
+
+        DefragThreadTableRow *row = &t->rows[idx];
+        DefragTracker *dt = row->tail;
+        if (dt == NULL)
+            continue;
+
+        DefragThreadTableUnlink(row, dt);
+        DefragTrackerClearMemory(dt);
+        t->cnt--;
+        t->prune_idx = idx;
+        return dt;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief get a cleared tracker: our spare list first, then the global
+ *         spare queue, a new one and last, our own oldest tracker */
+static DefragTracker *DefragThreadTableGetNew(DefragThreadTable *t)
+{
+    DefragTracker *dt = t->spare;
+    if (dt != NULL) {
+        t->spare = dt->lnext;
+        dt->lnext = NULL;
+        t->spare_cnt--;
+        return dt;
+    }
+
+    dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    if (dt != NULL)
+        return dt;
+
+    dt = DefragTrackerAlloc();
+    if (dt != NULL)
+        return dt;
+
+    return DefragThreadTableGetUsed(t);
+}
+
+/**
+ *  \brief Find or create the tracker for a fragment in a thread table
+ *
+ *  \retval dt tracker or NULL at memcap. The tracker is not locked and
+ *          its use_cnt is not raised, as no other thread can see it.
+ */
+DefragTracker *DefragThreadTableGetTracker(DefragThreadTable *t, Packet *p)
+{
+    DefragThreadTableRow *row = &t->rows[DefragHashGetHash(p) % t->size];
+
+    for (DefragTracker *dt = row->head; dt != NULL; dt = dt->hnext) {
+        if (dt->remove || DefragTrackerCompare(dt, p) == 0)
+            continue;
+
+        /* put it on top of the row, this rewards active trackers */
+        if (dt != row->head) {
+            DefragThreadTableUnlink(row, dt);
+            DefragThreadTableLinkHead(row, dt);
+        }
+        return dt;
+    }
+
+    DefragTracker *dt = DefragThreadTableGetNew(t);
+    if (dt == NULL)
+        return NULL;
+
+    DefragTrackerInit(dt, p);
+    (void) DefragTrackerDecrUsecnt(dt);
+
+    DefragThreadTableLinkHead(row, dt);
+    t->cnt++;
+    return dt;
+}
+
+/** \internal
+ *  \brief unlink and clear a tracker and keep it for reuse */
+static void DefragThreadTableRemoveFromRow(DefragThreadTable *t,
+        DefragThreadTableRow *row, DefragTracker *dt)
+{
+    DefragThreadTableUnlink(row, dt);
+    DefragTrackerClearMemory(dt);
+    t->cnt--;
+
+    if (t->spare_cnt < DEFRAG_THREAD_SPARE_MAX) {
+        dt->lnext = t->spare;
+        t->spare = dt;
+        t->spare_cnt++;
+    } else {
+        DefragTrackerEnqueue(&defragtracker_spare_q, dt);
+    }
+}
+
+/**
+ *  \brief Remove a tracker from a thread table after reassembly
+ *
+ *  \param p the fragment the tracker was looked up with
+ */
+void DefragThreadTableRemove(DefragThreadTable *t, Packet *p, DefragTracker *dt)
+{
+    DefragThreadTableRemoveFromRow(t, &t->rows[DefragHashGetHash(p) % t->size], dt);
+}
+
+/**
+ *  \brief time out the trackers of a thread table
+ *
+ *  Called by the owning thread, as the flow manager only handles the
+ *  global hash.
+ *
+ *  \retval cnt number of timed out trackers
+ */
+uint32_t DefragThreadTableTimeout(DefragThreadTable *t, const struct timeval *ts)
+{
+    uint32_t cnt = 0;
+
+    if (t->cnt == 0)
+        return 0;
+
+    for (uint32_t u = 0; u < t->size; u++) {
+        DefragThreadTableRow *row = &t->rows[u];
+        DefragTracker *dt = row->tail;
+        while (dt != NULL) {
+            DefragTracker *prev = dt->hprev;
+            if (dt->remove || !timercmp(&dt->timeout, ts, >)) {
+                DefragThreadTableRemoveFromRow(t, row, dt);
+                cnt++;
+            }
+            dt = prev;
+        }
+    }
+    return cnt;
+}
@@ -26,6 +26,7 @@
 
 #include "decode.h"
 #include "defrag.h"
+#include "util-memcap.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define DRLOCK_SPIN
@@ -64,6 +65,33 @@ typedef struct DefragTrackerHashRow_ {
 /** defrag tracker hash table */
 DefragTrackerHashRow *defragtracker_hash;
 
+typedef struct DefragThreadTableRow_ {
+    DefragTracker *head;
+    DefragTracker *tail;
+} DefragThreadTableRow;
+
+/** \brief tracker table of a single decoder thread
+ *
+ *  Only used by the thread owning it, so there is no locking. Requires
+ *  all fragments of a datagram to be delivered to the same thread. */
+typedef struct DefragThreadTable_ {
+    DefragThreadTableRow *rows;
+    uint32_t size;
+
+    /** trackers in the table */
+    uint32_t cnt;
+
+    /** cleared trackers for reuse, linked through lnext */
+    DefragTracker *spare;
+    uint32_t spare_cnt;
+
+    /** row to start looking for a tracker to reuse at memcap */
+    uint32_t prune_idx;
+
+    /** packet time of the next timeout run */
+    time_t next_timeout;
+} DefragThreadTable;
+
 #define DEFRAG_VERBOSE    0
 #define DEFRAG_QUIET      1
 
@@ -72,6 +100,10 @@ typedef struct DefragConfig_ {
     uint32_t hash_rand;
     uint32_t hash_size;
     uint32_t prealloc;
+
+    /** per thread tables instead of the global hash */
+    int thread_local;
+    uint32_t thread_hash_size;
 } DefragConfig;
 
 /** \brief check if a memory alloc would fit in the memcap
@@ -82,10 +114,10 @@ typedef struct DefragConfig_ {
  *  \retval 0 no fit
  */
 #define DEFRAG_CHECK_MEMCAP(size) \
-    ((((uint64_t)SC_ATOMIC_GET(defrag_memuse) + (uint64_t)(size)) <= SC_ATOMIC_GET(defrag_config.memcap)))
+    MemcapCounterCheck(&defrag_memuse, (uint64_t)(size), SC_ATOMIC_GET(defrag_config.memcap))
 
 DefragConfig defrag_config;
-SC_ATOMIC_DECLARE(uint64_t,defrag_memuse);
+MemcapCounter defrag_memuse;
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_counter);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_prune_idx);
 
@@ -99,6 +131,12 @@ void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
+DefragThreadTable *DefragThreadTableAlloc(void);
+void DefragThreadTableFree(DefragThreadTable *);
+DefragTracker *DefragThreadTableGetTracker(DefragThreadTable *, Packet *);
+void DefragThreadTableRemove(DefragThreadTable *, Packet *, DefragTracker *);
+uint32_t DefragThreadTableTimeout(DefragThreadTable *, const struct timeval *);
+
 int DefragTrackerSetMemcap(uint64_t);
 uint64_t DefragTrackerGetMemcap(void);
 uint64_t DefragTrackerGetMemuse(void);
@@ -264,6 +264,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
      * fragments are inserted if frag_offset order. */
     Frag *frag = NULL;
     int len = 0;
+    uint32_t hdr_len = 0, end = 0;
     RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         if (frag->offset > len) {
             /* This fragment starts after the end of the previous
@@ -273,6 +274,10 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         else {
             len += frag->data_len;
         }
+        if (frag->offset == 0)
+            hdr_len = frag->data_offset;
+        if ((uint32_t)frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
@@ -286,6 +291,10 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->flags |= PKT_REBUILT_FRAGMENT;
     rp->recursion_level = p->recursion_level;
+    /* get the final buffer in place before copying, so each byte is
+     * copied once */
+    if (PacketReserveData(rp, MIN(hdr_len + end, MAX_PAYLOAD_SIZE)) != 0)
+        goto error_remove_tracker;
 
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
@@ -377,12 +386,17 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     /* Check that we have all the data. Relies on the fact that
      * fragments are inserted if frag_offset order. */
     int len = 0;
+    uint32_t hdr_len = 0, end = 0;
     Frag *first = RB_MIN(IP_FRAGMENTS, &tracker->fragment_tree);
     Frag *frag = NULL;
     RB_FOREACH_FROM(frag, IP_FRAGMENTS, first) {
         if (frag->skip) {
             continue;
         }
+        if (frag->offset == 0)
+            hdr_len = frag->frag_hdr_offset;
+        if ((uint32_t)frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
 
         if (frag == first) {
             if (frag->offset != 0) {
@@ -404,14 +418,15 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
         goto error_remove_tracker;
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
+    if (PacketReserveData(rp, MIN(hdr_len + end, MAX_PAYLOAD_SIZE)) != 0)
+        goto error_remove_tracker;
 
     int unfragmentable_len = 0;
     int fragmentable_offset = 0;
@@ -817,7 +832,19 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
+    /* The first fragment keeps its headers, they are the headers of the
+     * reassembled packet. Of the others only the data is needed, so
+     * that is all that is copied. */
+    const int first = (frag_offset == 0 && ltrim == 0);
+    uint32_t copy_offset = first ? 0 : (uint32_t)data_offset + ltrim;
+    uint32_t copy_len = first ? (uint32_t)data_offset + data_len :
+        (uint32_t)data_len - ltrim;
+    if (copy_offset + copy_len > GET_PKT_LEN(p)) {
+        /* should not happen, the decoders checked the lengths */
+        copy_len = copy_offset < GET_PKT_LEN(p) ? GET_PKT_LEN(p) - copy_offset : 0;
+    }
+
+    new->pkt = SCMalloc(copy_len > 0 ? copy_len : 1);
     if (new->pkt == NULL) {
         SCMutexLock(&defrag_context->frag_pool_lock);
         PoolReturn(defrag_context->frag_pool, new);
@@ -829,12 +856,12 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
         }
         goto done;
     }
-    memcpy(new->pkt, GET_PKT_DATA(p) + ltrim, GET_PKT_LEN(p) - ltrim);
-    new->len = GET_PKT_LEN(p) - ltrim;
+    memcpy(new->pkt, GET_PKT_DATA(p) + copy_offset, copy_len);
+    new->len = copy_len;
     /* in case of unfragmentable exthdrs, update the 'next hdr' field
      * in the raw buffer so the reassembled packet will point to the
      * correct next header after stripping the frag header */
-    if (ip6_nh_set_offset > 0 && frag_offset == 0 && ltrim == 0) {
+    if (ip6_nh_set_offset > 0 && first) {
         if (new->len > ip6_nh_set_offset) {
             SCLogDebug("updating frag to have 'correct' nh value: %u -> %u",
                     new->pkt[ip6_nh_set_offset], ip6_nh_set_value);
@@ -844,7 +871,7 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
 
     new->hlen = hlen;
     new->offset = frag_offset + ltrim;
-    new->data_offset = data_offset;
+    new->data_offset = first ? data_offset : 0;
     new->data_len = data_len - ltrim;
     new->ip_hdr_offset = ip_hdr_offset;
     new->frag_hdr_offset = frag_hdr_offset;
@@ -985,6 +1012,33 @@ DefragGetTracker(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     return DefragGetTrackerFromHash(p);
 }
 
+/** \internal
+ *  \brief handle a fragment with the tracker table of this thread
+ *
+ *  No locks are taken. The table is timed out here, once per second of
+ *  packet time, as the flow manager only handles the global hash.
+ */
+static Packet *
+DefragThreadLocal(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, PacketQueue *pq)
+{
+    DefragThreadTable *table = dtv->defrag_table;
+
+    if (p->ts.tv_sec >= table->next_timeout) {
+        (void)DefragThreadTableTimeout(table, &p->ts);
+        table->next_timeout = p->ts.tv_sec + 1;
+    }
+
+    DefragTracker *tracker = DefragThreadTableGetTracker(table, p);
+    if (tracker == NULL)
+        return NULL;
+
+    Packet *rp = DefragInsertFrag(tv, dtv, tracker, p, pq);
+    if (tracker->remove) {
+        DefragThreadTableRemove(table, p, tracker);
+    }
+    return rp;
+}
+
 /**
  * \brief Entry point for IPv4 and IPv6 fragments.
  *
@@ -1030,6 +1084,10 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, PacketQueue *pq)
         }
     }
 
+    if (dtv != NULL && dtv->defrag_table != NULL) {
+        return DefragThreadLocal(tv, dtv, p, pq);
+    }
+
     /* return a locked tracker or NULL */
     tracker = DefragGetTracker(tv, dtv, p);
     if (tracker == NULL)
@@ -2070,6 +2128,69 @@ static int IPV6DefragSturgesNovakLastTest(void)
     PASS;
 }
 
+/**
+ * Reassembly and timeout with a per thread tracker table.
+ */
+static int DefragThreadLocalTest(void)
+{
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+
+    FAIL_IF_NOT(ConfSet("defrag.thread-local.enabled", "yes"));
+    FAIL_IF_NOT(ConfSet("defrag.thread-local.hash-size", "16"));
+    DefragInit();
+
+    dtv.defrag_table = DefragThreadTableAlloc();
+    FAIL_IF_NULL(dtv.defrag_table);
+    DefragThreadTable *table = dtv.defrag_table;
+    FAIL_IF(table->size != 16);
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, 12, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, 12, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = BuildTestPacket(IPPROTO_ICMP, 12, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, &dtv, p1, NULL) != NULL);
+    FAIL_IF(Defrag(NULL, &dtv, p2, NULL) != NULL);
+    FAIL_IF(table->cnt != 1);
+    /* nothing went into the global hash */
+    FAIL_IF_NOT_NULL(DefragLookupTrackerFromHash(p1));
+
+    Packet *reassembled = Defrag(NULL, &dtv, p3, NULL);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(IPV4_GET_IPLEN(reassembled) != 39);
+    FAIL_IF(GET_PKT_DATA(reassembled)[36] != 'C');
+
+    /* reassembled trackers are removed right away and reused */
+    FAIL_IF(table->cnt != 0);
+    FAIL_IF(table->spare_cnt != 1);
+    SCFree(reassembled);
+
+    /* a lone fragment is timed out on the next packet past its timeout */
+    FAIL_IF(Defrag(NULL, &dtv, p1, NULL) != NULL);
+    FAIL_IF(table->cnt != 1);
+    FAIL_IF(table->spare_cnt != 0);
+
+    Packet *p4 = BuildTestPacket(IPPROTO_ICMP, 13, 0, 1, 'D', 8);
+    FAIL_IF_NULL(p4);
+    p4->ts.tv_sec += (defrag_context->timeout + 1);
+    FAIL_IF(Defrag(NULL, &dtv, p4, NULL) != NULL);
+    FAIL_IF(table->cnt != 1);
+    FAIL_IF(table->spare_cnt != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(p4);
+
+    DefragThreadTableFree(dtv.defrag_table);
+    DefragDestroy();
+    FAIL_IF_NOT(ConfSet("defrag.thread-local.enabled", "no"));
+    PASS;
+}
+
 static int DefragTimeoutTest(void)
 {
     int i;
@@ -2176,6 +2297,58 @@ static int DefragIPv4TooLargeTest(void)
     PASS;
 }
 
+/**
+ * Reassemble into more than default_packet_size. Only the first fragment
+ * keeps its headers and the reassembled packet gets its extended buffer
+ * before anything is copied in.
+ */
+static int DefragLargeReassemblyTest(void)
+{
+    DefragInit();
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 1200);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, 1, 1200 >> 3, 1, 'B', 1200);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = BuildTestPacket(IPPROTO_ICMP, 1, 2400 >> 3, 0, 'C', 100);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, NULL, p1, NULL) != NULL);
+    FAIL_IF(Defrag(NULL, NULL, p2, NULL) != NULL);
+
+    DefragTracker *tracker = DefragLookupTrackerFromHash(p1);
+    FAIL_IF_NULL(tracker);
+    Frag *frag = RB_MIN(IP_FRAGMENTS, &tracker->fragment_tree);
+    FAIL_IF_NULL(frag);
+    FAIL_IF(frag->len != 20 + 1200);
+    frag = IP_FRAGMENTS_RB_NEXT(frag);
+    FAIL_IF_NULL(frag);
+    FAIL_IF(frag->len != 1200);
+    FAIL_IF(frag->data_offset != 0);
+    FAIL_IF(frag->pkt[0] != 'B');
+    DefragTrackerRelease(tracker);
+
+    Packet *rp = Defrag(NULL, NULL, p3, NULL);
+    FAIL_IF_NULL(rp);
+    FAIL_IF_NULL(rp->ext_pkt);
+    FAIL_IF(GET_PKT_LEN(rp) != 20 + 2500);
+    FAIL_IF(IPV4_GET_IPLEN(rp) != 20 + 2500);
+    FAIL_IF(GET_PKT_DATA(rp)[20] != 'A');
+    FAIL_IF(GET_PKT_DATA(rp)[20 + 1199] != 'A');
+    FAIL_IF(GET_PKT_DATA(rp)[20 + 1200] != 'B');
+    FAIL_IF(GET_PKT_DATA(rp)[20 + 2399] != 'B');
+    FAIL_IF(GET_PKT_DATA(rp)[20 + 2400] != 'C');
+    FAIL_IF(GET_PKT_DATA(rp)[20 + 2499] != 'C');
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    PacketFree(rp);
+
+    DefragDestroy();
+    PASS;
+}
+
 /**
  * Test that fragments in different VLANs that would otherwise be
  * re-assembled, are not re-assembled.  Just use simple in-order
@@ -2475,6 +2648,7 @@ void DefragRegisterTests(void)
 
     UtRegisterTest("DefragIPv4NoDataTest", DefragIPv4NoDataTest);
     UtRegisterTest("DefragIPv4TooLargeTest", DefragIPv4TooLargeTest);
+    UtRegisterTest("DefragLargeReassemblyTest", DefragLargeReassemblyTest);
 
     UtRegisterTest("IPV6DefragInOrderSimpleTest", IPV6DefragInOrderSimpleTest);
     UtRegisterTest("IPV6DefragReverseSimpleTest", IPV6DefragReverseSimpleTest);
@@ -2494,6 +2668,7 @@ void DefragRegisterTests(void)
     UtRegisterTest("DefragVlanTest", DefragVlanTest);
     UtRegisterTest("DefragVlanQinQTest", DefragVlanQinQTest);
     UtRegisterTest("DefragTrackerReuseTest", DefragTrackerReuseTest);
+    UtRegisterTest("DefragThreadLocalTest", DefragThreadLocalTest);
     UtRegisterTest("DefragTimeoutTest", DefragTimeoutTest);
     UtRegisterTest("DefragMfIpv4Test", DefragMfIpv4Test);
     UtRegisterTest("DefragMfIpv6Test", DefragMfIpv6Test);
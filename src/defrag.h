@@ -86,6 +86,7 @@ typedef struct DefragTracker_ {
                            * this tracker. */
 
     uint16_t vlan_id[2]; /**< VLAN ID tracker applies to. */
+    uint64_t domain_id; /**< MPLS domain and PPPoE session tracker applies to. */
 
     uint32_t id; /**< IP ID for this tracker.  32 bits for IPv6, 16
                   * for IPv4. */
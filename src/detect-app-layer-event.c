@@ -29,6 +29,7 @@
 #include "app-layer-protos.h"
 #include "app-layer-parser.h"
 #include "app-layer-smtp.h"
+#include "app-layer-ssl.h"
 #include "detect.h"
 #include "detect-parse.h"
 #include "detect-engine.h"
@@ -320,6 +321,11 @@ static int DetectAppLayerEventSetupP1(DetectEngineCtx *de_ctx, Signature *s, con
         if (DetectSignatureSetAppProto(s, data->alproto) != 0)
             goto error;
 
+        /* TLS events, like the heartbeat ones, can be set after the
+         * handshake, so the records have to be tracked */
+        if (data->alproto == ALPROTO_TLS)
+            SSLEnableEncryptedInspection();
+
         SigMatchAppendSMToList(s, sm, g_applayer_events_list_id);
     }
 
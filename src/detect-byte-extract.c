@@ -35,6 +35,7 @@
 #include "detect-bytejump.h"
 #include "detect-bytetest.h"
 #include "detect-byte-extract.h"
+#include "detect-bytemath.h"
 #include "detect-isdataat.h"
 
 #include "app-layer-protos.h"
@@ -156,8 +157,7 @@ int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, const SigMatchData
 
     /* Extract the byte data */
     if (data->flags & DETECT_BYTE_EXTRACT_FLAG_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = data->extract[BYTE_BIG_ENDIAN](&val, data->nbytes, ptr);
         if (extbytes <= 0) {
             /* strtoull() return 0 if there is no numeric value in data string */
             if (val == 0) {
@@ -172,7 +172,7 @@ int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, const SigMatchData
     } else {
         int endianness = (endian == DETECT_BYTE_EXTRACT_ENDIAN_BIG) ?
                           BYTE_BIG_ENDIAN : BYTE_LITTLE_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = data->extract[endianness](&val, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogDebug("error extracting %d bytes of numeric data: %d",
                     data->nbytes, extbytes);
@@ -484,6 +484,20 @@ static inline DetectByteExtractData *DetectByteExtractParse(const char *arg)
             bed->endian = DETECT_BYTE_EXTRACT_ENDIAN_DEFAULT;
     }
 
+    if (bed->flags & DETECT_BYTE_EXTRACT_FLAG_STRING) {
+        bed->extract[BYTE_BIG_ENDIAN] = ByteExtractStringGetFunc(bed->base);
+        bed->extract[BYTE_LITTLE_ENDIAN] = bed->extract[BYTE_BIG_ENDIAN];
+    } else {
+        bed->extract[BYTE_BIG_ENDIAN] = ByteExtractGetFunc(BYTE_BIG_ENDIAN, bed->nbytes);
+        bed->extract[BYTE_LITTLE_ENDIAN] = ByteExtractGetFunc(BYTE_LITTLE_ENDIAN, bed->nbytes);
+    }
+    if (bed->extract[BYTE_BIG_ENDIAN] == NULL ||
+            bed->extract[BYTE_LITTLE_ENDIAN] == NULL) {
+        SCLogError(SC_ERR_INVALID_SIGNATURE, "byte_extract can't process "
+                   "%d bytes", bed->nbytes);
+        goto error;
+    }
+
     return bed;
  error:
     if (bed != NULL)
@@ -525,7 +539,7 @@ static int DetectByteExtractSetup(DetectEngineCtx *de_ctx, Signature *s, const c
     } else if (data->endian == DETECT_BYTE_EXTRACT_ENDIAN_DCE) {
         if (data->flags & DETECT_BYTE_EXTRACT_FLAG_RELATIVE) {
             prev_pm = DetectGetLastSMFromLists(s, DETECT_CONTENT, DETECT_PCRE,
-                    DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                    DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                     DETECT_ISDATAAT, -1);
             if (prev_pm == NULL) {
                 sm_list = DETECT_SM_LIST_PMATCH;
@@ -544,7 +558,7 @@ static int DetectByteExtractSetup(DetectEngineCtx *de_ctx, Signature *s, const c
     } else if (data->flags & DETECT_BYTE_EXTRACT_FLAG_RELATIVE) {
         prev_pm = DetectGetLastSMFromLists(s,
                 DETECT_CONTENT, DETECT_PCRE,
-                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                 DETECT_ISDATAAT, -1);
         if (prev_pm == NULL) {
             sm_list = DETECT_SM_LIST_PMATCH;
@@ -574,14 +588,7 @@ static int DetectByteExtractSetup(DetectEngineCtx *de_ctx, Signature *s, const c
         }
     }
 
-    SigMatch *prev_bed_sm = DetectGetLastSMByListId(s, sm_list,
-            DETECT_BYTE_EXTRACT, -1);
-    if (prev_bed_sm == NULL)
-        data->local_id = 0;
-    else
-        data->local_id = ((DetectByteExtractData *)prev_bed_sm->ctx)->local_id + 1;
-    if (data->local_id > de_ctx->byte_extract_max_local_id)
-        de_ctx->byte_extract_max_local_id = data->local_id;
+    data->local_id = DetectByteExtractNextLocalId(de_ctx, s, sm_list);
 
 
     sm = SigMatchAlloc();
@@ -658,6 +665,61 @@ SigMatch *DetectByteExtractRetrieveSMVar(const char *arg, const Signature *s)
     return NULL;
 }
 
+/**
+ * \brief Lookup the local id of a named byte_extract or byte_math variable.
+ *
+ * \param arg The name of the variable to lookup.
+ * \param s Pointer the signature to look in.
+ *
+ * \retval local id if found, otherwise -1.
+ */
+int32_t DetectByteExtractRetrieveVarLocalId(const char *arg, const Signature *s)
+{
+    SigMatch *sm = DetectByteExtractRetrieveSMVar(arg, s);
+    if (sm != NULL)
+        return ((DetectByteExtractData *)sm->ctx)->local_id;
+
+    const int nlists = s->init_data->smlists_array_size;
+    for (int list = 0; list < nlists; list++) {
+        for (sm = s->init_data->smlists[list]; sm != NULL; sm = sm->next) {
+            if (sm->type == DETECT_BYTEMATH) {
+                const DetectByteMathData *bmd = (const DetectByteMathData *)sm->ctx;
+                if (strcmp(bmd->result, arg) == 0) {
+                    return bmd->local_id;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * \brief Get the local id for a new byte_extract or byte_math variable.
+ *
+ * byte_extract and byte_math results are stored in the same per thread
+ * array, so the ids are counted over both keywords per list.
+ *
+ * \retval local id for the variable
+ */
+uint8_t DetectByteExtractNextLocalId(DetectEngineCtx *de_ctx, const Signature *s,
+        const int sm_list)
+{
+    uint8_t local_id = 0;
+
+    SigMatch *prev_sm = DetectGetLastSMByListId(s, sm_list,
+            DETECT_BYTE_EXTRACT, DETECT_BYTEMATH, -1);
+    if (prev_sm != NULL && prev_sm->type == DETECT_BYTE_EXTRACT) {
+        local_id = ((DetectByteExtractData *)prev_sm->ctx)->local_id + 1;
+    } else if (prev_sm != NULL) {
+        local_id = ((DetectByteMathData *)prev_sm->ctx)->local_id + 1;
+    }
+    if (local_id > de_ctx->byte_extract_max_local_id)
+        de_ctx->byte_extract_max_local_id = local_id;
+
+    return local_id;
+}
+
 /*************************************Unittests********************************/
 
 #ifdef UNITTESTS
@@ -24,6 +24,8 @@
 #ifndef __DETECT_BYTEEXTRACT_H__
 #define __DETECT_BYTEEXTRACT_H__
 
+#include "util-byte.h"
+
 /* flags */
 #define DETECT_BYTE_EXTRACT_FLAG_RELATIVE   0x01
 #define DETECT_BYTE_EXTRACT_FLAG_MULTIPLIER 0x02
@@ -57,11 +59,16 @@ typedef struct DetectByteExtractData_ {
     /* unique id used to reference this byte_extract keyword */
     uint16_t id;
 
+    /** extractors set up by the parser, indexed by BYTE_BIG_ENDIAN and
+     *  BYTE_LITTLE_ENDIAN as dce picks the endianness per packet */
+    ByteExtractFunc extract[2];
 } DetectByteExtractData;
 
 void DetectByteExtractRegister(void);
 
 SigMatch *DetectByteExtractRetrieveSMVar(const char *, const Signature *);
+int32_t DetectByteExtractRetrieveVarLocalId(const char *, const Signature *);
+uint8_t DetectByteExtractNextLocalId(DetectEngineCtx *, const Signature *, const int);
 int DetectByteExtractDoMatch(DetectEngineThreadCtx *, const SigMatchData *, const Signature *,
                              uint8_t *, uint16_t, uint64_t *, uint8_t);
 
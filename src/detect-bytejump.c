@@ -134,8 +134,7 @@ int DetectBytejumpDoMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
 
     /* Extract the byte data */
     if (flags & DETECT_BYTEJUMP_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = data->extract[BYTE_BIG_ENDIAN](&val, data->nbytes, ptr);
         if(extbytes <= 0) {
             SCLogDebug("error extracting %d bytes of string data: %d",
                     data->nbytes, extbytes);
@@ -144,7 +143,7 @@ int DetectBytejumpDoMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
     }
     else {
         int endianness = (flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = data->extract[endianness](&val, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogDebug("error extracting %d bytes of numeric data: %d",
                     data->nbytes, extbytes);
@@ -243,8 +242,7 @@ static int DetectBytejumpMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
 
     /* Extract the byte data */
     if (data->flags & DETECT_BYTEJUMP_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = data->extract[BYTE_BIG_ENDIAN](&val, data->nbytes, ptr);
         if (extbytes <= 0) {
             SCLogDebug("error extracting %d bytes of string data: %d",
                     data->nbytes, extbytes);
@@ -253,7 +251,7 @@ static int DetectBytejumpMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     }
     else {
         int endianness = (data->flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = data->extract[endianness](&val, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogDebug("error extracting %d bytes of numeric data: %d",
                     data->nbytes, extbytes);
@@ -491,6 +489,19 @@ static DetectBytejumpData *DetectBytejumpParse(const char *optstr, char **offset
     /* This is max 23 so it will fit in a byte (see above) */
     data->nbytes = (uint8_t)nbytes;
 
+    if (data->flags & DETECT_BYTEJUMP_STRING) {
+        data->extract[BYTE_BIG_ENDIAN] = ByteExtractStringGetFunc(data->base);
+        data->extract[BYTE_LITTLE_ENDIAN] = data->extract[BYTE_BIG_ENDIAN];
+    } else {
+        data->extract[BYTE_BIG_ENDIAN] = ByteExtractGetFunc(BYTE_BIG_ENDIAN, nbytes);
+        data->extract[BYTE_LITTLE_ENDIAN] = ByteExtractGetFunc(BYTE_LITTLE_ENDIAN, nbytes);
+    }
+    if (data->extract[BYTE_BIG_ENDIAN] == NULL ||
+            data->extract[BYTE_LITTLE_ENDIAN] == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Invalid number of bytes or base: %s", optstr);
+        goto error;
+    }
+
     return data;
 
 error:
@@ -529,7 +540,7 @@ static int DetectBytejumpSetup(DetectEngineCtx *de_ctx, Signature *s, const char
         if (data->flags & DETECT_BYTEJUMP_RELATIVE) {
             prev_pm = DetectGetLastSMFromLists(s,
                     DETECT_CONTENT, DETECT_PCRE,
-                    DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                    DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                     DETECT_ISDATAAT, -1);
             if (prev_pm == NULL) {
                 sm_list = DETECT_SM_LIST_PMATCH;
@@ -548,7 +559,7 @@ static int DetectBytejumpSetup(DetectEngineCtx *de_ctx, Signature *s, const char
     } else if (data->flags & DETECT_BYTEJUMP_RELATIVE) {
         prev_pm = DetectGetLastSMFromLists(s,
                 DETECT_CONTENT, DETECT_PCRE,
-                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                 DETECT_ISDATAAT, -1);
         if (prev_pm == NULL) {
             sm_list = DETECT_SM_LIST_PMATCH;
@@ -577,13 +588,13 @@ static int DetectBytejumpSetup(DetectEngineCtx *de_ctx, Signature *s, const char
     }
 
     if (offset != NULL) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(offset, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(offset, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "Unknown byte_extract var "
                        "seen in byte_jump - %s\n", offset);
             goto error;
         }
-        data->offset = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        data->offset = local_id;
         data->flags |= DETECT_BYTEJUMP_OFFSET_BE;
         SCFree(offset);
     }
@@ -24,6 +24,8 @@
 #ifndef __DETECT_BYTEJUMP_H__
 #define __DETECT_BYTEJUMP_H__
 
+#include "util-byte.h"
+
 /** Bytejump Base */
 #define DETECT_BYTEJUMP_BASE_UNSET  0 /**< Unset type value string (automatic)*/
 #define DETECT_BYTEJUMP_BASE_OCT    8 /**< "oct" type value string */
@@ -47,6 +49,9 @@ typedef struct DetectBytejumpData_ {
     uint32_t multiplier;              /**< Multiplier for nbytes (multiplier n)*/
     int32_t offset;                   /**< Offset in payload to extract value */
     int32_t post_offset;              /**< Offset to adjust post-jump */
+    /** extractors set up by the parser, indexed by BYTE_BIG_ENDIAN and
+     *  BYTE_LITTLE_ENDIAN as dce picks the endianness per packet */
+    ByteExtractFunc extract[2];
 } DetectBytejumpData;
 
 /* prototypes */
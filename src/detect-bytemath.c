@@ -0,0 +1,547 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the byte_math keyword:
+ *
+ *     byte_math:bytes <num>, offset <offset>, oper <+|-|*|/|<<|>>>,
+ *               rvalue <value|var>, result <var>[, relative]
+ *               [, endian <big|little|dce>][, string <hex|dec|oct>]
+ *               [, bitmask <mask>];
+ *
+ * The result is stored like a byte_extract variable, so it can be used by
+ * byte_test, byte_jump, isdataat and the content modifiers.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-content.h"
+#include "detect-pcre.h"
+#include "detect-byte-extract.h"
+#include "detect-bytemath.h"
+
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+/* max bytes that can be extracted, as a number or as a string */
+#define BYTEMATH_MAX_BYTES          4
+#define BYTEMATH_MAX_STRING_BYTES   10
+
+static int DetectByteMathSetup(DetectEngineCtx *, Signature *, const char *);
+static void DetectByteMathFree(void *);
+#ifdef UNITTESTS
+static void DetectByteMathRegisterTests(void);
+#endif
+
+void DetectBytemathRegister(void)
+{
+    sigmatch_table[DETECT_BYTEMATH].name = "byte_math";
+    sigmatch_table[DETECT_BYTEMATH].desc = "do an arithmetic operation on extracted bytes and store the result";
+    sigmatch_table[DETECT_BYTEMATH].url = DOC_URL DOC_VERSION "/rules/payload-keywords.html#byte-math";
+    sigmatch_table[DETECT_BYTEMATH].Setup = DetectByteMathSetup;
+    sigmatch_table[DETECT_BYTEMATH].Free  = DetectByteMathFree;
+#ifdef UNITTESTS
+    sigmatch_table[DETECT_BYTEMATH].RegisterTests = DetectByteMathRegisterTests;
+#endif
+}
+
+/**
+ *  \brief extract the value and apply the operation
+ *
+ *  \param rvalue right hand value, already resolved if it is a variable
+ *  \param value[out] result
+ *  \param endian DETECT_BYTEMATH_ENDIAN_BIG or DETECT_BYTEMATH_ENDIAN_LITTLE
+ *
+ *  \retval 1 result stored
+ *  \retval 0 no match: data not available, not a number or division by 0
+ */
+int DetectByteMathDoMatch(DetectEngineThreadCtx *det_ctx, const DetectByteMathData *data,
+        const uint8_t *payload, const uint32_t payload_len, const uint64_t rvalue,
+        uint64_t *value, const uint8_t endian)
+{
+    const uint8_t *ptr;
+    int64_t len;
+
+    if (payload_len == 0) {
+        return 0;
+    }
+
+    if (data->flags & DETECT_BYTEMATH_FLAG_RELATIVE) {
+        ptr = payload + det_ctx->buffer_offset + data->offset;
+        len = (int64_t)payload_len - det_ctx->buffer_offset - data->offset;
+        /* No match if there is no relative base */
+        if (len <= 0) {
+            return 0;
+        }
+    } else {
+        ptr = payload + data->offset;
+        len = (int64_t)payload_len - data->offset;
+    }
+
+    if (ptr < payload || data->nbytes > len) {
+        SCLogDebug("data not within payload: len %"PRIi64", nbytes %u",
+                len, data->nbytes);
+        return 0;
+    }
+
+    uint64_t val = 0;
+    const int extbytes = data->extract[endian](&val, data->nbytes, ptr);
+    if (extbytes <= 0) {
+        SCLogDebug("no numeric value in %u bytes", data->nbytes);
+        return 0;
+    }
+
+    if (data->flags & DETECT_BYTEMATH_FLAG_BITMASK) {
+        val &= data->bitmask_val;
+        val >>= data->bitmask_shift_count;
+    }
+
+    switch (data->oper) {
+        case DETECT_BYTEMATH_OPERATOR_PLUS:
+            val += rvalue;
+            break;
+        case DETECT_BYTEMATH_OPERATOR_MINUS:
+            val -= rvalue;
+            break;
+        case DETECT_BYTEMATH_OPERATOR_DIVIDE:
+            if (rvalue == 0) {
+                SCLogDebug("division by zero");
+                return 0;
+            }
+            val /= rvalue;
+            break;
+        case DETECT_BYTEMATH_OPERATOR_MULTIPLY:
+            val *= rvalue;
+            break;
+        case DETECT_BYTEMATH_OPERATOR_LSHIFT:
+            val = (rvalue < 64) ? val << rvalue : 0;
+            break;
+        case DETECT_BYTEMATH_OPERATOR_RSHIFT:
+            val = (rvalue < 64) ? val >> rvalue : 0;
+            break;
+        default:
+            return 0;
+    }
+
+    det_ctx->buffer_offset = (ptr + extbytes) - payload;
+
+    *value = val;
+    SCLogDebug("byte_math result %"PRIu64, val);
+    return 1;
+}
+
+/** \internal
+ *  \brief parse the option string into bmd
+ *  \param rvalue_var[out] name of the rvalue variable, or empty if the
+ *                         rvalue is a number
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int DetectByteMathParse(const char *str, DetectByteMathData *bmd,
+        char *rvalue_var, size_t rvalue_var_size, char *result, size_t result_size)
+{
+    char copy[512];
+    if (strlcpy(copy, str, sizeof(copy)) >= sizeof(copy))
+        return -1;
+
+    bool have_bytes = false, have_offset = false, have_oper = false;
+    bool have_rvalue = false;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        while (isspace((unsigned char)*tok))
+            tok++;
+        size_t len = strlen(tok);
+        while (len > 0 && isspace((unsigned char)tok[len - 1]))
+            tok[--len] = '\0';
+
+        char *val = strchr(tok, ' ');
+        if (val != NULL) {
+            *val++ = '\0';
+            while (isspace((unsigned char)*val))
+                val++;
+        }
+
+        if (strcmp(tok, "relative") == 0 && val == NULL) {
+            bmd->flags |= DETECT_BYTEMATH_FLAG_RELATIVE;
+            continue;
+        } else if (val == NULL || *val == '\0') {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: option '%s' "
+                    "needs a value", tok);
+            return -1;
+        }
+
+        if (strcmp(tok, "bytes") == 0) {
+            uint8_t nbytes = 0;
+            if (ByteExtractStringUint8(&nbytes, 10, 0, val) != (int)strlen(val) ||
+                    nbytes == 0) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bad bytes "
+                        "value '%s'", val);
+                return -1;
+            }
+            bmd->nbytes = nbytes;
+            have_bytes = true;
+        } else if (strcmp(tok, "offset") == 0) {
+            if (ByteExtractStringInt32(&bmd->offset, 10, 0, val) != (int)strlen(val) ||
+                    bmd->offset < -65535 || bmd->offset > 65535) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bad offset "
+                        "'%s', the range is -65535 to 65535", val);
+                return -1;
+            }
+            have_offset = true;
+        } else if (strcmp(tok, "oper") == 0) {
+            if (strcmp(val, "+") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_PLUS;
+            } else if (strcmp(val, "-") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_MINUS;
+            } else if (strcmp(val, "/") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_DIVIDE;
+            } else if (strcmp(val, "*") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_MULTIPLY;
+            } else if (strcmp(val, "<<") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_LSHIFT;
+            } else if (strcmp(val, ">>") == 0) {
+                bmd->oper = DETECT_BYTEMATH_OPERATOR_RSHIFT;
+            } else {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: unknown "
+                        "operator '%s'", val);
+                return -1;
+            }
+            have_oper = true;
+        } else if (strcmp(tok, "rvalue") == 0) {
+            if (isalpha((unsigned char)val[0])) {
+                if (strlcpy(rvalue_var, val, rvalue_var_size) >= rvalue_var_size)
+                    return -1;
+                bmd->flags |= DETECT_BYTEMATH_FLAG_RVALUE_VAR;
+            } else if (ByteExtractStringUint32(&bmd->rvalue, 0, 0, val) != (int)strlen(val)) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bad rvalue "
+                        "'%s'", val);
+                return -1;
+            }
+            have_rvalue = true;
+        } else if (strcmp(tok, "result") == 0) {
+            if (!isalpha((unsigned char)val[0]) ||
+                    strlcpy(result, val, result_size) >= result_size) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bad result "
+                        "name '%s'", val);
+                return -1;
+            }
+        } else if (strcmp(tok, "endian") == 0) {
+            if (strcmp(val, "big") == 0) {
+                bmd->endian = DETECT_BYTEMATH_ENDIAN_BIG;
+            } else if (strcmp(val, "little") == 0) {
+                bmd->endian = DETECT_BYTEMATH_ENDIAN_LITTLE;
+            } else if (strcmp(val, "dce") == 0) {
+                bmd->endian = DETECT_BYTEMATH_ENDIAN_DCE;
+            } else {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: unknown "
+                        "endianness '%s'", val);
+                return -1;
+            }
+        } else if (strcmp(tok, "string") == 0) {
+            if (strcmp(val, "hex") == 0) {
+                bmd->base = 16;
+            } else if (strcmp(val, "dec") == 0) {
+                bmd->base = 10;
+            } else if (strcmp(val, "oct") == 0) {
+                bmd->base = 8;
+            } else {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: unknown "
+                        "string base '%s'", val);
+                return -1;
+            }
+            bmd->flags |= DETECT_BYTEMATH_FLAG_STRING;
+        } else if (strcmp(tok, "bitmask") == 0) {
+            if (ByteExtractStringUint32(&bmd->bitmask_val, 0, 0, val) != (int)strlen(val) ||
+                    bmd->bitmask_val == 0) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bad bitmask "
+                        "'%s'", val);
+                return -1;
+            }
+            bmd->bitmask_shift_count = __builtin_ctz(bmd->bitmask_val);
+            bmd->flags |= DETECT_BYTEMATH_FLAG_BITMASK;
+        } else {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: unknown "
+                    "option '%s'", tok);
+            return -1;
+        }
+    }
+
+    if (!have_bytes || !have_offset || !have_oper || !have_rvalue || result[0] == '\0') {
+        SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: bytes, offset, "
+                "oper, rvalue and result are required");
+        return -1;
+    }
+
+    if (bmd->flags & DETECT_BYTEMATH_FLAG_STRING) {
+        if (bmd->endian != DETECT_BYTEMATH_ENDIAN_BIG) {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: endian can't "
+                    "be combined with string");
+            return -1;
+        }
+        if (bmd->nbytes > BYTEMATH_MAX_STRING_BYTES) {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: can't process "
+                    "more than %d bytes with string", BYTEMATH_MAX_STRING_BYTES);
+            return -1;
+        }
+        bmd->extract[BYTE_BIG_ENDIAN] = ByteExtractStringGetFunc(bmd->base);
+        bmd->extract[BYTE_LITTLE_ENDIAN] = bmd->extract[BYTE_BIG_ENDIAN];
+    } else {
+        if (bmd->nbytes > BYTEMATH_MAX_BYTES) {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "byte_math: can't process "
+                    "more than %d bytes", BYTEMATH_MAX_BYTES);
+            return -1;
+        }
+        bmd->extract[BYTE_BIG_ENDIAN] = ByteExtractGetFunc(BYTE_BIG_ENDIAN, bmd->nbytes);
+        bmd->extract[BYTE_LITTLE_ENDIAN] = ByteExtractGetFunc(BYTE_LITTLE_ENDIAN, bmd->nbytes);
+    }
+
+    return 0;
+}
+
+static int DetectByteMathSetup(DetectEngineCtx *de_ctx, Signature *s, const char *arg)
+{
+    char rvalue_var[64] = "";
+    char result[64] = "";
+    SigMatch *prev_pm = NULL;
+
+    DetectByteMathData *bmd = SCCalloc(1, sizeof(*bmd));
+    if (unlikely(bmd == NULL))
+        return -1;
+
+    if (arg == NULL || DetectByteMathParse(arg, bmd, rvalue_var,
+                sizeof(rvalue_var), result, sizeof(result)) != 0)
+        goto error;
+
+    int sm_list;
+    if (s->init_data->list != DETECT_SM_LIST_NOTSET) {
+        sm_list = s->init_data->list;
+        if (bmd->flags & DETECT_BYTEMATH_FLAG_RELATIVE) {
+            prev_pm = DetectGetLastSMFromLists(s, DETECT_CONTENT, DETECT_PCRE, -1);
+        }
+    } else if (bmd->flags & DETECT_BYTEMATH_FLAG_RELATIVE) {
+        prev_pm = DetectGetLastSMFromLists(s,
+                DETECT_CONTENT, DETECT_PCRE,
+                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
+                DETECT_ISDATAAT, -1);
+        if (prev_pm == NULL) {
+            sm_list = DETECT_SM_LIST_PMATCH;
+        } else {
+            sm_list = SigMatchListSMBelongsTo(s, prev_pm);
+            if (sm_list < 0)
+                goto error;
+        }
+    } else {
+        sm_list = DETECT_SM_LIST_PMATCH;
+    }
+
+    if (bmd->endian == DETECT_BYTEMATH_ENDIAN_DCE) {
+        if (DetectSignatureSetAppProto(s, ALPROTO_DCERPC) != 0)
+            goto error;
+    }
+
+    if (bmd->flags & DETECT_BYTEMATH_FLAG_RVALUE_VAR) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(rvalue_var, s);
+        if (local_id < 0) {
+            SCLogError(SC_ERR_INVALID_SIGNATURE, "unknown byte_extract or "
+                    "byte_math var seen in byte_math - %s", rvalue_var);
+            goto error;
+        }
+        bmd->rvalue = (uint32_t)local_id;
+    }
+
+    bmd->result = SCStrdup(result);
+    if (bmd->result == NULL)
+        goto error;
+    bmd->local_id = DetectByteExtractNextLocalId(de_ctx, s, sm_list);
+
+    SigMatch *sm = SigMatchAlloc();
+    if (sm == NULL)
+        goto error;
+    sm->type = DETECT_BYTEMATH;
+    sm->ctx = (SigMatchCtx *)bmd;
+    SigMatchAppendSMToList(s, sm, sm_list);
+
+    if (prev_pm != NULL && prev_pm->type == DETECT_CONTENT) {
+        DetectContentData *cd = (DetectContentData *)prev_pm->ctx;
+        cd->flags |= DETECT_CONTENT_RELATIVE_NEXT;
+    } else if (prev_pm != NULL && prev_pm->type == DETECT_PCRE) {
+        DetectPcreData *pd = (DetectPcreData *)prev_pm->ctx;
+        pd->flags |= DETECT_PCRE_RELATIVE_NEXT;
+    }
+    return 0;
+
+error:
+    DetectByteMathFree(bmd);
+    return -1;
+}
+
+static void DetectByteMathFree(void *ptr)
+{
+    DetectByteMathData *bmd = ptr;
+    if (bmd == NULL)
+        return;
+    if (bmd->result != NULL)
+        SCFree((void *)bmd->result);
+    SCFree(bmd);
+}
+
+#ifdef UNITTESTS
+static int DetectByteMathParseHelper(const char *str, DetectByteMathData *bmd)
+{
+    char rvalue_var[64] = "";
+    char result[64] = "";
+    memset(bmd, 0, sizeof(*bmd));
+    return DetectByteMathParse(str, bmd, rvalue_var, sizeof(rvalue_var),
+            result, sizeof(result));
+}
+
+/** \test option parsing */
+static int DetectByteMathTest01(void)
+{
+    DetectByteMathData bmd;
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 4, offset 2, oper +, "
+                "rvalue 10, result foo", &bmd) == 0);
+    FAIL_IF_NOT(bmd.nbytes == 4);
+    FAIL_IF_NOT(bmd.offset == 2);
+    FAIL_IF_NOT(bmd.oper == DETECT_BYTEMATH_OPERATOR_PLUS);
+    FAIL_IF_NOT(bmd.rvalue == 10);
+    FAIL_IF_NOT(bmd.endian == DETECT_BYTEMATH_ENDIAN_BIG);
+    FAIL_IF_NOT(bmd.flags == 0);
+    FAIL_IF_NULL(bmd.extract[BYTE_BIG_ENDIAN]);
+
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 2, offset -3, oper <<, "
+                "rvalue bar, result foo, relative, endian little, "
+                "bitmask 0x0ff0", &bmd) == 0);
+    FAIL_IF_NOT(bmd.oper == DETECT_BYTEMATH_OPERATOR_LSHIFT);
+    FAIL_IF_NOT(bmd.offset == -3);
+    FAIL_IF_NOT(bmd.endian == DETECT_BYTEMATH_ENDIAN_LITTLE);
+    FAIL_IF_NOT(bmd.flags == (DETECT_BYTEMATH_FLAG_RELATIVE |
+                DETECT_BYTEMATH_FLAG_RVALUE_VAR | DETECT_BYTEMATH_FLAG_BITMASK));
+    FAIL_IF_NOT(bmd.bitmask_val == 0x0ff0);
+    FAIL_IF_NOT(bmd.bitmask_shift_count == 4);
+
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 10, offset 0, oper /, "
+                "rvalue 2, result foo, string dec", &bmd) == 0);
+    FAIL_IF_NOT(bmd.flags == DETECT_BYTEMATH_FLAG_STRING);
+    FAIL_IF_NOT(bmd.base == 10);
+
+    /* missing result, too many bytes, bad operator, string with endian */
+    FAIL_IF(DetectByteMathParseHelper("bytes 4, offset 0, oper +, rvalue 1", &bmd) == 0);
+    FAIL_IF(DetectByteMathParseHelper("bytes 5, offset 0, oper +, "
+                "rvalue 1, result foo", &bmd) == 0);
+    FAIL_IF(DetectByteMathParseHelper("bytes 4, offset 0, oper %, "
+                "rvalue 1, result foo", &bmd) == 0);
+    FAIL_IF(DetectByteMathParseHelper("bytes 4, offset 0, oper +, "
+                "rvalue 1, result foo, string hex, endian little", &bmd) == 0);
+    PASS;
+}
+
+/** \test extraction and operations */
+static int DetectByteMathTest02(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    DetectByteMathData bmd;
+    uint64_t value = 0;
+    const uint8_t buf[] = "\x01\x02\x03\x04" "1234";
+
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 2, offset 1, oper *, "
+                "rvalue 2, result foo", &bmd) == 0);
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_BIG) == 1);
+    FAIL_IF_NOT(value == 0x0203 * 2);
+    FAIL_IF_NOT(det_ctx.buffer_offset == 3);
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_LITTLE) == 1);
+    FAIL_IF_NOT(value == 0x0302 * 2);
+
+    /* relative to the previous match, past the end */
+    bmd.flags |= DETECT_BYTEMATH_FLAG_RELATIVE;
+    det_ctx.buffer_offset = 6;
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_BIG) == 0);
+
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 4, offset 4, oper -, "
+                "rvalue 34, result foo, string dec", &bmd) == 0);
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_BIG) == 1);
+    FAIL_IF_NOT(value == 1200);
+
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 2, offset 2, oper >>, "
+                "rvalue 1, result foo, bitmask 0x0ff0", &bmd) == 0);
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_BIG) == 1);
+    FAIL_IF_NOT(value == (0x30 >> 1));
+
+    /* division by zero doesn't match */
+    FAIL_IF_NOT(DetectByteMathParseHelper("bytes 1, offset 0, oper /, "
+                "rvalue 0, result foo", &bmd) == 0);
+    FAIL_IF_NOT(DetectByteMathDoMatch(&det_ctx, &bmd, buf, 8, bmd.rvalue, &value,
+                DETECT_BYTEMATH_ENDIAN_BIG) == 0);
+    PASS;
+}
+
+/** \test result used by byte_test and as rvalue of another byte_math */
+static int DetectByteMathTest03(void)
+{
+    uint8_t buf[] = "\x00\x10" "abcd" "\x00\x03";
+    Packet *p = UTHBuildPacket(buf, sizeof(buf) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(byte_math:bytes 2, offset 0, oper +, rvalue 4, result len; "
+                "byte_test:2,=,len,0; sid:1;)") == 0);
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(byte_math:bytes 2, offset 0, oper -, rvalue 10, result len; "
+                "byte_test:2,=,len,0,relative; sid:1;)") == 0);
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(byte_math:bytes 2, offset 0, oper -, rvalue 3, result len; "
+                "byte_math:bytes 2, offset 4, oper +, rvalue len, result len2, "
+                "relative; byte_test:1,=,len2,1; sid:1;)") == 1);
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(content:\"abcd\"; byte_math:bytes 2, offset 0, oper <<, "
+                "rvalue 2, result len, relative; byte_test:1,=,len,1; sid:1;)") == 0);
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(content:\"abcd\"; byte_math:bytes 2, offset 0, oper <<, "
+                "rvalue 2, result len, relative; isdataat:len,relative; sid:1;)") == 0);
+    FAIL_IF_NOT(UTHPacketMatchSig(p, "alert tcp any any -> any any "
+                "(content:\"abcd\"; byte_math:bytes 2, offset 0, oper *, "
+                "rvalue 0x21, result len, relative; byte_test:1,=,len,4; sid:1;)") == 1);
+
+    /* unknown rvalue var */
+    FAIL_IF_NOT(UTHParseSignature("alert tcp any any -> any any "
+                "(byte_math:bytes 2, offset 0, oper +, rvalue nope, result len; "
+                "sid:1;)", false));
+    UTHFreePacket(p);
+    PASS;
+}
+
+static void DetectByteMathRegisterTests(void)
+{
+    UtRegisterTest("DetectByteMathTest01", DetectByteMathTest01);
+    UtRegisterTest("DetectByteMathTest02", DetectByteMathTest02);
+    UtRegisterTest("DetectByteMathTest03", DetectByteMathTest03);
+}
+#endif
@@ -0,0 +1,76 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * byte_math: extract a value and store the result of an arithmetic
+ * operation on it in a variable, like byte_extract does.
+ */
+
+#ifndef __DETECT_BYTEMATH_H__
+#define __DETECT_BYTEMATH_H__
+
+#include "util-byte.h"
+
+/* flags */
+#define DETECT_BYTEMATH_FLAG_RELATIVE   0x01
+#define DETECT_BYTEMATH_FLAG_STRING     0x02
+#define DETECT_BYTEMATH_FLAG_BITMASK    0x04
+#define DETECT_BYTEMATH_FLAG_RVALUE_VAR 0x08
+
+/* operators */
+#define DETECT_BYTEMATH_OPERATOR_PLUS     1
+#define DETECT_BYTEMATH_OPERATOR_MINUS    2
+#define DETECT_BYTEMATH_OPERATOR_DIVIDE   3
+#define DETECT_BYTEMATH_OPERATOR_MULTIPLY 4
+#define DETECT_BYTEMATH_OPERATOR_LSHIFT   5
+#define DETECT_BYTEMATH_OPERATOR_RSHIFT   6
+
+/* endianness, the first two double as index into the extractors */
+#define DETECT_BYTEMATH_ENDIAN_BIG      BYTE_BIG_ENDIAN
+#define DETECT_BYTEMATH_ENDIAN_LITTLE   BYTE_LITTLE_ENDIAN
+#define DETECT_BYTEMATH_ENDIAN_DCE      2
+
+typedef struct DetectByteMathData_ {
+    /* local id used by other keywords in the sig to reference the result */
+    uint8_t local_id;
+
+    uint8_t nbytes;
+    uint8_t oper;
+    uint8_t flags;
+    uint8_t endian;
+    uint8_t base;
+    /* number of trailing zero bits in the bitmask, the masked value is
+     * shifted right by this */
+    uint8_t bitmask_shift_count;
+    int32_t offset;
+    uint32_t bitmask_val;
+    /* rvalue, or the local id of the variable holding it */
+    uint32_t rvalue;
+    const char *result;
+
+    /* extractors indexed by DETECT_BYTEMATH_ENDIAN_BIG/LITTLE */
+    ByteExtractFunc extract[2];
+} DetectByteMathData;
+
+void DetectBytemathRegister(void);
+
+int DetectByteMathDoMatch(DetectEngineThreadCtx *, const DetectByteMathData *,
+        const uint8_t *, const uint32_t, const uint64_t, uint64_t *, const uint8_t);
+
+#endif /* __DETECT_BYTEMATH_H__ */
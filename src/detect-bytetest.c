@@ -149,8 +149,7 @@ int DetectBytetestDoMatch(DetectEngineThreadCtx *det_ctx,
 
     /* Extract the byte data */
     if (flags & DETECT_BYTETEST_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = data->extract[BYTE_BIG_ENDIAN](&val, data->nbytes, ptr);
         if (extbytes <= 0) {
             /* strtoull() return 0 if there is no numeric value in data string */
             if (val == 0) {
@@ -169,7 +168,7 @@ int DetectBytetestDoMatch(DetectEngineThreadCtx *det_ctx,
     else {
         int endianness = (flags & DETECT_BYTETEST_LITTLE) ?
                           BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = data->extract[endianness](&val, data->nbytes, ptr);
         if (extbytes != data->nbytes) {
             SCLogDebug("error extracting %d bytes "
                    "of numeric data: %d", data->nbytes, extbytes);
@@ -416,6 +415,19 @@ static DetectBytetestData *DetectBytetestParse(const char *optstr, char **value,
     /* This is max 23 so it will fit in a byte (see above) */
     data->nbytes = (uint8_t)nbytes;
 
+    if (data->flags & DETECT_BYTETEST_STRING) {
+        data->extract[BYTE_BIG_ENDIAN] = ByteExtractStringGetFunc(data->base);
+        data->extract[BYTE_LITTLE_ENDIAN] = data->extract[BYTE_BIG_ENDIAN];
+    } else {
+        data->extract[BYTE_BIG_ENDIAN] = ByteExtractGetFunc(BYTE_BIG_ENDIAN, nbytes);
+        data->extract[BYTE_LITTLE_ENDIAN] = ByteExtractGetFunc(BYTE_LITTLE_ENDIAN, nbytes);
+    }
+    if (data->extract[BYTE_BIG_ENDIAN] == NULL ||
+            data->extract[BYTE_LITTLE_ENDIAN] == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Invalid number of bytes or base: %s", optstr);
+        goto error;
+    }
+
     for (i = 0; i < (ret - 1); i++){
         if (args[i] != NULL) SCFree(args[i]);
     }
@@ -456,7 +468,7 @@ static int DetectBytetestSetup(DetectEngineCtx *de_ctx, Signature *s, const char
         if (data->flags & DETECT_BYTETEST_RELATIVE) {
             prev_pm = DetectGetLastSMFromLists(s,
                 DETECT_CONTENT, DETECT_PCRE,
-                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                 DETECT_ISDATAAT, -1);
             if (prev_pm == NULL) {
                 sm_list = DETECT_SM_LIST_PMATCH;
@@ -475,7 +487,7 @@ static int DetectBytetestSetup(DetectEngineCtx *de_ctx, Signature *s, const char
     } else if (data->flags & DETECT_BYTETEST_RELATIVE) {
         prev_pm = DetectGetLastSMFromLists(s,
                 DETECT_CONTENT, DETECT_PCRE,
-                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT,
+                DETECT_BYTETEST, DETECT_BYTEJUMP, DETECT_BYTE_EXTRACT, DETECT_BYTEMATH,
                 DETECT_ISDATAAT, -1);
         if (prev_pm == NULL) {
             sm_list = DETECT_SM_LIST_PMATCH;
@@ -503,26 +515,26 @@ static int DetectBytetestSetup(DetectEngineCtx *de_ctx, Signature *s, const char
     }
 
     if (value != NULL) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(value, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(value, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "Unknown byte_extract var "
                        "seen in byte_test - %s\n", value);
             goto error;
         }
-        data->value = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        data->value = local_id;
         data->flags |= DETECT_BYTETEST_VALUE_BE;
         SCFree(value);
         value = NULL;
     }
 
     if (offset != NULL) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(offset, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(offset, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "Unknown byte_extract var "
                        "seen in byte_test - %s\n", offset);
             goto error;
         }
-        data->offset = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        data->offset = local_id;
         data->flags |= DETECT_BYTETEST_OFFSET_BE;
         SCFree(offset);
         offset = NULL;
@@ -24,6 +24,8 @@
 #ifndef __DETECT_BYTETEST_H__
 #define __DETECT_BYTETEST_H__
 
+#include "util-byte.h"
+
 /** Bytetest Operators */
 #define DETECT_BYTETEST_OP_LT     1 /**< "less than" operator */
 #define DETECT_BYTETEST_OP_GT     2 /**< "greater than" operator */
@@ -56,6 +58,9 @@ typedef struct DetectBytetestData_ {
     uint8_t flags;                    /**< Flags (big|little|relative|string) */
     int32_t offset;                   /**< Offset in payload */
     uint64_t value;                   /**< Value to compare against */
+    /** extractors set up by the parser, indexed by BYTE_BIG_ENDIAN and
+     *  BYTE_LITTLE_ENDIAN as dce picks the endianness per packet */
+    ByteExtractFunc extract[2];
 } DetectBytetestData;
 
 /* prototypes */
@@ -0,0 +1,243 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the dataset keyword: match a sticky buffer against a dataset.
+ *
+ *     dataset:isset,<name>[, type <string|md5|sha256>, load <file>];
+ */
+
+#include "suricata-common.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "datasets.h"
+#include "detect-dataset.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+static int DetectDatasetSetup (DetectEngineCtx *, Signature *, const char *);
+static void DetectDatasetFree (void *);
+#ifdef UNITTESTS
+static void DetectDatasetRegisterTests(void);
+#endif
+
+void DetectDatasetRegister (void)
+{
+    sigmatch_table[DETECT_DATASET].name = "dataset";
+    sigmatch_table[DETECT_DATASET].desc = "match sticky buffer against datasets";
+    sigmatch_table[DETECT_DATASET].url = DOC_URL DOC_VERSION "/rules/datasets.html#dataset";
+    sigmatch_table[DETECT_DATASET].Setup = DetectDatasetSetup;
+    sigmatch_table[DETECT_DATASET].Free  = DetectDatasetFree;
+#ifdef UNITTESTS
+    sigmatch_table[DETECT_DATASET].RegisterTests = DetectDatasetRegisterTests;
+#endif
+}
+
+/**
+ *  \brief match the buffer against the dataset
+ *
+ *  \retval 1 match
+ *  \retval 0 no match
+ */
+int DetectDatasetBufferMatch(DetectEngineThreadCtx *det_ctx,
+    const DetectDatasetData *sd,
+    const uint8_t *data, const uint32_t data_len)
+{
+    if (data == NULL || data_len == 0)
+        return 0;
+
+    int r = DatasetLookup(sd->set, data, data_len);
+    switch (sd->cmd) {
+        case DETECT_DATASET_CMD_ISSET:
+            return (r == 1);
+        case DETECT_DATASET_CMD_ISNOTSET:
+            return (r == 0);
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief parse 'isset,name[, type X, load Y]'
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int DetectDatasetParse(const char *str, uint8_t *cmd, char *name,
+        size_t name_size, enum DatasetTypes *type, char *load, size_t load_size)
+{
+    char copy[PATH_MAX + 128];
+    if (strlcpy(copy, str, sizeof(copy)) >= sizeof(copy))
+        return -1;
+
+    int i = 0;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr), i++) {
+        while (isspace((unsigned char)*tok))
+            tok++;
+        size_t len = strlen(tok);
+        while (len > 0 && isspace((unsigned char)tok[len - 1]))
+            tok[--len] = '\0';
+
+        if (i == 0) {
+            if (strcmp(tok, "isset") == 0) {
+                *cmd = DETECT_DATASET_CMD_ISSET;
+            } else if (strcmp(tok, "isnotset") == 0) {
+                *cmd = DETECT_DATASET_CMD_ISNOTSET;
+            } else {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "dataset: unknown "
+                        "command '%s', expected isset or isnotset", tok);
+                return -1;
+            }
+        } else if (i == 1) {
+            if (len == 0 || strlcpy(name, tok, name_size) >= name_size) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "dataset: bad name '%s'", tok);
+                return -1;
+            }
+        } else if (strncmp(tok, "type ", 5) == 0) {
+            *type = DatasetGetTypeFromString(tok + 5);
+            if (*type == DATASET_TYPE_NOTSET) {
+                SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "dataset: bad type '%s'", tok + 5);
+                return -1;
+            }
+        } else if (strncmp(tok, "load ", 5) == 0) {
+            if (strlcpy(load, tok + 5, load_size) >= load_size)
+                return -1;
+        } else {
+            SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "dataset: unknown option '%s'", tok);
+            return -1;
+        }
+    }
+
+    if (i < 2) {
+        SCLogError(SC_ERR_INVALID_RULE_ARGUMENT, "dataset: needs a command and a name");
+        return -1;
+    }
+    return 0;
+}
+
+static int DetectDatasetSetup (DetectEngineCtx *de_ctx, Signature *s, const char *rawstr)
+{
+    uint8_t cmd = 0;
+    char name[DATASET_NAME_MAX_LEN + 1] = "";
+    enum DatasetTypes type = DATASET_TYPE_NOTSET;
+    char load[PATH_MAX] = "";
+
+    int list = s->init_data->list;
+    if (list == DETECT_SM_LIST_NOTSET) {
+        SCLogError(SC_ERR_INVALID_SIGNATURE, "datasets are only supported for sticky buffers");
+        return -1;
+    }
+
+    if (rawstr == NULL ||
+            DetectDatasetParse(rawstr, &cmd, name, sizeof(name), &type,
+                load, sizeof(load)) != 0)
+        return -1;
+
+    Dataset *set;
+    if (strlen(load) > 0) {
+        char *path = DetectLoadCompleteSigPath(de_ctx, load);
+        if (path == NULL)
+            return -1;
+        set = DatasetGet(name, type, path);
+        SCFree(path);
+    } else {
+        set = DatasetGet(name, type, NULL);
+    }
+    if (set == NULL)
+        return -1;
+
+    DetectDatasetData *cd = SCCalloc(1, sizeof(DetectDatasetData));
+    if (unlikely(cd == NULL))
+        return -1;
+    cd->set = set;
+    cd->cmd = cmd;
+
+    SigMatch *sm = SigMatchAlloc();
+    if (sm == NULL) {
+        SCFree(cd);
+        return -1;
+    }
+    sm->type = DETECT_DATASET;
+    sm->ctx = (SigMatchCtx *)cd;
+    SigMatchAppendSMToList(s, sm, list);
+    return 0;
+}
+
+static void DetectDatasetFree (void *ptr)
+{
+    /* the set itself is global and outlives the rules */
+    SCFree(ptr);
+}
+
+#ifdef UNITTESTS
+static int DetectDatasetTest01(void)
+{
+    char filename[] = "/tmp/suricata-dataset-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "bad.example.com\n");
+    fclose(fp);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    char rule[PATH_MAX + 256];
+    snprintf(rule, sizeof(rule), "alert dns any any -> any any (dns_query; "
+            "dataset:isset,detect-dataset-test01, type string, load %s; sid:1;)",
+            filename);
+    Signature *s = DetectEngineAppendSig(de_ctx, rule);
+    unlink(filename);
+    FAIL_IF_NULL(s);
+    /* no sticky buffer */
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dataset:isset,detect-dataset-test01; sid:2;)"));
+    /* unknown set */
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dns_query; dataset:isset,detect-dataset-test01-unknown; sid:3;)"));
+    /* existing set, by name */
+    s = DetectEngineAppendSig(de_ctx, "alert dns any any -> any any "
+            "(dns_query; dataset:isnotset,detect-dataset-test01; sid:4;)");
+    FAIL_IF_NULL(s);
+    SigGroupBuild(de_ctx);
+
+    DetectDatasetData sd = { .set = DatasetGet("detect-dataset-test01", DATASET_TYPE_NOTSET, NULL),
+                             .cmd = DETECT_DATASET_CMD_ISSET };
+    FAIL_IF_NULL(sd.set);
+    FAIL_IF_NOT(DetectDatasetBufferMatch(NULL, &sd, (const uint8_t *)"bad.example.com", 15) == 1);
+    FAIL_IF_NOT(DetectDatasetBufferMatch(NULL, &sd, (const uint8_t *)"ok.example.com", 14) == 0);
+    sd.cmd = DETECT_DATASET_CMD_ISNOTSET;
+    FAIL_IF_NOT(DetectDatasetBufferMatch(NULL, &sd, (const uint8_t *)"bad.example.com", 15) == 0);
+    FAIL_IF_NOT(DetectDatasetBufferMatch(NULL, &sd, (const uint8_t *)"ok.example.com", 14) == 1);
+
+    DetectEngineCtxFree(de_ctx);
+    DatasetsDestroy();
+    PASS;
+}
+
+static void DetectDatasetRegisterTests(void)
+{
+    UtRegisterTest("DetectDatasetTest01", DetectDatasetTest01);
+}
+#endif
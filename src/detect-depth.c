@@ -105,13 +105,13 @@ static int DetectDepthSetup (DetectEngineCtx *de_ctx, Signature *s, const char *
         goto end;
     }
     if (str[0] != '-' && isalpha((unsigned char)str[0])) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(str, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(str, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "unknown byte_extract var "
                        "seen in depth - %s\n", str);
             goto end;
         }
-        cd->depth = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        cd->depth = local_id;
         cd->flags |= DETECT_CONTENT_DEPTH_BE;
     } else {
         if (ByteExtractStringUint16(&cd->depth, 0, 0, str) != (int)strlen(str))
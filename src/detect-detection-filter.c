@@ -400,6 +400,7 @@ static int DetectDetectionFilterTestSig1(void)
     int alerts = 0;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset(&th_v, 0, sizeof(th_v));
 
@@ -448,6 +449,7 @@ static int DetectDetectionFilterTestSig1(void)
 
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -472,6 +474,7 @@ static int DetectDetectionFilterTestSig2(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -526,6 +529,7 @@ static int DetectDetectionFilterTestSig2(void)
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -545,6 +549,7 @@ static int DetectDetectionFilterTestSig3(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -624,6 +629,7 @@ static int DetectDetectionFilterTestSig3(void)
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -104,13 +104,13 @@ static int DetectDistanceSetup (DetectEngineCtx *de_ctx, Signature *s,
         goto end;
     }
     if (str[0] != '-' && isalpha((unsigned char)str[0])) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(str, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(str, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "unknown byte_extract var "
                        "seen in distance - %s\n", str);
             goto end;
         }
-        cd->distance = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        cd->distance = local_id;
         cd->flags |= DETECT_CONTENT_DISTANCE_BE;
     } else {
         if (ByteExtractStringInt32(&cd->distance, 0, 0, str) != (int)strlen(str)) {
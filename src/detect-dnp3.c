@@ -388,6 +388,8 @@ static int DetectDNP3ObjSetup(DetectEngineCtx *de_ctx, Signature *s, const char
         goto fail;
     }
 
+    DNP3EnableObjectDecoding();
+
     detect = SCCalloc(1, sizeof(*detect));
     if (unlikely(detect == NULL)) {
         goto fail;
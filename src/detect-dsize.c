@@ -322,15 +322,11 @@ PrefilterPacketDsizeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void
         SCReturn;
     }
 
-    const PrefilterPacketHeaderCtx *ctx = pectx;
-    if (PrefilterPacketHeaderExtraMatch(ctx, p) == FALSE)
-        return;
-
     const uint16_t dsize = p->payload_len;
-    if (DsizeMatch(dsize, ctx->v1.u8[0], ctx->v1.u16[1], ctx->v1.u16[2]))
-    {
+    const SigsArray *sa = PrefilterPacketU16RangeLookup(pectx, dsize);
+    if (sa->cnt) {
         SCLogDebug("packet matches dsize %u", dsize);
-        PrefilterAddSids(&det_ctx->pmq, ctx->sigs_array, ctx->sigs_cnt);
+        PrefilterAddSids(&det_ctx->pmq, sa->sigs, sa->cnt);
     }
 }
 
@@ -338,27 +334,31 @@ static void
 PrefilterPacketDsizeSet(PrefilterPacketHeaderValue *v, void *smctx)
 {
     const DetectDsizeData *a = smctx;
-    v->u8[0] = a->mode;
+    switch (a->mode) {
+        case DETECTDSIZE_LT:
+            v->u8[0] = PREFILTER_U16RANGE_MODE_LT;
+            break;
+        case DETECTDSIZE_EQ:
+            v->u8[0] = PREFILTER_U16RANGE_MODE_EQ;
+            break;
+        case DETECTDSIZE_GT:
+            v->u8[0] = PREFILTER_U16RANGE_MODE_GT;
+            break;
+        case DETECTDSIZE_RA:
+            v->u8[0] = PREFILTER_U16RANGE_MODE_RA;
+            break;
+    }
     v->u16[1] = a->dsize;
     v->u16[2] = a->dsize2;
 }
 
-static _Bool
-PrefilterPacketDsizeCompare(PrefilterPacketHeaderValue v, void *smctx)
-{
-    const DetectDsizeData *a = smctx;
-    if (v.u8[0] == a->mode &&
-        v.u16[1] == a->dsize &&
-        v.u16[2] == a->dsize2)
-        return TRUE;
-    return FALSE;
-}
-
+/** \internal
+ *  \brief all dsize rules of the group in a single table lookup on
+ *         the payload size */
 static int PrefilterSetupDsize(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 {
-    return PrefilterSetupPacketHeader(de_ctx, sgh, DETECT_DSIZE,
+    return PrefilterSetupPacketHeaderU16Range(de_ctx, sgh, DETECT_DSIZE,
             PrefilterPacketDsizeSet,
-            PrefilterPacketDsizeCompare,
             PrefilterPacketDsizeMatch);
 }
 
@@ -956,6 +956,57 @@ end:
     return result;
 
 }
+
+static _Bool DsizePrefilterTestMatch(const Signature *s, const uint16_t v)
+{
+    const SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_MATCH];
+    while (smd != NULL) {
+        if (smd->type == DETECT_DSIZE) {
+            const DetectDsizeData *dd = (const DetectDsizeData *)smd->ctx;
+            return DsizeMatch(v, dd->mode, dd->dsize, dd->dsize2) == 1;
+        }
+        if (smd->is_last)
+            break;
+        smd++;
+    }
+    return FALSE;
+}
+
+/**
+ * \test the u16 range prefilter table of dsize holds the rules that
+ *       match each payload size, for all modes and their edges
+ */
+static int DsizePrefilterTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    const char *sigs[] = {
+        "alert tcp any any -> any any (dsize:10; prefilter; sid:1;)",
+        "alert tcp any any -> any any (dsize:<10; prefilter; sid:2;)",
+        "alert tcp any any -> any any (dsize:>1000; prefilter; sid:3;)",
+        "alert tcp any any -> any any (dsize:5<>20; prefilter; sid:4;)",
+        "alert tcp any any -> any any (dsize:0; prefilter; sid:5;)",
+        "alert tcp any any -> any any (dsize:<0; prefilter; sid:6;)",
+        "alert tcp any any -> any any (dsize:10<>11; prefilter; sid:7;)",
+        "alert tcp any any -> any any (dsize:>65534; prefilter; sid:8;)",
+        "alert tcp any any -> any any (dsize:10; prefilter; sid:9;)",
+        NULL,
+    };
+    for (int i = 0; sigs[i] != NULL; i++) {
+        FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sigs[i]));
+    }
+    SigGroupBuild(de_ctx);
+
+    const PrefilterPacketU16RangeCtx *ctx =
+        PrefilterPacketHeaderGetCtx(de_ctx, PrefilterPacketDsizeMatch);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(PrefilterPacketU16RangeCheck(de_ctx, ctx, DsizePrefilterTestMatch));
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -986,6 +1037,7 @@ static void DsizeRegisterTests(void)
     UtRegisterTest("DsizeTestParse20", DsizeTestParse20);
 
     UtRegisterTest("DetectDsizeIcmpv6Test01", DetectDsizeIcmpv6Test01);
+    UtRegisterTest("DsizePrefilterTest01", DsizePrefilterTest01);
 #endif /* UNITTESTS */
 }
 
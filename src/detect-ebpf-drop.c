@@ -0,0 +1,247 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the ebpf-drop keyword
+ *
+ * Adds the source or destination of an alert to the drop maps of the
+ * XDP filter, so the next packets of that host are dropped or rate
+ * limited in the driver. Like tag, it runs only for alerts that passed
+ * thresholding, so a threshold on the signature decides what a flood is.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-ebpf-drop.h"
+
+#include "decode.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-ebpf.h"
+#include "util-unittest.h"
+
+/* a source is dropped for a minute by default */
+#define DETECT_EBPF_DROP_TIMEOUT    60
+
+typedef struct DetectEbpfDropData_ {
+    bool dst;           /**< drop the destination instead of the source */
+    uint32_t timeout;   /**< seconds */
+    uint32_t rate;      /**< packets per second let through, 0 for none */
+} DetectEbpfDropData;
+
+static int DetectEbpfDropMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *,
+        const Signature *, const SigMatchCtx *);
+static int DetectEbpfDropSetup(DetectEngineCtx *, Signature *, const char *);
+static void DetectEbpfDropFree(void *);
+static void DetectEbpfDropRegisterTests(void);
+
+/**
+ * \brief Registration function for keyword: ebpf-drop
+ */
+void DetectEbpfDropRegister(void)
+{
+    sigmatch_table[DETECT_EBPF_DROP].name = "ebpf-drop";
+    sigmatch_table[DETECT_EBPF_DROP].desc = "drop or rate limit the packets of the alert's source in the XDP filter";
+    sigmatch_table[DETECT_EBPF_DROP].url = DOC_URL DOC_VERSION "/rules/bypass-keyword.html#ebpf-drop";
+    sigmatch_table[DETECT_EBPF_DROP].Match = DetectEbpfDropMatch;
+    sigmatch_table[DETECT_EBPF_DROP].Setup = DetectEbpfDropSetup;
+    sigmatch_table[DETECT_EBPF_DROP].Free  = DetectEbpfDropFree;
+    sigmatch_table[DETECT_EBPF_DROP].RegisterTests = DetectEbpfDropRegisterTests;
+    sigmatch_table[DETECT_EBPF_DROP].flags |= SIGMATCH_IPONLY_COMPAT;
+}
+
+/**
+ * \brief parse the options: [src|dst][, timeout <sec>][, rate <pps>]
+ *
+ * \retval 0 ok
+ * \retval -1 invalid options
+ */
+static int DetectEbpfDropParse(const char *str, DetectEbpfDropData *ed)
+{
+    ed->dst = false;
+    ed->timeout = DETECT_EBPF_DROP_TIMEOUT;
+    ed->rate = 0;
+
+    if (str == NULL)
+        return 0;
+
+    char copy[128];
+    if (strlcpy(copy, str, sizeof(copy)) >= sizeof(copy))
+        return -1;
+
+    char *saveptr = NULL;
+    for (char *opt = strtok_r(copy, ",", &saveptr); opt != NULL;
+            opt = strtok_r(NULL, ",", &saveptr)) {
+        while (isspace((unsigned char)*opt))
+            opt++;
+        size_t len = strlen(opt);
+        while (len > 0 && isspace((unsigned char)opt[len - 1]))
+            opt[--len] = '\0';
+
+        uint32_t *val = NULL;
+        if (strcmp(opt, "src") == 0) {
+            ed->dst = false;
+        } else if (strcmp(opt, "dst") == 0) {
+            ed->dst = true;
+        } else if (strncmp(opt, "timeout", 7) == 0 && isspace((unsigned char)opt[7])) {
+            val = &ed->timeout;
+            opt += 7;
+        } else if (strncmp(opt, "rate", 4) == 0 && isspace((unsigned char)opt[4])) {
+            val = &ed->rate;
+            opt += 4;
+        } else {
+            SCLogError(SC_ERR_INVALID_VALUE, "ebpf-drop: invalid option '%s'", opt);
+            return -1;
+        }
+        if (val == NULL)
+            continue;
+
+        while (isspace((unsigned char)*opt))
+            opt++;
+        if (*opt == '\0' || strspn(opt, "0123456789") != strlen(opt) ||
+                ByteExtractStringUint32(val, 10, strlen(opt), opt) <= 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "ebpf-drop: invalid value '%s'", opt);
+            return -1;
+        }
+    }
+
+    if (ed->timeout == 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "ebpf-drop: timeout can't be 0");
+        return -1;
+    }
+    return 0;
+}
+
+static int DetectEbpfDropSetup(DetectEngineCtx *de_ctx, Signature *s, const char *str)
+{
+#ifndef HAVE_PACKET_XDP
+    if (!RunmodeIsUnittests()) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "ebpf-drop needs XDP support, "
+                   "which is not built in");
+        return -1;
+    }
+#endif
+    DetectEbpfDropData *ed = SCCalloc(1, sizeof(*ed));
+    if (unlikely(ed == NULL))
+        return -1;
+    if (DetectEbpfDropParse(str, ed) < 0) {
+        SCFree(ed);
+        return -1;
+    }
+
+    SigMatch *sm = SigMatchAlloc();
+    if (sm == NULL) {
+        SCFree(ed);
+        return -1;
+    }
+    sm->type = DETECT_EBPF_DROP;
+    sm->ctx = (SigMatchCtx *)ed;
+
+    /* run with the tags, only for the alerts that passed thresholding */
+    SigMatchAppendSMToList(s, sm, DETECT_SM_LIST_TMATCH);
+    return 0;
+}
+
+static int DetectEbpfDropMatch(ThreadVars *tv, DetectEngineThreadCtx *det_ctx, Packet *p,
+        const Signature *s, const SigMatchCtx *ctx)
+{
+#ifdef HAVE_PACKET_XDP
+    const DetectEbpfDropData *ed = (const DetectEbpfDropData *)ctx;
+
+    if (p->livedev == NULL || !(PKT_IS_IPV4(p) || PKT_IS_IPV6(p)))
+        return 1;
+
+    const Address *addr = ed->dst ? &p->dst : &p->src;
+    if (EBPFDropAddress(p->livedev->dev, addr, ed->timeout, ed->rate)) {
+        SCLogDebug("sid %"PRIu32": source added to the XDP drop map", s->id);
+    }
+#endif
+    return 1;
+}
+
+static void DetectEbpfDropFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
+#ifdef UNITTESTS
+static int DetectEbpfDropTestParse01(void)
+{
+    DetectEbpfDropData ed;
+
+    FAIL_IF_NOT(DetectEbpfDropParse(NULL, &ed) == 0);
+    FAIL_IF(ed.dst);
+    FAIL_IF_NOT(ed.timeout == DETECT_EBPF_DROP_TIMEOUT);
+    FAIL_IF_NOT(ed.rate == 0);
+
+    FAIL_IF_NOT(DetectEbpfDropParse(" dst , timeout 300, rate 100 ", &ed) == 0);
+    FAIL_IF_NOT(ed.dst);
+    FAIL_IF_NOT(ed.timeout == 300);
+    FAIL_IF_NOT(ed.rate == 100);
+
+    FAIL_IF_NOT(DetectEbpfDropParse("rate 10", &ed) == 0);
+    FAIL_IF(ed.dst);
+    FAIL_IF_NOT(ed.timeout == DETECT_EBPF_DROP_TIMEOUT);
+    FAIL_IF_NOT(ed.rate == 10);
+    PASS;
+}
+
+static int DetectEbpfDropTestParse02(void)
+{
+    DetectEbpfDropData ed;
+
+    FAIL_IF_NOT(DetectEbpfDropParse("both", &ed) < 0);
+    FAIL_IF_NOT(DetectEbpfDropParse("timeout", &ed) < 0);
+    FAIL_IF_NOT(DetectEbpfDropParse("timeout 0", &ed) < 0);
+    FAIL_IF_NOT(DetectEbpfDropParse("timeout -1", &ed) < 0);
+    FAIL_IF_NOT(DetectEbpfDropParse("rate 1x", &ed) < 0);
+    FAIL_IF_NOT(DetectEbpfDropParse("timeout60", &ed) < 0);
+    PASS;
+}
+
+static int DetectEbpfDropTestSig01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert udp any any -> any any "
+            "(threshold: type threshold, track by_src, count 1000, seconds 1; "
+            "ebpf-drop: src, timeout 120; sid:1;)");
+    FAIL_IF_NULL(s);
+    FAIL_IF_NULL(s->init_data->smlists[DETECT_SM_LIST_TMATCH]);
+    FAIL_IF_NOT(s->init_data->smlists[DETECT_SM_LIST_TMATCH]->type == DETECT_EBPF_DROP);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void DetectEbpfDropRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectEbpfDropTestParse01", DetectEbpfDropTestParse01);
+    UtRegisterTest("DetectEbpfDropTestParse02", DetectEbpfDropTestParse02);
+    UtRegisterTest("DetectEbpfDropTestSig01", DetectEbpfDropTestSig01);
+#endif
+}
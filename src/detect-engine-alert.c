@@ -28,6 +28,10 @@
 #include "flow-private.h"
 
 #include "util-profiling.h"
+#include "util-trace.h"
+
+/** max number of alerts queued per packet, the queue size is a uint16_t */
+#define ALERT_QUEUE_MAX UINT16_MAX
 
 /** tag signature we use for tag alerts */
 static Signature g_tag_signature;
@@ -168,7 +172,7 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
         return 0;
     }
 
-    for (i = pos; i <= p->alerts.cnt - 1; i++) {
+    for (i = pos; i + 1 < p->alerts.cnt; i++) {
         memcpy(&p->alerts.alerts[i], &p->alerts.alerts[i + 1], sizeof(PacketAlert));
     }
 
@@ -178,7 +182,30 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
     return match;
 }
 
-/** \brief append a signature match to a packet
+/** \internal
+ *  \brief grow the thread's alert queue
+ *  \retval 0 ok, -1 if the queue is at its max or the alloc failed */
+static int AlertQueueExpand(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->alert_queue_capacity == ALERT_QUEUE_MAX)
+        return -1;
+
+    uint32_t capacity = det_ctx->alert_queue_capacity ?
+        (uint32_t)det_ctx->alert_queue_capacity * 2 : PACKET_ALERT_MAX + 1;
+    if (capacity > ALERT_QUEUE_MAX)
+        capacity = ALERT_QUEUE_MAX;
+    PacketAlert *queue = SCRealloc(det_ctx->alert_queue, capacity * sizeof(PacketAlert));
+    if (unlikely(queue == NULL))
+        return -1;
+    det_ctx->alert_queue = queue;
+    det_ctx->alert_queue_capacity = (uint16_t)capacity;
+    return 0;
+}
+
+/** \brief append a signature match to the alerts of the packet
+ *
+ *  The alerts are queued in the thread ctx in order of Signature::num,
+ *  PacketAlertFinalize() moves them to the packet.
  *
  *  \param det_ctx thread detection engine ctx
  *  \param s the signature that matched
@@ -188,41 +215,31 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
 int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, const Signature *s,
         Packet *p, uint64_t tx_id, uint8_t flags)
 {
-    int i = 0;
-
-    if (p->alerts.cnt == PACKET_ALERT_MAX)
+    if (det_ctx->alert_queue_size == det_ctx->alert_queue_capacity &&
+            AlertQueueExpand(det_ctx) < 0) {
+        p->alerts.discarded++;
         return 0;
+    }
 
     SCLogDebug("sid %"PRIu32"", s->id);
+    SCTrace2(rule_match, p, s->id);
 
     /* It should be usually the last, so check it before iterating */
-    if (p->alerts.cnt == 0 || (p->alerts.cnt > 0 &&
-                               p->alerts.alerts[p->alerts.cnt - 1].num < s->num)) {
-        /* We just add it */
-        p->alerts.alerts[p->alerts.cnt].num = s->num;
-        p->alerts.alerts[p->alerts.cnt].action = s->action;
-        p->alerts.alerts[p->alerts.cnt].flags = flags;
-        p->alerts.alerts[p->alerts.cnt].s = s;
-        p->alerts.alerts[p->alerts.cnt].tx_id = tx_id;
-    } else {
-        /* We need to make room for this s->num
-         (a bit ugly with memcpy but we are planning changes here)*/
-        for (i = p->alerts.cnt - 1; i >= 0 && p->alerts.alerts[i].num > s->num; i--) {
-            memcpy(&p->alerts.alerts[i + 1], &p->alerts.alerts[i], sizeof(PacketAlert));
-        }
-
-        i++; /* The right place to store the alert */
-
-        p->alerts.alerts[i].num = s->num;
-        p->alerts.alerts[i].action = s->action;
-        p->alerts.alerts[i].flags = flags;
-        p->alerts.alerts[i].s = s;
-        p->alerts.alerts[i].tx_id = tx_id;
+    uint16_t i = det_ctx->alert_queue_size;
+    if (i > 0 && det_ctx->alert_queue[i - 1].num > s->num) {
+        while (i > 0 && det_ctx->alert_queue[i - 1].num > s->num)
+            i--;
+        memmove(&det_ctx->alert_queue[i + 1], &det_ctx->alert_queue[i],
+                (det_ctx->alert_queue_size - i) * sizeof(PacketAlert));
     }
 
-    /* Update the count */
-    p->alerts.cnt++;
-
+    PacketAlert *pa = &det_ctx->alert_queue[i];
+    pa->num = s->num;
+    pa->action = s->action;
+    pa->flags = flags;
+    pa->s = s;
+    pa->tx_id = tx_id;
+    det_ctx->alert_queue_size++;
     return 0;
 }
 
@@ -238,13 +255,13 @@ int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, const Signature *s,
 void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx, Packet *p)
 {
     SCEnter();
-    int i = 0;
 
-    while (i < p->alerts.cnt) {
-        SCLogDebug("Sig->num: %"PRIu16, p->alerts.alerts[i].num);
-        const Signature *s = de_ctx->sig_array[p->alerts.alerts[i].num];
+    for (uint16_t i = 0; i < det_ctx->alert_queue_size; i++) {
+        PacketAlert *pa = &det_ctx->alert_queue[i];
+        SCLogDebug("Sig->num: %"PRIu32, pa->num);
+        const Signature *s = de_ctx->sig_array[pa->num];
 
-        int res = PacketAlertHandle(de_ctx, det_ctx, s, p, &p->alerts.alerts[i]);
+        int res = PacketAlertHandle(de_ctx, det_ctx, s, p, pa);
         if (res > 0) {
             /* Now, if we have an alert, we have to check if we want
              * to tag this session or src/dst host */
@@ -287,18 +304,13 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
             }
 
             /* set actions on packet */
-            DetectSignatureApplyActions(p, p->alerts.alerts[i].s, p->alerts.alerts[i].flags);
-
-            if (PACKET_TEST_ACTION(p, ACTION_PASS)) {
-                /* Ok, reset the alert cnt to end in the previous of pass
-                 * so we ignore the rest with less prio */
-                p->alerts.cnt = i;
-                break;
+            DetectSignatureApplyActions(p, pa->s, pa->flags);
 
             /* if the signature wants to drop, check if the
              * PACKET_ALERT_FLAG_DROP_FLOW flag is set. */
-            } else if ((PACKET_TEST_ACTION(p, ACTION_DROP)) &&
-                    ((p->alerts.alerts[i].flags & PACKET_ALERT_FLAG_DROP_FLOW) ||
+            if (!PACKET_TEST_ACTION(p, ACTION_PASS) &&
+                    (PACKET_TEST_ACTION(p, ACTION_DROP)) &&
+                    ((pa->flags & PACKET_ALERT_FLAG_DROP_FLOW) ||
                          (s->flags & SIG_FLAG_APPLAYER))
                        && p->flow != NULL)
             {
@@ -307,16 +319,24 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
             }
         }
 
-        /* Thresholding removes this alert */
+        /* Thresholding removes this alert, a pass action the rest of the
+         * alerts as they have less priority. */
         if (res == 0 || res == 2) {
-            PacketAlertRemove(p, i);
+            continue;
+        } else if (PACKET_TEST_ACTION(p, ACTION_PASS)) {
+            break;
+        }
 
-            if (p->alerts.cnt == 0)
-                break;
+        /* Moving the alert to the packet. The queue is in the order of
+         * priority, so when it is full the ones left out are those
+         * with the least priority. */
+        if (p->alerts.cnt < PACKET_ALERT_MAX) {
+            p->alerts.alerts[p->alerts.cnt++] = *pa;
         } else {
-            i++;
+            p->alerts.discarded++;
         }
     }
+    det_ctx->alert_queue_size = 0;
 
     /* At this point, we should have all the new alerts. Now check the tag
      * keyword context for sessions and hosts */
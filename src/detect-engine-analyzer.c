@@ -31,6 +31,7 @@
 #include "detect-engine.h"
 #include "detect-engine-analyzer.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
 #include "conf.h"
 #include "detect-content.h"
 #include "detect-flow.h"
@@ -335,6 +336,188 @@ void CleanupFPAnalyzer(void)
 }
 
 
+/**
+ * \brief Print the IP-only engine summary to the rules analysis
+ */
+void EngineAnalysisIPOnly(const DetectEngineCtx *de_ctx)
+{
+    const DetectEngineIPOnlyCtx *io_ctx = &de_ctx->io_ctx;
+
+    if (rule_engine_analysis_FD == NULL || rule_warnings_only)
+        return;
+
+    fprintf(rule_engine_analysis_FD, "== IP-only rules ==\n");
+    fprintf(rule_engine_analysis_FD, "    Rules: %"PRIu32"\n", io_ctx->sig_cnt);
+    if (io_ctx->sig_cnt == 0) {
+        fprintf(rule_engine_analysis_FD, "\n");
+        return;
+    }
+    fprintf(rule_engine_analysis_FD, "    Unique address prefixes: %"PRIu32"\n",
+            io_ctx->prefix_cnt);
+    fprintf(rule_engine_analysis_FD, "    Memory for the sig lists: %"PRIu64" bytes\n",
+            io_ctx->sna_memuse);
+    fprintf(rule_engine_analysis_FD, "    Memory for the IPv4 lookup tables: %"PRIu64" bytes\n",
+            io_ctx->lpm_memuse);
+    fprintf(rule_engine_analysis_FD, "    Average memory per rule: %"PRIu64" bytes\n",
+            (io_ctx->sna_memuse + io_ctx->lpm_memuse) / io_ctx->sig_cnt);
+    if (io_ctx->lpm_ipv4src.tbl16 == NULL || io_ctx->lpm_ipv4dst.tbl16 == NULL) {
+        fprintf(rule_engine_analysis_FD, "    Warning: IPv4 lookup table too large, "
+                "using the slower radix tree lookup.\n");
+    }
+    fprintf(rule_engine_analysis_FD, "\n");
+}
+
+/** \internal
+ *  \brief print the prefilter engines of a list, like "2 (payload, stream)"
+ */
+static void EngineAnalysisPrefilterEngines(const DetectEngineCtx *de_ctx,
+        const char *name, const PrefilterEngine *engines, uint32_t *cnt)
+{
+    uint32_t n = 0;
+    char names[512] = "";
+
+    for (const PrefilterEngine *e = engines; e != NULL; e++) {
+        const char *ename = PrefilterStoreGetNameById(de_ctx, e->gid);
+        if (n > 0)
+            strlcat(names, ", ", sizeof(names));
+        strlcat(names, ename ? ename : "unknown", sizeof(names));
+        n++;
+        if (e->is_last)
+            break;
+    }
+    if (n > 0) {
+        fprintf(rule_engine_analysis_FD, "    Prefilter %s engines: %"PRIu32" (%s)\n",
+                name, n, names);
+    }
+    *cnt += n;
+}
+
+/** \internal
+ *  \brief print a mpm store of a rule group
+ */
+static void EngineAnalysisMpmStore(const DetectEngineCtx *de_ctx,
+        const MpmStore *ms, uint64_t *memory)
+{
+    if (ms == NULL || ms->mpm_ctx == NULL)
+        return;
+
+    char name[128];
+    MpmStoreGetName(de_ctx, ms, name, sizeof(name));
+
+    const MpmCtx *mpm_ctx = ms->mpm_ctx;
+    if (ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
+        fprintf(rule_engine_analysis_FD, "    MPM \"%s\": %"PRIu32" patterns, "
+                "shared context\n", name, mpm_ctx->pattern_cnt);
+        return;
+    }
+    fprintf(rule_engine_analysis_FD, "    MPM \"%s\": %"PRIu32" patterns, "
+            "%"PRIu32" bytes, prepared in %"PRIu64" usecs, used by %"PRIu32" group(s)\n",
+            name, mpm_ctx->pattern_cnt, mpm_ctx->memory_size, ms->prepare_usecs,
+            ms->sgh_cnt);
+    /* the memory of a store used by several groups is divided over them */
+    *memory += mpm_ctx->memory_size / (ms->sgh_cnt ? ms->sgh_cnt : 1);
+}
+
+/**
+ * \brief Print the rule groups and mpm stores summary to the rules analysis
+ *
+ * Per rule group: the build time, the mpm stores with their pattern counts,
+ * memory and prepare time, the prefilter engines and an estimate of the
+ * per packet cost: the number of prefilter engines and of rules that are
+ * inspected for every packet because they have no prefilter.
+ *
+ * Needs the rule group init data, so it's called before that is freed.
+ */
+void EngineAnalysisRuleGroups(const DetectEngineCtx *de_ctx)
+{
+    if (rule_engine_analysis_FD == NULL || rule_warnings_only)
+        return;
+
+    uint32_t groups = 0;
+    uint64_t build_usecs = 0;
+    for (uint32_t idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[idx];
+        if (sgh == NULL || sgh->init == NULL)
+            continue;
+        groups++;
+        build_usecs += sgh->init->build_usecs;
+    }
+
+    fprintf(rule_engine_analysis_FD, "== Rule groups ==\n");
+    fprintf(rule_engine_analysis_FD, "    Rule groups: %"PRIu32", built in %"PRIu64" usecs\n\n",
+            groups, build_usecs);
+
+    for (uint32_t idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[idx];
+        if (sgh == NULL || sgh->init == NULL)
+            continue;
+
+        const char *dir = "both directions";
+        if (sgh->init->direction == SIG_FLAG_TOSERVER)
+            dir = "toserver";
+        else if (sgh->init->direction == SIG_FLAG_TOCLIENT)
+            dir = "toclient";
+        const char *proto = "other IP";
+        if (sgh->init->protos[IPPROTO_TCP])
+            proto = "TCP";
+        else if (sgh->init->protos[IPPROTO_UDP])
+            proto = "UDP";
+
+        fprintf(rule_engine_analysis_FD, "Rule group %"PRIu32": %s %s, %"PRIu32
+                " rules, built in %"PRIu64" usecs\n", sgh->id, proto, dir,
+                (uint32_t)sgh->sig_cnt, sgh->init->build_usecs);
+
+        uint64_t memory = 0;
+        for (int i = 0; i < MPMB_MAX; i++) {
+            EngineAnalysisMpmStore(de_ctx, sgh->init->mpm_store[i], &memory);
+        }
+        if (sgh->init->app_mpms != NULL) {
+            for (const DetectMpmAppLayerKeyword *am = de_ctx->app_mpms;
+                    am->reg != NULL; am++) {
+                EngineAnalysisMpmStore(de_ctx, sgh->init->app_mpms[am->reg->id],
+                        &memory);
+            }
+        }
+        fprintf(rule_engine_analysis_FD, "    MPM memory: %"PRIu64" bytes\n", memory);
+
+        uint32_t engines = 0;
+        EngineAnalysisPrefilterEngines(de_ctx, "packet", sgh->pkt_engines, &engines);
+        EngineAnalysisPrefilterEngines(de_ctx, "payload", sgh->payload_engines, &engines);
+        EngineAnalysisPrefilterEngines(de_ctx, "tx", sgh->tx_engines, &engines);
+
+        fprintf(rule_engine_analysis_FD, "    Estimated per packet cost: %"PRIu32
+                " prefilter engines, %"PRIu32" rules without prefilter "
+                "(%"PRIu32" on SYN packets)\n\n", engines,
+                sgh->non_pf_other_store_cnt, sgh->non_pf_syn_store_cnt);
+    }
+
+    fprintf(rule_engine_analysis_FD, "== MPM stores ==\n");
+    uint32_t stores = 0;
+    uint64_t memory = 0;
+    uint64_t prepare_usecs = 0;
+    for (HashListTableBucket *htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL ||
+                ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+            continue;
+
+        char name[128];
+        MpmStoreGetName(de_ctx, ms, name, sizeof(name));
+        fprintf(rule_engine_analysis_FD, "    \"%s\": %"PRIu32" patterns (length "
+                "%"PRIu16"-%"PRIu16"), %"PRIu32" bytes, prepared in %"PRIu64
+                " usecs, used by %"PRIu32" group(s)\n", name,
+                ms->mpm_ctx->pattern_cnt, ms->mpm_ctx->minlen, ms->mpm_ctx->maxlen,
+                ms->mpm_ctx->memory_size, ms->prepare_usecs, ms->sgh_cnt);
+        stores++;
+        memory += ms->mpm_ctx->memory_size;
+        prepare_usecs += ms->prepare_usecs;
+    }
+    fprintf(rule_engine_analysis_FD, "    Unique MPM stores: %"PRIu32", %"PRIu64
+            " bytes, prepared in %"PRIu64" usecs\n\n", stores, memory, prepare_usecs);
+}
+
 void CleanupRuleAnalyzer(void)
 {
     if (rule_engine_analysis_FD != NULL) {
@@ -677,6 +860,9 @@ void EngineAnalysisRules2(const DetectEngineCtx *de_ctx, const Signature *s)
         if (s->flags & SIG_FLAG_IPONLY) {
             json_array_append_new(js_flags, json_string("ip_only"));
         }
+        if (s->flags & SIG_FLAG_HTTP2) {
+            json_array_append_new(js_flags, json_string("http2"));
+        }
         if (s->flags & SIG_FLAG_REQUIRE_PACKET) {
             json_array_append_new(js_flags, json_string("need_packet"));
         }
@@ -719,6 +905,9 @@ void EngineAnalysisRules2(const DetectEngineCtx *de_ctx, const Signature *s)
         if (s->flags & SIG_FLAG_DEST_IS_TARGET) {
             json_array_append_new(js_flags, json_string("dst_is_target"));
         }
+        if (s->flags & SIG_FLAG_ENCRYPTED) {
+            json_array_append_new(js_flags, json_string("encrypted"));
+        }
         json_object_set_new(ctx.js, "flags", js_flags);
     }
 
@@ -31,6 +31,8 @@ void CleanupFPAnalyzer(void);
 
 int SetupRuleAnalyzer(void);
 void CleanupRuleAnalyzer (void);
+void EngineAnalysisIPOnly(const DetectEngineCtx *de_ctx);
+void EngineAnalysisRuleGroups(const DetectEngineCtx *de_ctx);
 
 int PerCentEncodingSetup (void);
 int PerCentEncodingMatch (uint8_t *content, uint8_t content_len);
@@ -28,6 +28,7 @@
 #include "detect-engine-port.h"
 #include "detect-engine-prefilter.h"
 #include "detect-engine-proto.h"
+#include "detect-engine-rule-sample.h"
 
 #include "detect-dsize.h"
 #include "detect-flags.h"
@@ -1710,6 +1711,11 @@ int SigAddressCleanupStage1(DetectEngineCtx *de_ctx)
         de_ctx->flow_gh[f].tcp = NULL;
         DetectPortCleanupList(de_ctx, de_ctx->flow_gh[f].udp);
         de_ctx->flow_gh[f].udp = NULL;
+
+        DetectPortLookupTableFree(de_ctx->flow_gh[f].tcp_ports);
+        de_ctx->flow_gh[f].tcp_ports = NULL;
+        DetectPortLookupTableFree(de_ctx->flow_gh[f].udp_ports);
+        de_ctx->flow_gh[f].udp_ports = NULL;
     }
 
     uint32_t idx;
@@ -1766,6 +1772,8 @@ static void DbgPrintSigs2(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 }
 #endif
 
+extern int rule_engine_analysis_set;
+
 /** \brief finalize preparing sgh's */
 int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
 {
@@ -1786,22 +1794,41 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
         SigGroupHeadSetFileHashFlag(de_ctx, sgh);
         SigGroupHeadSetFilesizeFlag(de_ctx, sgh);
         SigGroupHeadSetFilestoreCount(de_ctx, sgh);
+        SigGroupHeadSetEncryptedFlag(de_ctx, sgh);
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
 
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+
         PrefilterSetupRuleGroup(de_ctx, sgh);
 
         SigGroupHeadBuildNonPrefilterArray(de_ctx, sgh);
 
-        SigGroupHeadInitDataFree(sgh->init);
-        sgh->init = NULL;
+        gettimeofday(&end, NULL);
+        sgh->init->build_usecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_usec - start.tv_usec);
 
         sgh->id = idx;
         cnt++;
     }
     SCLogPerf("Unique rule groups: %u", cnt);
 
+    /* port lookup tables for the per packet rule group lookup. Without
+     * them the lists are walked. */
+    for (int f = 0; f < FLOW_STATES; f++) {
+        de_ctx->flow_gh[f].tcp_ports = DetectPortLookupTableBuild(de_ctx->flow_gh[f].tcp);
+        de_ctx->flow_gh[f].udp_ports = DetectPortLookupTableBuild(de_ctx->flow_gh[f].udp);
+    }
+
+    if (MpmStorePrepareAll(de_ctx) != 0) {
+        SCReturnInt(-1);
+    }
     MpmStoreReportStats(de_ctx);
 
+    if (rule_engine_analysis_set) {
+        EngineAnalysisRuleGroups(de_ctx);
+    }
+
     if (de_ctx->decoder_event_sgh != NULL) {
         /* no need to set filestore count here as that would make a
          * signature not decode event only. */
@@ -1823,13 +1850,22 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
         RulesDumpGrouping(de_ctx, add_rules, add_mpm_stats);
     }
 
+    /* the init data is kept until here for the analysis and the
+     * grouping dump */
+    for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
+        SigGroupHead *sgh = de_ctx->sgh_array[idx];
+        if (sgh == NULL)
+            continue;
+        SigGroupHeadInitDataFree(sgh->init);
+        sgh->init = NULL;
+    }
+
 #ifdef PROFILING
     SCProfilingSghInitCounters(de_ctx);
 #endif
     SCReturnInt(0);
 }
 
-extern int rule_engine_analysis_set;
 /** \internal
  *  \brief perform final per signature setup tasks
  *
@@ -1952,6 +1988,8 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
     SCProfilingRuleInitCounters(de_ctx);
 #endif
+    DetectRuleSampleSetup(de_ctx);
+
     SCFree(de_ctx->app_mpms);
     de_ctx->app_mpms = NULL;
 
@@ -37,11 +37,13 @@
 #include "detect-bytetest.h"
 #include "detect-bytejump.h"
 #include "detect-byte-extract.h"
+#include "detect-bytemath.h"
 #include "detect-replace.h"
 #include "detect-engine-content-inspection.h"
 #include "detect-uricontent.h"
 #include "detect-urilen.h"
 #include "detect-bsize.h"
+#include "detect-dataset.h"
 #include "detect-lua.h"
 #include "detect-base64-decode.h"
 #include "detect-base64-data.h"
@@ -60,6 +62,256 @@
 #include "util-lua.h"
 #endif
 
+/** content flags the fast paths don't handle */
+#define DETECT_CI_FAST_CONTENT_UNSUPPORTED_FLAGS                            \
+    (DETECT_CONTENT_NEGATED|DETECT_CONTENT_REPLACE|                         \
+     DETECT_CONTENT_OFFSET_BE|DETECT_CONTENT_DEPTH_BE|                      \
+     DETECT_CONTENT_DISTANCE_BE|DETECT_CONTENT_WITHIN_BE)
+
+/**
+ *  \brief pick the content inspection fast path for a SigMatchData list
+ *
+ *  Lists made up only of contents without negation, replace or
+ *  byte_extract'd modifiers are inspected by a specialized, non
+ *  recursive, version of DetectEngineContentInspection.
+ *
+ *  \param smd list to set up, result is stored in smd[0].ci_fast
+ */
+void DetectEngineContentInspectionSetup(SigMatchData *smd)
+{
+    if (smd == NULL)
+        return;
+
+    smd->ci_fast = DETECT_CI_FAST_NONE;
+
+    int cnt = 0;
+    const SigMatchData *e = smd;
+    while (1) {
+        if (e->type != DETECT_CONTENT)
+            return;
+        const DetectContentData *cd = (const DetectContentData *)e->ctx;
+        if (cd->flags & DETECT_CI_FAST_CONTENT_UNSUPPORTED_FLAGS)
+            return;
+        if (++cnt > DETECT_CI_FAST_CHAIN_MAX)
+            return;
+        if (e->is_last)
+            break;
+        e++;
+    }
+
+    smd->ci_fast = (cnt == 1) ? DETECT_CI_FAST_SINGLE : DETECT_CI_FAST_CHAIN;
+}
+
+/**
+ *  \internal
+ *  \brief scan for a content in buffer + offset
+ *
+ *  Nocase content is searched in the lowercase copy of the buffer if
+ *  the inspect engine set one up for this buffer.
+ */
+static inline uint8_t *ContentInspectScan(DetectEngineThreadCtx *det_ctx,
+        const DetectContentData *cd, const uint8_t *buffer,
+        uint32_t offset, uint32_t len)
+{
+    if ((cd->flags & DETECT_CONTENT_NOCASE) && det_ctx->inspect_lc != NULL &&
+            det_ctx->inspect_lc_orig == buffer)
+    {
+        const uint8_t *found = SpmScanLowercase(cd->spm_ctx,
+                det_ctx->spm_thread_ctx, det_ctx->inspect_lc + offset, len);
+        if (found == NULL)
+            return NULL;
+        return (uint8_t *)buffer + (found - det_ctx->inspect_lc);
+    }
+    return SpmScan(cd->spm_ctx, det_ctx->spm_thread_ctx, buffer + offset, len);
+}
+
+/**
+ *  \internal
+ *  \brief search a content for the fast paths
+ *
+ *  Offset and depth logic of DetectEngineContentInspection for contents
+ *  without byte_extract'd modifiers in a buffer that is not inspected
+ *  in chunks.
+ *
+ *  \param prev_buffer_offset offset of the previous match for relative
+ *                            contents
+ *  \param prev_offset start of the search when looking for another
+ *                     occurence, or 0
+ *  \param match_offset set to the end of the match
+ *
+ *  \retval 1 found
+ *  \retval 0 not found
+ *  \retval -1 nothing to search, the content can't fit
+ */
+static inline int ContentInspectFastSearch(DetectEngineThreadCtx *det_ctx,
+        const DetectContentData *cd, const uint8_t *buffer, uint32_t buffer_len,
+        uint32_t prev_buffer_offset, uint32_t prev_offset, uint32_t *match_offset)
+{
+    uint32_t offset;
+    uint32_t depth = buffer_len;
+
+    if (cd->flags & (DETECT_CONTENT_DISTANCE|DETECT_CONTENT_WITHIN)) {
+        offset = prev_buffer_offset;
+
+        int distance = cd->distance;
+        if (cd->flags & DETECT_CONTENT_DISTANCE) {
+            if (distance < 0 && (uint32_t)(abs(distance)) > offset)
+                offset = 0;
+            else
+                offset += distance;
+        }
+        if (cd->flags & DETECT_CONTENT_WITHIN) {
+            if ((int32_t)depth > (int32_t)(prev_buffer_offset + cd->within + distance)) {
+                depth = prev_buffer_offset + cd->within + distance;
+            }
+        }
+        if (cd->depth != 0 && (cd->depth + prev_buffer_offset) < depth) {
+            depth = prev_buffer_offset + cd->depth;
+        }
+        if (cd->offset > offset) {
+            offset = cd->offset;
+        }
+    } else {
+        if (cd->depth != 0) {
+            depth = cd->depth;
+        }
+        offset = cd->offset;
+    }
+
+    if (prev_offset != 0)
+        offset = prev_offset;
+    if (depth > buffer_len)
+        depth = buffer_len;
+
+    if (offset > depth || depth == 0)
+        return -1;
+
+    const uint32_t sbuffer_len = depth - offset;
+    if (cd->flags & DETECT_CONTENT_ENDS_WITH && depth < buffer_len)
+        return 0;
+    if (cd->content_len > sbuffer_len)
+        return 0;
+
+    const uint8_t *found = ContentInspectScan(det_ctx, cd, buffer,
+            offset, sbuffer_len);
+    if (found == NULL)
+        return 0;
+
+    *match_offset = (uint32_t)((found - buffer) + cd->content_len);
+    return 1;
+}
+
+/**
+ *  \internal
+ *  \brief DETECT_CI_FAST_SINGLE: inspect a list holding a single content
+ */
+static int ContentInspectFastSingle(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx, const SigMatchData *smd,
+        const uint8_t *buffer, uint32_t buffer_len)
+{
+    const DetectContentData *cd = (const DetectContentData *)smd->ctx;
+
+    det_ctx->inspection_recursion_counter++;
+    if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
+        det_ctx->discontinue_matching = 1;
+        return 0;
+    }
+    if (buffer_len == 0)
+        return 0;
+
+    const uint32_t prev_buffer_offset = det_ctx->buffer_offset;
+    uint32_t prev_offset = 0;
+    uint32_t match_offset = 0;
+    while (1) {
+        int r = ContentInspectFastSearch(det_ctx, cd, buffer, buffer_len,
+                prev_buffer_offset, prev_offset, &match_offset);
+        if (r != 1) {
+            if (r == 0 && (cd->flags & (DETECT_CONTENT_DISTANCE|DETECT_CONTENT_WITHIN)) == 0)
+                det_ctx->discontinue_matching = 1;
+            return 0;
+        }
+        det_ctx->buffer_offset = match_offset;
+        if ((cd->flags & DETECT_CONTENT_ENDS_WITH) == 0 || match_offset == buffer_len)
+            return 1;
+        prev_offset = match_offset - (cd->content_len - 1);
+    }
+}
+
+/**
+ *  \internal
+ *  \brief DETECT_CI_FAST_CHAIN: inspect a list of contents
+ *
+ *  Iterative version of the recursive content matching in
+ *  DetectEngineContentInspection. Per content the state of the
+ *  recursion is kept in a small stack, so that when a content further
+ *  down the list fails, the next occurence of a content it depends on
+ *  can be searched for.
+ */
+static int ContentInspectFastChain(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx, const SigMatchData *smd,
+        const uint8_t *buffer, uint32_t buffer_len)
+{
+    uint32_t prev_buffer_offset[DETECT_CI_FAST_CHAIN_MAX];
+    uint32_t prev_offset[DETECT_CI_FAST_CHAIN_MAX];
+    uint32_t match_offset[DETECT_CI_FAST_CHAIN_MAX];
+    const DetectContentData *cd;
+    int level = 0;
+    int r;
+
+enter:
+    det_ctx->inspection_recursion_counter++;
+    if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
+        det_ctx->discontinue_matching = 1;
+        goto no_match;
+    }
+    if (buffer_len == 0)
+        goto no_match;
+
+    prev_buffer_offset[level] = det_ctx->buffer_offset;
+    prev_offset[level] = 0;
+
+search:
+    cd = (const DetectContentData *)smd[level].ctx;
+    r = ContentInspectFastSearch(det_ctx, cd, buffer, buffer_len,
+            prev_buffer_offset[level], prev_offset[level], &match_offset[level]);
+    if (r != 1) {
+        if (r == 0 && (cd->flags & (DETECT_CONTENT_DISTANCE|DETECT_CONTENT_WITHIN)) == 0) {
+            /* independent match from previous matches, so failure is fatal */
+            det_ctx->discontinue_matching = 1;
+        }
+        goto no_match;
+    }
+    det_ctx->buffer_offset = match_offset[level];
+
+    if ((cd->flags & DETECT_CONTENT_ENDS_WITH) == 0 || match_offset[level] == buffer_len) {
+        if (smd[level].is_last)
+            return 1;
+        /* see if the next content matches */
+        level++;
+        goto enter;
+    }
+
+next:
+    /* look for another occurence after the start of this match */
+    prev_offset[level] = match_offset[level] - (cd->content_len - 1);
+    goto search;
+
+no_match:
+    if (level == 0)
+        return 0;
+    /* back to the previous content, 'next sm' didn't match */
+    level--;
+    cd = (const DetectContentData *)smd[level].ctx;
+    if (det_ctx->discontinue_matching)
+        goto no_match;
+    /* no match and no reason to look for another instance */
+    if ((cd->flags & DETECT_CONTENT_WITHIN_NEXT) == 0) {
+        det_ctx->discontinue_matching = 1;
+        goto no_match;
+    }
+    goto next;
+}
+
 /**
  * \brief Run the actual payload match functions
  *
@@ -106,6 +358,21 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
                                   uint8_t inspection_mode)
 {
     SCEnter();
+
+    /* content only lists picked at prepare time. Chunked stream
+     * inspection is left to the generic code below. */
+    if (smd != NULL && smd->ci_fast != DETECT_CI_FAST_NONE && stream_start_offset == 0) {
+        int r;
+        KEYWORD_PROFILING_START;
+        if (smd->ci_fast == DETECT_CI_FAST_SINGLE) {
+            r = ContentInspectFastSingle(de_ctx, det_ctx, smd, buffer, buffer_len);
+        } else {
+            r = ContentInspectFastChain(de_ctx, det_ctx, smd, buffer, buffer_len);
+        }
+        KEYWORD_PROFILING_END(det_ctx, DETECT_CONTENT, r);
+        SCReturnInt(r);
+    }
+
     KEYWORD_PROFILING_START;
 
     det_ctx->inspection_recursion_counter++;
@@ -266,7 +533,6 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
                 }
             }
 
-            uint8_t *sbuffer = buffer + offset;
             uint32_t sbuffer_len = depth - offset;
             uint32_t match_offset = 0;
             SCLogDebug("sbuffer_len %"PRIu32, sbuffer_len);
@@ -280,7 +546,7 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
                 found = NULL;
             } else {
                 /* do the actual search */
-                found = SpmScan(cd->spm_ctx, det_ctx->spm_thread_ctx, sbuffer,
+                found = ContentInspectScan(det_ctx, cd, buffer, offset,
                         sbuffer_len);
             }
 
@@ -525,6 +791,40 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
 
         goto match;
 
+    } else if (smd->type == DETECT_BYTEMATH) {
+
+        const DetectByteMathData *bmd = (const DetectByteMathData *)smd->ctx;
+        uint8_t endian = bmd->endian;
+        uint64_t rvalue = bmd->rvalue;
+
+        if (bmd->flags & DETECT_BYTEMATH_FLAG_RVALUE_VAR) {
+            rvalue = det_ctx->bj_values[rvalue];
+        }
+
+        /* with dce the endianness is the one of the dce header */
+        if (endian == DETECT_BYTEMATH_ENDIAN_DCE) {
+            endian = (flags & DETECT_CI_FLAGS_DCE_LE) ?
+                DETECT_BYTEMATH_ENDIAN_LITTLE : DETECT_BYTEMATH_ENDIAN_BIG;
+        }
+
+        if (DetectByteMathDoMatch(det_ctx, bmd, buffer, buffer_len, rvalue,
+                                  &det_ctx->bj_values[bmd->local_id], endian) != 1) {
+            goto no_match;
+        }
+
+        goto match;
+
+    } else if (smd->type == DETECT_DATASET) {
+
+        /* the whole buffer is looked up, so a failed lookup is final */
+        const DetectDatasetData *sd = (const DetectDatasetData *)smd->ctx;
+        int r = DetectDatasetBufferMatch(det_ctx, sd, buffer, buffer_len);
+        if (r == 1) {
+            goto match;
+        }
+        det_ctx->discontinue_matching = 1;
+        goto no_match;
+
     } else if (smd->type == DETECT_BSIZE) {
 
         bool eof = (flags & DETECT_CI_FLAGS_END);
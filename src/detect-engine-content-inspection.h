@@ -44,6 +44,19 @@ enum {
  *  inspection function contains both start and end of the data. */
 #define DETECT_CI_FLAGS_SINGLE  (DETECT_CI_FLAGS_START|DETECT_CI_FLAGS_END)
 
+/** content inspection fast paths, picked per SigMatchData list when
+ *  the detection engine is prepared */
+enum {
+    DETECT_CI_FAST_NONE = 0,    /**< use the generic inspection */
+    DETECT_CI_FAST_SINGLE,      /**< single plain content */
+    DETECT_CI_FAST_CHAIN,       /**< only plain contents */
+};
+
+/** max number of contents in a DETECT_CI_FAST_CHAIN list */
+#define DETECT_CI_FAST_CHAIN_MAX    8
+
+void DetectEngineContentInspectionSetup(SigMatchData *smd);
+
 int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
                                   const Signature *s, const SigMatchData *smd,
                                   Packet *p, Flow *f,
@@ -0,0 +1,643 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast pattern statistics.
+ *
+ * When enabled, every rule that makes it into the prefilter result counts
+ * a hit for its fast pattern. A pattern's hit count is the highest count
+ * of the rules using it, as the rules can be spread over several rule
+ * groups. On reload and shutdown the counts are written to a file as hits
+ * per hour. The next engine loads that file and RetrieveFPForSig() uses it
+ * to move the fast pattern of a rule away from a pattern that hits a lot.
+ *
+ * Only the patterns that are fast patterns are measured, so the stats of
+ * patterns that are not used in this run are kept from the file.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-fpstats.h"
+#include "detect-content.h"
+#include "conf.h"
+#include "util-conf.h"
+#include "util-path.h"
+#include "util-hashlist.h"
+#include "util-hash-lookup3.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+#define FPSTATS_HASH_SIZE       4096
+/** default for detect.fast-pattern-stats.min-rate in hits per hour */
+#define FPSTATS_MIN_RATE        1000.0
+#define FPSTATS_TOP_DEFAULT     20
+#define FPSTATS_TOP_MAX         1000
+
+typedef struct DetectFPStatsPattern_ {
+    const char *buffer;     /**< buffer name, owned by the engine */
+    char *buffer_copy;      /**< buffer name if loaded from the file */
+    uint8_t *content;
+    uint16_t content_len;
+    bool nocase;
+
+    /** rate from the stats file */
+    bool has_rate;
+    double rate;
+
+    /** rules using this as fast pattern in this engine */
+    uint32_t rules;
+    /** hits of this run, set by FPStatsAggregate() */
+    uint64_t hits;
+} DetectFPStatsPattern;
+
+typedef struct DetectFPStats_ {
+    HashListTable *patterns;
+    /** fast pattern per internal sig id */
+    DetectFPStatsPattern **sig_patterns;
+    /** prefilter hits per internal sig id */
+    uint64_t *hits;
+    uint32_t sigs;
+
+    double min_rate;
+    struct timeval start;
+    /** protects the aggregation of the hits into the patterns */
+    SCMutex lock;
+    char filename[PATH_MAX];
+} DetectFPStats;
+
+static uint32_t FPStatsHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const DetectFPStatsPattern *p = data;
+    uint32_t hash = hashlittle(p->content, p->content_len, p->nocase);
+    hash = hashlittle(p->buffer, strlen(p->buffer), hash);
+    return hash % ht->array_size;
+}
+
+static char FPStatsCompareFunc(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const DetectFPStatsPattern *p1 = data1;
+    const DetectFPStatsPattern *p2 = data2;
+    return (p1->content_len == p2->content_len && p1->nocase == p2->nocase &&
+            memcmp(p1->content, p2->content, p1->content_len) == 0 &&
+            strcmp(p1->buffer, p2->buffer) == 0);
+}
+
+static void FPStatsFreeFunc(void *data)
+{
+    DetectFPStatsPattern *p = data;
+    SCFree(p->buffer_copy);
+    SCFree(p->content);
+    SCFree(p);
+}
+
+static const char *FPStatsBufferName(const DetectEngineCtx *de_ctx, int list)
+{
+    if (list < DETECT_SM_LIST_DYNAMIC_START)
+        return DetectListToHumanString(list);
+    return DetectBufferTypeGetNameById(de_ctx, list);
+}
+
+/** \internal
+ *  \brief find a pattern, or add it if 'add' is true
+ *
+ *  \param buffer_copy if true, the buffer name is copied */
+static DetectFPStatsPattern *FPStatsGetPattern(DetectFPStats *fps,
+        const char *buffer, const uint8_t *content, uint16_t content_len,
+        bool nocase, bool add, bool buffer_copy)
+{
+    DetectFPStatsPattern lookup = {
+        .buffer = buffer, .content = (uint8_t *)content,
+        .content_len = content_len, .nocase = nocase };
+    DetectFPStatsPattern *p = HashListTableLookup(fps->patterns, &lookup, 0);
+    if (p != NULL || !add)
+        return p;
+
+    p = SCCalloc(1, sizeof(*p));
+    if (unlikely(p == NULL))
+        return NULL;
+    p->content = SCMalloc(content_len);
+    if (unlikely(p->content == NULL))
+        goto error;
+    memcpy(p->content, content, content_len);
+    p->content_len = content_len;
+    p->nocase = nocase;
+    if (buffer_copy) {
+        p->buffer_copy = SCStrdup(buffer);
+        if (unlikely(p->buffer_copy == NULL))
+            goto error;
+        p->buffer = p->buffer_copy;
+    } else {
+        p->buffer = buffer;
+    }
+    if (HashListTableAdd(fps->patterns, p, 0) != 0)
+        goto error;
+    return p;
+
+error:
+    FPStatsFreeFunc(p);
+    return NULL;
+}
+
+static int FPStatsHexToBytes(const char *hex, uint8_t *out, uint32_t out_size)
+{
+    static const char digits[] = "0123456789abcdef";
+    const size_t len = strlen(hex);
+    if (len == 0 || len % 2 != 0 || len / 2 > out_size)
+        return -1;
+
+    for (size_t i = 0; i < len; i += 2) {
+        const char *h = strchr(digits, tolower((unsigned char)hex[i]));
+        const char *l = strchr(digits, tolower((unsigned char)hex[i + 1]));
+        if (h == NULL || l == NULL || *h == '\0' || *l == '\0')
+            return -1;
+        out[i / 2] = (uint8_t)(((h - digits) << 4) | (l - digits));
+    }
+    return (int)(len / 2);
+}
+
+/** \internal
+ *  \brief load the stats file, lines are "<buffer> <nocase> <hex> <rate>" */
+static void FPStatsLoad(DetectFPStats *fps)
+{
+    FILE *fp = fopen(fps->filename, "r");
+    if (fp == NULL) {
+        SCLogConfig("no fast pattern stats loaded from %s: %s",
+                fps->filename, strerror(errno));
+        return;
+    }
+
+    uint8_t content[1024];
+    char line[4096];
+    uint32_t cnt = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        /* skip the rest of lines that are too long for us */
+        if (strchr(line, '\n') == NULL && !feof(fp)) {
+            int c;
+            while ((c = fgetc(fp)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        char buffer[64];
+        char hex[sizeof(line)];
+        int nocase;
+        double rate;
+        if (sscanf(line, "%63s %d %4095s %lf", buffer, &nocase, hex, &rate) != 4 ||
+                rate < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid line in fast "
+                    "pattern stats %s: %s", fps->filename, line);
+            continue;
+        }
+        int len = FPStatsHexToBytes(hex, content, sizeof(content));
+        if (len < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid pattern in fast "
+                    "pattern stats %s: %s", fps->filename, line);
+            continue;
+        }
+        DetectFPStatsPattern *p = FPStatsGetPattern(fps, buffer, content,
+                (uint16_t)len, nocase != 0, true, true);
+        if (p == NULL)
+            break;
+        p->has_rate = true;
+        p->rate = rate;
+        cnt++;
+    }
+    fclose(fp);
+    SCLogConfig("loaded the hit rate of %u fast patterns from %s",
+            cnt, fps->filename);
+}
+
+/**
+ * \brief Set up the fast pattern stats if enabled in the config.
+ *
+ * Only for the regular engine, not for tenants. Must be called after the
+ * internal sig ids are assigned.
+ */
+void DetectFPStatsSetup(DetectEngineCtx *de_ctx)
+{
+    int enabled = 0;
+    if (de_ctx->fp_stats != NULL || strlen(de_ctx->config_prefix) > 0)
+        return;
+    if (ConfGetBool("detect.fast-pattern-stats.enabled", &enabled) != 1 ||
+            enabled == 0)
+        return;
+
+    DetectFPStats *fps = SCCalloc(1, sizeof(*fps));
+    if (unlikely(fps == NULL))
+        return;
+    SCMutexInit(&fps->lock, NULL);
+    fps->patterns = HashListTableInit(FPSTATS_HASH_SIZE, FPStatsHashFunc,
+            FPStatsCompareFunc, FPStatsFreeFunc);
+    fps->sigs = de_ctx->signum;
+    if (fps->sigs > 0) {
+        fps->sig_patterns = SCCalloc(fps->sigs, sizeof(DetectFPStatsPattern *));
+        fps->hits = SCCalloc(fps->sigs, sizeof(uint64_t));
+    }
+    if (fps->patterns == NULL ||
+            (fps->sigs > 0 && (fps->sig_patterns == NULL || fps->hits == NULL))) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to set up fast pattern stats");
+        de_ctx->fp_stats = fps;
+        DetectFPStatsFree(de_ctx);
+        return;
+    }
+
+    const char *filename = "fp-stats.txt";
+    (void)ConfGet("detect.fast-pattern-stats.filename", &filename);
+    if (PathIsAbsolute(filename)) {
+        strlcpy(fps->filename, filename, sizeof(fps->filename));
+    } else {
+        snprintf(fps->filename, sizeof(fps->filename), "%s/%s",
+                ConfigGetLogDirectory(), filename);
+    }
+    fps->min_rate = FPSTATS_MIN_RATE;
+    const char *min_rate = NULL;
+    if (ConfGet("detect.fast-pattern-stats.min-rate", &min_rate) == 1 &&
+            min_rate != NULL) {
+        fps->min_rate = atof(min_rate);
+    }
+
+    FPStatsLoad(fps);
+    gettimeofday(&fps->start, NULL);
+    de_ctx->fp_stats = fps;
+}
+
+/**
+ * \brief Register the fast pattern of a rule so its hits are counted.
+ */
+void DetectFPStatsAddSig(DetectEngineCtx *de_ctx, const Signature *s,
+        int list, const DetectContentData *cd)
+{
+    DetectFPStats *fps = de_ctx->fp_stats;
+    if (fps == NULL || s->num >= fps->sigs || (cd->flags & DETECT_CONTENT_NEGATED))
+        return;
+
+    DetectFPStatsPattern *p = FPStatsGetPattern(fps,
+            FPStatsBufferName(de_ctx, list), cd->content, cd->content_len,
+            (cd->flags & DETECT_CONTENT_NOCASE) != 0, true, false);
+    if (p == NULL)
+        return;
+    p->rules++;
+    fps->sig_patterns[s->num] = p;
+}
+
+/**
+ * \brief Get the hit rate of a pattern from the stats file.
+ *
+ * \retval true if the rate is known and at least the configured
+ *         'min-rate', so it is worth picking another pattern.
+ */
+bool DetectFPStatsGetRate(const DetectEngineCtx *de_ctx, int list,
+        const DetectContentData *cd, double *rate)
+{
+    DetectFPStats *fps = de_ctx->fp_stats;
+    if (fps == NULL)
+        return false;
+
+    const DetectFPStatsPattern *p = FPStatsGetPattern(fps,
+            FPStatsBufferName(de_ctx, list), cd->content, cd->content_len,
+            (cd->flags & DETECT_CONTENT_NOCASE) != 0, false, false);
+    if (p == NULL || !p->has_rate)
+        return false;
+    *rate = p->rate;
+    return p->rate >= fps->min_rate;
+}
+
+/**
+ * \brief Count the hits of the rules in the prefilter result.
+ */
+void DetectFPStatsUpdate(DetectEngineCtx *de_ctx, const PrefilterRuleStore *pmq)
+{
+    DetectFPStats *fps = de_ctx->fp_stats;
+    for (uint32_t i = 0; i < pmq->rule_id_array_cnt; i++) {
+        const SigIntId id = pmq->rule_id_array[i];
+        if (likely(id < fps->sigs))
+            __atomic_fetch_add(&fps->hits[id], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/** \internal
+ *  \brief set the hits of this run on the patterns
+ *
+ *  \retval elapsed seconds since the setup */
+static double FPStatsAggregate(DetectFPStats *fps)
+{
+    HashListTableBucket *b = HashListTableGetListHead(fps->patterns);
+    for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+        DetectFPStatsPattern *p = HashListTableGetListData(b);
+        p->hits = 0;
+    }
+    for (uint32_t i = 0; i < fps->sigs; i++) {
+        DetectFPStatsPattern *p = fps->sig_patterns[i];
+        if (p == NULL)
+            continue;
+        const uint64_t hits = __atomic_load_n(&fps->hits[i], __ATOMIC_RELAXED);
+        if (hits > p->hits)
+            p->hits = hits;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (double)(now.tv_sec - fps->start.tv_sec) +
+           (double)(now.tv_usec - fps->start.tv_usec) / 1000000.0;
+}
+
+/**
+ * \brief Write the stats file: the rates measured by this engine and the
+ *        loaded rates of the patterns this engine didn't use.
+ */
+void DetectFPStatsWrite(DetectEngineCtx *de_ctx)
+{
+    DetectFPStats *fps = de_ctx->fp_stats;
+    if (fps == NULL)
+        return;
+
+    char tmp_name[PATH_MAX];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp",
+                fps->filename) >= (int)sizeof(tmp_name))
+        return;
+
+    FILE *fp = fopen(tmp_name, "w");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", tmp_name,
+                strerror(errno));
+        return;
+    }
+
+    SCMutexLock(&fps->lock);
+    const double elapsed = FPStatsAggregate(fps);
+    /* too short to say anything about the rates */
+    const bool measured = elapsed >= 1.0;
+
+    uint32_t cnt = 0;
+    fprintf(fp, "# buffer nocase pattern hits-per-hour\n");
+    HashListTableBucket *b = HashListTableGetListHead(fps->patterns);
+    for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+        const DetectFPStatsPattern *p = HashListTableGetListData(b);
+        double rate;
+        if (p->rules > 0 && measured) {
+            rate = (double)p->hits * 3600.0 / elapsed;
+        } else if (p->has_rate) {
+            rate = p->rate;
+        } else {
+            continue;
+        }
+        fprintf(fp, "%s %d ", p->buffer, p->nocase ? 1 : 0);
+        for (uint16_t i = 0; i < p->content_len; i++) {
+            fprintf(fp, "%02x", p->content[i]);
+        }
+        fprintf(fp, " %.3f\n", rate);
+        cnt++;
+    }
+    SCMutexUnlock(&fps->lock);
+
+    if (fclose(fp) != 0 || rename(tmp_name, fps->filename) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to write %s: %s",
+                fps->filename, strerror(errno));
+        unlink(tmp_name);
+        return;
+    }
+    SCLogPerf("wrote the hit rate of %u fast patterns to %s", cnt, fps->filename);
+}
+
+/**
+ * \brief Write the stats and free them.
+ */
+void DetectFPStatsFree(DetectEngineCtx *de_ctx)
+{
+    DetectFPStats *fps = de_ctx->fp_stats;
+    if (fps == NULL)
+        return;
+
+    if (fps->patterns != NULL && fps->sig_patterns != NULL)
+        DetectFPStatsWrite(de_ctx);
+
+    if (fps->patterns != NULL)
+        HashListTableFree(fps->patterns);
+    SCFree(fps->sig_patterns);
+    SCFree(fps->hits);
+    SCMutexDestroy(&fps->lock);
+    SCFree(fps);
+    de_ctx->fp_stats = NULL;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+static int FPStatsSortByHits(const void *a, const void *b)
+{
+    const DetectFPStatsPattern *p1 = *(const DetectFPStatsPattern **)a;
+    const DetectFPStatsPattern *p2 = *(const DetectFPStatsPattern **)b;
+    if (p1->hits == p2->hits)
+        return 0;
+    return p1->hits > p2->hits ? -1 : 1;
+}
+
+/** \internal
+ *  \brief pattern in rule notation, non-printable bytes as |xx| */
+static void FPStatsPatternToString(const DetectFPStatsPattern *p,
+        char *out, size_t out_size)
+{
+    size_t o = 0;
+    for (uint16_t i = 0; i < p->content_len && o + 5 < out_size; i++) {
+        const uint8_t c = p->content[i];
+        if (isprint(c) && c != '|' && c != '"' && c != ';' && c != '\\') {
+            out[o++] = (char)c;
+        } else {
+            o += snprintf(out + o, out_size - o, "|%02X|", c);
+        }
+    }
+    out[o] = '\0';
+}
+
+/**
+ * \brief Unix socket command: the fast patterns with the most hits.
+ *
+ * Optional argument "count", the number of patterns to list.
+ */
+TmEcode DetectFPStatsCommand(json_t *cmd, json_t *answer, void *data)
+{
+    uint32_t count = FPSTATS_TOP_DEFAULT;
+    json_t *jarg = json_object_get(cmd, "count");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > FPSTATS_TOP_MAX) {
+            json_object_set_new(answer, "message",
+                    json_string("count is not an integer between 1 and 1000"));
+            return TM_ECODE_FAILED;
+        }
+        count = (uint32_t)json_integer_value(jarg);
+    }
+
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    if (de_ctx == NULL || de_ctx->fp_stats == NULL) {
+        if (de_ctx != NULL)
+            DetectEngineDeReference(&de_ctx);
+        json_object_set_new(answer, "message",
+                json_string("fast pattern stats are not enabled"));
+        return TM_ECODE_FAILED;
+    }
+    DetectFPStats *fps = de_ctx->fp_stats;
+
+    json_t *jdata = json_object();
+    json_t *jpatterns = json_array();
+    uint32_t size = fps->patterns->array_size;
+    DetectFPStatsPattern **list = NULL;
+    uint32_t cnt = 0;
+
+    SCMutexLock(&fps->lock);
+    const double elapsed = FPStatsAggregate(fps);
+    HashListTableBucket *b = HashListTableGetListHead(fps->patterns);
+    for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+        DetectFPStatsPattern *p = HashListTableGetListData(b);
+        if (p->rules == 0)
+            continue;
+        if (list == NULL || cnt == size) {
+            DetectFPStatsPattern **tmp = SCRealloc(list, (cnt + size) * sizeof(*list));
+            if (tmp == NULL)
+                break;
+            list = tmp;
+            size = cnt + size;
+        }
+        list[cnt++] = p;
+    }
+
+    if (jdata == NULL || jpatterns == NULL || list == NULL) {
+        SCMutexUnlock(&fps->lock);
+        SCFree(list);
+        if (jdata != NULL)
+            json_decref(jdata);
+        if (jpatterns != NULL)
+            json_decref(jpatterns);
+        DetectEngineDeReference(&de_ctx);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    qsort(list, cnt, sizeof(*list), FPStatsSortByHits);
+    for (uint32_t i = 0; i < cnt && i < count; i++) {
+        const DetectFPStatsPattern *p = list[i];
+        char pattern[1024];
+        FPStatsPatternToString(p, pattern, sizeof(pattern));
+
+        json_t *jp = json_object();
+        if (jp == NULL)
+            continue;
+        json_object_set_new(jp, "buffer", json_string(p->buffer));
+        json_object_set_new(jp, "pattern", json_string(pattern));
+        json_object_set_new(jp, "nocase", json_boolean(p->nocase));
+        json_object_set_new(jp, "hits", json_integer(p->hits));
+        json_object_set_new(jp, "rules", json_integer(p->rules));
+        json_array_append_new(jpatterns, jp);
+    }
+    SCMutexUnlock(&fps->lock);
+    SCFree(list);
+
+    json_object_set_new(jdata, "seconds", json_integer((json_int_t)elapsed));
+    json_object_set_new(jdata, "patterns", jpatterns);
+    json_object_set_new(answer, "message", jdata);
+    DetectEngineDeReference(&de_ctx);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+#include "detect-engine-mpm.h"
+
+/**
+ * \test A fast pattern that hits a lot is replaced by a rare pattern of
+ *       the rule, and the measured hits are written out as a rate.
+ */
+static int DetectFPStatsTest01(void)
+{
+    char filename[] = "/tmp/suricata-fpstats-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    /* "abcdefgh" */
+    fprintf(fp, "payload 0 6162636465666768 50000.0\n");
+    fprintf(fp, "payload 0 zz 1.0\n");
+    fclose(fp);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("detect.fast-pattern-stats.enabled", "yes");
+    ConfSet("detect.fast-pattern-stats.filename", filename);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"abcdefgh\"; content:\"wxyz\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    s->num = 0;
+    de_ctx->signum = 1;
+
+    DetectFPStatsSetup(de_ctx);
+    FAIL_IF_NULL(de_ctx->fp_stats);
+
+    RetrieveFPForSig(de_ctx, s);
+    FAIL_IF_NULL(s->init_data->mpm_sm);
+    const DetectContentData *cd = (DetectContentData *)s->init_data->mpm_sm->ctx;
+    FAIL_IF(cd->content_len != 4 || memcmp(cd->content, "wxyz", 4) != 0);
+
+    DetectFPStatsAddSig(de_ctx, s, DETECT_SM_LIST_PMATCH, cd);
+    SigIntId ids[1] = { 0 };
+    PrefilterRuleStore pmq = { .rule_id_array = ids, .rule_id_array_cnt = 1 };
+    DetectFPStatsUpdate(de_ctx, &pmq);
+    DetectFPStatsUpdate(de_ctx, &pmq);
+    FAIL_IF(de_ctx->fp_stats->hits[0] != 2);
+
+    /* pretend an hour passed: the rate is the number of hits */
+    de_ctx->fp_stats->start.tv_sec -= 3600;
+    DetectEngineCtxFree(de_ctx);
+
+    fp = fopen(filename, "r");
+    FAIL_IF_NULL(fp);
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "payload 0 7778797a 2.", 21) == 0)
+            found |= 1;
+        if (strcmp(line, "payload 0 6162636465666768 50000.000\n") == 0)
+            found |= 2;
+    }
+    fclose(fp);
+    unlink(filename);
+    FAIL_IF(found != 3);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectFPStatsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectFPStatsTest01", DetectFPStatsTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,45 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast pattern statistics: how often the fast pattern of each rule hits,
+ * used to pick rarer fast patterns when the rules are loaded again.
+ */
+
+#ifndef __DETECT_ENGINE_FPSTATS_H__
+#define __DETECT_ENGINE_FPSTATS_H__
+
+#include "detect-content.h"
+
+void DetectFPStatsSetup(DetectEngineCtx *de_ctx);
+void DetectFPStatsAddSig(DetectEngineCtx *de_ctx, const Signature *s,
+        int list, const DetectContentData *cd);
+bool DetectFPStatsGetRate(const DetectEngineCtx *de_ctx, int list,
+        const DetectContentData *cd, double *rate);
+void DetectFPStatsUpdate(DetectEngineCtx *de_ctx, const PrefilterRuleStore *pmq);
+void DetectFPStatsWrite(DetectEngineCtx *de_ctx);
+void DetectFPStatsFree(DetectEngineCtx *de_ctx);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DetectFPStatsCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void DetectFPStatsRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_FPSTATS_H__ */
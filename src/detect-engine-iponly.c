@@ -568,10 +568,334 @@ static void SigNumArrayFree(void *tmp)
 
     if (sna->array != NULL)
         SCFree(sna->array);
+    if (sna->sids != NULL)
+        SCFree(sna->sids);
 
     SCFree(sna);
 }
 
+/**
+ * \brief Build the sorted list of sig nums set in a SigNumArray, so that
+ *        the matching only has to walk the sigs that are set
+ *
+ * \retval bytes of memory used by the SigNumArray, 0 if it was done already
+ */
+static uint64_t SigNumArrayBuildSids(SigNumArray *sna)
+{
+    if (sna->sids != NULL)
+        return 0;
+
+    uint32_t cnt = 0;
+    for (uint32_t u = 0; u < sna->size; u++) {
+        for (uint8_t b = sna->array[u]; b != 0; b &= b - 1)
+            cnt++;
+    }
+
+    /* always allocate, a NULL list means not built yet */
+    sna->sids = SCMalloc(MAX(cnt, 1) * sizeof(SigIntId));
+    if (sna->sids == NULL) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in SigNumArrayBuildSids. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t i = 0;
+    for (uint32_t u = 0; u < sna->size; u++) {
+        uint8_t bitarray = sna->array[u];
+        for (uint8_t b = 0; bitarray != 0; b++, bitarray >>= 1) {
+            if (bitarray & 0x01)
+                sna->sids[i++] = u * 8 + b;
+        }
+    }
+    sna->sids_cnt = cnt;
+
+    return sizeof(SigNumArray) + sna->size + MAX(cnt, 1) * sizeof(SigIntId);
+}
+
+/** entry of the IPv4 LPM table pointing to a next level chunk */
+#define IPONLY_LPM_CHUNK        0x80000000U
+#define IPONLY_LPM_CHUNK_SIZE   256
+/** max chunks (1KiB each) per table. A table that would need more is not
+ *  built and the radix tree is used for that direction. */
+#define IPONLY_LPM_MAX_CHUNKS   (32 * 1024)
+
+static void IPOnlyLpm4Free(IPOnlyLpm4 *lpm)
+{
+    if (lpm->tbl16 != NULL)
+        SCFree(lpm->tbl16);
+    if (lpm->chunks != NULL)
+        SCFree(lpm->chunks);
+    if (lpm->results != NULL)
+        SCFree(lpm->results);
+    memset(lpm, 0, sizeof(*lpm));
+}
+
+/**
+ * \brief Get a new chunk with all entries set to the entry it replaces
+ *
+ * \retval 0 ok, *idx set to the new chunk
+ * \retval -1 error or too many chunks
+ */
+static int IPOnlyLpm4ChunkNew(IPOnlyLpm4 *lpm, const uint32_t fill, uint32_t *idx)
+{
+    if (lpm->chunks_cnt == IPONLY_LPM_MAX_CHUNKS)
+        return -1;
+
+    if (lpm->chunks_cnt == lpm->chunks_size) {
+        uint32_t size = lpm->chunks_size ? lpm->chunks_size * 2 : 64;
+        if (size > IPONLY_LPM_MAX_CHUNKS)
+            size = IPONLY_LPM_MAX_CHUNKS;
+        uint32_t *ptr = SCRealloc(lpm->chunks,
+                (size_t)size * IPONLY_LPM_CHUNK_SIZE * sizeof(uint32_t));
+        if (ptr == NULL)
+            return -1;
+        lpm->chunks = ptr;
+        lpm->chunks_size = size;
+    }
+
+    uint32_t *chunk = lpm->chunks + (size_t)lpm->chunks_cnt * IPONLY_LPM_CHUNK_SIZE;
+    for (int i = 0; i < IPONLY_LPM_CHUNK_SIZE; i++)
+        chunk[i] = fill;
+    *idx = lpm->chunks_cnt++;
+    return 0;
+}
+
+/** \internal
+ *  \brief set an entry to a result, including all the entries of the chunks
+ *         below it */
+static void IPOnlyLpm4Set(IPOnlyLpm4 *lpm, uint32_t *e, const uint32_t res)
+{
+    if (*e & IPONLY_LPM_CHUNK) {
+        uint32_t *chunk = lpm->chunks +
+            (size_t)(*e & ~IPONLY_LPM_CHUNK) * IPONLY_LPM_CHUNK_SIZE;
+        for (int i = 0; i < IPONLY_LPM_CHUNK_SIZE; i++)
+            IPOnlyLpm4Set(lpm, &chunk[i], res);
+    } else {
+        *e = res;
+    }
+}
+
+/** \internal
+ *  \brief make sure the entry is a chunk, returning the chunk index */
+static int IPOnlyLpm4ChunkGet(IPOnlyLpm4 *lpm, uint32_t *tbl, const size_t e, uint32_t *idx)
+{
+    if (tbl[e] & IPONLY_LPM_CHUNK) {
+        *idx = tbl[e] & ~IPONLY_LPM_CHUNK;
+        return 0;
+    }
+    const uint32_t fill = tbl[e];
+    if (IPOnlyLpm4ChunkNew(lpm, fill, idx) < 0)
+        return -1;
+    tbl[e] = *idx | IPONLY_LPM_CHUNK;
+    return 0;
+}
+
+/**
+ * \brief Add a prefix to the table. Prefixes have to be added in order
+ *        of ascending netmask, so that a prefix overrides the shorter
+ *        ones it is part of.
+ *
+ * \param ip address in host order
+ * \param res index of the result
+ */
+static int IPOnlyLpm4Insert(IPOnlyLpm4 *lpm, uint32_t ip, const uint8_t netmask,
+        const uint32_t res)
+{
+    if (netmask > 32)
+        return -1;
+    if (netmask < 32)
+        ip &= ~(0xffffffffU >> netmask);
+
+    if (netmask <= 16) {
+        const uint32_t start = ip >> 16;
+        const uint32_t n = 1U << (16 - netmask);
+        for (uint32_t i = start; i < start + n; i++)
+            IPOnlyLpm4Set(lpm, &lpm->tbl16[i], res);
+        return 0;
+    }
+
+    uint32_t c2;
+    if (IPOnlyLpm4ChunkGet(lpm, lpm->tbl16, ip >> 16, &c2) < 0)
+        return -1;
+
+    if (netmask <= 24) {
+        uint32_t *chunk = lpm->chunks + (size_t)c2 * IPONLY_LPM_CHUNK_SIZE;
+        const uint32_t start = (ip >> 8) & 0xff;
+        const uint32_t n = 1U << (24 - netmask);
+        for (uint32_t i = start; i < start + n; i++)
+            IPOnlyLpm4Set(lpm, &chunk[i], res);
+        return 0;
+    }
+
+    /* the chunks array may move when adding a chunk, so index from the
+     * base of the array rather than from a chunk pointer */
+    uint32_t c3;
+    if (IPOnlyLpm4ChunkGet(lpm, lpm->chunks,
+                (size_t)c2 * IPONLY_LPM_CHUNK_SIZE + ((ip >> 8) & 0xff), &c3) < 0)
+        return -1;
+
+    uint32_t *chunk = lpm->chunks + (size_t)c3 * IPONLY_LPM_CHUNK_SIZE;
+    const uint32_t start = ip & 0xff;
+    const uint32_t n = 1U << (32 - netmask);
+    for (uint32_t i = start; i < start + n; i++)
+        chunk[i] = res;
+    return 0;
+}
+
+/**
+ * \brief Longest prefix match lookup
+ *
+ * \param addr address in network order
+ *
+ * \retval sna SigNumArray of the longest matching prefix or NULL
+ */
+static inline SigNumArray *IPOnlyLpm4Lookup(const IPOnlyLpm4 *lpm, const uint32_t addr)
+{
+    const uint32_t ip = SCNtohl(addr);
+    uint32_t e = lpm->tbl16[ip >> 16];
+    if (e & IPONLY_LPM_CHUNK) {
+        e = lpm->chunks[(size_t)(e & ~IPONLY_LPM_CHUNK) * IPONLY_LPM_CHUNK_SIZE +
+            ((ip >> 8) & 0xff)];
+        if (e & IPONLY_LPM_CHUNK) {
+            e = lpm->chunks[(size_t)(e & ~IPONLY_LPM_CHUNK) * IPONLY_LPM_CHUNK_SIZE +
+                (ip & 0xff)];
+        }
+    }
+    return lpm->results[e];
+}
+
+/** \brief address/netmask of the ip only rules, kept from the CIDR lists
+ *         to build the lookup tables once the radix trees are complete */
+typedef struct IPOnlyPrefix_ {
+    uint32_t ip[4];
+    uint8_t netmask;
+    uint8_t family;
+    uint8_t dst;
+} IPOnlyPrefix;
+
+static int IPOnlyPrefixCompare(const void *a, const void *b)
+{
+    const IPOnlyPrefix *pa = a;
+    const IPOnlyPrefix *pb = b;
+    if (pa->netmask != pb->netmask)
+        return pa->netmask < pb->netmask ? -1 : 1;
+    return memcmp(pa->ip, pb->ip, sizeof(pa->ip));
+}
+
+static IPOnlyPrefix *IPOnlyPrefixesCollect(const IPOnlyCIDRItem *src,
+        const IPOnlyCIDRItem *dst, uint32_t *cnt)
+{
+    uint32_t n = 0;
+    for (const IPOnlyCIDRItem *it = src; it != NULL; it = it->next)
+        n++;
+    for (const IPOnlyCIDRItem *it = dst; it != NULL; it = it->next)
+        n++;
+
+    *cnt = 0;
+    if (n == 0)
+        return NULL;
+
+    IPOnlyPrefix *prefixes = SCCalloc(n, sizeof(IPOnlyPrefix));
+    if (prefixes == NULL)
+        return NULL;
+
+    const IPOnlyCIDRItem *lists[2] = { src, dst };
+    for (int d = 0; d < 2; d++) {
+        for (const IPOnlyCIDRItem *it = lists[d]; it != NULL; it = it->next) {
+            IPOnlyPrefix *p = &prefixes[(*cnt)++];
+            memcpy(p->ip, it->ip, sizeof(p->ip));
+            p->netmask = it->netmask;
+            p->family = it->family;
+            p->dst = (uint8_t)d;
+        }
+    }
+    qsort(prefixes, *cnt, sizeof(IPOnlyPrefix), IPOnlyPrefixCompare);
+    return prefixes;
+}
+
+/** \internal
+ *  \brief get the SigNumArray the radix tree holds for exactly this prefix */
+static SigNumArray *IPOnlyPrefixGetSigNumArray(const DetectEngineIPOnlyCtx *io_ctx,
+        const IPOnlyPrefix *p)
+{
+    uint32_t ip[4];
+    memcpy(ip, p->ip, sizeof(ip));
+    void *user_data = NULL;
+
+    if (p->family == AF_INET) {
+        SCRadixTree *tree = p->dst ? io_ctx->tree_ipv4dst : io_ctx->tree_ipv4src;
+        if (p->netmask == 32)
+            (void)SCRadixFindKeyIPV4ExactMatch((uint8_t *)&ip[0], tree, &user_data);
+        else
+            (void)SCRadixFindKeyIPV4Netblock((uint8_t *)&ip[0], tree,
+                    p->netmask, &user_data);
+    } else if (p->family == AF_INET6) {
+        SCRadixTree *tree = p->dst ? io_ctx->tree_ipv6dst : io_ctx->tree_ipv6src;
+        if (p->netmask == 128)
+            (void)SCRadixFindKeyIPV6ExactMatch((uint8_t *)&ip[0], tree, &user_data);
+        else
+            (void)SCRadixFindKeyIPV6Netblock((uint8_t *)&ip[0], tree,
+                    p->netmask, &user_data);
+    }
+    return (SigNumArray *)user_data;
+}
+
+/**
+ * \brief Build the sparse sig lists and the IPv4 LPM tables from the
+ *        complete radix trees
+ *
+ * \param prefixes prefixes of the CIDR lists, sorted by netmask
+ */
+static void IPOnlyPrepareLookup(DetectEngineIPOnlyCtx *io_ctx,
+        const IPOnlyPrefix *prefixes, const uint32_t cnt)
+{
+    IPOnlyLpm4 *lpms[2] = { &io_ctx->lpm_ipv4src, &io_ctx->lpm_ipv4dst };
+
+    for (int d = 0; d < 2; d++) {
+        IPOnlyLpm4 *lpm = lpms[d];
+        lpm->tbl16 = SCCalloc(1 << 16, sizeof(uint32_t));
+        lpm->results = SCCalloc(cnt + 1, sizeof(SigNumArray *));
+        if (lpm->tbl16 == NULL || lpm->results == NULL)
+            IPOnlyLpm4Free(lpm);
+        else
+            lpm->results_cnt = 1;
+    }
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const IPOnlyPrefix *p = &prefixes[i];
+        SigNumArray *sna = IPOnlyPrefixGetSigNumArray(io_ctx, p);
+        if (sna == NULL)
+            continue;
+
+        uint64_t mem = SigNumArrayBuildSids(sna);
+        if (mem == 0)
+            continue; /* same prefix from another rule */
+        io_ctx->sna_memuse += mem;
+        io_ctx->prefix_cnt++;
+
+        IPOnlyLpm4 *lpm = lpms[p->dst];
+        if (p->family != AF_INET || lpm->tbl16 == NULL)
+            continue;
+
+        lpm->results[lpm->results_cnt] = sna;
+        if (IPOnlyLpm4Insert(lpm, SCNtohl(p->ip[0]), p->netmask, lpm->results_cnt) < 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "ip-only: IPv4 %s lookup table "
+                    "too large, using the radix tree", p->dst ? "dst" : "src");
+            IPOnlyLpm4Free(lpm);
+            continue;
+        }
+        lpm->results_cnt++;
+    }
+
+    for (int d = 0; d < 2; d++) {
+        const IPOnlyLpm4 *lpm = lpms[d];
+        if (lpm->tbl16 == NULL)
+            continue;
+        io_ctx->lpm_memuse += (1 << 16) * sizeof(uint32_t) +
+            (uint64_t)lpm->chunks_size * IPONLY_LPM_CHUNK_SIZE * sizeof(uint32_t) +
+            (uint64_t)(cnt + 1) * sizeof(SigNumArray *);
+    }
+}
+
 /**
  * \brief This function parses and return a list of IPOnlyCIDRItem
  *
@@ -894,7 +1218,16 @@ void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
  */
 void IPOnlyPrint(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
 {
-    /* XXX: how are we going to print the stats now? */
+    if (io_ctx->sig_cnt == 0)
+        return;
+
+    SCLogPerf("IP-only: %"PRIu32" rules, %"PRIu32" prefixes, "
+            "%"PRIu64" KiB for the sig lists, %"PRIu64" KiB for the IPv4 "
+            "lookup tables (src: %s, dst: %s)", io_ctx->sig_cnt,
+            io_ctx->prefix_cnt, io_ctx->sna_memuse / 1024,
+            io_ctx->lpm_memuse / 1024,
+            io_ctx->lpm_ipv4src.tbl16 ? "table" : "radix",
+            io_ctx->lpm_ipv4dst.tbl16 ? "table" : "radix");
 }
 
 /**
@@ -925,6 +1258,9 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
         SCRadixReleaseRadixTree(io_ctx->tree_ipv6dst);
     io_ctx->tree_ipv6dst = NULL;
 
+    IPOnlyLpm4Free(&io_ctx->lpm_ipv4src);
+    IPOnlyLpm4Free(&io_ctx->lpm_ipv4dst);
+
     if (io_ctx->sig_init_array)
         SCFree(io_ctx->sig_init_array);
     io_ctx->sig_init_array = NULL;
@@ -985,7 +1321,11 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     void *user_data_src = NULL, *user_data_dst = NULL;
 
     if (p->src.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
+        if (io_ctx->lpm_ipv4src.tbl16 != NULL)
+            user_data_src = IPOnlyLpm4Lookup(&io_ctx->lpm_ipv4src,
+                    GET_IPV4_SRC_ADDR_U32(p));
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
                                               io_ctx->tree_ipv4src, &user_data_src);
     } else if (p->src.family == AF_INET6) {
         (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
@@ -993,7 +1333,11 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     }
 
     if (p->dst.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
+        if (io_ctx->lpm_ipv4dst.tbl16 != NULL)
+            user_data_dst = IPOnlyLpm4Lookup(&io_ctx->lpm_ipv4dst,
+                    GET_IPV4_DST_ADDR_U32(p));
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
                                               io_ctx->tree_ipv4dst, &user_data_dst);
     } else if (p->dst.family == AF_INET6) {
         (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
@@ -1003,105 +1347,102 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     src = user_data_src;
     dst = user_data_dst;
 
-    if (src == NULL || dst == NULL)
+    if (src == NULL || dst == NULL || src->sids == NULL || dst->sids == NULL)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
+    /* walk the shorter sig list and check the sigs against the bit array
+     * of the other side. The lists are sorted, so the sigs are still
+     * evaluated in sig num order. */
+    const SigNumArray *walk = src, *other = dst;
+    if (dst->sids_cnt < src->sids_cnt) {
+        walk = dst;
+        other = src;
+    }
 
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
+    for (uint32_t x = 0; x < walk->sids_cnt; x++) {
+        const SigIntId num = walk->sids[x];
+        if (!(other->array[num / 8] & (1 << (num % 8))))
+            continue;
 
         /* We have to move the logic of the signature checking
          * to the main detect loop, in order to apply the
          * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
-
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
-
-                    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-                    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
+        Signature *s = de_ctx->sig_array[num];
 
-                    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
-                        SCLogDebug("proto didn't match");
-                        continue;
-                    }
+        if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
+            SCLogDebug("ip version didn't match");
+            continue;
+        }
+        if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
+            SCLogDebug("ip version didn't match");
+            continue;
+        }
 
-                    /* check the source & dst port in the sig */
-                    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
-                        if (!(s->flags & SIG_FLAG_DP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
-                            if (dport == NULL) {
-                                SCLogDebug("dport didn't match.");
-                                continue;
-                            }
-                        }
-                        if (!(s->flags & SIG_FLAG_SP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
-                            if (sport == NULL) {
-                                SCLogDebug("sport didn't match.");
-                                continue;
-                            }
-                        }
-                    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
-                        SCLogDebug("port-less protocol and sig needs ports");
-                        continue;
-                    }
+        if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
+            SCLogDebug("proto didn't match");
+            continue;
+        }
 
-                    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
-                        continue;
-                    }
+        /* check the source & dst port in the sig */
+        if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
+            if (!(s->flags & SIG_FLAG_DP_ANY)) {
+                if (p->flags & PKT_IS_FRAGMENT)
+                    continue;
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
-
-                    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
-                        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
-
-                        SCLogDebug("running match functions, sm %p", smd);
-
-                        if (smd != NULL) {
-                            while (1) {
-                                KEYWORD_PROFILING_START;
-                                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
-                                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
-                                if (smd->is_last)
-                                    break;
-                                smd++;
-                            }
-                        }
-                    }
-                    if (!(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0, 0);
-                    } else {
-                        /* apply actions for noalert/rule suppressed as well */
-                        DetectSignatureApplyActions(p, s, 0);
-                    }
+                DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
+                if (dport == NULL) {
+                    SCLogDebug("dport didn't match.");
+                    continue;
+                }
+            }
+            if (!(s->flags & SIG_FLAG_SP_ANY)) {
+                if (p->flags & PKT_IS_FRAGMENT)
+                    continue;
+
+                DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
+                if (sport == NULL) {
+                    SCLogDebug("sport didn't match.");
+                    continue;
+                }
+            }
+        } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
+            SCLogDebug("port-less protocol and sig needs ports");
+            continue;
+        }
+
+        if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
+            continue;
+        }
+
+        SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+                   num, s->id, s->msg);
+
+        if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
+            KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
+            SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
+
+            SCLogDebug("running match functions, sm %p", smd);
+
+            if (smd != NULL) {
+                while (1) {
+                    KEYWORD_PROFILING_START;
+                    (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
+                    KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
+                    if (smd->is_last)
+                        break;
+                    smd++;
                 }
             }
         }
+        if (!(s->flags & SIG_FLAG_NOALERT)) {
+            if (s->action & ACTION_DROP)
+                PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
+            else
+                PacketAlertAppend(det_ctx, s, p, 0, 0);
+        } else {
+            /* apply actions for noalert/rule suppressed as well */
+            DetectSignatureApplyActions(p, s, 0);
+        }
     }
 }
 
@@ -1125,6 +1466,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
     IPOnlyCIDRItem *src, *dst;
     SCRadixNode *node = NULL;
 
+    /* the lists are freed while building the trees, keep the prefixes
+     * for the lookup tables */
+    uint32_t prefix_cnt = 0;
+    IPOnlyPrefix *prefixes = IPOnlyPrefixesCollect((de_ctx->io_ctx).ip_src,
+            (de_ctx->io_ctx).ip_dst, &prefix_cnt);
+
     /* Prepare Src radix trees */
     for (src = (de_ctx->io_ctx).ip_src; src != NULL; ) {
         if (src->family == AF_INET) {
@@ -1522,6 +1869,11 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv6dst);
     SCLogDebug("__________________");
     */
+
+    if (prefixes != NULL) {
+        IPOnlyPrepareLookup(&de_ctx->io_ctx, prefixes, prefix_cnt);
+        SCFree(prefixes);
+    }
 }
 
 /**
@@ -1552,6 +1904,7 @@ void IPOnlyAddSignature(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx,
 
     if (s->num > io_ctx->max_idx)
         io_ctx->max_idx = s->num;
+    io_ctx->sig_cnt++;
 
     /* enable the sig in the bitarray */
     io_ctx->sig_init_array[(s->num/8)] |= 1 << (s->num % 8);
@@ -2253,6 +2606,117 @@ static int IPOnlyTestSig17(void)
     return result;
 }
 
+/**
+ * \test the IPv4 lookup tables give the same results as the radix trees
+ */
+static int IPOnlyTestSig18(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip any any -> any any (sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip 10.0.0.0/8 any -> any any (sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip [10.1.0.0/16,!10.1.2.0/24] any -> 192.168.0.0/20 any (sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip 10.1.2.128/25 any -> [192.168.1.1,192.168.1.2] any (sid:4;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip 10.1.2.130 any -> !192.168.1.0/28 any (sid:5;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert ip 172.16.0.0/12 any -> 0.0.0.0/1 any (sid:6;)"));
+    SigGroupBuild(de_ctx);
+
+    const DetectEngineIPOnlyCtx *io_ctx = &de_ctx->io_ctx;
+    FAIL_IF_NULL(io_ctx->lpm_ipv4src.tbl16);
+    FAIL_IF_NULL(io_ctx->lpm_ipv4dst.tbl16);
+
+    const char *addrs[] = { "0.0.0.0", "9.255.255.255", "10.0.0.0", "10.1.1.255",
+        "10.1.2.0", "10.1.2.127", "10.1.2.128", "10.1.2.129", "10.1.2.130",
+        "10.1.2.131", "10.1.2.255", "10.1.3.0", "10.2.0.0", "127.255.255.255",
+        "128.0.0.0", "172.16.0.1", "172.31.255.255", "172.32.0.0",
+        "192.168.0.0", "192.168.1.0", "192.168.1.1", "192.168.1.2",
+        "192.168.1.15", "192.168.1.16", "192.168.15.255", "192.168.16.0",
+        "255.255.255.255", NULL };
+
+    for (int i = 0; addrs[i] != NULL; i++) {
+        struct in_addr in;
+        FAIL_IF(inet_pton(AF_INET, addrs[i], &in) != 1);
+
+        void *user_data = NULL;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&in.s_addr,
+                io_ctx->tree_ipv4src, &user_data);
+        FAIL_IF(IPOnlyLpm4Lookup(&io_ctx->lpm_ipv4src, in.s_addr) != user_data);
+
+        user_data = NULL;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&in.s_addr,
+                io_ctx->tree_ipv4dst, &user_data);
+        FAIL_IF(IPOnlyLpm4Lookup(&io_ctx->lpm_ipv4dst, in.s_addr) != user_data);
+    }
+
+    /* sig lists match the bit arrays */
+    struct in_addr in;
+    FAIL_IF(inet_pton(AF_INET, "10.1.2.130", &in) != 1);
+    SigNumArray *sna = IPOnlyLpm4Lookup(&io_ctx->lpm_ipv4src, in.s_addr);
+    FAIL_IF_NULL(sna);
+    FAIL_IF_NULL(sna->sids);
+    FAIL_IF_NOT(sna->sids_cnt == 4); /* sid 1, 2, 4, 5 */
+    for (uint32_t x = 1; x < sna->sids_cnt; x++)
+        FAIL_IF_NOT(sna->sids[x - 1] < sna->sids[x]);
+    for (uint32_t x = 0; x < sna->sids_cnt; x++)
+        FAIL_IF_NOT(sna->array[sna->sids[x] / 8] & (1 << (sna->sids[x] % 8)));
+
+    FAIL_IF_NOT(io_ctx->sig_cnt == 6);
+    FAIL_IF(io_ctx->sna_memuse == 0);
+    FAIL_IF(io_ctx->lpm_memuse == 0);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/**
+ * \test LPM table prefix expansion and chunk levels
+ */
+static int IPOnlyTestLpm01(void)
+{
+    SigNumArray r[5];
+    memset(r, 0, sizeof(r));
+
+    IPOnlyLpm4 lpm;
+    memset(&lpm, 0, sizeof(lpm));
+    lpm.tbl16 = SCCalloc(1 << 16, sizeof(uint32_t));
+    FAIL_IF_NULL(lpm.tbl16);
+    lpm.results = SCCalloc(5, sizeof(SigNumArray *));
+    FAIL_IF_NULL(lpm.results);
+    for (int i = 1; i < 5; i++)
+        lpm.results[i] = &r[i];
+    lpm.results_cnt = 5;
+
+    /* ascending netmask order */
+    FAIL_IF(IPOnlyLpm4Insert(&lpm, 0x0a000000, 8, 1) < 0);
+    FAIL_IF(IPOnlyLpm4Insert(&lpm, 0x0a010200, 23, 2) < 0);
+    FAIL_IF(IPOnlyLpm4Insert(&lpm, 0x0a010280, 25, 3) < 0);
+    FAIL_IF(IPOnlyLpm4Insert(&lpm, 0x0a010281, 32, 4) < 0);
+    FAIL_IF_NOT(lpm.chunks_cnt == 2);
+
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x09ffffff)) == NULL);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a000000)) == &r[1]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a0101ff)) == &r[1]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a010200)) == &r[2]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a01027f)) == &r[2]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a010280)) == &r[3]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a010281)) == &r[4]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a0102ff)) == &r[3]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a0103ff)) == &r[2]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0a010400)) == &r[1]);
+    FAIL_IF_NOT(IPOnlyLpm4Lookup(&lpm, htonl(0x0b000000)) == NULL);
+
+    IPOnlyLpm4Free(&lpm);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void)
@@ -2288,6 +2752,8 @@ void IPOnlyRegisterTests(void)
     UtRegisterTest("IPOnlyTestSig16", IPOnlyTestSig16);
 
     UtRegisterTest("IPOnlyTestSig17", IPOnlyTestSig17);
+    UtRegisterTest("IPOnlyTestSig18", IPOnlyTestSig18);
+    UtRegisterTest("IPOnlyTestLpm01", IPOnlyTestLpm01);
 #endif
 
     return;
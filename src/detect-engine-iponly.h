@@ -33,6 +33,10 @@
 typedef struct SigNumArray_ {
     uint8_t *array; /* bit array of sig nums */
     uint32_t size;  /* size in bytes of the array */
+    /* sorted list of the sig nums set in array, built once the trees
+     * are complete */
+    SigIntId *sids;
+    uint32_t sids_cnt;
 } SigNumArray;
 
 void IPOnlyCIDRListFree(IPOnlyCIDRItem *tmphead);
@@ -35,6 +35,7 @@
 #include "queue.h"
 #include "util-signal.h"
 
+#include "detect-engine.h"
 #include "detect-engine-loader.h"
 #include "detect-engine-analyzer.h"
 #include "detect-engine-mpm.h"
@@ -42,6 +43,7 @@
 
 #include "util-detect.h"
 #include "util-threshold-config.h"
+#include "util-hash-lookup3.h"
 
 #ifdef HAVE_GLOB_H
 #include <glob.h>
@@ -262,6 +264,117 @@ static int ProcessSigFiles(DetectEngineCtx *de_ctx, char *pattern,
     return r;
 }
 
+/**
+ *  \internal
+ *  \brief Fold a block of data into a 64 bit digest.
+ */
+static void DigestUpdate(uint32_t digest[2], const void *data, size_t len)
+{
+    digest[0] = hashlittle_safe(data, len, digest[0]);
+    digest[1] = hashlittle_safe(data, len, digest[1] ^ 0x9e3779b9);
+}
+
+static int DigestFile(const char *path, uint32_t digest[2])
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    DigestUpdate(digest, path, strlen(path));
+
+    uint8_t buf[16384];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        DigestUpdate(digest, buf, len);
+    }
+    int r = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return r;
+}
+
+/**
+ *  \brief Digest of the name and content of a file
+ *
+ *  \retval 0 on success, -1 if the file can't be read
+ */
+int DetectFileDigest(const char *path, uint64_t *digest)
+{
+    uint32_t d[2] = { 0, 0 };
+    if (DigestFile(path, d) != 0)
+        return -1;
+    *digest = ((uint64_t)d[1] << 32) | d[0];
+    return 0;
+}
+
+static int DigestSigFiles(const char *pattern, uint32_t digest[2])
+{
+#ifdef HAVE_GLOB_H
+    glob_t files;
+    int r = glob(pattern, 0, NULL, &files);
+    if (r == GLOB_NOMATCH) {
+        DigestUpdate(digest, pattern, strlen(pattern));
+        return 0;
+    } else if (r != 0) {
+        return -1;
+    }
+
+    r = 0;
+    for (size_t i = 0; r == 0 && i < (size_t)files.gl_pathc; i++) {
+        if (strcmp("/dev/null", files.gl_pathv[i]) == 0)
+            continue;
+        r = DigestFile(files.gl_pathv[i], digest);
+    }
+    globfree(&files);
+    return r;
+#else
+    if (strcmp("/dev/null", pattern) == 0)
+        return 0;
+    return DigestFile(pattern, digest);
+#endif
+}
+
+/**
+ *  \brief Digest of the rule files SigLoadSignatures() would load
+ *
+ *  Covers the names and the content of the files, in load order. Takes the
+ *  same arguments as SigLoadSignatures().
+ *
+ *  \retval 0 on success, -1 if a file can't be read
+ */
+int SigFilesDigest(DetectEngineCtx *de_ctx, char *sig_file,
+        int sig_file_exclusive, uint64_t *digest)
+{
+    uint32_t d[2] = { 0, 0 };
+    char varname[128] = "rule-files";
+
+    if (strlen(de_ctx->config_prefix) > 0) {
+        snprintf(varname, sizeof(varname), "%s.rule-files",
+                de_ctx->config_prefix);
+    }
+
+    if (!(sig_file != NULL && sig_file_exclusive == TRUE)) {
+        ConfNode *rule_files = ConfGetNode(varname);
+        if (rule_files != NULL && ConfNodeIsSequence(rule_files)) {
+            ConfNode *file;
+            TAILQ_FOREACH(file, &rule_files->head, next) {
+                char *sfile = DetectLoadCompleteSigPath(de_ctx, file->val);
+                if (sfile == NULL)
+                    return -1;
+                int r = DigestSigFiles(sfile, d);
+                SCFree(sfile);
+                if (r != 0)
+                    return -1;
+            }
+        }
+    }
+
+    if (sig_file != NULL && DigestSigFiles(sig_file, d) != 0)
+        return -1;
+
+    *digest = ((uint64_t)d[1] << 32) | d[0];
+    return 0;
+}
+
 /**
  *  \brief Load signatures
  *  \param de_ctx Pointer to the detection engine context
@@ -292,6 +405,14 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
         rule_engine_analysis_set = SetupRuleAnalyzer();
     }
 
+    /* digest the files before loading them, so that a file changing while
+     * it is loaded is picked up by the next reload */
+    if (DetectEngineReloadSkipUnchanged() &&
+            SigFilesDigest(de_ctx, sig_file, sig_file_exclusive,
+                &de_ctx->sig_files_digest) != 0) {
+        de_ctx->sig_files_digest = 0;
+    }
+
     /* ok, let's load signature files from the general config */
     if (!(sig_file != NULL && sig_file_exclusive == TRUE)) {
         rule_files = ConfGetNode(varname);
@@ -372,6 +493,8 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
     gettimeofday(&de_ctx->last_reload, NULL);
     if (RunmodeGetCurrent() == RUNMODE_ENGINE_ANALYSIS) {
         if (rule_engine_analysis_set) {
+            if (ret == 0)
+                EngineAnalysisIPOnly(de_ctx);
             CleanupRuleAnalyzer();
         }
         if (fp_engine_analysis_set) {
@@ -38,6 +38,7 @@
 #include "detect-parse.h"
 #include "detect-engine-prefilter.h"
 #include "util-mpm.h"
+#include "util-cpu.h"
 #include "util-memcmp.h"
 #include "util-memcpy.h"
 #include "conf.h"
@@ -51,10 +52,12 @@
 
 #include "detect-engine-payload.h"
 #include "detect-engine-dns.h"
+#include "detect-engine-fpstats.h"
 
 #include "stream.h"
 
 #include "util-enum.h"
+#include "util-hash-lookup3.h"
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-validate.h"
@@ -172,6 +175,25 @@ void DetectAppLayerMpmRegister(const char *name,
     SupportFastPatternForSigMatchList(sm_list, priority);
 }
 
+/** \brief mark the mpm engines of a buffer as batchable
+ *
+ *  For small buffers, where the per call cost of the mpm dominates. With
+ *  detect.prefilter.batch the batchable buffers of the same tx progress
+ *  are searched in one call.
+ *
+ *  \note to be used at start up / registration only, after the
+ *        registration of the mpm engines of the buffer
+ */
+void DetectAppLayerMpmSetBatchable(const char *name)
+{
+    for (DetectMpmAppLayerRegistery *am = g_app_mpms_list; am != NULL; am = am->next) {
+        if (strcmp(am->name, name) == 0) {
+            BUG_ON(am->v2.PrefilterRegisterWithListId != PrefilterGenericMpmRegister);
+            am->batchable = true;
+        }
+    }
+}
+
 /** \brief copy a mpm engine from parent_id, add in transforms */
 void DetectAppLayerMpmRegisterByParentId(DetectEngineCtx *de_ctx,
         const int id, const int parent_id,
@@ -193,6 +215,7 @@ void DetectAppLayerMpmRegisterByParentId(DetectEngineCtx *de_ctx,
             am->v2.GetData = t->v2.GetData;
             am->v2.alproto = t->v2.alproto;
             am->v2.tx_min_progress = t->v2.tx_min_progress;
+            am->batchable = t->batchable;
             am->priority = t->priority;
             am->next = t->next;
             if (transforms) {
@@ -239,6 +262,81 @@ void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx)
             de_ctx->app_mpms_list, de_ctx->app_mpms_list_cnt);
 }
 
+/** \internal
+ *  \brief group the batchable buffers by proto, direction and progress
+ *
+ *  Only unique mpm ctx' are merged, a shared one is used by all rule
+ *  groups already. Groups of one buffer are not a batch.
+ */
+static void DetectMpmSetupAppMpmBatches(DetectEngineCtx *de_ctx)
+{
+    uint32_t cnt = 0;
+    DetectMpmAppLayerBatch *batches = SCCalloc(de_ctx->app_mpms_list_cnt,
+            sizeof(*batches));
+    if (batches == NULL)
+        return;
+
+    for (DetectMpmAppLayerKeyword *am = de_ctx->app_mpms; am->reg != NULL; am++) {
+        const DetectMpmAppLayerRegistery *reg = am->reg;
+        if (!reg->batchable || am->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+            continue;
+
+        DetectMpmAppLayerBatch *b = NULL;
+        for (uint32_t i = 0; i < cnt; i++) {
+            if (batches[i].alproto == reg->v2.alproto &&
+                    batches[i].direction == reg->direction &&
+                    batches[i].tx_min_progress == reg->v2.tx_min_progress) {
+                b = &batches[i];
+                break;
+            }
+        }
+        if (b == NULL) {
+            b = &batches[cnt];
+            b->alproto = reg->v2.alproto;
+            b->direction = reg->direction;
+            b->tx_min_progress = reg->v2.tx_min_progress;
+            b->id = cnt++;
+        }
+        if (b->cnt < DETECT_MPM_BATCH_MAX)
+            b->regs[b->cnt++] = reg;
+    }
+
+    /* drop the batches of one buffer, keeping the ids the index */
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (batches[i].cnt < 2)
+            continue;
+        DetectMpmAppLayerBatch *b = &batches[n];
+        if (i != n)
+            *b = batches[i];
+        b->id = n++;
+
+        for (uint32_t j = 0; j < b->cnt; j++) {
+            if (j > 0)
+                strlcat(b->pname, "+", sizeof(b->pname));
+            strlcat(b->pname, b->regs[j]->pname, sizeof(b->pname));
+        }
+    }
+    if (n == 0) {
+        SCFree(batches);
+        return;
+    }
+
+    de_ctx->app_mpm_batches = batches;
+    de_ctx->app_mpm_batches_cnt = n;
+    for (uint32_t i = 0; i < n; i++) {
+        DetectMpmAppLayerBatch *b = &batches[i];
+        for (uint32_t j = 0; j < b->cnt; j++) {
+            de_ctx->app_mpms[b->regs[j]->id].batch = b;
+        }
+        if (!(de_ctx->flags & DE_QUIET)) {
+            SCLogPerf("using one mpm search for %s %s",
+                    b->direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient",
+                    b->pname);
+        }
+    }
+}
+
 void DetectMpmSetupAppMpms(DetectEngineCtx *de_ctx)
 {
     BUG_ON(de_ctx->app_mpms_list_cnt == 0);
@@ -278,6 +376,9 @@ void DetectMpmSetupAppMpms(DetectEngineCtx *de_ctx)
 
         list = list->next;
     }
+
+    if (de_ctx->prefilter_batch)
+        DetectMpmSetupAppMpmBatches(de_ctx);
 }
 
 /**
@@ -489,14 +590,10 @@ uint16_t PatternMatchDefaultMatcher(void)
             if (strcmp("auto", mpm_algo) == 0) {
                 goto done;
             }
-            for (u = 0; u < MPM_TABLE_SIZE; u++) {
-                if (mpm_table[u].name == NULL)
-                    continue;
-
-                if (strcmp(mpm_table[u].name, mpm_algo) == 0) {
-                    mpm_algo_val = u;
-                    goto done;
-                }
+            u = PatternMatchMatcherByName(mpm_algo);
+            if (u != MPM_NOTSET) {
+                mpm_algo_val = u;
+                goto done;
             }
         }
 
@@ -509,6 +606,31 @@ uint16_t PatternMatchDefaultMatcher(void)
     return mpm_algo_val;
 }
 
+/** \brief look up a matcher by its mpm-algo name
+ *  \retval MPM_NOTSET if there is no matcher of that name */
+uint16_t PatternMatchMatcherByName(const char *name)
+{
+    for (uint16_t u = 0; u < MPM_TABLE_SIZE; u++) {
+        if (mpm_table[u].name == NULL)
+            continue;
+        if (strcmp(mpm_table[u].name, name) == 0)
+            return u;
+    }
+    return MPM_NOTSET;
+}
+
+/** \brief matcher to prepare the mpm thread ctx of a detect thread for
+ *
+ *  Hyperscan is the only matcher that uses its thread ctx, the scratch, in
+ *  the search. The others ignore it, so once a store uses hyperscan the
+ *  one thread ctx is prepared for hyperscan. */
+uint16_t PatternMatchThreadMatcher(const DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_matchers_used & BIT_U32(MPM_HS))
+        return MPM_HS;
+    return de_ctx->mpm_matcher;
+}
+
 /** \brief cleans up the mpm instance after a match */
 void PacketPatternCleanup(DetectEngineThreadCtx *det_ctx)
 {
@@ -576,47 +698,56 @@ uint32_t PatternStrength(uint8_t *pat, uint16_t patlen)
     return s;
 }
 
-static void PopulateMpmHelperAddPattern(MpmCtx *mpm_ctx,
-                                        const DetectContentData *cd,
-                                        const Signature *s, uint8_t flags,
-                                        int chop)
+/** \internal
+ *  \brief get the pattern, offset and depth a content adds to the mpm,
+ *         taking fast_pattern:only chopping into account */
+static void PopulateMpmHelperGetPattern(const DetectContentData *cd, int chop,
+        const uint8_t **pat, uint16_t *pat_len,
+        uint16_t *pat_offset, uint16_t *pat_depth)
 {
-    uint16_t pat_offset = cd->offset;
-    uint16_t pat_depth = cd->depth;
+    *pat_offset = cd->offset;
+    *pat_depth = cd->depth;
 
     /* recompute offset/depth to cope with chop */
-    if (chop && (pat_depth || pat_offset)) {
-        pat_offset += cd->fp_chop_offset;
-        if (pat_depth) {
-            pat_depth -= cd->content_len;
-            pat_depth += cd->fp_chop_offset + cd->fp_chop_len;
+    if (chop && (*pat_depth || *pat_offset)) {
+        *pat_offset += cd->fp_chop_offset;
+        if (*pat_depth) {
+            *pat_depth -= cd->content_len;
+            *pat_depth += cd->fp_chop_offset + cd->fp_chop_len;
         }
     }
 
+    if (chop) {
+        *pat = cd->content + cd->fp_chop_offset;
+        *pat_len = cd->fp_chop_len;
+    } else {
+        *pat = cd->content;
+        *pat_len = cd->content_len;
+    }
+}
+
+/** \param anywhere ignore offset and depth, for a ctx searched over
+ *         several buffers, where offsets are into their concatenation */
+static void PopulateMpmHelperAddPattern(MpmCtx *mpm_ctx,
+                                        const DetectContentData *cd,
+                                        const Signature *s, uint8_t flags,
+                                        int chop, bool anywhere)
+{
+    const uint8_t *pat;
+    uint16_t pat_len, pat_offset, pat_depth;
+    PopulateMpmHelperGetPattern(cd, chop, &pat, &pat_len, &pat_offset, &pat_depth);
+    if (anywhere) {
+        pat_offset = pat_depth = 0;
+    }
+
     if (cd->flags & DETECT_CONTENT_NOCASE) {
-        if (chop) {
-            MpmAddPatternCI(mpm_ctx,
-                            cd->content + cd->fp_chop_offset, cd->fp_chop_len,
-                            pat_offset, pat_depth,
-                            cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
-        } else {
-            MpmAddPatternCI(mpm_ctx,
-                            cd->content, cd->content_len,
-                            pat_offset, pat_depth,
-                            cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
-        }
+        MpmAddPatternCI(mpm_ctx, (uint8_t *)pat, pat_len,
+                        pat_offset, pat_depth,
+                        cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
     } else {
-        if (chop) {
-            MpmAddPatternCS(mpm_ctx,
-                            cd->content + cd->fp_chop_offset, cd->fp_chop_len,
-                            pat_offset, pat_depth,
-                            cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
-        } else {
-            MpmAddPatternCS(mpm_ctx,
-                            cd->content, cd->content_len,
-                            pat_offset, pat_depth,
-                            cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
-        }
+        MpmAddPatternCS(mpm_ctx, (uint8_t *)pat, pat_len,
+                        pat_offset, pat_depth,
+                        cd->id, s->num, flags|MPM_PATTERN_CTX_OWNS_ID);
     }
 
     return;
@@ -689,6 +820,58 @@ static SigMatch *GetMpmForList(const Signature *s, const int list, SigMatch *mpm
     return mpm_sm;
 }
 
+/** \internal
+ *  \brief move the fast pattern away from a pattern that hits a lot
+ *
+ *  Uses the rates of the fast pattern stats. Another pattern is only used
+ *  if its rate is below half of the rate of the current pattern. A pattern
+ *  without a rate hasn't been a fast pattern yet, it counts as 0 so it will
+ *  get measured.
+ */
+static SigMatch *GetMpmByStats(const DetectEngineCtx *de_ctx, const Signature *s,
+        const int *final_sm_list, int count_final_sm_list, uint16_t max_len,
+        SigMatch *mpm_sm)
+{
+    double rate;
+    const DetectContentData *mpm_cd = (DetectContentData *)mpm_sm->ctx;
+    if (!DetectFPStatsGetRate(de_ctx, SigMatchListSMBelongsTo(s, mpm_sm),
+                mpm_cd, &rate))
+        return mpm_sm;
+
+    /* don't trade the pattern for a very short one */
+    const uint16_t min_len = MIN(max_len, 4);
+    SigMatch *best_sm = mpm_sm;
+    double best_rate = rate / 2;
+    for (int i = 0; i < count_final_sm_list; i++) {
+        if (final_sm_list[i] >= (int)s->init_data->smlists_array_size)
+            continue;
+
+        for (SigMatch *sm = s->init_data->smlists[final_sm_list[i]]; sm != NULL; sm = sm->next) {
+            if (sm->type != DETECT_CONTENT || sm == mpm_sm)
+                continue;
+
+            const DetectContentData *cd = (DetectContentData *)sm->ctx;
+            if ((cd->flags & DETECT_CONTENT_NEGATED) || cd->content_len < min_len)
+                continue;
+
+            double cand_rate = 0;
+            (void)DetectFPStatsGetRate(de_ctx, final_sm_list[i], cd, &cand_rate);
+            const DetectContentData *best_cd = (DetectContentData *)best_sm->ctx;
+            if (cand_rate < best_rate ||
+                    (best_sm != mpm_sm && cand_rate == best_rate &&
+                     cd->content_len > best_cd->content_len)) {
+                best_sm = sm;
+                best_rate = cand_rate;
+            }
+        }
+    }
+    if (best_sm != mpm_sm) {
+        SCLogDebug("sig %u: fast pattern with rate %f replaced by one with "
+                "rate %f", s->id, rate, best_rate);
+    }
+    return best_sm;
+}
+
 void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s)
 {
     if (s->init_data->mpm_sm != NULL)
@@ -795,11 +978,130 @@ void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s)
         mpm_sm = GetMpmForList(s, final_sm_list[i], mpm_sm, max_len, skip_negated_content);
     }
 
+    if (de_ctx->fp_stats != NULL && skip_negated_content && mpm_sm != NULL) {
+        mpm_sm = GetMpmByStats(de_ctx, s, final_sm_list, count_final_sm_list,
+                max_len, mpm_sm);
+    }
+
     /* assign to signature */
     SetMpm(s, mpm_sm);
     return;
 }
 
+/* Prepared unique mpm contexts are kept in a global table keyed on their
+ * content: the matcher and every pattern with its id and sid. Engines with
+ * the same rule groups, like tenants loading the same ruleset or the new
+ * engine of a reload, use the context of the first one instead of building
+ * and compiling their own copy. */
+
+#define MPM_CTX_CACHE_SIZE 4096
+
+typedef struct MpmCtxCacheEntry_ {
+    uint8_t *key;
+    uint32_t key_len;
+    uint32_t hash;
+    /** number of mpm stores using the ctx, over all engines */
+    uint32_t refcnt;
+    MpmCtx *mpm_ctx;
+    struct MpmCtxCacheEntry_ *next;
+} MpmCtxCacheEntry;
+
+static SCMutex g_mpm_ctx_cache_lock = SCMUTEX_INITIALIZER;
+static MpmCtxCacheEntry *g_mpm_ctx_cache[MPM_CTX_CACHE_SIZE];
+
+static MpmCtxCacheEntry *MpmCtxCacheLookup(const uint8_t *key, uint32_t key_len,
+        uint32_t hash)
+{
+    MpmCtxCacheEntry *e = g_mpm_ctx_cache[hash % MPM_CTX_CACHE_SIZE];
+    for ( ; e != NULL; e = e->next) {
+        if (e->hash == hash && e->key_len == key_len &&
+                memcmp(e->key, key, key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief get a reference to the cached ctx for the store's key
+ *  \retval 1 ms uses the cached ctx
+ *  \retval 0 not in the cache */
+static int MpmCtxCacheGet(MpmStore *ms)
+{
+    SCMutexLock(&g_mpm_ctx_cache_lock);
+    MpmCtxCacheEntry *e = MpmCtxCacheLookup(ms->cache_key, ms->cache_key_len,
+            ms->cache_hash);
+    if (e != NULL) {
+        e->refcnt++;
+        ms->mpm_ctx = e->mpm_ctx;
+        ms->cache_entry = e;
+        ms->shared = true;
+    }
+    SCMutexUnlock(&g_mpm_ctx_cache_lock);
+
+    if (e == NULL)
+        return 0;
+
+    SCFree(ms->cache_key);
+    ms->cache_key = NULL;
+    return 1;
+}
+
+/** \internal
+ *  \brief hand the prepared ctx of the store over to the cache
+ *
+ *  If an engine built in parallel added the same ctx first, the store
+ *  keeps its own copy. */
+static void MpmCtxCacheAdd(MpmStore *ms)
+{
+    MpmCtxCacheEntry *e = SCCalloc(1, sizeof(*e));
+    if (unlikely(e == NULL))
+        return;
+    e->key = ms->cache_key;
+    e->key_len = ms->cache_key_len;
+    e->hash = ms->cache_hash;
+    e->refcnt = 1;
+    e->mpm_ctx = ms->mpm_ctx;
+
+    SCMutexLock(&g_mpm_ctx_cache_lock);
+    if (MpmCtxCacheLookup(e->key, e->key_len, e->hash) != NULL) {
+        SCMutexUnlock(&g_mpm_ctx_cache_lock);
+        SCFree(e);
+        return;
+    }
+    const uint32_t idx = e->hash % MPM_CTX_CACHE_SIZE;
+    e->next = g_mpm_ctx_cache[idx];
+    g_mpm_ctx_cache[idx] = e;
+    SCMutexUnlock(&g_mpm_ctx_cache_lock);
+
+    ms->cache_key = NULL;
+    ms->cache_entry = e;
+}
+
+/** \internal
+ *  \brief drop the store's reference, the ctx is freed with the last one */
+static void MpmCtxCacheRelease(MpmStore *ms)
+{
+    MpmCtxCacheEntry *e = ms->cache_entry;
+    ms->cache_entry = NULL;
+
+    SCMutexLock(&g_mpm_ctx_cache_lock);
+    if (--e->refcnt > 0) {
+        SCMutexUnlock(&g_mpm_ctx_cache_lock);
+        return;
+    }
+    MpmCtxCacheEntry **pe = &g_mpm_ctx_cache[e->hash % MPM_CTX_CACHE_SIZE];
+    while (*pe != e)
+        pe = &(*pe)->next;
+    *pe = e->next;
+    SCMutexUnlock(&g_mpm_ctx_cache_lock);
+
+    SCLogDebug("destroying shared mpm_ctx %p", e->mpm_ctx);
+    mpm_table[e->mpm_ctx->mpm_type].DestroyCtx(e->mpm_ctx);
+    SCFree(e->mpm_ctx);
+    SCFree(e->key);
+    SCFree(e);
+}
+
 /** \internal
  *  \brief The hash function for MpmStore
  *
@@ -850,6 +1152,9 @@ static char MpmStoreCompareFunc(void *data1, uint16_t len1, void *data2,
     if (ms1->sm_list != ms2->sm_list)
         return 0;
 
+    if (ms1->batch != ms2->batch)
+        return 0;
+
     if (SCMemcmp(ms1->sid_array, ms2->sid_array,
                  ms1->sid_array_size) != 0)
     {
@@ -863,7 +1168,9 @@ static void MpmStoreFreeFunc(void *ptr)
 {
     MpmStore *ms = ptr;
     if (ms != NULL) {
-        if (ms->mpm_ctx != NULL && !(ms->mpm_ctx->flags & MPMCTX_FLAGS_GLOBAL))
+        if (ms->cache_entry != NULL) {
+            MpmCtxCacheRelease(ms);
+        } else if (ms->mpm_ctx != NULL && !(ms->mpm_ctx->flags & MPMCTX_FLAGS_GLOBAL))
         {
             SCLogDebug("destroying mpm_ctx %p", ms->mpm_ctx);
             mpm_table[ms->mpm_ctx->mpm_type].DestroyCtx(ms->mpm_ctx);
@@ -871,6 +1178,8 @@ static void MpmStoreFreeFunc(void *ptr)
         }
         ms->mpm_ctx = NULL;
 
+        if (ms->cache_key != NULL)
+            SCFree(ms->cache_key);
         SCFree(ms->sid_array);
         SCFree(ms);
     }
@@ -930,6 +1239,38 @@ static MpmStore *MpmStoreLookup(DetectEngineCtx *de_ctx, MpmStore *s)
     return rs;
 }
 
+/**
+ * \brief Get a printable name for a mpm store, like "toserver TCP packet"
+ *        or "toserver http_uri".
+ */
+void MpmStoreGetName(const DetectEngineCtx *de_ctx, const MpmStore *ms,
+        char *str, size_t size)
+{
+    if (ms->buffer < MPMB_MAX) {
+        strlcpy(str, builtin_mpms[ms->buffer], size);
+        return;
+    }
+    if (ms->batch != NULL) {
+        snprintf(str, size, "%s %s",
+                ms->direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient",
+                ms->batch->pname);
+        return;
+    }
+
+    const DetectMpmAppLayerKeyword *am = de_ctx->app_mpms;
+    while (am->reg != NULL) {
+        if (ms->sm_list == am->reg->sm_list &&
+                ms->direction == am->reg->direction) {
+            snprintf(str, size, "%s %s",
+                    am->reg->direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient",
+                    am->reg->name);
+            return;
+        }
+        am++;
+    }
+    snprintf(str, size, "list %d", ms->sm_list);
+}
+
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
 {
     HashListTableBucket *htb = NULL;
@@ -943,6 +1284,9 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
     uint32_t stats[MPMB_MAX] = {0};
     uint32_t appstats[app_mpms_cnt + 1];    // +1 to silence scan-build
     memset(&appstats, 0x00, sizeof(appstats));
+    uint32_t shared = 0;
+    uint32_t batches = 0;
+    uint32_t matchers[MPM_TABLE_SIZE] = {0};
 
     for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
             htb != NULL;
@@ -952,8 +1296,14 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
         if (ms == NULL) {
             continue;
         }
+        if (ms->shared)
+            shared++;
+        if (ms->mpm_ctx != NULL)
+            matchers[ms->mpm_ctx->mpm_type]++;
         if (ms->buffer < MPMB_MAX)
             stats[ms->buffer]++;
+        else if (ms->batch != NULL)
+            batches++;
         else if (ms->sm_list != DETECT_SM_LIST_PMATCH) {
             int i = 0;
             DetectMpmAppLayerKeyword *am = de_ctx->app_mpms;
@@ -988,7 +1338,168 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
             const char *direction = de_ctx->app_mpms[x].reg->direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient";
             SCLogPerf("AppLayer MPM \"%s %s\": %u", direction, name, appstats[x]);
         }
+        if (batches > 0) {
+            SCLogPerf("AppLayer MPM batches: %u", batches);
+        }
+        if (shared > 0) {
+            SCLogPerf("MPM contexts shared with other detection engines: %u", shared);
+        }
+        for (x = 0; x < MPM_TABLE_SIZE; x++) {
+            if (matchers[x] == 0)
+                continue;
+            SCLogPerf("MPM contexts using \"%s\": %u", mpm_table[x].name, matchers[x]);
+        }
+    }
+}
+
+/** upper limit for detect.mpm-prepare-threads: auto */
+#define MPM_PREPARE_THREADS_MAX 16
+
+typedef struct MpmPrepareCtx_ {
+    MpmStore **stores;
+    uint32_t cnt;
+    SC_ATOMIC_DECLARE(uint32_t, next);
+    SC_ATOMIC_DECLARE(int, failed);
+} MpmPrepareCtx;
+
+static void *MpmStorePrepareThread(void *arg)
+{
+    MpmPrepareCtx *pctx = arg;
+
+    while (1) {
+        const uint32_t i = SC_ATOMIC_ADD(pctx->next, 1) - 1;
+        if (i >= pctx->cnt)
+            break;
+        MpmStore *ms = pctx->stores[i];
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        if (mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx) != 0) {
+            SC_ATOMIC_SET(pctx->failed, 1);
+        }
+        gettimeofday(&end, NULL);
+        ms->prepare_usecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_usec - start.tv_usec);
     }
+    return NULL;
+}
+
+static uint32_t MpmStorePrepareThreads(void)
+{
+    uint32_t threads = 0;
+    const char *str = NULL;
+    if (ConfGet("detect.mpm-prepare-threads", &str) == 1 && str != NULL &&
+            strcmp(str, "auto") != 0) {
+        intmax_t value = 0;
+        if (ConfGetInt("detect.mpm-prepare-threads", &value) != 1 ||
+                value < 1 || value > MPM_PREPARE_THREADS_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value for "
+                    "detect.mpm-prepare-threads: %s, using \"auto\"", str);
+        } else {
+            threads = (uint32_t)value;
+        }
+    }
+    if (threads == 0) {
+        threads = UtilCpuGetNumProcessorsOnline();
+        if (threads == 0)
+            threads = 1;
+        else if (threads > MPM_PREPARE_THREADS_MAX)
+            threads = MPM_PREPARE_THREADS_MAX;
+    }
+    return threads;
+}
+
+/**
+ * \brief Prepare the mpm contexts of the unique (per sgh) mpm stores.
+ *
+ * The contexts are independent of each other, so they are prepared by a
+ * number of short lived threads: compiling the patterns is the largest part
+ * of the rule group build with big rulesets.
+ *
+ * \retval 0 on success
+ * \retval -1 if preparing one of the contexts failed
+ */
+int MpmStorePrepareAll(DetectEngineCtx *de_ctx)
+{
+    HashListTableBucket *htb = NULL;
+    uint32_t cnt = 0;
+
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL)
+            continue;
+        de_ctx->mpm_matchers_used |= BIT_U32(ms->mpm_ctx->mpm_type);
+        if (ms->cache_entry == NULL &&
+                ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+                mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL)
+            cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    MpmPrepareCtx pctx;
+    memset(&pctx, 0, sizeof(pctx));
+    pctx.stores = SCMalloc(cnt * sizeof(MpmStore *));
+    if (pctx.stores == NULL)
+        return -1;
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms != NULL && ms->mpm_ctx != NULL && ms->cache_entry == NULL &&
+                ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+                mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL)
+            pctx.stores[pctx.cnt++] = ms;
+    }
+    SC_ATOMIC_INIT(pctx.next);
+    SC_ATOMIC_INIT(pctx.failed);
+
+    uint32_t threads = MpmStorePrepareThreads();
+    if (threads > cnt)
+        threads = cnt;
+    SCLogDebug("preparing %u mpm contexts with %u threads", cnt, threads);
+
+    /* the calling thread takes part as well */
+    pthread_t tids[MPM_PREPARE_THREADS_MAX];
+    uint32_t started = 0;
+    for (uint32_t i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, MpmStorePrepareThread,
+                    &pctx) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "failed to create mpm "
+                    "prepare thread: %s", strerror(errno));
+            break;
+        }
+        started++;
+    }
+    MpmStorePrepareThread(&pctx);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    const int failed = SC_ATOMIC_GET(pctx.failed);
+    SC_ATOMIC_DESTROY(pctx.next);
+    SC_ATOMIC_DESTROY(pctx.failed);
+    SCFree(pctx.stores);
+
+    if (failed) {
+        SCLogError(SC_ERR_INITIALIZATION, "failed to prepare the mpm "
+                "contexts of the rule groups");
+        return -1;
+    }
+
+    /* the contexts are complete now, so other engines can use them */
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms != NULL && ms->mpm_ctx != NULL && ms->cache_key != NULL)
+            MpmCtxCacheAdd(ms);
+    }
+    return 0;
 }
 
 /**
@@ -1007,6 +1518,187 @@ void MpmStoreFree(DetectEngineCtx *de_ctx)
     return;
 }
 
+/** \internal
+ *  \brief get the index of a list in a batch
+ *
+ *  \retval idx or -1 if the list is not part of the batch */
+static int DetectMpmBatchGetIdx(const DetectMpmAppLayerBatch *batch, const int list)
+{
+    for (uint32_t i = 0; i < batch->cnt; i++) {
+        if (batch->regs[i]->sm_list == list)
+            return (int)i;
+    }
+    return -1;
+}
+
+/** \internal
+ *  \brief get the pattern a sig adds to a store
+ *
+ *  \retval cd the pattern or NULL if the sig doesn't add one */
+static const DetectContentData *MpmStoreSigPattern(const MpmStore *ms,
+        const Signature *s)
+{
+    if (s == NULL)
+        return NULL;
+    if ((s->flags & ms->direction) == 0)
+        return NULL;
+    if (s->init_data->mpm_sm == NULL)
+        return NULL;
+    int list = SigMatchListSMBelongsTo(s, s->init_data->mpm_sm);
+    if (list < 0)
+        return NULL;
+    if (ms->batch != NULL) {
+        if (DetectMpmBatchGetIdx(ms->batch, list) < 0)
+            return NULL;
+    } else if (list != ms->sm_list) {
+        return NULL;
+    }
+
+    const DetectContentData *cd = (DetectContentData *)s->init_data->mpm_sm->ctx;
+
+    /* negated logic: if mpm match can't be used to be sure about this
+     * pattern, we have to inspect the rule fully regardless of mpm
+     * match. So in this case there is no point of adding it at all.
+     * The non-mpm list entry for the sig will make sure the sig is
+     * inspected. */
+    if ((cd->flags & DETECT_CONTENT_NEGATED) &&
+        !(DETECT_CONTENT_MPM_IS_CONCLUSIVE(cd)))
+    {
+        SCLogDebug("not adding negated mpm as it's not 'single'");
+        return NULL;
+    }
+    return cd;
+}
+
+/** \internal
+ *  \brief pick the matcher for a store
+ *
+ *  A unique mpm ctx with few patterns uses the teddy matcher, as the
+ *  state tables of ac and the per call overhead of hyperscan cost more
+ *  than a few shuffles per block of data. Teddy masks no more bytes than
+ *  the shortest pattern has, so a 1 byte pattern leaves it a single mask
+ *  that hits all over the data.
+ *
+ *  The state table of ac grows with the pattern bytes, and with it the
+ *  cache misses per scanned byte, so a ctx with many pattern bytes uses
+ *  detect.mpm-algo-large if set. Its setup and per call cost pays off
+ *  sooner over the packet and stream data than over the short app-layer
+ *  buffers, which need MPM_LARGE_APP_FACTOR times the bytes. */
+static uint16_t MpmStoreGetMatcher(const DetectEngineCtx *de_ctx, const MpmStore *ms)
+{
+    if (ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+        return de_ctx->mpm_matcher;
+
+    /* upper bound of the unique patterns and their bytes */
+    uint32_t cnt = 0;
+    uint32_t bytes = 0;
+    uint16_t minlen = UINT16_MAX;
+    for (uint32_t sig = 0; sig < (ms->sid_array_size * 8); sig++) {
+        if (!(ms->sid_array[sig / 8] & (1 << (sig % 8))))
+            continue;
+        const DetectContentData *cd = MpmStoreSigPattern(ms, de_ctx->sig_array[sig]);
+        if (cd == NULL)
+            continue;
+
+        const uint8_t *pat;
+        uint16_t len, offset, depth;
+        PopulateMpmHelperGetPattern(cd, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP),
+                &pat, &len, &offset, &depth);
+        cnt++;
+        bytes += len;
+        if (len < minlen)
+            minlen = len;
+    }
+    if (cnt == 0)
+        return de_ctx->mpm_matcher;
+
+    if (cnt <= de_ctx->mpm_teddy_max_patterns && minlen > 1 &&
+            mpm_table[MPM_TEDDY].Search != NULL)
+        return MPM_TEDDY;
+
+    if (de_ctx->mpm_matcher_large != MPM_NOTSET) {
+        uint32_t large = de_ctx->mpm_large_pattern_bytes;
+        if (ms->buffer == MPMB_MAX)
+            large *= MPM_LARGE_APP_FACTOR;
+        if (bytes >= large)
+            return de_ctx->mpm_matcher_large;
+    }
+    return de_ctx->mpm_matcher;
+}
+
+/** \internal
+ *  \brief build the mpm ctx cache key of a store
+ *
+ *  The key is the matcher and whether the ctx is of a batch, followed by
+ *  the patterns the ctx would be built from, with everything
+ *  MpmAddPattern*() takes.
+ *
+ *  \retval 0 ms->cache_key is set
+ *  \retval -1 no patterns or out of memory */
+static int MpmStoreSetupCacheKey(const DetectEngineCtx *de_ctx, MpmStore *ms,
+        const uint16_t matcher)
+{
+    struct MpmCtxCacheKeyPattern {
+        uint32_t pid;
+        SigIntId sid;
+        uint16_t len;
+        uint16_t offset;
+        uint16_t depth;
+        uint16_t nocase;
+    } kp;
+    uint32_t size = 256;
+    uint32_t len = 0;
+    uint8_t *key = SCMalloc(size);
+    if (unlikely(key == NULL))
+        return -1;
+    memcpy(key, &matcher, sizeof(matcher));
+    key[sizeof(matcher)] = (ms->batch != NULL);
+    const uint32_t header_len = sizeof(matcher) + 1;
+    len = header_len;
+
+    for (uint32_t sig = 0; sig < (ms->sid_array_size * 8); sig++) {
+        if (!(ms->sid_array[sig / 8] & (1 << (sig % 8))))
+            continue;
+        const Signature *s = de_ctx->sig_array[sig];
+        const DetectContentData *cd = MpmStoreSigPattern(ms, s);
+        if (cd == NULL)
+            continue;
+
+        const uint8_t *pat;
+        memset(&kp, 0, sizeof(kp));
+        PopulateMpmHelperGetPattern(cd, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP),
+                &pat, &kp.len, &kp.offset, &kp.depth);
+        if (ms->batch != NULL)
+            kp.offset = kp.depth = 0;
+        kp.pid = cd->id;
+        kp.sid = s->num;
+        kp.nocase = (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0;
+
+        if (len + sizeof(kp) + kp.len > size) {
+            size = (len + sizeof(kp) + kp.len) * 2;
+            uint8_t *nkey = SCRealloc(key, size);
+            if (unlikely(nkey == NULL)) {
+                SCFree(key);
+                return -1;
+            }
+            key = nkey;
+        }
+        memcpy(key + len, &kp, sizeof(kp));
+        len += sizeof(kp);
+        memcpy(key + len, pat, kp.len);
+        len += kp.len;
+    }
+
+    if (len == header_len) {
+        SCFree(key);
+        return -1;
+    }
+    ms->cache_key = key;
+    ms->cache_key_len = len;
+    ms->cache_hash = hashlittle_safe(key, len, 0);
+    return 0;
+}
+
 static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
 {
     const Signature *s = NULL;
@@ -1045,61 +1737,44 @@ static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
             dir = 0;
     }
 
+    const uint16_t matcher = MpmStoreGetMatcher(de_ctx, ms);
+    if (de_ctx->mpm_ctx_sharing &&
+            ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+            mpm_table[matcher].Prepare != NULL &&
+            MpmStoreSetupCacheKey(de_ctx, ms, matcher) == 0 &&
+            MpmCtxCacheGet(ms) == 1) {
+        SCLogDebug("using shared mpm_ctx %p", ms->mpm_ctx);
+        return;
+    }
+
     ms->mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, ms->sgh_mpm_context, dir);
     if (ms->mpm_ctx == NULL)
         return;
 
-    MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    SCLogDebug("mpm store %p uses %s", ms, mpm_table[matcher].name);
+    MpmInitCtx(ms->mpm_ctx, matcher);
+    if (ms->batch != NULL)
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_VECTOR;
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
         if (ms->sid_array[sig / 8] & (1 << (sig % 8))) {
             s = de_ctx->sig_array[sig];
-            if (s == NULL)
-                continue;
-            if ((s->flags & ms->direction) == 0)
-                continue;
-            if (s->init_data->mpm_sm == NULL)
-                continue;
-            int list = SigMatchListSMBelongsTo(s, s->init_data->mpm_sm);
-            if (list < 0)
-                continue;
-            if (list != ms->sm_list)
+            const DetectContentData *cd = MpmStoreSigPattern(ms, s);
+            if (cd == NULL)
                 continue;
 
             SCLogDebug("adding %u", s->id);
-
-            const DetectContentData *cd = (DetectContentData *)s->init_data->mpm_sm->ctx;
-
-            int skip = 0;
-            /* negated logic: if mpm match can't be used to be sure about this
-             * pattern, we have to inspect the rule fully regardless of mpm
-             * match. So in this case there is no point of adding it at all.
-             * The non-mpm list entry for the sig will make sure the sig is
-             * inspected. */
-            if ((cd->flags & DETECT_CONTENT_NEGATED) &&
-                !(DETECT_CONTENT_MPM_IS_CONCLUSIVE(cd)))
-            {
-                skip = 1;
-                SCLogDebug("not adding negated mpm as it's not 'single'");
-            }
-
-            if (!skip) {
-                PopulateMpmHelperAddPattern(ms->mpm_ctx,
-                        cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP));
-            }
+            PopulateMpmHelperAddPattern(ms->mpm_ctx,
+                    cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP),
+                    ms->batch != NULL);
         }
     }
 
+    /* unique contexts are prepared by MpmStorePrepareAll() */
     if (ms->mpm_ctx->pattern_cnt == 0) {
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
-    } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
-        }
     }
 }
 
@@ -1233,10 +1908,11 @@ MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
 
         MpmStoreSetup(de_ctx, copy);
         MpmStoreAdd(de_ctx, copy);
-        return copy;
-    } else {
-        return result;
+        result = copy;
     }
+    result->sgh_cnt++;
+    sgh->init->mpm_store[buf] = result;
+    return result;
 }
 
 static MpmStore *MpmStorePrepareBufferAppLayer(DetectEngineCtx *de_ctx,
@@ -1309,12 +1985,78 @@ static MpmStore *MpmStorePrepareBufferAppLayer(DetectEngineCtx *de_ctx,
 
         MpmStoreSetup(de_ctx, copy);
         MpmStoreAdd(de_ctx, copy);
-        return copy;
+        result = copy;
     } else {
         SCLogDebug("using existing mpm %p", result);
-        return result;
     }
-    return NULL;
+    result->sgh_cnt++;
+    return result;
+}
+
+/** \internal
+ *  \brief get the MpmStore of the buffers of a batch
+ *
+ *  \retval store or NULL if less than two buffers of the batch have
+ *          patterns in the group, then the buffers use their own */
+static MpmStore *MpmStorePrepareBufferBatch(DetectEngineCtx *de_ctx,
+        SigGroupHead *sgh, const DetectMpmAppLayerBatch *batch)
+{
+    uint32_t lists = 0;
+    uint32_t max_sid = DetectEngineGetMaxSigId(de_ctx) / 8 + 1;
+    uint8_t sids_array[max_sid];
+    memset(sids_array, 0x00, max_sid);
+
+    for (uint32_t sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->init_data->mpm_sm == NULL)
+            continue;
+        if ((s->flags & batch->direction) == 0)
+            continue;
+
+        int list = SigMatchListSMBelongsTo(s, s->init_data->mpm_sm);
+        if (list < 0)
+            continue;
+        int idx = DetectMpmBatchGetIdx(batch, list);
+        if (idx < 0)
+            continue;
+
+        sids_array[s->num / 8] |= 1 << (s->num % 8);
+        lists |= BIT_U32(idx);
+    }
+
+    if (lists == 0 || (lists & (lists - 1)) == 0)
+        return NULL;
+
+    MpmStore lookup = { sids_array, max_sid, batch->direction,
+        MPMB_MAX, -1, 0, NULL};
+    lookup.batch = batch;
+
+    MpmStore *result = MpmStoreLookup(de_ctx, &lookup);
+    if (result == NULL) {
+        MpmStore *copy = SCCalloc(1, sizeof(MpmStore));
+        if (copy == NULL)
+            return NULL;
+        uint8_t *sids = SCCalloc(1, max_sid);
+        if (sids == NULL) {
+            SCFree(copy);
+            return NULL;
+        }
+
+        memcpy(sids, sids_array, max_sid);
+        copy->sid_array = sids;
+        copy->sid_array_size = max_sid;
+        copy->buffer = MPMB_MAX;
+        copy->direction = batch->direction;
+        copy->sm_list = -1;
+        copy->sgh_mpm_context = MPM_CTX_FACTORY_UNIQUE_CONTEXT;
+        copy->batch = batch;
+
+        MpmStoreSetup(de_ctx, copy);
+        MpmStoreAdd(de_ctx, copy);
+        result = copy;
+    }
+    result->sgh_cnt++;
+    return result;
 }
 
 static void SetRawReassemblyFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
@@ -1398,17 +2140,43 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
     if (i == 0)
         return 0;
 
-    sh->init->app_mpms = SCCalloc(i, sizeof(MpmCtx *));
+    sh->init->app_mpms = SCCalloc(i, sizeof(MpmStore *));
     BUG_ON(sh->init->app_mpms == NULL);
 
+    /* batches used by this group, their buffers have no engine of their
+     * own. The store is listed under the first buffer of the batch. */
+    bool batched[de_ctx->app_mpm_batches_cnt + 1];
+    memset(batched, 0, sizeof(batched));
+    for (uint32_t b = 0; b < de_ctx->app_mpm_batches_cnt; b++) {
+        const DetectMpmAppLayerBatch *batch = &de_ctx->app_mpm_batches[b];
+        if (!((batch->direction == SIG_FLAG_TOSERVER && SGH_DIRECTION_TS(sh)) ||
+              (batch->direction == SIG_FLAG_TOCLIENT && SGH_DIRECTION_TC(sh))))
+            continue;
+
+        mpm_store = MpmStorePrepareBufferBatch(de_ctx, sh, batch);
+        if (mpm_store == NULL)
+            continue;
+        batched[b] = true;
+        sh->init->app_mpms[batch->regs[0]->id] = mpm_store;
+        if (mpm_store->mpm_ctx != NULL) {
+            BUG_ON(PrefilterBatchMpmRegister(de_ctx, sh, mpm_store->mpm_ctx,
+                        batch) != 0);
+            SCLogDebug("mpm batch %s set up", batch->pname);
+        }
+    }
+
     a = de_ctx->app_mpms;
     while (a->reg != NULL) {
+        if (a->batch != NULL && batched[a->batch->id]) {
+            a++;
+            continue;
+        }
         if ((a->reg->direction == SIG_FLAG_TOSERVER && SGH_DIRECTION_TS(sh)) ||
             (a->reg->direction == SIG_FLAG_TOCLIENT && SGH_DIRECTION_TC(sh)))
         {
             mpm_store = MpmStorePrepareBufferAppLayer(de_ctx, sh, a);
             if (mpm_store != NULL) {
-                sh->init->app_mpms[a->reg->id] = mpm_store->mpm_ctx;
+                sh->init->app_mpms[a->reg->id] = mpm_store;
 
                 SCLogDebug("a->reg->PrefilterRegister %p mpm_store->mpm_ctx %p",
                         a->reg->PrefilterRegister, mpm_store->mpm_ctx);
@@ -1460,6 +2228,8 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
     uint32_t content_total_size = 0;
     Signature *s = NULL;
 
+    DetectFPStatsSetup(de_ctx);
+
     /* Count the amount of memory needed to store all the structures
      * and the content of those structures. This will over estimate the
      * true size, since duplicates are removed below, but counted here.
@@ -1498,6 +2268,7 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
             BUG_ON(sm_list == -1);
 
             DetectContentData *cd = (DetectContentData *)s->init_data->mpm_sm->ctx;
+            DetectFPStatsAddSig(de_ctx, s, sm_list, cd);
             DetectFPAndItsId *dup = (DetectFPAndItsId *)ahb;
             if (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP) {
                 content = cd->content + cd->fp_chop_offset;
@@ -1569,3 +2340,179 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
 
     return 0;
 }
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+/** \internal
+ *  \brief set up the sigs of de_ctx as far as MpmStoreGetMatcher() needs */
+static int MpmStoreTestPrepare(DetectEngineCtx *de_ctx)
+{
+    de_ctx->signum = 0;
+    for (Signature *s = de_ctx->sig_list; s != NULL; s = s->next)
+        s->num = de_ctx->signum++;
+    if (DetectSetFastPatternAndItsId(de_ctx) < 0)
+        return -1;
+
+    de_ctx->sig_array_len = de_ctx->signum;
+    de_ctx->sig_array_size = de_ctx->sig_array_len * sizeof(Signature *);
+    de_ctx->sig_array = SCCalloc(de_ctx->sig_array_len, sizeof(Signature *));
+    if (de_ctx->sig_array == NULL)
+        return -1;
+    for (Signature *s = de_ctx->sig_list; s != NULL; s = s->next)
+        de_ctx->sig_array[s->num] = s;
+    return 0;
+}
+
+/** \internal
+ *  \brief matcher of a unique store of the sigs with the num's in sigs */
+static uint16_t MpmStoreTestGetMatcher(const DetectEngineCtx *de_ctx,
+        enum MpmBuiltinBuffers buffer, int sm_list,
+        const uint32_t *sigs, uint32_t sigs_cnt)
+{
+    MpmStore ms;
+    memset(&ms, 0, sizeof(ms));
+    ms.sid_array_size = (de_ctx->sig_array_len + 7) / 8;
+    ms.sid_array = SCCalloc(1, ms.sid_array_size);
+    if (ms.sid_array == NULL)
+        return MPM_NOTSET;
+    for (uint32_t i = 0; i < sigs_cnt; i++)
+        ms.sid_array[sigs[i] / 8] |= 1 << (sigs[i] % 8);
+    ms.direction = SIG_FLAG_TOSERVER;
+    ms.buffer = buffer;
+    ms.sm_list = sm_list;
+    ms.sgh_mpm_context = MPM_CTX_FACTORY_UNIQUE_CONTEXT;
+
+    const uint16_t matcher = MpmStoreGetMatcher(de_ctx, &ms);
+    SCFree(ms.sid_array);
+    return matcher;
+}
+
+/** \test teddy for a few patterns, unless one of them is 1 byte */
+static int MpmStoreGetMatcherTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"abcd\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"efgh\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"x\"; sid:3;)"));
+    FAIL_IF(MpmStoreTestPrepare(de_ctx) != 0);
+    /* no large matcher, so it's teddy or the default */
+    de_ctx->mpm_matcher_large = MPM_NOTSET;
+    de_ctx->mpm_teddy_max_patterns = 2;
+
+    const uint16_t teddy = (mpm_table[MPM_TEDDY].Search != NULL) ?
+        MPM_TEDDY : de_ctx->mpm_matcher;
+    const uint32_t two[] = { 0, 1 };
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == teddy);
+    /* sid 3 has a 1 byte pattern */
+    const uint32_t short_pat[] = { 0, 2 };
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, short_pat, 2) == de_ctx->mpm_matcher);
+    /* more patterns than mpm-teddy-max-patterns */
+    const uint32_t all[] = { 0, 1, 2 };
+    de_ctx->mpm_teddy_max_patterns = 3;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, all, 3) == de_ctx->mpm_matcher);
+    de_ctx->mpm_teddy_max_patterns = 1;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == de_ctx->mpm_matcher);
+    /* no patterns for the list */
+    de_ctx->mpm_teddy_max_patterns = 2;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_MAX,
+                DetectBufferTypeGetByName("http_uri"), two, 2) == de_ctx->mpm_matcher);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test mpm-algo-large once the patterns have mpm-large-pattern-bytes */
+static int MpmStoreGetMatcherTest02(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"abcdefgh\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"ijklmnop\"; sid:2;)"));
+    FAIL_IF(MpmStoreTestPrepare(de_ctx) != 0);
+    de_ctx->mpm_teddy_max_patterns = 0;
+    de_ctx->mpm_large_pattern_bytes = 16;
+    const uint16_t large = (de_ctx->mpm_matcher == MPM_AC) ? MPM_AC_KS : MPM_AC;
+    const uint32_t one[] = { 0 };
+    const uint32_t two[] = { 0, 1 };
+
+    /* not set, so never used */
+    de_ctx->mpm_matcher_large = MPM_NOTSET;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == de_ctx->mpm_matcher);
+
+    de_ctx->mpm_matcher_large = large;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, one, 1) == de_ctx->mpm_matcher);
+    /* 16 bytes, at the limit */
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == large);
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_STREAM_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == large);
+    de_ctx->mpm_large_pattern_bytes = 17;
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_TCP_PKT_TS,
+                DETECT_SM_LIST_PMATCH, two, 2) == de_ctx->mpm_matcher);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test app-layer stores need MPM_LARGE_APP_FACTOR times the bytes */
+static int MpmStoreGetMatcherTest03(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(flow:to_server; http.uri; content:\"abcdefgh\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(flow:to_server; http.uri; content:\"ijklmnop\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(flow:to_server; http.uri; content:\"qrstuvwx\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(flow:to_server; http.uri; content:\"yz012345\"; sid:4;)"));
+    FAIL_IF(MpmStoreTestPrepare(de_ctx) != 0);
+    de_ctx->mpm_teddy_max_patterns = 0;
+    de_ctx->mpm_large_pattern_bytes = 8;
+    const uint16_t large = (de_ctx->mpm_matcher == MPM_AC) ? MPM_AC_KS : MPM_AC;
+    de_ctx->mpm_matcher_large = large;
+    const int list = DetectBufferTypeGetByName("http_uri");
+    FAIL_IF(list < 0);
+
+    /* 8 bytes would do for a packet or stream store */
+    const uint32_t one[] = { 0 };
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_MAX, list,
+                one, 1) == de_ctx->mpm_matcher);
+    const uint32_t three[] = { 0, 1, 2 };
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_MAX, list,
+                three, 3) == de_ctx->mpm_matcher);
+    /* 32 bytes, 4 times the limit */
+    const uint32_t four[] = { 0, 1, 2, 3 };
+    FAIL_IF_NOT(MpmStoreTestGetMatcher(de_ctx, MPMB_MAX, list,
+                four, 4) == large);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectEngineMpmRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MpmStoreGetMatcherTest01", MpmStoreGetMatcherTest01);
+    UtRegisterTest("MpmStoreGetMatcherTest02", MpmStoreGetMatcherTest02);
+    UtRegisterTest("MpmStoreGetMatcherTest03", MpmStoreGetMatcherTest03);
+#endif /* UNITTESTS */
+}
@@ -32,6 +32,10 @@
 
 #include "stream.h"
 
+/** app-layer mpm ctx' need this many times detect.mpm-large-pattern-bytes
+ *  to use detect.mpm-algo-large */
+#define MPM_LARGE_APP_FACTOR 4
+
 void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx);
 void DetectMpmSetupAppMpms(DetectEngineCtx *de_ctx);
 int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx);
@@ -41,6 +45,8 @@ int DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx);
 uint32_t PatternStrength(uint8_t *, uint16_t);
 
 uint16_t PatternMatchDefaultMatcher(void);
+uint16_t PatternMatchMatcherByName(const char *name);
+uint16_t PatternMatchThreadMatcher(const DetectEngineCtx *de_ctx);
 uint32_t DnsQueryPatternSearch(DetectEngineThreadCtx *det_ctx, uint8_t *buffer, uint32_t buffer_len, uint8_t flags);
 
 void PacketPatternCleanup(DetectEngineThreadCtx *);
@@ -66,6 +72,9 @@ void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s);
 int MpmStoreInit(DetectEngineCtx *);
 void MpmStoreFree(DetectEngineCtx *);
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx);
+void MpmStoreGetName(const DetectEngineCtx *de_ctx, const MpmStore *ms,
+        char *str, size_t size);
+int MpmStorePrepareAll(DetectEngineCtx *de_ctx);
 MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh, enum MpmBuiltinBuffers buf);
 
 /**
@@ -112,10 +121,13 @@ void DetectAppLayerMpmRegister2(const char *name,
             const DetectMpmAppLayerRegistery *mpm_reg, int list_id),
         InspectionBufferGetDataPtr GetData,
         AppProto alproto, int tx_min_progress);
+void DetectAppLayerMpmSetBatchable(const char *name);
 void DetectAppLayerMpmRegisterByParentId(
         DetectEngineCtx *de_ctx,
         const int id, const int parent_id,
         DetectEngineTransforms *transforms);
 
+void DetectEngineMpmRegisterTests(void);
+
 #endif /* __DETECT_ENGINE_MPM_H__ */
 
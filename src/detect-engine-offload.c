@@ -0,0 +1,511 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Detect offload: a pool of helper threads that take part in the multi
+ * pattern matcher scan of large inspection buffers, like file_data.
+ *
+ * A worker that has to scan a large buffer splits it into chunks and
+ * posts the scan as a job. The worker and any idle helper then take
+ * chunks until none are left. The chunks overlap by the longest pattern
+ * length minus one, so no match on a chunk boundary is missed. Helpers
+ * collect their matches in the job, which the worker merges into its own
+ * prefilter results once all helpers are done with the job. Matches
+ * found twice in the overlap are removed by the prefilter sort.
+ *
+ * Patterns with an offset match relative to the start of the buffer, so
+ * MPM contexts containing them are always scanned in one go.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-offload.h"
+#include "runmodes.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "util-mpm.h"
+#include "util-prefilter.h"
+#include "util-misc.h"
+#include "util-time.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+/** max number of jobs posted at the same time */
+#define DETECT_OFFLOAD_MAX_JOBS             64
+#define DETECT_OFFLOAD_MIN_SIZE_DEFAULT     (256 * 1024)
+#define DETECT_OFFLOAD_CHUNK_SIZE_DEFAULT   (64 * 1024)
+/** spins while waiting for the helpers to finish, before sleeping */
+#define DETECT_OFFLOAD_SPIN                 1000
+
+typedef struct DetectOffloadJob_ {
+    const MpmCtx *mpm_ctx;
+    const uint8_t *buf;
+    uint32_t buf_len;
+    uint32_t chunk_size;
+    uint32_t chunks;
+
+    /** next chunk to scan, taken with an atomic add */
+    uint32_t next_chunk;
+    /** number of helpers working on the job */
+    uint32_t refs;
+    /** matches found by the helpers */
+    uint32_t matches;
+
+    /** protects pmq */
+    SCMutex m;
+    /** rule ids found by the helpers */
+    PrefilterRuleStore pmq;
+} DetectOffloadJob;
+
+typedef struct DetectOffloadThreadData_ {
+    uint32_t instance;
+    /** detect engine version the mpm thread ctxs were set up for */
+    uint32_t version;
+    uint64_t chunks;
+    PrefilterRuleStore pmq;
+    MpmThreadCtx mtc[MPM_TABLE_SIZE];
+    uint8_t mtc_init[MPM_TABLE_SIZE];
+} DetectOffloadThreadData;
+
+static uint32_t offload_threads = 0;
+static uint32_t offload_min_size = DETECT_OFFLOAD_MIN_SIZE_DEFAULT;
+static uint32_t offload_chunk_size = DETECT_OFFLOAD_CHUNK_SIZE_DEFAULT;
+
+static SCMutex offload_jobs_lock = SCMUTEX_INITIALIZER;
+static DetectOffloadJob *offload_jobs[DETECT_OFFLOAD_MAX_JOBS];
+static uint32_t offload_jobs_cnt = 0;
+/** bumped for every posted job, so helpers don't miss a wake up */
+static uint32_t offload_jobs_seq = 0;
+
+static ThreadVars **offload_tvs = NULL;
+static uint32_t offload_tvs_cnt = 0;
+
+SC_ATOMIC_DECLARE(uint32_t, detect_offload_cnt);
+
+/**
+ * \brief parse the detect.offload config
+ *
+ * Offloading is disabled unless detect.offload.threads is set.
+ */
+static void DetectOffloadInit(void)
+{
+    intmax_t threads = 0;
+    const char *str = NULL;
+
+    if (ConfGetInt("detect.offload.threads", &threads) != 1 || threads == 0)
+        return;
+    if (threads < 0 || threads > 1024) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "invalid detect.offload.threads setting %"PRIdMAX, threads);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ConfGet("detect.offload.min-size", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU32(str, &offload_min_size) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "error parsing "
+                    "detect.offload.min-size from conf file - %s", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+    str = NULL;
+    if (ConfGet("detect.offload.chunk-size", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU32(str, &offload_chunk_size) < 0 ||
+                offload_chunk_size < 1024) {
+            SCLogError(SC_ERR_SIZE_PARSE, "error parsing "
+                    "detect.offload.chunk-size from conf file - %s", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* a buffer should at least be split in two */
+    if (offload_min_size < 2 * offload_chunk_size)
+        offload_min_size = 2 * offload_chunk_size;
+
+    offload_threads = (uint32_t)threads;
+    SCLogConfig("using %u detect offload threads for buffers of %u bytes "
+            "and up, in chunks of %u bytes", offload_threads,
+            offload_min_size, offload_chunk_size);
+}
+
+static uint32_t DetectOffloadSearchChunk(const DetectOffloadJob *job,
+        uint32_t chunk, MpmThreadCtx *mtc, PrefilterRuleStore *pmq)
+{
+    const MpmCtx *mpm_ctx = job->mpm_ctx;
+    const uint32_t overlap = mpm_ctx->maxlen > 0 ? mpm_ctx->maxlen - 1 : 0;
+    const uint32_t start = chunk * job->chunk_size;
+
+    uint32_t len = job->buf_len - start;
+    if (len > job->chunk_size + overlap)
+        len = job->chunk_size + overlap;
+    if (len < mpm_ctx->minlen)
+        return 0;
+
+    return mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, mtc, pmq,
+            job->buf + start, len);
+}
+
+/** \retval 0 if posted, -1 if there is no room for another job */
+static int DetectOffloadPost(DetectOffloadJob *job)
+{
+    SCMutexLock(&offload_jobs_lock);
+    if (offload_jobs_cnt == DETECT_OFFLOAD_MAX_JOBS) {
+        SCMutexUnlock(&offload_jobs_lock);
+        return -1;
+    }
+    offload_jobs[offload_jobs_cnt] = job;
+    offload_jobs_cnt++;
+    __atomic_add_fetch(&offload_jobs_seq, 1, __ATOMIC_RELEASE);
+    SCMutexUnlock(&offload_jobs_lock);
+
+    for (uint32_t i = 0; i < offload_tvs_cnt; i++) {
+        ThreadVars *tv = offload_tvs[i];
+        SCCtrlMutexLock(tv->ctrl_mutex);
+        SCCtrlCondSignal(tv->ctrl_cond);
+        SCCtrlMutexUnlock(tv->ctrl_mutex);
+    }
+    return 0;
+}
+
+/** \brief take a job off the board, no helper can pick it up after this */
+static void DetectOffloadRemove(DetectOffloadJob *job)
+{
+    SCMutexLock(&offload_jobs_lock);
+    for (uint32_t i = 0; i < offload_jobs_cnt; i++) {
+        if (offload_jobs[i] == job) {
+            offload_jobs[i] = offload_jobs[offload_jobs_cnt - 1];
+            offload_jobs[offload_jobs_cnt - 1] = NULL;
+            offload_jobs_cnt--;
+            break;
+        }
+    }
+    SCMutexUnlock(&offload_jobs_lock);
+}
+
+/** \brief get a job with chunks left to scan, and a reference to it */
+static DetectOffloadJob *DetectOffloadGetJob(uint32_t instance)
+{
+    DetectOffloadJob *job = NULL;
+
+    SCMutexLock(&offload_jobs_lock);
+    for (uint32_t i = 0; i < offload_jobs_cnt; i++) {
+        /* start at a different job per helper to spread them out */
+        DetectOffloadJob *j = offload_jobs[(instance + i) % offload_jobs_cnt];
+        if (__atomic_load_n(&j->next_chunk, __ATOMIC_RELAXED) < j->chunks) {
+            __atomic_add_fetch(&j->refs, 1, __ATOMIC_ACQ_REL);
+            job = j;
+            break;
+        }
+    }
+    SCMutexUnlock(&offload_jobs_lock);
+    return job;
+}
+
+/**
+ * \brief scan a buffer with the mpm, using the offload threads
+ *
+ * Buffers smaller than detect.offload.min-size are scanned directly. For
+ * larger ones the calling worker scans chunks itself as well, so the scan
+ * never waits for a helper to become available.
+ *
+ * \param det_ctx detection engine thread ctx, matches go into its pmq
+ * \param mpm_ctx mpm ctx to scan with
+ * \param buf buffer to scan
+ * \param buf_len length of buf
+ *
+ * \retval matches number of pattern matches
+ */
+uint32_t DetectOffloadMpmSearch(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, const uint8_t *buf, uint32_t buf_len)
+{
+    if (offload_threads == 0 || buf_len < offload_min_size ||
+            (mpm_ctx->flags & MPMCTX_FLAGS_OFFSET)) {
+        return mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                &det_ctx->mtcu, &det_ctx->pmq, buf, buf_len);
+    }
+
+    DetectOffloadJob job;
+    memset(&job, 0, sizeof(job));
+    job.mpm_ctx = mpm_ctx;
+    job.buf = buf;
+    job.buf_len = buf_len;
+    job.chunk_size = offload_chunk_size;
+    job.chunks = (buf_len + offload_chunk_size - 1) / offload_chunk_size;
+    SCMutexInit(&job.m, NULL);
+
+    if (DetectOffloadPost(&job) != 0) {
+        SCMutexDestroy(&job.m);
+        return mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                &det_ctx->mtcu, &det_ctx->pmq, buf, buf_len);
+    }
+
+    uint32_t matches = 0;
+    uint32_t chunk;
+    while ((chunk = __atomic_fetch_add(&job.next_chunk, 1, __ATOMIC_RELAXED)) < job.chunks) {
+        matches += DetectOffloadSearchChunk(&job, chunk, &det_ctx->mtcu, &det_ctx->pmq);
+    }
+
+    /* all chunks are taken: wait for the helpers still scanning one */
+    DetectOffloadRemove(&job);
+    uint32_t spins = 0;
+    while (__atomic_load_n(&job.refs, __ATOMIC_ACQUIRE) != 0) {
+        if (++spins < DETECT_OFFLOAD_SPIN) {
+            cc_barrier();
+        } else {
+            SleepUsec(1);
+        }
+    }
+
+    PrefilterAddSids(&det_ctx->pmq, job.pmq.rule_id_array, job.pmq.rule_id_array_cnt);
+    matches += job.matches;
+
+    if (job.pmq.rule_id_array != NULL)
+        SCFree(job.pmq.rule_id_array);
+    SCMutexDestroy(&job.m);
+    return matches;
+}
+
+static MpmThreadCtx *DetectOffloadGetMpmThreadCtx(DetectOffloadThreadData *ftd,
+        uint8_t mpm_type)
+{
+    /* a new detect engine may need larger per thread ctxs (e.g.
+     * hyperscan scratch), so set them up again when it changes */
+    uint32_t version = DetectEngineGetVersion();
+    if (version != ftd->version) {
+        for (int i = 0; i < MPM_TABLE_SIZE; i++) {
+            if (ftd->mtc_init[i]) {
+                PatternMatchThreadDestroy(&ftd->mtc[i], i);
+                ftd->mtc_init[i] = 0;
+            }
+        }
+        ftd->version = version;
+    }
+
+    if (!ftd->mtc_init[mpm_type]) {
+        memset(&ftd->mtc[mpm_type], 0, sizeof(MpmThreadCtx));
+        PatternMatchThreadPrepare(&ftd->mtc[mpm_type], mpm_type);
+        ftd->mtc_init[mpm_type] = 1;
+    }
+    return &ftd->mtc[mpm_type];
+}
+
+static void DetectOffloadRunJob(DetectOffloadThreadData *ftd, DetectOffloadJob *job)
+{
+    MpmThreadCtx *mtc = DetectOffloadGetMpmThreadCtx(ftd, job->mpm_ctx->mpm_type);
+    uint32_t matches = 0;
+    uint32_t chunk;
+
+    ftd->pmq.rule_id_array_cnt = 0;
+    while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->chunks) {
+        matches += DetectOffloadSearchChunk(job, chunk, mtc, &ftd->pmq);
+        ftd->chunks++;
+    }
+
+    if (ftd->pmq.rule_id_array_cnt > 0 || matches > 0) {
+        SCMutexLock(&job->m);
+        PrefilterAddSids(&job->pmq, ftd->pmq.rule_id_array, ftd->pmq.rule_id_array_cnt);
+        job->matches += matches;
+        SCMutexUnlock(&job->m);
+    }
+
+    /* last access to the job, the worker may free it after this */
+    __atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+static TmEcode DetectOffloadThreadInit(ThreadVars *t, const void *initdata, void **data)
+{
+    DetectOffloadThreadData *ftd = SCCalloc(1, sizeof(DetectOffloadThreadData));
+    if (ftd == NULL)
+        return TM_ECODE_FAILED;
+
+    if (PmqSetup(&ftd->pmq) != 0) {
+        SCFree(ftd);
+        return TM_ECODE_FAILED;
+    }
+
+    ftd->instance = SC_ATOMIC_ADD(detect_offload_cnt, 1) - 1; /* id's start at 0 */
+    SCLogDebug("detect offload instance %u", ftd->instance);
+
+    *data = ftd;
+    return TM_ECODE_OK;
+}
+
+static TmEcode DetectOffloadThreadDeinit(ThreadVars *t, void *data)
+{
+    DetectOffloadThreadData *ftd = (DetectOffloadThreadData *)data;
+
+    SCLogPerf("detect offload thread %u scanned %"PRIu64" chunks",
+            ftd->instance, ftd->chunks);
+
+    for (int i = 0; i < MPM_TABLE_SIZE; i++) {
+        if (ftd->mtc_init[i])
+            PatternMatchThreadDestroy(&ftd->mtc[i], i);
+    }
+    PmqFree(&ftd->pmq);
+    SCFree(ftd);
+    return TM_ECODE_OK;
+}
+
+static TmEcode DetectOffload(ThreadVars *th_v, void *thread_data)
+{
+    DetectOffloadThreadData *ftd = (DetectOffloadThreadData *)thread_data;
+    BUG_ON(ftd == NULL);
+
+    SCLogDebug("offload thread started");
+    while (1)
+    {
+        if (TmThreadsCheckFlag(th_v, THV_PAUSE)) {
+            TmThreadsSetFlag(th_v, THV_PAUSED);
+            TmThreadTestThreadUnPaused(th_v);
+            TmThreadsUnsetFlag(th_v, THV_PAUSED);
+        }
+
+        const uint32_t seq = __atomic_load_n(&offload_jobs_seq, __ATOMIC_ACQUIRE);
+
+        DetectOffloadJob *job = DetectOffloadGetJob(ftd->instance);
+        if (job != NULL) {
+            DetectOffloadRunJob(ftd, job);
+            continue;
+        }
+
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            break;
+        }
+
+        /* wait for a new job. The timeout is for the kill signal, which
+         * is sent without holding the ctrl mutex. */
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + 1;
+        ts.tv_nsec = tv.tv_usec * 1000;
+
+        SCCtrlMutexLock(th_v->ctrl_mutex);
+        if (__atomic_load_n(&offload_jobs_seq, __ATOMIC_ACQUIRE) == seq) {
+            SCCtrlCondTimedwait(th_v->ctrl_cond, th_v->ctrl_mutex, &ts);
+        }
+        SCCtrlMutexUnlock(th_v->ctrl_mutex);
+    }
+
+    return TM_ECODE_OK;
+}
+
+/** \brief spawn the detect offload threads, if enabled */
+void DetectOffloadThreadSpawn(void)
+{
+    DetectOffloadInit();
+    if (offload_threads == 0)
+        return;
+
+    offload_tvs = SCCalloc(offload_threads, sizeof(ThreadVars *));
+    if (offload_tvs == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc detect offload threads");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < offload_threads; i++) {
+        char name[TM_THREAD_NAME_MAX];
+        snprintf(name, sizeof(name), "%s#%02u", thread_name_detect_offload, i+1);
+
+        ThreadVars *tv_offload = TmThreadCreateCmdThreadByName(name,
+                "DetectOffload", 1);
+        if (tv_offload == NULL) {
+            SCLogError(SC_ERR_THREAD_CREATE, "creating detect offload thread failed");
+            exit(EXIT_FAILURE);
+        }
+        if (TmThreadSpawn(tv_offload) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_THREAD_SPAWN, "spawning detect offload thread failed");
+            exit(EXIT_FAILURE);
+        }
+        offload_tvs[offload_tvs_cnt++] = tv_offload;
+    }
+}
+
+void TmModuleDetectOffloadRegister(void)
+{
+    tmm_modules[TMM_DETECTOFFLOAD].name = "DetectOffload";
+    tmm_modules[TMM_DETECTOFFLOAD].ThreadInit = DetectOffloadThreadInit;
+    tmm_modules[TMM_DETECTOFFLOAD].ThreadDeinit = DetectOffloadThreadDeinit;
+    tmm_modules[TMM_DETECTOFFLOAD].Management = DetectOffload;
+    tmm_modules[TMM_DETECTOFFLOAD].cap_flags = 0;
+    tmm_modules[TMM_DETECTOFFLOAD].flags = TM_FLAG_MANAGEMENT_TM;
+    SCLogDebug("%s registered", tmm_modules[TMM_DETECTOFFLOAD].name);
+
+    SC_ATOMIC_INIT(detect_offload_cnt);
+}
+
+#ifdef UNITTESTS
+
+/** \test chunked scan finds matches on chunk boundaries */
+static int DetectOffloadTest01(void)
+{
+    MpmCtx mpm_ctx;
+    DetectEngineThreadCtx det_ctx;
+    uint8_t buf[4096];
+
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(buf, 'x', sizeof(buf));
+
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    MpmInitThreadCtx(&det_ctx.mtcu, MPM_AC);
+    FAIL_IF(PmqSetup(&det_ctx.pmq) != 0);
+
+    /* sid 1 straddles the first chunk boundary, sid 2 is at the end */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"boundary", 8, 0, 0, 0, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"lastbytes", 9, 0, 0, 1, 2, 0);
+    mpm_table[MPM_AC].Prepare(&mpm_ctx);
+
+    memcpy(buf + 1020, "boundary", 8);
+    memcpy(buf + sizeof(buf) - 9, "lastbytes", 9);
+
+    uint32_t threads = offload_threads;
+    uint32_t min_size = offload_min_size;
+    uint32_t chunk_size = offload_chunk_size;
+    /* no helpers are running, so the caller scans all chunks */
+    offload_threads = 1;
+    offload_min_size = 2048;
+    offload_chunk_size = 1024;
+
+    uint32_t cnt = DetectOffloadMpmSearch(&det_ctx, &mpm_ctx, buf, sizeof(buf));
+    FAIL_IF_NOT(cnt == 2);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array_cnt == 2);
+    FAIL_IF_NOT(offload_jobs_cnt == 0);
+
+    offload_threads = threads;
+    offload_min_size = min_size;
+    offload_chunk_size = chunk_size;
+
+    mpm_table[MPM_AC].DestroyCtx(&mpm_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(NULL, &det_ctx.mtcu);
+    PmqFree(&det_ctx.pmq);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void DetectOffloadRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectOffloadTest01", DetectOffloadTest01);
+#endif
+}
@@ -0,0 +1,35 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Detect offload API: helper threads that take part in scanning large
+ * inspection buffers with the multi pattern matcher.
+ */
+
+#ifndef __DETECT_ENGINE_OFFLOAD_H__
+#define __DETECT_ENGINE_OFFLOAD_H__
+
+void DetectOffloadThreadSpawn(void);
+void TmModuleDetectOffloadRegister(void);
+void DetectOffloadRegisterTests(void);
+
+uint32_t DetectOffloadMpmSearch(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, const uint8_t *buf, uint32_t buf_len);
+
+#endif /* __DETECT_ENGINE_OFFLOAD_H__ */
@@ -51,9 +51,11 @@
 struct StreamMpmData {
     DetectEngineThreadCtx *det_ctx;
     const MpmCtx *mpm_ctx;
+    MpmStreamState *state;
 };
 
-static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamMpmFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     struct StreamMpmData *smd = cb_data;
     if (data_len >= smd->mpm_ctx->minlen) {
@@ -61,13 +63,40 @@ static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data
         smd->det_ctx->stream_mpm_cnt++;
         smd->det_ctx->stream_mpm_size += data_len;
 #endif
-        (void)mpm_table[smd->mpm_ctx->mpm_type].Search(smd->mpm_ctx,
-                &smd->det_ctx->mtcs, &smd->det_ctx->pmq,
-                data, data_len);
+        (void)MpmSearchStream(smd->mpm_ctx,
+                &smd->det_ctx->mtcs, &smd->det_ctx->pmq, smd->state,
+                smd->det_ctx->de_ctx->version, data, data_len, offset);
     }
     return 0;
 }
 
+/**
+ *  \internal
+ *  \brief get the raw mpm scan state of the stream of a packet
+ *
+ *  The state is set up on first use and freed with the stream.
+ *
+ *  \retval state or NULL if not enabled or the stream memcap is reached
+ */
+static MpmStreamState *StreamMpmGetState(DetectEngineThreadCtx *det_ctx,
+        Packet *p)
+{
+    if (!det_ctx->de_ctx->prefilter_stream_state)
+        return NULL;
+
+    TcpSession *ssn = (TcpSession *)p->flow->protoctx;
+    TcpStream *stream = PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server;
+    if (stream->mpm_state == NULL) {
+        if (StreamTcpCheckMemcap((uint64_t)sizeof(MpmStreamState)) == 0)
+            return NULL;
+        stream->mpm_state = SCCalloc(1, sizeof(MpmStreamState));
+        if (unlikely(stream->mpm_state == NULL))
+            return NULL;
+        StreamTcpIncrMemuse((uint64_t)sizeof(MpmStreamState));
+    }
+    return stream->mpm_state;
+}
+
 static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
         Packet *p, const void *pectx)
 {
@@ -79,7 +108,8 @@ static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
     if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
         SCLogDebug("PRE det_ctx->raw_stream_progress %"PRIu64,
                 det_ctx->raw_stream_progress);
-        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx };
+        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx,
+            StreamMpmGetState(det_ctx, p) };
         StreamReassembleRaw(p->flow->protoctx, p,
                 StreamMpmFunc, &stream_mpm_data,
                 &det_ctx->raw_stream_progress,
@@ -224,7 +254,8 @@ struct StreamContentInspectData {
     Flow *f;
 };
 
-static int StreamContentInspectFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
@@ -282,7 +313,8 @@ struct StreamContentInspectEngineData {
     Flow *f;
 };
 
-static int StreamContentInspectEngineFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectEngineFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
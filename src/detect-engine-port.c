@@ -752,6 +752,55 @@ DetectPortLookupGroup(DetectPort *dp, uint16_t port)
     return NULL;
 }
 
+/**
+ * \brief Build a port lookup table from a DetectPort list
+ *
+ * Each port is set to the group of the first entry of the list that
+ * covers it, which is what DetectPortLookupGroup returns for it.
+ *
+ * \param head list of port groups
+ *
+ * \retval t the table or NULL on error or if the list has too many groups
+ *           to index
+ */
+DetectPortLookupTable *DetectPortLookupTableBuild(const DetectPort *head)
+{
+    uint32_t cnt = 0;
+    for (const DetectPort *p = head; p != NULL; p = p->next)
+        cnt++;
+    /* index 0 is reserved for ports without a group */
+    if (cnt >= UINT16_MAX)
+        return NULL;
+
+    DetectPortLookupTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    t->sgh = SCCalloc(cnt + 1, sizeof(struct SigGroupHead_ *));
+    if (unlikely(t->sgh == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+
+    uint16_t i = 1;
+    for (const DetectPort *p = head; p != NULL; p = p->next, i++) {
+        t->sgh[i] = p->sh;
+        for (uint32_t port = p->port; port <= p->port2; port++) {
+            if (t->idx[port] == 0)
+                t->idx[port] = i;
+        }
+    }
+    t->sgh_cnt = cnt + 1;
+    return t;
+}
+
+void DetectPortLookupTableFree(DetectPortLookupTable *t)
+{
+    if (t == NULL)
+        return;
+    SCFree(t->sgh);
+    SCFree(t);
+}
+
 /**
  * \brief Used to check if a DetectPort list contains an instance with
  *        a similar DetectPort.  The comparison done is not the one that
@@ -2467,6 +2516,36 @@ static int PortTestFunctions07(void)
     PASS;
 }
 
+/**
+ * \test Test the port lookup table against the list lookup
+ */
+static int PortTestFunctions08(void)
+{
+    DetectPort *dd = NULL;
+    FAIL_IF_NOT(DetectPortParse(NULL, &dd, "[1:80,![2,4],443,8000:8080]") == 0);
+
+    /* fake rule groups, only used as pointers */
+    uintptr_t id = 1;
+    for (DetectPort *p = dd; p != NULL; p = p->next)
+        p->sh = (struct SigGroupHead_ *)id++;
+
+    DetectPortLookupTable *t = DetectPortLookupTableBuild(dd);
+    FAIL_IF_NULL(t);
+    for (uint32_t port = 0; port <= 65535; port++) {
+        DetectPort *p = DetectPortLookupGroup(dd, (uint16_t)port);
+        FAIL_IF_NOT(DetectPortLookupTableGet(t, (uint16_t)port) == (p ? p->sh : NULL));
+    }
+    FAIL_IF_NOT_NULL(DetectPortLookupTableGet(t, 2));
+    FAIL_IF_NULL(DetectPortLookupTableGet(t, 443));
+    FAIL_IF_NULL(DetectPortLookupTableGet(t, 8080));
+
+    DetectPortLookupTableFree(t);
+    for (DetectPort *p = dd; p != NULL; p = p->next)
+        p->sh = NULL;
+    DetectPortCleanupList(NULL, dd);
+    PASS;
+}
+
 /**
  * \test Test packet Matches
  * \param raw_eth_pkt pointer to the ethernet packet
@@ -2791,6 +2870,7 @@ void DetectPortTests(void)
     UtRegisterTest("PortTestFunctions05", PortTestFunctions05);
     UtRegisterTest("PortTestFunctions06", PortTestFunctions06);
     UtRegisterTest("PortTestFunctions07", PortTestFunctions07);
+    UtRegisterTest("PortTestFunctions08", PortTestFunctions08);
     UtRegisterTest("PortTestMatchReal01", PortTestMatchReal01);
     UtRegisterTest("PortTestMatchReal02", PortTestMatchReal02);
     UtRegisterTest("PortTestMatchReal03", PortTestMatchReal03);
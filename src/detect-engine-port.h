@@ -34,6 +34,16 @@ int DetectPortInsert(DetectEngineCtx *,DetectPort **, DetectPort *);
 void DetectPortCleanupList (const DetectEngineCtx *de_ctx, DetectPort *head);
 
 DetectPort *DetectPortLookupGroup(DetectPort *dp, uint16_t port);
+
+DetectPortLookupTable *DetectPortLookupTableBuild(const DetectPort *head);
+void DetectPortLookupTableFree(DetectPortLookupTable *t);
+
+/** \brief get the rule group for a port from a lookup table */
+static inline struct SigGroupHead_ *DetectPortLookupTableGet(
+        const DetectPortLookupTable *t, uint16_t port)
+{
+    return t->sgh[t->idx[port]];
+}
 DetectPort *DetectPortLookupInList(DetectPort *head, DetectPort *gr);
 
 int DetectPortJoin(DetectEngineCtx *,DetectPort *target, DetectPort *source);
@@ -392,6 +392,189 @@ error:
     return -1;
 }
 
+static void PrefilterPacketU16RangeCtxFree(void *vctx)
+{
+    PrefilterPacketU16RangeCtx *ctx = vctx;
+    if (ctx->arrays != NULL) {
+        for (uint32_t i = 0; i < ctx->cnt; i++)
+            SCFree(ctx->arrays[i].sigs);
+        SCFree(ctx->arrays);
+    }
+    SCFree(ctx->starts);
+    SCFree(ctx);
+}
+
+/** \internal
+ *  \brief get the inclusive value ranges of a U16RANGE mode
+ *  \retval cnt number of ranges, 0 if no value can match */
+static int U16RangeGetRanges(const PrefilterPacketHeaderValue v,
+        uint32_t lo[2], uint32_t hi[2])
+{
+    const uint32_t v1 = v.u16[1];
+    const uint32_t v2 = v.u16[2];
+    int cnt = 0;
+    switch (v.u8[0]) {
+        case PREFILTER_U16RANGE_MODE_EQ:
+            lo[cnt] = v1; hi[cnt++] = v1;
+            break;
+        case PREFILTER_U16RANGE_MODE_LT:
+            if (v1 > 0) {
+                lo[cnt] = 0; hi[cnt++] = v1 - 1;
+            }
+            break;
+        case PREFILTER_U16RANGE_MODE_GT:
+            if (v1 < UINT16_MAX) {
+                lo[cnt] = v1 + 1; hi[cnt++] = UINT16_MAX;
+            }
+            break;
+        case PREFILTER_U16RANGE_MODE_RA:
+            if (v2 > v1 + 1) {
+                lo[cnt] = v1 + 1; hi[cnt++] = v2 - 1;
+            }
+            break;
+        case PREFILTER_U16RANGE_MODE_NE:
+            if (v1 > 0) {
+                lo[cnt] = 0; hi[cnt++] = v1 - 1;
+            }
+            if (v1 < UINT16_MAX) {
+                lo[cnt] = v1 + 1; hi[cnt++] = UINT16_MAX;
+            }
+            break;
+    }
+    return cnt;
+}
+
+static int U16Compare(const void *a, const void *b)
+{
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/** \internal
+ *  \brief index of the interval starting at 'v' */
+static uint32_t U16RangeIndex(const PrefilterPacketU16RangeCtx *ctx, const uint32_t v)
+{
+    const SigsArray *sa = PrefilterPacketU16RangeLookup(ctx, (uint16_t)v);
+    return (uint32_t)(sa - ctx->arrays);
+}
+
+int PrefilterSetupPacketHeaderU16Range(DetectEngineCtx *de_ctx,
+        SigGroupHead *sgh, int sm_type,
+        void (*Set)(PrefilterPacketHeaderValue *v, void *),
+        void (*Match)(DetectEngineThreadCtx *det_ctx,
+                      Packet *p, const void *pectx))
+{
+    if (sgh == NULL)
+        return 0;
+
+    /* each rule has at most 2 ranges, each adding at most 2 starts */
+    uint32_t starts_size = 1;
+    for (uint32_t sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->init_data->prefilter_sm == NULL ||
+                s->init_data->prefilter_sm->type != sm_type)
+            continue;
+        starts_size += 4;
+    }
+    if (starts_size == 1)
+        return 0;
+
+    PrefilterPacketU16RangeCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return -1;
+    ctx->starts = SCCalloc(starts_size, sizeof(uint16_t));
+    if (ctx->starts == NULL)
+        goto error;
+
+    /* collect the interval boundaries */
+    uint32_t n = 0;
+    ctx->starts[n++] = 0;
+    for (uint32_t sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->init_data->prefilter_sm == NULL ||
+                s->init_data->prefilter_sm->type != sm_type)
+            continue;
+
+        PrefilterPacketHeaderValue v;
+        memset(&v, 0, sizeof(v));
+        Set(&v, s->init_data->prefilter_sm->ctx);
+        uint32_t lo[2], hi[2];
+        const int cnt = U16RangeGetRanges(v, lo, hi);
+        for (int r = 0; r < cnt; r++) {
+            ctx->starts[n++] = (uint16_t)lo[r];
+            if (hi[r] < UINT16_MAX)
+                ctx->starts[n++] = (uint16_t)(hi[r] + 1);
+        }
+    }
+    qsort(ctx->starts, n, sizeof(uint16_t), U16Compare);
+    uint32_t unique = 1;
+    for (uint32_t i = 1; i < n; i++) {
+        if (ctx->starts[i] != ctx->starts[unique - 1])
+            ctx->starts[unique++] = ctx->starts[i];
+    }
+    ctx->cnt = unique;
+
+    ctx->arrays = SCCalloc(ctx->cnt, sizeof(SigsArray));
+    if (ctx->arrays == NULL)
+        goto error;
+
+    /* count the rules per interval, then store them. Rules are added in
+     * the order of the match_array, so the arrays are sorted. */
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t sig = 0; sig < sgh->sig_cnt; sig++) {
+            const Signature *s = sgh->match_array[sig];
+            if (s == NULL || s->init_data->prefilter_sm == NULL ||
+                    s->init_data->prefilter_sm->type != sm_type)
+                continue;
+
+            PrefilterPacketHeaderValue v;
+            memset(&v, 0, sizeof(v));
+            Set(&v, s->init_data->prefilter_sm->ctx);
+            uint32_t lo[2], hi[2];
+            const int cnt = U16RangeGetRanges(v, lo, hi);
+            for (int r = 0; r < cnt; r++) {
+                const uint32_t last = U16RangeIndex(ctx, hi[r]);
+                for (uint32_t i = U16RangeIndex(ctx, lo[r]); i <= last; i++) {
+                    SigsArray *sa = &ctx->arrays[i];
+                    if (pass == 0) {
+                        sa->cnt++;
+                    } else {
+                        sa->sigs[sa->offset++] = s->num;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0) {
+            for (uint32_t i = 0; i < ctx->cnt; i++) {
+                if (ctx->arrays[i].cnt == 0)
+                    continue;
+                ctx->arrays[i].sigs = SCCalloc(ctx->arrays[i].cnt, sizeof(SigIntId));
+                if (ctx->arrays[i].sigs == NULL)
+                    goto error;
+            }
+        }
+    }
+
+    SCLogDebug("%s: %u intervals", sigmatch_table[sm_type].name, ctx->cnt);
+    if (PrefilterAppendEngine(de_ctx, sgh, Match, ctx,
+                PrefilterPacketU16RangeCtxFree, sigmatch_table[sm_type].name) < 0)
+        goto error;
+
+    /* rules that can't match are covered too: they are never added to
+     * the candidates */
+    for (uint32_t sig = 0; sig < sgh->sig_cnt; sig++) {
+        Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->init_data->prefilter_sm == NULL ||
+                s->init_data->prefilter_sm->type != sm_type)
+            continue;
+        s->flags |= SIG_FLAG_PREFILTER;
+    }
+    return 0;
+error:
+    PrefilterPacketU16RangeCtxFree(ctx);
+    return -1;
+}
+
 int PrefilterSetupPacketHeaderU8Hash(DetectEngineCtx *de_ctx,
         SigGroupHead *sgh, int sm_type,
         void (*Set)(PrefilterPacketHeaderValue *v, void *),
@@ -413,3 +596,57 @@ int PrefilterSetupPacketHeader(DetectEngineCtx *de_ctx,
     return PrefilterSetupPacketHeaderCommon(de_ctx, sgh, sm_type,
             Set, Compare, Match, FALSE);
 }
+
+#ifdef UNITTESTS
+/** \brief get the ctx of the packet engine with the Match callback of the
+ *         first rule group that has one, for use after SigGroupBuild() */
+const void *PrefilterPacketHeaderGetCtx(const DetectEngineCtx *de_ctx,
+        void (*Match)(DetectEngineThreadCtx *det_ctx,
+            Packet *p, const void *pectx))
+{
+    for (uint32_t i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL || sgh->pkt_engines == NULL)
+            continue;
+        for (const PrefilterEngine *e = sgh->pkt_engines; ; e++) {
+            if (e->cb.Prefilter == Match)
+                return e->pectx;
+            if (e->is_last)
+                break;
+        }
+    }
+    return NULL;
+}
+
+/** \brief check a u16 range table against the non-prefiltered match
+ *
+ *  For each u16 value the rules of the table must be exactly the rules
+ *  of de_ctx for which Match returns true, in order.
+ *
+ *  \retval 1 ok
+ *  \retval 0 the table differs from Match */
+int PrefilterPacketU16RangeCheck(const DetectEngineCtx *de_ctx,
+        const PrefilterPacketU16RangeCtx *ctx,
+        _Bool (*Match)(const Signature *s, const uint16_t v))
+{
+    for (uint32_t v = 0; v <= UINT16_MAX; v++) {
+        const SigsArray *sa = PrefilterPacketU16RangeLookup(ctx, (uint16_t)v);
+        uint32_t idx = 0;
+        for (uint32_t sig = 0; sig < de_ctx->sig_array_len; sig++) {
+            const Signature *s = de_ctx->sig_array[sig];
+            if (s == NULL || !Match(s, (uint16_t)v))
+                continue;
+            if (idx >= sa->cnt || sa->sigs[idx] != s->num) {
+                printf("value %u: sid %u missing\n", v, s->id);
+                return 0;
+            }
+            idx++;
+        }
+        if (idx != sa->cnt) {
+            printf("value %u: %u rules too many\n", v, sa->cnt - idx);
+            return 0;
+        }
+    }
+    return 1;
+}
+#endif /* UNITTESTS */
@@ -56,6 +56,21 @@ typedef struct PrefilterPacketU8HashCtx_ {
 #define PREFILTER_U8HASH_MODE_GT    2
 #define PREFILTER_U8HASH_MODE_RA    3
 
+/** u16 range table: the u16 value space is split into the intervals
+ *  made by the ranges of the rules, each with the rules matching in it */
+typedef struct PrefilterPacketU16RangeCtx_ {
+    uint32_t cnt;           /**< number of intervals */
+    uint16_t *starts;       /**< first value of each interval, sorted,
+                             *   starts[0] is 0 */
+    SigsArray *arrays;      /**< rules per interval */
+} PrefilterPacketU16RangeCtx;
+
+#define PREFILTER_U16RANGE_MODE_EQ  0
+#define PREFILTER_U16RANGE_MODE_LT  1
+#define PREFILTER_U16RANGE_MODE_GT  2
+#define PREFILTER_U16RANGE_MODE_RA  3   /**< exclusive: v1 < x < v2 */
+#define PREFILTER_U16RANGE_MODE_NE  4
+
 int PrefilterSetupPacketHeader(DetectEngineCtx *de_ctx,
         SigGroupHead *sgh, int sm_type,
         void (*Set)(PrefilterPacketHeaderValue *v, void *),
@@ -70,6 +85,33 @@ int PrefilterSetupPacketHeaderU8Hash(DetectEngineCtx *de_ctx,
         void (*Match)(DetectEngineThreadCtx *det_ctx,
             Packet *p, const void *pectx));
 
+/** \brief setup a single engine looking up the rules by a u16 value
+ *
+ *  Set stores the mode (PREFILTER_U16RANGE_MODE_*) in v.u8[0] and the
+ *  values in v.u16[1] and v.u16[2]. Match gets the value from the packet
+ *  and adds the rules of PrefilterPacketU16RangeLookup(). */
+int PrefilterSetupPacketHeaderU16Range(DetectEngineCtx *de_ctx,
+        SigGroupHead *sgh, int sm_type,
+        void (*Set)(PrefilterPacketHeaderValue *v, void *),
+        void (*Match)(DetectEngineThreadCtx *det_ctx,
+            Packet *p, const void *pectx));
+
+static inline const SigsArray *
+PrefilterPacketU16RangeLookup(const PrefilterPacketU16RangeCtx *ctx, const uint16_t v)
+{
+    uint32_t lo = 0;
+    uint32_t hi = ctx->cnt;
+    while (hi - lo > 1) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (ctx->starts[mid] <= v) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &ctx->arrays[lo];
+}
+
 static inline _Bool
 PrefilterPacketHeaderExtraMatch(const PrefilterPacketHeaderCtx *ctx,
                                 const Packet *p)
@@ -94,4 +136,13 @@ PrefilterPacketHeaderExtraMatch(const PrefilterPacketHeaderCtx *ctx,
     return TRUE;
 }
 
+#ifdef UNITTESTS
+const void *PrefilterPacketHeaderGetCtx(const DetectEngineCtx *de_ctx,
+        void (*Match)(DetectEngineThreadCtx *det_ctx,
+            Packet *p, const void *pectx));
+int PrefilterPacketU16RangeCheck(const DetectEngineCtx *de_ctx,
+        const PrefilterPacketU16RangeCtx *ctx,
+        _Bool (*Match)(const Signature *s, const uint16_t v));
+#endif
+
 #endif /* __DETECT_ENGINE_PREFILTER_COMMON_H__ */
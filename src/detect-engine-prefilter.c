@@ -49,11 +49,24 @@
 
 #include "detect-engine-prefilter.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-offload.h"
+#include "detect-engine-fpstats.h"
 
 #include "app-layer-parser.h"
 #include "app-layer-htp.h"
 
 #include "util-profiling.h"
+#include "util-validate.h"
+#include "util-hash-lookup3.h"
+#include "util-trace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/** from this number of sids on they are sorted through a bitmap, see
+ *  PrefilterSortSidsBitmap() */
+#define PREFILTER_SORT_BITMAP_MIN 64
 
 static int PrefilterStoreGetId(DetectEngineCtx *de_ctx,
         const char *name, void (*FreeFunc)(void *));
@@ -84,6 +97,76 @@ static inline void QuickSortSigIntId(SigIntId *sids, uint32_t n)
     QuickSortSigIntId(l, sids + n - l);
 }
 
+/**
+ * \internal
+ * \brief Sort the sids by setting them in a bitmap of all sids, then
+ *        reading them back in order. Duplicates are removed.
+ *
+ * Linear in the number of sids and in the span between the lowest and the
+ * highest sid, so only used for the larger arrays.
+ */
+static void PrefilterSortSidsBitmap(DetectEngineThreadCtx *det_ctx)
+{
+    SigIntId *sids = det_ctx->pmq.rule_id_array;
+    const uint32_t cnt = det_ctx->pmq.rule_id_array_cnt;
+    uint64_t *bitmap = det_ctx->pf_sid_bitmap;
+    SigIntId min = sids[0];
+    SigIntId max = sids[0];
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const SigIntId id = sids[i];
+        DEBUG_VALIDATE_BUG_ON(id / 64 >= det_ctx->pf_sid_bitmap_size);
+        bitmap[id / 64] |= (1ULL << (id % 64));
+        min = MIN(min, id);
+        max = MAX(max, id);
+    }
+
+    uint32_t n = 0;
+    uint32_t w = min / 64;
+    const uint32_t end = max / 64 + 1;
+    while (w < end) {
+#if defined(__AVX2__)
+        /* skip empty parts of the bitmap 256 sids at a time */
+        if (end - w >= 4) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)&bitmap[w]);
+            if (_mm256_testz_si256(v, v)) {
+                w += 4;
+                continue;
+            }
+        }
+#endif
+        uint64_t bits = bitmap[w];
+        if (bits != 0) {
+            /* clear as we go, the bitmap is empty again when done */
+            bitmap[w] = 0;
+            const SigIntId base = (SigIntId)(w * 64);
+            do {
+                sids[n++] = base + (SigIntId)__builtin_ctzll(bits);
+                bits &= bits - 1;
+            } while (bits != 0);
+        }
+        w++;
+    }
+    det_ctx->pmq.rule_id_array_cnt = n;
+}
+
+/**
+ * \brief Sort the sids in the rule store of the thread ctx.
+ *
+ * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries.
+ * The bitmap sort of the larger arrays removes them, the merge with the
+ * non-prefilter rules skips those that are left.
+ */
+static inline void PrefilterSortSids(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->pmq.rule_id_array_cnt >= PREFILTER_SORT_BITMAP_MIN &&
+            det_ctx->pf_sid_bitmap != NULL) {
+        PrefilterSortSidsBitmap(det_ctx);
+    } else {
+        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+    }
+}
+
 /**
  * \brief run prefilter engines on a transaction
  */
@@ -113,6 +196,12 @@ void DetectRunPrefilterTx(DetectEngineThreadCtx *det_ctx,
             }
         }
 
+        /* at the engine's min progress the buffer may still change, so
+         * the engine runs again on the next packet. Let it keep its result
+         * in the tx so that it can skip the buffer if it didn't change. */
+        det_ctx->pf_tx = (tx->tx_progress == engine->tx_min_progress &&
+                tx->tx_progress < tx->tx_end_state) ? tx : NULL;
+
         PREFILTER_PROFILING_START;
         engine->cb.PrefilterTx(det_ctx, engine->pectx,
                 p, p->flow, tx->tx_ptr, tx->tx_id, flow_flags);
@@ -126,14 +215,16 @@ void DetectRunPrefilterTx(DetectEngineThreadCtx *det_ctx,
             break;
         engine++;
     } while (1);
+    det_ctx->pf_tx = NULL;
 
-    /* Sort the rule list to lets look at pmq.
-     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries */
+    /* Sort the rule list to lets look at pmq. */
     if (likely(det_ctx->pmq.rule_id_array_cnt > 1)) {
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PF_SORT1);
-        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+        PrefilterSortSids(det_ctx);
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PF_SORT1);
     }
+    if (unlikely(det_ctx->de_ctx->fp_stats != NULL))
+        DetectFPStatsUpdate(det_ctx->de_ctx, &det_ctx->pmq);
 }
 
 void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
@@ -157,10 +248,13 @@ void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PF_PKT);
     }
 
-    /* run payload inspecting engines */
+    /* run payload inspecting engines, unless the payload is encrypted
+     * and no rule of the group asked for it with 'flow:encrypted' */
     if (sgh->payload_engines &&
         (p->payload_len || (p->flags & PKT_DETECT_HAS_STREAMDATA)) &&
-        !(p->flags & PKT_NOPAYLOAD_INSPECTION))
+        !(p->flags & PKT_NOPAYLOAD_INSPECTION) &&
+        (p->flow == NULL || !(p->flow->flags & FLOW_PAYLOAD_ENCRYPTED) ||
+         (sgh->flags & SIG_GROUP_HEAD_HAVEENCRYPTED)))
     {
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PF_PAYLOAD);
         PrefilterEngine *engine = sgh->payload_engines;
@@ -176,13 +270,14 @@ void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PF_PAYLOAD);
     }
 
-    /* Sort the rule list to lets look at pmq.
-     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries */
+    /* Sort the rule list to lets look at pmq. */
     if (likely(det_ctx->pmq.rule_id_array_cnt > 1)) {
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PF_SORT1);
-        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+        PrefilterSortSids(det_ctx);
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PF_SORT1);
     }
+    if (unlikely(det_ctx->de_ctx->fp_stats != NULL))
+        DetectFPStatsUpdate(det_ctx->de_ctx, &det_ctx->pmq);
     SCReturn;
 }
 
@@ -548,6 +643,15 @@ static const PrefilterStore *PrefilterStoreGetStore(const DetectEngineCtx *de_ct
     return store;
 }
 
+/** \brief get the name of a prefilter engine by its global id
+ *  \warning slow */
+const char *PrefilterStoreGetNameById(const DetectEngineCtx *de_ctx,
+        const uint32_t id)
+{
+    const PrefilterStore *store = PrefilterStoreGetStore(de_ctx, id);
+    return store ? store->name : NULL;
+}
+
 #ifdef PROFILING
 const char *PrefilterStoreGetName(const uint32_t id)
 {
@@ -564,6 +668,81 @@ typedef struct PrefilterMpmCtx {
     const DetectEngineTransforms *transforms;
 } PrefilterMpmCtx;
 
+/** \internal
+ *  \brief add the sids stored for a tx buffer if it's unchanged
+ *
+ *  \param c set to the cache entry of the engine, if the tx has one
+ *  \retval true stored sids were added, no need to scan the buffer
+ */
+static bool PrefilterTxCacheLookup(DetectEngineThreadCtx *det_ctx,
+        DetectTransaction *tx, const void *pectx, const uint64_t hash,
+        const uint32_t len, const uint64_t offset, DeStatePrefilterCache **c)
+{
+    *c = NULL;
+    if (tx->de_state == NULL)
+        return false;
+
+    *c = DeStatePrefilterCacheGet(tx->de_state, pectx, false);
+    if (*c != NULL && (*c)->hash == hash && (*c)->len == len &&
+            (*c)->offset == offset) {
+        SCLogDebug("tx %"PRIu64" buffer unchanged, adding %u stored sids",
+                tx->tx_id, (*c)->sids_cnt);
+        PrefilterAddSids(&det_ctx->pmq, (*c)->sids, (*c)->sids_cnt);
+        return true;
+    }
+    return false;
+}
+
+/** \internal
+ *  \brief store the sids found in a tx buffer since pmq entry start */
+static void PrefilterTxCacheStore(DetectEngineThreadCtx *det_ctx,
+        DetectTransaction *tx, const void *pectx, Flow *f, const uint8_t flags,
+        DeStatePrefilterCache *c, const uint64_t hash, const uint32_t len,
+        const uint64_t offset, const uint32_t start)
+{
+    if (tx->de_state == NULL) {
+        tx->de_state = DetectEngineStateGetDirection(f, tx->tx_ptr, flags);
+        if (tx->de_state == NULL)
+            return;
+    }
+    if (c == NULL) {
+        c = DeStatePrefilterCacheGet(tx->de_state, pectx, true);
+        if (c == NULL)
+            return;
+    }
+    (void)DeStatePrefilterCacheSet(c, offset, hash, len,
+            det_ctx->pmq.rule_id_array + start,
+            det_ctx->pmq.rule_id_array_cnt - start);
+}
+
+/** \internal
+ *  \brief run mpm on a tx buffer that we may see again
+ *
+ *  The sids mpm found are stored in the tx's detect state, keyed by the
+ *  prefilter engine and a hash of the buffer. If the buffer is unchanged
+ *  the next time the tx is inspected, the stored sids are used instead of
+ *  scanning it again.
+ */
+static void PrefilterMpmTxCached(DetectEngineThreadCtx *det_ctx,
+        DetectTransaction *tx, const void *pectx, const MpmCtx *mpm_ctx,
+        Flow *f, const uint8_t flags, const InspectionBuffer *buffer)
+{
+    uint32_t h1 = 0, h2 = 0;
+    hashlittle2(buffer->inspect, buffer->inspect_len, &h1, &h2);
+    const uint64_t hash = ((uint64_t)h1 << 32) | h2;
+
+    DeStatePrefilterCache *c = NULL;
+    if (PrefilterTxCacheLookup(det_ctx, tx, pectx, hash, buffer->inspect_len,
+                buffer->inspect_offset, &c))
+        return;
+
+    const uint32_t start = det_ctx->pmq.rule_id_array_cnt;
+    (void)DetectOffloadMpmSearch(det_ctx, mpm_ctx, buffer->inspect, buffer->inspect_len);
+
+    PrefilterTxCacheStore(det_ctx, tx, pectx, f, flags, c, hash,
+            buffer->inspect_len, buffer->inspect_offset, start);
+}
+
 /** \brief Generic Mpm prefilter callback
  *
  *  \param det_ctx detection engine thread ctx
@@ -595,8 +774,17 @@ static void PrefilterMpm(DetectEngineThreadCtx *det_ctx,
     //PrintRawDataFp(stdout, data, data_len);
 
     if (data != NULL && data_len >= mpm_ctx->minlen) {
-        (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                &det_ctx->mtcu, &det_ctx->pmq, data, data_len);
+        SCTrace2(mpm_scan_start, ctx->list_id, data_len);
+        if (det_ctx->pf_tx != NULL) {
+            PrefilterMpmTxCached(det_ctx, det_ctx->pf_tx, pectx, mpm_ctx,
+                    f, flags, buffer);
+            SCTrace2(mpm_scan_done, ctx->list_id, 0);
+        } else {
+            const uint32_t matches =
+                DetectOffloadMpmSearch(det_ctx, mpm_ctx, data, data_len);
+            SCTrace2(mpm_scan_done, ctx->list_id, matches);
+            (void)matches;
+        }
     }
 }
 
@@ -626,3 +814,167 @@ int PrefilterGenericMpmRegister(DetectEngineCtx *de_ctx,
     }
     return r;
 }
+
+/** \brief prefilter engine of a batch of small tx buffers, see
+ *         DetectMpmAppLayerBatch */
+typedef struct PrefilterBatchMpmCtx_ {
+    const MpmCtx *mpm_ctx;
+    uint32_t cnt;
+    struct {
+        int list_id;
+        InspectionBufferGetDataPtr GetData;
+        const DetectEngineTransforms *transforms;
+    } bufs[DETECT_MPM_BATCH_MAX];
+} PrefilterBatchMpmCtx;
+
+/** \internal
+ *  \brief get the buffers of the batch and search them in one call
+ *
+ *  The tx cache covers the buffers as one, so a change in any of them
+ *  rescans all of them.
+ */
+static void PrefilterBatchMpm(DetectEngineThreadCtx *det_ctx,
+        const void *pectx,
+        Packet *p, Flow *f, void *txv,
+        const uint64_t idx, const uint8_t flags)
+{
+    SCEnter();
+
+    const PrefilterBatchMpmCtx *ctx = (const PrefilterBatchMpmCtx *)pectx;
+    const MpmCtx *mpm_ctx = ctx->mpm_ctx;
+
+    const uint8_t *bufs[DETECT_MPM_BATCH_MAX];
+    uint32_t lens[DETECT_MPM_BATCH_MAX];
+    uint32_t cnt = 0;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < ctx->cnt; i++) {
+        InspectionBuffer *buffer = ctx->bufs[i].GetData(det_ctx,
+                ctx->bufs[i].transforms, f, flags, txv, ctx->bufs[i].list_id);
+        if (buffer == NULL || buffer->inspect == NULL || buffer->inspect_len == 0)
+            continue;
+        bufs[cnt] = buffer->inspect;
+        lens[cnt] = buffer->inspect_len;
+        total += buffer->inspect_len;
+        cnt++;
+    }
+    if (cnt == 0 || total < mpm_ctx->minlen)
+        return;
+
+    if (det_ctx->pf_tx == NULL) {
+        (void)MpmSearchVector(mpm_ctx, &det_ctx->mtcu, &det_ctx->pmq,
+                bufs, lens, cnt);
+        return;
+    }
+
+    /* the lengths are part of the hash, so moving bytes from one buffer
+     * to the next is a change */
+    uint32_t h1 = 0, h2 = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        hashlittle2(&lens[i], sizeof(lens[i]), &h1, &h2);
+        hashlittle2(bufs[i], lens[i], &h1, &h2);
+    }
+    const uint64_t hash = ((uint64_t)h1 << 32) | h2;
+
+    DeStatePrefilterCache *c = NULL;
+    if (PrefilterTxCacheLookup(det_ctx, det_ctx->pf_tx, pectx, hash, total,
+                0, &c))
+        return;
+
+    const uint32_t start = det_ctx->pmq.rule_id_array_cnt;
+    (void)MpmSearchVector(mpm_ctx, &det_ctx->mtcu, &det_ctx->pmq,
+            bufs, lens, cnt);
+
+    PrefilterTxCacheStore(det_ctx, det_ctx->pf_tx, pectx, f, flags, c, hash,
+            total, 0, start);
+}
+
+/** \brief register the prefilter engine of a batch of tx buffers
+ *
+ *  \param mpm_ctx ctx with the patterns of all buffers of the batch
+ */
+int PrefilterBatchMpmRegister(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
+        MpmCtx *mpm_ctx, const DetectMpmAppLayerBatch *batch)
+{
+    SCEnter();
+    PrefilterBatchMpmCtx *pectx = SCCalloc(1, sizeof(*pectx));
+    if (pectx == NULL)
+        return -1;
+    pectx->mpm_ctx = mpm_ctx;
+    pectx->cnt = batch->cnt;
+    for (uint32_t i = 0; i < batch->cnt; i++) {
+        const DetectMpmAppLayerRegistery *reg = batch->regs[i];
+        pectx->bufs[i].list_id = reg->sm_list;
+        pectx->bufs[i].GetData = reg->v2.GetData;
+        pectx->bufs[i].transforms = &reg->v2.transforms;
+    }
+
+    int r = PrefilterAppendTxEngine(de_ctx, sgh, PrefilterBatchMpm,
+        batch->alproto, batch->tx_min_progress,
+        pectx, PrefilterGenericMpmFree, batch->pname);
+    if (r != 0) {
+        SCFree(pectx);
+    }
+    return r;
+}
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+/** \test bitmap sort against quicksort, with duplicates */
+static int PrefilterTest01(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    const uint32_t sigs = 2000;
+    det_ctx.pf_sid_bitmap_size = (sigs + 63) / 64;
+    det_ctx.pf_sid_bitmap = SCCalloc(det_ctx.pf_sid_bitmap_size, sizeof(uint64_t));
+    FAIL_IF_NULL(det_ctx.pf_sid_bitmap);
+
+    SigIntId sids[1000];
+    SigIntId ref[1000];
+    for (uint32_t i = 0; i < 1000; i++) {
+        /* every sid twice, in a scattered order */
+        sids[i] = ref[i] = ((i / 2) * 7919) % sigs;
+    }
+    QuickSortSigIntId(ref, 1000);
+    uint32_t ref_cnt = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        if (ref_cnt == 0 || ref[ref_cnt - 1] != ref[i])
+            ref[ref_cnt++] = ref[i];
+    }
+
+    det_ctx.pmq.rule_id_array = sids;
+    det_ctx.pmq.rule_id_array_cnt = 1000;
+    PrefilterSortSids(&det_ctx);
+    FAIL_IF(det_ctx.pmq.rule_id_array_cnt != ref_cnt);
+    FAIL_IF(memcmp(sids, ref, ref_cnt * sizeof(SigIntId)) != 0);
+
+    /* the bitmap is left empty */
+    for (uint32_t i = 0; i < det_ctx.pf_sid_bitmap_size; i++) {
+        FAIL_IF(det_ctx.pf_sid_bitmap[i] != 0);
+    }
+
+    /* the highest sid and a single word */
+    sids[0] = sigs - 1;
+    for (uint32_t i = 1; i < PREFILTER_SORT_BITMAP_MIN; i++) {
+        sids[i] = PREFILTER_SORT_BITMAP_MIN - i;
+    }
+    det_ctx.pmq.rule_id_array_cnt = PREFILTER_SORT_BITMAP_MIN;
+    PrefilterSortSids(&det_ctx);
+    FAIL_IF(det_ctx.pmq.rule_id_array_cnt != PREFILTER_SORT_BITMAP_MIN);
+    for (uint32_t i = 0; i < PREFILTER_SORT_BITMAP_MIN - 1; i++) {
+        FAIL_IF(sids[i] != i + 1);
+    }
+    FAIL_IF(sids[PREFILTER_SORT_BITMAP_MIN - 1] != sigs - 1);
+
+    SCFree(det_ctx.pf_sid_bitmap);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PrefilterTest01", PrefilterTest01);
+#endif /* UNITTESTS */
+}
@@ -65,6 +65,8 @@ void PrefilterFreeEnginesList(PrefilterEngineList *list);
 void PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 void PrefilterCleanupRuleGroup(const DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
+const char *PrefilterStoreGetNameById(const DetectEngineCtx *de_ctx,
+        const uint32_t id);
 #ifdef PROFILING
 const char *PrefilterStoreGetName(const uint32_t id);
 #endif
@@ -75,5 +77,9 @@ void PrefilterDeinit(DetectEngineCtx *de_ctx);
 int PrefilterGenericMpmRegister(DetectEngineCtx *de_ctx,
         SigGroupHead *sgh, MpmCtx *mpm_ctx,
         const DetectMpmAppLayerRegistery *mpm_reg, int list_id);
+int PrefilterBatchMpmRegister(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
+        MpmCtx *mpm_ctx, const DetectMpmAppLayerBatch *batch);
+
+void PrefilterRegisterTests(void);
 
 #endif
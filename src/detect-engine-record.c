@@ -0,0 +1,489 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Recording of the app-layer inspection buffers per transaction.
+ *
+ * With 'detect.record-buffers: <file>' set, each tx inspected by the
+ * detection engine appends the untransformed buffers that were set up
+ * for it (the buffers the prefilter engines and rules asked for) to the
+ * file. The recording can then be replayed through the inspection
+ * engines only, see util-bench-detect.c.
+ *
+ * The file is written in host byte order and is meant to be replayed on
+ * the same kind of host:
+ *
+ *     "SCDETREC" <u32 version>
+ *     'N' <u16 name_id> <u16 len> <name>           buffer name definition
+ *     'T' <u16 alproto> <u8 ipproto> <u8 flags>    start of a tx
+ *     'B' <u16 name_id> <u32 local_id> <u32 len> <data>
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-parse.h"
+#include "detect-engine-record.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#define RECORD_MAGIC        "SCDETREC"
+#define RECORD_MAGIC_LEN    8
+#define RECORD_VERSION      1
+
+#define RECORD_TYPE_NAME    'N'
+#define RECORD_TYPE_TX      'T'
+#define RECORD_TYPE_BUFFER  'B'
+
+bool g_detect_record_buffers = false;
+
+static SCMutex g_record_lock = SCMUTEX_INITIALIZER;
+static FILE *g_record_fp = NULL;
+/* names written so far. The buffer type names are registered once at
+ * startup and shared by all detect engines, so the pointers are stable
+ * and are compared as such. */
+static const char **g_record_names = NULL;
+static uint16_t g_record_names_cnt = 0;
+
+int DetectBufferRecordSetup(void)
+{
+    const char *path = NULL;
+    if (ConfGet("detect.record-buffers", &path) != 1 || path == NULL ||
+            strlen(path) == 0)
+        return 0;
+
+    g_record_fp = fopen(path, "wb");
+    if (g_record_fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    const uint32_t version = RECORD_VERSION;
+    if (fwrite(RECORD_MAGIC, RECORD_MAGIC_LEN, 1, g_record_fp) != 1 ||
+            fwrite(&version, sizeof(version), 1, g_record_fp) != 1) {
+        SCLogError(SC_ERR_FWRITE, "failed to write to %s: %s", path, strerror(errno));
+        fclose(g_record_fp);
+        g_record_fp = NULL;
+        return -1;
+    }
+
+    SCLogConfig("recording the inspection buffers to %s", path);
+    g_detect_record_buffers = true;
+    return 0;
+}
+
+void DetectBufferRecordDeinit(void)
+{
+    SCMutexLock(&g_record_lock);
+    g_detect_record_buffers = false;
+    if (g_record_fp != NULL) {
+        fclose(g_record_fp);
+        g_record_fp = NULL;
+    }
+    SCFree(g_record_names);
+    g_record_names = NULL;
+    g_record_names_cnt = 0;
+    SCMutexUnlock(&g_record_lock);
+}
+
+/** \internal
+ *  \brief get the id of a name, writing its definition on first use
+ *  \retval id or -1 on error */
+static int RecordNameId(const char *name)
+{
+    for (uint16_t i = 0; i < g_record_names_cnt; i++) {
+        if (g_record_names[i] == name)
+            return i;
+    }
+    if (g_record_names_cnt == UINT16_MAX)
+        return -1;
+
+    const char **names = SCRealloc(g_record_names,
+            (g_record_names_cnt + 1) * sizeof(char *));
+    if (names == NULL)
+        return -1;
+    g_record_names = names;
+
+    const uint16_t id = g_record_names_cnt;
+    const uint16_t len = (uint16_t)strlen(name);
+    const uint8_t type = RECORD_TYPE_NAME;
+    if (fwrite(&type, 1, 1, g_record_fp) != 1 ||
+            fwrite(&id, sizeof(id), 1, g_record_fp) != 1 ||
+            fwrite(&len, sizeof(len), 1, g_record_fp) != 1 ||
+            fwrite(name, len, 1, g_record_fp) != 1)
+        return -1;
+
+    g_record_names[g_record_names_cnt++] = name;
+    return id;
+}
+
+static int RecordBuffer(const char *name, const uint32_t local_id,
+        const InspectionBuffer *buffer)
+{
+    const int id = RecordNameId(name);
+    if (id < 0)
+        return -1;
+
+    const uint16_t name_id = (uint16_t)id;
+    const uint8_t type = RECORD_TYPE_BUFFER;
+    if (fwrite(&type, 1, 1, g_record_fp) != 1 ||
+            fwrite(&name_id, sizeof(name_id), 1, g_record_fp) != 1 ||
+            fwrite(&local_id, sizeof(local_id), 1, g_record_fp) != 1 ||
+            fwrite(&buffer->orig_len, sizeof(buffer->orig_len), 1, g_record_fp) != 1)
+        return -1;
+    if (buffer->orig_len > 0 &&
+            fwrite(buffer->orig, buffer->orig_len, 1, g_record_fp) != 1)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief check if a list with the same name was already seen in the queue
+ *
+ *  Transformed lists share the name (and the untransformed data) of their
+ *  base list, so only the first of them is recorded. */
+static bool RecordSeenBefore(const DetectEngineCtx *de_ctx, const uint32_t *queue,
+        const uint32_t idx, const char *name)
+{
+    for (uint32_t i = 0; i < idx; i++) {
+        if (DetectBufferTypeGetNameById(de_ctx, queue[i]) == name)
+            return true;
+    }
+    return false;
+}
+
+/**
+ *  \brief append the inspection buffers set up for a tx to the recording
+ *
+ *  Called at the end of the inspection of the tx, before the buffers are
+ *  cleaned up. Only the buffers used by the loaded rules are available.
+ */
+void DetectBufferRecordTx(const DetectEngineCtx *de_ctx,
+        const DetectEngineThreadCtx *det_ctx, const uint8_t ipproto,
+        const AppProto alproto, const uint8_t flow_flags)
+{
+    if (det_ctx->inspect.to_clear_idx == 0 && det_ctx->multi_inspect.to_clear_idx == 0)
+        return;
+
+    SCMutexLock(&g_record_lock);
+    if (g_record_fp == NULL)
+        goto end;
+
+    const uint8_t type = RECORD_TYPE_TX;
+    const uint16_t proto = alproto;
+    const uint8_t dir = flow_flags & (STREAM_TOSERVER|STREAM_TOCLIENT);
+    if (fwrite(&type, 1, 1, g_record_fp) != 1 ||
+            fwrite(&proto, sizeof(proto), 1, g_record_fp) != 1 ||
+            fwrite(&ipproto, 1, 1, g_record_fp) != 1 ||
+            fwrite(&dir, 1, 1, g_record_fp) != 1)
+        goto error;
+
+    for (uint32_t i = 0; i < det_ctx->inspect.to_clear_idx; i++) {
+        const uint32_t list_id = det_ctx->inspect.to_clear_queue[i];
+        const InspectionBuffer *buffer = &det_ctx->inspect.buffers[list_id];
+        const char *name = DetectBufferTypeGetNameById(de_ctx, list_id);
+        if (buffer->inspect == NULL || name == NULL ||
+                RecordSeenBefore(de_ctx, det_ctx->inspect.to_clear_queue, i, name))
+            continue;
+        if (RecordBuffer(name, 0, buffer) < 0)
+            goto error;
+    }
+    for (uint32_t i = 0; i < det_ctx->multi_inspect.to_clear_idx; i++) {
+        const uint32_t list_id = det_ctx->multi_inspect.to_clear_queue[i];
+        const InspectionBufferMultipleForList *mbuffer =
+            &det_ctx->multi_inspect.buffers[list_id];
+        const char *name = DetectBufferTypeGetNameById(de_ctx, list_id);
+        if (name == NULL ||
+                RecordSeenBefore(de_ctx, det_ctx->multi_inspect.to_clear_queue, i, name))
+            continue;
+        for (uint32_t x = 0; x <= mbuffer->max && x < mbuffer->size; x++) {
+            const InspectionBuffer *buffer = &mbuffer->inspection_buffers[x];
+            if (buffer->inspect == NULL)
+                continue;
+            if (RecordBuffer(name, x, buffer) < 0)
+                goto error;
+        }
+    }
+end:
+    SCMutexUnlock(&g_record_lock);
+    return;
+error:
+    SCLogError(SC_ERR_FWRITE, "writing the buffer recording failed: %s, "
+            "recording stopped", strerror(errno));
+    fclose(g_record_fp);
+    g_record_fp = NULL;
+    g_detect_record_buffers = false;
+    SCMutexUnlock(&g_record_lock);
+}
+
+/** \internal
+ *  \brief read 'len' bytes at 'pos', bounds checked */
+static const uint8_t *RecordRead(const DetectBufferRecording *rec, size_t *pos,
+        const size_t len, void *out)
+{
+    if (rec->data_len - *pos < len)
+        return NULL;
+    const uint8_t *ptr = rec->data + *pos;
+    if (out != NULL)
+        memcpy(out, ptr, len);
+    *pos += len;
+    return ptr;
+}
+
+static int RecordingAddName(DetectBufferRecording *rec, const uint16_t id,
+        const uint8_t *name, const uint16_t len)
+{
+    if (id != rec->names_cnt)
+        return -1;
+    char **names = SCRealloc(rec->names, (rec->names_cnt + 1) * sizeof(char *));
+    if (names == NULL)
+        return -1;
+    rec->names = names;
+    char *str = SCMalloc(len + 1);
+    if (str == NULL)
+        return -1;
+    memcpy(str, name, len);
+    str[len] = '\0';
+    rec->names[rec->names_cnt++] = str;
+    return 0;
+}
+
+/**
+ *  \brief load a recording made with 'detect.record-buffers'
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, rec is freed
+ */
+int DetectBufferRecordingLoad(const char *path, DetectBufferRecording *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size < RECORD_MAGIC_LEN + 4) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is not a buffer recording", path);
+        fclose(fp);
+        return -1;
+    }
+    rec->data_len = (size_t)st.st_size;
+    rec->data = SCMalloc(rec->data_len);
+    if (rec->data == NULL || fread(rec->data, rec->data_len, 1, fp) != 1) {
+        fclose(fp);
+        goto error;
+    }
+    fclose(fp);
+
+    uint32_t version = 0;
+    size_t pos = RECORD_MAGIC_LEN;
+    if (memcmp(rec->data, RECORD_MAGIC, RECORD_MAGIC_LEN) != 0 ||
+            RecordRead(rec, &pos, sizeof(version), &version) == NULL ||
+            version != RECORD_VERSION) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is not a buffer recording "
+                "of version %u", path, RECORD_VERSION);
+        goto error;
+    }
+
+    uint32_t txs_size = 0;
+    uint32_t buffers_size = 0;
+    DetectRecordedTx *tx = NULL;
+    while (pos < rec->data_len) {
+        uint8_t type = 0;
+        (void)RecordRead(rec, &pos, 1, &type);
+
+        if (type == RECORD_TYPE_NAME) {
+            uint16_t id, len;
+            const uint8_t *name;
+            if (RecordRead(rec, &pos, sizeof(id), &id) == NULL ||
+                    RecordRead(rec, &pos, sizeof(len), &len) == NULL ||
+                    (name = RecordRead(rec, &pos, len, NULL)) == NULL ||
+                    RecordingAddName(rec, id, name, len) < 0)
+                goto corrupt;
+
+        } else if (type == RECORD_TYPE_TX) {
+            if (rec->txs_cnt == txs_size) {
+                uint32_t size = txs_size ? txs_size * 2 : 1024;
+                void *ptr = SCRealloc(rec->txs, size * sizeof(DetectRecordedTx));
+                if (ptr == NULL)
+                    goto error;
+                rec->txs = ptr;
+                txs_size = size;
+            }
+            tx = &rec->txs[rec->txs_cnt];
+            memset(tx, 0, sizeof(*tx));
+            uint16_t alproto;
+            if (RecordRead(rec, &pos, sizeof(alproto), &alproto) == NULL ||
+                    RecordRead(rec, &pos, 1, &tx->ipproto) == NULL ||
+                    RecordRead(rec, &pos, 1, &tx->flow_flags) == NULL)
+                goto corrupt;
+            tx->alproto = alproto;
+            tx->buffers_idx = rec->buffers_cnt;
+            rec->txs_cnt++;
+
+        } else if (type == RECORD_TYPE_BUFFER) {
+            if (tx == NULL)
+                goto corrupt;
+            if (rec->buffers_cnt == buffers_size) {
+                uint32_t size = buffers_size ? buffers_size * 2 : 4096;
+                void *ptr = SCRealloc(rec->buffers, size * sizeof(DetectRecordedBuffer));
+                if (ptr == NULL)
+                    goto error;
+                rec->buffers = ptr;
+                buffers_size = size;
+            }
+            DetectRecordedBuffer *b = &rec->buffers[rec->buffers_cnt];
+            if (RecordRead(rec, &pos, sizeof(b->name_id), &b->name_id) == NULL ||
+                    RecordRead(rec, &pos, sizeof(b->local_id), &b->local_id) == NULL ||
+                    RecordRead(rec, &pos, sizeof(b->len), &b->len) == NULL ||
+                    (b->data = RecordRead(rec, &pos, b->len, NULL)) == NULL ||
+                    b->name_id >= rec->names_cnt)
+                goto corrupt;
+            rec->buffers_cnt++;
+            tx->buffers_cnt++;
+
+        } else {
+            goto corrupt;
+        }
+    }
+    return 0;
+
+corrupt:
+    SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: corrupt or truncated buffer "
+            "recording at offset %"PRIuMAX, path, (uintmax_t)pos);
+error:
+    DetectBufferRecordingFree(rec);
+    return -1;
+}
+
+void DetectBufferRecordingFree(DetectBufferRecording *rec)
+{
+    for (uint16_t i = 0; i < rec->names_cnt; i++)
+        SCFree(rec->names[i]);
+    SCFree(rec->names);
+    SCFree(rec->txs);
+    SCFree(rec->buffers);
+    SCFree(rec->data);
+    memset(rec, 0, sizeof(*rec));
+}
+
+#ifdef UNITTESTS
+static int DetectBufferRecordTest01(void)
+{
+    char filename[] = "/tmp/suricata-record-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF_NOT(ConfSet("detect.record-buffers", filename) == 1);
+    FAIL_IF_NOT(DetectBufferRecordSetup() == 0);
+    FAIL_IF_NOT(g_detect_record_buffers);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(http_uri; content:\"/a\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(http_uri; to_lowercase; content:\"/a\"; sid:2;)"));
+    SigGroupBuild(de_ctx);
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    /* the uri as set up by its GetData callback, plus a transformed copy
+     * that must not be recorded again */
+    const int list_id = DetectBufferTypeGetByName("http_uri");
+    FAIL_IF(list_id < 0);
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    InspectionBufferSetup(buffer, (const uint8_t *)"/A/b", 4);
+    int transforms[1] = { DETECT_TRANSFORM_TOLOWER };
+    const int t_list_id = DetectBufferTypeGetByIdTransforms(de_ctx, list_id, transforms, 1);
+    FAIL_IF(t_list_id < 0 || t_list_id == list_id);
+    buffer = InspectionBufferGet(det_ctx, t_list_id);
+    InspectionBufferSetup(buffer, (const uint8_t *)"/A/b", 4);
+    InspectionBufferApplyTransforms(buffer, &de_ctx->buffer_type_map[t_list_id]->transforms);
+
+    DetectBufferRecordTx(de_ctx, det_ctx, IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOSERVER);
+    InspectionBufferClean(det_ctx);
+    /* nothing set up, nothing recorded */
+    DetectBufferRecordTx(de_ctx, det_ctx, IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOCLIENT);
+    DetectBufferRecordDeinit();
+
+    DetectBufferRecording rec;
+    FAIL_IF_NOT(DetectBufferRecordingLoad(filename, &rec) == 0);
+    unlink(filename);
+    FAIL_IF_NOT(rec.names_cnt == 1);
+    FAIL_IF_NOT(strcmp(rec.names[0], "http_uri") == 0);
+    FAIL_IF_NOT(rec.txs_cnt == 1);
+    FAIL_IF_NOT(rec.txs[0].alproto == ALPROTO_HTTP);
+    FAIL_IF_NOT(rec.txs[0].ipproto == IPPROTO_TCP);
+    FAIL_IF_NOT(rec.txs[0].flow_flags == STREAM_TOSERVER);
+    FAIL_IF_NOT(rec.txs[0].buffers_cnt == 1);
+    FAIL_IF_NOT(rec.buffers_cnt == 1);
+    FAIL_IF_NOT(rec.buffers[0].len == 4);
+    /* untransformed data */
+    FAIL_IF_NOT(memcmp(rec.buffers[0].data, "/A/b", 4) == 0);
+    DetectBufferRecordingFree(&rec);
+
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+/** \test truncated recordings are rejected */
+static int DetectBufferRecordTest02(void)
+{
+    char filename[] = "/tmp/suricata-record-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "wb");
+    FAIL_IF_NULL(fp);
+    const uint32_t version = RECORD_VERSION;
+    const uint8_t tx[] = { RECORD_TYPE_TX, 1, 0, IPPROTO_TCP, STREAM_TOSERVER };
+    const uint8_t buf[] = { RECORD_TYPE_BUFFER, 0, 0 };
+    fwrite(RECORD_MAGIC, RECORD_MAGIC_LEN, 1, fp);
+    fwrite(&version, sizeof(version), 1, fp);
+    fwrite(tx, sizeof(tx), 1, fp);
+    fwrite(buf, sizeof(buf), 1, fp);
+    fclose(fp);
+
+    DetectBufferRecording rec;
+    FAIL_IF_NOT(DetectBufferRecordingLoad(filename, &rec) == -1);
+    FAIL_IF_NOT(rec.data == NULL && rec.txs == NULL);
+    unlink(filename);
+    PASS;
+}
+
+void DetectBufferRecordRegisterTests(void)
+{
+    UtRegisterTest("DetectBufferRecordTest01", DetectBufferRecordTest01);
+    UtRegisterTest("DetectBufferRecordTest02", DetectBufferRecordTest02);
+}
+#endif
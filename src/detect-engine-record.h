@@ -0,0 +1,72 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Recording of the app-layer inspection buffers per transaction, for
+ * replaying them through the detection engine only (--bench=detect).
+ */
+
+#ifndef __DETECT_ENGINE_RECORD_H__
+#define __DETECT_ENGINE_RECORD_H__
+
+/** a recorded buffer, the data points into DetectBufferRecording::data */
+typedef struct DetectRecordedBuffer_ {
+    uint16_t name_id;
+    uint32_t local_id;  /**< index for multi buffers, 0 otherwise */
+    uint32_t len;
+    const uint8_t *data;
+} DetectRecordedBuffer;
+
+typedef struct DetectRecordedTx_ {
+    AppProto alproto;
+    uint8_t ipproto;
+    uint8_t flow_flags;     /**< STREAM_TOSERVER or STREAM_TOCLIENT */
+    uint32_t buffers_idx;   /**< first buffer in DetectBufferRecording::buffers */
+    uint32_t buffers_cnt;
+} DetectRecordedTx;
+
+typedef struct DetectBufferRecording_ {
+    uint8_t *data;          /**< the whole file */
+    size_t data_len;
+
+    char **names;           /**< buffer names, indexed by name_id */
+    uint16_t names_cnt;
+
+    DetectRecordedTx *txs;
+    uint32_t txs_cnt;
+    DetectRecordedBuffer *buffers;
+    uint32_t buffers_cnt;
+} DetectBufferRecording;
+
+extern bool g_detect_record_buffers;
+
+int DetectBufferRecordSetup(void);
+void DetectBufferRecordDeinit(void);
+void DetectBufferRecordTx(const DetectEngineCtx *de_ctx,
+        const DetectEngineThreadCtx *det_ctx, const uint8_t ipproto,
+        const AppProto alproto, const uint8_t flow_flags);
+
+int DetectBufferRecordingLoad(const char *path, DetectBufferRecording *rec);
+void DetectBufferRecordingFree(DetectBufferRecording *rec);
+
+#ifdef UNITTESTS
+void DetectBufferRecordRegisterTests(void);
+#endif
+
+#endif /* __DETECT_ENGINE_RECORD_H__ */
@@ -98,6 +98,7 @@
 #include "detect-classtype.h"
 #include "detect-reference.h"
 #include "detect-tag.h"
+#include "detect-ebpf-drop.h"
 #include "detect-threshold.h"
 #include "detect-metadata.h"
 #include "detect-msg.h"
@@ -139,6 +140,7 @@
 #include "detect-dce-stub-data.h"
 #include "detect-urilen.h"
 #include "detect-bsize.h"
+#include "detect-dataset.h"
 #include "detect-detection-filter.h"
 #include "detect-http-client-body.h"
 #include "detect-http-server-body.h"
@@ -153,6 +155,7 @@
 #include "detect-http-request-line.h"
 #include "detect-http-response-line.h"
 #include "detect-byte-extract.h"
+#include "detect-bytemath.h"
 #include "detect-file-data.h"
 #include "detect-pkt-data.h"
 #include "detect-replace.h"
@@ -180,6 +183,8 @@
 #include "detect-transform-md5.h"
 #include "detect-transform-sha1.h"
 #include "detect-transform-sha256.h"
+#include "detect-transform-casechange.h"
+#include "detect-transform-urldecode.h"
 
 #include "util-rule-vars.h"
 
@@ -380,6 +385,7 @@ void SigTableSetup(void)
     DetectClasstypeRegister();
     DetectReferenceRegister();
     DetectTagRegister();
+    DetectEbpfDropRegister();
     DetectThresholdRegister();
     DetectMetadataRegister();
     DetectMsgRegister();
@@ -496,6 +502,7 @@ void SigTableSetup(void)
     DetectNfsVersionRegister();
     DetectUrilenRegister();
     DetectBsizeRegister();
+    DetectDatasetRegister();
     DetectDetectionFilterRegister();
     DetectAsn1Register();
     DetectSshProtocolRegister();
@@ -505,6 +512,7 @@ void SigTableSetup(void)
     DetectSslStateRegister();
     DetectSslVersionRegister();
     DetectByteExtractRegister();
+    DetectBytemathRegister();
     DetectFiledataRegister();
     DetectPktDataRegister();
     DetectLuaRegister();
@@ -528,6 +536,8 @@ void SigTableSetup(void)
     DetectTransformMd5Register();
     DetectTransformSha1Register();
     DetectTransformSha256Register();
+    DetectTransformToLowerRegister();
+    DetectTransformUrlDecodeRegister();
 
     /* close keyword registration */
     DetectBufferTypeCloseRegistration();
@@ -55,6 +55,7 @@ enum {
     DETECT_METADATA,
     DETECT_REFERENCE,
     DETECT_TAG,
+    DETECT_EBPF_DROP,
     DETECT_MSG,
     DETECT_CONTENT,
     DETECT_URICONTENT,
@@ -100,6 +101,7 @@ enum {
     DETECT_MARK,
 
     DETECT_BSIZE,
+    DETECT_DATASET,
 
     DETECT_AL_TLS_VERSION,
     DETECT_AL_TLS_SUBJECT,
@@ -161,6 +163,7 @@ enum {
     DETECT_AL_SSL_VERSION,
     DETECT_AL_SSL_STATE,
     DETECT_BYTE_EXTRACT,
+    DETECT_BYTEMATH,
     DETECT_FILE_DATA,
     DETECT_PKT_DATA,
     DETECT_AL_APP_LAYER_EVENT,
@@ -236,6 +239,8 @@ enum {
     DETECT_TRANSFORM_MD5,
     DETECT_TRANSFORM_SHA1,
     DETECT_TRANSFORM_SHA256,
+    DETECT_TRANSFORM_TOLOWER,
+    DETECT_TRANSFORM_URL_DECODE,
 
     /* make sure this stays last */
     DETECT_TBLSIZE,
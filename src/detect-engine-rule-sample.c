@@ -0,0 +1,556 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled rule profiling.
+ *
+ * The rule profiling of util-profiling-rules.c needs --enable-profiling,
+ * which is too slow for production. This is always compiled in: when
+ * the rate is set, each detect thread measures the ticks of 1 in 'rate'
+ * rule inspections. When disabled, the cost is a load and a branch per
+ * rule inspection.
+ *
+ * Each thread writes its own counters, allocated at its first sample.
+ * Only the thread writes them, so the updates are plain atomic stores
+ * that the dump can read while the thread runs. The threads are only
+ * registered with the engine under a lock, once.
+ *
+ * The rate is set by detect.rule-sampling.rate and at runtime by the
+ * ruleset-profile-sample unix socket command. The rules with the most
+ * sampled ticks are returned by ruleset-profile-sample-top, and written
+ * to detect.rule-sampling.filename when the detection engine is freed.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-parse.h"
+#include "detect-engine-rule-sample.h"
+#include "conf.h"
+#include "util-conf.h"
+#include "util-path.h"
+#include "util-time.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#include <jansson.h>
+
+#define RULE_SAMPLE_TOP_DEFAULT 20
+#define RULE_SAMPLE_TOP_MAX     1000
+#define RULE_SAMPLE_RATE_MAX    1000000000
+
+typedef struct DetectRuleSampleData_ {
+    uint64_t samples;
+    uint64_t matches;
+    uint64_t ticks;
+    uint64_t max;
+} DetectRuleSampleData;
+
+/** counters of a detect thread, per Signature::num */
+typedef struct DetectRuleSampleThread_ {
+    DetectRuleSampleData *data;
+    struct DetectRuleSampleThread_ *next;
+} DetectRuleSampleThread;
+
+typedef struct DetectRuleSample_ {
+    uint32_t sigs;
+    /** protects threads and merged */
+    SCMutex lock;
+    DetectRuleSampleThread *threads;
+    /** counters of the threads that are gone */
+    DetectRuleSampleData *merged;
+} DetectRuleSample;
+
+/** summary of a rule for the output */
+typedef struct RuleSampleSummary_ {
+    const Signature *s;
+    DetectRuleSampleData d;
+} RuleSampleSummary;
+
+uint32_t g_detect_rule_sample_rate = 0;
+static char rule_sample_file_name[PATH_MAX] = "";
+static uint32_t rule_sample_limit = 100;
+
+/**
+ * \brief Read the detect.rule-sampling config.
+ */
+void DetectRuleSampleGlobalInit(void)
+{
+    intmax_t rate = 0;
+    if (ConfGetInt("detect.rule-sampling.rate", &rate) == 1) {
+        if (rate < 0 || rate > RULE_SAMPLE_RATE_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.rule-sampling.rate %"PRIdMAX, rate);
+        } else {
+            g_detect_rule_sample_rate = (uint32_t)rate;
+        }
+    }
+
+    intmax_t limit = 0;
+    if (ConfGetInt("detect.rule-sampling.limit", &limit) == 1 && limit > 0)
+        rule_sample_limit = (uint32_t)MIN(limit, UINT32_MAX);
+
+    const char *filename = NULL;
+    if (ConfGet("detect.rule-sampling.filename", &filename) == 1 &&
+            filename != NULL) {
+        if (PathIsAbsolute(filename)) {
+            strlcpy(rule_sample_file_name, filename,
+                    sizeof(rule_sample_file_name));
+        } else {
+            snprintf(rule_sample_file_name, sizeof(rule_sample_file_name),
+                    "%s/%s", ConfigGetLogDirectory(), filename);
+        }
+    }
+
+    if (g_detect_rule_sample_rate > 0) {
+        SCLogConfig("sampling 1 in %u rule inspections",
+                g_detect_rule_sample_rate);
+    }
+}
+
+/**
+ * \brief Set up the sampling of an engine, must be called after the
+ *        internal sig ids are assigned.
+ */
+void DetectRuleSampleSetup(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->rule_sample != NULL || de_ctx->signum == 0)
+        return;
+
+    DetectRuleSample *rs = SCCalloc(1, sizeof(*rs));
+    if (unlikely(rs == NULL))
+        return;
+    SCMutexInit(&rs->lock, NULL);
+    rs->sigs = de_ctx->signum;
+    de_ctx->rule_sample = rs;
+}
+
+static inline void RuleSampleStore(uint64_t *ptr, const uint64_t v)
+{
+    __atomic_store_n(ptr, v, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t RuleSampleLoad(const uint64_t *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static DetectRuleSampleThread *RuleSampleThreadRegister(DetectRuleSample *rs)
+{
+    DetectRuleSampleThread *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    t->data = SCCalloc(rs->sigs, sizeof(DetectRuleSampleData));
+    if (unlikely(t->data == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+
+    SCMutexLock(&rs->lock);
+    t->next = rs->threads;
+    rs->threads = t;
+    SCMutexUnlock(&rs->lock);
+    return t;
+}
+
+/**
+ * \brief Store a sampled rule inspection.
+ *
+ * \param ticks ticks spent on the inspection of the rule
+ * \param match did the rule match?
+ */
+void DetectRuleSampleRecord(DetectEngineThreadCtx *det_ctx,
+        const Signature *s, const uint64_t ticks, const bool match)
+{
+    DetectRuleSample *rs = det_ctx->de_ctx->rule_sample;
+    if (rs == NULL || s->num >= rs->sigs)
+        return;
+
+    DetectRuleSampleThread *t = det_ctx->rule_sample;
+    if (unlikely(t == NULL)) {
+        t = RuleSampleThreadRegister(rs);
+        if (t == NULL)
+            return;
+        det_ctx->rule_sample = t;
+    }
+
+    /* we are the only writer */
+    DetectRuleSampleData *d = &t->data[s->num];
+    RuleSampleStore(&d->samples, d->samples + 1);
+    if (match)
+        RuleSampleStore(&d->matches, d->matches + 1);
+    RuleSampleStore(&d->ticks, d->ticks + ticks);
+    if (ticks > d->max)
+        RuleSampleStore(&d->max, ticks);
+}
+
+static void RuleSampleAdd(DetectRuleSampleData *dst, const DetectRuleSampleData *src)
+{
+    dst->samples += RuleSampleLoad(&src->samples);
+    dst->matches += RuleSampleLoad(&src->matches);
+    dst->ticks += RuleSampleLoad(&src->ticks);
+    const uint64_t max = RuleSampleLoad(&src->max);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+/**
+ * \brief Move the counters of the thread to the engine.
+ */
+void DetectRuleSampleThreadDeinit(DetectEngineThreadCtx *det_ctx)
+{
+    DetectRuleSampleThread *t = det_ctx->rule_sample;
+    if (t == NULL)
+        return;
+    det_ctx->rule_sample = NULL;
+
+    DetectRuleSample *rs = det_ctx->de_ctx->rule_sample;
+    SCMutexLock(&rs->lock);
+    DetectRuleSampleThread **pt = &rs->threads;
+    while (*pt != NULL && *pt != t)
+        pt = &(*pt)->next;
+    if (*pt != NULL)
+        *pt = t->next;
+
+    if (rs->merged == NULL)
+        rs->merged = SCCalloc(rs->sigs, sizeof(DetectRuleSampleData));
+    if (rs->merged != NULL) {
+        for (uint32_t i = 0; i < rs->sigs; i++) {
+            RuleSampleAdd(&rs->merged[i], &t->data[i]);
+        }
+    }
+    SCMutexUnlock(&rs->lock);
+
+    SCFree(t->data);
+    SCFree(t);
+}
+
+static int RuleSampleSortByTicks(const void *a, const void *b)
+{
+    const RuleSampleSummary *s0 = a;
+    const RuleSampleSummary *s1 = b;
+    if (s1->d.ticks == s0->d.ticks)
+        return 0;
+    return s0->d.ticks > s1->d.ticks ? -1 : 1;
+}
+
+/** \internal
+ *  \brief get the counters of the engine and all its threads, the rules
+ *         with samples sorted by ticks
+ *
+ *  \param total set to the total of the ticks
+ *  \retval cnt number of rules in summary */
+static uint32_t RuleSampleSummarize(const DetectEngineCtx *de_ctx,
+        RuleSampleSummary **summary, uint64_t *total)
+{
+    DetectRuleSample *rs = de_ctx->rule_sample;
+    *summary = NULL;
+    *total = 0;
+
+    DetectRuleSampleData *data = SCCalloc(rs->sigs, sizeof(*data));
+    if (unlikely(data == NULL))
+        return 0;
+
+    SCMutexLock(&rs->lock);
+    if (rs->merged != NULL) {
+        memcpy(data, rs->merged, rs->sigs * sizeof(*data));
+    }
+    for (DetectRuleSampleThread *t = rs->threads; t != NULL; t = t->next) {
+        for (uint32_t i = 0; i < rs->sigs; i++) {
+            RuleSampleAdd(&data[i], &t->data[i]);
+        }
+    }
+    SCMutexUnlock(&rs->lock);
+
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < rs->sigs; i++) {
+        if (data[i].samples > 0)
+            cnt++;
+    }
+    RuleSampleSummary *list = NULL;
+    if (cnt > 0) {
+        list = SCCalloc(cnt, sizeof(*list));
+        if (unlikely(list == NULL)) {
+            SCFree(data);
+            return 0;
+        }
+    }
+    cnt = 0;
+    for (uint32_t i = 0; i < rs->sigs; i++) {
+        if (data[i].samples == 0 || de_ctx->sig_array[i] == NULL)
+            continue;
+        list[cnt].s = de_ctx->sig_array[i];
+        list[cnt].d = data[i];
+        *total += data[i].ticks;
+        cnt++;
+    }
+    SCFree(data);
+
+    if (cnt > 0)
+        qsort(list, cnt, sizeof(*list), RuleSampleSortByTicks);
+    *summary = list;
+    return cnt;
+}
+
+/** \internal
+ *  \brief the top rules, with the fields of the rule profiling json */
+static json_t *RuleSampleToJson(const DetectEngineCtx *de_ctx, uint32_t limit)
+{
+    RuleSampleSummary *summary;
+    uint64_t total_ticks;
+    const uint32_t cnt = RuleSampleSummarize(de_ctx, &summary, &total_ticks);
+
+    json_t *js = json_object();
+    json_t *jsa = json_array();
+    if (js == NULL || jsa == NULL) {
+        if (js != NULL)
+            json_decref(js);
+        if (jsa != NULL)
+            json_decref(jsa);
+        SCFree(summary);
+        return NULL;
+    }
+
+    char timebuf[64];
+    struct timeval tval;
+    gettimeofday(&tval, NULL);
+    CreateIsoTimeString(&tval, timebuf, sizeof(timebuf));
+    json_object_set_new(js, "timestamp", json_string(timebuf));
+    json_object_set_new(js, "sort", json_string("ticks"));
+    json_object_set_new(js, "rate", json_integer(
+                __atomic_load_n(&g_detect_rule_sample_rate, __ATOMIC_RELAXED)));
+
+    for (uint32_t i = 0; i < cnt && i < limit; i++) {
+        const RuleSampleSummary *r = &summary[i];
+        json_t *jsm = json_object();
+        if (jsm == NULL)
+            continue;
+        json_object_set_new(jsm, "signature_id", json_integer(r->s->id));
+        json_object_set_new(jsm, "gid", json_integer(r->s->gid));
+        json_object_set_new(jsm, "rev", json_integer(r->s->rev));
+
+        json_object_set_new(jsm, "samples", json_integer(r->d.samples));
+        json_object_set_new(jsm, "matches", json_integer(r->d.matches));
+
+        json_object_set_new(jsm, "ticks_total", json_integer(r->d.ticks));
+        json_object_set_new(jsm, "ticks_max", json_integer(r->d.max));
+        json_object_set_new(jsm, "ticks_avg",
+                json_integer(r->d.ticks / r->d.samples));
+
+        double percent = (long double)r->d.ticks /
+            (long double)total_ticks * 100;
+        json_object_set_new(jsm, "percent", json_integer(percent));
+        json_array_append_new(jsa, jsm);
+    }
+    json_object_set_new(js, "rules", jsa);
+    SCFree(summary);
+    return js;
+}
+
+/** \internal
+ *  \brief append the top rules to the file, as a single line of json */
+static void RuleSampleDump(const DetectEngineCtx *de_ctx)
+{
+    json_t *js = RuleSampleToJson(de_ctx, rule_sample_limit);
+    if (js == NULL)
+        return;
+    if (json_array_size(json_object_get(js, "rules")) == 0) {
+        json_decref(js);
+        return;
+    }
+
+    FILE *fp = fopen(rule_sample_file_name, "a");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s",
+                rule_sample_file_name, strerror(errno));
+        json_decref(js);
+        return;
+    }
+    char *js_s = json_dumps(js,
+            JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+            JSON_ESCAPE_SLASH);
+    if (js_s != NULL) {
+        fprintf(fp, "%s\n", js_s);
+        free(js_s);
+    }
+    fclose(fp);
+    json_decref(js);
+}
+
+/**
+ * \brief Write the top rules to the file if configured and free the
+ *        sampling data. The detect threads must be gone.
+ */
+void DetectRuleSampleFree(DetectEngineCtx *de_ctx)
+{
+    DetectRuleSample *rs = de_ctx->rule_sample;
+    if (rs == NULL)
+        return;
+
+    if (rule_sample_file_name[0] != '\0' && de_ctx->sig_array != NULL)
+        RuleSampleDump(de_ctx);
+
+    DetectRuleSampleThread *t = rs->threads;
+    while (t != NULL) {
+        DetectRuleSampleThread *next = t->next;
+        SCFree(t->data);
+        SCFree(t);
+        t = next;
+    }
+    SCFree(rs->merged);
+    SCMutexDestroy(&rs->lock);
+    SCFree(rs);
+    de_ctx->rule_sample = NULL;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief Unix socket command: get or set the sampling rate.
+ *
+ * Optional argument "rate", sample 1 in this many rule inspections.
+ * 0 disables the sampling.
+ */
+TmEcode DetectRuleSampleCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "rate");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 0 ||
+                json_integer_value(jarg) > RULE_SAMPLE_RATE_MAX) {
+            json_object_set_new(answer, "message",
+                    json_string("rate is not an integer between 0 and 1000000000"));
+            return TM_ECODE_FAILED;
+        }
+        const uint32_t rate = (uint32_t)json_integer_value(jarg);
+        __atomic_store_n(&g_detect_rule_sample_rate, rate, __ATOMIC_RELAXED);
+        SCLogNotice("rule sampling rate set to %u", rate);
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(jdata, "rate", json_integer(
+                __atomic_load_n(&g_detect_rule_sample_rate, __ATOMIC_RELAXED)));
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Unix socket command: the rules with the most sampled ticks.
+ *
+ * Optional argument "count", the number of rules to list.
+ */
+TmEcode DetectRuleSampleTopCommand(json_t *cmd, json_t *answer, void *data)
+{
+    uint32_t count = RULE_SAMPLE_TOP_DEFAULT;
+    json_t *jarg = json_object_get(cmd, "count");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > RULE_SAMPLE_TOP_MAX) {
+            json_object_set_new(answer, "message",
+                    json_string("count is not an integer between 1 and 1000"));
+            return TM_ECODE_FAILED;
+        }
+        count = (uint32_t)json_integer_value(jarg);
+    }
+
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    if (de_ctx == NULL || de_ctx->rule_sample == NULL) {
+        if (de_ctx != NULL)
+            DetectEngineDeReference(&de_ctx);
+        json_object_set_new(answer, "message",
+                json_string("no rules to sample"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *js = RuleSampleToJson(de_ctx, count);
+    DetectEngineDeReference(&de_ctx);
+    if (js == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+/**
+ * \test Every inspection is sampled at rate 1, the counters of the thread
+ *       are kept when the thread is gone.
+ */
+static int DetectRuleSampleTest01(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    memset(&tv, 0, sizeof(tv));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"boo\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"boo\"; fast_pattern; content:\"far\"; sid:2;)"));
+    SigGroupBuild(de_ctx);
+    FAIL_IF_NULL(de_ctx->rule_sample);
+    DetectEngineThreadCtxInit(&tv, de_ctx, (void *)&det_ctx);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"boo", 3, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    /* disabled: nothing is allocated */
+    g_detect_rule_sample_rate = 0;
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p);
+    FAIL_IF_NOT_NULL(det_ctx->rule_sample);
+
+    g_detect_rule_sample_rate = 1;
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p);
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p);
+    g_detect_rule_sample_rate = 0;
+    FAIL_IF_NULL(det_ctx->rule_sample);
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+
+    RuleSampleSummary *summary;
+    uint64_t total;
+    uint32_t cnt = RuleSampleSummarize(de_ctx, &summary, &total);
+    FAIL_IF_NOT(cnt == 2);
+    for (uint32_t i = 0; i < cnt; i++) {
+        FAIL_IF_NOT(summary[i].d.samples == 2);
+        FAIL_IF_NOT(summary[i].d.matches == (summary[i].s->id == 1 ? 2 : 0));
+    }
+    SCFree(summary);
+
+    UTHFreePackets(&p, 1);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectRuleSampleRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectRuleSampleTest01", DetectRuleSampleTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled rule profiling: the cost of 1 in N rule inspections, for use
+ * in builds without --enable-profiling.
+ */
+
+#ifndef __DETECT_ENGINE_RULE_SAMPLE_H__
+#define __DETECT_ENGINE_RULE_SAMPLE_H__
+
+#include "util-cpu.h"
+
+/** inspect 1 in this many rules, 0 if sampling is disabled */
+extern uint32_t g_detect_rule_sample_rate;
+
+void DetectRuleSampleGlobalInit(void);
+void DetectRuleSampleSetup(DetectEngineCtx *de_ctx);
+void DetectRuleSampleFree(DetectEngineCtx *de_ctx);
+void DetectRuleSampleThreadDeinit(DetectEngineThreadCtx *det_ctx);
+void DetectRuleSampleRecord(DetectEngineThreadCtx *det_ctx,
+        const Signature *s, const uint64_t ticks, const bool match);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DetectRuleSampleCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode DetectRuleSampleTopCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void DetectRuleSampleRegisterTests(void);
+
+/** \brief check if this rule inspection is to be sampled */
+static inline bool DetectRuleSampleCheck(DetectEngineThreadCtx *det_ctx)
+{
+    const uint32_t rate = __atomic_load_n(&g_detect_rule_sample_rate, __ATOMIC_RELAXED);
+    if (likely(rate == 0))
+        return false;
+    if (++det_ctx->rule_sample_cnt < rate)
+        return false;
+    det_ctx->rule_sample_cnt = 0;
+    return true;
+}
+
+#define RULE_SAMPLE_START(det_ctx) \
+    uint64_t rule_sample_start_ = 0; \
+    if (unlikely(DetectRuleSampleCheck((det_ctx)))) { \
+        rule_sample_start_ = UtilCpuGetTicks(); \
+    }
+
+#define RULE_SAMPLE_END(det_ctx, s, m) \
+    if (unlikely(rule_sample_start_ != 0)) { \
+        DetectRuleSampleRecord((det_ctx), (s), \
+                UtilCpuGetTicks() - rule_sample_start_, (m)); \
+    }
+
+#endif /* __DETECT_ENGINE_RULE_SAMPLE_H__ */
@@ -143,6 +143,15 @@ error:
     return NULL;
 }
 
+static void SigGroupHeadFreeNonPrefilterBuckets(SignatureNonPrefilterBuckets *b)
+{
+    if (b->array != NULL)
+        SCFree(b->array);
+    if (b->ids != NULL)
+        SCFree(b->ids);
+    memset(b, 0, sizeof(*b));
+}
+
 /**
  * \brief Free a SigGroupHead and its members.
  *
@@ -172,6 +181,9 @@ void SigGroupHeadFree(const DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         sgh->non_pf_syn_store_cnt = 0;
     }
 
+    SigGroupHeadFreeNonPrefilterBuckets(&sgh->non_pf_other_buckets);
+    SigGroupHeadFreeNonPrefilterBuckets(&sgh->non_pf_syn_buckets);
+
     sgh->sig_cnt = 0;
 
     if (sgh->init != NULL) {
@@ -612,6 +624,36 @@ void SigGroupHeadSetFileHashFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/**
+ *  \brief Set the flag for the sgh to keep running the payload mpm on
+ *         flows with encrypted payload, if a sig has 'flow:encrypted'.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetEncryptedFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if (s->flags & SIG_FLAG_ENCRYPTED) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVEENCRYPTED;
+            SCLogDebug("sgh %p inspects encrypted payloads", sgh);
+            break;
+        }
+    }
+
+    return;
+}
+
 /**
  *  \brief Set the filestore_cnt in the sgh.
  *
@@ -639,6 +681,65 @@ void SigGroupHeadSetFilestoreCount(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/** \internal
+ *  \brief group a non prefilter store by mask and alproto
+ *
+ *  The store is in rule id order, so the ids of each bucket are too.
+ *  Buckets are only used if on average they hold at least 2 rules,
+ *  otherwise checking the buckets costs as much as checking the rules.
+ */
+static void SigGroupHeadBuildNonPrefilterBuckets(const SignatureNonPrefilterStore *store,
+        const uint32_t store_cnt, SignatureNonPrefilterBuckets *b)
+{
+    const uint32_t max_buckets = store_cnt / 2;
+    if (max_buckets == 0)
+        return;
+
+    b->array = SCCalloc(max_buckets, sizeof(SignatureNonPrefilterBucket));
+    b->ids = SCCalloc(store_cnt, sizeof(SigIntId));
+    if (b->array == NULL || b->ids == NULL)
+        goto fail;
+
+    /* find the buckets and their sizes */
+    for (uint32_t i = 0; i < store_cnt; i++) {
+        uint32_t x;
+        for (x = 0; x < b->cnt; x++) {
+            if (b->array[x].mask == store[i].mask && b->array[x].alproto == store[i].alproto)
+                break;
+        }
+        if (x == b->cnt) {
+            if (b->cnt == max_buckets)
+                goto fail;
+            b->array[x].mask = store[i].mask;
+            b->array[x].alproto = store[i].alproto;
+            b->cnt++;
+        }
+        b->array[x].cnt++;
+    }
+
+    /* give each bucket its part of the ids */
+    SigIntId *ptr = b->ids;
+    for (uint32_t x = 0; x < b->cnt; x++) {
+        b->array[x].ids = ptr;
+        ptr += b->array[x].cnt;
+        b->array[x].cnt = 0;
+    }
+    for (uint32_t i = 0; i < store_cnt; i++) {
+        for (uint32_t x = 0; x < b->cnt; x++) {
+            SignatureNonPrefilterBucket *bucket = &b->array[x];
+            if (bucket->mask == store[i].mask && bucket->alproto == store[i].alproto) {
+                bucket->ids[bucket->cnt++] = store[i].id;
+                break;
+            }
+        }
+    }
+    SCLogDebug("%u non prefilter rules in %u buckets", store_cnt, b->cnt);
+    return;
+
+fail:
+    SigGroupHeadFreeNonPrefilterBuckets(b);
+}
+
 /** \brief build an array of rule id's for sigs with no prefilter
  *  Also updated de_ctx::non_pf_store_cnt_max to track the highest cnt
  */
@@ -709,6 +810,11 @@ int SigGroupHeadBuildNonPrefilterArray(DetectEngineCtx *de_ctx, SigGroupHead *sg
         }
     }
 
+    SigGroupHeadBuildNonPrefilterBuckets(sgh->non_pf_other_store_array,
+            sgh->non_pf_other_store_cnt, &sgh->non_pf_other_buckets);
+    SigGroupHeadBuildNonPrefilterBuckets(sgh->non_pf_syn_store_array,
+            sgh->non_pf_syn_store_cnt, &sgh->non_pf_syn_buckets);
+
     /* track highest cnt for any sgh in our de_ctx */
     uint32_t max = MAX(sgh->non_pf_other_store_cnt, sgh->non_pf_syn_store_cnt);
     if (max > de_ctx->non_pf_store_cnt_max)
@@ -1197,6 +1303,44 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+
+/**
+ * \test non prefilter rules are grouped by mask
+ */
+static int SigGroupHeadTest11(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(flow:established; dsize:>10; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(dsize:>10; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(flow:established; dsize:>20; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(dsize:>20; sid:4;)"));
+    SigGroupBuild(de_ctx);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"ABC", 3, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    const SigGroupHead *sgh = SigMatchSignaturesGetSgh(de_ctx, p);
+    FAIL_IF_NULL(sgh);
+    FAIL_IF_NOT(sgh->non_pf_other_store_cnt == 4);
+
+    const SignatureNonPrefilterBuckets *b = &sgh->non_pf_other_buckets;
+    FAIL_IF_NOT(b->cnt == 2);
+    for (uint32_t x = 0; x < b->cnt; x++) {
+        FAIL_IF_NOT(b->array[x].cnt == 2);
+        FAIL_IF_NOT(b->array[x].ids[0] < b->array[x].ids[1]);
+    }
+    FAIL_IF(b->array[0].mask == b->array[1].mask);
+
+    UTHFreePackets(&p, 1);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
 #endif
 
 void SigGroupHeadRegisterTests(void)
@@ -1208,5 +1352,6 @@ void SigGroupHeadRegisterTests(void)
     UtRegisterTest("SigGroupHeadTest08", SigGroupHeadTest08);
     UtRegisterTest("SigGroupHeadTest09", SigGroupHeadTest09);
     UtRegisterTest("SigGroupHeadTest10", SigGroupHeadTest10);
+    UtRegisterTest("SigGroupHeadTest11", SigGroupHeadTest11);
 #endif
 }
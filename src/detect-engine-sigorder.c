@@ -36,6 +36,7 @@
 #include "util-unittest-helper.h"
 #include "util-debug.h"
 #include "util-action.h"
+#include "conf.h"
 #include "action-globals.h"
 #include "flow-util.h"
 
@@ -64,6 +65,22 @@
 #define DETECT_XBITS_TYPE_SET_READ 3
 #define DETECT_XBITS_TYPE_SET      4
 
+/** cost of rules without profile data, they go after the profiled ones */
+#define DETECT_COST_UNKNOWN        INT_MAX
+
+/** cost of a rule from a cost profile: the average number of cpu ticks
+ *  spent per check of the rule */
+typedef struct SCSigCost_ {
+    uint32_t gid;
+    uint32_t sid;
+    int cost;
+} SCSigCost;
+
+typedef struct SCSigCostProfile_ {
+    SCSigCost *costs;
+    uint32_t cnt;
+} SCSigCostProfile;
+
 
 /**
  * \brief Registers a keyword-based, signature ordering function
@@ -444,6 +461,67 @@ static inline void SCSigProcessUserDataForFlowbits(SCSigSignatureWrapper *sw)
     sw->user[SC_RADIX_USER_DATA_FLOWBITS] = SCSigGetFlowbitsType(sw->sig);
 }
 
+/** max depth of the flowbits dependency graph we track, deeper chains
+ *  (or loops) are cut off here */
+#define SC_SIG_FLOWBITS_DEPTH_MAX 32
+
+/**
+ * \brief Computes the depth of each signature in the flowbits dependency
+ *        graph: 0 for signatures that don't check flowbits, otherwise one
+ *        more than the deepest signature setting a bit it checks.
+ *
+ *        Ordering on the depth puts the setters of a bit before the
+ *        signatures checking it, also for chains of signatures that both
+ *        check and set bits.
+ *
+ * \param de_ctx detection engine ctx, for the highest flowbit id
+ * \param sw_list list of sigwrappers to process
+ */
+static void SCSigProcessFlowbitsDepth(const DetectEngineCtx *de_ctx,
+                                      SCSigSignatureWrapper *sw_list)
+{
+    const uint32_t bits = de_ctx->max_fb_id + 1;
+    int *bit_depth = SCCalloc(bits, sizeof(int));
+    if (bit_depth == NULL)
+        return;
+
+    /* longest path relaxation. Each round fixes at least one more level
+     * of the graph, so for a graph without loops it ends early */
+    for (int round = 0; round < SC_SIG_FLOWBITS_DEPTH_MAX; round++) {
+        bool changed = false;
+        for (SCSigSignatureWrapper *sw = sw_list; sw != NULL; sw = sw->next) {
+            if (sw->user[SC_RADIX_USER_DATA_FLOWBITS] == DETECT_FLOWBITS_NOT_USED)
+                continue;
+
+            int depth = 0;
+            for (const SigMatch *sm = sw->sig->init_data->smlists[DETECT_SM_LIST_MATCH];
+                    sm != NULL; sm = sm->next) {
+                if (sm->type != DETECT_FLOWBITS)
+                    continue;
+                const DetectFlowbitsData *fb = (const DetectFlowbitsData *)sm->ctx;
+                if (fb->idx < bits && bit_depth[fb->idx] + 1 > depth)
+                    depth = bit_depth[fb->idx] + 1;
+            }
+            depth = MIN(depth, SC_SIG_FLOWBITS_DEPTH_MAX);
+            sw->user[SC_RADIX_USER_DATA_FLOWBITS_DEPTH] = depth;
+
+            for (const SigMatch *sm = sw->sig->init_data->smlists[DETECT_SM_LIST_POSTMATCH];
+                    sm != NULL; sm = sm->next) {
+                if (sm->type != DETECT_FLOWBITS)
+                    continue;
+                const DetectFlowbitsData *fb = (const DetectFlowbitsData *)sm->ctx;
+                if (fb->idx < bits && bit_depth[fb->idx] < depth) {
+                    bit_depth[fb->idx] = depth;
+                    changed = true;
+                }
+            }
+        }
+        if (!changed)
+            break;
+    }
+    SCFree(bit_depth);
+}
+
 /**
  * \brief Processes the flowvar data for this signature and caches it for
  *        future use.  This is needed to optimize the sig_ordering module.
@@ -609,6 +687,17 @@ static int SCSigOrderByFlowbitsCompare(SCSigSignatureWrapper *sw1,
         sw2->user[SC_RADIX_USER_DATA_FLOWBITS];
 }
 
+/**
+ * \brief Orders an incoming Signature based on its depth in the flowbits
+ *        dependency graph, lowest first
+ */
+static int SCSigOrderByFlowbitsDepthCompare(SCSigSignatureWrapper *sw1,
+                                            SCSigSignatureWrapper *sw2)
+{
+    return sw2->user[SC_RADIX_USER_DATA_FLOWBITS_DEPTH] -
+        sw1->user[SC_RADIX_USER_DATA_FLOWBITS_DEPTH];
+}
+
 /**
  * \brief Orders an incoming Signature based on its flowvar type
  *
@@ -672,6 +761,19 @@ static int SCSigOrderByIPPairbitsCompare(SCSigSignatureWrapper *sw1,
         sw2->user[SC_RADIX_USER_DATA_IPPAIRBITS];
 }
 
+/**
+ * \brief Orders an incoming Signature based on its cost from the cost
+ *        profile, cheapest first. As the last ordering function it only
+ *        orders signatures that are equal in all other respects.
+ */
+static int SCSigOrderByCostCompare(SCSigSignatureWrapper *sw1,
+                                   SCSigSignatureWrapper *sw2)
+{
+    const int c1 = sw1->user[SC_RADIX_USER_DATA_COST];
+    const int c2 = sw2->user[SC_RADIX_USER_DATA_COST];
+    return (c1 < c2) - (c1 > c2);
+}
+
 /**
  * \brief Orders an incoming Signature based on its priority type
  *
@@ -692,7 +794,112 @@ static int SCSigOrderByPriorityCompare(SCSigSignatureWrapper *sw1,
  *
  * \retval sw Pointer to the wrapper that holds the signature
  */
-static inline SCSigSignatureWrapper *SCSigAllocSignatureWrapper(Signature *sig)
+static int SCSigCostCompare(const void *a, const void *b)
+{
+    const SCSigCost *c1 = a;
+    const SCSigCost *c2 = b;
+    if (c1->gid != c2->gid)
+        return c1->gid < c2->gid ? -1 : 1;
+    if (c1->sid != c2->sid)
+        return c1->sid < c2->sid ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \brief Load the cost profile set in detect.cost-profile, as written by
+ *        the rule profiling (profiling.rules.cost-profile).
+ *
+ * Each line has the gid, sid, rev, checks, matches and ticks of a rule,
+ * lines starting with a '#' are comments.
+ *
+ * \retval 0 if loaded or not configured, -1 on error
+ */
+static int SCSigLoadCostProfile(const DetectEngineCtx *de_ctx,
+                                SCSigCostProfile *profile)
+{
+    char name[256];
+    const char *filename = NULL;
+
+    memset(profile, 0, sizeof(*profile));
+
+    if (strlen(de_ctx->config_prefix) > 0) {
+        snprintf(name, sizeof(name), "%s.detect.cost-profile",
+                 de_ctx->config_prefix);
+    } else {
+        strlcpy(name, "detect.cost-profile", sizeof(name));
+    }
+    if (ConfGet(name, &filename) != 1 || filename == NULL)
+        return 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open cost profile %s: %s",
+                     filename, strerror(errno));
+        return -1;
+    }
+
+    uint32_t size = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        uint32_t gid, sid, rev;
+        uint64_t checks, matches, ticks;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%"SCNu32" %"SCNu32" %"SCNu32" %"SCNu64" %"SCNu64
+                   " %"SCNu64, &gid, &sid, &rev, &checks, &matches, &ticks) != 6) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid line in cost "
+                         "profile %s: %s", filename, line);
+            continue;
+        }
+        if (checks == 0)
+            continue;
+
+        if (profile->cnt == size) {
+            uint32_t new_size = size ? size * 2 : 1024;
+            SCSigCost *costs = SCRealloc(profile->costs,
+                                         new_size * sizeof(SCSigCost));
+            if (costs == NULL) {
+                SCFree(profile->costs);
+                memset(profile, 0, sizeof(*profile));
+                fclose(fp);
+                return -1;
+            }
+            profile->costs = costs;
+            size = new_size;
+        }
+        const uint64_t avg = ticks / checks;
+        profile->costs[profile->cnt].gid = gid;
+        profile->costs[profile->cnt].sid = sid;
+        profile->costs[profile->cnt].cost =
+            avg < DETECT_COST_UNKNOWN ? (int)avg : DETECT_COST_UNKNOWN - 1;
+        profile->cnt++;
+    }
+    fclose(fp);
+
+    if (profile->cnt > 0) {
+        qsort(profile->costs, profile->cnt, sizeof(SCSigCost),
+              SCSigCostCompare);
+    }
+    SCLogConfig("loaded the cost of %u rules from %s", profile->cnt, filename);
+    return 0;
+}
+
+static inline void SCSigProcessUserDataForCost(SCSigSignatureWrapper *sw,
+                                               const SCSigCostProfile *profile)
+{
+    sw->user[SC_RADIX_USER_DATA_COST] = DETECT_COST_UNKNOWN;
+    if (profile == NULL || profile->cnt == 0)
+        return;
+
+    SCSigCost key = { .gid = sw->sig->gid, .sid = sw->sig->id, .cost = 0 };
+    const SCSigCost *c = bsearch(&key, profile->costs, profile->cnt,
+                                 sizeof(SCSigCost), SCSigCostCompare);
+    if (c != NULL)
+        sw->user[SC_RADIX_USER_DATA_COST] = c->cost;
+}
+
+static inline SCSigSignatureWrapper *SCSigAllocSignatureWrapper(Signature *sig,
+        const SCSigCostProfile *profile)
 {
     SCSigSignatureWrapper *sw = NULL;
 
@@ -710,6 +917,7 @@ static inline SCSigSignatureWrapper *SCSigAllocSignatureWrapper(Signature *sig)
     SCSigProcessUserDataForPktvar(sw);
     SCSigProcessUserDataForHostbits(sw);
     SCSigProcessUserDataForIPPairbits(sw);
+    SCSigProcessUserDataForCost(sw, profile);
 
     return sw;
 }
@@ -729,9 +937,12 @@ void SCSigOrderSignatures(DetectEngineCtx *de_ctx)
     int i = 0;
     SCLogDebug("ordering signatures in memory");
 
+    SCSigCostProfile profile;
+    (void)SCSigLoadCostProfile(de_ctx, &profile);
+
     sig = de_ctx->sig_list;
     while (sig != NULL) {
-        sigw = SCSigAllocSignatureWrapper(sig);
+        sigw = SCSigAllocSignatureWrapper(sig, &profile);
         /* Push signature wrapper onto a list, order doesn't matter here. */
         sigw->next = sigw_list;
         sigw_list = sigw;
@@ -740,6 +951,11 @@ void SCSigOrderSignatures(DetectEngineCtx *de_ctx)
         i++;
     }
 
+    if (profile.costs != NULL)
+        SCFree(profile.costs);
+
+    SCSigProcessFlowbitsDepth(de_ctx, sigw_list);
+
     /* Sort the list */
     sigw_list = SCSigOrder(sigw_list, de_ctx->sc_sig_order_funcs);
 
@@ -786,12 +1002,14 @@ void SCSigRegisterSignatureOrderingFuncs(DetectEngineCtx *de_ctx)
 
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByActionCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowbitsCompare);
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowbitsDepthCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowintCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowvarCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByPktvarCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByHostbitsCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByIPPairbitsCompare);
     SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByPriorityCompare);
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByCostCompare);
 }
 
 /**
@@ -2142,6 +2360,91 @@ end:
     return result;
 }
 
+/** \test ordering by the cost profile */
+static int SCSigOrderingTest14(void)
+{
+    char filename[] = "/tmp/suricata-cost-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "# gid sid rev checks matches ticks\n"
+                "1 1 1 10 0 5000\n"
+                "1 2 1 10 1 1000\n"
+                "1 4 1 10 0 99990\n");
+    fclose(fp);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("detect.cost-profile", filename);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"a\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"b\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"c\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"d\"; priority:1; sid:4;)"));
+
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByPriorityCompare);
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByCostCompare);
+    SCSigOrderSignatures(de_ctx);
+
+    /* priority goes before cost, unprofiled rules go last */
+    Signature *sig = de_ctx->sig_list;
+    FAIL_IF_NOT(sig->id == 4);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 2);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 1);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 3);
+
+    DetectEngineCtxFree(de_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    unlink(filename);
+    PASS;
+}
+
+/** \test chains of flowbits: setters go before the checkers */
+static int SCSigOrderingTest15(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    /* c checks b, set by b that checks a, set by a */
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (flowbits:isset,fbb; "
+                "flowbits:set,fbc; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (flowbits:isset,fbc; sid:4;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (flowbits:isset,fba; "
+                "flowbits:set,fbb; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"a\"; "
+                "flowbits:set,fba; sid:1;)"));
+
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowbitsCompare);
+    SCSigRegisterSignatureOrderingFunc(de_ctx, SCSigOrderByFlowbitsDepthCompare);
+    SCSigOrderSignatures(de_ctx);
+
+    Signature *sig = de_ctx->sig_list;
+    FAIL_IF_NOT(sig->id == 1);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 2);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 3);
+    sig = sig->next;
+    FAIL_IF_NOT(sig->id == 4);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif
 
 void SCSigRegisterSignatureOrderingTests(void)
@@ -2161,5 +2464,7 @@ void SCSigRegisterSignatureOrderingTests(void)
     UtRegisterTest("SCSigOrderingTest11", SCSigOrderingTest11);
     UtRegisterTest("SCSigOrderingTest12", SCSigOrderingTest12);
     UtRegisterTest("SCSigOrderingTest13", SCSigOrderingTest13);
+    UtRegisterTest("SCSigOrderingTest14", SCSigOrderingTest14);
+    UtRegisterTest("SCSigOrderingTest15", SCSigOrderingTest15);
 #endif
 }
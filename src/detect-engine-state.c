@@ -18,11 +18,10 @@
 /**
  * \defgroup sigstate State support
  *
- * State is stored in the ::DetectEngineState structure. This is
- * basically a containter for storage item of type ::DeStateStore.
- * They contains an array of ::DeStateStoreItem which store the
- * state of match for an individual signature identified by
- * DeStateStoreItem::sid.
+ * State is stored in the ::DetectEngineState structure. Per direction
+ * it contains an array of ::DeStateStoreItem which store the state of
+ * match for an individual signature identified by DeStateStoreItem::sid,
+ * and a bitmap of the stored sids for quick lookups.
  *
  * @{
  */
@@ -84,85 +83,87 @@ static inline int StateIsValid(uint16_t alproto, void *alstate)
     return 0;
 }
 
-static DeStateStore *DeStateStoreAlloc(void)
+/** \internal
+ *  \brief set the bit for sig num in the bitmap, growing it if needed
+ *  \retval 0 ok
+ *  \retval -1 error */
+static int DeStateSidBitmapSet(DetectEngineStateDirection *dir_state, const SigIntId num)
 {
-    DeStateStore *d = SCMalloc(sizeof(DeStateStore));
-    if (unlikely(d == NULL))
-        return NULL;
-    memset(d, 0, sizeof(DeStateStore));
-
-    return d;
-}
-
-#ifdef DEBUG_VALIDATION
-static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIntId num)
-{
-    DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
-    DeStateStore *tx_store = dir_state->head;
-    SigIntId store_cnt;
-    SigIntId state_cnt = 0;
-
-    for (; tx_store != NULL; tx_store = tx_store->next) {
-        SCLogDebug("tx_store %p", tx_store);
-        for (store_cnt = 0;
-             store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
-             store_cnt++, state_cnt++)
-        {
-            DeStateStoreItem *item = &tx_store->store[store_cnt];
-            if (item->sid == num) {
-                SCLogDebug("sid %u already in state: %p %p %p %u %u, direction %s",
-                            num, state, dir_state, tx_store, state_cnt,
-                            store_cnt, direction & STREAM_TOSERVER ? "toserver" : "toclient");
-                return 1;
-            }
-        }
+    const SigIntId base = num & ~(SigIntId)63;
+    if (dir_state->sid_bitmap_words == 0) {
+        dir_state->sid_bitmap = SCCalloc(1, sizeof(uint64_t));
+        if (dir_state->sid_bitmap == NULL)
+            return -1;
+        dir_state->sid_bitmap_words = 1;
+        dir_state->sid_bitmap_base = base;
+    } else if (num < dir_state->sid_bitmap_base) {
+        /* grow downwards: move the current words up */
+        const uint32_t shift = (dir_state->sid_bitmap_base - base) >> 6;
+        const uint32_t words = dir_state->sid_bitmap_words + shift;
+        uint64_t *ptr = SCRealloc(dir_state->sid_bitmap, words * sizeof(uint64_t));
+        if (ptr == NULL)
+            return -1;
+        memmove(ptr + shift, ptr, dir_state->sid_bitmap_words * sizeof(uint64_t));
+        memset(ptr, 0, shift * sizeof(uint64_t));
+        dir_state->sid_bitmap = ptr;
+        dir_state->sid_bitmap_words = words;
+        dir_state->sid_bitmap_base = base;
+    } else if (((num - dir_state->sid_bitmap_base) >> 6) >= dir_state->sid_bitmap_words) {
+        const uint32_t words = ((num - dir_state->sid_bitmap_base) >> 6) + 1;
+        uint64_t *ptr = SCRealloc(dir_state->sid_bitmap, words * sizeof(uint64_t));
+        if (ptr == NULL)
+            return -1;
+        memset(ptr + dir_state->sid_bitmap_words, 0,
+                (words - dir_state->sid_bitmap_words) * sizeof(uint64_t));
+        dir_state->sid_bitmap = ptr;
+        dir_state->sid_bitmap_words = words;
     }
+
+    const uint32_t bit = num - dir_state->sid_bitmap_base;
+    dir_state->sid_bitmap[bit >> 6] |= (1ULL << (bit & 63));
     return 0;
 }
-#endif
 
 static void DeStateSignatureAppend(DetectEngineState *state,
         const Signature *s, uint32_t inspect_flags, uint8_t direction)
 {
-    int jump = 0;
-    int i = 0;
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
 
 #ifdef DEBUG_VALIDATION
-    BUG_ON(DeStateSearchState(state, direction, s->num));
+    BUG_ON(DeStateHasSig(dir_state, s->num));
 #endif
-    DeStateStore *store = dir_state->head;
-
-    if (store == NULL) {
-        store = DeStateStoreAlloc();
-        if (store != NULL) {
-            dir_state->head = store;
-            dir_state->tail = store;
-        }
-    } else {
-        jump = dir_state->cnt / DE_STATE_CHUNK_SIZE;
-        for (i = 0; i < jump; i++) {
-            store = store->next;
-        }
-        if (store == NULL) {
-            store = DeStateStoreAlloc();
-            if (store != NULL) {
-                dir_state->tail->next = store;
-                dir_state->tail = store;
-            }
-        }
+    if (dir_state->cnt == dir_state->size) {
+        const SigIntId new_size = dir_state->size ?
+            dir_state->size * 2 : DE_STATE_STORE_INIT_SIZE;
+        DeStateStoreItem *ptr = SCRealloc(dir_state->store,
+                new_size * sizeof(DeStateStoreItem));
+        if (ptr == NULL)
+            return;
+        dir_state->store = ptr;
+        dir_state->size = new_size;
     }
-
-    if (store == NULL)
+    if (DeStateSidBitmapSet(dir_state, s->num) != 0)
         return;
 
-    SigIntId idx = dir_state->cnt++ % DE_STATE_CHUNK_SIZE;
-    store->store[idx].sid = s->num;
-    store->store[idx].flags = inspect_flags;
+    SigIntId idx = dir_state->cnt++;
+    dir_state->store[idx].sid = s->num;
+    dir_state->store[idx].flags = inspect_flags;
 
     return;
 }
 
+/** \internal
+ *  \brief forget all stored sigs of a direction, keeping the memory */
+static void DeStateDirectionReset(DetectEngineStateDirection *dir_state)
+{
+    dir_state->cnt = 0;
+    dir_state->filestore_cnt = 0;
+    dir_state->flags = 0;
+    dir_state->pf_cache_cnt = 0;
+    if (dir_state->sid_bitmap != NULL)
+        memset(dir_state->sid_bitmap, 0, dir_state->sid_bitmap_words * sizeof(uint64_t));
+}
+
 DetectEngineState *DetectEngineStateAlloc(void)
 {
     DetectEngineState *d = SCMalloc(sizeof(DetectEngineState));
@@ -175,17 +176,17 @@ DetectEngineState *DetectEngineStateAlloc(void)
 
 void DetectEngineStateFree(DetectEngineState *state)
 {
-    DeStateStore *store;
-    DeStateStore *store_next;
-    int i = 0;
-
-    for (i = 0; i < 2; i++) {
-        store = state->dir_state[i].head;
-        while (store != NULL) {
-            store_next = store->next;
-            SCFree(store);
-            store = store_next;
+    for (int i = 0; i < 2; i++) {
+        if (state->dir_state[i].store != NULL)
+            SCFree(state->dir_state[i].store);
+        if (state->dir_state[i].sid_bitmap != NULL)
+            SCFree(state->dir_state[i].sid_bitmap);
+        for (uint8_t c = 0; c < state->dir_state[i].pf_cache_size; c++) {
+            if (state->dir_state[i].pf_cache[c].sids != NULL)
+                SCFree(state->dir_state[i].pf_cache[c].sids);
         }
+        if (state->dir_state[i].pf_cache != NULL)
+            SCFree(state->dir_state[i].pf_cache);
     }
     SCFree(state);
 
@@ -218,30 +219,117 @@ static void StoreStateTxHandleFiles(const SigGroupHead *sgh, Flow *f,
     }
 }
 
-void DetectRunStoreStateTx(
-        const SigGroupHead *sgh,
-        Flow *f, void *tx, uint64_t tx_id,
-        const Signature *s,
-        uint32_t inspect_flags, uint8_t flow_flags,
-        const uint16_t file_no_match)
+/** \internal
+ *  \brief get the detect state of a tx, create it if it doesn't exist yet
+ *  \retval destate or NULL if it couldn't be created */
+static DetectEngineState *DetectEngineStateGetOrAlloc(Flow *f, void *tx)
 {
     DetectEngineState *destate = AppLayerParserGetTxDetectState(f->proto, f->alproto, tx);
     if (destate == NULL) {
         destate = DetectEngineStateAlloc();
         if (destate == NULL)
-            return;
+            return NULL;
         if (AppLayerParserSetTxDetectState(f, tx, destate) < 0) {
             DetectEngineStateFree(destate);
-            return;
+            return NULL;
         }
-        SCLogDebug("destate created for %"PRIu64, tx_id);
+        SCLogDebug("destate created for tx %p", tx);
     }
+    return destate;
+}
+
+void DetectRunStoreStateTx(
+        const SigGroupHead *sgh,
+        Flow *f, void *tx, uint64_t tx_id,
+        const Signature *s,
+        uint32_t inspect_flags, uint8_t flow_flags,
+        const uint16_t file_no_match)
+{
+    DetectEngineState *destate = DetectEngineStateGetOrAlloc(f, tx);
+    if (destate == NULL)
+        return;
     DeStateSignatureAppend(destate, s, inspect_flags, flow_flags);
     StoreStateTxHandleFiles(sgh, f, destate, flow_flags, tx_id, file_no_match);
 
     SCLogDebug("Stored for TX %"PRIu64, tx_id);
 }
 
+/** \brief get the detect state of a tx for a direction, create it if
+ *         it doesn't exist yet
+ *  \retval dir_state or NULL if the state couldn't be created */
+DetectEngineStateDirection *DetectEngineStateGetDirection(Flow *f, void *tx,
+        const uint8_t flow_flags)
+{
+    DetectEngineState *destate = DetectEngineStateGetOrAlloc(f, tx);
+    if (destate == NULL)
+        return NULL;
+    return &destate->dir_state[flow_flags & STREAM_TOSERVER ? 0 : 1];
+}
+
+/** \brief get the prefilter result cache entry of an engine
+ *
+ *  \param add if true create the entry if it doesn't exist yet
+ *
+ *  \retval c entry or NULL if not found (or couldn't be added)
+ */
+DeStatePrefilterCache *DeStatePrefilterCacheGet(DetectEngineStateDirection *dir_state,
+        const void *pectx, const bool add)
+{
+    for (uint8_t i = 0; i < dir_state->pf_cache_cnt; i++) {
+        if (dir_state->pf_cache[i].pectx == pectx)
+            return &dir_state->pf_cache[i];
+    }
+    if (!add)
+        return NULL;
+
+    if (dir_state->pf_cache_cnt == dir_state->pf_cache_size) {
+        if (dir_state->pf_cache_size > UINT8_MAX - 4)
+            return NULL;
+        const uint8_t new_size = dir_state->pf_cache_size + 4;
+        void *ptr = SCRealloc(dir_state->pf_cache, new_size * sizeof(DeStatePrefilterCache));
+        if (ptr == NULL)
+            return NULL;
+        dir_state->pf_cache = ptr;
+        memset(&dir_state->pf_cache[dir_state->pf_cache_size], 0,
+                (new_size - dir_state->pf_cache_size) * sizeof(DeStatePrefilterCache));
+        dir_state->pf_cache_size = new_size;
+    }
+    DeStatePrefilterCache *c = &dir_state->pf_cache[dir_state->pf_cache_cnt++];
+    /* reused entries keep their sids array */
+    c->pectx = pectx;
+    c->offset = 0;
+    c->hash = 0;
+    c->len = 0;
+    c->sids_cnt = 0;
+    return c;
+}
+
+/** \brief store the result of a prefilter engine on a buffer
+ *  \retval 0 ok
+ *  \retval -1 error, the entry is invalidated */
+int DeStatePrefilterCacheSet(DeStatePrefilterCache *c, const uint64_t offset,
+        const uint64_t hash, const uint32_t len,
+        const SigIntId *sids, const uint32_t sids_cnt)
+{
+    if (sids_cnt > c->sids_size) {
+        void *ptr = SCRealloc(c->sids, sids_cnt * sizeof(SigIntId));
+        if (ptr == NULL) {
+            /* can't match any buffer */
+            c->pectx = NULL;
+            return -1;
+        }
+        c->sids = ptr;
+        c->sids_size = sids_cnt;
+    }
+    if (sids_cnt > 0)
+        memcpy(c->sids, sids, sids_cnt * sizeof(SigIntId));
+    c->sids_cnt = sids_cnt;
+    c->offset = offset;
+    c->hash = hash;
+    c->len = len;
+    return 0;
+}
+
 /** \brief update flow's inspection id's
  *
  *  \param f unlocked flow
@@ -287,13 +375,8 @@ void DetectEngineStateResetTxs(Flow *f)
                 continue;
             }
 
-            tx_de_state->dir_state[0].cnt = 0;
-            tx_de_state->dir_state[0].filestore_cnt = 0;
-            tx_de_state->dir_state[0].flags = 0;
-
-            tx_de_state->dir_state[1].cnt = 0;
-            tx_de_state->dir_state[1].filestore_cnt = 0;
-            tx_de_state->dir_state[1].flags = 0;
+            DeStateDirectionReset(&tx_de_state->dir_state[0]);
+            DeStateDirectionReset(&tx_de_state->dir_state[1]);
         }
     }
 }
@@ -306,8 +389,8 @@ static int DeStateTest01(void)
 {
     SCLogDebug("sizeof(DetectEngineState)\t\t%"PRIuMAX,
             (uintmax_t)sizeof(DetectEngineState));
-    SCLogDebug("sizeof(DeStateStore)\t\t\t%"PRIuMAX,
-            (uintmax_t)sizeof(DeStateStore));
+    SCLogDebug("sizeof(DetectEngineStateDirection)\t%"PRIuMAX,
+            (uintmax_t)sizeof(DetectEngineStateDirection));
     SCLogDebug("sizeof(DeStateStoreItem)\t\t%"PRIuMAX"",
             (uintmax_t)sizeof(DeStateStoreItem));
 
@@ -359,12 +442,19 @@ static int DeStateTest02(void)
     s.num = 166;
     DeStateSignatureAppend(state, &s, 0, direction);
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 11);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next == NULL);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[14].sid != 144);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[0].sid != 155);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[1].sid != 166);
+    const DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
+    FAIL_IF(dir_state->store == NULL);
+    FAIL_IF(dir_state->cnt != 17);
+    FAIL_IF(dir_state->store[1].sid != 11);
+    FAIL_IF(dir_state->store[14].sid != 144);
+    FAIL_IF(dir_state->store[15].sid != 155);
+    FAIL_IF(dir_state->store[16].sid != 166);
+    FAIL_IF_NOT(DeStateHasSig(dir_state, 0));
+    FAIL_IF_NOT(DeStateHasSig(dir_state, 166));
+    FAIL_IF(DeStateHasSig(dir_state, 1));
+    FAIL_IF(DeStateHasSig(dir_state, 167));
+    FAIL_IF(DeStateHasSig(dir_state, 100000));
+    FAIL_IF(DeStateHasSig(&state->dir_state[direction & STREAM_TOSERVER ? 1 : 0], 11));
 
     DetectEngineStateFree(state);
 
@@ -386,11 +476,86 @@ static int DeStateTest03(void)
     s.num = 22;
     DeStateSignatureAppend(state, &s, BIT_U32(DE_STATE_FLAG_BASE), direction);
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].sid != 11);
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].flags & BIT_U32(DE_STATE_FLAG_BASE));
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 22);
-    FAIL_IF(!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].flags & BIT_U32(DE_STATE_FLAG_BASE)));
+    const DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
+    FAIL_IF(dir_state->store == NULL);
+    FAIL_IF(dir_state->store[0].sid != 11);
+    FAIL_IF(dir_state->store[0].flags & BIT_U32(DE_STATE_FLAG_BASE));
+    FAIL_IF(dir_state->store[1].sid != 22);
+    FAIL_IF(!(dir_state->store[1].flags & BIT_U32(DE_STATE_FLAG_BASE)));
+
+    DetectEngineStateFree(state);
+    PASS;
+}
+
+/** \test sid bitmap growing in both directions */
+static int DeStateTest05(void)
+{
+    DetectEngineState *state = DetectEngineStateAlloc();
+    FAIL_IF_NULL(state);
+    DetectEngineStateDirection *dir_state = &state->dir_state[1];
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+    const SigIntId nums[] = { 700, 10, 5000, 64, 639 };
+    for (int i = 0; i < 5; i++) {
+        s.num = nums[i];
+        DeStateSignatureAppend(state, &s, 0, STREAM_TOCLIENT);
+    }
+    FAIL_IF_NOT(dir_state->cnt == 5);
+    FAIL_IF_NOT(dir_state->sid_bitmap_base == 0);
+    for (int i = 0; i < 5; i++) {
+        FAIL_IF_NOT(DeStateHasSig(dir_state, nums[i]));
+        FAIL_IF(DeStateHasSig(dir_state, nums[i] + 1));
+    }
+    FAIL_IF(DeStateHasSig(dir_state, 0));
+    FAIL_IF(DeStateHasSig(dir_state, 5001));
+    FAIL_IF(DeStateHasSig(&state->dir_state[0], 700));
+
+    DeStateDirectionReset(dir_state);
+    FAIL_IF_NOT(dir_state->cnt == 0);
+    for (int i = 0; i < 5; i++) {
+        FAIL_IF(DeStateHasSig(dir_state, nums[i]));
+    }
+
+    DetectEngineStateFree(state);
+    PASS;
+}
+
+/** \test prefilter result cache entries: add, lookup, update, reuse */
+static int DeStateTest04(void)
+{
+    DetectEngineState *state = DetectEngineStateAlloc();
+    FAIL_IF_NULL(state);
+    DetectEngineStateDirection *dir_state = &state->dir_state[0];
+
+    int engines[6];
+    SigIntId sids[] = { 1, 5, 9 };
+
+    FAIL_IF_NOT_NULL(DeStatePrefilterCacheGet(dir_state, &engines[0], false));
+    for (int i = 0; i < 6; i++) {
+        DeStatePrefilterCache *c = DeStatePrefilterCacheGet(dir_state, &engines[i], true);
+        FAIL_IF_NULL(c);
+        FAIL_IF_NOT(DeStatePrefilterCacheSet(c, 0, 1234 + i, 10, sids, i % 4) == 0);
+    }
+    FAIL_IF_NOT(dir_state->pf_cache_cnt == 6);
+
+    DeStatePrefilterCache *c = DeStatePrefilterCacheGet(dir_state, &engines[3], false);
+    FAIL_IF_NULL(c);
+    FAIL_IF_NOT(c->hash == 1237);
+    FAIL_IF_NOT(c->sids_cnt == 3);
+    FAIL_IF_NOT(c->sids[2] == 9);
+
+    /* update with a smaller result */
+    FAIL_IF_NOT(DeStatePrefilterCacheSet(c, 100, 42, 20, sids, 1) == 0);
+    c = DeStatePrefilterCacheGet(dir_state, &engines[3], true);
+    FAIL_IF_NOT(c->hash == 42 && c->offset == 100 && c->len == 20 && c->sids_cnt == 1);
+
+    /* reset as on a reload: entries are reused, not looked up */
+    dir_state->pf_cache_cnt = 0;
+    FAIL_IF_NOT_NULL(DeStatePrefilterCacheGet(dir_state, &engines[3], false));
+    c = DeStatePrefilterCacheGet(dir_state, &engines[5], true);
+    FAIL_IF_NULL(c);
+    FAIL_IF_NOT(c->sids_cnt == 0 && c->hash == 0);
 
     DetectEngineStateFree(state);
     PASS;
@@ -563,7 +728,7 @@ static int DeStateSigTest02(void)
     FAIL_IF(tx_de_state->dir_state[0].cnt != 1);
     /* http_header(mpm): 5, uri: 3, method: 6, cookie: 7 */
     uint32_t expected_flags = (BIT_U32(5) | BIT_U32(3) | BIT_U32(6) |BIT_U32(7));
-    FAIL_IF(tx_de_state->dir_state[0].head->store[0].flags != expected_flags);
+    FAIL_IF(tx_de_state->dir_state[0].store[0].flags != expected_flags);
 
     r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
                             STREAM_TOSERVER, httpbuf4, httplen4);
@@ -1371,6 +1536,8 @@ void DeStateRegisterTests(void)
     UtRegisterTest("DeStateTest01", DeStateTest01);
     UtRegisterTest("DeStateTest02", DeStateTest02);
     UtRegisterTest("DeStateTest03", DeStateTest03);
+    UtRegisterTest("DeStateTest04", DeStateTest04);
+    UtRegisterTest("DeStateTest05", DeStateTest05);
     UtRegisterTest("DeStateSigTest01", DeStateSigTest01);
     UtRegisterTest("DeStateSigTest02", DeStateSigTest02);
     UtRegisterTest("DeStateSigTest03", DeStateSigTest03);
@@ -49,8 +49,8 @@
  *  more files that have ongoing inspection. */
 #define DETECT_ENGINE_INSPECT_SIG_MATCH_MORE_FILES 4
 
-/** number of DeStateStoreItem's in one DeStateStore object */
-#define DE_STATE_CHUNK_SIZE             15
+/** initial number of DeStateStoreItem's in a direction's store */
+#define DE_STATE_STORE_INIT_SIZE        16
 
 /* per sig flags */
 #define DE_STATE_FLAG_FULL_INSPECT              BIT_U32(0)
@@ -75,17 +75,31 @@ typedef struct DeStateStoreItem_ {
     SigIntId sid;
 } DeStateStoreItem;
 
-typedef struct DeStateStore_ {
-    DeStateStoreItem store[DE_STATE_CHUNK_SIZE];
-    struct DeStateStore_ *next;
-} DeStateStore;
+/** result of a tx prefilter engine on a buffer, so that the engine can
+ *  skip the buffer if it's unchanged the next time the tx is inspected */
+typedef struct DeStatePrefilterCache_ {
+    const void *pectx;      /**< prefilter engine the result belongs to */
+    uint64_t offset;        /**< inspect offset of the buffer */
+    uint64_t hash;          /**< hash of the buffer */
+    uint32_t len;           /**< length of the buffer */
+    uint32_t sids_cnt;
+    uint32_t sids_size;
+    SigIntId *sids;         /**< sids the engine added for the buffer */
+} DeStatePrefilterCache;
 
 typedef struct DetectEngineStateDirection_ {
-    DeStateStore *head;
-    DeStateStore *tail;
+    DeStateStoreItem *store;    /**< stored sigs, in the order they were stored */
+    /** bit per stored sig, for sig nums from sid_bitmap_base on */
+    uint64_t *sid_bitmap;
+    DeStatePrefilterCache *pf_cache;
     SigIntId cnt;
+    SigIntId size;              /**< size of store in items */
+    SigIntId sid_bitmap_base;   /**< sig num of bit 0, multiple of 64 */
+    uint32_t sid_bitmap_words;  /**< size of sid_bitmap in words */
     uint16_t filestore_cnt;
     uint8_t flags;
+    uint8_t pf_cache_cnt;
+    uint8_t pf_cache_size;
     /* coccinelle: DetectEngineStateDirection:flags:DETECT_ENGINE_STATE_FLAG_ */
 } DetectEngineStateDirection;
 
@@ -130,6 +144,27 @@ void DeStateUpdateInspectTransactionId(Flow *f, const uint8_t flags,
 
 void DetectEngineStateResetTxs(Flow *f);
 
+/** \brief check if a sig has state stored in this direction
+ *  \param num sig num (Signature::num) */
+static inline bool DeStateHasSig(const DetectEngineStateDirection *dir_state,
+        const SigIntId num)
+{
+    if (num < dir_state->sid_bitmap_base)
+        return false;
+    const uint32_t bit = num - dir_state->sid_bitmap_base;
+    if ((bit >> 6) >= dir_state->sid_bitmap_words)
+        return false;
+    return (dir_state->sid_bitmap[bit >> 6] & (1ULL << (bit & 63))) != 0;
+}
+
+DetectEngineStateDirection *DetectEngineStateGetDirection(Flow *f, void *tx,
+        const uint8_t flow_flags);
+DeStatePrefilterCache *DeStatePrefilterCacheGet(DetectEngineStateDirection *dir_state,
+        const void *pectx, const bool add);
+int DeStatePrefilterCacheSet(DeStatePrefilterCache *c, const uint64_t offset,
+        const uint64_t hash, const uint32_t len,
+        const SigIntId *sids, const uint32_t sids_cnt);
+
 void DeStateRegisterTests(void);
 
 
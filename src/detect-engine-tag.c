@@ -42,22 +42,47 @@
 #include "flow-util.h"
 #include "stream-tcp-private.h"
 
-SC_ATOMIC_DECLARE(unsigned int, num_tags);  /**< Atomic counter, to know if we
-                                                 have tagged hosts/sessions,
-                                                 to avoid locking */
+SC_ATOMIC_DECLARE(unsigned int, host_tags); /**< Atomic counter, to know if we
+                                                 have tagged hosts, to avoid
+                                                 the host lookups */
+SC_ATOMIC_DECLARE(unsigned int, flow_tags); /**< Atomic counter of the session
+                                                 tags */
 static int host_tag_id = -1;                /**< Host storage id for tags */
 static int flow_tag_id = -1;                /**< Flow storage id for tags */
 
+/** entries of a new tag list, doubled when it fills up */
+#define TAG_LIST_INIT_SIZE 2
+
+static void TagHostListFree(void *ptr)
+{
+    if (ptr != NULL) {
+        DetectTagList *list = ptr;
+        (void) SC_ATOMIC_SUB(host_tags, list->cnt);
+        SCFree(list);
+    }
+}
+
+static void TagFlowListFree(void *ptr)
+{
+    if (ptr != NULL) {
+        DetectTagList *list = ptr;
+        (void) SC_ATOMIC_SUB(flow_tags, list->cnt);
+        SCFree(list);
+    }
+}
+
 void TagInitCtx(void)
 {
-    SC_ATOMIC_INIT(num_tags);
+    SC_ATOMIC_INIT(host_tags);
+    SC_ATOMIC_INIT(flow_tags);
 
-    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, DetectTagDataListFree);
+    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, TagHostListFree);
     if (host_tag_id == -1) {
         SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for tag");
         exit(EXIT_FAILURE);
     }
-    flow_tag_id = FlowStorageRegister("tag", sizeof(void *), NULL, DetectTagDataListFree);
+    flow_tag_id = FlowStorageRegister("tag", sizeof(void *), NULL,
+            TagFlowListFree, FLOW_STORAGE_LATE);
     if (flow_tag_id == -1) {
         SCLogError(SC_ERR_FLOW_INIT, "Can't initiate flow storage for tag");
         exit(EXIT_FAILURE);
@@ -73,9 +98,11 @@ void TagInitCtx(void)
 void TagDestroyCtx(void)
 {
 #ifdef DEBUG
-    BUG_ON(SC_ATOMIC_GET(num_tags) != 0);
+    BUG_ON(SC_ATOMIC_GET(host_tags) != 0);
+    BUG_ON(SC_ATOMIC_GET(flow_tags) != 0);
 #endif
-    SC_ATOMIC_DESTROY(num_tags);
+    SC_ATOMIC_DESTROY(host_tags);
+    SC_ATOMIC_DESTROY(flow_tags);
 }
 
 /** \brief Reset the tagging engine context
@@ -91,53 +118,28 @@ int TagHostHasTag(Host *host)
     return HostGetStorageById(host, host_tag_id) ? 1 : 0;
 }
 
-static DetectTagDataEntry *DetectTagDataCopy(DetectTagDataEntry *dtd)
-{
-    DetectTagDataEntry *tde = SCMalloc(sizeof(DetectTagDataEntry));
-    if (unlikely(tde == NULL)) {
-        return NULL;
-    }
-    memset(tde, 0, sizeof(DetectTagDataEntry));
-
-    tde->sid = dtd->sid;
-    tde->gid = dtd->gid;
-    tde->flags = dtd->flags;
-    tde->metric = dtd->metric;
-    tde->count = dtd->count;
-
-    tde->first_ts = dtd->first_ts;
-    tde->last_ts = dtd->last_ts;
-    return tde;
-}
-
 /**
- * \brief This function is used to add a tag to a session (type session)
- *        or update it if it's already installed. The number of times to
- *        allow an update is limited by DETECT_TAG_MATCH_LIMIT. This way
- *        repetitive matches to the same rule are limited of setting tags,
- *        to avoid DOS attacks
+ * \internal
+ * \brief Add a tag to a list or update the entry of its sid/gid. The
+ *        number of times to allow an update is limited by
+ *        DETECT_TAG_MATCH_LIMIT. This way repetitive matches to the same
+ *        rule are limited of setting tags, to avoid DOS attacks
  *
- * \param p pointer to the current packet
- * \param tde pointer to the new DetectTagDataEntry
+ * \param list the list, NULL to start one. Reallocated when full.
+ * \param tde the tag, usually on the stack
  *
- * \retval 0 if the tde was added succesfuly
+ * \retval 0 if the tde was added
  * \retval 1 if an entry of this sid/gid already exist and was updated
+ * \retval -1 if the list is full or we're out of memory
  */
-int TagFlowAdd(Packet *p, DetectTagDataEntry *tde)
+static int TagListAdd(DetectTagList **list, const DetectTagDataEntry *tde)
 {
-    uint8_t updated = 0;
-    uint16_t tag_cnt = 0;
-    DetectTagDataEntry *iter = NULL;
-
-    if (p->flow == NULL)
-        return 1;
+    DetectTagList *l = *list;
 
-    iter = FlowGetStorageById(p->flow, flow_tag_id);
-    if (iter != NULL) {
+    if (l != NULL) {
         /* First iterate installed entries searching a duplicated sid/gid */
-        for (; iter != NULL; iter = iter->next) {
-            tag_cnt++;
-
+        for (uint16_t i = 0; i < l->cnt; i++) {
+            DetectTagDataEntry *iter = &l->entries[i];
             if (iter->sid == tde->sid && iter->gid == tde->gid) {
                 iter->cnt_match++;
 
@@ -149,26 +151,69 @@ int TagFlowAdd(Packet *p, DetectTagDataEntry *tde)
                     iter->packets = 0;
                     iter->bytes = 0;
                 }
-                updated = 1;
-                break;
+                return 1;
             }
         }
+        if (l->cnt == DETECT_TAG_MAX_TAGS) {
+            SCLogDebug("Max tags reached (%"PRIu16")", l->cnt);
+            return -1;
+        }
     }
 
-    /* If there was no entry of this rule, prepend the new tde */
-    if (updated == 0 && tag_cnt < DETECT_TAG_MAX_TAGS) {
-        DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
-        if (new_tde != NULL) {
-            new_tde->next = FlowGetStorageById(p->flow, flow_tag_id);
-            FlowSetStorageById(p->flow, flow_tag_id, new_tde);
-            SCLogDebug("adding tag with first_ts %u", new_tde->first_ts);
-            (void) SC_ATOMIC_ADD(num_tags, 1);
-        }
-    } else if (tag_cnt == DETECT_TAG_MAX_TAGS) {
-        SCLogDebug("Max tags for sessions reached (%"PRIu16")", tag_cnt);
+    if (l == NULL || l->cnt == l->size) {
+        uint16_t size = l ? MIN(l->size * 2, DETECT_TAG_MAX_TAGS) : TAG_LIST_INIT_SIZE;
+        DetectTagList *nl = SCRealloc(l, sizeof(DetectTagList) +
+                size * sizeof(DetectTagDataEntry));
+        if (unlikely(nl == NULL))
+            return -1;
+        if (l == NULL)
+            nl->cnt = 0;
+        nl->size = size;
+        *list = l = nl;
     }
 
-    return updated;
+    DetectTagDataEntry *new_tde = &l->entries[l->cnt++];
+    memset(new_tde, 0, sizeof(DetectTagDataEntry));
+    new_tde->sid = tde->sid;
+    new_tde->gid = tde->gid;
+    new_tde->flags = tde->flags;
+    new_tde->metric = tde->metric;
+    new_tde->count = tde->count;
+    new_tde->first_ts = tde->first_ts;
+    new_tde->last_ts = tde->last_ts;
+    return 0;
+}
+
+/**
+ * \brief This function is used to add a tag to a session (type session)
+ *        or update it if it's already installed.
+ *
+ * \param p pointer to the current packet
+ * \param tde pointer to the new DetectTagDataEntry
+ *
+ * \retval 0 if the tde was added succesfuly
+ * \retval 1 if an entry of this sid/gid already exist and was updated
+ */
+int TagFlowAdd(Packet *p, DetectTagDataEntry *tde)
+{
+    if (p->flow == NULL)
+        return 1;
+
+    DetectTagList *old = FlowGetStorageById(p->flow, flow_tag_id);
+    DetectTagList *list = old;
+
+    int r = TagListAdd(&list, tde);
+    if (list != old && FlowSetStorageById(p->flow, flow_tag_id, list) != 0) {
+        /* no memory for the flow's late storage */
+        SCFree(list);
+        return 0;
+    }
+    if (r == 0) {
+        SCLogDebug("adding tag with first_ts %u", tde->first_ts);
+        p->flow->flags |= FLOW_HAS_TAGS;
+        (void) SC_ATOMIC_ADD(flow_tags, 1);
+    }
+    return r == 1 ? 1 : 0;
 }
 
 /**
@@ -184,8 +229,6 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
 {
     SCEnter();
 
-    uint8_t updated = 0;
-    uint16_t num_tags = 0;
     Host *host = NULL;
 
     /* Lookup host in the hash. If it doesn't exist yet it's
@@ -201,69 +244,37 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
         return -1;
     }
 
-    void *tag = HostGetStorageById(host, host_tag_id);
-    if (tag == NULL) {
-        /* get a new tde as the one we have is on the stack */
-        DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
-        if (new_tde != NULL) {
-            HostSetStorageById(host, host_tag_id, new_tde);
-            (void) SC_ATOMIC_ADD(num_tags, 1);
-            SCLogDebug("host tag added");
-        }
-    } else {
-        /* Append the tag to the list of this host */
-        SCLogDebug("updating existing host");
+    DetectTagList *old = HostGetStorageById(host, host_tag_id);
+    DetectTagList *list = old;
 
-        /* First iterate installed entries searching a duplicated sid/gid */
-        DetectTagDataEntry *iter = NULL;
-
-        for (iter = tag; iter != NULL; iter = iter->next) {
-            num_tags++;
-            if (iter->sid == tde->sid && iter->gid == tde->gid) {
-                iter->cnt_match++;
-                /* If so, update data, unless the maximum MATCH limit is
-                 * reached. This prevents possible DOS attacks */
-                if (iter->cnt_match < DETECT_TAG_MATCH_LIMIT) {
-                    /* Reset time and counters */
-                    iter->first_ts = iter->last_ts = tde->first_ts;
-                    iter->packets = 0;
-                    iter->bytes = 0;
-                }
-                updated = 1;
-                break;
-            }
-        }
-
-        /* If there was no entry of this rule, append the new tde */
-        if (updated == 0 && num_tags < DETECT_TAG_MAX_TAGS) {
-            /* get a new tde as the one we have is on the stack */
-            DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
-            if (new_tde != NULL) {
-                (void) SC_ATOMIC_ADD(num_tags, 1);
-
-                new_tde->next = tag;
-                HostSetStorageById(host, host_tag_id, new_tde);
-            }
-        } else if (num_tags == DETECT_TAG_MAX_TAGS) {
-            SCLogDebug("Max tags for sessions reached (%"PRIu16")", num_tags);
-        }
+    int r = TagListAdd(&list, tde);
+    if (list != old)
+        HostSetStorageById(host, host_tag_id, list);
+    if (r == 0) {
+        SCLogDebug("host tag added");
+        (void) SC_ATOMIC_ADD(host_tags, 1);
     }
 
     HostRelease(host);
+    int updated = (r == 1);
     SCReturnInt(updated);
 }
 
-static void TagHandlePacketFlow(Flow *f, Packet *p)
+/**
+ * \internal
+ * \brief Update the tags of a list with the packet, removing the expired
+ *        ones. Flags the packet for logging if a tag is still active.
+ *
+ * \retval cnt number of tags removed
+ */
+static uint16_t TagListHandlePacket(DetectTagList *list, Packet *p)
 {
-    if (FlowGetStorageById(f, flow_tag_id) == NULL)
-        return;
+    uint16_t removed = 0;
+    uint16_t i = 0;
 
-    DetectTagDataEntry *tde = NULL;
-    DetectTagDataEntry *prev = NULL;
-    DetectTagDataEntry *iter = FlowGetStorageById(f, flow_tag_id);
-    uint8_t flag_added = 0;
+    while (i < list->cnt) {
+        DetectTagDataEntry *iter = &list->entries[i];
 
-    while (iter != NULL) {
         /* update counters */
         iter->last_ts = p->ts.tv_sec;
         switch (iter->metric) {
@@ -279,218 +290,69 @@ static void TagHandlePacketFlow(Flow *f, Packet *p)
          * to log it (the alert will log it) */
         if (!(iter->flags & TAG_ENTRY_FLAG_SKIPPED_FIRST)) {
             iter->flags |= TAG_ENTRY_FLAG_SKIPPED_FIRST;
-        } else {
-            /* Update metrics; remove if tag expired; and set alerts */
-            switch (iter->metric) {
-                case DETECT_TAG_METRIC_PACKET:
-                    if (iter->packets > iter->count) {
-                        SCLogDebug("flow tag expired: packets %u > %u",
-                            iter->packets, iter->count);
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            FlowSetStorageById(p->flow, flow_tag_id, iter->next);
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-                case DETECT_TAG_METRIC_BYTES:
-                    if (iter->bytes > iter->count) {
-                        /* tag expired */
-                        SCLogDebug("flow tag expired: bytes %u > %u",
-                            iter->bytes, iter->count);
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            FlowSetStorageById(p->flow, flow_tag_id, iter->next);
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-                case DETECT_TAG_METRIC_SECONDS:
-                    /* last_ts handles this metric, but also a generic time based
-                     * expiration to prevent dead sessions/hosts */
-                    if (iter->last_ts - iter->first_ts > iter->count) {
-                        SCLogDebug("flow tag expired: %u - %u = %u > %u",
-                            iter->last_ts, iter->first_ts,
-                            (iter->last_ts - iter->first_ts), iter->count);
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            FlowSetStorageById(p->flow, flow_tag_id, iter->next);
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-            }
-
+            i++;
+            continue;
         }
 
-        prev = iter;
-        iter = iter->next;
-    }
-}
-
-static void TagHandlePacketHost(Host *host, Packet *p)
-{
-    DetectTagDataEntry *tde = NULL;
-    DetectTagDataEntry *prev = NULL;
-    DetectTagDataEntry *iter;
-    uint8_t flag_added = 0;
-
-    iter = HostGetStorageById(host, host_tag_id);
-    prev = NULL;
-    while (iter != NULL) {
-        /* update counters */
-        iter->last_ts = p->ts.tv_sec;
+        bool expired = false;
         switch (iter->metric) {
             case DETECT_TAG_METRIC_PACKET:
-                iter->packets++;
+                expired = iter->packets > iter->count;
                 break;
             case DETECT_TAG_METRIC_BYTES:
-                iter->bytes += GET_PKT_LEN(p);
+                expired = iter->bytes > iter->count;
+                break;
+            case DETECT_TAG_METRIC_SECONDS:
+                /* last_ts handles this metric, but also a generic time based
+                 * expiration to prevent dead sessions/hosts */
+                expired = iter->last_ts - iter->first_ts > iter->count;
                 break;
         }
+        if (expired) {
+            SCLogDebug("tag of sid %u expired", iter->sid);
+            /* order doesn't matter, move the last entry here */
+            list->entries[i] = list->entries[--list->cnt];
+            removed++;
+            continue;
+        }
 
-        /* If this packet triggered the rule with tag, we dont need
-         * to log it (the alert will log it) */
-        if (!(iter->flags & TAG_ENTRY_FLAG_SKIPPED_FIRST)) {
-            iter->flags |= TAG_ENTRY_FLAG_SKIPPED_FIRST;
-        } else {
-            /* Update metrics; remove if tag expired; and set alerts */
-            switch (iter->metric) {
-                case DETECT_TAG_METRIC_PACKET:
-                    if (iter->packets > iter->count) {
-                        SCLogDebug("host tag expired: packets %u > %u", iter->packets, iter->count);
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-                case DETECT_TAG_METRIC_BYTES:
-                    if (iter->bytes > iter->count) {
-                        SCLogDebug("host tag expired: bytes %u > %u", iter->bytes, iter->count);
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-                case DETECT_TAG_METRIC_SECONDS:
-                    /* last_ts handles this metric, but also a generic time based
-                     * expiration to prevent dead sessions/hosts */
-                    if (iter->last_ts - iter->first_ts > iter->count) {
-                        SCLogDebug("host tag expired: %u - %u = %u > %u",
-                            iter->last_ts, iter->first_ts,
-                            (iter->last_ts - iter->first_ts), iter->count);
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                    break;
-            }
+        /* It's matching the tag. Add it to be logged */
+        p->flags |= PKT_HAS_TAG;
+        i++;
+    }
+    return removed;
+}
+
+static void TagHandlePacketFlow(Flow *f, Packet *p)
+{
+    DetectTagList *list = FlowGetStorageById(f, flow_tag_id);
+    if (list == NULL) {
+        f->flags &= ~FLOW_HAS_TAGS;
+        return;
+    }
 
+    uint16_t removed = TagListHandlePacket(list, p);
+    if (removed > 0) {
+        (void) SC_ATOMIC_SUB(flow_tags, removed);
+        if (list->cnt == 0) {
+            FlowSetStorageById(f, flow_tag_id, NULL);
+            SCFree(list);
+            f->flags &= ~FLOW_HAS_TAGS;
         }
+    }
+}
 
-        prev = iter;
-        iter = iter->next;
+static void TagHandlePacketHost(Host *host, Packet *p)
+{
+    DetectTagList *list = HostGetStorageById(host, host_tag_id);
+
+    uint16_t removed = TagListHandlePacket(list, p);
+    if (removed > 0) {
+        (void) SC_ATOMIC_SUB(host_tags, removed);
+        if (list->cnt == 0) {
+            HostSetStorageById(host, host_tag_id, NULL);
+            SCFree(list);
+        }
     }
 }
 
@@ -507,16 +369,15 @@ void TagHandlePacket(DetectEngineCtx *de_ctx,
 {
     SCEnter();
 
-    /* If there's no tag, get out of here */
-    unsigned int current_tags = SC_ATOMIC_GET(num_tags);
-    if (current_tags == 0)
-        SCReturn;
-
     /* First update and get session tags */
-    if (p->flow != NULL) {
+    if (p->flow != NULL && (p->flow->flags & FLOW_HAS_TAGS)) {
         TagHandlePacketFlow(p->flow, p);
     }
 
+    /* If no host is tagged, skip the lookups */
+    if (SC_ATOMIC_GET(host_tags) == 0)
+        SCReturn;
+
     Host *src = HostLookupHostFromHash(&p->src);
     if (src) {
         if (TagHostHasTag(src)) {
@@ -545,45 +406,79 @@ void TagHandlePacket(DetectEngineCtx *de_ctx,
  */
 int TagTimeoutCheck(Host *host, struct timeval *tv)
 {
-    DetectTagDataEntry *tde = NULL;
-    DetectTagDataEntry *tmp = NULL;
-    DetectTagDataEntry *prev = NULL;
-    int retval = 1;
-
-    tmp = HostGetStorageById(host, host_tag_id);
-    if (tmp == NULL)
+    DetectTagList *list = HostGetStorageById(host, host_tag_id);
+    if (list == NULL)
         return 1;
 
-    prev = NULL;
-    while (tmp != NULL) {
-        if ((tv->tv_sec - tmp->last_ts) <= TAG_MAX_LAST_TIME_SEEN) {
-            prev = tmp;
-            tmp = tmp->next;
-            retval = 0;
+    uint16_t i = 0;
+    while (i < list->cnt) {
+        if ((tv->tv_sec - list->entries[i].last_ts) <= TAG_MAX_LAST_TIME_SEEN) {
+            i++;
             continue;
         }
 
         /* timed out */
+        list->entries[i] = list->entries[--list->cnt];
+        (void) SC_ATOMIC_SUB(host_tags, 1);
+    }
 
-        if (prev != NULL) {
-            prev->next = tmp->next;
-
-            tde = tmp;
-            tmp = tde->next;
+    if (list->cnt > 0)
+        return 0;
 
-            SCFree(tde);
-            (void) SC_ATOMIC_SUB(num_tags, 1);
-        } else {
-            HostSetStorageById(host, host_tag_id, tmp->next);
+    HostSetStorageById(host, host_tag_id, NULL);
+    SCFree(list);
+    return 1;
+}
 
-            tde = tmp;
-            tmp = tde->next;
+/**
+ * \brief Expire the tags of a flow that is not timing out yet. Called by
+ *        the flow manager with the flow locked, so the tags of an active
+ *        flow are released without waiting for its packets.
+ *
+ * Tags expire when their seconds are up or when they didn't see a packet
+ * for TAG_MAX_LAST_TIME_SEEN.
+ *
+ * \param f locked flow
+ * \param ts the current time
+ *
+ * \retval ts the next tag of the flow expires at, 0 if no tags are left
+ */
+uint32_t TagFlowTimeoutCheck(Flow *f, struct timeval *ts)
+{
+    DetectTagList *list = FlowGetStorageById(f, flow_tag_id);
+    if (list == NULL) {
+        f->flags &= ~FLOW_HAS_TAGS;
+        return 0;
+    }
 
-            SCFree(tde);
-            (void) SC_ATOMIC_SUB(num_tags, 1);
+    const uint64_t now = (uint64_t)ts->tv_sec;
+    uint64_t next = UINT32_MAX;
+    uint16_t i = 0;
+    while (i < list->cnt) {
+        const DetectTagDataEntry *iter = &list->entries[i];
+        uint64_t due = (uint64_t)iter->last_ts + TAG_MAX_LAST_TIME_SEEN;
+        if (iter->metric == DETECT_TAG_METRIC_SECONDS)
+            due = MIN(due, (uint64_t)iter->first_ts + iter->count);
+
+        if (due >= now) {
+            next = MIN(next, due);
+            i++;
+            continue;
         }
+
+        /* timed out */
+        SCLogDebug("flow tag of sid %u timed out", iter->sid);
+        list->entries[i] = list->entries[--list->cnt];
+        (void) SC_ATOMIC_SUB(flow_tags, 1);
     }
-    return retval;
+
+    if (list->cnt > 0)
+        return (uint32_t)next;
+
+    FlowSetStorageById(f, flow_tag_id, NULL);
+    SCFree(list);
+    f->flags &= ~FLOW_HAS_TAGS;
+    return 0;
 }
 
 #ifdef UNITTESTS
@@ -665,7 +560,8 @@ static int DetectTagTestPacket01 (void)
         void *tag = HostGetStorageById(dst, host_tag_id);
         BUG_ON(tag == NULL);
 
-        DetectTagDataEntry *iter = tag;
+        DetectTagList *list = tag;
+        DetectTagDataEntry *iter = &list->entries[0];
 
         /* check internal state */
         if (!(iter->gid == 1 && iter->sid == 2 && iter->packets == 4 && iter->count == 4)) {
@@ -1495,6 +1391,67 @@ end:
     return result;
 }
 
+/**
+ * \test flow tags expired by the flow manager
+ */
+static int DetectTagTestFlowTimeout01(void)
+{
+    StorageInit();
+    TagInitCtx();
+    StorageFinalize();
+    HostInitConfig(1);
+    FlowInitConfig(1);
+
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FLOW_INITIALIZE(f);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"tagged", 6, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    p->ts.tv_sec = 1000;
+
+    DetectTagDataEntry tde;
+    memset(&tde, 0, sizeof(tde));
+    tde.gid = 1;
+    tde.sid = 1;
+    tde.metric = DETECT_TAG_METRIC_SECONDS;
+    tde.count = 10;
+    tde.first_ts = tde.last_ts = 1000;
+    FAIL_IF_NOT(TagFlowAdd(p, &tde) == 0);
+    tde.sid = 2;
+    tde.metric = DETECT_TAG_METRIC_PACKET;
+    FAIL_IF_NOT(TagFlowAdd(p, &tde) == 0);
+    FAIL_IF_NOT(TagFlowAdd(p, &tde) == 1);
+    FAIL_IF_NOT(f->flags & FLOW_HAS_TAGS);
+    FAIL_IF_NOT(SC_ATOMIC_GET(flow_tags) == 2);
+
+    struct timeval ts = { 1005, 0 };
+    FAIL_IF_NOT(TagFlowTimeoutCheck(f, &ts) == 1010);
+
+    /* seconds are up for sid 1 */
+    ts.tv_sec = 1011;
+    FAIL_IF_NOT(TagFlowTimeoutCheck(f, &ts) == 1000 + TAG_MAX_LAST_TIME_SEEN);
+    DetectTagList *list = FlowGetStorageById(f, flow_tag_id);
+    FAIL_IF_NULL(list);
+    FAIL_IF_NOT(list->cnt == 1 && list->entries[0].sid == 2);
+
+    /* no packets for too long */
+    ts.tv_sec = 1001 + TAG_MAX_LAST_TIME_SEEN;
+    FAIL_IF_NOT(TagFlowTimeoutCheck(f, &ts) == 0);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, flow_tag_id));
+    FAIL_IF(f->flags & FLOW_HAS_TAGS);
+    FAIL_IF_NOT(SC_ATOMIC_GET(flow_tags) == 0);
+
+    UTHFreePacket(p);
+    FlowFree(f);
+    FlowShutdown();
+    HostShutdown();
+    TagDestroyCtx();
+    StorageCleanup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1510,6 +1467,7 @@ void DetectEngineTagRegisterTests(void)
     UtRegisterTest("DetectTagTestPacket05", DetectTagTestPacket05);
     UtRegisterTest("DetectTagTestPacket06", DetectTagTestPacket06);
     UtRegisterTest("DetectTagTestPacket07", DetectTagTestPacket07);
+    UtRegisterTest("DetectTagTestFlowTimeout01", DetectTagTestFlowTimeout01);
 #endif /* UNITTESTS */
 }
 
@@ -53,6 +53,7 @@ void TagDestroyCtx(void);
 void TagRestartCtx(void);
 
 int TagTimeoutCheck(Host *, struct timeval *);
+uint32_t TagFlowTimeoutCheck(Flow *, struct timeval *);
 
 int TagHostHasTag(Host *host);
 
@@ -40,12 +40,6 @@
 #include "detect.h"
 #include "flow.h"
 
-#include "host.h"
-#include "host-storage.h"
-
-#include "ippair.h"
-#include "ippair-storage.h"
-
 #include "detect-parse.h"
 #include "detect-engine-sigorder.h"
 
@@ -62,43 +56,141 @@
 #include "detect-uricontent.h"
 
 #include "util-hash.h"
+#include "util-hash-lookup3.h"
+#include "util-random.h"
+#include "util-misc.h"
+#include "util-byte.h"
 #include "util-time.h"
 #include "util-error.h"
 #include "util-debug.h"
 
 #include "util-var-name.h"
 #include "tm-threads.h"
-
-static int host_threshold_id = -1; /**< host storage id for thresholds */
-static int ippair_threshold_id = -1; /**< ip pair storage id for thresholds */
-
-int ThresholdHostStorageId(void)
+#include "conf.h"
+
+#define THRESHOLD_DEFAULT_HASHSIZE  4096
+#define THRESHOLD_DEFAULT_MEMCAP    (16 * 1024 * 1024)
+
+/** row of the threshold tracking table. Each row has its own lock so
+ *  that alerts for different sids and addresses don't contend. */
+typedef struct ThresholdHashRow_ {
+    SCMutex lock;
+    DetectThresholdEntry *head;
+    /** lowest expiry time of the entries in the row. Lets the timeout
+     *  code skip rows that have nothing to expire yet. */
+    uint32_t next_expire;
+} __attribute__((aligned(CLS))) ThresholdHashRow;
+
+/** table tracking the by_src, by_dst and by_both thresholds, keyed on
+ *  sid, gid, track and address(es) */
+static struct {
+    ThresholdHashRow *rows;
+    uint32_t size;
+    uint32_t hash_rand;
+    uint64_t memcap;
+    SC_ATOMIC_DECLARE(uint64_t, memuse);
+    SC_ATOMIC_DECLARE(uint64_t, entries);
+    /** entries removed because they timed out */
+    SC_ATOMIC_DECLARE(uint64_t, evicted);
+} th_table = { NULL, 0, 0, 0 };
+
+static void ThresholdEntryFree(DetectThresholdEntry *e)
 {
-    return host_threshold_id;
+    SCFree(e);
+    (void)SC_ATOMIC_SUB(th_table.memuse, sizeof(DetectThresholdEntry));
+    (void)SC_ATOMIC_SUB(th_table.entries, 1);
 }
 
+/**
+ * \brief Set up the threshold tracking table
+ *
+ * Uses detect.thresholds.hash-size and detect.thresholds.memcap.
+ */
 void ThresholdInit(void)
 {
-    host_threshold_id = HostStorageRegister("threshold", sizeof(void *), NULL, ThresholdListFree);
-    if (host_threshold_id == -1) {
-        SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for thresholding");
-        exit(EXIT_FAILURE);
+    uint32_t size = THRESHOLD_DEFAULT_HASHSIZE;
+    uint64_t memcap = THRESHOLD_DEFAULT_MEMCAP;
+    const char *conf_val;
+
+    if ((ConfGet("detect.thresholds.hash-size", &conf_val)) == 1) {
+        if (ByteExtractStringUint32(&size, 10, strlen(conf_val), conf_val) <= 0 ||
+                size == 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                    "detect.thresholds.hash-size: %s", conf_val);
+            exit(EXIT_FAILURE);
+        }
     }
-    ippair_threshold_id = IPPairStorageRegister("threshold", sizeof(void *), NULL, ThresholdListFree);
-    if (ippair_threshold_id == -1) {
-        SCLogError(SC_ERR_HOST_INIT, "Can't initiate IP pair storage for thresholding");
+    if ((ConfGet("detect.thresholds.memcap", &conf_val)) == 1) {
+        if (ParseSizeStringU64(conf_val, &memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing detect.thresholds.memcap "
+                    "from conf file - %s", conf_val);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    th_table.rows = SCMallocAligned(size * sizeof(ThresholdHashRow), CLS);
+    if (unlikely(th_table.rows == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Can't initiate threshold table");
         exit(EXIT_FAILURE);
     }
+    memset(th_table.rows, 0, size * sizeof(ThresholdHashRow));
+    for (uint32_t i = 0; i < size; i++) {
+        SCMutexInit(&th_table.rows[i].lock, NULL);
+    }
+    th_table.size = size;
+    th_table.memcap = memcap;
+    th_table.hash_rand = (uint32_t)RandomGet();
+    SC_ATOMIC_INIT(th_table.memuse);
+    SC_ATOMIC_INIT(th_table.entries);
+    SC_ATOMIC_INIT(th_table.evicted);
+    (void)SC_ATOMIC_ADD(th_table.memuse, size * sizeof(ThresholdHashRow));
+}
+
+/**
+ * \brief Free the threshold tracking table and all its entries
+ */
+void ThresholdDestroy(void)
+{
+    if (th_table.rows == NULL)
+        return;
+
+    for (uint32_t i = 0; i < th_table.size; i++) {
+        ThresholdHashRow *row = &th_table.rows[i];
+        DetectThresholdEntry *e = row->head;
+        while (e != NULL) {
+            DetectThresholdEntry *next = e->next;
+            ThresholdEntryFree(e);
+            e = next;
+        }
+        SCMutexDestroy(&row->lock);
+    }
+    SCFreeAligned(th_table.rows);
+    th_table.rows = NULL;
+    th_table.size = 0;
+    SC_ATOMIC_DESTROY(th_table.memuse);
+    SC_ATOMIC_DESTROY(th_table.entries);
+    SC_ATOMIC_DESTROY(th_table.evicted);
 }
 
-int ThresholdHostHasThreshold(Host *host)
+/**
+ * \brief Get the number of entries in the threshold tracking table
+ */
+uint64_t ThresholdsGetEntryCount(void)
 {
-    return HostGetStorageById(host, host_threshold_id) ? 1 : 0;
+    if (th_table.rows == NULL)
+        return 0;
+    return SC_ATOMIC_GET(th_table.entries);
 }
 
-int ThresholdIPPairHasThreshold(IPPair *pair)
+/**
+ * \brief Get the number of entries removed from the threshold tracking
+ *        table because they timed out
+ */
+uint64_t ThresholdsGetEvictedCount(void)
 {
-    return IPPairGetStorageById(pair, ippair_threshold_id) ? 1 : 0;
+    if (th_table.rows == NULL)
+        return 0;
+    return SC_ATOMIC_GET(th_table.evicted);
 }
 
 /**
@@ -154,67 +246,89 @@ const DetectThresholdData *SigGetThresholdTypeIter(const Signature *sig,
     return NULL;
 }
 
-/**
- * \brief Remove timeout threshold hash elements
+/** \internal
+ *  \brief get the time after which an entry can be removed
+ */
+static inline uint32_t ThresholdEntryExpire(const DetectThresholdEntry *e)
+{
+    uint32_t expire = e->tv_sec1 + e->seconds;
+    if (e->tv_timeout != 0 && e->tv_timeout + e->timeout > expire)
+        expire = e->tv_timeout + e->timeout;
+    return expire;
+}
+
+/** \internal
+ *  \brief check if an entry timed out
  *
- * \param head Current head element of storage
- * \param tv Current time
+ *  The 'now' time can be before the creation time due to the async nature
+ *  of the timeout code that also calls this from a management thread.
+ */
+static inline int ThresholdEntryTimedOut(const DetectThresholdEntry *e, uint32_t now)
+{
+    return (now >= e->tv_sec1 && now > ThresholdEntryExpire(e));
+}
+
+/** \internal
+ *  \brief remove the timed out entries of a row
  *
- * \retval DetectThresholdEntry Return new head element or NULL if all expired
+ *  \param row *LOCKED* row
  *
+ *  \retval cnt number of removed entries
  */
-
-static DetectThresholdEntry* ThresholdTimeoutCheck(DetectThresholdEntry *head, struct timeval *tv)
+static uint32_t ThresholdRowTimeoutCheck(ThresholdHashRow *row, uint32_t now)
 {
-    DetectThresholdEntry *tmp = head;
+    uint32_t cnt = 0;
+    uint32_t next_expire = UINT32_MAX;
     DetectThresholdEntry *prev = NULL;
-    DetectThresholdEntry *new_head = head;
-
-    while (tmp != NULL) {
-        /* check if the 'check' timestamp is not before the creation ts.
-         * This can happen due to the async nature of the host timeout
-         * code that also calls this code from a management thread. */
-        if (((uint32_t)tv->tv_sec < tmp->tv_sec1) || (tv->tv_sec - tmp->tv_sec1) <= tmp->seconds) {
-            prev = tmp;
-            tmp = tmp->next;
-            continue;
-        }
-
-        /* timed out */
-
-        DetectThresholdEntry *tde = tmp;
-        if (prev != NULL) {
-            prev->next = tmp->next;
+    DetectThresholdEntry *e = row->head;
+
+    while (e != NULL) {
+        DetectThresholdEntry *next = e->next;
+        if (ThresholdEntryTimedOut(e, now)) {
+            if (prev != NULL)
+                prev->next = next;
+            else
+                row->head = next;
+            ThresholdEntryFree(e);
+            (void)SC_ATOMIC_ADD(th_table.evicted, 1);
+            cnt++;
+        } else {
+            uint32_t expire = ThresholdEntryExpire(e);
+            if (expire < next_expire)
+                next_expire = expire;
+            prev = e;
         }
-        else {
-            new_head = tmp->next;
-        }
-        tmp = tde->next;
-        SCFree(tde);
+        e = next;
     }
-
-    return new_head;
+    row->next_expire = next_expire;
+    return cnt;
 }
 
-int ThresholdHostTimeoutCheck(Host *host, struct timeval *tv)
+/**
+ * \brief Remove the timed out entries from the threshold table
+ *
+ * Rows whose entries can't have expired yet are skipped, as are rows that
+ * are busy: those will be handled on the next run.
+ *
+ * \param ts current time
+ *
+ * \retval cnt number of removed entries
+ */
+uint32_t ThresholdsTimeoutCheck(struct timeval *ts)
 {
-    DetectThresholdEntry* head = HostGetStorageById(host, host_threshold_id);
-    DetectThresholdEntry* new_head = ThresholdTimeoutCheck(head, tv);
-    if (new_head != head) {
-        HostSetStorageById(host, host_threshold_id, new_head);
-    }
-    return new_head == NULL;
-}
+    uint32_t cnt = 0;
+    const uint32_t now = (uint32_t)ts->tv_sec;
 
-
-int ThresholdIPPairTimeoutCheck(IPPair *pair, struct timeval *tv)
-{
-    DetectThresholdEntry* head = IPPairGetStorageById(pair, ippair_threshold_id);
-    DetectThresholdEntry* new_head = ThresholdTimeoutCheck(head, tv);
-    if (new_head != head) {
-        IPPairSetStorageById(pair, ippair_threshold_id, new_head);
+    for (uint32_t i = 0; i < th_table.size; i++) {
+        ThresholdHashRow *row = &th_table.rows[i];
+        if (SCMutexTrylock(&row->lock) != 0)
+            continue;
+        if (row->head != NULL && row->next_expire < now) {
+            cnt += ThresholdRowTimeoutCheck(row, now);
+        }
+        SCMutexUnlock(&row->lock);
     }
-    return new_head == NULL;
+    return cnt;
 }
 
 static DetectThresholdEntry *
@@ -232,36 +346,127 @@ DetectThresholdEntryAlloc(const DetectThresholdData *td, Packet *p,
     ste->gid = gid;
     ste->track = td->track;
     ste->seconds = td->seconds;
+    ste->timeout = td->timeout;
 
     SCReturnPtr(ste, "DetectThresholdEntry");
 }
 
-static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h,
-        uint32_t sid, uint32_t gid)
+/** \internal
+ *  \brief get the addresses tracked for a packet
+ *
+ *  For by_both the lowest address goes first, so that both directions
+ *  use the same entry.
+ */
+static void ThresholdGetAddrs(const Packet *p, int track,
+        const Address **a, const Address **b)
 {
-    DetectThresholdEntry *e;
-
-    for (e = HostGetStorageById(h, host_threshold_id); e != NULL; e = e->next) {
-        if (e->sid == sid && e->gid == gid)
-            break;
+    *b = NULL;
+    if (track == TRACK_SRC) {
+        *a = &p->src;
+    } else if (track == TRACK_DST) {
+        *a = &p->dst;
+    } else {
+        if (memcmp(p->src.addr_data32, p->dst.addr_data32,
+                    sizeof(p->src.addr_data32)) <= 0) {
+            *a = &p->src;
+            *b = &p->dst;
+        } else {
+            *a = &p->dst;
+            *b = &p->src;
+        }
     }
+}
 
-    return e;
+static inline ThresholdHashRow *ThresholdGetRow(uint32_t sid, uint32_t gid,
+        int track, const Address *a, const Address *b)
+{
+    uint32_t key[11];
+    key[0] = sid;
+    key[1] = gid;
+    key[2] = (uint32_t)track;
+    memcpy(&key[3], a->addr_data32, 4 * sizeof(uint32_t));
+    if (b != NULL)
+        memcpy(&key[7], b->addr_data32, 4 * sizeof(uint32_t));
+    else
+        memset(&key[7], 0, 4 * sizeof(uint32_t));
+
+    uint32_t hash = hashword(key, 11, th_table.hash_rand);
+    return &th_table.rows[hash % th_table.size];
 }
 
-static DetectThresholdEntry *ThresholdIPPairLookupEntry(IPPair *pair,
-        uint32_t sid, uint32_t gid)
+/** \internal
+ *  \brief look up an entry in a row, removing the timed out entries
+ *         we come across
+ *
+ *  \param row *LOCKED* row
+ */
+static DetectThresholdEntry *ThresholdRowLookupEntry(ThresholdHashRow *row,
+        uint32_t sid, uint32_t gid, int track, const Address *a, const Address *b,
+        uint32_t now)
 {
-    DetectThresholdEntry *e;
+    DetectThresholdEntry *prev = NULL;
+    DetectThresholdEntry *e = row->head;
 
-    for (e = IPPairGetStorageById(pair, ippair_threshold_id); e != NULL; e = e->next) {
-        if (e->sid == sid && e->gid == gid)
-            break;
+    while (e != NULL) {
+        if (e->sid == sid && e->gid == gid && e->track == track &&
+                e->addr.family == a->family && CMP_ADDR(&e->addr, a) &&
+                (b == NULL || CMP_ADDR(&e->addr2, b))) {
+            return e;
+        }
+
+        DetectThresholdEntry *next = e->next;
+        if (ThresholdEntryTimedOut(e, now)) {
+            if (prev != NULL)
+                prev->next = next;
+            else
+                row->head = next;
+            ThresholdEntryFree(e);
+            (void)SC_ATOMIC_ADD(th_table.evicted, 1);
+        } else {
+            prev = e;
+        }
+        e = next;
     }
+    return NULL;
+}
 
+/** \internal
+ *  \brief alloc an entry for the table, within the memcap
+ */
+static DetectThresholdEntry *ThresholdTableEntryAlloc(const DetectThresholdData *td,
+        Packet *p, uint32_t sid, uint32_t gid, const Address *a, const Address *b)
+{
+    if (SC_ATOMIC_GET(th_table.memuse) + sizeof(DetectThresholdEntry) > th_table.memcap)
+        return NULL;
+
+    DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+    if (e == NULL)
+        return NULL;
+
+    COPY_ADDRESS(a, &e->addr);
+    if (b != NULL)
+        COPY_ADDRESS(b, &e->addr2);
+
+    (void)SC_ATOMIC_ADD(th_table.memuse, sizeof(DetectThresholdEntry));
+    (void)SC_ATOMIC_ADD(th_table.entries, 1);
     return e;
 }
 
+/** \internal
+ *  \brief add a set up entry to a row
+ *
+ *  \param row *LOCKED* row
+ */
+static void ThresholdRowAddEntry(ThresholdHashRow *row, DetectThresholdEntry *e)
+{
+    uint32_t expire = ThresholdEntryExpire(e);
+    if (row->head == NULL || expire < row->next_expire)
+        row->next_expire = expire;
+
+    e->next = row->head;
+    row->head = e;
+}
+
 static int ThresholdHandlePacketSuppress(Packet *p,
         const DetectThresholdData *td, uint32_t sid, uint32_t gid)
 {
@@ -370,70 +575,26 @@ static int IsThresholdReached(DetectThresholdEntry* lookup_tsh, const DetectThre
     return ret;
 }
 
-static void AddEntryToHostStorage(Host *h, DetectThresholdEntry *e, uint32_t packet_time)
-{
-    if (h && e) {
-        e->current_count = 1;
-        e->tv_sec1 = packet_time;
-        e->tv_timeout = 0;
-        e->next = HostGetStorageById(h, host_threshold_id);
-        HostSetStorageById(h, host_threshold_id, e);
-    }
-}
-
-static void AddEntryToIPPairStorage(IPPair *pair, DetectThresholdEntry *e, uint32_t packet_time)
-{
-    if (pair && e) {
-        e->current_count = 1;
-        e->tv_sec1 = packet_time;
-        e->tv_timeout = 0;
-        e->next = IPPairGetStorageById(pair, ippair_threshold_id);
-        IPPairSetStorageById(pair, ippair_threshold_id, e);
-    }
-}
-
-static int ThresholdHandlePacketIPPair(IPPair *pair, Packet *p, const DetectThresholdData *td,
-    uint32_t sid, uint32_t gid, PacketAlert *pa)
-{
-    int ret = 0;
-
-    DetectThresholdEntry *lookup_tsh = ThresholdIPPairLookupEntry(pair, sid, gid);
-    SCLogDebug("ippair lookup_tsh %p sid %u gid %u", lookup_tsh, sid, gid);
-
-    switch (td->type) {
-        case TYPE_RATE:
-        {
-            SCLogDebug("rate_filter");
-            ret = 1;
-            if (lookup_tsh && IsThresholdReached(lookup_tsh, td, p->ts.tv_sec)) {
-                RateFilterSetAction(p, pa, td->new_action);
-            } else if (!lookup_tsh) {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
-                AddEntryToIPPairStorage(pair, e, p->ts.tv_sec);
-            }
-            break;
-        }
-        default:
-        {
-            SCLogError(SC_ERR_INVALID_VALUE, "type %d is not supported", td->type);
-            break;
-        }
-    }
-
-    return ret;
-}
-
 /**
  *  \retval 2 silent match (no alert but apply actions)
  *  \retval 1 normal match
  *  \retval 0 no match
  */
-static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdData *td,
+static int ThresholdHandlePacketTable(Packet *p, const DetectThresholdData *td,
         uint32_t sid, uint32_t gid, PacketAlert *pa)
 {
     int ret = 0;
 
-    DetectThresholdEntry *lookup_tsh = ThresholdHostLookupEntry(h, sid, gid);
+    if (th_table.rows == NULL)
+        return 0;
+
+    const Address *a, *b;
+    ThresholdGetAddrs(p, td->track, &a, &b);
+    ThresholdHashRow *row = ThresholdGetRow(sid, gid, td->track, a, b);
+    SCMutexLock(&row->lock);
+
+    DetectThresholdEntry *lookup_tsh = ThresholdRowLookupEntry(row, sid, gid,
+            td->track, a, b, (uint32_t)p->ts.tv_sec);
     SCLogDebug("lookup_tsh %p sid %u gid %u", lookup_tsh, sid, gid);
 
     switch(td->type)   {
@@ -457,7 +618,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                     ret = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdTableEntryAlloc(td, p, sid, gid, a, b);
                 if (e == NULL) {
                     break;
                 }
@@ -467,8 +628,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
 
                 ret = 1;
 
-                e->next = HostGetStorageById(h, host_threshold_id);
-                HostSetStorageById(h, host_threshold_id, e);
+                ThresholdRowAddEntry(row, e);
             }
             break;
         }
@@ -492,7 +652,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                 if (td->count == 1)  {
                     ret = 1;
                 } else {
-                    DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                    DetectThresholdEntry *e = ThresholdTableEntryAlloc(td, p, sid, gid, a, b);
                     if (e == NULL) {
                         break;
                     }
@@ -500,8 +660,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                     e->current_count = 1;
                     e->tv_sec1 = p->ts.tv_sec;
 
-                    e->next = HostGetStorageById(h, host_threshold_id);
-                    HostSetStorageById(h, host_threshold_id, e);
+                    ThresholdRowAddEntry(row, e);
                 }
             }
             break;
@@ -532,7 +691,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                     }
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdTableEntryAlloc(td, p, sid, gid, a, b);
                 if (e == NULL) {
                     break;
                 }
@@ -540,8 +699,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                 e->current_count = 1;
                 e->tv_sec1 = p->ts.tv_sec;
 
-                e->next = HostGetStorageById(h, host_threshold_id);
-                HostSetStorageById(h, host_threshold_id, e);
+                ThresholdRowAddEntry(row, e);
 
                 /* for the first match we return 1 to
                  * indicate we should alert */
@@ -575,7 +733,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                     lookup_tsh->current_count = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdTableEntryAlloc(td, p, sid, gid, a, b);
                 if (e == NULL) {
                     break;
                 }
@@ -584,8 +742,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
                 e->tv_sec1 = p->ts.tv_sec;
                 e->tv_usec1 = p->ts.tv_usec;
 
-                e->next = HostGetStorageById(h, host_threshold_id);
-                HostSetStorageById(h, host_threshold_id, e);
+                ThresholdRowAddEntry(row, e);
             }
             break;
         }
@@ -597,8 +754,13 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
             if (lookup_tsh && IsThresholdReached(lookup_tsh, td, p->ts.tv_sec)) {
                 RateFilterSetAction(p, pa, td->new_action);
             } else if (!lookup_tsh) {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
-                AddEntryToHostStorage(h, e, p->ts.tv_sec);
+                DetectThresholdEntry *e = ThresholdTableEntryAlloc(td, p, sid, gid, a, b);
+                if (e != NULL) {
+                    e->current_count = 1;
+                    e->tv_sec1 = p->ts.tv_sec;
+                    e->tv_timeout = 0;
+                    ThresholdRowAddEntry(row, e);
+                }
             }
             break;
         }
@@ -607,6 +769,7 @@ static int ThresholdHandlePacketHost(Host *h, Packet *p, const DetectThresholdDa
             SCLogError(SC_ERR_INVALID_VALUE, "type %d is not supported", td->type);
     }
 
+    SCMutexUnlock(&row->lock);
     return ret;
 }
 
@@ -671,24 +834,9 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
 
     if (td->type == TYPE_SUPPRESS) {
         ret = ThresholdHandlePacketSuppress(p,td,s->id,s->gid);
-    } else if (td->track == TRACK_SRC) {
-        Host *src = HostGetHostFromHash(&p->src);
-        if (src) {
-            ret = ThresholdHandlePacketHost(src,p,td,s->id,s->gid,pa);
-            HostRelease(src);
-        }
-    } else if (td->track == TRACK_DST) {
-        Host *dst = HostGetHostFromHash(&p->dst);
-        if (dst) {
-            ret = ThresholdHandlePacketHost(dst,p,td,s->id,s->gid,pa);
-            HostRelease(dst);
-        }
-    } else if (td->track == TRACK_BOTH) {
-        IPPair *pair = IPPairGetIPPairFromHash(&p->src, &p->dst);
-        if (pair) {
-            ret = ThresholdHandlePacketIPPair(pair, p, td, s->id, s->gid, pa);
-            IPPairRelease(pair);
-        }
+    } else if (td->track == TRACK_SRC || td->track == TRACK_DST ||
+               td->track == TRACK_BOTH) {
+        ret = ThresholdHandlePacketTable(p, td, s->id, s->gid, pa);
     } else if (td->track == TRACK_RULE) {
         SCMutexLock(&de_ctx->ths_ctx.threshold_table_lock);
         ret = ThresholdHandlePacketRule(de_ctx,p,td,s,pa);
@@ -698,6 +846,23 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     SCReturnInt(ret);
 }
 
+#ifdef UNITTESTS
+/**
+ * \brief look up the table entry for a packet, without locking
+ */
+DetectThresholdEntry *ThresholdsLookupEntry(Packet *p, uint32_t sid,
+        uint32_t gid, int track)
+{
+    if (th_table.rows == NULL)
+        return NULL;
+
+    const Address *a, *b;
+    ThresholdGetAddrs(p, track, &a, &b);
+    ThresholdHashRow *row = ThresholdGetRow(sid, gid, track, a, b);
+    return ThresholdRowLookupEntry(row, sid, gid, track, a, b, (uint32_t)p->ts.tv_sec);
+}
+#endif
+
 /**
  * \brief Init threshold context hash tables
  *
@@ -726,25 +891,6 @@ void ThresholdContextDestroy(DetectEngineCtx *de_ctx)
     SCMutexDestroy(&de_ctx->ths_ctx.threshold_table_lock);
 }
 
-/**
- * \brief this function will free all the entries of a list
- *        DetectTagDataEntry
- *
- * \param td pointer to DetectTagDataEntryList
- */
-void ThresholdListFree(void *ptr)
-{
-    if (ptr != NULL) {
-        DetectThresholdEntry *entry = ptr;
-
-        while (entry != NULL) {
-            DetectThresholdEntry *next_entry = entry->next;
-            SCFree(entry);
-            entry = next_entry;
-        }
-    }
-}
-
 /**
  * @}
  */
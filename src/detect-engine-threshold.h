@@ -26,15 +26,9 @@
 #define __DETECT_ENGINE_THRESHOLD_H__
 
 #include "detect.h"
-#include "host.h"
-#include "ippair.h"
 
 void ThresholdInit(void);
-
-int ThresholdHostStorageId(void);
-int ThresholdHostHasThreshold(Host *);
-
-int ThresholdIPPairHasThreshold(IPPair *pair);
+void ThresholdDestroy(void);
 
 const DetectThresholdData *SigGetThresholdTypeIter(const Signature *,
         Packet *, const SigMatchData **, int list);
@@ -45,8 +39,13 @@ int PacketAlertThreshold(DetectEngineCtx *, DetectEngineThreadCtx *,
 void ThresholdHashInit(DetectEngineCtx *);
 void ThresholdContextDestroy(DetectEngineCtx *);
 
-int ThresholdHostTimeoutCheck(Host *, struct timeval *);
-int ThresholdIPPairTimeoutCheck(IPPair *, struct timeval *);
-void ThresholdListFree(void *ptr);
+uint32_t ThresholdsTimeoutCheck(struct timeval *);
+uint64_t ThresholdsGetEntryCount(void);
+uint64_t ThresholdsGetEvictedCount(void);
+
+#ifdef UNITTESTS
+DetectThresholdEntry *ThresholdsLookupEntry(Packet *, uint32_t sid,
+        uint32_t gid, int track);
+#endif
 
 #endif /* __DETECT_ENGINE_THRESHOLD_H__ */
@@ -43,6 +43,8 @@
 #include "detect-engine-port.h"
 #include "detect-engine-prefilter.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-rule-sample.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-tag.h"
 
@@ -71,6 +73,7 @@
 #include "util-magic.h"
 #include "util-signal.h"
 #include "util-spm.h"
+#include "util-memcpy.h"
 #include "util-device.h"
 #include "util-var-name.h"
 
@@ -82,8 +85,13 @@
 #endif
 
 #include "reputation.h"
+#include "datasets.h"
 
 #define DETECT_ENGINE_DEFAULT_INSPECTION_RECURSION_LIMIT 3000
+/** default for detect.mpm-teddy-max-patterns */
+#define DETECT_MPM_TEDDY_MAX_PATTERNS 8
+/** default for detect.mpm-large-pattern-bytes */
+#define DETECT_MPM_LARGE_PATTERN_BYTES 16384
 
 static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
         ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt);
@@ -93,11 +101,11 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *);
 static DetectEngineMasterCtx g_master_de_ctx = { SCMUTEX_INITIALIZER,
     0, 99, NULL, NULL, TENANT_SELECTOR_UNKNOWN, NULL, NULL, 0};
 
-static uint32_t TenantIdHash(HashTable *h, void *data, uint16_t data_len);
-static char TenantIdCompare(void *d1, uint16_t d1_len, void *d2, uint16_t d2_len);
-static void TenantIdFree(void *d);
+static void TenantIdFree(DetectEngineThreadCtx *det_ctx);
+static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx);
 static uint32_t DetectEngineTentantGetIdFromLivedev(const void *ctx, const Packet *p);
 static uint32_t DetectEngineTentantGetIdFromVlanId(const void *ctx, const Packet *p);
+static uint32_t DetectEngineTentantGetIdFromVni(const void *ctx, const Packet *p);
 static uint32_t DetectEngineTentantGetIdFromPcap(const void *ctx, const Packet *p);
 
 static DetectEngineAppInspectionEngine *g_app_inspect_engines = NULL;
@@ -304,6 +312,28 @@ static void DetectAppLayerInspectEngineCopyListToDetectCtx(DetectEngineCtx *de_c
     }
 }
 
+/** \internal
+ *  \brief check if nocase content in the list benefits from searching
+ *         a lowercase copy of the buffer */
+static bool DetectEngineSmdUseLowercase(const DetectEngineCtx *de_ctx,
+        const SigMatchData *smd)
+{
+    if (smd == NULL || spm_table[de_ctx->spm_matcher].ScanLowercase == NULL)
+        return false;
+
+    while (1) {
+        if (smd->type == DETECT_CONTENT) {
+            const DetectContentData *cd = (const DetectContentData *)smd->ctx;
+            if (cd->flags & DETECT_CONTENT_NOCASE)
+                return true;
+        }
+        if (smd->is_last)
+            break;
+        smd++;
+    }
+    return false;
+}
+
 /** \internal
  *  \brief append the stream inspection
  *
@@ -393,7 +423,7 @@ int DetectEngineAppInspectionEngine2Signature(DetectEngineCtx *de_ctx, Signature
 
         if (t->alproto == ALPROTO_UNKNOWN) {
             /* special case, inspect engine applies to all protocols */
-        } else if (s->alproto != ALPROTO_UNKNOWN && s->alproto != t->alproto)
+        } else if (s->alproto != ALPROTO_UNKNOWN && !AppProtoEquals(s->alproto, t->alproto))
             goto next;
 
         if (s->flags & SIG_FLAG_TOSERVER && !(s->flags & SIG_FLAG_TOCLIENT)) {
@@ -421,6 +451,7 @@ int DetectEngineAppInspectionEngine2Signature(DetectEngineCtx *de_ctx, Signature
         new_engine->Callback = t->Callback;
         new_engine->progress = t->progress;
         new_engine->v2 = t->v2;
+        new_engine->lowercase = DetectEngineSmdUseLowercase(de_ctx, new_engine->smd);
         SCLogDebug("sm_list %d new_engine->v2 %p/%p/%p",
                 new_engine->sm_list, new_engine->v2.Callback,
                 new_engine->v2.GetData, new_engine->v2.transforms);
@@ -492,6 +523,31 @@ next:
         }
     }
 
+    /* a http rule only inspects http2 flows if all its http buffers
+     * have a http2 engine, otherwise the buffers without one would be
+     * skipped on http2, matching on less than the rule asks for. */
+    if (s->alproto == ALPROTO_HTTP) {
+        bool http2 = true;
+        for (const DetectEngineAppInspectionEngine *a = s->app_inspect;
+                a != NULL && http2; a = a->next)
+        {
+            if (a->alproto != ALPROTO_HTTP)
+                continue;
+            http2 = false;
+            for (const DetectEngineAppInspectionEngine *b = s->app_inspect;
+                    b != NULL; b = b->next)
+            {
+                if (b->alproto == ALPROTO_HTTP2 && b->sm_list == a->sm_list &&
+                        b->dir == a->dir) {
+                    http2 = true;
+                    break;
+                }
+            }
+        }
+        if (http2)
+            s->flags |= SIG_FLAG_HTTP2;
+    }
+
 #ifdef DEBUG
     const DetectEngineAppInspectionEngine *iter = s->app_inspect;
     while (iter) {
@@ -932,6 +988,7 @@ void InspectionBufferSetup(InspectionBuffer *buffer, const uint8_t *data, const
     buffer->inspect = buffer->orig = data;
     buffer->inspect_len = buffer->orig_len = data_len;
     buffer->len = 0;
+    buffer->lc_set = false;
 }
 
 void InspectionBufferFree(InspectionBuffer *buffer)
@@ -939,9 +996,42 @@ void InspectionBufferFree(InspectionBuffer *buffer)
     if (buffer->buf != NULL) {
         SCFree(buffer->buf);
     }
+    if (buffer->lc != NULL) {
+        SCFree(buffer->lc);
+    }
     memset(buffer, 0, sizeof(*buffer));
 }
 
+/** \brief get a lowercase copy of the inspect data
+ *
+ *  The copy is made on the first call after the buffer was set up, so
+ *  all nocase inspection of the buffer in a tx shares a single pass.
+ *
+ *  \retval lc lowercase data of inspect_len bytes or NULL on error
+ */
+const uint8_t *InspectionBufferGetLowercase(InspectionBuffer *buffer)
+{
+    if (buffer->lc_set)
+        return buffer->lc;
+    if (buffer->inspect == NULL || buffer->inspect_len == 0)
+        return NULL;
+
+    if (buffer->lc_size < buffer->inspect_len) {
+        uint32_t new_size = (buffer->lc_size == 0) ? 4096 : buffer->lc_size;
+        while (new_size < buffer->inspect_len) {
+            new_size *= 2;
+        }
+        void *ptr = SCRealloc(buffer->lc, new_size);
+        if (ptr == NULL)
+            return NULL;
+        buffer->lc = ptr;
+        buffer->lc_size = new_size;
+    }
+    memcpy_tolower(buffer->lc, buffer->inspect, buffer->inspect_len);
+    buffer->lc_set = true;
+    return buffer->lc;
+}
+
 /**
  * \brief make sure that the buffer has at least 'min_size' bytes
  * Expand the buffer if necessary
@@ -1278,6 +1368,11 @@ int DetectEngineInspectBufferGeneric(
     det_ctx->buffer_offset = 0;
     det_ctx->inspection_recursion_counter = 0;
 
+    if (engine->lowercase) {
+        det_ctx->inspect_lc = InspectionBufferGetLowercase((InspectionBuffer *)buffer);
+        det_ctx->inspect_lc_orig = data;
+    }
+
     /* Inspect all the uricontents fetched on each
      * transaction at the app layer */
     int r = DetectEngineContentInspection(de_ctx, det_ctx,
@@ -1285,6 +1380,7 @@ int DetectEngineInspectBufferGeneric(
                                           NULL, f,
                                           (uint8_t *)data, data_len, offset, ci_flags,
                                           DETECT_ENGINE_CONTENT_INSPECTION_MODE_STATE);
+    det_ctx->inspect_lc = det_ctx->inspect_lc_orig = NULL;
     if (r == 1) {
         return DETECT_ENGINE_INSPECT_SIG_MATCH;
     } else {
@@ -1406,6 +1502,7 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
 
     /* can be zero in unix socket mode */
     if (no_of_detect_tvs == 0) {
+        DatasetsThreadSyncDone(DatasetsThreadSyncStart());
         return 0;
     }
 
@@ -1458,6 +1555,10 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
     }
     BUG_ON(i != no_of_detect_tvs);
 
+    /* sets retired by a dataset reload so far are no longer used once
+     * the threads have moved to the new det_ctx */
+    const uint32_t datasets_epoch = DatasetsThreadSyncStart();
+
     /* atomicly replace the det_ctx data */
     i = 0;
     tv = tv_root[TVT_PPT];
@@ -1537,6 +1638,8 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         }
     }
 
+    DatasetsThreadSyncDone(datasets_epoch);
+
     /* free all the ctxs */
     for (i = 0; i < no_of_detect_tvs; i++) {
         SCLogDebug("Freeing old_det_ctx - %p used by detect",
@@ -1544,8 +1647,6 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         DetectEngineThreadCtxDeinit(NULL, old_det_ctx[i]);
     }
 
-    SRepReloadComplete();
-
     return 1;
 
  error:
@@ -1689,6 +1790,10 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     if (de_ctx == NULL)
         return;
 
+    /* writes the stats, needs the buffer names */
+    DetectFPStatsFree(de_ctx);
+    DetectRuleSampleFree(de_ctx);
+
 #ifdef PROFILING
     if (de_ctx->profile_ctx != NULL) {
         SCProfilingRuleDestroyCtx(de_ctx->profile_ctx);
@@ -1715,6 +1820,8 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     SigCleanSignatures(de_ctx);
     SCFree(de_ctx->app_mpms);
     de_ctx->app_mpms = NULL;
+    SCFree(de_ctx->app_mpm_batches);
+    de_ctx->app_mpm_batches = NULL;
     if (de_ctx->sig_array)
         SCFree(de_ctx->sig_array);
 
@@ -1728,7 +1835,6 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     MpmFactoryDeRegisterAllMpmCtxProfiles(de_ctx);
 
     DetectEngineCtxFreeThreadKeywordData(de_ctx);
-    SRepDestroy(de_ctx);
     DetectEngineCtxFreeFailedSigs(de_ctx);
 
     DetectAddressMapFree(de_ctx);
@@ -1759,6 +1865,68 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     //DetectPortPrintMemory();
 }
 
+/** \internal
+ *  \brief load the inspection budget per packet and per tx
+ *
+ *  detect.inspection-budget.rules and .ticks limit the rules to inspect
+ *  and the ticks to spend. Over budget only the rules with a priority up
+ *  to .priority are inspected. The .policy 'event' also sets an engine
+ *  event on the packet, 'bypass' also bypasses the flow.
+ */
+static void DetectEngineCtxLoadBudget(DetectEngineCtx *de_ctx)
+{
+    intmax_t rules = 0;
+    if (ConfGetInt("detect.inspection-budget.rules", &rules) == 1) {
+        if (rules < 0 || rules > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.inspection-budget.rules: %"PRIdMAX, rules);
+            rules = 0;
+        }
+    }
+    intmax_t ticks = 0;
+    if (ConfGetInt("detect.inspection-budget.ticks", &ticks) == 1) {
+        if (ticks < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.inspection-budget.ticks: %"PRIdMAX, ticks);
+            ticks = 0;
+        }
+    }
+    de_ctx->budget_rules = (uint32_t)rules;
+    de_ctx->budget_ticks = (uint64_t)ticks;
+    de_ctx->budget_enabled = (rules > 0 || ticks > 0);
+    if (!de_ctx->budget_enabled)
+        return;
+
+    intmax_t prio = 1;
+    if (ConfGetInt("detect.inspection-budget.priority", &prio) == 1) {
+        if (prio < 0 || prio > 255) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.inspection-budget.priority: %"PRIdMAX", using 1", prio);
+            prio = 1;
+        }
+    }
+    de_ctx->budget_priority = (int)prio;
+
+    de_ctx->budget_policy = DETECT_BUDGET_POLICY_SKIP;
+    const char *policy = NULL;
+    if (ConfGet("detect.inspection-budget.policy", &policy) == 1 &&
+            policy != NULL) {
+        if (strcmp(policy, "event") == 0) {
+            de_ctx->budget_policy = DETECT_BUDGET_POLICY_EVENT;
+        } else if (strcmp(policy, "bypass") == 0) {
+            de_ctx->budget_policy = DETECT_BUDGET_POLICY_BYPASS;
+        } else if (strcmp(policy, "skip") != 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.inspection-budget.policy: %s, using skip", policy);
+        }
+    }
+
+    SCLogConfig("inspection budget: %u rules, %"PRIu64" ticks, policy %s",
+            de_ctx->budget_rules, de_ctx->budget_ticks,
+            de_ctx->budget_policy == DETECT_BUDGET_POLICY_BYPASS ? "bypass" :
+            de_ctx->budget_policy == DETECT_BUDGET_POLICY_EVENT ? "event" : "skip");
+}
+
 /** \brief  Function that load DetectEngineCtx config for grouping sigs
  *          used by the engine
  *  \retval 0 if no config provided, 1 if config was provided
@@ -1824,6 +1992,7 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
         /* for now, since we still haven't implemented any intelligence into
          * understanding the patterns and distributing mpm_ctx across sgh */
         if (de_ctx->mpm_matcher == MPM_AC || de_ctx->mpm_matcher == MPM_AC_KS ||
+            de_ctx->mpm_matcher == MPM_AC_COMPACT ||
 #ifdef BUILD_HYPERSCAN
             de_ctx->mpm_matcher == MPM_HS ||
 #endif
@@ -2046,6 +2215,77 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
             break;
     }
 
+    int stream_state = 0;
+    if (ConfGetBool("detect.prefilter.stream-state", &stream_state) == 1 &&
+            stream_state) {
+        if (mpm_table[de_ctx->mpm_matcher].SearchStream == NULL) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "detect.prefilter.stream-state "
+                    "is not supported by mpm-algo %s, ignoring",
+                    mpm_table[de_ctx->mpm_matcher].name);
+        } else {
+            de_ctx->prefilter_stream_state = true;
+            SCLogConfig("prefilter: resuming the raw stream mpm scans");
+        }
+    }
+
+    /* auto: only if the matcher searches several buffers in one call, the
+     * merged ctx' are no gain for the others */
+    de_ctx->prefilter_batch = (mpm_table[de_ctx->mpm_matcher].SearchVector != NULL);
+    const char *batch = NULL;
+    if (ConfGet("detect.prefilter.batch", &batch) == 1 && batch != NULL &&
+            strcasecmp(batch, "auto") != 0) {
+        de_ctx->prefilter_batch = (ConfValIsTrue(batch) != 0);
+    }
+    if (de_ctx->prefilter_batch) {
+        SCLogConfig("prefilter: searching the small tx buffers in batches");
+    }
+
+    de_ctx->mpm_teddy_max_patterns = DETECT_MPM_TEDDY_MAX_PATTERNS;
+    intmax_t teddy_max = 0;
+    if (ConfGetInt("detect.mpm-teddy-max-patterns", &teddy_max) == 1) {
+        if (teddy_max < 0 || teddy_max > UINT16_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.mpm-teddy-max-patterns: %"PRIdMAX", using %u",
+                    teddy_max, DETECT_MPM_TEDDY_MAX_PATTERNS);
+        } else {
+            de_ctx->mpm_teddy_max_patterns = (uint32_t)teddy_max;
+        }
+    }
+
+    de_ctx->mpm_matcher_large = MPM_NOTSET;
+    const char *algo_large = NULL;
+    if (ConfGet("detect.mpm-algo-large", &algo_large) == 1 && algo_large != NULL) {
+        const uint16_t m = PatternMatchMatcherByName(algo_large);
+        if (m == MPM_NOTSET || mpm_table[m].Search == NULL) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid or unsupported "
+                    "detect.mpm-algo-large: %s, ignoring", algo_large);
+        } else if (m != de_ctx->mpm_matcher) {
+            de_ctx->mpm_matcher_large = m;
+        }
+    }
+    de_ctx->mpm_large_pattern_bytes = DETECT_MPM_LARGE_PATTERN_BYTES;
+    intmax_t large_bytes = 0;
+    if (ConfGetInt("detect.mpm-large-pattern-bytes", &large_bytes) == 1) {
+        if (large_bytes < 1 || large_bytes > UINT32_MAX / MPM_LARGE_APP_FACTOR) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.mpm-large-pattern-bytes: %"PRIdMAX", using %u",
+                    large_bytes, DETECT_MPM_LARGE_PATTERN_BYTES);
+        } else {
+            de_ctx->mpm_large_pattern_bytes = (uint32_t)large_bytes;
+        }
+    }
+    if (de_ctx->mpm_matcher_large != MPM_NOTSET) {
+        SCLogConfig("mpm: rule groups with %u or more pattern bytes use %s",
+                de_ctx->mpm_large_pattern_bytes,
+                mpm_table[de_ctx->mpm_matcher_large].name);
+    }
+
+    int mpm_ctx_sharing = 1;
+    (void)ConfGetBool("detect.mpm-ctx-sharing", &mpm_ctx_sharing);
+    de_ctx->mpm_ctx_sharing = (mpm_ctx_sharing != 0);
+
+    DetectEngineCtxLoadBudget(de_ctx);
+
     return 0;
 }
 
@@ -2165,7 +2405,7 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
     uint32_t map_cnt = 0;
     int max_tenant_id = 0;
     DetectEngineCtx *list = master->list;
-    HashTable *mt_det_ctxs_hash = NULL;
+    DetectTenantHash *mt_det_ctxs_hash = NULL;
 
     if (master->tenant_selector == TENANT_SELECTOR_UNKNOWN) {
         SCLogError(SC_ERR_MT_NO_SELECTOR, "no tenant selector set: "
@@ -2182,7 +2422,7 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
         tcnt++;
     }
 
-    mt_det_ctxs_hash = HashTableInit(tcnt * 2, TenantIdHash, TenantIdCompare, TenantIdFree);
+    mt_det_ctxs_hash = DetectTenantHashInit(tcnt);
     if (mt_det_ctxs_hash == NULL) {
         goto error;
     }
@@ -2228,7 +2468,8 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
                 DetectEngineThreadCtx *mt_det_ctx = DetectEngineThreadCtxInitForReload(tv, list, 0);
                 if (mt_det_ctx == NULL)
                     goto error;
-                if (HashTableAdd(mt_det_ctxs_hash, mt_det_ctx, 0) != 0) {
+                if (DetectTenantHashAdd(mt_det_ctxs_hash, mt_det_ctx) != 0) {
+                    DetectEngineThreadCtxFree(mt_det_ctx);
                     goto error;
                 }
             }
@@ -2256,6 +2497,10 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
             det_ctx->TenantGetId = DetectEngineTentantGetIdFromLivedev;
             SCLogDebug("TENANT_SELECTOR_LIVEDEV");
             break;
+        case TENANT_SELECTOR_VNI:
+            det_ctx->TenantGetId = DetectEngineTentantGetIdFromVni;
+            SCLogDebug("TENANT_SELECTOR_VNI");
+            break;
         case TENANT_SELECTOR_DIRECT:
             det_ctx->TenantGetId = DetectEngineTentantGetIdFromPcap;
             SCLogDebug("TENANT_SELECTOR_DIRECT");
@@ -2267,7 +2512,7 @@ error:
     if (map_array != NULL)
         SCFree(map_array);
     if (mt_det_ctxs_hash != NULL)
-        HashTableFree(mt_det_ctxs_hash);
+        DetectTenantHashFree(mt_det_ctxs_hash, TenantIdFree);
 
     return TM_ECODE_FAILED;
 }
@@ -2277,9 +2522,15 @@ error:
  */
 static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
 {
-    PatternMatchThreadPrepare(&det_ctx->mtc, de_ctx->mpm_matcher);
-    PatternMatchThreadPrepare(&det_ctx->mtcs, de_ctx->mpm_matcher);
-    PatternMatchThreadPrepare(&det_ctx->mtcu, de_ctx->mpm_matcher);
+    det_ctx->memuse = sizeof(DetectEngineThreadCtx);
+
+    /* the packet, stream and app-layer mpms never run at the same time,
+     * so they share the matcher thread ctx (e.g. the hyperscan scratch) */
+    det_ctx->mtc_matcher = PatternMatchThreadMatcher(de_ctx);
+    PatternMatchThreadPrepare(&det_ctx->mtc, det_ctx->mtc_matcher);
+    det_ctx->mtcs = det_ctx->mtc;
+    det_ctx->mtcu = det_ctx->mtc;
+    det_ctx->memuse += det_ctx->mtc.memory_size;
 
     PmqSetup(&det_ctx->pmq);
 
@@ -2293,6 +2544,9 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     if (de_ctx->non_pf_store_cnt_max > 0) {
         det_ctx->non_pf_id_array =  SCCalloc(de_ctx->non_pf_store_cnt_max, sizeof(SigIntId));
         BUG_ON(det_ctx->non_pf_id_array == NULL);
+        det_ctx->non_pf_id_array_tmp = SCCalloc(de_ctx->non_pf_store_cnt_max, sizeof(SigIntId));
+        BUG_ON(det_ctx->non_pf_id_array_tmp == NULL);
+        det_ctx->memuse += 2 * de_ctx->non_pf_store_cnt_max * sizeof(SigIntId);
     }
 
     /* IP-ONLY */
@@ -2309,6 +2563,15 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
                det_ctx->match_array_len * sizeof(Signature *));
 
         RuleMatchCandidateTxArrayInit(det_ctx, de_ctx->sig_array_len);
+        det_ctx->memuse += de_ctx->sig_array_len *
+            (sizeof(Signature *) + sizeof(RuleMatchCandidateTx));
+
+        det_ctx->pf_sid_bitmap_size = (de_ctx->sig_array_len + 63) / 64;
+        det_ctx->pf_sid_bitmap = SCCalloc(det_ctx->pf_sid_bitmap_size, sizeof(uint64_t));
+        if (det_ctx->pf_sid_bitmap == NULL) {
+            return TM_ECODE_FAILED;
+        }
+        det_ctx->memuse += det_ctx->pf_sid_bitmap_size * sizeof(uint64_t);
     }
 
     /* byte_extract storage */
@@ -2317,6 +2580,8 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     if (det_ctx->bj_values == NULL) {
         return TM_ECODE_FAILED;
     }
+    det_ctx->memuse += sizeof(*det_ctx->bj_values) *
+        (de_ctx->byte_extract_max_local_id + 1);
 
     /* Allocate space for base64 decoded data. */
     if (de_ctx->base64_decode_max_len) {
@@ -2326,6 +2591,7 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         }
         det_ctx->base64_decoded_len_max = de_ctx->base64_decode_max_len;
         det_ctx->base64_decoded_len = 0;
+        det_ctx->memuse += de_ctx->base64_decode_max_len;
     }
 
     det_ctx->inspect.buffers_size = de_ctx->buffer_type_id;
@@ -2349,7 +2615,9 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         return TM_ECODE_FAILED;
     }
     det_ctx->multi_inspect.to_clear_idx = 0;
-
+    /* the buffers themselves are allocated on first use */
+    det_ctx->memuse += de_ctx->buffer_type_id * (sizeof(InspectionBuffer) +
+            sizeof(InspectionBufferMultipleForList) + 2 * sizeof(uint32_t));
 
     DetectEngineThreadCtxInitKeywords(de_ctx, det_ctx);
     DetectEngineThreadCtxInitGlobalKeywords(det_ctx);
@@ -2364,6 +2632,26 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     return TM_ECODE_OK;
 }
 
+/** \brief set up a tenant thread ctx on its first use
+ *
+ *  Tenant ctxs are created for every tenant in every detect thread, but
+ *  most of the per thread data is only allocated when the thread sees
+ *  traffic for the tenant.
+ *
+ *  \retval TM_ECODE_OK if the ctx is ready to use
+ */
+TmEcode DetectEngineThreadCtxInitLazy(ThreadVars *tv, DetectEngineThreadCtx *det_ctx)
+{
+    if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_DETECT_PREPARE, "setting up thread local detect ctx "
+                "for tenant %u failed", det_ctx->tenant_id);
+        return TM_ECODE_FAILED;
+    }
+    det_ctx->init_pending = false;
+    StatsAddUI64(tv, det_ctx->counter_memuse, det_ctx->memuse);
+    return TM_ECODE_OK;
+}
+
 /** \brief initialize thread specific detection engine context
  *
  *  \note there is a special case when using delayed detect. In this case the
@@ -2415,6 +2703,9 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_alerts_overflow = StatsRegisterCounter("detect.alert_queue_overflow", tv);
+    det_ctx->counter_budget_exceeded = StatsRegisterCounter("detect.inspection_budget_exceeded", tv);
+    det_ctx->counter_memuse = StatsRegisterCounter("detect.thread_memuse", tv);
 #ifdef PROFILING
     det_ctx->counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     det_ctx->counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -2460,8 +2751,11 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
         return NULL;
     }
 
-    /* most of the init happens here */
-    if (det_ctx->de_ctx->type == DETECT_ENGINE_TYPE_NORMAL ||
+    /* most of the init happens here, for tenants it is done on the first
+     * packet of the tenant: see DetectEngineThreadCtxInitLazy() */
+    if (det_ctx->de_ctx->type == DETECT_ENGINE_TYPE_TENANT && !mt) {
+        det_ctx->init_pending = true;
+    } else if (det_ctx->de_ctx->type == DETECT_ENGINE_TYPE_NORMAL ||
         det_ctx->de_ctx->type == DETECT_ENGINE_TYPE_TENANT)
     {
         if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
@@ -2473,6 +2767,9 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_alerts_overflow = StatsRegisterCounter("detect.alert_queue_overflow", tv);
+    det_ctx->counter_budget_exceeded = StatsRegisterCounter("detect.inspection_budget_exceeded", tv);
+    det_ctx->counter_memuse = StatsRegisterCounter("detect.thread_memuse", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -2495,6 +2792,8 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
     return det_ctx;
 }
 
+static void ThreadCtxDoDeinit(DetectEngineThreadCtx *det_ctx);
+
 static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 {
 #if  DEBUG
@@ -2512,20 +2811,43 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         det_ctx->tenant_array = NULL;
     }
 
+    if (!det_ctx->init_pending)
+        ThreadCtxDoDeinit(det_ctx);
+
+    if (det_ctx->de_ctx != NULL) {
+#ifdef UNITTESTS
+        if (!RunmodeIsUnittests() || det_ctx->de_ctx->ref_cnt > 0)
+            DetectEngineDeReference(&det_ctx->de_ctx);
+#else
+        DetectEngineDeReference(&det_ctx->de_ctx);
+#endif
+    }
+
+    AppLayerDecoderEventsFreeEvents(&det_ctx->decoder_events);
+
+    SCFree(det_ctx);
+}
+
+/** \internal
+ *  \brief free what ThreadCtxDoInit() set up, also after a partial init
+ */
+static void ThreadCtxDoDeinit(DetectEngineThreadCtx *det_ctx)
+{
 #ifdef PROFILING
     SCProfilingRuleThreadCleanup(det_ctx);
     SCProfilingKeywordThreadCleanup(det_ctx);
     SCProfilingPrefilterThreadCleanup(det_ctx);
     SCProfilingSghThreadCleanup(det_ctx);
 #endif
+    if (det_ctx->de_ctx != NULL)
+        DetectRuleSampleThreadDeinit(det_ctx);
 
     DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
 
     /** \todo get rid of this static */
+    /* mtcs and mtcu share the ctx of mtc */
     if (det_ctx->de_ctx != NULL) {
-        PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
-        PatternMatchThreadDestroy(&det_ctx->mtcs, det_ctx->de_ctx->mpm_matcher);
-        PatternMatchThreadDestroy(&det_ctx->mtcu, det_ctx->de_ctx->mpm_matcher);
+        PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->mtc_matcher);
     }
 
     PmqFree(&det_ctx->pmq);
@@ -2536,12 +2858,20 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 
     if (det_ctx->non_pf_id_array != NULL)
         SCFree(det_ctx->non_pf_id_array);
+    if (det_ctx->non_pf_id_array_tmp != NULL)
+        SCFree(det_ctx->non_pf_id_array_tmp);
 
     if (det_ctx->match_array != NULL)
         SCFree(det_ctx->match_array);
 
     RuleMatchCandidateTxArrayFree(det_ctx);
 
+    if (det_ctx->alert_queue != NULL)
+        SCFree(det_ctx->alert_queue);
+
+    if (det_ctx->pf_sid_bitmap != NULL)
+        SCFree(det_ctx->pf_sid_bitmap);
+
     if (det_ctx->bj_values != NULL)
         SCFree(det_ctx->bj_values);
 
@@ -2576,17 +2906,7 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
     DetectEngineThreadCtxDeinitGlobalKeywords(det_ctx);
     if (det_ctx->de_ctx != NULL) {
         DetectEngineThreadCtxDeinitKeywords(det_ctx->de_ctx, det_ctx);
-#ifdef UNITTESTS
-        if (!RunmodeIsUnittests() || det_ctx->de_ctx->ref_cnt > 0)
-            DetectEngineDeReference(&det_ctx->de_ctx);
-#else
-        DetectEngineDeReference(&det_ctx->de_ctx);
-#endif
     }
-
-    AppLayerDecoderEventsFreeEvents(&det_ctx->decoder_events);
-
-    SCFree(det_ctx);
 }
 
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data)
@@ -2599,7 +2919,7 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data)
     }
 
     if (det_ctx->mt_det_ctxs_hash != NULL) {
-        HashTableFree(det_ctx->mt_det_ctxs_hash);
+        DetectTenantHashFree(det_ctx->mt_det_ctxs_hash, TenantIdFree);
         det_ctx->mt_det_ctxs_hash = NULL;
     }
     DetectEngineThreadCtxFree(det_ctx);
@@ -2610,8 +2930,8 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data)
 void DetectEngineThreadCtxInfo(ThreadVars *t, DetectEngineThreadCtx *det_ctx)
 {
     /* XXX */
-    PatternMatchThreadPrint(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
-    PatternMatchThreadPrint(&det_ctx->mtcu, det_ctx->de_ctx->mpm_matcher);
+    PatternMatchThreadPrint(&det_ctx->mtc, det_ctx->mtc_matcher);
+    PatternMatchThreadPrint(&det_ctx->mtcu, det_ctx->mtc_matcher);
 }
 
 /** \brief Register Thread keyword context Funcs
@@ -3147,6 +3467,62 @@ error:
     return 0;
 }
 
+static int DetectEngineMultiTenantSetupLoadVniMappings(const ConfNode *mappings_root_node,
+        bool failure_fatal)
+{
+    ConfNode *mapping_node = NULL;
+
+    int mapping_cnt = 0;
+    if (mappings_root_node != NULL) {
+        TAILQ_FOREACH(mapping_node, &mappings_root_node->head, next) {
+            ConfNode *tenant_id_node = ConfNodeLookupChild(mapping_node, "tenant-id");
+            if (tenant_id_node == NULL)
+                goto bad_mapping;
+            ConfNode *vni_node = ConfNodeLookupChild(mapping_node, "vni");
+            if (vni_node == NULL)
+                goto bad_mapping;
+
+            uint32_t tenant_id = 0;
+            if (ByteExtractStringUint32(&tenant_id, 10, strlen(tenant_id_node->val),
+                        tenant_id_node->val) == -1)
+            {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "tenant-id  "
+                        "of %s is invalid", tenant_id_node->val);
+                goto bad_mapping;
+            }
+
+            uint32_t vni = 0;
+            if (ByteExtractStringUint32(&vni, 10, strlen(vni_node->val),
+                        vni_node->val) == -1)
+            {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "vni  "
+                        "of %s is invalid", vni_node->val);
+                goto bad_mapping;
+            }
+            if (vni == 0 || vni > 0xffffff) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "vni  "
+                        "of %s is invalid. Valid range 1-16777215.", vni_node->val);
+                goto bad_mapping;
+            }
+
+            if (DetectEngineTentantRegisterVni(tenant_id, vni) != 0) {
+                goto error;
+            }
+            SCLogConfig("vni %u connected to tenant-id %u", vni, tenant_id);
+            mapping_cnt++;
+            continue;
+
+        bad_mapping:
+            if (failure_fatal)
+                goto error;
+        }
+    }
+    return mapping_cnt;
+
+error:
+    return 0;
+}
+
 /**
  *  \brief setup multi-detect / multi-tenancy
  *
@@ -3190,6 +3566,8 @@ int DetectEngineMultiTenantSetup(void)
                     goto error;
                 }
 
+            } else if (strcmp(handler, "vni") == 0) {
+                tenant_selector = master->tenant_selector = TENANT_SELECTOR_VNI;
             } else if (strcmp(handler, "direct") == 0) {
                 tenant_selector = master->tenant_selector = TENANT_SELECTOR_DIRECT;
             } else if (strcmp(handler, "device") == 0) {
@@ -3214,9 +3592,13 @@ int DetectEngineMultiTenantSetup(void)
         /* traffic -- tenant mappings */
         ConfNode *mappings_root_node = ConfGetNode("multi-detect.mappings");
 
-        if (tenant_selector == TENANT_SELECTOR_VLAN) {
-            int mapping_cnt = DetectEngineMultiTenantSetupLoadVlanMappings(mappings_root_node,
-                    failure_fatal);
+        if (tenant_selector == TENANT_SELECTOR_VLAN ||
+                tenant_selector == TENANT_SELECTOR_VNI) {
+            int mapping_cnt = (tenant_selector == TENANT_SELECTOR_VLAN) ?
+                DetectEngineMultiTenantSetupLoadVlanMappings(mappings_root_node,
+                        failure_fatal) :
+                DetectEngineMultiTenantSetupLoadVniMappings(mappings_root_node,
+                        failure_fatal);
             if (mapping_cnt == 0) {
                 /* no mappings are valid when we're in unix socket mode,
                  * they can be added on the fly. Otherwise warn/error
@@ -3333,6 +3715,28 @@ static uint32_t DetectEngineTentantGetIdFromVlanId(const void *ctx, const Packet
     return 0;
 }
 
+/** \internal
+ *  \brief the vni is set on the packets carried in a vxlan or geneve tunnel
+ *         by the decoder, so this is a lookup of the mapping like for vlans */
+static uint32_t DetectEngineTentantGetIdFromVni(const void *ctx, const Packet *p)
+{
+    const DetectEngineThreadCtx *det_ctx = ctx;
+    const uint32_t vni = p->vni;
+
+    if (vni == 0)
+        return 0;
+
+    if (det_ctx == NULL || det_ctx->tenant_array == NULL || det_ctx->tenant_array_size == 0)
+        return 0;
+
+    for (uint32_t x = 0; x < det_ctx->tenant_array_size; x++) {
+        if (det_ctx->tenant_array[x].traffic_id == vni)
+            return det_ctx->tenant_array[x].tenant_id;
+    }
+
+    return 0;
+}
+
 static uint32_t DetectEngineTentantGetIdFromLivedev(const void *ctx, const Packet *p)
 {
     const DetectEngineThreadCtx *det_ctx = ctx;
@@ -3437,6 +3841,16 @@ int DetectEngineTentantUnregisterVlanId(uint32_t tenant_id, uint16_t vlan_id)
     return DetectEngineTentantUnregisterSelector(TENANT_SELECTOR_VLAN, tenant_id, (uint32_t)vlan_id);
 }
 
+int DetectEngineTentantRegisterVni(uint32_t tenant_id, uint32_t vni)
+{
+    return DetectEngineTentantRegisterSelector(TENANT_SELECTOR_VNI, tenant_id, vni);
+}
+
+int DetectEngineTentantUnregisterVni(uint32_t tenant_id, uint32_t vni)
+{
+    return DetectEngineTentantUnregisterSelector(TENANT_SELECTOR_VNI, tenant_id, vni);
+}
+
 int DetectEngineTentantRegisterPcapFile(uint32_t tenant_id)
 {
     SCLogInfo("registering %u %d 0", TENANT_SELECTOR_DIRECT, tenant_id);
@@ -3603,6 +4017,41 @@ void DetectEnginePruneFreeList(void)
 
 static int reloads = 0;
 
+/**
+ *  \brief Check if reloads that don't change the yaml or the rule files
+ *         are skipped, detect.skip-unchanged-reload.
+ */
+bool DetectEngineReloadSkipUnchanged(void)
+{
+    int skip = 0;
+    if (ConfGetBool("detect.skip-unchanged-reload", &skip) != 1)
+        return false;
+    return skip != 0;
+}
+
+/** \internal
+ *  \brief Check if new_de_ctx would be identical to old_de_ctx
+ *
+ *  True if skipping unchanged reloads is enabled and neither the yaml,
+ *  new_de_ctx->conf_digest, nor the rule files changed since old_de_ctx
+ *  was loaded. An unknown digest counts as changed.
+ */
+static bool DetectEngineReloadIsUnchanged(const DetectEngineCtx *old_de_ctx,
+        DetectEngineCtx *new_de_ctx, const SCInstance *suri)
+{
+    if (!DetectEngineReloadSkipUnchanged() ||
+            old_de_ctx->type != DETECT_ENGINE_TYPE_NORMAL ||
+            old_de_ctx->conf_digest == 0 || old_de_ctx->sig_files_digest == 0 ||
+            old_de_ctx->conf_digest != new_de_ctx->conf_digest)
+        return false;
+
+    uint64_t sig_files_digest = 0;
+    if (SigFilesDigest(new_de_ctx, suri->sig_file,
+                suri->sig_file_exclusive, &sig_files_digest) != 0)
+        return false;
+    return sig_files_digest == old_de_ctx->sig_files_digest;
+}
+
 /** \brief Reload the detection engine
  *
  *  \param filename YAML file to load for the detect config
@@ -3617,10 +4066,13 @@ int DetectEngineReload(const SCInstance *suri)
 
     char prefix[128];
     memset(prefix, 0, sizeof(prefix));
+    uint64_t conf_digest = 0;
 
     SCLogNotice("rule reload starting");
 
     if (suri->conf_filename != NULL) {
+        if (DetectFileDigest(suri->conf_filename, &conf_digest) != 0)
+            conf_digest = 0;
         snprintf(prefix, sizeof(prefix), "detect-engine-reloads.%d", reloads++);
         if (ConfYamlLoadFileWithPrefix(suri->conf_filename, prefix) != 0) {
             SCLogError(SC_ERR_CONF_YAML_ERROR, "failed to load yaml %s",
@@ -3654,6 +4106,9 @@ int DetectEngineReload(const SCInstance *suri)
         return -1;
     }
 
+    /* so the new engine picks its fast patterns with the latest stats */
+    DetectFPStatsWrite(old_de_ctx);
+
     /* get new detection engine */
     new_de_ctx = DetectEngineCtxInitWithPrefix(prefix);
     if (new_de_ctx == NULL) {
@@ -3662,6 +4117,18 @@ int DetectEngineReload(const SCInstance *suri)
         DetectEngineDeReference(&old_de_ctx);
         return -1;
     }
+    new_de_ctx->conf_digest = conf_digest;
+
+    /* if neither the yaml nor the rule files changed, the new engine
+     * would be identical to the current one */
+    if (DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, suri)) {
+        DetectEngineCtxFree(new_de_ctx);
+        DetectEngineDeReference(&old_de_ctx);
+        SCLogNotice("rule reload skipped: configuration and rule files "
+                "unchanged");
+        return 0;
+    }
+
     if (SigLoadSignatures(new_de_ctx,
                           suri->sig_file, suri->sig_file_exclusive) != 0) {
         DetectEngineCtxFree(new_de_ctx);
@@ -3693,22 +4160,9 @@ int DetectEngineReload(const SCInstance *suri)
     return 0;
 }
 
-static uint32_t TenantIdHash(HashTable *h, void *data, uint16_t data_len)
+static void TenantIdFree(DetectEngineThreadCtx *det_ctx)
 {
-    DetectEngineThreadCtx *det_ctx = (DetectEngineThreadCtx *)data;
-    return det_ctx->tenant_id % h->array_size;
-}
-
-static char TenantIdCompare(void *d1, uint16_t d1_len, void *d2, uint16_t d2_len)
-{
-    DetectEngineThreadCtx *det1 = (DetectEngineThreadCtx *)d1;
-    DetectEngineThreadCtx *det2 = (DetectEngineThreadCtx *)d2;
-    return (det1->tenant_id == det2->tenant_id);
-}
-
-static void TenantIdFree(void *d)
-{
-    DetectEngineThreadCtxFree(d);
+    DetectEngineThreadCtxFree(det_ctx);
 }
 
 int DetectEngineMTApply(void)
@@ -4075,6 +4529,153 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test thread ctx memory: shared mpm thread ctx and lazy tenant init */
+static int DetectEngineTest10(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx,
+                "alert tcp any any -> any any (content:\"abc\"; sid:1;)"));
+    SigGroupBuild(de_ctx);
+
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+    FAIL_IF(det_ctx->init_pending);
+    FAIL_IF_NULL(det_ctx->match_array);
+    FAIL_IF(det_ctx->mtcs.ctx != det_ctx->mtc.ctx);
+    FAIL_IF(det_ctx->mtcu.ctx != det_ctx->mtc.ctx);
+    FAIL_IF(det_ctx->memuse <= sizeof(DetectEngineThreadCtx));
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+
+    /* tenant ctxs are set up on first use */
+    de_ctx->type = DETECT_ENGINE_TYPE_TENANT;
+    det_ctx = DetectEngineThreadCtxInitForReload(&tv, de_ctx, 0);
+    FAIL_IF_NULL(det_ctx);
+    FAIL_IF_NOT(det_ctx->init_pending);
+    FAIL_IF_NOT_NULL(det_ctx->match_array);
+    FAIL_IF(DetectEngineThreadCtxInitLazy(&tv, det_ctx) != TM_ECODE_OK);
+    FAIL_IF(det_ctx->init_pending);
+    FAIL_IF_NULL(det_ctx->match_array);
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+
+    de_ctx->type = DETECT_ENGINE_TYPE_NORMAL;
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test identical engines share their prepared mpm contexts */
+static int DetectEngineTest11(void)
+{
+    const char *sig = "alert tcp any any -> any any (content:\"abcdef\"; sid:1;)";
+
+    DetectEngineCtx *de_ctx1 = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx1);
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx1, sig));
+    SigGroupBuild(de_ctx1);
+
+    DetectEngineCtx *de_ctx2 = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx2);
+    FAIL_IF_NOT(de_ctx2->mpm_ctx_sharing);
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx2, sig));
+    SigGroupBuild(de_ctx2);
+
+    MpmStore *shared = NULL;
+    for (HashListTableBucket *htb = HashListTableGetListHead(de_ctx2->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb)) {
+        MpmStore *ms = HashListTableGetListData(htb);
+        if (ms->shared) {
+            shared = ms;
+            break;
+        }
+    }
+    FAIL_IF_NULL(shared);
+    FAIL_IF_NULL(shared->mpm_ctx);
+
+    bool found = false;
+    for (HashListTableBucket *htb = HashListTableGetListHead(de_ctx1->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb)) {
+        MpmStore *ms = HashListTableGetListData(htb);
+        if (ms->mpm_ctx == shared->mpm_ctx)
+            found = true;
+    }
+    FAIL_IF_NOT(found);
+
+    /* the context outlives the engine that built it */
+    DetectEngineCtxFree(de_ctx1);
+    FAIL_IF_NOT(shared->mpm_ctx->pattern_cnt == 1);
+
+    DetectEngineCtxFree(de_ctx2);
+    PASS;
+}
+
+/** \test a reload is skipped only while the yaml and the rule files
+ *        are unchanged */
+static int DetectEngineTest12(void)
+{
+    char filename[] = "/tmp/suricata-rules-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd < 0);
+    FILE *fp = fdopen(fd, "w");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "alert tcp any any -> any any (content:\"abc\"; sid:1;)\n");
+    fclose(fp);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF_NOT(ConfSetFinal("detect.skip-unchanged-reload", "yes"));
+
+    SCInstance suri;
+    memset(&suri, 0, sizeof(suri));
+    suri.sig_file = filename;
+    suri.sig_file_exclusive = TRUE;
+
+    DetectEngineCtx *old_de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(old_de_ctx);
+    old_de_ctx->conf_digest = 1;
+    FAIL_IF(SigFilesDigest(old_de_ctx, filename, TRUE,
+                &old_de_ctx->sig_files_digest) != 0);
+    FAIL_IF(old_de_ctx->sig_files_digest == 0);
+
+    DetectEngineCtx *new_de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(new_de_ctx);
+    new_de_ctx->conf_digest = 1;
+    FAIL_IF_NOT(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+
+    /* the yaml changed */
+    new_de_ctx->conf_digest = 2;
+    FAIL_IF(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+    new_de_ctx->conf_digest = 1;
+
+    /* the old engine's digest is unknown */
+    const uint64_t digest = old_de_ctx->sig_files_digest;
+    old_de_ctx->sig_files_digest = 0;
+    FAIL_IF(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+    old_de_ctx->sig_files_digest = digest;
+
+    /* a rule file changed */
+    fp = fopen(filename, "a");
+    FAIL_IF_NULL(fp);
+    fprintf(fp, "alert tcp any any -> any any (content:\"def\"; sid:2;)\n");
+    fclose(fp);
+    FAIL_IF(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+
+    /* a rule file went away */
+    unlink(filename);
+    FAIL_IF(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+
+    /* not enabled */
+    ConfRestoreContextBackup();
+    FAIL_IF(DetectEngineReloadIsUnchanged(old_de_ctx, new_de_ctx, &suri));
+
+    DetectEngineCtxFree(old_de_ctx);
+    DetectEngineCtxFree(new_de_ctx);
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -4086,6 +4687,9 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
+    UtRegisterTest("DetectEngineTest11", DetectEngineTest11);
+    UtRegisterTest("DetectEngineTest12", DetectEngineTest12);
 #endif
     return;
 }
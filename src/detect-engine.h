@@ -28,11 +28,17 @@
 #include "tm-threads.h"
 #include "flow-private.h"
 
+#define DetectTenantKey(det_ctx)    ((det_ctx)->tenant_id)
+#define DetectTenantCmp(a, b)       ((a) == (b))
+OPEN_HASH_GENERATE(DetectTenantHash, DetectEngineThreadCtx, uint32_t, OpenHashU32,
+        DetectTenantKey, DetectTenantCmp)
+
 void InspectionBufferInit(InspectionBuffer *buffer, uint32_t initial_size);
 void InspectionBufferSetup(InspectionBuffer *buffer, const uint8_t *data, const uint32_t data_len);
 void InspectionBufferFree(InspectionBuffer *buffer);
 void InspectionBufferCheckAndExpand(InspectionBuffer *buffer, uint32_t min_size);
 void InspectionBufferCopy(InspectionBuffer *buffer, uint8_t *buf, uint32_t buf_len);
+const uint8_t *InspectionBufferGetLowercase(InspectionBuffer *buffer);
 void InspectionBufferApplyTransforms(InspectionBuffer *buffer,
         const DetectEngineTransforms *transforms);
 void InspectionBufferClean(DetectEngineThreadCtx *det_ctx);
@@ -75,6 +81,7 @@ int DetectRegisterThreadCtxGlobalFuncs(const char *name,
 void *DetectThreadCtxGetGlobalKeywordThreadCtx(DetectEngineThreadCtx *det_ctx, int id);
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
+TmEcode DetectEngineThreadCtxInitLazy(ThreadVars *, DetectEngineThreadCtx *);
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *, void *);
 //inline uint32_t DetectEngineGetMaxSigId(DetectEngineCtx *);
 /* faster as a macro than a inline function on my box -- VJ */
@@ -93,6 +100,7 @@ int DetectEngineMoveToFreeList(DetectEngineCtx *de_ctx);
 DetectEngineCtx *DetectEngineReference(DetectEngineCtx *);
 void DetectEngineDeReference(DetectEngineCtx **de_ctx);
 int DetectEngineReload(const SCInstance *suri);
+bool DetectEngineReloadSkipUnchanged(void);
 int DetectEngineEnabled(void);
 int DetectEngineMTApply(void);
 int DetectEngineMultiTenantEnabled(void);
@@ -109,6 +117,8 @@ int DetectEngineReloadTenantBlocking(uint32_t tenant_id, const char *yaml, int r
 int DetectEngineTentantRegisterLivedev(uint32_t tenant_id, int device_id);
 int DetectEngineTentantRegisterVlanId(uint32_t tenant_id, uint16_t vlan_id);
 int DetectEngineTentantUnregisterVlanId(uint32_t tenant_id, uint16_t vlan_id);
+int DetectEngineTentantRegisterVni(uint32_t tenant_id, uint32_t vni);
+int DetectEngineTentantUnregisterVni(uint32_t tenant_id, uint32_t vni);
 int DetectEngineTentantRegisterPcapFile(uint32_t tenant_id);
 int DetectEngineTentantUnregisterPcapFile(uint32_t tenant_id);
 
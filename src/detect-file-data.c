@@ -34,6 +34,7 @@
 #include "detect-engine-mpm.h"
 #include "detect-engine-state.h"
 #include "detect-engine-prefilter.h"
+#include "detect-engine-offload.h"
 #include "detect-engine-content-inspection.h"
 #include "detect-file-data.h"
 
@@ -314,14 +315,30 @@ static InspectionBuffer *HttpServerBodyGetDataCallback(DetectEngineThreadCtx *de
         if (swf_file_type == FILE_SWF_ZLIB_COMPRESSION ||
             swf_file_type == FILE_SWF_LZMA_COMPRESSION)
         {
-            (void)FileSwfDecompression(data, data_len,
+            /* while the window starts at the start of the body, continue
+             * the decompression of the previous inspection */
+            if (offset == 0) {
+                (void)FileSwfDecompressionStream(&body->swf,
+                                       data, data_len,
                                        det_ctx,
                                        buffer,
                                        htp_state->cfg->swf_compression_type,
                                        htp_state->cfg->swf_decompress_depth,
                                        htp_state->cfg->swf_compress_depth);
+            } else {
+                (void)FileSwfDecompression(data, data_len,
+                                       det_ctx,
+                                       buffer,
+                                       htp_state->cfg->swf_compression_type,
+                                       htp_state->cfg->swf_decompress_depth,
+                                       htp_state->cfg->swf_compress_depth);
+            }
         }
     }
+    if (offset != 0 && body->swf != NULL) {
+        FileSwfDecompressionStreamFree(body->swf);
+        body->swf = NULL;
+    }
 
     /* move inspected tracker to end of the data. HtpBodyPrune will consider
      * the window sizes when freeing data */
@@ -502,8 +519,7 @@ static void PrefilterTxFiledata(DetectEngineThreadCtx *det_ctx,
                 continue;
 
             if (buffer->inspect_len >= mpm_ctx->minlen) {
-                (void)mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                        &det_ctx->mtcu, &det_ctx->pmq,
+                (void)DetectOffloadMpmSearch(det_ctx, mpm_ctx,
                         buffer->inspect, buffer->inspect_len);
             }
         }
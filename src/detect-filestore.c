@@ -211,7 +211,7 @@ static int DetectFilestorePostMatch(ThreadVars *t, DetectEngineThreadCtx *det_ct
 
     /* set filestore depth for stream reassembling */
     TcpSession *ssn = (TcpSession *)p->flow->protoctx;
-    TcpSessionSetReassemblyDepth(ssn, FileReassemblyDepth());
+    TcpSessionRequireReassemblyDepth(ssn, FileReassemblyDepth());
 
     if (p->flowflags & FLOW_PKT_TOCLIENT)
         flags |= STREAM_TOCLIENT;
@@ -34,6 +34,7 @@
 
 #include "flow.h"
 #include "flow-var.h"
+#include "flow-util.h"
 
 #include "detect-flow.h"
 
@@ -80,15 +81,21 @@ void DetectFlowRegister (void)
 /**
  * \param pflags packet flags (p->flags)
  * \param pflowflags packet flow flags (p->flowflags)
+ * \param fflags flow flags (p->flow->flags), 0 without flow
  * \param tflags detection flags (det_ctx->flags)
  * \param dflags detect flow flags
  * \param match_cnt number of matches to trigger
  */
 static inline int FlowMatch(const uint32_t pflags, const uint8_t pflowflags,
-    const uint16_t tflags, const uint16_t dflags, const uint8_t match_cnt)
+    const uint32_t fflags, const uint16_t tflags, const uint16_t dflags,
+    const uint8_t match_cnt)
 {
     uint8_t cnt = 0;
 
+    if ((dflags & DETECT_FLOW_FLAG_ENCRYPTED) && (fflags & FLOW_PAYLOAD_ENCRYPTED)) {
+        cnt++;
+    }
+
     if ((dflags & DETECT_FLOW_FLAG_NO_FRAG) &&
         (!(pflags & PKT_REBUILT_FRAGMENT))) {
         cnt++;
@@ -152,7 +159,9 @@ int DetectFlowMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
 
     const DetectFlowData *fd = (const DetectFlowData *)ctx;
 
-    const int ret = FlowMatch(p->flags, p->flowflags, det_ctx->flags, fd->flags, fd->match_cnt);
+    const uint32_t fflags = p->flow ? p->flow->flags : 0;
+    const int ret = FlowMatch(p->flags, p->flowflags, fflags, det_ctx->flags,
+            fd->flags, fd->match_cnt);
     SCLogDebug("returning %" PRId32 " fd->match_cnt %" PRId32 " fd->flags 0x%02X p->flowflags 0x%02X",
         ret, fd->match_cnt, fd->flags, p->flowflags);
     SCReturnInt(ret);
@@ -298,6 +307,12 @@ static DetectFlowData *DetectFlowParse (const char *flowstr)
                     goto error;
                 }
                 fd->flags |= DETECT_FLOW_FLAG_ONLY_FRAG;
+            } else if (strcasecmp(args[i], "encrypted") == 0) {
+                if (fd->flags & DETECT_FLOW_FLAG_ENCRYPTED) {
+                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set encrypted flag is already set");
+                    goto error;
+                }
+                fd->flags |= DETECT_FLOW_FLAG_ENCRYPTED;
             } else {
                 SCLogError(SC_ERR_INVALID_VALUE, "invalid flow option \"%s\"", args[i]);
                 goto error;
@@ -388,6 +403,9 @@ int DetectFlowSetup (DetectEngineCtx *de_ctx, Signature *s, const char *flowstr)
     if (fd->flags & DETECT_FLOW_FLAG_ONLYSTREAM) {
         s->flags |= SIG_FLAG_REQUIRE_STREAM;
     }
+    if (fd->flags & DETECT_FLOW_FLAG_ENCRYPTED) {
+        s->flags |= SIG_FLAG_ENCRYPTED;
+    }
     if (fd->flags & DETECT_FLOW_FLAG_NOSTREAM) {
         s->flags |= SIG_FLAG_REQUIRE_PACKET;
     } else if (fd->flags == DETECT_FLOW_FLAG_TOSERVER ||
@@ -432,7 +450,9 @@ PrefilterPacketFlowMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *
     if (PrefilterPacketHeaderExtraMatch(ctx, p) == FALSE)
         return;
 
-    if (FlowMatch(p->flags, p->flowflags, det_ctx->flags, ctx->v1.u8[0], ctx->v1.u8[1]))
+    const uint32_t fflags = p->flow ? p->flow->flags : 0;
+    if (FlowMatch(p->flags, p->flowflags, fflags, det_ctx->flags,
+                ctx->v1.u16[0], ctx->v1.u8[2]))
     {
         PrefilterAddSids(&det_ctx->pmq, ctx->sigs_array, ctx->sigs_cnt);
     }
@@ -442,16 +462,16 @@ static void
 PrefilterPacketFlowSet(PrefilterPacketHeaderValue *v, void *smctx)
 {
     const DetectFlowData *fb = smctx;
-    v->u8[0] = fb->flags;
-    v->u8[1] = fb->match_cnt;
+    v->u16[0] = fb->flags;
+    v->u8[2] = fb->match_cnt;
 }
 
 static _Bool
 PrefilterPacketFlowCompare(PrefilterPacketHeaderValue v, void *smctx)
 {
     const DetectFlowData *fb = smctx;
-    if (v.u8[0] == fb->flags &&
-        v.u8[1] == fb->match_cnt)
+    if (v.u16[0] == fb->flags &&
+        v.u8[2] == fb->match_cnt)
     {
         return TRUE;
     }
@@ -1040,9 +1060,9 @@ static int DetectFlowTestNoFragMatch(void)
     FAIL_IF_NULL(fd);
     FAIL_IF_NOT(fd->flags & DETECT_FLOW_FLAG_NO_FRAG);
     FAIL_IF_NOT(fd->match_cnt == 1);
-    FAIL_IF_NOT(FlowMatch(pflags, 0, 0, fd->flags, fd->match_cnt));
+    FAIL_IF_NOT(FlowMatch(pflags, 0, 0, 0, fd->flags, fd->match_cnt));
     pflags |= PKT_REBUILT_FRAGMENT;
-    FAIL_IF(FlowMatch(pflags, 0, 0, fd->flags, fd->match_cnt));
+    FAIL_IF(FlowMatch(pflags, 0, 0, 0, fd->flags, fd->match_cnt));
     PASS;
 }
 
@@ -1056,9 +1076,101 @@ static int DetectFlowTestOnlyFragMatch(void)
     FAIL_IF_NULL(fd);
     FAIL_IF_NOT(fd->flags & DETECT_FLOW_FLAG_ONLY_FRAG);
     FAIL_IF_NOT(fd->match_cnt == 1);
-    FAIL_IF(FlowMatch(pflags, 0, 0, fd->flags, fd->match_cnt));
+    FAIL_IF(FlowMatch(pflags, 0, 0, 0, fd->flags, fd->match_cnt));
     pflags |= PKT_REBUILT_FRAGMENT;
-    FAIL_IF_NOT(FlowMatch(pflags, 0, 0, fd->flags, fd->match_cnt));
+    FAIL_IF_NOT(FlowMatch(pflags, 0, 0, 0, fd->flags, fd->match_cnt));
+    PASS;
+}
+
+/**
+ * \test Test parsing and matching of the "encrypted" flow argument.
+ */
+static int DetectFlowTestEncryptedMatch(void)
+{
+    DetectFlowData *fd = DetectFlowParse("to_server, encrypted");
+    FAIL_IF_NULL(fd);
+    FAIL_IF_NOT(fd->flags & DETECT_FLOW_FLAG_ENCRYPTED);
+    FAIL_IF_NOT(fd->match_cnt == 2);
+    FAIL_IF(FlowMatch(0, FLOW_PKT_TOSERVER, 0, 0, fd->flags, fd->match_cnt));
+    FAIL_IF_NOT(FlowMatch(0, FLOW_PKT_TOSERVER, FLOW_PAYLOAD_ENCRYPTED, 0,
+                fd->flags, fd->match_cnt));
+    FAIL_IF(FlowMatch(0, FLOW_PKT_TOCLIENT, FLOW_PAYLOAD_ENCRYPTED, 0,
+                fd->flags, fd->match_cnt));
+    DetectFlowFree(fd);
+
+    fd = DetectFlowParse("encrypted,encrypted");
+    FAIL_IF_NOT_NULL(fd);
+    PASS;
+}
+
+/** \internal
+ *  \brief run the sigs on a packet of a flow with encrypted payload
+ *  \retval 1 if sid 1 alerted, 2 if sid 2 did, 3 for both, -1 on error */
+static int DetectFlowEncryptedSigRun(const char *sig1, const char *sig2)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    uint8_t *buf = (uint8_t *)"supernovaduper";
+    uint16_t buflen = strlen((char *)buf);
+    int result = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    FLOW_INITIALIZE(&f);
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4 | FLOW_PAYLOAD_ENCRYPTED;
+
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    if (p == NULL)
+        return -1;
+    p->flow = &f;
+    p->flags |= PKT_HAS_FLOW;
+    p->flowflags |= FLOW_PKT_TOSERVER | FLOW_PKT_ESTABLISHED;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        UTHFreePacket(p);
+        return -1;
+    }
+    de_ctx->flags |= DE_QUIET;
+
+    if (DetectEngineAppendSig(de_ctx, sig1) == NULL ||
+            (sig2 != NULL && DetectEngineAppendSig(de_ctx, sig2) == NULL)) {
+        result = -1;
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (PacketAlertCheck(p, 1))
+        result |= 1;
+    if (PacketAlertCheck(p, 2))
+        result |= 2;
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+end:
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePacket(p);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
+/**
+ * \test Test that the payload mpm is skipped on flows with encrypted
+ *       payload, unless a sig of the group opts in with flow:encrypted.
+ */
+static int DetectFlowSigTestEncrypted(void)
+{
+    const char *sig1 = "alert tcp any any -> any any (msg:\"dummy\"; "
+        "content:\"nova\"; flow:no_stream; sid:1;)";
+    const char *sig2 = "alert tcp any any -> any any (msg:\"dummy\"; "
+        "content:\"duper\"; flow:encrypted,no_stream; sid:2;)";
+
+    FAIL_IF_NOT(DetectFlowEncryptedSigRun(sig1, NULL) == 0);
+    FAIL_IF_NOT(DetectFlowEncryptedSigRun(sig1, sig2) == 3);
     PASS;
 }
 
@@ -1113,7 +1225,10 @@ void DetectFlowRegisterTests(void)
         DetectFlowTestParseNoFragOnlyFrag);
     UtRegisterTest("DetectFlowTestNoFragMatch", DetectFlowTestNoFragMatch);
     UtRegisterTest("DetectFlowTestOnlyFragMatch", DetectFlowTestOnlyFragMatch);
+    UtRegisterTest("DetectFlowTestEncryptedMatch",
+        DetectFlowTestEncryptedMatch);
 
     UtRegisterTest("DetectFlowSigTest01", DetectFlowSigTest01);
+    UtRegisterTest("DetectFlowSigTestEncrypted", DetectFlowSigTestEncrypted);
 #endif /* UNITTESTS */
 }
@@ -917,7 +917,7 @@ static int FlowBitsTestSig06(void)
     gv = p->flow->flowvar;
     FAIL_IF_NULL(gv);
     for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
+        if (gv->type == DETECT_FLOWBITS && FlowBitIsset(p->flow, idx)) {
                 result = 1;
         }
     }
@@ -993,7 +993,7 @@ static int FlowBitsTestSig07(void)
     FAIL_IF_NULL(gv);
 
     for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
+        if (gv->type == DETECT_FLOWBITS && FlowBitIsset(p->flow, idx)) {
                 result = 1;
         }
     }
@@ -1070,7 +1070,7 @@ static int FlowBitsTestSig08(void)
     FAIL_IF_NULL(gv);
 
     for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
+        if (gv->type == DETECT_FLOWBITS && FlowBitIsset(p->flow, idx)) {
                 result = 1;
         }
     }
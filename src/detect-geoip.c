@@ -59,7 +59,8 @@ void DetectGeoipRegister(void)
 
 #else /* HAVE_GEOIP */
 
-#include <GeoIP.h>
+#include "util-geoip.h"
+#include "suricata.h"
 
 static int DetectGeoipMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *,
                             const Signature *, const SigMatchCtx *);
@@ -80,34 +81,6 @@ void DetectGeoipRegister(void)
     sigmatch_table[DETECT_GEOIP].RegisterTests = DetectGeoipRegisterTests;
 }
 
-/**
- * \internal
- * \brief This function is used to initialize the geolocation MaxMind engine
- *
- * \retval NULL if the engine couldn't be initialized
- * \retval (GeoIP *) to the geolocation engine
- */
-static GeoIP *InitGeolocationEngine(void)
-{
-    return GeoIP_new(GEOIP_MEMORY_CACHE);
-}
-
-/**
- * \internal
- * \brief This function is used to geolocate the IP using the MaxMind libraries
- *
- * \param ip IP to geolocate (uint32_t ip)
- *
- * \retval NULL if it couldn't be geolocated
- * \retval ptr (const char *) to the country code string
- */
-static const char *GeolocateIPv4(GeoIP *geoengine, uint32_t ip)
-{
-    if (geoengine != NULL)
-        return GeoIP_country_code_by_ipnum(geoengine,  SCNtohl(ip));
-    return NULL;
-}
-
 /* Match-on conditions supported */
 #define GEOIP_MATCH_SRC_STR     "src"
 #define GEOIP_MATCH_DST_STR     "dst"
@@ -123,28 +96,31 @@ static const char *GeolocateIPv4(GeoIP *geoengine, uint32_t ip)
 
 /**
  * \internal
- * \brief This function is used to geolocate the IP using the MaxMind libraries
+ * \brief This function is used to match the country of the packet's
+ *        source or destination
+ *
+ * The country comes from the flow if the packet has one, so all the
+ * geoip rules share a single lookup per side of the flow.
  *
- * \param ip IP to geolocate (uint32_t ip)
+ * \param src true for the source, false for the destination
  *
  * \retval 0 no match
  * \retval 1 match
  */
-static int CheckGeoMatchIPv4(const DetectGeoipData *geoipdata, uint32_t ip)
+static int CheckGeoMatch(const DetectGeoipData *geoipdata, const Packet *p, const bool src)
 {
-    const char *country;
+    const GeoipCountry country = GeoipPacketCountry(p, src);
     int i;
-    country = GeolocateIPv4(geoipdata->geoengine, ip);
     /* Check if NOT NEGATED match-on condition */
     if ((geoipdata->flags & GEOIP_MATCH_NEGATED) == 0)
     {
         for (i = 0; i < geoipdata->nlocations; i++)
-            if (country != NULL && strcmp(country, (char *)geoipdata->location[i])==0)
+            if (country == geoipdata->country[i])
                 return 1;
     } else {
         /* Check if NEGATED match-on condition */
         for (i = 0; i < geoipdata->nlocations; i++)
-            if (country != NULL && strcmp(country, (char *)geoipdata->location[i])==0)
+            if (country == geoipdata->country[i])
                 return 0; /* if one matches, rule does NOT match (negated) */
         return 1; /* returns 1 if no location matches (negated) */
     }
@@ -172,11 +148,11 @@ static int DetectGeoipMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     if (PKT_IS_PSEUDOPKT(p))
         return 0;
 
-    if (PKT_IS_IPV4(p))
+    if (PKT_IS_IPV4(p) || PKT_IS_IPV6(p))
     {
         if (geoipdata->flags & ( GEOIP_MATCH_SRC_FLAG | GEOIP_MATCH_BOTH_FLAG ))
         {
-            if (CheckGeoMatchIPv4(geoipdata, GET_IPV4_SRC_ADDR_U32(p)))
+            if (CheckGeoMatch(geoipdata, p, true))
             {
                 if (geoipdata->flags & GEOIP_MATCH_BOTH_FLAG)
                     matches++;
@@ -186,7 +162,7 @@ static int DetectGeoipMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
         }
         if (geoipdata->flags & ( GEOIP_MATCH_DST_FLAG | GEOIP_MATCH_BOTH_FLAG ))
         {
-            if (CheckGeoMatchIPv4(geoipdata, GET_IPV4_DST_ADDR_U32(p)))
+            if (CheckGeoMatch(geoipdata, p, false))
             {
                 if (geoipdata->flags & GEOIP_MATCH_BOTH_FLAG)
                     matches++;
@@ -279,6 +255,9 @@ static DetectGeoipData *DetectGeoipDataParse (const char *str)
                 else
                     strlcpy((char *)geoipdata->location[geoipdata->nlocations], &str[prevpos],
                                                                                 pos-prevpos+1);
+                geoipdata->country[geoipdata->nlocations] = GEOIP_COUNTRY_CODE(
+                        geoipdata->location[geoipdata->nlocations][0],
+                        geoipdata->location[geoipdata->nlocations][1]);
 
                 if (geoipdata->nlocations < GEOOPTION_MAXLOCATIONS)
                     geoipdata->nlocations++;
@@ -298,11 +277,6 @@ static DetectGeoipData *DetectGeoipDataParse (const char *str)
         SCLogDebug("negated geoip");
     }
 
-    /* Initialize the geolocation engine */
-    geoipdata->geoengine = InitGeolocationEngine();
-    if (geoipdata->geoengine == NULL)
-        goto error;
-
     return geoipdata;
 
 error:
@@ -327,6 +301,13 @@ static int DetectGeoipSetup(DetectEngineCtx *de_ctx, Signature *s, const char *o
     DetectGeoipData *geoipdata = NULL;
     SigMatch *sm = NULL;
 
+    /* the rules are parsed without the database in the unittests */
+    if (!GeoipEnabled() && !RunmodeIsUnittests()) {
+        SCLogError(SC_ERR_GEOIP_ERROR, "geoip keyword needs the "
+                "geoip-database to be set");
+        goto error;
+    }
+
     geoipdata = DetectGeoipDataParse(optstr);
     if (geoipdata == NULL)
         goto error;
@@ -462,6 +443,12 @@ static int GeoipMatchTest(const char *rule, const char *srcip, const char *dstip
     DetectEngineThreadCtx *det_ctx;
     int result = 0;
 
+    /* the countries come from the geoip-database */
+    if (!GeoipEnabled()) {
+        SCLogInfo("no geoip-database loaded, skipping");
+        return 1;
+    }
+
     memset(&th_v, 0, sizeof(th_v));
 
     p1 = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, srcip, dstip);
@@ -26,17 +26,16 @@
 
 #ifdef HAVE_GEOIP
 
-#include <GeoIP.h>
-#include "util-spm-bm.h"
+#include "util-geoip.h"
 
 #define GEOOPTION_MAXSIZE 3 /* Country Code (2 chars) + NULL */
 #define GEOOPTION_MAXLOCATIONS 64
 
 typedef struct DetectGeoipData_ {
     uint8_t location[GEOOPTION_MAXLOCATIONS][GEOOPTION_MAXSIZE];  /** country code for now, null term.*/
+    GeoipCountry country[GEOOPTION_MAXLOCATIONS]; /** location as packed country code */
     int nlocations; /** number of location strings parsed */
     uint32_t flags;
-    GeoIP *geoengine;
 } DetectGeoipData;
 
 #endif
@@ -126,6 +126,8 @@ static int DetectHostbitMatchUnset (Packet *p, const DetectXbitsData *fd)
     switch (fd->tracker) {
         case DETECT_XBITS_TRACK_IPSRC:
             if (p->host_src == NULL) {
+                if (HostBitsMayHave(&p->src) == 0)
+                    return 1;
                 p->host_src = HostLookupHostFromHash(&p->src);
                 if (p->host_src == NULL)
                     return 1;
@@ -137,6 +139,8 @@ static int DetectHostbitMatchUnset (Packet *p, const DetectXbitsData *fd)
             break;
         case DETECT_XBITS_TRACK_IPDST:
             if (p->host_dst == NULL) {
+                if (HostBitsMayHave(&p->dst) == 0)
+                    return 1;
                 p->host_dst = HostLookupHostFromHash(&p->dst);
                 if (p->host_dst == NULL)
                     return 1;
@@ -185,6 +189,8 @@ static int DetectHostbitMatchIsset (Packet *p, const DetectXbitsData *fd)
     switch (fd->tracker) {
         case DETECT_XBITS_TRACK_IPSRC:
             if (p->host_src == NULL) {
+                if (HostBitsMayHave(&p->src) == 0)
+                    return 0;
                 p->host_src = HostLookupHostFromHash(&p->src);
                 if (p->host_src == NULL)
                     return 0;
@@ -196,6 +202,8 @@ static int DetectHostbitMatchIsset (Packet *p, const DetectXbitsData *fd)
             return r;
         case DETECT_XBITS_TRACK_IPDST:
             if (p->host_dst == NULL) {
+                if (HostBitsMayHave(&p->dst) == 0)
+                    return 0;
                 p->host_dst = HostLookupHostFromHash(&p->dst);
                 if (p->host_dst == NULL)
                     return 0;
@@ -215,6 +223,8 @@ static int DetectHostbitMatchIsnotset (Packet *p, const DetectXbitsData *fd)
     switch (fd->tracker) {
         case DETECT_XBITS_TRACK_IPSRC:
             if (p->host_src == NULL) {
+                if (HostBitsMayHave(&p->src) == 0)
+                    return 1;
                 p->host_src = HostLookupHostFromHash(&p->src);
                 if (p->host_src == NULL)
                     return 1;
@@ -226,6 +236,8 @@ static int DetectHostbitMatchIsnotset (Packet *p, const DetectXbitsData *fd)
             return r;
         case DETECT_XBITS_TRACK_IPDST:
             if (p->host_dst == NULL) {
+                if (HostBitsMayHave(&p->dst) == 0)
+                    return 1;
                 p->host_dst = HostLookupHostFromHash(&p->dst);
                 if (p->host_dst == NULL)
                     return 1;
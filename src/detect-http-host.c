@@ -57,6 +57,10 @@
 #include "app-layer-htp.h"
 #include "stream-tcp.h"
 #include "detect-http-host.h"
+#ifdef HAVE_RUST
+#include "app-layer-http2.h"
+#include "rust-http2-http2-gen.h"
+#endif
 
 static int DetectHttpHHSetup(DetectEngineCtx *, Signature *, const char *);
 #ifdef UNITTESTS
@@ -74,6 +78,14 @@ static int DetectHttpHostRawSetupSticky(DetectEngineCtx *de_ctx, Signature *s, c
 static InspectionBuffer *GetRawData(DetectEngineThreadCtx *det_ctx,
         const DetectEngineTransforms *transforms, Flow *_f,
         const uint8_t _flow_flags, void *txv, const int list_id);
+#ifdef HAVE_RUST
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+static InspectionBuffer *GetRawDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+#endif
 static int g_http_host_buffer_id = 0;
 
 /**
@@ -105,6 +117,15 @@ void DetectHttpHHRegister(void)
     DetectAppLayerMpmRegister2("http_host", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_REQUEST_HEADERS);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_host", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_host", SIG_FLAG_TOSERVER, 2,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
+    DetectAppLayerMpmSetBatchable("http_host");
 
     DetectBufferTypeRegisterValidateCallback("http_host",
             DetectHttpHostValidateCallback);
@@ -135,6 +156,15 @@ void DetectHttpHHRegister(void)
     DetectAppLayerMpmRegister2("http_raw_host", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetRawData, ALPROTO_HTTP,
             HTP_REQUEST_HEADERS);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_raw_host", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetRawDataHTTP2);
+    DetectAppLayerMpmRegister2("http_raw_host", SIG_FLAG_TOSERVER, 2,
+            PrefilterGenericMpmRegister, GetRawDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
+    DetectAppLayerMpmSetBatchable("http_raw_host");
 
     DetectBufferTypeSetDescriptionByName("http_raw_host",
             "http raw host header");
@@ -311,6 +341,50 @@ static InspectionBuffer *GetRawData(DetectEngineThreadCtx *det_ctx,
     return buffer;
 }
 
+#ifdef HAVE_RUST
+/** \internal
+ *  \brief HTTP/2 :authority, or the host header, lowercase */
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_host(txv, &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+
+/** \internal
+ *  \brief HTTP/2 :authority */
+static InspectionBuffer *GetRawDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_request_header(txv, ":authority", &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+#endif /* HAVE_RUST */
+
 /************************************Unittests*********************************/
 
 #ifdef UNITTESTS
@@ -57,6 +57,10 @@
 
 #include "app-layer-htp.h"
 #include "detect-http-method.h"
+#ifdef HAVE_RUST
+#include "app-layer-http2.h"
+#include "rust-http2-http2-gen.h"
+#endif
 #include "stream-tcp.h"
 
 static int g_http_method_buffer_id = 0;
@@ -70,6 +74,11 @@ static _Bool DetectHttpMethodValidateCallback(const Signature *s, const char **s
 static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
         const DetectEngineTransforms *transforms, Flow *_f,
         const uint8_t _flow_flags, void *txv, const int list_id);
+#ifdef HAVE_RUST
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+#endif
 
 /**
  * \brief Registration function for keyword: http_method
@@ -102,6 +111,15 @@ void DetectHttpMethodRegister(void)
     DetectAppLayerMpmRegister2("http_method", SIG_FLAG_TOSERVER, 4,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_REQUEST_LINE);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_method", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_method", SIG_FLAG_TOSERVER, 4,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
+    DetectAppLayerMpmSetBatchable("http_method");
 
     DetectBufferTypeSetDescriptionByName("http_method",
             "http request method");
@@ -208,6 +226,29 @@ static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
     return buffer;
 }
 
+#ifdef HAVE_RUST
+/** \internal
+ *  \brief HTTP/2 :method */
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_request_header(txv, ":method", &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+#endif /* HAVE_RUST */
+
 #ifdef UNITTESTS
 #include "tests/detect-http-method.c"
 #endif
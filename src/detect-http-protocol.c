@@ -134,6 +134,7 @@ void DetectHttpProtocolRegister(void)
     DetectAppLayerMpmRegister2(BUFFER_NAME, SIG_FLAG_TOCLIENT, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_RESPONSE_LINE);
+    DetectAppLayerMpmSetBatchable(BUFFER_NAME);
     DetectAppLayerInspectEngineRegister2(BUFFER_NAME, ALPROTO_HTTP,
             SIG_FLAG_TOSERVER, HTP_REQUEST_LINE,
             DetectEngineInspectBufferGeneric, GetData);
@@ -60,6 +60,10 @@
 
 #include "app-layer-htp.h"
 #include "detect-http-stat-code.h"
+#ifdef HAVE_RUST
+#include "app-layer-http2.h"
+#include "rust-http2-http2-gen.h"
+#endif
 #include "stream-tcp-private.h"
 #include "stream-tcp.h"
 
@@ -72,6 +76,11 @@ static int g_http_stat_code_buffer_id = 0;
 static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
         const DetectEngineTransforms *transforms, Flow *_f,
         const uint8_t _flow_flags, void *txv, const int list_id);
+#ifdef HAVE_RUST
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+#endif
 
 /**
  * \brief Registration function for keyword: http_stat_code
@@ -103,6 +112,15 @@ void DetectHttpStatCodeRegister (void)
     DetectAppLayerMpmRegister2("http_stat_code", SIG_FLAG_TOCLIENT, 4,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_RESPONSE_LINE);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_stat_code", ALPROTO_HTTP2,
+            SIG_FLAG_TOCLIENT, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_stat_code", SIG_FLAG_TOCLIENT, 4,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
+    DetectAppLayerMpmSetBatchable("http_stat_code");
 
     DetectBufferTypeSetDescriptionByName("http_stat_code",
             "http response status code");
@@ -168,6 +186,29 @@ static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
     return buffer;
 }
 
+#ifdef HAVE_RUST
+/** \internal
+ *  \brief HTTP/2 :status */
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_response_header(txv, ":status", &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+#endif /* HAVE_RUST */
+
 #ifdef UNITTESTS
 #include "tests/detect-http-stat-code.c"
 #endif /* UNITTESTS */
@@ -103,6 +103,7 @@ void DetectHttpStatMsgRegister (void)
     DetectAppLayerMpmRegister2("http_stat_msg", SIG_FLAG_TOCLIENT, 3,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_RESPONSE_LINE);
+    DetectAppLayerMpmSetBatchable("http_stat_msg");
 
     DetectBufferTypeSetDescriptionByName("http_stat_msg",
             "http response status message");
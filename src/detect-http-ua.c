@@ -58,6 +58,10 @@
 #include "app-layer-htp.h"
 #include "stream-tcp.h"
 #include "detect-http-ua.h"
+#ifdef HAVE_RUST
+#include "app-layer-http2.h"
+#include "rust-http2-http2-gen.h"
+#endif
 
 static int DetectHttpUASetup(DetectEngineCtx *, Signature *, const char *);
 #ifdef UNITTESTS
@@ -69,6 +73,11 @@ static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
         const DetectEngineTransforms *transforms,
         Flow *_f, const uint8_t _flow_flags,
         void *txv, const int list_id);
+#ifdef HAVE_RUST
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+#endif
 
 /**
  * \brief Registers the keyword handlers for the "http_user_agent" keyword.
@@ -102,6 +111,15 @@ void DetectHttpUARegister(void)
     DetectAppLayerMpmRegister2("http_user_agent", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_REQUEST_HEADERS);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_user_agent", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_user_agent", SIG_FLAG_TOSERVER, 2,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
+    DetectAppLayerMpmSetBatchable("http_user_agent");
 
     DetectBufferTypeSetDescriptionByName("http_user_agent",
             "http user agent");
@@ -176,6 +194,29 @@ static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
     return buffer;
 }
 
+#ifdef HAVE_RUST
+/** \internal
+ *  \brief HTTP/2 user-agent header */
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_request_header(txv, "user-agent", &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+#endif /* HAVE_RUST */
+
 #ifdef UNITTESTS
 #include "tests/detect-http-user-agent.c"
 #endif /* UNITTESTS */
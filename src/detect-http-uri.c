@@ -55,6 +55,10 @@
 
 #include "app-layer-htp.h"
 #include "detect-http-uri.h"
+#ifdef HAVE_RUST
+#include "app-layer-http2.h"
+#include "rust-http2-http2-gen.h"
+#endif
 #include "detect-uricontent.h"
 #include "stream-tcp.h"
 
@@ -77,6 +81,11 @@ static InspectionBuffer *GetRawData(DetectEngineThreadCtx *det_ctx,
         const DetectEngineTransforms *transforms,
         Flow *_f, const uint8_t _flow_flags,
         void *txv, const int list_id);
+#ifdef HAVE_RUST
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id);
+#endif
 static int DetectHttpRawUriSetupSticky(DetectEngineCtx *de_ctx, Signature *s, const char *str);
 
 static int g_http_raw_uri_buffer_id = 0;
@@ -113,6 +122,14 @@ void DetectHttpUriRegister (void)
     DetectAppLayerMpmRegister2("http_uri", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_HTTP,
             HTP_REQUEST_LINE);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_uri", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_uri", SIG_FLAG_TOSERVER, 2,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
 
     DetectBufferTypeSetDescriptionByName("http_uri",
             "http request uri");
@@ -147,6 +164,14 @@ void DetectHttpUriRegister (void)
     DetectAppLayerMpmRegister2("http_raw_uri", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetRawData, ALPROTO_HTTP,
             HTP_REQUEST_LINE);
+#ifdef HAVE_RUST
+    DetectAppLayerInspectEngineRegister2("http_raw_uri", ALPROTO_HTTP2,
+            SIG_FLAG_TOSERVER, HTTP2_STATE_HEADERS,
+            DetectEngineInspectBufferGeneric, GetDataHTTP2);
+    DetectAppLayerMpmRegister2("http_raw_uri", SIG_FLAG_TOSERVER, 2,
+            PrefilterGenericMpmRegister, GetDataHTTP2, ALPROTO_HTTP2,
+            HTTP2_STATE_HEADERS);
+#endif
 
     DetectBufferTypeSetDescriptionByName("http_raw_uri",
             "raw http uri");
@@ -301,6 +326,29 @@ static InspectionBuffer *GetRawData(DetectEngineThreadCtx *det_ctx,
     return buffer;
 }
 
+#ifdef HAVE_RUST
+/** \internal
+ *  \brief HTTP/2 :path, as is as HTTP/2 has no normalizer */
+static InspectionBuffer *GetDataHTTP2(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Flow *_f,
+        const uint8_t _flow_flags, void *txv, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+
+        if (rs_http2_tx_get_request_header(txv, ":path", &data, &data_len) == 0)
+            return NULL;
+
+        InspectionBufferSetup(buffer, data, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+#endif /* HAVE_RUST */
+
 #ifdef UNITTESTS /* UNITTESTS */
 #include "tests/detect-http-uri.c"
 #endif /* UNITTESTS */
@@ -46,7 +46,6 @@
 #include "util-fmemopen.h"
 
 #include "reputation.h"
-#include "host.h"
 
 #define PARSE_REGEX         "\\s*(any|src|dst|both)\\s*,\\s*([A-Za-z0-9\\-\\_]+)\\s*,\\s*(\\<|\\>|\\=)\\s*,\\s*([0-9]+)\\s*"
 static pcre *parse_regex;
@@ -71,83 +70,14 @@ void DetectIPRepRegister (void)
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
-static uint8_t GetHostRepSrc(Packet *p, uint8_t cat, uint32_t version)
+static void *DetectIPRepThreadInit(void *data)
 {
-    uint8_t val = 0;
-    Host *h = NULL;
-
-    if (p->flags & PKT_HOST_SRC_LOOKED_UP && p->host_src == NULL) {
-        return 0;
-    } else if (p->host_src != NULL) {
-        h = (Host *)p->host_src;
-        HostLock(h);
-    } else {
-        h = HostLookupHostFromHash(&(p->src));
-
-        p->flags |= PKT_HOST_SRC_LOOKED_UP;
-
-        if (h == NULL)
-            return 0;
-
-        HostReference(&p->host_src, h);
-    }
-
-    if (h->iprep == NULL) {
-        HostRelease(h);
-        return 0;
-    }
-
-    SReputation *r = (SReputation *)h->iprep;
-
-    /* allow higher versions as this happens during
-     * rule reload */
-    if (r->version >= version)
-        val = r->rep[cat];
-    else
-        SCLogDebug("version mismatch %u != %u", r->version, version);
-
-    HostRelease(h);
-    return val;
+    return SRepReaderRegister();
 }
 
-static uint8_t GetHostRepDst(Packet *p, uint8_t cat, uint32_t version)
+static void DetectIPRepThreadFree(void *ctx)
 {
-    uint8_t val = 0;
-    Host *h = NULL;
-
-    if (p->flags & PKT_HOST_DST_LOOKED_UP && p->host_dst == NULL) {
-        return 0;
-    } else if (p->host_dst != NULL) {
-        h = (Host *)p->host_dst;
-        HostLock(h);
-    } else {
-        h = HostLookupHostFromHash(&(p->dst));
-
-        p->flags |= PKT_HOST_DST_LOOKED_UP;
-
-        if (h == NULL) {
-            return 0;
-        }
-
-        HostReference(&p->host_dst, h);
-    }
-
-    if (h->iprep == NULL) {
-        HostRelease(h);
-        return 0;
-    }
-
-    SReputation *r = (SReputation *)h->iprep;
-
-    /* allow higher versions as this happens during
-     * rule reload */
-    if (r->version >= version)
-        val = r->rep[cat];
-    else
-        SCLogDebug("version mismatch %u != %u", r->version, version);
-
-    HostRelease(h);
-    return val;
+    SRepReaderDeregister((SRepReader *)ctx);
 }
 
 static inline int RepMatch(uint8_t op, uint8_t val1, uint8_t val2)
@@ -174,63 +104,57 @@ static int DetectIPRepMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Pack
     if (rd == NULL)
         return 0;
 
-    uint32_t version = det_ctx->de_ctx->srep_version;
+    SRepReader *reader = DetectThreadCtxGetKeywordThreadCtx(det_ctx, rd->thread_ctx_id);
+    if (reader == NULL)
+        return 0;
+
+    const SRepCIDRTree *cidr_ctx = SRepReadBegin(reader);
+    int ret = 0;
     uint8_t val = 0;
 
     SCLogDebug("rd->cmd %u", rd->cmd);
     switch(rd->cmd) {
         case DETECT_IPREP_CMD_ANY:
-            val = GetHostRepSrc(p, rd->cat, version);
-            if (val == 0)
-                val = SRepCIDRGetIPRepSrc(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
-            if (val > 0) {
-                if (RepMatch(rd->op, val, rd->val) == 1)
-                    return 1;
+            val = SRepCIDRGetIPRepSrc(cidr_ctx, p, rd->cat);
+            if (val > 0 && RepMatch(rd->op, val, rd->val) == 1) {
+                ret = 1;
+                break;
             }
-            val = GetHostRepDst(p, rd->cat, version);
-            if (val == 0)
-                val = SRepCIDRGetIPRepDst(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
+            val = SRepCIDRGetIPRepDst(cidr_ctx, p, rd->cat);
             if (val > 0) {
-                return RepMatch(rd->op, val, rd->val);
+                ret = RepMatch(rd->op, val, rd->val);
             }
             break;
 
         case DETECT_IPREP_CMD_SRC:
-            val = GetHostRepSrc(p, rd->cat, version);
+            val = SRepCIDRGetIPRepSrc(cidr_ctx, p, rd->cat);
             SCLogDebug("checking src -- val %u (looking for cat %u, val %u)", val, rd->cat, rd->val);
-            if (val == 0)
-                val = SRepCIDRGetIPRepSrc(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
             if (val > 0) {
-                return RepMatch(rd->op, val, rd->val);
+                ret = RepMatch(rd->op, val, rd->val);
             }
             break;
 
         case DETECT_IPREP_CMD_DST:
             SCLogDebug("checking dst");
-            val = GetHostRepDst(p, rd->cat, version);
-            if (val == 0)
-                val = SRepCIDRGetIPRepDst(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
+            val = SRepCIDRGetIPRepDst(cidr_ctx, p, rd->cat);
             if (val > 0) {
-                return RepMatch(rd->op, val, rd->val);
+                ret = RepMatch(rd->op, val, rd->val);
             }
             break;
 
         case DETECT_IPREP_CMD_BOTH:
-            val = GetHostRepSrc(p, rd->cat, version);
-            if (val == 0)
-                val = SRepCIDRGetIPRepSrc(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
+            val = SRepCIDRGetIPRepSrc(cidr_ctx, p, rd->cat);
             if (val == 0 || RepMatch(rd->op, val, rd->val) == 0)
-                return 0;
-            val = GetHostRepDst(p, rd->cat, version);
-            if (val == 0)
-                val = SRepCIDRGetIPRepDst(det_ctx->de_ctx->srepCIDR_ctx, p, rd->cat, version);
+                break;
+            val = SRepCIDRGetIPRepDst(cidr_ctx, p, rd->cat);
             if (val > 0) {
-                return RepMatch(rd->op, val, rd->val);
+                ret = RepMatch(rd->op, val, rd->val);
             }
             break;
     }
 
-    return 0;
+    SRepReadEnd(reader);
+    return ret;
 }
 
 int DetectIPRepSetup (DetectEngineCtx *de_ctx, Signature *s, const char *rawstr)
@@ -335,6 +259,12 @@ int DetectIPRepSetup (DetectEngineCtx *de_ctx, Signature *s, const char *rawstr)
     cd->cat = cat;
     cd->op = op;
     cd->val = val;
+
+    /* the readers of the reputation store, one per detect thread */
+    cd->thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "iprep",
+            DetectIPRepThreadInit, NULL, DetectIPRepThreadFree, 1);
+    if (cd->thread_ctx_id == -1)
+        goto error;
     SCLogDebug("cmd %u, cat %u, op %u, val %u", cd->cmd, cd->cat, cd->op, cd->val);
 
     pcre_free_substring(name);
@@ -448,7 +378,6 @@ static int DetectIPRepTest01(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -458,7 +387,6 @@ static int DetectIPRepTest01(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -467,7 +395,7 @@ static int DetectIPRepTest01(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -496,7 +424,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result;
 }
 
@@ -510,7 +438,6 @@ static int DetectIPRepTest02(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -520,7 +447,6 @@ static int DetectIPRepTest02(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -529,7 +455,7 @@ static int DetectIPRepTest02(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -558,7 +484,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result;
 }
 
@@ -572,7 +498,6 @@ static int DetectIPRepTest03(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -582,7 +507,6 @@ static int DetectIPRepTest03(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -591,7 +515,7 @@ static int DetectIPRepTest03(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -620,7 +544,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result;
 }
 
@@ -634,7 +558,6 @@ static int DetectIPRepTest04(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -645,7 +568,6 @@ static int DetectIPRepTest04(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -654,7 +576,7 @@ static int DetectIPRepTest04(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -683,7 +605,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result;
 }
 
@@ -697,7 +619,6 @@ static int DetectIPRepTest05(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -707,7 +628,6 @@ static int DetectIPRepTest05(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -716,7 +636,7 @@ static int DetectIPRepTest05(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -745,7 +665,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result == 0;
 }
 
@@ -759,7 +679,6 @@ static int DetectIPRepTest06(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -769,7 +688,6 @@ static int DetectIPRepTest06(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -778,7 +696,7 @@ static int DetectIPRepTest06(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -807,7 +725,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result == 0;
 }
 
@@ -821,7 +739,6 @@ static int DetectIPRepTest07(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -831,7 +748,6 @@ static int DetectIPRepTest07(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -840,7 +756,7 @@ static int DetectIPRepTest07(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -869,7 +785,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result == 0;
 }
 
@@ -883,7 +799,6 @@ static int DetectIPRepTest08(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -894,7 +809,6 @@ static int DetectIPRepTest08(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy();
     r = SRepLoadCatFileFromFD(fd);
@@ -903,7 +817,7 @@ static int DetectIPRepTest08(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -932,7 +846,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result == 0;
 }
 
@@ -946,7 +860,6 @@ static int DetectIPRepTest09(void)
     Packet *p = UTHBuildPacket((uint8_t *)"lalala", 6, IPPROTO_TCP);
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
 
-    HostInitConfig(HOST_QUIET);
     memset(&th_v, 0, sizeof(th_v));
 
     if (de_ctx == NULL || p == NULL)
@@ -957,7 +870,6 @@ static int DetectIPRepTest09(void)
     de_ctx->flags |= DE_QUIET;
 
     SRepInit(de_ctx);
-    SRepResetVersion();
 
     fd = DetectIPRepGenerateCategoriesDummy2();
     r = SRepLoadCatFileFromFD(fd);
@@ -966,7 +878,7 @@ static int DetectIPRepTest09(void)
     }
 
     fd = DetectIPRepGenerateNetworksDummy2();
-    r = SRepLoadFileFromFD(de_ctx->srepCIDR_ctx, fd);
+    r = SRepLoadFileFromFD(fd);
     if (r < 0) {
         goto end;
     }
@@ -995,7 +907,7 @@ end:
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    HostShutdown();
+    SRepDestroy();
     return result;
 }
 #endif /* UNITTESTS */
@@ -38,6 +38,7 @@ typedef struct DetectIPRepData_ {
     int8_t cat;
     int8_t op;
     uint8_t val;
+    int thread_ctx_id;
 } DetectIPRepData;
 
 /* prototypes */
@@ -50,6 +50,7 @@
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "app-layer-htp.h"
+#include "app-layer-dnp3.h"
 
 #include "stream-tcp.h"
 
@@ -213,6 +214,30 @@ void LuaDumpStack(lua_State *state)
 }
 #endif
 
+/** \internal
+ *  \brief add a buffer to the args table at the top of the stack
+ *
+ *  Scripts that asked for ffi get a pointer to the buffer, and its length
+ *  in \a len_name, instead of a copy in a lua string. The pointer is only
+ *  valid during the match call. */
+static void DetectLuaPushBuffer(lua_State *luastate, const DetectLuaData *ld,
+        const char *name, const char *len_name, const uint8_t *buf, uint32_t buf_len)
+{
+    lua_pushstring(luastate, name); /* stack at -2 */
+#ifdef HAVE_LUAJIT
+    if (ld->ffi) {
+        lua_pushlightuserdata(luastate, (void *)buf);
+        lua_settable(luastate, -3);
+        lua_pushstring(luastate, len_name);
+        lua_pushinteger(luastate, (lua_Integer)buf_len);
+        lua_settable(luastate, -3);
+        return;
+    }
+#endif
+    LuaPushStringBuffer(luastate, buf, (size_t)buf_len); /* stack at -3 */
+    lua_settable(luastate, -3);
+}
+
 int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx,
         const Signature *s, const SigMatchData *smd,
         uint8_t *buffer, uint32_t buffer_len, uint32_t offset,
@@ -243,9 +268,8 @@ int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx,
     lua_pushnumber (tlua->luastate, (int)(offset + 1));
     lua_settable(tlua->luastate, -3);
 
-    lua_pushstring (tlua->luastate, lua->buffername); /* stack at -2 */
-    LuaPushStringBuffer(tlua->luastate, (const uint8_t *)buffer, (size_t)buffer_len);
-    lua_settable(tlua->luastate, -3);
+    DetectLuaPushBuffer(tlua->luastate, lua, lua->buffername, lua->buffername_len,
+            (const uint8_t *)buffer, buffer_len);
 
     int retval = lua_pcall(tlua->luastate, 1, 1, 0);
     if (retval != 0) {
@@ -361,14 +385,12 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
     lua_newtable(tlua->luastate); /* stack at -1 */
 
     if ((tlua->flags & DATATYPE_PAYLOAD) && p->payload_len) {
-        lua_pushliteral(tlua->luastate, "payload"); /* stack at -2 */
-        LuaPushStringBuffer (tlua->luastate, (const uint8_t *)p->payload, (size_t)p->payload_len); /* stack at -3 */
-        lua_settable(tlua->luastate, -3);
+        DetectLuaPushBuffer(tlua->luastate, lua, "payload", "payload.len",
+                (const uint8_t *)p->payload, p->payload_len);
     }
     if ((tlua->flags & DATATYPE_PACKET) && GET_PKT_LEN(p)) {
-        lua_pushliteral(tlua->luastate, "packet"); /* stack at -2 */
-        LuaPushStringBuffer (tlua->luastate, (const uint8_t *)GET_PKT_DATA(p), (size_t)GET_PKT_LEN(p)); /* stack at -3 */
-        lua_settable(tlua->luastate, -3);
+        DetectLuaPushBuffer(tlua->luastate, lua, "packet", "packet.len",
+                (const uint8_t *)GET_PKT_DATA(p), GET_PKT_LEN(p));
     }
     if (tlua->alproto == ALPROTO_HTTP) {
         HtpState *htp_state = p->flow->alstate;
@@ -384,11 +406,10 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
 
                 if ((tlua->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
-                    lua_pushliteral(tlua->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tlua->luastate,
-                                     (const uint8_t *)bstr_ptr(tx->request_line),
-                                     bstr_len(tx->request_line));
-                    lua_settable(tlua->luastate, -3);
+                    DetectLuaPushBuffer(tlua->luastate, lua, "http.request_line",
+                            "http.request_line.len",
+                            (const uint8_t *)bstr_ptr(tx->request_line),
+                            bstr_len(tx->request_line));
                 }
             }
         }
@@ -486,11 +507,10 @@ static int DetectLuaAppMatchCommon (ThreadVars *t, DetectEngineThreadCtx *det_ct
             if (tx != NULL) {
                 if ((tlua->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
-                    lua_pushliteral(tlua->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tlua->luastate,
-                                     (const uint8_t *)bstr_ptr(tx->request_line),
-                                     bstr_len(tx->request_line));
-                    lua_settable(tlua->luastate, -3);
+                    DetectLuaPushBuffer(tlua->luastate, lua, "http.request_line",
+                            "http.request_line.len",
+                            (const uint8_t *)bstr_ptr(tx->request_line),
+                            bstr_len(tx->request_line));
                 }
             }
         }
@@ -578,9 +598,175 @@ static int DetectLuaAppTxMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx,
 static const char *ut_script = NULL;
 #endif
 
-static void *DetectLuaThreadInit(void *data)
+/* Scripts are compiled once when the rules are loaded and kept as bytecode
+ * the thread states load, instead of each thread parsing the file again.
+ * The bytecode is kept in a global list, so that a rule reload or another
+ * tenant using an unchanged script file gets it without compiling. */
+
+typedef struct DetectLuaScript_ {
+    char *filename;
+    time_t mtime;
+    off_t size;
+    char *bytecode;
+    size_t bytecode_len;
+    /** number of lua keywords using the script, over all engines */
+    uint32_t refcnt;
+    struct DetectLuaScript_ *next;
+} DetectLuaScript;
+
+static SCMutex g_lua_scripts_lock = SCMUTEX_INITIALIZER;
+static DetectLuaScript *g_lua_scripts = NULL;
+
+static int DetectLuaScriptWriter(lua_State *luastate, const void *p, size_t sz, void *ud)
 {
+    DetectLuaScript *ls = (DetectLuaScript *)ud;
+    char *ptr = SCRealloc(ls->bytecode, ls->bytecode_len + sz);
+    if (unlikely(ptr == NULL))
+        return 1;
+    memcpy(ptr + ls->bytecode_len, p, sz);
+    ls->bytecode = ptr;
+    ls->bytecode_len += sz;
+    return 0;
+}
+
+/** \internal
+ *  \brief compile the script file (or the unittest script) to bytecode */
+static int DetectLuaScriptCompile(DetectLuaScript *ls)
+{
+    lua_State *luastate = luaL_newstate();
+    if (luastate == NULL)
+        return -1;
+
     int status;
+#ifdef UNITTESTS
+    if (ut_script != NULL)
+        status = luaL_loadbuffer(luastate, ut_script, strlen(ut_script), "unittest");
+    else
+#endif
+        status = luaL_loadfile(luastate, ls->filename);
+    if (status) {
+        SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(luastate, -1));
+        lua_close(luastate);
+        return -1;
+    }
+    if (lua_dump(luastate, DetectLuaScriptWriter, ls) != 0 || ls->bytecode_len == 0) {
+        SCLogError(SC_ERR_LUA_ERROR, "couldn't compile file %s", ls->filename);
+        lua_close(luastate);
+        return -1;
+    }
+    lua_close(luastate);
+    return 0;
+}
+
+static void DetectLuaScriptFree(DetectLuaScript *ls)
+{
+    if (ls->bytecode != NULL)
+        SCFree(ls->bytecode);
+    if (ls->filename != NULL)
+        SCFree(ls->filename);
+    SCFree(ls);
+}
+
+/** \internal
+ *  \brief get the compiled script for a file, compiling it if it is not
+ *         in the list or if the file changed since it was compiled */
+static DetectLuaScript *DetectLuaScriptGet(const char *filename)
+{
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+#ifdef UNITTESTS
+    if (ut_script == NULL)
+#endif
+    {
+        if (stat(filename, &st) != 0) {
+            SCLogError(SC_ERR_LUA_ERROR, "couldn't load file %s: %s",
+                    filename, strerror(errno));
+            return NULL;
+        }
+    }
+
+    SCMutexLock(&g_lua_scripts_lock);
+#ifdef UNITTESTS
+    if (ut_script == NULL)
+#endif
+    {
+        for (DetectLuaScript *ls = g_lua_scripts; ls != NULL; ls = ls->next) {
+            if (ls->mtime == st.st_mtime && ls->size == st.st_size &&
+                    strcmp(ls->filename, filename) == 0) {
+                ls->refcnt++;
+                SCMutexUnlock(&g_lua_scripts_lock);
+                SCLogDebug("using cached bytecode for %s", filename);
+                return ls;
+            }
+        }
+    }
+
+    DetectLuaScript *ls = SCCalloc(1, sizeof(*ls));
+    if (unlikely(ls == NULL))
+        goto error;
+    ls->filename = SCStrdup(filename);
+    if (ls->filename == NULL)
+        goto error;
+    ls->mtime = st.st_mtime;
+    ls->size = st.st_size;
+    if (DetectLuaScriptCompile(ls) != 0)
+        goto error;
+    ls->refcnt = 1;
+    /* unittest scripts are not tied to the file, so they are not shared */
+#ifdef UNITTESTS
+    if (ut_script == NULL)
+#endif
+    {
+        ls->next = g_lua_scripts;
+        g_lua_scripts = ls;
+    }
+    SCMutexUnlock(&g_lua_scripts_lock);
+    return ls;
+
+error:
+    SCMutexUnlock(&g_lua_scripts_lock);
+    if (ls != NULL)
+        DetectLuaScriptFree(ls);
+    return NULL;
+}
+
+static void DetectLuaScriptRelease(DetectLuaScript *ls)
+{
+    SCMutexLock(&g_lua_scripts_lock);
+    if (--ls->refcnt > 0) {
+        SCMutexUnlock(&g_lua_scripts_lock);
+        return;
+    }
+    DetectLuaScript **pls = &g_lua_scripts;
+    while (*pls != NULL && *pls != ls)
+        pls = &(*pls)->next;
+    if (*pls == ls)
+        *pls = ls->next;
+    SCMutexUnlock(&g_lua_scripts_lock);
+
+    DetectLuaScriptFree(ls);
+}
+
+/** \internal
+ *  \brief load the compiled script of the keyword into a state and run
+ *         its main chunk, so that its functions are defined */
+static int DetectLuaLoadScript(lua_State *luastate, const DetectLuaData *ld)
+{
+    const DetectLuaScript *ls = ld->script;
+    if (luaL_loadbuffer(luastate, ls->bytecode, ls->bytecode_len, ls->filename) != 0) {
+        SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(luastate, -1));
+        return -1;
+    }
+    /* prime the script (or something) */
+    if (lua_pcall(luastate, 0, 0, 0) != 0) {
+        SCLogError(SC_ERR_LUA_ERROR, "couldn't prime file: %s", lua_tostring(luastate, -1));
+        return -1;
+    }
+    return 0;
+}
+
+static void *DetectLuaThreadInit(void *data)
+{
     DetectLuaData *lua = (DetectLuaData *)data;
     BUG_ON(lua == NULL);
 
@@ -611,30 +797,8 @@ static void *DetectLuaThreadInit(void *data)
     lua_pushinteger(t->luastate, (lua_Integer)(lua->gid));
     lua_setglobal(t->luastate, "SCRuleGid");
 
-    /* hackish, needed to allow unittests to pass buffers as scripts instead of files */
-#ifdef UNITTESTS
-    if (ut_script != NULL) {
-        status = luaL_loadbuffer(t->luastate, ut_script, strlen(ut_script), "unittest");
-        if (status) {
-            SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(t->luastate, -1));
-            goto error;
-        }
-    } else {
-#endif
-        status = luaL_loadfile(t->luastate, lua->filename);
-        if (status) {
-            SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(t->luastate, -1));
-            goto error;
-        }
-#ifdef UNITTESTS
-    }
-#endif
-
-    /* prime the script (or something) */
-    if (lua_pcall(t->luastate, 0, 0, 0) != 0) {
-        SCLogError(SC_ERR_LUA_ERROR, "couldn't prime file: %s", lua_tostring(t->luastate, -1));
+    if (DetectLuaLoadScript(t->luastate, lua) != 0)
         goto error;
-    }
 
     return (void *)t;
 
@@ -695,37 +859,17 @@ error:
 
 static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
 {
-    int status;
+    ld->script = DetectLuaScriptGet(ld->filename);
+    if (ld->script == NULL)
+        return -1;
 
     lua_State *luastate = luaL_newstate();
     if (luastate == NULL)
         return -1;
     luaL_openlibs(luastate);
 
-    /* hackish, needed to allow unittests to pass buffers as scripts instead of files */
-#ifdef UNITTESTS
-    if (ut_script != NULL) {
-        status = luaL_loadbuffer(luastate, ut_script, strlen(ut_script), "unittest");
-        if (status) {
-            SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(luastate, -1));
-            goto error;
-        }
-    } else {
-#endif
-        status = luaL_loadfile(luastate, ld->filename);
-        if (status) {
-            SCLogError(SC_ERR_LUA_ERROR, "couldn't load file: %s", lua_tostring(luastate, -1));
-            goto error;
-        }
-#ifdef UNITTESTS
-    }
-#endif
-
-    /* prime the script (or something) */
-    if (lua_pcall(luastate, 0, 0, 0) != 0) {
-        SCLogError(SC_ERR_LUA_ERROR, "couldn't prime file: %s", lua_tostring(luastate, -1));
+    if (DetectLuaLoadScript(luastate, ld) != 0)
         goto error;
-    }
 
     lua_getglobal(luastate, "init");
     if (lua_type(luastate, -1) != LUA_TFUNCTION) {
@@ -851,6 +995,8 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
 
             /* http types */
             ld->alproto = ALPROTO_HTTP;
+            /* the script can get the raw headers through the http lib */
+            AppLayerHtpNeedRawHeaders();
 
             if (strcmp(k, "http.uri") == 0)
                 ld->flags |= DATATYPE_HTTP_URI;
@@ -876,8 +1022,10 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
             else if (strcmp(k, "http.request_body") == 0)
                 ld->flags |= DATATYPE_HTTP_REQUEST_BODY;
 
-            else if (strcmp(k, "http.response_body") == 0)
+            else if (strcmp(k, "http.response_body") == 0) {
                 ld->flags |= DATATYPE_HTTP_RESPONSE_BODY;
+                AppLayerHtpEnableResponseBodyCallback();
+            }
 
             else if (strcmp(k, "http.response_cookie") == 0)
                 ld->flags |= DATATYPE_HTTP_RESPONSE_COOKIE;
@@ -939,9 +1087,17 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
         } else if (strncmp(k, "dnp3", 4) == 0 && strcmp(v, "true") == 0) {
 
             ld->alproto = ALPROTO_DNP3;
+            DNP3EnableObjectDecoding();
 
             ld->flags |= DATATYPE_DNP3;
 
+        } else if (strcmp(k, "ffi") == 0 && strcmp(v, "true") == 0) {
+#ifdef HAVE_LUAJIT
+            ld->ffi = 1;
+#else
+            SCLogError(SC_ERR_LUA_ERROR, "ffi buffers need LuaJIT");
+            goto error;
+#endif
         } else {
             SCLogError(SC_ERR_LUA_ERROR, "unsupported data type %s", k);
             goto error;
@@ -951,6 +1107,14 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
     /* pop the table */
     lua_pop(luastate, 1);
     lua_close(luastate);
+
+    if (ld->ffi && ld->buffername != NULL) {
+        size_t len = strlen(ld->buffername) + sizeof(".len");
+        ld->buffername_len = SCMalloc(len);
+        if (ld->buffername_len == NULL)
+            return -1;
+        snprintf(ld->buffername_len, len, "%s.len", ld->buffername);
+    }
     return 0;
 error:
     lua_close(luastate);
@@ -1114,8 +1278,12 @@ static void DetectLuaFree(void *ptr)
 
         if (lua->buffername)
             SCFree(lua->buffername);
+        if (lua->buffername_len)
+            SCFree(lua->buffername_len);
         if (lua->filename)
             SCFree(lua->filename);
+        if (lua->script)
+            DetectLuaScriptRelease(lua->script);
 
         SCFree(lua);
     }
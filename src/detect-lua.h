@@ -35,13 +35,20 @@ typedef struct DetectLuaThreadData {
 #define DETECT_LUAJIT_MAX_FLOWVARS  15
 #define DETECT_LUAJIT_MAX_FLOWINTS  15
 
+struct DetectLuaScript_;
+
 typedef struct DetectLuaData {
     int thread_ctx_id;
     int negated;
+    /* buffers are passed as pointer and length for use with the ffi */
+    int ffi;
     char *filename;
+    /* compiled script, shared with other keywords using the same file */
+    struct DetectLuaScript_ *script;
     uint32_t flags;
     AppProto alproto;
     char *buffername; /* buffer name in case of a single buffer */
+    char *buffername_len; /* "<buffername>.len" for ffi scripts */
     uint32_t flowint[DETECT_LUAJIT_MAX_FLOWINTS];
     uint16_t flowints;
     uint16_t flowvars;
@@ -32,6 +32,7 @@
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-state.h"
+#include "detect-engine-content-inspection.h"
 
 #include "detect-content.h"
 #include "detect-pcre.h"
@@ -1531,6 +1532,7 @@ SigMatchData* SigMatchList2DataArray(SigMatch *head)
         sm->ctx = NULL; // SigMatch no longer owns the ctx
         smd->is_last = (sm->next == NULL);
     }
+    DetectEngineContentInspectionSetup(out);
     return out;
 }
 
@@ -79,6 +79,29 @@ static pcre_extra *parse_capture_regex_study;
 static int pcre_use_jit = 1;
 #endif
 
+#ifdef PCRE_HAVE_JIT_EXEC
+/* per thread JIT stack, grows from 32k up to 512k */
+#define PCRE_JIT_STACK_MIN  (32 * 1024)
+#define PCRE_JIT_STACK_MAX  (512 * 1024)
+
+static int g_pcre_jit_thread_ctx_id = -1;
+
+static void *DetectPcreJitThreadInit(void *data)
+{
+    pcre_jit_stack *jit_stack = pcre_jit_stack_alloc(PCRE_JIT_STACK_MIN,
+            PCRE_JIT_STACK_MAX);
+    if (jit_stack == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate pcre jit stack");
+    }
+    return jit_stack;
+}
+
+static void DetectPcreJitThreadFree(void *ctx)
+{
+    pcre_jit_stack_free((pcre_jit_stack *)ctx);
+}
+#endif
+
 static int DetectPcreSetup (DetectEngineCtx *, Signature *, const char *);
 static void DetectPcreFree(void *);
 static void DetectPcreRegisterTests(void);
@@ -149,6 +172,12 @@ void DetectPcreRegister (void)
         pcre_use_jit = 0;
     }
 #endif
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (pcre_use_jit) {
+        g_pcre_jit_thread_ctx_id = DetectRegisterThreadCtxGlobalFuncs("pcre",
+                DetectPcreJitThreadInit, NULL, DetectPcreJitThreadFree);
+    }
+#endif
 
     DetectParseRegexAddToFreeList(parse_capture_regex, parse_capture_regex_study);
     return;
@@ -196,6 +225,18 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, const Signature *s,
     }
 
     /* run the actual pcre detection */
+#ifdef PCRE_HAVE_JIT_EXEC
+    pcre_jit_stack *jit_stack = NULL;
+    if (pe->flags & DETECT_PCRE_JIT) {
+        jit_stack = (pcre_jit_stack *)DetectThreadCtxGetGlobalKeywordThreadCtx(det_ctx,
+                g_pcre_jit_thread_ctx_id);
+    }
+    if (jit_stack != NULL) {
+        /* jit compiled: skip pcre_exec's checks and use the thread's stack */
+        ret = pcre_jit_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0,
+                ov, MAX_SUBSTRINGS, jit_stack);
+    } else
+#endif
     ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
@@ -646,6 +687,8 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
         SCLogDebug("PCRE JIT compiler does not support: %s. "
                 "Falling back to regular PCRE handling (%s:%d)",
                 regexstr, de_ctx->rule_file, de_ctx->rule_line);
+    } else {
+        pd->flags |= DETECT_PCRE_JIT;
     }
 #endif /*PCRE_HAVE_JIT*/
 
@@ -1621,6 +1664,45 @@ static int DetectPcreParseTest28(void)
     PASS;
 }
 
+/** \test jit compiled regex matching with the thread's jit stack */
+static int DetectPcreParseTest29(void)
+{
+    int list = DETECT_SM_LIST_NOTSET;
+    AppProto alproto = ALPROTO_UNKNOWN;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    Signature s;
+    memset(&s, 0, sizeof(s));
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    DetectPcreData *pd = DetectPcreParse(de_ctx, "/ab+c/", &list, NULL, 0, false, &alproto);
+    FAIL_IF_NULL(pd);
+#ifdef PCRE_HAVE_JIT_EXEC
+    if (pcre_use_jit) {
+        FAIL_IF_NOT(pd->flags & DETECT_PCRE_JIT);
+    }
+#endif
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    SigMatchData smd = { .type = DETECT_PCRE, .is_last = 1, .ctx = (SigMatchCtx *)pd };
+    uint8_t buf[] = "xxabbbcxx";
+    FAIL_IF_NOT(DetectPcrePayloadMatch(det_ctx, &s, &smd, NULL, NULL, buf, sizeof(buf) - 1) == 1);
+    FAIL_IF_NOT(det_ctx->buffer_offset == 7);
+    det_ctx->buffer_offset = 0;
+    det_ctx->pcre_match_start_offset = 0;
+    uint8_t buf2[] = "xxacxx";
+    FAIL_IF_NOT(DetectPcrePayloadMatch(det_ctx, &s, &smd, NULL, NULL, buf2, sizeof(buf2) - 1) == 0);
+
+    DetectPcreFree(pd);
+    DetectEngineThreadCtxDeinit(&tv, det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 static int DetectPcreTestSig01(void)
 {
     uint8_t *buf = (uint8_t *)
@@ -3561,6 +3643,7 @@ static void DetectPcreRegisterTests(void)
     UtRegisterTest("DetectPcreParseTest26", DetectPcreParseTest26);
     UtRegisterTest("DetectPcreParseTest27", DetectPcreParseTest27);
     UtRegisterTest("DetectPcreParseTest28", DetectPcreParseTest28);
+    UtRegisterTest("DetectPcreParseTest29", DetectPcreParseTest29);
 
     UtRegisterTest("DetectPcreTestSig01 -- pcre test", DetectPcreTestSig01);
     UtRegisterTest("DetectPcreTestSig02 -- pcre test", DetectPcreTestSig02);
@@ -31,6 +31,7 @@
 #define DETECT_PCRE_MATCH_LIMIT         0x00020
 #define DETECT_PCRE_RELATIVE_NEXT       0x00040
 #define DETECT_PCRE_NEGATE              0x00080
+#define DETECT_PCRE_JIT                 0x00100 /**< regex is jit compiled */
 
 #define DETECT_PCRE_CAPTURE_MAX         8
 
@@ -49,8 +49,6 @@
 #include "util-debug.h"
 #include "threads.h"
 
-SC_ATOMIC_EXTERN(unsigned int, num_tags);
-
 /* format: tag: <type>, <count>, <metric>, [direction]; */
 #define PARSE_REGEX  "^\\s*(host|session)\\s*(,\\s*(\\d+)\\s*,\\s*(packets|bytes|seconds)\\s*(,\\s*(src|dst))?\\s*)?$"
 
@@ -301,41 +299,6 @@ int DetectTagSetup(DetectEngineCtx *de_ctx, Signature *s, const char *tagstr)
     return 0;
 }
 
-/** \internal
- *  \brief this function will free memory associated with
- *        DetectTagDataEntry
- *
- *  \param td pointer to DetectTagDataEntry
- */
-static void DetectTagDataEntryFree(void *ptr)
-{
-    if (ptr != NULL) {
-        DetectTagDataEntry *dte = (DetectTagDataEntry *)ptr;
-        SCFree(dte);
-    }
-}
-
-
-/**
- * \brief this function will free all the entries of a list
- *        DetectTagDataEntry
- *
- * \param td pointer to DetectTagDataEntryList
- */
-void DetectTagDataListFree(void *ptr)
-{
-    if (ptr != NULL) {
-        DetectTagDataEntry *entry = ptr;
-
-        while (entry != NULL) {
-            DetectTagDataEntry *next_entry = entry->next;
-            DetectTagDataEntryFree(entry);
-            (void) SC_ATOMIC_SUB(num_tags, 1);
-            entry = next_entry;
-        }
-    }
-}
-
 /**
  * \brief this function will free memory associated with DetectTagData
  *
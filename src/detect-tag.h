@@ -85,13 +85,15 @@ typedef struct DetectTagDataEntry_ {
     };
     uint32_t first_ts;                  /**< First time seen (for metric = seconds) */
     uint32_t last_ts;                   /**< Last time seen (to prune old sessions) */
-#if __WORDSIZE == 64
-    uint32_t pad1;
-#endif
-    struct DetectTagDataEntry_ *next;   /**< Pointer to the next tag of this
-                                         *   session/src_host/dst_host (if any from other rule) */
 } DetectTagDataEntry;
 
+/** The tags of a session or host, stored in the flow/host storage */
+typedef struct DetectTagList_ {
+    uint16_t cnt;                       /**< entries in use */
+    uint16_t size;                      /**< entries allocated */
+    DetectTagDataEntry entries[];
+} DetectTagList;
+
 #define TAG_ENTRY_FLAG_DIR_SRC          0x01
 #define TAG_ENTRY_FLAG_DIR_DST          0x02
 #define TAG_ENTRY_FLAG_SKIPPED_FIRST    0x04
@@ -99,7 +101,6 @@ typedef struct DetectTagDataEntry_ {
 /* prototypes */
 void DetectTagRegister(void);
 void DetectTagDataFree(void *ptr);
-void DetectTagDataListFree(void *ptr);
 
 #endif /* __DETECT_TAG_H__ */
 
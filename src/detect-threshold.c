@@ -37,7 +37,6 @@
 #include "decode.h"
 
 #include "host.h"
-#include "host-storage.h"
 
 #include "detect.h"
 #include "detect-parse.h"
@@ -392,6 +391,7 @@ static int DetectThresholdTestSig1(void)
     int alerts = 0;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset(&th_v, 0, sizeof(th_v));
 
@@ -472,6 +472,7 @@ static int DetectThresholdTestSig1(void)
 
     UTHFreePackets(&p, 1);
 
+    ThresholdDestroy();
     HostShutdown();
 end:
     return result;
@@ -496,6 +497,7 @@ static int DetectThresholdTestSig2(void)
     int alerts = 0;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset(&th_v, 0, sizeof(th_v));
 
@@ -551,6 +553,7 @@ cleanup:
 
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -576,6 +579,7 @@ static int DetectThresholdTestSig3(void)
     DetectThresholdEntry *lookup_tsh = NULL;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -605,19 +609,11 @@ static int DetectThresholdTestSig3(void)
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
 
-    Host *host = HostLookupHostFromHash(&p->dst);
-    if (host == NULL) {
-        printf("host not found: ");
+    if (ThresholdsLookupEntry(p, 10, 1, TRACK_DST) == NULL) {
+        printf("no threshold entry: ");
         goto cleanup;
     }
 
-    if (!(ThresholdHostHasThreshold(host))) {
-        HostRelease(host);
-        printf("host has no threshold: ");
-        goto cleanup;
-    }
-    HostRelease(host);
-
     TimeSetIncrementTime(200);
     TimeGet(&p->ts);
 
@@ -625,16 +621,8 @@ static int DetectThresholdTestSig3(void)
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
 
-    host = HostLookupHostFromHash(&p->dst);
-    if (host == NULL) {
-        printf("host not found: ");
-        goto cleanup;
-    }
-    HostRelease(host);
-
-    lookup_tsh = HostGetStorageById(host, ThresholdHostStorageId());
+    lookup_tsh = ThresholdsLookupEntry(p, 10, 1, TRACK_DST);
     if (lookup_tsh == NULL) {
-        HostRelease(host);
         printf("lookup_tsh is NULL: ");
         goto cleanup;
     }
@@ -656,6 +644,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -680,6 +669,7 @@ static int DetectThresholdTestSig4(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -734,6 +724,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -757,6 +748,7 @@ static int DetectThresholdTestSig5(void)
     int alerts = 0;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset(&th_v, 0, sizeof(th_v));
     p = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
@@ -822,6 +814,7 @@ cleanup:
 
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -836,6 +829,7 @@ static int DetectThresholdTestSig6Ticks(void)
     int alerts = 0;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset(&th_v, 0, sizeof(th_v));
     p = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
@@ -905,6 +899,7 @@ cleanup:
 
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -924,6 +919,7 @@ static int DetectThresholdTestSig7(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -999,6 +995,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -1018,6 +1015,7 @@ static int DetectThresholdTestSig8(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -1093,6 +1091,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -1112,6 +1111,7 @@ static int DetectThresholdTestSig9(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -1187,6 +1187,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -1206,6 +1207,7 @@ static int DetectThresholdTestSig10(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -1281,6 +1283,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -1300,6 +1303,7 @@ static int DetectThresholdTestSig11(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -1375,6 +1379,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
@@ -1394,6 +1399,7 @@ static int DetectThresholdTestSig12(void)
     struct timeval ts;
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     memset (&ts, 0, sizeof(struct timeval));
     TimeGet(&ts);
@@ -1469,6 +1475,7 @@ cleanup:
     DetectEngineCtxFree(de_ctx);
 end:
     UTHFreePackets(&p, 1);
+    ThresholdDestroy();
     HostShutdown();
     return result;
 }
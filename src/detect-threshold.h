@@ -76,6 +76,12 @@ typedef struct DetectThresholdEntry_ {
     uint32_t tv_usec1;       /**< Var for time control */
     uint32_t current_count; /**< Var for count control */
     int track;          /**< Track type: by_src, by_src */
+    uint32_t timeout;   /**< new_action timeout (for rate_filter) */
+
+    /** address(es) the entry tracks: the src or dst for by_src/by_dst,
+     *  both for by_both with addr being the lowest */
+    Address addr;
+    Address addr2;
 
     struct DetectThresholdEntry_ *next;
 } DetectThresholdEntry;
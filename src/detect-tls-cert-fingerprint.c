@@ -90,6 +90,7 @@ void DetectTlsFingerprintRegister(void)
     DetectAppLayerMpmRegister2("tls.cert_fingerprint", SIG_FLAG_TOCLIENT, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS,
             TLS_STATE_CERT_READY);
+    DetectAppLayerMpmSetBatchable("tls.cert_fingerprint");
 
     DetectBufferTypeSetDescriptionByName("tls.cert_fingerprint",
             "TLS certificate fingerprint");
@@ -86,6 +86,7 @@ void DetectTlsIssuerRegister(void)
     DetectAppLayerMpmRegister2("tls.cert_issuer", SIG_FLAG_TOCLIENT, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS,
             TLS_STATE_CERT_READY);
+    DetectAppLayerMpmSetBatchable("tls.cert_issuer");
 
     DetectBufferTypeSetDescriptionByName("tls.cert_issuer",
             "TLS certificate issuer");
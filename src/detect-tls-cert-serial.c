@@ -90,6 +90,7 @@ void DetectTlsSerialRegister(void)
     DetectAppLayerMpmRegister2("tls.cert_serial", SIG_FLAG_TOCLIENT, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS,
             TLS_STATE_CERT_READY);
+    DetectAppLayerMpmSetBatchable("tls.cert_serial");
 
     DetectBufferTypeSetDescriptionByName("tls.cert_serial",
             "TLS certificate serial number");
@@ -86,6 +86,7 @@ void DetectTlsSubjectRegister(void)
     DetectAppLayerMpmRegister2("tls.cert_subject", SIG_FLAG_TOCLIENT, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS,
             TLS_STATE_CERT_READY);
+    DetectAppLayerMpmSetBatchable("tls.cert_subject");
 
     DetectBufferTypeSetDescriptionByName("tls.cert_subject",
             "TLS certificate subject");
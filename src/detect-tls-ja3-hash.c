@@ -92,6 +92,7 @@ void DetectTlsJa3HashRegister(void)
 
     DetectAppLayerMpmRegister2("ja3.hash", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS, 0);
+    DetectAppLayerMpmSetBatchable("ja3.hash");
 
     DetectBufferTypeSetDescriptionByName("ja3.hash", "TLS JA3 hash");
 
@@ -88,6 +88,7 @@ void DetectTlsJa3StringRegister(void)
 
     DetectAppLayerMpmRegister2("ja3.string", SIG_FLAG_TOSERVER, 2,
             PrefilterGenericMpmRegister, GetData, ALPROTO_TLS, 0);
+    DetectAppLayerMpmSetBatchable("ja3.string");
 
     DetectBufferTypeSetDescriptionByName("ja3.string", "TLS JA3 string");
 
@@ -131,7 +132,7 @@ static InspectionBuffer *GetData(DetectEngineThreadCtx *det_ctx,
             return NULL;
         }
 
-        const uint32_t data_len = strlen(ssl_state->ja3_str->data);
+        const uint32_t data_len = ssl_state->ja3_str->used;
         const uint8_t *data = (uint8_t *)ssl_state->ja3_str->data;
 
         InspectionBufferSetup(buffer, data, data_len);
@@ -0,0 +1,140 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the to_lowercase transform keyword
+ */
+
+#include "suricata-common.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-prefilter.h"
+#include "detect-parse.h"
+#include "detect-transform-casechange.h"
+
+#include "util-unittest.h"
+#include "util-print.h"
+#include "util-memcpy.h"
+
+static int DetectTransformToLowerSetup (DetectEngineCtx *, Signature *, const char *);
+static void DetectTransformToLowerRegisterTests(void);
+
+static void TransformToLower(InspectionBuffer *buffer);
+
+void DetectTransformToLowerRegister(void)
+{
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].name = "to_lowercase";
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].desc =
+        "convert buffer to lowercase before inspection";
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].url =
+        DOC_URL DOC_VERSION "/rules/transforms.html#to-lowercase";
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].Transform =
+        TransformToLower;
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].Setup =
+        DetectTransformToLowerSetup;
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].RegisterTests =
+        DetectTransformToLowerRegisterTests;
+
+    sigmatch_table[DETECT_TRANSFORM_TOLOWER].flags |= SIGMATCH_NOOPT;
+}
+
+/**
+ *  \internal
+ *  \brief Add the to_lowercase transform to the current sticky buffer
+ *  \param de_ctx detection engine ctx
+ *  \param s signature
+ *  \param nullstr should be null
+ *  \retval 0 ok
+ *  \retval -1 failure
+ */
+static int DetectTransformToLowerSetup (DetectEngineCtx *de_ctx, Signature *s, const char *nullstr)
+{
+    SCEnter();
+    int r = DetectSignatureAddTransform(s, DETECT_TRANSFORM_TOLOWER);
+    SCReturnInt(r);
+}
+
+static void TransformToLower(InspectionBuffer *buffer)
+{
+    const uint8_t *input = buffer->inspect;
+    const uint32_t input_len = buffer->inspect_len;
+
+    /* the size doesn't change, so if the input is our buffer already
+     * (from a previous transform) this is done in place */
+    if (input_len == 0)
+        return;
+    InspectionBufferCheckAndExpand(buffer, input_len);
+    if (buffer->size < input_len)
+        return;
+    memcpy_tolower(buffer->buf, input, input_len);
+
+    buffer->inspect = buffer->buf;
+    buffer->inspect_len = input_len;
+}
+
+#ifdef UNITTESTS
+static int DetectTransformToLowerTest01(void)
+{
+    const uint8_t *input = (const uint8_t *)"GET /Index.PHP?A=[Z]@ HTTP/1.1 \xc0\xdf";
+    const uint8_t *result = (const uint8_t *)"get /index.php?a=[z]@ http/1.1 \xc0\xdf";
+    uint32_t input_len = strlen((char *)input);
+
+    InspectionBuffer buffer;
+    InspectionBufferInit(&buffer, 8);
+    InspectionBufferSetup(&buffer, input, input_len);
+    TransformToLower(&buffer);
+    FAIL_IF_NOT(buffer.inspect_len == input_len);
+    FAIL_IF_NOT(memcmp(buffer.inspect, result, input_len) == 0);
+    /* in place */
+    TransformToLower(&buffer);
+    FAIL_IF_NOT(buffer.inspect_len == input_len);
+    FAIL_IF_NOT(memcmp(buffer.inspect, result, input_len) == 0);
+    InspectionBufferFree(&buffer);
+    PASS;
+}
+
+static int DetectTransformToLowerTest02(void)
+{
+    const char rule[] = "alert http any any -> any any (http_request_line; to_lowercase; content:\"get / http\"; sid:1;)";
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    memset(&th_v, 0, sizeof(th_v));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    Signature *s = DetectEngineAppendSig(de_ctx, rule);
+    FAIL_IF_NULL(s);
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif
+
+static void DetectTransformToLowerRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectTransformToLowerTest01",
+            DetectTransformToLowerTest01);
+    UtRegisterTest("DetectTransformToLowerTest02",
+            DetectTransformToLowerTest02);
+#endif
+}
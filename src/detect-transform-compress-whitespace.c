@@ -34,6 +34,10 @@
 #include "util-unittest.h"
 #include "util-print.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static int DetectTransformCompressWhitespaceSetup (DetectEngineCtx *, Signature *, const char *);
 static void DetectTransformCompressWhitespaceRegisterTests(void);
 
@@ -72,32 +76,72 @@ static int DetectTransformCompressWhitespaceSetup (DetectEngineCtx *de_ctx, Sign
     SCReturnInt(r);
 }
 
+#ifdef __SSE2__
+/** \internal
+ *  \brief bitmask of the bytes in the vector that isspace() is true for:
+ *          ' ' and \\t \\n \\v \\f \\r, which are 0x09-0x0d */
+static inline uint32_t WhitespaceMask(__m128i v)
+{
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x08)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8(0x0e)));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(sp, ctl));
+}
+#endif
+
 static void TransformCompressWhitespace(InspectionBuffer *buffer)
 {
     const uint8_t *input = buffer->inspect;
     const uint32_t input_len = buffer->inspect_len;
-    uint8_t output[input_len]; // we can only shrink
-    uint8_t *oi = output, *os = output;
 
-    //PrintRawDataFp(stdout, input, input_len);
-    for (uint32_t i = 0; i < input_len; ) {
-        if (!(isspace(*input))) {
-            *oi++ = *input++;
-            i++;
-        } else {
-            *oi++ = *input++;
-            i++;
+    /* we can only shrink, so if the input is our buffer already (from a
+     * previous transform) this is done in place */
+    if (input_len == 0)
+        return;
+    InspectionBufferCheckAndExpand(buffer, input_len);
+    if (buffer->size < input_len)
+        return;
+    uint8_t *output = buffer->buf;
+    uint32_t i = 0, o = 0;
+    /* the first whitespace char of a run is kept, the rest is dropped */
+    int in_ws = 0;
 
-            while (i < input_len && isspace(*input)) {
-                input++;
-                i++;
+#ifdef __SSE2__
+    /* the store can only overwrite input we already read */
+    for ( ; i + 16 <= input_len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+        uint32_t mask = WhitespaceMask(v);
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)(output + o), v);
+            o += 16;
+            in_ws = 0;
+            continue;
+        }
+        for (uint32_t j = 0; j < 16; j++) {
+            if (mask & (1 << j)) {
+                if (!in_ws)
+                    output[o++] = input[i + j];
+                in_ws = 1;
+            } else {
+                output[o++] = input[i + j];
+                in_ws = 0;
             }
         }
     }
-    uint32_t output_size = oi - os;
-    //PrintRawDataFp(stdout, output, output_size);
+#endif
+    for ( ; i < input_len; i++) {
+        if (isspace(input[i])) {
+            if (!in_ws)
+                output[o++] = input[i];
+            in_ws = 1;
+        } else {
+            output[o++] = input[i];
+            in_ws = 0;
+        }
+    }
 
-    InspectionBufferCopy(buffer, os, output_size);
+    buffer->inspect = buffer->buf;
+    buffer->inspect_len = o;
 }
 
 #ifdef UNITTESTS
@@ -175,6 +219,27 @@ static int DetectTransformCompressWhitespaceTest03(void)
     PASS;
 }
 
+static int DetectTransformCompressWhitespaceTest04(void)
+{
+    const uint8_t *input = (const uint8_t *)"window  .navigate\t\t(\r\n\"http://example.com/\"  ) ;";
+    const uint8_t *result = (const uint8_t *)"window .navigate\t(\r\"http://example.com/\" ) ;";
+    uint32_t input_len = strlen((char *)input);
+    uint32_t result_len = strlen((char *)result);
+
+    InspectionBuffer buffer;
+    InspectionBufferInit(&buffer, 8);
+    InspectionBufferSetup(&buffer, input, input_len);
+    TransformCompressWhitespace(&buffer);
+    FAIL_IF_NOT(buffer.inspect_len == result_len);
+    FAIL_IF_NOT(memcmp(buffer.inspect, result, result_len) == 0);
+    /* in place */
+    TransformCompressWhitespace(&buffer);
+    FAIL_IF_NOT(buffer.inspect_len == result_len);
+    FAIL_IF_NOT(memcmp(buffer.inspect, result, result_len) == 0);
+    InspectionBufferFree(&buffer);
+    PASS;
+}
+
 #endif
 
 static void DetectTransformCompressWhitespaceRegisterTests(void)
@@ -186,5 +251,7 @@ static void DetectTransformCompressWhitespaceRegisterTests(void)
             DetectTransformCompressWhitespaceTest02);
     UtRegisterTest("DetectTransformCompressWhitespaceTest03",
             DetectTransformCompressWhitespaceTest03);
+    UtRegisterTest("DetectTransformCompressWhitespaceTest04",
+            DetectTransformCompressWhitespaceTest04);
 #endif
 }
@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-engine-prefilter-common.h"
 
 #include "detect-window.h"
 #include "flow.h"
@@ -52,6 +53,8 @@ static int DetectWindowMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *,
 static int DetectWindowSetup(DetectEngineCtx *, Signature *, const char *);
 void DetectWindowRegisterTests(void);
 void DetectWindowFree(void *);
+static int PrefilterSetupWindow(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+static _Bool PrefilterWindowIsPrefilterable(const Signature *s);
 
 /**
  * \brief Registration function for window: keyword
@@ -66,6 +69,9 @@ void DetectWindowRegister (void)
     sigmatch_table[DETECT_WINDOW].Free  = DetectWindowFree;
     sigmatch_table[DETECT_WINDOW].RegisterTests = DetectWindowRegisterTests;
 
+    sigmatch_table[DETECT_WINDOW].SupportsPrefilter = PrefilterWindowIsPrefilterable;
+    sigmatch_table[DETECT_WINDOW].SetupPrefilter = PrefilterSetupWindow;
+
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
@@ -211,7 +217,50 @@ void DetectWindowFree(void *ptr)
     SCFree(wd);
 }
 
+/* prefilter code */
+
+static void
+PrefilterPacketWindowMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p)) {
+        return;
+    }
+
+    const SigsArray *sa = PrefilterPacketU16RangeLookup(pectx, TCP_GET_WINDOW(p));
+    if (sa->cnt) {
+        PrefilterAddSids(&det_ctx->pmq, sa->sigs, sa->cnt);
+    }
+}
+
+static void
+PrefilterPacketWindowSet(PrefilterPacketHeaderValue *v, void *smctx)
+{
+    const DetectWindowData *a = smctx;
+    v->u8[0] = a->negated ? PREFILTER_U16RANGE_MODE_NE : PREFILTER_U16RANGE_MODE_EQ;
+    v->u16[1] = a->size;
+}
+
+static int PrefilterSetupWindow(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU16Range(de_ctx, sgh, DETECT_WINDOW,
+            PrefilterPacketWindowSet,
+            PrefilterPacketWindowMatch);
+}
+
+static _Bool PrefilterWindowIsPrefilterable(const Signature *s)
+{
+    const SigMatch *sm;
+    for (sm = s->init_data->smlists[DETECT_SM_LIST_MATCH] ; sm != NULL; sm = sm->next) {
+        switch (sm->type) {
+            case DETECT_WINDOW:
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 #ifdef UNITTESTS /* UNITTESTS */
+#include "detect-engine.h"
 
 /**
  * \test DetectWindowTestParse01 is a test to make sure that we set the size correctly
@@ -327,6 +376,55 @@ end:
     return result;
 }
 
+static _Bool WindowPrefilterTestMatch(const Signature *s, const uint16_t v)
+{
+    const SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_MATCH];
+    while (smd != NULL) {
+        if (smd->type == DETECT_WINDOW) {
+            const DetectWindowData *wd = (const DetectWindowData *)smd->ctx;
+            return (v == wd->size) != (wd->negated != 0);
+        }
+        if (smd->is_last)
+            break;
+        smd++;
+    }
+    return FALSE;
+}
+
+/**
+ * \test the u16 range prefilter table of window holds the rules that
+ *       match each window size, including negated ones
+ */
+static int DetectWindowPrefilterTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    const char *sigs[] = {
+        "alert tcp any any -> any any (window:1024; prefilter; sid:1;)",
+        "alert tcp any any -> any any (window:!1024; prefilter; sid:2;)",
+        "alert tcp any any -> any any (window:0; prefilter; sid:3;)",
+        "alert tcp any any -> any any (window:!0; prefilter; sid:4;)",
+        "alert tcp any any -> any any (window:65535; prefilter; sid:5;)",
+        "alert tcp any any -> any any (window:!65535; prefilter; sid:6;)",
+        "alert tcp any any -> any any (window:1024; prefilter; sid:7;)",
+        NULL,
+    };
+    for (int i = 0; sigs[i] != NULL; i++) {
+        FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sigs[i]));
+    }
+    SigGroupBuild(de_ctx);
+
+    const PrefilterPacketU16RangeCtx *ctx =
+        PrefilterPacketHeaderGetCtx(de_ctx, PrefilterPacketWindowMatch);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(PrefilterPacketU16RangeCheck(de_ctx, ctx, WindowPrefilterTestMatch));
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -340,5 +438,6 @@ void DetectWindowRegisterTests(void)
     UtRegisterTest("DetectWindowTestParse03", DetectWindowTestParse03);
     UtRegisterTest("DetectWindowTestParse04", DetectWindowTestParse04);
     UtRegisterTest("DetectWindowTestPacket01", DetectWindowTestPacket01);
+    UtRegisterTest("DetectWindowPrefilterTest01", DetectWindowPrefilterTest01);
     #endif /* UNITTESTS */
 }
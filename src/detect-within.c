@@ -104,13 +104,13 @@ static int DetectWithinSetup(DetectEngineCtx *de_ctx, Signature *s, const char *
         goto end;
     }
     if (str[0] != '-' && isalpha((unsigned char)str[0])) {
-        SigMatch *bed_sm = DetectByteExtractRetrieveSMVar(str, s);
-        if (bed_sm == NULL) {
+        int32_t local_id = DetectByteExtractRetrieveVarLocalId(str, s);
+        if (local_id < 0) {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "unknown byte_extract var "
                        "seen in within - %s\n", str);
             goto end;
         }
-        cd->within = ((DetectByteExtractData *)bed_sm->ctx)->local_id;
+        cd->within = local_id;
         cd->flags |= DETECT_CONTENT_WITHIN_BE;
     } else {
         if (ByteExtractStringInt32(&cd->within, 0, 0, str) != (int)strlen(str)) {
@@ -91,6 +91,9 @@ static int DetectIPPairbitMatchToggle (Packet *p, const DetectXbitsData *fd)
 /* return true even if bit not found */
 static int DetectIPPairbitMatchUnset (Packet *p, const DetectXbitsData *fd)
 {
+    if (IPPairBitsMayHave(&p->src, &p->dst) == 0)
+        return 1;
+
     IPPair *pair = IPPairLookupIPPairFromHash(&p->src, &p->dst);
     if (pair == NULL)
         return 1;
@@ -114,6 +117,9 @@ static int DetectIPPairbitMatchSet (Packet *p, const DetectXbitsData *fd)
 static int DetectIPPairbitMatchIsset (Packet *p, const DetectXbitsData *fd)
 {
     int r = 0;
+    if (IPPairBitsMayHave(&p->src, &p->dst) == 0)
+        return 0;
+
     IPPair *pair = IPPairLookupIPPairFromHash(&p->src, &p->dst);
     if (pair == NULL)
         return 0;
@@ -126,6 +132,9 @@ static int DetectIPPairbitMatchIsset (Packet *p, const DetectXbitsData *fd)
 static int DetectIPPairbitMatchIsnotset (Packet *p, const DetectXbitsData *fd)
 {
     int r = 0;
+    if (IPPairBitsMayHave(&p->src, &p->dst) == 0)
+        return 1;
+
     IPPair *pair = IPPairLookupIPPairFromHash(&p->src, &p->dst);
     if (pair == NULL)
         return 1;
@@ -36,6 +36,8 @@
 #include "detect.h"
 #include "detect-engine.h"
 #include "detect-engine-profile.h"
+#include "detect-engine-record.h"
+#include "detect-engine-rule-sample.h"
 
 #include "detect-engine-alert.h"
 #include "detect-engine-siggroup.h"
@@ -58,6 +60,7 @@
 
 #include "util-validate.h"
 #include "util-detect.h"
+#include "util-cpu.h"
 
 typedef struct DetectRunScratchpad {
     const AppProto alproto;
@@ -206,19 +209,27 @@ const SigGroupHead *SigMatchSignaturesGetSgh(const DetectEngineCtx *de_ctx,
                 de_ctx->flow_gh[1].tcp, de_ctx->flow_gh[0].tcp, de_ctx->flow_gh[f].tcp);
         uint16_t port = f ? p->dp : p->sp;
         SCLogDebug("tcp port %u -> %u:%u", port, p->sp, p->dp);
-        DetectPort *sghport = DetectPortLookupGroup(list, port);
-        if (sghport != NULL)
-            sgh = sghport->sh;
-        SCLogDebug("TCP list %p, port %u, direction %s, sghport %p, sgh %p",
-                list, port, f ? "toserver" : "toclient", sghport, sgh);
+        if (likely(de_ctx->flow_gh[f].tcp_ports != NULL)) {
+            sgh = DetectPortLookupTableGet(de_ctx->flow_gh[f].tcp_ports, port);
+        } else {
+            DetectPort *sghport = DetectPortLookupGroup(list, port);
+            if (sghport != NULL)
+                sgh = sghport->sh;
+        }
+        SCLogDebug("TCP list %p, port %u, direction %s, sgh %p",
+                list, port, f ? "toserver" : "toclient", sgh);
     } else if (proto == IPPROTO_UDP) {
         DetectPort *list = de_ctx->flow_gh[f].udp;
         uint16_t port = f ? p->dp : p->sp;
-        DetectPort *sghport = DetectPortLookupGroup(list, port);
-        if (sghport != NULL)
-            sgh = sghport->sh;
-        SCLogDebug("UDP list %p, port %u, direction %s, sghport %p, sgh %p",
-                list, port, f ? "toserver" : "toclient", sghport, sgh);
+        if (likely(de_ctx->flow_gh[f].udp_ports != NULL)) {
+            sgh = DetectPortLookupTableGet(de_ctx->flow_gh[f].udp_ports, port);
+        } else {
+            DetectPort *sghport = DetectPortLookupGroup(list, port);
+            if (sghport != NULL)
+                sgh = sghport->sh;
+        }
+        SCLogDebug("UDP list %p, port %u, direction %s, sgh %p",
+                list, port, f ? "toserver" : "toclient", sgh);
     } else {
         sgh = de_ctx->flow_gh[f].sgh[proto];
     }
@@ -226,6 +237,18 @@ const SigGroupHead *SigMatchSignaturesGetSgh(const DetectEngineCtx *de_ctx,
     SCReturnPtr(sgh, "SigGroupHead");
 }
 
+/** \internal
+ *  \brief see if the rule applies to a flow of alproto
+ *
+ *  http rules apply to http2 if all their buffers can be inspected
+ *  on http2, see SIG_FLAG_HTTP2. */
+static inline bool DetectRunSigAppProtoMatch(const Signature *s, const AppProto alproto)
+{
+    if (s->alproto == alproto)
+        return true;
+    return (s->flags & SIG_FLAG_HTTP2) && AppProtoEquals(s->alproto, alproto);
+}
+
 static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
                                             DetectEngineThreadCtx *det_ctx)
 {
@@ -352,13 +375,53 @@ static inline void DetectPrefilterMergeSort(DetectEngineCtx *de_ctx,
 static inline void
 DetectPrefilterBuildNonPrefilterList(DetectEngineThreadCtx *det_ctx, SignatureMask mask, uint8_t alproto)
 {
+    const SignatureNonPrefilterBuckets *buckets = det_ctx->non_pf_buckets;
+    if (buckets->cnt > 0) {
+        /* only visit the buckets the mask allows, merging their sorted
+         * id lists as the merge sort with the mpm results needs the
+         * list sorted */
+        uint32_t cnt = 0;
+        for (uint32_t b = 0; b < buckets->cnt; b++) {
+            const SignatureNonPrefilterBucket *bucket = &buckets->array[b];
+            if ((bucket->mask & mask) != bucket->mask ||
+                    (bucket->alproto != 0 && !AppProtoEquals(bucket->alproto, alproto)))
+                continue;
+
+            if (cnt == 0) {
+                memcpy(det_ctx->non_pf_id_array, bucket->ids, bucket->cnt * sizeof(SigIntId));
+                cnt = bucket->cnt;
+                continue;
+            }
+
+            const SigIntId *a = det_ctx->non_pf_id_array;
+            const SigIntId *a_end = a + cnt;
+            const SigIntId *i = bucket->ids;
+            const SigIntId *i_end = i + bucket->cnt;
+            SigIntId *out = det_ctx->non_pf_id_array_tmp;
+            while (a < a_end && i < i_end) {
+                *out++ = (*a < *i) ? *a++ : *i++;
+            }
+            while (a < a_end)
+                *out++ = *a++;
+            while (i < i_end)
+                *out++ = *i++;
+            cnt += bucket->cnt;
+
+            SigIntId *tmp = det_ctx->non_pf_id_array;
+            det_ctx->non_pf_id_array = det_ctx->non_pf_id_array_tmp;
+            det_ctx->non_pf_id_array_tmp = tmp;
+        }
+        det_ctx->non_pf_id_cnt = cnt;
+        return;
+    }
+
     uint32_t x = 0;
     for (x = 0; x < det_ctx->non_pf_store_cnt; x++) {
         /* only if the mask matches this rule can possibly match,
          * so build the non_mpm array only for match candidates */
         const SignatureMask rule_mask = det_ctx->non_pf_store_ptr[x].mask;
         const uint8_t rule_alproto = det_ctx->non_pf_store_ptr[x].alproto;
-        if ((rule_mask & mask) == rule_mask && (rule_alproto == 0 || rule_alproto == alproto)) {
+        if ((rule_mask & mask) == rule_mask && (rule_alproto == 0 || AppProtoEquals(rule_alproto, alproto))) {
             det_ctx->non_pf_id_array[det_ctx->non_pf_id_cnt++] = det_ctx->non_pf_store_ptr[x].id;
         }
     }
@@ -374,9 +437,11 @@ DetectPrefilterSetNonPrefilterList(const Packet *p, DetectEngineThreadCtx *det_c
     if ((p->proto == IPPROTO_TCP) && (p->tcph != NULL) && (p->tcph->th_flags & TH_SYN)) {
         det_ctx->non_pf_store_ptr = scratch->sgh->non_pf_syn_store_array;
         det_ctx->non_pf_store_cnt = scratch->sgh->non_pf_syn_store_cnt;
+        det_ctx->non_pf_buckets = &scratch->sgh->non_pf_syn_buckets;
     } else {
         det_ctx->non_pf_store_ptr = scratch->sgh->non_pf_other_store_array;
         det_ctx->non_pf_store_cnt = scratch->sgh->non_pf_other_store_cnt;
+        det_ctx->non_pf_buckets = &scratch->sgh->non_pf_other_buckets;
     }
     SCLogDebug("sgh non_pf ptr %p cnt %u (syn %p/%u, other %p/%u)",
             det_ctx->non_pf_store_ptr, det_ctx->non_pf_store_cnt,
@@ -736,6 +801,58 @@ static inline void DetectRunPrefilterPkt(
 #endif
 }
 
+/** \internal
+ *  \brief start the inspection budget of a packet or tx */
+static inline void DetectRunBudgetReset(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx)
+{
+    det_ctx->budget_exceeded = false;
+    det_ctx->budget_rules_cnt = 0;
+    if (de_ctx->budget_ticks != 0)
+        det_ctx->budget_ticks_start = UtilCpuGetTicks();
+}
+
+static void DetectRunBudgetExceeded(ThreadVars *tv,
+        const DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
+        Packet *p)
+{
+    det_ctx->budget_exceeded = true;
+    if (tv != NULL)
+        StatsIncr(tv, det_ctx->counter_budget_exceeded);
+    SCLogDebug("packet %"PRIu64" over the inspection budget", p->pcap_cnt);
+
+    if (de_ctx->budget_policy >= DETECT_BUDGET_POLICY_EVENT &&
+            !ENGINE_ISSET_EVENT(p, DETECT_INSPECTION_BUDGET_EXCEEDED)) {
+        ENGINE_SET_EVENT(p, DETECT_INSPECTION_BUDGET_EXCEEDED);
+    }
+    if (de_ctx->budget_policy == DETECT_BUDGET_POLICY_BYPASS &&
+            p->flow != NULL) {
+        PacketBypassCallback(p);
+    }
+}
+
+/** \internal
+ *  \brief account a rule inspection against the budget of the packet
+ *         or tx
+ *
+ *  \retval true if the rule is to be skipped
+ */
+static inline bool DetectRunBudgetSkip(ThreadVars *tv,
+        const DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
+        Packet *p, const Signature *s)
+{
+    if (!det_ctx->budget_exceeded) {
+        if (!((de_ctx->budget_rules != 0 &&
+                    ++det_ctx->budget_rules_cnt > de_ctx->budget_rules) ||
+              (de_ctx->budget_ticks != 0 &&
+                    UtilCpuGetTicks() - det_ctx->budget_ticks_start >
+                        de_ctx->budget_ticks)))
+            return false;
+        DetectRunBudgetExceeded(tv, de_ctx, det_ctx, p);
+    }
+    return s->prio > de_ctx->budget_priority;
+}
+
 static inline void DetectRulePacketRules(
     ThreadVars * const tv,
     DetectEngineCtx * const de_ctx,
@@ -767,6 +884,9 @@ static inline void DetectRulePacketRules(
 #endif
 #endif
 
+    if (unlikely(de_ctx->budget_enabled))
+        DetectRunBudgetReset(de_ctx, det_ctx);
+
     uint32_t sflags, next_sflags = 0;
     if (match_cnt) {
         next_s = *match_array++;
@@ -774,11 +894,10 @@ static inline void DetectRulePacketRules(
     }
     while (match_cnt--) {
         RULE_PROFILING_START(p);
+        RULE_SAMPLE_START(det_ctx);
         uint8_t alert_flags = 0;
         bool state_alert = false;
-#ifdef PROFILING
         bool smatch = false; /* signature match */
-#endif
         s = next_s;
         sflags = next_sflags;
         if (match_cnt) {
@@ -810,7 +929,7 @@ static inline void DetectRulePacketRules(
 
         /* if the sig has alproto and the session as well they should match */
         if (likely(sflags & SIG_FLAG_APPLAYER)) {
-            if (s->alproto != ALPROTO_UNKNOWN && s->alproto != scratch->alproto) {
+            if (s->alproto != ALPROTO_UNKNOWN && !DetectRunSigAppProtoMatch(s, scratch->alproto)) {
                 if (s->alproto == ALPROTO_DCERPC) {
                     if (scratch->alproto != ALPROTO_SMB) {
                         SCLogDebug("DCERPC sig, alproto not SMB");
@@ -823,6 +942,11 @@ static inline void DetectRulePacketRules(
             }
         }
 
+        if (unlikely(de_ctx->budget_enabled) &&
+                DetectRunBudgetSkip(tv, de_ctx, det_ctx, p, s)) {
+            goto next;
+        }
+
         if (DetectRunInspectRuleHeader(p, pflow, s, sflags, s_proto_flags) == 0) {
             goto next;
         }
@@ -871,9 +995,7 @@ static inline void DetectRulePacketRules(
         if (DetectRunInspectRulePacketMatches(tv, det_ctx, p, pflow, s) == 0)
             goto next;
 
-#ifdef PROFILING
         smatch = true;
-#endif
         DetectRunPostMatch(tv, det_ctx, p, s);
 
         if (!(sflags & SIG_FLAG_NOALERT)) {
@@ -888,6 +1010,7 @@ next:
         DetectVarProcessList(det_ctx, pflow, p);
         DetectReplaceFree(det_ctx);
         RULE_PROFILING_END(det_ctx, s, smatch, p);
+        RULE_SAMPLE_END(det_ctx, s, smatch);
 
         det_ctx->flags = 0;
         continue;
@@ -907,7 +1030,9 @@ static DetectRunScratchpad DetectRunSetup(
 
 #ifdef UNITTESTS
     p->alerts.cnt = 0;
+    p->alerts.discarded = 0;
 #endif
+    det_ctx->alert_queue_size = 0;
     det_ctx->ticker++;
     det_ctx->filestore_cnt = 0;
     det_ctx->base64_decoded_len = 0;
@@ -1013,6 +1138,10 @@ static inline void DetectRunPostRules(
     if (p->alerts.cnt > 0) {
         StatsAddUI64(tv, det_ctx->counter_alerts, (uint64_t)p->alerts.cnt);
     }
+    if (p->alerts.discarded > 0) {
+        StatsAddUI64(tv, det_ctx->counter_alerts_overflow,
+                (uint64_t)p->alerts.discarded);
+    }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_ALERT);
 }
 
@@ -1159,7 +1288,7 @@ static bool DetectRunTxInspectRule(ThreadVars *tv,
             return false;
         }
         /* stream mpm and negated mpm sigs can end up here with wrong proto */
-        if (!(f->alproto == s->alproto || s->alproto == ALPROTO_UNKNOWN)) {
+        if (!(DetectRunSigAppProtoMatch(s, f->alproto) || s->alproto == ALPROTO_UNKNOWN)) {
             TRACE_SID_TXS(s->id, tx, "alproto mismatch");
             return false;
         }
@@ -1393,6 +1522,9 @@ static void DetectRunTx(ThreadVars *tv,
             for (uint32_t i = 0; i < det_ctx->pmq.rule_id_array_cnt; i++) {
                 const Signature *s = de_ctx->sig_array[det_ctx->pmq.rule_id_array[i]];
                 const SigIntId id = s->num;
+                /* rules with stored state are added from the state below */
+                if (tx.de_state != NULL && DeStateHasSig(tx.de_state, id))
+                    continue;
                 det_ctx->tx_candidates[array_idx].s = s;
                 det_ctx->tx_candidates[array_idx].id = id;
                 det_ctx->tx_candidates[array_idx].flags = NULL;
@@ -1411,6 +1543,8 @@ static void DetectRunTx(ThreadVars *tv,
             const Signature *s = det_ctx->match_array[i];
             if (s->app_inspect != NULL) {
                 const SigIntId id = s->num;
+                if (tx.de_state != NULL && DeStateHasSig(tx.de_state, id))
+                    continue;
                 det_ctx->tx_candidates[array_idx].s = s;
                 det_ctx->tx_candidates[array_idx].id = id;
                 det_ctx->tx_candidates[array_idx].flags = NULL;
@@ -1437,30 +1571,24 @@ static void DetectRunTx(ThreadVars *tv,
                 tx.de_state->flags &= ~DETECT_ENGINE_STATE_FLAG_FILE_NEW;
             }
 
-            SigIntId state_cnt = 0;
-            DeStateStore *tx_store = tx.de_state->head;
-            for (; tx_store != NULL; tx_store = tx_store->next) {
-                SCLogDebug("tx_store %p", tx_store);
-
-                SigIntId store_cnt = 0;
-                for (store_cnt = 0;
-                        store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < tx.de_state->cnt;
-                        store_cnt++, state_cnt++)
-                {
-                    DeStateStoreItem *item = &tx_store->store[store_cnt];
-                    SCLogDebug("rule id %u, inspect_flags %u", item->sid, item->flags);
-                    if (have_new_file && (item->flags & DE_STATE_FLAG_FILE_INSPECT)) {
-                        /* remove part of the state. File inspect engine will now
-                         * be able to run again */
-                        item->flags &= ~(DE_STATE_FLAG_SIG_CANT_MATCH|DE_STATE_FLAG_FULL_INSPECT|DE_STATE_FLAG_FILE_INSPECT);
-                        SCLogDebug("rule id %u, post file reset inspect_flags %u", item->sid, item->flags);
-                    }
-                    det_ctx->tx_candidates[array_idx].s = de_ctx->sig_array[item->sid];
-                    det_ctx->tx_candidates[array_idx].id = item->sid;
-                    det_ctx->tx_candidates[array_idx].flags = &item->flags;
-                    det_ctx->tx_candidates[array_idx].stream_reset = 0;
-                    array_idx++;
+            for (SigIntId state_cnt = 0; state_cnt < tx.de_state->cnt; state_cnt++) {
+                DeStateStoreItem *item = &tx.de_state->store[state_cnt];
+                SCLogDebug("rule id %u, inspect_flags %u", item->sid, item->flags);
+                if (have_new_file && (item->flags & DE_STATE_FLAG_FILE_INSPECT)) {
+                    /* remove part of the state. File inspect engine will now
+                     * be able to run again */
+                    item->flags &= ~(DE_STATE_FLAG_SIG_CANT_MATCH|DE_STATE_FLAG_FULL_INSPECT|DE_STATE_FLAG_FILE_INSPECT);
+                    SCLogDebug("rule id %u, post file reset inspect_flags %u", item->sid, item->flags);
                 }
+                /* done with this rule for this tx, no need to consider it */
+                if (item->flags & (DE_STATE_FLAG_FULL_INSPECT|DE_STATE_FLAG_SIG_CANT_MATCH))
+                    continue;
+
+                det_ctx->tx_candidates[array_idx].s = de_ctx->sig_array[item->sid];
+                det_ctx->tx_candidates[array_idx].id = item->sid;
+                det_ctx->tx_candidates[array_idx].flags = &item->flags;
+                det_ctx->tx_candidates[array_idx].stream_reset = 0;
+                array_idx++;
             }
             if (old && old != array_idx) {
                 qsort(det_ctx->tx_candidates, array_idx, sizeof(RuleMatchCandidateTx),
@@ -1475,6 +1603,9 @@ static void DetectRunTx(ThreadVars *tv,
         det_ctx->tx_id_set = 1;
         det_ctx->p = p;
 
+        if (unlikely(de_ctx->budget_enabled))
+            DetectRunBudgetReset(de_ctx, det_ctx);
+
         /* run rules: inspect the match candidates */
         for (uint32_t i = 0; i < array_idx; i++) {
             RuleMatchCandidateTx *can = &det_ctx->tx_candidates[i];
@@ -1482,7 +1613,7 @@ static void DetectRunTx(ThreadVars *tv,
             uint32_t *inspect_flags = det_ctx->tx_candidates[i].flags;
 
             /* deduplicate: rules_array is sorted, but not deduplicated:
-             * both mpm and stored state could give us the same sid.
+             * both mpm and the 'match' list could give us the same sid.
              * As they are back to back in that case we can check for it
              * here. We select the stored state one. */
             if ((i + 1) < array_idx) {
@@ -1523,8 +1654,15 @@ static void DetectRunTx(ThreadVars *tv,
                 SCLogDebug("%p/%"PRIu64" Start sid %u", tx.tx_ptr, tx.tx_id, s->id);
             }
 
+            /* skipped rules are inspected again with the next packet */
+            if (unlikely(de_ctx->budget_enabled) &&
+                    DetectRunBudgetSkip(tv, de_ctx, det_ctx, p, s)) {
+                continue;
+            }
+
             /* call individual rule inspection */
             RULE_PROFILING_START(p);
+            RULE_SAMPLE_START(det_ctx);
             const int r = DetectRunTxInspectRule(tv, de_ctx, det_ctx, p, f, flow_flags,
                     alstate, &tx, s, inspect_flags, can, scratch);
             if (r == 1) {
@@ -1544,6 +1682,7 @@ static void DetectRunTx(ThreadVars *tv,
             }
             DetectVarProcessList(det_ctx, p->flow, p);
             RULE_PROFILING_END(det_ctx, s, r, p);
+            RULE_SAMPLE_END(det_ctx, s, r == 1);
         }
 
         det_ctx->tx_id = 0;
@@ -1579,6 +1718,8 @@ static void DetectRunTx(ThreadVars *tv,
                     flow_flags, new_detect_flags);
         }
 next:
+        if (unlikely(g_detect_record_buffers))
+            DetectBufferRecordTx(de_ctx, det_ctx, ipproto, alproto, flow_flags);
         InspectionBufferClean(det_ctx);
 
         if (!ires.has_next)
@@ -1610,12 +1751,9 @@ void DetectSignatureApplyActions(Packet *p,
     }
 }
 
-static DetectEngineThreadCtx *GetTenantById(HashTable *h, uint32_t id)
+static DetectEngineThreadCtx *GetTenantById(const DetectTenantHash *h, uint32_t id)
 {
-    /* technically we need to pass a DetectEngineThreadCtx struct with the
-     * tentant_id member. But as that member is the first in the struct, we
-     * can use the id directly. */
-    return HashTableLookup(h, &id, 0);
+    return DetectTenantHashLookup(h, id);
 }
 
 static void DetectFlow(ThreadVars *tv,
@@ -1687,6 +1825,8 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
         (void)SC_ATOMIC_SET(det_ctx->so_far_used_by_detect, 1);
         SCLogDebug("Detect Engine using new det_ctx - %p",
                   det_ctx);
+        /* tenant ctxs add their memory when they are set up */
+        StatsSetUI64(tv, det_ctx->counter_memuse, det_ctx->memuse);
     }
 
     /* if in MT mode _and_ we have tenants registered, use
@@ -1701,6 +1841,10 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
             det_ctx = GetTenantById(det_ctx->mt_det_ctxs_hash, tenant_id);
             if (det_ctx == NULL)
                 return TM_ECODE_OK;
+            if (unlikely(det_ctx->init_pending)) {
+                if (DetectEngineThreadCtxInitLazy(tv, det_ctx) != TM_ECODE_OK)
+                    return TM_ECODE_OK;
+            }
             de_ctx = det_ctx->de_ctx;
             if (de_ctx == NULL)
                 return TM_ECODE_OK;
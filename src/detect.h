@@ -39,6 +39,7 @@
 #include "util-spm.h"
 #include "util-hash.h"
 #include "util-hashlist.h"
+#include "util-hash-open.h"
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-radix-tree.h"
@@ -210,6 +211,15 @@ typedef struct DetectPort_ {
     struct DetectPort_ *next;
 } DetectPort;
 
+/** \brief port to rule group lookup table, built from a DetectPort list */
+typedef struct DetectPortLookupTable_ {
+    /** per port index into sgh, 0 for ports without a group */
+    uint16_t idx[65536];
+    uint32_t sgh_cnt;
+    /** rule groups, sgh[0] is NULL */
+    struct SigGroupHead_ **sgh;
+} DetectPortLookupTable;
+
 /* Signature flags */
 /** \note: additions should be added to the rule analyzer as well */
 
@@ -222,8 +232,9 @@ typedef struct DetectPort_ {
 #define SIG_FLAG_DSIZE                  BIT_U32(5)  /**< signature has a dsize setting */
 #define SIG_FLAG_APPLAYER               BIT_U32(6)  /**< signature applies to app layer instead of packets */
 #define SIG_FLAG_IPONLY                 BIT_U32(7)  /**< ip only signature */
-
-// vacancy
+/** http sig that can inspect http2 flows: all its http buffers have a
+ *  http2 engine */
+#define SIG_FLAG_HTTP2                  BIT_U32(8)
 
 #define SIG_FLAG_REQUIRE_PACKET         BIT_U32(9)  /**< signature is requiring packet match */
 #define SIG_FLAG_REQUIRE_STREAM         BIT_U32(10) /**< signature is requiring stream match */
@@ -254,6 +265,8 @@ typedef struct DetectPort_ {
 #define SIG_FLAG_SRC_IS_TARGET          BIT_U32(25)
 /** Info for Source and Target identification */
 #define SIG_FLAG_DEST_IS_TARGET         BIT_U32(26)
+/** sig has flow:encrypted, so wants the raw payload mpm on encrypted flows */
+#define SIG_FLAG_ENCRYPTED              BIT_U32(27)
 
 #define SIG_FLAG_HAS_TARGET             (SIG_FLAG_DEST_IS_TARGET|SIG_FLAG_SRC_IS_TARGET)
 
@@ -331,6 +344,8 @@ typedef struct SigMatch_ {
 typedef struct SigMatchData_ {
     uint8_t type; /**< match type */
     uint8_t is_last; /**< Last element of the list */
+    uint8_t ci_fast; /**< content inspection fast path, DETECT_CI_FAST_*.
+                      *   Only set on the first element of the list */
     SigMatchCtx *ctx; /**< plugin specific data */
 } SigMatchData;
 
@@ -355,6 +370,12 @@ typedef struct InspectionBuffer {
 
     uint32_t orig_len;
     const uint8_t *orig;
+
+    /** lowercase copy of ::inspect for nocase content inspection, created
+     *  on first use. See InspectionBufferGetLowercase() */
+    bool lc_set;
+    uint32_t lc_size;
+    uint8_t *lc;
 } InspectionBuffer;
 
 /* inspection buffers are kept per tx (in det_ctx), but some protocols
@@ -404,6 +425,9 @@ typedef struct DetectEngineAppInspectionEngine_ {
     uint16_t stream:1;
     uint16_t sm_list:14;
     int16_t progress;
+    /** list has nocase content that can be searched in a lowercase copy
+     *  of the buffer */
+    bool lowercase;
 
     /* \retval 0 No match.  Don't discontinue matching yet.  We need more data.
      *         1 Match.
@@ -589,16 +613,37 @@ typedef struct DetectMpmAppLayerRegistery_ {
         DetectEngineTransforms transforms;
     } v2;
 
+    /** small buffer: its prefilter may share one mpm ctx and one
+     *  vectored search with the others of the tx progress, see
+     *  detect.prefilter.batch */
+    bool batchable;
+
     int id;                     /**< index into this array and result arrays */
 
     struct DetectMpmAppLayerRegistery_ *next;
 } DetectMpmAppLayerRegistery;
 
+#define DETECT_MPM_BATCH_MAX 8
+
+/** \brief batchable buffers of the same app layer proto, direction and
+ *         tx progress, that are prefiltered as one */
+typedef struct DetectMpmAppLayerBatch_ {
+    char pname[128];            /**< engine name, the buffer names */
+    int direction;
+    AppProto alproto;
+    int tx_min_progress;
+    uint32_t id;                /**< index into de_ctx::app_mpm_batches */
+    uint32_t cnt;
+    const DetectMpmAppLayerRegistery *regs[DETECT_MPM_BATCH_MAX];
+} DetectMpmAppLayerBatch;
+
 /** \brief structure for storing per detect engine mpm keyword settings
  */
 typedef struct DetectMpmAppLayerKeyword_ {
     const DetectMpmAppLayerRegistery *reg;
     int32_t sgh_mpm_context;    /**< mpm factory id */
+    /** batch the buffer is prefiltered in, NULL if none */
+    const DetectMpmAppLayerBatch *batch;
 } DetectMpmAppLayerKeyword;
 
 typedef struct DetectReplaceList_ {
@@ -629,6 +674,22 @@ typedef struct DetectEngineIPOnlyThreadCtx_ {
     uint32_t sig_match_size;  /* size in bytes of the array */
 } DetectEngineIPOnlyThreadCtx;
 
+/** \brief IPv4 longest prefix match table of the IP only engine.
+ *
+ *  DIR-16-8-8 layout: a 64k entry first level indexed by the upper 16 bits
+ *  of the address, then 256 entry chunks for the next 8 bits and the last
+ *  8 bits. An entry is either an index into results or, with
+ *  IPONLY_LPM_CHUNK set, the index of the next level chunk. */
+typedef struct IPOnlyLpm4_ {
+    uint32_t *tbl16;
+    uint32_t *chunks;
+    uint32_t chunks_cnt;
+    uint32_t chunks_size;
+    /* SigNumArrays owned by the radix tree, 0 means no match */
+    struct SigNumArray_ **results;
+    uint32_t results_cnt;
+} IPOnlyLpm4;
+
 /** \brief IP only rules matching ctx. */
 typedef struct DetectEngineIPOnlyCtx_ {
     /* lookup hashes */
@@ -639,6 +700,10 @@ typedef struct DetectEngineIPOnlyCtx_ {
     SCRadixTree *tree_ipv4src, *tree_ipv4dst;
     SCRadixTree *tree_ipv6src, *tree_ipv6dst;
 
+    /* IPv4 lookup tables built from the radix trees. If the table for
+     * a direction is not built (tbl16 NULL) the radix tree is used. */
+    IPOnlyLpm4 lpm_ipv4src, lpm_ipv4dst;
+
     /* Used to build the radix trees */
     IPOnlyCIDRItem *ip_src, *ip_dst;
 
@@ -656,11 +721,19 @@ typedef struct DetectEngineIPOnlyCtx_ {
     /* number of sigs in this head */
     uint32_t sig_cnt;
     uint32_t *match_array;
+
+    /* lookup memory, for the stats and the engine analysis */
+    uint32_t prefix_cnt;
+    uint64_t sna_memuse;    /**< SigNumArrays and their sparse lists */
+    uint64_t lpm_memuse;    /**< IPv4 lookup tables */
 } DetectEngineIPOnlyCtx;
 
 typedef struct DetectEngineLookupFlow_ {
     DetectPort *tcp;
     DetectPort *udp;
+    /** lookup tables built from the tcp and udp lists */
+    DetectPortLookupTable *tcp_ports;
+    DetectPortLookupTable *udp_ports;
     struct SigGroupHead_ *sgh[256];
 } DetectEngineLookupFlow;
 
@@ -712,6 +785,15 @@ enum DetectEnginePrefilterSetting
     DETECT_PREFILTER_AUTO = 1,  /**< use mpm + keyword prefilters */
 };
 
+/** what to do when a packet or tx is over the inspection budget, each
+ *  policy also does what the ones before it do */
+enum DetectEngineBudgetPolicy
+{
+    DETECT_BUDGET_POLICY_SKIP = 0,  /**< skip the low priority rules */
+    DETECT_BUDGET_POLICY_EVENT = 1, /**< set an engine event */
+    DETECT_BUDGET_POLICY_BYPASS = 2,/**< bypass the flow */
+};
+
 enum DetectEngineType
 {
     DETECT_ENGINE_TYPE_NORMAL = 0,
@@ -730,12 +812,6 @@ typedef struct DetectEngineCtx_ {
     Signature *sig_list;
     uint32_t sig_cnt;
 
-    /* version of the srep data */
-    uint32_t srep_version;
-
-    /* reputation for netblocks */
-    SRepCIDRTree *srepCIDR_ctx;
-
     Signature **sig_array;
     uint32_t sig_array_size; /* size in bytes */
     uint32_t sig_array_len;  /* size in array members */
@@ -865,6 +941,45 @@ typedef struct DetectEngineCtx_ {
     /** are we useing just mpm or also other prefilters */
     enum DetectEnginePrefilterSetting prefilter_setting;
 
+    /** resume the raw stream mpm scan where the previous one ended */
+    bool prefilter_stream_state;
+
+    /** prefilter the small tx buffers of batches with one search */
+    bool prefilter_batch;
+
+    /** unique mpm ctx' with up to this many patterns use teddy, 0 to
+     *  disable */
+    uint32_t mpm_teddy_max_patterns;
+
+    /** matcher for unique mpm ctx' with many pattern bytes, MPM_NOTSET
+     *  to use mpm_matcher */
+    uint16_t mpm_matcher_large;
+    /** pattern bytes from which a packet or stream mpm ctx uses
+     *  mpm_matcher_large, app-layer ones need MPM_LARGE_APP_FACTOR times
+     *  as many */
+    uint32_t mpm_large_pattern_bytes;
+
+    /** matchers used by the mpm stores, BIT_U32(mpm_type) */
+    uint32_t mpm_matchers_used;
+
+    /** use the prepared mpm ctx' of other engines with the same patterns */
+    bool mpm_ctx_sharing;
+
+    /** fast pattern hit stats, see detect-engine-fpstats.c */
+    struct DetectFPStats_ *fp_stats;
+
+    /** sampled rule profiling, see detect-engine-rule-sample.c */
+    struct DetectRuleSample_ *rule_sample;
+
+    /** inspection budget per packet and per tx, see
+     *  detect.inspection-budget */
+    bool budget_enabled;
+    uint8_t budget_policy;  /**< DETECT_BUDGET_POLICY_* */
+    /** rules with a priority up to this are inspected over budget */
+    int budget_priority;
+    uint32_t budget_rules;  /**< max rules to inspect, 0 for no limit */
+    uint64_t budget_ticks;  /**< max ticks to spend, 0 for no limit */
+
     HashListTable *dport_hash_table;
 
     DetectPort *tcp_whitelist;
@@ -897,10 +1012,17 @@ typedef struct DetectEngineCtx_ {
      *  \todo we only need this at init, so perhaps this
      *        can move to a DetectEngineCtx 'init' struct */
     DetectMpmAppLayerKeyword *app_mpms;
+    DetectMpmAppLayerBatch *app_mpm_batches;
+    uint32_t app_mpm_batches_cnt;
 
     /** time of last ruleset reload */
     struct timeval last_reload;
 
+    /** digests of the rule files and of the yaml this engine was built
+     *  from, 0 if unknown. Used to skip reloads that change nothing. */
+    uint64_t sig_files_digest;
+    uint64_t conf_digest;
+
     /** signatures stats */
     SigFileLoaderStat sig_stat;
 
@@ -945,6 +1067,23 @@ typedef struct SignatureNonPrefilterStore_ {
     uint8_t alproto;
 } SignatureNonPrefilterStore;
 
+/** non prefilter rules of a store with the same mask and alproto */
+typedef struct SignatureNonPrefilterBucket_ {
+    SignatureMask mask;
+    uint8_t alproto;
+    uint32_t cnt;
+    SigIntId *ids;  /**< sorted, points into SignatureNonPrefilterBuckets::ids */
+} SignatureNonPrefilterBucket;
+
+/** non prefilter store grouped by mask and alproto, so that a packet
+ *  only visits the rules its mask and alproto allow. Not set up if the
+ *  rules of the store have too little in common. */
+typedef struct SignatureNonPrefilterBuckets_ {
+    uint32_t cnt;
+    SignatureNonPrefilterBucket *array;
+    SigIntId *ids;
+} SignatureNonPrefilterBuckets;
+
 /** array of TX inspect rule candidates */
 typedef struct RuleMatchCandidateTx {
     SigIntId id;            /**< internal signature id */
@@ -963,9 +1102,10 @@ typedef struct RuleMatchCandidateTx {
 /**
   * Detection engine thread data.
   */
+/** tenant id to DetectEngineThreadCtx, see DetectTenantHashLookup() */
+OPEN_HASH_HEAD(DetectTenantHash, struct DetectEngineThreadCtx_);
+
 typedef struct DetectEngineThreadCtx_ {
-    /** \note multi-tenant hash lookup code from Detect() *depends*
-     *        on this beeing the first member */
     uint32_t tenant_id;
 
     /** ticker that is incremented once per packet. */
@@ -979,7 +1119,20 @@ typedef struct DetectEngineThreadCtx_ {
 
     uint32_t mt_det_ctxs_cnt;
     struct DetectEngineThreadCtx_ **mt_det_ctxs;
-    HashTable *mt_det_ctxs_hash;
+    DetectTenantHash *mt_det_ctxs_hash;
+
+    /** tenant ctx that is set up on the first packet for the tenant */
+    bool init_pending;
+    /** memory allocated for this ctx, in bytes */
+    uint64_t memuse;
+
+    /** bitmap with a bit per sid, used to sort the prefilter results.
+     *  All zero between uses. */
+    uint64_t *pf_sid_bitmap;
+    uint32_t pf_sid_bitmap_size;    /**< in number of elements */
+    /** tx the current tx prefilter engine may store its result in, set
+     *  if the engine will run on the tx again. See PrefilterMpm(). */
+    struct DetectTransaction_ *pf_tx;
 
     struct DetectEngineTenantMapping_ *tenant_array;
     uint32_t tenant_array_size;
@@ -1001,6 +1154,12 @@ typedef struct DetectEngineThreadCtx_ {
 
     /** id for alert counter */
     uint16_t counter_alerts;
+    /** id for the counter of alerts not fitting in the packet */
+    uint16_t counter_alerts_overflow;
+    /** id for the counter of packets and txs over the inspection budget */
+    uint16_t counter_budget_exceeded;
+    /** id for the counter of the memory used by the thread ctxs */
+    uint16_t counter_memuse;
 #ifdef PROFILING
     uint16_t counter_mpm_list;
     uint16_t counter_nonmpm_list;
@@ -1041,6 +1200,11 @@ typedef struct DetectEngineThreadCtx_ {
     /* holds the current recursion depth on content inspection */
     int inspection_recursion_counter;
 
+    /** lowercase copy of the buffer in inspection: nocase content is
+     *  searched in inspect_lc if the buffer is inspect_lc_orig */
+    const uint8_t *inspect_lc;
+    const uint8_t *inspect_lc_orig;
+
     /** array of signature pointers we're going to inspect in the detection
      *  loop. */
     Signature **match_array;
@@ -1053,8 +1217,28 @@ typedef struct DetectEngineThreadCtx_ {
     RuleMatchCandidateTx *tx_candidates;
     uint32_t tx_candidates_size;
 
+    /** alerts of the packet in inspection, in order of Signature::num.
+     *  Moved to the packet by PacketAlertFinalize() */
+    PacketAlert *alert_queue;
+    uint16_t alert_queue_size;
+    uint16_t alert_queue_capacity;
+
+    /** inspection budget of the current packet or tx */
+    bool budget_exceeded;
+    uint32_t budget_rules_cnt;
+    uint64_t budget_ticks_start;
+
+    /** rule inspections since the last sample */
+    uint32_t rule_sample_cnt;
+    /** sampled rule profiling counters, allocated at the first sample */
+    struct DetectRuleSampleThread_ *rule_sample;
+
     SignatureNonPrefilterStore *non_pf_store_ptr;
     uint32_t non_pf_store_cnt;
+    const SignatureNonPrefilterBuckets *non_pf_buckets;
+    /** scratch space for merging the ids of the buckets, same size as
+     *  non_pf_id_array */
+    SigIntId *non_pf_id_array_tmp;
 
     /** pointer to the current mpm ctx that is stored
      *  in a rule group head -- can be either a content
@@ -1062,6 +1246,7 @@ typedef struct DetectEngineThreadCtx_ {
     MpmThreadCtx mtc;   /**< thread ctx for the mpm */
     MpmThreadCtx mtcu;  /**< thread ctx for uricontent mpm */
     MpmThreadCtx mtcs;  /**< thread ctx for stream mpm */
+    uint16_t mtc_matcher;   /**< matcher mtc was prepared for */
     PrefilterRuleStore pmq;
 
     /** SPM thread context used for scanning. This has been cloned from the
@@ -1197,6 +1382,8 @@ enum {
 #define SIG_GROUP_HEAD_HAVEFILESIZE     BIT_U32(22)
 #define SIG_GROUP_HEAD_HAVEFILESHA1     BIT_U32(23)
 #define SIG_GROUP_HEAD_HAVEFILESHA256   BIT_U32(24)
+/** a sig wants the payload mpm to run on encrypted flows */
+#define SIG_GROUP_HEAD_HAVEENCRYPTED    BIT_U32(25)
 
 enum MpmBuiltinBuffers {
     MPMB_TCP_PKT_TS,
@@ -1220,6 +1407,23 @@ typedef struct MpmStore_ {
 
     MpmCtx *mpm_ctx;
 
+    /** number of rule groups using the store */
+    uint32_t sgh_cnt;
+    /** time spent preparing the mpm ctx, for the engine analysis */
+    uint64_t prepare_usecs;
+
+    /** key of the ctx in the mpm ctx cache, until the ctx is added to it */
+    uint8_t *cache_key;
+    uint32_t cache_key_len;
+    uint32_t cache_hash;
+    /** cache entry of the ctx, NULL if the store owns it */
+    struct MpmCtxCacheEntry_ *cache_entry;
+    /** ctx was built by another engine */
+    bool shared;
+
+    /** store of the buffers of a batch, sm_list is -1 */
+    const DetectMpmAppLayerBatch *batch;
+
 } MpmStore;
 
 typedef struct PrefilterEngineList_ {
@@ -1276,7 +1480,8 @@ typedef struct PrefilterEngine_ {
 } PrefilterEngine;
 
 typedef struct SigGroupHeadInitData_ {
-    MpmStore mpm_store[MPMB_MAX];
+    /** builtin mpm stores used by the group */
+    MpmStore *mpm_store[MPMB_MAX];
 
     uint8_t *sig_array; /**< bit array of sig nums (internal id's) */
     uint32_t sig_size; /**< size in bytes */
@@ -1285,7 +1490,13 @@ typedef struct SigGroupHeadInitData_ {
     uint32_t direction;     /**< set to SIG_FLAG_TOSERVER, SIG_FLAG_TOCLIENT or both */
     int whitelist;          /**< try to make this group a unique one */
 
-    MpmCtx **app_mpms;
+    /** app layer mpm stores used by the group, indexed by the
+     *  DetectMpmAppLayerRegistery id */
+    MpmStore **app_mpms;
+
+    /** time spent setting up the prefilter engines and the non-prefilter
+     *  rule lists, for the engine analysis */
+    uint64_t build_usecs;
 
     PrefilterEngineList *pkt_engines;
     PrefilterEngineList *payload_engines;
@@ -1309,6 +1520,9 @@ typedef struct SigGroupHead_ {
     SignatureNonPrefilterStore *non_pf_other_store_array; // size is non_mpm_store_cnt * sizeof(SignatureNonPrefilterStore)
     /* non mpm list including SYN rules */
     SignatureNonPrefilterStore *non_pf_syn_store_array; // size is non_mpm_syn_store_cnt * sizeof(SignatureNonPrefilterStore)
+    /* the non prefilter lists above grouped by mask */
+    SignatureNonPrefilterBuckets non_pf_other_buckets;
+    SignatureNonPrefilterBuckets non_pf_syn_buckets;
 
     /** the number of signatures in this sgh that have the filestore keyword
      *  set. */
@@ -1361,6 +1575,7 @@ enum DetectEngineTenantSelectors
     TENANT_SELECTOR_DIRECT,         /**< method provides direct tenant id */
     TENANT_SELECTOR_VLAN,           /**< map vlan to tenant id */
     TENANT_SELECTOR_LIVEDEV,        /**< map livedev to tenant id */
+    TENANT_SELECTOR_VNI,            /**< map vxlan/geneve vni to tenant id */
 };
 
 typedef struct DetectEngineTenantMapping_ {
@@ -1426,6 +1641,8 @@ void SigAddressPrepareBidirectionals (DetectEngineCtx *);
 void DisableDetectFlowFileFlags(Flow *f);
 char *DetectLoadCompleteSigPath(const DetectEngineCtx *, const char *sig_file);
 int SigLoadSignatures (DetectEngineCtx *, char *, int);
+int DetectFileDigest(const char *, uint64_t *);
+int SigFilesDigest(DetectEngineCtx *, char *, int, uint64_t *);
 void SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx,
                        DetectEngineThreadCtx *det_ctx, Packet *p);
 
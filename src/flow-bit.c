@@ -43,11 +43,13 @@
 #include "util-unittest.h"
 
 /* get the flowbit with idx from the flow */
-static FlowBit *FlowBitGet(Flow *f, uint32_t idx)
+/* get the flow's bits. They are added at the head of the list, so
+ * normally the loop doesn't run */
+static FlowBit *FlowBitGetAll(const Flow *f)
 {
     GenericVar *gv = f->flowvar;
     for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
+        if (gv->type == DETECT_FLOWBITS) {
             return (FlowBit *)gv;
         }
     }
@@ -55,19 +57,43 @@ static FlowBit *FlowBitGet(Flow *f, uint32_t idx)
     return NULL;
 }
 
-/* add a flowbit to the flow */
+static inline int FlowBitTest(const FlowBit *fb, uint32_t idx)
+{
+    return (fb != NULL && idx < fb->size &&
+            (fb->bits[idx >> 6] & (1ULL << (idx & 63))) != 0);
+}
+
+/* get the flow's bits if bit idx is set */
+static FlowBit *FlowBitGet(Flow *f, uint32_t idx)
+{
+    FlowBit *fb = FlowBitGetAll(f);
+    return FlowBitTest(fb, idx) ? fb : NULL;
+}
+
 static void FlowBitAdd(Flow *f, uint32_t idx)
 {
-    FlowBit *fb = FlowBitGet(f, idx);
+    FlowBit *fb = FlowBitGetAll(f);
     if (fb == NULL) {
-        fb = SCMalloc(sizeof(FlowBit));
+        fb = SCCalloc(1, sizeof(FlowBit));
         if (unlikely(fb == NULL))
             return;
 
         fb->type = DETECT_FLOWBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        GenericVarAppend(&f->flowvar, (GenericVar *)fb);
+        fb->next = f->flowvar;
+        f->flowvar = (GenericVar *)fb;
+    }
+    if (idx >= fb->size) {
+        const uint32_t new_size = (idx | 63) + 1;
+        uint64_t *bits = SCRealloc(fb->bits, (new_size / 64) * sizeof(uint64_t));
+        if (unlikely(bits == NULL))
+            return;
+        memset(bits + fb->size / 64, 0, ((new_size - fb->size) / 64) * sizeof(uint64_t));
+        fb->bits = bits;
+        fb->size = new_size;
+    }
+    if (!FlowBitTest(fb, idx)) {
+        fb->bits[idx >> 6] |= (1ULL << (idx & 63));
+        fb->cnt++;
     }
 }
 
@@ -77,8 +103,11 @@ static void FlowBitRemove(Flow *f, uint32_t idx)
     if (fb == NULL)
         return;
 
-    GenericVarRemove(&f->flowvar, (GenericVar *)fb);
-    FlowBitFree(fb);
+    fb->bits[idx >> 6] &= ~(1ULL << (idx & 63));
+    if (--fb->cnt == 0) {
+        GenericVarRemove(&f->flowvar, (GenericVar *)fb);
+        FlowBitFree(fb);
+    }
 }
 
 void FlowBitSet(Flow *f, uint32_t idx)
@@ -103,26 +132,28 @@ void FlowBitToggle(Flow *f, uint32_t idx)
 
 int FlowBitIsset(Flow *f, uint32_t idx)
 {
-    int r = 0;
-
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
-        r = 1;
-    }
-
-    return r;
+    return FlowBitTest(FlowBitGetAll(f), idx);
 }
 
 int FlowBitIsnotset(Flow *f, uint32_t idx)
 {
-    int r = 0;
+    return !FlowBitTest(FlowBitGetAll(f), idx);
+}
 
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        r = 1;
+/** \brief find the next set bit from *idx on
+ *  \retval 1 found, *idx is updated to the bit
+ *  \retval 0 no more bits */
+int FlowBitNext(const FlowBit *fb, uint32_t *idx)
+{
+    for (uint32_t i = *idx; i < fb->size; ) {
+        const uint64_t word = fb->bits[i >> 6] >> (i & 63);
+        if (word != 0) {
+            *idx = i + __builtin_ctzll(word);
+            return 1;
+        }
+        i = (i | 63) + 1;
     }
-
-    return r;
+    return 0;
 }
 
 void FlowBitFree(FlowBit *fb)
@@ -130,11 +161,12 @@ void FlowBitFree(FlowBit *fb)
     if (fb == NULL)
         return;
 
+    if (fb->bits != NULL)
+        SCFree(fb->bits);
     SCFree(fb);
 }
 
 
-/* TESTS */
 #ifdef UNITTESTS
 static int FlowBitTest01 (void)
 {
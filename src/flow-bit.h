@@ -27,16 +27,20 @@
 #include "flow.h"
 #include "util-var.h"
 
+/** all flowbits of a flow, as a bitmap indexed by the name idx. It's
+ *  kept at the head of the flow's GenericVar list. */
 typedef struct FlowBit_ {
     uint8_t type; /* type, DETECT_FLOWBITS in this case */
     uint8_t pad[3];
-    uint32_t idx; /* name idx */
-    GenericVar *next; /* right now just implement this as a list,
-                       * in the long run we have think of something
-                       * faster. */
+    uint32_t idx; /* unused */
+    GenericVar *next;
+    uint32_t size; /* number of bits there is room for, multiple of 64 */
+    uint32_t cnt;  /* number of bits set */
+    uint64_t *bits;
 } FlowBit;
 
 void FlowBitFree(FlowBit *);
+int FlowBitNext(const FlowBit *, uint32_t *);
 void FlowBitRegisterTests(void);
 
 void FlowBitSet(Flow *, uint32_t);
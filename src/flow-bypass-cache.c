@@ -0,0 +1,277 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per thread cache of locally bypassed flows, used by the flow worker
+ * before the flow lookup. It works with any capture method.
+ *
+ * An entry only takes a slot from another flow once the counters of that
+ * flow are added to it, or when these are older than the refresh interval:
+ * the packets of a flow that stopped in the last seconds of its bypass are
+ * then not added to its counters.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-util.h"
+#include "flow-bypass.h"
+#include "flow-bypass-cache.h"
+
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+/**
+ *  \brief Allocate the cache of a thread
+ *
+ *  \retval c cache or NULL if disabled or the flow memcap doesn't allow it
+ */
+FlowBypassCache *FlowBypassCacheAlloc(ThreadVars *tv)
+{
+    if (flow_config.bypass_cache_size == 0)
+        return NULL;
+
+    const uint64_t size = sizeof(FlowBypassCache) +
+        (uint64_t)flow_config.bypass_cache_size * sizeof(FlowBypassCacheEntry);
+    if (!(FLOW_CHECK_MEMCAP(size))) {
+        SCLogWarning(SC_ERR_FLOW_INIT, "flow memcap reached, thread "
+                "will not use a bypass cache");
+        return NULL;
+    }
+
+    FlowBypassCache *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    c->entries = SCCalloc(flow_config.bypass_cache_size,
+            sizeof(FlowBypassCacheEntry));
+    if (unlikely(c->entries == NULL)) {
+        SCFree(c);
+        return NULL;
+    }
+    c->mask = flow_config.bypass_cache_size - 1;
+    MemcapCounterIncr(&flow_memuse, size);
+
+    if (tv != NULL) {
+        c->counter_hit = StatsRegisterCounter("flow_bypassed.local_cache_pkts", tv);
+    }
+    return c;
+}
+
+void FlowBypassCacheFree(FlowBypassCache *c)
+{
+    if (c == NULL)
+        return;
+
+    MemcapCounterDecr(&flow_memuse, sizeof(FlowBypassCache) +
+            (uint64_t)(c->mask + 1) * sizeof(FlowBypassCacheEntry));
+    SCFree(c->entries);
+    SCFree(c);
+}
+
+/**
+ *  \brief see if an entry is for the flow of a packet
+ *
+ *  \retval 0 no match
+ *  \retval 1 packet is from src to dst
+ *  \retval 2 packet is from dst to src
+ */
+static inline int FlowBypassCacheMatch(const FlowBypassCacheEntry *e,
+        const Packet *p)
+{
+    if (e->proto != p->proto ||
+            e->recursion_level != p->recursion_level ||
+            e->vlan_id[0] != p->vlan_id[0] ||
+            e->vlan_id[1] != p->vlan_id[1] ||
+            e->domain_id != p->domain_id)
+        return 0;
+
+    if (CMP_ADDR(&e->src, &p->src) && CMP_ADDR(&e->dst, &p->dst) &&
+            CMP_PORT(e->sp, p->sp) && CMP_PORT(e->dp, p->dp))
+        return 1;
+    if (CMP_ADDR(&e->src, &p->dst) && CMP_ADDR(&e->dst, &p->src) &&
+            CMP_PORT(e->sp, p->dp) && CMP_PORT(e->dp, p->sp))
+        return 2;
+    return 0;
+}
+
+/**
+ *  \brief Count a packet of a bypassed flow in the cache
+ *
+ *  \retval 1 the packet is part of a bypassed flow and was counted, the
+ *            flow isn't looked up
+ *  \retval 0 look up the flow
+ */
+int FlowBypassCacheLookup(ThreadVars *tv, FlowBypassCache *c, const Packet *p)
+{
+    /* the cache is only for plain TCP and UDP */
+    if (p->tcph == NULL && p->udph == NULL)
+        return 0;
+
+    FlowBypassCacheEntry *e = &c->entries[p->flow_hash & c->mask];
+    if (e->refresh_ts == 0 || (uint32_t)p->ts.tv_sec >= e->refresh_ts)
+        return 0;
+
+    const int dir = FlowBypassCacheMatch(e, p);
+    if (dir == 0)
+        return 0;
+
+    if ((dir == 1) == (e->toserver != 0)) {
+        e->todstpktcnt++;
+        e->todstbytecnt += GET_PKT_LEN(p);
+    } else {
+        e->tosrcpktcnt++;
+        e->tosrcbytecnt += GET_PKT_LEN(p);
+    }
+    StatsIncr(tv, c->counter_hit);
+    return 1;
+}
+
+/**
+ *  \brief Add the cached counters to the flow of a packet and cache the
+ *         flow if it is locally bypassed
+ *
+ *  Called for packets the flow worker doesn't inspect, with the flow
+ *  locked and the packet already counted in it.
+ *
+ *  \param f locked flow of the packet
+ */
+void FlowBypassCacheUpdate(FlowBypassCache *c, Flow *f, Packet *p)
+{
+    if (p->tcph == NULL && p->udph == NULL)
+        return;
+
+    FlowBypassCacheEntry *e = &c->entries[p->flow_hash & c->mask];
+    const int state = SC_ATOMIC_GET(f->flow_state);
+    const int dir = e->refresh_ts ? FlowBypassCacheMatch(e, p) : 0;
+
+    if (dir != 0) {
+        if (state == FLOW_STATE_LOCAL_BYPASSED &&
+                (e->todstpktcnt != 0 || e->tosrcpktcnt != 0)) {
+            f->todstpktcnt += e->todstpktcnt;
+            f->todstbytecnt += e->todstbytecnt;
+            f->tosrcpktcnt += e->tosrcpktcnt;
+            f->tosrcbytecnt += e->tosrcbytecnt;
+            BypassedFlowUpdate(f, p);
+        }
+    } else if (e->refresh_ts != 0 &&
+            (uint32_t)p->ts.tv_sec < e->refresh_ts &&
+            (e->todstpktcnt != 0 || e->tosrcpktcnt != 0)) {
+        /* slot in use by a flow with counters not added to it yet */
+        return;
+    }
+
+    if (state != FLOW_STATE_LOCAL_BYPASSED) {
+        if (dir != 0)
+            e->refresh_ts = 0;
+        return;
+    }
+
+    COPY_ADDRESS(&p->src, &e->src);
+    COPY_ADDRESS(&p->dst, &e->dst);
+    e->sp = p->sp;
+    e->dp = p->dp;
+    e->proto = p->proto;
+    e->recursion_level = p->recursion_level;
+    e->toserver = (p->flowflags & FLOW_PKT_TOSERVER) ? 1 : 0;
+    e->vlan_id[0] = p->vlan_id[0];
+    e->vlan_id[1] = p->vlan_id[1];
+    e->domain_id = p->domain_id;
+    e->refresh_ts = (uint32_t)p->ts.tv_sec + FLOW_BYPASS_CACHE_REFRESH;
+    e->todstpktcnt = 0;
+    e->tosrcpktcnt = 0;
+    e->todstbytecnt = 0;
+    e->tosrcbytecnt = 0;
+}
+
+#ifdef UNITTESTS
+/**
+ *  \test  packets of a locally bypassed flow are counted in the cache
+ *         until the refresh, then added to the flow
+ */
+static int FlowBypassCacheTest01(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.bypass_cache_size = 64;
+
+    FlowBypassCache *c = FlowBypassCacheAlloc(NULL);
+    FAIL_IF_NULL(c);
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+            "10.0.0.2", 1024, 53);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.2",
+            "10.0.0.1", 53, 1024);
+    FAIL_IF_NULL(p2);
+    p1->flow_hash = p2->flow_hash = 7;
+    p2->ts = p1->ts;
+    p1->flowflags = FLOW_PKT_TOSERVER;
+    p2->flowflags = FLOW_PKT_TOCLIENT;
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    FLOW_INITIALIZE(&f);
+
+    /* not bypassed: not cached */
+    FlowBypassCacheUpdate(c, &f, p1);
+    FAIL_IF(FlowBypassCacheLookup(&tv, c, p1));
+
+    SC_ATOMIC_SET(f.flow_state, FLOW_STATE_LOCAL_BYPASSED);
+    FlowBypassCacheUpdate(c, &f, p1);
+    FAIL_IF_NOT(FlowBypassCacheLookup(&tv, c, p1));
+    FAIL_IF_NOT(FlowBypassCacheLookup(&tv, c, p2));
+    FAIL_IF_NOT(FlowBypassCacheLookup(&tv, c, p2));
+
+    /* another flow on the same slot doesn't match, nor takes the slot */
+    Packet *p3 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.3",
+            "10.0.0.2", 1024, 53);
+    FAIL_IF_NULL(p3);
+    p3->flow_hash = 7;
+    p3->ts = p1->ts;
+    FAIL_IF(FlowBypassCacheLookup(&tv, c, p3));
+    FlowBypassCacheUpdate(c, &f, p3);
+    FAIL_IF_NOT(FlowBypassCacheLookup(&tv, c, p1));
+
+    /* at the refresh the flow is looked up and gets the counters */
+    p1->ts.tv_sec += FLOW_BYPASS_CACHE_REFRESH;
+    FAIL_IF(FlowBypassCacheLookup(&tv, c, p1));
+    FlowBypassCacheUpdate(c, &f, p1);
+    FAIL_IF(f.todstpktcnt != 2);
+    FAIL_IF(f.tosrcpktcnt != 2);
+    p2->ts.tv_sec = p1->ts.tv_sec;
+    FAIL_IF_NOT(FlowBypassCacheLookup(&tv, c, p2));
+
+    FlowBypassCacheFree(c);
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    UTHFreePacket(p3);
+    FlowShutdown();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowBypassCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowBypassCacheTest01", FlowBypassCacheTest01);
+#endif /* UNITTESTS */
+}
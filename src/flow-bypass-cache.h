@@ -0,0 +1,72 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per thread cache of locally bypassed flows (flow.bypass-cache-size).
+ *
+ * A direct mapped table, indexed by the flow hash, of the 5-tuples of the
+ * flows the thread found in the local bypass state. Packets of these flows
+ * are counted in the cache and skip the flow hash lookup and the flow lock.
+ * Once every FLOW_BYPASS_CACHE_REFRESH seconds a packet of the flow goes
+ * the normal way again: its counters are added to the flow, which keeps
+ * the flow from timing out, and the entry is renewed if the flow is still
+ * bypassed.
+ */
+
+#ifndef __FLOW_BYPASS_CACHE_H__
+#define __FLOW_BYPASS_CACHE_H__
+
+#include "decode.h"
+#include "flow.h"
+
+/** seconds a cache entry is used before the flow is looked up again */
+#define FLOW_BYPASS_CACHE_REFRESH   2
+
+typedef struct FlowBypassCacheEntry_ {
+    Address src, dst;
+    Port sp, dp;
+    uint8_t proto;
+    uint8_t recursion_level;
+    /** set if packets from src to dst are to server */
+    uint8_t toserver;
+    uint16_t vlan_id[2];
+    uint64_t domain_id;
+    /** second from which the flow is looked up again, 0 if unused */
+    uint32_t refresh_ts;
+    /** counters not yet added to the flow */
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
+} FlowBypassCacheEntry;
+
+typedef struct FlowBypassCache_ {
+    uint32_t mask;
+    FlowBypassCacheEntry *entries;
+    uint16_t counter_hit;
+} FlowBypassCache;
+
+FlowBypassCache *FlowBypassCacheAlloc(ThreadVars *tv);
+void FlowBypassCacheFree(FlowBypassCache *c);
+int FlowBypassCacheLookup(ThreadVars *tv, FlowBypassCache *c, const Packet *p);
+void FlowBypassCacheUpdate(FlowBypassCache *c, Flow *f, Packet *p);
+
+void FlowBypassCacheRegisterTests(void);
+
+#endif /* __FLOW_BYPASS_CACHE_H__ */
@@ -30,22 +30,29 @@
 
 #define FLOW_BYPASS_DELAY       10
 
+#define BYPASSFUNCMAX   4
+
 typedef struct BypassedFlowManagerThreadData_ {
     uint16_t flow_bypassed_cnt_clo;
     uint16_t flow_bypassed_pkts;
     uint16_t flow_bypassed_bytes;
+    /* counters of the check functions registered with their own names */
+    uint16_t func_cnt[BYPASSFUNCMAX];
+    uint16_t func_pkts[BYPASSFUNCMAX];
+    uint16_t func_bytes[BYPASSFUNCMAX];
 } BypassedFlowManagerThreadData;
 
-#define BYPASSFUNCMAX   4
 int g_bypassed_func_max_index = 0;
 BypassedCheckFunc BypassedFuncList[BYPASSFUNCMAX];
+/* NULL for the functions using the flow_bypassed counters */
+static const BypassedCheckCounters *BypassedFuncCounters[BYPASSFUNCMAX];
 
 int g_bypassed_update_max_index = 0;
 BypassedUpdateFunc UpdateFuncList[BYPASSFUNCMAX];
 
 static TmEcode BypassedFlowManager(ThreadVars *th_v, void *thread_data)
 {
-#ifdef HAVE_PACKET_EBPF
+#if defined(HAVE_PACKET_EBPF) || defined(NAPATECH_ENABLE_BYPASS)
     int tcount = 0;
     BypassedFlowManagerThreadData *ftd = thread_data;
     while (1) {
@@ -61,7 +68,13 @@ static TmEcode BypassedFlowManager(ThreadVars *th_v, void *thread_data)
         for (i = 0; i < g_bypassed_func_max_index; i++) {
             struct flows_stats bypassstats = { 0, 0, 0};
             tcount = BypassedFuncList[i](&bypassstats, &curtime);
-            if (tcount) {
+            if (tcount == 0)
+                continue;
+            if (BypassedFuncCounters[i] != NULL) {
+                StatsAddUI64(th_v, ftd->func_cnt[i], (uint64_t)bypassstats.count);
+                StatsAddUI64(th_v, ftd->func_pkts[i], (uint64_t)bypassstats.packets);
+                StatsAddUI64(th_v, ftd->func_bytes[i], (uint64_t)bypassstats.bytes);
+            } else {
                 StatsAddUI64(th_v, ftd->flow_bypassed_cnt_clo, (uint64_t)bypassstats.count);
                 StatsAddUI64(th_v, ftd->flow_bypassed_pkts, (uint64_t)bypassstats.packets);
                 StatsAddUI64(th_v, ftd->flow_bypassed_bytes, (uint64_t)bypassstats.bytes);
@@ -108,6 +121,15 @@ static TmEcode BypassedFlowManagerThreadInit(ThreadVars *t, const void *initdata
     ftd->flow_bypassed_pkts = StatsRegisterCounter("flow_bypassed.pkts", t);
     ftd->flow_bypassed_bytes = StatsRegisterCounter("flow_bypassed.bytes", t);
 
+    for (int i = 0; i < g_bypassed_func_max_index; i++) {
+        const BypassedCheckCounters *c = BypassedFuncCounters[i];
+        if (c == NULL)
+            continue;
+        ftd->func_cnt[i] = StatsRegisterCounter(c->count, t);
+        ftd->func_pkts[i] = StatsRegisterCounter(c->pkts, t);
+        ftd->func_bytes[i] = StatsRegisterCounter(c->bytes, t);
+    }
+
     return TM_ECODE_OK;
 }
 
@@ -141,12 +163,32 @@ void BypassedFlowManagerThreadSpawn()
 }
 
 int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc)
+{
+    return BypassedFlowManagerRegisterCheckFuncCounters(CheckFunc, NULL);
+}
+
+/**
+ * \brief register a check function with its own counters
+ *
+ * The flows_stats returned by the function are added to the counters
+ * named in counters instead of the flow_bypassed ones. A function that
+ * is already registered is not added again.
+ *
+ * \param counters counter names, NULL for the flow_bypassed counters
+ */
+int BypassedFlowManagerRegisterCheckFuncCounters(BypassedCheckFunc CheckFunc,
+        const BypassedCheckCounters *counters)
 {
     if (!CheckFunc) {
         return -1;
     }
+    for (int i = 0; i < g_bypassed_func_max_index; i++) {
+        if (BypassedFuncList[i] == CheckFunc)
+            return 0;
+    }
     if (g_bypassed_func_max_index < BYPASSFUNCMAX) {
         BypassedFuncList[g_bypassed_func_max_index] = CheckFunc;
+        BypassedFuncCounters[g_bypassed_func_max_index] = counters;
         g_bypassed_func_max_index++;
     } else {
         return -1;
@@ -34,12 +34,21 @@ typedef int (*BypassedCheckFunc)(struct flows_stats *bypassstats,
                                  struct timespec *curtime);
 typedef int (*BypassedUpdateFunc)(Flow *f, Packet *p);
 
+/** names of the counters a check function reports its flows_stats to */
+typedef struct BypassedCheckCounters_ {
+    const char *count;
+    const char *pkts;
+    const char *bytes;
+} BypassedCheckCounters;
+
 void FlowAddToBypassed(Flow *f);
 
 void BypassedFlowManagerThreadSpawn(void);
 void TmModuleBypassedFlowManagerRegister(void);
 
 int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc);
+int BypassedFlowManagerRegisterCheckFuncCounters(BypassedCheckFunc CheckFunc,
+        const BypassedCheckCounters *counters);
 int BypassedFlowManagerRegisterUpdateFunc(BypassedUpdateFunc UpdateFunc);
 
 void BypassedFlowUpdate(Flow *f, Packet *p);
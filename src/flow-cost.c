@@ -0,0 +1,555 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow cpu cost.
+ *
+ * The ticks are kept in flow storage and only touched by the thread
+ * holding the flow lock. When the flow ends they are added to the totals
+ * of its app-layer protocol and, with 'hosts', to the host storage of
+ * both of its addresses. The top flows are taken from the shared flow
+ * hash only, like stream-memuse-top does, so flows of thread local flow
+ * tables are only seen in the totals.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "conf.h"
+#include "counters.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-hash.h"
+#include "flow-storage.h"
+#include "flow-cost.h"
+#include "host.h"
+#include "host-storage.h"
+#include "app-layer-protos.h"
+
+#include "util-print.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+int g_flow_cost_enabled = 0;
+int g_flow_cost_storage_id = -1;
+
+static int flow_cost_host_id = -1;
+static uint64_t flow_cost_bypass_ticks = 0;
+
+/** ticks of the ended flows per app-layer protocol, updated atomically */
+static uint64_t flow_cost_alproto_ticks[ALPROTO_MAX][FLOW_COST_SIZE];
+static uint64_t flow_cost_alproto_flows[ALPROTO_MAX];
+
+/** per host totals, updated with the host locked */
+typedef struct FlowCostHost_ {
+    uint64_t ticks[FLOW_COST_SIZE];
+    uint64_t flows;
+} FlowCostHost;
+
+static void *FlowCostAlloc(unsigned int size)
+{
+    return SCCalloc(1, size);
+}
+
+static void FlowCostFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
+void FlowCostInitConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("flow.cpu-cost.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    intmax_t bypass = 0;
+    if (ConfGetInt("flow.cpu-cost.bypass-ticks", &bypass) == 1) {
+        if (bypass < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "flow.cpu-cost.bypass-ticks "
+                    "can't be negative");
+            exit(EXIT_FAILURE);
+        }
+        flow_cost_bypass_ticks = (uint64_t)bypass;
+    }
+
+    g_flow_cost_storage_id = FlowStorageRegister("cpu-cost", sizeof(FlowCost),
+            FlowCostAlloc, FlowCostFree, 0);
+    if (g_flow_cost_storage_id < 0) {
+        SCLogError(SC_ERR_FLOW_INIT, "flow.cpu-cost: failed to register "
+                "the flow storage");
+        exit(EXIT_FAILURE);
+    }
+
+    int hosts = 0;
+    (void)ConfGetBool("flow.cpu-cost.hosts", &hosts);
+    if (hosts) {
+        flow_cost_host_id = HostStorageRegister("cpu-cost",
+                sizeof(FlowCostHost), FlowCostAlloc, FlowCostFree);
+        if (flow_cost_host_id < 0) {
+            SCLogError(SC_ERR_FLOW_INIT, "flow.cpu-cost: failed to register "
+                    "the host storage");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    SCLogConfig("flow cpu cost accounting enabled%s, bypass-ticks %"PRIu64,
+            hosts ? " with host totals" : "", flow_cost_bypass_ticks);
+    g_flow_cost_enabled = 1;
+}
+
+void FlowCostRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    if (!g_flow_cost_enabled || flow_cost_bypass_ticks == 0)
+        return;
+
+    dtv->counter_flow_cost_bypassed =
+        StatsRegisterCounter("flow.cpu_cost.bypassed", tv);
+}
+
+const char *FlowCostIdToString(enum FlowCostId id)
+{
+    switch (id) {
+        case FLOW_COST_STREAM:
+            return "stream";
+        case FLOW_COST_APPLAYER:
+            return "app_layer";
+        case FLOW_COST_DETECT:
+            return "detect";
+        case FLOW_COST_OUTPUT:
+            return "output";
+        case FLOW_COST_SIZE:
+            break;
+    }
+    return "unknown";
+}
+
+uint64_t FlowCostTotal(const FlowCost *fc)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < FLOW_COST_SIZE; i++)
+        total += fc->ticks[i];
+    return total;
+}
+
+/**
+ *  \brief bypass the flow of p if it cost more than bypass-ticks
+ *
+ *  \param fc cost of the locked flow of p, can be NULL
+ */
+void FlowCostCheckBypass(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        const FlowCost *fc)
+{
+    if (fc == NULL || flow_cost_bypass_ticks == 0)
+        return;
+    if (FlowCostTotal(fc) < flow_cost_bypass_ticks)
+        return;
+
+    const int state = SC_ATOMIC_GET(p->flow->flow_state);
+    if (state == FLOW_STATE_LOCAL_BYPASSED ||
+            state == FLOW_STATE_CAPTURE_BYPASSED)
+        return;
+
+    SCLogDebug("flow %p bypassed, cost %"PRIu64" ticks", p->flow,
+            FlowCostTotal(fc));
+    StatsIncr(tv, dtv->counter_flow_cost_bypassed);
+    PacketBypassCallback(p);
+}
+
+static void FlowCostSetAddress(Address *a, const Flow *f, const FlowAddress *fa)
+{
+    memset(a, 0, sizeof(*a));
+    if (FLOW_IS_IPV4(f)) {
+        a->family = AF_INET;
+        a->addr_data32[0] = fa->addr_data32[0];
+    } else {
+        a->family = AF_INET6;
+        memcpy(a->addr_data32, fa->addr_data32, sizeof(a->addr_data32));
+    }
+}
+
+static void FlowCostHostAdd(Address *a, const FlowCost *fc)
+{
+    Host *h = HostGetHostFromHash(a);
+    if (h == NULL)
+        return;
+    FlowCostHost *hc = HostAllocStorageById(h, flow_cost_host_id);
+    if (hc != NULL) {
+        for (int i = 0; i < FLOW_COST_SIZE; i++)
+            hc->ticks[i] += fc->ticks[i];
+        hc->flows++;
+    }
+    HostRelease(h);
+}
+
+/**
+ *  \brief add the cost of an ending flow to the totals
+ *
+ *  Called from FlowClearMemory() before the flow storage is freed.
+ */
+void FlowCostFlowEnd(Flow *f)
+{
+    const FlowCost *fc = FlowCostPeek(f);
+    if (fc == NULL)
+        return;
+
+    const AppProto alproto = f->alproto < ALPROTO_MAX ? f->alproto : ALPROTO_UNKNOWN;
+    for (int i = 0; i < FLOW_COST_SIZE; i++) {
+        (void)__atomic_fetch_add(&flow_cost_alproto_ticks[alproto][i],
+                fc->ticks[i], __ATOMIC_RELAXED);
+    }
+    (void)__atomic_fetch_add(&flow_cost_alproto_flows[alproto], 1,
+            __ATOMIC_RELAXED);
+
+    if (flow_cost_host_id < 0 || !(FLOW_IS_IPV4(f) || FLOW_IS_IPV6(f)))
+        return;
+    Address a;
+    FlowCostSetAddress(&a, f, &f->src);
+    FlowCostHostAdd(&a, fc);
+    FlowCostSetAddress(&a, f, &f->dst);
+    FlowCostHostAdd(&a, fc);
+}
+
+typedef struct FlowCostEntry_ {
+    uint64_t total;
+    uint64_t ticks[FLOW_COST_SIZE];
+    /** flows of a host */
+    uint64_t flows;
+    /** copied for the report */
+    char src[46];
+    char dst[46];
+    Port sp;
+    Port dp;
+    AppProto alproto;
+} FlowCostEntry;
+
+/** the costliest entries seen so far, in descending order */
+typedef struct FlowCostTop_ {
+    uint32_t size;
+    uint32_t cnt;
+    FlowCostEntry *entries;
+    /** flows or hosts skipped as they were locked */
+    uint32_t busy;
+} FlowCostTop;
+
+/** \internal
+ *  \brief add e to the list if it's among the costliest */
+static void FlowCostTopAdd(FlowCostTop *top, const FlowCostEntry *e)
+{
+    uint32_t i = top->cnt;
+    if (i == top->size) {
+        if (top->entries[i - 1].total >= e->total)
+            return;
+        i--;
+    } else {
+        top->cnt++;
+    }
+    while (i > 0 && top->entries[i - 1].total < e->total) {
+        top->entries[i] = top->entries[i - 1];
+        i--;
+    }
+    top->entries[i] = *e;
+}
+
+static void FlowCostPrintAddress(const Flow *f, const FlowAddress *fa,
+        char *buf, size_t size)
+{
+    if (FLOW_IS_IPV4(f)) {
+        PrintInet(AF_INET, (const void *)&fa->addr_data32[0], buf, size);
+    } else {
+        PrintInet(AF_INET6, (const void *)&fa->address, buf, size);
+    }
+}
+
+/** \internal
+ *  \brief collect the costliest flows of the flow hash */
+static void FlowCostCollectFlows(FlowCostTop *top)
+{
+    for (uint32_t u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        FBLOCK_LOCK(fb);
+        for (Flow *f = fb->head; f != NULL; f = f->hnext) {
+            if (FLOWLOCK_TRYRDLOCK(f) != 0) {
+                top->busy++;
+                continue;
+            }
+            const FlowCost *fc = FlowCostPeek(f);
+            if (fc != NULL) {
+                FlowCostEntry e;
+                memset(&e, 0, sizeof(e));
+                memcpy(e.ticks, fc->ticks, sizeof(e.ticks));
+                e.total = FlowCostTotal(fc);
+                if (top->cnt < top->size || e.total > top->entries[top->cnt - 1].total) {
+                    FlowCostPrintAddress(f, &f->src, e.src, sizeof(e.src));
+                    FlowCostPrintAddress(f, &f->dst, e.dst, sizeof(e.dst));
+                    e.sp = f->sp;
+                    e.dp = f->dp;
+                    e.alproto = f->alproto;
+                    FlowCostTopAdd(top, &e);
+                }
+            }
+            FLOWLOCK_UNLOCK(f);
+        }
+        FBLOCK_UNLOCK(fb);
+    }
+}
+
+/** \internal
+ *  \brief collect the costliest hosts of the host hash */
+static void FlowCostCollectHosts(FlowCostTop *top)
+{
+    for (uint32_t u = 0; u < host_config.hash_size; u++) {
+        HostHashRow *hb = &host_hash[u];
+        HOST_ROW_LOCK(hb);
+        for (Host *h = hb->head; h != NULL; h = h->hnext) {
+            if (SCMutexTrylock(&h->m) != 0) {
+                top->busy++;
+                continue;
+            }
+            const FlowCostHost *hc = HostGetStorageById(h, flow_cost_host_id);
+            if (hc != NULL) {
+                FlowCostEntry e;
+                memset(&e, 0, sizeof(e));
+                memcpy(e.ticks, hc->ticks, sizeof(e.ticks));
+                for (int i = 0; i < FLOW_COST_SIZE; i++)
+                    e.total += hc->ticks[i];
+                e.flows = hc->flows;
+                if (h->a.family == AF_INET) {
+                    PrintInet(AF_INET, (const void *)&h->a.addr_data32[0],
+                            e.src, sizeof(e.src));
+                } else {
+                    PrintInet(AF_INET6, (const void *)&h->a.address,
+                            e.src, sizeof(e.src));
+                }
+                FlowCostTopAdd(top, &e);
+            }
+            SCMutexUnlock(&h->m);
+        }
+        HOST_ROW_UNLOCK(hb);
+    }
+}
+
+#ifdef BUILD_UNIX_SOCKET
+static json_t *FlowCostTicksJson(const uint64_t *ticks, uint64_t total)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+    for (int i = 0; i < FLOW_COST_SIZE; i++) {
+        json_object_set_new(js, FlowCostIdToString(i), json_integer(ticks[i]));
+    }
+    json_object_set_new(js, "total", json_integer(total));
+    return js;
+}
+
+static json_t *FlowCostFlowsJson(const FlowCostTop *top)
+{
+    json_t *jflows = json_array();
+    if (jflows == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < top->cnt; i++) {
+        const FlowCostEntry *e = &top->entries[i];
+        json_t *jf = json_object();
+        if (jf == NULL)
+            continue;
+        json_object_set_new(jf, "src_ip", json_string(e->src));
+        json_object_set_new(jf, "src_port", json_integer(e->sp));
+        json_object_set_new(jf, "dest_ip", json_string(e->dst));
+        json_object_set_new(jf, "dest_port", json_integer(e->dp));
+        json_object_set_new(jf, "app_proto", json_string(AppProtoToString(e->alproto)));
+        json_object_set_new(jf, "cpu_ticks", FlowCostTicksJson(e->ticks, e->total));
+        json_array_append_new(jflows, jf);
+    }
+    return jflows;
+}
+
+static json_t *FlowCostHostsJson(const FlowCostTop *top)
+{
+    json_t *jhosts = json_array();
+    if (jhosts == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < top->cnt; i++) {
+        const FlowCostEntry *e = &top->entries[i];
+        json_t *jh = json_object();
+        if (jh == NULL)
+            continue;
+        json_object_set_new(jh, "ip", json_string(e->src));
+        json_object_set_new(jh, "flows", json_integer(e->flows));
+        json_object_set_new(jh, "cpu_ticks", FlowCostTicksJson(e->ticks, e->total));
+        json_array_append_new(jhosts, jh);
+    }
+    return jhosts;
+}
+
+static json_t *FlowCostAppProtosJson(void)
+{
+    json_t *jprotos = json_array();
+    if (jprotos == NULL)
+        return NULL;
+
+    /* sorted by total, which is at most ALPROTO_MAX entries */
+    FlowCostEntry entries[ALPROTO_MAX];
+    FlowCostTop top = { ALPROTO_MAX, 0, entries, 0 };
+    for (AppProto a = 0; a < ALPROTO_MAX; a++) {
+        FlowCostEntry e;
+        memset(&e, 0, sizeof(e));
+        e.flows = __atomic_load_n(&flow_cost_alproto_flows[a], __ATOMIC_RELAXED);
+        if (e.flows == 0)
+            continue;
+        for (int i = 0; i < FLOW_COST_SIZE; i++) {
+            e.ticks[i] = __atomic_load_n(&flow_cost_alproto_ticks[a][i],
+                    __ATOMIC_RELAXED);
+            e.total += e.ticks[i];
+        }
+        e.alproto = a;
+        FlowCostTopAdd(&top, &e);
+    }
+    for (uint32_t i = 0; i < top.cnt; i++) {
+        const FlowCostEntry *e = &top.entries[i];
+        json_t *jp = json_object();
+        if (jp == NULL)
+            continue;
+        json_object_set_new(jp, "app_proto", json_string(AppProtoToString(e->alproto)));
+        json_object_set_new(jp, "flows", json_integer(e->flows));
+        json_object_set_new(jp, "cpu_ticks", FlowCostTicksJson(e->ticks, e->total));
+        json_array_append_new(jprotos, jp);
+    }
+    return jprotos;
+}
+
+/**
+ *  \brief unix socket command listing the flows and hosts that cost the
+ *         most cpu and the cost of the ended flows per app-layer protocol
+ *
+ *  Takes an optional "count" argument, the number of flows and hosts
+ *  to list.
+ */
+TmEcode FlowCostTopCommand(json_t *cmd, json_t *answer, void *data)
+{
+    if (!g_flow_cost_enabled) {
+        json_object_set_new(answer, "message",
+                json_string("flow.cpu-cost is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+    uint32_t size = FLOW_COST_TOP_DEFAULT;
+    json_t *jarg = json_object_get(cmd, "count");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > FLOW_COST_TOP_MAX) {
+            json_object_set_new(answer, "message",
+                    json_string("count is not an integer between 1 and 100"));
+            return TM_ECODE_FAILED;
+        }
+        size = (uint32_t)json_integer_value(jarg);
+    }
+
+    FlowCostEntry *entries = SCCalloc(size, sizeof(*entries));
+    json_t *jdata = json_object();
+    if (entries == NULL || jdata == NULL) {
+        SCFree(entries);
+        if (jdata != NULL)
+            json_decref(jdata);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    if (flow_hash != NULL) {
+        FlowCostTop top = { size, 0, entries, 0 };
+        FlowCostCollectFlows(&top);
+        json_object_set_new(jdata, "flows_busy", json_integer(top.busy));
+        json_object_set_new(jdata, "flows", FlowCostFlowsJson(&top));
+    }
+    if (flow_cost_host_id >= 0 && host_hash != NULL) {
+        FlowCostTop top = { size, 0, entries, 0 };
+        FlowCostCollectHosts(&top);
+        json_object_set_new(jdata, "hosts_busy", json_integer(top.busy));
+        json_object_set_new(jdata, "hosts", FlowCostHostsJson(&top));
+    }
+    SCFree(entries);
+
+    json_object_set_new(jdata, "app_protos", FlowCostAppProtosJson());
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+
+/** \test list keeps the costliest entries in descending order */
+static int FlowCostTest01(void)
+{
+    FlowCostEntry entries[3];
+    FlowCostTop top = { 3, 0, entries, 0 };
+    const uint64_t totals[] = { 10, 50, 20, 5, 40, 50 };
+
+    for (size_t i = 0; i < sizeof(totals) / sizeof(totals[0]); i++) {
+        FlowCostEntry e;
+        memset(&e, 0, sizeof(e));
+        e.total = totals[i];
+        FlowCostTopAdd(&top, &e);
+    }
+    FAIL_IF_NOT(top.cnt == 3);
+    FAIL_IF_NOT(top.entries[0].total == 50);
+    FAIL_IF_NOT(top.entries[1].total == 50);
+    FAIL_IF_NOT(top.entries[2].total == 40);
+    PASS;
+}
+
+/** \test app-layer ticks counted inside the stream stage are not
+ *        counted twice */
+static int FlowCostTest02(void)
+{
+    FlowCost cost;
+    memset(&cost, 0, sizeof(cost));
+    FlowCost *fc = &cost;
+
+    FLOW_COST_START_EXCL(fc, FLOW_COST_STREAM, FLOW_COST_APPLAYER);
+    {
+        FLOW_COST_START(fc, FLOW_COST_APPLAYER);
+        for (volatile int i = 0; i < 100000; i++)
+            ;
+        FLOW_COST_END(fc, FLOW_COST_APPLAYER);
+    }
+    FLOW_COST_END_EXCL(fc, FLOW_COST_STREAM, FLOW_COST_APPLAYER);
+
+    FAIL_IF(fc->ticks[FLOW_COST_APPLAYER] == 0);
+    /* stream and app-layer add up to the time spent in the stream stage */
+    FAIL_IF_NOT(FlowCostTotal(fc) <=
+            UtilCpuGetTicks() - flow_cost_start_FLOW_COST_STREAM);
+
+    /* no accounting without cost storage */
+    FlowCost *none = NULL;
+    FLOW_COST_START(none, FLOW_COST_DETECT);
+    FAIL_IF_NOT(flow_cost_start_FLOW_COST_DETECT == 0);
+    FLOW_COST_END(none, FLOW_COST_DETECT);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowCostRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowCostTest01", FlowCostTest01);
+    UtRegisterTest("FlowCostTest02", FlowCostTest02);
+#endif
+}
@@ -0,0 +1,113 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow cpu cost.
+ *
+ * With 'flow.cpu-cost' enabled the flow worker counts the cpu ticks it
+ * spends on each flow in stream tracking, app-layer parsing, detection
+ * and output. The counts are logged in the EVE flow record, summed per
+ * app-layer protocol and host when the flow ends, and listed by the
+ * 'flow-cost-top' unix socket command. Flows costing more than
+ * 'bypass-ticks' are bypassed.
+ */
+
+#ifndef __FLOW_COST_H__
+#define __FLOW_COST_H__
+
+#include "decode.h"
+#include "flow.h"
+#include "flow-storage.h"
+#include "util-cpu.h"
+#include "tm-threads-common.h"
+
+enum FlowCostId {
+    FLOW_COST_STREAM = 0,
+    FLOW_COST_APPLAYER,
+    FLOW_COST_DETECT,
+    FLOW_COST_OUTPUT,
+    FLOW_COST_SIZE,
+};
+
+typedef struct FlowCost_ {
+    uint64_t ticks[FLOW_COST_SIZE];
+} FlowCost;
+
+#define FLOW_COST_TOP_DEFAULT   10
+#define FLOW_COST_TOP_MAX       100
+
+extern int g_flow_cost_enabled;
+extern int g_flow_cost_storage_id;
+
+void FlowCostInitConfig(void);
+void FlowCostRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv);
+const char *FlowCostIdToString(enum FlowCostId id);
+uint64_t FlowCostTotal(const FlowCost *fc);
+void FlowCostCheckBypass(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        const FlowCost *fc);
+void FlowCostFlowEnd(Flow *f);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode FlowCostTopCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void FlowCostRegisterTests(void);
+
+/** \brief get the cost of a flow, set up on first use
+ *  \param f locked flow or NULL
+ *  \retval fc cost or NULL if not enabled */
+static inline FlowCost *FlowCostGet(Flow *f)
+{
+    if (likely(!g_flow_cost_enabled) || f == NULL)
+        return NULL;
+    return FlowAllocStorageById(f, g_flow_cost_storage_id);
+}
+
+/** \brief get the cost of a flow if it has one */
+static inline const FlowCost *FlowCostPeek(Flow *f)
+{
+    if (likely(!g_flow_cost_enabled) || f == NULL)
+        return NULL;
+    return FlowGetStorageById(f, g_flow_cost_storage_id);
+}
+
+#define FLOW_COST_START(fc, id) \
+    const uint64_t flow_cost_start_##id = \
+        unlikely((fc) != NULL) ? UtilCpuGetTicks() : 0
+
+#define FLOW_COST_END(fc, id) \
+    if (unlikely((fc) != NULL)) { \
+        (fc)->ticks[(id)] += UtilCpuGetTicks() - flow_cost_start_##id; \
+    }
+
+/** like FLOW_COST_START, for a stage that runs 'inner' itself, which
+ *  counts its own ticks and has them excluded from this stage. 'inner'
+ *  can be 'id' for a stage that can be nested in itself. */
+#define FLOW_COST_START_EXCL(fc, id, inner) \
+    FLOW_COST_START(fc, id); \
+    const uint64_t flow_cost_inner_##id = \
+        unlikely((fc) != NULL) ? (fc)->ticks[(inner)] : 0
+
+#define FLOW_COST_END_EXCL(fc, id, inner) \
+    if (unlikely((fc) != NULL)) { \
+        (fc)->ticks[(id)] += (UtilCpuGetTicks() - flow_cost_start_##id) - \
+            ((fc)->ticks[(inner)] - flow_cost_inner_##id); \
+    }
+
+#endif /* __FLOW_COST_H__ */
@@ -28,6 +28,7 @@
 #include "threads.h"
 
 #include "decode.h"
+#include "defrag.h"
 #include "detect-engine-state.h"
 
 #include "flow.h"
@@ -42,17 +43,39 @@
 #include "util-debug.h"
 
 #include "util-hash-lookup3.h"
+#include "util-hash-crc32c.h"
+#include "util-hash-siphash.h"
+#include "util-trace.h"
 
 #include "conf.h"
 #include "output.h"
 #include "output-flow.h"
+#include "tm-threads.h"
+
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
+/** bits of the hash stored in the tag index, the low bits pick the bucket */
+#define FLOW_HASH_TAG(hash) ((uint16_t)((hash) >> 16))
+
+FlowBucketTags *flow_hash_tags = NULL;
+
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv);
+static Flow *FlowThreadTableGetUsed(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t);
+
+/** all per thread flow tables, for the engine shutdown */
+static FlowThreadTable *flow_thread_tables = NULL;
+static SCMutex flow_thread_tables_lock = SCMUTEX_INITIALIZER;
 
 /** \brief compare two raw ipv6 addrs
  *
@@ -86,8 +109,9 @@ typedef struct FlowHashKey4_ {
             uint16_t proto; /**< u16 so proto and recur add up to u32 */
             uint16_t recur; /**< u16 so proto and recur add up to u32 */
             uint16_t vlan_id[2];
+            uint32_t domain[2];
         };
-        const uint32_t u32[5];
+        const uint32_t u32[7];
     };
 } FlowHashKey4;
 
@@ -99,21 +123,39 @@ typedef struct FlowHashKey6_ {
             uint16_t proto; /**< u16 so proto and recur add up to u32 */
             uint16_t recur; /**< u16 so proto and recur add up to u32 */
             uint16_t vlan_id[2];
+            uint32_t domain[2];
         };
-        const uint32_t u32[11];
+        const uint32_t u32[13];
     };
 } FlowHashKey6;
 
+/** \brief hash a FlowHashKey4 or FlowHashKey6 with flow.hash-function */
+static inline uint32_t FlowHashWords(const uint32_t *k, const size_t n)
+{
+    switch (flow_config.hash_function) {
+        case FLOW_HASH_CRC32C:
+            return HashCrc32cWords(k, n, flow_config.hash_rand);
+        case FLOW_HASH_SIPHASH:
+            return HashSipWords(k, n, flow_config.hash_key);
+        case FLOW_HASH_LOOKUP3:
+        default:
+            return hashword(k, n, flow_config.hash_rand);
+    }
+}
+
 /* calculate the hash key for this packet
  *
  * we're using:
- *  hash_rand -- set at init time
+ *  hash_rand or hash_key -- set at init time
  *  source port
  *  destination port
  *  source address
  *  destination address
  *  recursion level -- for tunnels, make sure different tunnel layers can
  *                     never get mixed up.
+ *  vlan id's
+ *  domain -- MPLS domain and PPPoE session, if enabled, and the VXLAN or
+ *            Geneve VNI
  *
  *  For ICMP we only consider UNREACHABLE errors atm.
  */
@@ -137,8 +179,10 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.domain[0] = (uint32_t)p->domain_id;
+            fhk.domain[1] = (uint32_t)(p->domain_id >> 32);
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = FlowHashWords(fhk.u32, 7);
 
         } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
             uint32_t psrc = IPV4_GET_RAW_IPSRC_U32(ICMPV4_GET_EMB_IPV4(p));
@@ -157,8 +201,10 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.domain[0] = (uint32_t)p->domain_id;
+            fhk.domain[1] = (uint32_t)(p->domain_id >> 32);
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = FlowHashWords(fhk.u32, 7);
 
         } else {
             FlowHashKey4 fhk;
@@ -171,8 +217,10 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.domain[0] = (uint32_t)p->domain_id;
+            fhk.domain[1] = (uint32_t)(p->domain_id >> 32);
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = FlowHashWords(fhk.u32, 7);
         }
     } else if (p->ip6h != NULL) {
         FlowHashKey6 fhk;
@@ -203,8 +251,10 @@ static inline uint32_t FlowGetHash(const Packet *p)
         fhk.recur = (uint16_t)p->recursion_level;
         fhk.vlan_id[0] = p->vlan_id[0];
         fhk.vlan_id[1] = p->vlan_id[1];
+        fhk.domain[0] = (uint32_t)p->domain_id;
+        fhk.domain[1] = (uint32_t)(p->domain_id >> 32);
 
-        hash = hashword(fhk.u32, 11, flow_config.hash_rand);
+        hash = FlowHashWords(fhk.u32, 13);
     }
 
     return hash;
@@ -222,7 +272,8 @@ static inline uint32_t FlowGetHash(const Packet *p)
      (f1)->proto == (f2)->proto && \
      (f1)->recursion_level == (f2)->recursion_level && \
      (f1)->vlan_id[0] == (f2)->vlan_id[0] && \
-     (f1)->vlan_id[1] == (f2)->vlan_id[1])
+     (f1)->vlan_id[1] == (f2)->vlan_id[1] && \
+     (f1)->domain_id == (f2)->domain_id)
 #define CMP_FLOW_ICMP(f1,f2) \
     (((CMP_ADDR(&(f1)->src, &(f2)->src) && \
        CMP_ADDR(&(f1)->dst, &(f2)->dst) && \
@@ -233,7 +284,8 @@ static inline uint32_t FlowGetHash(const Packet *p)
      (f1)->proto == (f2)->proto && \
      (f1)->recursion_level == (f2)->recursion_level && \
      (f1)->vlan_id[0] == (f2)->vlan_id[0] && \
-     (f1)->vlan_id[1] == (f2)->vlan_id[1])
+     (f1)->vlan_id[1] == (f2)->vlan_id[1] && \
+     (f1)->domain_id == (f2)->domain_id)
 
 /**
  *  \brief See if a ICMP packet belongs to a flow by comparing the embedded
@@ -258,7 +310,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->domain_id == p->domain_id)
         {
             return 1;
 
@@ -271,7 +324,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->domain_id == p->domain_id)
         {
             return 1;
         }
@@ -291,6 +345,58 @@ void FlowSetupPacket(Packet *p)
     p->flow_hash = FlowGetHash(p);
 }
 
+/**
+ *  \brief Prefetch the flow hash rows a batch of packets will look up
+ *
+ *  Works in two passes so the memory loads of the batch overlap: first the
+ *  rows (and their tag index) are prefetched, then the first flow of each
+ *  row, by which time the row is usually in the cache. The lookups by
+ *  FlowGetFlowFromHash() that follow then find most of what they need in
+ *  the cache instead of waiting for DRAM for each packet in turn.
+ *
+ *  Only packets that are decoded (FlowSetupPacket() done) are used. Reads
+ *  of the rows are done without locking, they are only hints.
+ *
+ *  \param dtv decode thread vars of the thread doing the lookups, NULL
+ *             if that isn't known (e.g. the capture)
+ *  \param pkts the packets
+ *  \param cnt number of packets
+ */
+void FlowHashPrefetch(const DecodeThreadVars *dtv, Packet * const *pkts,
+        const uint32_t cnt)
+{
+    FlowBucket *rows = flow_hash;
+    uint32_t size = flow_config.hash_size;
+
+    if (dtv != NULL && dtv->flow_table != NULL) {
+        rows = dtv->flow_table->rows;
+        size = dtv->flow_table->size;
+    } else if (flow_config.thread_local) {
+        /* we don't know in which table the flows are */
+        return;
+    }
+    if (unlikely(rows == NULL))
+        return;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const Packet *p = pkts[i];
+        if (!(p->flags & PKT_WANTS_FLOW))
+            continue;
+        const uint32_t idx = p->flow_hash % size;
+        prefetch(&rows[idx]);
+        if (flow_hash_tags != NULL && rows == flow_hash)
+            prefetch(&flow_hash_tags[idx]);
+    }
+    for (uint32_t i = 0; i < cnt; i++) {
+        const Packet *p = pkts[i];
+        if (!(p->flags & PKT_WANTS_FLOW))
+            continue;
+        const Flow *f = rows[p->flow_hash % size].head;
+        if (f != NULL)
+            prefetch(f);
+    }
+}
+
 int TcpSessionPacketSsnReuse(const Packet *p, const Flow *f, void *tcp_ssn);
 
 static inline int FlowCompare(Flow *f, const Packet *p)
@@ -333,6 +439,74 @@ static inline int FlowCreateCheck(const Packet *p)
     return 1;
 }
 
+/** \internal
+ *  \brief find the flow of a packet in the tag index of its bucket
+ *  \retval f the flow or NULL if it's not in the index */
+static inline Flow *FlowBucketTagsLookup(const FlowBucketTags *bt,
+        const uint16_t tag, const Packet *p)
+{
+#ifdef __SSE2__
+    const __m128i tags = _mm_load_si128((const __m128i *)bt->tag);
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi16(tags, _mm_set1_epi16((short)tag)));
+    /* 2 mask bits per tag, drop the unused lanes */
+    mask &= (1U << (2 * FLOW_BUCKET_TAGS)) - 1;
+    while (mask != 0) {
+        const int i = __builtin_ctz(mask) / 2;
+        mask &= ~(3U << (2 * i));
+        Flow *f = bt->flow[i];
+        if (f != NULL && FlowCompare(f, p) != 0)
+            return f;
+    }
+#else
+    for (int i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        Flow *f = bt->flow[i];
+        if (bt->tag[i] == tag && f != NULL && FlowCompare(f, p) != 0)
+            return f;
+    }
+#endif
+    return NULL;
+}
+
+/** \internal
+ *  \brief move a flow to the front of the tag index of its bucket. If it
+ *         wasn't in the index, the least recently used flow drops out. */
+static inline void FlowBucketTagsUse(FlowBucketTags *bt, const uint16_t tag,
+        Flow *f)
+{
+    if (bt->flow[0] == f)
+        return;
+
+    int i;
+    for (i = 1; i < FLOW_BUCKET_TAGS - 1; i++) {
+        if (bt->flow[i] == f)
+            break;
+    }
+    memmove(&bt->flow[1], &bt->flow[0], i * sizeof(bt->flow[0]));
+    memmove(&bt->tag[1], &bt->tag[0], i * sizeof(bt->tag[0]));
+    bt->flow[0] = f;
+    bt->tag[0] = tag;
+}
+
+/** \brief remove a flow from the tag index, called whenever a flow is
+ *         taken out of its bucket. The bucket must be locked. */
+void FlowBucketTagsRemove(const FlowBucket *fb, const Flow *f)
+{
+    /* flows of the per thread tables are never in the index */
+    if (flow_hash_tags == NULL || fb < flow_hash ||
+            fb >= flow_hash + flow_config.hash_size)
+        return;
+
+    FlowBucketTags *bt = &flow_hash_tags[fb - flow_hash];
+    for (int i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        if (bt->flow[i] == f) {
+            bt->flow[i] = NULL;
+            bt->tag[i] = 0;
+            return;
+        }
+    }
+}
+
 static inline void FlowUpdateCounter(ThreadVars *tv, DecodeThreadVars *dtv,
         uint8_t proto)
 {
@@ -358,6 +532,47 @@ static inline void FlowUpdateCounter(ThreadVars *tv, DecodeThreadVars *dtv,
 #endif
 }
 
+/** \brief take a flow from the thread local spare cache
+ *
+ *  Refills the cache with a batch from the global spare queue if it is
+ *  empty, so the spare queue lock is taken once per batch.
+ *
+ *  \retval f *unlocked* flow or NULL if the spare queue is empty too
+ */
+static Flow *FlowSpareGetLocal(DecodeThreadVars *dtv)
+{
+    if (dtv->flow_spare == NULL) {
+        dtv->flow_spare = FlowDequeueBatch(&flow_spare_q,
+                dtv->flow_spare_batch, &dtv->flow_spare_cnt);
+        if (dtv->flow_spare == NULL)
+            return NULL;
+    }
+
+    Flow *f = dtv->flow_spare;
+    dtv->flow_spare = f->lnext;
+    dtv->flow_spare_cnt--;
+    f->lnext = NULL;
+    return f;
+}
+
+/** \brief allocate a flow through the thread local spare cache
+ *
+ *  Allocates a batch of flows at once so the memcap is checked and
+ *  updated once per batch.
+ *
+ *  \retval f *unlocked* flow or NULL on memcap or out of memory
+ */
+static Flow *FlowAllocLocal(DecodeThreadVars *dtv)
+{
+    if (dtv->flow_spare == NULL) {
+        dtv->flow_spare = FlowAllocBatch(dtv->flow_spare_batch,
+                &dtv->flow_spare_cnt);
+        if (dtv->flow_spare == NULL)
+            return NULL;
+    }
+    return FlowSpareGetLocal(dtv);
+}
+
 /**
  *  \brief Get a new flow
  *
@@ -378,7 +593,11 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
     }
 
     /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    const bool local = (dtv != NULL && dtv->flow_spare_batch > 0);
+    if (local)
+        f = FlowSpareGetLocal(dtv);
+    else
+        f = FlowDequeue(&flow_spare_q);
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
@@ -394,12 +613,18 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
                 FlowWakeupFlowManagerThread();
             }
 
-            f = FlowGetUsedFlow(tv, dtv);
+            /* a thread with its own table reuses its own flows first, the
+             * shared hash may hold few or none of them */
+            if (dtv != NULL && dtv->flow_table != NULL)
+                f = FlowThreadTableGetUsed(tv, dtv, dtv->flow_table);
+            if (f == NULL)
+                f = FlowGetUsedFlow(tv, dtv);
             if (f == NULL) {
                 /* max memcap reached, so increments the counter */
                 if (tv != NULL && dtv != NULL) {
                     StatsIncr(tv, dtv->counter_flow_memcap);
                 }
+                SCTrace2(memcap_hit, "flow", (uint64_t)SC_ATOMIC_GET(flow_config.memcap));
 
                 /* very rare, but we can fail. Just giving up */
                 return NULL;
@@ -408,11 +633,12 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
             /* freed a flow, but it's unlocked */
         } else {
             /* now see if we can alloc a new flow */
-            f = FlowAlloc();
+            f = local ? FlowAllocLocal(dtv) : FlowAlloc();
             if (f == NULL) {
                 if (tv != NULL && dtv != NULL) {
                     StatsIncr(tv, dtv->counter_flow_memcap);
                 }
+                SCTrace2(memcap_hit, "flow", (uint64_t)SC_ATOMIC_GET(flow_config.memcap));
                 return NULL;
             }
 
@@ -426,6 +652,7 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
 
     FLOWLOCK_WRLOCK(f);
     FlowUpdateCounter(tv, dtv, p->proto);
+    SCTrace2(flow_new, f, p->proto);
     return f;
 }
 
@@ -463,6 +690,141 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     return f;
 }
 
+static inline void FlowThreadTableUnlink(FlowBucket *fb, Flow *f)
+{
+    if (f->hprev != NULL)
+        f->hprev->hnext = f->hnext;
+    if (f->hnext != NULL)
+        f->hnext->hprev = f->hprev;
+    if (fb->head == f)
+        fb->head = f->hnext;
+    if (fb->tail == f)
+        fb->tail = f->hprev;
+    f->hnext = NULL;
+    f->hprev = NULL;
+}
+
+static inline void FlowThreadTableLinkHead(FlowBucket *fb, Flow *f)
+{
+    f->hprev = NULL;
+    f->hnext = fb->head;
+    if (fb->head != NULL)
+        fb->head->hprev = f;
+    else
+        fb->tail = f;
+    fb->head = f;
+}
+
+/** new TCP flows looked at before deciding on asymmetric delivery */
+#define FLOW_THREAD_FALLBACK_SAMPLE 4096
+
+/** \internal
+ *  \brief watch for asymmetric delivery of flows to the worker threads
+ *
+ *  If the two directions of a flow end up in different threads, the
+ *  responder side creates its own flow, starting with the SYN/ACK. Once
+ *  too many new TCP flows of this thread start like that, its new flows
+ *  are no longer added to its table so both directions meet in the shared
+ *  hash. Other threads may still get symmetric delivery, e.g. from
+ *  another interface, and keep using their tables.
+ */
+static void FlowThreadTableCheckDelivery(FlowThreadTable *t, const Packet *p)
+{
+    if (flow_config.thread_fallback_pct == 0 || !PKT_IS_TCP(p))
+        return;
+
+    t->tcp_new++;
+    if ((p->tcph->th_flags & (TH_SYN|TH_ACK)) == (TH_SYN|TH_ACK))
+        t->tcp_synack++;
+    if (t->tcp_new < FLOW_THREAD_FALLBACK_SAMPLE)
+        return;
+
+    if ((uint64_t)t->tcp_synack * 100 >
+            (uint64_t)t->tcp_new * flow_config.thread_fallback_pct &&
+            !t->fallback)
+    {
+        t->fallback = true;
+        SCLogWarning(SC_WARN_FLOW_THREAD_LOCAL, "%"PRIu32" of the last "
+                "%"PRIu32" new TCP flows started with a SYN/ACK, the capture "
+                "doesn't seem to deliver both directions of a flow to this "
+                "thread. New flows of this thread will use the shared flow "
+                "hash.", t->tcp_synack, t->tcp_new);
+    }
+    t->tcp_new = 0;
+    t->tcp_synack = 0;
+}
+
+/** \internal
+ *  \brief Get Flow for packet from the thread's private table
+ *
+ *  Like FlowGetFlowFromHash(), but no other thread can see the table, so
+ *  the row isn't locked. The flow lock is still taken, as the rest of the
+ *  engine expects a locked flow.
+ *
+ *  \param create add a new flow if the packet's flow isn't in the table
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+static Flow *FlowThreadTableGetFlow(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, const Packet *p, Flow **dest, const bool create)
+{
+    const uint32_t hash = p->flow_hash;
+    FlowBucket *fb = &t->rows[hash % t->size];
+    Flow *f;
+
+    for (f = fb->head; f != NULL; f = f->hnext) {
+        if (FlowCompare(f, p) != 0)
+            break;
+    }
+
+    /* the row can't be used to reuse a flow from if we run into the
+     * memcap below */
+    t->busy = fb;
+
+    if (f != NULL) {
+        /* put it on top of the row, this rewards active flows */
+        if (f != fb->head) {
+            FlowThreadTableUnlink(fb, f);
+            FlowThreadTableLinkHead(fb, f);
+        }
+
+        FLOWLOCK_WRLOCK(f);
+        if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
+            f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
+            if (f == NULL) {
+                t->busy = NULL;
+                return NULL;
+            }
+        }
+        FlowReference(dest, f);
+        t->busy = NULL;
+        return f;
+    }
+
+    if (!create) {
+        t->busy = NULL;
+        return NULL;
+    }
+
+    f = FlowGetNew(tv, dtv, p);
+    t->busy = NULL;
+    if (f == NULL)
+        return NULL;
+
+    /* flow is locked */
+    FlowThreadTableLinkHead(fb, f);
+
+    FlowInit(f, p);
+    f->flow_hash = hash;
+    f->fb = fb;
+    FlowUpdateState(f, FLOW_STATE_NEW);
+
+    FlowThreadTableCheckDelivery(t, p);
+
+    FlowReference(dest, f);
+    return f;
+}
+
 /** \brief Get Flow for packet
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
@@ -484,9 +846,22 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 {
     Flow *f = NULL;
 
+    /* with a private table, new flows go there unless delivery to this
+     * thread turned out to be asymmetric. Flows added before that are
+     * still looked up in the table first. */
+    if (dtv != NULL && dtv->flow_table != NULL) {
+        const bool create = !dtv->flow_table->fallback;
+        f = FlowThreadTableGetFlow(tv, dtv, dtv->flow_table, p, dest, create);
+        if (f != NULL || create)
+            return f;
+    }
+
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    const uint32_t idx = hash % flow_config.hash_size;
+    FlowBucket *fb = &flow_hash[idx];
+    FlowBucketTags *bt = flow_hash_tags ? &flow_hash_tags[idx] : NULL;
+    const uint16_t tag = FLOW_HASH_TAG(hash);
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
@@ -508,6 +883,8 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
         f->flow_hash = hash;
         f->fb = fb;
         FlowUpdateState(f, FLOW_STATE_NEW);
+        if (bt != NULL)
+            FlowBucketTagsUse(bt, tag, f);
 
         FlowReference(dest, f);
 
@@ -515,6 +892,14 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
         return f;
     }
 
+    /* recently used flows are found through the tag index, without
+     * walking the list */
+    if (bt != NULL) {
+        f = FlowBucketTagsLookup(bt, tag, p);
+        if (f != NULL)
+            goto found;
+    }
+
     /* ok, we have a flow in the bucket. Let's find out if it is our flow */
     f = fb->head;
 
@@ -543,6 +928,8 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 f->flow_hash = hash;
                 f->fb = fb;
                 FlowUpdateState(f, FLOW_STATE_NEW);
+                if (bt != NULL)
+                    FlowBucketTagsUse(bt, tag, f);
 
                 FlowReference(dest, f);
 
@@ -569,23 +956,12 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 fb->head = f;
 
                 /* found our flow, lock & return */
-                FLOWLOCK_WRLOCK(f);
-                if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-                    f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-                    if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
-                        return NULL;
-                    }
-                }
-
-                FlowReference(dest, f);
-
-                FBLOCK_UNLOCK(fb);
-                return f;
+                break;
             }
         }
     }
 
+found:
     /* lock & return */
     FLOWLOCK_WRLOCK(f);
     if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
@@ -595,6 +971,8 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             return NULL;
         }
     }
+    if (bt != NULL)
+        FlowBucketTagsUse(bt, tag, f);
 
     FlowReference(dest, f);
 
@@ -602,6 +980,95 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
     return f;
 }
 
+/** \internal
+ *  \brief log and clear a flow that was taken out of a hash row for
+ *         reuse, unlocks the flow
+ */
+static void FlowReuseUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, Flow *f)
+{
+    SCTrace2(flow_evict, f, f->proto);
+
+    int state = SC_ATOMIC_GET(f->flow_state);
+    if (state == FLOW_STATE_NEW)
+        f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
+    else if (state == FLOW_STATE_ESTABLISHED)
+        f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
+    else if (state == FLOW_STATE_CLOSED)
+        f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+    else if (state == FLOW_STATE_CAPTURE_BYPASSED)
+        f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+    else if (state == FLOW_STATE_LOCAL_BYPASSED)
+        f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+
+    f->flow_end_flags |= FLOW_END_FLAG_FORCED;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        f->flow_end_flags |= FLOW_END_FLAG_EMERGENCY;
+
+    /* invoke flow log api */
+    if (dtv && dtv->output_flow_thread_data)
+        (void)OutputFlowLog(tv, dtv->output_flow_thread_data, f);
+
+    FlowClearMemory(f, f->protomap);
+
+    FlowUpdateState(f, FLOW_STATE_NEW);
+
+    FLOWLOCK_UNLOCK(f);
+}
+
+/** classes of flows to evict at memcap, the lowest goes first */
+enum FlowEvictClass {
+    /** bypassed: we no longer inspect it anyway */
+    FLOW_EVICT_BYPASSED = 0,
+    /** no app-layer state, e.g. half open flows of a SYN flood */
+    FLOW_EVICT_NO_APP_STATE,
+    /** all others, the least recently seen goes first */
+    FLOW_EVICT_OLDEST,
+};
+
+static inline enum FlowEvictClass FlowEvictGetClass(const Flow *f)
+{
+    const int state = SC_ATOMIC_GET(f->flow_state);
+    if (state == FLOW_STATE_LOCAL_BYPASSED ||
+            state == FLOW_STATE_CAPTURE_BYPASSED)
+        return FLOW_EVICT_BYPASSED;
+    if (f->alstate == NULL)
+        return FLOW_EVICT_NO_APP_STATE;
+    return FLOW_EVICT_OLDEST;
+}
+
+/** \internal
+ *  \brief see if flow 'f' should be evicted before 'best'
+ */
+static inline bool FlowEvictBefore(const Flow *f, enum FlowEvictClass c,
+        const Flow *best, enum FlowEvictClass best_c)
+{
+    if (c != best_c)
+        return c < best_c;
+    return timercmp(&f->lastts, &best->lastts, <);
+}
+
+static void FlowEvictUpdateCounters(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Flow *f, enum FlowEvictClass c)
+{
+    if (tv == NULL || dtv == NULL)
+        return;
+
+    switch (c) {
+        case FLOW_EVICT_BYPASSED:
+            StatsIncr(tv, dtv->counter_flow_evict_bypassed);
+            break;
+        case FLOW_EVICT_NO_APP_STATE:
+            StatsIncr(tv, dtv->counter_flow_evict_no_app_state);
+            break;
+        case FLOW_EVICT_OLDEST:
+            StatsIncr(tv, dtv->counter_flow_evict_oldest);
+            break;
+    }
+    StatsAddUI64(tv, dtv->counter_flow_evict_bytes,
+            f->todstbytecnt + f->tosrcbytecnt);
+}
+
 /** \internal
  *  \brief Get a flow from the hash directly.
  *
@@ -612,6 +1079,12 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  *  top each time since that would clear the top of the hash leading to longer
  *  and longer search times under high pressure (observed).
  *
+ *  Of the first flow.eviction-scan flows that can be freed, the one of the
+ *  lowest FlowEvictClass is evicted, so a flood of new flows pushes out
+ *  bypassed and other new flows before the sessions we have state for.
+ *  The row and flow of the best candidate so far stay locked, other locks
+ *  are only tried so holding them can't deadlock.
+ *
  *  \param tv thread vars
  *  \param dtv decode thread vars (for flow log api thread data)
  *
@@ -620,9 +1093,13 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 {
     uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
-    uint32_t cnt = flow_config.hash_size;
+    uint32_t cnt;
+    uint32_t candidates = 0;
+    FlowBucket *best_fb = NULL;
+    Flow *best = NULL;
+    enum FlowEvictClass best_c = FLOW_EVICT_OLDEST;
 
-    while (cnt--) {
+    for (cnt = 1; cnt <= flow_config.hash_size; cnt++) {
         if (++idx >= flow_config.hash_size)
             idx = 0;
 
@@ -650,52 +1127,637 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
             continue;
         }
 
-        /* remove from the hash */
-        if (f->hprev != NULL)
-            f->hprev->hnext = f->hnext;
-        if (f->hnext != NULL)
-            f->hnext->hprev = f->hprev;
-        if (fb->head == f)
-            fb->head = f->hnext;
-        if (fb->tail == f)
-            fb->tail = f->hprev;
-
-        f->hnext = NULL;
-        f->hprev = NULL;
-        f->fb = NULL;
-        SC_ATOMIC_SET(fb->next_ts, 0);
-        FBLOCK_UNLOCK(fb);
+        const enum FlowEvictClass c = FlowEvictGetClass(f);
+        if (best == NULL || FlowEvictBefore(f, c, best, best_c)) {
+            if (best != NULL) {
+                FLOWLOCK_UNLOCK(best);
+                FBLOCK_UNLOCK(best_fb);
+            }
+            best = f;
+            best_fb = fb;
+            best_c = c;
+        } else {
+            FLOWLOCK_UNLOCK(f);
+            FBLOCK_UNLOCK(fb);
+        }
 
-        int state = SC_ATOMIC_GET(f->flow_state);
-        if (state == FLOW_STATE_NEW)
-            f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
-        else if (state == FLOW_STATE_ESTABLISHED)
-            f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
-        else if (state == FLOW_STATE_CLOSED)
-            f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
-        else if (state == FLOW_STATE_CAPTURE_BYPASSED)
-            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
-        else if (state == FLOW_STATE_LOCAL_BYPASSED)
-            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+        if (best_c == FLOW_EVICT_BYPASSED ||
+                ++candidates >= flow_config.eviction_scan)
+            break;
+    }
 
-        f->flow_end_flags |= FLOW_END_FLAG_FORCED;
+    if (best == NULL)
+        return NULL;
 
-        if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
-            f->flow_end_flags |= FLOW_END_FLAG_EMERGENCY;
+    Flow *f = best;
+    FlowBucket *fb = best_fb;
+
+    /* remove from the hash */
+    if (f->hprev != NULL)
+        f->hprev->hnext = f->hnext;
+    if (f->hnext != NULL)
+        f->hnext->hprev = f->hprev;
+    if (fb->head == f)
+        fb->head = f->hnext;
+    if (fb->tail == f)
+        fb->tail = f->hprev;
+    FlowBucketTagsRemove(fb, f);
+
+    f->hnext = NULL;
+    f->hprev = NULL;
+    f->fb = NULL;
+    SC_ATOMIC_SET(fb->next_ts, 0);
+    FBLOCK_UNLOCK(fb);
 
-        /* invoke flow log api */
-        if (dtv && dtv->output_flow_thread_data)
-            (void)OutputFlowLog(tv, dtv->output_flow_thread_data, f);
+    FlowEvictUpdateCounters(tv, dtv, f, best_c);
+    FlowReuseUsedFlow(tv, dtv, f);
 
-        FlowClearMemory(f, f->protomap);
+    (void) SC_ATOMIC_ADD(flow_prune_idx, cnt);
+    return f;
+}
 
-        FlowUpdateState(f, FLOW_STATE_NEW);
+/** \internal
+ *  \brief Get a flow from the thread's own table at memcap
+ *
+ *  Like FlowGetUsedFlow(), but the rows don't need locking. Flows that
+ *  still have pseudo packets pending have a use_cnt and are skipped, as
+ *  is the row the caller is updating.
+ */
+static Flow *FlowThreadTableGetUsed(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t)
+{
+    uint32_t idx = t->prune_idx;
+    uint32_t candidates = 0;
+    uint32_t best_idx = 0;
+    Flow *best = NULL;
+    enum FlowEvictClass best_c = FLOW_EVICT_OLDEST;
+
+    for (uint32_t cnt = 0; cnt < t->size; cnt++) {
+        if (++idx >= t->size)
+            idx = 0;
 
-        FLOWLOCK_UNLOCK(f);
+        FlowBucket *fb = &t->rows[idx];
+        Flow *f = fb->tail;
+        if (f == NULL || fb == t->busy)
+            continue;
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
-        return f;
+        if (SC_ATOMIC_GET(f->use_cnt) > 0)
+            continue;
+
+        /* only this thread updates these flows, so no lock is needed
+         * to compare them */
+        const enum FlowEvictClass c = FlowEvictGetClass(f);
+        if (best == NULL || FlowEvictBefore(f, c, best, best_c)) {
+            best = f;
+            best_idx = idx;
+            best_c = c;
+        }
+
+        if (best_c == FLOW_EVICT_BYPASSED ||
+                ++candidates >= flow_config.eviction_scan)
+            break;
     }
+    if (best == NULL)
+        return NULL;
 
-    return NULL;
+    Flow *f = best;
+    FlowBucket *fb = &t->rows[best_idx];
+
+    FLOWLOCK_WRLOCK(f);
+    FlowThreadTableUnlink(fb, f);
+    f->fb = NULL;
+    SC_ATOMIC_SET(fb->next_ts, 0);
+
+    FlowEvictUpdateCounters(tv, dtv, f, best_c);
+    FlowReuseUsedFlow(tv, dtv, f);
+
+    t->prune_idx = idx;
+    return f;
+}
+
+/**
+ *  \brief Allocate the private flow table of a flow worker thread
+ *
+ *  The row locks are not initialized, they are never used.
+ *
+ *  \param tv owning thread, woken up by the flow manager when it is idle
+ *
+ *  \retval t table or NULL if per thread tables are disabled or the
+ *          memcap doesn't allow it, in which case the shared hash is used
+ */
+FlowThreadTable *FlowThreadTableAlloc(ThreadVars *tv)
+{
+    if (!flow_config.thread_local)
+        return NULL;
+
+    const uint64_t rows_size =
+        (uint64_t)flow_config.thread_hash_size * sizeof(FlowBucket);
+    if (!(FLOW_CHECK_MEMCAP(sizeof(FlowThreadTable) + rows_size))) {
+        SCLogWarning(SC_ERR_FLOW_INIT, "flow memcap reached, thread "
+                "will use the shared flow hash");
+        return NULL;
+    }
+
+    FlowThreadTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    t->rows = SCMallocAligned(rows_size, CLS);
+    if (unlikely(t->rows == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    memset(t->rows, 0, rows_size);
+    t->size = flow_config.thread_hash_size;
+    t->tv = tv;
+    SC_ATOMIC_INIT(t->timeout_ts);
+    SC_ATOMIC_INIT(t->timeout_req);
+    MemcapCounterIncr(&flow_memuse, sizeof(FlowThreadTable) + rows_size);
+
+    SCMutexLock(&flow_thread_tables_lock);
+    t->next = flow_thread_tables;
+    flow_thread_tables = t;
+    SCMutexUnlock(&flow_thread_tables_lock);
+    return t;
+}
+
+void FlowThreadTableFree(FlowThreadTable *t)
+{
+    if (t == NULL)
+        return;
+
+    SCMutexLock(&flow_thread_tables_lock);
+    FlowThreadTable **pt = &flow_thread_tables;
+    while (*pt != NULL && *pt != t)
+        pt = &(*pt)->next;
+    if (*pt != NULL)
+        *pt = t->next;
+    SCMutexUnlock(&flow_thread_tables_lock);
+
+    /* normally empty, the engine shutdown hands the flows to the
+     * flow recycler */
+    for (uint32_t u = 0; u < t->size; u++) {
+        Flow *f = t->rows[u].head;
+        while (f) {
+            Flow *n = f->hnext;
+            FlowClearMemory(f, f->protomap);
+            FlowFree(f);
+            f = n;
+        }
+    }
+
+    MemcapCounterDecr(&flow_memuse, sizeof(FlowThreadTable) +
+            (uint64_t)t->size * sizeof(FlowBucket));
+    SC_ATOMIC_DESTROY(t->timeout_ts);
+    SC_ATOMIC_DESTROY(t->timeout_req);
+    SCFreeAligned(t->rows);
+    SCFree(t);
+}
+
+/**
+ *  \brief time out the thread's private flow table if a pass is due
+ *
+ *  A pass runs once per second of packet time, and when the flow manager
+ *  asked for one. Pseudo packets only run the passes that were asked for,
+ *  with the time of the request, as they don't carry a packet time.
+ */
+void FlowThreadTableCheckTimeout(FlowThreadTable *t, const Packet *p)
+{
+    const uint32_t req = SC_ATOMIC_GET(t->timeout_req);
+    const bool pseudo = PKT_IS_PSEUDOPKT(p);
+    const uint32_t sec = (uint32_t)p->ts.tv_sec;
+
+    if (likely(req == 0) &&
+            (pseudo || SC_ATOMIC_GET(t->timeout_ts) == sec))
+        return;
+
+    struct timeval ts = p->ts;
+    if (pseudo || req > sec) {
+        ts.tv_sec = req;
+        ts.tv_usec = 0;
+    }
+    if (!pseudo)
+        SC_ATOMIC_SET(t->timeout_ts, sec);
+    /* cleared before the pass, so a request made meanwhile isn't lost */
+    SC_ATOMIC_SET(t->timeout_req, 0);
+
+    FlowThreadTableTimeout(t, &ts);
+}
+
+/**
+ *  \brief ask the owners of the per thread flow tables for a timeout pass
+ *
+ *  Called by the flow manager. A worker only times out its table while it
+ *  handles packets, so the capture of a thread that fell more than a second
+ *  behind is made to inject a pseudo packet to run the pass on. In
+ *  emergency mode every thread is asked, so the emergency timeouts apply
+ *  to the private tables right away, not at the next packet second.
+ *
+ *  \param ts flow manager time
+ *  \param emergency flow engine is in emergency mode
+ */
+void FlowThreadTablesRequestTimeout(const struct timeval *ts,
+        const bool emergency)
+{
+    const uint32_t now = (uint32_t)ts->tv_sec;
+
+    SCMutexLock(&flow_thread_tables_lock);
+    for (FlowThreadTable *t = flow_thread_tables; t != NULL; t = t->next) {
+        if (SC_ATOMIC_GET(t->timeout_req) != 0)
+            continue;
+        if (!emergency && SC_ATOMIC_GET(t->timeout_ts) + 1 >= now)
+            continue;
+
+        SC_ATOMIC_SET(t->timeout_req, now);
+        if (t->tv != NULL)
+            TmThreadsSetFlag(t->tv, THV_CAPTURE_INJECT_PKT);
+    }
+    SCMutexUnlock(&flow_thread_tables_lock);
+}
+
+/**
+ *  \brief Run RowFunc on every row of all per thread flow tables
+ *
+ *  Only for the engine shutdown, once the worker threads no longer
+ *  look up flows.
+ */
+void FlowThreadTablesForEachRow(void (*RowFunc)(FlowBucket *))
+{
+    SCMutexLock(&flow_thread_tables_lock);
+    for (FlowThreadTable *t = flow_thread_tables; t != NULL; t = t->next) {
+        for (uint32_t u = 0; u < t->size; u++) {
+            RowFunc(&t->rows[u]);
+        }
+    }
+    SCMutexUnlock(&flow_thread_tables_lock);
+}
+
+#ifdef UNITTESTS
+
+/** \test tag index keeps the most recently used flows of a bucket, also
+ *        if all of them have the same tag */
+static int FlowHashTagsTest01(void)
+{
+    const int cnt = FLOW_BUCKET_TAGS + 2;
+    Packet *p[FLOW_BUCKET_TAGS + 2];
+    Flow f[FLOW_BUCKET_TAGS + 2];
+    FlowBucketTags bt;
+    FlowBucket fb;
+    memset(&f, 0, sizeof(f));
+    memset(&bt, 0, sizeof(bt));
+    memset(&fb, 0, sizeof(fb));
+
+    for (int i = 0; i < cnt; i++) {
+        p[i] = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+                "10.0.0.2", 1024 + i, 53);
+        FAIL_IF_NULL(p[i]);
+        FlowInit(&f[i], p[i]);
+        FlowBucketTagsUse(&bt, 0x1234, &f[i]);
+    }
+    /* first two dropped out */
+    FAIL_IF_NOT_NULL(FlowBucketTagsLookup(&bt, 0x1234, p[0]));
+    FAIL_IF_NOT_NULL(FlowBucketTagsLookup(&bt, 0x1234, p[1]));
+    for (int i = 2; i < cnt; i++) {
+        FAIL_IF(FlowBucketTagsLookup(&bt, 0x1234, p[i]) != &f[i]);
+        /* other tag */
+        FAIL_IF_NOT_NULL(FlowBucketTagsLookup(&bt, 0x4321, p[i]));
+    }
+    FAIL_IF(bt.flow[0] != &f[cnt - 1]);
+
+    /* use moves to the front without dropping anything */
+    FlowBucketTagsUse(&bt, 0x1234, &f[3]);
+    FAIL_IF(bt.flow[0] != &f[3]);
+    FAIL_IF(bt.flow[1] != &f[cnt - 1]);
+    for (int i = 2; i < cnt; i++) {
+        FAIL_IF(FlowBucketTagsLookup(&bt, 0x1234, p[i]) != &f[i]);
+    }
+
+    /* remove */
+    FlowBucket *saved_hash = flow_hash;
+    FlowBucketTags *saved_tags = flow_hash_tags;
+    const uint32_t saved_size = flow_config.hash_size;
+    flow_hash = &fb;
+    flow_hash_tags = &bt;
+    flow_config.hash_size = 1;
+    FlowBucketTagsRemove(&fb, &f[3]);
+    flow_hash = saved_hash;
+    flow_hash_tags = saved_tags;
+    flow_config.hash_size = saved_size;
+    FAIL_IF_NOT_NULL(FlowBucketTagsLookup(&bt, 0x1234, p[3]));
+    FAIL_IF(FlowBucketTagsLookup(&bt, 0x1234, p[4]) != &f[4]);
+
+    for (int i = 0; i < cnt; i++) {
+        UTHFreePacket(p[i]);
+    }
+    PASS;
+}
+
+/** \test per thread table: flows go to the thread's table and are timed
+ *        out from it, after the fallback new flows use the shared hash */
+static int FlowThreadTableTest01(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.thread_local = 1;
+    flow_config.thread_hash_size = 64;
+
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+    dtv.flow_table = FlowThreadTableAlloc(NULL);
+    FAIL_IF_NULL(dtv.flow_table);
+    FlowThreadTable *t = dtv.flow_table;
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+            "10.0.0.2", 1024, 53);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+            "10.0.0.2", 1025, 53);
+    FAIL_IF_NULL(p2);
+    FlowSetupPacket(p1);
+    FlowSetupPacket(p2);
+
+    Flow *f1 = FlowGetFlowFromHash(NULL, &dtv, p1, &p1->flow);
+    FAIL_IF_NULL(f1);
+    FLOWLOCK_UNLOCK(f1);
+    FAIL_IF(f1->fb != &t->rows[p1->flow_hash % t->size]);
+    FAIL_IF_NOT_NULL(flow_hash[p1->flow_hash % flow_config.hash_size].head);
+    FlowDeReference(&p1->flow);
+
+    FAIL_IF(FlowGetFlowFromHash(NULL, &dtv, p1, &p1->flow) != f1);
+    FLOWLOCK_UNLOCK(f1);
+    FlowDeReference(&p1->flow);
+
+    /* after the fallback known flows are still found in the table, new
+     * ones go to the shared hash */
+    t->fallback = true;
+    FAIL_IF(FlowGetFlowFromHash(NULL, &dtv, p1, &p1->flow) != f1);
+    FLOWLOCK_UNLOCK(f1);
+    FlowDeReference(&p1->flow);
+    Flow *f2 = FlowGetFlowFromHash(NULL, &dtv, p2, &p2->flow);
+    FAIL_IF_NULL(f2);
+    FLOWLOCK_UNLOCK(f2);
+    FAIL_IF(flow_hash[p2->flow_hash % flow_config.hash_size].head != f2);
+    FlowDeReference(&p2->flow);
+    t->fallback = false;
+
+    /* timeout moves the flow to the recycler */
+    struct timeval ts = p1->ts;
+    ts.tv_sec += 3600;
+    FAIL_IF(FlowThreadTableTimeout(t, &ts) != 1);
+    FAIL_IF_NOT_NULL(t->rows[p1->flow_hash % t->size].head);
+    FAIL_IF(flow_recycle_q.len != 1);
+    FAIL_IF(!(f1->flow_end_flags & FLOW_END_FLAG_TIMEOUT));
+
+    FlowThreadTableFree(t);
+    flow_config.thread_local = 0;
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  the flow manager gets the flows of an idle thread timed out, and
+ *         the fallback to the shared hash is kept per thread
+ */
+static int FlowThreadTableTest02(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.thread_local = 1;
+    flow_config.thread_hash_size = 64;
+
+    DecodeThreadVars dtv1, dtv2;
+    memset(&dtv1, 0, sizeof(dtv1));
+    memset(&dtv2, 0, sizeof(dtv2));
+    dtv1.flow_table = FlowThreadTableAlloc(NULL);
+    FAIL_IF_NULL(dtv1.flow_table);
+    dtv2.flow_table = FlowThreadTableAlloc(NULL);
+    FAIL_IF_NULL(dtv2.flow_table);
+    FlowThreadTable *t1 = dtv1.flow_table;
+    FlowThreadTable *t2 = dtv2.flow_table;
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+            "10.0.0.2", 1024, 53);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+            "10.0.0.2", 1025, 53);
+    FAIL_IF_NULL(p2);
+    FlowSetupPacket(p1);
+    FlowSetupPacket(p2);
+
+    /* a fallback of the first thread doesn't affect the second */
+    t1->fallback = true;
+    Flow *f2 = FlowGetFlowFromHash(NULL, &dtv2, p2, &p2->flow);
+    FAIL_IF_NULL(f2);
+    FLOWLOCK_UNLOCK(f2);
+    FAIL_IF(f2->fb != &t2->rows[p2->flow_hash % t2->size]);
+    FlowDeReference(&p2->flow);
+    t1->fallback = false;
+
+    FlowThreadTableCheckTimeout(t1, p1);
+    Flow *f1 = FlowGetFlowFromHash(NULL, &dtv1, p1, &p1->flow);
+    FAIL_IF_NULL(f1);
+    FLOWLOCK_UNLOCK(f1);
+    FlowDeReference(&p1->flow);
+    FAIL_IF(SC_ATOMIC_GET(t1->timeout_ts) != (uint32_t)p1->ts.tv_sec);
+
+    /* nothing is asked of a thread that is up to date */
+    struct timeval ts = p1->ts;
+    SC_ATOMIC_SET(t2->timeout_ts, (uint32_t)ts.tv_sec + 3600);
+    FlowThreadTablesRequestTimeout(&ts, false);
+    FAIL_IF(SC_ATOMIC_GET(t1->timeout_req) != 0);
+
+    /* the thread stays idle, the flow manager asks for a pass which runs
+     * on the pseudo packet the capture injects */
+    ts.tv_sec += 3600;
+    FlowThreadTablesRequestTimeout(&ts, false);
+    FAIL_IF(SC_ATOMIC_GET(t1->timeout_req) != (uint32_t)ts.tv_sec);
+    FAIL_IF(SC_ATOMIC_GET(t2->timeout_req) != 0);
+
+    Packet *pp = PacketGetFromAlloc();
+    FAIL_IF_NULL(pp);
+    pp->flags |= PKT_PSEUDO_STREAM_END;
+    FlowThreadTableCheckTimeout(t1, pp);
+    FAIL_IF(SC_ATOMIC_GET(t1->timeout_req) != 0);
+    FAIL_IF_NOT_NULL(t1->rows[p1->flow_hash % t1->size].head);
+    FAIL_IF(!(f1->flow_end_flags & FLOW_END_FLAG_TIMEOUT));
+
+    /* in emergency mode every thread is asked */
+    FlowThreadTablesRequestTimeout(&p1->ts, true);
+    FAIL_IF(SC_ATOMIC_GET(t1->timeout_req) == 0);
+    FAIL_IF(SC_ATOMIC_GET(t2->timeout_req) == 0);
+
+    PacketFree(pp);
+    FlowThreadTableFree(t1);
+    FlowThreadTableFree(t2);
+    flow_config.thread_local = 0;
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  at memcap bypassed flows are evicted first, then flows without
+ *         app-layer state, then the others.
+ */
+static int FlowEvictTest01(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.thread_local = 1;
+    flow_config.thread_hash_size = 64;
+
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+    dtv.flow_table = FlowThreadTableAlloc(NULL);
+    FAIL_IF_NULL(dtv.flow_table);
+    FlowThreadTable *t = dtv.flow_table;
+
+    Flow *f[3];
+    Packet *p[3];
+    for (int i = 0; i < 3; i++) {
+        p[i] = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "10.0.0.1",
+                "10.0.0.2", 1024 + i, 53);
+        FAIL_IF_NULL(p[i]);
+        FlowSetupPacket(p[i]);
+        f[i] = FlowGetFlowFromHash(NULL, &dtv, p[i], &p[i]->flow);
+        FAIL_IF_NULL(f[i]);
+        FLOWLOCK_UNLOCK(f[i]);
+        FlowDeReference(&p[i]->flow);
+    }
+    /* f[0] is an app-layer session, f[1] is bypassed, f[2] has no state */
+    int alstate;
+    f[0]->alstate = &alstate;
+    FlowUpdateState(f[1], FLOW_STATE_LOCAL_BYPASSED);
+
+    Flow *e = FlowThreadTableGetUsed(NULL, &dtv, t);
+    FAIL_IF(e != f[1]);
+    FlowEnqueue(&flow_spare_q, e);
+    e = FlowThreadTableGetUsed(NULL, &dtv, t);
+    FAIL_IF(e != f[2]);
+    FlowEnqueue(&flow_spare_q, e);
+    FAIL_IF(f[0]->fb == NULL);
+
+    f[0]->alstate = NULL;
+    FlowThreadTableFree(t);
+    flow_config.thread_local = 0;
+    for (int i = 0; i < 3; i++)
+        UTHFreePacket(p[i]);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  the ICMP error and the reassembled datagram of a flow are looked
+ *         up in the row of the flow, whatever hash the capture had put in
+ *         the packets.
+ */
+static int FlowHashLookupTest01(void)
+{
+    /* udp 10.0.0.1:1024 -> 10.0.0.2:53 */
+    uint8_t udp_pkt[] = {
+        0x45, 0x00, 0x00, 0x24, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x10, 0x00, 0x00,
+        0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    };
+    /* port unreachable from 10.0.0.2 for the datagram above */
+    uint8_t icmp_pkt[] = {
+        0x45, 0x00, 0x00, 0x38, 0x00, 0x02, 0x00, 0x00,
+        0x40, 0x01, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x02,
+        0x0a, 0x00, 0x00, 0x01,
+        0x03, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x45, 0x00, 0x00, 0x24, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x10, 0x00, 0x00,
+    };
+    /* next datagram of the flow in two fragments */
+    uint8_t frag1_pkt[] = {
+        0x45, 0x00, 0x00, 0x24, 0x00, 0x03, 0x20, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x18, 0x00, 0x00,
+        0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+    };
+    uint8_t frag2_pkt[] = {
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x03, 0x00, 0x02,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+    };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    memset(&pq, 0, sizeof(pq));
+
+    FlowInitConfig(FLOW_QUIET);
+    DefragInit();
+
+    /* a capture hash, as a NIC would put it, doesn't survive decoding */
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p1);
+    p1->flow_hash = 0x12345678;
+    FAIL_IF(PacketCopyData(p1, udp_pkt, sizeof(udp_pkt)) != 0);
+    DecodeIPV4(&tv, &dtv, p1, GET_PKT_DATA(p1), GET_PKT_LEN(p1), &pq);
+    FAIL_IF_NULL(p1->udph);
+    FAIL_IF(p1->flow_hash != FlowGetHash(p1));
+    Flow *f = FlowGetFlowFromHash(NULL, &dtv, p1, &p1->flow);
+    FAIL_IF_NULL(f);
+    FLOWLOCK_UNLOCK(f);
+
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+    p2->flow_hash = 0x9abcdef0;
+    FAIL_IF(PacketCopyData(p2, icmp_pkt, sizeof(icmp_pkt)) != 0);
+    DecodeIPV4(&tv, &dtv, p2, GET_PKT_DATA(p2), GET_PKT_LEN(p2), &pq);
+    FAIL_IF_NOT(ICMPV4_DEST_UNREACH_IS_VALID(p2));
+    FAIL_IF(p2->flow_hash != p1->flow_hash);
+    FAIL_IF(FlowGetFlowFromHash(NULL, &dtv, p2, &p2->flow) != f);
+    FLOWLOCK_UNLOCK(f);
+
+    Packet *p3 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p3);
+    p3->flow_hash = 0x12345678;
+    FAIL_IF(PacketCopyData(p3, frag1_pkt, sizeof(frag1_pkt)) != 0);
+    DecodeIPV4(&tv, &dtv, p3, GET_PKT_DATA(p3), GET_PKT_LEN(p3), &pq);
+    FAIL_IF_NOT(p3->flags & PKT_IS_FRAGMENT);
+    FAIL_IF(p3->flags & PKT_WANTS_FLOW);
+    Packet *p4 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p4);
+    p4->flow_hash = 0x12345678;
+    FAIL_IF(PacketCopyData(p4, frag2_pkt, sizeof(frag2_pkt)) != 0);
+    DecodeIPV4(&tv, &dtv, p4, GET_PKT_DATA(p4), GET_PKT_LEN(p4), &pq);
+    Packet *rp = PacketDequeue(&pq);
+    FAIL_IF_NULL(rp);
+    FAIL_IF_NULL(rp->udph);
+    FAIL_IF(rp->flow_hash != p1->flow_hash);
+    FAIL_IF(FlowGetFlowFromHash(NULL, &dtv, rp, &rp->flow) != f);
+    FLOWLOCK_UNLOCK(f);
+
+    FlowDeReference(&p1->flow);
+    FlowDeReference(&p2->flow);
+    FlowDeReference(&rp->flow);
+    PacketFree(p1);
+    PacketFree(p2);
+    PacketFree(p3);
+    PacketFree(p4);
+    PacketFree(rp);
+    DefragDestroy();
+    FlowShutdown();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FlowHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowHashTagsTest01", FlowHashTagsTest01);
+    UtRegisterTest("FlowThreadTableTest01", FlowThreadTableTest01);
+    UtRegisterTest("FlowThreadTableTest02", FlowThreadTableTest02);
+    UtRegisterTest("FlowEvictTest01", FlowEvictTest01);
+    UtRegisterTest("FlowHashLookupTest01", FlowHashLookupTest01);
+#endif /* UNITTESTS */
 }
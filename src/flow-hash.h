@@ -72,9 +72,68 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** flows per bucket in the tag index, so FlowBucketTags is a cache line */
+#define FLOW_BUCKET_TAGS 6
+
+/* optional tag index of the flow hash (flow.bucket-tags), one per bucket.
+ * It holds the most recently used flows of the bucket with 16 bits of
+ * their hash that weren't used to pick the bucket. Lookups compare all
+ * tags at once and only look at the flows that match, instead of walking
+ * the list. The bucket list stays authoritative, the index is protected
+ * by the bucket lock and flows have to be removed from it when they are
+ * taken out of the bucket. */
+typedef struct FlowBucketTags_ {
+    /** the last 2 are unused, they make the tags a 16 byte vector */
+    uint16_t tag[FLOW_BUCKET_TAGS + 2];
+    Flow *flow[FLOW_BUCKET_TAGS];
+} __attribute__((aligned(CLS))) FlowBucketTags;
+
+extern FlowBucketTags *flow_hash_tags;
+
+/* private flow table of a flow worker thread (flow.thread-local). Only the
+ * owning thread adds, looks up and times out its flows, so the rows are
+ * never locked. Rows are FlowBucket's so Flow::fb works as usual. The flow
+ * manager only asks the owner for a timeout pass, when the thread is idle
+ * or in emergency mode. */
+typedef struct FlowThreadTable_ {
+    FlowBucket *rows;
+    uint32_t size;
+    /** row to start from when looking for a flow to reuse at memcap */
+    uint32_t prune_idx;
+    /** row the timeout pass continues at */
+    uint32_t timeout_idx;
+    /** packet second the owner last ran a timeout pass at */
+    SC_ATOMIC_DECLARE(uint32_t, timeout_ts);
+    /** second the flow manager asked for a timeout pass at, 0 if none is
+     *  pending */
+    SC_ATOMIC_DECLARE(uint32_t, timeout_req);
+    /** owning thread, woken up through its capture when idle */
+    ThreadVars *tv;
+    /** delivery to this thread turned out to be asymmetric, its new
+     *  flows go to the shared hash */
+    bool fallback;
+    /** row that is being updated, skipped when reusing flows */
+    FlowBucket *busy;
+    /** new TCP flows and how many of them started with a SYN/ACK, used
+     *  to detect asymmetric delivery of flows to the threads */
+    uint32_t tcp_new;
+    uint32_t tcp_synack;
+    struct FlowThreadTable_ *next;
+} FlowThreadTable;
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+void FlowHashPrefetch(const DecodeThreadVars *dtv, Packet * const *pkts,
+        const uint32_t cnt);
+void FlowBucketTagsRemove(const FlowBucket *fb, const Flow *f);
+FlowThreadTable *FlowThreadTableAlloc(ThreadVars *tv);
+void FlowThreadTableFree(FlowThreadTable *t);
+void FlowThreadTableCheckTimeout(FlowThreadTable *t, const Packet *p);
+void FlowThreadTablesRequestTimeout(const struct timeval *ts,
+        const bool emergency);
+void FlowThreadTablesForEachRow(void (*RowFunc)(FlowBucket *));
+void FlowHashRegisterTests(void);
 
 void FlowDisableTcpReuseHandling(void);
 
@@ -41,10 +41,12 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp.h"
+#include "stream-tcp-memuse.h"
 
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -64,6 +66,9 @@
 #include "host-timeout.h"
 #include "defrag-timeout.h"
 #include "ippair-timeout.h"
+#include "detect-engine-threshold.h"
+#include "detect-engine-tag.h"
+#include "app-layer-expectation.h"
 
 #include "output-flow.h"
 
@@ -80,6 +85,85 @@ static uint32_t flowrec_number = 1;
 /* atomic counter for flow recyclers, to assign instance id */
 SC_ATOMIC_DECLARE(uint32_t, flowrec_cnt);
 
+/* recycle queues of the recyclers after the first, which uses
+ * flow_recycle_q. Each queue gets the flows of a part of the hash. */
+static FlowQueue *flow_recycle_queues = NULL;
+/* number of recycle queues, including flow_recycle_q */
+static uint32_t flow_recycle_queues_cnt = 1;
+
+/** \brief get recycle queue, 0 being flow_recycle_q */
+static inline FlowQueue *FlowRecycleQueue(uint32_t n)
+{
+    return (n == 0) ? &flow_recycle_q : &flow_recycle_queues[n - 1];
+}
+
+/** \internal
+ *  \brief get the recycle queue for the part of the hash a flow is in
+ *
+ *  The hash is split in as many ranges as there are queues, like it is
+ *  split between the flow managers, so with as many recyclers as managers
+ *  the managers don't share a queue.
+ */
+static inline FlowQueue *FlowRecycleQueueForFlow(const Flow *f)
+{
+    if (flow_recycle_queues_cnt == 1)
+        return &flow_recycle_q;
+
+    const uint32_t idx = f->flow_hash % flow_config.hash_size;
+    return FlowRecycleQueue((uint32_t)(((uint64_t)idx * flow_recycle_queues_cnt) /
+                flow_config.hash_size));
+}
+
+/** \internal
+ *  \brief read flow.recyclers and set up a recycle queue per recycler
+ *
+ *  Done before the flow managers start, as they fill the queues.
+ */
+static void FlowRecycleQueuesSetup(void)
+{
+    if (flow_recycle_queues != NULL)
+        return;
+
+    intmax_t setting = 1;
+    (void)ConfGetInt("flow.recyclers", &setting);
+
+    if (setting < 1 || setting > 1024) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS,
+                "invalid flow.recyclers setting %"PRIdMAX, setting);
+        exit(EXIT_FAILURE);
+    }
+    flowrec_number = (uint32_t)setting;
+    if (flowrec_number == 1)
+        return;
+
+    flow_recycle_queues = SCCalloc(flowrec_number - 1, sizeof(FlowQueue));
+    if (flow_recycle_queues == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc flow recycle queues");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t u = 0; u < flowrec_number - 1; u++)
+        FlowQueueInit(&flow_recycle_queues[u]);
+    flow_recycle_queues_cnt = flowrec_number;
+}
+
+/** \brief free the recycle queues of the extra recyclers and their flows */
+void FlowRecycleQueuesFree(void)
+{
+    if (flow_recycle_queues == NULL)
+        return;
+
+    for (uint32_t u = 0; u < flow_recycle_queues_cnt - 1; u++) {
+        Flow *f;
+        while ((f = FlowDequeue(&flow_recycle_queues[u]))) {
+            FlowFree(f);
+        }
+        FlowQueueDestroy(&flow_recycle_queues[u]);
+    }
+    SCFree(flow_recycle_queues);
+    flow_recycle_queues = NULL;
+    flow_recycle_queues_cnt = 1;
+}
+
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 
@@ -116,12 +200,15 @@ typedef struct FlowTimeoutCounters_ {
     uint32_t flows_timeout;
     uint32_t flows_timeout_inuse;
     uint32_t flows_removed;
+    uint32_t flows_compacted;
 
     uint32_t rows_checked;
     uint32_t rows_skipped;
     uint32_t rows_empty;
     uint32_t rows_busy;
     uint32_t rows_maxlen;
+
+    FlowTimeoutFlush flush;
 } FlowTimeoutCounters;
 
 /**
@@ -254,17 +341,89 @@ static int FlowManagerFlowTimeout(const Flow *f, enum FlowState state, struct ti
     return 1;
 }
 
+/** \internal
+ *  \brief Compact the state of a flow that has been idle for
+ *         flow.idle-compact-timeout seconds, but has not timed out.
+ *
+ *  Prunes the stream and frees the completed transactions, the inspected
+ *  body data and the slack of the streaming buffers, so long lived flows
+ *  that are mostly idle hold on to as little memory as possible. Done
+ *  once per idle period, the next packet of the flow clears the flag.
+ *
+ *  \param f flow, hash row is locked by the caller
+ *  \param ts timestamp
+ *  \param next_ts next time the row needs to be checked
+ *
+ *  \retval 1 compacted
+ *  \retval 0 not idle long enough, already compacted or busy
+ */
+static int FlowManagerFlowCompact(Flow *f, struct timeval *ts, int32_t *next_ts)
+{
+    if (flow_config.idle_compact == 0 || (f->flags & FLOW_IDLE_COMPACTED))
+        return 0;
+
+    int32_t compact_at = (int32_t)(f->lastts.tv_sec + flow_config.idle_compact);
+    if (compact_at >= ts->tv_sec) {
+        if (*next_ts == 0 || compact_at < *next_ts)
+            *next_ts = compact_at;
+        return 0;
+    }
+
+    /* in use by a packet, so not idle after all */
+    if (SC_ATOMIC_GET(f->use_cnt) > 0)
+        return 0;
+    /* don't wait for a busy flow, next pass will do */
+    if (FLOWLOCK_TRYWRLOCK(f) != 0)
+        return 0;
+
+    if (f->proto == IPPROTO_TCP && f->protoctx != NULL)
+        StreamTcpCompactSession(f);
+    if (f->alparser != NULL)
+        AppLayerParserStateCompact(f);
+    f->flags |= FLOW_IDLE_COMPACTED;
+
+    FLOWLOCK_UNLOCK(f);
+    return 1;
+}
+
+/** \internal
+ *  \brief expire the session tags of a flow that is not timing out yet
+ *
+ *  The row is scheduled for the next tag expiry, so the tags of a busy
+ *  flow are released on time instead of on its next packet.
+ *
+ *  \param f flow
+ *  \param ts timestamp
+ *  \param next_ts in/out earliest time the row needs checking
+ */
+static void FlowManagerFlowTagsTimeout(Flow *f, struct timeval *ts, int32_t *next_ts)
+{
+    if (!(f->flags & FLOW_HAS_TAGS))
+        return;
+    /* don't wait for a busy flow, next pass will do */
+    if (FLOWLOCK_TRYWRLOCK(f) != 0)
+        return;
+
+    uint32_t due = TagFlowTimeoutCheck(f, ts);
+    FLOWLOCK_UNLOCK(f);
+
+    if (due != 0 && (*next_ts == 0 || (int32_t)due < *next_ts))
+        *next_ts = (int32_t)due;
+}
+
 /** \internal
  *  \brief See if we can really discard this flow. Check use_cnt reference
  *         counter and force reassembly if necessary.
  *
  *  \param f flow
  *  \param ts timestamp
+ *  \param flush pseudo packet batch of this pass or NULL
  *
  *  \retval 0 not timed out just yet
  *  \retval 1 fully timed out, lets kill it
  */
-static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
+static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts,
+        FlowTimeoutFlush *flush)
 {
     /* never prune a flow that is used by a packet we
      * are currently processing in one of the threads */
@@ -276,7 +435,7 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
 
     if (!(f->flags & FLOW_TIMEOUT_REASSEMBLY_DONE) &&
             FlowForceReassemblyNeedReassembly(f, &server, &client) == 1) {
-        FlowForceReassemblyForFlow(f, server, client);
+        FlowForceReassemblyForFlowBatch(f, server, client, flush);
         return 0;
     }
 #ifdef DEBUG
@@ -296,11 +455,13 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param pool_wait wait for packets in the pool before taking a flow
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters, int32_t *next_ts)
+        int emergency, FlowTimeoutCounters *counters, int32_t *next_ts,
+        const bool pool_wait)
 {
     uint32_t cnt = 0;
     uint32_t checked = 0;
@@ -319,6 +480,9 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
         if (FlowManagerFlowTimeout(f, state, ts, next_ts) == 0) {
 
             counters->flows_notimeout++;
+            if (FlowManagerFlowCompact(f, ts, next_ts) == 1)
+                counters->flows_compacted++;
+            FlowManagerFlowTagsTimeout(f, ts, next_ts);
 
             f = f->hprev;
             continue;
@@ -326,7 +490,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* before grabbing the flow lock, make sure we have at least
          * 3 packets in the pool */
-        PacketPoolWaitForN(3);
+        if (pool_wait)
+            PacketPoolWaitForN(3);
 
         FLOWLOCK_WRLOCK(f);
 
@@ -336,7 +501,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* check if the flow is fully timed out and
          * ready to be discarded. */
-        if (FlowManagerFlowTimedOut(f, ts) == 1) {
+        if (FlowManagerFlowTimedOut(f, ts, &counters->flush) == 1) {
             /* remove from the hash */
             if (f->hprev != NULL)
                 f->hprev->hnext = f->hnext;
@@ -346,6 +511,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                 f->fb->head = f->hnext;
             if (f->fb->tail == f)
                 f->fb->tail = f->hprev;
+            FlowBucketTagsRemove(f->fb, f);
 
             f->hnext = NULL;
             f->hprev = NULL;
@@ -371,7 +537,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
             /* no one is referring to this flow, use_cnt 0, removed from hash
              * so we can unlock it and pass it to the flow recycler */
             FLOWLOCK_UNLOCK(f);
-            FlowEnqueue(&flow_recycle_q, f);
+            FlowEnqueue(FlowRecycleQueueForFlow(f), f);
 
             cnt++;
 
@@ -415,12 +581,13 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
  *  \param hash_min min hash index to consider
  *  \param hash_max max hash index to consider
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param w timeout wheel to schedule the rows in, or NULL
  *
  *  \retval cnt number of timed out flow
  */
 static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
         uint32_t hash_min, uint32_t hash_max,
-        FlowTimeoutCounters *counters)
+        FlowTimeoutCounters *counters, FlowWheel *w)
 {
     uint32_t idx = 0;
     uint32_t cnt = 0;
@@ -437,6 +604,8 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
         int32_t check_ts = SC_ATOMIC_GET(fb->next_ts);
         if (check_ts > (int32_t)ts->tv_sec) {
             counters->rows_skipped++;
+            if (w != NULL && check_ts != INT_MAX)
+                FlowWheelSchedule(w, idx, (uint32_t)check_ts);
             continue;
         }
 
@@ -446,6 +615,8 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
 
         if (FBLOCK_TRYLOCK(fb) != 0) {
             counters->rows_busy++;
+            if (w != NULL)
+                FlowWheelSchedule(w, idx, (uint32_t)ts->tv_sec + 1);
             continue;
         }
 
@@ -460,9 +631,11 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
         int32_t next_ts = 0;
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts);
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts, true);
 
         SC_ATOMIC_SET(fb->next_ts, next_ts);
+        if (w != NULL && fb->tail != NULL)
+            FlowWheelSchedule(w, idx, (uint32_t)next_ts);
 
 next:
         FBLOCK_UNLOCK(fb);
@@ -474,6 +647,146 @@ next:
     return cnt;
 }
 
+/** \internal
+ *  \brief time out the flows of a row taken from the wheel and schedule
+ *         the row again for the earliest timeout of its flows
+ */
+static uint32_t FlowTimeoutWheelRow(FlowWheel *w, uint32_t idx,
+        struct timeval *ts, int emergency, FlowTimeoutCounters *counters)
+{
+    FlowBucket *fb = &flow_hash[idx];
+
+    counters->rows_checked++;
+
+    /* before grabbing the row lock, make sure we have at least
+     * 9 packets in the pool */
+    PacketPoolWaitForN(9);
+
+    if (FBLOCK_TRYLOCK(fb) != 0) {
+        counters->rows_busy++;
+        FlowWheelSchedule(w, idx, (uint32_t)ts->tv_sec + 1);
+        return 0;
+    }
+
+    /* empty rows are left out of the wheel until a flow is added */
+    if (fb->tail == NULL) {
+        SC_ATOMIC_SET(fb->next_ts, INT_MAX);
+        counters->rows_empty++;
+        FBLOCK_UNLOCK(fb);
+        return 0;
+    }
+
+    int32_t next_ts = 0;
+    uint32_t cnt = FlowManagerHashRowTimeout(fb->tail, ts, emergency,
+            counters, &next_ts, true);
+    SC_ATOMIC_SET(fb->next_ts, next_ts);
+    const bool empty = (fb->tail == NULL);
+    FBLOCK_UNLOCK(fb);
+
+    if (!empty)
+        FlowWheelSchedule(w, idx, (uint32_t)next_ts);
+    return cnt;
+}
+
+/**
+ *  \brief time out flows using the wheel of this flow manager
+ *
+ *  Only the rows that are due and those the workers queued are visited.
+ *  The whole part of the hash is walked on the first run and after the
+ *  time jumped further than the wheel reaches, to (re)build the wheel, and
+ *  in emergency mode, as the rows were scheduled for the normal timeouts.
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowTimeoutWheel(FlowWheel *w, struct timeval *ts,
+        FlowTimeoutCounters *counters)
+{
+    const uint32_t now = (uint32_t)ts->tv_sec;
+    uint32_t cnt = 0;
+    int emergency = 0;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    const bool rebuild = (w->now == 0 || now > w->now + FLOW_WHEEL_SPAN);
+    if (rebuild)
+        FlowWheelReset(w, now);
+    if (rebuild || emergency)
+        cnt += FlowTimeoutHash(ts, 0, w->min, w->max, counters, w);
+
+    /* rows with new flows or flows that changed state */
+    uint32_t idx = FlowWheelTakeIntake(w);
+    while (idx != FLOW_WHEEL_NONE) {
+        const uint32_t next = FlowWheelIntakeNext(idx);
+        cnt += FlowTimeoutWheelRow(w, idx, ts, emergency, counters);
+        idx = next;
+    }
+
+    idx = FlowWheelExpire(w, now);
+    while (idx != FLOW_WHEEL_NONE) {
+        const uint32_t next = flow_wheel_rows[idx].next;
+        cnt += FlowTimeoutWheelRow(w, idx, ts, emergency, counters);
+        idx = next;
+    }
+
+    return cnt;
+}
+
+/** flows of a private table that may get reassembly pseudo packets in one
+ *  timeout pass */
+#define FLOW_THREAD_TIMEOUT_INUSE_MAX 64
+
+/**
+ *  \brief time out the flows of a thread's private flow table
+ *
+ *  Run by the owning thread through FlowThreadTableCheckTimeout(), like
+ *  FlowTimeoutHash() on the shared hash but without row locks. It doesn't
+ *  wait for the packet pool, as that is refilled by this same thread.
+ *  Instead the pass stops once FLOW_THREAD_TIMEOUT_INUSE_MAX flows couldn't
+ *  be removed yet, which includes those that just got pseudo packets. The
+ *  next pass continues where this one stopped.
+ *
+ *  \retval cnt number of timed out flows
+ */
+uint32_t FlowThreadTableTimeout(FlowThreadTable *t, struct timeval *ts)
+{
+    FlowTimeoutCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    FlowTimeoutFlushInit(&counters.flush);
+    uint32_t cnt = 0;
+    int emergency = 0;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    for (uint32_t u = 0; u < t->size; u++) {
+        if (++t->timeout_idx >= t->size)
+            t->timeout_idx = 0;
+
+        FlowBucket *fb = &t->rows[t->timeout_idx];
+
+        int32_t check_ts = SC_ATOMIC_GET(fb->next_ts);
+        if (check_ts > (int32_t)ts->tv_sec)
+            continue;
+
+        if (fb->tail == NULL) {
+            SC_ATOMIC_SET(fb->next_ts, INT_MAX);
+            continue;
+        }
+
+        int32_t next_ts = 0;
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, &counters,
+                &next_ts, false);
+        SC_ATOMIC_SET(fb->next_ts, next_ts);
+
+        if (counters.flows_timeout_inuse >= FLOW_THREAD_TIMEOUT_INUSE_MAX)
+            break;
+    }
+    FlowTimeoutFlushInject(&counters.flush);
+
+    return cnt;
+}
+
 /**
  *  \internal
  *
@@ -503,6 +816,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
             f->fb->head = f->hnext;
         if (f->fb->tail == f)
             f->fb->tail = f->hprev;
+        FlowBucketTagsRemove(f->fb, f);
 
         f->hnext = NULL;
         f->hprev = NULL;
@@ -520,7 +834,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
          * so we can unlock it and move it to the recycle queue. */
         FLOWLOCK_UNLOCK(f);
 
-        FlowEnqueue(&flow_recycle_q, f);
+        FlowEnqueue(FlowRecycleQueueForFlow(f), f);
 
         cnt++;
 
@@ -555,12 +869,20 @@ static uint32_t FlowCleanupHash(void){
     return cnt;
 }
 
+static void FlowCleanupThreadTableRow(FlowBucket *fb)
+{
+    if (fb->tail != NULL)
+        (void)FlowManagerHashRowCleanup(fb->tail);
+}
+
 extern int g_detect_disabled;
 
 typedef struct FlowManagerThreadData_ {
     uint32_t instance;
     uint32_t min;
     uint32_t max;
+    /** timeout wheel for our part of the hash, NULL to walk the hash */
+    FlowWheel *wheel;
 
     uint16_t flow_mgr_cnt_clo;
     uint16_t flow_mgr_cnt_new;
@@ -576,6 +898,7 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_mgr_flows_timeout;
     uint16_t flow_mgr_flows_timeout_inuse;
     uint16_t flow_mgr_flows_removed;
+    uint16_t flow_mgr_flows_compacted;
 
     uint16_t flow_mgr_rows_checked;
     uint16_t flow_mgr_rows_skipped;
@@ -583,6 +906,14 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_mgr_rows_busy;
     uint16_t flow_mgr_rows_maxlen;
 
+    uint16_t flow_mgr_stream_evicted;
+
+    uint16_t thresholds_entries;
+    uint16_t thresholds_evicted;
+
+    uint16_t flow_mgr_pseudo_injected;
+    uint16_t flow_mgr_pseudo_deferred;
+
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void **data)
@@ -610,6 +941,10 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
 
     SCLogDebug("instance %u hash range %u %u", ftd->instance, ftd->min, ftd->max);
 
+    ftd->wheel = FlowWheelGet(ftd->instance);
+    BUG_ON(ftd->wheel != NULL &&
+            (ftd->wheel->min != ftd->min || ftd->wheel->max != ftd->max));
+
     /* pass thread data back to caller */
     *data = ftd;
 
@@ -627,6 +962,7 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
     ftd->flow_mgr_flows_timeout = StatsRegisterCounter("flow_mgr.flows_timeout", t);
     ftd->flow_mgr_flows_timeout_inuse = StatsRegisterCounter("flow_mgr.flows_timeout_inuse", t);
     ftd->flow_mgr_flows_removed = StatsRegisterCounter("flow_mgr.flows_removed", t);
+    ftd->flow_mgr_flows_compacted = StatsRegisterCounter("flow_mgr.flows_compacted", t);
 
     ftd->flow_mgr_rows_checked = StatsRegisterCounter("flow_mgr.rows_checked", t);
     ftd->flow_mgr_rows_skipped = StatsRegisterCounter("flow_mgr.rows_skipped", t);
@@ -634,6 +970,14 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
     ftd->flow_mgr_rows_busy = StatsRegisterCounter("flow_mgr.rows_busy", t);
     ftd->flow_mgr_rows_maxlen = StatsRegisterCounter("flow_mgr.rows_maxlen", t);
 
+    ftd->flow_mgr_stream_evicted = StatsRegisterCounter("flow_mgr.stream_evicted", t);
+
+    ftd->thresholds_entries = StatsRegisterCounter("thresholds.entries", t);
+    ftd->thresholds_evicted = StatsRegisterCounter("thresholds.evicted", t);
+
+    ftd->flow_mgr_pseudo_injected = StatsRegisterCounter("flow_mgr.pseudo_injected", t);
+    ftd->flow_mgr_pseudo_deferred = StatsRegisterCounter("flow_mgr.pseudo_deferred", t);
+
     PacketPoolInit();
     return TM_ECODE_OK;
 }
@@ -700,15 +1044,31 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
             FlowUpdateSpareFlows();
 
         /* try to time out flows */
-        FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        FlowTimeoutCounters counters;
+        memset(&counters, 0, sizeof(counters));
+        FlowTimeoutFlushInit(&counters.flush);
+        if (ftd->wheel != NULL)
+            FlowTimeoutWheel(ftd->wheel, &ts, &counters);
+        else
+            FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters, NULL);
+        FlowTimeoutFlushInject(&counters.flush);
 
 
         if (ftd->instance == 1) {
+            FlowThreadTablesRequestTimeout(&ts,
+                    (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) != 0);
             DefragTimeoutHash(&ts);
             //uint32_t hosts_pruned =
             HostTimeoutHash(&ts);
             IPPairTimeoutHash(&ts);
+            AppLayerExpectationTimeout(&ts);
+
+            uint32_t evicted = StreamTcpMemuseEvict();
+            StatsAddUI64(th_v, ftd->flow_mgr_stream_evicted, (uint64_t)evicted);
+
+            ThresholdsTimeoutCheck(&ts);
+            StatsSetUI64(th_v, ftd->thresholds_entries, ThresholdsGetEntryCount());
+            StatsSetUI64(th_v, ftd->thresholds_evicted, ThresholdsGetEvictedCount());
         }
 /*
         StatsAddUI64(th_v, flow_mgr_host_prune, (uint64_t)hosts_pruned);
@@ -728,6 +1088,7 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         StatsSetUI64(th_v, ftd->flow_mgr_flows_timeout, (uint64_t)counters.flows_timeout);
         StatsSetUI64(th_v, ftd->flow_mgr_flows_removed, (uint64_t)counters.flows_removed);
         StatsSetUI64(th_v, ftd->flow_mgr_flows_timeout_inuse, (uint64_t)counters.flows_timeout_inuse);
+        StatsAddUI64(th_v, ftd->flow_mgr_flows_compacted, (uint64_t)counters.flows_compacted);
 
         StatsSetUI64(th_v, ftd->flow_mgr_rows_checked, (uint64_t)counters.rows_checked);
         StatsSetUI64(th_v, ftd->flow_mgr_rows_skipped, (uint64_t)counters.rows_skipped);
@@ -735,6 +1096,9 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         StatsSetUI64(th_v, ftd->flow_mgr_rows_busy, (uint64_t)counters.rows_busy);
         StatsSetUI64(th_v, ftd->flow_mgr_rows_empty, (uint64_t)counters.rows_empty);
 
+        StatsAddUI64(th_v, ftd->flow_mgr_pseudo_injected, (uint64_t)counters.flush.injected);
+        StatsAddUI64(th_v, ftd->flow_mgr_pseudo_deferred, (uint64_t)counters.flush.deferred);
+
         uint32_t len = 0;
         FQLOCK_LOCK(&flow_spare_q);
         len = flow_spare_q.len;
@@ -797,6 +1161,20 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
 }
 
 /** \brief spawn the flow manager thread */
+/** memory used by the timeout wheel, 0 if it is not used */
+static uint64_t flow_wheel_memuse = 0;
+
+/** \brief free the flow timeout wheel, if it was set up */
+void FlowTimeoutWheelDestroy(void)
+{
+    if (flow_wheel_memuse == 0)
+        return;
+
+    FlowWheelDestroy();
+    MemcapCounterDecr(&flow_memuse, flow_wheel_memuse);
+    flow_wheel_memuse = 0;
+}
+
 void FlowManagerThreadSpawn()
 {
 #ifdef AFLFUZZ_DISABLE_MGTTHREADS
@@ -813,6 +1191,28 @@ void FlowManagerThreadSpawn()
     flowmgr_number = (uint32_t)setting;
 
     SCLogConfig("using %u flow manager threads", flowmgr_number);
+
+    /* the managers start handing flows to the recyclers right away */
+    FlowRecycleQueuesSetup();
+
+    int timeout_wheel = 0;
+    if (ConfGetBool("flow.timeout-wheel", &timeout_wheel) == 1 && timeout_wheel) {
+        FlowTimeoutWheelDestroy();
+
+        const uint64_t size = FlowWheelMemuse(flow_config.hash_size, flowmgr_number);
+        if (!(FLOW_CHECK_MEMCAP(size))) {
+            SCLogError(SC_ERR_FLOW_INIT, "allocating flow timeout wheel failed: "
+                    "max flow memcap is smaller than projected size %"PRIu64, size);
+            exit(EXIT_FAILURE);
+        }
+        if (FlowWheelInit(flow_config.hash_size, flowmgr_number) != 0) {
+            SCLogError(SC_ERR_FLOW_INIT, "allocating flow timeout wheel failed");
+            exit(EXIT_FAILURE);
+        }
+        MemcapCounterIncr(&flow_memuse, size);
+        flow_wheel_memuse = size;
+        SCLogConfig("flow timeout wheel enabled, %"PRIu64" bytes", size);
+    }
     SCCtrlCondInit(&flow_manager_ctrl_cond, NULL);
     SCCtrlMutexInit(&flow_manager_ctrl_mutex, NULL);
 
@@ -842,7 +1242,13 @@ void FlowManagerThreadSpawn()
     return;
 }
 
+/** max number of flows a recycler takes from its queue at once */
+#define FLOW_RECYCLER_BATCH 64
+
 typedef struct FlowRecyclerThreadData_ {
+    uint32_t instance;
+    /** queue with the flows of our part of the hash */
+    FlowQueue *recycle_q;
     void *output_thread_data;
 } FlowRecyclerThreadData;
 
@@ -852,6 +1258,11 @@ static TmEcode FlowRecyclerThreadInit(ThreadVars *t, const void *initdata, void
     if (ftd == NULL)
         return TM_ECODE_FAILED;
 
+    ftd->instance = SC_ATOMIC_ADD(flowrec_cnt, 1);
+    BUG_ON(ftd->instance > flow_recycle_queues_cnt);
+    ftd->recycle_q = FlowRecycleQueue(ftd->instance - 1);
+    SCLogDebug("flow recycler instance %u", ftd->instance);
+
     if (OutputFlowLogThreadInit(t, NULL, &ftd->output_thread_data) != TM_ECODE_OK) {
         SCLogError(SC_ERR_THREAD_INIT, "initializing flow log API for thread failed");
         SCFree(ftd);
@@ -903,23 +1314,30 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
         SCLogDebug("ts %" PRIdMAX "", (intmax_t)ts.tv_sec);
 
         uint32_t len = 0;
-        FQLOCK_LOCK(&flow_recycle_q);
-        len = flow_recycle_q.len;
-        FQLOCK_UNLOCK(&flow_recycle_q);
-
-        /* Loop through the queue and clean up all flows in it */
+        FQLOCK_LOCK(ftd->recycle_q);
+        len = ftd->recycle_q->len;
+        FQLOCK_UNLOCK(ftd->recycle_q);
+
+        /* Loop through the queue and clean up all flows in it. Flows are
+         * taken and returned to the spare queue in batches, so the queue
+         * locks are taken once per batch instead of twice per flow, and
+         * the spare queue gets flows back while the rest is logged. */
         if (len) {
-            Flow *f;
+            Flow *list;
+            uint32_t cnt;
 
-            while ((f = FlowDequeue(&flow_recycle_q)) != NULL) {
-                FLOWLOCK_WRLOCK(f);
+            while ((list = FlowDequeueBatch(ftd->recycle_q,
+                            FLOW_RECYCLER_BATCH, &cnt)) != NULL) {
+                for (Flow *f = list; f != NULL; f = f->lnext) {
+                    FLOWLOCK_WRLOCK(f);
 
-                (void)OutputFlowLog(th_v, ftd->output_thread_data, f);
+                    (void)OutputFlowLog(th_v, ftd->output_thread_data, f);
 
-                FlowClearMemory (f, f->protomap);
-                FLOWLOCK_UNLOCK(f);
-                FlowMoveToSpare(f);
-                recycled_cnt++;
+                    FlowClearMemory (f, f->protomap);
+                    FLOWLOCK_UNLOCK(f);
+                }
+                FlowMoveListToSpare(list);
+                recycled_cnt += cnt;
             }
         }
 
@@ -950,9 +1368,12 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
 static int FlowRecyclerReadyToShutdown(void)
 {
     uint32_t len = 0;
-    FQLOCK_LOCK(&flow_recycle_q);
-    len = flow_recycle_q.len;
-    FQLOCK_UNLOCK(&flow_recycle_q);
+    for (uint32_t u = 0; u < flow_recycle_queues_cnt; u++) {
+        FlowQueue *q = FlowRecycleQueue(u);
+        FQLOCK_LOCK(q);
+        len += q->len;
+        FQLOCK_UNLOCK(q);
+    }
 
     return ((len == 0));
 }
@@ -963,15 +1384,7 @@ void FlowRecyclerThreadSpawn()
 #ifdef AFLFUZZ_DISABLE_MGTTHREADS
     return;
 #endif
-    intmax_t setting = 1;
-    (void)ConfGetInt("flow.recyclers", &setting);
-
-    if (setting < 1 || setting > 1024) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS,
-                "invalid flow.recyclers setting %"PRIdMAX, setting);
-        exit(EXIT_FAILURE);
-    }
-    flowrec_number = (uint32_t)setting;
+    FlowRecycleQueuesSetup();
 
     SCLogConfig("using %u flow recycler threads", flowrec_number);
 
@@ -1021,6 +1434,7 @@ void FlowDisableFlowRecyclerThread(void)
 
     /* move all flows still in the hash to the recycler queue */
     FlowCleanupHash();
+    FlowThreadTablesForEachRow(FlowCleanupThreadTableRow);
 
     /* make sure all flows are processed */
     do {
@@ -1152,7 +1566,7 @@ static int FlowMgrTest01 (void)
 
     int32_t next_ts = 0;
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts, NULL) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1208,7 +1622,7 @@ static int FlowMgrTest02 (void)
 
     int32_t next_ts = 0;
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts, NULL) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1256,7 +1670,7 @@ static int FlowMgrTest03 (void)
 
     int next_ts = 0;
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts, NULL) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1313,7 +1727,7 @@ static int FlowMgrTest04 (void)
 
     int next_ts = 0;
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, &next_ts) != 1 && FlowManagerFlowTimedOut(&f, &ts, NULL) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1365,8 +1779,11 @@ static int FlowMgrTest05 (void)
     struct timeval ts;
     TimeGet(&ts);
     /* try to time out flows */
-    FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
-    FlowTimeoutHash(&ts, 0 /* check all */, 0, flow_config.hash_size, &counters);
+    FlowTimeoutCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    FlowTimeoutFlushInit(&counters.flush);
+    FlowTimeoutHash(&ts, 0 /* check all */, 0, flow_config.hash_size, &counters, NULL);
+    FlowTimeoutFlushInject(&counters.flush);
 
     if (flow_recycle_q.len > 0) {
         result = 1;
@@ -1376,6 +1793,40 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+/**
+ *  \test  Flows go to the recycle queue of their part of the hash.
+ */
+static int FlowMgrTest06 (void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF(ConfSet("flow.recyclers", "4") != 1);
+
+    FlowInitConfig(FLOW_QUIET);
+    FlowRecycleQueuesSetup();
+    FAIL_IF(flow_recycle_queues_cnt != 4);
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    f.flow_hash = 0;
+    FAIL_IF(FlowRecycleQueueForFlow(&f) != &flow_recycle_q);
+    f.flow_hash = flow_config.hash_size / 4;
+    FAIL_IF(FlowRecycleQueueForFlow(&f) != &flow_recycle_queues[0]);
+    f.flow_hash = flow_config.hash_size - 1;
+    FAIL_IF(FlowRecycleQueueForFlow(&f) != &flow_recycle_queues[2]);
+    /* wraps like the hash lookup */
+    f.flow_hash = flow_config.hash_size;
+    FAIL_IF(FlowRecycleQueueForFlow(&f) != &flow_recycle_q);
+
+    FlowShutdown();
+    FAIL_IF(flow_recycle_queues != NULL);
+    FAIL_IF(flow_recycle_queues_cnt != 1);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1394,5 +1845,7 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Test recycle queue per hash range",
+                   FlowMgrTest06);
 #endif /* UNITTESTS */
 }
@@ -35,6 +35,8 @@ SCCtrlMutex flow_manager_ctrl_mutex;
 
 void FlowManagerThreadSpawn(void);
 void FlowDisableFlowManagerThread(void);
+void FlowTimeoutWheelDestroy(void);
+uint32_t FlowThreadTableTimeout(struct FlowThreadTable_ *t, struct timeval *ts);
 void FlowMgrRegisterTests (void);
 
 /** flow recycler scheduling condition */
@@ -45,6 +47,7 @@ SCCtrlMutex flow_recycler_ctrl_mutex;
 
 void FlowRecyclerThreadSpawn(void);
 void FlowDisableFlowRecyclerThread(void);
+void FlowRecycleQueuesFree(void);
 
 void TmModuleFlowManagerRegister (void);
 void TmModuleFlowRecyclerRegister (void);
@@ -28,6 +28,7 @@
 #include "flow-queue.h"
 
 #include "util-atomic.h"
+#include "util-memcap.h"
 
 /* global flow flags */
 
@@ -97,7 +98,7 @@ FlowBucket *flow_hash;
 FlowConfig flow_config;
 
 /** flow memuse counter (atomic), for enforcing memcap limit */
-SC_ATOMIC_DECLARE(uint64_t, flow_memuse);
+MemcapCounter flow_memuse;
 
 #endif /* __FLOW_PRIVATE_H__ */
 
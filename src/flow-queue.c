@@ -135,6 +135,60 @@ Flow *FlowDequeue (FlowQueue *q)
     return f;
 }
 
+/**
+ *  \brief remove up to \a max flows from the queue at once
+ *
+ *  Flows are taken in the same order as FlowDequeue() would return them
+ *  and are returned as a list linked through Flow::lnext.
+ *
+ *  \param q queue
+ *  \param max max number of flows to take
+ *  \param cnt set to the number of flows taken
+ *
+ *  \retval f first flow of the list or NULL if the queue was empty
+ */
+Flow *FlowDequeueBatch(FlowQueue *q, uint32_t max, uint32_t *cnt)
+{
+    *cnt = 0;
+    if (max == 0)
+        return NULL;
+
+    FQLOCK_LOCK(q);
+    Flow *head = q->bot;
+    if (head == NULL) {
+        FQLOCK_UNLOCK(q);
+        return NULL;
+    }
+
+    /* walk up from the bottom, relinking the taken flows through lnext */
+    Flow *f = head;
+    uint32_t n = 1;
+    while (n < max && f->lprev != NULL) {
+        Flow *prev = f->lprev;
+        f->lnext = prev;
+        f = prev;
+        n++;
+    }
+    q->bot = f->lprev;
+    if (q->bot != NULL)
+        q->bot->lnext = NULL;
+    else
+        q->top = NULL;
+    f->lnext = NULL;
+
+#ifdef DEBUG
+    BUG_ON(q->len < n);
+#endif
+    q->len -= MIN(q->len, n);
+    FQLOCK_UNLOCK(q);
+
+    for (f = head; f != NULL; f = f->lnext) {
+        f->lprev = NULL;
+    }
+    *cnt = n;
+    return head;
+}
+
 /**
  *  \brief Transfer a flow from a queue to the spare queue
  *
@@ -166,3 +220,39 @@ void FlowMoveToSpare(Flow *f)
     FQLOCK_UNLOCK(&flow_spare_q);
 }
 
+/**
+ *  \brief Transfer a list of flows to the spare queue at once
+ *
+ *  Like FlowMoveToSpare() for each flow, but taking the spare queue
+ *  lock only once.
+ *
+ *  \param list flows linked through Flow::lnext, as returned by
+ *         FlowDequeueBatch()
+ */
+void FlowMoveListToSpare(Flow *list)
+{
+    if (list == NULL)
+        return;
+
+    FQLOCK_LOCK(&flow_spare_q);
+    Flow *f = list;
+    while (f != NULL) {
+        Flow *next = f->lnext;
+
+        f->lprev = flow_spare_q.bot;
+        if (f->lprev != NULL)
+            f->lprev->lnext = f;
+        f->lnext = NULL;
+        flow_spare_q.bot = f;
+        if (flow_spare_q.top == NULL)
+            flow_spare_q.top = f;
+        flow_spare_q.len++;
+
+        f = next;
+    }
+#ifdef DBG_PERF
+    if (flow_spare_q.len > flow_spare_q.dbg_maxlen)
+        flow_spare_q.dbg_maxlen = flow_spare_q.len;
+#endif /* DBG_PERF */
+    FQLOCK_UNLOCK(&flow_spare_q);
+}
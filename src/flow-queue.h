@@ -78,8 +78,10 @@ void FlowQueueDestroy (FlowQueue *);
 
 void FlowEnqueue (FlowQueue *, Flow *);
 Flow *FlowDequeue (FlowQueue *);
+Flow *FlowDequeueBatch(FlowQueue *, uint32_t, uint32_t *);
 
 void FlowMoveToSpare(Flow *);
+void FlowMoveListToSpare(Flow *);
 
 #endif /* __FLOW_QUEUE_H__ */
 
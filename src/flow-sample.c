@@ -0,0 +1,366 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow sampling for overload protection.
+ *
+ * When a new flow is set up 1 in 'rate' flows is kept, based on the flow
+ * hash. The others are bypassed, so their packets skip stream, detect
+ * and output, but the flows that are kept see all of their packets.
+ * Flows with an address in the 'keep' list are never sampled out.
+ *
+ * With 'adaptive' the rate follows the capture ring: it's doubled each
+ * second the ring is above its high water mark, up to 'max-rate', and
+ * halved back to 'rate' after the ring drained.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "conf.h"
+#include "conf-yaml-loader.h"
+#include "counters.h"
+#include "flow.h"
+#include "flow-sample.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-radix-tree.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#define FLOW_SAMPLE_MAX_RATE 65536
+
+int g_flow_sample_enabled = 0;
+
+static uint32_t flow_sample_rate = 1;
+static uint32_t flow_sample_max_rate = 1;
+static int flow_sample_adaptive = 0;
+
+/** networks that are never sampled out, NULL if none */
+static SCRadixTree *flow_sample_keep = NULL;
+/** user data of the keep tree, lookups need a non NULL value */
+static int flow_sample_keep_data = 1;
+
+static int FlowSampleParseRate(const char *name, uint32_t *rate)
+{
+    const char *str = NULL;
+    if (ConfGet(name, &str) != 1 || str == NULL)
+        return 0;
+
+    uint32_t value = 0;
+    if (ByteExtractStringUint32(&value, 10, strlen(str), str) != (int)strlen(str) ||
+            value == 0 || value > FLOW_SAMPLE_MAX_RATE)
+    {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s must be between 1 and %u",
+                name, FLOW_SAMPLE_MAX_RATE);
+        return -1;
+    }
+    *rate = value;
+    return 0;
+}
+
+static int FlowSampleAddKeep(const char *str)
+{
+    SCRadixNode *node;
+    if (strchr(str, ':') != NULL) {
+        node = SCRadixAddKeyIPV6String(str, flow_sample_keep,
+                &flow_sample_keep_data);
+    } else {
+        node = SCRadixAddKeyIPV4String(str, flow_sample_keep,
+                &flow_sample_keep_data);
+    }
+    if (node == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "flow.sampling.keep: invalid "
+                "address \"%s\"", str);
+        return -1;
+    }
+    return 0;
+}
+
+void FlowSampleInitConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("flow.sampling.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    uint32_t rate = 1;
+    if (FlowSampleParseRate("flow.sampling.rate", &rate) < 0)
+        return;
+    uint32_t max_rate = rate;
+    if (FlowSampleParseRate("flow.sampling.max-rate", &max_rate) < 0)
+        return;
+    if (max_rate < rate) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "flow.sampling.max-rate is "
+                "lower than flow.sampling.rate, using %u", rate);
+        max_rate = rate;
+    }
+    int adaptive = 0;
+    (void)ConfGetBool("flow.sampling.adaptive", &adaptive);
+
+    ConfNode *keep = ConfGetNode("flow.sampling.keep");
+    if (keep != NULL) {
+        flow_sample_keep = SCRadixCreateRadixTree(NULL, NULL);
+        if (flow_sample_keep == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "flow.sampling: failed to set up "
+                    "the keep list");
+            return;
+        }
+        ConfNode *n;
+        TAILQ_FOREACH(n, &keep->head, next) {
+            if (n->val == NULL || FlowSampleAddKeep(n->val) < 0) {
+                FlowSampleDestroy();
+                return;
+            }
+        }
+    }
+
+    if (rate == 1 && !(adaptive && max_rate > 1)) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "flow.sampling is enabled "
+                "but keeps all flows");
+    }
+
+    flow_sample_rate = rate;
+    flow_sample_max_rate = max_rate;
+    flow_sample_adaptive = adaptive;
+    g_flow_sample_enabled = 1;
+    SCLogConfig("flow sampling: keeping 1 in %u flows%s", rate,
+            adaptive ? ", adapting to the capture ring" : "");
+}
+
+void FlowSampleDestroy(void)
+{
+    if (flow_sample_keep != NULL) {
+        SCRadixReleaseRadixTree(flow_sample_keep);
+        flow_sample_keep = NULL;
+    }
+    flow_sample_rate = 1;
+    flow_sample_max_rate = 1;
+    flow_sample_adaptive = 0;
+    g_flow_sample_enabled = 0;
+}
+
+void FlowSampleRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    if (!g_flow_sample_enabled)
+        return;
+
+    dtv->flow_sample_rate = flow_sample_rate;
+    dtv->counter_flow_sampled_out =
+        StatsRegisterCounter("flow.sampling.sampled_out", tv);
+    dtv->counter_flow_sample_rate =
+        StatsRegisterCounter("flow.sampling.rate", tv);
+}
+
+/** \internal
+ *  \brief update the rate of this thread once per second of packet time */
+static uint32_t FlowSampleUpdateRate(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Packet *p)
+{
+    if (dtv->flow_sample_rate == 0)
+        dtv->flow_sample_rate = flow_sample_rate;
+    if (!flow_sample_adaptive || (uint32_t)p->ts.tv_sec == dtv->flow_sample_ts)
+        return dtv->flow_sample_rate;
+    dtv->flow_sample_ts = (uint32_t)p->ts.tv_sec;
+
+    uint32_t rate = dtv->flow_sample_rate;
+    if (p->flags & PKT_RING_CONGESTED) {
+        rate = MIN(rate * 2, flow_sample_max_rate);
+    } else if (rate > flow_sample_rate) {
+        rate = MAX(rate / 2, flow_sample_rate);
+    }
+    if (rate != dtv->flow_sample_rate) {
+        SCLogDebug("flow sampling rate %u -> %u", dtv->flow_sample_rate, rate);
+        dtv->flow_sample_rate = rate;
+    }
+    StatsSetUI64(tv, dtv->counter_flow_sample_rate, rate);
+    return rate;
+}
+
+/** \internal
+ *  \brief keep 1 in rate hashes. The low bits of the hash pick the flow
+ *         bucket, so use the high bits after mixing or the kept flows
+ *         would all end up in the same buckets. */
+static inline bool FlowSampleHashKeep(uint32_t hash, uint32_t rate)
+{
+    return (((hash * 2654435761U) >> 8) % rate) == 0;
+}
+
+static bool FlowSampleKeepAddress(const Packet *p)
+{
+    if (flow_sample_keep == NULL)
+        return false;
+
+    void *user = NULL;
+    if (PKT_IS_IPV4(p)) {
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)GET_IPV4_SRC_ADDR_PTR(p),
+                flow_sample_keep, &user);
+        if (user == NULL) {
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)GET_IPV4_DST_ADDR_PTR(p),
+                    flow_sample_keep, &user);
+        }
+    } else if (PKT_IS_IPV6(p)) {
+        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)GET_IPV6_SRC_ADDR(p),
+                flow_sample_keep, &user);
+        if (user == NULL) {
+            (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)GET_IPV6_DST_ADDR(p),
+                    flow_sample_keep, &user);
+        }
+    }
+    return user != NULL;
+}
+
+/**
+ *  \brief decide if a new flow is kept, bypass it if not
+ *
+ *  \param f new flow, locked and referenced by p
+ */
+void FlowSampleFlow(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, Flow *f)
+{
+    const uint32_t rate = FlowSampleUpdateRate(tv, dtv, p);
+    if (rate <= 1 || FlowSampleHashKeep(f->flow_hash, rate))
+        return;
+    if (FlowSampleKeepAddress(p))
+        return;
+
+    SCLogDebug("flow %p sampled out, rate %u", f, rate);
+    StatsIncr(tv, dtv->counter_flow_sampled_out);
+    PacketBypassCallback(p);
+}
+
+#ifdef UNITTESTS
+
+/** \test the share of kept hashes matches the rate */
+static int FlowSampleTest01(void)
+{
+    static const uint32_t rates[] = { 2, 4, 10, 64 };
+    const uint32_t n = 1000000;
+
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        uint32_t kept = 0;
+        /* consecutive hashes are the worst case for the mixing */
+        for (uint32_t h = 0; h < n; h++) {
+            kept += FlowSampleHashKeep(h, rates[r]);
+        }
+        const uint32_t expect = n / rates[r];
+        FAIL_IF(kept < expect - expect / 20 || kept > expect + expect / 20);
+    }
+    FAIL_IF_NOT(FlowSampleHashKeep(12345, 1));
+    PASS;
+}
+
+/** \test the rate doubles while the ring is congested and drops back */
+static int FlowSampleTest02(void)
+{
+    const char conf[] = "\
+%YAML 1.1\n\
+---\n\
+flow:\n\
+  sampling:\n\
+    enabled: yes\n\
+    rate: 2\n\
+    max-rate: 8\n\
+    adaptive: yes\n\
+";
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(conf, strlen(conf));
+    FlowSampleInitConfig();
+    FAIL_IF_NOT(g_flow_sample_enabled);
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    p->ts.tv_sec = 1;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 2);
+
+    p->flags |= PKT_RING_CONGESTED;
+    p->ts.tv_sec = 2;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 4);
+    /* same second, no change */
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 4);
+    p->ts.tv_sec = 3;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 8);
+    p->ts.tv_sec = 4;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 8);
+
+    p->flags &= ~PKT_RING_CONGESTED;
+    p->ts.tv_sec = 5;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 4);
+    p->ts.tv_sec = 6;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 2);
+    p->ts.tv_sec = 7;
+    FAIL_IF(FlowSampleUpdateRate(&tv, &dtv, p) != 2);
+
+    UTHFreePacket(p);
+    FlowSampleDestroy();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+/** \test flows of addresses in the keep list are never sampled out */
+static int FlowSampleTest03(void)
+{
+    const char conf[] = "\
+%YAML 1.1\n\
+---\n\
+flow:\n\
+  sampling:\n\
+    enabled: yes\n\
+    rate: 64\n\
+    keep:\n\
+      - 192.168.1.0/24\n\
+      - 2001:db8::/32\n\
+";
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(conf, strlen(conf));
+    FlowSampleInitConfig();
+    FAIL_IF_NOT(g_flow_sample_enabled);
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+            "10.0.0.1", "192.168.1.20", 41424, 80);
+    FAIL_IF_NULL(p1);
+    FAIL_IF_NOT(FlowSampleKeepAddress(p1));
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+            "10.0.0.1", "192.168.2.20", 41424, 80);
+    FAIL_IF_NULL(p2);
+    FAIL_IF(FlowSampleKeepAddress(p2));
+
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    FlowSampleDestroy();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FlowSampleRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowSampleTest01", FlowSampleTest01);
+    UtRegisterTest("FlowSampleTest02", FlowSampleTest02);
+    UtRegisterTest("FlowSampleTest03", FlowSampleTest03);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow sampling for overload protection.
+ *
+ * New flows are kept or bypassed based on their hash, so all packets of
+ * a flow get the same treatment. See 'flow.sampling' in suricata.yaml.
+ */
+
+#ifndef __FLOW_SAMPLE_H__
+#define __FLOW_SAMPLE_H__
+
+#include "decode.h"
+#include "flow.h"
+
+extern int g_flow_sample_enabled;
+
+void FlowSampleInitConfig(void);
+void FlowSampleDestroy(void);
+void FlowSampleRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv);
+void FlowSampleFlow(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, Flow *f);
+void FlowSampleRegisterTests(void);
+
+#endif /* __FLOW_SAMPLE_H__ */
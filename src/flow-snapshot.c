@@ -0,0 +1,436 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Flow snapshot file: a FlowSnapshotHeader followed by cnt records. It is
+ * written to a temporary file that is renamed when complete, and mapped
+ * read only at start. An index of the records by a direction independent
+ * hash of their tuple is built when loading, after that the snapshot is
+ * only read, so the packet threads look it up without locking.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "conf.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-hash.h"
+#include "flow-util.h"
+#include "flow-snapshot.h"
+#include "stream-tcp-private.h"
+
+#include "util-conf.h"
+#include "util-path.h"
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#include <sys/mman.h>
+
+#define FLOW_SNAPSHOT_DEFAULT_FILENAME  "flow.snapshot"
+/** snapshots older than this many seconds are not restored */
+#define FLOW_SNAPSHOT_DEFAULT_MAX_AGE   3600
+
+static int flow_snapshot_enabled = 0;
+static char flow_snapshot_path[PATH_MAX] = "";
+
+/* loaded snapshot */
+static void *flow_snapshot_map = NULL;
+static size_t flow_snapshot_map_size = 0;
+static const FlowSnapshotRecord *flow_snapshot_records = NULL;
+/** record index + 1 per slot, 0 if empty */
+static uint32_t *flow_snapshot_index = NULL;
+static uint32_t flow_snapshot_index_mask = 0;
+
+/* snapshot being written */
+static FILE *flow_snapshot_fp = NULL;
+static uint32_t flow_snapshot_written = 0;
+
+static inline uint32_t FlowSnapshotHash(const uint32_t *a, const uint32_t *b,
+        const uint16_t sp, const uint16_t dp, const uint8_t recursion_level)
+{
+    /* the same for both directions */
+    const uint32_t k[6] = {
+        a[0] ^ b[0], a[1] ^ b[1], a[2] ^ b[2], a[3] ^ b[3],
+        (uint32_t)(sp ^ dp) | ((uint32_t)(sp + dp) << 16),
+        recursion_level,
+    };
+    return hashword(k, 6, 0);
+}
+
+static int FlowSnapshotIndexBuild(uint32_t cnt)
+{
+    uint32_t size = 2;
+    while (size < cnt * 2)
+        size <<= 1;
+
+    flow_snapshot_index = SCCalloc(size, sizeof(uint32_t));
+    if (flow_snapshot_index == NULL)
+        return -1;
+    flow_snapshot_index_mask = size - 1;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const FlowSnapshotRecord *r = &flow_snapshot_records[i];
+        uint32_t h = FlowSnapshotHash(r->src, r->dst, r->sp, r->dp,
+                r->recursion_level) & flow_snapshot_index_mask;
+        while (flow_snapshot_index[h] != 0)
+            h = (h + 1) & flow_snapshot_index_mask;
+        flow_snapshot_index[h] = i + 1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief map a snapshot file and index its records
+ *
+ *  \param now wall clock time
+ *  \param max_age oldest snapshot to use, in seconds
+ *
+ *  \retval cnt number of records, -1 if there is no usable snapshot
+ */
+static int FlowSnapshotLoadFile(const char *path, uint32_t now, uint32_t max_age)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        SCLogDebug("no flow snapshot %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FlowSnapshotHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to map flow snapshot %s: %s",
+                path, strerror(errno));
+        return -1;
+    }
+
+    const FlowSnapshotHeader *h = map;
+    if (memcmp(h->magic, FLOW_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+            h->version != FLOW_SNAPSHOT_VERSION ||
+            h->record_size != sizeof(FlowSnapshotRecord) ||
+            (uint64_t)st.st_size != sizeof(*h) +
+                (uint64_t)h->cnt * sizeof(FlowSnapshotRecord)) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "flow snapshot %s is invalid, "
+                "ignoring it", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (strncmp(h->engine, PROG_VER, sizeof(h->engine)) != 0) {
+        SCLogInfo("flow snapshot %s is from version %.*s, ignoring it",
+                path, (int)sizeof(h->engine), h->engine);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (now < h->ts || now - h->ts > max_age) {
+        SCLogInfo("flow snapshot %s is too old, ignoring it", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    flow_snapshot_map = map;
+    flow_snapshot_map_size = st.st_size;
+    flow_snapshot_records = (const FlowSnapshotRecord *)(h + 1);
+    if (h->cnt == 0 || FlowSnapshotIndexBuild(h->cnt) < 0) {
+        FlowSnapshotDestroy();
+        return h->cnt == 0 ? 0 : -1;
+    }
+    return (int)h->cnt;
+}
+
+void FlowSnapshotInitConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("flow.snapshot.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    const char *filename = NULL;
+    if (ConfGet("flow.snapshot.filename", &filename) != 1 || filename == NULL)
+        filename = FLOW_SNAPSHOT_DEFAULT_FILENAME;
+    if (PathIsAbsolute(filename)) {
+        strlcpy(flow_snapshot_path, filename, sizeof(flow_snapshot_path));
+    } else {
+        snprintf(flow_snapshot_path, sizeof(flow_snapshot_path), "%s/%s",
+                ConfigGetLogDirectory(), filename);
+    }
+
+    intmax_t max_age = FLOW_SNAPSHOT_DEFAULT_MAX_AGE;
+    if (ConfGetInt("flow.snapshot.max-age", &max_age) == 1 &&
+            (max_age < 0 || max_age > UINT32_MAX)) {
+        SCLogError(SC_ERR_INVALID_VALUE, "invalid flow.snapshot.max-age, "
+                "using default %u", FLOW_SNAPSHOT_DEFAULT_MAX_AGE);
+        max_age = FLOW_SNAPSHOT_DEFAULT_MAX_AGE;
+    }
+    flow_snapshot_enabled = 1;
+
+    int cnt = FlowSnapshotLoadFile(flow_snapshot_path, (uint32_t)time(NULL),
+            (uint32_t)max_age);
+    if (cnt > 0) {
+        SCLogConfig("flow snapshot: %d TCP sessions to restore from %s",
+                cnt, flow_snapshot_path);
+    }
+}
+
+void FlowSnapshotDestroy(void)
+{
+    if (flow_snapshot_map != NULL) {
+        munmap(flow_snapshot_map, flow_snapshot_map_size);
+        flow_snapshot_map = NULL;
+        flow_snapshot_map_size = 0;
+    }
+    flow_snapshot_records = NULL;
+    if (flow_snapshot_index != NULL) {
+        SCFree(flow_snapshot_index);
+        flow_snapshot_index = NULL;
+    }
+    flow_snapshot_index_mask = 0;
+}
+
+/**
+ *  \brief find the snapshot record for the session of a packet
+ *
+ *  \param toserver set to 1 if the packet is from the client
+ *
+ *  \retval r record or NULL
+ */
+const FlowSnapshotRecord *FlowSnapshotLookup(const Packet *p, int *toserver)
+{
+    if (flow_snapshot_index == NULL)
+        return NULL;
+
+    const int ipv6 = (p->src.family == AF_INET6);
+    uint32_t h = FlowSnapshotHash(p->src.addr_data32, p->dst.addr_data32,
+            p->sp, p->dp, p->recursion_level) & flow_snapshot_index_mask;
+    while (flow_snapshot_index[h] != 0) {
+        const FlowSnapshotRecord *r =
+            &flow_snapshot_records[flow_snapshot_index[h] - 1];
+        if (((r->flags & FLOW_SNAPSHOT_IPV6) != 0) == ipv6 &&
+                r->recursion_level == p->recursion_level &&
+                r->vlan_id[0] == p->vlan_id[0] &&
+                r->vlan_id[1] == p->vlan_id[1] &&
+                r->domain_id == p->domain_id) {
+            if (memcmp(r->src, p->src.addr_data32, sizeof(r->src)) == 0 &&
+                    memcmp(r->dst, p->dst.addr_data32, sizeof(r->dst)) == 0 &&
+                    r->sp == p->sp && r->dp == p->dp) {
+                *toserver = 1;
+                return r;
+            }
+            if (memcmp(r->src, p->dst.addr_data32, sizeof(r->src)) == 0 &&
+                    memcmp(r->dst, p->src.addr_data32, sizeof(r->dst)) == 0 &&
+                    r->sp == p->dp && r->dp == p->sp) {
+                *toserver = 0;
+                return r;
+            }
+        }
+        h = (h + 1) & flow_snapshot_index_mask;
+    }
+    return NULL;
+}
+
+static void FlowSnapshotWriteRow(FlowBucket *fb)
+{
+    for (Flow *f = fb->head; f != NULL; f = f->hnext) {
+        if (f->proto != IPPROTO_TCP || f->protoctx == NULL)
+            continue;
+        const TcpSession *ssn = f->protoctx;
+        if (ssn->state != TCP_ESTABLISHED)
+            continue;
+
+        FlowSnapshotRecord r;
+        memset(&r, 0, sizeof(r));
+        memcpy(r.src, f->src.addr_data32, sizeof(r.src));
+        memcpy(r.dst, f->dst.addr_data32, sizeof(r.dst));
+        r.sp = f->sp;
+        r.dp = f->dp;
+        r.vlan_id[0] = f->vlan_id[0];
+        r.vlan_id[1] = f->vlan_id[1];
+        r.domain_id = f->domain_id;
+        r.recursion_level = f->recursion_level;
+        r.client_next_seq = ssn->client.next_seq;
+        r.server_next_seq = ssn->server.next_seq;
+        r.client_wscale = ssn->client.wscale;
+        r.server_wscale = ssn->server.wscale;
+        r.alproto = f->alproto;
+        if (ssn->flags & STREAMTCP_FLAG_SACKOK)
+            r.flags |= FLOW_SNAPSHOT_SACKOK;
+        if (FLOW_IS_IPV6(f))
+            r.flags |= FLOW_SNAPSHOT_IPV6;
+
+        if (fwrite(&r, sizeof(r), 1, flow_snapshot_fp) != 1)
+            return;
+        flow_snapshot_written++;
+    }
+}
+
+/**
+ *  \brief write the established TCP sessions of the flow tables
+ *
+ *  \retval cnt number of sessions written, -1 on error
+ */
+static int FlowSnapshotWriteFile(const char *path, uint32_t now)
+{
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    flow_snapshot_fp = fopen(tmp_path, "w");
+    if (flow_snapshot_fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open flow snapshot %s: %s",
+                tmp_path, strerror(errno));
+        return -1;
+    }
+
+    FlowSnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FLOW_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = FLOW_SNAPSHOT_VERSION;
+    h.record_size = sizeof(FlowSnapshotRecord);
+    h.ts = now;
+    strlcpy(h.engine, PROG_VER, sizeof(h.engine));
+
+    int r = -1;
+    if (fwrite(&h, sizeof(h), 1, flow_snapshot_fp) != 1)
+        goto end;
+
+    flow_snapshot_written = 0;
+    if (flow_hash != NULL) {
+        for (uint32_t u = 0; u < flow_config.hash_size; u++)
+            FlowSnapshotWriteRow(&flow_hash[u]);
+    }
+    FlowThreadTablesForEachRow(FlowSnapshotWriteRow);
+
+    h.cnt = flow_snapshot_written;
+    if (fseek(flow_snapshot_fp, 0, SEEK_SET) != 0 ||
+            fwrite(&h, sizeof(h), 1, flow_snapshot_fp) != 1)
+        goto end;
+    r = (int)h.cnt;
+end:
+    if (fclose(flow_snapshot_fp) != 0)
+        r = -1;
+    flow_snapshot_fp = NULL;
+    if (r < 0 || rename(tmp_path, path) != 0) {
+        SCLogError(SC_ERR_FWRITE, "failed to write flow snapshot %s: %s",
+                path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return r;
+}
+
+/**
+ *  \brief write the snapshot, if enabled
+ *
+ *  Called at shutdown once the packet threads are done, before the
+ *  flows are removed from the flow tables.
+ */
+void FlowSnapshotWrite(void)
+{
+    if (!flow_snapshot_enabled)
+        return;
+
+    int cnt = FlowSnapshotWriteFile(flow_snapshot_path, (uint32_t)time(NULL));
+    if (cnt >= 0) {
+        SCLogInfo("flow snapshot: wrote %d TCP sessions to %s", cnt,
+                flow_snapshot_path);
+    }
+}
+
+#ifdef UNITTESTS
+/**
+ *  \test  an established session written to a snapshot is found from
+ *         both directions after loading it
+ */
+static int FlowSnapshotTest01(void)
+{
+    char path[] = "/tmp/suricata-flow-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    FlowInitConfig(FLOW_QUIET);
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "10.0.0.1",
+            "10.0.0.2", 1024, 80);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "10.0.0.2",
+            "10.0.0.1", 80, 1024);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "10.0.0.2",
+            "10.0.0.1", 80, 1025);
+    FAIL_IF_NULL(p3);
+
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+    ssn.state = TCP_ESTABLISHED;
+    ssn.flags = STREAMTCP_FLAG_SACKOK;
+    ssn.client.next_seq = 1000;
+    ssn.client.wscale = 7;
+    ssn.server.next_seq = 5000;
+    ssn.server.wscale = 2;
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    FLOW_INITIALIZE(&f);
+    FlowInit(&f, p1);
+    f.protoctx = &ssn;
+    f.alproto = ALPROTO_HTTP;
+    flow_hash[0].head = &f;
+
+    FAIL_IF(FlowSnapshotWriteFile(path, 1000) != 1);
+    flow_hash[0].head = NULL;
+    f.protoctx = NULL;
+
+    /* too old */
+    FAIL_IF(FlowSnapshotLoadFile(path, 5000, 3600) != -1);
+    FAIL_IF(FlowSnapshotLoadFile(path, 1010, 3600) != 1);
+
+    int toserver = -1;
+    const FlowSnapshotRecord *r = FlowSnapshotLookup(p2, &toserver);
+    FAIL_IF_NULL(r);
+    FAIL_IF(toserver != 0);
+    FAIL_IF(r->alproto != ALPROTO_HTTP);
+    FAIL_IF(r->client_wscale != 7 || r->server_wscale != 2);
+    FAIL_IF(r->client_next_seq != 1000 || r->server_next_seq != 5000);
+    FAIL_IF(!(r->flags & FLOW_SNAPSHOT_SACKOK));
+    FAIL_IF(FlowSnapshotLookup(p1, &toserver) != r);
+    FAIL_IF(toserver != 1);
+    FAIL_IF_NOT_NULL(FlowSnapshotLookup(p3, &toserver));
+
+    FlowSnapshotDestroy();
+    FAIL_IF_NOT_NULL(FlowSnapshotLookup(p1, &toserver));
+    unlink(path);
+
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    UTHFreePacket(p3);
+    FlowShutdown();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowSnapshotRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowSnapshotTest01", FlowSnapshotTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Snapshot of the established TCP sessions at shutdown (flow.snapshot).
+ *
+ * At shutdown the tuple, window scaling and SACK settings and the detected
+ * app-layer protocol of each established TCP session are written to a
+ * file of fixed size records. At the next start the file is mapped and the
+ * stream engine picks up the sessions it finds in it, in the right
+ * direction and without running protocol detection again.
+ */
+
+#ifndef __FLOW_SNAPSHOT_H__
+#define __FLOW_SNAPSHOT_H__
+
+#include "decode.h"
+
+#define FLOW_SNAPSHOT_MAGIC     "SCFLOWSS"
+#define FLOW_SNAPSHOT_VERSION   1
+
+#define FLOW_SNAPSHOT_SACKOK    0x01
+#define FLOW_SNAPSHOT_IPV6      0x02
+
+typedef struct FlowSnapshotHeader_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t cnt;
+    /** wall clock time the snapshot was written */
+    uint32_t ts;
+    /** engine version, app-layer protocol ids are only valid within one */
+    char engine[32];
+} FlowSnapshotHeader;
+
+typedef struct FlowSnapshotRecord_ {
+    /** client and server */
+    uint32_t src[4];
+    uint32_t dst[4];
+    uint16_t sp;
+    uint16_t dp;
+    uint16_t vlan_id[2];
+    uint64_t domain_id;
+    /** next sequence number of the client and the server */
+    uint32_t client_next_seq;
+    uint32_t server_next_seq;
+    AppProto alproto;
+    uint8_t recursion_level;
+    uint8_t client_wscale;
+    uint8_t server_wscale;
+    uint8_t flags;
+    uint8_t pad[2];
+} FlowSnapshotRecord;
+
+void FlowSnapshotInitConfig(void);
+void FlowSnapshotWrite(void);
+void FlowSnapshotDestroy(void);
+const FlowSnapshotRecord *FlowSnapshotLookup(const Packet *p, int *toserver);
+
+void FlowSnapshotRegisterTests(void);
+
+#endif /* __FLOW_SNAPSHOT_H__ */
@@ -31,6 +31,20 @@
 #include "flow-util.h"
 #include "util-unittest.h"
 
+/** ids of late storage are offset by this, so the storage functions can
+ *  tell them apart */
+#define FLOW_STORAGE_LATE_ID    0x10000
+
+static inline Storage *FlowStorageEager(Flow *f)
+{
+    return (Storage *)((void *)f + sizeof(Flow));
+}
+
+static inline Storage *FlowStorageLate(const FlowExt *ext)
+{
+    return (Storage *)((void *)ext + sizeof(FlowExt));
+}
+
 unsigned int FlowStorageSize(void)
 {
     return StorageGetSize(STORAGE_FLOW);
@@ -38,31 +52,68 @@ unsigned int FlowStorageSize(void)
 
 void *FlowGetStorageById(Flow *f, int id)
 {
-    return StorageGetById((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id);
+    if (id >= FLOW_STORAGE_LATE_ID) {
+        if (f->ext == NULL)
+            return NULL;
+        return StorageGetById(FlowStorageLate(f->ext), STORAGE_FLOW_LATE,
+                id - FLOW_STORAGE_LATE_ID);
+    }
+    return StorageGetById(FlowStorageEager(f), STORAGE_FLOW, id);
 }
 
 int FlowSetStorageById(Flow *f, int id, void *ptr)
 {
-    return StorageSetById((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id, ptr);
+    if (id >= FLOW_STORAGE_LATE_ID) {
+        /* clearing storage we never had is a no-op */
+        if (ptr == NULL && f->ext == NULL)
+            return 0;
+        FlowExt *ext = FlowGetExt(f);
+        if (ext == NULL)
+            return -1;
+        return StorageSetById(FlowStorageLate(ext), STORAGE_FLOW_LATE,
+                id - FLOW_STORAGE_LATE_ID, ptr);
+    }
+    return StorageSetById(FlowStorageEager(f), STORAGE_FLOW, id, ptr);
 }
 
 void *FlowAllocStorageById(Flow *f, int id)
 {
-    return StorageAllocByIdPrealloc((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id);
+    if (id >= FLOW_STORAGE_LATE_ID) {
+        FlowExt *ext = FlowGetExt(f);
+        if (ext == NULL)
+            return NULL;
+        return StorageAllocByIdPrealloc(FlowStorageLate(ext), STORAGE_FLOW_LATE,
+                id - FLOW_STORAGE_LATE_ID);
+    }
+    return StorageAllocByIdPrealloc(FlowStorageEager(f), STORAGE_FLOW, id);
 }
 
 void FlowFreeStorageById(Flow *f, int id)
 {
-    StorageFreeById((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id);
+    if (id >= FLOW_STORAGE_LATE_ID) {
+        if (f->ext != NULL)
+            StorageFreeById(FlowStorageLate(f->ext), STORAGE_FLOW_LATE,
+                    id - FLOW_STORAGE_LATE_ID);
+        return;
+    }
+    StorageFreeById(FlowStorageEager(f), STORAGE_FLOW, id);
 }
 
+/** \brief free the storage of a flow. The late storage goes with the
+ *         FlowExt, see FlowFreeExt(). */
 void FlowFreeStorage(Flow *f)
 {
     if (FlowStorageSize() > 0)
-        StorageFreeAll((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW);
+        StorageFreeAll(FlowStorageEager(f), STORAGE_FLOW);
 }
 
-int FlowStorageRegister(const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *)) {
+int FlowStorageRegister(const char *name, const unsigned int size,
+        void *(*Alloc)(unsigned int), void (*Free)(void *), const int flags)
+{
+    if (flags & FLOW_STORAGE_LATE) {
+        int id = StorageRegister(STORAGE_FLOW_LATE, name, size, Alloc, Free);
+        return (id < 0) ? id : id + FLOW_STORAGE_LATE_ID;
+    }
     return StorageRegister(STORAGE_FLOW, name, size, Alloc, Free);
 }
 
@@ -85,13 +136,13 @@ static int FlowStorageTest01(void)
 
     StorageInit();
 
-    int id1 = FlowStorageRegister("test", 8, StorageTestAlloc, StorageTestFree);
+    int id1 = FlowStorageRegister("test", 8, StorageTestAlloc, StorageTestFree, 0);
     if (id1 < 0)
         goto error;
-    int id2 = FlowStorageRegister("variable", 24, StorageTestAlloc, StorageTestFree);
+    int id2 = FlowStorageRegister("variable", 24, StorageTestAlloc, StorageTestFree, 0);
     if (id2 < 0)
         goto error;
-    int id3 = FlowStorageRegister("store", sizeof(void *), StorageTestAlloc, StorageTestFree);
+    int id3 = FlowStorageRegister("store", sizeof(void *), StorageTestAlloc, StorageTestFree, 0);
     if (id3 < 0)
         goto error;
 
@@ -165,7 +216,7 @@ static int FlowStorageTest02(void)
 
     StorageInit();
 
-    int id1 = FlowStorageRegister("test", sizeof(void *), NULL, StorageTestFree);
+    int id1 = FlowStorageRegister("test", sizeof(void *), NULL, StorageTestFree, 0);
     if (id1 < 0)
         goto error;
 
@@ -216,13 +267,13 @@ static int FlowStorageTest03(void)
 
     StorageInit();
 
-    int id1 = FlowStorageRegister("test1", sizeof(void *), NULL, StorageTestFree);
+    int id1 = FlowStorageRegister("test1", sizeof(void *), NULL, StorageTestFree, 0);
     if (id1 < 0)
         goto error;
-    int id2 = FlowStorageRegister("test2", sizeof(void *), NULL, StorageTestFree);
+    int id2 = FlowStorageRegister("test2", sizeof(void *), NULL, StorageTestFree, 0);
     if (id2 < 0)
         goto error;
-    int id3 = FlowStorageRegister("test3", 32, StorageTestAlloc, StorageTestFree);
+    int id3 = FlowStorageRegister("test3", 32, StorageTestAlloc, StorageTestFree, 0);
     if (id3 < 0)
         goto error;
 
@@ -284,6 +335,55 @@ error:
     StorageCleanup();
     return 0;
 }
+
+/**
+ *  \test late storage is only allocated with the FlowExt when set
+ */
+static int FlowStorageTest04(void)
+{
+    StorageInit();
+
+    int id1 = FlowStorageRegister("eager", sizeof(void *), NULL, StorageTestFree, 0);
+    FAIL_IF(id1 < 0);
+    int id2 = FlowStorageRegister("late", sizeof(void *), NULL, StorageTestFree,
+            FLOW_STORAGE_LATE);
+    FAIL_IF(id2 < 0);
+    int id3 = FlowStorageRegister("late-alloc", 32, StorageTestAlloc, StorageTestFree,
+            FLOW_STORAGE_LATE);
+    FAIL_IF(id3 < 0);
+    FAIL_IF(StorageFinalize() < 0);
+    /* only the eager one is part of the flow */
+    FAIL_IF(FlowStorageSize() != sizeof(void *));
+
+    FlowInitConfig(FLOW_QUIET);
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, id2));
+    FAIL_IF(FlowSetStorageById(f, id2, NULL) != 0);
+    FAIL_IF_NOT_NULL(f->ext);
+
+    void *ptr2 = SCMalloc(64);
+    FAIL_IF_NULL(ptr2);
+    FAIL_IF(FlowSetStorageById(f, id2, ptr2) != 0);
+    FAIL_IF_NULL(f->ext);
+    FAIL_IF(FlowGetStorageById(f, id2) != ptr2);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, id1));
+
+    void *ptr3 = FlowAllocStorageById(f, id3);
+    FAIL_IF_NULL(ptr3);
+    FAIL_IF(FlowGetStorageById(f, id3) != ptr3);
+
+    /* recycling frees the ext and the late storage with it */
+    FlowClearMemory(f, 0);
+    FAIL_IF_NOT_NULL(f->ext);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, id2));
+
+    FlowFree(f);
+    FlowShutdown();
+    StorageCleanup();
+    PASS;
+}
 #endif
 
 void RegisterFlowStorageTests(void)
@@ -292,5 +392,6 @@ void RegisterFlowStorageTests(void)
     UtRegisterTest("FlowStorageTest01", FlowStorageTest01);
     UtRegisterTest("FlowStorageTest02", FlowStorageTest02);
     UtRegisterTest("FlowStorageTest03", FlowStorageTest03);
+    UtRegisterTest("FlowStorageTest04", FlowStorageTest04);
 #endif
 }
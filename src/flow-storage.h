@@ -29,6 +29,11 @@
 #include "util-storage.h"
 #include "flow.h"
 
+/** FlowStorageRegister() flag: the storage is only needed once the flow
+ *  is far along (e.g. app-layer detected), so it isn't part of each flow's
+ *  allocation but kept in the FlowExt that is allocated when first set */
+#define FLOW_STORAGE_LATE   0x01
+
 unsigned int FlowStorageSize(void);
 
 void *FlowGetStorageById(Flow *h, int id);
@@ -40,6 +45,7 @@ void FlowFreeStorage(Flow *h);
 
 void RegisterFlowStorageTests(void);
 
-int FlowStorageRegister(const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *));
+int FlowStorageRegister(const char *name, const unsigned int size,
+        void *(*Alloc)(unsigned int), void (*Free)(void *), const int flags);
 
 #endif /* __FLOW_STORAGE_H__ */
@@ -91,6 +91,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
     p->vlan_id[0] = f->vlan_id[0];
     p->vlan_id[1] = f->vlan_id[1];
     p->vlan_idx = f->vlan_idx;
+    p->domain_id = f->domain_id;
     p->livedev = (struct LiveDevice_ *)f->livedev;
 
     if (f->flags & FLOW_NOPACKET_INSPECTION) {
@@ -326,19 +327,110 @@ int FlowForceReassemblyNeedReassembly(Flow *f, int *server, int *client)
     SCReturnInt(1);
 }
 
+/** flow.timeout-flush settings */
+static uint32_t flow_timeout_flush_batch = FLOW_TIMEOUT_FLUSH_BATCH_DEFAULT;
+static uint32_t flow_timeout_flush_max = 0;
+static uint32_t flow_timeout_flush_queue = 0;
+
+void FlowTimeoutFlushInitConfig(void)
+{
+    intmax_t value = 0;
+    if (ConfGetInt("flow.timeout-flush.batch-size", &value) == 1) {
+        if (value < 1 || value > FLOW_TIMEOUT_FLUSH_BATCH_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid flow.timeout-flush.batch-size, "
+                    "must be 1 to %u, using default %u", FLOW_TIMEOUT_FLUSH_BATCH_MAX,
+                    FLOW_TIMEOUT_FLUSH_BATCH_DEFAULT);
+        } else {
+            flow_timeout_flush_batch = (uint32_t)value;
+        }
+    }
+    if (ConfGetInt("flow.timeout-flush.max-per-pass", &value) == 1) {
+        if (value < 0 || value > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid flow.timeout-flush.max-per-pass");
+        } else {
+            flow_timeout_flush_max = (uint32_t)value;
+        }
+    }
+    if (ConfGetInt("flow.timeout-flush.max-queue", &value) == 1) {
+        if (value < 0 || value > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid flow.timeout-flush.max-queue");
+        } else {
+            flow_timeout_flush_queue = (uint32_t)value;
+        }
+    }
+    SCLogConfig("flow timeout flush: batch-size %u, max-per-pass %u, max-queue %u",
+            flow_timeout_flush_batch, flow_timeout_flush_max, flow_timeout_flush_queue);
+}
+
+/**
+ *  \brief set up the flush state for a timeout pass
+ */
+void FlowTimeoutFlushInit(FlowTimeoutFlush *fl)
+{
+    extern intmax_t max_pending_packets;
+
+    memset(fl, 0, sizeof(*fl));
+    /* the held back packets come from the pool of the thread that waits
+     * for packets before each flow, so keep them well under its size */
+    fl->batch = MIN(flow_timeout_flush_batch,
+            MAX(1, (uint32_t)(max_pending_packets / 4)));
+    fl->budget = flow_timeout_flush_max;
+}
+
+/**
+ *  \brief inject the held back pseudo packets, one batch per thread
+ */
+void FlowTimeoutFlushInject(FlowTimeoutFlush *fl)
+{
+    Packet *packets[FLOW_TIMEOUT_FLUSH_BATCH_MAX + 1];
+
+    for (uint32_t i = 0; i < fl->cnt; i++) {
+        if (fl->packets[i] == NULL)
+            continue;
+
+        /* in order, so the packets of a flow stay in order */
+        const int thread_id = fl->thread_ids[i];
+        uint32_t n = 0;
+        for (uint32_t j = i; j < fl->cnt; j++) {
+            if (fl->packets[j] != NULL && fl->thread_ids[j] == thread_id) {
+                packets[n++] = fl->packets[j];
+                fl->packets[j] = NULL;
+            }
+        }
+        packets[n] = NULL;
+
+        if (unlikely(!(TmThreadsInjectPacketsById(packets, thread_id)))) {
+            for (uint32_t j = 0; j < n; j++) {
+                FlowDeReference(&packets[j]->flow);
+                TmqhOutputPacketpool(NULL, packets[j]);
+            }
+        } else {
+            fl->injected += n;
+        }
+    }
+    fl->cnt = 0;
+}
+
 /**
  * \internal
  * \brief Forces reassembly for flow if it needs it.
  *
  *        The function requires flow to be locked beforehand.
  *
+ * With a flush state, the packets are held back and injected with the
+ * batch, and the flow is put off to a next pass if this pass used up its
+ * budget or the worker of the flow already has too many packets queued.
+ *
  * \param f Pointer to the flow.
  * \param server action required for server: 1 or 2
  * \param client action required for client: 1 or 2
+ * \param fl flush state, NULL to inject directly
  *
- * \retval 0 This flow doesn't need any reassembly processing; 1 otherwise.
+ * \retval 0 This flow doesn't need any reassembly processing or it was put
+ *           off; 1 otherwise.
  */
-int FlowForceReassemblyForFlow(Flow *f, int server, int client)
+int FlowForceReassemblyForFlowBatch(Flow *f, int server, int client,
+        FlowTimeoutFlush *fl)
 {
     Packet *p1 = NULL, *p2 = NULL;
 
@@ -347,6 +439,21 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
         return 0;
     }
 
+    int thread_id = (int)f->thread_id;
+    if (fl != NULL) {
+        const uint32_t need =
+            (client == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION &&
+             server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION) ? 2 : 1;
+        if ((fl->budget != 0 && fl->used + need > fl->budget) ||
+            (flow_timeout_flush_queue != 0 &&
+             TmThreadsInjectQueueLenById(thread_id) >= flow_timeout_flush_queue)) {
+            fl->deferred++;
+            return 0;
+        }
+        if (fl->cnt + need > fl->batch)
+            FlowTimeoutFlushInject(fl);
+    }
+
     /* Get the tcp session for the flow */
     TcpSession *ssn = (TcpSession *)f->protoctx;
 
@@ -388,8 +495,21 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
         }
     }
 
+    /* hold back the packet(s) for the batch */
+    if (fl != NULL) {
+        fl->packets[fl->cnt] = p1;
+        fl->thread_ids[fl->cnt++] = thread_id;
+        if (p2 != NULL) {
+            fl->packets[fl->cnt] = p2;
+            fl->thread_ids[fl->cnt++] = thread_id;
+        }
+        fl->used += p2 ? 2 : 1;
+        if (fl->cnt >= fl->batch)
+            FlowTimeoutFlushInject(fl);
+        goto done;
+    }
+
     /* inject the packet(s) into the appropriate thread */
-    int thread_id = (int)f->thread_id;
     Packet *packets[3] = { p1, p2 ? p2 : NULL, NULL }; /**< null terminated array of packets */
     if (unlikely(!(TmThreadsInjectPacketsById(packets, thread_id)))) {
         FlowDeReference(&p1->flow);
@@ -407,6 +527,11 @@ done:
     return 1;
 }
 
+int FlowForceReassemblyForFlow(Flow *f, int server, int client)
+{
+    return FlowForceReassemblyForFlowBatch(f, server, client, NULL);
+}
+
 /**
  * \internal
  * \brief Forces reassembly for flows that need it.
@@ -422,48 +547,61 @@ done:
  *
  * \param q The queue to process flows from.
  */
-static inline void FlowForceReassemblyForHash(void)
+static void FlowForceReassemblyForRow(FlowBucket *fb)
 {
-    for (uint32_t idx = 0; idx < flow_config.hash_size; idx++) {
-        FlowBucket *fb = &flow_hash[idx];
+    /* get the topmost flow from the QUEUE */
+    Flow *f = fb->head;
 
-        PacketPoolWaitForN(9);
-        FBLOCK_LOCK(fb);
+    /* we need to loop through all the flows in the queue */
+    while (f != NULL) {
+        PacketPoolWaitForN(3);
 
-        /* get the topmost flow from the QUEUE */
-        Flow *f = fb->head;
+        FLOWLOCK_WRLOCK(f);
 
-        /* we need to loop through all the flows in the queue */
-        while (f != NULL) {
-            PacketPoolWaitForN(3);
+        /* Get the tcp session for the flow */
+        TcpSession *ssn = (TcpSession *)f->protoctx;
+        /* \todo Also skip flows that shouldn't be inspected */
+        if (ssn == NULL) {
+            FLOWLOCK_UNLOCK(f);
+            f = f->hnext;
+            continue;
+        }
 
-            FLOWLOCK_WRLOCK(f);
+        int client_ok = 0;
+        int server_ok = 0;
+        if (FlowForceReassemblyNeedReassembly(f, &server_ok, &client_ok) == 1) {
+            FlowForceReassemblyForFlow(f, server_ok, client_ok);
+        }
 
-            /* Get the tcp session for the flow */
-            TcpSession *ssn = (TcpSession *)f->protoctx;
-            /* \todo Also skip flows that shouldn't be inspected */
-            if (ssn == NULL) {
-                FLOWLOCK_UNLOCK(f);
-                f = f->hnext;
-                continue;
-            }
+        FLOWLOCK_UNLOCK(f);
 
-            int client_ok = 0;
-            int server_ok = 0;
-            if (FlowForceReassemblyNeedReassembly(f, &server_ok, &client_ok) == 1) {
-                FlowForceReassemblyForFlow(f, server_ok, client_ok);
-            }
+        /* next flow in the queue */
+        f = f->hnext;
+    }
+}
 
-            FLOWLOCK_UNLOCK(f);
+static inline void FlowForceReassemblyForHash(void)
+{
+    for (uint32_t idx = 0; idx < flow_config.hash_size; idx++) {
+        FlowBucket *fb = &flow_hash[idx];
 
-            /* next flow in the queue */
-            f = f->hnext;
-        }
+        PacketPoolWaitForN(9);
+        FBLOCK_LOCK(fb);
+        FlowForceReassemblyForRow(fb);
         FBLOCK_UNLOCK(fb);
     }
     return;
 }
 
+/** \internal
+ *  \brief the per thread flow tables aren't locked, the workers have
+ *          stopped looking up flows by the time this runs */
+static void FlowForceReassemblyForThreadTableRow(FlowBucket *fb)
+{
+    PacketPoolWaitForN(9);
+    FlowForceReassemblyForRow(fb);
+}
+
 /**
  * \brief Force reassembly for all the flows that have unprocessed segments.
  */
@@ -471,5 +609,6 @@ void FlowForceReassembly(void)
 {
     /* Carry out flow reassembly for unattended flows */
     FlowForceReassemblyForHash();
+    FlowThreadTablesForEachRow(FlowForceReassemblyForThreadTableRow);
     return;
 }
@@ -24,6 +24,35 @@
 #ifndef __FLOW_TIMEOUT_H__
 #define __FLOW_TIMEOUT_H__
 
+/** max pseudo packets held back before they are injected */
+#define FLOW_TIMEOUT_FLUSH_BATCH_MAX    64
+#define FLOW_TIMEOUT_FLUSH_BATCH_DEFAULT 16
+
+/** pseudo packets of the timed out flows of one timeout pass
+ *
+ *  The packets are held back and injected per thread, so a worker's
+ *  queue is locked and signalled once per batch instead of once per flow.
+ *  See flow.timeout-flush. */
+typedef struct FlowTimeoutFlush_ {
+    /** packets to hold back before injecting them */
+    uint32_t batch;
+    /** max packets to inject in this pass, 0 for no limit */
+    uint32_t budget;
+    /** packets injected or held back in this pass */
+    uint32_t used;
+    /** flows put off to the next pass */
+    uint32_t deferred;
+    uint32_t injected;
+    uint32_t cnt;
+    Packet *packets[FLOW_TIMEOUT_FLUSH_BATCH_MAX];
+    int thread_ids[FLOW_TIMEOUT_FLUSH_BATCH_MAX];
+} FlowTimeoutFlush;
+
+void FlowTimeoutFlushInitConfig(void);
+void FlowTimeoutFlushInit(FlowTimeoutFlush *fl);
+void FlowTimeoutFlushInject(FlowTimeoutFlush *fl);
+int FlowForceReassemblyForFlowBatch(Flow *f, int server, int client,
+        FlowTimeoutFlush *fl);
 int FlowForceReassemblyForFlow(Flow *f, int server, int client);
 int FlowForceReassemblyNeedReassembly(Flow *f, int *server, int *client);
 void FlowForceReassembly(void);
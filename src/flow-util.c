@@ -57,11 +57,11 @@ Flow *FlowAlloc(void)
         return NULL;
     }
 
-    (void) SC_ATOMIC_ADD(flow_memuse, size);
+    MemcapCounterIncr(&flow_memuse, size);
 
     f = SCMalloc(size);
     if (unlikely(f == NULL)) {
-        (void)SC_ATOMIC_SUB(flow_memuse, size);
+        MemcapCounterDecr(&flow_memuse, size);
         return NULL;
     }
     memset(f, 0, size);
@@ -72,6 +72,55 @@ Flow *FlowAlloc(void)
 }
 
 
+/** \brief allocate a number of flows at once
+ *
+ *  Like FlowAlloc(), but the memcap is checked and the memuse counter
+ *  updated once for the whole batch. The number of flows is reduced to
+ *  what fits in the memcap.
+ *
+ *  \param max max number of flows to allocate
+ *  \param cnt set to the number of flows allocated
+ *
+ *  \retval f first flow of a list linked through Flow::lnext, or NULL
+ */
+Flow *FlowAllocBatch(uint32_t max, uint32_t *cnt)
+{
+    size_t size = sizeof(Flow) + FlowStorageSize();
+    uint64_t memuse = MemcapCounterGet(&flow_memuse);
+    uint64_t memcap = SC_ATOMIC_GET(flow_config.memcap);
+    uint32_t n = max;
+
+    *cnt = 0;
+    if (memuse >= memcap)
+        return NULL;
+    if ((memcap - memuse) / size < n)
+        n = (memcap - memuse) / size;
+    if (n == 0)
+        return NULL;
+
+    MemcapCounterIncr(&flow_memuse, n * size);
+
+    Flow *head = NULL;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        Flow *f = SCMalloc(size);
+        if (unlikely(f == NULL))
+            break;
+        memset(f, 0, size);
+
+        /* coverity[missing_lock] */
+        FLOW_INITIALIZE(f);
+        f->lnext = head;
+        head = f;
+    }
+    if (i < n) {
+        MemcapCounterDecr(&flow_memuse, (n - i) * size);
+    }
+
+    *cnt = i;
+    return head;
+}
+
 /**
  *  \brief cleanup & free the memory of a flow
  *
@@ -83,7 +132,51 @@ void FlowFree(Flow *f)
     SCFree(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
-    (void) SC_ATOMIC_SUB(flow_memuse, size);
+    MemcapCounterDecr(&flow_memuse, size);
+}
+
+/**
+ *  \brief get the rarely used part of a flow, allocating it if needed
+ *
+ *  Counted in the flow memcap like the flow itself.
+ *
+ *  \retval ext or NULL if the memcap or allocation failed
+ */
+FlowExt *FlowGetExt(Flow *f)
+{
+    if (f->ext != NULL)
+        return f->ext;
+
+    const size_t size = sizeof(FlowExt) + StorageGetSize(STORAGE_FLOW_LATE);
+    if (!(FLOW_CHECK_MEMCAP(size))) {
+        return NULL;
+    }
+    FlowExt *ext = SCCalloc(1, size);
+    if (unlikely(ext == NULL)) {
+        return NULL;
+    }
+    MemcapCounterIncr(&flow_memuse, size);
+
+    f->ext = ext;
+    return ext;
+}
+
+/**
+ *  \brief free the rarely used part of a flow and its late storage
+ */
+void FlowFreeExt(Flow *f)
+{
+    if (f->ext == NULL)
+        return;
+
+    if (StorageGetSize(STORAGE_FLOW_LATE) > 0)
+        StorageFreeAll((Storage *)((void *)f->ext + sizeof(FlowExt)),
+                STORAGE_FLOW_LATE);
+    SCFree(f->ext);
+    f->ext = NULL;
+
+    MemcapCounterDecr(&flow_memuse,
+            sizeof(FlowExt) + StorageGetSize(STORAGE_FLOW_LATE));
 }
 
 /**
@@ -154,6 +247,7 @@ void FlowInit(Flow *f, const Packet *p)
     f->vlan_id[0] = p->vlan_id[0];
     f->vlan_id[1] = p->vlan_id[1];
     f->vlan_idx = p->vlan_idx;
+    f->domain_id = p->domain_id;
     f->livedev = p->livedev;
 
     if (PKT_IS_IPV4(p)) {
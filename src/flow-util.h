@@ -45,7 +45,7 @@
         SC_ATOMIC_INIT((f)->flow_state); \
         SC_ATOMIC_INIT((f)->use_cnt); \
         (f)->tenant_id = 0; \
-        (f)->parent_id = 0; \
+        (f)->ext = NULL; \
         (f)->probing_parser_toserver_alproto_masks = 0; \
         (f)->probing_parser_toclient_alproto_masks = 0; \
         (f)->flags = 0; \
@@ -90,7 +90,7 @@
         SC_ATOMIC_RESET((f)->flow_state); \
         SC_ATOMIC_RESET((f)->use_cnt); \
         (f)->tenant_id = 0; \
-        (f)->parent_id = 0; \
+        FlowFreeExt((f)); \
         (f)->probing_parser_toserver_alproto_masks = 0; \
         (f)->probing_parser_toclient_alproto_masks = 0; \
         (f)->flags = 0; \
@@ -123,6 +123,7 @@
         \
         FLOWLOCK_DESTROY((f)); \
         GenericVarFree((f)->flowvar); \
+        FlowFreeExt((f)); \
     } while(0)
 
 /** \brief check if a memory alloc would fit in the memcap
@@ -133,11 +134,14 @@
  *  \retval 0 no fit
  */
 #define FLOW_CHECK_MEMCAP(size) \
-    ((((uint64_t)SC_ATOMIC_GET(flow_memuse) + (uint64_t)(size)) <= SC_ATOMIC_GET(flow_config.memcap)))
+    MemcapCounterCheck(&flow_memuse, (uint64_t)(size), SC_ATOMIC_GET(flow_config.memcap))
 
 Flow *FlowAlloc(void);
+Flow *FlowAllocBatch(uint32_t, uint32_t *);
 Flow *FlowAllocDirect(void);
 void FlowFree(Flow *);
+FlowExt *FlowGetExt(Flow *);
+void FlowFreeExt(Flow *);
 uint8_t FlowGetProtoMapping(uint8_t);
 void FlowInit(Flow *, const Packet *);
 uint8_t FlowGetReverseProtoMapping(uint8_t rproto);
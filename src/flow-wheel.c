@@ -0,0 +1,389 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timing wheel of flow hash rows for the flow manager.
+ *
+ * Level 0 has a slot per second for the next FLOW_WHEEL_L0_SIZE seconds.
+ * Level 1 has a slot per FLOW_WHEEL_L0_SIZE seconds, its rows move down to
+ * level 0 when their slot comes up.
+ */
+
+#include "suricata-common.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-wheel.h"
+
+#include "util-unittest.h"
+
+FlowWheelRow *flow_wheel_rows = NULL;
+static uint32_t flow_wheel_rows_cnt = 0;
+static FlowWheel *flow_wheels = NULL;
+static uint32_t flow_wheel_cnt = 0;
+static uint32_t flow_wheel_range = 0;
+
+uint64_t FlowWheelMemuse(uint32_t hash_size, uint32_t wheels)
+{
+    return (uint64_t)hash_size * sizeof(FlowWheelRow) +
+        (uint64_t)wheels * sizeof(FlowWheel);
+}
+
+/**
+ *  \brief Set up a wheel per flow manager, each for its part of the hash
+ *
+ *  \retval 0 ok, -1 out of memory
+ */
+int FlowWheelInit(uint32_t hash_size, uint32_t wheels)
+{
+    FlowWheelDestroy();
+
+    FlowWheelRow *rows = SCCalloc(hash_size, sizeof(FlowWheelRow));
+    if (unlikely(rows == NULL))
+        return -1;
+    FlowWheel *w = SCCalloc(wheels, sizeof(FlowWheel));
+    if (unlikely(w == NULL)) {
+        SCFree(rows);
+        return -1;
+    }
+
+    for (uint32_t u = 0; u < hash_size; u++) {
+        rows[u].next = FLOW_WHEEL_NONE;
+        rows[u].prev = FLOW_WHEEL_NONE;
+        rows[u].intake_next = FLOW_WHEEL_NONE;
+        SC_ATOMIC_INIT(rows[u].queued);
+    }
+
+    /* same split of the hash as the flow manager instances */
+    const uint32_t range = hash_size / wheels;
+    for (uint32_t u = 0; u < wheels; u++) {
+        w[u].min = range * u;
+        w[u].max = (u == wheels - 1) ? hash_size : range * (u + 1);
+        for (uint32_t s = 0; s < FLOW_WHEEL_L0_SIZE + FLOW_WHEEL_L1_SIZE; s++)
+            w[u].slots[s] = FLOW_WHEEL_NONE;
+        SC_ATOMIC_INIT(w[u].intake);
+        SC_ATOMIC_SET(w[u].intake, FLOW_WHEEL_NONE);
+    }
+
+    flow_wheel_rows_cnt = hash_size;
+    flow_wheel_cnt = wheels;
+    flow_wheel_range = range;
+    flow_wheel_rows = rows;
+    flow_wheels = w;
+    return 0;
+}
+
+void FlowWheelDestroy(void)
+{
+    if (flow_wheels != NULL) {
+        for (uint32_t u = 0; u < flow_wheel_cnt; u++)
+            SC_ATOMIC_DESTROY(flow_wheels[u].intake);
+        SCFree(flow_wheels);
+        flow_wheels = NULL;
+    }
+    if (flow_wheel_rows != NULL) {
+        for (uint32_t u = 0; u < flow_wheel_rows_cnt; u++)
+            SC_ATOMIC_DESTROY(flow_wheel_rows[u].queued);
+        SCFree(flow_wheel_rows);
+        flow_wheel_rows = NULL;
+    }
+    flow_wheel_rows_cnt = 0;
+    flow_wheel_cnt = 0;
+    flow_wheel_range = 0;
+}
+
+/** \brief wheel of flow manager instance 'instance', counting from 1 */
+FlowWheel *FlowWheelGet(uint32_t instance)
+{
+    if (flow_wheels == NULL || instance == 0 || instance > flow_wheel_cnt)
+        return NULL;
+    return &flow_wheels[instance - 1];
+}
+
+/**
+ *  \brief Have the row looked at by its flow manager on its next run
+ *
+ *  Called by the workers, without locks. A row is on the intake stack
+ *  at most once.
+ */
+void FlowWheelQueueRowIdx(uint32_t idx)
+{
+    FlowWheelRow *r = &flow_wheel_rows[idx];
+    if (SC_ATOMIC_GET(r->queued) != 0)
+        return;
+    if (!SC_ATOMIC_CAS(&r->queued, 0, 1))
+        return;
+
+    uint32_t u = flow_wheel_range ? idx / flow_wheel_range : flow_wheel_cnt - 1;
+    if (u >= flow_wheel_cnt)
+        u = flow_wheel_cnt - 1;
+    FlowWheel *w = &flow_wheels[u];
+
+    uint32_t head;
+    do {
+        head = SC_ATOMIC_GET(w->intake);
+        r->intake_next = head;
+    } while (!SC_ATOMIC_CAS(&w->intake, head, idx));
+}
+
+/** \brief queue a row of the flow hash, ignores other rows like those of
+ *         the per thread tables */
+void FlowWheelQueueRow(const FlowBucket *fb)
+{
+    if (flow_wheels == NULL || fb < flow_hash ||
+            fb >= flow_hash + flow_wheel_rows_cnt)
+        return;
+    FlowWheelQueueRowIdx((uint32_t)(fb - flow_hash));
+}
+
+/**
+ *  \brief take all queued rows
+ *
+ *  \retval idx first row, walk the rest with FlowWheelIntakeNext()
+ */
+uint32_t FlowWheelTakeIntake(FlowWheel *w)
+{
+    uint32_t head;
+    do {
+        head = SC_ATOMIC_GET(w->intake);
+    } while (!SC_ATOMIC_CAS(&w->intake, head, FLOW_WHEEL_NONE));
+    return head;
+}
+
+/** \brief next row of a taken intake list, the row can be queued again
+ *         from now on */
+uint32_t FlowWheelIntakeNext(uint32_t idx)
+{
+    FlowWheelRow *r = &flow_wheel_rows[idx];
+    const uint32_t next = r->intake_next;
+    r->intake_next = FLOW_WHEEL_NONE;
+    SC_ATOMIC_SET(r->queued, 0);
+    return next;
+}
+
+/** \brief empty the wheel and start it at 'now' */
+void FlowWheelReset(FlowWheel *w, uint32_t now)
+{
+    for (uint32_t s = 0; s < FLOW_WHEEL_L0_SIZE + FLOW_WHEEL_L1_SIZE; s++)
+        w->slots[s] = FLOW_WHEEL_NONE;
+    for (uint32_t u = w->min; u < w->max; u++) {
+        flow_wheel_rows[u].ts = 0;
+        flow_wheel_rows[u].next = FLOW_WHEEL_NONE;
+        flow_wheel_rows[u].prev = FLOW_WHEEL_NONE;
+    }
+    w->now = now;
+}
+
+static void FlowWheelUnlink(FlowWheel *w, uint32_t idx)
+{
+    FlowWheelRow *r = &flow_wheel_rows[idx];
+    if (r->prev != FLOW_WHEEL_NONE)
+        flow_wheel_rows[r->prev].next = r->next;
+    else
+        w->slots[r->slot] = r->next;
+    if (r->next != FLOW_WHEEL_NONE)
+        flow_wheel_rows[r->next].prev = r->prev;
+    r->next = FLOW_WHEEL_NONE;
+    r->prev = FLOW_WHEEL_NONE;
+    r->ts = 0;
+}
+
+/** \internal
+ *  \brief put a row in the slot for 'due', which is not before w->now */
+static void FlowWheelInsert(FlowWheel *w, uint32_t idx, uint32_t due)
+{
+    FlowWheelRow *r = &flow_wheel_rows[idx];
+    uint32_t slot;
+
+    if (due - w->now < FLOW_WHEEL_L0_SIZE) {
+        slot = due & FLOW_WHEEL_L0_MASK;
+    } else {
+        uint32_t block = due >> FLOW_WHEEL_L0_BITS;
+        const uint32_t last = (w->now >> FLOW_WHEEL_L0_BITS) + FLOW_WHEEL_L1_SIZE - 1;
+        if (block > last)
+            block = last;
+        slot = FLOW_WHEEL_L0_SIZE + (block & FLOW_WHEEL_L1_MASK);
+    }
+
+    r->ts = due;
+    r->slot = slot;
+    r->prev = FLOW_WHEEL_NONE;
+    r->next = w->slots[slot];
+    if (r->next != FLOW_WHEEL_NONE)
+        flow_wheel_rows[r->next].prev = idx;
+    w->slots[slot] = idx;
+}
+
+/**
+ *  \brief (re)schedule a row, 'due' in the past means the next second
+ */
+void FlowWheelSchedule(FlowWheel *w, uint32_t idx, uint32_t due)
+{
+    if (flow_wheel_rows[idx].ts != 0)
+        FlowWheelUnlink(w, idx);
+    if (due <= w->now)
+        due = w->now + 1;
+    FlowWheelInsert(w, idx, due);
+}
+
+/**
+ *  \brief advance the wheel to 'now' and take the rows that are due
+ *
+ *  The rows are no longer scheduled, each needs to be scheduled again
+ *  after its visit unless it's empty.
+ *
+ *  \retval idx first due row, linked through FlowWheelRow::next
+ */
+uint32_t FlowWheelExpire(FlowWheel *w, uint32_t now)
+{
+    uint32_t list = FLOW_WHEEL_NONE;
+
+    while (w->now < now) {
+        w->now++;
+
+        if ((w->now & FLOW_WHEEL_L0_MASK) == 0) {
+            /* move the rows of the level 1 slot starting now down */
+            const uint32_t slot = FLOW_WHEEL_L0_SIZE +
+                ((w->now >> FLOW_WHEEL_L0_BITS) & FLOW_WHEEL_L1_MASK);
+            uint32_t idx = w->slots[slot];
+            w->slots[slot] = FLOW_WHEEL_NONE;
+            while (idx != FLOW_WHEEL_NONE) {
+                const uint32_t next = flow_wheel_rows[idx].next;
+                uint32_t due = flow_wheel_rows[idx].ts;
+                if (due < w->now)
+                    due = w->now;
+                FlowWheelInsert(w, idx, due);
+                idx = next;
+            }
+        }
+
+        const uint32_t slot = w->now & FLOW_WHEEL_L0_MASK;
+        uint32_t idx = w->slots[slot];
+        w->slots[slot] = FLOW_WHEEL_NONE;
+        while (idx != FLOW_WHEEL_NONE) {
+            FlowWheelRow *r = &flow_wheel_rows[idx];
+            const uint32_t next = r->next;
+            r->ts = 0;
+            r->prev = FLOW_WHEEL_NONE;
+            r->next = list;
+            list = idx;
+            idx = next;
+        }
+    }
+    return list;
+}
+
+#ifdef UNITTESTS
+
+static int FlowWheelCount(uint32_t list)
+{
+    int cnt = 0;
+    while (list != FLOW_WHEEL_NONE) {
+        cnt++;
+        list = flow_wheel_rows[list].next;
+    }
+    return cnt;
+}
+
+/** \test rows come out of the wheel in the second they are due, also
+ *        when scheduled on level 1 or beyond the span of the wheel */
+static int FlowWheelTest01(void)
+{
+    FAIL_IF(FlowWheelInit(64, 1) != 0);
+    FlowWheel *w = FlowWheelGet(1);
+    FAIL_IF_NULL(w);
+    FlowWheelReset(w, 1000);
+
+    FlowWheelSchedule(w, 1, 1010);
+    FlowWheelSchedule(w, 2, 1010);
+    FlowWheelSchedule(w, 3, 1000 + 300);
+    FlowWheelSchedule(w, 4, 1000 + FLOW_WHEEL_SPAN + 500);
+    FlowWheelSchedule(w, 5, 900);
+    /* rescheduling moves a row */
+    FlowWheelSchedule(w, 2, 1011);
+
+    uint32_t list = FlowWheelExpire(w, 1001);
+    FAIL_IF(list != 5);
+    FAIL_IF(FlowWheelCount(list) != 1);
+
+    FAIL_IF(FlowWheelExpire(w, 1009) != FLOW_WHEEL_NONE);
+    list = FlowWheelExpire(w, 1010);
+    FAIL_IF(list != 1);
+    FAIL_IF(FlowWheelCount(list) != 1);
+    list = FlowWheelExpire(w, 1011);
+    FAIL_IF(list != 2);
+
+    FAIL_IF(FlowWheelExpire(w, 1299) != FLOW_WHEEL_NONE);
+    list = FlowWheelExpire(w, 1300);
+    FAIL_IF(list != 3);
+
+    FAIL_IF(FlowWheelExpire(w, 1000 + FLOW_WHEEL_SPAN + 499) != FLOW_WHEEL_NONE);
+    list = FlowWheelExpire(w, 1000 + FLOW_WHEEL_SPAN + 500);
+    FAIL_IF(list != 4);
+    FAIL_IF(FlowWheelCount(list) != 1);
+
+    FlowWheelDestroy();
+    PASS;
+}
+
+/** \test rows are queued once until the intake is taken */
+static int FlowWheelTest02(void)
+{
+    FAIL_IF(FlowWheelInit(64, 2) != 0);
+    FlowWheel *w1 = FlowWheelGet(1);
+    FlowWheel *w2 = FlowWheelGet(2);
+    FAIL_IF_NULL(w1);
+    FAIL_IF_NULL(w2);
+    FAIL_IF(w1->max != 32 || w2->min != 32 || w2->max != 64);
+
+    FlowWheelQueueRowIdx(3);
+    FlowWheelQueueRowIdx(7);
+    FlowWheelQueueRowIdx(3);
+    FlowWheelQueueRowIdx(40);
+
+    uint32_t idx = FlowWheelTakeIntake(w1);
+    FAIL_IF(idx != 7);
+    idx = FlowWheelIntakeNext(idx);
+    FAIL_IF(idx != 3);
+    /* taken rows can be queued again */
+    FlowWheelQueueRowIdx(7);
+    idx = FlowWheelIntakeNext(idx);
+    FAIL_IF(idx != FLOW_WHEEL_NONE);
+
+    idx = FlowWheelTakeIntake(w1);
+    FAIL_IF(idx != 7);
+    FAIL_IF(FlowWheelIntakeNext(idx) != FLOW_WHEEL_NONE);
+    FAIL_IF(FlowWheelTakeIntake(w1) != FLOW_WHEEL_NONE);
+
+    idx = FlowWheelTakeIntake(w2);
+    FAIL_IF(idx != 40);
+    FAIL_IF(FlowWheelIntakeNext(idx) != FLOW_WHEEL_NONE);
+
+    FlowWheelDestroy();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FlowWheelRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowWheelTest01", FlowWheelTest01);
+    UtRegisterTest("FlowWheelTest02", FlowWheelTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,97 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timing wheel of flow hash rows for the flow manager (flow.timeout-wheel).
+ *
+ * Instead of walking the whole hash, each flow manager keeps the rows of
+ * its part of the hash in a two level wheel, keyed on the second the row
+ * needs to be looked at again: the next_ts the manager computed for it.
+ * Packets only ever move a flow's timeout to later, so the wheel isn't
+ * updated for them. A visit that finds nothing timed out just schedules
+ * the row again. Workers only hand over rows that need an earlier visit,
+ * when a flow is added or changes state, through a lock free stack.
+ *
+ * The wheel itself is only used by its flow manager thread.
+ */
+
+#ifndef __FLOW_WHEEL_H__
+#define __FLOW_WHEEL_H__
+
+#include "flow-hash.h"
+
+#define FLOW_WHEEL_L0_BITS  8
+#define FLOW_WHEEL_L0_SIZE  (1 << FLOW_WHEEL_L0_BITS)
+#define FLOW_WHEEL_L0_MASK  (FLOW_WHEEL_L0_SIZE - 1)
+#define FLOW_WHEEL_L1_BITS  6
+#define FLOW_WHEEL_L1_SIZE  (1 << FLOW_WHEEL_L1_BITS)
+#define FLOW_WHEEL_L1_MASK  (FLOW_WHEEL_L1_SIZE - 1)
+/** seconds covered by the wheel, rows due later are put in the last slot
+ *  and placed again once that is reached */
+#define FLOW_WHEEL_SPAN     (FLOW_WHEEL_L0_SIZE * FLOW_WHEEL_L1_SIZE)
+
+/** end of a list of rows */
+#define FLOW_WHEEL_NONE     UINT32_MAX
+
+/** wheel state of a flow hash row */
+typedef struct FlowWheelRow_ {
+    /** second the row is scheduled for, 0 if it isn't */
+    uint32_t ts;
+    /** slot it is in: level 0 slots first, then level 1 */
+    uint32_t slot;
+    /** slot list neighbours, as row index */
+    uint32_t next;
+    uint32_t prev;
+    /** next row on the intake stack */
+    uint32_t intake_next;
+    /** set while the row is on the intake stack */
+    SC_ATOMIC_DECLARE(int, queued);
+} FlowWheelRow;
+
+typedef struct FlowWheel_ {
+    /** hash rows handled by this wheel, like the flow manager instance */
+    uint32_t min;
+    uint32_t max;
+    /** last second that was expired */
+    uint32_t now;
+    /** heads of the slot lists */
+    uint32_t slots[FLOW_WHEEL_L0_SIZE + FLOW_WHEEL_L1_SIZE];
+    /** rows the workers want looked at, newest first */
+    SC_ATOMIC_DECLARE(uint32_t, intake);
+} FlowWheel;
+
+extern FlowWheelRow *flow_wheel_rows;
+
+int FlowWheelInit(uint32_t hash_size, uint32_t wheels);
+void FlowWheelDestroy(void);
+uint64_t FlowWheelMemuse(uint32_t hash_size, uint32_t wheels);
+FlowWheel *FlowWheelGet(uint32_t instance);
+
+void FlowWheelQueueRowIdx(uint32_t idx);
+void FlowWheelQueueRow(const FlowBucket *fb);
+uint32_t FlowWheelTakeIntake(FlowWheel *w);
+uint32_t FlowWheelIntakeNext(uint32_t idx);
+
+void FlowWheelReset(FlowWheel *w, uint32_t now);
+void FlowWheelSchedule(FlowWheel *w, uint32_t idx, uint32_t due);
+uint32_t FlowWheelExpire(FlowWheel *w, uint32_t now);
+
+void FlowWheelRegisterTests(void);
+
+#endif /* __FLOW_WHEEL_H__ */
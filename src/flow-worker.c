@@ -42,13 +42,21 @@
 #include "app-layer-parser.h"
 
 #include "util-validate.h"
+#include "util-latency.h"
+#include "util-early-filter.h"
 
 #include "flow-util.h"
+#include "flow-hash.h"
+#include "flow-bypass-cache.h"
+#include "flow-cost.h"
+#include "runmodes.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
 typedef struct FlowWorkerThreadData_ {
     DecodeThreadVars *dtv;
+    /** locally bypassed flows, NULL if disabled */
+    FlowBypassCache *bypass_cache;
 
     union {
         StreamTcpThread *stream_thread;
@@ -98,6 +106,14 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
         return TM_ECODE_FAILED;
     }
 
+    /* in the workers runmode all packets of a flow are handled by one
+     * thread, which can then keep its flows to itself */
+    const char *runmode = RunmodeGetActive();
+    if (runmode != NULL && strcmp(runmode, "workers") == 0) {
+        fw->dtv->flow_table = FlowThreadTableAlloc(tv);
+    }
+    fw->bypass_cache = FlowBypassCacheAlloc(tv);
+
     /* setup TCP */
     if (StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK) {
         FlowWorkerThreadDeinit(tv, fw);
@@ -135,7 +151,12 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
 
+    if (fw->dtv != NULL) {
+        FlowThreadTableFree(fw->dtv->flow_table);
+        fw->dtv->flow_table = NULL;
+    }
     DecodeThreadVarsFree(tv, fw->dtv);
+    FlowBypassCacheFree(fw->bypass_cache);
 
     /* free TCP */
     StreamTcpThreadDeinit(tv, (void *)fw->stream_thread);
@@ -174,32 +195,59 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
         TimeSetByThread(tv->id, &p->ts);
     }
 
+    /* taken out of the pipeline by the early filter */
+    if (unlikely(EARLY_FILTER_SKIP_PIPELINE(p))) {
+        return TM_ECODE_OK;
+    }
+
     /* handle Flow */
     if (p->flags & PKT_WANTS_FLOW) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_FLOW);
+        LATENCY_FW_START(tv, PROFILE_FLOWWORKER_FLOW);
+
+        /* packets of flows we bypassed don't need the flow */
+        if (fw->bypass_cache != NULL &&
+                FlowBypassCacheLookup(tv, fw->bypass_cache, p)) {
+            return TM_ECODE_OK;
+        }
 
         FlowHandlePacket(tv, fw->dtv, p);
         if (likely(p->flow != NULL)) {
             DEBUG_ASSERT_FLOW_LOCKED(p->flow);
             if (FlowUpdate(p) == TM_ECODE_DONE) {
+                if (fw->bypass_cache != NULL) {
+                    FlowBypassCacheUpdate(fw->bypass_cache, p->flow, p);
+                }
                 FLOWLOCK_UNLOCK(p->flow);
                 return TM_ECODE_OK;
             }
         }
         /* Flow is now LOCKED */
 
+        LATENCY_FW_END(tv, PROFILE_FLOWWORKER_FLOW);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_FLOW);
 
     /* if PKT_WANTS_FLOW is not set, but PKT_HAS_FLOW is, then this is a
      * pseudo packet created by the flow manager. */
     } else if (p->flags & PKT_HAS_FLOW) {
         FLOWLOCK_WRLOCK(p->flow);
+
+    /* the flow manager wakes up an idle thread with a pseudo packet to
+     * time out its private flow table */
+    } else if (fw->dtv->flow_table != NULL) {
+        FlowThreadTableCheckTimeout(fw->dtv->flow_table, p);
     }
 
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
 
+    /* cpu cost of the flow, NULL unless flow.cpu-cost is enabled */
+    FlowCost *fcost = FlowCostGet(p->flow);
+
     /* handle TCP and app layer */
-    if (p->flow && PKT_IS_TCP(p)) {
+    if (p->early_filter == EARLY_FILTER_NO_STREAM) {
+        SCLogDebug("packet %"PRIu64" skips stream/app-layer", p->pcap_cnt);
+
+    } else if (p->flow && PKT_IS_TCP(p)) {
         SCLogDebug("packet %"PRIu64" is TCP. Direction %s", p->pcap_cnt, PKT_IS_TOSERVER(p) ? "TOSERVER" : "TOCLIENT");
         DEBUG_ASSERT_FLOW_LOCKED(p->flow);
 
@@ -213,7 +261,11 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
         }
 
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_STREAM);
+        LATENCY_FW_START(tv, PROFILE_FLOWWORKER_STREAM);
+        FLOW_COST_START_EXCL(fcost, FLOW_COST_STREAM, FLOW_COST_APPLAYER);
         StreamTcp(tv, p, fw->stream_thread, &fw->pq, NULL);
+        FLOW_COST_END_EXCL(fcost, FLOW_COST_STREAM, FLOW_COST_APPLAYER);
+        LATENCY_FW_END(tv, PROFILE_FLOWWORKER_STREAM);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_STREAM);
 
         if (FlowChangeProto(p->flow)) {
@@ -230,12 +282,18 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
             //StreamTcp(tv, x, fw->stream_thread, &fw->pq, NULL);
             if (detect_thread != NULL) {
                 FLOWWORKER_PROFILING_START(x, PROFILE_FLOWWORKER_DETECT);
+                LATENCY_FW_START(tv, PROFILE_FLOWWORKER_DETECT);
+                FLOW_COST_START(fcost, FLOW_COST_DETECT);
                 Detect(tv, x, detect_thread, NULL, NULL);
+                FLOW_COST_END(fcost, FLOW_COST_DETECT);
+                LATENCY_FW_END(tv, PROFILE_FLOWWORKER_DETECT);
                 FLOWWORKER_PROFILING_END(x, PROFILE_FLOWWORKER_DETECT);
             }
 
             //  Outputs
+            FLOW_COST_START(fcost, FLOW_COST_OUTPUT);
             OutputLoggerLog(tv, x, fw->output_thread);
+            FLOW_COST_END(fcost, FLOW_COST_OUTPUT);
 
             /* put these packets in the preq queue so that they are
              * by the other thread modules before packet 'p'. */
@@ -245,7 +303,11 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
     /* handle the app layer part of the UDP packet payload */
     } else if (p->flow && p->proto == IPPROTO_UDP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_APPLAYERUDP);
+        LATENCY_FW_START(tv, PROFILE_FLOWWORKER_APPLAYERUDP);
+        FLOW_COST_START(fcost, FLOW_COST_APPLAYER);
         AppLayerHandleUdp(tv, fw->stream_thread->ra_ctx->app_tctx, p, p->flow);
+        FLOW_COST_END(fcost, FLOW_COST_APPLAYER);
+        LATENCY_FW_END(tv, PROFILE_FLOWWORKER_APPLAYERUDP);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_APPLAYERUDP);
     }
 
@@ -257,18 +319,29 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
 
     if (detect_thread != NULL) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
+        LATENCY_FW_START(tv, PROFILE_FLOWWORKER_DETECT);
+        FLOW_COST_START(fcost, FLOW_COST_DETECT);
         Detect(tv, p, detect_thread, NULL, NULL);
+        FLOW_COST_END(fcost, FLOW_COST_DETECT);
+        LATENCY_FW_END(tv, PROFILE_FLOWWORKER_DETECT);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
     }
 
     // Outputs.
+    FLOW_COST_START(fcost, FLOW_COST_OUTPUT);
     OutputLoggerLog(tv, p, fw->output_thread);
+    FLOW_COST_END(fcost, FLOW_COST_OUTPUT);
+
+    /* bypass the flow if it became too costly */
+    FlowCostCheckBypass(tv, fw->dtv, p, fcost);
 
     /*  Release tcp segments. Done here after alerting can use them. */
     if (p->flow != NULL && p->proto == IPPROTO_TCP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_TCPPRUNE);
+        LATENCY_FW_START(tv, PROFILE_FLOWWORKER_TCPPRUNE);
         StreamTcpPruneSession(p->flow, p->flowflags & FLOW_PKT_TOSERVER ?
                 STREAM_TOSERVER : STREAM_TOCLIENT);
+        LATENCY_FW_END(tv, PROFILE_FLOWWORKER_TCPPRUNE);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_TCPPRUNE);
     }
 
@@ -44,6 +44,10 @@
 #include "flow-manager.h"
 #include "flow-storage.h"
 #include "flow-bypass.h"
+#include "flow-sample.h"
+#include "flow-cost.h"
+#include "flow-snapshot.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -56,6 +60,9 @@
 
 #include "util-debug.h"
 #include "util-privs.h"
+#include "util-pages.h"
+#include "util-startup.h"
+#include "util-hash-crc32c.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -71,6 +78,13 @@
 #define FLOW_DEFAULT_MEMCAP      (32 * 1024 * 1024) /* 32 MB */
 
 #define FLOW_DEFAULT_PREALLOC    10000
+#define FLOW_DEFAULT_SPARE_BATCH 32
+#define FLOW_MAX_SPARE_BATCH     1024
+#define FLOW_DEFAULT_EVICTION_SCAN 8
+#define FLOW_MAX_EVICTION_SCAN   1024
+#define FLOW_DEFAULT_THREAD_HASHSIZE 16384
+#define FLOW_DEFAULT_THREAD_FALLBACK_PCT 10
+#define FLOW_MAX_BYPASS_CACHE_SIZE (1 << 20)
 
 /** atomic int that is used when freeing a flow from the hash. In this
  *  case we walk the hash to find a flow to free. This var records where
@@ -97,7 +111,7 @@ extern int run_mode;
  */
 int FlowSetMemcap(uint64_t size)
 {
-    if ((uint64_t)SC_ATOMIC_GET(flow_memuse) < size) {
+    if (MemcapCounterGet(&flow_memuse) < size) {
         SC_ATOMIC_SET(flow_config.memcap, size);
         return 1;
     }
@@ -118,7 +132,7 @@ uint64_t FlowGetMemcap(void)
 
 uint64_t FlowGetMemuse(void)
 {
-    uint64_t memusecopy = SC_ATOMIC_GET(flow_memuse);
+    uint64_t memusecopy = MemcapCounterGet(&flow_memuse);
     return memusecopy;
 }
 
@@ -404,6 +418,8 @@ void FlowHandlePacketUpdate(Flow *f, Packet *p)
     if (state != FLOW_STATE_CAPTURE_BYPASSED) {
         /* update the last seen timestamp of this flow */
         COPY_TIMESTAMP(&p->ts, &f->lastts);
+        /* compact it again next time it goes idle */
+        f->flags &= ~FLOW_IDLE_COMPACTED;
     } else {
         /* still seeing packet, we downgrade to local bypass */
         if (p->ts.tv_sec - f->lastts.tv_sec > FLOW_BYPASSED_TIMEOUT / 2) {
@@ -495,6 +511,11 @@ void FlowHandlePacketUpdate(Flow *f, Packet *p)
  */
 void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
+    /* private flow tables are timed out by their own thread */
+    if (dtv != NULL && dtv->flow_table != NULL) {
+        FlowThreadTableCheckTimeout(dtv->flow_table, p);
+    }
+
     /* Get this packet's flow from the hash. FlowHandlePacket() will setup
      * a new flow if nescesary. If we get NULL, we're out of flow memory.
      * The returned flow is locked. */
@@ -502,11 +523,23 @@ void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     if (f == NULL)
         return;
 
+    /* new flows can be sampled out, no packets were counted for them yet */
+    if (g_flow_sample_enabled && f->todstpktcnt == 0 && f->tosrcpktcnt == 0) {
+        FlowSampleFlow(tv, dtv, p, f);
+    }
+
     /* set the flow in the packet */
     p->flags |= PKT_HAS_FLOW;
     return;
 }
 
+/** settings of FlowInitHash(), it can't read the config itself as it
+ *  may run in parallel to the rest of the startup */
+static char flow_init_quiet = FALSE;
+static bool flow_init_bucket_tags = false;
+
+static void FlowInitHash(void);
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void FlowInitConfig(char quiet)
@@ -515,7 +548,7 @@ void FlowInitConfig(char quiet)
 
     memset(&flow_config,  0, sizeof(flow_config));
     SC_ATOMIC_INIT(flow_flags);
-    SC_ATOMIC_INIT(flow_memuse);
+    MemcapCounterInit(&flow_memuse, 0);
     SC_ATOMIC_INIT(flow_prune_idx);
     SC_ATOMIC_INIT(flow_config.memcap);
     FlowQueueInit(&flow_spare_q);
@@ -523,8 +556,15 @@ void FlowInitConfig(char quiet)
 
     /* set defaults */
     flow_config.hash_rand   = (uint32_t)RandomGet();
+    flow_config.hash_key[0] = ((uint64_t)(uint32_t)RandomGet() << 32) | (uint32_t)RandomGet();
+    flow_config.hash_key[1] = ((uint64_t)(uint32_t)RandomGet() << 32) | (uint32_t)RandomGet();
+    flow_config.hash_function = FLOW_HASH_LOOKUP3;
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
+    flow_config.spare_batch = FLOW_DEFAULT_SPARE_BATCH;
+    flow_config.eviction_scan = FLOW_DEFAULT_EVICTION_SCAN;
+    flow_config.thread_hash_size = FLOW_DEFAULT_THREAD_HASHSIZE;
+    flow_config.thread_fallback_pct = FLOW_DEFAULT_THREAD_FALLBACK_PCT;
     SC_ATOMIC_SET(flow_config.memcap, FLOW_DEFAULT_MEMCAP);
 
     /* If we have specific config, overwrite the defaults with them,
@@ -576,6 +616,25 @@ void FlowInitConfig(char quiet)
             flow_config.hash_size = configval;
         }
     }
+    if ((ConfGet("flow.hash-function", &conf_val)) == 1 && conf_val != NULL)
+    {
+        if (strcmp(conf_val, "lookup3") == 0) {
+            flow_config.hash_function = FLOW_HASH_LOOKUP3;
+        } else if (strcmp(conf_val, "crc32c") == 0) {
+            if (HashCrc32cAvailable()) {
+                flow_config.hash_function = FLOW_HASH_CRC32C;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "flow.hash-function crc32c "
+                        "needs a cpu with SSE4.2 or the ARMv8 CRC extension, "
+                        "using lookup3");
+            }
+        } else if (strcmp(conf_val, "siphash") == 0) {
+            flow_config.hash_function = FLOW_HASH_SIPHASH;
+        } else {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.hash-function must be "
+                    "lookup3, crc32c or siphash, using lookup3");
+        }
+    }
     if ((ConfGet("flow.prealloc", &conf_val)) == 1)
     {
         if (conf_val == NULL) {
@@ -588,10 +647,128 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    if ((ConfGet("flow.spare-batch", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0 ||
+            configval > FLOW_MAX_SPARE_BATCH)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.spare-batch must be "
+                    "between 0 and %u, using default %u",
+                    FLOW_MAX_SPARE_BATCH, FLOW_DEFAULT_SPARE_BATCH);
+        } else {
+            flow_config.spare_batch = configval;
+        }
+    }
+    if ((ConfGet("flow.eviction-scan", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0 ||
+            configval < 1 || configval > FLOW_MAX_EVICTION_SCAN)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.eviction-scan must be "
+                    "between 1 and %u, using default %u",
+                    FLOW_MAX_EVICTION_SCAN, FLOW_DEFAULT_EVICTION_SCAN);
+        } else {
+            flow_config.eviction_scan = configval;
+        }
+    }
+    int thread_local = 0;
+    if (ConfGetBool("flow.thread-local.enabled", &thread_local) == 1 &&
+            thread_local == 1) {
+        flow_config.thread_local = 1;
+    }
+    if ((ConfGet("flow.thread-local.hash-size", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0 || configval == 0)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid value for "
+                    "flow.thread-local.hash-size, using default %u",
+                    FLOW_DEFAULT_THREAD_HASHSIZE);
+        } else {
+            flow_config.thread_hash_size = configval;
+        }
+    }
+    if ((ConfGet("flow.thread-local.fallback-threshold", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0 || configval > 100)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.thread-local."
+                    "fallback-threshold must be between 0 and 100, using "
+                    "default %u", FLOW_DEFAULT_THREAD_FALLBACK_PCT);
+        } else {
+            flow_config.thread_fallback_pct = configval;
+        }
+    }
+    if ((ConfGet("flow.bypass-cache-size", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0 ||
+            configval > FLOW_MAX_BYPASS_CACHE_SIZE)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.bypass-cache-size must be "
+                    "between 0 and %u, cache disabled", FLOW_MAX_BYPASS_CACHE_SIZE);
+        } else if (configval > 0) {
+            /* the cache is indexed with a mask of the flow hash */
+            uint32_t size = 1;
+            while (size < configval)
+                size <<= 1;
+            flow_config.bypass_cache_size = size;
+        }
+    }
+    if ((ConfGet("flow.idle-compact-timeout", &conf_val)) == 1)
+    {
+        if (conf_val == NULL ||
+            ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) <= 0)
+        {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid value for "
+                    "flow.idle-compact-timeout, idle compaction disabled");
+        } else {
+            flow_config.idle_compact = configval;
+        }
+    }
+    int bucket_tags = 0;
+    if (ConfGetBool("flow.bucket-tags", &bucket_tags) == 1 && bucket_tags) {
+        flow_init_bucket_tags = true;
+    }
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, SC_ATOMIC_GET(flow_config.memcap),
                flow_config.hash_size, flow_config.prealloc);
 
+    if (!quiet) {
+        static const char *hash_names[] = { "lookup3", "crc32c", "siphash" };
+        SCLogConfig("flow hash function %s", hash_names[flow_config.hash_function]);
+    }
+
+    flow_init_quiet = quiet;
+    StartupTaskRun("flow hash", FlowInitHash);
+
+    FlowInitFlowProto();
+    FlowSampleInitConfig();
+    FlowSnapshotInitConfig();
+    FlowTimeoutFlushInitConfig();
+
+    return;
+}
+
+/** \internal
+ *  \brief allocate the flow hash and preallocate the flows
+ *
+ *  Can run in parallel to the rest of the startup, so it only uses the
+ *  flow_config values set up by FlowInitConfig(). The hash comes zeroed
+ *  from PageAllocTable(). */
+static void FlowInitHash(void)
+{
+    const char quiet = flow_init_quiet;
+
     /* alloc hash memory */
     uint64_t hash_size = flow_config.hash_size * sizeof(FlowBucket);
     if (!(FLOW_CHECK_MEMCAP(hash_size))) {
@@ -603,24 +780,42 @@ void FlowInitConfig(char quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCMallocAligned(flow_config.hash_size * sizeof(FlowBucket), CLS);
+    flow_hash = PageAllocTable(flow_config.hash_size * sizeof(FlowBucket));
     if (unlikely(flow_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
-    memset(flow_hash, 0, flow_config.hash_size * sizeof(FlowBucket));
 
     uint32_t i = 0;
     for (i = 0; i < flow_config.hash_size; i++) {
         FBLOCK_INIT(&flow_hash[i]);
         SC_ATOMIC_INIT(flow_hash[i].next_ts);
     }
-    (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+    MemcapCounterIncr(&flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+
+    if (flow_init_bucket_tags) {
+        const uint64_t tags_size = flow_config.hash_size * sizeof(FlowBucketTags);
+        if (!(FLOW_CHECK_MEMCAP(tags_size))) {
+            SCLogError(SC_ERR_FLOW_INIT, "allocating the flow hash tag index "
+                    "failed: max flow memcap is smaller than projected size "
+                    "of %"PRIu64" bytes", tags_size);
+            exit(EXIT_FAILURE);
+        }
+        flow_hash_tags = PageAllocTable(tags_size);
+        if (unlikely(flow_hash_tags == NULL)) {
+            SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+        MemcapCounterIncr(&flow_memuse, tags_size);
+        if (quiet == FALSE) {
+            SCLogConfig("flow hash tag index enabled, %"PRIu64" bytes", tags_size);
+        }
+    }
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the flow hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
-                  SC_ATOMIC_GET(flow_memuse), flow_config.hash_size,
+                  MemcapCounterGet(&flow_memuse), flow_config.hash_size,
                   (uintmax_t)sizeof(FlowBucket));
     }
 
@@ -630,7 +825,7 @@ void FlowInitConfig(char quiet)
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
                     "max flow memcap reached. Memcap %"PRIu64", "
                     "Memuse %"PRIu64".", SC_ATOMIC_GET(flow_config.memcap),
-                    ((uint64_t)SC_ATOMIC_GET(flow_memuse) + (uint64_t)sizeof(Flow)));
+                    (MemcapCounterGet(&flow_memuse) + (uint64_t)sizeof(Flow)));
             exit(EXIT_FAILURE);
         }
 
@@ -647,12 +842,12 @@ void FlowInitConfig(char quiet)
         SCLogConfig("preallocated %" PRIu32 " flows of size %" PRIuMAX "",
                 flow_spare_q.len, (uintmax_t)(sizeof(Flow) + + FlowStorageSize()));
         SCLogConfig("flow memory usage: %"PRIu64" bytes, maximum: %"PRIu64,
-                SC_ATOMIC_GET(flow_memuse), SC_ATOMIC_GET(flow_config.memcap));
+                MemcapCounterGet(&flow_memuse), SC_ATOMIC_GET(flow_config.memcap));
+        if (flow_config.thread_local) {
+            SCLogConfig("flow uses per thread tables of %"PRIu32" buckets in "
+                    "the workers runmode", flow_config.thread_hash_size);
+        }
     }
-
-    FlowInitFlowProto();
-
-    return;
 }
 
 /** \brief print some flow stats
@@ -678,6 +873,7 @@ void FlowShutdown(void)
     while((f = FlowDequeue(&flow_recycle_q))) {
         FlowFree(f);
     }
+    FlowRecycleQueuesFree();
 
     /* clear and free the hash */
     if (flow_hash != NULL) {
@@ -698,17 +894,25 @@ void FlowShutdown(void)
             FBLOCK_DESTROY(&flow_hash[u]);
             SC_ATOMIC_DESTROY(flow_hash[u].next_ts);
         }
-        SCFreeAligned(flow_hash);
+        PageFreeTable(flow_hash, flow_config.hash_size * sizeof(FlowBucket));
         flow_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    MemcapCounterDecr(&flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    FlowTimeoutWheelDestroy();
+    if (flow_hash_tags != NULL) {
+        PageFreeTable(flow_hash_tags, flow_config.hash_size * sizeof(FlowBucketTags));
+        flow_hash_tags = NULL;
+        MemcapCounterDecr(&flow_memuse, flow_config.hash_size * sizeof(FlowBucketTags));
+    }
     FlowQueueDestroy(&flow_spare_q);
     FlowQueueDestroy(&flow_recycle_q);
 
     SC_ATOMIC_DESTROY(flow_config.memcap);
     SC_ATOMIC_DESTROY(flow_prune_idx);
-    SC_ATOMIC_DESTROY(flow_memuse);
+    MemcapCounterDestroy(&flow_memuse);
     SC_ATOMIC_DESTROY(flow_flags);
+    FlowSampleDestroy();
+    FlowSnapshotDestroy();
     return;
 }
 
@@ -1033,6 +1237,7 @@ int FlowClearMemory(Flow* f, uint8_t proto_map)
         flow_freefuncs[proto_map].Freefunc(f->protoctx);
     }
 
+    FlowCostFlowEnd(f);
     FlowFreeStorage(f);
 
     FLOW_RECYCLE(f);
@@ -1107,6 +1312,8 @@ void FlowUpdateState(Flow *f, enum FlowState s)
         /* and reset the flow buckup next_ts value so that the flow manager
          * has to revisit this row */
         SC_ATOMIC_SET(f->fb->next_ts, 0);
+        /* with the timeout wheel the row is handed to the flow manager */
+        FlowWheelQueueRow(f->fb);
     }
 }
 
@@ -1319,6 +1526,99 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test Test taking flows from a queue and allocating them in batches.
+ */
+static int FlowTest10 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    FlowQueue q;
+    FlowQueueInit(&q);
+
+    uint32_t cnt = 0;
+    Flow *list = FlowAllocBatch(3, &cnt);
+    FAIL_IF_NULL(list);
+    FAIL_IF_NOT(cnt == 3);
+
+    Flow *f[3];
+    for (int i = 0; i < 3; i++) {
+        FAIL_IF_NULL(list);
+        f[i] = list;
+        list = list->lnext;
+        f[i]->lnext = NULL;
+        FlowEnqueue(&q, f[i]);
+    }
+    FAIL_IF_NOT_NULL(list);
+    FAIL_IF_NOT(q.len == 3);
+
+    /* same order as FlowDequeue: oldest first */
+    list = FlowDequeueBatch(&q, 2, &cnt);
+    FAIL_IF_NOT(cnt == 2);
+    FAIL_IF_NOT(q.len == 1);
+    FAIL_IF_NOT(list == f[0]);
+    FAIL_IF_NOT(list->lnext == f[1]);
+    FAIL_IF_NOT_NULL(f[1]->lnext);
+    FAIL_IF_NOT(q.top == f[2] && q.bot == f[2]);
+    FAIL_IF_NOT_NULL(f[2]->lnext);
+
+    list = FlowDequeueBatch(&q, 2, &cnt);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(list == f[2]);
+    FAIL_IF_NOT(q.len == 0);
+    FAIL_IF_NOT_NULL(q.top);
+    FAIL_IF_NOT_NULL(q.bot);
+
+    FAIL_IF_NOT_NULL(FlowDequeueBatch(&q, 2, &cnt));
+    FAIL_IF_NOT(cnt == 0);
+
+    for (int i = 0; i < 3; i++) {
+        FlowFree(f[i]);
+    }
+    FlowQueueDestroy(&q);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test Test returning a list of flows to the spare queue at once.
+ */
+static int FlowTest11 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    uint32_t cnt = 0;
+    Flow *list = FlowAllocBatch(2, &cnt);
+    FAIL_IF_NULL(list);
+    FAIL_IF_NOT(cnt == 2);
+    Flow *f0 = list;
+    Flow *f1 = list->lnext;
+    FAIL_IF_NULL(f1);
+
+    const uint32_t spare_len = flow_spare_q.len;
+    FlowMoveListToSpare(list);
+    FAIL_IF_NOT(flow_spare_q.len == spare_len + 2);
+    /* appended in list order, like FlowMoveToSpare() on each */
+    FAIL_IF_NOT(flow_spare_q.bot == f1);
+    FAIL_IF_NOT(f1->lprev == f0);
+    FAIL_IF_NOT(f0->lnext == f1);
+    FAIL_IF_NOT_NULL(f1->lnext);
+
+    list = FlowDequeueBatch(&flow_spare_q, 2, &cnt);
+    FAIL_IF_NOT(cnt == 2);
+    FAIL_IF_NOT(list == f1);
+    FAIL_IF_NOT(list->lnext == f0);
+    FAIL_IF_NOT(flow_spare_q.len == spare_len);
+
+    FlowFree(f0);
+    FlowFree(f1);
+    FlowMoveListToSpare(NULL);
+    FAIL_IF_NOT(flow_spare_q.len == spare_len);
+
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1336,6 +1636,10 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test batched flow dequeue and alloc",
+                   FlowTest10);
+    UtRegisterTest("FlowTest11 -- Test returning a list of flows to spare",
+                   FlowTest11);
 
     FlowMgrRegisterTests();
     RegisterFlowStorageTests();
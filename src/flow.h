@@ -104,6 +104,14 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #define FLOW_WRONG_THREAD               BIT_U32(25)
 /** Protocol detection told us flow is picked up in wrong direction (midstream) */
 #define FLOW_DIR_REVERSED               BIT_U32(26)
+/** app-layer saw the handshake complete, the payload that follows is
+ *  encrypted (TLS, SSH) */
+#define FLOW_PAYLOAD_ENCRYPTED          BIT_U32(27)
+/** the flow manager compacted the state of the idle flow, cleared by
+ *  the next packet */
+#define FLOW_IDLE_COMPACTED             BIT_U32(28)
+/** the flow has session tags, saves the storage lookup */
+#define FLOW_HAS_TAGS                   BIT_U32(29)
 
 /* File flags */
 
@@ -257,10 +265,20 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #define FLOW_RESET_PP_DONE(f, dir) (((dir) & STREAM_TOSERVER) ? ((f)->flags &= ~FLOW_TS_PP_ALPROTO_DETECT_DONE) : ((f)->flags &= ~FLOW_TC_PP_ALPROTO_DETECT_DONE))
 #define FLOW_RESET_PE_DONE(f, dir) (((dir) & STREAM_TOSERVER) ? ((f)->flags &= ~FLOW_TS_PE_ALPROTO_DETECT_DONE) : ((f)->flags &= ~FLOW_TC_PE_ALPROTO_DETECT_DONE))
 
+/** hash function of the flow table, flow.hash-function */
+enum FlowHashFunction {
+    FLOW_HASH_LOOKUP3 = 0,
+    FLOW_HASH_CRC32C,
+    FLOW_HASH_SIPHASH,
+};
+
 /* global flow config */
 typedef struct FlowCnf_
 {
     uint32_t hash_rand;
+    /** key for FLOW_HASH_SIPHASH */
+    uint64_t hash_key[2];
+    enum FlowHashFunction hash_function;
     uint32_t hash_size;
     uint32_t max_flows;
     uint32_t prealloc;
@@ -272,6 +290,28 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** number of flows a thread takes from the spare queue or allocates
+     *  at once into its local cache, 0 disables the cache */
+    uint32_t spare_batch;
+
+    /** number of evictable flows compared to pick the one to evict at
+     *  memcap, 1 evicts the first one found */
+    uint32_t eviction_scan;
+
+    /** flow.thread-local: private flow table per worker thread */
+    uint32_t thread_local;
+    uint32_t thread_hash_size;
+    /** percentage of new TCP flows starting with a SYN/ACK at which new
+     *  flows go to the shared hash again, 0 disables the check */
+    uint32_t thread_fallback_pct;
+    /** entries of the per thread cache of locally bypassed flows, a power
+     *  of 2, 0 if disabled */
+    uint32_t bypass_cache_size;
+    /** seconds without packets after which the flow manager frees what
+     *  the flow's stream and app-layer state can do without, 0 if
+     *  disabled */
+    uint32_t idle_compact;
+
     SC_ATOMIC_DECLARE(uint64_t, memcap);
 } FlowConfig;
 
@@ -282,6 +322,7 @@ typedef struct FlowKey_
     Port sp, dp;
     uint8_t proto;
     uint8_t recursion_level;
+    uint64_t domain_id;
 
 } FlowKey;
 
@@ -345,6 +386,14 @@ typedef struct Flow_
     uint8_t recursion_level;
     uint16_t vlan_id[2];
     uint8_t vlan_idx;
+    /** MPLS domain and PPPoE session, see Packet::domain_id */
+    uint64_t domain_id;
+
+    /** hash list pointers, protected by fb->s. Next to the header so the
+     *  hash lookup walking the list stays in the first cache line. */
+    struct Flow_ *hnext; /* hash list */
+    struct Flow_ *hprev;
+    struct FlowBucket_ *fb;
 
     /** Incoming interface */
     const struct LiveDevice_ *livedev;
@@ -385,8 +434,8 @@ typedef struct Flow_
      *  for use with STARTTLS and HTTP CONNECT detection */
     uint16_t protodetect_dp; /**< 0 if not used */
 
-    /* Parent flow id for protocol like ftp */
-    int64_t parent_id;
+    /** rarely used parts, NULL until one of them is needed */
+    struct FlowExt_ *ext;
 
 #ifdef FLOWLOCK_RWLOCK
     SCRWLock r;
@@ -447,11 +496,6 @@ typedef struct Flow_
     /* pointer to the var list */
     GenericVar *flowvar;
 
-    /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
-    struct Flow_ *hprev;
-    struct FlowBucket_ *fb;
-
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
@@ -463,6 +507,14 @@ typedef struct Flow_
     uint64_t tosrcbytecnt;
 } Flow;
 
+/** rarely used parts of a flow, allocated by FlowGetExt() when first set
+ *  and freed with the flow's storage. The storage registered with
+ *  FLOW_STORAGE_LATE follows the struct. */
+typedef struct FlowExt_ {
+    /* Parent flow id for protocol like ftp */
+    int64_t parent_id;
+} FlowExt;
+
 enum FlowState {
     FLOW_STATE_NEW = 0,
     FLOW_STATE_ESTABLISHED,
@@ -39,11 +39,11 @@
 #include "host-storage.h"
 
 static int host_bit_id = -1;                /**< Host storage id for bits */
+static XBitsFilter *host_bit_filter = NULL; /**< addresses of hosts with bits */
 
 static void HostBitFreeAll(void *store)
 {
-    GenericVar *gv = store;
-    GenericVarFree(gv);
+    XBitsFree(store);
 }
 
 void HostBitInitCtx(void)
@@ -53,6 +53,35 @@ void HostBitInitCtx(void)
         SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for bits");
         exit(EXIT_FAILURE);
     }
+    if (host_bit_filter == NULL) {
+        host_bit_filter = XBitsFilterNew();
+        if (host_bit_filter == NULL) {
+            SCLogError(SC_ERR_HOST_INIT, "Can't initiate host bits filter");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static inline uint16_t HostBitKeyLen(const Address *a)
+{
+    return (a->family == AF_INET6) ? 16 : 4;
+}
+
+/** \brief check if the host with address a may have bits, without looking
+ *         up the host
+ *  \retval 0 the host has no bits
+ *  \retval 1 the host may have bits */
+int HostBitsMayHave(const Address *a)
+{
+    return XBitsFilterMayHave(host_bit_filter, a->addr_data8, HostBitKeyLen(a)) ? 1 : 0;
+}
+
+/** \brief remove the host from the filter before its storage is freed
+ *  \note host is locked or not in use */
+void HostBitsRelease(Host *h)
+{
+    if (host_bit_id != -1 && HostGetStorageById(h, host_bit_id) != NULL)
+        XBitsFilterRemove(host_bit_filter, h->a.addr_data8, HostBitKeyLen(&h->a));
 }
 
 /* lock before using this */
@@ -67,71 +96,45 @@ int HostHasHostBits(Host *host)
   * \retval 0 host still has active (non-expired) xbits */
 int HostBitsTimedoutCheck(Host *h, struct timeval *ts)
 {
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS) {
-            XBit *xb = (XBit *)gv;
-            if (xb->expire > (uint32_t)ts->tv_sec)
-                return 0;
-        }
+    const XBits *xbs = HostGetStorageById(h, host_bit_id);
+    for (uint32_t idx = 0; XBitsNext(xbs, &idx) == 1; idx++) {
+        if (xbs->expire[idx] > (uint32_t)ts->tv_sec)
+            return 0;
     }
     return 1;
 }
 
-/* get the bit with idx from the host */
-static XBit *HostBitGet(Host *h, uint32_t idx)
+/* get the expire time of the bit with idx from the host */
+static uint32_t *HostBitGet(Host *h, uint32_t idx)
 {
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS && gv->idx == idx) {
-            return (XBit *)gv;
-        }
-    }
-
-    return NULL;
+    return XBitsGet(HostGetStorageById(h, host_bit_id), idx);
 }
 
-/* add a flowbit to the flow */
+/* add a bit to the host, or update its expire time */
 static void HostBitAdd(Host *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = HostBitGet(h, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(XBit));
-        if (unlikely(fb == NULL))
-            return;
-
-        fb->type = DETECT_XBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        fb->expire = expire;
-
-        GenericVar *gv = HostGetStorageById(h, host_bit_id);
-        GenericVarAppend(&gv, (GenericVar *)fb);
-        HostSetStorageById(h, host_bit_id, gv);
-
-    // bit already set, lets update it's time
-    } else {
-        fb->expire = expire;
-    }
+    XBits *xbs = HostGetStorageById(h, host_bit_id);
+    const bool first = (xbs == NULL);
+    (void)XBitsSet(&xbs, idx, expire);
+    HostSetStorageById(h, host_bit_id, xbs);
+    if (first && xbs != NULL)
+        XBitsFilterAdd(host_bit_filter, h->a.addr_data8, HostBitKeyLen(&h->a));
 }
 
 static void HostBitRemove(Host *h, uint32_t idx)
 {
-    XBit *fb = HostBitGet(h, idx);
-    if (fb == NULL)
-        return;
-
-    GenericVar *gv = HostGetStorageById(h, host_bit_id);
-    if (gv) {
-        GenericVarRemove(&gv, (GenericVar *)fb);
-        XBitFree(fb);
-        HostSetStorageById(h, host_bit_id, gv);
+    XBits *xbs = HostGetStorageById(h, host_bit_id);
+    if (xbs) {
+        XBitsUnset(&xbs, idx);
+        HostSetStorageById(h, host_bit_id, xbs);
+        if (xbs == NULL)
+            XBitsFilterRemove(host_bit_filter, h->a.addr_data8, HostBitKeyLen(&h->a));
     }
 }
 
 void HostBitSet(Host *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = HostBitGet(h, idx);
+    uint32_t *fb = HostBitGet(h, idx);
     if (fb == NULL) {
         HostBitAdd(h, idx, expire);
     }
@@ -139,15 +142,12 @@ void HostBitSet(Host *h, uint32_t idx, uint32_t expire)
 
 void HostBitUnset(Host *h, uint32_t idx)
 {
-    XBit *fb = HostBitGet(h, idx);
-    if (fb != NULL) {
-        HostBitRemove(h, idx);
-    }
+    HostBitRemove(h, idx);
 }
 
 void HostBitToggle(Host *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = HostBitGet(h, idx);
+    uint32_t *fb = HostBitGet(h, idx);
     if (fb != NULL) {
         HostBitRemove(h, idx);
     } else {
@@ -157,9 +157,9 @@ void HostBitToggle(Host *h, uint32_t idx, uint32_t expire)
 
 int HostBitIsset(Host *h, uint32_t idx, uint32_t ts)
 {
-    XBit *fb = HostBitGet(h, idx);
+    uint32_t *fb = HostBitGet(h, idx);
     if (fb != NULL) {
-        if (fb->expire < ts) {
+        if (*fb < ts) {
             HostBitRemove(h,idx);
             return 0;
         }
@@ -170,35 +170,32 @@ int HostBitIsset(Host *h, uint32_t idx, uint32_t ts)
 
 int HostBitIsnotset(Host *h, uint32_t idx, uint32_t ts)
 {
-    XBit *fb = HostBitGet(h, idx);
+    uint32_t *fb = HostBitGet(h, idx);
     if (fb == NULL) {
         return 1;
     }
 
-    if (fb->expire < ts) {
+    if (*fb < ts) {
         HostBitRemove(h,idx);
         return 1;
     }
     return 0;
 }
 
-int HostBitList(Host *h, XBit **iter)
+/** \brief get the next bit of the host
+ *  \param iter iterator, start with 0
+ *  \retval 1 bit returned in idx and expire
+ *  \retval 0 no more bits */
+int HostBitList(Host *h, uint32_t *iter, uint32_t *idx, uint32_t *expire)
 {
-    GenericVar *gv = (GenericVar *)*iter;
-    if (gv == NULL) {
-        gv = HostGetStorageById(h, host_bit_id);
-    } else {
-        gv = gv->next;
-    }
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS) {
-            *iter = (XBit *)gv;
-            return 1;
-        }
-    }
-    *iter = NULL;
-    return 0;
+    const XBits *xbs = HostGetStorageById(h, host_bit_id);
+    uint32_t i = *iter;
+    if (XBitsNext(xbs, &i) == 0)
+        return 0;
+    *idx = i;
+    *expire = xbs->expire[i];
+    *iter = i + 1;
+    return 1;
 }
 
 /* TESTS */
@@ -214,7 +211,7 @@ static int HostBitTest01 (void)
 
     HostBitAdd(h, 0, 0);
 
-    XBit *fb = HostBitGet(h,0);
+    uint32_t *fb = HostBitGet(h,0);
     if (fb != NULL)
         ret = 1;
 
@@ -233,7 +230,7 @@ static int HostBitTest02 (void)
     if (h == NULL)
         goto end;
 
-    XBit *fb = HostBitGet(h,0);
+    uint32_t *fb = HostBitGet(h,0);
     if (fb == NULL)
         ret = 1;
 
@@ -254,7 +251,7 @@ static int HostBitTest03 (void)
 
     HostBitAdd(h, 0, 30);
 
-    XBit *fb = HostBitGet(h,0);
+    uint32_t *fb = HostBitGet(h,0);
     if (fb == NULL) {
         printf("fb == NULL although it was just added: ");
         goto end;
@@ -290,7 +287,7 @@ static int HostBitTest04 (void)
     HostBitAdd(h, 2, 30);
     HostBitAdd(h, 3, 30);
 
-    XBit *fb = HostBitGet(h,0);
+    uint32_t *fb = HostBitGet(h,0);
     if (fb != NULL)
         ret = 1;
 
@@ -314,7 +311,7 @@ static int HostBitTest05 (void)
     HostBitAdd(h, 2, 30);
     HostBitAdd(h, 3, 30);
 
-    XBit *fb = HostBitGet(h,1);
+    uint32_t *fb = HostBitGet(h,1);
     if (fb != NULL)
         ret = 1;
 
@@ -338,7 +335,7 @@ static int HostBitTest06 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,2);
+    uint32_t *fb = HostBitGet(h,2);
     if (fb != NULL)
         ret = 1;
 
@@ -362,7 +359,7 @@ static int HostBitTest07 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,3);
+    uint32_t *fb = HostBitGet(h,3);
     if (fb != NULL)
         ret = 1;
 
@@ -386,7 +383,7 @@ static int HostBitTest08 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,0);
+    uint32_t *fb = HostBitGet(h,0);
     if (fb == NULL)
         goto end;
 
@@ -419,7 +416,7 @@ static int HostBitTest09 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,1);
+    uint32_t *fb = HostBitGet(h,1);
     if (fb == NULL)
         goto end;
 
@@ -452,7 +449,7 @@ static int HostBitTest10 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,2);
+    uint32_t *fb = HostBitGet(h,2);
     if (fb == NULL)
         goto end;
 
@@ -485,7 +482,7 @@ static int HostBitTest11 (void)
     HostBitAdd(h, 2, 90);
     HostBitAdd(h, 3, 90);
 
-    XBit *fb = HostBitGet(h,3);
+    uint32_t *fb = HostBitGet(h,3);
     if (fb == NULL)
         goto end;
 
@@ -504,6 +501,35 @@ end:
     return ret;
 }
 
+/** \test the filter follows the first bit set and the last one removed,
+ *        and forgets the host when it's freed */
+static int HostBitTest12 (void)
+{
+    HostInitConfig(TRUE);
+    Host *h = HostAlloc();
+    FAIL_IF_NULL(h);
+    h->a.family = AF_INET;
+    h->a.addr_data32[0] = htonl(0xc0000201);
+
+    FAIL_IF(HostBitsMayHave(&h->a));
+    HostBitAdd(h, 0, 90);
+    HostBitAdd(h, 1, 90);
+    FAIL_IF_NOT(HostBitsMayHave(&h->a));
+    HostBitRemove(h, 0);
+    FAIL_IF_NOT(HostBitsMayHave(&h->a));
+    HostBitRemove(h, 1);
+    FAIL_IF(HostBitsMayHave(&h->a));
+
+    HostBitAdd(h, 2, 90);
+    FAIL_IF_NOT(HostBitsMayHave(&h->a));
+    Address a = h->a;
+    HostFree(h);
+    FAIL_IF(HostBitsMayHave(&a));
+
+    HostCleanup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void HostBitRegisterTests(void)
@@ -520,5 +546,6 @@ void HostBitRegisterTests(void)
     UtRegisterTest("HostBitTest09", HostBitTest09);
     UtRegisterTest("HostBitTest10", HostBitTest10);
     UtRegisterTest("HostBitTest11", HostBitTest11);
+    UtRegisterTest("HostBitTest12", HostBitTest12);
 #endif /* UNITTESTS */
 }
@@ -32,12 +32,14 @@ void HostBitRegisterTests(void);
 
 int HostHasHostBits(Host *host);
 int HostBitsTimedoutCheck(Host *h, struct timeval *ts);
+int HostBitsMayHave(const Address *a);
+void HostBitsRelease(Host *h);
 
 void HostBitSet(Host *, uint32_t, uint32_t);
 void HostBitUnset(Host *, uint32_t);
 void HostBitToggle(Host *, uint32_t, uint32_t);
 int HostBitIsset(Host *, uint32_t, uint32_t);
 int HostBitIsnotset(Host *, uint32_t, uint32_t);
-int HostBitList(Host *, XBit **);
+int HostBitList(Host *, uint32_t *iter, uint32_t *idx, uint32_t *expire);
 
 #endif /* __HOST_BIT_H__ */
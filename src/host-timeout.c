@@ -25,12 +25,10 @@
 #include "host.h"
 
 #include "detect-engine-tag.h"
-#include "detect-engine-threshold.h"
 
 #include "host-bit.h"
 #include "host-timeout.h"
 
-#include "reputation.h"
 
 uint32_t HostGetSpareCount(void)
 {
@@ -54,7 +52,6 @@ uint32_t HostGetActiveCount(void)
 static int HostHostTimedOut(Host *h, struct timeval *ts)
 {
     int tags = 0;
-    int thresholds = 0;
     int vars = 0;
 
     /** never prune a host that is used by a packet
@@ -63,24 +60,14 @@ static int HostHostTimedOut(Host *h, struct timeval *ts)
         return 0;
     }
 
-    if (h->iprep) {
-        if (SRepHostTimedOut(h) == 0)
-            return 0;
-
-        SCLogDebug("host %p reputation timed out", h);
-    }
-
     if (TagHostHasTag(h) && TagTimeoutCheck(h, ts) == 0) {
         tags = 1;
     }
-    if (ThresholdHostHasThreshold(h) && ThresholdHostTimeoutCheck(h, ts) == 0) {
-        thresholds = 1;
-    }
     if (HostHasHostBits(h) && HostBitsTimedoutCheck(h, ts) == 0) {
         vars = 1;
     }
 
-    if (tags || thresholds || vars)
+    if (tags || vars)
         return 0;
 
     SCLogDebug("host %p timed out", h);
@@ -161,19 +148,19 @@ uint32_t HostTimeoutHash(struct timeval *ts)
     for (idx = 0; idx < host_config.hash_size; idx++) {
         HostHashRow *hb = &host_hash[idx];
 
-        if (HRLOCK_TRYLOCK(hb) != 0)
+        if (HOST_ROW_TRYLOCK(hb) != 0)
             continue;
 
         /* host hash bucket is now locked */
 
         if (hb->tail == NULL) {
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
             continue;
         }
 
         /* we have a host, or more than one */
         cnt += HostHashRowTimeout(hb, hb->tail, ts);
-        HRLOCK_UNLOCK(hb);
+        HOST_ROW_UNLOCK(hb);
     }
 
     return cnt;
@@ -42,6 +42,8 @@
 #include "detect-engine-threshold.h"
 
 #include "util-hash-lookup3.h"
+#include "util-pages.h"
+#include "util-unittest.h"
 
 static Host *HostGetUsedHost(void);
 
@@ -150,18 +152,16 @@ error:
 
 void HostClearMemory(Host *h)
 {
-    if (h->iprep != NULL) {
-        SCFree(h->iprep);
-        h->iprep = NULL;
-    }
-
-    if (HostStorageSize() > 0)
+    if (HostStorageSize() > 0) {
+        HostBitsRelease(h);
         HostFreeStorage(h);
+    }
 }
 
 #define HOST_DEFAULT_HASHSIZE 4096
 #define HOST_DEFAULT_MEMCAP 16777216
 #define HOST_DEFAULT_PREALLOC 1000
+#define HOST_DEFAULT_STRIPES 1024
 
 /** \brief initialize the configuration
  *  \warning Not thread safe */
@@ -183,6 +183,7 @@ void HostInitConfig(char quiet)
     host_config.hash_rand   = (uint32_t)RandomGet();
     host_config.hash_size   = HOST_DEFAULT_HASHSIZE;
     host_config.prealloc    = HOST_DEFAULT_PREALLOC;
+    host_config.stripes     = HOST_DEFAULT_STRIPES;
     SC_ATOMIC_SET(host_config.memcap, HOST_DEFAULT_MEMCAP);
 
     /* Check if we have memcap and hash_size defined at config */
@@ -219,12 +220,27 @@ void HostInitConfig(char quiet)
             WarnInvalidConfEntry("host.prealloc", "%"PRIu32, host_config.prealloc);
         }
     }
+    if ((ConfGetValue("host.lock-stripes", &conf_val)) == 1)
+    {
+        if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) > 0 && configval > 0) {
+            host_config.stripes = configval;
+        } else {
+            WarnInvalidConfEntry("host.lock-stripes", "%"PRIu32, host_config.stripes);
+        }
+    }
+    /* a power of 2, no more than there are rows */
+    while (host_config.stripes & (host_config.stripes - 1))
+        host_config.stripes &= host_config.stripes - 1;
+    while (host_config.stripes > 1 && host_config.stripes > host_config.hash_size)
+        host_config.stripes >>= 1;
     SCLogDebug("Host config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, SC_ATOMIC_GET(host_config.memcap),
                host_config.hash_size, host_config.prealloc);
 
     /* alloc hash memory */
-    uint64_t hash_size = host_config.hash_size * sizeof(HostHashRow);
+    uint64_t hash_size = host_config.hash_size * sizeof(HostHashRow) +
+        host_config.stripes * sizeof(HostHashStripe);
     if (!(HOST_CHECK_MEMCAP(hash_size))) {
         SCLogError(SC_ERR_HOST_INIT, "allocating host hash failed: "
                 "max host memcap is smaller than projected hash size. "
@@ -234,24 +250,29 @@ void HostInitConfig(char quiet)
                 (uintmax_t)sizeof(HostHashRow));
         exit(EXIT_FAILURE);
     }
-    host_hash = SCMallocAligned(host_config.hash_size * sizeof(HostHashRow), CLS);
+    host_hash = PageAllocTable(host_config.hash_size * sizeof(HostHashRow));
     if (unlikely(host_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
-    memset(host_hash, 0, host_config.hash_size * sizeof(HostHashRow));
+
+    host_hash_stripes = SCMallocAligned(host_config.stripes * sizeof(HostHashStripe), CLS);
+    if (unlikely(host_hash_stripes == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
 
     uint32_t i = 0;
-    for (i = 0; i < host_config.hash_size; i++) {
-        HRLOCK_INIT(&host_hash[i]);
+    for (i = 0; i < host_config.stripes; i++) {
+        HRLOCK_INIT(&host_hash_stripes[i]);
     }
-    (void) SC_ATOMIC_ADD(host_memuse, (host_config.hash_size * sizeof(HostHashRow)));
+    (void) SC_ATOMIC_ADD(host_memuse, hash_size);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the host hash... "
-                  "%" PRIu32 " buckets of size %" PRIuMAX "",
+                  "%" PRIu32 " buckets of size %" PRIuMAX ", %" PRIu32 " locks",
                   SC_ATOMIC_GET(host_memuse), host_config.hash_size,
-                  (uintmax_t)sizeof(HostHashRow));
+                  (uintmax_t)sizeof(HostHashRow), host_config.stripes);
     }
 
     /* pre allocate hosts */
@@ -319,13 +340,19 @@ void HostShutdown(void)
                 HostFree(h);
                 h = n;
             }
-
-            HRLOCK_DESTROY(&host_hash[u]);
         }
-        SCFreeAligned(host_hash);
+        PageFreeTable(host_hash, host_config.hash_size * sizeof(HostHashRow));
         host_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(host_memuse, host_config.hash_size * sizeof(HostHashRow));
+    if (host_hash_stripes != NULL) {
+        for (u = 0; u < host_config.stripes; u++) {
+            HRLOCK_DESTROY(&host_hash_stripes[u]);
+        }
+        SCFreeAligned(host_hash_stripes);
+        host_hash_stripes = NULL;
+    }
+    (void) SC_ATOMIC_SUB(host_memuse, host_config.hash_size * sizeof(HostHashRow) +
+            host_config.stripes * sizeof(HostHashStripe));
     HostQueueDestroy(&host_spare_q);
 
     SC_ATOMIC_DESTROY(host_prune_idx);
@@ -350,31 +377,25 @@ void HostCleanup(void)
         for (u = 0; u < host_config.hash_size; u++) {
             h = host_hash[u].head;
             HostHashRow *hb = &host_hash[u];
-            HRLOCK_LOCK(hb);
+            HOST_ROW_LOCK(hb);
             while (h) {
-                if ((SC_ATOMIC_GET(h->use_cnt) > 0) && (h->iprep != NULL)) {
-                    /* iprep is attached to host only clear local storage */
-                    HostFreeStorage(h);
-                    h = h->hnext;
-                } else {
-                    Host *n = h->hnext;
-                    /* remove from the hash */
-                    if (h->hprev != NULL)
-                        h->hprev->hnext = h->hnext;
-                    if (h->hnext != NULL)
-                        h->hnext->hprev = h->hprev;
-                    if (hb->head == h)
-                        hb->head = h->hnext;
-                    if (hb->tail == h)
-                        hb->tail = h->hprev;
-                    h->hnext = NULL;
-                    h->hprev = NULL;
-                    HostClearMemory(h);
-                    HostMoveToSpare(h);
-                    h = n;
-                }
+                Host *n = h->hnext;
+                /* remove from the hash */
+                if (h->hprev != NULL)
+                    h->hprev->hnext = h->hnext;
+                if (h->hnext != NULL)
+                    h->hnext->hprev = h->hprev;
+                if (hb->head == h)
+                    hb->head = h->hnext;
+                if (hb->tail == h)
+                    hb->tail = h->hprev;
+                h->hnext = NULL;
+                h->hprev = NULL;
+                HostClearMemory(h);
+                HostMoveToSpare(h);
+                h = n;
             }
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
         }
     }
 
@@ -505,13 +526,13 @@ Host *HostGetHostFromHash (Address *a)
     uint32_t key = HostGetKey(a);
     /* get our hash bucket and lock it */
     HostHashRow *hb = &host_hash[key];
-    HRLOCK_LOCK(hb);
+    HOST_ROW_LOCK(hb);
 
     /* see if the bucket already has a host */
     if (hb->head == NULL) {
         h = HostGetNew(a);
         if (h == NULL) {
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
             return NULL;
         }
 
@@ -522,7 +543,7 @@ Host *HostGetHostFromHash (Address *a)
         /* got one, now lock, initialize and return */
         HostInit(h,a);
 
-        HRLOCK_UNLOCK(hb);
+        HOST_ROW_UNLOCK(hb);
         return h;
     }
 
@@ -540,7 +561,7 @@ Host *HostGetHostFromHash (Address *a)
             if (h == NULL) {
                 h = ph->hnext = HostGetNew(a);
                 if (h == NULL) {
-                    HRLOCK_UNLOCK(hb);
+                    HOST_ROW_UNLOCK(hb);
                     return NULL;
                 }
                 hb->tail = h;
@@ -552,7 +573,7 @@ Host *HostGetHostFromHash (Address *a)
                 /* initialize and return */
                 HostInit(h,a);
 
-                HRLOCK_UNLOCK(hb);
+                HOST_ROW_UNLOCK(hb);
                 return h;
             }
 
@@ -577,7 +598,7 @@ Host *HostGetHostFromHash (Address *a)
                 /* found our host, lock & return */
                 SCMutexLock(&h->m);
                 (void) HostIncrUsecnt(h);
-                HRLOCK_UNLOCK(hb);
+                HOST_ROW_UNLOCK(hb);
                 return h;
             }
         }
@@ -586,11 +607,14 @@ Host *HostGetHostFromHash (Address *a)
     /* lock & return */
     SCMutexLock(&h->m);
     (void) HostIncrUsecnt(h);
-    HRLOCK_UNLOCK(hb);
+    HOST_ROW_UNLOCK(hb);
     return h;
 }
 
 /** \brief look up a host in the hash
+ *
+ *  Doesn't create the host if it's not in the hash, for callers that
+ *  only read from the host.
  *
  *  \param a address to look up
  *
@@ -600,15 +624,20 @@ Host *HostLookupHostFromHash (Address *a)
 {
     Host *h = NULL;
 
+    /* nothing was ever stored for any host, like when no tags or
+     * hostbits are in use: nothing to look up or lock */
+    if (SC_ATOMIC_GET(host_counter) == 0)
+        return NULL;
+
     /* get the key to our bucket */
     uint32_t key = HostGetKey(a);
     /* get our hash bucket and lock it */
     HostHashRow *hb = &host_hash[key];
-    HRLOCK_LOCK(hb);
+    HOST_ROW_LOCK(hb);
 
     /* see if the bucket already has a host */
     if (hb->head == NULL) {
-        HRLOCK_UNLOCK(hb);
+        HOST_ROW_UNLOCK(hb);
         return h;
     }
 
@@ -621,7 +650,7 @@ Host *HostLookupHostFromHash (Address *a)
             h = h->hnext;
 
             if (h == NULL) {
-                HRLOCK_UNLOCK(hb);
+                HOST_ROW_UNLOCK(hb);
                 return h;
             }
 
@@ -646,7 +675,7 @@ Host *HostLookupHostFromHash (Address *a)
                 /* found our host, lock & return */
                 SCMutexLock(&h->m);
                 (void) HostIncrUsecnt(h);
-                HRLOCK_UNLOCK(hb);
+                HOST_ROW_UNLOCK(hb);
                 return h;
             }
         }
@@ -655,7 +684,7 @@ Host *HostLookupHostFromHash (Address *a)
     /* lock & return */
     SCMutexLock(&h->m);
     (void) HostIncrUsecnt(h);
-    HRLOCK_UNLOCK(hb);
+    HOST_ROW_UNLOCK(hb);
     return h;
 }
 
@@ -681,24 +710,24 @@ static Host *HostGetUsedHost(void)
 
         HostHashRow *hb = &host_hash[idx];
 
-        if (HRLOCK_TRYLOCK(hb) != 0)
+        if (HOST_ROW_TRYLOCK(hb) != 0)
             continue;
 
         Host *h = hb->tail;
         if (h == NULL) {
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
             continue;
         }
 
         if (SCMutexTrylock(&h->m) != 0) {
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
             continue;
         }
 
         /** never prune a host that is used by a packets
          *  we are currently processing in one of the threads */
         if (SC_ATOMIC_GET(h->use_cnt) > 0) {
-            HRLOCK_UNLOCK(hb);
+            HOST_ROW_UNLOCK(hb);
             SCMutexUnlock(&h->m);
             continue;
         }
@@ -715,7 +744,8 @@ static Host *HostGetUsedHost(void)
 
         h->hnext = NULL;
         h->hprev = NULL;
-        HRLOCK_UNLOCK(hb);
+        HOST_ROW_UNLOCK(hb);
+        (void) SC_ATOMIC_SUB(host_counter, 1);
 
         HostClearMemory (h);
 
@@ -728,8 +758,51 @@ static Host *HostGetUsedHost(void)
     return NULL;
 }
 
+#ifdef UNITTESTS
+/** \test lock stripes are rounded down to a power of 2 and lookups
+ *         don't create hosts */
+static int HostTest01(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF(ConfSet("host.hash-size", "1000") != 1);
+    FAIL_IF(ConfSet("host.lock-stripes", "100") != 1);
+    HostInitConfig(HOST_QUIET);
+    FAIL_IF_NOT(host_config.stripes == 64);
+
+    Address a;
+    memset(&a, 0x00, sizeof(a));
+    a.addr_data32[0] = 0x01020304;
+    a.family = AF_INET;
+    FAIL_IF_NOT_NULL(HostLookupHostFromHash(&a));
+    FAIL_IF_NOT(SC_ATOMIC_GET(host_counter) == 0);
+
+    Host *h = HostGetHostFromHash(&a);
+    FAIL_IF_NULL(h);
+    HostRelease(h);
+    FAIL_IF_NOT(SC_ATOMIC_GET(host_counter) == 1);
+
+    Host *h2 = HostLookupHostFromHash(&a);
+    FAIL_IF_NOT(h2 == h);
+    HostRelease(h2);
+
+    /* a row and the row a stripe further share a lock */
+    FAIL_IF_NOT(HostHashRowStripe(&host_hash[1]) ==
+            HostHashRowStripe(&host_hash[1 + host_config.stripes]));
+    FAIL_IF(HostHashRowStripe(&host_hash[1]) == HostHashRowStripe(&host_hash[2]));
+
+    HostShutdown();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+#endif /* UNITTESTS */
+
 void HostRegisterUnittests(void)
 {
+#ifdef UNITTESTS
+    UtRegisterTest("HostTest01", HostTest01);
+#endif
     RegisterHostStorageTests();
 }
 
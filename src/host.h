@@ -65,9 +65,6 @@ typedef struct Host_ {
     /** use cnt, reference counter */
     SC_ATOMIC_DECLARE(unsigned int, use_cnt);
 
-    /** pointers to iprep storage */
-    void *iprep;
-
     /** storage api handle */
     Storage *storage;
 
@@ -80,14 +77,22 @@ typedef struct Host_ {
     struct Host_ *lprev;
 } Host;
 
+/** host hash row, protected by the lock of its stripe */
 typedef struct HostHashRow_ {
-    HRLOCK_TYPE lock;
     Host *head;
     Host *tail;
-} __attribute__((aligned(CLS))) HostHashRow;
+} HostHashRow;
+
+/** lock shared by the rows with the same index modulo the number of
+ *  stripes, so the rows stay small and the locks get their own cache
+ *  line */
+typedef struct HostHashStripe_ {
+    HRLOCK_TYPE lock;
+} __attribute__((aligned(CLS))) HostHashStripe;
 
 /** host hash table */
 HostHashRow *host_hash;
+HostHashStripe *host_hash_stripes;
 
 #define HOST_VERBOSE    0
 #define HOST_QUIET      1
@@ -96,6 +101,8 @@ typedef struct HostConfig_ {
     SC_ATOMIC_DECLARE(uint64_t, memcap);
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** number of row locks, power of 2 */
+    uint32_t stripes;
     uint32_t prealloc;
 } HostConfig;
 
@@ -133,6 +140,12 @@ SC_ATOMIC_DECLARE(uint64_t,host_memuse);
 SC_ATOMIC_DECLARE(uint32_t,host_counter);
 SC_ATOMIC_DECLARE(uint32_t,host_prune_idx);
 
+#define HostHashRowStripe(hb) \
+    (&host_hash_stripes[((hb) - host_hash) & (host_config.stripes - 1)])
+#define HOST_ROW_LOCK(hb) HRLOCK_LOCK(HostHashRowStripe(hb))
+#define HOST_ROW_TRYLOCK(hb) HRLOCK_TRYLOCK(HostHashRowStripe(hb))
+#define HOST_ROW_UNLOCK(hb) HRLOCK_UNLOCK(HostHashRowStripe(hb))
+
 void HostInitConfig(char quiet);
 void HostShutdown(void);
 void HostCleanup(void);
@@ -39,11 +39,11 @@
 #include "ippair-storage.h"
 
 static int ippair_bit_id = -1;                /**< IPPair storage id for bits */
+static XBitsFilter *ippair_bit_filter = NULL; /**< address pairs with bits */
 
 static void XBitFreeAll(void *store)
 {
-    GenericVar *gv = store;
-    GenericVarFree(gv);
+    XBitsFree(store);
 }
 
 void IPPairBitInitCtx(void)
@@ -53,6 +53,61 @@ void IPPairBitInitCtx(void)
         SCLogError(SC_ERR_IPPAIR_INIT, "Can't initiate ippair storage for bits");
         exit(EXIT_FAILURE);
     }
+    if (ippair_bit_filter == NULL) {
+        ippair_bit_filter = XBitsFilterNew();
+        if (ippair_bit_filter == NULL) {
+            SCLogError(SC_ERR_IPPAIR_INIT, "Can't initiate ippair bits filter");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* the filter key is the two addresses, lowest first, like the ippair
+ * lookup that doesn't care about the direction */
+static uint16_t IPPairBitKey(const Address *a, const Address *b, uint8_t *key)
+{
+    const uint16_t len = (a->family == AF_INET6) ? 16 : 4;
+    if (memcmp(a->addr_data8, b->addr_data8, len) > 0) {
+        const Address *t = a;
+        a = b;
+        b = t;
+    }
+    memcpy(key, a->addr_data8, len);
+    memcpy(key + len, b->addr_data8, len);
+    return len * 2;
+}
+
+static void IPPairBitFilterAdd(IPPair *h)
+{
+    uint8_t key[32];
+    const uint16_t len = IPPairBitKey(&h->a[0], &h->a[1], key);
+    XBitsFilterAdd(ippair_bit_filter, key, len);
+}
+
+static void IPPairBitFilterRemove(IPPair *h)
+{
+    uint8_t key[32];
+    const uint16_t len = IPPairBitKey(&h->a[0], &h->a[1], key);
+    XBitsFilterRemove(ippair_bit_filter, key, len);
+}
+
+/** \brief check if the ippair of a and b may have bits, without looking
+ *         up the ippair
+ *  \retval 0 the ippair has no bits
+ *  \retval 1 the ippair may have bits */
+int IPPairBitsMayHave(const Address *a, const Address *b)
+{
+    uint8_t key[32];
+    const uint16_t len = IPPairBitKey(a, b, key);
+    return XBitsFilterMayHave(ippair_bit_filter, key, len) ? 1 : 0;
+}
+
+/** \brief remove the ippair from the filter before its storage is freed
+ *  \note ippair is locked or not in use */
+void IPPairBitsRelease(IPPair *h)
+{
+    if (ippair_bit_id != -1 && IPPairGetStorageById(h, ippair_bit_id) != NULL)
+        IPPairBitFilterRemove(h);
 }
 
 /* lock before using this */
@@ -67,71 +122,45 @@ int IPPairHasBits(IPPair *ippair)
   * \retval 0 ippair still has active (non-expired) xbits */
 int IPPairBitsTimedoutCheck(IPPair *h, struct timeval *ts)
 {
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS) {
-            XBit *xb = (XBit *)gv;
-            if (xb->expire > (uint32_t)ts->tv_sec)
-                return 0;
-        }
+    const XBits *xbs = IPPairGetStorageById(h, ippair_bit_id);
+    for (uint32_t idx = 0; XBitsNext(xbs, &idx) == 1; idx++) {
+        if (xbs->expire[idx] > (uint32_t)ts->tv_sec)
+            return 0;
     }
     return 1;
 }
 
-/* get the bit with idx from the ippair */
-static XBit *IPPairBitGet(IPPair *h, uint32_t idx)
+/* get the expire time of the bit with idx from the ippair */
+static uint32_t *IPPairBitGet(IPPair *h, uint32_t idx)
 {
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_XBITS && gv->idx == idx) {
-            return (XBit *)gv;
-        }
-    }
-
-    return NULL;
+    return XBitsGet(IPPairGetStorageById(h, ippair_bit_id), idx);
 }
 
-/* add a flowbit to the flow */
+/* add a bit to the ippair, or update its expire time */
 static void IPPairBitAdd(IPPair *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = IPPairBitGet(h, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(XBit));
-        if (unlikely(fb == NULL))
-            return;
-
-        fb->type = DETECT_XBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        fb->expire = expire;
-
-        GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-        GenericVarAppend(&gv, (GenericVar *)fb);
-        IPPairSetStorageById(h, ippair_bit_id, gv);
-
-    // bit already set, lets update it's timer
-    } else {
-        fb->expire = expire;
-    }
+    XBits *xbs = IPPairGetStorageById(h, ippair_bit_id);
+    const bool first = (xbs == NULL);
+    (void)XBitsSet(&xbs, idx, expire);
+    IPPairSetStorageById(h, ippair_bit_id, xbs);
+    if (first && xbs != NULL)
+        IPPairBitFilterAdd(h);
 }
 
 static void IPPairBitRemove(IPPair *h, uint32_t idx)
 {
-    XBit *fb = IPPairBitGet(h, idx);
-    if (fb == NULL)
-        return;
-
-    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
-    if (gv) {
-        GenericVarRemove(&gv, (GenericVar *)fb);
-        XBitFree(fb);
-        IPPairSetStorageById(h, ippair_bit_id, gv);
+    XBits *xbs = IPPairGetStorageById(h, ippair_bit_id);
+    if (xbs) {
+        XBitsUnset(&xbs, idx);
+        IPPairSetStorageById(h, ippair_bit_id, xbs);
+        if (xbs == NULL)
+            IPPairBitFilterRemove(h);
     }
 }
 
 void IPPairBitSet(IPPair *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = IPPairBitGet(h, idx);
+    uint32_t *fb = IPPairBitGet(h, idx);
     if (fb == NULL) {
         IPPairBitAdd(h, idx, expire);
     }
@@ -139,15 +168,12 @@ void IPPairBitSet(IPPair *h, uint32_t idx, uint32_t expire)
 
 void IPPairBitUnset(IPPair *h, uint32_t idx)
 {
-    XBit *fb = IPPairBitGet(h, idx);
-    if (fb != NULL) {
-        IPPairBitRemove(h, idx);
-    }
+    IPPairBitRemove(h, idx);
 }
 
 void IPPairBitToggle(IPPair *h, uint32_t idx, uint32_t expire)
 {
-    XBit *fb = IPPairBitGet(h, idx);
+    uint32_t *fb = IPPairBitGet(h, idx);
     if (fb != NULL) {
         IPPairBitRemove(h, idx);
     } else {
@@ -157,13 +183,12 @@ void IPPairBitToggle(IPPair *h, uint32_t idx, uint32_t expire)
 
 int IPPairBitIsset(IPPair *h, uint32_t idx, uint32_t ts)
 {
-    XBit *fb = IPPairBitGet(h, idx);
+    uint32_t *fb = IPPairBitGet(h, idx);
     if (fb != NULL) {
-        if (fb->expire < ts) {
-            IPPairBitRemove(h, idx);
+        if (*fb < ts) {
+            IPPairBitRemove(h,idx);
             return 0;
         }
-
         return 1;
     }
     return 0;
@@ -171,20 +196,18 @@ int IPPairBitIsset(IPPair *h, uint32_t idx, uint32_t ts)
 
 int IPPairBitIsnotset(IPPair *h, uint32_t idx, uint32_t ts)
 {
-    XBit *fb = IPPairBitGet(h, idx);
+    uint32_t *fb = IPPairBitGet(h, idx);
     if (fb == NULL) {
         return 1;
     }
 
-    if (fb->expire < ts) {
-        IPPairBitRemove(h, idx);
+    if (*fb < ts) {
+        IPPairBitRemove(h,idx);
         return 1;
     }
-
     return 0;
 }
 
-
 /* TESTS */
 #ifdef UNITTESTS
 static int IPPairBitTest01 (void)
@@ -198,7 +221,7 @@ static int IPPairBitTest01 (void)
 
     IPPairBitAdd(h, 0, 0);
 
-    XBit *fb = IPPairBitGet(h,0);
+    uint32_t *fb = IPPairBitGet(h,0);
     if (fb != NULL)
         ret = 1;
 
@@ -217,7 +240,7 @@ static int IPPairBitTest02 (void)
     if (h == NULL)
         goto end;
 
-    XBit *fb = IPPairBitGet(h,0);
+    uint32_t *fb = IPPairBitGet(h,0);
     if (fb == NULL)
         ret = 1;
 
@@ -238,7 +261,7 @@ static int IPPairBitTest03 (void)
 
     IPPairBitAdd(h, 0, 30);
 
-    XBit *fb = IPPairBitGet(h,0);
+    uint32_t *fb = IPPairBitGet(h,0);
     if (fb == NULL) {
         printf("fb == NULL although it was just added: ");
         goto end;
@@ -274,7 +297,7 @@ static int IPPairBitTest04 (void)
     IPPairBitAdd(h, 2,30);
     IPPairBitAdd(h, 3,30);
 
-    XBit *fb = IPPairBitGet(h,0);
+    uint32_t *fb = IPPairBitGet(h,0);
     if (fb != NULL)
         ret = 1;
 
@@ -298,7 +321,7 @@ static int IPPairBitTest05 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,1);
+    uint32_t *fb = IPPairBitGet(h,1);
     if (fb != NULL)
         ret = 1;
 
@@ -322,7 +345,7 @@ static int IPPairBitTest06 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,2);
+    uint32_t *fb = IPPairBitGet(h,2);
     if (fb != NULL)
         ret = 1;
 
@@ -346,7 +369,7 @@ static int IPPairBitTest07 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,3);
+    uint32_t *fb = IPPairBitGet(h,3);
     if (fb != NULL)
         ret = 1;
 
@@ -370,7 +393,7 @@ static int IPPairBitTest08 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,0);
+    uint32_t *fb = IPPairBitGet(h,0);
     if (fb == NULL)
         goto end;
 
@@ -403,7 +426,7 @@ static int IPPairBitTest09 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,1);
+    uint32_t *fb = IPPairBitGet(h,1);
     if (fb == NULL)
         goto end;
 
@@ -436,7 +459,7 @@ static int IPPairBitTest10 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,2);
+    uint32_t *fb = IPPairBitGet(h,2);
     if (fb == NULL)
         goto end;
 
@@ -469,7 +492,7 @@ static int IPPairBitTest11 (void)
     IPPairBitAdd(h, 2,90);
     IPPairBitAdd(h, 3,90);
 
-    XBit *fb = IPPairBitGet(h,3);
+    uint32_t *fb = IPPairBitGet(h,3);
     if (fb == NULL)
         goto end;
 
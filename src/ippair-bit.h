@@ -32,6 +32,8 @@ void IPPairBitRegisterTests(void);
 
 int IPPairHasBits(IPPair *host);
 int IPPairBitsTimedoutCheck(IPPair *h, struct timeval *ts);
+int IPPairBitsMayHave(const Address *a, const Address *b);
+void IPPairBitsRelease(IPPair *h);
 
 void IPPairBitSet(IPPair *, uint32_t, uint32_t);
 void IPPairBitUnset(IPPair *, uint32_t);
@@ -25,7 +25,6 @@
 #include "ippair.h"
 #include "ippair-bit.h"
 #include "ippair-timeout.h"
-#include "detect-engine-threshold.h"
 
 uint32_t IPPairGetSpareCount(void)
 {
@@ -49,7 +48,6 @@ uint32_t IPPairGetActiveCount(void)
 static int IPPairTimedOut(IPPair *h, struct timeval *ts)
 {
     int vars = 0;
-    int thresholds = 0;
 
     /** never prune a ippair that is used by a packet
      *  we are currently processing in one of the threads */
@@ -61,11 +59,7 @@ static int IPPairTimedOut(IPPair *h, struct timeval *ts)
         vars = 1;
     }
 
-    if (ThresholdIPPairHasThreshold(h) && ThresholdIPPairTimeoutCheck(h, ts) == 0) {
-        thresholds = 1;
-    }
-
-    if (vars || thresholds) {
+    if (vars) {
         return 0;
     }
 
@@ -147,19 +141,19 @@ uint32_t IPPairTimeoutHash(struct timeval *ts)
     for (idx = 0; idx < ippair_config.hash_size; idx++) {
         IPPairHashRow *hb = &ippair_hash[idx];
 
-        if (HRLOCK_TRYLOCK(hb) != 0)
+        if (IPPAIR_ROW_TRYLOCK(hb) != 0)
             continue;
 
         /* ippair hash bucket is now locked */
 
         if (hb->tail == NULL) {
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
             continue;
         }
 
         /* we have a ippair, or more than one */
         cnt += IPPairHashRowTimeout(hb, hb->tail, ts);
-        HRLOCK_UNLOCK(hb);
+        IPPAIR_ROW_UNLOCK(hb);
     }
 
     return cnt;
@@ -29,6 +29,7 @@
 #include "util-debug.h"
 #include "ippair.h"
 #include "ippair-storage.h"
+#include "ippair-bit.h"
 
 #include "util-random.h"
 #include "util-misc.h"
@@ -41,6 +42,7 @@
 #include "detect-engine-threshold.h"
 
 #include "util-hash-lookup3.h"
+#include "util-pages.h"
 
 static IPPair *IPPairGetUsedIPPair(void);
 
@@ -151,13 +153,16 @@ error:
 
 void IPPairClearMemory(IPPair *h)
 {
-    if (IPPairStorageSize() > 0)
+    if (IPPairStorageSize() > 0) {
+        IPPairBitsRelease(h);
         IPPairFreeStorage(h);
+    }
 }
 
 #define IPPAIR_DEFAULT_HASHSIZE 4096
 #define IPPAIR_DEFAULT_MEMCAP 16777216
 #define IPPAIR_DEFAULT_PREALLOC 1000
+#define IPPAIR_DEFAULT_STRIPES 1024
 
 /** \brief initialize the configuration
  *  \warning Not thread safe */
@@ -179,6 +184,7 @@ void IPPairInitConfig(char quiet)
     ippair_config.hash_rand   = (uint32_t)RandomGet();
     ippair_config.hash_size   = IPPAIR_DEFAULT_HASHSIZE;
     ippair_config.prealloc    = IPPAIR_DEFAULT_PREALLOC;
+    ippair_config.stripes     = IPPAIR_DEFAULT_STRIPES;
     SC_ATOMIC_SET(ippair_config.memcap, IPPAIR_DEFAULT_MEMCAP);
 
     /* Check if we have memcap and hash_size defined at config */
@@ -215,12 +221,27 @@ void IPPairInitConfig(char quiet)
             WarnInvalidConfEntry("ippair.prealloc", "%"PRIu32, ippair_config.prealloc);
         }
     }
+    if ((ConfGet("ippair.lock-stripes", &conf_val)) == 1)
+    {
+        if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                    conf_val) > 0 && configval > 0) {
+            ippair_config.stripes = configval;
+        } else {
+            WarnInvalidConfEntry("ippair.lock-stripes", "%"PRIu32, ippair_config.stripes);
+        }
+    }
+    /* a power of 2, no more than there are rows */
+    while (ippair_config.stripes & (ippair_config.stripes - 1))
+        ippair_config.stripes &= ippair_config.stripes - 1;
+    while (ippair_config.stripes > 1 && ippair_config.stripes > ippair_config.hash_size)
+        ippair_config.stripes >>= 1;
     SCLogDebug("IPPair config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, SC_ATOMIC_GET(ippair_config.memcap),
                ippair_config.hash_size, ippair_config.prealloc);
 
     /* alloc hash memory */
-    uint64_t hash_size = ippair_config.hash_size * sizeof(IPPairHashRow);
+    uint64_t hash_size = ippair_config.hash_size * sizeof(IPPairHashRow) +
+        ippair_config.stripes * sizeof(IPPairHashStripe);
     if (!(IPPAIR_CHECK_MEMCAP(hash_size))) {
         SCLogError(SC_ERR_IPPAIR_INIT, "allocating ippair hash failed: "
                 "max ippair memcap is smaller than projected hash size. "
@@ -230,24 +251,29 @@ void IPPairInitConfig(char quiet)
                 (uintmax_t)sizeof(IPPairHashRow));
         exit(EXIT_FAILURE);
     }
-    ippair_hash = SCMallocAligned(ippair_config.hash_size * sizeof(IPPairHashRow), CLS);
+    ippair_hash = PageAllocTable(ippair_config.hash_size * sizeof(IPPairHashRow));
     if (unlikely(ippair_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
-    memset(ippair_hash, 0, ippair_config.hash_size * sizeof(IPPairHashRow));
+
+    ippair_hash_stripes = SCMallocAligned(ippair_config.stripes * sizeof(IPPairHashStripe), CLS);
+    if (unlikely(ippair_hash_stripes == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
 
     uint32_t i = 0;
-    for (i = 0; i < ippair_config.hash_size; i++) {
-        HRLOCK_INIT(&ippair_hash[i]);
+    for (i = 0; i < ippair_config.stripes; i++) {
+        HRLOCK_INIT(&ippair_hash_stripes[i]);
     }
-    (void) SC_ATOMIC_ADD(ippair_memuse, (ippair_config.hash_size * sizeof(IPPairHashRow)));
+    (void) SC_ATOMIC_ADD(ippair_memuse, hash_size);
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the ippair hash... "
-                  "%" PRIu32 " buckets of size %" PRIuMAX "",
+                  "%" PRIu32 " buckets of size %" PRIuMAX ", %" PRIu32 " locks",
                   SC_ATOMIC_GET(ippair_memuse), ippair_config.hash_size,
-                  (uintmax_t)sizeof(IPPairHashRow));
+                  (uintmax_t)sizeof(IPPairHashRow), ippair_config.stripes);
     }
 
     /* pre allocate ippairs */
@@ -315,13 +341,19 @@ void IPPairShutdown(void)
                 IPPairFree(h);
                 h = n;
             }
-
-            HRLOCK_DESTROY(&ippair_hash[u]);
         }
-        SCFreeAligned(ippair_hash);
+        PageFreeTable(ippair_hash, ippair_config.hash_size * sizeof(IPPairHashRow));
         ippair_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(ippair_memuse, ippair_config.hash_size * sizeof(IPPairHashRow));
+    if (ippair_hash_stripes != NULL) {
+        for (u = 0; u < ippair_config.stripes; u++) {
+            HRLOCK_DESTROY(&ippair_hash_stripes[u]);
+        }
+        SCFreeAligned(ippair_hash_stripes);
+        ippair_hash_stripes = NULL;
+    }
+    (void) SC_ATOMIC_SUB(ippair_memuse, ippair_config.hash_size * sizeof(IPPairHashRow) +
+            ippair_config.stripes * sizeof(IPPairHashStripe));
     IPPairQueueDestroy(&ippair_spare_q);
 
     SC_ATOMIC_DESTROY(ippair_prune_idx);
@@ -346,11 +378,11 @@ void IPPairCleanup(void)
         for (u = 0; u < ippair_config.hash_size; u++) {
             h = ippair_hash[u].head;
             IPPairHashRow *hb = &ippair_hash[u];
-            HRLOCK_LOCK(hb);
+            IPPAIR_ROW_LOCK(hb);
             while (h) {
                 if ((SC_ATOMIC_GET(h->use_cnt) > 0)) {
                     /* iprep is attached to ippair only clear local storage */
-                    IPPairFreeStorage(h);
+                    IPPairClearMemory(h);
                     h = h->hnext;
                 } else {
                     IPPair *n = h->hnext;
@@ -370,7 +402,7 @@ void IPPairCleanup(void)
                     h = n;
                 }
             }
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
         }
     }
 
@@ -549,13 +581,13 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
     uint32_t key = IPPairGetKey(a, b);
     /* get our hash bucket and lock it */
     IPPairHashRow *hb = &ippair_hash[key];
-    HRLOCK_LOCK(hb);
+    IPPAIR_ROW_LOCK(hb);
 
     /* see if the bucket already has a ippair */
     if (hb->head == NULL) {
         h = IPPairGetNew(a,b);
         if (h == NULL) {
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
             return NULL;
         }
 
@@ -566,7 +598,7 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
         /* got one, now lock, initialize and return */
         IPPairInit(h,a,b);
 
-        HRLOCK_UNLOCK(hb);
+        IPPAIR_ROW_UNLOCK(hb);
         return h;
     }
 
@@ -584,7 +616,7 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
             if (h == NULL) {
                 h = ph->hnext = IPPairGetNew(a,b);
                 if (h == NULL) {
-                    HRLOCK_UNLOCK(hb);
+                    IPPAIR_ROW_UNLOCK(hb);
                     return NULL;
                 }
                 hb->tail = h;
@@ -596,7 +628,7 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
                 /* initialize and return */
                 IPPairInit(h,a,b);
 
-                HRLOCK_UNLOCK(hb);
+                IPPAIR_ROW_UNLOCK(hb);
                 return h;
             }
 
@@ -621,7 +653,7 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
                 /* found our ippair, lock & return */
                 SCMutexLock(&h->m);
                 (void) IPPairIncrUsecnt(h);
-                HRLOCK_UNLOCK(hb);
+                IPPAIR_ROW_UNLOCK(hb);
                 return h;
             }
         }
@@ -630,11 +662,14 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
     /* lock & return */
     SCMutexLock(&h->m);
     (void) IPPairIncrUsecnt(h);
-    HRLOCK_UNLOCK(hb);
+    IPPAIR_ROW_UNLOCK(hb);
     return h;
 }
 
 /** \brief look up a ippair in the hash
+ *
+ *  Doesn't create the ippair if it's not in the hash, for callers that
+ *  only read from it.
  *
  *  \param a address to look up
  *
@@ -644,15 +679,19 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
 {
     IPPair *h = NULL;
 
+    /* nothing was ever stored for any ippair: nothing to look up or lock */
+    if (SC_ATOMIC_GET(ippair_counter) == 0)
+        return NULL;
+
     /* get the key to our bucket */
     uint32_t key = IPPairGetKey(a, b);
     /* get our hash bucket and lock it */
     IPPairHashRow *hb = &ippair_hash[key];
-    HRLOCK_LOCK(hb);
+    IPPAIR_ROW_LOCK(hb);
 
     /* see if the bucket already has a ippair */
     if (hb->head == NULL) {
-        HRLOCK_UNLOCK(hb);
+        IPPAIR_ROW_UNLOCK(hb);
         return h;
     }
 
@@ -665,7 +704,7 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
             h = h->hnext;
 
             if (h == NULL) {
-                HRLOCK_UNLOCK(hb);
+                IPPAIR_ROW_UNLOCK(hb);
                 return h;
             }
 
@@ -690,7 +729,7 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
                 /* found our ippair, lock & return */
                 SCMutexLock(&h->m);
                 (void) IPPairIncrUsecnt(h);
-                HRLOCK_UNLOCK(hb);
+                IPPAIR_ROW_UNLOCK(hb);
                 return h;
             }
         }
@@ -699,7 +738,7 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
     /* lock & return */
     SCMutexLock(&h->m);
     (void) IPPairIncrUsecnt(h);
-    HRLOCK_UNLOCK(hb);
+    IPPAIR_ROW_UNLOCK(hb);
     return h;
 }
 
@@ -725,24 +764,24 @@ static IPPair *IPPairGetUsedIPPair(void)
 
         IPPairHashRow *hb = &ippair_hash[idx];
 
-        if (HRLOCK_TRYLOCK(hb) != 0)
+        if (IPPAIR_ROW_TRYLOCK(hb) != 0)
             continue;
 
         IPPair *h = hb->tail;
         if (h == NULL) {
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
             continue;
         }
 
         if (SCMutexTrylock(&h->m) != 0) {
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
             continue;
         }
 
         /** never prune a ippair that is used by a packets
          *  we are currently processing in one of the threads */
         if (SC_ATOMIC_GET(h->use_cnt) > 0) {
-            HRLOCK_UNLOCK(hb);
+            IPPAIR_ROW_UNLOCK(hb);
             SCMutexUnlock(&h->m);
             continue;
         }
@@ -759,7 +798,8 @@ static IPPair *IPPairGetUsedIPPair(void)
 
         h->hnext = NULL;
         h->hprev = NULL;
-        HRLOCK_UNLOCK(hb);
+        IPPAIR_ROW_UNLOCK(hb);
+        (void) SC_ATOMIC_SUB(ippair_counter, 1);
 
         IPPairClearMemory (h);
 
@@ -77,14 +77,21 @@ typedef struct IPPair_ {
     struct IPPair_ *lprev;
 } IPPair;
 
+/** ippair hash row, protected by the lock of its stripe */
 typedef struct IPPairHashRow_ {
-    HRLOCK_TYPE lock;
     IPPair *head;
     IPPair *tail;
-} __attribute__((aligned(CLS))) IPPairHashRow;
+} IPPairHashRow;
+
+/** lock shared by the rows with the same index modulo the number of
+ *  stripes */
+typedef struct IPPairHashStripe_ {
+    HRLOCK_TYPE lock;
+} __attribute__((aligned(CLS))) IPPairHashStripe;
 
 /** ippair hash table */
 IPPairHashRow *ippair_hash;
+IPPairHashStripe *ippair_hash_stripes;
 
 #define IPPAIR_VERBOSE    0
 #define IPPAIR_QUIET      1
@@ -93,6 +100,8 @@ typedef struct IPPairConfig_ {
     SC_ATOMIC_DECLARE(uint64_t, memcap);
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** number of row locks, power of 2 */
+    uint32_t stripes;
     uint32_t prealloc;
 } IPPairConfig;
 
@@ -130,6 +139,12 @@ SC_ATOMIC_DECLARE(uint64_t,ippair_memuse);
 SC_ATOMIC_DECLARE(uint32_t,ippair_counter);
 SC_ATOMIC_DECLARE(uint32_t,ippair_prune_idx);
 
+#define IPPairHashRowStripe(hb) \
+    (&ippair_hash_stripes[((hb) - ippair_hash) & (ippair_config.stripes - 1)])
+#define IPPAIR_ROW_LOCK(hb) HRLOCK_LOCK(IPPairHashRowStripe(hb))
+#define IPPAIR_ROW_TRYLOCK(hb) HRLOCK_TRYLOCK(IPPairHashRowStripe(hb))
+#define IPPAIR_ROW_UNLOCK(hb) HRLOCK_UNLOCK(IPPairHashRowStripe(hb))
+
 void IPPairInitConfig(char quiet);
 void IPPairShutdown(void);
 void IPPairCleanup(void);
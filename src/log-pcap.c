@@ -41,6 +41,7 @@
 #include "debug.h"
 #include "detect.h"
 #include "flow.h"
+#include "flow-storage.h"
 #include "conf.h"
 
 #include "threads.h"
@@ -87,10 +88,62 @@
 #define HONOR_PASS_RULES_DISABLED       0
 #define HONOR_PASS_RULES_ENABLED        1
 
+#define LOGMODE_COND_ALL                0
+#define LOGMODE_COND_ALERTS             1
+#define LOGMODE_COND_TAG                2
+
+#define DEFAULT_PRE_ALERT_PACKETS       32
+#define DEFAULT_PRE_ALERT_BYTES         64 * 1024
+#define DEFAULT_PRE_ALERT_MEMCAP        32 * 1024 * 1024
+
 #define PCAP_SNAPLEN                    262144
 
+/** size of the pcap file header, before the first packet */
+#define PCAP_FILE_HEADER_LEN            24
+/** size of the pcap record header in the file */
+#define PCAP_RECORD_HEADER_LEN          16
+
+#define PCAP_LOG_INDEX_NONE             0
+#define PCAP_LOG_INDEX_TIME             1
+#define PCAP_LOG_INDEX_FLOW             2
+
+#define PCAP_LOG_INDEX_SUFFIX           ".idx"
+
+/**
+ * Record of the index that is written next to a pcap file, in host byte
+ * order. With "time" there is a record for the first packet of each second,
+ * with "flow" there is a record for each packet.
+ */
+typedef struct PcapLogIndexRecord_ {
+    uint64_t offset;            /**< offset of the packet in the pcap file */
+    int64_t flow_id;            /**< eve flow_id of the packet, 0 if none */
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+} PcapLogIndexRecord;
+
 SC_ATOMIC_DECLARE(uint32_t, thread_cnt);
 
+/** packet kept back in conditional mode, until the flow alerts */
+typedef struct PcapLogBufferedPacket_ {
+    struct timeval ts;
+    uint32_t len;
+    struct PcapLogBufferedPacket_ *next;
+    uint8_t data[];
+} PcapLogBufferedPacket;
+
+/** per flow list of the last packets, oldest first */
+typedef struct PcapLogFlowBuffer_ {
+    PcapLogBufferedPacket *head;
+    PcapLogBufferedPacket *tail;
+    uint32_t cnt;
+    uint64_t bytes;
+} PcapLogFlowBuffer;
+
+/** flow storage id of the PcapLogFlowBuffer */
+static int g_pcap_flow_buffer_id = -1;
+/** memory used by the buffers of all flows */
+SC_ATOMIC_DECLARE(uint64_t, pcap_buffer_memuse);
+
 typedef struct PcapFileName_ {
     char *filename;
     char *dirname;
@@ -177,6 +230,19 @@ typedef struct PcapLogData_ {
     char *filename_parts[MAX_TOKS];
     int filename_part_cnt;
 
+    uint64_t buffer_size;       /**< write buffer size, 0 for the stdio default */
+    char *buffer;               /**< write buffer of the current file */
+    int preallocate;            /**< reserve 'limit' on disk when opening a file */
+    int index;                  /**< PCAP_LOG_INDEX_* */
+    FILE *index_file;           /**< index of the current file */
+    uint64_t file_offset;       /**< offset of the next packet in the file */
+    uint32_t index_sec;         /**< second of the last index record */
+
+    int conditional;            /**< LOGMODE_COND_* */
+    uint32_t pre_alert_packets; /**< packets to keep per flow before an alert */
+    uint64_t pre_alert_bytes;   /**< bytes to keep per flow before an alert */
+    uint64_t pre_alert_memcap;  /**< limit of all buffered packets */
+
     PcapLogCompressionData compression;
 } PcapLogData;
 
@@ -201,6 +267,7 @@ static void PcapLogFileDeInitCtx(OutputCtx *);
 static OutputInitResult PcapLogInitCtx(ConfNode *);
 static void PcapLogProfilingDump(PcapLogData *);
 static int PcapLogCondition(ThreadVars *, const Packet *);
+static void PcapLogFlowBufferFree(void *);
 
 void PcapLogRegister(void)
 {
@@ -209,6 +276,11 @@ void PcapLogRegister(void)
         PcapLogDataDeinit, NULL);
     PcapLogProfileSetup();
     SC_ATOMIC_INIT(thread_cnt);
+    SC_ATOMIC_INIT(pcap_buffer_memuse);
+
+    /* only used in conditional mode, so keep it out of the flow itself */
+    g_pcap_flow_buffer_id = FlowStorageRegister("pcap-log", sizeof(void *),
+            NULL, PcapLogFlowBufferFree, FLOW_STORAGE_LATE);
     return;
 }
 
@@ -242,6 +314,19 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
         PCAPLOG_PROFILE_START;
 
         if (pl->pcap_dumper != NULL) {
+#ifdef HAVE_FALLOCATE
+            if (pl->preallocate &&
+                    pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+                /* give back what was reserved but not used */
+                pcap_dump_flush(pl->pcap_dumper);
+                long size = pcap_dump_ftell(pl->pcap_dumper);
+                if (size >= 0 &&
+                        ftruncate(fileno(pcap_dump_file(pl->pcap_dumper)), size) != 0) {
+                    SCLogDebug("ftruncate of %s failed: %s", pl->filename,
+                            strerror(errno));
+                }
+            }
+#endif
             pcap_dump_close(pl->pcap_dumper);
 #ifdef HAVE_LIBLZ4
             PcapLogCompressionData *comp = &pl->compression;
@@ -262,6 +347,11 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
         pl->size_current = 0;
         pl->pcap_dumper = NULL;
 
+        if (pl->index_file != NULL) {
+            fclose(pl->index_file);
+            pl->index_file = NULL;
+        }
+
         if (pl->pcap_dead_handle != NULL)
             pcap_close(pl->pcap_dead_handle);
         pl->pcap_dead_handle = NULL;
@@ -294,6 +384,18 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
     return 0;
 }
 
+/** \internal
+ *  \brief remove the index of a pcap file, if there is one */
+static void PcapLogRemoveIndex(const char *filename)
+{
+    char path[PATH_MAX];
+    int ret = snprintf(path, sizeof(path), "%s%s", filename,
+            PCAP_LOG_INDEX_SUFFIX);
+    if (ret > 0 && (size_t)ret < sizeof(path)) {
+        (void)remove(path);
+    }
+}
+
 static void PcapFileNameFree(PcapFileName *pf)
 {
     if (pf != NULL) {
@@ -334,6 +436,9 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
         pf = TAILQ_FIRST(&pl->pcap_file_list);
         SCLogDebug("Removing pcap file %s", pf->filename);
 
+        if (pl->index != PCAP_LOG_INDEX_NONE) {
+            PcapLogRemoveIndex(pf->filename);
+        }
         if (remove(pf->filename) != 0) {
             // VJ remove can fail because file is already gone
             //LogWarning(SC_ERR_PCAP_FILE_DELETE_FAILED,
@@ -378,6 +483,90 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
     return 0;
 }
 
+/** \internal
+ *  \brief open an uncompressed pcap file with the configured write
+ *         buffer, reserving the space for it if preallocate is set */
+static FILE *PcapLogOpenPcapFile(PcapLogData *pl)
+{
+    FILE *fp = fopen(pl->filename, "w");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_OPENING_FILE, "Error opening dump file %s: %s",
+                pl->filename, strerror(errno));
+        return NULL;
+    }
+
+    if (pl->buffer_size > 0) {
+        if (pl->buffer == NULL) {
+            pl->buffer = SCMalloc(pl->buffer_size);
+        }
+        /* without it stdio falls back to its own buffer */
+        if (pl->buffer != NULL) {
+            setvbuf(fp, pl->buffer, _IOFBF, pl->buffer_size);
+        }
+    }
+
+#ifdef HAVE_FALLOCATE
+    if (pl->preallocate) {
+        /* keep the file size, so a file that isn't closed cleanly doesn't
+         * end in zeroes. The unused part is released on close. */
+        if (fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0,
+                    (off_t)pl->size_limit) != 0) {
+            SCLogWarning(SC_WARN_PCAP_LOG_PREALLOC, "pcap-log: preallocating "
+                    "%s failed, disabling preallocate: %s", pl->filename,
+                    strerror(errno));
+            pl->preallocate = 0;
+        }
+    }
+#endif
+    return fp;
+}
+
+/** \internal
+ *  \brief open the index of the current file. Without it the file is
+ *         logged without index. */
+static void PcapLogOpenIndex(PcapLogData *pl)
+{
+    char path[PATH_MAX];
+    int ret = snprintf(path, sizeof(path), "%s%s", pl->filename,
+            PCAP_LOG_INDEX_SUFFIX);
+    if (ret < 0 || (size_t)ret >= sizeof(path)) {
+        SCLogError(SC_ERR_SPRINTF, "failed to construct index path");
+        return;
+    }
+    pl->index_file = fopen(path, "w");
+    if (pl->index_file == NULL) {
+        SCLogError(SC_ERR_OPENING_FILE, "Error opening index file %s: %s",
+                path, strerror(errno));
+        return;
+    }
+    pl->index_sec = 0;
+}
+
+/** \internal
+ *  \brief add the packet that is about to be written to the index */
+static void PcapLogWriteIndex(PcapLogData *pl, const Packet *p)
+{
+    const uint32_t sec = (uint32_t)pl->h->ts.tv_sec;
+    if (pl->index == PCAP_LOG_INDEX_TIME && sec == pl->index_sec &&
+            pl->file_offset != PCAP_FILE_HEADER_LEN) {
+        return;
+    }
+    pl->index_sec = sec;
+
+    PcapLogIndexRecord rec = {
+        .offset = pl->file_offset,
+        .flow_id = 0,
+        .ts_sec = sec,
+        .ts_usec = (uint32_t)pl->h->ts.tv_usec,
+    };
+    if (pl->index == PCAP_LOG_INDEX_FLOW && p->flow != NULL) {
+        rec.flow_id = FlowGetId(p->flow);
+    }
+    if (fwrite(&rec, sizeof(rec), 1, pl->index_file) != 1) {
+        SCLogDebug("index write failed: %s", strerror(errno));
+    }
+}
+
 static int PcapLogOpenHandles(PcapLogData *pl, const Packet *p)
 {
     PCAPLOG_PROFILE_START;
@@ -394,11 +583,20 @@ static int PcapLogOpenHandles(PcapLogData *pl, const Packet *p)
 
     if (pl->pcap_dumper == NULL) {
         if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_NONE) {
-            if ((pl->pcap_dumper = pcap_dump_open(pl->pcap_dead_handle,
-                    pl->filename)) == NULL) {
+            FILE *fp = PcapLogOpenPcapFile(pl);
+            if (fp == NULL) {
+                return TM_ECODE_FAILED;
+            }
+            if ((pl->pcap_dumper = pcap_dump_fopen(pl->pcap_dead_handle,
+                    fp)) == NULL) {
                 SCLogInfo("Error opening dump file %s", pcap_geterr(pl->pcap_dead_handle));
+                fclose(fp);
                 return TM_ECODE_FAILED;
             }
+            pl->file_offset = PCAP_FILE_HEADER_LEN;
+            if (pl->index != PCAP_LOG_INDEX_NONE) {
+                PcapLogOpenIndex(pl);
+            }
         }
 #ifdef HAVE_LIBLZ4
         else if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_LZ4) {
@@ -462,49 +660,33 @@ static void PcapLogUnlock(PcapLogData *pl)
     }
 }
 
-/**
- * \brief Pcap logging main function
+/** \internal
+ *  \brief write a packet to the current file, rotating it if needed
  *
- * \param t threadvar
- * \param p packet
- * \param data thread module specific data
- * \param pq pre-packet-queue
- * \param postpq post-packet-queue
+ *  \param p packet, used for the link type and flow of the data
+ *  \param ts timestamp of the data
+ *  \param data packet data, either of p or kept back from an earlier
+ *         packet of its flow
  *
- * \retval TM_ECODE_OK on succes
- * \retval TM_ECODE_FAILED on serious error
+ *  NOTE: must be called with the PcapLogLock held
  */
-static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
+static int PcapLogWrite(ThreadVars *t, PcapLogData *pl, const Packet *p,
+        const struct timeval *ts, const uint8_t *data, uint32_t data_len)
 {
     size_t len;
     int rotate = 0;
     int ret = 0;
 
-    PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
-    PcapLogData *pl = td->pcap_log;
-
-    if ((p->flags & PKT_PSEUDO_STREAM_END) ||
-        ((p->flags & PKT_STREAM_NOPCAPLOG) &&
-         (pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED)) ||
-        (IS_TUNNEL_PKT(p) && !IS_TUNNEL_ROOT_PKT(p)) ||
-        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)))
-    {
-        return TM_ECODE_OK;
-    }
-
-    PcapLogLock(pl);
-
     pl->pkt_cnt++;
-    pl->h->ts.tv_sec = p->ts.tv_sec;
-    pl->h->ts.tv_usec = p->ts.tv_usec;
-    pl->h->caplen = GET_PKT_LEN(p);
-    pl->h->len = GET_PKT_LEN(p);
-    len = sizeof(*pl->h) + GET_PKT_LEN(p);
+    pl->h->ts.tv_sec = ts->tv_sec;
+    pl->h->ts.tv_usec = ts->tv_usec;
+    pl->h->caplen = data_len;
+    pl->h->len = data_len;
+    len = sizeof(*pl->h) + data_len;
 
     if (pl->filename == NULL) {
         ret = PcapLogOpenFileCtx(pl);
         if (ret < 0) {
-            PcapLogUnlock(pl);
             return TM_ECODE_FAILED;
         }
         SCLogDebug("Opening PCAP log file %s", pl->filename);
@@ -512,7 +694,7 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
 
     if (pl->mode == LOGMODE_SGUIL) {
         struct tm local_tm;
-        struct tm *tms = SCLocalTime(p->ts.tv_sec, &local_tm);
+        struct tm *tms = SCLocalTime(ts->tv_sec, &local_tm);
         if (tms->tm_mday != pl->prev_day) {
             rotate = 1;
             pl->prev_day = tms->tm_mday;
@@ -523,7 +705,6 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     if (comp->format == PCAP_LOG_COMPRESSION_FORMAT_NONE) {
         if ((pl->size_current + len) > pl->size_limit || rotate) {
             if (PcapLogRotateFile(t,pl) < 0) {
-                PcapLogUnlock(pl);
                 SCLogDebug("rotation of pcap failed");
                 return TM_ECODE_FAILED;
             }
@@ -540,7 +721,6 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
         if ((pl->size_current + comp->bytes_in_block + len) > pl->size_limit ||
                 rotate) {
             if (PcapLogRotateFile(t,pl) < 0) {
-                PcapLogUnlock(pl);
                 SCLogDebug("rotation of pcap failed");
                 return TM_ECODE_FAILED;
             }
@@ -552,15 +732,18 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
      * this here as we don't know the link type until we get our first packet */
     if (pl->pcap_dead_handle == NULL || pl->pcap_dumper == NULL) {
         if (PcapLogOpenHandles(pl, p) != TM_ECODE_OK) {
-            PcapLogUnlock(pl);
             return TM_ECODE_FAILED;
         }
     }
 
     PCAPLOG_PROFILE_START;
-    pcap_dump((u_char *)pl->pcap_dumper, pl->h, GET_PKT_DATA(p));
+    if (pl->index_file != NULL) {
+        PcapLogWriteIndex(pl, p);
+    }
+    pcap_dump((u_char *)pl->pcap_dumper, pl->h, data);
     if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_NONE) {
         pl->size_current += len;
+        pl->file_offset += PCAP_RECORD_HEADER_LEN + pl->h->caplen;
     }
 #ifdef HAVE_LIBLZ4
     else if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_LZ4) {
@@ -596,10 +779,166 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     SCLogDebug("pl->size_current %"PRIu64",  pl->size_limit %"PRIu64,
                pl->size_current, pl->size_limit);
 
-    PcapLogUnlock(pl);
     return TM_ECODE_OK;
 }
 
+static void PcapLogFlowBufferFree(void *ptr)
+{
+    PcapLogFlowBuffer *fb = ptr;
+    PcapLogBufferedPacket *bp = fb->head;
+    while (bp != NULL) {
+        PcapLogBufferedPacket *next = bp->next;
+        SCFree(bp);
+        bp = next;
+    }
+    (void)SC_ATOMIC_SUB(pcap_buffer_memuse,
+            fb->bytes + fb->cnt * sizeof(PcapLogBufferedPacket) + sizeof(*fb));
+    SCFree(fb);
+}
+
+/** \internal
+ *  \brief remove the oldest packet of a flow buffer */
+static void PcapLogFlowBufferPop(PcapLogFlowBuffer *fb)
+{
+    PcapLogBufferedPacket *bp = fb->head;
+    fb->head = bp->next;
+    if (fb->head == NULL)
+        fb->tail = NULL;
+    fb->cnt--;
+    fb->bytes -= bp->len;
+    (void)SC_ATOMIC_SUB(pcap_buffer_memuse,
+            bp->len + sizeof(PcapLogBufferedPacket));
+    SCFree(bp);
+}
+
+/** \internal
+ *  \brief keep a copy of a packet that didn't match the condition (yet),
+ *         dropping the oldest packets of its flow to stay within the
+ *         pre-alert limits */
+static void PcapLogBufferPacket(const PcapLogData *pl, const Packet *p)
+{
+    const uint32_t len = GET_PKT_LEN(p);
+    if (pl->pre_alert_packets == 0 || len > pl->pre_alert_bytes)
+        return;
+
+    PcapLogFlowBuffer *fb = FlowGetStorageById(p->flow, g_pcap_flow_buffer_id);
+    if (fb == NULL) {
+        if (SC_ATOMIC_GET(pcap_buffer_memuse) + sizeof(*fb) > pl->pre_alert_memcap)
+            return;
+        fb = SCCalloc(1, sizeof(*fb));
+        if (unlikely(fb == NULL))
+            return;
+        if (FlowSetStorageById(p->flow, g_pcap_flow_buffer_id, fb) != 0) {
+            SCFree(fb);
+            return;
+        }
+        (void)SC_ATOMIC_ADD(pcap_buffer_memuse, sizeof(*fb));
+    }
+
+    while (fb->head != NULL && (fb->cnt >= pl->pre_alert_packets ||
+                fb->bytes + len > pl->pre_alert_bytes)) {
+        PcapLogFlowBufferPop(fb);
+    }
+
+    const uint64_t size = sizeof(PcapLogBufferedPacket) + len;
+    if (SC_ATOMIC_GET(pcap_buffer_memuse) + size > pl->pre_alert_memcap)
+        return;
+    PcapLogBufferedPacket *bp = SCMalloc(size);
+    if (unlikely(bp == NULL))
+        return;
+    bp->ts = p->ts;
+    bp->len = len;
+    bp->next = NULL;
+    memcpy(bp->data, GET_PKT_DATA(p), len);
+    (void)SC_ATOMIC_ADD(pcap_buffer_memuse, size);
+
+    if (fb->tail != NULL)
+        fb->tail->next = bp;
+    else
+        fb->head = bp;
+    fb->tail = bp;
+    fb->cnt++;
+    fb->bytes += len;
+}
+
+/** \internal
+ *  \brief check if a packet is to be logged in conditional mode */
+static bool PcapLogConditionalMatch(const PcapLogData *pl, const Packet *p)
+{
+    if (p->alerts.cnt > 0)
+        return true;
+
+    switch (pl->conditional) {
+        case LOGMODE_COND_ALERTS:
+            /* everything after the first alert of the flow */
+            return p->flow != NULL && FlowHasAlerts(p->flow);
+        case LOGMODE_COND_TAG:
+            return (p->flags & PKT_HAS_TAG) != 0;
+    }
+    return true;
+}
+
+/**
+ * \brief Pcap logging main function
+ *
+ * \param t threadvar
+ * \param p packet
+ * \param data thread module specific data
+ * \param pq pre-packet-queue
+ * \param postpq post-packet-queue
+ *
+ * \retval TM_ECODE_OK on succes
+ * \retval TM_ECODE_FAILED on serious error
+ */
+static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
+{
+    PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
+    PcapLogData *pl = td->pcap_log;
+    PcapLogFlowBuffer *fb = NULL;
+
+    if ((p->flags & PKT_PSEUDO_STREAM_END) ||
+        ((p->flags & PKT_STREAM_NOPCAPLOG) &&
+         (pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED)) ||
+        (IS_TUNNEL_PKT(p) && !IS_TUNNEL_ROOT_PKT(p)) ||
+        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)))
+    {
+        return TM_ECODE_OK;
+    }
+
+    if (pl->conditional != LOGMODE_COND_ALL) {
+        if (!PcapLogConditionalMatch(pl, p)) {
+            if (p->flow != NULL)
+                PcapLogBufferPacket(pl, p);
+            return TM_ECODE_OK;
+        }
+        /* take the packets from before the alert, they go first */
+        if (p->flow != NULL) {
+            fb = FlowGetStorageById(p->flow, g_pcap_flow_buffer_id);
+            if (fb != NULL)
+                FlowSetStorageById(p->flow, g_pcap_flow_buffer_id, NULL);
+        }
+    }
+
+    PcapLogLock(pl);
+
+    int ret = TM_ECODE_OK;
+    if (fb != NULL) {
+        for (PcapLogBufferedPacket *bp = fb->head;
+                bp != NULL && ret == TM_ECODE_OK; bp = bp->next) {
+            ret = PcapLogWrite(t, pl, p, &bp->ts, bp->data, bp->len);
+        }
+    }
+    if (ret == TM_ECODE_OK) {
+        ret = PcapLogWrite(t, pl, p, &p->ts, GET_PKT_DATA(p), GET_PKT_LEN(p));
+    }
+
+    PcapLogUnlock(pl);
+
+    if (fb != NULL)
+        PcapLogFlowBufferFree(fb);
+    return ret;
+}
+
 static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
 {
     BUG_ON(pl->mode != LOGMODE_MULTI);
@@ -631,6 +970,13 @@ static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
     copy->timestamp_format = pl->timestamp_format;
     copy->use_stream_depth = pl->use_stream_depth;
     copy->size_limit = pl->size_limit;
+    copy->buffer_size = pl->buffer_size;
+    copy->preallocate = pl->preallocate;
+    copy->index = pl->index;
+    copy->conditional = pl->conditional;
+    copy->pre_alert_packets = pl->pre_alert_packets;
+    copy->pre_alert_bytes = pl->pre_alert_bytes;
+    copy->pre_alert_memcap = pl->pre_alert_memcap;
 
     const PcapLogCompressionData *comp = &pl->compression;
     PcapLogCompressionData *copy_comp = &copy->compression;
@@ -820,6 +1166,12 @@ static TmEcode PcapLogInitRingBuffer(PcapLogData *pl)
         if (fnmatch(basename, entry->d_name, 0) != 0) {
             continue;
         }
+        const size_t name_len = strlen(entry->d_name);
+        const size_t suffix_len = strlen(PCAP_LOG_INDEX_SUFFIX);
+        if (name_len > suffix_len && strcmp(entry->d_name + name_len - suffix_len,
+                    PCAP_LOG_INDEX_SUFFIX) == 0) {
+            continue;
+        }
 
         uint64_t secs = 0;
         uint32_t usecs = 0;
@@ -885,6 +1237,7 @@ static TmEcode PcapLogInitRingBuffer(PcapLogData *pl)
         PcapFileName *pf = TAILQ_FIRST(&pl->pcap_file_list);
         while (pf != NULL && pl->file_cnt > pl->max_files) {
             SCLogDebug("Removing PCAP file %s", pf->filename);
+            PcapLogRemoveIndex(pf->filename);
             if (remove(pf->filename) != 0) {
                 SCLogWarning(SC_WARN_REMOVE_FILE,
                     "Failed to remove PCAP file %s: %s", pf->filename,
@@ -1008,6 +1361,9 @@ static void PcapLogDataFree(PcapLogData *pl)
     SCFree(pl->h);
     SCFree(pl->filename);
     SCFree(pl->prefix);
+    if (pl->buffer != NULL) {
+        SCFree(pl->buffer);
+    }
 
 #ifdef HAVE_LIBLZ4
     if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_LZ4) {
@@ -1496,6 +1852,111 @@ static OutputInitResult PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    if (conf != NULL) {
+        const char *buffer_size = ConfNodeLookupChildValue(conf, "buffer-size");
+        if (buffer_size != NULL) {
+            if (ParseSizeStringU64(buffer_size, &pl->buffer_size) < 0) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                    "log-pcap buffer-size specified %s is invalid", buffer_size);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        const char *preallocate = ConfNodeLookupChildValue(conf, "preallocate");
+        if (preallocate != NULL && ConfValIsTrue(preallocate)) {
+#ifdef HAVE_FALLOCATE
+            if (pl->compression.format != PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "log-pcap preallocate "
+                        "is not supported with compression, ignoring");
+            } else {
+                pl->preallocate = 1;
+            }
+#else
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "log-pcap preallocate "
+                    "is not supported on this platform, ignoring");
+#endif
+        }
+
+        const char *index = ConfNodeLookupChildValue(conf, "index");
+        if (index != NULL) {
+            if (strcasecmp(index, "time") == 0) {
+                pl->index = PCAP_LOG_INDEX_TIME;
+            } else if (strcasecmp(index, "flow") == 0) {
+                pl->index = PCAP_LOG_INDEX_FLOW;
+            } else if (!ConfValIsFalse(index)) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                    "log-pcap index specified %s is invalid must be"
+                    " \"no\", \"time\" or \"flow\"", index);
+                exit(EXIT_FAILURE);
+            }
+            if (pl->index != PCAP_LOG_INDEX_NONE &&
+                    pl->compression.format != PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "log-pcap index "
+                        "is not supported with compression, ignoring");
+                pl->index = PCAP_LOG_INDEX_NONE;
+            }
+        }
+    }
+
+    pl->pre_alert_packets = DEFAULT_PRE_ALERT_PACKETS;
+    pl->pre_alert_bytes = DEFAULT_PRE_ALERT_BYTES;
+    pl->pre_alert_memcap = DEFAULT_PRE_ALERT_MEMCAP;
+
+    const char *conditional = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        conditional = ConfNodeLookupChildValue(conf, "conditional");
+    }
+    if (conditional != NULL) {
+        if (strcasecmp(conditional, "alerts") == 0) {
+            pl->conditional = LOGMODE_COND_ALERTS;
+        } else if (strcasecmp(conditional, "tag") == 0) {
+            pl->conditional = LOGMODE_COND_TAG;
+        } else if (strcasecmp(conditional, "all") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap conditional specified %s is invalid must be"
+                " \"all\", \"alerts\" or \"tag\"", conditional);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (pl->conditional != LOGMODE_COND_ALL) {
+        const char *pre_alert_packets = ConfNodeLookupChildValue(conf,
+                "pre-alert-packets");
+        if (pre_alert_packets != NULL &&
+                ByteExtractStringUint32(&pl->pre_alert_packets, 10, 0,
+                    pre_alert_packets) == -1) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap pre-alert-packets specified %s is invalid",
+                pre_alert_packets);
+            exit(EXIT_FAILURE);
+        }
+        const char *pre_alert_bytes = ConfNodeLookupChildValue(conf,
+                "pre-alert-bytes");
+        if (pre_alert_bytes != NULL &&
+                ParseSizeStringU64(pre_alert_bytes, &pl->pre_alert_bytes) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap pre-alert-bytes specified %s is invalid",
+                pre_alert_bytes);
+            exit(EXIT_FAILURE);
+        }
+        const char *pre_alert_memcap = ConfNodeLookupChildValue(conf,
+                "pre-alert-memcap");
+        if (pre_alert_memcap != NULL &&
+                ParseSizeStringU64(pre_alert_memcap, &pl->pre_alert_memcap) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap pre-alert-memcap specified %s is invalid",
+                pre_alert_memcap);
+            exit(EXIT_FAILURE);
+        }
+        if (g_pcap_flow_buffer_id == -1) {
+            SCLogWarning(SC_ERR_FLOW_INIT, "log-pcap: no flow storage, "
+                    "packets before the alert are not logged");
+            pl->pre_alert_packets = 0;
+        }
+        SCLogConfig("pcap-log: logging %s, keeping %"PRIu32" packets / "
+                "%"PRIu64" bytes per flow before the alert", conditional,
+                pl->pre_alert_packets, pl->pre_alert_bytes);
+    }
+
     /* create the output ctx and send it back */
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
@@ -1847,3 +2308,146 @@ void PcapLogProfileSetup(void)
         }
     }
 }
+
+#ifdef UNITTESTS
+#include "flow-util.h"
+
+/** \test which packets match in the conditional modes */
+static int PcapLogConditionalTest01(void)
+{
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    p->flow = &f;
+
+    pl.conditional = LOGMODE_COND_ALL;
+    FAIL_IF_NOT(PcapLogConditionalMatch(&pl, p));
+
+    /* alerts: the alerting packet and everything after it in the flow */
+    pl.conditional = LOGMODE_COND_ALERTS;
+    FAIL_IF(PcapLogConditionalMatch(&pl, p));
+    p->alerts.cnt = 1;
+    FAIL_IF_NOT(PcapLogConditionalMatch(&pl, p));
+    p->alerts.cnt = 0;
+    f.flags |= FLOW_HAS_ALERTS;
+    FAIL_IF_NOT(PcapLogConditionalMatch(&pl, p));
+    p->flow = NULL;
+    FAIL_IF(PcapLogConditionalMatch(&pl, p));
+    p->flow = &f;
+
+    /* tag: only alerting and tagged packets */
+    pl.conditional = LOGMODE_COND_TAG;
+    FAIL_IF(PcapLogConditionalMatch(&pl, p));
+    p->flags |= PKT_HAS_TAG;
+    FAIL_IF_NOT(PcapLogConditionalMatch(&pl, p));
+    p->flags &= ~PKT_HAS_TAG;
+    p->alerts.cnt = 1;
+    FAIL_IF_NOT(PcapLogConditionalMatch(&pl, p));
+
+    p->flow = NULL;
+    PacketFree(p);
+    PASS;
+}
+
+/**
+ * \test packets that don't match are kept back in their flow within the
+ *       pre-alert limits, and aren't written
+ */
+static int PcapLogConditionalTest02(void)
+{
+    const int id = g_pcap_flow_buffer_id;
+    StorageInit();
+    g_pcap_flow_buffer_id = FlowStorageRegister("pcap-log", sizeof(void *),
+            NULL, PcapLogFlowBufferFree, FLOW_STORAGE_LATE);
+    FAIL_IF(g_pcap_flow_buffer_id < 0);
+    FAIL_IF(StorageFinalize() < 0);
+    FlowInitConfig(FLOW_QUIET);
+
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.conditional = LOGMODE_COND_ALERTS;
+    pl.pre_alert_packets = 3;
+    pl.pre_alert_bytes = 1024;
+    pl.pre_alert_memcap = DEFAULT_PRE_ALERT_MEMCAP;
+    PcapLogThreadData td = { .pcap_log = &pl };
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    const uint64_t memuse = SC_ATOMIC_GET(pcap_buffer_memuse);
+
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    uint8_t data[200];
+    memset(data, 0x11, sizeof(data));
+    FAIL_IF(PacketCopyData(p, data, 100) != 0);
+
+    /* only the last pre-alert-packets are kept */
+    for (int i = 1; i <= 5; i++) {
+        p->ts.tv_sec = i;
+        FAIL_IF(PcapLog(&tv, &td, p) != TM_ECODE_OK);
+    }
+    FAIL_IF(pl.pkt_cnt != 0);
+    PcapLogFlowBuffer *fb = FlowGetStorageById(f, g_pcap_flow_buffer_id);
+    FAIL_IF_NULL(fb);
+    FAIL_IF(fb->cnt != 3);
+    FAIL_IF(fb->bytes != 300);
+    FAIL_IF(fb->head->ts.tv_sec != 3);
+    FAIL_IF(fb->tail->ts.tv_sec != 5);
+    FAIL_IF(SC_ATOMIC_GET(pcap_buffer_memuse) != memuse + sizeof(*fb) +
+            3 * (sizeof(PcapLogBufferedPacket) + 100));
+
+    /* and no more than pre-alert-bytes */
+    pl.pre_alert_bytes = 250;
+    p->ts.tv_sec = 6;
+    FAIL_IF(PcapLog(&tv, &td, p) != TM_ECODE_OK);
+    FAIL_IF(fb->cnt != 2);
+    FAIL_IF(fb->bytes != 200);
+    FAIL_IF(fb->head->ts.tv_sec != 5);
+
+    /* a packet larger than that is not kept at all */
+    FAIL_IF(PacketCopyData(p, data, sizeof(data)) != 0);
+    pl.pre_alert_bytes = 150;
+    p->ts.tv_sec = 7;
+    FAIL_IF(PcapLog(&tv, &td, p) != TM_ECODE_OK);
+    FAIL_IF(fb->cnt != 2);
+    FAIL_IF(fb->tail->ts.tv_sec != 6);
+
+    /* over the memcap nothing is kept for a new flow */
+    Flow *f2 = FlowAlloc();
+    FAIL_IF_NULL(f2);
+    pl.pre_alert_bytes = 1024;
+    pl.pre_alert_memcap = SC_ATOMIC_GET(pcap_buffer_memuse);
+    p->flow = f2;
+    FAIL_IF(PcapLog(&tv, &td, p) != TM_ECODE_OK);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f2, g_pcap_flow_buffer_id));
+    FAIL_IF(pl.pkt_cnt != 0);
+
+    /* the buffers are released with the flow */
+    p->flow = NULL;
+    PacketFree(p);
+    FlowClearMemory(f, 0);
+    FlowClearMemory(f2, 0);
+    FAIL_IF(SC_ATOMIC_GET(pcap_buffer_memuse) != memuse);
+    FlowFree(f);
+    FlowFree(f2);
+
+    FlowShutdown();
+    StorageCleanup();
+    g_pcap_flow_buffer_id = id;
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapLogConditionalTest01", PcapLogConditionalTest01);
+    UtRegisterTest("PcapLogConditionalTest02", PcapLogConditionalTest02);
+#endif
+}
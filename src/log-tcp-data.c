@@ -76,53 +76,117 @@ typedef struct LogTcpDataFileCtx_ {
     int dir;
 } LogTcpDataFileCtx;
 
+/** files of the 'dir' type kept open between chunks, per thread */
+#define LOG_TCP_DATA_OPEN_FILES 16
+
+typedef struct LogTcpDataOpenFile_ {
+    FILE *fp;
+    char name[PATH_MAX];
+} LogTcpDataOpenFile;
+
 typedef struct LogTcpDataLogThread_ {
     LogTcpDataFileCtx *tcpdatalog_ctx;
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     MemBuffer *buffer;
+    /** open files of the 'dir' type, the oldest is closed for a new one */
+    LogTcpDataOpenFile files[LOG_TCP_DATA_OPEN_FILES];
+    uint32_t files_next;
 } LogTcpDataLogThread;
 
+static LogTcpDataOpenFile *LogTcpDataLookupFile(LogTcpDataLogThread *aft,
+        const char *name)
+{
+    for (int i = 0; i < LOG_TCP_DATA_OPEN_FILES; i++) {
+        if (aft->files[i].fp != NULL && strcmp(aft->files[i].name, name) == 0)
+            return &aft->files[i];
+    }
+    return NULL;
+}
+
+static void LogTcpDataCloseFile(LogTcpDataOpenFile *of)
+{
+    if (of->fp != NULL) {
+        fclose(of->fp);
+        of->fp = NULL;
+    }
+}
+
+/** \internal
+ *  \brief get the open file for a stream, opening it if needed
+ *
+ *  Opening and closing the file for each chunk of data was the bulk of the
+ *  cost of the 'dir' type, so a few files stay open until the stream is
+ *  closed or the slot is needed.
+ *
+ *  \param truncate start a new file
+ */
+static FILE *LogTcpDataGetFile(LogTcpDataLogThread *aft, const char *name,
+        bool truncate)
+{
+    LogTcpDataOpenFile *of = LogTcpDataLookupFile(aft, name);
+    if (of != NULL && !truncate)
+        return of->fp;
+
+    if (of == NULL) {
+        of = &aft->files[aft->files_next];
+        aft->files_next = (aft->files_next + 1) % LOG_TCP_DATA_OPEN_FILES;
+    }
+    LogTcpDataCloseFile(of);
+
+    of->fp = fopen(name, truncate ? "w" : "a");
+    if (of->fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", name, strerror(errno));
+        return NULL;
+    }
+    strlcpy(of->name, name, sizeof(of->name));
+    return of->fp;
+}
+
 static int LogTcpDataLoggerDir(ThreadVars *tv, void *thread_data, const Flow *f,
         const uint8_t *data, uint32_t data_len, uint64_t tx_id, uint8_t flags)
 {
     SCEnter();
     LogTcpDataLogThread *aft = thread_data;
     LogTcpDataFileCtx *td = aft->tcpdatalog_ctx;
-    const char *mode = "a";
 
-    if (flags & OUTPUT_STREAMING_FLAG_OPEN)
-        mode = "w";
+    const bool has_data = (data && data_len);
+    if (!has_data && !(flags & OUTPUT_STREAMING_FLAG_CLOSE))
+        SCReturnInt(TM_ECODE_OK);
+
+    char srcip[46] = "", dstip[46] = "";
+    if (FLOW_IS_IPV4(f)) {
+        PrintInet(AF_INET, (const void *)&f->src.addr_data32[0], srcip, sizeof(srcip));
+        PrintInet(AF_INET, (const void *)&f->dst.addr_data32[0], dstip, sizeof(dstip));
+    } else if (FLOW_IS_IPV6(f)) {
+        PrintInet(AF_INET6, (const void *)f->src.addr_data32, srcip, sizeof(srcip));
+        PrintInet(AF_INET6, (const void *)f->dst.addr_data32, dstip, sizeof(dstip));
+    }
 
-    if (data && data_len) {
-        char srcip[46] = "", dstip[46] = "";
-        if (FLOW_IS_IPV4(f)) {
-            PrintInet(AF_INET, (const void *)&f->src.addr_data32[0], srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)&f->dst.addr_data32[0], dstip, sizeof(dstip));
-        } else if (FLOW_IS_IPV6(f)) {
-            PrintInet(AF_INET6, (const void *)f->src.addr_data32, srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)f->dst.addr_data32, dstip, sizeof(dstip));
-        }
+    char name[PATH_MAX];
 
-        char name[PATH_MAX];
+    char tx[64] = { 0 };
+    if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION) {
+        snprintf(tx, sizeof(tx), "%"PRIu64, tx_id);
+    }
 
-        char tx[64] = { 0 };
-        if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION) {
-            snprintf(tx, sizeof(tx), "%"PRIu64, tx_id);
+    snprintf(name, sizeof(name), "%s/%s/%s_%u-%s_%u-%s-%s.data",
+            td->log_dir,
+            td->type == STREAMING_HTTP_BODIES ? "http" : "tcp",
+            srcip, f->sp, dstip, f->dp, tx,
+            flags & OUTPUT_STREAMING_FLAG_TOSERVER ? "ts" : "tc");
+
+    if (has_data) {
+        FILE *fp = LogTcpDataGetFile(aft, name, flags & OUTPUT_STREAMING_FLAG_OPEN);
+        if (fp != NULL) {
+            // PrintRawDataFp(stdout, (uint8_t *)data, data_len);
+            fwrite(data, data_len, 1, fp);
         }
+    }
 
-        snprintf(name, sizeof(name), "%s/%s/%s_%u-%s_%u-%s-%s.data",
-                td->log_dir,
-                td->type == STREAMING_HTTP_BODIES ? "http" : "tcp",
-                srcip, f->sp, dstip, f->dp, tx,
-                flags & OUTPUT_STREAMING_FLAG_TOSERVER ? "ts" : "tc");
-
-        FILE *fp = fopen(name, mode);
-        BUG_ON(fp == NULL);
-
-        // PrintRawDataFp(stdout, (uint8_t *)data, data_len);
-        fwrite(data, data_len, 1, fp);
-
-        fclose(fp);
+    if (flags & OUTPUT_STREAMING_FLAG_CLOSE) {
+        LogTcpDataOpenFile *of = LogTcpDataLookupFile(aft, name);
+        if (of != NULL)
+            LogTcpDataCloseFile(of);
     }
     SCReturnInt(TM_ECODE_OK);
 }
@@ -213,6 +277,9 @@ TmEcode LogTcpDataLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    for (int i = 0; i < LOG_TCP_DATA_OPEN_FILES; i++) {
+        LogTcpDataCloseFile(&aft->files[i]);
+    }
     MemBufferFree(aft->buffer);
     /* clear memory */
     memset(aft, 0, sizeof(LogTcpDataLogThread));
@@ -257,6 +324,8 @@ OutputInitResult LogTcpDataLogInitCtx(ConfNode *conf)
                 tcpdatalog_ctx->type = STREAMING_HTTP_BODIES;
                 snprintf(filename, sizeof(filename), "%s.log", conf->name);
                 strlcpy(dirname, "http", sizeof(dirname));
+                AppLayerHtpEnableRequestBodyCallback();
+                AppLayerHtpEnableResponseBodyCallback();
             }
         }
 
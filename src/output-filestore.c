@@ -26,8 +26,16 @@
 #include "output-filestore.h"
 #include "output-json-file.h"
 
+#include "runmodes.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+
+#include "util-bloomfilter.h"
+#include "util-hash.h"
 #include "util-print.h"
 #include "util-misc.h"
+#include "util-unittest.h"
 
 #ifdef HAVE_NSS
 
@@ -50,6 +58,9 @@ typedef struct OutputFilestoreCtx_ {
     char prefix[FILESTORE_PREFIX_MAX];
     char tmpdir[FILESTORE_PREFIX_MAX];
     bool fileinfo;
+    /** files up to this size are held back until they are closed, and
+     *  not written at all if they are already stored. 0 to disable. */
+    uint32_t dedup_buffer_size;
     HttpXFFCfg *xff_cfg;
 } OutputFilestoreCtx;
 
@@ -57,8 +68,124 @@ typedef struct OutputFilestoreLogThread_ {
     OutputFilestoreCtx *ctx;
     uint16_t counter_max_hits;
     uint16_t fs_error_counter;
+    uint16_t writer_drop_counter;
+    uint16_t dedup_counter;
+    /** files held back for dedup, by file store id */
+    HashTable *heads;
 } OutputFilestoreLogThread;
 
+/** start of a file held back until it is closed, the file id is the
+ *  hash key */
+typedef struct FilestoreHead_ {
+    uint32_t file_id;
+    uint32_t len;
+    uint32_t size;
+    uint8_t *buf;
+} FilestoreHead;
+
+/*
+ * Stored files
+ *
+ * A bloom filter of the SHA256 of the files stored since startup. The
+ * filestore itself, being named by SHA256, is the on-disk index: a hit
+ * is confirmed by looking for the file, a miss means the file can be
+ * renamed into place without looking. If the file was stored before a
+ * restart, the rename replaces it with the same content.
+ */
+
+/** 1MiB, for a false positive rate of ~2% at 1M stored files */
+#define FILESTORE_BLOOM_BITS        (8 * 1024 * 1024)
+#define FILESTORE_BLOOM_ITERATIONS  4
+
+static BloomFilter *filestore_bloom = NULL;
+static SCMutex filestore_bloom_lock = SCMUTEX_INITIALIZER;
+
+/*
+ * Writer threads
+ *
+ * With file-store.writer-threads set, the workers don't touch the disk.
+ * They queue the open, write and close of each file to one of the writer
+ * threads, picked by the file store id, so all operations on a file are
+ * done in order by the same writer. A writer takes its whole queue at
+ * once and writes consecutive chunks of the same file with a single
+ * writev(). The rename and the fileinfo record at close are done by the
+ * writer as well.
+ *
+ * The data queued to the writers is limited by file-store.writer-memcap.
+ * A worker that would go over it doesn't wait: the chunk is dropped and
+ * the writer discards the file.
+ */
+
+#define FILESTORE_WRITER_MEMCAP_DEFAULT (64 * 1024 * 1024)
+#define FILESTORE_WRITER_MAX_THREADS    64
+#define FILESTORE_WRITER_IOV_MAX        64
+#define FILESTORE_WRITER_HASH_SIZE      4096
+
+#ifndef HAVE_SYS_UIO_H
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
+typedef enum FilestoreWriterOpType_ {
+    FILESTORE_OP_OPEN = 0,
+    FILESTORE_OP_WRITE,
+    FILESTORE_OP_ABORT,
+    FILESTORE_OP_CLOSE,
+} FilestoreWriterOpType;
+
+typedef struct FilestoreWriterOp_ {
+    struct FilestoreWriterOp_ *next;
+    FilestoreWriterOpType type;
+    uint32_t file_id;
+    /** WRITE: length of the data, CLOSE: length of the file names */
+    uint32_t data_len;
+    /** CLOSE: fileinfo record to write, if enabled */
+    json_t *fileinfo;
+    /** WRITE: the file data, CLOSE: the SHA256, then the final and the
+     *  fileinfo file names */
+    uint8_t data[];
+} FilestoreWriterOp;
+
+typedef struct FilestoreWriter_ {
+    SCMutex m;
+    FilestoreWriterOp *head;
+    FilestoreWriterOp *tail;
+    ThreadVars *tv;
+} FilestoreWriter;
+
+/** file open in a writer, the file id is the hash key */
+typedef struct FilestoreWriterFile_ {
+    uint32_t file_id;
+    int fd;
+    bool aborted;
+} FilestoreWriterFile;
+
+typedef struct FilestoreWriterThread_ {
+    uint32_t instance;
+    FilestoreWriter *w;
+    HashTable *files;
+    struct iovec iov[FILESTORE_WRITER_IOV_MAX];
+
+    uint64_t files_cnt;
+    uint64_t writes;
+    uint64_t writevs;
+    uint64_t bytes;
+} FilestoreWriterThread;
+
+static uint32_t filestore_writer_threads = 0;
+static uint64_t filestore_writer_memcap = FILESTORE_WRITER_MEMCAP_DEFAULT;
+/** ctx of the filestore output, for the writers to build file names */
+static OutputFilestoreCtx *filestore_writer_ctx = NULL;
+/** set once the writers are spawned, read only after that */
+static FilestoreWriter *filestore_writers = NULL;
+static uint32_t filestore_writers_cnt = 0;
+
+static SC_ATOMIC_DECLARE(uint32_t, filestore_writer_instances);
+static SC_ATOMIC_DECLARE(uint64_t, filestore_writer_memuse);
+static SC_ATOMIC_DECLARE(uint64_t, filestore_writer_fs_errors);
+
 /* For WARN_ONCE, a record of warnings that have already been
  * issued. */
 static __thread bool once_errs[SC_ERR_MAX];
@@ -121,83 +248,289 @@ static void OutputFilestoreUpdateFileTime(const char *src_filename,
     }
 }
 
-static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
-        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
-        const Packet *p, File *ff, uint8_t dir) {
+/** the SHA256 is uniformly distributed, each iteration uses 4 bytes of it */
+static uint32_t FilestoreBloomHash(const void *data, uint16_t datalen,
+        uint8_t iter, uint32_t hash_size)
+{
+    uint32_t hash;
+    memcpy(&hash, (const uint8_t *)data + (iter * sizeof(hash)) % datalen,
+            sizeof(hash));
+    return hash % hash_size;
+}
+
+static bool FilestoreBloomTest(const uint8_t *sha256)
+{
+    if (filestore_bloom == NULL)
+        return true;
+    SCMutexLock(&filestore_bloom_lock);
+    const int r = BloomFilterTest(filestore_bloom, sha256, SHA256_LENGTH);
+    SCMutexUnlock(&filestore_bloom_lock);
+    return r == 1;
+}
+
+static void FilestoreBloomAdd(const uint8_t *sha256)
+{
+    if (filestore_bloom == NULL)
+        return;
+    SCMutexLock(&filestore_bloom_lock);
+    BloomFilterAdd(filestore_bloom, sha256, SHA256_LENGTH);
+    SCMutexUnlock(&filestore_bloom_lock);
+}
+
+static void OutputFilestoreTmpFilename(const OutputFilestoreCtx *ctx,
+        uint32_t file_id, char *filename, size_t size)
+{
+    snprintf(filename, size, "%s/file.%u", ctx->tmpdir, file_id);
+}
+
+/**
+ * \brief Get the final file name and, if enabled, the fileinfo record
+ *     file name of a closed file.
+ *
+ * \retval true if a fileinfo record is to be written
+ */
+static bool OutputFilestoreFinalFilenames(const OutputFilestoreCtx *ctx,
+        const Packet *p, const File *ff, char *final_filename,
+        size_t final_size, char *js_metadata_filename, size_t js_size)
+{
     /* Stringify the SHA256 which will be used in the final
      * filename. */
     char sha256string[(SHA256_LENGTH * 2) + 1];
-    PrintHexString(sha256string, sizeof(sha256string), ff->sha256,
+    PrintHexString(sha256string, sizeof(sha256string), (uint8_t *)ff->sha256,
             sizeof(ff->sha256));
 
-    char tmp_filename[PATH_MAX] = "";
-    snprintf(tmp_filename, sizeof(tmp_filename), "%s/file.%u", ctx->tmpdir,
-            ff->file_store_id);
-
-    char final_filename[PATH_MAX] = "";
-    snprintf(final_filename, sizeof(final_filename), "%s/%c%c/%s",
+    snprintf(final_filename, final_size, "%s/%c%c/%s",
             ctx->prefix, sha256string[0], sha256string[1], sha256string);
 
-    if (SCPathExists(final_filename)) {
+    if (!ctx->fileinfo)
+        return false;
+
+    if (snprintf(js_metadata_filename, js_size,
+                    "%s.%"PRIuMAX".%u.json", final_filename,
+                    (uintmax_t)p->ts.tv_sec, ff->file_store_id)
+            == (int)js_size) {
+        WARN_ONCE(SC_ERR_SPRINTF,
+            "Failed to write file info record. Output filename truncated.");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Move a closed file from the tmp directory to its final name,
+ *     and write its fileinfo record.
+ *
+ * \param sha256 SHA256 of the file, the final name is built from it
+ * \param js_fileinfo fileinfo record, or NULL. Always consumed.
+ *
+ * \retval errors number of file system errors
+ */
+static int OutputFilestoreFinalize(const uint8_t *sha256,
+        const char *tmp_filename, const char *final_filename,
+        const char *js_metadata_filename, json_t *js_fileinfo)
+{
+    int errors = 0;
+
+    if (FilestoreBloomTest(sha256) && SCPathExists(final_filename)) {
         OutputFilestoreUpdateFileTime(tmp_filename, final_filename);
         if (unlink(tmp_filename) != 0) {
-            StatsIncr(tv, oft->fs_error_counter);
+            errors++;
             WARN_ONCE(SC_WARN_REMOVE_FILE,
                     "Failed to remove temporary file %s: %s", tmp_filename,
                     strerror(errno));
         }
     } else if (rename(tmp_filename, final_filename) != 0) {
-        StatsIncr(tv, oft->fs_error_counter);
+        errors++;
         WARN_ONCE(SC_WARN_RENAMING_FILE, "Failed to rename %s to %s: %s",
                 tmp_filename, final_filename, strerror(errno));
         if (unlink(tmp_filename) != 0) {
             /* Just increment, don't log as has_fs_errors would
              * already be set above. */
-            StatsIncr(tv, oft->fs_error_counter);
+            errors++;
+        }
+        if (js_fileinfo != NULL)
+            json_decref(js_fileinfo);
+        return errors;
+    } else {
+        FilestoreBloomAdd(sha256);
+    }
+
+    if (js_fileinfo != NULL) {
+        json_dump_file(js_fileinfo, js_metadata_filename, 0);
+        json_decref(js_fileinfo);
+    }
+    return errors;
+}
+
+static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
+        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
+        const Packet *p, File *ff, uint8_t dir) {
+    char tmp_filename[PATH_MAX] = "";
+    OutputFilestoreTmpFilename(ctx, ff->file_store_id, tmp_filename,
+            sizeof(tmp_filename));
+
+    char final_filename[PATH_MAX] = "";
+    char js_metadata_filename[PATH_MAX] = "";
+    json_t *js_fileinfo = NULL;
+    if (OutputFilestoreFinalFilenames(ctx, p, ff, final_filename,
+                sizeof(final_filename), js_metadata_filename,
+                sizeof(js_metadata_filename))) {
+        js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir, ctx->xff_cfg);
+    }
+
+    int errors = OutputFilestoreFinalize(ff->sha256, tmp_filename,
+            final_filename, js_metadata_filename, js_fileinfo);
+    if (errors > 0) {
+        StatsAddUI64(tv, oft->fs_error_counter, errors);
+    }
+}
+
+static uint64_t OutputFilestoreWriterMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_writer_memuse);
+}
+
+static uint64_t OutputFilestoreWriterErrorsCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_writer_fs_errors);
+}
+
+static FilestoreWriterOp *FilestoreWriterOpAlloc(FilestoreWriterOpType type,
+        uint32_t file_id, uint32_t data_len)
+{
+    FilestoreWriterOp *op = SCMalloc(sizeof(*op) + data_len);
+    if (unlikely(op == NULL))
+        return NULL;
+    op->next = NULL;
+    op->type = type;
+    op->file_id = file_id;
+    op->data_len = data_len;
+    op->fileinfo = NULL;
+    return op;
+}
+
+static void FilestoreWriterOpFree(FilestoreWriterOp *op)
+{
+    if (op->type == FILESTORE_OP_WRITE) {
+        (void) SC_ATOMIC_SUB(filestore_writer_memuse, sizeof(*op) + op->data_len);
+    } else if (op->fileinfo != NULL) {
+        json_decref(op->fileinfo);
+    }
+    SCFree(op);
+}
+
+/** \brief append a list of ops to a writer's queue, and wake it up */
+static void FilestoreWriterEnqueue(FilestoreWriter *w, FilestoreWriterOp *head,
+        FilestoreWriterOp *tail)
+{
+    SCMutexLock(&w->m);
+    const bool was_empty = (w->head == NULL);
+    if (was_empty) {
+        w->head = head;
+    } else {
+        w->tail->next = head;
+    }
+    w->tail = tail;
+    SCMutexUnlock(&w->m);
+
+    /* a writer with a non empty queue takes it before it waits again */
+    if (was_empty) {
+        SCCtrlMutexLock(w->tv->ctrl_mutex);
+        SCCtrlCondSignal(w->tv->ctrl_cond);
+        SCCtrlMutexUnlock(w->tv->ctrl_mutex);
+    }
+}
+
+#define FILESTORE_OP_APPEND(head, tail, op) do { \
+        if ((tail) == NULL)                      \
+            (head) = (op);                       \
+        else                                     \
+            (tail)->next = (op);                 \
+        (tail) = (op);                           \
+    } while (0)
+
+/**
+ * \brief Queue the file operations of a file data log call to the writer
+ *     of the file.
+ */
+static int OutputFilestoreQueue(ThreadVars *tv, OutputFilestoreLogThread *aft,
+        const OutputFilestoreCtx *ctx, const Packet *p, File *ff,
+        const uint8_t *data, uint32_t data_len, uint8_t flags, uint8_t dir)
+{
+    FilestoreWriter *w = &filestore_writers[ff->file_store_id % filestore_writers_cnt];
+    FilestoreWriterOp *head = NULL, *tail = NULL;
+    FilestoreWriterOp *op;
+
+    if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+        op = FilestoreWriterOpAlloc(FILESTORE_OP_OPEN, ff->file_store_id, 0);
+        if (op != NULL) {
+            FILESTORE_OP_APPEND(head, tail, op);
         }
-        return;
     }
 
-    if (ctx->fileinfo) {
-        char js_metadata_filename[PATH_MAX];
-        if (snprintf(js_metadata_filename, sizeof(js_metadata_filename),
-                        "%s.%"PRIuMAX".%u.json", final_filename,
-                        (uintmax_t)p->ts.tv_sec, ff->file_store_id)
-                == (int)sizeof(js_metadata_filename)) {
-            WARN_ONCE(SC_ERR_SPRINTF,
-                "Failed to write file info record. Output filename truncated.");
+    if (data != NULL && data_len > 0) {
+        const uint64_t size = sizeof(*op) + data_len;
+        op = NULL;
+        if (SC_ATOMIC_ADD(filestore_writer_memuse, size) <= filestore_writer_memcap) {
+            op = FilestoreWriterOpAlloc(FILESTORE_OP_WRITE, ff->file_store_id, data_len);
+        }
+        if (op != NULL) {
+            memcpy(op->data, data, data_len);
         } else {
-            json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
-                    ctx->xff_cfg);
-            if (likely(js_fileinfo != NULL)) {
-                json_dump_file(js_fileinfo, js_metadata_filename, 0);
-                json_decref(js_fileinfo);
+            /* over the memcap: don't wait for the writer, discard the file */
+            (void) SC_ATOMIC_SUB(filestore_writer_memuse, size);
+            StatsIncr(tv, aft->writer_drop_counter);
+            op = FilestoreWriterOpAlloc(FILESTORE_OP_ABORT, ff->file_store_id, 0);
+        }
+        if (op != NULL) {
+            FILESTORE_OP_APPEND(head, tail, op);
+        }
+    }
+
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        char final_filename[PATH_MAX] = "";
+        char js_metadata_filename[PATH_MAX] = "";
+        const bool fileinfo = OutputFilestoreFinalFilenames(ctx, p, ff,
+                final_filename, sizeof(final_filename),
+                js_metadata_filename, sizeof(js_metadata_filename));
+
+        /* the SHA256 and both names, NUL terminated, in the data of the op */
+        const size_t final_len = strlen(final_filename) + 1;
+        const size_t js_len = strlen(js_metadata_filename) + 1;
+        op = FilestoreWriterOpAlloc(FILESTORE_OP_CLOSE, ff->file_store_id,
+                SHA256_LENGTH + final_len + js_len);
+        if (op != NULL) {
+            memcpy(op->data, ff->sha256, SHA256_LENGTH);
+            memcpy(op->data + SHA256_LENGTH, final_filename, final_len);
+            memcpy(op->data + SHA256_LENGTH + final_len, js_metadata_filename,
+                    js_len);
+            if (fileinfo) {
+                op->fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
+                        ctx->xff_cfg);
             }
+            FILESTORE_OP_APPEND(head, tail, op);
         }
     }
+
+    if (head != NULL) {
+        FilestoreWriterEnqueue(w, head, tail);
+    }
+    return 0;
 }
 
-static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
+static int OutputFilestoreWrite(ThreadVars *tv, OutputFilestoreLogThread *aft,
         const Packet *p, File *ff, const uint8_t *data, uint32_t data_len,
         uint8_t flags, uint8_t dir)
 {
-    SCEnter();
-    OutputFilestoreLogThread *aft = (OutputFilestoreLogThread *)thread_data;
     OutputFilestoreCtx *ctx = aft->ctx;
     char filename[PATH_MAX] = "";
     int file_fd = -1;
 
-    /* no flow, no files */
-    if (p->flow == NULL) {
-        SCReturnInt(TM_ECODE_OK);
-    }
-
-    if (!(PKT_IS_IPV4(p) || PKT_IS_IPV6(p))) {
-        return 0;
+    if (filestore_writers_cnt > 0) {
+        return OutputFilestoreQueue(tv, aft, ctx, p, ff, data, data_len,
+                flags, dir);
     }
 
-    SCLogDebug("ff %p, data %p, data_len %u", ff, data, data_len);
-
     char base_filename[PATH_MAX] = "";
     snprintf(base_filename, sizeof(base_filename), "%s/file.%u",
             ctx->tmpdir, ff->file_store_id);
@@ -268,6 +601,164 @@ static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
     return 0;
 }
 
+static uint32_t FilestoreHeadHash(HashTable *ht, void *data, uint16_t len)
+{
+    const FilestoreHead *h = data;
+    return h->file_id % ht->array_size;
+}
+
+static char FilestoreHeadCompare(void *a, uint16_t a_len, void *b,
+        uint16_t b_len)
+{
+    return ((FilestoreHead *)a)->file_id == ((FilestoreHead *)b)->file_id;
+}
+
+static void FilestoreHeadFree(void *data)
+{
+    FilestoreHead *h = data;
+    if (h->buf != NULL)
+        SCFree(h->buf);
+    SCFree(h);
+}
+
+/**
+ * \brief Check if a closed file is already stored, and if so only
+ *     update its timestamp and write its fileinfo record.
+ *
+ * \retval true if the file is stored already
+ */
+static bool OutputFilestoreDedup(ThreadVars *tv, OutputFilestoreLogThread *aft,
+        const Packet *p, File *ff, uint8_t dir)
+{
+    const OutputFilestoreCtx *ctx = aft->ctx;
+
+    if (!(ff->flags & FILE_SHA256) || !FilestoreBloomTest(ff->sha256))
+        return false;
+
+    char final_filename[PATH_MAX] = "";
+    char js_metadata_filename[PATH_MAX] = "";
+    const bool fileinfo = OutputFilestoreFinalFilenames(ctx, p, ff,
+            final_filename, sizeof(final_filename),
+            js_metadata_filename, sizeof(js_metadata_filename));
+    if (!SCPathExists(final_filename))
+        return false;
+
+    if (utime(final_filename, NULL) != 0) {
+        SCLogDebug("Failed to update file timestamps: %s: %s", final_filename,
+                strerror(errno));
+    }
+    if (fileinfo) {
+        json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
+                ctx->xff_cfg);
+        if (likely(js_fileinfo != NULL)) {
+            json_dump_file(js_fileinfo, js_metadata_filename, 0);
+            json_decref(js_fileinfo);
+        }
+    }
+    StatsIncr(tv, aft->dedup_counter);
+    return true;
+}
+
+/**
+ * \brief Hold back the start of a file until it is closed or grows
+ *     beyond the dedup buffer size.
+ *
+ * A file that is closed while held back and is already stored is not
+ * written at all. Otherwise it's written in one go, and a file that
+ * grows too large is written as far as it's held back and then handled
+ * as usual.
+ */
+static int OutputFilestoreDedupLog(ThreadVars *tv, OutputFilestoreLogThread *aft,
+        const Packet *p, File *ff, const uint8_t *data, uint32_t data_len,
+        uint8_t flags, uint8_t dir)
+{
+    FilestoreHead key = { .file_id = ff->file_store_id };
+    FilestoreHead *h = NULL;
+
+    if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+        h = SCCalloc(1, sizeof(*h));
+        if (h != NULL) {
+            h->file_id = ff->file_store_id;
+            if (HashTableAdd(aft->heads, h, sizeof(*h)) != 0) {
+                FilestoreHeadFree(h);
+                h = NULL;
+            }
+        }
+    } else {
+        h = HashTableLookup(aft->heads, &key, sizeof(key));
+    }
+    /* not held back, or no longer */
+    if (h == NULL) {
+        return OutputFilestoreWrite(tv, aft, p, ff, data, data_len, flags, dir);
+    }
+
+    if (data != NULL && data_len > 0) {
+        if (data_len > aft->ctx->dedup_buffer_size - h->len) {
+            int r = OutputFilestoreWrite(tv, aft, p, ff, h->buf, h->len,
+                    OUTPUT_FILEDATA_FLAG_OPEN, dir);
+            HashTableRemove(aft->heads, h, sizeof(*h));
+            if (r != 0)
+                return r;
+            return OutputFilestoreWrite(tv, aft, p, ff, data, data_len,
+                    flags & ~OUTPUT_FILEDATA_FLAG_OPEN, dir);
+        }
+
+        if (h->len + data_len > h->size) {
+            uint32_t size = MAX(h->size * 2, h->len + data_len);
+            size = MIN(size, aft->ctx->dedup_buffer_size);
+            uint8_t *buf = SCRealloc(h->buf, size);
+            if (unlikely(buf == NULL)) {
+                int r = OutputFilestoreWrite(tv, aft, p, ff, h->buf, h->len,
+                        OUTPUT_FILEDATA_FLAG_OPEN, dir);
+                HashTableRemove(aft->heads, h, sizeof(*h));
+                if (r != 0)
+                    return r;
+                return OutputFilestoreWrite(tv, aft, p, ff, data, data_len,
+                        flags & ~OUTPUT_FILEDATA_FLAG_OPEN, dir);
+            }
+            h->buf = buf;
+            h->size = size;
+        }
+        memcpy(h->buf + h->len, data, data_len);
+        h->len += data_len;
+    }
+
+    int r = 0;
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        if (!OutputFilestoreDedup(tv, aft, p, ff, dir)) {
+            r = OutputFilestoreWrite(tv, aft, p, ff, h->buf, h->len,
+                    OUTPUT_FILEDATA_FLAG_OPEN | OUTPUT_FILEDATA_FLAG_CLOSE, dir);
+        }
+        HashTableRemove(aft->heads, h, sizeof(*h));
+    }
+    return r;
+}
+
+static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
+        const Packet *p, File *ff, const uint8_t *data, uint32_t data_len,
+        uint8_t flags, uint8_t dir)
+{
+    SCEnter();
+    OutputFilestoreLogThread *aft = (OutputFilestoreLogThread *)thread_data;
+
+    /* no flow, no files */
+    if (p->flow == NULL) {
+        SCReturnInt(TM_ECODE_OK);
+    }
+
+    if (!(PKT_IS_IPV4(p) || PKT_IS_IPV6(p))) {
+        return 0;
+    }
+
+    SCLogDebug("ff %p, data %p, data_len %u", ff, data, data_len);
+
+    if (aft->heads != NULL) {
+        return OutputFilestoreDedupLog(tv, aft, p, ff, data, data_len,
+                flags, dir);
+    }
+    return OutputFilestoreWrite(tv, aft, p, ff, data, data_len, flags, dir);
+}
+
 static TmEcode OutputFilestoreLogThreadInit(ThreadVars *t, const void *initdata,
         void **data)
 {
@@ -293,6 +784,19 @@ static TmEcode OutputFilestoreLogThreadInit(ThreadVars *t, const void *initdata,
      * occurence. */
     aft->fs_error_counter = StatsRegisterCounter("file_store.fs_errors", t);
 
+    aft->writer_drop_counter =
+        StatsRegisterCounter("file_store.writer_memcap_drops", t);
+
+    if (ctx->dedup_buffer_size > 0) {
+        aft->heads = HashTableInit(4096, FilestoreHeadHash,
+                FilestoreHeadCompare, FilestoreHeadFree);
+        if (aft->heads == NULL) {
+            SCFree(aft);
+            return TM_ECODE_FAILED;
+        }
+        aft->dedup_counter = StatsRegisterCounter("file_store.dedup", t);
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -304,6 +808,11 @@ static TmEcode OutputFilestoreLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    /* files still held back at shutdown are not stored */
+    if (aft->heads != NULL) {
+        HashTableFree(aft->heads);
+    }
+
     /* clear memory */
     memset(aft, 0, sizeof(OutputFilestoreLogThread));
 
@@ -314,6 +823,10 @@ static TmEcode OutputFilestoreLogThreadDeinit(ThreadVars *t, void *data)
 static void OutputFilestoreLogDeInitCtx(OutputCtx *output_ctx)
 {
     OutputFilestoreCtx *ctx = (OutputFilestoreCtx *)output_ctx->data;
+    if (filestore_bloom != NULL) {
+        BloomFilterFree(filestore_bloom);
+        filestore_bloom = NULL;
+    }
     if (ctx->xff_cfg != NULL) {
         SCFree(ctx->xff_cfg);
     }
@@ -510,13 +1023,656 @@ static OutputInitResult OutputFilestoreLogInitCtx(ConfNode *conf)
     StatsRegisterGlobalCounter("file_store.open_files",
             OutputFilestoreOpenFilesCounter);
 
+    const char *dedup_str = ConfNodeLookupChildValue(conf,
+            "dedup-buffer-size");
+    if (dedup_str != NULL) {
+        if (ParseSizeStringU32(dedup_str, &ctx->dedup_buffer_size) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                       "file-store.dedup-buffer-size "
+                       "from conf file - %s.  Killing engine",
+                       dedup_str);
+            exit(EXIT_FAILURE);
+        }
+        if (ctx->dedup_buffer_size > 0) {
+            SCLogConfig("Filestore (v2) will hold back files of up to %u "
+                    "bytes, and not write them if already stored",
+                    ctx->dedup_buffer_size);
+        }
+    }
+
+    if (filestore_bloom == NULL) {
+        filestore_bloom = BloomFilterInit(FILESTORE_BLOOM_BITS,
+                FILESTORE_BLOOM_ITERATIONS, FilestoreBloomHash);
+    }
+
+    intmax_t writer_threads = 0;
+    if (ConfGetChildValueInt(conf, "writer-threads", &writer_threads)) {
+        if (writer_threads < 0 || writer_threads > FILESTORE_WRITER_MAX_THREADS) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Error parsing "
+                    "file-store.writer-threads from conf file - %"PRIdMAX
+                    ". Killing engine", writer_threads);
+            exit(EXIT_FAILURE);
+        }
+    }
+    const char *writer_memcap_str = ConfNodeLookupChildValue(conf,
+            "writer-memcap");
+    if (writer_memcap_str != NULL) {
+        if (ParseSizeStringU64(writer_memcap_str,
+                               &filestore_writer_memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                       "file-store.writer-memcap "
+                       "from conf file - %s.  Killing engine",
+                       writer_memcap_str);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (writer_threads > 0) {
+        filestore_writer_threads = (uint32_t)writer_threads;
+        filestore_writer_ctx = ctx;
+        SCLogConfig("Filestore (v2) will write files from %u writer "
+                "threads, with %"PRIu64" bytes of queued data at most",
+                filestore_writer_threads, filestore_writer_memcap);
+
+        StatsRegisterGlobalCounter("file_store.writer_memuse",
+                OutputFilestoreWriterMemuseCounter);
+        StatsRegisterGlobalCounter("file_store.writer_fs_errors",
+                OutputFilestoreWriterErrorsCounter);
+    }
+
     result.ctx = output_ctx;
     result.ok = true;
     SCReturnCT(result, "OutputInitResult");
 }
 
+static uint32_t FilestoreWriterFileHash(HashTable *ht, void *data, uint16_t len)
+{
+    const FilestoreWriterFile *f = data;
+    return f->file_id % ht->array_size;
+}
+
+static char FilestoreWriterFileCompare(void *a, uint16_t a_len, void *b,
+        uint16_t b_len)
+{
+    return ((FilestoreWriterFile *)a)->file_id ==
+        ((FilestoreWriterFile *)b)->file_id;
+}
+
+static void FilestoreWriterFileClose(FilestoreWriterFile *f)
+{
+    if (f->fd != -1) {
+        close(f->fd);
+        f->fd = -1;
+        SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+    }
+}
+
+static void FilestoreWriterFileFree(void *data)
+{
+    FilestoreWriterFile *f = data;
+    FilestoreWriterFileClose(f);
+    SCFree(f);
+}
+
+static FilestoreWriterFile *FilestoreWriterFileLookup(FilestoreWriterThread *wt,
+        uint32_t file_id)
+{
+    FilestoreWriterFile key = { .file_id = file_id };
+    return HashTableLookup(wt->files, &key, sizeof(key));
+}
+
+static void FilestoreWriterOpen(FilestoreWriterThread *wt, uint32_t file_id)
+{
+    char filename[PATH_MAX] = "";
+    OutputFilestoreTmpFilename(filestore_writer_ctx, file_id, filename,
+            sizeof(filename));
+
+    FilestoreWriterFile *f = SCCalloc(1, sizeof(*f));
+    if (unlikely(f == NULL))
+        return;
+    f->file_id = file_id;
+    f->fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+    if (f->fd == -1) {
+        (void) SC_ATOMIC_ADD(filestore_writer_fs_errors, 1);
+        WARN_ONCE(SC_ERR_OPENING_FILE,
+                "Filestore (v2) failed to create %s: %s", filename,
+                strerror(errno));
+        f->aborted = true;
+    } else if (SC_ATOMIC_GET(filestore_open_file_cnt) < FileGetMaxOpenFiles()) {
+        SC_ATOMIC_ADD(filestore_open_file_cnt, 1);
+    } else {
+        close(f->fd);
+        f->fd = -1;
+    }
+
+    if (HashTableAdd(wt->files, f, sizeof(*f)) != 0) {
+        FilestoreWriterFileFree(f);
+        return;
+    }
+    wt->files_cnt++;
+}
+
+#ifndef HAVE_SYS_UIO_H
+static ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return write(fd, iov->iov_base, iov->iov_len);
+}
+#endif
+
+/** \brief writev() all of iov, resuming after short writes */
+static int FilestoreWriterWritev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t r = writev(fd, iov, iovcnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Write a run of consecutive WRITE ops of the same file with a
+ *     single writev() and free them.
+ *
+ * \retval next the first op after the run
+ */
+static FilestoreWriterOp *FilestoreWriterWrite(FilestoreWriterThread *wt,
+        FilestoreWriterOp *op)
+{
+    const uint32_t file_id = op->file_id;
+    FilestoreWriterOp *next = op;
+    int iovcnt = 0;
+    uint64_t len = 0;
+
+    while (next != NULL && next->type == FILESTORE_OP_WRITE &&
+            next->file_id == file_id && iovcnt < FILESTORE_WRITER_IOV_MAX) {
+        wt->iov[iovcnt].iov_base = next->data;
+        wt->iov[iovcnt].iov_len = next->data_len;
+        iovcnt++;
+        len += next->data_len;
+        next = next->next;
+    }
+
+    FilestoreWriterFile *f = FilestoreWriterFileLookup(wt, file_id);
+    if (f != NULL && !f->aborted) {
+        char filename[PATH_MAX] = "";
+        OutputFilestoreTmpFilename(filestore_writer_ctx, file_id, filename,
+                sizeof(filename));
+
+        int fd = f->fd;
+        if (fd == -1) {
+            fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+            if (fd == -1) {
+                (void) SC_ATOMIC_ADD(filestore_writer_fs_errors, 1);
+                WARN_ONCE(SC_ERR_OPENING_FILE,
+                        "Filestore (v2) failed to open file %s: %s",
+                        filename, strerror(errno));
+            }
+        }
+        if (fd != -1) {
+            const int r = FilestoreWriterWritev(fd, wt->iov, iovcnt);
+            if (r != 0) {
+                (void) SC_ATOMIC_ADD(filestore_writer_fs_errors, 1);
+                WARN_ONCE(SC_ERR_FWRITE,
+                        "Filestore (v2) failed to write to %s: %s",
+                        filename, strerror(errno));
+            }
+            if (fd != f->fd) {
+                close(fd);
+            } else if (r != 0) {
+                FilestoreWriterFileClose(f);
+            }
+            wt->writes += iovcnt;
+            wt->writevs++;
+            wt->bytes += len;
+        }
+    }
+
+    while (op != next) {
+        FilestoreWriterOp *tmp = op->next;
+        FilestoreWriterOpFree(op);
+        op = tmp;
+    }
+    return next;
+}
+
+/** \brief discard a file the worker dropped data of */
+static void FilestoreWriterAbort(FilestoreWriterThread *wt, uint32_t file_id)
+{
+    FilestoreWriterFile *f = FilestoreWriterFileLookup(wt, file_id);
+    if (f == NULL || f->aborted)
+        return;
+
+    char filename[PATH_MAX] = "";
+    OutputFilestoreTmpFilename(filestore_writer_ctx, file_id, filename,
+            sizeof(filename));
+
+    FilestoreWriterFileClose(f);
+    f->aborted = true;
+    if (unlink(filename) != 0) {
+        (void) SC_ATOMIC_ADD(filestore_writer_fs_errors, 1);
+        WARN_ONCE(SC_WARN_REMOVE_FILE,
+                "Failed to remove temporary file %s: %s", filename,
+                strerror(errno));
+    }
+}
+
+static void FilestoreWriterClose(FilestoreWriterThread *wt,
+        FilestoreWriterOp *op)
+{
+    FilestoreWriterFile *f = FilestoreWriterFileLookup(wt, op->file_id);
+    if (f == NULL)
+        return;
+
+    FilestoreWriterFileClose(f);
+    if (!f->aborted) {
+        char tmp_filename[PATH_MAX] = "";
+        OutputFilestoreTmpFilename(filestore_writer_ctx, op->file_id,
+                tmp_filename, sizeof(tmp_filename));
+
+        const char *final_filename = (const char *)op->data + SHA256_LENGTH;
+        const char *js_metadata_filename = final_filename +
+            strlen(final_filename) + 1;
+
+        int errors = OutputFilestoreFinalize(op->data, tmp_filename,
+                final_filename, js_metadata_filename, op->fileinfo);
+        op->fileinfo = NULL;
+        if (errors > 0) {
+            (void) SC_ATOMIC_ADD(filestore_writer_fs_errors, errors);
+        }
+    }
+    HashTableRemove(wt->files, f, sizeof(*f));
+}
+
+/** \brief run a list of ops taken from the queue, in order */
+static void FilestoreWriterRun(FilestoreWriterThread *wt, FilestoreWriterOp *op)
+{
+    while (op != NULL) {
+        if (op->type == FILESTORE_OP_WRITE) {
+            op = FilestoreWriterWrite(wt, op);
+            continue;
+        }
+
+        switch (op->type) {
+            case FILESTORE_OP_OPEN:
+                FilestoreWriterOpen(wt, op->file_id);
+                break;
+            case FILESTORE_OP_ABORT:
+                FilestoreWriterAbort(wt, op->file_id);
+                break;
+            case FILESTORE_OP_CLOSE:
+                FilestoreWriterClose(wt, op);
+                break;
+            default:
+                break;
+        }
+
+        FilestoreWriterOp *next = op->next;
+        FilestoreWriterOpFree(op);
+        op = next;
+    }
+}
+
+static TmEcode FilestoreWriterThreadInit(ThreadVars *t, const void *initdata,
+        void **data)
+{
+    FilestoreWriterThread *wt = SCCalloc(1, sizeof(*wt));
+    if (unlikely(wt == NULL))
+        return TM_ECODE_FAILED;
+
+    wt->instance = SC_ATOMIC_ADD(filestore_writer_instances, 1) - 1; /* id's start at 0 */
+    BUG_ON(wt->instance >= filestore_writer_threads);
+    wt->w = &filestore_writers[wt->instance];
+
+    wt->files = HashTableInit(FILESTORE_WRITER_HASH_SIZE,
+            FilestoreWriterFileHash, FilestoreWriterFileCompare,
+            FilestoreWriterFileFree);
+    if (wt->files == NULL) {
+        SCFree(wt);
+        return TM_ECODE_FAILED;
+    }
+
+    *data = wt;
+    return TM_ECODE_OK;
+}
+
+static TmEcode FilestoreWriterThreadDeinit(ThreadVars *t, void *data)
+{
+    FilestoreWriterThread *wt = (FilestoreWriterThread *)data;
+
+    SCLogPerf("filestore writer %u: %"PRIu64" files, %"PRIu64" writes of %"
+            PRIu64" bytes in %"PRIu64" writev calls", wt->instance,
+            wt->files_cnt, wt->writes, wt->bytes, wt->writevs);
+
+    /* files still open at shutdown stay in the tmp directory */
+    HashTableFree(wt->files);
+    SCFree(wt);
+    return TM_ECODE_OK;
+}
+
+static TmEcode FilestoreWriterLoop(ThreadVars *th_v, void *thread_data)
+{
+    FilestoreWriterThread *wt = (FilestoreWriterThread *)thread_data;
+    FilestoreWriter *w = wt->w;
+
+    while (1)
+    {
+        if (TmThreadsCheckFlag(th_v, THV_PAUSE)) {
+            TmThreadsSetFlag(th_v, THV_PAUSED);
+            TmThreadTestThreadUnPaused(th_v);
+            TmThreadsUnsetFlag(th_v, THV_PAUSED);
+        }
+
+        SCMutexLock(&w->m);
+        FilestoreWriterOp *ops = w->head;
+        w->head = w->tail = NULL;
+        SCMutexUnlock(&w->m);
+
+        if (ops != NULL) {
+            FilestoreWriterRun(wt, ops);
+            continue;
+        }
+
+        /* the workers are stopped before us, so the queue is drained */
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            break;
+        }
+
+        /* wait for more ops. The timeout is for the kill signal, which
+         * is sent without holding the ctrl mutex. */
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + 1;
+        ts.tv_nsec = tv.tv_usec * 1000;
+
+        SCCtrlMutexLock(th_v->ctrl_mutex);
+        SCMutexLock(&w->m);
+        const bool empty = (w->head == NULL);
+        SCMutexUnlock(&w->m);
+        if (empty) {
+            SCCtrlCondTimedwait(th_v->ctrl_cond, th_v->ctrl_mutex, &ts);
+        }
+        SCCtrlMutexUnlock(th_v->ctrl_mutex);
+    }
+
+    return TM_ECODE_OK;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief set up a filestore in a new temporary directory, with its
+ *         tmp directory and the "ab" leaf directory the test files use */
+static int OutputFilestoreTestSetup(OutputFilestoreCtx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return -1;
+    snprintf(ctx->prefix, sizeof(ctx->prefix), "%s", dir);
+    snprintf(ctx->tmpdir, sizeof(ctx->tmpdir), "%s/tmp", dir);
+
+    char leaf[PATH_MAX];
+    snprintf(leaf, sizeof(leaf), "%s/ab", dir);
+    if (mkdir(ctx->tmpdir, 0700) != 0 || mkdir(leaf, 0700) != 0)
+        return -1;
+    return 0;
+}
+
+static void OutputFilestoreTestCleanup(const OutputFilestoreCtx *ctx,
+        const uint8_t *sha256)
+{
+    char filename[PATH_MAX] = "";
+    char js_filename[PATH_MAX] = "";
+    File ff;
+    memset(&ff, 0, sizeof(ff));
+    memcpy(ff.sha256, sha256, SHA256_LENGTH);
+    OutputFilestoreFinalFilenames(ctx, NULL, &ff, filename, sizeof(filename),
+            js_filename, sizeof(js_filename));
+    unlink(filename);
+
+    snprintf(filename, sizeof(filename), "%s/ab", ctx->prefix);
+    rmdir(filename);
+    rmdir(ctx->tmpdir);
+    rmdir(ctx->prefix);
+}
+
+static int OutputFilestoreTestWriteFile(const char *filename, const char *data)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+        return -1;
+    const size_t len = strlen(data);
+    const size_t r = fwrite(data, 1, len, fp);
+    fclose(fp);
+    return r == len ? 0 : -1;
+}
+
+/**
+ * \test the bloom filter of stored files: a new file is renamed into
+ *       place and added, a duplicate is dropped, and a bloom hit on a
+ *       file that is no longer stored still stores it
+ */
+static int OutputFilestoreBloomTest01(void)
+{
+    BloomFilter *bloom = filestore_bloom;
+    filestore_bloom = BloomFilterInit(FILESTORE_BLOOM_BITS,
+            FILESTORE_BLOOM_ITERATIONS, FilestoreBloomHash);
+    FAIL_IF_NULL(filestore_bloom);
+
+    OutputFilestoreCtx ctx;
+    FAIL_IF(OutputFilestoreTestSetup(&ctx) != 0);
+
+    uint8_t sha_a[SHA256_LENGTH];
+    uint8_t sha_b[SHA256_LENGTH];
+    for (int i = 0; i < SHA256_LENGTH; i++) {
+        sha_a[i] = (uint8_t)(0xab + i);
+        sha_b[i] = (uint8_t)(0xab + 2 * i);
+    }
+    FAIL_IF(FilestoreBloomTest(sha_a));
+
+    File ff;
+    memset(&ff, 0, sizeof(ff));
+    memcpy(ff.sha256, sha_a, SHA256_LENGTH);
+    char tmp_filename[PATH_MAX] = "";
+    char final_filename[PATH_MAX] = "";
+    char js_filename[PATH_MAX] = "";
+    OutputFilestoreTmpFilename(&ctx, 1, tmp_filename, sizeof(tmp_filename));
+    FAIL_IF(OutputFilestoreFinalFilenames(&ctx, NULL, &ff, final_filename,
+                sizeof(final_filename), js_filename, sizeof(js_filename)));
+
+    /* new file */
+    FAIL_IF(OutputFilestoreTestWriteFile(tmp_filename, "file data") != 0);
+    FAIL_IF(OutputFilestoreFinalize(sha_a, tmp_filename, final_filename,
+                NULL, NULL) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(SCPathExists(final_filename));
+    FAIL_IF_NOT(FilestoreBloomTest(sha_a));
+    FAIL_IF(FilestoreBloomTest(sha_b));
+
+    /* duplicate, only the tmp file is removed */
+    FAIL_IF(OutputFilestoreTestWriteFile(tmp_filename, "file data") != 0);
+    FAIL_IF(OutputFilestoreFinalize(sha_a, tmp_filename, final_filename,
+                NULL, NULL) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(SCPathExists(final_filename));
+
+    /* in the bloom filter, but removed from the filestore */
+    FAIL_IF(unlink(final_filename) != 0);
+    FAIL_IF(OutputFilestoreTestWriteFile(tmp_filename, "file data") != 0);
+    FAIL_IF(OutputFilestoreFinalize(sha_a, tmp_filename, final_filename,
+                NULL, NULL) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(SCPathExists(final_filename));
+
+    OutputFilestoreTestCleanup(&ctx, sha_a);
+    BloomFilterFree(filestore_bloom);
+    filestore_bloom = bloom;
+    PASS;
+}
+
+/**
+ * \test with dedup-buffer-size set, a small file is held back until it is
+ *       closed and not written at all if it is stored already, while a
+ *       file that outgrows the buffer is written before it's closed
+ */
+static int OutputFilestoreDedupTest02(void)
+{
+    BloomFilter *bloom = filestore_bloom;
+    filestore_bloom = BloomFilterInit(FILESTORE_BLOOM_BITS,
+            FILESTORE_BLOOM_ITERATIONS, FilestoreBloomHash);
+    FAIL_IF_NULL(filestore_bloom);
+
+    OutputFilestoreCtx ctx;
+    FAIL_IF(OutputFilestoreTestSetup(&ctx) != 0);
+    ctx.dedup_buffer_size = 16;
+
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    OutputFilestoreLogThread aft;
+    memset(&aft, 0, sizeof(aft));
+    aft.ctx = &ctx;
+    aft.counter_max_hits = StatsRegisterCounter("file_store.open_files_max_hit", &tv);
+    aft.fs_error_counter = StatsRegisterCounter("file_store.fs_errors", &tv);
+    aft.dedup_counter = StatsRegisterCounter("file_store.dedup", &tv);
+    StatsSetupPrivate(&tv);
+    aft.heads = HashTableInit(4096, FilestoreHeadHash, FilestoreHeadCompare,
+            FilestoreHeadFree);
+    FAIL_IF_NULL(aft.heads);
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    File ff;
+    memset(&ff, 0, sizeof(ff));
+    ff.fd = -1;
+    ff.flags = FILE_SHA256;
+    for (int i = 0; i < SHA256_LENGTH; i++)
+        ff.sha256[i] = (uint8_t)(0xab + i);
+    char tmp_filename[PATH_MAX] = "";
+    char final_filename[PATH_MAX] = "";
+    char js_filename[PATH_MAX] = "";
+    FAIL_IF(OutputFilestoreFinalFilenames(&ctx, p, &ff, final_filename,
+                sizeof(final_filename), js_filename, sizeof(js_filename)));
+
+    /* small file, not stored yet: held back, then written at close */
+    ff.file_store_id = 1;
+    OutputFilestoreTmpFilename(&ctx, ff.file_store_id, tmp_filename,
+            sizeof(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, (uint8_t *)"12345678", 8,
+                OUTPUT_FILEDATA_FLAG_OPEN, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, NULL, 0,
+                OUTPUT_FILEDATA_FLAG_CLOSE, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(SCPathExists(final_filename));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, aft.dedup_counter) == 0);
+
+    /* the same small file again: never written */
+    ff.file_store_id = 2;
+    OutputFilestoreTmpFilename(&ctx, ff.file_store_id, tmp_filename,
+            sizeof(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, (uint8_t *)"12345678", 8,
+                OUTPUT_FILEDATA_FLAG_OPEN, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, NULL, 0,
+                OUTPUT_FILEDATA_FLAG_CLOSE, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, aft.dedup_counter) == 1);
+
+    /* larger than the buffer: written once it outgrows it */
+    ff.file_store_id = 3;
+    OutputFilestoreTmpFilename(&ctx, ff.file_store_id, tmp_filename,
+            sizeof(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, (uint8_t *)"1234567890", 10,
+                OUTPUT_FILEDATA_FLAG_OPEN, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, (uint8_t *)"1234567890", 10,
+                0, STREAM_TOCLIENT) != 0);
+    FAIL_IF_NOT(SCPathExists(tmp_filename));
+    FAIL_IF(OutputFilestoreDedupLog(&tv, &aft, p, &ff, NULL, 0,
+                OUTPUT_FILEDATA_FLAG_CLOSE, STREAM_TOCLIENT) != 0);
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, aft.dedup_counter) == 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, aft.fs_error_counter) == 0);
+
+    PacketFree(p);
+    HashTableFree(aft.heads);
+    StatsThreadCleanup(&tv);
+    OutputFilestoreTestCleanup(&ctx, ff.sha256);
+    BloomFilterFree(filestore_bloom);
+    filestore_bloom = bloom;
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
 #endif /* HAVE_NSS */
 
+/** \brief spawn the filestore writer threads, if enabled */
+void OutputFilestoreWriterThreadSpawn(void)
+{
+#ifdef HAVE_NSS
+    if (filestore_writer_threads == 0 || filestore_writer_ctx == NULL)
+        return;
+
+    FilestoreWriter *writers = SCCalloc(filestore_writer_threads,
+            sizeof(FilestoreWriter));
+    if (writers == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc filestore writers");
+        exit(EXIT_FAILURE);
+    }
+    filestore_writers = writers;
+
+    for (uint32_t i = 0; i < filestore_writer_threads; i++) {
+        char name[TM_THREAD_NAME_MAX];
+        snprintf(name, sizeof(name), "%s#%02u", thread_name_filestore_writer, i+1);
+
+        SCMutexInit(&writers[i].m, NULL);
+        ThreadVars *tv_writer = TmThreadCreateCmdThreadByName(name,
+                "FilestoreWriter", 1);
+        if (tv_writer == NULL) {
+            SCLogError(SC_ERR_THREAD_CREATE, "creating filestore writer thread failed");
+            exit(EXIT_FAILURE);
+        }
+        writers[i].tv = tv_writer;
+        if (TmThreadSpawn(tv_writer) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_THREAD_SPAWN, "spawning filestore writer thread failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* the workers are still paused, they start queueing after this */
+    filestore_writers_cnt = filestore_writer_threads;
+#endif
+}
+
+void TmModuleFilestoreWriterRegister(void)
+{
+    tmm_modules[TMM_FILESTOREWRITER].name = "FilestoreWriter";
+#ifdef HAVE_NSS
+    tmm_modules[TMM_FILESTOREWRITER].ThreadInit = FilestoreWriterThreadInit;
+    tmm_modules[TMM_FILESTOREWRITER].ThreadDeinit = FilestoreWriterThreadDeinit;
+    tmm_modules[TMM_FILESTOREWRITER].Management = FilestoreWriterLoop;
+    SC_ATOMIC_INIT(filestore_writer_instances);
+    SC_ATOMIC_INIT(filestore_writer_memuse);
+    SC_ATOMIC_INIT(filestore_writer_fs_errors);
+#endif
+    tmm_modules[TMM_FILESTOREWRITER].cap_flags = 0;
+    tmm_modules[TMM_FILESTOREWRITER].flags = TM_FLAG_MANAGEMENT_TM;
+}
+
 void OutputFilestoreRegister(void)
 {
 #ifdef HAVE_NSS
@@ -529,3 +1685,11 @@ void OutputFilestoreRegister(void)
     SC_ATOMIC_SET(filestore_open_file_cnt, 0);
 #endif
 }
+
+void OutputFilestoreRegisterTests(void)
+{
+#if defined(HAVE_NSS) && defined(UNITTESTS)
+    UtRegisterTest("OutputFilestoreBloomTest01", OutputFilestoreBloomTest01);
+    UtRegisterTest("OutputFilestoreDedupTest02", OutputFilestoreDedupTest02);
+#endif
+}
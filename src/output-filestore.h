@@ -21,4 +21,9 @@
 void OutputFilestoreRegister(void);
 void OutputFilestoreInitConfig(void);
 
+void OutputFilestoreWriterThreadSpawn(void);
+void TmModuleFilestoreWriterRegister(void);
+
+void OutputFilestoreRegisterTests(void);
+
 #endif /* __OUTPUT_FILESTORE_H__ */
@@ -345,6 +345,36 @@ void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *
     json_object_set_new(js, "alert", ajs);
 }
 
+/** \internal
+ *  \brief log the outer layer of a tunnel decoded in place */
+static void AlertJsonTunnelOuter(const Packet *p, json_t *tunnel)
+{
+    const PacketTunnelOuter *outer = &p->tunnel_outer;
+    char srcip[46] = {0}, dstip[46] = {0};
+    char proto[16];
+
+    if (outer->src.family == AF_INET) {
+        PrintInet(AF_INET, (const void *)&outer->src.addr_data32[0],
+                srcip, sizeof(srcip));
+        PrintInet(AF_INET, (const void *)&outer->dst.addr_data32[0],
+                dstip, sizeof(dstip));
+    } else {
+        PrintInet(AF_INET6, (const void *)outer->src.addr_data32,
+                srcip, sizeof(srcip));
+        PrintInet(AF_INET6, (const void *)outer->dst.addr_data32,
+                dstip, sizeof(dstip));
+    }
+    if (SCProtoNameValid(outer->proto) == TRUE) {
+        strlcpy(proto, known_proto[outer->proto], sizeof(proto));
+    } else {
+        snprintf(proto, sizeof(proto), "%03" PRIu32, outer->proto);
+    }
+
+    json_object_set_new(tunnel, "src_ip", json_string(srcip));
+    json_object_set_new(tunnel, "dest_ip", json_string(dstip));
+    json_object_set_new(tunnel, "proto", json_string(proto));
+}
+
 static void AlertJsonTunnel(const Packet *p, json_t *js)
 {
     json_t *tunnel = json_object();
@@ -352,7 +382,13 @@ static void AlertJsonTunnel(const Packet *p, json_t *js)
         return;
 
     if (p->root == NULL) {
-        json_decref(tunnel);
+        if (p->flags & PKT_TUNNEL_IN_PLACE) {
+            AlertJsonTunnelOuter(p, tunnel);
+            json_object_set_new(tunnel, "depth", json_integer(p->recursion_level));
+            json_object_set_new(js, "tunnel", tunnel);
+        } else {
+            json_decref(tunnel);
+        }
         return;
     }
 
@@ -417,7 +453,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
         /* alert */
         AlertJsonHeader(json_output_ctx, p, pa, js, json_output_ctx->flags);
 
-        if (IS_TUNNEL_PKT(p)) {
+        if (IS_TUNNEL_PKT(p) || (p->flags & PKT_TUNNEL_IN_PLACE)) {
             AlertJsonTunnel(p, js);
         }
 
@@ -834,6 +870,10 @@ static void JsonAlertLogSetupMetadata(AlertJsonOutputCtx *json_output_ctx,
         SetFlag(conf, "payload-printable", LOG_JSON_PAYLOAD, &flags);
         SetFlag(conf, "http-body-printable", LOG_JSON_HTTP_BODY, &flags);
         SetFlag(conf, "http-body", LOG_JSON_HTTP_BODY_BASE64, &flags);
+        if (flags & (LOG_JSON_HTTP_BODY|LOG_JSON_HTTP_BODY_BASE64)) {
+            AppLayerHtpEnableRequestBodyCallback();
+            AppLayerHtpEnableResponseBodyCallback();
+        }
 
         /* Check for obsolete configuration flags to enable specific
          * protocols. These are now just aliases for enabling
@@ -110,9 +110,10 @@ static int AnomalyJson(ThreadVars *tv, JsonAnomalyLogThread *aft, const Packet *
         uint8_t event_code = p->events.events[i];
         if (event_code < DECODE_EVENT_MAX) {
             const char *event = DEvents[event_code].event_name;
-            json_object_set_new(ajs, "type",
-                                EVENT_IS_DECODER_PACKET_ERROR(event_code) ? 
-                                    json_string("packet") : json_string("stream"));
+            const char *type = EVENT_IS_DECODER_PACKET_ERROR(event_code) ?
+                "packet" : (event_code == DETECT_INSPECTION_BUDGET_EXCEEDED ?
+                        "detect" : "stream");
+            json_object_set_new(ajs, "type", json_string(type));
             json_object_set_new(ajs, "event", json_string(event));
         } else {
             /* include event code with unrecognized events */
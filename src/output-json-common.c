@@ -59,6 +59,10 @@ OutputInitResult OutputJsonLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
         return result;
     }
     *log_ctx = *ajt;
+    if (conf != NULL && OutputJsonParseSampleRate(conf, &log_ctx->cfg) < 0) {
+        SCFree(log_ctx);
+        return result;
+    }
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(*output_ctx));
     if (unlikely(output_ctx == NULL)) {
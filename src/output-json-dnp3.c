@@ -392,6 +392,7 @@ static OutputInitResult OutputDNP3LogInitSub(ConfNode *conf, OutputCtx *parent_c
     SCLogInfo("DNP3 log sub-module initialized.");
 
     AppLayerParserRegisterLogger(IPPROTO_TCP, ALPROTO_DNP3);
+    DNP3EnableObjectDecoding();
 
     result.ctx = output_ctx;
     result.ok = true;
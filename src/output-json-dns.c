@@ -123,7 +123,13 @@
 #define LOG_FORMAT_DETAILED    BIT_U64(61)
 
 #define LOG_FORMAT_ALL (LOG_FORMAT_GROUPED|LOG_FORMAT_DETAILED)
-#define LOG_ALL_RRTYPES (~(uint64_t)(LOG_QUERIES|LOG_ANSWERS|LOG_FORMAT_DETAILED|LOG_FORMAT_GROUPED))
+
+/* optional fields of the version 2 answer */
+#define LOG_FLAGS              BIT_U64(62)
+#define LOG_AUTHORITIES        BIT_U64(63)
+
+#define LOG_FIELDS_ALL (LOG_FLAGS|LOG_AUTHORITIES)
+#define LOG_ALL_RRTYPES (~(uint64_t)(LOG_QUERIES|LOG_ANSWERS|LOG_FORMAT_ALL|LOG_FIELDS_ALL))
 
 typedef enum {
     DNS_RRTYPE_A = 0,
@@ -258,6 +264,12 @@ static struct {
    { "uri", LOG_URI }
 };
 
+static const OutputJsonField dns_fields[] = {
+    { "flags", LOG_FLAGS },
+    { "authorities", LOG_AUTHORITIES },
+    { NULL, 0 },
+};
+
 typedef struct LogDnsFileCtx_ {
     LogFileCtx *file_ctx;
     uint64_t flags; /** Store mode */
@@ -292,7 +304,7 @@ json_t *JsonDNSLogQuery(void *txptr, uint64_t tx_id)
 
 json_t *JsonDNSLogAnswer(void *txptr, uint64_t tx_id)
 {
-    return rs_dns_log_json_answer(txptr, LOG_ALL_RRTYPES);
+    return rs_dns_log_json_answer(txptr, LOG_ALL_RRTYPES|LOG_FIELDS_ALL);
 }
 
 static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
@@ -307,6 +319,9 @@ static int JsonDnsLoggerToServer(ThreadVars *tv, void *thread_data,
     if (unlikely(dnslog_ctx->flags & LOG_QUERIES) == 0) {
         return TM_ECODE_OK;
     }
+    if (!OutputJsonSampleFlow(&dnslog_ctx->cfg, f)) {
+        return TM_ECODE_OK;
+    }
 
     for (uint16_t i = 0; i < 0xffff; i++) {
         js = CreateJSONHeader(p, LOG_DIR_PACKET, "dns");
@@ -340,6 +355,9 @@ static int JsonDnsLoggerToClient(ThreadVars *tv, void *thread_data,
     if (unlikely(dnslog_ctx->flags & LOG_ANSWERS) == 0) {
         return TM_ECODE_OK;
     }
+    if (!OutputJsonSampleFlow(&dnslog_ctx->cfg, f)) {
+        return TM_ECODE_OK;
+    }
 
     json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "dns");
     if (unlikely(js == NULL))
@@ -536,7 +554,7 @@ static DnsVersion JsonDnsParseVersion(ConfNode *conf)
     return version;
 }
 
-static void JsonDnsLogInitFilters(LogDnsFileCtx *dnslog_ctx, ConfNode *conf)
+static int JsonDnsLogInitFilters(LogDnsFileCtx *dnslog_ctx, ConfNode *conf)
 {
     dnslog_ctx->flags = ~0UL;
 
@@ -561,9 +579,16 @@ static void JsonDnsLogInitFilters(LogDnsFileCtx *dnslog_ctx, ConfNode *conf)
                 } else {
                     dnslog_ctx->flags |= LOG_FORMAT_ALL;
                 }
+
+                uint64_t fields = LOG_FIELDS_ALL;
+                if (OutputJsonParseFields(conf, dns_fields, &fields) < 0)
+                    return -1;
+                dnslog_ctx->flags &= ~LOG_FIELDS_ALL;
+                dnslog_ctx->flags |= fields;
             }
         }
     }
+    return 0;
 }
 
 static OutputInitResult JsonDnsLogInitCtxSub(ConfNode *conf, OutputCtx *parent_ctx)
@@ -587,6 +612,10 @@ static OutputInitResult JsonDnsLogInitCtxSub(ConfNode *conf, OutputCtx *parent_c
 
     dnslog_ctx->file_ctx = ojc->file_ctx;
     dnslog_ctx->cfg = ojc->cfg;
+    if (OutputJsonParseSampleRate(conf, &dnslog_ctx->cfg) < 0) {
+        SCFree(dnslog_ctx);
+        return result;
+    }
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
     if (unlikely(output_ctx == NULL)) {
@@ -598,7 +627,10 @@ static OutputInitResult JsonDnsLogInitCtxSub(ConfNode *conf, OutputCtx *parent_c
     output_ctx->DeInit = LogDnsLogDeInitCtxSub;
 
     dnslog_ctx->version = version;
-    JsonDnsLogInitFilters(dnslog_ctx, conf);
+    if (JsonDnsLogInitFilters(dnslog_ctx, conf) < 0) {
+        LogDnsLogDeInitCtxSub(output_ctx);
+        return result;
+    }
 
     SCLogDebug("DNS log sub-module initialized");
 
@@ -657,7 +689,10 @@ static OutputInitResult JsonDnsLogInitCtx(ConfNode *conf)
     output_ctx->DeInit = LogDnsLogDeInitCtx;
 
     dnslog_ctx->version = version;
-    JsonDnsLogInitFilters(dnslog_ctx, conf);
+    if (JsonDnsLogInitFilters(dnslog_ctx, conf) < 0) {
+        LogDnsLogDeInitCtx(output_ctx);
+        return result;
+    }
 
     SCLogDebug("DNS log output initialized");
 
@@ -48,6 +48,7 @@
 #include "output-json-flow.h"
 
 #include "stream-tcp-private.h"
+#include "flow-cost.h"
 
 #ifdef HAVE_LIBJANSSON
 
@@ -63,121 +64,6 @@ typedef struct JsonFlowLogThread_ {
     MemBuffer *buffer;
 } JsonFlowLogThread;
 
-static json_t *CreateJSONHeaderFromFlow(const Flow *f, const char *event_type)
-{
-    char timebuf[64];
-    char srcip[46] = {0}, dstip[46] = {0};
-    Port sp, dp;
-
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
-    struct timeval tv;
-    memset(&tv, 0x00, sizeof(tv));
-    TimeGet(&tv);
-
-    CreateIsoTimeString(&tv, timebuf, sizeof(timebuf));
-
-    if ((f->flags & FLOW_DIR_REVERSED) == 0) {
-        if (FLOW_IS_IPV4(f)) {
-            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), dstip, sizeof(dstip));
-        } else if (FLOW_IS_IPV6(f)) {
-            PrintInet(AF_INET6, (const void *)&(f->src.address), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)&(f->dst.address), dstip, sizeof(dstip));
-        }
-        sp = f->sp;
-        dp = f->dp;
-    } else {
-        if (FLOW_IS_IPV4(f)) {
-            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), dstip, sizeof(dstip));
-        } else if (FLOW_IS_IPV6(f)) {
-            PrintInet(AF_INET6, (const void *)&(f->dst.address), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)&(f->src.address), dstip, sizeof(dstip));
-        }
-        sp = f->dp;
-        dp = f->sp;
-    }
-
-    char proto[16];
-    if (SCProtoNameValid(f->proto) == TRUE) {
-        strlcpy(proto, known_proto[f->proto], sizeof(proto));
-    } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, f->proto);
-    }
-
-    /* time */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
-
-    CreateJSONFlowId(js, (const Flow *)f);
-
-#if 0 // TODO
-    /* sensor id */
-    if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
-#endif
-
-    /* input interface */
-    if (f->livedev) {
-        json_object_set_new(js, "in_iface", json_string(f->livedev->dev));
-    }
-
-    if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
-    }
-
-    /* vlan */
-    if (f->vlan_idx > 0) {
-        json_t *js_vlan = json_array();
-        json_array_append_new(js_vlan, json_integer(f->vlan_id[0]));
-        if (f->vlan_idx > 1) {
-            json_array_append_new(js_vlan, json_integer(f->vlan_id[1]));
-        }
-        json_object_set_new(js, "vlan", js_vlan);
-    }
-
-    /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
-    switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
-        case IPPROTO_UDP:
-        case IPPROTO_TCP:
-        case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
-            break;
-    }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
-    switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
-        case IPPROTO_UDP:
-        case IPPROTO_TCP:
-        case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
-            break;
-    }
-    json_object_set_new(js, "proto", json_string(proto));
-    switch (f->proto) {
-        case IPPROTO_ICMP:
-        case IPPROTO_ICMPV6:
-            json_object_set_new(js, "icmp_type",
-                    json_integer(f->icmp_s.type));
-            json_object_set_new(js, "icmp_code",
-                    json_integer(f->icmp_s.code));
-            if (f->tosrcpktcnt) {
-                json_object_set_new(js, "response_icmp_type",
-                        json_integer(f->icmp_d.type));
-                json_object_set_new(js, "response_icmp_code",
-                        json_integer(f->icmp_d.code));
-            }
-            break;
-    }
-    return js;
-}
-
 void JsonAddFlow(Flow *f, json_t *js, json_t *hjs)
 {
     json_object_set_new(js, "app_proto",
@@ -214,26 +100,55 @@ void JsonAddFlow(Flow *f, json_t *js, json_t *hjs)
 }
 
 /* JSON format logging */
-static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
+static void JsonFlowLogJSON(JsonFlowLogThread *aft, JsonBuilder *jb, Flow *f)
 {
     LogJsonFileCtx *flow_ctx = aft->flowlog_ctx;
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
+
+    switch (f->proto) {
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            JbSetUint(jb, "icmp_type", f->icmp_s.type);
+            JbSetUint(jb, "icmp_code", f->icmp_s.code);
+            if (f->tosrcpktcnt) {
+                JbSetUint(jb, "response_icmp_type", f->icmp_d.type);
+                JbSetUint(jb, "response_icmp_code", f->icmp_d.code);
+            }
+            break;
     }
 
-    JsonAddFlow(f, js, hjs);
+    JbSetString(jb, "app_proto", AppProtoToString(f->alproto));
+    if (f->alproto_ts != f->alproto) {
+        JbSetString(jb, "app_proto_ts", AppProtoToString(f->alproto_ts));
+    }
+    if (f->alproto_tc != f->alproto) {
+        JbSetString(jb, "app_proto_tc", AppProtoToString(f->alproto_tc));
+    }
+    if (f->alproto_orig != f->alproto && f->alproto_orig != ALPROTO_UNKNOWN) {
+        JbSetString(jb, "app_proto_orig", AppProtoToString(f->alproto_orig));
+    }
+    if (f->alproto_expect != f->alproto && f->alproto_expect != ALPROTO_UNKNOWN) {
+        JbSetString(jb, "app_proto_expected", AppProtoToString(f->alproto_expect));
+    }
+
+    JbOpenObject(jb, "flow");
+    JbSetUint(jb, "pkts_toserver", f->todstpktcnt);
+    JbSetUint(jb, "pkts_toclient", f->tosrcpktcnt);
+    JbSetUint(jb, "bytes_toserver", f->todstbytecnt);
+    JbSetUint(jb, "bytes_toclient", f->tosrcbytecnt);
+
+    char timebuf1[64];
+    CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
+    JbSetString(jb, "start", timebuf1);
 
     char timebuf2[64];
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JbSetString(jb, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JbSetInt(jb, "age", age);
 
     if (f->flow_end_flags & FLOW_END_FLAG_EMERGENCY)
-        json_object_set_new(hjs, "emergency", json_true());
+        JbSetBool(jb, "emergency", true);
     const char *state = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_STATE_NEW)
         state = "new";
@@ -246,12 +161,10 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
         int flow_state = SC_ATOMIC_GET(f->flow_state);
         switch (flow_state) {
             case FLOW_STATE_LOCAL_BYPASSED:
-                json_object_set_new(hjs, "bypass",
-                        json_string("local"));
+                JbSetString(jb, "bypass", "local");
                 break;
             case FLOW_STATE_CAPTURE_BYPASSED:
-                json_object_set_new(hjs, "bypass",
-                        json_string("capture"));
+                JbSetString(jb, "bypass", "capture");
                 break;
             default:
                 SCLogError(SC_ERR_INVALID_VALUE,
@@ -260,8 +173,7 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
         }
     }
 
-    json_object_set_new(hjs, "state",
-            json_string(state));
+    JbSetString(jb, "state", state);
 
     const char *reason = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)
@@ -271,40 +183,46 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_SHUTDOWN)
         reason = "shutdown";
 
-    json_object_set_new(hjs, "reason",
-            json_string(reason));
+    JbSetString(jb, "reason", reason);
 
-    json_object_set_new(hjs, "alerted", json_boolean(FlowHasAlerts(f)));
+    JbSetBool(jb, "alerted", FlowHasAlerts(f));
     if (f->flags & FLOW_WRONG_THREAD)
-        json_object_set_new(hjs, "wrong_thread", json_true());
+        JbSetBool(jb, "wrong_thread", true);
 
-    json_object_set_new(js, "flow", hjs);
+    const FlowCost *fc = FlowCostPeek(f);
+    if (fc != NULL) {
+        JbOpenObject(jb, "cpu_ticks");
+        for (int i = 0; i < FLOW_COST_SIZE; i++) {
+            JbSetUint(jb, FlowCostIdToString(i), fc->ticks[i]);
+        }
+        JbSetUint(jb, "total", FlowCostTotal(fc));
+        JbClose(jb);
+    }
 
-    JsonAddCommonOptions(&flow_ctx->cfg, NULL, f, js);
+    JbClose(jb);
+
+    JbAddCommonOptions(&flow_ctx->cfg, NULL, f, jb);
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
+        JbOpenObject(jb, "tcp");
 
         TcpSession *ssn = f->protoctx;
 
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->tcp_packet_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JbSetString(jb, "tcp_flags", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->client.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_ts", json_string(hexflags));
+        JbSetString(jb, "tcp_flags_ts", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_tc", json_string(hexflags));
+        JbSetString(jb, "tcp_flags_tc", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->tcp_packet_flags : 0, tjs);
+        JbTcpFlags(ssn ? ssn->tcp_packet_flags : 0, jb);
 
         if (ssn) {
             const char *tcp_state = NULL;
@@ -346,14 +264,14 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
                     tcp_state = "closed";
                     break;
             }
-            json_object_set_new(tjs, "state", json_string(tcp_state));
+            JbSetString(jb, "state", tcp_state);
             if (ssn->client.flags & STREAMTCP_STREAM_FLAG_GAP)
-                json_object_set_new(tjs, "gap_ts", json_true());
+                JbSetBool(jb, "gap_ts", true);
             if (ssn->server.flags & STREAMTCP_STREAM_FLAG_GAP)
-                json_object_set_new(tjs, "gap_tc", json_true());
+                JbSetBool(jb, "gap_tc", true);
         }
 
-        json_object_set_new(js, "tcp", tjs);
+        JbClose(jb);
     }
 }
 
@@ -361,21 +279,18 @@ static int JsonFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 {
     SCEnter();
     JsonFlowLogThread *jhl = (JsonFlowLogThread *)thread_data;
+    LogFileCtx *file_ctx = jhl->flowlog_ctx->file_ctx;
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-
-    json_t *js = CreateJSONHeaderFromFlow(f, "flow");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    if (!OutputJsonSampleFlow(&jhl->flowlog_ctx->cfg, f))
+        SCReturnInt(TM_ECODE_OK);
 
-    JsonFlowLogJSON(jhl, js, f);
+    JsonBuilder jb;
+    OutputJsonBuilderStart(&jb, file_ctx, &jhl->buffer);
 
-    OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
+    CreateEveHeaderFromFlow(&jb, f, "flow", 0);
+    JsonFlowLogJSON(jhl, &jb, f);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonBuilderBuffer(&jb, file_ctx, &jhl->buffer);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -404,7 +319,7 @@ static OutputInitResult OutputFlowLogInit(ConfNode *conf)
         return result;
     }
 
-    LogJsonFileCtx *flow_ctx = SCMalloc(sizeof(LogJsonFileCtx));
+    LogJsonFileCtx *flow_ctx = SCCalloc(1, sizeof(LogJsonFileCtx));
     if (unlikely(flow_ctx == NULL)) {
         LogFileFreeCtx(file_ctx);
         return result;
@@ -438,7 +353,7 @@ static OutputInitResult OutputFlowLogInitSub(ConfNode *conf, OutputCtx *parent_c
     OutputInitResult result = { NULL, false };
     OutputJsonCtx *ojc = parent_ctx->data;
 
-    LogJsonFileCtx *flow_ctx = SCMalloc(sizeof(LogJsonFileCtx));
+    LogJsonFileCtx *flow_ctx = SCCalloc(1, sizeof(LogJsonFileCtx));
     if (unlikely(flow_ctx == NULL))
         return result;
 
@@ -450,6 +365,11 @@ static OutputInitResult OutputFlowLogInitSub(ConfNode *conf, OutputCtx *parent_c
 
     flow_ctx->file_ctx = ojc->file_ctx;
     flow_ctx->cfg = ojc->cfg;
+    if (OutputJsonParseSampleRate(conf, &flow_ctx->cfg) < 0) {
+        SCFree(flow_ctx);
+        SCFree(output_ctx);
+        return result;
+    }
 
     output_ctx->data = flow_ctx;
     output_ctx->DeInit = OutputFlowLogDeinitSub;
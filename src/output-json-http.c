@@ -61,6 +61,7 @@ typedef struct LogHttpFileCtx_ {
     LogFileCtx *file_ctx;
     uint32_t flags; /** Store mode */
     uint64_t fields;/** Store fields */
+    uint64_t log_fields; /** default and extended fields to log */
     HttpXFFCfg *xff_cfg;
     HttpXFFCfg *parent_xff_cfg;
     OutputJsonCommonSettings cfg;
@@ -72,6 +73,8 @@ typedef struct JsonHttpLogThread_ {
     uint32_t uri_cnt;
 
     MemBuffer *buffer;
+    /** cached json strings for the method and protocol */
+    JsonStringCache *strings;
 } JsonHttpLogThread;
 
 #define MAX_SIZE_HEADER_NAME 256
@@ -84,6 +87,39 @@ typedef struct JsonHttpLogThread_ {
 #define LOG_HTTP_REQ_HEADERS 8
 #define LOG_HTTP_RES_HEADERS 16
 
+/* fields of the default and extended records, selected with "fields" */
+#define LOG_HTTP_FIELD_HOSTNAME         BIT_U64(0)
+#define LOG_HTTP_FIELD_PORT             BIT_U64(1)
+#define LOG_HTTP_FIELD_URL              BIT_U64(2)
+#define LOG_HTTP_FIELD_USER_AGENT       BIT_U64(3)
+#define LOG_HTTP_FIELD_XFF              BIT_U64(4)
+#define LOG_HTTP_FIELD_CONTENT_TYPE     BIT_U64(5)
+#define LOG_HTTP_FIELD_CONTENT_RANGE    BIT_U64(6)
+#define LOG_HTTP_FIELD_REFER            BIT_U64(7)
+#define LOG_HTTP_FIELD_METHOD           BIT_U64(8)
+#define LOG_HTTP_FIELD_PROTOCOL         BIT_U64(9)
+#define LOG_HTTP_FIELD_STATUS           BIT_U64(10)
+#define LOG_HTTP_FIELD_REDIRECT         BIT_U64(11)
+#define LOG_HTTP_FIELD_LENGTH           BIT_U64(12)
+#define LOG_HTTP_FIELD_ALL              (~(uint64_t)0)
+
+static const OutputJsonField http_log_fields[] = {
+    { "hostname", LOG_HTTP_FIELD_HOSTNAME },
+    { "http_port", LOG_HTTP_FIELD_PORT },
+    { "url", LOG_HTTP_FIELD_URL },
+    { "http_user_agent", LOG_HTTP_FIELD_USER_AGENT },
+    { "xff", LOG_HTTP_FIELD_XFF },
+    { "http_content_type", LOG_HTTP_FIELD_CONTENT_TYPE },
+    { "content_range", LOG_HTTP_FIELD_CONTENT_RANGE },
+    { "http_refer", LOG_HTTP_FIELD_REFER },
+    { "http_method", LOG_HTTP_FIELD_METHOD },
+    { "protocol", LOG_HTTP_FIELD_PROTOCOL },
+    { "status", LOG_HTTP_FIELD_STATUS },
+    { "redirect", LOG_HTTP_FIELD_REDIRECT },
+    { "length", LOG_HTTP_FIELD_LENGTH },
+    { NULL, 0 },
+};
+
 typedef enum {
     HTTP_FIELD_ACCEPT = 0,
     HTTP_FIELD_ACCEPT_CHARSET,
@@ -201,10 +237,10 @@ struct {
     { "x_bluecoat_via", "x-bluecoat-via", LOG_HTTP_REQUEST },
 };
 
-static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
+static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx, uint64_t fields)
 {
     /* hostname */
-    if (tx->request_hostname != NULL) {
+    if ((fields & LOG_HTTP_FIELD_HOSTNAME) && tx->request_hostname != NULL) {
         const size_t size = bstr_len(tx->request_hostname) * 2 + 1;
         char string[size];
         BytesToStringBuffer(bstr_ptr(tx->request_hostname), bstr_len(tx->request_hostname), string, size);
@@ -217,13 +253,13 @@ static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
      * There is no connection (from the suricata point of view) between this
      * port and the TCP destination port of the flow.
      */
-    if (tx->request_port_number >= 0) {
+    if ((fields & LOG_HTTP_FIELD_PORT) && tx->request_port_number >= 0) {
         json_object_set_new(js, "http_port",
                 json_integer(tx->request_port_number));
     }
 
     /* uri */
-    if (tx->request_uri != NULL) {
+    if ((fields & LOG_HTTP_FIELD_URL) && tx->request_uri != NULL) {
         const size_t size = bstr_len(tx->request_uri) * 2 + 1;
         char string[size];
         BytesToStringBuffer(bstr_ptr(tx->request_uri), bstr_len(tx->request_uri), string, size);
@@ -232,7 +268,8 @@ static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
 
     if (tx->request_headers != NULL) {
         /* user agent */
-        htp_header_t *h_user_agent = htp_table_get_c(tx->request_headers, "user-agent");
+        htp_header_t *h_user_agent = (fields & LOG_HTTP_FIELD_USER_AGENT) ?
+            htp_table_get_c(tx->request_headers, "user-agent") : NULL;
         if (h_user_agent != NULL) {
             const size_t size = bstr_len(h_user_agent->value) * 2 + 1;
             char string[size];
@@ -241,7 +278,8 @@ static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         }
 
         /* x-forwarded-for */
-        htp_header_t *h_x_forwarded_for = htp_table_get_c(tx->request_headers, "x-forwarded-for");
+        htp_header_t *h_x_forwarded_for = (fields & LOG_HTTP_FIELD_XFF) ?
+            htp_table_get_c(tx->request_headers, "x-forwarded-for") : NULL;
         if (h_x_forwarded_for != NULL) {
             const size_t size = bstr_len(h_x_forwarded_for->value) * 2 + 1;
             char string[size];
@@ -252,7 +290,8 @@ static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
 
     /* content-type */
     if (tx->response_headers != NULL) {
-        htp_header_t *h_content_type = htp_table_get_c(tx->response_headers, "content-type");
+        htp_header_t *h_content_type = (fields & LOG_HTTP_FIELD_CONTENT_TYPE) ?
+            htp_table_get_c(tx->response_headers, "content-type") : NULL;
         if (h_content_type != NULL) {
             const size_t size = bstr_len(h_content_type->value) * 2 + 1;
             char string[size];
@@ -262,7 +301,8 @@ static void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
                 *p = '\0';
             json_object_set_new(js, "http_content_type", SCJsonString(string));
         }
-        htp_header_t *h_content_range = htp_table_get_c(tx->response_headers, "content-range");
+        htp_header_t *h_content_range = (fields & LOG_HTTP_FIELD_CONTENT_RANGE) ?
+            htp_table_get_c(tx->response_headers, "content-range") : NULL;
         if (h_content_range != NULL) {
             const size_t size = bstr_len(h_content_range->value) * 2 + 1;
             char string[size];
@@ -327,11 +367,12 @@ static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, json_t *js, htp_tx_t
     }
 }
 
-static void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
+static void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx, uint64_t fields,
+        JsonStringCache *strings)
 {
     /* referer */
     htp_header_t *h_referer = NULL;
-    if (tx->request_headers != NULL) {
+    if ((fields & LOG_HTTP_FIELD_REFER) && tx->request_headers != NULL) {
         h_referer = htp_table_get_c(tx->request_headers, "referer");
     }
     if (h_referer != NULL) {
@@ -343,31 +384,34 @@ static void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
     }
 
     /* method */
-    if (tx->request_method != NULL) {
+    if ((fields & LOG_HTTP_FIELD_METHOD) && tx->request_method != NULL) {
         const size_t size = bstr_len(tx->request_method) * 2 + 1;
         char string[size];
         BytesToStringBuffer(bstr_ptr(tx->request_method), bstr_len(tx->request_method), string, size);
-        json_object_set_new(js, "http_method", SCJsonString(string));
+        json_object_set_new(js, "http_method", JsonStringCacheGet(strings, string));
     }
 
     /* protocol */
-    if (tx->request_protocol != NULL) {
+    if ((fields & LOG_HTTP_FIELD_PROTOCOL) && tx->request_protocol != NULL) {
         const size_t size = bstr_len(tx->request_protocol) * 2 + 1;
         char string[size];
         BytesToStringBuffer(bstr_ptr(tx->request_protocol), bstr_len(tx->request_protocol), string, size);
-        json_object_set_new(js, "protocol", SCJsonString(string));
+        json_object_set_new(js, "protocol", JsonStringCacheGet(strings, string));
     }
 
     /* response status */
     if (tx->response_status != NULL) {
-        const size_t status_size = bstr_len(tx->response_status) * 2 + 1;
-        char status_string[status_size];
-        BytesToStringBuffer(bstr_ptr(tx->response_status), bstr_len(tx->response_status),
-                status_string, status_size);
-        unsigned int val = strtoul(status_string, NULL, 10);
-        json_object_set_new(js, "status", json_integer(val));
-
-        htp_header_t *h_location = htp_table_get_c(tx->response_headers, "location");
+        if (fields & LOG_HTTP_FIELD_STATUS) {
+            const size_t status_size = bstr_len(tx->response_status) * 2 + 1;
+            char status_string[status_size];
+            BytesToStringBuffer(bstr_ptr(tx->response_status), bstr_len(tx->response_status),
+                    status_string, status_size);
+            unsigned int val = strtoul(status_string, NULL, 10);
+            json_object_set_new(js, "status", json_integer(val));
+        }
+
+        htp_header_t *h_location = (fields & LOG_HTTP_FIELD_REDIRECT) ?
+            htp_table_get_c(tx->response_headers, "location") : NULL;
         if (h_location != NULL) {
             const size_t size = bstr_len(h_location->value) * 2 + 1;
             char string[size];
@@ -377,7 +421,9 @@ static void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
     }
 
     /* length */
-    json_object_set_new(js, "length", json_integer(tx->response_message_len));
+    if (fields & LOG_HTTP_FIELD_LENGTH) {
+        json_object_set_new(js, "length", json_integer(tx->response_message_len));
+    }
 }
 
 static void JsonHttpLogJSONHeaders(json_t *js, uint32_t direction, htp_tx_t *tx)
@@ -498,12 +544,12 @@ static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx, ui
         return;
     }
 
-    JsonHttpLogJSONBasic(hjs, tx);
+    JsonHttpLogJSONBasic(hjs, tx, http_ctx->log_fields);
     /* log custom fields if configured */
     if (http_ctx->fields != 0)
         JsonHttpLogJSONCustom(http_ctx, hjs, tx);
     if (http_ctx->flags & LOG_HTTP_EXTENDED)
-        JsonHttpLogJSONExtended(hjs, tx);
+        JsonHttpLogJSONExtended(hjs, tx, http_ctx->log_fields, aft->strings);
     if (http_ctx->flags & LOG_HTTP_REQ_HEADERS)
         JsonHttpLogJSONHeaders(hjs, LOG_HTTP_REQ_HEADERS, tx);
     if (http_ctx->flags & LOG_HTTP_RES_HEADERS)
@@ -519,6 +565,9 @@ static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Fl
     htp_tx_t *tx = txptr;
     JsonHttpLogThread *jhl = (JsonHttpLogThread *)thread_data;
 
+    if (!OutputJsonSampleFlow(&jhl->httplog_ctx->cfg, f))
+        return TM_ECODE_OK;
+
     json_t *js = CreateJSONHeaderWithTxId(p, LOG_DIR_FLOW, "http", tx_id);
     if (unlikely(js == NULL))
         return TM_ECODE_OK;
@@ -575,8 +624,8 @@ json_t *JsonHttpAddMetadata(const Flow *f, uint64_t tx_id)
             if (unlikely(hjs == NULL))
                 return NULL;
 
-            JsonHttpLogJSONBasic(hjs, tx);
-            JsonHttpLogJSONExtended(hjs, tx);
+            JsonHttpLogJSONBasic(hjs, tx, LOG_HTTP_FIELD_ALL);
+            JsonHttpLogJSONExtended(hjs, tx, LOG_HTTP_FIELD_ALL, NULL);
             return hjs;
         }
     }
@@ -611,7 +660,7 @@ static OutputInitResult OutputHttpLogInit(ConfNode *conf)
         return result;
     }
 
-    LogHttpFileCtx *http_ctx = SCMalloc(sizeof(LogHttpFileCtx));
+    LogHttpFileCtx *http_ctx = SCCalloc(1, sizeof(LogHttpFileCtx));
     if (unlikely(http_ctx == NULL)) {
         LogFileFreeCtx(file_ctx);
         return result;
@@ -626,6 +675,7 @@ static OutputInitResult OutputHttpLogInit(ConfNode *conf)
 
     http_ctx->file_ctx = file_ctx;
     http_ctx->flags = LOG_HTTP_DEFAULT;
+    http_ctx->log_fields = LOG_HTTP_FIELD_ALL;
 
     if (conf) {
         const char *extended = ConfNodeLookupChildValue(conf, "extended");
@@ -692,9 +742,18 @@ static OutputInitResult OutputHttpLogInitSub(ConfNode *conf, OutputCtx *parent_c
 
     http_ctx->file_ctx = ojc->file_ctx;
     http_ctx->flags = LOG_HTTP_DEFAULT;
+    http_ctx->log_fields = LOG_HTTP_FIELD_ALL;
     http_ctx->cfg = ojc->cfg;
 
     if (conf) {
+        if (OutputJsonParseSampleRate(conf, &http_ctx->cfg) < 0 ||
+                OutputJsonParseFields(conf, http_log_fields,
+                    &http_ctx->log_fields) < 0) {
+            SCFree(http_ctx);
+            SCFree(output_ctx);
+            return result;
+        }
+
         const char *extended = ConfNodeLookupChildValue(conf, "extended");
 
         if (extended != NULL) {
@@ -783,6 +842,13 @@ static TmEcode JsonHttpLogThreadInit(ThreadVars *t, const void *initdata, void *
         return TM_ECODE_FAILED;
     }
 
+    aft->strings = JsonStringCacheInit();
+    if (aft->strings == NULL) {
+        MemBufferFree(aft->buffer);
+        SCFree(aft);
+        return TM_ECODE_FAILED;
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -795,6 +861,7 @@ static TmEcode JsonHttpLogThreadDeinit(ThreadVars *t, void *data)
     }
 
     MemBufferFree(aft->buffer);
+    JsonStringCacheFree(aft->strings);
     /* clear memory */
     memset(aft, 0, sizeof(JsonHttpLogThread));
 
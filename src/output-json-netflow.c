@@ -64,233 +64,109 @@ typedef struct JsonNetFlowLogThread_ {
 } JsonNetFlowLogThread;
 
 
-static json_t *CreateJSONHeaderFromFlow(const Flow *f, const char *event_type, int dir)
+/* JSON format logging */
+static void JsonNetFlowLogJSONToServer(JsonNetFlowLogThread *aft, JsonBuilder *jb, Flow *f)
 {
-    char timebuf[64];
-    char srcip[46] = {0}, dstip[46] = {0};
-    Port sp, dp;
-
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
-    struct timeval tv;
-    memset(&tv, 0x00, sizeof(tv));
-    TimeGet(&tv);
-
-    CreateIsoTimeString(&tv, timebuf, sizeof(timebuf));
-
-    /* reverse header direction if the flow started out wrong */
-    dir ^= ((f->flags & FLOW_DIR_REVERSED) != 0);
-
-    if (FLOW_IS_IPV4(f)) {
-        if (dir == 0) {
-            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), dstip, sizeof(dstip));
-        } else {
-            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), dstip, sizeof(dstip));
-        }
-    } else if (FLOW_IS_IPV6(f)) {
-        if (dir == 0) {
-            PrintInet(AF_INET6, (const void *)&(f->src.address), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)&(f->dst.address), dstip, sizeof(dstip));
-        } else {
-            PrintInet(AF_INET6, (const void *)&(f->dst.address), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)&(f->src.address), dstip, sizeof(dstip));
-        }
-    }
-
-    if (dir == 0) {
-        sp = f->sp;
-        dp = f->dp;
-    } else {
-        sp = f->dp;
-        dp = f->sp;
-    }
-
-    char proto[16];
-    if (SCProtoNameValid(f->proto) == TRUE) {
-        strlcpy(proto, known_proto[f->proto], sizeof(proto));
-    } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, f->proto);
-    }
-
-    /* time */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
-
-    CreateJSONFlowId(js, (const Flow *)f);
-
-#if 0 // TODO
-    /* sensor id */
-    if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
-#endif
-
-    /* input interface */
-    if (f->livedev) {
-        json_object_set_new(js, "in_iface", json_string(f->livedev->dev));
-    }
-
-    if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
-    }
-
-    /* vlan */
-    if (f->vlan_idx > 0) {
-        json_t *js_vlan = json_array();
-        json_array_append_new(js_vlan, json_integer(f->vlan_id[0]));
-        if (f->vlan_idx > 1) {
-            json_array_append_new(js_vlan, json_integer(f->vlan_id[1]));
-        }
-        json_object_set_new(js, "vlan", js_vlan);
-    }
-
-    /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
-    switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
-        case IPPROTO_UDP:
-        case IPPROTO_TCP:
-        case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
-            break;
-    }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
-    switch(f->proto) {
-        case IPPROTO_ICMP:
-            break;
-        case IPPROTO_UDP:
-        case IPPROTO_TCP:
-        case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
-            break;
-    }
-    json_object_set_new(js, "proto", json_string(proto));
     switch (f->proto) {
         case IPPROTO_ICMP:
         case IPPROTO_ICMPV6: {
-            uint8_t type = f->icmp_s.type;
-            uint8_t code = f->icmp_s.code;
-            if (dir == 1) {
-                type = f->icmp_d.type;
-                code = f->icmp_d.code;
-
-            }
-            json_object_set_new(js, "icmp_type", json_integer(type));
-            json_object_set_new(js, "icmp_code", json_integer(code));
+            const bool reversed = (f->flags & FLOW_DIR_REVERSED) != 0;
+            JbSetUint(jb, "icmp_type", reversed ? f->icmp_d.type : f->icmp_s.type);
+            JbSetUint(jb, "icmp_code", reversed ? f->icmp_d.code : f->icmp_s.code);
             break;
         }
     }
-    return js;
-}
-
-/* JSON format logging */
-static void JsonNetFlowLogJSONToServer(JsonNetFlowLogThread *aft, json_t *js, Flow *f)
-{
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
 
-    json_object_set_new(js, "app_proto",
-            json_string(AppProtoToString(f->alproto_ts ? f->alproto_ts : f->alproto)));
+    JbSetString(jb, "app_proto",
+            AppProtoToString(f->alproto_ts ? f->alproto_ts : f->alproto));
 
-    json_object_set_new(hjs, "pkts",
-            json_integer(f->todstpktcnt));
-    json_object_set_new(hjs, "bytes",
-            json_integer(f->todstbytecnt));
+    JbOpenObject(jb, "netflow");
+    JbSetUint(jb, "pkts", f->todstpktcnt);
+    JbSetUint(jb, "bytes", f->todstbytecnt);
 
     char timebuf1[64], timebuf2[64];
 
     CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
 
-    json_object_set_new(hjs, "start", json_string(timebuf1));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JbSetString(jb, "start", timebuf1);
+    JbSetString(jb, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JbSetInt(jb, "age", age);
 
-    json_object_set_new(hjs, "min_ttl", json_integer(f->min_ttl_toserver));
-    json_object_set_new(hjs, "max_ttl", json_integer(f->max_ttl_toserver));
-
-    json_object_set_new(js, "netflow", hjs);
+    JbSetUint(jb, "min_ttl", f->min_ttl_toserver);
+    JbSetUint(jb, "max_ttl", f->max_ttl_toserver);
+    JbClose(jb);
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
+        JbOpenObject(jb, "tcp");
 
         TcpSession *ssn = f->protoctx;
 
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->client.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JbSetString(jb, "tcp_flags", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->client.tcp_flags : 0, tjs);
+        JbTcpFlags(ssn ? ssn->client.tcp_flags : 0, jb);
 
-        json_object_set_new(js, "tcp", tjs);
+        JbClose(jb);
     }
 }
 
-static void JsonNetFlowLogJSONToClient(JsonNetFlowLogThread *aft, json_t *js, Flow *f)
+static void JsonNetFlowLogJSONToClient(JsonNetFlowLogThread *aft, JsonBuilder *jb, Flow *f)
 {
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
+    switch (f->proto) {
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6: {
+            const bool reversed = (f->flags & FLOW_DIR_REVERSED) != 0;
+            JbSetUint(jb, "icmp_type", reversed ? f->icmp_s.type : f->icmp_d.type);
+            JbSetUint(jb, "icmp_code", reversed ? f->icmp_s.code : f->icmp_d.code);
+            break;
+        }
     }
 
-    json_object_set_new(js, "app_proto",
-            json_string(AppProtoToString(f->alproto_tc ? f->alproto_tc : f->alproto)));
+    JbSetString(jb, "app_proto",
+            AppProtoToString(f->alproto_tc ? f->alproto_tc : f->alproto));
 
-    json_object_set_new(hjs, "pkts",
-            json_integer(f->tosrcpktcnt));
-    json_object_set_new(hjs, "bytes",
-            json_integer(f->tosrcbytecnt));
+    JbOpenObject(jb, "netflow");
+    JbSetUint(jb, "pkts", f->tosrcpktcnt);
+    JbSetUint(jb, "bytes", f->tosrcbytecnt);
 
     char timebuf1[64], timebuf2[64];
 
     CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
 
-    json_object_set_new(hjs, "start", json_string(timebuf1));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JbSetString(jb, "start", timebuf1);
+    JbSetString(jb, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JbSetInt(jb, "age", age);
 
     /* To client is zero if we did not see any packet */
     if (f->tosrcpktcnt) {
-        json_object_set_new(hjs, "min_ttl", json_integer(f->min_ttl_toclient));
-        json_object_set_new(hjs, "max_ttl", json_integer(f->max_ttl_toclient));
+        JbSetUint(jb, "min_ttl", f->min_ttl_toclient);
+        JbSetUint(jb, "max_ttl", f->max_ttl_toclient);
     }
-
-    json_object_set_new(js, "netflow", hjs);
+    JbClose(jb);
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
+        JbOpenObject(jb, "tcp");
 
         TcpSession *ssn = f->protoctx;
 
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JbSetString(jb, "tcp_flags", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->server.tcp_flags : 0, tjs);
+        JbTcpFlags(ssn ? ssn->server.tcp_flags : 0, jb);
 
-        json_object_set_new(js, "tcp", tjs);
+        JbClose(jb);
     }
 }
 
@@ -299,32 +175,24 @@ static int JsonNetFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
     SCEnter();
     JsonNetFlowLogThread *jhl = (JsonNetFlowLogThread *)thread_data;
     LogJsonFileCtx *netflow_ctx = jhl->flowlog_ctx;
+    JsonBuilder jb;
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-    json_t *js = CreateJSONHeaderFromFlow(f, "netflow", 0);
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-    JsonNetFlowLogJSONToServer(jhl, js, f);
-    JsonAddCommonOptions(&netflow_ctx->cfg, NULL, f, js);
-    OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "netflow");
-    json_object_clear(js);
-    json_decref(js);
+    if (!OutputJsonSampleFlow(&netflow_ctx->cfg, f))
+        SCReturnInt(TM_ECODE_OK);
+
+    OutputJsonBuilderStart(&jb, netflow_ctx->file_ctx, &jhl->buffer);
+    CreateEveHeaderFromFlow(&jb, f, "netflow", 0);
+    JsonNetFlowLogJSONToServer(jhl, &jb, f);
+    JbAddCommonOptions(&netflow_ctx->cfg, NULL, f, &jb);
+    OutputJsonBuilderBuffer(&jb, netflow_ctx->file_ctx, &jhl->buffer);
 
     /* only log a response record if we actually have seen response packets */
     if (f->tosrcpktcnt) {
-        /* reset */
-        MemBufferReset(jhl->buffer);
-        js = CreateJSONHeaderFromFlow(f, "netflow", 1);
-        if (unlikely(js == NULL))
-            return TM_ECODE_OK;
-        JsonNetFlowLogJSONToClient(jhl, js, f);
-        JsonAddCommonOptions(&netflow_ctx->cfg, NULL, f, js);
-        OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-        json_object_del(js, "netflow");
-        json_object_clear(js);
-        json_decref(js);
+        OutputJsonBuilderStart(&jb, netflow_ctx->file_ctx, &jhl->buffer);
+        CreateEveHeaderFromFlow(&jb, f, "netflow", 1);
+        JsonNetFlowLogJSONToClient(jhl, &jb, f);
+        JbAddCommonOptions(&netflow_ctx->cfg, NULL, f, &jb);
+        OutputJsonBuilderBuffer(&jb, netflow_ctx->file_ctx, &jhl->buffer);
     }
     SCReturnInt(TM_ECODE_OK);
 }
@@ -353,7 +221,7 @@ static OutputInitResult OutputNetFlowLogInit(ConfNode *conf)
         return result;
     }
 
-    LogJsonFileCtx *flow_ctx = SCMalloc(sizeof(LogJsonFileCtx));
+    LogJsonFileCtx *flow_ctx = SCCalloc(1, sizeof(LogJsonFileCtx));
     if (unlikely(flow_ctx == NULL)) {
         LogFileFreeCtx(file_ctx);
         return result;
@@ -387,7 +255,7 @@ static OutputInitResult OutputNetFlowLogInitSub(ConfNode *conf, OutputCtx *paren
     OutputInitResult result = { NULL, false };
     OutputJsonCtx *ojc = parent_ctx->data;
 
-    LogJsonFileCtx *flow_ctx = SCMalloc(sizeof(LogJsonFileCtx));
+    LogJsonFileCtx *flow_ctx = SCCalloc(1, sizeof(LogJsonFileCtx));
     if (unlikely(flow_ctx == NULL))
         return result;
 
@@ -399,6 +267,11 @@ static OutputInitResult OutputNetFlowLogInitSub(ConfNode *conf, OutputCtx *paren
 
     flow_ctx->file_ctx = ojc->file_ctx;
     flow_ctx->cfg = ojc->cfg;
+    if (OutputJsonParseSampleRate(conf, &flow_ctx->cfg) < 0) {
+        SCFree(flow_ctx);
+        SCFree(output_ctx);
+        return result;
+    }
 
     output_ctx->data = flow_ctx;
     output_ctx->DeInit = OutputNetFlowLogDeinitSub;
@@ -85,6 +85,8 @@ static int JsonNFSLogger(ThreadVars *tv, void *thread_data,
 
     if (rs_nfs_tx_logging_is_filtered(state, nfstx))
         return TM_ECODE_OK;
+    if (!OutputJsonSampleFlow(&thread->ctx->cfg, f))
+        return TM_ECODE_OK;
 
     json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "nfs");
     if (unlikely(js == NULL)) {
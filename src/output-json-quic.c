@@ -0,0 +1,186 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implement JSON/eve logging app-layer QUIC.
+ */
+
+#include "suricata-common.h"
+#include "debug.h"
+#include "detect.h"
+#include "pkt-var.h"
+#include "conf.h"
+
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+
+#include "util-unittest.h"
+#include "util-buffer.h"
+#include "util-debug.h"
+#include "util-byte.h"
+
+#include "output.h"
+#include "output-json.h"
+
+#include "app-layer.h"
+#include "app-layer-parser.h"
+
+#include "app-layer-quic.h"
+#include "output-json-quic.h"
+
+#if defined(HAVE_LIBJANSSON) && defined(HAVE_RUST)
+
+#include "rust.h"
+#include "rust-quic-logger-gen.h"
+
+typedef struct LogQUICFileCtx_ {
+    LogFileCtx *file_ctx;
+    uint32_t    flags;
+} LogQUICFileCtx;
+
+typedef struct LogQUICLogThread_ {
+    LogQUICFileCtx *quiclog_ctx;
+    uint32_t        count;
+    MemBuffer      *buffer;
+} LogQUICLogThread;
+
+static int JsonQUICLogger(ThreadVars *tv, void *thread_data,
+    const Packet *p, Flow *f, void *state, void *tx, uint64_t tx_id)
+{
+    LogQUICLogThread *thread = thread_data;
+
+    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "quic");
+    if (unlikely(js == NULL)) {
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *quicjs = rs_quic_logger_log(tx);
+    if (unlikely(quicjs == NULL)) {
+        goto error;
+    }
+
+    json_object_set_new(js, "quic", quicjs);
+
+    MemBufferReset(thread->buffer);
+    OutputJSONBuffer(js, thread->quiclog_ctx->file_ctx, &thread->buffer);
+
+    json_decref(js);
+    return TM_ECODE_OK;
+
+error:
+    json_decref(js);
+    return TM_ECODE_FAILED;
+}
+
+static void OutputQUICLogDeInitCtxSub(OutputCtx *output_ctx)
+{
+    LogQUICFileCtx *quiclog_ctx = (LogQUICFileCtx *)output_ctx->data;
+    SCFree(quiclog_ctx);
+    SCFree(output_ctx);
+}
+
+static OutputInitResult OutputQUICLogInitSub(ConfNode *conf,
+    OutputCtx *parent_ctx)
+{
+    OutputInitResult result = { NULL, false };
+    OutputJsonCtx *ajt = parent_ctx->data;
+
+    LogQUICFileCtx *quiclog_ctx = SCCalloc(1, sizeof(*quiclog_ctx));
+    if (unlikely(quiclog_ctx == NULL)) {
+        return result;
+    }
+    quiclog_ctx->file_ctx = ajt->file_ctx;
+
+    OutputCtx *output_ctx = SCCalloc(1, sizeof(*output_ctx));
+    if (unlikely(output_ctx == NULL)) {
+        SCFree(quiclog_ctx);
+        return result;
+    }
+    output_ctx->data = quiclog_ctx;
+    output_ctx->DeInit = OutputQUICLogDeInitCtxSub;
+
+    SCLogDebug("QUIC log sub-module initialized.");
+
+    AppLayerParserRegisterLogger(IPPROTO_UDP, ALPROTO_QUIC);
+
+    result.ctx = output_ctx;
+    result.ok = true;
+    return result;
+}
+
+#define OUTPUT_BUFFER_SIZE 65535
+
+static TmEcode JsonQUICLogThreadInit(ThreadVars *t, const void *initdata, void **data)
+{
+    LogQUICLogThread *thread = SCCalloc(1, sizeof(*thread));
+    if (unlikely(thread == NULL)) {
+        return TM_ECODE_FAILED;
+    }
+
+    if (initdata == NULL) {
+        SCLogDebug("Error getting context for EveLogQUIC.  \"initdata\" is NULL.");
+        SCFree(thread);
+        return TM_ECODE_FAILED;
+    }
+
+    thread->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
+    if (unlikely(thread->buffer == NULL)) {
+        SCFree(thread);
+        return TM_ECODE_FAILED;
+    }
+
+    thread->quiclog_ctx = ((OutputCtx *)initdata)->data;
+    *data = (void *)thread;
+
+    return TM_ECODE_OK;
+}
+
+static TmEcode JsonQUICLogThreadDeinit(ThreadVars *t, void *data)
+{
+    LogQUICLogThread *thread = (LogQUICLogThread *)data;
+    if (thread == NULL) {
+        return TM_ECODE_OK;
+    }
+    if (thread->buffer != NULL) {
+        MemBufferFree(thread->buffer);
+    }
+    SCFree(thread);
+    return TM_ECODE_OK;
+}
+
+void JsonQUICLogRegister(void)
+{
+    /* Register as an eve sub-module. */
+    OutputRegisterTxSubModule(LOGGER_JSON_QUIC, "eve-log", "JsonQUICLog",
+                              "eve-log.quic", OutputQUICLogInitSub,
+                              ALPROTO_QUIC, JsonQUICLogger,
+                              JsonQUICLogThreadInit, JsonQUICLogThreadDeinit,
+                              NULL);
+
+    SCLogDebug("QUIC JSON logger registered.");
+}
+
+#else /* No JSON support. */
+
+void JsonQUICLogRegister(void)
+{
+}
+
+#endif /* HAVE_LIBJANSSON */
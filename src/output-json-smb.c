@@ -68,6 +68,9 @@ static int JsonSMBLogger(ThreadVars *tv, void *thread_data,
     OutputJsonThreadCtx *thread = thread_data;
     json_t *js, *smbjs;
 
+    if (!OutputJsonSampleFlow(&thread->ctx->cfg, f))
+        return TM_ECODE_OK;
+
     js = CreateJSONHeader(p, LOG_DIR_FLOW, "smb");
     if (unlikely(js == NULL)) {
         return TM_ECODE_FAILED;
@@ -77,6 +77,7 @@ SC_ATOMIC_DECLARE(unsigned int, cert_id);
 #define LOG_TLS_FIELD_CHAIN             (1 << 9)
 #define LOG_TLS_FIELD_SESSION_RESUMED   (1 << 10)
 #define LOG_TLS_FIELD_JA3               (1 << 11)
+#define LOG_TLS_FIELD_JA3S              (1 << 12)
 
 typedef struct {
     const char *name;
@@ -96,6 +97,7 @@ TlsFields tls_fields[] = {
     { "chain",           LOG_TLS_FIELD_CHAIN },
     { "session_resumed", LOG_TLS_FIELD_SESSION_RESUMED },
     { "ja3",             LOG_TLS_FIELD_JA3 },
+    { "ja3s",            LOG_TLS_FIELD_JA3S },
     { NULL,              -1 }
 };
 
@@ -110,6 +112,8 @@ typedef struct OutputTlsCtx_ {
 typedef struct JsonTlsLogThread_ {
     OutputTlsCtx *tlslog_ctx;
     MemBuffer *buffer;
+    /** cached json strings for the version */
+    JsonStringCache *strings;
 } JsonTlsLogThread;
 
 static void JsonTlsLogSubject(json_t *js, SSLState *ssl_state)
@@ -166,11 +170,12 @@ static void JsonTlsLogSerial(json_t *js, SSLState *ssl_state)
     }
 }
 
-static void JsonTlsLogVersion(json_t *js, SSLState *ssl_state)
+static void JsonTlsLogVersion(json_t *js, SSLState *ssl_state,
+        JsonStringCache *strings)
 {
     char ssl_version[SSL_VERSION_MAX_STRLEN];
     SSLVersionToString(ssl_state->server_connp.version, ssl_version);
-    json_object_set_new(js, "version", json_string(ssl_version));
+    json_object_set_new(js, "version", JsonStringCacheGet(strings, ssl_version));
 }
 
 static void JsonTlsLogNotBefore(json_t *js, SSLState *ssl_state)
@@ -225,6 +230,21 @@ static void JsonTlsLogJa3(json_t *js, SSLState *ssl_state)
     json_object_set_new(js, "ja3", tjs);
 }
 
+static void JsonTlsLogJa3S(json_t *js, SSLState *ssl_state)
+{
+    if (ssl_state->ja3s_str == NULL)
+        return;
+
+    json_t *tjs = json_object();
+    if (unlikely(tjs == NULL))
+        return;
+
+    json_object_set_new(tjs, "hash", json_string(ssl_state->ja3s_hash));
+    json_object_set_new(tjs, "string", json_string(ssl_state->ja3s_str->data));
+
+    json_object_set_new(js, "ja3s", tjs);
+}
+
 static void JsonTlsLogCertificate(json_t *js, SSLState *ssl_state)
 {
     if (TAILQ_EMPTY(&ssl_state->server_connp.certs)) {
@@ -281,7 +301,7 @@ void JsonTlsLogJSONBasic(json_t *js, SSLState *ssl_state)
 }
 
 static void JsonTlsLogJSONCustom(OutputTlsCtx *tls_ctx, json_t *js,
-                                 SSLState *ssl_state)
+                                 SSLState *ssl_state, JsonStringCache *strings)
 {
     /* tls subject */
     if (tls_ctx->fields & LOG_TLS_FIELD_SUBJECT)
@@ -309,7 +329,7 @@ static void JsonTlsLogJSONCustom(OutputTlsCtx *tls_ctx, json_t *js,
 
     /* tls version */
     if (tls_ctx->fields & LOG_TLS_FIELD_VERSION)
-        JsonTlsLogVersion(js, ssl_state);
+        JsonTlsLogVersion(js, ssl_state, strings);
 
     /* tls notbefore */
     if (tls_ctx->fields & LOG_TLS_FIELD_NOTBEFORE)
@@ -330,9 +350,14 @@ static void JsonTlsLogJSONCustom(OutputTlsCtx *tls_ctx, json_t *js,
     /* tls ja3_hash */
     if (tls_ctx->fields & LOG_TLS_FIELD_JA3)
         JsonTlsLogJa3(js, ssl_state);
+
+    /* tls ja3s */
+    if (tls_ctx->fields & LOG_TLS_FIELD_JA3S)
+        JsonTlsLogJa3S(js, ssl_state);
 }
 
-void JsonTlsLogJSONExtended(json_t *tjs, SSLState * state)
+static void JsonTlsLogJSONExtendedCached(json_t *tjs, SSLState *state,
+        JsonStringCache *strings)
 {
     JsonTlsLogJSONBasic(tjs, state);
 
@@ -346,7 +371,7 @@ void JsonTlsLogJSONExtended(json_t *tjs, SSLState * state)
     JsonTlsLogSni(tjs, state);
 
     /* tls version */
-    JsonTlsLogVersion(tjs, state);
+    JsonTlsLogVersion(tjs, state, strings);
 
     /* tls notbefore */
     JsonTlsLogNotBefore(tjs, state);
@@ -356,6 +381,14 @@ void JsonTlsLogJSONExtended(json_t *tjs, SSLState * state)
 
     /* tls ja3 */
     JsonTlsLogJa3(tjs, state);
+
+    /* tls ja3s */
+    JsonTlsLogJa3S(tjs, state);
+}
+
+void JsonTlsLogJSONExtended(json_t *tjs, SSLState *state)
+{
+    JsonTlsLogJSONExtendedCached(tjs, state, NULL);
 }
 
 static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
@@ -369,6 +402,10 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
         return 0;
     }
 
+    if (!OutputJsonSampleFlow(&tls_ctx->cfg, f)) {
+        return 0;
+    }
+
     if ((ssl_state->server_connp.cert0_issuerdn == NULL ||
             ssl_state->server_connp.cert0_subject == NULL) &&
             ((ssl_state->flags & SSL_AL_FLAG_SESSION_RESUMED) == 0 ||
@@ -395,11 +432,11 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
 
     /* log custom fields */
     if (tls_ctx->flags & LOG_TLS_CUSTOM) {
-        JsonTlsLogJSONCustom(tls_ctx, tjs, ssl_state);
+        JsonTlsLogJSONCustom(tls_ctx, tjs, ssl_state, aft->strings);
     }
     /* log extended */
     else if (tls_ctx->flags & LOG_TLS_EXTENDED) {
-        JsonTlsLogJSONExtended(tjs, ssl_state);
+        JsonTlsLogJSONExtendedCached(tjs, ssl_state, aft->strings);
     }
     /* log basic */
     else {
@@ -446,6 +483,13 @@ static TmEcode JsonTlsLogThreadInit(ThreadVars *t, const void *initdata, void **
         return TM_ECODE_FAILED;
     }
 
+    aft->strings = JsonStringCacheInit();
+    if (aft->strings == NULL) {
+        MemBufferFree(aft->buffer);
+        SCFree(aft);
+        return TM_ECODE_FAILED;
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -458,6 +502,7 @@ static TmEcode JsonTlsLogThreadDeinit(ThreadVars *t, void *data)
     }
 
     MemBufferFree(aft->buffer);
+    JsonStringCacheFree(aft->strings);
 
     /* clear memory */
     memset(aft, 0, sizeof(JsonTlsLogThread));
@@ -477,7 +522,7 @@ static void OutputTlsLogDeinit(OutputCtx *output_ctx)
 
 static OutputTlsCtx *OutputTlsInitCtx(ConfNode *conf)
 {
-    OutputTlsCtx *tls_ctx = SCMalloc(sizeof(OutputTlsCtx));
+    OutputTlsCtx *tls_ctx = SCCalloc(1, sizeof(OutputTlsCtx));
     if (unlikely(tls_ctx == NULL))
         return NULL;
 
@@ -515,10 +560,10 @@ static OutputTlsCtx *OutputTlsInitCtx(ConfNode *conf)
         tls_ctx->flags |= LOG_TLS_SESSION_RESUMPTION;
     }
 
-    if ((tls_ctx->fields & LOG_TLS_FIELD_JA3) &&
+    if ((tls_ctx->fields & (LOG_TLS_FIELD_JA3 | LOG_TLS_FIELD_JA3S)) &&
             Ja3IsDisabled("fields")) {
         /* JA3 is disabled, so don't log any JA3 fields */
-        tls_ctx->fields &= ~LOG_TLS_FIELD_JA3;
+        tls_ctx->fields &= ~(LOG_TLS_FIELD_JA3 | LOG_TLS_FIELD_JA3S);
     }
 
     if ((tls_ctx->fields & LOG_TLS_FIELD_CERTIFICATE) &&
@@ -595,6 +640,11 @@ static OutputInitResult OutputTlsLogInitSub(ConfNode *conf, OutputCtx *parent_ct
 
     tls_ctx->file_ctx = ojc->file_ctx;
     tls_ctx->cfg = ojc->cfg;
+    if (OutputJsonParseSampleRate(conf, &tls_ctx->cfg) < 0) {
+        SCFree(tls_ctx);
+        SCFree(output_ctx);
+        return result;
+    }
 
     if ((tls_ctx->fields & LOG_TLS_FIELD_CERTIFICATE) &&
             (tls_ctx->fields & LOG_TLS_FIELD_CHAIN)) {
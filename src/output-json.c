@@ -50,6 +50,7 @@
 #include "output-json.h"
 
 #include "util-byte.h"
+#include "util-geoip.h"
 #include "util-privs.h"
 #include "util-print.h"
 #include "util-proto-name.h"
@@ -57,12 +58,16 @@
 #include "util-buffer.h"
 #include "util-logopenfile.h"
 #include "util-log-redis.h"
+#include "util-log-kafka.h"
 #include "util-device.h"
 #include "util-validate.h"
 #include "util-crypt.h"
+#include "util-misc.h"
+#include "util-hash-open.h"
 
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-storage.h"
 
 #include "source-pcap-file.h"
 
@@ -98,10 +103,33 @@ static const char *TRAFFIC_LABEL_PREFIX = "traffic/label/";
 static size_t traffic_id_prefix_len = 0;
 static size_t traffic_label_prefix_len = 0;
 
+/** header fields that are the same for every record of a flow, filled
+ *  in on first use and kept in the flow storage */
+typedef struct OutputJsonFlowCache_ {
+    char srcip[46];
+    char dstip[46];
+    bool community_id_set;
+    uint16_t community_id_seed;
+    char community_id[64];
+} OutputJsonFlowCache;
+
+static int g_flow_cache_id = -1;
+
+static OutputJsonFlowCache *OutputJsonFlowCacheGet(const Flow *f);
+
+static void OutputJsonFlowCacheFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
 void OutputJsonRegister (void)
 {
     OutputRegisterModule(MODULE_NAME, "eve-log", OutputJsonInitCtx);
 
+    /* most flows end up in a record, so no point in the late storage */
+    g_flow_cache_id = FlowStorageRegister("eve-header", sizeof(void *),
+            NULL, OutputJsonFlowCacheFree, 0);
+
     traffic_id_prefix_len = strlen(TRAFFIC_ID_PREFIX);
     traffic_label_prefix_len = strlen(TRAFFIC_LABEL_PREFIX);
 }
@@ -145,6 +173,106 @@ json_t *SCJsonString(const char *val)
     return retval;
 }
 
+/* strings up to this length are cached, longer ones are unlikely to be
+ * one of the few values that repeat a lot */
+#define JSON_STRING_CACHE_MAX_LEN       32
+#define JSON_STRING_CACHE_MAX_ENTRIES   256
+
+typedef struct JsonStringCacheEntry_ {
+    char *str;
+    json_t *js;
+} JsonStringCacheEntry;
+
+static inline uint32_t JsonStringCacheHash(const char *str)
+{
+    return OpenHashString(str, 0);
+}
+
+#define JsonStringCacheKey(e)       ((const char *)(e)->str)
+#define JsonStringCacheCmp(a, b)    (strcmp((a), (b)) == 0)
+
+OPEN_HASH_HEAD(JsonStringTable, JsonStringCacheEntry);
+OPEN_HASH_GENERATE(JsonStringTable, JsonStringCacheEntry, const char *,
+        JsonStringCacheHash, JsonStringCacheKey, JsonStringCacheCmp)
+
+struct JsonStringCache_ {
+    JsonStringTable *table;
+};
+
+/**
+ * \brief per thread cache of the json strings of values that repeat a lot,
+ *        like the HTTP method or the TLS version.
+ *
+ * A logger thread gets the cached json_t with a new reference instead of
+ * allocating and copying a new string for every record. The reference
+ * counts of jansson are not atomic, so a cache is only used by the thread
+ * that owns it, for records it writes out itself.
+ */
+JsonStringCache *JsonStringCacheInit(void)
+{
+    JsonStringCache *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    c->table = JsonStringTableInit(32);
+    if (c->table == NULL) {
+        SCFree(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void JsonStringCacheEntryFree(JsonStringCacheEntry *e)
+{
+    json_decref(e->js);
+    SCFree(e->str);
+    SCFree(e);
+}
+
+void JsonStringCacheFree(JsonStringCache *c)
+{
+    if (c == NULL)
+        return;
+    JsonStringTableFree(c->table, JsonStringCacheEntryFree);
+    SCFree(c);
+}
+
+/**
+ * \brief json string of val, from the cache if possible
+ *
+ * Without a cache, for long strings and once the cache is full, this is
+ * SCJsonString(). The cache keeps the first values it sees: it is meant
+ * for fields with a handful of common values, junk values past the limit
+ * are not cached.
+ *
+ * \retval js new reference, to be consumed with json_object_set_new()
+ */
+json_t *JsonStringCacheGet(JsonStringCache *c, const char *val)
+{
+    if (c == NULL || val == NULL || strlen(val) > JSON_STRING_CACHE_MAX_LEN)
+        return SCJsonString(val);
+
+    JsonStringCacheEntry *e = JsonStringTableLookup(c->table, val);
+    if (e != NULL)
+        return json_incref(e->js);
+
+    if (c->table->cnt >= JSON_STRING_CACHE_MAX_ENTRIES)
+        return SCJsonString(val);
+
+    e = SCCalloc(1, sizeof(*e));
+    if (unlikely(e == NULL))
+        return SCJsonString(val);
+    e->str = SCStrdup(val);
+    e->js = SCJsonString(val);
+    if (e->str == NULL || e->js == NULL ||
+            JsonStringTableAdd(c->table, e) != 0) {
+        json_t *js = e->js;
+        SCFree(e->str);
+        SCFree(e);
+        return js;
+    }
+    return json_incref(e->js);
+}
+
 /* Default Sensor ID value */
 static int64_t sensor_id = -1; /* -1 = not defined */
 
@@ -306,35 +434,37 @@ static void JsonAddFlowVars(const Flow *f, json_t *js_root, json_t **js_traffic)
 
             }
         } else if (gv->type == DETECT_FLOWBITS) {
-            FlowBit *fb = (FlowBit *)gv;
-            const char *varname = VarNameStoreLookupById(fb->idx,
-                    VAR_TYPE_FLOW_BIT);
-            if (varname) {
-                if (SCStringHasPrefix(varname, TRAFFIC_ID_PREFIX)) {
-                    if (js_traffic_id == NULL) {
-                        js_traffic_id = json_array();
-                        if (unlikely(js_traffic_id == NULL)) {
-                            break;
+            const FlowBit *fb = (const FlowBit *)gv;
+            for (uint32_t idx = 0; FlowBitNext(fb, &idx) == 1; idx++) {
+                const char *varname = VarNameStoreLookupById(idx,
+                        VAR_TYPE_FLOW_BIT);
+                if (varname) {
+                    if (SCStringHasPrefix(varname, TRAFFIC_ID_PREFIX)) {
+                        if (js_traffic_id == NULL) {
+                            js_traffic_id = json_array();
+                            if (unlikely(js_traffic_id == NULL)) {
+                                break;
+                            }
                         }
-                    }
-                    json_array_append_new(js_traffic_id,
-                            json_string(&varname[traffic_id_prefix_len]));
-                } else if (SCStringHasPrefix(varname, TRAFFIC_LABEL_PREFIX)) {
-                    if (js_traffic_label == NULL) {
-                        js_traffic_label = json_array();
-                        if (unlikely(js_traffic_label == NULL)) {
-                            break;
+                        json_array_append_new(js_traffic_id,
+                                json_string(&varname[traffic_id_prefix_len]));
+                    } else if (SCStringHasPrefix(varname, TRAFFIC_LABEL_PREFIX)) {
+                        if (js_traffic_label == NULL) {
+                            js_traffic_label = json_array();
+                            if (unlikely(js_traffic_label == NULL)) {
+                                break;
+                            }
                         }
+                        json_array_append_new(js_traffic_label,
+                                json_string(&varname[traffic_label_prefix_len]));
+                    } else {
+                        if (js_flowbits == NULL) {
+                            js_flowbits = json_array();
+                            if (unlikely(js_flowbits == NULL))
+                                break;
+                        }
+                        json_array_append_new(js_flowbits, json_string(varname));
                     }
-                    json_array_append_new(js_traffic_label,
-                            json_string(&varname[traffic_label_prefix_len]));
-                } else {
-                    if (js_flowbits == NULL) {
-                        js_flowbits = json_array();
-                        if (unlikely(js_flowbits == NULL))
-                            break;
-                    }
-                    json_array_append_new(js_flowbits, json_string(varname));
                 }
             }
         }
@@ -387,6 +517,41 @@ static void JsonAddMetadata(const Packet *p, const Flow *f, json_t *js)
     }
 }
 
+/**
+ * \brief Add the countries of the flow's client and server
+ *
+ * The countries are cached in the flow, so this is a lookup per flow
+ * side, shared with the geoip keyword.
+ */
+static void JbAddGeoip(const Flow *f, JsonBuilder *jb)
+{
+    /* only the flow's geoip cache is updated */
+    Flow *wf = (Flow *)f;
+    char client[3], server[3];
+    GeoipCountryToString(GeoipFlowCountry(wf, true), client);
+    GeoipCountryToString(GeoipFlowCountry(wf, false), server);
+
+    JbOpenObject(jb, "geoip");
+    JbSetString(jb, "client_country", client);
+    JbSetString(jb, "server_country", server);
+    JbClose(jb);
+}
+
+static void JsonAddGeoip(const Flow *f, json_t *js)
+{
+    Flow *wf = (Flow *)f;
+    char client[3], server[3];
+    GeoipCountryToString(GeoipFlowCountry(wf, true), client);
+    GeoipCountryToString(GeoipFlowCountry(wf, false), server);
+
+    json_t *geo = json_object();
+    if (unlikely(geo == NULL))
+        return;
+    json_object_set_new(geo, "client_country", json_string(client));
+    json_object_set_new(geo, "server_country", json_string(server));
+    json_object_set_new(js, "geoip", geo);
+}
+
 void JsonAddCommonOptions(const OutputJsonCommonSettings *cfg,
         const Packet *p, const Flow *f, json_t *js)
 {
@@ -396,6 +561,9 @@ void JsonAddCommonOptions(const OutputJsonCommonSettings *cfg,
     if (cfg->include_community_id && f != NULL) {
         CreateJSONCommunityFlowId(js, f, cfg->community_id_seed);
     }
+    if (cfg->include_geoip && f != NULL) {
+        JsonAddGeoip(f, js);
+    }
 }
 
 /**
@@ -444,6 +612,31 @@ void JsonTcpFlags(uint8_t flags, json_t *js)
         json_object_set_new(js, "cwr", json_true());
 }
 
+/**
+ * \brief Get the string of a packet address
+ *
+ * Addresses of the packet's flow come from the flow's header cache. Others,
+ * like the outer addresses of an icmp error, are formatted into buf.
+ */
+static const char *JsonPacketAddrString(const Packet *p, int af,
+        const void *addr, char *buf, size_t buf_len)
+{
+    const Flow *f = p->flow;
+    if (f != NULL && ((af == AF_INET && FLOW_IS_IPV4(f)) ||
+                (af == AF_INET6 && FLOW_IS_IPV6(f)))) {
+        OutputJsonFlowCache *c = OutputJsonFlowCacheGet(f);
+        if (c != NULL) {
+            const size_t len = (af == AF_INET) ? 4 : 16;
+            if (memcmp(addr, f->src.addr_data32, len) == 0)
+                return c->srcip;
+            if (memcmp(addr, f->dst.addr_data32, len) == 0)
+                return c->dstip;
+        }
+    }
+    PrintInet(af, addr, buf, buf_len);
+    return buf;
+}
+
 /**
  * \brief Add five tuple from packet to JSON object
  *
@@ -453,97 +646,55 @@ void JsonTcpFlags(uint8_t flags, json_t *js)
  */
 void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
 {
-    char srcip[46] = {0}, dstip[46] = {0};
+    char srcbuf[46] = {0}, dstbuf[46] = {0};
+    const char *srcip = srcbuf, *dstip = dstbuf;
     Port sp, dp;
     char proto[16];
+    bool swap;
 
     switch (dir) {
         case LOG_DIR_PACKET:
-            if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                        srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                        dstip, sizeof(dstip));
-            } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                        srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                        dstip, sizeof(dstip));
-            } else {
+            if (!PKT_IS_IPV4(p) && !PKT_IS_IPV6(p)) {
                 /* Not an IP packet so don't do anything */
                 return;
             }
-            sp = p->sp;
-            dp = p->dp;
+            swap = false;
             break;
         case LOG_DIR_FLOW:
         case LOG_DIR_FLOW_TOSERVER:
-            if ((PKT_IS_TOSERVER(p))) {
-                if (PKT_IS_IPV4(p)) {
-                    PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
-                } else if (PKT_IS_IPV6(p)) {
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
-                }
-                sp = p->sp;
-                dp = p->dp;
-            } else {
-                if (PKT_IS_IPV4(p)) {
-                    PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
-                } else if (PKT_IS_IPV6(p)) {
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
-                }
-                sp = p->dp;
-                dp = p->sp;
-            }
+            swap = !PKT_IS_TOSERVER(p);
             break;
         case LOG_DIR_FLOW_TOCLIENT:
-            if ((PKT_IS_TOCLIENT(p))) {
-                if (PKT_IS_IPV4(p)) {
-                    PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
-                } else if (PKT_IS_IPV6(p)) {
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
-                }
-                sp = p->sp;
-                dp = p->dp;
-            } else {
-                if (PKT_IS_IPV4(p)) {
-                    PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
-                } else if (PKT_IS_IPV6(p)) {
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
-                    PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
-                }
-                sp = p->dp;
-                dp = p->sp;
-            }
+            swap = !PKT_IS_TOCLIENT(p);
             break;
         default:
             DEBUG_VALIDATE_BUG_ON(1);
             return;
     }
 
+    if (PKT_IS_IPV4(p)) {
+        srcip = JsonPacketAddrString(p, AF_INET, GET_IPV4_SRC_ADDR_PTR(p),
+                srcbuf, sizeof(srcbuf));
+        dstip = JsonPacketAddrString(p, AF_INET, GET_IPV4_DST_ADDR_PTR(p),
+                dstbuf, sizeof(dstbuf));
+    } else if (PKT_IS_IPV6(p)) {
+        srcip = JsonPacketAddrString(p, AF_INET6, GET_IPV6_SRC_ADDR(p),
+                srcbuf, sizeof(srcbuf));
+        dstip = JsonPacketAddrString(p, AF_INET6, GET_IPV6_DST_ADDR(p),
+                dstbuf, sizeof(dstbuf));
+    }
+
+    if (swap) {
+        const char *tmp = srcip;
+        srcip = dstip;
+        dstip = tmp;
+        sp = p->dp;
+        dp = p->sp;
+    } else {
+        sp = p->sp;
+        dp = p->dp;
+    }
+
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
         strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
     } else {
@@ -577,8 +728,8 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
     json_object_set_new(js, "proto", json_string(proto));
 }
 
-static void CreateJSONCommunityFlowIdv4(json_t *js, const Flow *f,
-        const uint16_t seed)
+static bool CommunityFlowIdv4(const Flow *f, const uint16_t seed,
+        unsigned char *base64buf, unsigned long base64buf_len)
 {
     struct {
         uint16_t seed;
@@ -618,12 +769,14 @@ static void CreateJSONCommunityFlowIdv4(json_t *js, const Flow *f,
 
     uint8_t hash[20];
     if (ComputeSHA1((const uint8_t *)&ipv4, sizeof(ipv4), hash, sizeof(hash)) == 1) {
-        unsigned char base64buf[64] = "1:";
-        unsigned long out_len = sizeof(base64buf) - 2;
+        base64buf[0] = '1';
+        base64buf[1] = ':';
+        unsigned long out_len = base64buf_len - 2;
         if (Base64Encode(hash, sizeof(hash), base64buf+2, &out_len) == SC_BASE64_OK) {
-            json_object_set_new(js, "community_id", json_string((const char *)base64buf));
+            return true;
         }
     }
+    return false;
 }
 
 static inline bool FlowHashRawAddressIPv6LtU32(const uint32_t *a, const uint32_t *b)
@@ -638,8 +791,8 @@ static inline bool FlowHashRawAddressIPv6LtU32(const uint32_t *a, const uint32_t
     return false;
 }
 
-static void CreateJSONCommunityFlowIdv6(json_t *js, const Flow *f,
-        const uint16_t seed)
+static bool CommunityFlowIdv6(const Flow *f, const uint16_t seed,
+        unsigned char *base64buf, unsigned long base64buf_len)
 {
     struct {
         uint16_t seed;
@@ -679,20 +832,99 @@ static void CreateJSONCommunityFlowIdv6(json_t *js, const Flow *f,
 
     uint8_t hash[20];
     if (ComputeSHA1((const uint8_t *)&ipv6, sizeof(ipv6), hash, sizeof(hash)) == 1) {
-        unsigned char base64buf[64] = "1:";
-        unsigned long out_len = sizeof(base64buf) - 2;
+        base64buf[0] = '1';
+        base64buf[1] = ':';
+        unsigned long out_len = base64buf_len - 2;
         if (Base64Encode(hash, sizeof(hash), base64buf+2, &out_len) == SC_BASE64_OK) {
-            json_object_set_new(js, "community_id", json_string((const char *)base64buf));
+            return true;
         }
     }
+    return false;
 }
 
-static void CreateJSONCommunityFlowId(json_t *js, const Flow *f, const uint16_t seed)
+static bool CommunityFlowId(const Flow *f, const uint16_t seed,
+        unsigned char *base64buf, unsigned long base64buf_len)
 {
     if (f->flags & FLOW_IPV4)
-        return CreateJSONCommunityFlowIdv4(js, f, seed);
+        return CommunityFlowIdv4(f, seed, base64buf, base64buf_len);
     else if (f->flags & FLOW_IPV6)
-        return CreateJSONCommunityFlowIdv6(js, f, seed);
+        return CommunityFlowIdv6(f, seed, base64buf, base64buf_len);
+    return false;
+}
+
+/**
+ * \brief Get the header cache of a flow, creating it on first use
+ *
+ * Loggers run with the flow locked, so the cache can be set up here.
+ *
+ * \retval cache or NULL if the flow is not IP or on alloc failure
+ */
+static OutputJsonFlowCache *OutputJsonFlowCacheGet(const Flow *f)
+{
+    if (g_flow_cache_id == -1)
+        return NULL;
+
+    OutputJsonFlowCache *c = FlowGetStorageById((Flow *)f, g_flow_cache_id);
+    if (likely(c != NULL))
+        return c;
+
+    int af;
+    if (FLOW_IS_IPV4(f))
+        af = AF_INET;
+    else if (FLOW_IS_IPV6(f))
+        af = AF_INET6;
+    else
+        return NULL;
+
+    c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    PrintInet(af, (const void *)f->src.addr_data32, c->srcip, sizeof(c->srcip));
+    PrintInet(af, (const void *)f->dst.addr_data32, c->dstip, sizeof(c->dstip));
+
+    if (FlowSetStorageById((Flow *)f, g_flow_cache_id, c) != 0) {
+        SCFree(c);
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * \brief Get the community id of a flow, from the header cache if possible
+ *
+ * \param base64buf scratch buffer for when the flow has no cache
+ * \retval id string or NULL on failure
+ */
+static const char *CommunityFlowIdCached(const Flow *f, const uint16_t seed,
+        unsigned char *base64buf, unsigned long base64buf_len)
+{
+    OutputJsonFlowCache *c = OutputJsonFlowCacheGet(f);
+    if (c == NULL) {
+        if (CommunityFlowId(f, seed, base64buf, base64buf_len))
+            return (const char *)base64buf;
+        return NULL;
+    }
+
+    /* the seed is per logger, so it can change from record to record */
+    if (!c->community_id_set || c->community_id_seed != seed) {
+        if (!CommunityFlowId(f, seed, (unsigned char *)c->community_id,
+                    sizeof(c->community_id))) {
+            c->community_id_set = false;
+            return NULL;
+        }
+        c->community_id_set = true;
+        c->community_id_seed = seed;
+    }
+    return c->community_id;
+}
+
+static void CreateJSONCommunityFlowId(json_t *js, const Flow *f, const uint16_t seed)
+{
+    unsigned char base64buf[64];
+    const char *id = CommunityFlowIdCached(f, seed, base64buf, sizeof(base64buf));
+    if (id != NULL) {
+        json_object_set_new(js, "community_id", json_string(id));
+    }
 }
 
 void CreateJSONFlowId(json_t *js, const Flow *f)
@@ -701,8 +933,8 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
         return;
     int64_t flow_id = FlowGetId(f);
     json_object_set_new(js, "flow_id", json_integer(flow_id));
-    if (f->parent_id) {
-        json_object_set_new(js, "parent_id", json_integer(f->parent_id));
+    if (f->ext != NULL && f->ext->parent_id) {
+        json_object_set_new(js, "parent_id", json_integer(f->ext->parent_id));
     }
 }
 
@@ -816,6 +1048,13 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
         json_object_set_new(js, "pcap_filename", json_string(PcapFileGetFilename()));
     }
 
+    if (file_ctx->cbor) {
+        if (!JbDumpCbor(buffer, js))
+            return TM_ECODE_OK;
+        LogFileWrite(file_ctx, *buffer);
+        return 0;
+    }
+
     if (file_ctx->prefix) {
         MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
     }
@@ -834,6 +1073,280 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
     return 0;
 }
 
+void JbFlowId(JsonBuilder *jb, const Flow *f)
+{
+    if (f == NULL)
+        return;
+    JbSetInt(jb, "flow_id", FlowGetId(f));
+    if (f->ext != NULL && f->ext->parent_id) {
+        JbSetInt(jb, "parent_id", f->ext->parent_id);
+    }
+}
+
+/** \brief add the 'true' tcp flags, see JsonTcpFlags() */
+void JbTcpFlags(uint8_t flags, JsonBuilder *jb)
+{
+    if (flags & TH_SYN)
+        JbSetBool(jb, "syn", true);
+    if (flags & TH_FIN)
+        JbSetBool(jb, "fin", true);
+    if (flags & TH_RST)
+        JbSetBool(jb, "rst", true);
+    if (flags & TH_PUSH)
+        JbSetBool(jb, "psh", true);
+    if (flags & TH_ACK)
+        JbSetBool(jb, "ack", true);
+    if (flags & TH_URG)
+        JbSetBool(jb, "urg", true);
+    if (flags & TH_ECN)
+        JbSetBool(jb, "ecn", true);
+    if (flags & TH_CWR)
+        JbSetBool(jb, "cwr", true);
+}
+
+void JbAddCommonOptions(const OutputJsonCommonSettings *cfg,
+        const Packet *p, const Flow *f, JsonBuilder *jb)
+{
+    if (cfg->include_metadata) {
+        /* the vars are rare enough to keep them on jansson */
+        json_t *js = json_object();
+        if (js != NULL) {
+            JsonAddMetadata(p, f, js);
+            JbSetJson(jb, "metadata", json_object_get(js, "metadata"));
+            json_decref(js);
+        }
+    }
+    if (cfg->include_community_id && f != NULL) {
+        unsigned char base64buf[64];
+        const char *id = CommunityFlowIdCached(f, cfg->community_id_seed,
+                base64buf, sizeof(base64buf));
+        if (id != NULL) {
+            JbSetString(jb, "community_id", id);
+        }
+    }
+    if (cfg->include_geoip && f != NULL) {
+        JbAddGeoip(f, jb);
+    }
+}
+
+/**
+ * \brief Add the eve header for a flow record
+ *
+ * Up to and including the proto, the icmp fields are up to the caller.
+ *
+ * \param dir 0 for the flow's direction, 1 for the reverse
+ */
+void CreateEveHeaderFromFlow(JsonBuilder *jb, const Flow *f,
+        const char *event_type, int dir)
+{
+    char timebuf[64];
+    char srcbuf[46] = {0}, dstbuf[46] = {0};
+    const char *srcip = srcbuf, *dstip = dstbuf;
+    Port sp, dp;
+
+    struct timeval tv;
+    memset(&tv, 0x00, sizeof(tv));
+    TimeGet(&tv);
+
+    CreateIsoTimeString(&tv, timebuf, sizeof(timebuf));
+
+    /* reverse header direction if the flow started out wrong */
+    dir ^= ((f->flags & FLOW_DIR_REVERSED) != 0);
+
+    OutputJsonFlowCache *c = OutputJsonFlowCacheGet(f);
+    if (c != NULL) {
+        srcip = dir == 0 ? c->srcip : c->dstip;
+        dstip = dir == 0 ? c->dstip : c->srcip;
+    } else if (FLOW_IS_IPV4(f)) {
+        if (dir == 0) {
+            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), srcbuf, sizeof(srcbuf));
+            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), dstbuf, sizeof(dstbuf));
+        } else {
+            PrintInet(AF_INET, (const void *)&(f->dst.addr_data32[0]), srcbuf, sizeof(srcbuf));
+            PrintInet(AF_INET, (const void *)&(f->src.addr_data32[0]), dstbuf, sizeof(dstbuf));
+        }
+    } else if (FLOW_IS_IPV6(f)) {
+        if (dir == 0) {
+            PrintInet(AF_INET6, (const void *)&(f->src.address), srcbuf, sizeof(srcbuf));
+            PrintInet(AF_INET6, (const void *)&(f->dst.address), dstbuf, sizeof(dstbuf));
+        } else {
+            PrintInet(AF_INET6, (const void *)&(f->dst.address), srcbuf, sizeof(srcbuf));
+            PrintInet(AF_INET6, (const void *)&(f->src.address), dstbuf, sizeof(dstbuf));
+        }
+    }
+
+    if (dir == 0) {
+        sp = f->sp;
+        dp = f->dp;
+    } else {
+        sp = f->dp;
+        dp = f->sp;
+    }
+
+    char proto[16];
+    if (SCProtoNameValid(f->proto) == TRUE) {
+        strlcpy(proto, known_proto[f->proto], sizeof(proto));
+    } else {
+        snprintf(proto, sizeof(proto), "%03" PRIu32, f->proto);
+    }
+
+    /* time */
+    JbSetString(jb, "timestamp", timebuf);
+
+    JbFlowId(jb, f);
+
+    /* input interface */
+    if (f->livedev) {
+        JbSetString(jb, "in_iface", f->livedev->dev);
+    }
+
+    if (event_type) {
+        JbSetString(jb, "event_type", event_type);
+    }
+
+    /* vlan */
+    if (f->vlan_idx > 0) {
+        JbOpenArray(jb, "vlan");
+        JbAppendUint(jb, f->vlan_id[0]);
+        if (f->vlan_idx > 1) {
+            JbAppendUint(jb, f->vlan_id[1]);
+        }
+        JbClose(jb);
+    }
+
+    /* tuple */
+    JbSetString(jb, "src_ip", srcip);
+    switch(f->proto) {
+        case IPPROTO_ICMP:
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JbSetUint(jb, "src_port", sp);
+            break;
+    }
+    JbSetString(jb, "dest_ip", dstip);
+    switch(f->proto) {
+        case IPPROTO_ICMP:
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JbSetUint(jb, "dest_port", dp);
+            break;
+    }
+    JbSetString(jb, "proto", proto);
+}
+
+/** \brief reset the buffer and start a record in it */
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+
+    if (file_ctx->cbor) {
+        JbInit(jb, buffer, JB_CBOR);
+        return;
+    }
+
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+
+    JbInit(jb, buffer, file_ctx->json_flags);
+}
+
+/** \brief finish the record started by OutputJsonBuilderStart() and log it
+ *
+ *  All objects and arrays but the root object have to be closed.
+ */
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer)
+{
+    if (file_ctx->sensor_name) {
+        JbSetString(jb, "host", file_ctx->sensor_name);
+    }
+
+    if (file_ctx->is_pcap_offline) {
+        JbSetString(jb, "pcap_filename", PcapFileGetFilename());
+    }
+
+    if (jb->depth != 1) {
+        jb->error = true;
+    }
+    if (!JbClose(jb)) {
+        SCLogDebug("incomplete record not logged");
+        return TM_ECODE_OK;
+    }
+
+    LogFileWrite(file_ctx, *buffer);
+    return 0;
+}
+
+/**
+ * \brief Compile the "fields" list of a sub-logger into a bitmask
+ *
+ * Loggers check the mask and don't build the fields that are not in it.
+ *
+ * \param fields the optional fields of the logger, terminated by a
+ *               NULL name
+ * \param mask   in: the fields to log if there is no list, out: the
+ *               fields to log
+ *
+ * \retval 0 ok, -1 unknown field name
+ */
+int OutputJsonParseFields(ConfNode *conf, const OutputJsonField *fields,
+        uint64_t *mask)
+{
+    ConfNode *list = ConfNodeLookupChild(conf, "fields");
+    if (list == NULL)
+        return 0;
+
+    uint64_t result = 0;
+    ConfNode *field;
+    TAILQ_FOREACH(field, &list->head, next) {
+        const OutputJsonField *f;
+        for (f = fields; f->name != NULL; f++) {
+            if (strcasecmp(f->name, field->val) == 0) {
+                result |= f->flag;
+                break;
+            }
+        }
+        if (f->name == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log.%s: unknown field "
+                    "\"%s\"", conf->name, field->val);
+            return -1;
+        }
+    }
+    *mask = result;
+    return 0;
+}
+
+/**
+ * \brief Get the "sample-rate" of a sub-logger
+ *
+ * \retval 0 ok, -1 invalid rate
+ */
+int OutputJsonParseSampleRate(ConfNode *conf, OutputJsonCommonSettings *cfg)
+{
+    cfg->sample_rate = 1;
+
+    const char *str = ConfNodeLookupChildValue(conf, "sample-rate");
+    if (str == NULL)
+        return 0;
+
+    if (ByteExtractStringUint32(&cfg->sample_rate, 10, strlen(str), str) !=
+            (int)strlen(str) || cfg->sample_rate == 0)
+    {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log.%s: invalid "
+                "sample-rate \"%s\"", conf->name, str);
+        return -1;
+    }
+    if (cfg->sample_rate > 1) {
+        SCLogConfig("eve-log.%s: logging 1 in %u flows", conf->name,
+                cfg->sample_rate);
+    }
+    return 0;
+}
+
 /**
  * \brief Create a new LogFileCtx for "fast" output style.
  * \param conf The configuration node for this output.
@@ -915,6 +1428,14 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
                 SCLogError(SC_ERR_INVALID_ARGUMENT,
                            "redis JSON output option is not compiled");
                 exit(EXIT_FAILURE);
+#endif
+            } else if (strcmp(output_s, "kafka") == 0) {
+#ifdef HAVE_LIBRDKAFKA
+                json_ctx->json_out = LOGFILE_TYPE_KAFKA;
+#else
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "kafka JSON output option is not compiled");
+                exit(EXIT_FAILURE);
 #endif
             } else {
                 SCLogError(SC_ERR_INVALID_ARGUMENT,
@@ -923,8 +1444,27 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
             }
         }
 
+        /* record encoding: json text lines or a sequence of CBOR items */
+        const char *format = ConfNodeLookupChildValue(conf, "format");
+        if (format != NULL && strcmp(format, "cbor") == 0) {
+            if (json_ctx->json_out == LOGFILE_TYPE_SYSLOG) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log: cbor format "
+                        "can't be used with syslog output");
+                exit(EXIT_FAILURE);
+            }
+            json_ctx->file_ctx->cbor = true;
+            SCLogConfig("eve-log: using cbor format");
+        } else if (format != NULL && strcmp(format, "json") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid eve-log format: %s, "
+                    "expected json or cbor", format);
+            exit(EXIT_FAILURE);
+        }
+
         const char *prefix = ConfNodeLookupChildValue(conf, "prefix");
-        if (prefix != NULL)
+        if (prefix != NULL && json_ctx->file_ctx->cbor) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "eve-log: prefix is not "
+                    "used with the cbor format");
+        } else if (prefix != NULL)
         {
             SCLogInfo("Using prefix '%s' for JSON messages", prefix);
             json_ctx->file_ctx->prefix = SCStrdup(prefix);
@@ -937,6 +1477,19 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
             json_ctx->file_ctx->prefix_len = strlen(prefix);
         }
 
+        /* a file or connection per thread, so writers don't share
+         * the output mutex */
+        const char *threaded = ConfNodeLookupChildValue(conf, "threaded");
+        if (threaded != NULL && ConfValIsTrue(threaded)) {
+            if (json_ctx->json_out == LOGFILE_TYPE_SYSLOG ||
+                    json_ctx->json_out == LOGFILE_TYPE_KAFKA) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "eve-log: threaded "
+                        "is not supported for syslog and kafka, ignoring");
+            } else {
+                json_ctx->file_ctx->threaded = true;
+            }
+        }
+
         if (json_ctx->json_out == LOGFILE_TYPE_FILE ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_DGRAM ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_STREAM)
@@ -948,6 +1501,23 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
                 return result;
             }
             OutputRegisterFileRotationFlag(&json_ctx->file_ctx->rotation_flag);
+
+            /* write from a dedicated thread so a slow disk or socket
+             * doesn't stall the workers */
+            const char *async = ConfNodeLookupChildValue(conf, "async");
+            if (async != NULL && ConfValIsTrue(async)) {
+                uint64_t memcap = DEFAULT_LOG_ASYNC_MEMCAP;
+                const char *memcap_s = ConfNodeLookupChildValue(conf, "async-memcap");
+                if (memcap_s != NULL && ParseSizeStringU64(memcap_s, &memcap) < 0) {
+                    SCLogError(SC_ERR_SIZE_PARSE, "invalid async-memcap "
+                            "value %s, using the default", memcap_s);
+                    memcap = DEFAULT_LOG_ASYNC_MEMCAP;
+                }
+                if (LogFileAsyncStart(json_ctx->file_ctx, memcap) == 0) {
+                    SCLogConfig("eve-log: async output, queue memcap %"PRIu64,
+                            memcap);
+                }
+            }
         }
 #ifndef OS_WIN32
 	else if (json_ctx->json_out == LOGFILE_TYPE_SYSLOG) {
@@ -1002,6 +1572,17 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
             }
         }
 #endif
+#ifdef HAVE_LIBRDKAFKA
+        else if (json_ctx->json_out == LOGFILE_TYPE_KAFKA) {
+            ConfNode *kafka_node = ConfNodeLookupChild(conf, "kafka");
+            if (SCConfLogOpenKafka(kafka_node, json_ctx->file_ctx) < 0) {
+                LogFileFreeCtx(json_ctx->file_ctx);
+                SCFree(json_ctx);
+                SCFree(output_ctx);
+                return result;
+            }
+        }
+#endif
 
         const char *sensor_id_s = ConfNodeLookupChildValue(conf, "sensor-id");
         if (sensor_id_s != NULL) {
@@ -1030,6 +1611,17 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
         } else {
             json_ctx->cfg.include_community_id = false;
         }
+        /* See if we want the countries of the flows */
+        const ConfNode *geoip = ConfNodeLookupChild(conf, "geoip");
+        if (geoip && geoip->val && ConfValIsTrue(geoip->val)) {
+            if (GeoipEnabled()) {
+                SCLogConfig("Enabling eve geoip logging.");
+                json_ctx->cfg.include_geoip = true;
+            } else {
+                SCLogWarning(SC_ERR_GEOIP_ERROR, "eve geoip logging needs "
+                        "the geoip-database to be set, disabling");
+            }
+        }
         const char *cid_seed = ConfNodeLookupChildValue(conf, "community-id-seed");
         if (cid_seed != NULL) {
             if (ByteExtractStringUint16(&json_ctx->cfg.community_id_seed,
@@ -1085,4 +1677,147 @@ static void OutputJsonDeInitCtx(OutputCtx *output_ctx)
     SCFree(output_ctx);
 }
 
+
+#ifdef UNITTESTS
+#include "flow-util.h"
+
+static void OutputJsonFlowCacheTestSetFlow(Flow *f, const char *src,
+        const char *dst)
+{
+    f->flags |= FLOW_IPV4;
+    f->src.addr_data32[0] = UTHSetIPv4Address(src);
+    f->dst.addr_data32[0] = UTHSetIPv4Address(dst);
+    f->proto = IPPROTO_TCP;
+    f->sp = 1024;
+    f->dp = 80;
+}
+
+/**
+ * \test the ip strings and community id are cached per flow, the id is
+ *       recomputed for another seed, and a recycled flow gets new ones
+ */
+static int OutputJsonFlowCacheTest01(void)
+{
+    const int id = g_flow_cache_id;
+    StorageInit();
+    g_flow_cache_id = FlowStorageRegister("eve-header", sizeof(void *),
+            NULL, OutputJsonFlowCacheFree, 0);
+    FAIL_IF(g_flow_cache_id < 0);
+    FAIL_IF(StorageFinalize() < 0);
+    FlowInitConfig(FLOW_QUIET);
+
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    OutputJsonFlowCacheTestSetFlow(f, "1.2.3.4", "5.6.7.8");
+
+    OutputJsonFlowCache *c = OutputJsonFlowCacheGet(f);
+    FAIL_IF_NULL(c);
+    FAIL_IF(strcmp(c->srcip, "1.2.3.4") != 0);
+    FAIL_IF(strcmp(c->dstip, "5.6.7.8") != 0);
+    FAIL_IF(OutputJsonFlowCacheGet(f) != c);
+
+    unsigned char buf[64];
+    char seed0[64], seed1[64];
+    const char *cid = CommunityFlowIdCached(f, 0, buf, sizeof(buf));
+    FAIL_IF(cid != c->community_id);
+    FAIL_IF_NOT(CommunityFlowId(f, 0, (unsigned char *)seed0, sizeof(seed0)));
+    FAIL_IF(strcmp(cid, seed0) != 0);
+
+    cid = CommunityFlowIdCached(f, 1, buf, sizeof(buf));
+    FAIL_IF(cid != c->community_id);
+    FAIL_IF_NOT(CommunityFlowId(f, 1, (unsigned char *)seed1, sizeof(seed1)));
+    FAIL_IF(strcmp(cid, seed1) != 0);
+    FAIL_IF(strcmp(seed0, seed1) == 0);
+
+    /* recycled for another flow, nothing of the old one is left */
+    FlowClearMemory(f, 0);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, g_flow_cache_id));
+    OutputJsonFlowCacheTestSetFlow(f, "10.0.0.1", "10.0.0.2");
+
+    c = OutputJsonFlowCacheGet(f);
+    FAIL_IF_NULL(c);
+    FAIL_IF(strcmp(c->srcip, "10.0.0.1") != 0);
+    FAIL_IF(strcmp(c->dstip, "10.0.0.2") != 0);
+    cid = CommunityFlowIdCached(f, 1, buf, sizeof(buf));
+    FAIL_IF_NULL(cid);
+    FAIL_IF(strcmp(cid, seed1) == 0);
+    FAIL_IF_NOT(CommunityFlowId(f, 1, (unsigned char *)seed1, sizeof(seed1)));
+    FAIL_IF(strcmp(cid, seed1) != 0);
+
+    FlowFree(f);
+    FlowShutdown();
+    StorageCleanup();
+    g_flow_cache_id = id;
+    PASS;
+}
+
+/**
+ * \test the json string cache hands out references to the same string
+ *       for a cached value, and new strings for long values and for new
+ *       values once it's full
+ */
+static int OutputJsonStringCacheTest02(void)
+{
+    JsonStringCache *c = JsonStringCacheInit();
+    FAIL_IF_NULL(c);
+
+    json_t *js1 = JsonStringCacheGet(c, "GET");
+    FAIL_IF_NULL(js1);
+    json_t *js2 = JsonStringCacheGet(c, "GET");
+    FAIL_IF(js1 != js2);
+    FAIL_IF(strcmp(json_string_value(js1), "GET") != 0);
+    /* the cache and the two callers */
+    FAIL_IF(js1->refcount != 3);
+    json_decref(js1);
+    json_decref(js2);
+
+    char longval[JSON_STRING_CACHE_MAX_LEN + 2];
+    memset(longval, 'a', sizeof(longval) - 1);
+    longval[sizeof(longval) - 1] = '\0';
+    js1 = JsonStringCacheGet(c, longval);
+    js2 = JsonStringCacheGet(c, longval);
+    FAIL_IF_NULL(js1);
+    FAIL_IF(js1 == js2);
+    FAIL_IF(strcmp(json_string_value(js2), longval) != 0);
+    json_decref(js1);
+    json_decref(js2);
+
+    /* fill it up, "GET" is in already */
+    char val[16];
+    for (int i = 1; i < JSON_STRING_CACHE_MAX_ENTRIES; i++) {
+        snprintf(val, sizeof(val), "v%d", i);
+        json_decref(JsonStringCacheGet(c, val));
+    }
+    FAIL_IF(c->table->cnt != JSON_STRING_CACHE_MAX_ENTRIES);
+    js1 = JsonStringCacheGet(c, "POST");
+    js2 = JsonStringCacheGet(c, "POST");
+    FAIL_IF(js1 == js2);
+    FAIL_IF(strcmp(json_string_value(js1), "POST") != 0);
+    json_decref(js1);
+    json_decref(js2);
+    js1 = JsonStringCacheGet(c, "v1");
+    js2 = JsonStringCacheGet(c, "v1");
+    FAIL_IF(js1 != js2);
+    json_decref(js1);
+    json_decref(js2);
+
+    /* without a cache every call gets its own string */
+    js1 = JsonStringCacheGet(NULL, "GET");
+    FAIL_IF_NULL(js1);
+    FAIL_IF(js1->refcount != 1);
+    json_decref(js1);
+
+    JsonStringCacheFree(c);
+    PASS;
+}
+#endif /* UNITTESTS */
+
 #endif
+
+void OutputJsonRegisterTests(void)
+{
+#if defined(HAVE_LIBJANSSON) && defined(UNITTESTS)
+    UtRegisterTest("OutputJsonFlowCacheTest01", OutputJsonFlowCacheTest01);
+    UtRegisterTest("OutputJsonStringCacheTest02", OutputJsonStringCacheTest02);
+#endif
+}
@@ -26,12 +26,14 @@
 
 #include "suricata-common.h"
 #include "util-buffer.h"
+#include "util-jsonbuilder.h"
 #include "util-logopenfile.h"
 #include "output.h"
 
 #include "app-layer-htp-xff.h"
 
 void OutputJsonRegister(void);
+void OutputJsonRegisterTests(void);
 
 #ifdef HAVE_LIBJANSSON
 
@@ -68,9 +70,36 @@ TmEcode JsonLogThreadDeinit(ThreadVars *t, void *data);
 typedef struct OutputJsonCommonSettings_ {
     bool include_metadata;
     bool include_community_id;
+    bool include_geoip;     /**< countries of the flow's client and server */
     uint16_t community_id_seed;
+    uint32_t sample_rate;   /**< log 1 in sample_rate flows, 0 or 1 for all */
 } OutputJsonCommonSettings;
 
+/** optional field of a sub-logger, see OutputJsonParseFields() */
+typedef struct OutputJsonField_ {
+    const char *name;
+    uint64_t flag;
+} OutputJsonField;
+
+int OutputJsonParseFields(ConfNode *conf, const OutputJsonField *fields,
+        uint64_t *mask);
+int OutputJsonParseSampleRate(ConfNode *conf, OutputJsonCommonSettings *cfg);
+
+/**
+ * \brief check if the records of a flow are logged by a sampling sub-logger
+ *
+ * Picked by flow hash, so a flow is either logged completely or not at all
+ * and sub-loggers with the same rate log the same flows. The mixing differs
+ * from the one of flow.sampling, so the two don't select the same flows.
+ */
+static inline bool OutputJsonSampleFlow(const OutputJsonCommonSettings *cfg,
+        const Flow *f)
+{
+    if (likely(cfg->sample_rate <= 1) || f == NULL)
+        return true;
+    return (((f->flow_hash * 2246822519U) >> 16) % cfg->sample_rate) == 0;
+}
+
 /*
  * Global configuration context data
  */
@@ -90,9 +119,24 @@ json_t *SCJsonBool(int val);
 json_t *SCJsonString(const char *val);
 void SCJsonDecref(json_t *js);
 
+typedef struct JsonStringCache_ JsonStringCache;
+JsonStringCache *JsonStringCacheInit(void);
+void JsonStringCacheFree(JsonStringCache *c);
+json_t *JsonStringCacheGet(JsonStringCache *c, const char *val);
+
 void JsonAddCommonOptions(const OutputJsonCommonSettings *cfg,
         const Packet *p, const Flow *f, json_t *js);
 
+/* JsonBuilder based output */
+void JbFlowId(JsonBuilder *jb, const Flow *f);
+void JbTcpFlags(uint8_t flags, JsonBuilder *jb);
+void JbAddCommonOptions(const OutputJsonCommonSettings *cfg,
+        const Packet *p, const Flow *f, JsonBuilder *jb);
+void CreateEveHeaderFromFlow(JsonBuilder *jb, const Flow *f,
+        const char *event_type, int dir);
+void OutputJsonBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer);
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer);
+
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* __OUTPUT_JSON_H__ */
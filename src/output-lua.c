@@ -80,12 +80,31 @@ typedef struct LogLuaCtx_ {
     SCMutex m;
     lua_State *luastate;
     int deinit_once;
+    /** the script asked for a state per thread, luastate is unused */
+    int threaded;
+    char path[PATH_MAX];
 } LogLuaCtx;
 
 typedef struct LogLuaThreadCtx_ {
     LogLuaCtx *lua_ctx;
+    /** the state to run the script in: the thread's own or the shared one */
+    lua_State *luastate;
 } LogLuaThreadCtx;
 
+/** the shared state is used by one thread at a time, a state of our
+ *  own needs no lock */
+static inline void LuaLogLock(LogLuaThreadCtx *td)
+{
+    if (!td->lua_ctx->threaded)
+        SCMutexLock(&td->lua_ctx->m);
+}
+
+static inline void LuaLogUnlock(LogLuaThreadCtx *td)
+{
+    if (!td->lua_ctx->threaded)
+        SCMutexUnlock(&td->lua_ctx->m);
+}
+
 static TmEcode LuaLogThreadInit(ThreadVars *t, const void *initdata, void **data);
 static TmEcode LuaLogThreadDeinit(ThreadVars *t, void *data);
 
@@ -103,24 +122,24 @@ static int LuaTxLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow
 
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetTX(td->lua_ctx->luastate, txptr);
-    LuaStateSetFlow(td->lua_ctx->luastate, f);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetTX(td->luastate, txptr);
+    LuaStateSetFlow(td->luastate, f);
 
     /* prepare data to pass to script */
-    lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
-    LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
+    lua_getglobal(td->luastate, "log");
+    lua_newtable(td->luastate);
+    LuaPushTableKeyValueInt(td->luastate, "tx_id", (int)(tx_id));
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
 
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
     SCReturnInt(0);
 }
 
@@ -147,27 +166,27 @@ static int LuaStreamingLogger(ThreadVars *tv, void *thread_data, const Flow *f,
 
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
+    LuaStateSetThreadVars(td->luastate, tv);
     if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION)
-        LuaStateSetTX(td->lua_ctx->luastate, txptr);
-    LuaStateSetFlow(td->lua_ctx->luastate, (Flow *)f);
-    LuaStateSetStreamingBuffer(td->lua_ctx->luastate, &b);
+        LuaStateSetTX(td->luastate, txptr);
+    LuaStateSetFlow(td->luastate, (Flow *)f);
+    LuaStateSetStreamingBuffer(td->luastate, &b);
 
     /* prepare data to pass to script */
-    lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
+    lua_getglobal(td->luastate, "log");
+    lua_newtable(td->luastate);
 
     if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION)
-        LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
+        LuaPushTableKeyValueInt(td->luastate, "tx_id", (int)(tx_id));
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
 
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -203,7 +222,7 @@ static int LuaPacketLoggerAlerts(ThreadVars *tv, void *thread_data, const Packet
     }
 
     /* loop through alerts stored in the packet */
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
     uint16_t cnt;
     for (cnt = 0; cnt < p->alerts.cnt; cnt++) {
         const PacketAlert *pa = &p->alerts.alerts[cnt];
@@ -211,27 +230,27 @@ static int LuaPacketLoggerAlerts(ThreadVars *tv, void *thread_data, const Packet
             continue;
         }
 
-        lua_getglobal(td->lua_ctx->luastate, "log");
+        lua_getglobal(td->luastate, "log");
 
         void *txptr = NULL;
         if (p->flow && p->flow->alstate && (pa->flags & PACKET_ALERT_FLAG_TX))
             txptr = AppLayerParserGetTx(p->proto, p->flow->alproto, p->flow->alstate, pa->tx_id);
 
-        LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-        LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-        LuaStateSetTX(td->lua_ctx->luastate, txptr);
-        LuaStateSetFlow(td->lua_ctx->luastate, p->flow);
-        LuaStateSetPacketAlert(td->lua_ctx->luastate, (PacketAlert *)pa);
+        LuaStateSetThreadVars(td->luastate, tv);
+        LuaStateSetPacket(td->luastate, (Packet *)p);
+        LuaStateSetTX(td->luastate, txptr);
+        LuaStateSetFlow(td->luastate, p->flow);
+        LuaStateSetPacketAlert(td->luastate, (PacketAlert *)pa);
 
         /* prepare data to pass to script */
-        //lua_newtable(td->lua_ctx->luastate);
+        //lua_newtable(td->luastate);
 
-        int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+        int retval = lua_pcall(td->luastate, 0, 0, 0);
         if (retval != 0) {
-            SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+            SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
         }
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
 not_supported:
     SCReturnInt(0);
 }
@@ -274,21 +293,21 @@ static int LuaPacketLogger(ThreadVars *tv, void *thread_data, const Packet *p)
     }
 
     /* loop through alerts stored in the packet */
-    SCMutexLock(&td->lua_ctx->m);
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    LuaLogLock(td);
+    lua_getglobal(td->luastate, "log");
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetFlow(td->lua_ctx->luastate, p->flow);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetFlow(td->luastate, p->flow);
 
     /* prepare data to pass to script */
-    lua_newtable(td->lua_ctx->luastate);
+    lua_newtable(td->luastate);
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
 not_supported:
     SCReturnInt(0);
 }
@@ -317,27 +336,27 @@ static int LuaFileLogger(ThreadVars *tv, void *thread_data, const Packet *p, con
 
     SCLogDebug("ff %p", ff);
 
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
     if (p->flow && p->flow->alstate) {
         void *txptr = AppLayerParserGetTx(p->proto, p->flow->alproto, p->flow->alstate, ff->txid);
         if (txptr) {
-            LuaStateSetTX(td->lua_ctx->luastate, txptr);
+            LuaStateSetTX(td->luastate, txptr);
         }
     }
-    LuaStateSetFlow(td->lua_ctx->luastate, p->flow);
-    LuaStateSetFile(td->lua_ctx->luastate, (File *)ff);
+    LuaStateSetFlow(td->luastate, p->flow);
+    LuaStateSetFile(td->luastate, (File *)ff);
 
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+    int retval = lua_pcall(td->luastate, 0, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
     return 0;
 }
 
@@ -355,19 +374,19 @@ static int LuaFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 
     SCLogDebug("f %p", f);
 
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetFlow(td->lua_ctx->luastate, f);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetFlow(td->luastate, f);
 
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+    int retval = lua_pcall(td->luastate, 0, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
     return 0;
 }
 
@@ -378,11 +397,11 @@ static int LuaStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *s
     SCEnter();
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LuaLogLock(td);
 
-    lua_State *luastate = td->lua_ctx->luastate;
+    lua_State *luastate = td->luastate;
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
     /* create lua array, which is really just a table. The key is an int (1-x),
      * the value another table with named fields: name, tm_name, value, pvalue.
@@ -416,11 +435,11 @@ static int LuaStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *s
         lua_settable(luastate, -3);
     }
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaLogUnlock(td);
     return 0;
 
 }
@@ -435,6 +454,7 @@ typedef struct LogLuaScriptOptions_ {
     int http_body;
     int flow;
     int stats;
+    int threaded;
 } LogLuaScriptOptions;
 
 /** \brief load and evaluate the script
@@ -525,8 +545,11 @@ static int LuaScriptInit(const char *filename, LogLuaScriptOptions *options) {
 
         SCLogDebug("k='%s', v='%s'", k, v);
 
-        if (strcmp(k,"protocol") == 0 && strcmp(v, "http") == 0)
+        if (strcmp(k,"protocol") == 0 && strcmp(v, "http") == 0) {
             options->alproto = ALPROTO_HTTP;
+            /* the script can get the raw headers through the http lib */
+            AppLayerHtpNeedRawHeaders();
+        }
         else if (strcmp(k,"protocol") == 0 && strcmp(v, "dns") == 0)
             options->alproto = ALPROTO_DNS;
         else if (strcmp(k,"protocol") == 0 && strcmp(v, "tls") == 0)
@@ -549,6 +572,8 @@ static int LuaScriptInit(const char *filename, LogLuaScriptOptions *options) {
             options->tcp_data = 1;
         else if (strcmp(k, "type") == 0 && strcmp(v, "stats") == 0)
             options->stats = 1;
+        else if (strcmp(k, "threaded") == 0 && strcmp(v, "yes") == 0)
+            options->threaded = 1;
         else
             SCLogInfo("unknown key and/or value: k='%s', v='%s'", k, v);
     }
@@ -660,9 +685,11 @@ static void LogLuaSubFree(OutputCtx *oc) {
 
 /** \brief initialize output for a script instance
  *
- *  Runs script 'setup' function.
+ *  Runs script 'setup' function. For a threaded script this is left to
+ *  the threads, each sets up a state of its own.
  */
-static OutputInitResult OutputLuaLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
+static OutputInitResult OutputLuaLogInitSubDo(ConfNode *conf, OutputCtx *parent_ctx,
+        int threaded)
 {
     OutputInitResult result = { NULL, false };
     if (conf == NULL)
@@ -687,19 +714,22 @@ static OutputInitResult OutputLuaLogInitSub(ConfNode *conf, OutputCtx *parent_ct
         dir = mc->path;
     }
 
-    char path[PATH_MAX] = "";
-    int ret = snprintf(path, sizeof(path),"%s%s%s", dir, strlen(dir) ? "/" : "", conf->val);
-    if (ret < 0 || ret == sizeof(path)) {
+    char *path = lua_ctx->path;
+    int ret = snprintf(path, sizeof(lua_ctx->path),"%s%s%s", dir, strlen(dir) ? "/" : "", conf->val);
+    if (ret < 0 || ret == sizeof(lua_ctx->path)) {
         SCLogError(SC_ERR_SPRINTF,"failed to construct lua script path");
         goto error;
     }
     SCLogDebug("script full path %s", path);
 
-    SCMutexLock(&lua_ctx->m);
-    lua_ctx->luastate = LuaScriptSetup(path);
-    SCMutexUnlock(&lua_ctx->m);
-    if (lua_ctx->luastate == NULL)
-        goto error;
+    lua_ctx->threaded = threaded;
+    if (!threaded) {
+        SCMutexLock(&lua_ctx->m);
+        lua_ctx->luastate = LuaScriptSetup(path);
+        SCMutexUnlock(&lua_ctx->m);
+        if (lua_ctx->luastate == NULL)
+            goto error;
+    }
 
     SCLogDebug("lua_ctx %p", lua_ctx);
 
@@ -716,6 +746,16 @@ error:
     return result;
 }
 
+static OutputInitResult OutputLuaLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
+{
+    return OutputLuaLogInitSubDo(conf, parent_ctx, 0);
+}
+
+static OutputInitResult OutputLuaLogInitSubThreaded(ConfNode *conf, OutputCtx *parent_ctx)
+{
+    return OutputLuaLogInitSubDo(conf, parent_ctx, 1);
+}
+
 static void LogLuaMasterFree(OutputCtx *oc)
 {
     if (oc->data)
@@ -791,7 +831,10 @@ static OutputInitResult OutputLuaLogInit(ConfNode *conf)
 
         om->name = MODULE_NAME;
         om->conf_name = script->val;
-        om->InitSubFunc = OutputLuaLogInitSub;
+        /* a threaded script gets a state per thread instead of one
+         * state shared by all threads under a lock */
+        om->InitSubFunc = opts.threaded ?
+            OutputLuaLogInitSubThreaded : OutputLuaLogInitSub;
         om->ThreadInit = LuaLogThreadInit;
         om->ThreadDeinit = LuaLogThreadDeinit;
 
@@ -807,6 +850,10 @@ static OutputInitResult OutputLuaLogInit(ConfNode *conf)
             om->ts_log_progress = -1;
             om->tc_log_progress = -1;
             AppLayerParserRegisterLogger(IPPROTO_TCP, ALPROTO_HTTP);
+            /* scripts can get the bodies through HttpGetRequestBody and
+             * HttpGetResponseBody */
+            AppLayerHtpEnableRequestBodyCallback();
+            AppLayerHtpEnableResponseBodyCallback();
         } else if (opts.alproto == ALPROTO_TLS) {
             om->TxLogFunc = LuaTxLogger;
             om->alproto = ALPROTO_TLS;
@@ -880,10 +927,8 @@ error:
 /** \internal
  *  \brief Run the scripts 'deinit' function
  */
-static void OutputLuaLogDoDeinit(LogLuaCtx *lua_ctx)
+static void OutputLuaLogDoDeinit(lua_State *luastate)
 {
-    lua_State *luastate = lua_ctx->luastate;
-
     lua_getglobal(luastate, "deinit");
     if (lua_type(luastate, -1) != LUA_TFUNCTION) {
         SCLogError(SC_ERR_LUA_ERROR, "no deinit function in script");
@@ -901,7 +946,8 @@ static void OutputLuaLogDoDeinit(LogLuaCtx *lua_ctx)
 /** \internal
  *  \brief Initialize the thread storage for lua
  *
- *  Currently only stores a pointer to the global LogLuaCtx
+ *  Stores a pointer to the global LogLuaCtx and sets up the state of
+ *  the thread for threaded scripts.
  */
 static TmEcode LuaLogThreadInit(ThreadVars *t, const void *initdata, void **data)
 {
@@ -919,6 +965,15 @@ static TmEcode LuaLogThreadInit(ThreadVars *t, const void *initdata, void **data
     LogLuaCtx *lua_ctx = ((OutputCtx *)initdata)->data;
     SCLogDebug("lua_ctx %p", lua_ctx);
     td->lua_ctx = lua_ctx;
+    if (lua_ctx->threaded) {
+        td->luastate = LuaScriptSetup(lua_ctx->path);
+        if (td->luastate == NULL) {
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    } else {
+        td->luastate = lua_ctx->luastate;
+    }
     *data = (void *)td;
     return TM_ECODE_OK;
 }
@@ -926,7 +981,8 @@ static TmEcode LuaLogThreadInit(ThreadVars *t, const void *initdata, void **data
 /** \internal
  *  \brief Deinit the thread storage for lua
  *
- *  Calls OutputLuaLogDoDeinit if no-one else already did.
+ *  Calls OutputLuaLogDoDeinit on the state of the thread, or on the
+ *  shared state if no-one else already did.
  */
 static TmEcode LuaLogThreadDeinit(ThreadVars *t, void *data)
 {
@@ -935,12 +991,16 @@ static TmEcode LuaLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    SCMutexLock(&td->lua_ctx->m);
-    if (td->lua_ctx->deinit_once == 0) {
-        OutputLuaLogDoDeinit(td->lua_ctx);
-        td->lua_ctx->deinit_once = 1;
+    if (td->lua_ctx->threaded) {
+        OutputLuaLogDoDeinit(td->luastate);
+    } else {
+        SCMutexLock(&td->lua_ctx->m);
+        if (td->lua_ctx->deinit_once == 0) {
+            OutputLuaLogDoDeinit(td->lua_ctx->luastate);
+            td->lua_ctx->deinit_once = 1;
+        }
+        SCMutexUnlock(&td->lua_ctx->m);
     }
-    SCMutexUnlock(&td->lua_ctx->m);
 
     /* clear memory */
     memset(td, 0, sizeof(*td));
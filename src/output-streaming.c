@@ -148,9 +148,12 @@ static int Streamer(void *cbdata, Flow *f, const uint8_t *data, uint32_t data_le
  *
  *  Global logic:
  *
- *  - For each tx
+ *  - For each tx not done yet
  *    - For each body chunk
  *      - Invoke Streamer
+ *
+ *  The txs at the start that are complete and closed are skipped on the
+ *  next calls, per direction.
  */
 
 static int HttpBodyIterator(Flow *f, int close, void *cbdata, uint8_t iflags)
@@ -170,10 +173,16 @@ static int HttpBodyIterator(Flow *f, int close, void *cbdata, uint8_t iflags)
                 STREAM_TOCLIENT);
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, f->alstate);
 
+    const int dir = (iflags & OUTPUT_STREAMING_FLAG_TOSERVER) ? 0 : 1;
+    /* all txs before this one are done */
+    bool in_order = true;
+
     uint64_t tx_id = 0;
-    for (tx_id = 0; tx_id < total_txs; tx_id++) { // TODO optimization store log tx
+    for (tx_id = s->body_log_tx_id[dir]; tx_id < total_txs; tx_id++) {
         htp_tx_t *tx = AppLayerParserGetTx(f->proto, f->alproto, f->alstate, tx_id);
         if (tx == NULL) {
+            if (in_order)
+                s->body_log_tx_id[dir] = tx_id + 1;
             continue;
         }
 
@@ -249,6 +258,12 @@ static int HttpBodyIterator(Flow *f, int close, void *cbdata, uint8_t iflags)
                          iflags|OUTPUT_STREAMING_FLAG_CLOSE|OUTPUT_STREAMING_FLAG_TRANSACTION);
             }
         }
+
+        /* a done tx got its close call, don't revisit it */
+        if (in_order && tx_done)
+            s->body_log_tx_id[dir] = tx_id + 1;
+        else
+            in_order = false;
     }
     return 0;
 }
@@ -259,7 +274,8 @@ struct StreamLogData {
     Flow *f;
 };
 
-static int StreamLogFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamLogFunc(void *cb_data, const uint8_t *data,
+        const uint32_t data_len, const uint64_t offset)
 {
     struct StreamLogData *log = cb_data;
 
@@ -29,6 +29,7 @@
 
 #define DEFAULT_LOG_MODE_APPEND     "yes"
 #define DEFAULT_LOG_FILETYPE        "regular"
+#define DEFAULT_LOG_ASYNC_MEMCAP    (16 * 1024 * 1024)
 
 #include "output-packet.h"
 #include "output-tx.h"
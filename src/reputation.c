@@ -23,6 +23,17 @@
  *         Original Idea by Matt Jonkman
  *
  * IP Reputation Module, initial API for IPV4 and IPV6 feed
+ *
+ * The reputation data of hosts and netblocks is kept in a single store,
+ * shared by all detection engines. It holds two identical copies of the
+ * trees: the readers use trees[gen & 1], the writer changes the other
+ * copy, makes it the one in use by incrementing gen and then waits until
+ * no reader uses the old copy anymore before changing that one as well.
+ *
+ * Readers announce the generation they are using in their own slot, see
+ * SRepReadBegin(), so a lookup takes no lock and writes no shared cache
+ * line. Updates from the unix socket only touch the entries they change,
+ * a reload of the files builds new copies and swaps them in the same way.
  */
 
 #include "suricata-common.h"
@@ -32,121 +43,315 @@
 #include "util-radix-tree.h"
 #include "util-unittest.h"
 #include "threads.h"
+#include "tm-threads.h"
 #include "util-print.h"
-#include "host.h"
 #include "conf.h"
 #include "detect.h"
 #include "reputation.h"
 
-/** effective reputation version, atomic as the host
- *  time out code will use it to check if a host's
- *  reputation info is outdated. */
-SC_ATOMIC_DECLARE(uint32_t, srep_eversion);
-/** reputation version set to the host's reputation,
- *  this will be set to 1 before rep files are loaded,
- *  so hosts will always have a minial value of 1 */
-static uint32_t srep_version = 0;
+/** the value of an entry is kept in the user data of its tree node */
+#define SREP_VALUE_TO_USER(v)   ((void *)(uintptr_t)(v))
+#define SREP_USER_TO_VALUE(u)   ((uint8_t)(uintptr_t)(u))
+
+struct SRepReader_ {
+    /** generation of the copy the reader uses, 0 when not reading */
+    SC_ATOMIC_DECLARE(uint64_t, gen);
+    struct SRepReader_ *next;
+} __attribute__((aligned(CLS)));
+
+/** an address or netblock with its value for a category, from a
+ *  reputation file or an update */
+typedef struct SRepEntry_ {
+    uint8_t addr[16];
+    uint8_t family;
+    uint8_t netmask;
+    uint8_t cat;
+    uint8_t value;
+    /** remove the entry instead of setting it */
+    bool remove;
+} SRepEntry;
+
+typedef struct SRepEntries_ {
+    SRepEntry *e;
+    uint32_t cnt;
+    uint32_t size;
+} SRepEntries;
+
+/** the copies of the trees, the one in use is srep_trees[srep_gen & 1].
+ *  srep_gen is 0 until the store is set up. */
+static SRepCIDRTree *srep_trees[2] = { NULL, NULL };
+SC_ATOMIC_DECLARE(uint64_t, srep_gen);
+/** serializes the writers */
+static SCMutex srep_lock = SCMUTEX_INITIALIZER;
+
+static SCMutex srep_readers_lock = SCMUTEX_INITIALIZER;
+static SRepReader *srep_readers = NULL;
+
+/** categories are only loaded once, on the first init */
+static bool srep_cats_loaded = false;
+
+static void SRepTreesFree(SRepCIDRTree *cidr_ctx)
+{
+    if (cidr_ctx == NULL)
+        return;
+
+    for (int i = 0; i < SREP_MAX_CATS; i++) {
+        if (cidr_ctx->srepIPV4_tree[i] != NULL)
+            SCRadixReleaseRadixTree(cidr_ctx->srepIPV4_tree[i]);
+        if (cidr_ctx->srepIPV6_tree[i] != NULL)
+            SCRadixReleaseRadixTree(cidr_ctx->srepIPV6_tree[i]);
+    }
+    SCFree(cidr_ctx);
+}
 
-static uint32_t SRepIncrVersion(void)
+static SRepCIDRTree *SRepTreesAlloc(void)
 {
-    return ++srep_version;
+    SRepCIDRTree *cidr_ctx = SCMalloc(sizeof(SRepCIDRTree));
+    if (unlikely(cidr_ctx == NULL))
+        return NULL;
+    memset(cidr_ctx, 0, sizeof(SRepCIDRTree));
+    return cidr_ctx;
+}
+
+/**
+ *  \brief set or remove an entry in one copy of the trees
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory
+ */
+static int SRepTreesApply(SRepCIDRTree *cidr_ctx, const SRepEntry *e)
+{
+    SCRadixTree **tree = (e->family == AF_INET) ?
+        &cidr_ctx->srepIPV4_tree[e->cat] : &cidr_ctx->srepIPV6_tree[e->cat];
+
+    if (e->remove) {
+        if (*tree == NULL)
+            return 0;
+        if (e->family == AF_INET)
+            SCRadixRemoveKeyIPV4Netblock((uint8_t *)e->addr, *tree, e->netmask);
+        else
+            SCRadixRemoveKeyIPV6Netblock((uint8_t *)e->addr, *tree, e->netmask);
+        return 0;
+    }
+
+    if (*tree == NULL) {
+        *tree = SCRadixCreateRadixTree(NULL, NULL);
+        if (*tree == NULL)
+            return -1;
+    }
+
+    SCRadixNode *node;
+    if (e->family == AF_INET)
+        node = SCRadixAddKeyIPV4Netblock((uint8_t *)e->addr, *tree,
+                SREP_VALUE_TO_USER(e->value), e->netmask);
+    else
+        node = SCRadixAddKeyIPV6Netblock((uint8_t *)e->addr, *tree,
+                SREP_VALUE_TO_USER(e->value), e->netmask);
+    if (node == NULL)
+        return -1;
+    /* the add keeps the user data of a key that is already in the tree */
+    node->user = SREP_VALUE_TO_USER(e->value);
+    return 0;
 }
 
-static uint32_t SRepGetVersion(void)
+/** \retval cnt entries that could not be applied */
+static uint32_t SRepTreesApplyAll(SRepCIDRTree *cidr_ctx, const SRepEntry *e, uint32_t cnt)
 {
-    return srep_version;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (SRepTreesApply(cidr_ctx, &e[i]) < 0)
+            failed++;
+    }
+    return failed;
 }
 
-void SRepResetVersion(void)
+/** \brief set up the empty store on first use, srep_lock held */
+static int SRepStoreInit(void)
 {
-    srep_version = 0;
+    if (SC_ATOMIC_GET(srep_gen) != 0)
+        return 0;
+
+    srep_trees[0] = SRepTreesAlloc();
+    srep_trees[1] = SRepTreesAlloc();
+    if (srep_trees[0] == NULL || srep_trees[1] == NULL) {
+        SRepTreesFree(srep_trees[0]);
+        SRepTreesFree(srep_trees[1]);
+        srep_trees[0] = srep_trees[1] = NULL;
+        return -1;
+    }
+    SC_ATOMIC_SET(srep_gen, 1);
+    return 0;
 }
 
-static uint32_t SRepGetEffectiveVersion(void)
+/**
+ *  \brief make the other copy the one in use and wait for the readers
+ *         of the old one, srep_lock held
+ *
+ *  \retval cidr_ctx the copy that was in use, now unused
+ */
+static SRepCIDRTree *SRepPublish(void)
 {
-    return SC_ATOMIC_GET(srep_eversion);
+    const uint64_t gen = SC_ATOMIC_ADD(srep_gen, 1);
+
+    SCMutexLock(&srep_readers_lock);
+    for (SRepReader *r = srep_readers; r != NULL; r = r->next) {
+        uint64_t rgen;
+        while ((rgen = SC_ATOMIC_GET(r->gen)) != 0 && rgen != gen) {
+            SleepUsec(10);
+        }
+    }
+    SCMutexUnlock(&srep_readers_lock);
+
+    return srep_trees[(gen + 1) & 1];
 }
 
-static void SRepCIDRFreeUserData(void *data)
+#if defined(BUILD_UNIX_SOCKET) || defined(UNITTESTS)
+/**
+ *  \brief apply a set of changes to the store
+ *
+ *  The readers keep seeing the old data until all changes are in.
+ *
+ *  \retval cnt entries that could not be applied, -1 on error
+ */
+static int SRepUpdate(const SRepEntry *e, uint32_t cnt)
 {
-    if (data != NULL)
-        SCFree(data);
+    SCMutexLock(&srep_lock);
+    if (SRepStoreInit() < 0) {
+        SCMutexUnlock(&srep_lock);
+        return -1;
+    }
 
-    return;
+    const uint64_t gen = SC_ATOMIC_GET(srep_gen);
+    uint32_t failed = SRepTreesApplyAll(srep_trees[(gen + 1) & 1], e, cnt);
+    SRepCIDRTree *unused = SRepPublish();
+    /* apply the same changes to keep the copies the same */
+    const uint32_t failed2 = SRepTreesApplyAll(unused, e, cnt);
+    failed = MAX(failed, failed2);
+    SCMutexUnlock(&srep_lock);
+    return (int)failed;
 }
+#endif
 
-static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, int value)
+/**
+ *  \brief replace the content of the store with new copies
+ *
+ *  Takes ownership of the copies.
+ */
+static int SRepReplace(SRepCIDRTree *a, SRepCIDRTree *b)
 {
-    SReputation *user_data = NULL;
-    if ((user_data = SCMalloc(sizeof(SReputation))) == NULL) {
-        SCLogError(SC_ERR_FATAL, "Error allocating memory. Exiting");
-        exit(EXIT_FAILURE);
+    SCMutexLock(&srep_lock);
+    if (SRepStoreInit() < 0) {
+        SCMutexUnlock(&srep_lock);
+        SRepTreesFree(a);
+        SRepTreesFree(b);
+        return -1;
     }
-    memset(user_data, 0x00, sizeof(SReputation));
 
-    user_data->version = SRepGetVersion();
-    user_data->rep[cat] = value;
+    /* the unused copy can be replaced right away */
+    const uint64_t gen = SC_ATOMIC_GET(srep_gen);
+    SRepCIDRTree *old = srep_trees[(gen + 1) & 1];
+    srep_trees[(gen + 1) & 1] = a;
+    SRepTreesFree(old);
 
-    if (strchr(ip, ':') != NULL) {
-        if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
-            cidr_ctx->srepIPV6_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
-            if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
-                SCLogDebug("Error initializing Reputation IPV6 with CIDR module for cat %d", cat);
-                exit(EXIT_FAILURE);
-            }
-            SCLogDebug("Reputation IPV6 with CIDR module for cat %d initialized", cat);
-        }
+    old = SRepPublish();
+    srep_trees[gen & 1] = b;
+    SRepTreesFree(old);
+    SCMutexUnlock(&srep_lock);
+    return 0;
+}
 
-        SCLogDebug("adding ipv6 host %s", ip);
-        if (SCRadixAddKeyIPV6String(ip, cidr_ctx->srepIPV6_tree[cat], (void *)user_data) == NULL) {
-            SCLogWarning(SC_ERR_INVALID_VALUE,
-                        "failed to add ipv6 host %s", ip);
-        }
+/**
+ *  \brief register a thread that reads from the store
+ *
+ *  \retval r reader to pass to SRepReadBegin(), NULL on error
+ */
+SRepReader *SRepReaderRegister(void)
+{
+    SRepReader *r = SCMallocAligned(sizeof(SRepReader), CLS);
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0, sizeof(SRepReader));
+    SC_ATOMIC_INIT(r->gen);
+
+    SCMutexLock(&srep_readers_lock);
+    r->next = srep_readers;
+    srep_readers = r;
+    SCMutexUnlock(&srep_readers_lock);
+    return r;
+}
 
-    } else {
-        if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
-            cidr_ctx->srepIPV4_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
-            if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
-                SCLogDebug("Error initializing Reputation IPV4 with CIDR module for cat %d", cat);
-                exit(EXIT_FAILURE);
-            }
-            SCLogDebug("Reputation IPV4 with CIDR module for cat %d initialized", cat);
+void SRepReaderDeregister(SRepReader *r)
+{
+    if (r == NULL)
+        return;
+
+    SCMutexLock(&srep_readers_lock);
+    SRepReader **pr = &srep_readers;
+    while (*pr != NULL) {
+        if (*pr == r) {
+            *pr = r->next;
+            break;
         }
+        pr = &(*pr)->next;
+    }
+    SCMutexUnlock(&srep_readers_lock);
+    SCFreeAligned(r);
+}
 
-        SCLogDebug("adding ipv4 host %s", ip);
-        if (SCRadixAddKeyIPV4String(ip, cidr_ctx->srepIPV4_tree[cat], (void *)user_data) == NULL) {
-            SCLogWarning(SC_ERR_INVALID_VALUE,
-                        "failed to add ipv4 host %s", ip);
-        }
+/**
+ *  \brief get the trees to look up in
+ *
+ *  The trees stay valid until SRepReadEnd(), which has to be called soon
+ *  as the writers wait for it.
+ *
+ *  \retval cidr_ctx trees, NULL if there is no reputation data
+ */
+const SRepCIDRTree *SRepReadBegin(SRepReader *r)
+{
+    uint64_t gen = SC_ATOMIC_GET(srep_gen);
+    if (gen == 0)
+        return NULL;
+
+    /* the writer may have moved on before our slot was set, in which case
+     * it may not have seen it: check again until gen is stable */
+    while (1) {
+        SC_ATOMIC_SET(r->gen, gen);
+        const uint64_t cur = SC_ATOMIC_GET(srep_gen);
+        if (cur == gen)
+            break;
+        gen = cur;
     }
+    return srep_trees[gen & 1];
+}
+
+void SRepReadEnd(SRepReader *r)
+{
+    SC_ATOMIC_SET(r->gen, 0);
 }
 
-static uint8_t SRepCIDRGetIPv4IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv4_addr, uint8_t cat)
+static inline uint8_t SRepCIDRGetIPv4IPRep(const SRepCIDRTree *cidr_ctx,
+        uint8_t *ipv4_addr, uint8_t cat)
 {
     void *user_data = NULL;
     (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, cidr_ctx->srepIPV4_tree[cat], &user_data);
-    if (user_data == NULL)
-        return 0;
-
-    SReputation *r = (SReputation *)user_data;
-    return r->rep[cat];
+    return SREP_USER_TO_VALUE(user_data);
 }
 
-static uint8_t SRepCIDRGetIPv6IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv6_addr, uint8_t cat)
+static inline uint8_t SRepCIDRGetIPv6IPRep(const SRepCIDRTree *cidr_ctx,
+        uint8_t *ipv6_addr, uint8_t cat)
 {
     void *user_data = NULL;
     (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, cidr_ctx->srepIPV6_tree[cat], &user_data);
-    if (user_data == NULL)
-        return 0;
-
-    SReputation *r = (SReputation *)user_data;
-    return r->rep[cat];
+    return SREP_USER_TO_VALUE(user_data);
 }
 
-uint8_t SRepCIDRGetIPRepSrc(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint32_t version)
+uint8_t SRepCIDRGetIPRepSrc(const SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat)
 {
     uint8_t rep = 0;
 
+    if (cidr_ctx == NULL)
+        return 0;
+
     if (PKT_IS_IPV4(p))
         rep = SRepCIDRGetIPv4IPRep(cidr_ctx, (uint8_t *)GET_IPV4_SRC_ADDR_PTR(p), cat);
     else if (PKT_IS_IPV6(p))
@@ -155,10 +360,13 @@ uint8_t SRepCIDRGetIPRepSrc(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint
     return rep;
 }
 
-uint8_t SRepCIDRGetIPRepDst(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint32_t version)
+uint8_t SRepCIDRGetIPRepDst(const SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat)
 {
     uint8_t rep = 0;
 
+    if (cidr_ctx == NULL)
+        return 0;
+
     if (PKT_IS_IPV4(p))
         rep = SRepCIDRGetIPv4IPRep(cidr_ctx, (uint8_t *)GET_IPV4_DST_ADDR_PTR(p), cat);
     else if (PKT_IS_IPV6(p))
@@ -167,55 +375,6 @@ uint8_t SRepCIDRGetIPRepDst(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint
     return rep;
 }
 
-/** \brief Increment effective reputation version after
- *         a rule/reputatio reload is complete. */
-void SRepReloadComplete(void)
-{
-    (void) SC_ATOMIC_ADD(srep_eversion, 1);
-    SCLogDebug("effective Reputation version %u", SRepGetEffectiveVersion());
-}
-
-/** \brief Set effective reputation version after
- *         reputation initialization is complete. */
-static void SRepInitComplete(void)
-{
-    (void) SC_ATOMIC_SET(srep_eversion, 1);
-    SCLogDebug("effective Reputation version %u", SRepGetEffectiveVersion());
-}
-
-/** \brief Check if a Host is timed out wrt ip rep, meaning a new
- *         version is in place.
- *
- *  We clean up the old version here.
- *
- *  \param h host
- *
- *  \retval 0 not timed out
- *  \retval 1 timed out
- */
-int SRepHostTimedOut(Host *h)
-{
-    BUG_ON(h == NULL);
-
-    if (h->iprep == NULL)
-        return 1;
-
-    uint32_t eversion = SRepGetEffectiveVersion();
-    SReputation *r = h->iprep;
-    if (r->version < eversion) {
-        SCLogDebug("host %p has reputation version %u, "
-                "effective version is %u", h, r->version, eversion);
-
-        SCFree(h->iprep);
-        h->iprep = NULL;
-
-        HostDecrUsecnt(h);
-        return 1;
-    }
-
-    return 0;
-}
-
 static int SRepCatSplitLine(char *line, uint8_t *cat, char *shortname, size_t shortname_len)
 {
     size_t line_len = strlen(line);
@@ -262,12 +421,50 @@ static int SRepCatSplitLine(char *line, uint8_t *cat, char *shortname, size_t sh
 
 }
 
+/**
+ *  \brief parse an address with an optional /netmask
+ *
+ *  \retval 0 ok
+ *  \retval -1 invalid
+ */
+static int SRepParseAddress(const char *str, SRepEntry *e)
+{
+    char ip[64];
+    if (strlcpy(ip, str, sizeof(ip)) >= sizeof(ip))
+        return -1;
+
+    int netmask = -1;
+    char *mask = strchr(ip, '/');
+    if (mask != NULL) {
+        *mask++ = '\0';
+        if (*mask == '\0' || strlen(mask) > 3 || strspn(mask, "0123456789") != strlen(mask))
+            return -1;
+        netmask = atoi(mask);
+    }
+
+    memset(e->addr, 0, sizeof(e->addr));
+    if (inet_pton(AF_INET, ip, e->addr) == 1) {
+        e->family = AF_INET;
+        if (netmask > 32)
+            return -1;
+        e->netmask = (netmask < 0) ? 32 : (uint8_t)netmask;
+    } else if (inet_pton(AF_INET6, ip, e->addr) == 1) {
+        e->family = AF_INET6;
+        if (netmask > 128)
+            return -1;
+        e->netmask = (netmask < 0) ? 128 : (uint8_t)netmask;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  *  \retval 0 valid
  *  \retval 1 header
  *  \retval -1 bad line
  */
-static int SRepSplitLine(SRepCIDRTree *cidr_ctx, char *line, Address *ip, uint8_t *cat, uint8_t *value)
+static int SRepSplitLine(char *line, SRepEntry *e)
 {
     size_t line_len = strlen(line);
     char *ptrs[3] = {NULL,NULL,NULL};
@@ -315,22 +512,12 @@ static int SRepSplitLine(SRepCIDRTree *cidr_ctx, char *line, Address *ip, uint8_
         return -1;
     }
 
-    if (strchr(ptrs[0], '/') != NULL) {
-        SRepCIDRAddNetblock(cidr_ctx, ptrs[0], c, v);
-        return 1;
-    } else {
-        if (inet_pton(AF_INET, ptrs[0], &ip->address) == 1) {
-            ip->family = AF_INET;
-        } else if (inet_pton(AF_INET6, ptrs[0], &ip->address) == 1) {
-            ip->family = AF_INET6;
-        } else {
-            return -1;
-        }
-
-        *cat = c;
-        *value = v;
-    }
+    if (SRepParseAddress(ptrs[0], e) < 0)
+        return -1;
 
+    e->cat = (uint8_t)c;
+    e->value = (uint8_t)v;
+    e->remove = false;
     return 0;
 }
 
@@ -368,13 +555,8 @@ static int SRepLoadCatFile(const char *filename)
 int SRepLoadCatFileFromFD(FILE *fp)
 {
     char line[8192] = "";
-    Address a;
-    memset(&a, 0x00, sizeof(a));
-    a.family = AF_INET;
     memset(&srep_cat_table, 0x00, sizeof(srep_cat_table));
 
-    BUG_ON(SRepGetVersion() > 0);
-
     while(fgets(line, (int)sizeof(line), fp) != NULL) {
         size_t len = strlen(line);
         if (len == 0)
@@ -411,33 +593,27 @@ int SRepLoadCatFileFromFD(FILE *fp)
             continue;
         SCLogDebug("CAT %d, name %s", i, srep_cat_table[i]);
     }
+    srep_cats_loaded = true;
     return 0;
 }
 
-static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
+static int SRepEntriesAppend(SRepEntries *list, const SRepEntry *e)
 {
-    int r = 0;
-    FILE *fp = fopen(filename, "r");
-
-    if (fp == NULL) {
-        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep file %s: %s", filename, strerror(errno));
-        return -1;
+    if (list->cnt == list->size) {
+        const uint32_t size = list->size ? list->size * 2 : 1024;
+        SRepEntry *ptr = SCRealloc(list->e, size * sizeof(SRepEntry));
+        if (ptr == NULL)
+            return -1;
+        list->e = ptr;
+        list->size = size;
     }
-
-    r = SRepLoadFileFromFD(cidr_ctx, fp);
-
-    fclose(fp);
-    fp = NULL;
-    return r;
-
+    list->e[list->cnt++] = *e;
+    return 0;
 }
 
-int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
+static int SRepLoadEntriesFromFD(SRepEntries *list, FILE *fp)
 {
     char line[8192] = "";
-    Address a;
-    memset(&a, 0x00, sizeof(a));
-    a.family = AF_INET;
 
     while(fgets(line, (int)sizeof(line), fp) != NULL) {
         size_t len = strlen(line);
@@ -459,65 +635,14 @@ int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
             line[len - 1] = '\0';
         }
 
-        uint8_t cat = 0, value = 0;
-        int r = SRepSplitLine(cidr_ctx, line, &a, &cat, &value);
+        SRepEntry e;
+        int r = SRepSplitLine(line, &e);
         if (r < 0) {
             SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%s\"", line);
         } else if (r == 0) {
-            if (a.family == AF_INET) {
-                char ipstr[16];
-                PrintInet(AF_INET, (const void *)&a.address, ipstr, sizeof(ipstr));
-                SCLogDebug("%s %u %u", ipstr, cat, value);
-            } else {
-                char ipstr[128];
-                PrintInet(AF_INET6, (const void *)&a.address, ipstr, sizeof(ipstr));
-                SCLogDebug("%s %u %u", ipstr, cat, value);
-            }
-
-            Host *h = HostGetHostFromHash(&a);
-            if (h == NULL) {
-                SCLogError(SC_ERR_NO_REPUTATION, "failed to get a host, increase host.memcap");
-                break;
-            } else {
-                //SCLogInfo("host %p", h);
-
-                if (h->iprep == NULL) {
-                    h->iprep = SCMalloc(sizeof(SReputation));
-                    if (h->iprep != NULL) {
-                        memset(h->iprep, 0x00, sizeof(SReputation));
-
-                        HostIncrUsecnt(h);
-                    }
-                }
-                if (h->iprep != NULL) {
-                    SReputation *rep = h->iprep;
-
-                    /* if version is outdated, it's an older entry that we'll
-                     * now replace. */
-                    if (rep->version != SRepGetVersion()) {
-                        memset(rep, 0x00, sizeof(SReputation));
-                    }
-
-                    rep->version = SRepGetVersion();
-                    rep->rep[cat] = value;
-
-                    SCLogDebug("host %p iprep %p setting cat %u to value %u",
-                        h, h->iprep, cat, value);
-#ifdef DEBUG
-                    if (SCLogDebugEnabled()) {
-                        int i;
-                        for (i = 0; i < SREP_MAX_CATS; i++) {
-                            if (rep->rep[i] == 0)
-                                continue;
-
-                            SCLogDebug("--> host %p iprep %p cat %d to value %u",
-                                    h, h->iprep, i, rep->rep[i]);
-                        }
-                    }
-#endif
-                }
-
-                HostRelease(h);
+            if (SRepEntriesAppend(list, &e) < 0) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to store reputation entry");
+                return -1;
             }
         }
     }
@@ -525,6 +650,64 @@ int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
     return 0;
 }
 
+/** \brief build a copy of the trees from the entries of the files */
+static SRepCIDRTree *SRepTreesBuild(const SRepEntries *list)
+{
+    SRepCIDRTree *cidr_ctx = SRepTreesAlloc();
+    if (cidr_ctx == NULL)
+        return NULL;
+
+    if (SRepTreesApplyAll(cidr_ctx, list->e, list->cnt) > 0) {
+        SRepTreesFree(cidr_ctx);
+        return NULL;
+    }
+    return cidr_ctx;
+}
+
+/** \brief replace the store by the entries of the files */
+static int SRepReplaceFromEntries(const SRepEntries *list)
+{
+    SRepCIDRTree *a = SRepTreesBuild(list);
+    SRepCIDRTree *b = (a != NULL) ? SRepTreesBuild(list) : NULL;
+    if (b == NULL) {
+        SRepTreesFree(a);
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to build the reputation trees");
+        return -1;
+    }
+    return SRepReplace(a, b);
+}
+
+static int SRepLoadFile(SRepEntries *list, char *filename)
+{
+    int r = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep file %s: %s", filename, strerror(errno));
+        return -1;
+    }
+
+    r = SRepLoadEntriesFromFD(list, fp);
+
+    fclose(fp);
+    fp = NULL;
+    return r;
+
+}
+
+/** \brief replace the content of the store by the entries read from fp */
+int SRepLoadFileFromFD(FILE *fp)
+{
+    SRepEntries list = { NULL, 0, 0 };
+
+    int r = SRepLoadEntriesFromFD(&list, fp);
+    if (r == 0)
+        r = SRepReplaceFromEntries(&list);
+
+    SCFree(list.e);
+    return r;
+}
+
 /**
  *  \brief Create the path if default-rule-path was specified
  *  \param sig_file The name of the file
@@ -566,39 +749,63 @@ static char *SRepCompleteFilePath(char *file)
     return path;
 }
 
+/**
+ *  \brief load the reputation files into the store
+ *
+ *  \param keep_on_error keep the current data if a file fails to load,
+ *                       otherwise the entries of the other files are used
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int SRepLoadFiles(bool keep_on_error)
+{
+    ConfNode *files = ConfGetNode("reputation-files");
+    if (files == NULL)
+        return -1;
+
+    SRepEntries list = { NULL, 0, 0 };
+    ConfNode *file = NULL;
+    int r = 0;
+
+    TAILQ_FOREACH(file, &files->head, next) {
+        char *sfile = SRepCompleteFilePath(file->val);
+        if (sfile == NULL) {
+            r = -1;
+            continue;
+        }
+        SCLogInfo("Loading reputation file: %s", sfile);
+        if (SRepLoadFile(&list, sfile) < 0)
+            r = -1;
+        SCFree(sfile);
+    }
+
+    if (r == 0 || !keep_on_error) {
+        if (SRepReplaceFromEntries(&list) < 0) {
+            r = -1;
+        } else {
+            SCLogInfo("%u reputation entries loaded", list.cnt);
+        }
+    }
+    SCFree(list.e);
+    return r;
+}
+
 /** \brief init reputation
  *
- *  \param de_ctx detection engine ctx for tracking iprep version
+ *  \param de_ctx detection engine ctx
  *
  *  \retval 0 ok
  *  \retval -1 error
  *
  *  If this function is called more than once, the category file
- *  is not reloaded.
+ *  is not reloaded. The reputation files are, so a rule reload
+ *  also updates the reputation.
  */
 int SRepInit(DetectEngineCtx *de_ctx)
 {
     ConfNode *files;
-    ConfNode *file = NULL;
     const char *filename = NULL;
-    int init = 0;
-    int i = 0;
-
-    de_ctx->srepCIDR_ctx = (SRepCIDRTree *)SCMalloc(sizeof(SRepCIDRTree));
-    if (de_ctx->srepCIDR_ctx == NULL)
-        exit(EXIT_FAILURE);
-    memset(de_ctx->srepCIDR_ctx, 0, sizeof(SRepCIDRTree));
-    SRepCIDRTree *cidr_ctx = de_ctx->srepCIDR_ctx;
-
-    for (i = 0; i < SREP_MAX_CATS; i++) {
-        cidr_ctx->srepIPV4_tree[i] = NULL;
-        cidr_ctx->srepIPV6_tree[i] = NULL;
-    }
-
-    if (SRepGetVersion() == 0) {
-        SC_ATOMIC_INIT(srep_eversion);
-        init = 1;
-    }
 
     /* if both settings are missing, we assume the user doesn't want ip rep */
     (void)ConfGet("reputation-categories-file", &filename);
@@ -613,7 +820,7 @@ int SRepInit(DetectEngineCtx *de_ctx)
         return -1;
     }
 
-    if (init) {
+    if (!srep_cats_loaded) {
         if (filename == NULL) {
             SCLogError(SC_ERR_NO_REPUTATION, "\"reputation-categories-file\" not set");
             return -1;
@@ -628,56 +835,225 @@ int SRepInit(DetectEngineCtx *de_ctx)
         }
     }
 
-    de_ctx->srep_version = SRepIncrVersion();
-    SCLogDebug("Reputation version %u", de_ctx->srep_version);
+    /* the store is shared by the tenants, loading one doesn't reload it */
+    if (strlen(de_ctx->config_prefix) > 0 && SC_ATOMIC_GET(srep_gen) != 0)
+        return 0;
 
-    /* ok, let's load reputation files from the general config */
-    if (files != NULL) {
-        TAILQ_FOREACH(file, &files->head, next) {
-            char *sfile = SRepCompleteFilePath(file->val);
-            if (sfile) {
-                SCLogInfo("Loading reputation file: %s", sfile);
+    if (SRepLoadFiles(false) < 0) {
+        if (de_ctx->failure_fatal == 1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
 
-                int r = SRepLoadFile(cidr_ctx, sfile);
-                if (r < 0){
-                    if (de_ctx->failure_fatal == 1) {
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                SCFree(sfile);
-            }
+/**
+ *  \brief reload the reputation files, keeping the current data if one
+ *         of them fails to load
+ *
+ *  The categories are not reloaded, the rules refer to them.
+ */
+int SRepReload(void)
+{
+    if (!srep_cats_loaded)
+        return -1;
+    return SRepLoadFiles(true);
+}
+
+/** \brief free the store, no readers may be left */
+void SRepDestroy(void)
+{
+    SCMutexLock(&srep_lock);
+    SC_ATOMIC_SET(srep_gen, 0);
+    SRepTreesFree(srep_trees[0]);
+    SRepTreesFree(srep_trees[1]);
+    srep_trees[0] = srep_trees[1] = NULL;
+    SCMutexUnlock(&srep_lock);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/** \brief get a category from its number or short name */
+static int SRepJsonGetCat(json_t *jcat, uint8_t *cat)
+{
+    json_int_t c = -1;
+
+    if (json_is_integer(jcat)) {
+        c = json_integer_value(jcat);
+    } else if (json_is_string(jcat)) {
+        const char *str = json_string_value(jcat);
+        if (*str != '\0' && strspn(str, "0123456789") == strlen(str) && strlen(str) < 3) {
+            c = atoi(str);
+        } else {
+            char shortname[SREP_SHORTNAME_LEN];
+            strlcpy(shortname, str, sizeof(shortname));
+            c = SRepCatGetByShortname(shortname);
+            if (c == 0)
+                return -1;
         }
     }
+    if (c < 0 || c >= SREP_MAX_CATS)
+        return -1;
 
-    /* Set effective rep version.
-     * On live reload we will handle this after de_ctx has been swapped */
-    if (init) {
-        SRepInitComplete();
+    *cat = (uint8_t)c;
+    return 0;
+}
+
+static int SRepJsonGetEntry(json_t *jentry, bool remove, SRepEntry *e, json_t *answer)
+{
+    char msg[128];
+
+    json_t *jip = json_object_get(jentry, "ip");
+    if (!json_is_string(jip)) {
+        json_object_set_new(answer, "message", json_string("ip is not a string"));
+        return -1;
+    }
+    if (SRepParseAddress(json_string_value(jip), e) < 0) {
+        snprintf(msg, sizeof(msg), "invalid ip %s", json_string_value(jip));
+        json_object_set_new(answer, "message", json_string(msg));
+        return -1;
+    }
+    if (SRepJsonGetCat(json_object_get(jentry, "category"), &e->cat) < 0) {
+        snprintf(msg, sizeof(msg), "unknown category for %s", json_string_value(jip));
+        json_object_set_new(answer, "message", json_string(msg));
+        return -1;
     }
 
-    HostPrintStats();
+    e->remove = remove;
+    e->value = 0;
+    if (!remove) {
+        json_t *jval = json_object_get(jentry, "value");
+        if (!json_is_integer(jval) || json_integer_value(jval) < 0 ||
+                json_integer_value(jval) > SREP_MAX_VAL) {
+            snprintf(msg, sizeof(msg), "value for %s is not a number from 0 to %d",
+                    json_string_value(jip), SREP_MAX_VAL);
+            json_object_set_new(answer, "message", json_string(msg));
+            return -1;
+        }
+        e->value = (uint8_t)json_integer_value(jval);
+    }
     return 0;
 }
 
-void SRepDestroy(DetectEngineCtx *de_ctx) {
-    if (de_ctx->srepCIDR_ctx != NULL) {
-        int i;
-        for (i = 0; i < SREP_MAX_CATS; i++) {
-            if (de_ctx->srepCIDR_ctx->srepIPV4_tree[i] != NULL) {
-                SCRadixReleaseRadixTree(de_ctx->srepCIDR_ctx->srepIPV4_tree[i]);
-                de_ctx->srepCIDR_ctx->srepIPV4_tree[i] = NULL;
-            }
+/**
+ *  \brief set and remove reputation entries
+ *
+ *  Takes "add" and "remove" lists of entries with an "ip", optionally
+ *  with a /netmask, a "category", and for "add" a "value". A single
+ *  entry can also be passed directly, it's removed if it has no value.
+ *  All changes of a command become visible at once.
+ */
+TmEcode SRepUpdateCommand(json_t *cmd, json_t *answer, void *data)
+{
+    if (!srep_cats_loaded) {
+        json_object_set_new(answer, "message", json_string("ip reputation is not enabled"));
+        return TM_ECODE_FAILED;
+    }
 
-            if (de_ctx->srepCIDR_ctx->srepIPV6_tree[i] != NULL) {
-                SCRadixReleaseRadixTree(de_ctx->srepCIDR_ctx->srepIPV6_tree[i]);
-                de_ctx->srepCIDR_ctx->srepIPV6_tree[i] = NULL;
-            }
+    json_t *jadd = json_object_get(cmd, "add");
+    json_t *jremove = json_object_get(cmd, "remove");
+    size_t cnt = 1;
+    if (jadd != NULL || jremove != NULL) {
+        if ((jadd != NULL && !json_is_array(jadd)) ||
+                (jremove != NULL && !json_is_array(jremove))) {
+            json_object_set_new(answer, "message", json_string("add and remove must be lists"));
+            return TM_ECODE_FAILED;
+        }
+        cnt = json_array_size(jadd) + json_array_size(jremove);
+        if (cnt == 0) {
+            json_object_set_new(answer, "message", json_string("nothing to update"));
+            return TM_ECODE_OK;
         }
+    }
+
+    SRepEntry *e = SCCalloc(cnt, sizeof(SRepEntry));
+    if (e == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
 
-        SCFree(de_ctx->srepCIDR_ctx);
-        de_ctx->srepCIDR_ctx = NULL;
+    uint32_t added = 0, removed = 0;
+    if (jadd == NULL && jremove == NULL) {
+        const bool remove = (json_object_get(cmd, "value") == NULL);
+        if (SRepJsonGetEntry(cmd, remove, &e[0], answer) < 0)
+            goto error;
+        if (remove)
+            removed++;
+        else
+            added++;
+    } else {
+        for (size_t i = 0; i < json_array_size(jadd); i++) {
+            if (SRepJsonGetEntry(json_array_get(jadd, i), false, &e[added], answer) < 0)
+                goto error;
+            added++;
+        }
+        for (size_t i = 0; i < json_array_size(jremove); i++) {
+            if (SRepJsonGetEntry(json_array_get(jremove, i), true, &e[added + removed], answer) < 0)
+                goto error;
+            removed++;
+        }
     }
+
+    char msg[128];
+    int r = SRepUpdate(e, added + removed);
+    SCFree(e);
+    if (r != 0) {
+        if (r < 0)
+            snprintf(msg, sizeof(msg), "update failed");
+        else
+            snprintf(msg, sizeof(msg), "%d entries could not be set, out of memory", r);
+        json_object_set_new(answer, "message", json_string(msg));
+        return TM_ECODE_FAILED;
+    }
+
+    snprintf(msg, sizeof(msg), "%u entries set, %u removed", added, removed);
+    json_object_set_new(answer, "message", json_string(msg));
+    return TM_ECODE_OK;
+
+error:
+    SCFree(e);
+    return TM_ECODE_FAILED;
+}
+
+/** \brief reload the reputation files */
+TmEcode SRepReloadCommand(json_t *cmd, json_t *answer, void *data)
+{
+    if (!srep_cats_loaded) {
+        json_object_set_new(answer, "message", json_string("ip reputation is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+    if (SRepReload() < 0) {
+        json_object_set_new(answer, "message", json_string("reload failed"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(answer, "message", json_string("reputation files reloaded"));
+    return TM_ECODE_OK;
+}
+
+/** \brief get the value of an address for a category */
+TmEcode SRepLookupCommand(json_t *cmd, json_t *answer, void *data)
+{
+    SRepEntry e;
+    if (SRepJsonGetEntry(cmd, true, &e, answer) < 0)
+        return TM_ECODE_FAILED;
+
+    uint8_t value = 0;
+    void *user_data = NULL;
+    SCMutexLock(&srep_lock);
+    const uint64_t gen = SC_ATOMIC_GET(srep_gen);
+    if (gen != 0) {
+        const SRepCIDRTree *cidr_ctx = srep_trees[gen & 1];
+        if (e.family == AF_INET)
+            (void)SCRadixFindKeyIPV4BestMatch(e.addr, cidr_ctx->srepIPV4_tree[e.cat], &user_data);
+        else
+            (void)SCRadixFindKeyIPV6BestMatch(e.addr, cidr_ctx->srepIPV6_tree[e.cat], &user_data);
+        value = SREP_USER_TO_VALUE(user_data);
+    }
+    SCMutexUnlock(&srep_lock);
+
+    json_object_set_new(answer, "message", json_integer(value));
+    return TM_ECODE_OK;
 }
+#endif /* BUILD_UNIX_SOCKET */
 
 #ifdef UNITTESTS
 #include "tests/reputation.c"
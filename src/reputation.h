@@ -26,32 +26,39 @@
 #ifndef __REPUTATION_H__
 #define __REPUTATION_H__
 
-#include "host.h"
-
 #define SREP_MAX_CATS 60
 #define SREP_MAX_VAL 127
 
+/** one copy of the reputation data: a tree per category and ip version,
+ *  with the value of each address or netblock as the user data */
 typedef struct SRepCIDRTree_ {
     SCRadixTree *srepIPV4_tree[SREP_MAX_CATS];
     SCRadixTree *srepIPV6_tree[SREP_MAX_CATS];
 } SRepCIDRTree;
 
-typedef struct SReputation_ {
-    uint32_t version;
-    uint8_t rep[SREP_MAX_CATS];
-} SReputation;
+/** a thread reading from the reputation store */
+typedef struct SRepReader_ SRepReader;
 
 uint8_t SRepCatGetByShortname(char *shortname);
 int SRepInit(struct DetectEngineCtx_ *de_ctx);
-void SRepDestroy(struct DetectEngineCtx_ *de_ctx);
-void SRepReloadComplete(void);
-int SRepHostTimedOut(Host *);
+void SRepDestroy(void);
+
+SRepReader *SRepReaderRegister(void);
+void SRepReaderDeregister(SRepReader *r);
+const SRepCIDRTree *SRepReadBegin(SRepReader *r);
+void SRepReadEnd(SRepReader *r);
 
-uint8_t SRepCIDRGetIPRepSrc(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint32_t version);
-uint8_t SRepCIDRGetIPRepDst(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint32_t version);
-void SRepResetVersion(void);
+uint8_t SRepCIDRGetIPRepSrc(const SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat);
+uint8_t SRepCIDRGetIPRepDst(const SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat);
 int SRepLoadCatFileFromFD(FILE *fp);
-int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp);
+int SRepLoadFileFromFD(FILE *fp);
+int SRepReload(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode SRepUpdateCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode SRepReloadCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode SRepLookupCommand(json_t *cmd, json_t *answer, void *data);
+#endif
 
 void SCReputationRegisterTests(void);
 
@@ -156,6 +156,9 @@ static void *ParseAFPConfig(const char *iface)
     aconf->copy_mode = AFP_COPY_MODE_NONE;
     aconf->block_timeout = 10;
     aconf->block_size = getpagesize() << AFP_BLOCK_SIZE_DEFAULT_ORDER;
+    aconf->poll_mode = CAPTURE_POLL_BLOCKING;
+    aconf->poll_spin = AFP_POLL_SPIN_DEFAULT;
+    aconf->busy_poll = 0;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
         if (strlen(bpf_filter) > 0) {
@@ -385,6 +388,15 @@ static void *ParseAFPConfig(const char *iface)
                                &aconf->ebpf_lb_fd, EBPF_SOCKET_FILTER);
         if (ret != 0) {
             SCLogWarning(SC_ERR_INVALID_VALUE, "Error when loading eBPF lb file");
+        } else if (ConfGetChildValueBoolWithDefault(if_root, if_default,
+                    "ebpf-lb-rebalance", (int *)&boolval) == 1 && boolval) {
+            if (aconf->flags & AFP_TPACKET_V3) {
+                aconf->flags |= AFP_LB_REBALANCE;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_VALUE,
+                        "ebpf-lb-rebalance needs tpacket-v3 on iface %s, ignoring",
+                        aconf->iface);
+            }
         }
     }
 #else
@@ -436,6 +448,10 @@ static void *ParseAFPConfig(const char *iface)
         SCLogInfo("af-packet will use '%s' as XDP filter file",
                   ebpf_file);
         aconf->xdp_filter_file = ebpf_file;
+#ifdef HAVE_PACKET_XDP
+        /* expire the sources added by the ebpf-drop keyword */
+        EBPFDropRegister();
+#endif
         ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &conf_val);
         if (conf_val) {
 #ifdef HAVE_PACKET_XDP
@@ -530,6 +546,36 @@ static void *ParseAFPConfig(const char *iface)
         aconf->block_timeout = 10;
     }
 
+    if (ConfGetChildValueWithDefault(if_root, if_default, "poll-mode", &tmpctype) == 1) {
+        enum CapturePollMode poll_mode;
+        if (CapturePollParseMode(tmpctype, &poll_mode) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                    "Invalid poll-mode \"%s\" on iface %s, using blocking",
+                    tmpctype, aconf->iface);
+        } else {
+            aconf->poll_mode = poll_mode;
+        }
+    }
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "poll-spin", &value)) == 1) {
+        if (value < 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "poll-spin must be positive");
+        } else {
+            aconf->poll_spin = value;
+        }
+    }
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "busy-poll", &value)) == 1) {
+        if (value < 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "busy-poll must be positive");
+        } else {
+            aconf->busy_poll = value;
+        }
+    }
+    if (aconf->poll_mode != CAPTURE_POLL_BLOCKING) {
+        SCLogConfig("Using %s poll mode on iface %s",
+                aconf->poll_mode == CAPTURE_POLL_BUSY ? "busy" : "hybrid",
+                aconf->iface);
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogConfig("Disabling promiscuous mode on iface %s",
@@ -569,8 +615,21 @@ finalize:
     if (aconf->threads == 0) {
         /* for cluster_flow use core count */
         if (cluster_type == PACKET_FANOUT_HASH) {
-            aconf->threads = (int)UtilCpuGetNumProcessorsOnline();
-            SCLogPerf("%u cores, so using %u threads", aconf->threads, aconf->threads);
+            /* with an automatic cpu layout, use one thread per capture cpu */
+            if (AffinityIsAuto()) {
+                const char *runmode = RunmodeGetActive();
+                int set = (runmode != NULL && strcmp(runmode, "autofp") == 0) ?
+                    RECEIVE_CPU_SET : WORKER_CPU_SET;
+                aconf->threads = UtilAffinityGetAffinedCPUNum(&thread_affinity[set]);
+                if (aconf->threads > 0) {
+                    SCLogPerf("%d capture cpus, so using %d threads",
+                            aconf->threads, aconf->threads);
+                }
+            }
+            if (aconf->threads <= 0) {
+                aconf->threads = (int)UtilCpuGetNumProcessorsOnline();
+                SCLogPerf("%u cores, so using %u threads", aconf->threads, aconf->threads);
+            }
 
         /* for cluster_qm use RSS queue count */
         } else if (cluster_type == PACKET_FANOUT_QM) {
@@ -589,6 +648,13 @@ finalize:
     if (aconf->threads <= 0) {
         aconf->threads = 1;
     }
+#ifdef HAVE_PACKET_EBPF
+    if (aconf->flags & AFP_LB_REBALANCE) {
+        if (aconf->threads < 2 || EBPFLbSetup(iface, aconf->threads) != 0) {
+            aconf->flags &= ~AFP_LB_REBALANCE;
+        }
+    }
+#endif
     SC_ATOMIC_RESET(aconf->ref);
     (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
 
@@ -652,6 +718,23 @@ static int AFPConfigGeThreadsCount(void *conf)
     return afp->threads;
 }
 
+/** \brief reference the config of an interface for a worker added at
+ *         runtime
+ *
+ *  Only with a fanout group, which the new socket joins, and without
+ *  IPS peering or eBPF load balancing, which are set up for the number
+ *  of threads of the start.
+ */
+static void *AFPConfigRefForWorker(void *conf)
+{
+    AFPIfaceConfig *afp = (AFPIfaceConfig *)conf;
+    if (afp->threads < 2 || afp->copy_mode != AFP_COPY_MODE_NONE ||
+            (afp->flags & AFP_LB_REBALANCE))
+        return NULL;
+    (void) SC_ATOMIC_ADD(afp->ref, 1);
+    return afp;
+}
+
 int AFPRunModeIsIPS()
 {
     int nlive = LiveGetDeviceCount();
@@ -842,6 +925,9 @@ int RunModeIdsAFPWorkers(void)
         exit(EXIT_FAILURE);
     }
 
+    /* workers can be added and removed through the unix socket */
+    RunModeEnableWorkersScaling(AFPConfigRefForWorker);
+
     ret = RunModeSetLiveCaptureWorkers(ParseAFPConfig,
                                     AFPConfigGeThreadsCount,
                                     "ReceiveAFP",
@@ -0,0 +1,373 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup afxdp
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket runmode
+ *
+ * One AF_XDP socket is bound to each RX queue of the interface so only
+ * the single and workers modes are available: the packets of a flow
+ * reach the same thread thanks to the (symmetric) RSS of the card.
+ */
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H 1
+#define SC_PCAP_DONT_INCLUDE_PCAP_H 1
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-af-xdp.h"
+#include "output.h"
+
+#include "flow-bypass.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-ioctl.h"
+#include "util-ebpf.h"
+
+#include "source-af-xdp.h"
+
+static const char *default_mode_workers = NULL;
+
+const char *RunModeAFXDPGetDefaultMode(void)
+{
+    return default_mode_workers;
+}
+
+void RunModeIdsAFXDPRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "single",
+                              "Single threaded af-xdp mode",
+                              RunModeIdsAFXDPSingle);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "workers",
+                              "Workers af-xdp mode, each thread does all"
+                              " tasks from acquisition to logging",
+                              RunModeIdsAFXDPWorkers);
+    default_mode_workers = "workers";
+    return;
+}
+
+#ifdef HAVE_AF_XDP
+
+static void AFXDPDerefConfig(void *conf)
+{
+    AFXDPIfaceConfig *pfp = (AFXDPIfaceConfig *)conf;
+    if (SC_ATOMIC_SUB(pfp->ref, 1) == 0) {
+        SCFree(pfp);
+    }
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * The XDP filter is loaded and attached to the interface here as it
+ * is shared by all the threads of the interface.
+ *
+ * \return a AFXDPIfaceConfig corresponding to the interface name
+ */
+static void *ParseAFXDPConfig(const char *iface)
+{
+    const char *threadsstr = NULL;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *af_xdp_node;
+    const char *tmpctype;
+    const char *ebpf_file = NULL;
+    intmax_t value;
+    int boolval = 0;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    AFXDPIfaceConfig *aconf = SCCalloc(1, sizeof(*aconf));
+    if (unlikely(aconf == NULL)) {
+        return NULL;
+    }
+
+    strlcpy(aconf->iface, iface, sizeof(aconf->iface));
+    aconf->threads = 0;
+    SC_ATOMIC_INIT(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, 1);
+    SC_ATOMIC_INIT(aconf->queue_counter);
+    aconf->queue_start = 0;
+    aconf->ring_size = AFXDP_RING_SIZE_DEFAULT;
+    aconf->frame_size = AFXDP_FRAME_SIZE_DEFAULT;
+    aconf->promisc = 1;
+    aconf->checksum_mode = CHECKSUM_VALIDATION_KERNEL;
+    aconf->DerefFunc = AFXDPDerefConfig;
+    aconf->flags = 0;
+    aconf->xdp_filter_file = NULL;
+    aconf->xdp_filter_fd = -1;
+    aconf->xdp_mode = XDP_FLAGS_DRV_MODE;
+
+    /* Find initial node */
+    af_xdp_node = ConfGetNode("af-xdp");
+    if (af_xdp_node == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unable to find af-xdp config: "
+                   "an XDP filter file is needed");
+        goto error;
+    }
+
+    if_root = ConfFindDeviceConfig(af_xdp_node, iface);
+    if_default = ConfFindDeviceConfig(af_xdp_node, "default");
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unable to find af-xdp config for "
+                  "interface \"%s\" or \"default\"", iface);
+        goto error;
+    }
+
+    /* If there is no setting for current interface use default one as main iface */
+    if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &threadsstr) == 1) {
+        if (threadsstr != NULL && strcmp(threadsstr, "auto") != 0) {
+            aconf->threads = atoi(threadsstr);
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "queue-start", &value)) == 1) {
+        if (value < 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid queue-start value for %s",
+                       aconf->iface);
+        } else {
+            aconf->queue_start = value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "ring-size", &value)) == 1) {
+        if (value <= 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid ring-size value for %s",
+                       aconf->iface);
+        } else {
+            aconf->ring_size = value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "frame-size", &value)) == 1) {
+        if (value != 2048 && value != 4096) {
+            SCLogError(SC_ERR_INVALID_VALUE, "frame-size must be 2048 or 4096, "
+                       "using %d for %s", AFXDP_FRAME_SIZE_DEFAULT, aconf->iface);
+        } else {
+            aconf->frame_size = value;
+        }
+    }
+
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "zero-copy", (int *)&boolval) == 1) {
+        if (boolval) {
+            SCLogConfig("Forcing zero copy binding on iface %s", aconf->iface);
+            aconf->flags |= AFXDP_ZERO_COPY;
+        }
+    }
+
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
+    if (boolval) {
+        SCLogConfig("Disabling promiscuous mode on iface %s",
+                aconf->iface);
+        aconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else if (strcmp(tmpctype, "kernel") == 0) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_KERNEL;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid value for checksum-checks for %s", aconf->iface);
+        }
+    }
+
+    const char *xdp_mode;
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &xdp_mode) == 1) {
+        if (!strcmp(xdp_mode, "soft")) {
+            aconf->xdp_mode = XDP_FLAGS_SKB_MODE;
+        } else if (!strcmp(xdp_mode, "driver")) {
+            aconf->xdp_mode = XDP_FLAGS_DRV_MODE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                         "Invalid xdp-mode value: '%s'", xdp_mode);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-filter-file", &ebpf_file) != 1) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "af-xdp needs an 'xdp-filter-file' "
+                   "for iface %s", aconf->iface);
+        goto error;
+    }
+    SCLogInfo("af-xdp will use '%s' as XDP filter file", ebpf_file);
+    aconf->xdp_filter_file = ebpf_file;
+    /* expire the sources added by the ebpf-drop keyword */
+    EBPFDropRegister();
+
+    int conf_val = 0;
+    ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &conf_val);
+    if (conf_val) {
+        SCLogConfig("Using bypass kernel functionality for AF_XDP (iface %s)",
+                aconf->iface);
+        aconf->flags |= AFXDP_XDPBYPASS;
+        RunModeEnablesBypassManager();
+        BypassedFlowManagerRegisterCheckFunc(EBPFCheckBypassedFlowTimeout);
+    }
+
+    /* One shot loading of the eBPF file */
+    if (EBPFLoadFile(aconf->iface, aconf->xdp_filter_file, "xdp",
+                     &aconf->xdp_filter_fd, EBPF_XDP_CODE) != 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Error when loading XDP filter file");
+        goto error;
+    }
+    if (EBPFSetupXDP(aconf->iface, aconf->xdp_filter_fd, aconf->xdp_mode) != 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Error when setting up XDP");
+        goto error;
+    }
+    /* packets are steered by RSS so the CPU redirect is disabled */
+    EBPFBuildCPUSet(NULL, aconf->iface);
+
+    /* try to automagically set the proper number of threads */
+    if (aconf->threads == 0) {
+        int rss_queues = GetIfaceRSSQueuesNum(iface);
+        if (rss_queues > 0) {
+            aconf->threads = rss_queues - aconf->queue_start;
+            SCLogPerf("%d RSS queues, so using %d threads", rss_queues, aconf->threads);
+        }
+    }
+    if (aconf->threads <= 0) {
+        aconf->threads = 1;
+    }
+    SC_ATOMIC_RESET(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
+
+    int max_pkt_size = GetIfaceMaxPacketSize(iface);
+    if (max_pkt_size > aconf->frame_size) {
+        SCLogWarning(SC_ERR_AFXDP_CREATE, "%s: max packet size %d is bigger than "
+                     "frame-size %d, packets will be truncated by the kernel",
+                     iface, max_pkt_size, aconf->frame_size);
+    }
+
+    if (LiveGetOffload() == 0) {
+        if (GetIfaceOffloading(iface, 0, 1) == 1) {
+            SCLogWarning(SC_ERR_AFXDP_CREATE,
+                    "Using AF_XDP with offloading activated leads to capture problems");
+        }
+    } else {
+        DisableIfaceOffloading(LiveGetDevice(iface), 0, 1);
+    }
+
+    return aconf;
+
+error:
+    SCFree(aconf);
+    return NULL;
+}
+
+static int AFXDPConfigGetThreadsCount(void *conf)
+{
+    AFXDPIfaceConfig *afxdp = (AFXDPIfaceConfig *)conf;
+    return afxdp->threads;
+}
+
+#endif /* HAVE_AF_XDP */
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    SCEnter();
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureSingle(ParseAFXDPConfig,
+                                    AFXDPConfigGetThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_single,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPSingle initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    SCEnter();
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureWorkers(ParseAFXDPConfig,
+                                    AFXDPConfigGetThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_workers,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPWorkers initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,530 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup dpdk
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * DPDK runmode
+ *
+ * The EAL is initialized and the ports are configured and started here,
+ * with one RX and one TX queue per worker thread. Only the workers mode
+ * is available: the packets of a flow reach the same thread thanks to
+ * the symmetric RSS key set on the port.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-dpdk.h"
+#include "output.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-dpdk.h"
+
+#include "source-dpdk.h"
+
+static const char *default_mode_workers = NULL;
+
+const char *RunModeDpdkGetDefaultMode(void)
+{
+    return default_mode_workers;
+}
+
+void RunModeDpdkRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_DPDK, "workers",
+                              "Workers dpdk mode, each thread does all"
+                              " tasks from acquisition to logging",
+                              RunModeIdsDpdkWorkers);
+    default_mode_workers = "workers";
+    return;
+}
+
+#ifdef HAVE_DPDK
+
+/** maximum number of EAL arguments taken from the config */
+#define DPDK_EAL_ARGS_MAX 64
+
+/** Symmetric RSS key: both directions of a flow give the same hash.
+ *  Long enough for the NICs using a 52 bytes key. */
+static uint8_t dpdk_rss_key[] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+/**
+ * \brief initialize the DPDK EAL
+ *
+ * Arguments are taken from the dpdk.eal-params map: a one letter key
+ * gives '-k value', a longer one gives '--key=value' and a '--key' flag
+ * if the value is 'yes'.
+ */
+static int DPDKEalInit(void)
+{
+    static char *args[DPDK_EAL_ARGS_MAX];
+    int argc = 0;
+    ConfNode *eal_node;
+    ConfNode *param;
+
+    args[argc++] = SCStrdup("suricata");
+
+    eal_node = ConfGetNode("dpdk.eal-params");
+    if (eal_node != NULL) {
+        TAILQ_FOREACH(param, &eal_node->head, next) {
+            char arg[256];
+
+            if (argc >= DPDK_EAL_ARGS_MAX - 2) {
+                SCLogError(SC_ERR_DPDK_CREATE, "too many dpdk.eal-params");
+                return -1;
+            }
+            if (strlen(param->name) == 1) {
+                snprintf(arg, sizeof(arg), "-%s", param->name);
+                args[argc++] = SCStrdup(arg);
+                args[argc++] = SCStrdup(param->val);
+            } else if (ConfValIsTrue(param->val)) {
+                snprintf(arg, sizeof(arg), "--%s", param->name);
+                args[argc++] = SCStrdup(arg);
+            } else {
+                snprintf(arg, sizeof(arg), "--%s=%s", param->name, param->val);
+                args[argc++] = SCStrdup(arg);
+            }
+        }
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (args[i] == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "unable to build EAL arguments");
+            return -1;
+        }
+        SCLogDebug("EAL argument %d: %s", i, args[i]);
+    }
+
+    /* args are kept as EAL may reference them */
+    if (rte_eal_init(argc, args) < 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "unable to initialize DPDK EAL: %s",
+                   rte_strerror(rte_errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void DPDKDerefConfig(void *conf)
+{
+    DPDKIfaceConfig *dconf = (DPDKIfaceConfig *)conf;
+    if (SC_ATOMIC_SUB(dconf->ref, 1) == 0) {
+        SCFree(dconf);
+    }
+}
+
+/**
+ * \brief configure and start the port of the interface
+ *
+ * One RX and one TX queue are set up for each thread, the TX queues are
+ * used by the threads of the peer interface in tap and IPS mode.
+ */
+static int DPDKConfigurePort(DPDKIfaceConfig *dconf, struct rte_eth_dev_info *dev_info)
+{
+    DPDKPort *port = dconf->port;
+    const uint16_t port_id = port->port_id;
+    const int socket_id = rte_eth_dev_socket_id(port_id);
+    struct rte_eth_conf port_conf;
+    uint16_t nb_rx_desc = dconf->nb_rx_desc;
+    uint16_t nb_tx_desc = dconf->nb_tx_desc;
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    int ret;
+
+    snprintf(pool_name, sizeof(pool_name), "sc_mp_%u", port_id);
+    port->pkt_mempool = rte_pktmbuf_pool_create(pool_name, dconf->mempool_size,
+            dconf->mempool_cache_size, 0, RTE_MBUF_DEFAULT_BUF_SIZE, socket_id);
+    if (port->pkt_mempool == NULL) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to create mempool of %u "
+                   "mbufs: %s", dconf->iface, dconf->mempool_size,
+                   rte_strerror(rte_errno));
+        return -1;
+    }
+
+    memset(&port_conf, 0, sizeof(port_conf));
+    port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_NONE;
+    if (dconf->threads > 1) {
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            RTE_ETH_RSS_IP & dev_info->flow_type_rss_offloads;
+        if (dconf->flags & DPDK_RSS_SYMMETRIC) {
+            uint8_t key_len = dev_info->hash_key_size ? dev_info->hash_key_size : 40;
+            if (key_len <= sizeof(dpdk_rss_key)) {
+                port_conf.rx_adv_conf.rss_conf.rss_key = dpdk_rss_key;
+                port_conf.rx_adv_conf.rss_conf.rss_key_len = key_len;
+            } else {
+                SCLogWarning(SC_ERR_DPDK_CREATE, "%s: RSS key size %u not "
+                             "supported, RSS won't be symmetric",
+                             dconf->iface, key_len);
+            }
+        }
+    }
+    if (dconf->checksum_mode == CHECKSUM_VALIDATION_KERNEL) {
+        port_conf.rxmode.offloads |=
+            RTE_ETH_RX_OFFLOAD_CHECKSUM & dev_info->rx_offload_capa;
+    }
+
+    ret = rte_eth_dev_configure(port_id, dconf->threads, dconf->threads, &port_conf);
+    if (ret < 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to configure port: %s",
+                   dconf->iface, rte_strerror(-ret));
+        return -1;
+    }
+
+    ret = rte_eth_dev_adjust_nb_rx_tx_desc(port_id, &nb_rx_desc, &nb_tx_desc);
+    if (ret < 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: invalid number of descriptors: %s",
+                   dconf->iface, rte_strerror(-ret));
+        return -1;
+    }
+
+    for (uint16_t q = 0; q < dconf->threads; q++) {
+        ret = rte_eth_rx_queue_setup(port_id, q, nb_rx_desc, socket_id,
+                                     NULL, port->pkt_mempool);
+        if (ret < 0) {
+            SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to setup RX queue %u: %s",
+                       dconf->iface, q, rte_strerror(-ret));
+            return -1;
+        }
+        ret = rte_eth_tx_queue_setup(port_id, q, nb_tx_desc, socket_id, NULL);
+        if (ret < 0) {
+            SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to setup TX queue %u: %s",
+                       dconf->iface, q, rte_strerror(-ret));
+            return -1;
+        }
+    }
+
+    if (dconf->flags & DPDK_PROMISC) {
+        if (rte_eth_promiscuous_enable(port_id) != 0) {
+            SCLogWarning(SC_ERR_DPDK_CREATE, "%s: unable to set promiscuous mode",
+                         dconf->iface);
+        }
+    }
+
+    ret = rte_eth_dev_start(port_id);
+    if (ret < 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to start port: %s",
+                   dconf->iface, rte_strerror(-ret));
+        return -1;
+    }
+
+    SCLogConfig("%s: port %u started with %d queues of %u RX and %u TX "
+                "descriptors, %u mbufs", dconf->iface, port_id, dconf->threads,
+                nb_rx_desc, nb_tx_desc, dconf->mempool_size);
+    return 0;
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * The port is configured and started here as it is shared by all the
+ * threads of the interface.
+ *
+ * \return a DPDKIfaceConfig corresponding to the interface name
+ */
+static void *ParseDPDKConfig(const char *iface)
+{
+    const char *threadsstr = NULL;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *dpdk_node;
+    const char *tmpctype;
+    const char *copymodestr;
+    struct rte_eth_dev_info dev_info;
+    intmax_t value;
+    int boolval = 0;
+    extern intmax_t max_pending_packets;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    DPDKIfaceConfig *dconf = SCCalloc(1, sizeof(*dconf));
+    if (unlikely(dconf == NULL)) {
+        return NULL;
+    }
+
+    strlcpy(dconf->iface, iface, sizeof(dconf->iface));
+    dconf->threads = 0;
+    SC_ATOMIC_INIT(dconf->ref);
+    (void) SC_ATOMIC_ADD(dconf->ref, 1);
+    SC_ATOMIC_INIT(dconf->queue_counter);
+    dconf->nb_rx_desc = DPDK_RX_DESC_DEFAULT;
+    dconf->nb_tx_desc = DPDK_TX_DESC_DEFAULT;
+    dconf->mempool_size = DPDK_MEMPOOL_SIZE_DEFAULT;
+    dconf->mempool_cache_size = DPDK_MEMPOOL_CACHE_SIZE_DEFAULT;
+    dconf->flags = DPDK_PROMISC | DPDK_RSS_SYMMETRIC;
+    dconf->copy_mode = DPDK_COPY_MODE_NONE;
+    dconf->out_iface = NULL;
+    dconf->checksum_mode = CHECKSUM_VALIDATION_KERNEL;
+    dconf->DerefFunc = DPDKDerefConfig;
+
+    dconf->port = SCCalloc(1, sizeof(DPDKPort));
+    if (unlikely(dconf->port == NULL)) {
+        goto error;
+    }
+    SC_ATOMIC_INIT(dconf->port->ref);
+
+    if (rte_eth_dev_get_port_by_name(iface, &dconf->port->port_id) != 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: no DPDK port with this name, is "
+                   "the device bound to a DPDK driver?", iface);
+        goto error;
+    }
+    if (rte_eth_dev_info_get(dconf->port->port_id, &dev_info) != 0) {
+        SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to get device info", iface);
+        goto error;
+    }
+
+    /* Find initial node */
+    dpdk_node = ConfGetNode("dpdk.interfaces");
+    if (dpdk_node != NULL) {
+        if_root = ConfFindDeviceConfig(dpdk_node, iface);
+        if_default = ConfFindDeviceConfig(dpdk_node, "default");
+    } else {
+        if_root = NULL;
+    }
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("unable to find dpdk config for "
+                  "interface \"%s\" or \"default\", using default values",
+                  iface);
+    }
+
+    /* If there is no setting for current interface use default one as main iface */
+    if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &threadsstr) == 1) {
+        if (threadsstr != NULL && strcmp(threadsstr, "auto") != 0) {
+            dconf->threads = atoi(threadsstr);
+        }
+    }
+    /* auto: one thread per worker cpu or per cpu */
+    if (dconf->threads <= 0) {
+        if (threading_set_cpu_affinity) {
+            dconf->threads =
+                UtilAffinityGetAffinedCPUNum(&thread_affinity[WORKER_CPU_SET]);
+        }
+        if (dconf->threads <= 0) {
+            dconf->threads = (int)UtilCpuGetNumProcessorsOnline();
+        }
+        SCLogPerf("%s: using %d threads", iface, dconf->threads);
+    }
+    if (dconf->threads > dev_info.max_rx_queues ||
+            dconf->threads > dev_info.max_tx_queues) {
+        dconf->threads = MIN(dev_info.max_rx_queues, dev_info.max_tx_queues);
+        SCLogWarning(SC_ERR_INVALID_VALUE, "%s: device only supports %d queues, "
+                     "using %d threads", iface, dconf->threads, dconf->threads);
+    }
+    if (dconf->threads <= 0) {
+        dconf->threads = 1;
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "rx-descriptors", &value)) == 1) {
+        if (value <= 0 || value > UINT16_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid rx-descriptors value for %s",
+                       dconf->iface);
+        } else {
+            dconf->nb_rx_desc = (uint16_t)value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "tx-descriptors", &value)) == 1) {
+        if (value <= 0 || value > UINT16_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid tx-descriptors value for %s",
+                       dconf->iface);
+        } else {
+            dconf->nb_tx_desc = (uint16_t)value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "mempool-size", &value)) == 1) {
+        if (value <= 0 || value > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid mempool-size value for %s",
+                       dconf->iface);
+        } else {
+            dconf->mempool_size = (uint32_t)value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "mempool-cache-size", &value)) == 1) {
+        if (value < 0 || value > RTE_MEMPOOL_CACHE_MAX_SIZE) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid mempool-cache-size value "
+                       "for %s, maximum is %d", dconf->iface,
+                       RTE_MEMPOOL_CACHE_MAX_SIZE);
+        } else {
+            dconf->mempool_cache_size = (uint32_t)value;
+        }
+    }
+
+    /* mbufs sit in the RX and TX rings and in the packets held by the engine */
+    uint64_t needed = (uint64_t)dconf->threads *
+        (dconf->nb_rx_desc + dconf->nb_tx_desc) + max_pending_packets;
+    if (dconf->mempool_size < needed) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "%s: mempool-size %u is smaller than "
+                     "the %" PRIu64 " mbufs which can be in use, RX will run out "
+                     "of buffers", iface, dconf->mempool_size, needed);
+    }
+
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "promisc", &boolval) == 1) {
+        if (!boolval) {
+            SCLogConfig("Disabling promiscuous mode on iface %s", dconf->iface);
+            dconf->flags &= ~DPDK_PROMISC;
+        }
+    }
+
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "rss-symmetric", &boolval) == 1) {
+        if (!boolval) {
+            dconf->flags &= ~DPDK_RSS_SYMMETRIC;
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1) {
+        if (strcmp(copymodestr, "ips") == 0) {
+            SCLogInfo("DPDK IPS mode activated %s", iface);
+            dconf->copy_mode = DPDK_COPY_MODE_IPS;
+        } else if (strcmp(copymodestr, "tap") == 0) {
+            SCLogInfo("DPDK TAP mode activated %s", iface);
+            dconf->copy_mode = DPDK_COPY_MODE_TAP;
+        } else if (strcmp(copymodestr, "none") != 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Invalid copy-mode '%s' for %s "
+                       "(valid are none, tap, ips)", copymodestr, iface);
+            goto error;
+        }
+    }
+    if (dconf->copy_mode != DPDK_COPY_MODE_NONE) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-iface",
+                    &dconf->out_iface) != 1 || strlen(dconf->out_iface) == 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "%s: copy-mode needs a copy-iface",
+                       iface);
+            goto error;
+        }
+        if (strcmp(dconf->out_iface, iface) == 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "%s: copy-iface can't be the "
+                       "interface itself", iface);
+            goto error;
+        }
+        SCLogConfig("%s: forwarding packets to %s", iface, dconf->out_iface);
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else if (strcmp(tmpctype, "kernel") == 0) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_KERNEL;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid value for checksum-checks for %s", dconf->iface);
+        }
+    }
+
+    if (DPDKConfigurePort(dconf, &dev_info) < 0) {
+        goto error;
+    }
+
+    /* one reference per thread, the last one stops the port */
+    (void) SC_ATOMIC_ADD(dconf->port->ref, dconf->threads);
+    SC_ATOMIC_RESET(dconf->ref);
+    (void) SC_ATOMIC_ADD(dconf->ref, dconf->threads);
+
+    return dconf;
+
+error:
+    if (dconf->port != NULL) {
+        if (dconf->port->pkt_mempool != NULL)
+            rte_mempool_free(dconf->port->pkt_mempool);
+        SCFree(dconf->port);
+    }
+    SCFree(dconf);
+    return NULL;
+}
+
+static int DPDKConfigGetThreadsCount(void *conf)
+{
+    DPDKIfaceConfig *dconf = (DPDKIfaceConfig *)conf;
+    return dconf->threads;
+}
+
+#endif /* HAVE_DPDK */
+
+/**
+ * \brief Workers version of the DPDK processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsDpdkWorkers(void)
+{
+    SCEnter();
+#ifdef HAVE_DPDK
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    if (DPDKEalInit() < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    (void)ConfGet("dpdk.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureWorkers(ParseDPDKConfig,
+                                    DPDKConfigGetThreadsCount,
+                                    "ReceiveDPDK",
+                                    "DecodeDPDK", thread_name_workers,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsDpdkWorkers initialised");
+
+#endif /* HAVE_DPDK */
+    SCReturnInt(0);
+}
+
+/**
+ * @}
+ */
@@ -30,6 +30,7 @@
 #include "util-affinity.h"
 
 #include "util-runmodes.h"
+#include "tmqh-flow.h"
 
 static const char *default_mode;
 
@@ -158,7 +159,7 @@ int RunModeErfFileAutoFp(void)
     ThreadVars *tv =
         TmThreadCreatePacketHandler(thread_name_autofp,
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, TmqhAutofpGetHandlerName(),
                                     "pktacqloop");
     SCFree(queues);
 
@@ -201,7 +202,7 @@ int RunModeErfFileAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhAutofpGetHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -34,6 +34,7 @@
 #include "util-runmodes.h"
 #include "util-device.h"
 #include "util-napatech.h"
+#include "flow-bypass.h"
 #include "runmode-napatech.h"
 #include "source-napatech.h" // need NapatechStreamDevConf structure
 
@@ -49,6 +50,9 @@ static uint16_t num_configured_streams = 0;
 static uint16_t first_stream = 0xffff;
 static uint16_t last_stream = 0xffff;
 static int auto_config = 0;
+static int use_hw_bypass = 0;
+/* adapter the bypassed flows are programmed on */
+static int hw_bypass_adapter = -1;
 
 uint16_t NapatechGetNumConfiguredStreams(void)
 {
@@ -70,6 +74,11 @@ bool NapatechIsAutoConfigEnabled(void)
     return (auto_config != 0);
 }
 
+bool NapatechUseHWBypass(void)
+{
+    return (use_hw_bypass != 0);
+}
+
 #endif
 
 const char *RunModeNapatechGetDefaultMode(void)
@@ -91,6 +100,28 @@ void RunModeNapatechRegister(void)
 
 #ifdef HAVE_NAPATECH
 
+#ifdef NAPATECH_ENABLE_BYPASS
+/**
+ * \brief first port of napatech.ports, its adapter holds the flow table
+ *
+ * Flows can only be bypassed on one adapter, so all the ports merged
+ * into the streams have to be on the same one.
+ */
+static int NapatechGetBypassPort(void)
+{
+    ConfNode *ntports = ConfGetNode("napatech.ports");
+    if (ntports == NULL || TAILQ_EMPTY(&ntports->head)) {
+        return -1;
+    }
+    ConfNode *port = TAILQ_FIRST(&ntports->head);
+    if (strncmp(port->val, "all", 3) == 0) {
+        return 0;
+    }
+    /* also the start of a range */
+    return atoi(port->val);
+}
+#endif
+
 static int NapatechRegisterDeviceStreams(void)
 {
     /* Display the configuration mode */
@@ -109,6 +140,40 @@ static int NapatechRegisterDeviceStreams(void)
         SCLogError(SC_ERR_RUNMODE, "auto-config cannot be used with use-all-streams.");
     }
 
+    if (ConfGetBool("napatech.hardware-bypass", &use_hw_bypass) == 0) {
+        use_hw_bypass = 0;
+    }
+    if (use_hw_bypass) {
+#ifdef NAPATECH_ENABLE_BYPASS
+        /* the key definitions matching the bypassed flows are part of
+         * the filters set up by auto-config */
+        if (!auto_config) {
+            SCLogError(SC_ERR_RUNMODE, "napatech.hardware-bypass needs "
+                    "auto-config, hardware bypass disabled.");
+            use_hw_bypass = 0;
+        } else {
+            hw_bypass_adapter = NapatechGetBypassPort();
+            if (hw_bypass_adapter >= 0) {
+                hw_bypass_adapter = NapatechGetAdapter(hw_bypass_adapter);
+            }
+            if (hw_bypass_adapter < 0) {
+                SCLogError(SC_ERR_NAPATECH_INIT_FAILED, "Could not find the "
+                        "adapter of napatech.ports, hardware bypass disabled.");
+                use_hw_bypass = 0;
+            } else {
+                SCLogConfig("Using Napatech hardware bypass on adapter %d",
+                        hw_bypass_adapter);
+                RunModeEnablesBypassManager();
+                BypassedFlowManagerRegisterCheckFunc(NapatechCheckBypassedFlows);
+            }
+        }
+#else
+        SCLogError(SC_ERR_UNIMPLEMENTED, "napatech.hardware-bypass set but "
+                "the Napatech library has no flow management support.");
+        use_hw_bypass = 0;
+#endif
+    }
+
     /* Get the stream ID's either from the conf or by querying Napatech */
     NapatechStreamConfig stream_config[MAX_STREAMS];
 
@@ -179,6 +244,7 @@ static void *NapatechConfigParser(const char *device)
     if (ConfGetInt("napatech.hba", &conf->hba) == 0) {
         conf->hba = -1;
     }
+    conf->flow_adapter = use_hw_bypass ? hw_bypass_adapter : -1;
     return (void *) conf;
 }
 
@@ -43,6 +43,7 @@ uint16_t NapatechGetNumFirstStream(void);
 uint16_t NapatechGetNumLastStream(void);
 
 bool NapatechIsAutoConfigEnabled(void);
+bool NapatechUseHWBypass(void);
 
 
 
@@ -97,6 +97,8 @@ static int ParseNetmapSettings(NetmapIfaceSettings *ns, const char *iface,
     ns->promisc = true;
     ns->checksum_mode = CHECKSUM_VALIDATION_AUTO;
     ns->copy_mode = NETMAP_COPY_MODE_NONE;
+    ns->poll_mode = CAPTURE_POLL_BLOCKING;
+    ns->poll_spin = NETMAP_POLL_SPIN_DEFAULT;
     strlcpy(ns->iface, iface, sizeof(ns->iface));
 
     if (ns->iface[0]) {
@@ -201,6 +203,32 @@ static int ParseNetmapSettings(NetmapIfaceSettings *ns, const char *iface,
         }
     }
 
+    const char *pollmodestr;
+    if (ConfGetChildValueWithDefault(if_root, if_default,
+                "poll-mode", &pollmodestr) == 1)
+    {
+        enum CapturePollMode mode;
+        if (CapturePollParseMode(pollmodestr, &mode) == 0) {
+            ns->poll_mode = mode;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid poll-mode '%s' "
+                    "for %s (valid are blocking, hybrid, busy)",
+                    pollmodestr, iface);
+        }
+    }
+
+    intmax_t poll_spin;
+    if (ConfGetChildValueIntWithDefault(if_root, if_default,
+                "poll-spin", &poll_spin) == 1)
+    {
+        if (poll_spin < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid poll-spin "
+                    "for %s, using default", iface);
+        } else {
+            ns->poll_spin = (int)poll_spin;
+        }
+    }
+
 finalize:
 
     ns->ips = (ns->copy_mode != NETMAP_COPY_MODE_NONE);
@@ -220,6 +248,19 @@ finalize:
         ns->threads = 1;
     }
 
+    /* a single thread opens all rings at once, with more threads each
+     * one opens its own rings. If there are less threads than rings,
+     * some threads service several rings. */
+    ns->rings = ns->threads;
+    if (ns->real && !ns->sw_ring && ns->threads > 1) {
+        int rss = NetmapGetRSSCount(ns->iface);
+        if (rss > ns->threads) {
+            SCLogConfig("%s: %d threads for %d rings", ns->iface,
+                    ns->threads, rss);
+            ns->rings = rss;
+        }
+    }
+
     return 0;
 }
 
@@ -253,6 +294,7 @@ static void *ParseNetmapConfig(const char *iface_name)
     strlcpy(aconf->iface_name, iface_name, sizeof(aconf->iface_name));
     SC_ATOMIC_INIT(aconf->ref);
     (void) SC_ATOMIC_ADD(aconf->ref, 1);
+    SC_ATOMIC_INIT(aconf->thread_id);
 
     /* Find initial node */
     ConfNode *netmap_node = ConfGetNode("netmap");
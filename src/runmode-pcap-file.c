@@ -31,6 +31,7 @@
 #include "util-affinity.h"
 
 #include "util-runmodes.h"
+#include "tmqh-flow.h"
 
 static const char *default_mode = NULL;
 
@@ -189,40 +190,62 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
-    snprintf(tname, sizeof(tname), "%s#01", thread_name_autofp);
+    /* a directory can be split over several readers, one tap per reader */
+    uint16_t readers = 1;
+    intmax_t directory_threads = 0;
+    if (ConfGetInt("pcap-file.directory-threads", &directory_threads) == 1) {
+        DIR *dir = opendir(file);
+        if (dir == NULL) {
+            SCLogWarning(SC_ERR_RUNMODE, "directory-threads is only used "
+                         "when reading a directory");
+        } else {
+            closedir(dir);
+            if (directory_threads > 0 && directory_threads <= 64) {
+                readers = (uint16_t)directory_threads;
+            } else {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "directory-threads out of range");
+            }
+        }
+    }
+    PcapFileSetReaders(readers);
 
-    /* create the threads */
-    ThreadVars *tv_receivepcap =
-        TmThreadCreatePacketHandler(tname,
-                                    "packetpool", "packetpool",
-                                    queues, "flow",
-                                    "pktacqloop");
-    SCFree(queues);
+    TmModule *tm_module = NULL;
+    for (thread = 0; thread < readers; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_autofp, thread+1);
 
-    if (tv_receivepcap == NULL) {
-        SCLogError(SC_ERR_FATAL, "threading setup failed");
-        exit(EXIT_FAILURE);
-    }
-    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+        /* create the threads */
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(tname,
+                                        "packetpool", "packetpool",
+                                        queues, TmqhAutofpGetHandlerName(),
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
 
-    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
 
-    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
-        SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
-        exit(EXIT_FAILURE);
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
     }
+    SCFree(queues);
 
     for (thread = 0; thread < (uint16_t)thread_max; thread++) {
         snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
@@ -233,7 +256,7 @@ int RunModeFilePcapAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhAutofpGetHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
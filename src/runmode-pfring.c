@@ -117,6 +117,7 @@ static void *OldParsePfringConfig(const char *iface)
     pfconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
     SC_ATOMIC_INIT(pfconf->ref);
     (void) SC_ATOMIC_ADD(pfconf->ref, 1);
+    SC_ATOMIC_INIT(pfconf->queue_counter);
 
     /* Find initial node */
     if (ConfGet("pfring.threads", &threadsstr) != 1) {
@@ -215,6 +216,7 @@ static void *ParsePfringConfig(const char *iface)
     pfconf->DerefFunc = PfringDerefConfig;
     SC_ATOMIC_INIT(pfconf->ref);
     (void) SC_ATOMIC_ADD(pfconf->ref, 1);
+    SC_ATOMIC_INIT(pfconf->queue_counter);
 
     /* Find initial node */
     pf_ring_node = ConfGetNode("pfring");
@@ -245,7 +247,19 @@ static void *ParsePfringConfig(const char *iface)
         pfconf->threads = 1;
     } else if (threadsstr != NULL) {
         if (strcmp(threadsstr, "auto") == 0) {
-            pfconf->threads = (int)UtilCpuGetNumProcessorsOnline();
+            /* with cpu affinity, use one thread per worker cpu, so each
+             * worker gets its own ring (or ZC queue) on its own core */
+            if (threading_set_cpu_affinity) {
+                pfconf->threads =
+                    UtilAffinityGetAffinedCPUNum(&thread_affinity[WORKER_CPU_SET]);
+                if (pfconf->threads > 0) {
+                    SCLogPerf("%d worker cpus, so using %d threads",
+                            pfconf->threads, pfconf->threads);
+                }
+            }
+            if (pfconf->threads <= 0) {
+                pfconf->threads = (int)UtilCpuGetNumProcessorsOnline();
+            }
             if (pfconf->threads > 0) {
                 SCLogPerf("%u cores, so using %u threads", pfconf->threads, pfconf->threads);
             } else {
@@ -33,18 +33,31 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-offload.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-rule-sample.h"
+#include "datasets.h"
 #include "detect-engine-sigorder.h"
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
 #include "detect-engine-state.h"
+#include "detect-engine-record.h"
 #include "detect-engine-tag.h"
 #include "detect-engine-modbus.h"
 #include "detect-fast-pattern.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-sample.h"
+#include "flow-cost.h"
+#include "flow-wheel.h"
+#include "flow-bypass-cache.h"
+#include "flow-snapshot.h"
 #include "pkt-var.h"
 
 #include "host.h"
@@ -54,8 +67,11 @@
 #include "unix-manager.h"
 
 #include "stream-tcp.h"
+#include "stream-tcp-memuse.h"
 
 #include "app-layer-detect-proto.h"
+#include "app-layer-detect-proto-cache.h"
+#include "app-layer-expectation.h"
 #include "app-layer-parser.h"
 #include "app-layer.h"
 #include "app-layer-dcerpc.h"
@@ -78,6 +94,11 @@
 #include "util-reference-config.h"
 #include "util-profiling.h"
 #include "util-magic.h"
+#include "util-checksum-simd.h"
+#include "util-latency.h"
+#include "util-early-filter.h"
+#include "util-memcap.h"
+#include "util-memcap-governor.h"
 #include "util-memcmp.h"
 #include "util-misc.h"
 #include "util-signal.h"
@@ -87,12 +108,16 @@
 #include "util-spm.h"
 #include "util-hash.h"
 #include "util-hashlist.h"
+#include "util-hash-open.h"
+#include "util-hash-crc32c.h"
+#include "util-hash-siphash.h"
 #include "util-bloomfilter.h"
 #include "util-bloomfilter-counting.h"
 #include "util-pool.h"
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-line.h"
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
@@ -102,11 +127,20 @@
 #include "conf.h"
 #include "conf-yaml-loader.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
+#include "output-filestore.h"
+#include "log-pcap.h"
+#include "output-json.h"
 
 #include "util-streaming-buffer.h"
 #include "util-lua.h"
+#include "util-ja3.h"
+#include "util-jsonbuilder.h"
+#include "util-startup.h"
+#include "util-geoip.h"
+#include "util-pages.h"
 
 #ifdef OS_WIN32
 #include "win32-syscall.h"
@@ -130,12 +164,16 @@ static void RegisterUnittests(void)
 {
     UTHRegisterTests();
     StreamTcpRegisterTests();
+    StreamTcpMemuseRegisterTests();
     SigRegisterTests();
     SCReputationRegisterTests();
     TmModuleRegisterTests();
     SigTableRegisterTests();
     HashTableRegisterTests();
     HashListTableRegisterTests();
+    OpenHashRegisterTests();
+    HashCrc32cRegisterTests();
+    HashSipRegisterTests();
     BloomFilterRegisterTests();
     BloomFilterCountingRegisterTests();
     PoolRegisterTests();
@@ -157,13 +195,24 @@ static void RegisterUnittests(void)
     DecodeTCPRegisterTests();
     DecodeUDPV4RegisterTests();
     DecodeGRERegisterTests();
+    DecodeVXLANRegisterTests();
+    DecodeGeneveRegisterTests();
     DecodeAsn1RegisterTests();
     DecodeMPLSRegisterTests();
     AppLayerProtoDetectUnittestsRegister();
+    AppLayerProtoDetectCacheRegisterTests();
+    AppLayerExpectationRegisterTests();
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    TmqhRingRegisterTests();
     FlowRegisterTests();
+    FlowSampleRegisterTests();
+    FlowCostRegisterTests();
+    FlowHashRegisterTests();
+    FlowWheelRegisterTests();
+    FlowBypassCacheRegisterTests();
+    FlowSnapshotRegisterTests();
     HostRegisterUnittests();
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
@@ -175,6 +224,7 @@ static void RegisterUnittests(void)
     AppLayerParserRegisterUnittests();
     ThreadMacrosRegisterTests();
     UtilSpmSearchRegistertests();
+    JsonBuilderRegisterTests();
     UtilActionRegisterTests();
     SCClassConfRegisterTests();
     SCThresholdConfRegisterTests();
@@ -185,9 +235,21 @@ static void RegisterUnittests(void)
     SCProfilingRegisterTests();
 #endif
     DeStateRegisterTests();
+    DetectBufferRecordRegisterTests();
     MemcmpRegisterTests();
+    MemcapCounterRegisterTests();
+    MemcapGovernorRegisterTests();
+    LatencyRegisterTests();
+    ChecksumSimdRegisterTests();
+    EarlyFilterRegisterTests();
     DetectEngineInspectModbusRegisterTests();
     DetectEngineRegisterTests();
+    DetectOffloadRegisterTests();
+    PrefilterRegisterTests();
+    DetectEngineMpmRegisterTests();
+    DetectFPStatsRegisterTests();
+    DetectRuleSampleRegisterTests();
+    DatasetsRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
     UtilMiscRegisterTests();
@@ -196,9 +258,17 @@ static void RegisterUnittests(void)
     DetectPortTests();
     SCAtomicRegisterTests();
     MemrchrRegisterTests();
+    LineBufferRegisterTests();
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
+    OutputFilestoreRegisterTests();
+    PcapLogRegisterTests();
+    OutputJsonRegisterTests();
     StreamingBufferRegisterTests();
+    Ja3RegisterTests();
+    StartupRegisterTests();
+    GeoipRegisterTests();
+    PageRegisterTests();
 #ifdef OS_WIN32
     Win32SyscallRegisterTests();
 #endif
@@ -208,18 +278,12 @@ static void RegisterUnittests(void)
 }
 #endif
 
+#ifdef UNITTESTS
 /**
- * Run or list unittests
- *
- * \param list_unittests If set to 1, list unittests. Run them if set to 0.
- * \param regex_arg A regular expression to select unittests to run
- *
- * This function is terminal and will call exit after being called.
+ * \brief global setup shared by the unittests and the benchmarks
  */
-
-void RunUnittests(int list_unittests, const char *regex_arg)
+void RunUnittestsInit(void)
 {
-#ifdef UNITTESTS
     /* Initializations for global vars, queues, etc (memsets, mutex init..) */
     GlobalsInitPreConfig();
 
@@ -259,6 +323,23 @@ void RunUnittests(int list_unittests, const char *regex_arg)
     HostBitInitCtx();
 
     StorageFinalize();
+}
+#endif /* UNITTESTS */
+
+/**
+ * Run or list unittests
+ *
+ * \param list_unittests If set to 1, list unittests. Run them if set to 0.
+ * \param regex_arg A regular expression to select unittests to run
+ *
+ * This function is terminal and will call exit after being called.
+ */
+
+void RunUnittests(int list_unittests, const char *regex_arg)
+{
+#ifdef UNITTESTS
+    RunUnittestsInit();
+
    /* test and initialize the unittesting subsystem */
     if (regex_arg == NULL){
         regex_arg = ".*";
@@ -273,6 +354,7 @@ void RunUnittests(int list_unittests, const char *regex_arg)
 
 
     AppLayerHtpEnableRequestBodyCallback();
+    AppLayerHtpEnableResponseBodyCallback();
     AppLayerHtpNeedFileInspection();
 
     RegisterUnittests();
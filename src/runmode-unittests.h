@@ -27,4 +27,8 @@
 __attribute__((noreturn))
 void RunUnittests(int list_unittests, const char *regex_arg);
 
+#ifdef UNITTESTS
+void RunUnittestsInit(void);
+#endif
+
 #endif /* __UTIL_RUNMODE_UNITTESTS_H__ */
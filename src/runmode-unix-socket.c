@@ -45,10 +45,15 @@
 #include "host-bit.h"
 
 #include "util-misc.h"
+#include "util-signal.h"
 #include "util-profiling.h"
 
 #include "conf-yaml-loader.h"
 
+#ifndef OS_WIN32
+#include <sys/wait.h>
+#endif
+
 static const char *default_mode = NULL;
 
 int unix_socket_mode_is_running = 0;
@@ -64,10 +69,26 @@ typedef struct PcapFiles_ {
     TAILQ_ENTRY(PcapFiles_) next;
 } PcapFiles;
 
+/** state of a pipeline the pipeline process shares with the master */
+typedef struct PcapPipelineShared_ {
+    /* epoch millis of the last packet processed */
+    SC_ATOMIC_DECLARE(uint64_t, last_processed);
+} PcapPipelineShared;
+
+/** a pcap pipeline: a process running the pcap-file runmode */
+typedef struct PcapPipeline_ {
+    pid_t pid;              /**< 0 if the pipeline is free */
+    PcapFiles *file;
+} PcapPipeline;
+
 typedef struct PcapCommand_ {
     TAILQ_HEAD(, PcapFiles_) files;
     int running;
     PcapFiles *current_file;
+    /* pipelines, if unix-command.pcap-pipelines is more than 1 */
+    int pipelines_cnt;
+    PcapPipeline *pipelines;
+    PcapPipelineShared *pipelines_shared;
 } PcapCommand;
 
 typedef struct MemcapCommand_ {
@@ -136,6 +157,11 @@ static int unix_manager_pcap_task_failed = 0;
 static int unix_manager_pcap_task_interrupted = 0;
 static struct timespec unix_manager_pcap_last_processed;
 static SCCtrlMutex unix_manager_pcap_last_processed_mutex;
+/* in a pipeline process, its state shared with the master */
+static PcapPipelineShared *unix_manager_pcap_pipeline = NULL;
+static PcapCommand *unix_manager_pcapcmd = NULL;
+
+#define PCAP_PIPELINES_MAX 64
 
 /**
  * \brief return list of files in the queue
@@ -190,6 +216,23 @@ static TmEcode UnixSocketPcapCurrent(json_t *cmd, json_t* answer, void *data)
 {
     PcapCommand *this = (PcapCommand *) data;
 
+    if (this->pipelines_cnt > 1) {
+        json_t *jarray = json_array();
+        if (jarray == NULL) {
+            json_object_set_new(answer, "message",
+                                json_string("internal error at json object creation"));
+            return TM_ECODE_FAILED;
+        }
+        for (int i = 0; i < this->pipelines_cnt; i++) {
+            if (this->pipelines[i].pid != 0) {
+                json_array_append_new(jarray,
+                        SCJsonString(this->pipelines[i].file->filename));
+            }
+        }
+        json_object_set_new(answer, "message", jarray);
+        return TM_ECODE_OK;
+    }
+
     if (this->current_file != NULL && this->current_file->filename != NULL) {
         json_object_set_new(answer, "message",
                             json_string(this->current_file->filename));
@@ -201,11 +244,20 @@ static TmEcode UnixSocketPcapCurrent(json_t *cmd, json_t* answer, void *data)
 
 static TmEcode UnixSocketPcapLastProcessed(json_t *cmd, json_t *answer, void *data)
 {
+    PcapCommand *this = (PcapCommand *) data;
     json_int_t epoch_millis;
     SCCtrlMutexLock(&unix_manager_pcap_last_processed_mutex);
     epoch_millis = SCTimespecAsEpochMillis(&unix_manager_pcap_last_processed);
     SCCtrlMutexUnlock(&unix_manager_pcap_last_processed_mutex);
 
+    /* the latest of all the pipelines */
+    for (int i = 0; i < this->pipelines_cnt; i++) {
+        json_int_t pipeline_millis =
+            (json_int_t)SC_ATOMIC_GET(this->pipelines_shared[i].last_processed);
+        if (pipeline_millis > epoch_millis)
+            epoch_millis = pipeline_millis;
+    }
+
     json_object_set_new(answer, "message",
                         json_integer(epoch_millis));
 
@@ -214,7 +266,18 @@ static TmEcode UnixSocketPcapLastProcessed(json_t *cmd, json_t *answer, void *da
 
 static TmEcode UnixSocketPcapInterrupt(json_t *cmd, json_t *answer, void *data)
 {
-    unix_manager_pcap_task_interrupted = 1;
+    PcapCommand *this = (PcapCommand *) data;
+
+    if (this->pipelines_cnt > 1) {
+        /* pipelines stop their run on SIGTERM */
+        for (int i = 0; i < this->pipelines_cnt; i++) {
+            if (this->pipelines[i].pid != 0) {
+                kill(this->pipelines[i].pid, SIGTERM);
+            }
+        }
+    } else {
+        unix_manager_pcap_task_interrupted = 1;
+    }
 
     json_object_set_new(answer, "message", json_string("Interrupted"));
 
@@ -450,55 +513,16 @@ static TmEcode UnixSocketAddPcapFileContinuous(json_t *cmd, json_t* answer, void
 }
 
 /**
- * \brief Handle the file queue
+ * \brief Set the configuration of the pcap-file running mode for a file
  *
- * This function check if there is currently a file
- * being parse. If it is not the case, it will start to
- * work on a new file. This implies to start a new 'pcap-file'
- * running mode after having set the file and the output dir.
- * This function also handles the cleaning of the previous
- * running mode.
- *
- * \param this a UnixCommand:: structure
- * \retval 0 in case of error, 1 in case of success
+ * \param cfile the file to process
+ * \retval TM_ECODE_OK or TM_ECODE_FAILED
  */
-static TmEcode UnixSocketPcapFilesCheck(void *data)
+static TmEcode UnixSocketPcapFileSetConf(PcapFiles *cfile)
 {
-    PcapCommand *this = (PcapCommand *) data;
-    if (unix_manager_pcap_task_running == 1) {
-        return TM_ECODE_OK;
-    }
-    if ((unix_manager_pcap_task_failed == 1) || (this->running == 1)) {
-        if (unix_manager_pcap_task_failed) {
-            SCLogInfo("Preceeding task failed, cleaning the running mode");
-        }
-        unix_manager_pcap_task_failed = 0;
-        this->running = 0;
-
-        SCLogInfo("Resetting engine state");
-        PostRunDeinit(RUNMODE_PCAP_FILE, NULL /* no ts */);
-
-        if (this->current_file) {
-            PcapFilesFree(this->current_file);
-        }
-        this->current_file = NULL;
-    }
-
-    if (TAILQ_EMPTY(&this->files)) {
-        // nothing to do
-        return TM_ECODE_OK;
-    }
-
-    PcapFiles *cfile = TAILQ_FIRST(&this->files);
-    TAILQ_REMOVE(&this->files, cfile, next);
-
-    unix_manager_pcap_task_running = 1;
-    this->running = 1;
-
     if (ConfSetFinal("pcap-file.file", cfile->filename) != 1) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "Can not set working file to '%s'",
                    cfile->filename);
-        PcapFilesFree(cfile);
         return TM_ECODE_FAILED;
     }
 
@@ -510,7 +534,6 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
     }
     if (set_res != 1) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "Can not set continuous mode for pcap processing");
-        PcapFilesFree(cfile);
         return TM_ECODE_FAILED;
     }
     if (cfile->should_delete) {
@@ -520,7 +543,6 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
     }
     if (set_res != 1) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "Can not set delete mode for pcap processing");
-        PcapFilesFree(cfile);
         return TM_ECODE_FAILED;
     }
 
@@ -529,7 +551,6 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         snprintf(tstr, sizeof(tstr), "%" PRIuMAX, (uintmax_t)cfile->delay);
         if (ConfSetFinal("pcap-file.delay", tstr) != 1) {
             SCLogError(SC_ERR_INVALID_ARGUMENT, "Can not set delay to '%s'", tstr);
-            PcapFilesFree(cfile);
             return TM_ECODE_FAILED;
         }
     }
@@ -540,7 +561,6 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         if (ConfSetFinal("pcap-file.poll-interval", tstr) != 1) {
             SCLogError(SC_ERR_INVALID_ARGUMENT,
                        "Can not set poll-interval to '%s'", tstr);
-            PcapFilesFree(cfile);
             return TM_ECODE_FAILED;
         }
     }
@@ -551,7 +571,6 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         if (ConfSetFinal("pcap-file.tenant-id", tstr) != 1) {
             SCLogError(SC_ERR_INVALID_ARGUMENT,
                        "Can not set working tenant-id to '%s'", tstr);
-            PcapFilesFree(cfile);
             return TM_ECODE_FAILED;
         }
     } else {
@@ -562,15 +581,18 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
         if (ConfSetFinal("default-log-dir", cfile->output_dir) != 1) {
             SCLogError(SC_ERR_INVALID_ARGUMENT,
                        "Can not set output dir to '%s'", cfile->output_dir);
-            PcapFilesFree(cfile);
             return TM_ECODE_FAILED;
         }
     }
 
-    this->current_file = cfile;
-
-    SCLogInfo("Starting run for '%s'", this->current_file->filename);
+    return TM_ECODE_OK;
+}
 
+/**
+ * \brief Start a 'pcap-file' running mode with the current configuration
+ */
+static void UnixSocketPcapRunStart(void)
+{
     PreRunInit(RUNMODE_PCAP_FILE);
     PreRunPostPrivsDropInit(RUNMODE_PCAP_FILE);
     RunModeDispatch(RUNMODE_PCAP_FILE, NULL);
@@ -579,6 +601,179 @@ static TmEcode UnixSocketPcapFilesCheck(void *data)
     TmThreadWaitOnThreadInit();
     PacketPoolPostRunmodes();
     TmThreadContinueThreads();
+}
+
+static void UnixSocketPcapPipelineSignal(int sig)
+{
+    unix_manager_pcap_task_interrupted = 1;
+}
+
+/**
+ * \brief Process a file in a pipeline process
+ *
+ * Runs the 'pcap-file' running mode like the master does when it has no
+ * pipelines, then exits. The flow tables, stream state and outputs are
+ * the process' own, the detection engine is shared with the master until
+ * either writes to it.
+ *
+ * \param cfile the file to process
+ * \param shared state of the pipeline shared with the master
+ */
+static void UnixSocketPcapPipelineRun(PcapFiles *cfile, PcapPipelineShared *shared)
+{
+    unix_manager_pcap_pipeline = shared;
+    unix_manager_pcap_task_failed = 0;
+    unix_manager_pcap_task_interrupted = 0;
+    UtilSignalHandlerSetup(SIGTERM, UnixSocketPcapPipelineSignal);
+    UtilSignalHandlerSetup(SIGINT, UnixSocketPcapPipelineSignal);
+
+    if (UnixSocketPcapFileSetConf(cfile) != TM_ECODE_OK) {
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogInfo("Starting run for '%s' in process %d", cfile->filename, (int)getpid());
+
+    unix_manager_pcap_task_running = 1;
+    UnixSocketPcapRunStart();
+
+    while (unix_manager_pcap_task_running == 1) {
+        TmThreadCheckThreadState();
+        usleep(10 * 1000);
+    }
+
+    PostRunDeinit(RUNMODE_PCAP_FILE, NULL /* no ts */);
+    exit(unix_manager_pcap_task_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/**
+ * \brief Handle the file queue with pipelines
+ *
+ * Collects the pipelines that are done and hands the next files of the
+ * queue to the free ones.
+ *
+ * \param this a PcapCommand:: structure
+ * \retval 0 in case of error, 1 in case of success
+ */
+static TmEcode UnixSocketPcapPipelinesCheck(PcapCommand *this)
+{
+    for (int i = 0; i < this->pipelines_cnt; i++) {
+        PcapPipeline *pipeline = &this->pipelines[i];
+        int status;
+
+        if (pipeline->pid == 0 || waitpid(pipeline->pid, &status, WNOHANG) != pipeline->pid) {
+            continue;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            SCLogInfo("Pipeline %d done with '%s'", i, pipeline->file->filename);
+        } else {
+            SCLogWarning(SC_ERR_PCAP_FILE_DELETE_FAILED /* no better code */,
+                         "Pipeline %d failed on '%s'", i, pipeline->file->filename);
+        }
+        PcapFilesFree(pipeline->file);
+        pipeline->file = NULL;
+        pipeline->pid = 0;
+    }
+
+    /* a new pipeline gets the detection engine of the moment, don't
+     * start one in the middle of a reload */
+    if (DetectEngineReloadIsStart()) {
+        return TM_ECODE_OK;
+    }
+
+    for (int i = 0; i < this->pipelines_cnt && !TAILQ_EMPTY(&this->files); i++) {
+        PcapPipeline *pipeline = &this->pipelines[i];
+        if (pipeline->pid != 0) {
+            continue;
+        }
+
+        PcapFiles *cfile = TAILQ_FIRST(&this->files);
+        TAILQ_REMOVE(&this->files, cfile, next);
+
+        /* the threads of the master don't exist in the new process, so
+         * none of them may hold the lock of the thread list */
+        SCMutexLock(&tv_root_lock);
+        pid_t pid = fork();
+        SCMutexUnlock(&tv_root_lock);
+        if (pid == 0) {
+            UnixSocketPcapPipelineRun(cfile, &this->pipelines_shared[i]);
+            /* not reached */
+        } else if (pid < 0) {
+            SCLogError(SC_ERR_THREAD_SPAWN, "Can not start a pipeline for '%s': %s",
+                       cfile->filename, strerror(errno));
+            TAILQ_INSERT_HEAD(&this->files, cfile, next);
+            return TM_ECODE_FAILED;
+        }
+
+        SCLogInfo("Pipeline %d processing '%s' in process %d", i, cfile->filename,
+                  (int)pid);
+        pipeline->pid = pid;
+        pipeline->file = cfile;
+    }
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Handle the file queue
+ *
+ * This function check if there is currently a file
+ * being parse. If it is not the case, it will start to
+ * work on a new file. This implies to start a new 'pcap-file'
+ * running mode after having set the file and the output dir.
+ * This function also handles the cleaning of the previous
+ * running mode.
+ *
+ * With pipelines, the files are processed in parallel, each in a
+ * process of its own, see UnixSocketPcapPipelinesCheck().
+ *
+ * \param this a UnixCommand:: structure
+ * \retval 0 in case of error, 1 in case of success
+ */
+static TmEcode UnixSocketPcapFilesCheck(void *data)
+{
+    PcapCommand *this = (PcapCommand *) data;
+    if (this->pipelines_cnt > 1) {
+        return UnixSocketPcapPipelinesCheck(this);
+    }
+    if (unix_manager_pcap_task_running == 1) {
+        return TM_ECODE_OK;
+    }
+    if ((unix_manager_pcap_task_failed == 1) || (this->running == 1)) {
+        if (unix_manager_pcap_task_failed) {
+            SCLogInfo("Preceeding task failed, cleaning the running mode");
+        }
+        unix_manager_pcap_task_failed = 0;
+        this->running = 0;
+
+        SCLogInfo("Resetting engine state");
+        PostRunDeinit(RUNMODE_PCAP_FILE, NULL /* no ts */);
+
+        if (this->current_file) {
+            PcapFilesFree(this->current_file);
+        }
+        this->current_file = NULL;
+    }
+
+    if (TAILQ_EMPTY(&this->files)) {
+        // nothing to do
+        return TM_ECODE_OK;
+    }
+
+    PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    TAILQ_REMOVE(&this->files, cfile, next);
+
+    unix_manager_pcap_task_running = 1;
+    this->running = 1;
+
+    if (UnixSocketPcapFileSetConf(cfile) != TM_ECODE_OK) {
+        PcapFilesFree(cfile);
+        return TM_ECODE_FAILED;
+    }
+
+    this->current_file = cfile;
+
+    SCLogInfo("Starting run for '%s'", this->current_file->filename);
+
+    UnixSocketPcapRunStart();
 
     return TM_ECODE_OK;
 }
@@ -606,6 +801,10 @@ TmEcode UnixSocketPcapFile(TmEcode tm, struct timespec *last_processed)
         unix_manager_pcap_last_processed.tv_sec = last_processed->tv_sec;
         unix_manager_pcap_last_processed.tv_nsec = last_processed->tv_nsec;
         SCCtrlMutexUnlock(&unix_manager_pcap_last_processed_mutex);
+        if (unix_manager_pcap_pipeline != NULL) {
+            SC_ATOMIC_SET(unix_manager_pcap_pipeline->last_processed,
+                          SCTimespecAsEpochMillis(last_processed));
+        }
     }
     switch (tm) {
         case TM_ECODE_DONE:
@@ -697,6 +896,18 @@ TmEcode UnixSocketRegisterTenantHandler(json_t *cmd, json_t* answer, void *data)
 
         SCLogInfo("VLAN handler: id %u maps to tenant %u", (uint32_t)traffic_id, tenant_id);
         r = DetectEngineTentantRegisterVlanId(tenant_id, (uint32_t)traffic_id);
+    } else if (strcmp(htype, "vni") == 0) {
+        if (traffic_id <= 0) {
+            json_object_set_new(answer, "message", json_string("vni requires argument"));
+            return TM_ECODE_FAILED;
+        }
+        if (traffic_id > 0xffffff) {
+            json_object_set_new(answer, "message", json_string("vni argument out of range"));
+            return TM_ECODE_FAILED;
+        }
+
+        SCLogInfo("VNI handler: id %u maps to tenant %u", (uint32_t)traffic_id, tenant_id);
+        r = DetectEngineTentantRegisterVni(tenant_id, (uint32_t)traffic_id);
     }
     if (r != 0) {
         json_object_set_new(answer, "message", json_string("handler setup failure"));
@@ -778,6 +989,18 @@ TmEcode UnixSocketUnregisterTenantHandler(json_t *cmd, json_t* answer, void *dat
 
         SCLogInfo("VLAN handler: removing mapping of %u to tenant %u", (uint32_t)traffic_id, tenant_id);
         r = DetectEngineTentantUnregisterVlanId(tenant_id, (uint32_t)traffic_id);
+    } else if (strcmp(htype, "vni") == 0) {
+        if (traffic_id <= 0) {
+            json_object_set_new(answer, "message", json_string("vni requires argument"));
+            return TM_ECODE_FAILED;
+        }
+        if (traffic_id > 0xffffff) {
+            json_object_set_new(answer, "message", json_string("vni argument out of range"));
+            return TM_ECODE_FAILED;
+        }
+
+        SCLogInfo("VNI handler: removing mapping of %u to tenant %u", (uint32_t)traffic_id, tenant_id);
+        r = DetectEngineTentantUnregisterVni(tenant_id, (uint32_t)traffic_id);
     }
     if (r != 0) {
         json_object_set_new(answer, "message", json_string("handler unregister failure"));
@@ -1211,10 +1434,8 @@ TmEcode UnixSocketHostbitList(json_t *cmd, json_t* answer, void *data_unused)
         return TM_ECODE_FAILED;
     }
 
-    XBit *iter = NULL;
-    while (use < 256 && HostBitList(host, &iter) == 1) {
-        bits[use].id = iter->idx;
-        bits[use].expire = iter->expire;
+    uint32_t iter = 0;
+    while (use < 256 && HostBitList(host, &iter, &bits[use].id, &bits[use].expire) == 1) {
         use++;
     }
     HostUnlock(host);
@@ -1430,6 +1651,40 @@ static int RunModeUnixSocketMaster(void)
     TAILQ_INIT(&pcapcmd->files);
     pcapcmd->running = 0;
     pcapcmd->current_file = NULL;
+    pcapcmd->pipelines_cnt = 0;
+    pcapcmd->pipelines = NULL;
+    pcapcmd->pipelines_shared = NULL;
+
+    intmax_t pipelines = 1;
+    if (ConfGetInt("unix-command.pcap-pipelines", &pipelines) == 1 && pipelines > 1) {
+        if (pipelines > PCAP_PIPELINES_MAX) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "unix-command.pcap-pipelines "
+                         "capped to %d", PCAP_PIPELINES_MAX);
+            pipelines = PCAP_PIPELINES_MAX;
+        }
+        pcapcmd->pipelines = SCCalloc(pipelines, sizeof(PcapPipeline));
+        if (unlikely(pcapcmd->pipelines == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Can not allocate pcap pipelines");
+            SCFree(pcapcmd);
+            return 1;
+        }
+        /* the pipelines report their progress here */
+        pcapcmd->pipelines_shared = mmap(NULL, pipelines * sizeof(PcapPipelineShared),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (pcapcmd->pipelines_shared == MAP_FAILED) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Can not map pcap pipelines state: %s",
+                       strerror(errno));
+            SCFree(pcapcmd->pipelines);
+            SCFree(pcapcmd);
+            return 1;
+        }
+        for (int i = 0; i < pipelines; i++) {
+            SC_ATOMIC_INIT(pcapcmd->pipelines_shared[i].last_processed);
+        }
+        pcapcmd->pipelines_cnt = (int)pipelines;
+        SCLogConfig("processing up to %d pcap files in parallel", pcapcmd->pipelines_cnt);
+    }
+    unix_manager_pcapcmd = pcapcmd;
 
     memset(&unix_manager_pcap_last_processed, 0, sizeof(struct timespec));
 
@@ -1457,6 +1712,32 @@ int RunModeUnixSocketIsActive(void)
     return unix_socket_mode_is_running;
 }
 
+/**
+ * \brief Stop the pcap pipelines and wait for them to finish their output
+ */
+void UnixSocketPcapPipelinesStop(void)
+{
+#ifdef BUILD_UNIX_SOCKET
+    PcapCommand *this = unix_manager_pcapcmd;
+    if (this == NULL)
+        return;
+
+    for (int i = 0; i < this->pipelines_cnt; i++) {
+        if (this->pipelines[i].pid != 0) {
+            kill(this->pipelines[i].pid, SIGTERM);
+        }
+    }
+    for (int i = 0; i < this->pipelines_cnt; i++) {
+        if (this->pipelines[i].pid != 0) {
+            waitpid(this->pipelines[i].pid, NULL, 0);
+            PcapFilesFree(this->pipelines[i].file);
+            this->pipelines[i].file = NULL;
+            this->pipelines[i].pid = 0;
+        }
+    }
+#endif
+}
+
 
 
 
@@ -29,6 +29,7 @@ const char *RunModeUnixSocketGetDefaultMode(void);
 int RunModeUnixSocketIsActive(void);
 
 TmEcode UnixSocketPcapFile(TmEcode tm, struct timespec *last_processed);
+void UnixSocketPcapPipelinesStop(void);
 
 #ifdef BUILD_UNIX_SOCKET
 TmEcode UnixSocketRegisterTenantHandler(json_t *cmd, json_t* answer, void *data);
@@ -51,6 +51,11 @@ void RunModeIpsWinDivertRegister(void)
             RUNMODE_WINDIVERT, "autofp",
             "Multi-threaded WinDivert IPS mode load-balanced by flow",
             RunModeIpsWinDivertAutoFp);
+
+    RunModeRegisterNewRunMode(
+            RUNMODE_WINDIVERT, "workers",
+            "Multi-filter WinDivert IPS mode with one thread per filter",
+            RunModeIpsWinDivertWorker);
 }
 
 int RunModeIpsWinDivertAutoFp(void)
@@ -69,3 +74,20 @@ int RunModeIpsWinDivertAutoFp(void)
 #endif /* WINDIVERT */
     return ret;
 }
+
+int RunModeIpsWinDivertWorker(void)
+{
+    SCEnter();
+    int ret = 0;
+#ifdef WINDIVERT
+    RunModeInitialize();
+
+    TimeModeSetLive();
+
+    LiveDeviceHasNoStats();
+
+    ret = RunModeSetIPSWorker(WinDivertGetThread, "ReceiveWinDivert",
+                              "VerdictWinDivert", "DecodeWinDivert");
+#endif /* WINDIVERT */
+    return ret;
+}
@@ -26,6 +26,7 @@
 #define __RUNMODE_WINDIVERT_H__
 
 int RunModeIpsWinDivertAutoFp(void);
+int RunModeIpsWinDivertWorker(void);
 void RunModeIpsWinDivertRegister(void);
 const char *RunModeIpsWinDivertGetDefaultMode(void);
 
@@ -26,6 +26,7 @@
 #include "detect.h"
 #include "detect-engine.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-offload.h"
 #include "app-layer-parser.h"
 #include "tm-threads.h"
 #include "util-debug.h"
@@ -40,6 +41,7 @@
 #include "util-misc.h"
 
 #include "output.h"
+#include "output-filestore.h"
 
 #include "alert-fastlog.h"
 #include "alert-prelude.h"
@@ -54,6 +56,7 @@
 #include "flow-manager.h"
 #include "flow-bypass.h"
 #include "counters.h"
+#include "util-memcap-governor.h"
 
 int debuglog_enabled = 0;
 
@@ -67,8 +70,12 @@ const char *thread_name_flow_rec = "FR";
 const char *thread_name_flow_bypass = "FB";
 const char *thread_name_unix_socket = "US";
 const char *thread_name_detect_loader = "DL";
+const char *thread_name_detect_offload = "DO";
+const char *thread_name_filestore_writer = "FW";
 const char *thread_name_counter_stats = "CS";
 const char *thread_name_counter_wakeup = "CW";
+const char *thread_name_counter_exporter = "CE";
+const char *thread_name_memcap_governor = "MG";
 
 /**
  * \brief Holds description for a runmode.
@@ -151,6 +158,18 @@ static const char *RunModeTranslateModeToName(int runmode)
             return "WINDIVERT";
 #else
             return "WINDIVERT(DISABLED)";
+#endif
+        case RUNMODE_AFXDP_DEV:
+#ifdef HAVE_AF_XDP
+            return "AF_XDP_DEV";
+#else
+            return "AF_XDP_DEV(DISABLED)";
+#endif
+        case RUNMODE_DPDK:
+#ifdef HAVE_DPDK
+            return "DPDK";
+#else
+            return "DPDK(DISABLED)";
 #endif
         default:
             SCLogError(SC_ERR_UNKNOWN_RUN_MODE, "Unknown runtime mode. Aborting");
@@ -225,6 +244,8 @@ void RunModeRegisterRunModes(void)
     RunModeIdsNflogRegister();
     RunModeUnixSocketRegister();
     RunModeIpsWinDivertRegister();
+    RunModeIdsAFXDPRegister();
+    RunModeDpdkRegister();
 #ifdef UNITTESTS
     UtRunModeRegister();
 #endif
@@ -321,6 +342,12 @@ void RunModeDispatch(int runmode, const char *custom_mode)
             case RUNMODE_AFP_DEV:
                 custom_mode = RunModeAFPGetDefaultMode();
                 break;
+            case RUNMODE_AFXDP_DEV:
+                custom_mode = RunModeAFXDPGetDefaultMode();
+                break;
+            case RUNMODE_DPDK:
+                custom_mode = RunModeDpdkGetDefaultMode();
+                break;
             case RUNMODE_NETMAP:
                 custom_mode = RunModeNetmapGetDefaultMode();
                 break;
@@ -391,7 +418,10 @@ void RunModeDispatch(int runmode, const char *custom_mode)
         if (RunModeNeedsBypassManager()) {
             BypassedFlowManagerThreadSpawn();
         }
+        MemcapGovernorThreadSpawn();
         StatsSpawnThreads();
+        DetectOffloadThreadSpawn();
+        OutputFilestoreWriterThreadSpawn();
     }
 }
 
@@ -925,12 +955,20 @@ float threading_detect_ratio = 1;
 void RunModeInitialize(void)
 {
     threading_set_cpu_affinity = FALSE;
-    if ((ConfGetBool("threading.set-cpu-affinity", &threading_set_cpu_affinity)) == 0) {
-        threading_set_cpu_affinity = FALSE;
-    }
-    /* try to get custom cpu mask value if needed */
-    if (threading_set_cpu_affinity == TRUE) {
-        AffinitySetupLoadFromConfig();
+    const char *affinity = NULL;
+    if (ConfGet("threading.set-cpu-affinity", &affinity) == 1 &&
+            affinity != NULL && strcmp(affinity, "auto") == 0) {
+        /* derive the cpu sets from the NIC and NUMA layout */
+        threading_set_cpu_affinity = TRUE;
+        AffinitySetupAuto();
+    } else {
+        if ((ConfGetBool("threading.set-cpu-affinity", &threading_set_cpu_affinity)) == 0) {
+            threading_set_cpu_affinity = FALSE;
+        }
+        /* try to get custom cpu mask value if needed */
+        if (threading_set_cpu_affinity == TRUE) {
+            AffinitySetupLoadFromConfig();
+        }
     }
     if ((ConfGetFloat("threading.detect-thread-ratio", &threading_detect_ratio)) != 1) {
         if (ConfGetNode("threading.detect-thread-ratio") != NULL)
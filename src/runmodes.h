@@ -40,6 +40,8 @@ enum RunModes {
     RUNMODE_NAPATECH,
     RUNMODE_UNIX_SOCKET,
     RUNMODE_WINDIVERT,
+    RUNMODE_AFXDP_DEV,
+    RUNMODE_DPDK,
     RUNMODE_USER_MAX, /* Last standard running mode */
     RUNMODE_LIST_KEYWORDS,
     RUNMODE_LIST_APP_LAYERS,
@@ -50,6 +52,7 @@ enum RunModes {
     RUNMODE_DUMP_CONFIG,
     RUNMODE_CONF_TEST,
     RUNMODE_LIST_UNITTEST,
+    RUNMODE_BENCH,
     RUNMODE_ENGINE_ANALYSIS,
 #ifdef OS_WIN32
     RUNMODE_INSTALL_SERVICE,
@@ -69,8 +72,12 @@ extern const char *thread_name_flow_bypass;
 extern const char *thread_name_flow_rec;
 extern const char *thread_name_unix_socket;
 extern const char *thread_name_detect_loader;
+extern const char *thread_name_detect_offload;
+extern const char *thread_name_filestore_writer;
 extern const char *thread_name_counter_stats;
 extern const char *thread_name_counter_wakeup;
+extern const char *thread_name_counter_exporter;
+extern const char *thread_name_memcap_governor;
 
 char *RunmodeGetActive(void);
 const char *RunModeGetMainMode(void);
@@ -104,6 +111,8 @@ int RunModeNeedsBypassManager(void);
 #include "runmode-erf-dag.h"
 #include "runmode-napatech.h"
 #include "runmode-af-packet.h"
+#include "runmode-af-xdp.h"
+#include "runmode-dpdk.h"
 #include "runmode-nflog.h"
 #include "runmode-unix-socket.h"
 #include "runmode-netmap.h"
@@ -37,6 +37,7 @@
 #include "suricata.h"
 #include "decode.h"
 #include "packet-queue.h"
+#include "flow.h"
 #include "threads.h"
 #include "threadvars.h"
 #include "tm-queuehandlers.h"
@@ -167,6 +168,9 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, const void *initdata, void **data)
 
 #define POLL_TIMEOUT 100
 
+/** Number of tpacket_v3 frames set up before running them through the slots */
+#define AFP_V3_BATCH_SIZE 16
+
 #ifndef TP_STATUS_USER_BUSY
 /* for new use latest bit available in tp_status */
 #define TP_STATUS_USER_BUSY (1 << 31)
@@ -176,6 +180,10 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, const void *initdata, void **data)
 #define TP_STATUS_VLAN_VALID (1 << 4)
 #endif
 
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
 enum {
     AFP_READ_OK,
     AFP_READ_FAILURE,
@@ -225,6 +233,9 @@ typedef struct AFPThreadVars_
     int v4_map_fd;
     /* File descriptor of the IPv6 flow bypass table maps */
     int v6_map_fd;
+    /* socket in the lb_rebalance.bpf fanout group */
+    EBPFLbSocket lb;
+    uint16_t capture_lb_moved;
 #endif
 
     unsigned int frame_offset;
@@ -235,6 +246,8 @@ typedef struct AFPThreadVars_
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
     uint16_t capture_errors;
+    CaptureRingStats ring_stats;
+    CapturePoll poll;
 
     /* handle state */
     uint8_t afp_state;
@@ -261,6 +274,8 @@ typedef struct AFPThreadVars_
     int block_timeout;
     /* socket buffer size */
     int buffer_size;
+    /* SO_BUSY_POLL in usec */
+    int busy_poll;
     /* Filter */
     const char *bpf_filter;
     int ebpf_lb_fd;
@@ -311,8 +326,6 @@ static int AFPDerefSocket(AFPPeer* peer);
 static int AFPRefSocket(AFPPeer* peer);
 
 
-static unsigned int nr_cpus;
-
 /**
  * \brief Registration Function for RecieveAFP.
  * \todo Unit tests are needed for this module.
@@ -329,8 +342,6 @@ void TmModuleReceiveAFPRegister (void)
     tmm_modules[TMM_RECEIVEAFP].RegisterTests = NULL;
     tmm_modules[TMM_RECEIVEAFP].cap_flags = SC_CAP_NET_RAW;
     tmm_modules[TMM_RECEIVEAFP].flags = TM_FLAG_RECEIVE_TM;
-
-    nr_cpus = UtilCpuGetNumProcessorsConfigured();
 }
 
 
@@ -935,6 +946,7 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
         ptv->pkts++;
         p->livedev = ptv->livedev;
         p->datalink = ptv->datalink;
+        CaptureRingStatsPacket(&ptv->ring_stats, p);
 
         if (h.h2->tp_len > h.h2->tp_snaplen) {
             SCLogDebug("Packet length (%d) > snaplen (%d), truncating",
@@ -999,7 +1011,7 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         } else {
-            if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
+            if (h.h2->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         }
@@ -1039,11 +1051,16 @@ static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
     pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 }
 
-static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+/**
+ * \brief Setup a Packet from a frame of a tpacket_v3 block
+ *
+ * \retval the packet or NULL in case of failure
+ */
+static inline Packet *AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
 {
     Packet *p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
-        SCReturnInt(AFP_SURI_FAILURE);
+        return NULL;
     }
     PKT_SET_SRC(p, PKT_SRC_WIRE);
     if (ptv->flags & AFP_BYPASS) {
@@ -1063,6 +1080,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     ptv->pkts++;
     p->livedev = ptv->livedev;
     p->datalink = ptv->datalink;
+    CaptureRingStatsPacket(&ptv->ring_stats, p);
 
     if ((!(ptv->flags & AFP_VLAN_DISABLED)) &&
             (ppd->tp_status & TP_STATUS_VLAN_VALID || ppd->hv1.tp_vlan_tci)) {
@@ -1074,7 +1092,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     if (ptv->flags & AFP_ZERO_COPY) {
         if (PacketSetData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
             TmqhOutputPacketpool(ptv->tv, p);
-            SCReturnInt(AFP_SURI_FAILURE);
+            return NULL;
         }
         p->afp_v.relptr = ppd;
         p->ReleasePacket = AFPReleasePacketV3;
@@ -1090,7 +1108,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     } else {
         if (PacketCopyData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
             TmqhOutputPacketpool(ptv->tv, p);
-            SCReturnInt(AFP_SURI_FAILURE);
+            return NULL;
         }
     }
     /* Timestamp */
@@ -1099,6 +1117,13 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
             GET_PKT_LEN(p), p, GET_PKT_DATA(p));
 
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->lb.busy) {
+        if (EBPFLbSample(&ptv->lb, GET_PKT_DATA(p), GET_PKT_LEN(p)))
+            StatsIncr(ptv->tv, ptv->capture_lb_moved);
+    }
+#endif
+
     /* We only check for checksum disable */
     if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
         p->flags |= PKT_IGNORE_CHECKSUM;
@@ -1112,42 +1137,59 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     } else {
-        if (ppd->tp_status & TP_STATUS_CSUMNOTREADY) {
+        if (ppd->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
 
-    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        TmqhOutputPacketpool(ptv->tv, p);
-        SCReturnInt(AFP_SURI_FAILURE);
-    }
-
-    SCReturnInt(AFP_READ_OK);
+    return p;
 }
 
+/**
+ * \brief Process the frames of a tpacket_v3 block
+ *
+ * Frames are handled by batch of AFP_V3_BATCH_SIZE: packets are first
+ * all taken from the pool and set up, prefetching the next frame, then
+ * they are run through the slots while the data of the next packet is
+ * prefetched. This keeps the ring and pool accesses together and hides
+ * part of the cache misses on the packet data.
+ */
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
+    Packet *batch[AFP_V3_BATCH_SIZE];
+    int batch_pkts = 0;
+    int j;
     uint8_t *ppd;
-    int ret = 0;
 
     ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
     for (i = 0; i < num_pkts; ++i) {
-        ret = AFPParsePacketV3(ptv, pbd,
-                               (struct tpacket3_hdr *)ppd);
-        switch (ret) {
-            case AFP_READ_OK:
-                break;
-            case AFP_SURI_FAILURE:
-                /* Internal error but let's just continue and
-                 * treat thenext packet */
-                break;
-            case AFP_READ_FAILURE:
-                SCReturnInt(AFP_READ_FAILURE);
-            default:
-                SCReturnInt(ret);
+        struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)ppd;
+        uint8_t *next_ppd = ppd + hdr->tp_next_offset;
+
+        if (i + 1 < num_pkts) {
+            prefetch(next_ppd);
+        }
+        /* on internal error let's just continue and treat the next packet */
+        Packet *p = AFPParsePacketV3(ptv, pbd, hdr);
+        if (p != NULL) {
+            batch[batch_pkts++] = p;
+        }
+        ppd = next_ppd;
+
+        if (batch_pkts < AFP_V3_BATCH_SIZE && i + 1 < num_pkts) {
+            continue;
+        }
+
+        for (j = 0; j < batch_pkts; j++) {
+            if (j + 1 < batch_pkts) {
+                prefetch(GET_PKT_DATA(batch[j + 1]));
+            }
+            if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, batch[j]) != TM_ECODE_OK) {
+                TmqhOutputPacketpool(ptv->tv, batch[j]);
+            }
         }
-        ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
+        batch_pkts = 0;
     }
 
     SCReturnInt(AFP_READ_OK);
@@ -1200,6 +1242,32 @@ static int AFPReadFromRingV3(AFPThreadVars *ptv)
     SCReturnInt(AFP_READ_OK);
 }
 
+/**
+ * \brief Get the number of tpacket_v3 blocks waiting to be read
+ *
+ * Only done for tpacket_v3 where the ring has a few large blocks, on
+ * tpacket_v2 walking all frames would cost too much.
+ */
+static void AFPGetRingFill(AFPThreadVars *ptv, uint32_t *used, uint32_t *size)
+{
+    *used = 0;
+    *size = 0;
+#ifdef HAVE_TPACKET_V3
+    if (!(ptv->flags & AFP_TPACKET_V3) || ptv->ring.v3 == NULL)
+        return;
+
+    const unsigned int nr = ptv->req.v3.tp_block_nr;
+    for (unsigned int i = 0; i < nr; i++) {
+        struct tpacket_block_desc *pbd = (struct tpacket_block_desc *)
+            ptv->ring.v3[(ptv->frame_offset + i) % nr].iov_base;
+        if ((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            break;
+        (*used)++;
+    }
+    *size = nr;
+#endif
+}
+
 /**
  * \brief Reference socket
  *
@@ -1244,6 +1312,9 @@ static void AFPSwitchState(AFPThreadVars *ptv, int state)
 
     /* Do cleaning if switching to down state */
     if (state == AFP_STATE_DOWN) {
+#ifdef HAVE_PACKET_EBPF
+        EBPFLbLeave(&ptv->lb);
+#endif
 #ifdef HAVE_TPACKET_V3
         if (ptv->flags & AFP_TPACKET_V3) {
             if (!ptv->ring.v3) {
@@ -1534,7 +1605,8 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
 
             do {
                 usleep(AFP_RECONNECT_TIMEOUT);
-                if (suricata_ctl_flags != 0) {
+                if (suricata_ctl_flags != 0 ||
+                        TmThreadsCheckFlag(tv, THV_KILL_PKTACQ)) {
                     dbreak = 1;
                     break;
                 }
@@ -1549,9 +1621,12 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        r = poll(&fds, 1, POLL_TIMEOUT);
+        CaptureRingStatsPollStart(&ptv->ring_stats);
+        r = CapturePollWait(ptv->tv, &ptv->poll, &fds, 1, POLL_TIMEOUT);
 
-        if (suricata_ctl_flags != 0) {
+        /* the thread is also stopped on its own when the number of
+         * workers is lowered at runtime */
+        if (suricata_ctl_flags != 0 || TmThreadsCheckFlag(tv, THV_KILL_PKTACQ)) {
             break;
         }
 
@@ -1576,7 +1651,17 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
                 continue;
             }
         } else if (r > 0) {
+            uint32_t ring_used, ring_size;
+            AFPGetRingFill(ptv, &ring_used, &ring_size);
+#ifdef HAVE_PACKET_EBPF
+            if (ptv->flags & AFP_LB_REBALANCE)
+                EBPFLbUpdate(&ptv->lb, ring_used, ring_size);
+#endif
+            CaptureRingStatsPollEnd(ptv->tv, &ptv->ring_stats, ring_used, ring_size);
+            const uint64_t pkts_before = ptv->pkts;
+
             r = AFPReadFunc(ptv);
+            CaptureRingStatsBatchEnd(ptv->tv, &ptv->ring_stats, ptv->pkts - pkts_before);
             switch (r) {
                 case AFP_READ_OK:
                     /* Trigger one dump of stats every second */
@@ -2139,6 +2224,24 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         }
     }
 
+    if (ptv->busy_poll != 0) {
+#ifdef SO_BUSY_POLL
+        /* let the kernel poll the device queue instead of waiting for
+         * an interrupt, needs CAP_NET_ADMIN to go over
+         * net.core.busy_read */
+        if (setsockopt(ptv->socket, SOL_SOCKET, SO_BUSY_POLL,
+                       &ptv->busy_poll, sizeof(ptv->busy_poll)) == -1) {
+            SCLogWarning(SC_ERR_AFP_CREATE,
+                    "Couldn't set busy poll to %d usec on iface %s, error %s",
+                    ptv->busy_poll, devname, strerror(errno));
+        } else {
+            SCLogPerf("Setting AF_PACKET socket busy poll to %d usec", ptv->busy_poll);
+        }
+#else
+        SCLogWarning(SC_ERR_AFP_CREATE, "SO_BUSY_POLL is not supported");
+#endif
+    }
+
     r = bind(ptv->socket, (struct sockaddr *)&bind_address, sizeof(bind_address));
     if (r < 0) {
         if (verbose) {
@@ -2182,6 +2285,8 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
                        strerror(errno));
             goto socket_err;
         }
+        if (ptv->flags & AFP_LB_REBALANCE)
+            (void)EBPFLbJoin(ptv->iface, &ptv->lb);
     }
 #endif
 
@@ -2278,52 +2383,6 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
     return TM_ECODE_OK;
 }
 
-#ifdef HAVE_PACKET_EBPF
-/**
- * Insert a half flow in the kernel bypass table
- *
- * \param mapfd file descriptor of the protocol bypass table
- * \param key data to use as key in the table
- * \param inittime time of creation of the entry (in monotonic clock)
- * \return 0 in case of error, 1 if success
- */
-static int AFPInsertHalfFlow(int mapd, void *key, uint64_t inittime)
-{
-    struct pair value[nr_cpus];
-    unsigned int i;
-
-    if (mapd == -1) {
-        return 0;
-    }
-
-    /* We use a per CPU structure so we have to set an array of values as the kernel
-     * is not duplicating the data on each CPU by itself. */
-    for (i = 0; i < nr_cpus; i++) {
-        value[i].time = inittime;
-        value[i].packets = 0;
-        value[i].bytes = 0;
-    }
-    SCLogDebug("Inserting element in eBPF mapping: %lu", inittime);
-    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
-        switch (errno) {
-            /* no more place in the hash */
-            case E2BIG:
-                return 0;
-            /* if we already have the key then bypass is a success */
-            case EEXIST:
-                return 1;
-            /* Not supposed to be there so issue a error */
-            default:
-                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
-                        strerror(errno),
-                        errno);
-                return 0;
-        }
-    }
-    return 1;
-}
-#endif
-
 /**
  * Bypass function for AF_PACKET capture in eBPF mode
  *
@@ -2347,12 +2406,12 @@ static int AFPBypassCallback(Packet *p)
         return 0;
     }
 
-    /* Bypassing tunneled packets is currently not supported
-     * because we can't discard the inner packet only due to
-     * primitive parsing in eBPF */
-    if (IS_TUNNEL_PKT(p)) {
+    /* the eBPF filter only decapsulates some tunnels */
+    if (!EBPFBypassTupleSupported(p)) {
         return 0;
     }
+    /* tunnel pseudo packets use the maps of the packet they came in */
+    const Packet *rp = p->root ? p->root : p;
     struct timespec curtime;
     uint64_t inittime = 0;
     /* In eBPF, the function that we have use to get time return the
@@ -2363,24 +2422,24 @@ static int AFPBypassCallback(Packet *p)
     }
     if (PKT_IS_IPV4(p)) {
         SCLogDebug("add an IPv4");
-        if (p->afp_v.v4_map_fd == -1) {
+        if (rp->afp_v.v4_map_fd == -1) {
             return 0;
         }
-        struct flowv4_keys key = {};
-        key.src = htonl(GET_IPV4_SRC_ADDR_U32(p));
-        key.dst = htonl(GET_IPV4_DST_ADDR_U32(p));
-        key.port16[0] = GET_TCP_SRC_PORT(p);
-        key.port16[1] = GET_TCP_DST_PORT(p);
-
-        key.ip_proto = IPV4_GET_IPPROTO(p);
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        key.src = htonl(GET_IPV4_DST_ADDR_U32(p));
-        key.dst = htonl(GET_IPV4_SRC_ADDR_U32(p));
-        key.port16[0] = GET_TCP_DST_PORT(p);
-        key.port16[1] = GET_TCP_SRC_PORT(p);
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, &key, inittime) == 0) {
+        struct flowv4_keys key[2];
+        memset(key, 0, sizeof(key));
+        key[0].src = htonl(GET_IPV4_SRC_ADDR_U32(p));
+        key[0].dst = htonl(GET_IPV4_DST_ADDR_U32(p));
+        key[0].port16[0] = GET_TCP_SRC_PORT(p);
+        key[0].port16[1] = GET_TCP_DST_PORT(p);
+        key[0].ip_proto = IPV4_GET_IPPROTO(p);
+
+        key[1].src = htonl(GET_IPV4_DST_ADDR_U32(p));
+        key[1].dst = htonl(GET_IPV4_SRC_ADDR_U32(p));
+        key[1].port16[0] = GET_TCP_DST_PORT(p);
+        key[1].port16[1] = GET_TCP_SRC_PORT(p);
+        key[1].ip_proto = IPV4_GET_IPPROTO(p);
+        /* both half flows in one map update */
+        if (EBPFInsertFlow(rp->afp_v.v4_map_fd, key, sizeof(key[0]), inittime) == 0) {
             return 0;
         }
         EBPFUpdateFlow(p->flow, p);
@@ -2390,28 +2449,25 @@ static int AFPBypassCallback(Packet *p)
     if (PKT_IS_IPV6(p) &&
         ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
         int i;
-        if (p->afp_v.v6_map_fd == -1) {
+        if (rp->afp_v.v6_map_fd == -1) {
             return 0;
         }
         SCLogDebug("add an IPv6");
-        struct flowv6_keys key = {};
+        struct flowv6_keys key[2];
+        memset(key, 0, sizeof(key));
         for (i = 0; i < 4; i++) {
-            key.src[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
-            key.dst[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
-        }
-        key.port16[0] = GET_TCP_SRC_PORT(p);
-        key.port16[1] = GET_TCP_DST_PORT(p);
-        key.ip_proto = IPV6_GET_NH(p);
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        for (i = 0; i < 4; i++) {
-            key.src[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
-            key.dst[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
-        }
-        key.port16[0] = GET_TCP_DST_PORT(p);
-        key.port16[1] = GET_TCP_SRC_PORT(p);
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, &key, inittime) == 0) {
+            key[0].src[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
+            key[0].dst[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
+            key[1].src[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
+            key[1].dst[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
+        }
+        key[0].port16[0] = GET_TCP_SRC_PORT(p);
+        key[0].port16[1] = GET_TCP_DST_PORT(p);
+        key[0].ip_proto = IPV6_GET_NH(p);
+        key[1].port16[0] = GET_TCP_DST_PORT(p);
+        key[1].port16[1] = GET_TCP_SRC_PORT(p);
+        key[1].ip_proto = IPV6_GET_NH(p);
+        if (EBPFInsertFlow(rp->afp_v.v6_map_fd, key, sizeof(key[0]), inittime) == 0) {
             return 0;
         }
         EBPFUpdateFlow(p->flow, p);
@@ -2436,79 +2492,9 @@ static int AFPXDPBypassCallback(Packet *p)
 {
 #ifdef HAVE_PACKET_XDP
     SCLogDebug("Calling af_packet callback function");
-    /* Only bypass TCP and UDP */
-    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
-        return 0;
-    }
-
-    /* Bypassing tunneled packets is currently not supported
-     * because we can't discard the inner packet only due to
-     * primitive parsing in eBPF */
-    if (IS_TUNNEL_PKT(p)) {
-        return 0;
-    }
-    struct timespec curtime;
-    uint64_t inittime = 0;
-    /* In eBPF, the function that we have use to get time return the
-     * monotonic clock (the time since start of the computer). So we
-     * can't use the timestamp of the packet. */
-    if (clock_gettime(CLOCK_MONOTONIC, &curtime) == 0) {
-        inittime = curtime.tv_sec * 1000000000;
-    }
-    if (PKT_IS_IPV4(p)) {
-        struct flowv4_keys key = {};
-        if (p->afp_v.v4_map_fd == -1) {
-            return 0;
-        }
-        key.src = GET_IPV4_SRC_ADDR_U32(p);
-        key.dst = GET_IPV4_DST_ADDR_U32(p);
-        /* In the XDP filter we get port from parsing of packet and not from skb
-         * (as in eBPF filter) so we need to pass from host to network order */
-        key.port16[0] = htons(GET_TCP_SRC_PORT(p));
-        key.port16[1] = htons(GET_TCP_DST_PORT(p));
-        key.ip_proto = IPV4_GET_IPPROTO(p);
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        key.src = GET_IPV4_DST_ADDR_U32(p);
-        key.dst = GET_IPV4_SRC_ADDR_U32(p);
-        key.port16[0] = htons(GET_TCP_DST_PORT(p));
-        key.port16[1] = htons(GET_TCP_SRC_PORT(p));
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        return 1;
-    }
-    /* For IPv6 case we don't handle extended header in eBPF */
-    if (PKT_IS_IPV6(p) &&
-        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
-        SCLogDebug("add an IPv6");
-        if (p->afp_v.v6_map_fd == -1) {
-            return 0;
-        }
-        int i;
-        struct flowv6_keys key = {};
-        for (i = 0; i < 4; i++) {
-            key.src[i] = GET_IPV6_SRC_ADDR(p)[i];
-            key.dst[i] = GET_IPV6_DST_ADDR(p)[i];
-        }
-        key.port16[0] = htons(GET_TCP_SRC_PORT(p));
-        key.port16[1] = htons(GET_TCP_DST_PORT(p));
-        key.ip_proto = IPV6_GET_NH(p);
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        for (i = 0; i < 4; i++) {
-            key.src[i] = GET_IPV6_DST_ADDR(p)[i];
-            key.dst[i] = GET_IPV6_SRC_ADDR(p)[i];
-        }
-        key.port16[0] = htons(GET_TCP_DST_PORT(p));
-        key.port16[1] = htons(GET_TCP_SRC_PORT(p));
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, &key, inittime) == 0) {
-            return 0;
-        }
-        return 1;
-    }
+    /* tunnel pseudo packets use the maps of the packet they came in */
+    const Packet *rp = p->root ? p->root : p;
+    return EBPFXDPBypassFlow(p, rp->afp_v.v4_map_fd, rp->afp_v.v6_map_fd);
 #endif
     return 0;
 }
@@ -2553,6 +2539,7 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     }
 
     ptv->buffer_size = afpconfig->buffer_size;
+    ptv->busy_poll = afpconfig->busy_poll;
     ptv->ring_size = afpconfig->ring_size;
     ptv->block_size = afpconfig->block_size;
 
@@ -2581,6 +2568,11 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->xdp_mode = afpconfig->xdp_mode;
 
 #ifdef HAVE_PACKET_EBPF
+    EBPFLbSocketInit(&ptv->lb);
+    if (ptv->flags & AFP_LB_REBALANCE) {
+        ptv->capture_lb_moved = StatsRegisterCounter("capture.ebpf_lb_moved",
+                ptv->tv);
+    }
     if (ptv->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
         ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v4");
         if (ptv->v4_map_fd == -1) {
@@ -2601,6 +2593,9 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->capture_errors = StatsRegisterCounter("capture.errors",
             ptv->tv);
 #endif
+    CaptureRingStatsSetup(ptv->tv, &ptv->ring_stats);
+    CapturePollSetup(ptv->tv, &ptv->poll, afpconfig->poll_mode,
+            (uint32_t)afpconfig->poll_spin);
 
     ptv->copy_mode = afpconfig->copy_mode;
     if (ptv->copy_mode != AFP_COPY_MODE_NONE) {
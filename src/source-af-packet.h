@@ -53,6 +53,7 @@
 #define AFP_MMAP_LOCKED (1<<6)
 #define AFP_BYPASS   (1<<7)
 #define AFP_XDPBYPASS   (1<<8)
+#define AFP_LB_REBALANCE    (1<<10)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
@@ -67,6 +68,9 @@
  * to standard frame size */
 #define AFP_BLOCK_SIZE_DEFAULT_ORDER 3
 
+/* default spin budget in usec of the hybrid poll mode */
+#define AFP_POLL_SPIN_DEFAULT 50
+
 typedef struct AFPIfaceConfig_
 {
     char iface[AFP_IFACE_NAME_LENGTH];
@@ -80,6 +84,12 @@ typedef struct AFPIfaceConfig_
     int block_size;
     /* block timeout for tpacket_v3 in milliseconds */
     int block_timeout;
+    /* how the capture thread waits for packets, a CapturePollMode */
+    int poll_mode;
+    /* spin budget in usec for the hybrid poll mode */
+    int poll_spin;
+    /* SO_BUSY_POLL value in usec, 0 to leave it unset */
+    int busy_poll;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -0,0 +1,1004 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ *  \defgroup afxdp AF_XDP running mode
+ *
+ *  @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ *
+ * Each capture thread binds an AF_XDP socket to one RX queue of the
+ * interface. The XDP filter attached to the interface redirects the
+ * packets of this queue to the socket via its 'xsks_map'. Packets are
+ * received in a UMEM owned by the thread and are handed to the engine
+ * without copy: the UMEM frame is given back to the kernel in the
+ * release function of the packet.
+ */
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H 1
+#define SC_PCAP_DONT_INCLUDE_PCAP_H 1
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "decode.h"
+#include "packet-queue.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queuehandlers.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "util-ebpf.h"
+#include "tmqh-packetpool.h"
+#include "source-af-xdp.h"
+#include "runmodes.h"
+
+#ifdef HAVE_AF_XDP
+
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#endif /* HAVE_AF_XDP */
+
+#include "util-ioctl.h"
+
+#ifndef HAVE_AF_XDP
+
+TmEcode NoAFXDPSupportExit(ThreadVars *, const void *, void **);
+
+void TmModuleReceiveAFXDPRegister (void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister (void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_DECODEAFXDP].Func = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+TmEcode NoAFXDPSupportExit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_AF_XDP,"Error creating thread %s: you do not have "
+               "support for AF_XDP enabled, on Linux host please recompile "
+               "with --enable-af-packet and --enable-ebpf", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+#else /* We have AF_XDP support */
+
+#define POLL_TIMEOUT 100
+
+/** Maximum number of descriptors taken from the RX ring at once */
+#define AFXDP_RX_BATCH 64
+
+/**
+ * \brief a ring shared with the kernel
+ *
+ * Producer and consumer indexes are free running and the ring size is
+ * a power of 2 so the slot of an index is obtained by masking it.
+ */
+typedef struct AFXDPRing_ {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *desc;
+    uint32_t mask;
+    uint32_t size;
+    /** local copy of the index we own (producer or consumer) */
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_len;
+} AFXDPRing;
+
+/**
+ * \brief Structure to hold thread specific variables.
+ */
+typedef struct AFXDPThreadVars_
+{
+    ThreadVars *tv;
+    TmSlot *slot;
+    LiveDevice *livedev;
+
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    int ifindex;
+    uint32_t queue_id;
+    int socket;
+
+    unsigned int flags;
+    int promisc;
+    ChecksumValidationMode checksum_mode;
+    uint8_t xdp_mode;
+
+    /* UMEM: frame_nr frames of frame_size bytes */
+    uint8_t *umem_area;
+    size_t umem_len;
+    uint32_t frame_size;
+    uint32_t frame_nr;
+
+    AFXDPRing fill;
+    AFXDPRing comp;
+    AFXDPRing rx;
+
+    int v4_map_fd;
+    int v6_map_fd;
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t last_dumped_pkts;
+    uint64_t last_rx_dropped;
+
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+    uint16_t capture_errors;
+} AFXDPThreadVars;
+
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *, const void *, void **);
+static void ReceiveAFXDPThreadExitStats(ThreadVars *, void *);
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *, void *);
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot);
+
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *, const void *, void **);
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data);
+static TmEcode DecodeAFXDP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+static void ReceiveAFXDPRegisterTests(void);
+
+/**
+ * \brief capture threads with a socket per interface
+ *
+ * The XDP filter is attached to the interface once, by the runmode, and
+ * is shared by the sockets of all queues. It is only removed by the last
+ * thread that closes its socket, the others still need the redirection.
+ */
+typedef struct AFXDPIfaceUsers_ {
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    uint32_t users;
+    struct AFXDPIfaceUsers_ *next;
+} AFXDPIfaceUsers;
+
+static AFXDPIfaceUsers *afxdp_iface_users = NULL;
+static SCMutex afxdp_iface_users_lock = SCMUTEX_INITIALIZER;
+
+/**
+ * \brief Registration Function for ReceiveAFXDP.
+ */
+void TmModuleReceiveAFXDPRegister (void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = ReceiveAFXDPThreadInit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqLoop = ReceiveAFXDPLoop;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = ReceiveAFXDPThreadExitStats;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = ReceiveAFXDPThreadDeinit;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = ReceiveAFXDPRegisterTests;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = SC_CAP_NET_RAW | SC_CAP_NET_ADMIN;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister (void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = DecodeAFXDPThreadInit;
+    tmm_modules[TMM_DECODEAFXDP].Func = DecodeAFXDP;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = DecodeAFXDPThreadDeinit;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+static int AFXDPIfaceRef(const char *iface)
+{
+    AFXDPIfaceUsers *u;
+
+    SCMutexLock(&afxdp_iface_users_lock);
+    for (u = afxdp_iface_users; u != NULL; u = u->next) {
+        if (strcmp(u->iface, iface) == 0)
+            break;
+    }
+    if (u == NULL) {
+        u = SCCalloc(1, sizeof(*u));
+        if (unlikely(u == NULL)) {
+            SCMutexUnlock(&afxdp_iface_users_lock);
+            return -1;
+        }
+        strlcpy(u->iface, iface, sizeof(u->iface));
+        u->next = afxdp_iface_users;
+        afxdp_iface_users = u;
+    }
+    u->users++;
+    SCMutexUnlock(&afxdp_iface_users_lock);
+    return 0;
+}
+
+/**
+ * \retval 1 if the caller was the last user of the interface
+ */
+static int AFXDPIfaceDeref(const char *iface)
+{
+    int last = 0;
+
+    SCMutexLock(&afxdp_iface_users_lock);
+    AFXDPIfaceUsers **pu = &afxdp_iface_users;
+    while (*pu != NULL && strcmp((*pu)->iface, iface) != 0)
+        pu = &(*pu)->next;
+    AFXDPIfaceUsers *u = *pu;
+    if (u != NULL && --u->users == 0) {
+        *pu = u->next;
+        SCFree(u);
+        last = 1;
+    }
+    SCMutexUnlock(&afxdp_iface_users_lock);
+    return last;
+}
+
+/**
+ * \brief Give a UMEM frame back to the kernel
+ *
+ * The frame is only queued in the fill ring: the producer index is
+ * published by AFXDPFillRingFlush(). The fill ring can hold all the
+ * frames of the UMEM so there is always room for it.
+ */
+static inline void AFXDPFillRingPush(AFXDPThreadVars *ptv, uint64_t addr)
+{
+    uint64_t *slots = (uint64_t *)ptv->fill.desc;
+    slots[ptv->fill.cached_prod & ptv->fill.mask] = addr;
+    ptv->fill.cached_prod++;
+}
+
+static inline void AFXDPFillRingFlush(AFXDPThreadVars *ptv)
+{
+    if (*ptv->fill.producer != ptv->fill.cached_prod) {
+        /* kernel must see the addresses before the new index */
+        hw_barrier();
+        *ptv->fill.producer = ptv->fill.cached_prod;
+    }
+}
+
+/**
+ * \brief Release function for packets in a UMEM frame
+ *
+ * Capture loop and release of the packet are done by the same thread
+ * as only the single and workers runmodes are supported.
+ */
+static void AFXDPReleasePacket(Packet *p)
+{
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)p->afxdp_v.ptv;
+
+    if (ptv != NULL) {
+        AFXDPFillRingPush(ptv, p->afxdp_v.addr);
+    }
+    AFXDPV_CLEANUP(&p->afxdp_v);
+    PacketFreeOrRelease(p);
+}
+
+/**
+ * Bypass function for AF_XDP capture
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \return 0 if unable to bypass, 1 if success
+ */
+static int AFXDPBypassCallback(Packet *p)
+{
+    SCLogDebug("Calling af_xdp callback function");
+    /* tunnel pseudo packets use the maps of the packet they came in */
+    const Packet *rp = p->root ? p->root : p;
+    return EBPFXDPBypassFlow(p, rp->afxdp_v.v4_map_fd, rp->afxdp_v.v6_map_fd);
+}
+
+static inline void AFXDPDumpCounters(AFXDPThreadVars *ptv)
+{
+    struct xdp_statistics xstats;
+    socklen_t len = sizeof(xstats);
+
+    memset(&xstats, 0, sizeof(xstats));
+    if (getsockopt(ptv->socket, SOL_XDP, XDP_STATISTICS, &xstats, &len) < 0) {
+        return;
+    }
+    /* kernel counters are not reset on read */
+    uint64_t drops = xstats.rx_dropped - ptv->last_rx_dropped;
+    uint64_t pkts = ptv->pkts - ptv->last_dumped_pkts + drops;
+    ptv->last_rx_dropped = xstats.rx_dropped;
+    ptv->last_dumped_pkts = ptv->pkts;
+
+    SCLogDebug("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 "",
+            ptv->tv->name, pkts, drops);
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_packets, pkts);
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_drops, drops);
+    (void) SC_ATOMIC_ADD(ptv->livedev->drop, drops);
+    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, pkts);
+}
+
+static int AFXDPRingMap(AFXDPThreadVars *ptv, AFXDPRing *ring,
+                        struct xdp_ring_offset *off, size_t desc_size,
+                        off_t pgoff)
+{
+    ring->map_len = off->desc + ring->size * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ptv->socket, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to mmap ring: %s",
+                   ptv->iface, strerror(errno));
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->desc = (uint8_t *)ring->map + off->desc;
+    ring->mask = ring->size - 1;
+    ring->cached_prod = *ring->producer;
+    ring->cached_cons = *ring->consumer;
+    return 0;
+}
+
+static void AFXDPRingUnmap(AFXDPRing *ring)
+{
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->map_len);
+        ring->map = NULL;
+    }
+}
+
+static void AFXDPCloseSocket(AFXDPThreadVars *ptv)
+{
+    AFXDPRingUnmap(&ptv->rx);
+    AFXDPRingUnmap(&ptv->fill);
+    AFXDPRingUnmap(&ptv->comp);
+    if (ptv->socket != -1) {
+        close(ptv->socket);
+        ptv->socket = -1;
+    }
+    if (ptv->umem_area != NULL) {
+        munmap(ptv->umem_area, ptv->umem_len);
+        ptv->umem_area = NULL;
+    }
+}
+
+/**
+ * \brief create the AF_XDP socket, its UMEM and rings and bind it to
+ *        the RX queue of the thread
+ */
+static int AFXDPCreateSocket(AFXDPThreadVars *ptv)
+{
+    ptv->umem_len = (size_t)ptv->frame_nr * ptv->frame_size;
+    ptv->umem_area = mmap(NULL, ptv->umem_len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptv->umem_area == MAP_FAILED) {
+        ptv->umem_area = NULL;
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to allocate UMEM of %" PRIuMAX
+                   " bytes: %s", ptv->iface, (uintmax_t)ptv->umem_len, strerror(errno));
+        return -1;
+    }
+
+    ptv->socket = socket(AF_XDP, SOCK_RAW, 0);
+    if (ptv->socket == -1) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to create AF_XDP socket: %s",
+                   ptv->iface, strerror(errno));
+        goto error;
+    }
+
+    struct xdp_umem_reg mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uintptr_t)ptv->umem_area;
+    mr.len = ptv->umem_len;
+    mr.chunk_size = ptv->frame_size;
+    mr.headroom = 0;
+    if (setsockopt(ptv->socket, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to register UMEM: %s",
+                   ptv->iface, strerror(errno));
+        goto error;
+    }
+
+    if (setsockopt(ptv->socket, SOL_XDP, XDP_UMEM_FILL_RING,
+                   &ptv->fill.size, sizeof(ptv->fill.size)) < 0 ||
+        setsockopt(ptv->socket, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                   &ptv->comp.size, sizeof(ptv->comp.size)) < 0 ||
+        setsockopt(ptv->socket, SOL_XDP, XDP_RX_RING,
+                   &ptv->rx.size, sizeof(ptv->rx.size)) < 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to set ring size: %s",
+                   ptv->iface, strerror(errno));
+        goto error;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(ptv->socket, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to get ring offsets: %s",
+                   ptv->iface, strerror(errno));
+        goto error;
+    }
+
+    if (AFXDPRingMap(ptv, &ptv->fill, &off.fr, sizeof(uint64_t),
+                     XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+        AFXDPRingMap(ptv, &ptv->comp, &off.cr, sizeof(uint64_t),
+                     XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+        AFXDPRingMap(ptv, &ptv->rx, &off.rx, sizeof(struct xdp_desc),
+                     XDP_PGOFF_RX_RING) < 0) {
+        goto error;
+    }
+
+    /* hand all the frames to the kernel */
+    uint32_t i;
+    for (i = 0; i < ptv->frame_nr; i++) {
+        AFXDPFillRingPush(ptv, (uint64_t)i * ptv->frame_size);
+    }
+    AFXDPFillRingFlush(ptv);
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ptv->ifindex;
+    sxdp.sxdp_queue_id = ptv->queue_id;
+    /* without flag the kernel uses zero copy if the driver supports it
+     * and falls back to copy otherwise */
+    sxdp.sxdp_flags = (ptv->flags & AFXDP_ZERO_COPY) ? XDP_ZEROCOPY : 0;
+    if (bind(ptv->socket, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to bind AF_XDP socket to "
+                   "queue %u: %s", ptv->iface, ptv->queue_id, strerror(errno));
+        goto error;
+    }
+
+    if (EBPFSetXSKSocket(ptv->iface, ptv->queue_id, ptv->socket) < 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "%s: unable to register socket in XDP "
+                   "filter, is 'xsks_map' defined?", ptv->iface);
+        goto error;
+    }
+
+    SCLogConfig("%s: AF_XDP socket bound to queue %u (%u frames of %u bytes)",
+                ptv->iface, ptv->queue_id, ptv->frame_nr, ptv->frame_size);
+    return 0;
+
+error:
+    AFXDPCloseSocket(ptv);
+    return -1;
+}
+
+/**
+ * \brief Process the packets available in the RX ring
+ *
+ * Descriptors are taken by batch: the consumer index is published
+ * once per batch before the packets are processed so the kernel can
+ * refill the ring while the engine is busy.
+ *
+ * \retval number of packets read or -1 in case of engine failure
+ */
+static int AFXDPReadFromRing(AFXDPThreadVars *ptv)
+{
+    struct xdp_desc batch[AFXDP_RX_BATCH];
+    struct xdp_desc *ring = (struct xdp_desc *)ptv->rx.desc;
+    uint32_t cons = ptv->rx.cached_cons;
+    uint32_t avail;
+    uint32_t i;
+    struct timeval ts;
+
+    avail = *(volatile uint32_t *)ptv->rx.producer - cons;
+    if (avail == 0) {
+        return 0;
+    }
+    if (avail > AFXDP_RX_BATCH) {
+        avail = AFXDP_RX_BATCH;
+    }
+    /* don't read descriptors before reading producer index */
+    hw_barrier();
+    for (i = 0; i < avail; i++) {
+        batch[i] = ring[(cons + i) & ptv->rx.mask];
+    }
+    /* descriptors are copied, kernel can reuse the slots */
+    hw_barrier();
+    ptv->rx.cached_cons = cons + avail;
+    *ptv->rx.consumer = ptv->rx.cached_cons;
+
+    gettimeofday(&ts, NULL);
+
+    for (i = 0; i < avail; i++) {
+        Packet *p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            /* give back the frames we can't process */
+            for ( ; i < avail; i++) {
+                AFXDPFillRingPush(ptv, batch[i].addr);
+            }
+            AFXDPFillRingFlush(ptv);
+            return -1;
+        }
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+        p->livedev = ptv->livedev;
+        p->datalink = LINKTYPE_ETHERNET;
+        p->ts = ts;
+        ptv->pkts++;
+
+        if (PacketSetData(p, ptv->umem_area + batch[i].addr, batch[i].len) == -1) {
+            AFXDPFillRingPush(ptv, batch[i].addr);
+            TmqhOutputPacketpool(ptv->tv, p);
+            StatsIncr(ptv->tv, ptv->capture_errors);
+            continue;
+        }
+        p->afxdp_v.ptv = ptv;
+        p->afxdp_v.addr = batch[i].addr;
+        p->ReleasePacket = AFXDPReleasePacket;
+
+        if (ptv->flags & AFXDP_XDPBYPASS) {
+            p->BypassPacketsFlow = AFXDPBypassCallback;
+            p->afxdp_v.v4_map_fd = ptv->v4_map_fd;
+            p->afxdp_v.v6_map_fd = ptv->v6_map_fd;
+        }
+
+        if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+            if (ptv->livedev->ignore_checksum) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (ChecksumAutoModeCheck(ptv->pkts,
+                        SC_ATOMIC_GET(ptv->livedev->pkts),
+                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+                ptv->livedev->ignore_checksum = 1;
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+        }
+
+        if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            AFXDPFillRingFlush(ptv);
+            return -1;
+        }
+    }
+    AFXDPFillRingFlush(ptv);
+
+    return (int)avail;
+}
+
+/**
+ * \brief Main AF_XDP reading Loop function
+ */
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+    struct pollfd fds;
+    time_t last_dump = 0;
+    time_t current_time;
+    int r;
+
+    ptv->slot = s->slot_next;
+
+    fds.fd = ptv->socket;
+    fds.events = POLLIN;
+
+    while (1) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool, to prevent
+         * us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        r = AFXDPReadFromRing(ptv);
+        if (unlikely(r < 0)) {
+            StatsIncr(ptv->tv, ptv->capture_errors);
+        } else if (r == 0) {
+            /* ring is empty, wait for the kernel */
+            r = poll(&fds, 1, POLL_TIMEOUT);
+            if (suricata_ctl_flags != 0) {
+                break;
+            }
+            if (r > 0 && (fds.revents & (POLLHUP|POLLERR|POLLNVAL))) {
+                SCLogError(SC_ERR_AFXDP_READ, "Error reading data from iface '%s' "
+                           "queue %u", ptv->iface, ptv->queue_id);
+                SCReturnInt(TM_ECODE_FAILED);
+            } else if (r == 0) {
+                /* poll timed out, lets see if we need to inject a fake packet  */
+                TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+            } else if (r < 0 && errno != EINTR) {
+                SCLogError(SC_ERR_AFXDP_READ, "Error polling iface '%s': (%d) %s",
+                           ptv->iface, errno, strerror(errno));
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        }
+
+        /* Trigger one dump of stats every second */
+        current_time = time(NULL);
+        if (current_time != last_dump) {
+            AFXDPDumpCounters(ptv);
+            last_dump = current_time;
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    AFXDPDumpCounters(ptv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static uint32_t AFXDPRoundUpPow2(uint32_t v)
+{
+    uint32_t r = 1;
+    while (r < v && r < (1U << 31))
+        r <<= 1;
+    return r;
+}
+
+/**
+ * \brief size the rings and the UMEM of a thread
+ *
+ * RX ring is sized by ring-size, the UMEM holds twice as many frames so
+ * the kernel can keep filling the ring while the engine holds packets.
+ * Fill ring can hold all the frames.
+ */
+static void AFXDPSetRingSizes(AFXDPThreadVars *ptv, uint32_t ring_size,
+                              uint32_t frame_size)
+{
+    ptv->rx.size = AFXDPRoundUpPow2(ring_size);
+    ptv->comp.size = ptv->rx.size;
+    ptv->frame_nr = ptv->rx.size * 2;
+    ptv->fill.size = ptv->frame_nr;
+    ptv->frame_size = frame_size;
+}
+
+/**
+ * \brief Init function for ReceiveAFXDP.
+ *
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with AFXDPThreadVars
+ */
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    AFXDPThreadVars *ptv = SCCalloc(1, sizeof(AFXDPThreadVars));
+    if (unlikely(ptv == NULL)) {
+        aconf->DerefFunc(aconf);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    ptv->tv = tv;
+    ptv->socket = -1;
+    strlcpy(ptv->iface, aconf->iface, sizeof(ptv->iface));
+
+    ptv->livedev = LiveGetDevice(ptv->iface);
+    if (ptv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error;
+    }
+
+    ptv->ifindex = if_nametoindex(ptv->iface);
+    if (ptv->ifindex == 0) {
+        SCLogError(SC_ERR_AFXDP_CREATE, "Unable to find iface %s: %s",
+                   ptv->iface, strerror(errno));
+        goto error;
+    }
+
+    ptv->flags = aconf->flags;
+    ptv->promisc = aconf->promisc;
+    ptv->checksum_mode = aconf->checksum_mode;
+    ptv->xdp_mode = aconf->xdp_mode;
+    ptv->queue_id = aconf->queue_start +
+                    (SC_ATOMIC_ADD(aconf->queue_counter, 1) - 1);
+
+    AFXDPSetRingSizes(ptv, aconf->ring_size, aconf->frame_size);
+
+    ptv->v4_map_fd = -1;
+    ptv->v6_map_fd = -1;
+    if (ptv->flags & AFXDP_XDPBYPASS) {
+        ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v4");
+        if (ptv->v4_map_fd == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'", "flow_table_v4");
+        }
+        ptv->v6_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v6");
+        if (ptv->v6_map_fd  == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'", "flow_table_v6");
+        }
+    }
+
+    if (ptv->promisc != 0) {
+        int if_flags = GetIfaceFlags(ptv->iface);
+        if (if_flags != -1 && (if_flags & IFF_PROMISC) == 0) {
+            if (SetIfaceFlags(ptv->iface, if_flags | IFF_PROMISC) != 0) {
+                SCLogWarning(SC_ERR_AFXDP_CREATE, "Unable to set promiscuous mode on %s",
+                             ptv->iface);
+            }
+        }
+    }
+
+    if (AFXDPCreateSocket(ptv) < 0) {
+        goto error;
+    }
+    if (AFXDPIfaceRef(ptv->iface) < 0) {
+        AFXDPCloseSocket(ptv);
+        goto error;
+    }
+
+    ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            ptv->tv);
+    ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            ptv->tv);
+    ptv->capture_errors = StatsRegisterCounter("capture.errors",
+            ptv->tv);
+
+    aconf->DerefFunc(aconf);
+    *data = (void *)ptv;
+    SCReturnInt(TM_ECODE_OK);
+
+error:
+    aconf->DerefFunc(aconf);
+    SCFree(ptv);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static void ReceiveAFXDPThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    AFXDPDumpCounters(ptv);
+    SCLogPerf("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 "",
+            tv->name,
+            StatsGetLocalCounterValue(tv, ptv->capture_kernel_packets),
+            StatsGetLocalCounterValue(tv, ptv->capture_kernel_drops));
+}
+
+/**
+ * \brief DeInit function closes AF_XDP socket at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    /* stop redirection to the socket before closing it */
+    EBPFSetXSKSocket(ptv->iface, ptv->queue_id, -1);
+    AFXDPCloseSocket(ptv);
+    /* the sockets of the other queues still use the filter */
+    if (AFXDPIfaceDeref(ptv->iface) == 1) {
+        EBPFSetupXDP(ptv->iface, -1, ptv->xdp_mode);
+    }
+
+    SCFree(ptv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars
+ * \param pq pointer to the current PacketQueue
+ */
+static TmEcode DecodeAFXDP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(tv);
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+/** \test ring and UMEM sizes */
+static int AFXDPRingSizeTest01(void)
+{
+    AFXDPThreadVars ptv;
+    memset(&ptv, 0, sizeof(ptv));
+
+    AFXDPSetRingSizes(&ptv, 1000, 2048);
+    FAIL_IF(ptv.rx.size != 1024);
+    FAIL_IF(ptv.comp.size != 1024);
+    FAIL_IF(ptv.frame_nr != 2048);
+    /* the fill ring can hold all the frames of the UMEM */
+    FAIL_IF(ptv.fill.size != ptv.frame_nr);
+    FAIL_IF(ptv.frame_size != 2048);
+
+    AFXDPSetRingSizes(&ptv, 2048, 4096);
+    FAIL_IF(ptv.rx.size != 2048);
+    AFXDPSetRingSizes(&ptv, 0, 4096);
+    FAIL_IF(ptv.rx.size != 1);
+    PASS;
+}
+
+/** \test frames given back to the fill ring are published at the flush,
+ *        also when the indexes wrap */
+static int AFXDPFillRingTest01(void)
+{
+    AFXDPThreadVars ptv;
+    uint64_t slots[8];
+    uint32_t producer = UINT32_MAX - 2;
+    uint32_t consumer = UINT32_MAX - 2;
+    memset(&ptv, 0, sizeof(ptv));
+    memset(slots, 0, sizeof(slots));
+
+    ptv.fill.size = 8;
+    ptv.fill.mask = 7;
+    ptv.fill.desc = slots;
+    ptv.fill.producer = &producer;
+    ptv.fill.consumer = &consumer;
+    ptv.fill.cached_prod = producer;
+
+    for (uint64_t i = 0; i < 5; i++) {
+        AFXDPFillRingPush(&ptv, i * 2048);
+    }
+    /* nothing is visible to the kernel before the flush */
+    FAIL_IF(producer != UINT32_MAX - 2);
+    AFXDPFillRingFlush(&ptv);
+    FAIL_IF(producer != 2);
+    FAIL_IF(ptv.fill.cached_prod != 2);
+    FAIL_IF(slots[(UINT32_MAX - 2) & 7] != 0);
+    FAIL_IF(slots[UINT32_MAX & 7] != 2 * 2048);
+    FAIL_IF(slots[0] != 3 * 2048);
+    FAIL_IF(slots[1] != 4 * 2048);
+    PASS;
+}
+
+/** \test releasing a packet gives its UMEM frame back */
+static int AFXDPReleaseTest01(void)
+{
+    AFXDPThreadVars ptv;
+    uint64_t slots[4];
+    uint32_t producer = 0;
+    memset(&ptv, 0, sizeof(ptv));
+    memset(slots, 0, sizeof(slots));
+
+    ptv.fill.size = 4;
+    ptv.fill.mask = 3;
+    ptv.fill.desc = slots;
+    ptv.fill.producer = &producer;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->afxdp_v.ptv = &ptv;
+    p->afxdp_v.addr = 3 * 4096;
+    p->ReleasePacket = AFXDPReleasePacket;
+    p->ReleasePacket(p);
+
+    FAIL_IF(ptv.fill.cached_prod != 1);
+    FAIL_IF(slots[0] != 3 * 4096);
+    /* published with the next batch */
+    FAIL_IF(producer != 0);
+    AFXDPFillRingFlush(&ptv);
+    FAIL_IF(producer != 1);
+    PASS;
+}
+
+/** \test only the last thread of an interface detaches the XDP filter */
+static int AFXDPIfaceUsersTest01(void)
+{
+    FAIL_IF(AFXDPIfaceRef("afxdp-test0") != 0);
+    FAIL_IF(AFXDPIfaceRef("afxdp-test0") != 0);
+    FAIL_IF(AFXDPIfaceRef("afxdp-test1") != 0);
+
+    FAIL_IF(AFXDPIfaceDeref("afxdp-test0") != 0);
+    FAIL_IF(AFXDPIfaceDeref("afxdp-test1") != 1);
+    FAIL_IF(AFXDPIfaceDeref("afxdp-test0") != 1);
+    /* unknown interface */
+    FAIL_IF(AFXDPIfaceDeref("afxdp-test0") != 0);
+    FAIL_IF_NOT_NULL(afxdp_iface_users);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void ReceiveAFXDPRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AFXDPRingSizeTest01", AFXDPRingSizeTest01);
+    UtRegisterTest("AFXDPFillRingTest01", AFXDPFillRingTest01);
+    UtRegisterTest("AFXDPReleaseTest01", AFXDPReleaseTest01);
+    UtRegisterTest("AFXDPIfaceUsersTest01", AFXDPIfaceUsersTest01);
+#endif /* UNITTESTS */
+}
+
+#endif /* HAVE_AF_XDP */
+/* eof */
+/**
+ * @}
+ */
@@ -0,0 +1,89 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP capture
+ */
+
+#ifndef __SOURCE_AFXDP_H__
+#define __SOURCE_AFXDP_H__
+
+/* value for flags */
+#define AFXDP_ZERO_COPY     (1<<0)
+#define AFXDP_XDPBYPASS     (1<<1)
+
+#define AFXDP_IFACE_NAME_LENGTH 48
+
+/* Default number of frames in each ring */
+#define AFXDP_RING_SIZE_DEFAULT 2048
+/* Default and only supported size of a UMEM frame */
+#define AFXDP_FRAME_SIZE_DEFAULT 2048
+
+typedef struct AFXDPIfaceConfig_
+{
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    /* number of threads */
+    int threads;
+    /* first NIC queue to bind to, thread N uses queue_start + N */
+    int queue_start;
+    /* ring size in number of frames */
+    int ring_size;
+    /* size of a UMEM frame */
+    int frame_size;
+    /* promisc mode */
+    int promisc;
+    /* misc use flags */
+    unsigned int flags;
+    ChecksumValidationMode checksum_mode;
+    const char *xdp_filter_file;
+    int xdp_filter_fd;
+    uint8_t xdp_mode;
+    /* used to give each thread its own queue */
+    SC_ATOMIC_DECLARE(unsigned int, queue_counter);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} AFXDPIfaceConfig;
+
+/**
+ * \brief per packet AF_XDP vars
+ *
+ * This structure is used by the release data system and is cleaned
+ * up by the AFXDPV_CLEANUP macro below.
+ */
+typedef struct AFXDPPacketVars_
+{
+    /** Pointer to the capture thread owning the UMEM frame */
+    void *ptv;
+    /** address of the frame in the UMEM */
+    uint64_t addr;
+    int v4_map_fd;
+    int v6_map_fd;
+} AFXDPPacketVars;
+
+#define AFXDPV_CLEANUP(afxdpv) do {       \
+    (afxdpv)->ptv = NULL;                 \
+    (afxdpv)->addr = 0;                   \
+    (afxdpv)->v4_map_fd = -1;             \
+    (afxdpv)->v6_map_fd = -1;             \
+} while(0)
+
+void TmModuleReceiveAFXDPRegister (void);
+void TmModuleDecodeAFXDPRegister (void);
+
+#endif /* __SOURCE_AFXDP_H__ */
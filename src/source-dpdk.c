@@ -0,0 +1,598 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ *  \defgroup dpdk DPDK running mode
+ *
+ *  @{
+ */
+
+/**
+ * \file
+ *
+ * DPDK acquisition support
+ *
+ * The port is configured by the runmode with one RX and one TX queue
+ * per thread and a symmetric RSS key so both sides of a flow reach the
+ * same queue. Each thread polls its RX queue and hands the mbufs to the
+ * engine without copy: the mbuf is freed, or sent on the TX queue of
+ * the same index of the peer port in tap and IPS mode, in the release
+ * function of the packet.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "decode.h"
+#include "packet-queue.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queuehandlers.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "util-dpdk.h"
+#include "tmqh-packetpool.h"
+#include "source-dpdk.h"
+#include "runmodes.h"
+
+#ifndef HAVE_DPDK
+
+TmEcode NoDPDKSupportExit(ThreadVars *, const void *, void **);
+
+void TmModuleReceiveDPDKRegister (void)
+{
+    tmm_modules[TMM_RECEIVEDPDK].name = "ReceiveDPDK";
+    tmm_modules[TMM_RECEIVEDPDK].ThreadInit = NoDPDKSupportExit;
+    tmm_modules[TMM_RECEIVEDPDK].Func = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEDPDK].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeDPDK.
+ */
+void TmModuleDecodeDPDKRegister (void)
+{
+    tmm_modules[TMM_DECODEDPDK].name = "DecodeDPDK";
+    tmm_modules[TMM_DECODEDPDK].ThreadInit = NoDPDKSupportExit;
+    tmm_modules[TMM_DECODEDPDK].Func = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEDPDK].cap_flags = 0;
+    tmm_modules[TMM_DECODEDPDK].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+TmEcode NoDPDKSupportExit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_DPDK,"Error creating thread %s: you do not have "
+               "support for DPDK enabled, please recompile "
+               "with --enable-dpdk", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+#else /* We have DPDK support */
+
+/** Maximum number of mbufs taken from the RX queue at once */
+#define DPDK_BURST_SIZE 32
+
+/** Inject a pseudo packet if nothing was received for this long (ms) */
+#define DPDK_IDLE_TIMEOUT 100
+
+/**
+ * \brief Structure to hold thread specific variables.
+ */
+typedef struct DPDKThreadVars_
+{
+    ThreadVars *tv;
+    TmSlot *slot;
+    LiveDevice *livedev;
+
+    char iface[DPDK_IFACE_NAME_LENGTH];
+    DPDKPort *port;
+    uint16_t port_id;
+    uint16_t queue_id;
+
+    unsigned int flags;
+    int copy_mode;
+    ChecksumValidationMode checksum_mode;
+
+    /* TX side, used in tap and IPS mode */
+    uint16_t out_port_id;
+    struct rte_eth_dev_tx_buffer *tx_buffer;
+    uint64_t tx_dropped;
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t last_dumped_pkts;
+    uint64_t last_imissed;
+
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+    uint16_t capture_errors;
+    uint16_t capture_rx_nombuf;
+    uint16_t capture_tx_dropped;
+    uint16_t capture_mempool_avail;
+    uint16_t capture_mempool_in_use;
+} DPDKThreadVars;
+
+static TmEcode ReceiveDPDKThreadInit(ThreadVars *, const void *, void **);
+static void ReceiveDPDKThreadExitStats(ThreadVars *, void *);
+static TmEcode ReceiveDPDKThreadDeinit(ThreadVars *, void *);
+static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot);
+
+static TmEcode DecodeDPDKThreadInit(ThreadVars *, const void *, void **);
+static TmEcode DecodeDPDKThreadDeinit(ThreadVars *tv, void *data);
+static TmEcode DecodeDPDK(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+
+/**
+ * \brief Registration Function for ReceiveDPDK.
+ */
+void TmModuleReceiveDPDKRegister (void)
+{
+    tmm_modules[TMM_RECEIVEDPDK].name = "ReceiveDPDK";
+    tmm_modules[TMM_RECEIVEDPDK].ThreadInit = ReceiveDPDKThreadInit;
+    tmm_modules[TMM_RECEIVEDPDK].Func = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].PktAcqLoop = ReceiveDPDKLoop;
+    tmm_modules[TMM_RECEIVEDPDK].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadExitPrintStats = ReceiveDPDKThreadExitStats;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadDeinit = ReceiveDPDKThreadDeinit;
+    tmm_modules[TMM_RECEIVEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].cap_flags = SC_CAP_NET_RAW | SC_CAP_NET_ADMIN;
+    tmm_modules[TMM_RECEIVEDPDK].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeDPDK.
+ */
+void TmModuleDecodeDPDKRegister (void)
+{
+    tmm_modules[TMM_DECODEDPDK].name = "DecodeDPDK";
+    tmm_modules[TMM_DECODEDPDK].ThreadInit = DecodeDPDKThreadInit;
+    tmm_modules[TMM_DECODEDPDK].Func = DecodeDPDK;
+    tmm_modules[TMM_DECODEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadDeinit = DecodeDPDKThreadDeinit;
+    tmm_modules[TMM_DECODEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEDPDK].cap_flags = 0;
+    tmm_modules[TMM_DECODEDPDK].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief Release function for packets in a mbuf
+ *
+ * In tap and IPS mode the mbuf is queued in the TX buffer of the thread,
+ * it is flushed once per RX burst by the capture loop. Capture loop and
+ * release of the packet are done by the same thread as only the workers
+ * runmode is supported.
+ */
+static void DPDKReleasePacket(Packet *p)
+{
+    DPDKThreadVars *ptv = (DPDKThreadVars *)p->dpdk_v.ptv;
+    struct rte_mbuf *m = p->dpdk_v.mbuf;
+
+    if (m != NULL) {
+        if (p->dpdk_v.copy_mode != DPDK_COPY_MODE_NONE && ptv != NULL &&
+                !(p->dpdk_v.copy_mode == DPDK_COPY_MODE_IPS &&
+                  PACKET_TEST_ACTION(p, ACTION_DROP))) {
+            /* on failure the buffer callback frees the mbuf */
+            rte_eth_tx_buffer(ptv->out_port_id, ptv->queue_id, ptv->tx_buffer, m);
+        } else {
+            rte_pktmbuf_free(m);
+        }
+    }
+    DPDKV_CLEANUP(&p->dpdk_v);
+    PacketFreeOrRelease(p);
+}
+
+static inline void DPDKDumpCounters(DPDKThreadVars *ptv)
+{
+    uint64_t pkts = ptv->pkts - ptv->last_dumped_pkts;
+    ptv->last_dumped_pkts = ptv->pkts;
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_packets, pkts);
+    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, pkts);
+    StatsSetUI64(ptv->tv, ptv->capture_tx_dropped, ptv->tx_dropped);
+
+    /* port and mempool are shared by the threads of the interface,
+     * only the thread on the first queue reports them */
+    if (ptv->queue_id != 0)
+        return;
+
+    struct rte_eth_stats stats;
+    if (rte_eth_stats_get(ptv->port_id, &stats) == 0) {
+        /* imissed: packets dropped by the NIC as the RX queue was full */
+        uint64_t drops = stats.imissed - ptv->last_imissed;
+        ptv->last_imissed = stats.imissed;
+        StatsAddUI64(ptv->tv, ptv->capture_kernel_drops, drops);
+        (void) SC_ATOMIC_ADD(ptv->livedev->drop, drops);
+        StatsSetUI64(ptv->tv, ptv->capture_rx_nombuf, stats.rx_nombuf);
+    }
+
+    StatsSetUI64(ptv->tv, ptv->capture_mempool_avail,
+                 rte_mempool_avail_count(ptv->port->pkt_mempool));
+    StatsSetUI64(ptv->tv, ptv->capture_mempool_in_use,
+                 rte_mempool_in_use_count(ptv->port->pkt_mempool));
+}
+
+static inline void DPDKSetChecksumFlags(DPDKThreadVars *ptv, Packet *p,
+                                        struct rte_mbuf *m)
+{
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_KERNEL) {
+        /* trust the NIC when it validated both checksums */
+        if ((m->ol_flags & RTE_MBUF_F_RX_IP_CKSUM_MASK) == RTE_MBUF_F_RX_IP_CKSUM_GOOD &&
+            (m->ol_flags & RTE_MBUF_F_RX_L4_CKSUM_MASK) == RTE_MBUF_F_RX_L4_CKSUM_GOOD) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ptv->livedev->ignore_checksum) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ChecksumAutoModeCheck(ptv->pkts,
+                    SC_ATOMIC_GET(ptv->livedev->pkts),
+                    SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            ptv->livedev->ignore_checksum = 1;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+}
+
+/**
+ * \brief Process a burst of mbufs from the RX queue
+ *
+ * \retval number of packets read or -1 in case of engine failure
+ */
+static int DPDKReadFromQueue(DPDKThreadVars *ptv)
+{
+    struct rte_mbuf *mbufs[DPDK_BURST_SIZE];
+    struct timeval ts;
+    uint16_t nb_rx;
+    uint16_t i;
+
+    nb_rx = rte_eth_rx_burst(ptv->port_id, ptv->queue_id, mbufs, DPDK_BURST_SIZE);
+    if (nb_rx == 0) {
+        return 0;
+    }
+
+    gettimeofday(&ts, NULL);
+
+    for (i = 0; i < nb_rx; i++) {
+        struct rte_mbuf *m = mbufs[i];
+
+        Packet *p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            /* drop the mbufs we can't process */
+            for ( ; i < nb_rx; i++) {
+                rte_pktmbuf_free(mbufs[i]);
+            }
+            return -1;
+        }
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+        p->livedev = ptv->livedev;
+        p->datalink = LINKTYPE_ETHERNET;
+        p->ts = ts;
+        ptv->pkts++;
+
+        /* scattered RX is not enabled so the packet is in one segment */
+        if (PacketSetData(p, rte_pktmbuf_mtod(m, uint8_t *),
+                          rte_pktmbuf_pkt_len(m)) == -1) {
+            rte_pktmbuf_free(m);
+            TmqhOutputPacketpool(ptv->tv, p);
+            StatsIncr(ptv->tv, ptv->capture_errors);
+            continue;
+        }
+        p->dpdk_v.mbuf = m;
+        p->dpdk_v.ptv = ptv;
+        p->dpdk_v.copy_mode = ptv->copy_mode;
+        p->ReleasePacket = DPDKReleasePacket;
+
+        DPDKSetChecksumFlags(ptv, p, m);
+
+        if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            for (i++ ; i < nb_rx; i++) {
+                rte_pktmbuf_free(mbufs[i]);
+            }
+            return -1;
+        }
+    }
+
+    return (int)nb_rx;
+}
+
+/**
+ * \brief Main DPDK reading Loop function
+ *
+ * The RX queue is busy polled, a pseudo packet is injected when the
+ * queue stayed empty for DPDK_IDLE_TIMEOUT so the flow timeouts are
+ * still handled on an idle link.
+ */
+static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    DPDKThreadVars *ptv = (DPDKThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+    const uint64_t idle_cycles = rte_get_timer_hz() * DPDK_IDLE_TIMEOUT / 1000;
+    uint64_t last_rx = rte_get_timer_cycles();
+    time_t last_dump = 0;
+    time_t current_time;
+    int r;
+
+    ptv->slot = s->slot_next;
+
+    while (1) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool, to prevent
+         * us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        r = DPDKReadFromQueue(ptv);
+        if (ptv->tx_buffer != NULL) {
+            rte_eth_tx_buffer_flush(ptv->out_port_id, ptv->queue_id, ptv->tx_buffer);
+        }
+        if (unlikely(r < 0)) {
+            StatsIncr(ptv->tv, ptv->capture_errors);
+        } else if (r == 0) {
+            uint64_t now = rte_get_timer_cycles();
+            if (now - last_rx > idle_cycles) {
+                /* lets see if we need to inject a fake packet  */
+                TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+                last_rx = now;
+            }
+            rte_pause();
+        } else {
+            last_rx = rte_get_timer_cycles();
+        }
+
+        /* Trigger one dump of stats every second */
+        current_time = time(NULL);
+        if (current_time != last_dump) {
+            DPDKDumpCounters(ptv);
+            last_dump = current_time;
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    DPDKDumpCounters(ptv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Init function for ReceiveDPDK.
+ *
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with DPDKThreadVars
+ */
+static TmEcode ReceiveDPDKThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    DPDKIfaceConfig *dconf = (DPDKIfaceConfig *)initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    DPDKThreadVars *ptv = SCCalloc(1, sizeof(DPDKThreadVars));
+    if (unlikely(ptv == NULL)) {
+        dconf->DerefFunc(dconf);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    ptv->tv = tv;
+    strlcpy(ptv->iface, dconf->iface, sizeof(ptv->iface));
+
+    ptv->livedev = LiveGetDevice(ptv->iface);
+    if (ptv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error;
+    }
+
+#if RTE_VERSION >= RTE_VERSION_NUM(20, 11, 0, 0)
+    /* gives the thread a lcore id so it uses the mempool cache */
+    if (rte_thread_register() < 0) {
+        SCLogWarning(SC_ERR_DPDK_CREATE, "%s: unable to register thread to "
+                     "DPDK, mempool cache won't be used: %s", tv->name,
+                     rte_strerror(rte_errno));
+    }
+#endif
+
+    ptv->port = dconf->port;
+    ptv->port_id = dconf->port->port_id;
+    ptv->flags = dconf->flags;
+    ptv->copy_mode = dconf->copy_mode;
+    ptv->checksum_mode = dconf->checksum_mode;
+    ptv->queue_id = (uint16_t)(SC_ATOMIC_ADD(dconf->queue_counter, 1) - 1);
+
+    if (ptv->copy_mode != DPDK_COPY_MODE_NONE) {
+        struct rte_eth_dev_info dev_info;
+
+        if (rte_eth_dev_get_port_by_name(dconf->out_iface, &ptv->out_port_id) != 0) {
+            SCLogError(SC_ERR_DPDK_CREATE, "%s: unable to find copy-iface %s",
+                       ptv->iface, dconf->out_iface);
+            goto error;
+        }
+        /* the peer port is configured by its own interface entry */
+        if (rte_eth_dev_info_get(ptv->out_port_id, &dev_info) != 0 ||
+                dev_info.nb_tx_queues <= ptv->queue_id) {
+            SCLogError(SC_ERR_DPDK_CREATE, "%s: copy-iface %s has no TX queue %u, "
+                       "it must be configured with at least as many threads",
+                       ptv->iface, dconf->out_iface, ptv->queue_id);
+            goto error;
+        }
+
+        ptv->tx_buffer = rte_zmalloc_socket("sc_tx_buffer",
+                RTE_ETH_TX_BUFFER_SIZE(DPDK_BURST_SIZE), 0,
+                rte_eth_dev_socket_id(ptv->out_port_id));
+        if (ptv->tx_buffer == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "%s: unable to allocate TX buffer",
+                       ptv->iface);
+            goto error;
+        }
+        rte_eth_tx_buffer_init(ptv->tx_buffer, DPDK_BURST_SIZE);
+        rte_eth_tx_buffer_set_err_callback(ptv->tx_buffer,
+                rte_eth_tx_buffer_count_callback, &ptv->tx_dropped);
+    }
+
+    ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            ptv->tv);
+    ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            ptv->tv);
+    ptv->capture_errors = StatsRegisterCounter("capture.errors",
+            ptv->tv);
+    ptv->capture_rx_nombuf = StatsRegisterCounter("capture.dpdk.rx_nombuf",
+            ptv->tv);
+    ptv->capture_tx_dropped = StatsRegisterCounter("capture.dpdk.tx_dropped",
+            ptv->tv);
+    ptv->capture_mempool_avail = StatsRegisterCounter("capture.dpdk.mempool_avail",
+            ptv->tv);
+    ptv->capture_mempool_in_use = StatsRegisterCounter("capture.dpdk.mempool_in_use",
+            ptv->tv);
+
+    SCLogConfig("%s: thread %s polling port %u queue %u", ptv->iface,
+                tv->name, ptv->port_id, ptv->queue_id);
+
+    /* port reference is now owned by the thread */
+    dconf->DerefFunc(dconf);
+    *data = (void *)ptv;
+    SCReturnInt(TM_ECODE_OK);
+
+error:
+    if (ptv->tx_buffer != NULL)
+        rte_free(ptv->tx_buffer);
+    dconf->DerefFunc(dconf);
+    SCFree(ptv);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into DPDKThreadVars for ptv
+ */
+static void ReceiveDPDKThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    DPDKThreadVars *ptv = (DPDKThreadVars *)data;
+
+    DPDKDumpCounters(ptv);
+    SCLogPerf("(%s) NIC: Packets %" PRIu64 ", dropped %" PRIu64 ", TX dropped %"
+            PRIu64 "", tv->name,
+            StatsGetLocalCounterValue(tv, ptv->capture_kernel_packets),
+            StatsGetLocalCounterValue(tv, ptv->capture_kernel_drops),
+            ptv->tx_dropped);
+}
+
+/**
+ * \brief DeInit function stops the port when the last thread leaves.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into DPDKThreadVars for ptv
+ */
+static TmEcode ReceiveDPDKThreadDeinit(ThreadVars *tv, void *data)
+{
+    DPDKThreadVars *ptv = (DPDKThreadVars *)data;
+
+    if (ptv->tx_buffer != NULL) {
+        rte_eth_tx_buffer_flush(ptv->out_port_id, ptv->queue_id, ptv->tx_buffer);
+        rte_free(ptv->tx_buffer);
+    }
+
+    if (SC_ATOMIC_SUB(ptv->port->ref, 1) == 0) {
+        SCLogDebug("%s: stopping port %u", ptv->iface, ptv->port_id);
+        (void)rte_eth_dev_stop(ptv->port_id);
+        (void)rte_eth_dev_close(ptv->port_id);
+        rte_mempool_free(ptv->port->pkt_mempool);
+        SCFree(ptv->port);
+    }
+
+    SCFree(ptv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars
+ * \param pq pointer to the current PacketQueue
+ */
+static TmEcode DecodeDPDK(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static TmEcode DecodeDPDKThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(tv);
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static TmEcode DecodeDPDKThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+#endif /* HAVE_DPDK */
+/* eof */
+/**
+ * @}
+ */
@@ -0,0 +1,104 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DPDK capture
+ */
+
+#ifndef __SOURCE_DPDK_H__
+#define __SOURCE_DPDK_H__
+
+/* value for flags */
+#define DPDK_PROMISC        (1<<0)
+#define DPDK_RSS_SYMMETRIC  (1<<1)
+
+#define DPDK_COPY_MODE_NONE 0
+#define DPDK_COPY_MODE_TAP  1
+#define DPDK_COPY_MODE_IPS  2
+
+#define DPDK_IFACE_NAME_LENGTH 48
+
+/* Default number of descriptors in each RX and TX queue */
+#define DPDK_RX_DESC_DEFAULT 1024
+#define DPDK_TX_DESC_DEFAULT 1024
+/* Default number of mbufs in the mempool of a port */
+#define DPDK_MEMPOOL_SIZE_DEFAULT 65535
+#define DPDK_MEMPOOL_CACHE_SIZE_DEFAULT 256
+
+struct rte_mbuf;
+struct rte_mempool;
+
+/**
+ * \brief DPDK port state shared by all the threads of an interface
+ *
+ * The port is stopped and closed by the last thread leaving.
+ */
+typedef struct DPDKPort_
+{
+    uint16_t port_id;
+    struct rte_mempool *pkt_mempool;
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+} DPDKPort;
+
+typedef struct DPDKIfaceConfig_
+{
+    char iface[DPDK_IFACE_NAME_LENGTH];
+    DPDKPort *port;
+    /* number of threads, each one has its own RX and TX queue */
+    int threads;
+    uint16_t nb_rx_desc;
+    uint16_t nb_tx_desc;
+    uint32_t mempool_size;
+    uint32_t mempool_cache_size;
+    /* misc use flags */
+    unsigned int flags;
+    int copy_mode;
+    const char *out_iface;
+    ChecksumValidationMode checksum_mode;
+    /* used to give each thread its own queue */
+    SC_ATOMIC_DECLARE(unsigned int, queue_counter);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} DPDKIfaceConfig;
+
+/**
+ * \brief per packet DPDK vars
+ *
+ * This structure is used by the release data system and is cleaned
+ * up by the DPDKV_CLEANUP macro below.
+ */
+typedef struct DPDKPacketVars_
+{
+    /** mbuf holding the packet data */
+    struct rte_mbuf *mbuf;
+    /** Pointer to the capture thread, used to send the packet */
+    void *ptv;
+    int copy_mode;
+} DPDKPacketVars;
+
+#define DPDKV_CLEANUP(dpdkv) do {         \
+    (dpdkv)->mbuf = NULL;                 \
+    (dpdkv)->ptv = NULL;                  \
+    (dpdkv)->copy_mode = 0;               \
+} while(0)
+
+void TmModuleReceiveDPDKRegister (void);
+void TmModuleDecodeDPDKRegister (void);
+
+#endif /* __SOURCE_DPDK_H__ */
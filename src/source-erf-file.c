@@ -29,8 +29,20 @@
 #include "suricata.h"
 #include "tm-threads.h"
 #include "source-erf-file.h"
+#include "util-misc.h"
 
 #define DAG_TYPE_ETH 2
+#define DAG_TYPE_PAD 48
+/** type bit: extension headers follow the record header */
+#define DAG_TYPE_EXT_HDR 0x80
+#define DAG_EXT_HDR_LEN 8
+/** offset and pad bytes in front of an ethernet frame */
+#define DAG_ETH_PAD_LEN 2
+
+/** records read per packet pool check */
+#define ERF_FILE_BATCH 64
+/** bytes of a mapped file the kernel is asked to read ahead */
+#define ERF_FILE_PREFETCH (8 * 1024 * 1024)
 
 typedef struct DagFlags_ {
     uint8_t iface:2;
@@ -49,20 +61,44 @@ typedef struct DagRecord_ {
     uint16_t rlen;
     uint16_t lctr;
     uint16_t wlen;
-    uint16_t pad;
 } __attribute__((packed)) DagRecord;
 
+/** an ERF file, the records of a DAG stream */
+typedef struct ErfFileInput_ {
+    char *filename;
+    /** read with fread if the file could not be mapped */
+    FILE *erf;
+    uint8_t *buf;
+
+    uint8_t *map;
+    size_t map_len;
+    size_t map_offset;
+    /** end of the part of the map already prefetched */
+    size_t map_prefetched;
+    /** packets still pointing into the map */
+    SC_ATOMIC_DECLARE(uint64_t, map_refs);
+
+    /** next record of the file, NULL once the file is done */
+    uint8_t *rec;
+    uint64_t rec_ts;
+
+    uint32_t pkts;
+    uint64_t bytes;
+} ErfFileInput;
+
 typedef struct ErfFileThreadVars_ {
     ThreadVars *tv;
     TmSlot *slot;
 
-    FILE *erf;
+    ErfFileInput *inputs;
+    int inputs_cnt;
+    bool use_mmap;
 
     uint32_t pkts;
     uint64_t bytes;
+    uint32_t skipped;
 } ErfFileThreadVars;
 
-static inline TmEcode ReadErfRecord(ThreadVars *, Packet *, void *);
 TmEcode ReceiveErfFileLoop(ThreadVars *, void *, void *);
 TmEcode ReceiveErfFileThreadInit(ThreadVars *, const void *, void **);
 void ReceiveErfFileThreadExitStats(ThreadVars *, void *);
@@ -85,7 +121,7 @@ TmModuleReceiveErfFileRegister(void)
     tmm_modules[TMM_RECEIVEERFFILE].PktAcqBreakLoop = NULL;
     tmm_modules[TMM_RECEIVEERFFILE].ThreadExitPrintStats =
         ReceiveErfFileThreadExitStats;
-    tmm_modules[TMM_RECEIVEERFFILE].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEERFFILE].ThreadDeinit = ReceiveErfFileThreadDeinit;
     tmm_modules[TMM_RECEIVEERFFILE].RegisterTests = NULL;
     tmm_modules[TMM_RECEIVEERFFILE].cap_flags = 0;
     tmm_modules[TMM_RECEIVEERFFILE].flags = TM_FLAG_RECEIVE_TM;
@@ -108,84 +144,173 @@ TmModuleDecodeErfFileRegister(void)
 }
 
 /**
- * \brief ERF file reading loop.
+ * \brief Load the next record of an input
+ *
+ * A mapped record is left in place, else it is read into the buffer
+ * of the input.
+ *
+ * \retval 1 record loaded
+ * \retval 0 end of file
+ * \retval -1 truncated or corrupt record
  */
-TmEcode ReceiveErfFileLoop(ThreadVars *tv, void *data, void *slot)
+static int ErfFileInputNext(ErfFileInput *in)
 {
-    Packet *p = NULL;
-    ErfFileThreadVars *etv = (ErfFileThreadVars *)data;
-
-    etv->slot = ((TmSlot *)slot)->slot_next;
-
-    while (1) {
-        if (suricata_ctl_flags & SURICATA_STOP) {
-            SCReturnInt(TM_ECODE_OK);
-        }
-
-        /* Make sure we have at least one packet in the packet pool,
-         * to prevent us from alloc'ing packets at line rate. */
-        PacketPoolWait();
+    DagRecord dr;
 
-        p = PacketGetFromQueueOrAlloc();
-        if (unlikely(p == NULL)) {
-            SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate a packet.");
-            EngineStop();
-            SCReturnInt(TM_ECODE_FAILED);
-        }
-        PKT_SET_SRC(p, PKT_SRC_WIRE);
+    in->rec = NULL;
+
+    if (in->map != NULL) {
+        if (in->map_offset == in->map_len)
+            return 0;
+        if (in->map_len - in->map_offset < sizeof(dr))
+            goto truncated;
+        memcpy(&dr, in->map + in->map_offset, sizeof(dr));
+    } else {
+        size_t r = fread(&dr, 1, sizeof(dr), in->erf);
+        if (r == 0 && feof(in->erf))
+            return 0;
+        if (r < sizeof(dr))
+            goto truncated;
+    }
 
-        if (ReadErfRecord(tv, p, data) != TM_ECODE_OK) {
-            TmqhOutputPacketpool(etv->tv, p);
-            EngineStop();
-            SCReturnInt(TM_ECODE_FAILED);
+    size_t rlen = SCNtohs(dr.rlen);
+    if (rlen < sizeof(dr))
+        goto corrupt;
+
+    if (in->map != NULL) {
+        if (in->map_len - in->map_offset < rlen)
+            goto truncated;
+        in->rec = in->map + in->map_offset;
+        in->map_offset += rlen;
+
+#ifdef HAVE_SYS_MMAN_H
+        /* keep the kernel reading ahead of us */
+        if (in->map_prefetched < in->map_len &&
+                in->map_offset + ERF_FILE_PREFETCH / 2 > in->map_prefetched) {
+            size_t len = MIN(ERF_FILE_PREFETCH, in->map_len - in->map_prefetched);
+            (void)madvise(in->map + in->map_prefetched, len, MADV_WILLNEED);
+            in->map_prefetched += len;
         }
+#endif
+        /* the header of the next record is needed when this one is sent */
+        __builtin_prefetch(in->map + in->map_offset);
+    } else {
+        memcpy(in->buf, &dr, sizeof(dr));
+        if (fread(in->buf + sizeof(dr), rlen - sizeof(dr), 1, in->erf) < 1 &&
+                rlen > sizeof(dr))
+            goto truncated;
+        in->map_offset += rlen;
+        in->rec = in->buf;
+    }
+    in->rec_ts = dr.ts;
+    return 1;
+
+truncated:
+    SCLogWarning(SC_ERR_UNIMPLEMENTED, "truncated ERF record at offset %"PRIuMAX
+                 " in %s", (uintmax_t)in->map_offset, in->filename);
+    return -1;
+corrupt:
+    SCLogWarning(SC_ERR_UNIMPLEMENTED, "invalid ERF record length at offset %"PRIuMAX
+                 " in %s", (uintmax_t)in->map_offset, in->filename);
+    return -1;
+}
 
-        if (TmThreadsSlotProcessPkt(etv->tv, etv->slot, p) != TM_ECODE_OK) {
-            EngineStop();
-            SCReturnInt(TM_ECODE_FAILED);
-        }
+/**
+ * \brief Get the input with the oldest pending record
+ *
+ * The streams of a capture are written to files of their own; merging
+ * them by timestamp gives the flows their packets of both directions in
+ * order.
+ */
+static ErfFileInput *ErfFileNextInput(ErfFileThreadVars *etv)
+{
+    ErfFileInput *next = NULL;
+    for (int i = 0; i < etv->inputs_cnt; i++) {
+        ErfFileInput *in = &etv->inputs[i];
+        if (in->rec != NULL && (next == NULL || in->rec_ts < next->rec_ts))
+            next = in;
     }
-    SCReturnInt(TM_ECODE_FAILED);
+    return next;
 }
 
-static inline TmEcode ReadErfRecord(ThreadVars *tv, Packet *p, void *data)
+static void ErfFileReleasePacket(Packet *p)
 {
-    SCEnter();
+    ErfFileInput *in = (ErfFileInput *)p->erf_v.input;
 
-    ErfFileThreadVars *etv = (ErfFileThreadVars *)data;
+    p->erf_v.input = NULL;
+    PacketFreeOrRelease(p);
+    (void) SC_ATOMIC_SUB(in->map_refs, 1);
+}
+
+/**
+ * \brief Send the pending record of an input down the pipeline
+ *
+ * \retval TM_ECODE_OK record sent or skipped
+ * \retval TM_ECODE_FAILED unsupported record or processing failure
+ */
+static TmEcode ErfFileProcessRecord(ErfFileThreadVars *etv, ErfFileInput *in)
+{
     DagRecord dr;
+    memcpy(&dr, in->rec, sizeof(dr));
+
+    size_t rlen = SCNtohs(dr.rlen);
+    size_t hlen = sizeof(dr);
+
+    /* extension headers, chained by their top bit */
+    if (dr.type & DAG_TYPE_EXT_HDR) {
+        do {
+            if (rlen < hlen + DAG_EXT_HDR_LEN) {
+                SCLogError(SC_ERR_UNIMPLEMENTED, "ERF extension headers "
+                           "past the end of the record in %s", in->filename);
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            hlen += DAG_EXT_HDR_LEN;
+        } while (in->rec[hlen - DAG_EXT_HDR_LEN] & 0x80);
+    }
 
-    int r = fread(&dr, sizeof(DagRecord), 1, etv->erf);
-    if (r < 1) {
-        if (feof(etv->erf)) {
-            SCLogInfo("End of ERF file reached");
-        }
-        else {
-            SCLogInfo("Error reading ERF record");
-        }
-        SCReturnInt(TM_ECODE_FAILED);
+    switch (dr.type & ~DAG_TYPE_EXT_HDR) {
+        case DAG_TYPE_ETH:
+            break;
+        case DAG_TYPE_PAD:
+            /* fills the gaps of the streams, no packet */
+            etv->skipped++;
+            SCReturnInt(TM_ECODE_OK);
+        default:
+            /* Only support ethernet at this time. */
+            SCLogError(SC_ERR_UNIMPLEMENTED,
+                "DAG record type %d not implemented.", dr.type & ~DAG_TYPE_EXT_HDR);
+            SCReturnInt(TM_ECODE_FAILED);
     }
-    int rlen = SCNtohs(dr.rlen);
-    int wlen = SCNtohs(dr.wlen);
-    r = fread(GET_PKT_DATA(p), rlen - sizeof(DagRecord), 1, etv->erf);
-    if (r < 1) {
-        if (feof(etv->erf)) {
-            SCLogInfo("End of ERF file reached");
-        }
-        else {
-            SCLogInfo("Error reading ERF record");
-        }
+
+    hlen += DAG_ETH_PAD_LEN;
+    if (rlen < hlen) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "ERF record too short in %s", in->filename);
         SCReturnInt(TM_ECODE_FAILED);
     }
+    /* the record is padded to 8 bytes, wlen is the real length */
+    uint32_t len = (uint32_t)MIN(rlen - hlen, SCNtohs(dr.wlen));
 
-    /* Only support ethernet at this time. */
-    if (dr.type != DAG_TYPE_ETH) {
-        SCLogError(SC_ERR_UNIMPLEMENTED,
-            "DAG record type %d not implemented.", dr.type);
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (unlikely(p == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate a packet.");
         SCReturnInt(TM_ECODE_FAILED);
     }
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
 
-    GET_PKT_LEN(p) = wlen;
+    if (in->map != NULL) {
+        if (unlikely(PacketSetData(p, in->rec + hlen, len))) {
+            TmqhOutputPacketpool(etv->tv, p);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        p->erf_v.input = in;
+        p->ReleasePacket = ErfFileReleasePacket;
+        (void) SC_ATOMIC_ADD(in->map_refs, 1);
+    } else {
+        if (unlikely(PacketCopyData(p, in->rec + hlen, len))) {
+            TmqhOutputPacketpool(etv->tv, p);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+    }
     p->datalink = LINKTYPE_ETHERNET;
 
     /* Convert ERF time to timeval - from libpcap. */
@@ -199,14 +324,151 @@ static inline TmEcode ReadErfRecord(ThreadVars *tv, Packet *p, void *data)
         p->ts.tv_sec++;
     }
 
+    in->pkts++;
+    in->bytes += len;
     etv->pkts++;
-    etv->bytes += wlen;
+    etv->bytes += len;
 
+    if (TmThreadsSlotProcessPkt(etv->tv, etv->slot, p) != TM_ECODE_OK) {
+        SCReturnInt(TM_ECODE_FAILED);
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief Wait for the workers to release the packets of a map, unmap it
+ */
+static void ErfFileInputClose(ErfFileInput *in)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (in->map != NULL) {
+        while (SC_ATOMIC_GET(in->map_refs) > 0) {
+            usleep(1000);
+        }
+        munmap(in->map, in->map_len);
+        in->map = NULL;
+    }
+#endif
+    if (in->erf != NULL) {
+        fclose(in->erf);
+        in->erf = NULL;
+    }
+    in->rec = NULL;
+}
+
+/**
+ * \brief ERF file reading loop.
+ */
+TmEcode ReceiveErfFileLoop(ThreadVars *tv, void *data, void *slot)
+{
+    ErfFileThreadVars *etv = (ErfFileThreadVars *)data;
+    TmEcode ret = TM_ECODE_FAILED;
+
+    etv->slot = ((TmSlot *)slot)->slot_next;
+
+    for (int i = 0; i < etv->inputs_cnt; i++) {
+        if (ErfFileInputNext(&etv->inputs[i]) < 0)
+            goto done;
+    }
+
+    while (1) {
+        if (suricata_ctl_flags & SURICATA_STOP) {
+            ret = TM_ECODE_OK;
+            goto done;
+        }
+
+        /* Make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate. */
+        PacketPoolWait();
+
+        for (int i = 0; i < ERF_FILE_BATCH; i++) {
+            ErfFileInput *in = ErfFileNextInput(etv);
+            if (in == NULL) {
+                SCLogInfo("End of ERF file reached");
+                ret = TM_ECODE_DONE;
+                goto done;
+            }
+            if (ErfFileProcessRecord(etv, in) != TM_ECODE_OK)
+                goto done;
+            if (ErfFileInputNext(in) < 0)
+                goto done;
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+done:
+    for (int i = 0; i < etv->inputs_cnt; i++) {
+        ErfFileInputClose(&etv->inputs[i]);
+    }
+    EngineStop();
+    SCReturnInt(ret);
+}
+
+/**
+ * \brief Open an ERF file, map it if possible
+ */
+static int ErfFileInputOpen(ErfFileInput *in, bool use_mmap)
+{
+    SC_ATOMIC_INIT(in->map_refs);
+
+    FILE *erf = fopen(in->filename, "r");
+    if (erf == NULL) {
+        SCLogError(SC_ERR_FOPEN, "Failed to open %s: %s", in->filename,
+            strerror(errno));
+        return -1;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    if (use_mmap && fstat(fileno(erf), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+        /* private writable map: decoders never write to the file */
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+                         MAP_PRIVATE, fileno(erf), 0);
+        if (map != MAP_FAILED) {
+            (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            fclose(erf);
+            in->map = map;
+            in->map_len = (size_t)st.st_size;
+            SCLogDebug("%s mapped, %"PRIuMAX" bytes", in->filename,
+                       (uintmax_t)in->map_len);
+            return 0;
+        }
+        SCLogWarning(SC_ERR_FOPEN, "mmap of %s failed: %s, reading it "
+                     "instead", in->filename, strerror(errno));
+    }
+#endif
+
+    /* a record is at most 64k */
+    in->buf = SCMalloc(UINT16_MAX);
+    if (unlikely(in->buf == NULL)) {
+        fclose(erf);
+        return -1;
+    }
+    in->erf = erf;
+    return 0;
+}
+
+static void ErfFileFreeInputs(ErfFileThreadVars *etv)
+{
+    for (int i = 0; i < etv->inputs_cnt; i++) {
+        ErfFileInputClose(&etv->inputs[i]);
+        if (etv->inputs[i].buf != NULL)
+            SCFree(etv->inputs[i].buf);
+        if (etv->inputs[i].filename != NULL)
+            SCFree(etv->inputs[i].filename);
+    }
+    if (etv->inputs != NULL)
+        SCFree(etv->inputs);
+    etv->inputs = NULL;
+    etv->inputs_cnt = 0;
+}
+
 /**
  * \brief Initialize the ERF receiver thread.
+ *
+ * initdata is a file, or a comma separated list of the files of the
+ * streams of a capture, which are read together in timestamp order.
  */
 TmEcode
 ReceiveErfFileThreadInit(ThreadVars *tv, const void *initdata, void **data)
@@ -218,26 +480,76 @@ ReceiveErfFileThreadInit(ThreadVars *tv, const void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    FILE *erf = fopen((const char *)initdata, "r");
-    if (erf == NULL) {
-        SCLogError(SC_ERR_FOPEN, "Failed to open %s: %s", (char *)initdata,
-            strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-
     ErfFileThreadVars *etv = SCMalloc(sizeof(ErfFileThreadVars));
     if (unlikely(etv == NULL)) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate memory for ERF file thread vars.");
-        fclose(erf);
         SCReturnInt(TM_ECODE_FAILED);
     }
     memset(etv, 0, sizeof(*etv));
-    etv->erf = erf;
     etv->tv = tv;
+
+    int use_mmap = 1;
+    if (ConfGetBool("erf-file.mmap", &use_mmap) == 0)
+        use_mmap = 1;
+    etv->use_mmap = use_mmap == 1;
+
+    char *files = SCStrdup((const char *)initdata);
+    if (unlikely(files == NULL)) {
+        SCFree(etv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    int cnt = 1;
+    for (const char *c = files; *c != '\0'; c++) {
+        if (*c == ',')
+            cnt++;
+    }
+    etv->inputs = SCCalloc(cnt, sizeof(ErfFileInput));
+    if (unlikely(etv->inputs == NULL)) {
+        SCFree(files);
+        SCFree(etv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    char *saveptr = NULL;
+    for (char *f = strtok_r(files, ",", &saveptr); f != NULL;
+            f = strtok_r(NULL, ",", &saveptr)) {
+        ErfFileInput *in = &etv->inputs[etv->inputs_cnt];
+        in->filename = SCStrdup(f);
+        if (unlikely(in->filename == NULL)) {
+            goto error;
+        }
+        etv->inputs_cnt++;
+        if (ErfFileInputOpen(in, etv->use_mmap) != 0) {
+            goto error;
+        }
+        SCLogInfo("Processing ERF file %s", in->filename);
+    }
+    SCFree(files);
+
+    if (etv->inputs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Error: No filename provided.");
+        ErfFileFreeInputs(etv);
+        SCFree(etv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
     *data = (void *)etv;
+    SCReturnInt(TM_ECODE_OK);
 
-    SCLogInfo("Processing ERF file %s", (char *)initdata);
+error:
+    SCFree(files);
+    ErfFileFreeInputs(etv);
+    SCFree(etv);
+    exit(EXIT_FAILURE);
+}
 
+TmEcode ReceiveErfFileThreadDeinit(ThreadVars *tv, void *data)
+{
+    ErfFileThreadVars *etv = (ErfFileThreadVars *)data;
+    if (etv != NULL) {
+        ErfFileFreeInputs(etv);
+        SCFree(etv);
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -307,4 +619,14 @@ ReceiveErfFileThreadExitStats(ThreadVars *tv, void *data)
     ErfFileThreadVars *etv = (ErfFileThreadVars *)data;
 
     SCLogInfo("Packets: %"PRIu32"; Bytes: %"PRIu64, etv->pkts, etv->bytes);
+    if (etv->inputs_cnt > 1) {
+        for (int i = 0; i < etv->inputs_cnt; i++) {
+            SCLogInfo("%s: Packets: %"PRIu32"; Bytes: %"PRIu64,
+                      etv->inputs[i].filename, etv->inputs[i].pkts,
+                      etv->inputs[i].bytes);
+        }
+    }
+    if (etv->skipped > 0) {
+        SCLogInfo("Padding records skipped: %"PRIu32, etv->skipped);
+    }
 }
@@ -24,6 +24,12 @@
 #ifndef __SOURCE_ERF_H__
 #define __SOURCE_ERF_H__
 
+typedef struct ErfFilePacketVars_
+{
+    /** input the packet data is mapped from, NULL if copied */
+    void *input;
+} ErfFilePacketVars;
+
 void TmModuleReceiveErfFileRegister(void);
 void TmModuleDecodeErfFileRegister(void);
 
@@ -88,6 +88,11 @@ typedef struct NapatechThreadVars_ {
     uint16_t stream_id;
     int hba;
     TmSlot *slot;
+    /* adapter of the flow stream, -1 without hardware bypass */
+    int flow_adapter;
+#ifdef NAPATECH_ENABLE_BYPASS
+    NtFlowStream_t flow_stream;
+#endif
 } NapatechThreadVars;
 
 
@@ -115,6 +120,13 @@ SC_ATOMIC_DECLARE(uint16_t, numa1_count);
 SC_ATOMIC_DECLARE(uint16_t, numa2_count);
 SC_ATOMIC_DECLARE(uint16_t, numa3_count);
 
+#ifdef NAPATECH_ENABLE_BYPASS
+/* totals of the flow info records of the unlearned flows */
+SC_ATOMIC_DECLARE(uint64_t, bypass_closed);
+SC_ATOMIC_DECLARE(uint64_t, bypass_pkts);
+SC_ATOMIC_DECLARE(uint64_t, bypass_bytes);
+#endif
+
 /**
  * \brief Register the Napatech  receiver (reader) module.
  */
@@ -140,6 +152,12 @@ void TmModuleNapatechStreamRegister(void)
     SC_ATOMIC_INIT(numa1_count);
     SC_ATOMIC_INIT(numa2_count);
     SC_ATOMIC_INIT(numa3_count);
+
+#ifdef NAPATECH_ENABLE_BYPASS
+    SC_ATOMIC_INIT(bypass_closed);
+    SC_ATOMIC_INIT(bypass_pkts);
+    SC_ATOMIC_INIT(bypass_bytes);
+#endif
 }
 
 /**
@@ -190,6 +208,7 @@ TmEcode NapatechStreamThreadInit(ThreadVars *tv, const void *initdata, void **da
     ntv->stream_id = stream_id;
     ntv->tv = tv;
     ntv->hba = conf->hba;
+    ntv->flow_adapter = conf->flow_adapter;
     SCLogDebug("Started processing packets from NAPATECH  Stream: %lu", ntv->stream_id);
 
     *data = (void *) ntv;
@@ -204,6 +223,130 @@ static void NapatechReleasePacket(struct Packet_ *p)
     PacketEnqueue(&packets_to_release[p->ntpv.stream_id], p);
 }
 
+#ifdef NAPATECH_ENABLE_BYPASS
+/**
+ * \brief learn the flow of the packet in the adapter, as to be dropped
+ *
+ * The key is built like the sorted key definitions of the bypass
+ * filters: the lowest address first, each with its port.
+ *
+ * \retval 1 if the flow is bypassed by the adapter, 0 otherwise
+ */
+static int NapatechBypassCallback(Packet *p)
+{
+    NtFlow_t flow_match;
+
+    if (p->ntpv.flow_stream == NULL || !(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    memset(&flow_match, 0, sizeof(flow_match));
+
+    if (PKT_IS_IPV4(p)) {
+        struct {
+            uint32_t sa;
+            uint32_t da;
+            uint16_t sp;
+            uint16_t dp;
+        } __attribute__((__packed__)) key;
+
+        if (SCNtohl(GET_IPV4_SRC_ADDR_U32(p)) <= SCNtohl(GET_IPV4_DST_ADDR_U32(p))) {
+            key.sa = GET_IPV4_SRC_ADDR_U32(p);
+            key.da = GET_IPV4_DST_ADDR_U32(p);
+            key.sp = htons(p->sp);
+            key.dp = htons(p->dp);
+        } else {
+            key.sa = GET_IPV4_DST_ADDR_U32(p);
+            key.da = GET_IPV4_SRC_ADDR_U32(p);
+            key.sp = htons(p->dp);
+            key.dp = htons(p->sp);
+        }
+        memcpy(flow_match.keyData, &key, sizeof(key));
+        flow_match.keyId = NAPATECH_KEYTYPE_IPV4;
+    } else if (PKT_IS_IPV6(p)) {
+        struct {
+            uint8_t sa[16];
+            uint8_t da[16];
+            uint16_t sp;
+            uint16_t dp;
+        } __attribute__((__packed__)) key;
+
+        /* network order, so memcmp compares the addresses */
+        if (memcmp(GET_IPV6_SRC_ADDR(p), GET_IPV6_DST_ADDR(p), 16) <= 0) {
+            memcpy(key.sa, GET_IPV6_SRC_ADDR(p), 16);
+            memcpy(key.da, GET_IPV6_DST_ADDR(p), 16);
+            key.sp = htons(p->sp);
+            key.dp = htons(p->dp);
+        } else {
+            memcpy(key.sa, GET_IPV6_DST_ADDR(p), 16);
+            memcpy(key.da, GET_IPV6_SRC_ADDR(p), 16);
+            key.sp = htons(p->dp);
+            key.dp = htons(p->sp);
+        }
+        memcpy(flow_match.keyData, &key, sizeof(key));
+        flow_match.keyId = NAPATECH_KEYTYPE_IPV6;
+    } else {
+        return 0;
+    }
+
+    flow_match.ipProtocolField = p->proto;
+    flow_match.keySetId = NAPATECH_FLOWTYPE_DROP;
+    flow_match.op = 1;      /* learn */
+    flow_match.gfi = 1;     /* flow info record when unlearned */
+    flow_match.tau = PKT_IS_TCP(p) ? 1 : 0; /* unlearn on FIN or RST */
+
+    int status = NT_FlowWrite(*p->ntpv.flow_stream, &flow_match, -1);
+    if (unlikely(status != NT_SUCCESS)) {
+        NAPATECH_ERROR(SC_ERR_NAPATECH_OPEN_FAILED, status);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief add up the flow info records the adapter made for the flows
+ *         it unlearned, on timeout or at the end of a TCP session
+ */
+static void NapatechReadFlowInfo(NapatechThreadVars *ntv)
+{
+    NtFlowInfo_t info;
+
+    while (NT_FlowRead(ntv->flow_stream, &info, 0) == NT_SUCCESS) {
+        SC_ATOMIC_ADD(bypass_closed, 1);
+        SC_ATOMIC_ADD(bypass_pkts, info.packetsA + info.packetsB);
+        SC_ATOMIC_ADD(bypass_bytes, info.octetsA + info.octetsB);
+    }
+}
+
+/**
+ * \brief bypassed flow manager check function, reports the flows the
+ *         adapter unlearned since the last call
+ */
+int NapatechCheckBypassedFlows(struct flows_stats *bypassstats,
+                               struct timespec *curtime)
+{
+    /* only called from the bypassed flow manager thread */
+    static uint64_t last_closed = 0;
+    static uint64_t last_pkts = 0;
+    static uint64_t last_bytes = 0;
+
+    uint64_t closed = SC_ATOMIC_GET(bypass_closed);
+    if (closed == last_closed) {
+        return 0;
+    }
+    uint64_t pkts = SC_ATOMIC_GET(bypass_pkts);
+    uint64_t bytes = SC_ATOMIC_GET(bypass_bytes);
+
+    bypassstats->count = closed - last_closed;
+    bypassstats->packets = pkts - last_pkts;
+    bypassstats->bytes = bytes - last_bytes;
+    last_closed = closed;
+    last_pkts = pkts;
+    last_bytes = bytes;
+    return 1;
+}
+#endif /* NAPATECH_ENABLE_BYPASS */
+
 static int GetNumaNode(void)
 {
     int cpu = 0;
@@ -359,6 +502,24 @@ TmEcode NapatechPacketLoopZC(ThreadVars *tv, void *data, void *slot)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
+#ifdef NAPATECH_ENABLE_BYPASS
+    uint32_t flow_info_poll = 0;
+    if (ntv->flow_adapter >= 0) {
+        NtFlowAttr_t attr;
+        char flow_name[32];
+
+        snprintf(flow_name, sizeof(flow_name), "SuricataFlow%u", ntv->stream_id);
+        NT_FlowOpenAttrInit(&attr);
+        NT_FlowOpenAttrSetAdapterNo(&attr, ntv->flow_adapter);
+        if ((status = NT_FlowOpen_Attr(&ntv->flow_stream, flow_name, &attr)) != NT_SUCCESS) {
+            NAPATECH_ERROR(SC_ERR_NAPATECH_OPEN_FAILED, status);
+            SCLogWarning(SC_ERR_NAPATECH_OPEN_FAILED,
+                    "Hardware bypass disabled for Napatech stream %u", ntv->stream_id);
+            ntv->flow_adapter = -1;
+        }
+    }
+#endif
+
     TmSlot *s = (TmSlot *) slot;
     ntv->slot = s->slot_next;
 
@@ -367,9 +528,22 @@ TmEcode NapatechPacketLoopZC(ThreadVars *tv, void *data, void *slot)
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
+#ifdef NAPATECH_ENABLE_BYPASS
+        /* the flow info records queue up in the adapter, so read them
+         * every few packets and when idle */
+        if (ntv->flow_adapter >= 0 && (++flow_info_poll & 0xfff) == 0) {
+            NapatechReadFlowInfo(ntv);
+        }
+#endif
+
         /* Napatech returns packets 1 at a time */
         status = NT_NetRxGet(ntv->rx_stream, &packet_buffer, 1000);
         if (unlikely(status == NT_STATUS_TIMEOUT || status == NT_STATUS_TRYAGAIN)) {
+#ifdef NAPATECH_ENABLE_BYPASS
+            if (ntv->flow_adapter >= 0) {
+                NapatechReadFlowInfo(ntv);
+            }
+#endif
             continue;
         } else if (unlikely(status != NT_SUCCESS)) {
             NAPATECH_ERROR(SC_ERR_NAPATECH_OPEN_FAILED, status);
@@ -439,6 +613,14 @@ TmEcode NapatechPacketLoopZC(ThreadVars *tv, void *data, void *slot)
         p->ntpv.nt_packet_buf = packet_buffer;
         p->ntpv.stream_id = ntv->stream_id;
         p->datalink = LINKTYPE_ETHERNET;
+#ifdef NAPATECH_ENABLE_BYPASS
+        if (ntv->flow_adapter >= 0) {
+            p->ntpv.flow_stream = &ntv->flow_stream;
+            p->BypassPacketsFlow = NapatechBypassCallback;
+        } else {
+            p->ntpv.flow_stream = NULL;
+        }
+#endif
 
         if (unlikely(PacketSetData(p,
                      (uint8_t *) NT_NET_GET_PKT_L2_PTR(packet_buffer),
@@ -472,6 +654,12 @@ TmEcode NapatechPacketLoopZC(ThreadVars *tv, void *data, void *slot)
         NapatechDeleteFilter(hash_id);
     }
 
+#ifdef NAPATECH_ENABLE_BYPASS
+    if (filter_id) {
+        NapatechDeleteBypassFilters();
+    }
+#endif
+
     if (unlikely(ntv->hba > 0)) {
         SCLogInfo("Host Buffer Allowance Drops - pkts: %ld,  bytes: %ld",
                 hba_pkt_drops, hba_byte_drops);
@@ -526,6 +714,11 @@ TmEcode NapatechStreamThreadDeinit(ThreadVars *tv, void *data)
     NapatechThreadVars *ntv = (NapatechThreadVars *) data;
     SCLogDebug("Closing Napatech Stream: %d", ntv->stream_id);
     NT_NetRxClose(ntv->rx_stream);
+#ifdef NAPATECH_ENABLE_BYPASS
+    if (ntv->flow_adapter >= 0) {
+        NT_FlowClose(ntv->flow_stream);
+    }
+#endif
     SCReturnInt(TM_ECODE_OK);
 }
 
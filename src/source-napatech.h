@@ -34,7 +34,16 @@ void TmModuleNapatechDecodeRegister(void);
 struct NapatechStreamDevConf {
     uint16_t stream_id;
     intmax_t hba;
+    /* adapter to program bypassed flows on, -1 without hardware bypass */
+    int flow_adapter;
 };
 
+#ifdef NAPATECH_ENABLE_BYPASS
+#include "flow-bypass.h"
+
+int NapatechCheckBypassedFlows(struct flows_stats *bypassstats,
+                               struct timespec *curtime);
+#endif
+
 #endif /* HAVE_NAPATECH */
 #endif /* __SOURCE_NAPATECH_H__ */
@@ -126,6 +126,8 @@ enum {
 
 enum {
     NETMAP_FLAG_ZERO_COPY = 1,
+    /* forward by swapping buffers between the RX and TX rings */
+    NETMAP_FLAG_ZERO_COPY_FWD = 2,
 };
 
 /**
@@ -150,10 +152,13 @@ typedef struct NetmapDevice_
  */
 typedef struct NetmapThreadVars_
 {
-    /* receive inteface */
-    NetmapDevice *ifsrc;
+    /* receive inteface, one device per ring this thread services */
+    NetmapDevice *ifsrc[NETMAP_MAX_RINGS_PER_THREAD];
+    int ifsrc_cnt;
     /* dst interface for IPS mode */
     NetmapDevice *ifdst;
+    /* slots were put on the dst TX rings since the last sync */
+    bool tx_pending;
 
     int flags;
     struct bpf_program bpf_prog;
@@ -167,6 +172,8 @@ typedef struct NetmapThreadVars_
     int copy_mode;
     ChecksumValidationMode checksum_mode;
 
+    CapturePoll poll;
+
     /* counters */
     uint64_t pkts;
     uint64_t bytes;
@@ -444,9 +451,26 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, const void *initdata, voi
         SCLogDebug("Enabling zero copy mode for %s", aconf->in.iface);
     }
 
-    if (NetmapOpen(&aconf->in, &ntv->ifsrc, 1, 1,
-                (ntv->flags & NETMAP_FLAG_ZERO_COPY) != 0) != 0) {
-        goto error_ntv;
+    /* with less threads than rings, spread the rings over the threads */
+    int thread_id = (int)SC_ATOMIC_ADD(aconf->thread_id, 1) - 1;
+    ntv->ifsrc_cnt = aconf->in.rings / aconf->in.threads;
+    if (thread_id < aconf->in.rings % aconf->in.threads)
+        ntv->ifsrc_cnt++;
+    if (ntv->ifsrc_cnt < 1)
+        ntv->ifsrc_cnt = 1;
+    if (ntv->ifsrc_cnt > NETMAP_MAX_RINGS_PER_THREAD) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "%s: can't service %d rings "
+                "in one thread, using %d", aconf->iface_name,
+                ntv->ifsrc_cnt, NETMAP_MAX_RINGS_PER_THREAD);
+        ntv->ifsrc_cnt = NETMAP_MAX_RINGS_PER_THREAD;
+    }
+
+    for (int i = 0; i < ntv->ifsrc_cnt; i++) {
+        if (NetmapOpen(&aconf->in, &ntv->ifsrc[i], 1, 1,
+                    (ntv->flags & NETMAP_FLAG_ZERO_COPY) != 0) != 0) {
+            ntv->ifsrc_cnt = i;
+            goto error_src;
+        }
     }
 
     if (unlikely(aconf->in.sw_ring && aconf->in.threads > 1)) {
@@ -463,6 +487,16 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, const void *initdata, voi
                     1, 0, false) != 0) {
             goto error_src;
         }
+
+        /* buffers can only be swapped between rings sharing a memory
+         * region, and only if the verdict is known while we still own
+         * the RX slot, which is the case in workers mode. */
+        if ((ntv->flags & NETMAP_FLAG_ZERO_COPY) &&
+                ntv->ifsrc[0]->nmd->req.nr_arg2 == ntv->ifdst->nmd->req.nr_arg2) {
+            ntv->flags |= NETMAP_FLAG_ZERO_COPY_FWD;
+            SCLogConfig("%s: zero copy forwarding to %s",
+                    aconf->iface_name, aconf->out.iface);
+        }
     }
 
     /* basic counters */
@@ -470,10 +504,12 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, const void *initdata, voi
             ntv->tv);
     ntv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
             ntv->tv);
+    CapturePollSetup(ntv->tv, &ntv->poll, aconf->in.poll_mode,
+            aconf->in.poll_spin);
 
     if (aconf->in.bpf_filter) {
         SCLogConfig("Using BPF '%s' on iface '%s'",
-                  aconf->in.bpf_filter, ntv->ifsrc->ifname);
+                  aconf->in.bpf_filter, ntv->ifsrc[0]->ifname);
         char errbuf[PCAP_ERRBUF_SIZE];
         if (SCBPFCompile(default_packet_size,  /* snaplen_arg */
                     LINKTYPE_ETHERNET,    /* linktype_arg */
@@ -499,7 +535,9 @@ error_dst:
         NetmapClose(ntv->ifdst);
     }
 error_src:
-    NetmapClose(ntv->ifsrc);
+    for (int i = 0; i < ntv->ifsrc_cnt; i++) {
+        NetmapClose(ntv->ifsrc[i]);
+    }
 error_ntv:
     SCFree(ntv);
 error:
@@ -507,6 +545,39 @@ error:
     SCReturnInt(TM_ECODE_FAILED);
 }
 
+/**
+ * \brief Forward a packet by swapping its buffer into a TX slot.
+ * \param ntv Thread local variables.
+ * \param p Source packet, still owning its RX slot.
+ */
+static TmEcode NetmapWritePacketZeroCopy(NetmapThreadVars *ntv, Packet *p)
+{
+    struct nm_desc *d = ntv->ifdst->nmd;
+    struct netmap_slot *rs = (struct netmap_slot *)p->netmap_v.slot;
+
+    for (int ri = d->first_tx_ring; ri <= d->last_tx_ring; ri++) {
+        struct netmap_ring *ring = NETMAP_TXRING(d->nifp, ri);
+        if (nm_ring_space(ring) == 0)
+            continue;
+
+        struct netmap_slot *ts = &ring->slot[ring->cur];
+        uint32_t idx = ts->buf_idx;
+        ts->buf_idx = rs->buf_idx;
+        rs->buf_idx = idx;
+        ts->len = rs->len;
+        ts->flags |= NS_BUF_CHANGED;
+        rs->flags |= NS_BUF_CHANGED;
+        ring->head = ring->cur = nm_ring_next(ring, ring->cur);
+        ntv->tx_pending = true;
+        return TM_ECODE_OK;
+    }
+
+    SCLogDebug("no TX slots available %s -> %s",
+            ntv->ifsrc[0]->ifname, ntv->ifdst->ifname);
+    ntv->drops++;
+    return TM_ECODE_OK;
+}
+
 /**
  * \brief Output packet to destination interface or drop.
  * \param ntv Thread local variables.
@@ -521,13 +592,17 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
     }
     DEBUG_VALIDATE_BUG_ON(ntv->ifdst == NULL);
 
+    if (p->netmap_v.slot != NULL) {
+        return NetmapWritePacketZeroCopy(ntv, p);
+    }
+
     if (nm_inject(ntv->ifdst->nmd, GET_PKT_DATA(p), GET_PKT_LEN(p)) == 0) {
         SCLogDebug("failed to send %s -> %s",
-                ntv->ifsrc->ifname, ntv->ifdst->ifname);
+                ntv->ifsrc[0]->ifname, ntv->ifdst->ifname);
         ntv->drops++;
     }
     SCLogDebug("sent succesfully: %s(%d)->%s(%d) (%u)",
-		    ntv->ifsrc->ifname, ntv->ifsrc->ring,
+		    ntv->ifsrc[0]->ifname, ntv->ifsrc[0]->ring,
             ntv->ifdst->ifname, ntv->ifdst->ring, GET_PKT_LEN(p));
 
     ioctl(ntv->ifdst->nmd->fd, NIOCTXSYNC, 0);
@@ -545,16 +620,18 @@ static void NetmapReleasePacket(Packet *p)
     if ((ntv->copy_mode != NETMAP_COPY_MODE_NONE) && !PKT_IS_PSEUDOPKT(p)) {
         NetmapWritePacket(ntv, p);
     }
+    p->netmap_v.slot = NULL;
 
     PacketFreeOrRelease(p);
 }
 
-static void NetmapCallback(u_char *user, const struct nm_pkthdr *ph, const u_char *d)
+static void NetmapProcessSlot(NetmapThreadVars *ntv, struct netmap_ring *ring,
+        struct netmap_slot *slot)
 {
-    NetmapThreadVars *ntv = (NetmapThreadVars *)user;
+    const u_char *d = (const u_char *)NETMAP_BUF(ring, slot->buf_idx);
 
     if (ntv->bpf_prog.bf_len) {
-        struct pcap_pkthdr pkthdr = { {0, 0}, ph->len, ph->len };
+        struct pcap_pkthdr pkthdr = { {0, 0}, slot->len, slot->len };
         if (pcap_offline_filter(&ntv->bpf_prog, &pkthdr, d) == 0) {
             return;
         }
@@ -568,17 +645,17 @@ static void NetmapCallback(u_char *user, const struct nm_pkthdr *ph, const u_cha
     PKT_SET_SRC(p, PKT_SRC_WIRE);
     p->livedev = ntv->livedev;
     p->datalink = LINKTYPE_ETHERNET;
-    p->ts = ph->ts;
+    p->ts = ring->ts;
     ntv->pkts++;
-    ntv->bytes += ph->len;
+    ntv->bytes += slot->len;
 
     if (ntv->flags & NETMAP_FLAG_ZERO_COPY) {
-        if (PacketSetData(p, (uint8_t *)d, ph->len) == -1) {
+        if (PacketSetData(p, (uint8_t *)d, slot->len) == -1) {
             TmqhOutputPacketpool(ntv->tv, p);
             return;
         }
     } else {
-        if (PacketCopyData(p, (uint8_t *)d, ph->len) == -1) {
+        if (PacketCopyData(p, (uint8_t *)d, slot->len) == -1) {
             TmqhOutputPacketpool(ntv->tv, p);
             return;
         }
@@ -586,6 +663,7 @@ static void NetmapCallback(u_char *user, const struct nm_pkthdr *ph, const u_cha
 
     p->ReleasePacket = NetmapReleasePacket;
     p->netmap_v.ntv = ntv;
+    p->netmap_v.slot = (ntv->flags & NETMAP_FLAG_ZERO_COPY_FWD) ? slot : NULL;
 
     SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
             GET_PKT_LEN(p), p, GET_PKT_DATA(p));
@@ -597,6 +675,31 @@ static void NetmapCallback(u_char *user, const struct nm_pkthdr *ph, const u_cha
     return;
 }
 
+/**
+ * \brief Walk all RX rings of a device.
+ *
+ * In workers mode the packets are released before we get back here, so
+ * the slot can be handed back to the kernel right after processing.
+ */
+static void NetmapProcessRings(NetmapThreadVars *ntv, NetmapDevice *dev)
+{
+    struct nm_desc *d = dev->nmd;
+
+    for (int ri = d->first_rx_ring; ri <= d->last_rx_ring; ri++) {
+        struct netmap_ring *ring = NETMAP_RXRING(d->nifp, ri);
+
+        while (!nm_ring_empty(ring)) {
+            NetmapProcessSlot(ntv, ring, &ring->slot[ring->cur]);
+            ring->head = ring->cur = nm_ring_next(ring, ring->cur);
+        }
+    }
+
+    if (ntv->tx_pending) {
+        ioctl(ntv->ifdst->nmd->fd, NIOCTXSYNC, 0);
+        ntv->tx_pending = false;
+    }
+}
+
 /**
  *  \brief Main netmap reading loop function
  */
@@ -606,11 +709,13 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
 
     TmSlot *s = (TmSlot *)slot;
     NetmapThreadVars *ntv = (NetmapThreadVars *)data;
-    struct pollfd fds;
+    struct pollfd fds[NETMAP_MAX_RINGS_PER_THREAD];
 
     ntv->slot = s->slot_next;
-    fds.fd = ntv->ifsrc->nmd->fd;
-    fds.events = POLLIN;
+    for (int i = 0; i < ntv->ifsrc_cnt; i++) {
+        fds[i].fd = ntv->ifsrc[i]->nmd->fd;
+        fds[i].events = POLLIN;
+    }
 
     for(;;) {
         if (unlikely(suricata_ctl_flags != 0)) {
@@ -621,13 +726,13 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
          * to prevent us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        int r = poll(&fds, 1, POLL_TIMEOUT);
+        int r = CapturePollWait(tv, &ntv->poll, fds, ntv->ifsrc_cnt, POLL_TIMEOUT);
         if (r < 0) {
             /* error */
             if (errno != EINTR)
                 SCLogError(SC_ERR_NETMAP_READ,
                            "Error polling netmap from iface '%s': (%d" PRIu32 ") %s",
-                           ntv->ifsrc->ifname, errno, strerror(errno));
+                           ntv->ifsrc[0]->ifname, errno, strerror(errno));
             continue;
 
         } else if (r == 0) {
@@ -644,20 +749,22 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
             continue;
         }
 
-        if (unlikely(fds.revents & POLL_EVENTS)) {
-            if (fds.revents & POLLERR) {
-                //SCLogError(SC_ERR_NETMAP_READ,
-                //        "Error reading data from iface '%s': (%d" PRIu32 ") %s",
-                //        ntv->ifsrc->ifname, errno, strerror(errno));
-            } else if (fds.revents & POLLNVAL) {
-                SCLogError(SC_ERR_NETMAP_READ,
-                        "Invalid polling request");
+        for (int i = 0; i < ntv->ifsrc_cnt; i++) {
+            if (unlikely(fds[i].revents & POLL_EVENTS)) {
+                if (fds[i].revents & POLLERR) {
+                    //SCLogError(SC_ERR_NETMAP_READ,
+                    //        "Error reading data from iface '%s': (%d" PRIu32 ") %s",
+                    //        ntv->ifsrc->ifname, errno, strerror(errno));
+                } else if (fds[i].revents & POLLNVAL) {
+                    SCLogError(SC_ERR_NETMAP_READ,
+                            "Invalid polling request");
+                }
+                continue;
             }
-            continue;
-        }
 
-        if (likely(fds.revents & POLLIN)) {
-            nm_dispatch(ntv->ifsrc->nmd, -1, NetmapCallback, (void *)ntv);
+            if (likely(fds[i].revents & POLLIN)) {
+                NetmapProcessRings(ntv, ntv->ifsrc[i]);
+            }
         }
 
         NetmapDumpCounters(ntv);
@@ -698,10 +805,11 @@ static TmEcode ReceiveNetmapThreadDeinit(ThreadVars *tv, void *data)
 
     NetmapThreadVars *ntv = (NetmapThreadVars *)data;
 
-    if (ntv->ifsrc) {
-        NetmapClose(ntv->ifsrc);
-        ntv->ifsrc = NULL;
+    for (int i = 0; i < ntv->ifsrc_cnt; i++) {
+        NetmapClose(ntv->ifsrc[i]);
+        ntv->ifsrc[i] = NULL;
     }
+    ntv->ifsrc_cnt = 0;
     if (ntv->ifdst) {
         NetmapClose(ntv->ifdst);
         ntv->ifdst = NULL;
@@ -36,6 +36,12 @@ enum {
 
 #define NETMAP_IFACE_NAME_LENGTH    48
 
+/* max number of hw rings a single thread can service */
+#define NETMAP_MAX_RINGS_PER_THREAD 16
+
+/* default spin budget in usec for the hybrid poll mode */
+#define NETMAP_POLL_SPIN_DEFAULT 50
+
 typedef struct NetmapIfaceSettings_
 {
     /* real inner interface name */
@@ -49,9 +55,14 @@ typedef struct NetmapIfaceSettings_
     bool threads_auto;
 
     int threads;
+    /* number of rings to spread over the threads */
+    int rings;
     int copy_mode;
     ChecksumValidationMode checksum_mode;
     const char *bpf_filter;
+    /* capture poll mode, holds a CapturePollMode */
+    int poll_mode;
+    int poll_spin;
 } NetmapIfaceSettings;
 
 typedef struct NetmapIfaceConfig_
@@ -66,6 +77,8 @@ typedef struct NetmapIfaceConfig_
     NetmapIfaceSettings out;
 
     SC_ATOMIC_DECLARE(unsigned int, ref);
+    /* used to spread the rings over the threads */
+    SC_ATOMIC_DECLARE(unsigned int, thread_id);
     void (*DerefFunc)(void *);
 } NetmapIfaceConfig;
 
@@ -73,6 +86,8 @@ typedef struct NetmapPacketVars_
 {
     /* NetmapThreadVars */
     void *ntv;
+    /* RX slot of the packet, only set for zero copy forwarding */
+    void *slot;
 } NetmapPacketVars;
 
 int NetmapGetRSSCount(const char *ifname);
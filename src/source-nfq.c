@@ -166,6 +166,7 @@ typedef enum NFQMode_ {
 } NFQMode;
 
 #define NFQ_FLAG_FAIL_OPEN  (1 << 0)
+#define NFQ_FLAG_GSO        (1 << 1)
 
 typedef struct NFQCnf_ {
     NFQMode mode;
@@ -175,7 +176,9 @@ typedef struct NFQCnf_ {
     uint32_t bypass_mask;
     uint32_t next_queue;
     uint32_t flags;
-    uint8_t batchcount;
+    uint16_t batchcount;
+    /* netlink socket receive buffer size, 0 for the default */
+    uint32_t buffer_size;
 } NFQCnf;
 
 NFQCnf nfq_config;
@@ -259,6 +262,26 @@ void NFQInitConfig(char quiet)
 #endif
     }
 
+    boolval = 0;
+    (void)ConfGetBool("nfq.gso", (int *)&boolval);
+    if (boolval) {
+#if defined(HAVE_NFQ_SET_QUEUE_FLAGS) && defined(NFQA_CFG_F_GSO)
+        SCLogInfo("Enabling GSO on queue");
+        nfq_config.flags |= NFQ_FLAG_GSO;
+#else
+        SCLogError(SC_ERR_NFQ_NOSUPPORT,
+                   "nfq.%s set but NFQ library has no support for it.", "gso");
+#endif
+    }
+
+    if ((ConfGetInt("nfq.buffer-size", &value)) == 1) {
+        if (value > 0 && value <= UINT32_MAX) {
+            nfq_config.buffer_size = (uint32_t)value;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "nfq.buffer-size out of range");
+        }
+    }
+
     if ((ConfGetInt("nfq.repeat-mark", &value)) == 1) {
         nfq_config.mark = (uint32_t)value;
     }
@@ -281,12 +304,13 @@ void NFQInitConfig(char quiet)
 
     if ((ConfGetInt("nfq.batchcount", &value)) == 1) {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
-        if (value > 255) {
-            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "nfq.batchcount cannot exceed 255.");
-            value = 255;
+        if (value > NFQ_BATCH_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "nfq.batchcount cannot exceed %d.",
+                         NFQ_BATCH_MAX);
+            value = NFQ_BATCH_MAX;
         }
         if (value > 1)
-            nfq_config.batchcount = (uint8_t) (value - 1);
+            nfq_config.batchcount = (uint16_t) (value - 1);
 #else
         SCLogWarning(SC_ERR_NFQ_NOSUPPORT,
                    "nfq.%s set but NFQ library has no support for it.", "batchcount");
@@ -311,7 +335,7 @@ void NFQInitConfig(char quiet)
 
 }
 
-static uint8_t NFQVerdictCacheLen(NFQQueueVars *t)
+static uint16_t NFQVerdictCacheLen(NFQQueueVars *t)
 {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
     return t->verdict_cache.len;
@@ -460,6 +484,14 @@ static int NFQSetupPkt (Packet *p, struct nfq_q_handle *qh, void *data)
     p->nfq_v.ifo  = nfq_get_outdev(tb);
     p->nfq_v.verdicted = 0;
 
+#if defined(HAVE_NFQ_GET_SKBINFO) && defined(NFQA_SKB_CSUMNOTREADY)
+    /* locally generated and GSO packets don't have their checksum
+     * computed yet, validating it would only give false positives */
+    if (nfq_get_skbinfo(tb) & NFQA_SKB_CSUMNOTREADY) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+#endif
+
 #ifdef NFQ_GET_PAYLOAD_SIGNED
     ret = nfq_get_payload(tb, &pktdata);
 #else
@@ -668,8 +700,10 @@ static TmEcode NFQInitThread(NFQThreadVars *t, uint32_t queue_maxlen)
 #endif /* HAVE_NFQ_MAXLEN */
 
     /* set netlink buffer size to a decent value */
-    nfnl_rcvbufsiz(nfq_nfnlh(q->h), queue_maxlen * 1500);
-    SCLogInfo("setting nfnl bufsize to %" PRId32 "", queue_maxlen * 1500);
+    uint32_t bufsiz = nfq_config.buffer_size ? nfq_config.buffer_size :
+                      queue_maxlen * 1500;
+    nfnl_rcvbufsiz(nfq_nfnlh(q->h), bufsiz);
+    SCLogInfo("setting nfnl bufsize to %" PRIu32 "", bufsiz);
 
     q->nh = nfq_nfnlh(q->h);
     q->fd = nfnl_fd(q->nh);
@@ -710,6 +744,20 @@ static TmEcode NFQInitThread(NFQThreadVars *t, uint32_t queue_maxlen)
             SCLogInfo("fail-open mode should be set on queue");
         }
     }
+#ifdef NFQA_CFG_F_GSO
+    /* let the kernel queue unsegmented GSO packets, so one message
+     * and one verdict covers a whole super packet */
+    if (nfq_config.flags & NFQ_FLAG_GSO) {
+        int r = nfq_set_queue_flags(q->qh, NFQA_CFG_F_GSO, NFQA_CFG_F_GSO);
+
+        if (r == -1) {
+            SCLogWarning(SC_ERR_NFQ_SET_MODE, "can't set GSO mode: %s",
+                         strerror(errno));
+        } else {
+            SCLogInfo("GSO mode should be set on queue");
+        }
+    }
+#endif
 #endif
 
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
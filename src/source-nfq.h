@@ -33,6 +33,9 @@
 // Netfilter's limit
 #define NFQ_MAX_QUEUE 65535
 
+/* max number of packets covered by a single batch verdict */
+#define NFQ_BATCH_MAX 1024
+
 /* idea: set the recv-thread id in the packet to
  * select an verdict-queue */
 
@@ -78,8 +81,8 @@ typedef struct NFQQueueVars_
         uint32_t verdict;
         uint32_t mark;
         uint8_t mark_valid:1;
-        uint8_t len;
-        uint8_t maxlen;
+        uint16_t len;
+        uint16_t maxlen;
     } verdict_cache;
 
 } NFQQueueVars;
@@ -258,6 +258,24 @@ int PcapDirectoryGetModifiedTime(char const *file, struct timespec *out)
     return ret;
 }
 
+/**
+ * Check if a file belongs to this reader thread. All files of a tap go
+ * to the same reader, so they are still processed in timestamp order.
+ */
+static bool PcapDirectoryFileIsOurs(PcapFileDirectoryVars *pv, const char *name)
+{
+    if (pv->readers <= 1)
+        return true;
+
+    uint32_t hash = 5381;
+    for (const char *c = name; *c != '\0'; c++) {
+        if (pv->tap_delimiter != '\0' && *c == pv->tap_delimiter)
+            break;
+        hash = ((hash << 5) + hash) + (uint8_t)*c;
+    }
+    return (hash % pv->readers) == pv->reader_id;
+}
+
 TmEcode PcapDirectoryInsertFile(PcapFileDirectoryVars *pv,
                                 PendingFile *file_to_add
 ) {
@@ -327,6 +345,9 @@ TmEcode PcapDirectoryPopulateBuffer(PcapFileDirectoryVars *pv,
             strcmp(dir->d_name, "..") == 0) {
             continue;
         }
+        if (!PcapDirectoryFileIsOurs(pv, dir->d_name)) {
+            continue;
+        }
 
         char pathbuff[PATH_MAX] = {0};
 
@@ -46,6 +46,12 @@ typedef struct PcapFileDirectoryVars_
     time_t delay;
     time_t poll_interval;
 
+    /* files are split over this many reader threads by tap */
+    uint32_t readers;
+    uint32_t reader_id;
+    /** the part of the file name before this char names the tap */
+    char tap_delimiter;
+
     TAILQ_HEAD(PendingFiles, PendingFile_) directory_content;
 
     PcapFileSharedVars *shared;
@@ -27,15 +27,63 @@
 #include "util-checksum.h"
 #include "util-profiling.h"
 #include "source-pcap-file.h"
+#include "util-byte.h"
 
 extern int max_pending_packets;
 extern PcapFileGlobalVars pcap_g;
 
 static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt);
 
+/** classic pcap file header, see pcap-savefile(5) */
+typedef struct PcapFileMmapHeader_ {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} PcapFileMmapHeader;
+
+/** classic pcap record header */
+typedef struct PcapFileMmapRecordHeader_ {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} PcapFileMmapRecordHeader;
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+
+#ifdef HAVE_SYS_MMAN_H
+static void PcapFileMapRelease(PcapFileMap *map)
+{
+    if (SC_ATOMIC_SUB(map->refs, 1) == 0) {
+        munmap(map->data, map->len);
+        SC_ATOMIC_DESTROY(map->refs);
+        SCFree(map);
+    }
+}
+#endif
+
+static void PcapFileMmapCleanup(PcapFileFileVars *pfv)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (pfv->map == NULL)
+        return;
+
+    /* packets in flight may still point into the map, the last of them
+     * to be released unmaps it */
+    PcapFileMapRelease(pfv->map);
+    pfv->map = NULL;
+#endif
+}
+
 void CleanupPcapFileFileVars(PcapFileFileVars *pfv)
 {
     if (pfv != NULL) {
+        PcapFileMmapCleanup(pfv);
         if (pfv->pcap_handle != NULL) {
             pcap_close(pfv->pcap_handle);
             pfv->pcap_handle = NULL;
@@ -56,6 +104,20 @@ void CleanupPcapFileFileVars(PcapFileFileVars *pfv)
     }
 }
 
+static inline void PcapFileSetChecksumFlags(PcapFileFileVars *ptv, Packet *p)
+{
+    /* We only check for checksum disable */
+    if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ChecksumAutoModeCheck(ptv->shared->pkts, p->pcap_cnt,
+                                  SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
+            pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+}
+
 void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 {
     SCEnter();
@@ -73,7 +135,7 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
     p->datalink = ptv->datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
 
     p->pcap_v.tenant_id = ptv->shared->tenant_id;
     ptv->shared->pkts++;
@@ -85,16 +147,7 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
         SCReturn;
     }
 
-    /* We only check for checksum disable */
-    if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
-        p->flags |= PKT_IGNORE_CHECKSUM;
-    } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
-        if (ChecksumAutoModeCheck(ptv->shared->pkts, p->pcap_cnt,
-                                  SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
-            pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
-            p->flags |= PKT_IGNORE_CHECKSUM;
-        }
-    }
+    PcapFileSetChecksumFlags(ptv, p);
 
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
@@ -106,6 +159,209 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     SCReturn;
 }
 
+#ifdef HAVE_SYS_MMAN_H
+static void PcapFileMmapReleasePacket(Packet *p)
+{
+    PcapFileMap *map = (PcapFileMap *)p->pcap_v.map;
+
+    p->pcap_v.map = NULL;
+    PacketFreeOrRelease(p);
+    PcapFileMapRelease(map);
+}
+
+/**
+ *  \brief Create a packet for the next record of a mmap'd file
+ *
+ *  The packet data points into the map, so no copy is done.
+ *
+ *  \retval 1 packet was handled (or filtered out)
+ *  \retval 0 end of file
+ *  \retval -1 truncated record or processing failure
+ */
+static int PcapFileMmapNextRecord(PcapFileFileVars *ptv)
+{
+    PcapFileMmapRecordHeader rec;
+
+    const uint8_t *data = ptv->map->data;
+    const size_t len = ptv->map->len;
+
+    if (ptv->map_offset == len)
+        return 0;
+    if (len - ptv->map_offset < sizeof(rec)) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated record header at "
+                     "offset %"PRIuMAX" in %s", (uintmax_t)ptv->map_offset,
+                     ptv->filename);
+        return -1;
+    }
+    memcpy(&rec, data + ptv->map_offset, sizeof(rec));
+    if (ptv->map_swapped) {
+        rec.ts_sec = SCByteSwap32(rec.ts_sec);
+        rec.ts_frac = SCByteSwap32(rec.ts_frac);
+        rec.caplen = SCByteSwap32(rec.caplen);
+        rec.len = SCByteSwap32(rec.len);
+    }
+    if (rec.caplen > len - ptv->map_offset - sizeof(rec)) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated record at offset "
+                     "%"PRIuMAX" in %s", (uintmax_t)ptv->map_offset,
+                     ptv->filename);
+        return -1;
+    }
+
+    uint8_t *pkt = ptv->map->data + ptv->map_offset + sizeof(rec);
+    ptv->map_offset += sizeof(rec) + rec.caplen;
+
+    struct pcap_pkthdr h;
+    h.ts.tv_sec = rec.ts_sec;
+    h.ts.tv_usec = ptv->map_nsec ? rec.ts_frac / 1000 : rec.ts_frac;
+    h.caplen = rec.caplen;
+    h.len = rec.len;
+
+    if (ptv->shared->bpf_string != NULL &&
+            pcap_offline_filter(&ptv->filter, &h, pkt) == 0) {
+        return 1;
+    }
+
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (unlikely(p == NULL)) {
+        return 1;
+    }
+    PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILE);
+
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->ts.tv_sec = h.ts.tv_sec;
+    p->ts.tv_usec = h.ts.tv_usec;
+    p->datalink = ptv->datalink;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
+
+    p->pcap_v.tenant_id = ptv->shared->tenant_id;
+    ptv->shared->pkts++;
+    ptv->shared->bytes += h.caplen;
+
+    if (unlikely(PacketSetData(p, pkt, h.caplen))) {
+        TmqhOutputPacketpool(ptv->shared->tv, p);
+        PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+        return 1;
+    }
+    p->pcap_v.map = ptv->map;
+    p->ReleasePacket = PcapFileMmapReleasePacket;
+    (void) SC_ATOMIC_ADD(ptv->map->refs, 1);
+
+    PcapFileSetChecksumFlags(ptv, p);
+
+    PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+
+    if (TmThreadsSlotProcessPkt(ptv->shared->tv, ptv->shared->slot, p) != TM_ECODE_OK) {
+        ptv->shared->cb_result = TM_ECODE_FAILED;
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ *  \brief Reading loop for mmap'd files
+ */
+static TmEcode PcapFileDispatchMmap(PcapFileFileVars *ptv)
+{
+    const int packet_q_len = 64;
+
+    while (1) {
+        if (suricata_ctl_flags & SURICATA_STOP) {
+            SCReturnInt(TM_ECODE_OK);
+        }
+
+        PacketPoolWait();
+
+        for (int i = 0; i < packet_q_len; i++) {
+            int r = PcapFileMmapNextRecord(ptv);
+            if (r == 1)
+                continue;
+
+            if (r == 0) {
+                SCLogInfo("pcap file %s end of file reached", ptv->filename);
+                ptv->shared->files++;
+                SCReturnInt(TM_ECODE_DONE);
+            }
+            if (ptv->shared->cb_result == TM_ECODE_FAILED) {
+                SCLogError(SC_ERR_PCAP_DISPATCH,
+                           "Pcap packet processing failed for %s", ptv->filename);
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            SCReturnInt(TM_ECODE_DONE);
+        }
+        StatsSyncCountersIfSignalled(ptv->shared->tv);
+    }
+}
+
+/**
+ *  \brief Map a classic pcap file into memory
+ *
+ *  pcapng and anything that can't be mapped is left to libpcap.
+ */
+static void PcapFileMmapInit(PcapFileFileVars *pfv)
+{
+    struct stat st;
+    PcapFileMmapHeader hdr;
+
+    int fd = open(pfv->filename, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+            (uintmax_t)st.st_size < sizeof(hdr) ||
+            (uintmax_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return;
+    }
+
+    /* private writable map: decoders never write to the file */
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "mmap of %s failed: %s, "
+                     "falling back to libpcap", pfv->filename, strerror(errno));
+        return;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    switch (hdr.magic) {
+        case PCAP_MAGIC_USEC:
+            break;
+        case PCAP_MAGIC_NSEC:
+            pfv->map_nsec = true;
+            break;
+        default:
+            if (hdr.magic == SCByteSwap32(PCAP_MAGIC_USEC)) {
+                pfv->map_swapped = true;
+            } else if (hdr.magic == SCByteSwap32(PCAP_MAGIC_NSEC)) {
+                pfv->map_swapped = true;
+                pfv->map_nsec = true;
+            } else {
+                SCLogInfo("%s is not a classic pcap file, using libpcap",
+                          pfv->filename);
+                munmap(map, (size_t)st.st_size);
+                return;
+            }
+    }
+
+    (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    pfv->map = SCCalloc(1, sizeof(*pfv->map));
+    if (unlikely(pfv->map == NULL)) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+    pfv->map->data = map;
+    pfv->map->len = (size_t)st.st_size;
+    /* reference of the file, dropped at its cleanup */
+    SC_ATOMIC_INIT(pfv->map->refs);
+    SC_ATOMIC_SET(pfv->map->refs, 1);
+    pfv->map_offset = sizeof(hdr);
+    SCLogDebug("%s mapped, %"PRIuMAX" bytes", pfv->filename,
+               (uintmax_t)pfv->map->len);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
 char pcap_filename[PATH_MAX] = "unknown";
 
 const char *PcapFileGetFilename(void)
@@ -125,6 +381,12 @@ TmEcode PcapFileDispatch(PcapFileFileVars *ptv)
     TmEcode loop_result = TM_ECODE_OK;
     strlcpy(pcap_filename, ptv->filename, sizeof(pcap_filename));
 
+#ifdef HAVE_SYS_MMAN_H
+    if (ptv->map != NULL) {
+        SCReturnInt(PcapFileDispatchMmap(ptv));
+    }
+#endif
+
     while (loop_result == TM_ECODE_OK) {
         if (suricata_ctl_flags & SURICATA_STOP) {
             SCReturnInt(TM_ECODE_OK);
@@ -196,6 +458,12 @@ TmEcode InitPcapFile(PcapFileFileVars *pfv)
 
     Decoder temp;
     TmEcode validated = ValidateLinkType(pfv->datalink, &temp);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (validated == TM_ECODE_OK && pfv->shared != NULL && pfv->shared->use_mmap) {
+        PcapFileMmapInit(pfv);
+    }
+#endif
     SCReturnInt(validated);
 }
 
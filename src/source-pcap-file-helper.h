@@ -28,10 +28,16 @@
 #define __SOURCE_PCAP_FILE_HELPER_H__
 
 typedef struct PcapFileGlobalVars_ {
-    uint64_t cnt; /** packet counter */
+    SC_ATOMIC_DECLARE(uint64_t, cnt); /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
+    /** number of directory reader threads set up by the runmode */
+    uint32_t readers;
+    /** used to hand out directory slices to the reader threads */
+    SC_ATOMIC_DECLARE(unsigned int, reader_id);
+    /** reader threads that haven't finished yet */
+    SC_ATOMIC_DECLARE(unsigned int, readers_active);
 } PcapFileGlobalVars;
 
 /**
@@ -47,6 +53,9 @@ typedef struct PcapFileSharedVars_
 
     bool should_delete;
 
+    /** read files through mmap instead of libpcap if possible */
+    bool use_mmap;
+
     ThreadVars *tv;
     TmSlot *slot;
 
@@ -65,6 +74,16 @@ typedef struct PcapFileSharedVars_
 /**
  * Data specific to a single pcap file
  */
+/**
+ * A mmap'd pcap file. Held by the file and by each packet pointing into
+ * it, the last one to let go of it unmaps it.
+ */
+typedef struct PcapFileMap_ {
+    uint8_t *data;
+    size_t len;
+    SC_ATOMIC_DECLARE(unsigned int, refs);
+} PcapFileMap;
+
 typedef struct PcapFileFileVars_
 {
     char *filename;
@@ -73,6 +92,12 @@ typedef struct PcapFileFileVars_
     int datalink;
     struct bpf_program filter;
 
+    /* mmap'd file state, map is NULL when libpcap is used for reading */
+    PcapFileMap *map;
+    size_t map_offset;
+    bool map_swapped;
+    bool map_nsec;
+
     PcapFileSharedVars *shared;
 } PcapFileFileVars;
 
@@ -139,7 +139,19 @@ void TmModuleDecodePcapFileRegister (void)
 void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SC_ATOMIC_INIT(pcap_g.cnt);
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+    SC_ATOMIC_INIT(pcap_g.reader_id);
+    SC_ATOMIC_INIT(pcap_g.readers_active);
+    pcap_g.readers = 1;
+}
+
+/**
+ * \brief Set the number of threads reading a directory in parallel
+ */
+void PcapFileSetReaders(uint32_t readers)
+{
+    pcap_g.readers = readers;
 }
 
 TmEcode PcapFileExit(TmEcode status, struct timespec *last_processed)
@@ -148,7 +160,11 @@ TmEcode PcapFileExit(TmEcode status, struct timespec *last_processed)
         status = UnixSocketPcapFile(status, last_processed);
         SCReturnInt(status);
     } else {
-        EngineStop();
+        /* with several directory readers only the last one to finish
+         * stops the engine */
+        if (SC_ATOMIC_SUB(pcap_g.readers_active, 1) == 0) {
+            EngineStop();
+        }
         SCReturnInt(status);
     }
 }
@@ -196,6 +212,9 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
     const char *tmpstring = NULL;
     const char *tmp_bpf_string = NULL;
 
+    /* dropped again in PcapFileExit, also when init fails */
+    (void) SC_ATOMIC_ADD(pcap_g.readers_active, 1);
+
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
 
@@ -238,6 +257,12 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
         ptv->shared.should_delete = should_delete == 1;
     }
 
+    int use_mmap = 0;
+    ptv->shared.use_mmap = false;
+    if (ConfGetBool("pcap-file.mmap", &use_mmap) == 1) {
+        ptv->shared.use_mmap = use_mmap == 1;
+    }
+
     DIR *directory = NULL;
     SCLogDebug("checking file or directory %s", (char*)initdata);
     if(PcapDetermineDirectoryOrFile((char *)initdata, &directory) == TM_ECODE_FAILED) {
@@ -263,15 +288,16 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
             SCReturnInt(TM_ECODE_OK);
         }
 
+        pv->shared = &ptv->shared;
         status = InitPcapFile(pv);
         if(status == TM_ECODE_OK) {
-            pv->shared = &ptv->shared;
-
             ptv->is_directory = 0;
             ptv->behavior.file = pv;
         } else {
             SCLogWarning(SC_ERR_PCAP_DISPATCH,
                          "Failed to init pcap file %s, skipping", pv->filename);
+            /* don't let the cleanup delete a file we never read */
+            pv->shared = NULL;
             CleanupPcapFileFileVars(pv);
             CleanupPcapFileThreadVars(ptv);
             SCReturnInt(TM_ECODE_OK);
@@ -323,6 +349,14 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
             }
         }
 
+        pv->readers = pcap_g.readers;
+        pv->reader_id = SC_ATOMIC_ADD(pcap_g.reader_id, 1) - 1;
+        if (ConfGet("pcap-file.tap-delimiter", &tmpstring) == 1 &&
+                tmpstring != NULL && strlen(tmpstring) > 0) {
+            pv->tap_delimiter = tmpstring[0];
+        }
+        tmpstring = NULL;
+
         pv->shared = &ptv->shared;
         pv->directory = directory;
         TAILQ_INIT(&pv->directory_content);
@@ -357,9 +391,10 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
         PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
         if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            SC_ATOMIC_GET(pcap_g.cnt) < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-            uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+            uint64_t chrate = SC_ATOMIC_GET(pcap_g.cnt) /
+                              SC_ATOMIC_GET(pcap_g.invalid_checksums);
             if (chrate < CHECKSUM_INVALID_RATIO)
                 SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
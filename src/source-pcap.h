@@ -40,6 +40,9 @@ char *PcapLiveGetDevice(int);
 typedef struct PcapPacketVars_
 {
     uint32_t tenant_id;
+    /** pcap-file: mapped file the packet data points into, NULL if
+     *  copied */
+    void *map;
 } PcapPacketVars;
 
 /** needs to be able to contain Windows adapter id's, so
@@ -556,7 +556,19 @@ TmEcode ReceivePfringThreadInit(ThreadVars *tv, const void *initdata, void **dat
     }
 #endif
 
-    ptv->pd = pfring_open(ptv->interface, (uint32_t)default_packet_size, opflag);
+    /* ZC: give each thread its own queue, e.g. zc:eth0@2 or zc:99@2
+     * for a zbalance cluster, unless the queue was set explicitly */
+    char zc_iface[PFRING_IFACE_NAME_LENGTH + 8];
+    const char *open_iface = ptv->interface;
+    if (strncmp(ptv->interface, "zc", 2) == 0 && pfconf->threads > 1 &&
+            strchr(ptv->interface, '@') == NULL) {
+        unsigned int queue = SC_ATOMIC_ADD(pfconf->queue_counter, 1) - 1;
+        snprintf(zc_iface, sizeof(zc_iface), "%s@%u", ptv->interface, queue);
+        open_iface = zc_iface;
+        SCLogPerf("(%s) using ZC queue %s", tv->name, open_iface);
+    }
+
+    ptv->pd = pfring_open(open_iface, (uint32_t)default_packet_size, opflag);
     if (ptv->pd == NULL) {
         SCLogError(SC_ERR_PF_RING_OPEN,"Failed to open %s: pfring_open error."
                 " Check if %s exists and pf_ring module is loaded.",
@@ -50,6 +50,8 @@ typedef struct PfringIfaceConfig_
 
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, ref);
+    /* used to give each thread its own ZC queue */
+    SC_ATOMIC_DECLARE(unsigned int, queue_counter);
     void (*DerefFunc)(void *);
 } PfringIfaceConfig;
 
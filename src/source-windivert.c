@@ -91,6 +91,11 @@ TmEcode NoWinDivertSupportExit(ThreadVars *tv, const void *initdata,
 
 #else /* implied we do have WinDivert support */
 
+/** packets received or sent per WinDivertRecvEx/WinDivertSendEx call */
+#define WINDIVERT_BATCH 64
+/** ms to wait for packets before checking if we're stopping */
+#define WINDIVERT_RECV_TIMEOUT 100
+
 typedef struct WinDivertThreadVars_ {
     WinDivertHandle filter_handle;
 
@@ -101,9 +106,31 @@ typedef struct WinDivertThreadVars_ {
     int64_t qpc_freq_usec;
 
     TmSlot *slot;
+    /** thread running the receive loop */
+    ThreadVars *recv_tv;
 
     bool offload_enabled;
 
+    /* batch receive, overlapped so we can stop while waiting */
+    uint8_t *recv_buf;
+    uint32_t buf_size;
+    WINDIVERT_ADDRESS recv_addr[WINDIVERT_BATCH];
+    UINT recv_addr_len;
+    OVERLAPPED recv_ov;
+    HANDLE recv_event;
+
+    /* batch send, only when the verdict is given by the receive thread
+     * (workers runmode). The send of a batch overlaps the receive of the
+     * next one. */
+    bool batch_verdict;
+    bool send_pending;
+    uint8_t *send_buf;
+    uint32_t send_len;
+    WINDIVERT_ADDRESS send_addr[WINDIVERT_BATCH];
+    int send_cnt;
+    OVERLAPPED send_ov;
+    HANDLE send_event;
+
     TAILQ_HEAD(, LiveDevice_) live_devices;
 } WinDivertThreadVars;
 
@@ -361,6 +388,8 @@ TmEcode DecodeWinDivertThreadDeinit(ThreadVars *, void *);
 /* internal helper functions */
 static TmEcode WinDivertRecvHelper(ThreadVars *tv, WinDivertThreadVars *);
 static TmEcode WinDivertVerdictHelper(ThreadVars *tv, Packet *p);
+static TmEcode WinDivertSendFlush(WinDivertThreadVars *);
+static TmEcode WinDivertSendWait(WinDivertThreadVars *);
 static TmEcode WinDivertCloseHelper(WinDivertThreadVars *);
 
 static TmEcode WinDivertCollectFilterDevices(WinDivertThreadVars *,
@@ -414,7 +443,7 @@ TmEcode ReceiveWinDivertLoop(ThreadVars *tv, void *data, void *slot)
 
     while (true) {
         if (suricata_ctl_flags & SURICATA_STOP) {
-            SCReturnInt(TM_ECODE_OK);
+            break;
         }
 
         if (unlikely(WinDivertRecvHelper(tv, wd_tv) != TM_ECODE_OK)) {
@@ -424,9 +453,78 @@ TmEcode ReceiveWinDivertLoop(ThreadVars *tv, void *data, void *slot)
         StatsSyncCountersIfSignalled(tv);
     }
 
+    /* hand back the packets verdicted in the last batch */
+    if (WinDivertSendFlush(wd_tv) != TM_ECODE_OK ||
+        WinDivertSendWait(wd_tv) != TM_ECODE_OK) {
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief get the length of the IPv4/IPv6 packet at the start of a buffer
+ *
+ * \retval 0 if the length can't be determined
+ */
+static uint32_t WinDivertPacketLength(const uint8_t *data, uint32_t len)
+{
+    if (len >= IPV4_HEADER_LEN && IPV4_GET_RAW_VER((IPV4Hdr *)data) == 4) {
+        return ((uint32_t)data[2] << 8) | data[3];
+    }
+    if (len >= IPV6_HEADER_LEN && IPV6_GET_RAW_VER((IPV6Hdr *)data) == 6) {
+        return IPV6_HEADER_LEN + (((uint32_t)data[4] << 8) | data[5]);
+    }
+    return 0;
+}
+
+/**
+ * \brief receive a batch of packets
+ *
+ * The receive is overlapped, so that we can check for the engine stopping
+ * while no traffic matches the filter.
+ *
+ * \param recv_len out-pointer to the bytes received
+ *
+ * \retval TM_ECODE_OK batch received
+ * \retval TM_ECODE_DONE stopping, nothing received
+ * \retval TM_ECODE_FAILED receive error
+ */
+static TmEcode WinDivertRecvBatch(WinDivertThreadVars *wd_tv, UINT *recv_len)
+{
+    memset(&wd_tv->recv_ov, 0, sizeof(wd_tv->recv_ov));
+    wd_tv->recv_ov.hEvent = wd_tv->recv_event;
+    wd_tv->recv_addr_len = sizeof(wd_tv->recv_addr);
+
+    if (!WinDivertRecvEx(wd_tv->filter_handle, wd_tv->recv_buf,
+                         wd_tv->buf_size, 0, wd_tv->recv_addr, NULL,
+                         &wd_tv->recv_addr_len, &wd_tv->recv_ov) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        SCLogInfo("WinDivertRecvEx failed: error %" PRIu32 "",
+                  (uint32_t)(GetLastError()));
+        return TM_ECODE_FAILED;
+    }
+
+    while (WaitForSingleObject(wd_tv->recv_event, WINDIVERT_RECV_TIMEOUT) ==
+           WAIT_TIMEOUT) {
+        if (suricata_ctl_flags & SURICATA_STOP) {
+            /* the buffers must outlive the request, wait for the cancel */
+            CancelIo(wd_tv->filter_handle);
+            (void)GetOverlappedResult(wd_tv->filter_handle, &wd_tv->recv_ov,
+                                      (DWORD *)recv_len, TRUE);
+            return TM_ECODE_DONE;
+        }
+    }
+
+    if (!GetOverlappedResult(wd_tv->filter_handle, &wd_tv->recv_ov,
+                             (DWORD *)recv_len, FALSE)) {
+        SCLogInfo("WinDivertRecvEx failed: error %" PRIu32 "",
+                  (uint32_t)(GetLastError()));
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+}
+
 static TmEcode WinDivertRecvHelper(ThreadVars *tv, WinDivertThreadVars *wd_tv)
 {
     SCEnter();
@@ -440,71 +538,85 @@ static TmEcode WinDivertRecvHelper(ThreadVars *tv, WinDivertThreadVars *wd_tv)
      */
     PacketPoolWait();
 
-    /* obtain a packet buffer */
-    Packet *p = PacketGetFromQueueOrAlloc();
-    if (unlikely(p == NULL)) {
-        SCLogDebug(
-                "PacketGetFromQueueOrAlloc() - failed to obtain Packet buffer");
-        SCReturnInt(TM_ECODE_FAILED);
-    }
-    PKT_SET_SRC(p, PKT_SRC_WIRE);
-
-    /* receive packet, depending on offload status. MTU is used as an estimator
-     * for direct data alloc size, and this is meaningless if large segments are
-     * coalesced before they reach WinDivert */
-    bool success = false;
-    uint32_t pktlen = 0;
-    if (wd_tv->offload_enabled) {
-        /* allocate external, if not already */
-        PacketCallocExtPkt(p, MAX_PAYLOAD_SIZE);
-
-        success =
-                WinDivertRecv(wd_tv->filter_handle, p->ext_pkt,
-                              MAX_PAYLOAD_SIZE, &p->windivert_v.addr, &pktlen);
-    } else {
-        success = WinDivertRecv(wd_tv->filter_handle, GET_PKT_DIRECT_DATA(p),
-                                GET_PKT_DIRECT_MAX_SIZE(p),
-                                &p->windivert_v.addr, &pktlen);
+    UINT recv_len = 0;
+    TmEcode ret = WinDivertRecvBatch(wd_tv, &recv_len);
+    if (ret == TM_ECODE_DONE) {
+        SCReturnInt(TM_ECODE_OK);
     }
-    SET_PKT_LEN(p, pktlen);
-
-    if (!success) {
+    if (ret != TM_ECODE_OK) {
 #ifdef COUNTERS
         SCMutexLock(&wd_qv->counters_mutex);
         wd_qv->errs++;
         SCMutexUnlock(&wd_qv->counters_mutex);
 #endif /* COUNTERS */
-
-        /* ensure packet length is zero to trigger an error in packet decoding
-         */
-        SET_PKT_LEN(p, 0);
-
-        SCLogInfo("WinDivertRecv failed: error %" PRIu32 "",
-                  (uint32_t)(GetLastError()));
         SCReturnInt(TM_ECODE_FAILED);
     }
-    SCLogDebug("Packet received, length %" PRId32 "", GET_PKT_LEN(p));
 
-    p->ts = WinDivertTimestampToTimeval(wd_tv, p->windivert_v.addr.Timestamp);
-    p->windivert_v.thread_num = wd_tv->thread_num;
+    /* the packets of a batch are back to back in the buffer, with an
+     * address each */
+    int cnt = wd_tv->recv_addr_len / sizeof(WINDIVERT_ADDRESS);
+    uint8_t *data = wd_tv->recv_buf;
+    uint32_t left = recv_len;
+
+    for (int i = 0; i < cnt && left > 0; i++) {
+        uint32_t pktlen = WinDivertPacketLength(data, left);
+        /* coalesced segments may not have their length set */
+        if (i == cnt - 1 || pktlen == 0) {
+            pktlen = left;
+        }
+        if (pktlen > left) {
+#ifdef COUNTERS
+            SCMutexLock(&wd_qv->counters_mutex);
+            wd_qv->errs++;
+            SCMutexUnlock(&wd_qv->counters_mutex);
+#endif /* COUNTERS */
+            SCLogDebug("packet length %" PRIu32 " past the batch", pktlen);
+            break;
+        }
+
+        /* obtain a packet buffer */
+        Packet *p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            SCLogDebug("PacketGetFromQueueOrAlloc() - failed to obtain Packet "
+                       "buffer");
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+        if (unlikely(PacketCopyData(p, data, pktlen) != 0)) {
+            TmqhOutputPacketpool(tv, p);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        p->windivert_v.addr = wd_tv->recv_addr[i];
+        data += pktlen;
+        left -= pktlen;
+
+        SCLogDebug("Packet received, length %" PRId32 "", GET_PKT_LEN(p));
+
+        p->ts = WinDivertTimestampToTimeval(wd_tv,
+                                            p->windivert_v.addr.Timestamp);
+        p->windivert_v.thread_num = wd_tv->thread_num;
 
 #ifdef COUNTERS
-    SCMutexLock(&wd_qv->counters_mutex);
-    wd_qv->pkts++;
-    wd_qv->bytes += GET_PKT_LEN(p);
-    SCMutexUnlock(&wd_qv->counters_mutex);
+        SCMutexLock(&wd_qv->counters_mutex);
+        wd_qv->pkts++;
+        wd_qv->bytes += GET_PKT_LEN(p);
+        SCMutexUnlock(&wd_qv->counters_mutex);
 #endif /* COUNTERS */
 
-    /* Do the packet processing by calling TmThreadsSlotProcessPkt, this will,
-     * depending on the running mode, pass the packet to the treatment functions
-     * or push it to a packet pool. So processing time can vary.
-     */
-    if (TmThreadsSlotProcessPkt(tv, wd_tv->slot, p) != TM_ECODE_OK) {
-        TmqhOutputPacketpool(tv, p);
-        SCReturnInt(TM_ECODE_FAILED);
+        /* Do the packet processing by calling TmThreadsSlotProcessPkt, this
+         * will, depending on the running mode, pass the packet to the
+         * treatment functions or push it to a packet pool. So processing
+         * time can vary.
+         */
+        if (TmThreadsSlotProcessPkt(tv, wd_tv->slot, p) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(tv, p);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
     }
 
-    SCReturnInt(TM_ECODE_OK);
+    /* in workers mode the batch has been verdicted by now */
+    SCReturnInt(WinDivertSendFlush(wd_tv));
 }
 
 /**
@@ -563,9 +675,24 @@ TmEcode ReceiveWinDivertThreadInit(ThreadVars *tv, const void *initdata,
         goto unlock;
     }
 
+    /* coalesced segments can be up to 64k */
+    wd_tv->buf_size = WINDIVERT_BATCH *
+            (wd_tv->offload_enabled ? MAX_PAYLOAD_SIZE : default_packet_size);
+    wd_tv->recv_buf = SCMalloc(wd_tv->buf_size);
+    wd_tv->send_buf = SCMalloc(wd_tv->buf_size);
+    wd_tv->recv_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    wd_tv->send_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (wd_tv->recv_buf == NULL || wd_tv->send_buf == NULL ||
+        wd_tv->recv_event == NULL || wd_tv->send_event == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to set up WinDivert batches");
+        ret = TM_ECODE_FAILED;
+        goto unlock;
+    }
+
 unlock:
     if (ret == 0) { /* success */
         wd_tv->filter_handle = wd_qv->filter_handle;
+        wd_tv->recv_tv = tv;
 
         /* set our return context */
         *data = wd_tv;
@@ -698,7 +825,26 @@ TmEcode ReceiveWinDivertThreadDeinit(ThreadVars *tv, void *data)
 
     WinDivertThreadVars *wd_tv = (WinDivertThreadVars *)data;
 
-    SCReturnCT(WinDivertCloseHelper(wd_tv), "TmEcode");
+    TmEcode ret = WinDivertCloseHelper(wd_tv);
+
+    if (wd_tv->recv_event != NULL) {
+        CloseHandle(wd_tv->recv_event);
+        wd_tv->recv_event = NULL;
+    }
+    if (wd_tv->send_event != NULL) {
+        CloseHandle(wd_tv->send_event);
+        wd_tv->send_event = NULL;
+    }
+    if (wd_tv->recv_buf != NULL) {
+        SCFree(wd_tv->recv_buf);
+        wd_tv->recv_buf = NULL;
+    }
+    if (wd_tv->send_buf != NULL) {
+        SCFree(wd_tv->send_buf);
+        wd_tv->send_buf = NULL;
+    }
+
+    SCReturnCT(ret, "TmEcode");
 }
 
 /**
@@ -803,12 +949,32 @@ static TmEcode WinDivertVerdictHelper(ThreadVars *tv, Packet *p)
         SCReturnInt(TM_ECODE_OK);
     }
 
-    bool success = WinDivertSend(wd_tv->filter_handle, GET_PKT_DATA(p),
-                                 GET_PKT_LEN(p), &p->windivert_v.addr, NULL);
+    if (wd_tv->batch_verdict) {
+        /* sent with the rest of the batch in WinDivertSendFlush() */
+        if (wd_tv->send_pending &&
+            WinDivertSendWait(wd_tv) != TM_ECODE_OK) {
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        if (wd_tv->send_cnt == WINDIVERT_BATCH ||
+            wd_tv->send_len + GET_PKT_LEN(p) > wd_tv->buf_size) {
+            if (WinDivertSendFlush(wd_tv) != TM_ECODE_OK ||
+                WinDivertSendWait(wd_tv) != TM_ECODE_OK) {
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        }
+        memcpy(wd_tv->send_buf + wd_tv->send_len, GET_PKT_DATA(p),
+               GET_PKT_LEN(p));
+        wd_tv->send_len += GET_PKT_LEN(p);
+        wd_tv->send_addr[wd_tv->send_cnt++] = p->windivert_v.addr;
+    } else {
+        bool success = WinDivertSend(wd_tv->filter_handle, GET_PKT_DATA(p),
+                                     GET_PKT_LEN(p), &p->windivert_v.addr,
+                                     NULL);
 
-    if (unlikely(!success)) {
-        WinDivertLogError(GetLastError());
-        SCReturnInt(TM_ECODE_FAILED);
+        if (unlikely(!success)) {
+            WinDivertLogError(GetLastError());
+            SCReturnInt(TM_ECODE_FAILED);
+        }
     }
 
 #ifdef COUNTERS
@@ -820,6 +986,59 @@ static TmEcode WinDivertVerdictHelper(ThreadVars *tv, Packet *p)
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief send the packets verdicted since the last flush
+ *
+ * The send is overlapped: the thread goes on receiving while the driver
+ * reinjects the batch. WinDivertSendWait() must be called before the send
+ * buffer is used again.
+ */
+static TmEcode WinDivertSendFlush(WinDivertThreadVars *wd_tv)
+{
+    if (wd_tv->send_cnt == 0 || wd_tv->send_pending) {
+        return TM_ECODE_OK;
+    }
+
+    memset(&wd_tv->send_ov, 0, sizeof(wd_tv->send_ov));
+    wd_tv->send_ov.hEvent = wd_tv->send_event;
+
+    if (!WinDivertSendEx(wd_tv->filter_handle, wd_tv->send_buf,
+                         wd_tv->send_len, 0, wd_tv->send_addr, NULL,
+                         wd_tv->send_cnt * sizeof(WINDIVERT_ADDRESS),
+                         &wd_tv->send_ov) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        WinDivertLogError(GetLastError());
+        wd_tv->send_cnt = 0;
+        wd_tv->send_len = 0;
+        return TM_ECODE_FAILED;
+    }
+    wd_tv->send_pending = true;
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief wait for the batch being sent, if any
+ */
+static TmEcode WinDivertSendWait(WinDivertThreadVars *wd_tv)
+{
+    if (!wd_tv->send_pending) {
+        return TM_ECODE_OK;
+    }
+
+    DWORD send_len = 0;
+    bool success = GetOverlappedResult(wd_tv->filter_handle, &wd_tv->send_ov,
+                                       &send_len, TRUE);
+    wd_tv->send_pending = false;
+    wd_tv->send_cnt = 0;
+    wd_tv->send_len = 0;
+
+    if (unlikely(!success)) {
+        WinDivertLogError(GetLastError());
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+}
+
 /**
  * \brief init the verdict thread, which is piggybacked off the receive
  * thread
@@ -833,6 +1052,10 @@ TmEcode VerdictWinDivertThreadInit(ThreadVars *tv, const void *initdata,
 
     CaptureStatsSetup(tv, &wd_tv->stats);
 
+    /* when the receive thread gives the verdicts too, it can send them in
+     * batches: it knows when a received batch is done */
+    wd_tv->batch_verdict = (wd_tv->recv_tv == tv);
+
     *data = wd_tv;
 
     SCReturnInt(TM_ECODE_OK);
@@ -157,6 +157,82 @@ void StreamTcpInlineSegmentReplacePacket(const TcpStream *stream,
     }
 }
 
+/** size of the blocks compared and rewritten by
+ *  StreamTcpInlineSegmentNormalize(), one SIMD compare each */
+#define INLINE_NORMALIZE_BLOCK 16
+
+/**
+ *  \brief Make the packet payload match the already accepted data of a
+ *         segment it overlaps with
+ *
+ *  Does what StreamTcpInlineSegmentCompare() followed by
+ *  StreamTcpInlineSegmentReplacePacket() do, but computes the overlap
+ *  once and only writes to the packet when the data differs. Then only
+ *  the blocks that differ are copied, so a packet with a few changed
+ *  bytes isn't rewritten in full.
+ *
+ *  \param p Packet
+ *  \param seg TCP segment in the stream
+ *
+ *  \retval 0 shared data is the same (or no data is shared)
+ *  \retval 1 shared data was different, packet updated
+ */
+int StreamTcpInlineSegmentNormalize(const TcpStream *stream,
+        Packet *p, const TcpSegment *seg)
+{
+    SCEnter();
+
+    if (p == NULL || seg == NULL || p->payload_len == 0) {
+        SCReturnInt(0);
+    }
+
+    const uint32_t pkt_seq = TCP_GET_SEQ(p);
+
+    /* retransmission of the same segment: common case, one compare */
+    if (SEQ_EQ(pkt_seq, seg->seq) && p->payload_len == TCP_SEG_LEN(seg) &&
+        StreamingBufferSegmentCompareRawData(&stream->sb, &seg->sbseg,
+            p->payload, p->payload_len) == 1) {
+        SCReturnInt(0);
+    }
+
+    const uint8_t *seg_data;
+    uint32_t seg_datalen;
+    StreamingBufferSegmentGetData(&stream->sb, &seg->sbseg, &seg_data, &seg_datalen);
+    if (seg_data == NULL || seg_datalen == 0)
+        SCReturnInt(0);
+
+    const uint32_t pkt_end = pkt_seq + p->payload_len;
+    const uint32_t seg_end = seg->seq + seg_datalen;
+    if (SEQ_GEQ(pkt_seq, seg_end) || SEQ_GEQ(seg->seq, pkt_end))
+        SCReturnInt(0);
+
+    /* get the minimal seg*_end */
+    const uint32_t end = (SEQ_GT(pkt_end, seg_end)) ? seg_end : pkt_end;
+    /* and the max seq */
+    const uint32_t seq = (SEQ_LT(pkt_seq, seg->seq)) ? seg->seq : pkt_seq;
+
+    uint8_t *pkt_ptr = p->payload + (seq - pkt_seq);
+    const uint8_t *seg_ptr = seg_data + (seq - seg->seq);
+    const uint32_t range = end - seq;
+    SCLogDebug("seq %u, end %u, range %u", seq, end, range);
+    BUG_ON(range > 65536);
+
+    if (range == 0 || SCMemcmp(pkt_ptr, seg_ptr, range) == 0)
+        SCReturnInt(0);
+
+    for (uint32_t o = 0; o < range; o += INLINE_NORMALIZE_BLOCK) {
+        const uint32_t len = MIN(INLINE_NORMALIZE_BLOCK, range - o);
+        if (SCMemcmp(pkt_ptr + o, seg_ptr + o, len) != 0) {
+            memcpy(pkt_ptr + o, seg_ptr + o, len);
+        }
+    }
+
+    /* flag as modified so we can reinject / replace after
+     * recalculating the checksum */
+    p->flags |= PKT_STREAM_MODIFIED;
+    SCReturnInt(1);
+}
+
 #ifdef UNITTESTS
 #include "tests/stream-tcp-inline.c"
 #endif
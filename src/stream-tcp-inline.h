@@ -30,6 +30,8 @@ int StreamTcpInlineSegmentCompare(const TcpStream *,
         const Packet *, const TcpSegment *);
 void StreamTcpInlineSegmentReplacePacket(const TcpStream *,
         Packet *, const TcpSegment *);
+int StreamTcpInlineSegmentNormalize(const TcpStream *,
+        Packet *, const TcpSegment *);
 
 void StreamTcpInlineRegisterTests(void);
 
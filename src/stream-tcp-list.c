@@ -28,6 +28,7 @@
 #include "stream-tcp-inline.h"
 #include "stream-tcp-list.h"
 #include "util-streaming-buffer.h"
+#include "util-mpm.h"
 #include "util-print.h"
 #include "util-validate.h"
 
@@ -112,6 +113,73 @@ static inline int InsertSegmentDataCustom(TcpStream *stream, TcpSegment *seg, ui
     SCReturnInt(0);
 }
 
+/** \internal
+ *  \brief check if the overlap handling gives the same result no matter
+ *         how the data is split over segments
+ *
+ *  The other policies let the new data win depending on where it starts
+ *  and ends relative to the segment in the tree.
+ */
+static inline bool OverlapPolicyIsSegmentAgnostic(const TcpStream *stream)
+{
+    switch (stream->os_policy) {
+        case OS_POLICY_FIRST:
+        case OS_POLICY_VISTA:
+        case OS_POLICY_LAST:
+            return true;
+    }
+    return false;
+}
+
+/**
+ *  \brief add the data of an in order packet to the last segment
+ *
+ *  Chatty protocols send lots of packets with little data. Instead of a
+ *  segment per packet, the data is added to the last segment as long as
+ *  it stays under stream.reassembly.segment-coalesce-size.
+ *
+ *  \param size payload of 'p' to add
+ *
+ *  \retval 1 the data was added to the last segment
+ *  \retval 0 a new segment is needed
+ */
+int StreamTcpReassembleCoalesceSegment(TcpStream *stream, Packet *p, uint16_t size)
+{
+    TcpSegment *tail = stream->seg_tail;
+    if (stream_config.segment_coalesce_size == 0 || tail == NULL)
+        return 0;
+
+    const uint32_t seq = TCP_GET_SEQ(p);
+    if (!(SEQ_EQ(seq, SEG_SEQ_RIGHT_EDGE(tail)) &&
+          SEQ_EQ(seq, stream->segs_right_edge) &&
+          SEQ_GT(seq, stream->base_seq)))
+        return 0;
+    if ((uint32_t)TCP_SEG_LEN(tail) + size > stream_config.segment_coalesce_size)
+        return 0;
+    /* the whole tail segment needs to be in the buffer */
+    if (tail->sbseg.segment_len != TCP_SEG_LEN(tail) ||
+            StreamingBufferSegmentIsBeforeWindow(&stream->sb, &tail->sbseg))
+        return 0;
+    if (StreamTcpInlineMode() == TRUE || !OverlapPolicyIsSegmentAgnostic(stream))
+        return 0;
+
+    const uint64_t stream_offset = STREAM_BASE_OFFSET(stream) + (seq - stream->base_seq);
+    if (stream_offset != tail->sbseg.stream_offset + tail->sbseg.segment_len)
+        return 0;
+
+    StreamingBufferSegment sbseg;
+    if (StreamingBufferInsertAt(&stream->sb, &sbseg, p->payload, size,
+                stream_offset) != 0)
+        return 0;
+
+    SCLogDebug("seg %p seq %u: added %u bytes of packet %"PRIu64,
+            tail, tail->seq, size, p->pcap_cnt);
+    TCP_SEG_LEN(tail) += size;
+    tail->sbseg.segment_len += size;
+    stream->segs_right_edge += size;
+    return 1;
+}
+
 /** \internal
  *  \brief check if this segments overlaps with an in-tree seg.
  *  \retval true
@@ -176,6 +244,27 @@ static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, TcpSegment **dup
                    "len %" PRIu32 "", seg, seg->seq, TCP_SEG_LEN(seg));
         TCPSEG_RB_INSERT(&stream->seg_tree, seg);
         stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+        stream->seg_tail = seg;
+        stream->segs_cnt++;
+        return 0;
+    }
+
+    /* in order data: the segment starts at or after the right edge of all
+     * segments in the tree, so it can't overlap and it is appended as the
+     * right child of the tail without walking the tree */
+    if (SEQ_GEQ(seg->seq, stream->segs_right_edge)) {
+        TcpSegment *tail = stream->seg_tail;
+        if (tail == NULL)
+            tail = RB_MAX(TCPSEG, &stream->seg_tree);
+        SCLogDebug("in order, appending seg %p seq %" PRIu32 ", "
+                   "len %" PRIu32 " after %p", seg, seg->seq,
+                   TCP_SEG_LEN(seg), tail);
+        RB_SET(seg, tail, rb);
+        RB_RIGHT(tail, rb) = seg;
+        TCPSEG_RB_INSERT_COLOR(&stream->seg_tree, seg);
+        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+        stream->seg_tail = seg;
+        stream->segs_cnt++;
         return 0;
     }
 
@@ -188,8 +277,11 @@ static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, TcpSegment **dup
         *dup_seg = res;
         return 2; // duplicate has overlap by definition.
     } else {
+        stream->segs_cnt++;
         if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), stream->segs_right_edge))
             stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+        if (stream->seg_tail != NULL && TcpSegmentCompare(seg, stream->seg_tail) > 0)
+            stream->seg_tail = seg;
 
         /* insert succeeded, now check if we overlap with someone */
         if (CheckOverlap(&stream->seg_tree, seg) == true) {
@@ -232,9 +324,8 @@ static int DoHandleDataOverlap(TcpStream *stream, const TcpSegment *list,
 
     if (StreamTcpInlineMode()) {
         SCLogDebug("inline mode");
-        if (StreamTcpInlineSegmentCompare(stream, p, list) != 0) {
-            SCLogDebug("already accepted data not the same as packet data, rewrite packet");
-            StreamTcpInlineSegmentReplacePacket(stream, p, list);
+        if (StreamTcpInlineSegmentNormalize(stream, p, list) != 0) {
+            SCLogDebug("already accepted data not the same as packet data, packet rewritten");
             data_is_different = 1;
 
             /* in inline mode we check for different data unconditionally,
@@ -591,6 +682,9 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         /* XXX should we exclude 'retransmissions' here? */
         StatsIncr(tv, ra_ctx->counter_tcp_reass_overlap);
 
+        /* overlap handling may change data the raw mpm has scanned */
+        MpmStreamStateReset(stream->mpm_state);
+
         /* now let's consider the data in the overlap case */
         int res = DoHandleData(tv, ra_ctx, stream, seg, dup_seg, p);
         if (res < 0) {
@@ -725,7 +819,7 @@ static inline uint64_t GetLeftEdge(TcpSession *ssn, TcpStream *stream)
         SCLogDebug("left_edge %"PRIu64", using only app:%"PRIu64,
                 left_edge, STREAM_APP_PROGRESS(stream));
     } else {
-        left_edge = STREAM_BASE_OFFSET(stream) + stream->sb.buf_offset;
+        left_edge = STREAM_BUFFER_RIGHT_EDGE(stream);
         SCLogDebug("no app & raw: left_edge %"PRIu64" (full stream)", left_edge);
     }
 
@@ -786,7 +880,10 @@ static inline uint64_t GetLeftEdge(TcpSession *ssn, TcpStream *stream)
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
+    if (seg == stream->seg_tail)
+        stream->seg_tail = NULL;
     RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
+    stream->segs_cnt--;
 }
 
 /** \brief Remove idle TcpSegments from TcpSession
@@ -890,6 +987,27 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
     SCReturn;
 }
 
+/** \brief Give back the memory an idle session holds on to
+ *
+ *  Prunes both streams, then shrinks their streaming buffers to the
+ *  data they still hold.
+ *
+ *  \param f *locked* flow
+ */
+void StreamTcpCompactSession(Flow *f)
+{
+    if (f == NULL || f->protoctx == NULL) {
+        return;
+    }
+
+    StreamTcpPruneSession(f, STREAM_TOSERVER);
+    StreamTcpPruneSession(f, STREAM_TOCLIENT);
+
+    TcpSession *ssn = f->protoctx;
+    StreamingBufferShrink(&ssn->client.sb);
+    StreamingBufferShrink(&ssn->server.sb);
+}
+
 
 /*
  *  unittests
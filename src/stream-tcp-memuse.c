@@ -0,0 +1,385 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * The memory of a session isn't counted as it is allocated: the streaming
+ * buffer callbacks don't know the session they allocate for. It is
+ * computed from the session when asked, from the segment count kept in
+ * each TcpStream and the sizes of the streaming buffer blocks. Only the
+ * flows in the shared flow hash are considered, the flow tables of the
+ * worker threads are only walked by their owner.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "detect.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-hash.h"
+#include "stream-tcp-private.h"
+#include "stream-tcp-reassemble.h"
+#include "stream-tcp.h"
+#include "stream-tcp-memuse.h"
+#include "app-layer-parser.h"
+#include "app-layer-protos.h"
+
+#include "util-print.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+typedef struct StreamMemuseEntry_ {
+    /** only valid while the flow is locked */
+    const Flow *f;
+    uint64_t stream_memuse;
+    uint64_t app_memuse;
+    uint32_t segs_cnt;
+    /** copied for the report */
+    char src[46];
+    char dst[46];
+    Port sp;
+    Port dp;
+    AppProto alproto;
+} StreamMemuseEntry;
+
+/** the biggest entries seen so far, in descending order */
+typedef struct StreamMemuseTop_ {
+    uint32_t size;
+    uint32_t cnt;
+    StreamMemuseEntry *entries;
+    /** flows skipped as they were locked */
+    uint32_t busy;
+} StreamMemuseTop;
+
+static uint64_t StreamMemuse(const TcpStream *stream)
+{
+    uint64_t size = (uint64_t)stream->segs_cnt * sizeof(TcpSegment);
+    size += StreamingBufferGetMemuse(&stream->sb);
+
+    StreamTcpSackRecord *rec = NULL;
+    RB_FOREACH(rec, TCPSACK, (struct TCPSACK *)&stream->sack_tree) {
+        size += sizeof(*rec);
+    }
+    if (stream->mpm_state != NULL)
+        size += sizeof(MpmStreamState);
+    return size;
+}
+
+/**
+ *  \brief get the memory held by a session and its streams
+ *
+ *  \param ssn session, its flow has to be locked
+ */
+uint64_t StreamTcpSessionMemuse(const TcpSession *ssn)
+{
+    return sizeof(*ssn) + StreamMemuse(&ssn->client) + StreamMemuse(&ssn->server);
+}
+
+/** \internal
+ *  \brief add e to the list if it's among the biggest
+ *
+ *  Ordered by the memory of the streams, which is what evicting frees.
+ */
+static void StreamMemuseTopAdd(StreamMemuseTop *top, const StreamMemuseEntry *e)
+{
+    uint32_t i = top->cnt;
+    if (i == top->size) {
+        if (top->entries[i - 1].stream_memuse >= e->stream_memuse)
+            return;
+        i--;
+    } else {
+        top->cnt++;
+    }
+    while (i > 0 && top->entries[i - 1].stream_memuse < e->stream_memuse) {
+        top->entries[i] = top->entries[i - 1];
+        i--;
+    }
+    top->entries[i] = *e;
+}
+
+static void StreamMemuseSetEntry(StreamMemuseEntry *e, const Flow *f,
+        const TcpSession *ssn, bool report)
+{
+    memset(e, 0, sizeof(*e));
+    e->f = f;
+    e->stream_memuse = StreamTcpSessionMemuse(ssn);
+    e->segs_cnt = ssn->client.segs_cnt + ssn->server.segs_cnt;
+    if (!report)
+        return;
+
+    e->app_memuse = AppLayerParserGetStateMemuse(f);
+    e->sp = f->sp;
+    e->dp = f->dp;
+    e->alproto = f->alproto;
+    if (FLOW_IS_IPV4(f)) {
+        PrintInet(AF_INET, (const void *)&f->src.addr_data32[0], e->src, sizeof(e->src));
+        PrintInet(AF_INET, (const void *)&f->dst.addr_data32[0], e->dst, sizeof(e->dst));
+    } else {
+        PrintInet(AF_INET6, (const void *)&f->src.address, e->src, sizeof(e->src));
+        PrintInet(AF_INET6, (const void *)&f->dst.address, e->dst, sizeof(e->dst));
+    }
+}
+
+static bool StreamMemuseIsEvicted(const TcpSession *ssn)
+{
+    return (ssn->client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY) &&
+           (ssn->server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
+}
+
+/** \internal
+ *  \brief collect the biggest sessions of the flow hash
+ *
+ *  \param report false to only collect the sessions that can be evicted */
+static void StreamMemuseCollect(StreamMemuseTop *top, bool report)
+{
+    for (uint32_t u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        FBLOCK_LOCK(fb);
+        for (Flow *f = fb->head; f != NULL; f = f->hnext) {
+            if (f->proto != IPPROTO_TCP)
+                continue;
+            if (FLOWLOCK_TRYRDLOCK(f) != 0) {
+                top->busy++;
+                continue;
+            }
+            const TcpSession *ssn = f->protoctx;
+            if (ssn != NULL && (report || !StreamMemuseIsEvicted(ssn))) {
+                StreamMemuseEntry e;
+                StreamMemuseSetEntry(&e, f, ssn, report);
+                StreamMemuseTopAdd(top, &e);
+            }
+            FLOWLOCK_UNLOCK(f);
+        }
+        FBLOCK_UNLOCK(fb);
+    }
+}
+
+/** \internal
+ *  \brief stop reassembly of a session and free its segments and buffers
+ *
+ *  Like reaching the depth, but for both directions at once.
+ */
+static void StreamMemuseEvictSession(Flow *f, TcpSession *ssn)
+{
+    StreamTcpDisableAppLayer(f);
+    TcpStream *streams[2] = { &ssn->client, &ssn->server };
+    for (int i = 0; i < 2; i++) {
+        TcpStream *stream = streams[i];
+        stream->flags |= STREAMTCP_STREAM_FLAG_NOREASSEMBLY|
+                         STREAMTCP_STREAM_FLAG_DISABLE_RAW;
+        StreamTcpReturnStreamSegments(stream);
+        StreamingBufferClear(&stream->sb);
+    }
+}
+
+static bool StreamMemuseOverTarget(void)
+{
+    const uint64_t memcap = StreamTcpReassembleGetMemcap();
+    if (memcap == 0)
+        return false;
+    return (StreamTcpReassembleMemuseGlobalCounter() >=
+            memcap / 100 * STREAM_MEMUSE_EVICT_PCT);
+}
+
+/**
+ *  \brief free the reassembly data of the biggest sessions if the
+ *         reassembly memuse is near the memcap
+ *
+ *  Called by the flow manager. The biggest sessions are found first,
+ *  then the flows holding at least as much as the smallest of them are
+ *  evicted in a second walk, as they can't be kept locked in between.
+ *
+ *  \retval cnt number of sessions evicted
+ */
+uint32_t StreamTcpMemuseEvict(void)
+{
+    if (!stream_config.memcap_evict || flow_hash == NULL ||
+            !StreamMemuseOverTarget())
+        return 0;
+
+    StreamMemuseEntry entries[STREAM_MEMUSE_EVICT_MAX];
+    StreamMemuseTop top = { STREAM_MEMUSE_EVICT_MAX, 0, entries, 0 };
+    StreamMemuseCollect(&top, false);
+    if (top.cnt == 0)
+        return 0;
+    const uint64_t threshold = top.entries[top.cnt - 1].stream_memuse;
+
+    uint32_t cnt = 0;
+    for (uint32_t u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        if (FBLOCK_TRYLOCK(fb) != 0)
+            continue;
+        for (Flow *f = fb->head; f != NULL; f = f->hnext) {
+            if (f->proto != IPPROTO_TCP)
+                continue;
+            if (FLOWLOCK_TRYWRLOCK(f) != 0)
+                continue;
+            TcpSession *ssn = f->protoctx;
+            if (ssn != NULL && !StreamMemuseIsEvicted(ssn) &&
+                    StreamTcpSessionMemuse(ssn) >= threshold) {
+                SCLogDebug("evicting ssn %p, memuse %"PRIu64, ssn,
+                        StreamTcpSessionMemuse(ssn));
+                StreamMemuseEvictSession(f, ssn);
+                cnt++;
+            }
+            FLOWLOCK_UNLOCK(f);
+            if (cnt == STREAM_MEMUSE_EVICT_MAX)
+                break;
+        }
+        FBLOCK_UNLOCK(fb);
+        if (cnt == STREAM_MEMUSE_EVICT_MAX || !StreamMemuseOverTarget())
+            break;
+    }
+    return cnt;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ *  \brief unix socket command listing the flows holding the most memory
+ *
+ *  Takes an optional "count" argument, the number of flows to list.
+ */
+TmEcode StreamTcpMemuseTopCommand(json_t *cmd, json_t *answer, void *data)
+{
+    uint32_t size = STREAM_MEMUSE_TOP_DEFAULT;
+    json_t *jarg = json_object_get(cmd, "count");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > STREAM_MEMUSE_TOP_MAX) {
+            json_object_set_new(answer, "message",
+                    json_string("count is not an integer between 1 and 100"));
+            return TM_ECODE_FAILED;
+        }
+        size = (uint32_t)json_integer_value(jarg);
+    }
+    if (flow_hash == NULL) {
+        json_object_set_new(answer, "message", json_string("no flow hash"));
+        return TM_ECODE_FAILED;
+    }
+
+    StreamMemuseEntry *entries = SCCalloc(size, sizeof(*entries));
+    json_t *jdata = json_object();
+    json_t *jflows = json_array();
+    if (entries == NULL || jdata == NULL || jflows == NULL) {
+        SCFree(entries);
+        if (jdata != NULL)
+            json_decref(jdata);
+        if (jflows != NULL)
+            json_decref(jflows);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    StreamMemuseTop top = { size, 0, entries, 0 };
+    StreamMemuseCollect(&top, true);
+
+    for (uint32_t i = 0; i < top.cnt; i++) {
+        const StreamMemuseEntry *e = &top.entries[i];
+        json_t *jf = json_object();
+        if (jf == NULL)
+            continue;
+        json_object_set_new(jf, "src_ip", json_string(e->src));
+        json_object_set_new(jf, "src_port", json_integer(e->sp));
+        json_object_set_new(jf, "dest_ip", json_string(e->dst));
+        json_object_set_new(jf, "dest_port", json_integer(e->dp));
+        json_object_set_new(jf, "app_proto", json_string(AppProtoToString(e->alproto)));
+        json_object_set_new(jf, "segments", json_integer(e->segs_cnt));
+        json_object_set_new(jf, "stream_memuse", json_integer(e->stream_memuse));
+        json_object_set_new(jf, "app_memuse", json_integer(e->app_memuse));
+        json_object_set_new(jf, "memuse",
+                json_integer(e->stream_memuse + e->app_memuse));
+        json_array_append_new(jflows, jf);
+    }
+    SCFree(entries);
+
+    json_object_set_new(jdata, "reassembly_memuse",
+            json_integer(StreamTcpReassembleMemuseGlobalCounter()));
+    json_object_set_new(jdata, "reassembly_memcap",
+            json_integer(StreamTcpReassembleGetMemcap()));
+    json_object_set_new(jdata, "flows_busy", json_integer(top.busy));
+    json_object_set_new(jdata, "flows", jflows);
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+#include "stream-tcp-util.h"
+
+/** \test list keeps the biggest entries in descending order */
+static int StreamTcpMemuseTest01(void)
+{
+    StreamMemuseEntry entries[3];
+    StreamMemuseTop top = { 3, 0, entries, 0 };
+    const uint64_t sizes[] = { 10, 50, 20, 5, 40, 50 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        StreamMemuseEntry e;
+        memset(&e, 0, sizeof(e));
+        e.stream_memuse = sizes[i];
+        StreamMemuseTopAdd(&top, &e);
+    }
+    FAIL_IF_NOT(top.cnt == 3);
+    FAIL_IF_NOT(top.entries[0].stream_memuse == 50);
+    FAIL_IF_NOT(top.entries[1].stream_memuse == 50);
+    FAIL_IF_NOT(top.entries[2].stream_memuse == 40);
+    PASS;
+}
+
+/** \test session memuse follows its segments */
+static int StreamTcpMemuseTest02(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    memset(&tv, 0, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    StreamTcpUTSetupStream(&ssn.server, 1);
+
+    const uint64_t empty = StreamTcpSessionMemuse(&ssn);
+    FAIL_IF_NOT(empty == sizeof(TcpSession));
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 2, 'A', 100) == -1);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 102, 'B', 100) == -1);
+    FAIL_IF_NOT(ssn.client.segs_cnt == 2);
+    FAIL_IF_NOT(StreamTcpSessionMemuse(&ssn) >= empty + 2 * sizeof(TcpSegment) + 200);
+
+    StreamTcpReturnStreamSegments(&ssn.client);
+    FAIL_IF_NOT(ssn.client.segs_cnt == 0);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void StreamTcpMemuseRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StreamTcpMemuseTest01", StreamTcpMemuseTest01);
+    UtRegisterTest("StreamTcpMemuseTest02", StreamTcpMemuseTest02);
+#endif
+}
@@ -0,0 +1,54 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory use per TCP session.
+ *
+ * The memory of a session is its TcpSession, the segments and streaming
+ * buffers of both streams and the app-layer state, for the parsers that
+ * can tell. The 'stream-memuse-top' unix socket command lists the flows
+ * holding the most. With stream.reassembly.memcap-evict the flow manager
+ * frees the reassembly data of the biggest sessions when the reassembly
+ * memuse gets close to the memcap.
+ */
+
+#ifndef __STREAM_TCP_MEMUSE_H__
+#define __STREAM_TCP_MEMUSE_H__
+
+#include "tm-threads-common.h"
+#include "stream-tcp-private.h"
+
+/** start evicting at this percentage of stream.reassembly.memcap */
+#define STREAM_MEMUSE_EVICT_PCT         90
+/** max sessions to evict per flow manager run */
+#define STREAM_MEMUSE_EVICT_MAX         8
+
+#define STREAM_MEMUSE_TOP_DEFAULT       10
+#define STREAM_MEMUSE_TOP_MAX           100
+
+uint64_t StreamTcpSessionMemuse(const TcpSession *ssn);
+uint32_t StreamTcpMemuseEvict(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode StreamTcpMemuseTopCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void StreamTcpMemuseRegisterTests(void);
+
+#endif /* __STREAM_TCP_MEMUSE_H__ */
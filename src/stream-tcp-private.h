@@ -121,16 +121,25 @@ typedef struct TcpStream_ {
     StreamingBuffer sb;
     struct TCPSEG seg_tree;         /**< red black tree of TCP segments. Data is stored in TcpStream::sb */
     uint32_t segs_right_edge;
+    TcpSegment *seg_tail;           /**< segment with the highest seq in seg_tree, or NULL
+                                     *   if it is not known */
+    uint32_t segs_cnt;              /**< number of segments in seg_tree */
 
     uint32_t sack_size;             /**< combined size of the SACK ranges currently in our tree. Updated
                                      *   at INSERT/REMOVE time. */
     struct TCPSACK sack_tree;       /**< red back tree of TCP SACK records. */
+    uint32_t sack_hole_ack;         /**< last_ack the receiver keeps SACK'ing past */
+    uint16_t sack_hole_acks;        /**< number of packets that did so */
+
+    struct MpmStreamState_ *mpm_state; /**< raw stream mpm scan state, see
+                                        *   detect.prefilter.stream-state */
 } TcpStream;
 
 #define STREAM_BASE_OFFSET(stream)  ((stream)->sb.stream_offset)
 #define STREAM_APP_PROGRESS(stream) (STREAM_BASE_OFFSET((stream)) + (stream)->app_progress_rel)
 #define STREAM_RAW_PROGRESS(stream) (STREAM_BASE_OFFSET((stream)) + (stream)->raw_progress_rel)
 #define STREAM_LOG_PROGRESS(stream) (STREAM_BASE_OFFSET((stream)) + (stream)->log_progress_rel)
+#define STREAM_BUFFER_RIGHT_EDGE(stream) StreamingBufferGetRightEdge(&(stream)->sb)
 
 /* from /usr/include/netinet/tcp.h */
 enum
@@ -163,7 +172,8 @@ enum
 #define STREAMTCP_FLAG_TIMESTAMP                    0x0008
 /** Server supports wscale (even though it can be 0) */
 #define STREAMTCP_FLAG_SERVER_WSCALE                0x0010
-// vacancy
+/** Reassembly depth was lowered by the app layer */
+#define STREAMTCP_FLAG_DEPTH_LIMITED                0x0020
 /** Flag to indicate that the session is handling asynchronous stream.*/
 #define STREAMTCP_FLAG_ASYNC                        0x0040
 /** Flag to indicate we're dealing with 4WHS: SYN, SYN, SYN/ACK, ACK
@@ -176,7 +186,8 @@ enum
 #define STREAMTCP_FLAG_CLIENT_SACKOK                0x0200
 /** Flag to indicate both sides of the session permit SACK (SYN + SYN/ACK) */
 #define STREAMTCP_FLAG_SACKOK                       0x0400
-// vacancy
+/** Reassembly depth is set for a rule, it's not lowered anymore */
+#define STREAMTCP_FLAG_DEPTH_REQUIRED               0x0800
 /** 3WHS confirmed by server -- if suri sees 3whs ACK but server doesn't (pkt
  *  is lost on the way to server), SYN/ACK is retransmitted. If server sends
  *  normal packet we assume 3whs to be completed. Only used for SYN/ACK resend
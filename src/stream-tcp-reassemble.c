@@ -40,11 +40,13 @@
 #include "tm-threads.h"
 
 #include "util-pool.h"
+#include "util-memcap.h"
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-host-os-info.h"
 #include "util-unittest-helper.h"
 #include "util-byte.h"
+#include "util-misc.h"
 #include "util-device.h"
 
 #include "stream-tcp.h"
@@ -53,6 +55,7 @@
 #include "stream-tcp-inline.h"
 #include "stream-tcp-list.h"
 #include "stream-tcp-util.h"
+#include "stream-tcp-sack.h"
 
 #include "stream.h"
 
@@ -65,6 +68,9 @@
 
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-trace.h"
+
+#include "flow-cost.h"
 
 #ifdef DEBUG
 static SCMutex segment_pool_memuse_mutex;
@@ -77,7 +83,7 @@ static PoolThread *segment_thread_pool = NULL;
 static SCMutex segment_thread_pool_mutex = SCMUTEX_INITIALIZER;
 
 /* Memory use counter */
-SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
+static MemcapCounter ra_memuse;
 
 /* prototypes */
 TcpSegment *StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *);
@@ -86,7 +92,7 @@ void StreamTcpReassemblePseudoPacketCreate(TcpStream *, Packet *, PacketQueue *)
 
 void StreamTcpReassembleInitMemuse(void)
 {
-    SC_ATOMIC_INIT(ra_memuse);
+    MemcapCounterInit(&ra_memuse, 0);
 }
 
 /**
@@ -97,7 +103,7 @@ void StreamTcpReassembleInitMemuse(void)
  */
 void StreamTcpReassembleIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(ra_memuse, size);
+    MemcapCounterIncr(&ra_memuse, size);
     SCLogDebug("REASSEMBLY %"PRIu64", incr %"PRIu64, StreamTcpReassembleMemuseGlobalCounter(), size);
     return;
 }
@@ -111,17 +117,17 @@ void StreamTcpReassembleIncrMemuse(uint64_t size)
 void StreamTcpReassembleDecrMemuse(uint64_t size)
 {
 #ifdef UNITTESTS
-    uint64_t presize = SC_ATOMIC_GET(ra_memuse);
+    uint64_t presize = MemcapCounterGet(&ra_memuse);
     if (RunmodeIsUnittests()) {
         BUG_ON(presize > UINT_MAX);
     }
 #endif
 
-    (void) SC_ATOMIC_SUB(ra_memuse, size);
+    MemcapCounterDecr(&ra_memuse, size);
 
 #ifdef UNITTESTS
     if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(ra_memuse);
+        uint64_t postsize = MemcapCounterGet(&ra_memuse);
         BUG_ON(postsize > presize);
     }
 #endif
@@ -131,7 +137,7 @@ void StreamTcpReassembleDecrMemuse(uint64_t size)
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
 {
-    uint64_t smemuse = SC_ATOMIC_GET(ra_memuse);
+    uint64_t smemuse = MemcapCounterGet(&ra_memuse);
     return smemuse;
 }
 
@@ -146,9 +152,9 @@ uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
 int StreamTcpReassembleCheckMemcap(uint64_t size)
 {
     uint64_t memcapcopy = SC_ATOMIC_GET(stream_config.reassembly_memcap);
-    if (memcapcopy == 0 ||
-        (uint64_t)((uint64_t)size + SC_ATOMIC_GET(ra_memuse)) <= memcapcopy)
+    if (memcapcopy == 0 || MemcapCounterCheck(&ra_memuse, size, memcapcopy))
         return 1;
+    SCTrace2(memcap_hit, "stream.reassembly", memcapcopy);
     return 0;
 }
 
@@ -159,7 +165,7 @@ int StreamTcpReassembleCheckMemcap(uint64_t size)
  */
 int StreamTcpReassembleSetMemcap(uint64_t size)
 {
-    if (size == 0 || (uint64_t)SC_ATOMIC_GET(ra_memuse) < size) {
+    if (size == 0 || (uint64_t)MemcapCounterGet(&ra_memuse) < size) {
         SC_ATOMIC_SET(stream_config.reassembly_memcap, size);
         return 1;
     }
@@ -320,6 +326,8 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
         RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
         StreamTcpSegmentReturntoPool(seg);
     }
+    stream->seg_tail = NULL;
+    stream->segs_cnt = 0;
 }
 
 #ifdef UNITTESTS
@@ -373,6 +381,39 @@ static int StreamTcpReassemblyConfig(char quiet)
         SCLogConfig("stream.reassembly \"segment-prealloc\": %u", segment_prealloc);
     stream_config.prealloc_segments = segment_prealloc;
 
+    uint32_t coalesce_size = 0;
+    const char *coalesce_size_str = NULL;
+    if (ConfGetValue("stream.reassembly.segment-coalesce-size", &coalesce_size_str) == 1) {
+        if (ParseSizeStringU32(coalesce_size_str, &coalesce_size) < 0 ||
+                coalesce_size > UINT16_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "segment-coalesce-size of "
+                    "%s is invalid, max is %u", coalesce_size_str, UINT16_MAX);
+            return -1;
+        }
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"segment-coalesce-size\": %"PRIu32, coalesce_size);
+    stream_config.segment_coalesce_size = (uint16_t)coalesce_size;
+
+    int memcap_evict = 0;
+    ConfGetBool("stream.reassembly.memcap-evict", &memcap_evict);
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"memcap-evict\": %s",
+                memcap_evict ? "enabled" : "disabled");
+    stream_config.memcap_evict = memcap_evict ? true : false;
+
+    intmax_t sack_gap_acks = 0;
+    if (ConfGetInt("stream.reassembly.sack-gap-acks", &sack_gap_acks) == 1) {
+        if (sack_gap_acks < 0 || sack_gap_acks > UINT16_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "sack-gap-acks of "
+                    "%"PRIdMAX" is invalid, max is %u", sack_gap_acks, UINT16_MAX);
+            return -1;
+        }
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"sack-gap-acks\": %"PRIdMAX, sack_gap_acks);
+    stream_config.sack_gap_acks = (uint16_t)sack_gap_acks;
+
     int overlap_diff_data = 0;
     ConfGetBool("stream.reassembly.check-overlap-different-data", &overlap_diff_data);
     if (overlap_diff_data) {
@@ -389,6 +430,20 @@ static int StreamTcpReassemblyConfig(char quiet)
     stream_config.sbcnf.Realloc = ReassembleRealloc;
     stream_config.sbcnf.Free = ReassembleFree;
 
+    uint32_t region_gap = STREAMING_BUFFER_REGION_GAP_DEFAULT;
+    const char *region_gap_str = NULL;
+    if (ConfGetValue("stream.reassembly.region-gap", &region_gap_str) == 1) {
+        if (ParseSizeStringU32(region_gap_str, &region_gap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                    "stream.reassembly.region-gap from conf file - %s",
+                    region_gap_str);
+            return -1;
+        }
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"region-gap\": %"PRIu32, region_gap);
+    stream_config.sbcnf.region_gap = region_gap;
+
     return 0;
 }
 
@@ -630,6 +685,10 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         /* increment stream depth counter */
         StatsIncr(tv, ra_ctx->counter_tcp_stream_depth);
     }
+    if ((ssn->flags & STREAMTCP_FLAG_DEPTH_LIMITED) && size < p->payload_len) {
+        StatsAddUI64(tv, ra_ctx->counter_tcp_reass_depth_limited,
+                p->payload_len - size);
+    }
     if (size == 0) {
         SCLogDebug("ssn %p: depth reached, not reassembling", ssn);
         SCReturnInt(0);
@@ -639,6 +698,11 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     if (size > p->payload_len)
         size = p->payload_len;
 
+    if (StreamTcpReassembleCoalesceSegment(stream, p, (uint16_t)size) == 1) {
+        StatsIncr(tv, ra_ctx->counter_tcp_reass_coalesced);
+        SCReturnInt(0);
+    }
+
     TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx);
     if (seg == NULL) {
         SCLogDebug("segment_pool is empty");
@@ -705,6 +769,27 @@ static uint8_t StreamGetAppLayerFlags(TcpSession *ssn, TcpStream *stream,
     return flag;
 }
 
+/** \internal
+ *  \brief get the size of the ack'd data beyond base_seq
+ *
+ *  Normally up to last_ack, but if the receiver keeps SACK'ing past a
+ *  hole we consider lost, up to the right edge of the SACK'd data after
+ *  it. See StreamTcpSackGetAckEdge().
+ *
+ *  \retval delta 0 if nothing beyond base_seq is ack'd
+ */
+static inline uint32_t GetAckDelta(const TcpStream *stream)
+{
+    const uint32_t ack = StreamTcpSackGetAckEdge(stream);
+    if (ack == stream->last_ack) {
+        if (!STREAM_LASTACK_GT_BASESEQ(stream))
+            return 0;
+    } else if (SEQ_LEQ(ack, stream->base_seq)) {
+        return 0;
+    }
+    return ack - stream->base_seq;
+}
+
 /**
  *  \brief Check the minimum size limits for reassembly.
  *
@@ -747,8 +832,8 @@ static int StreamTcpReassembleRawCheckLimit(const TcpSession *ssn,
 
     /* check if we have enough data to do raw reassembly */
     if (PKT_IS_TOSERVER(p)) {
-        if (STREAM_LASTACK_GT_BASESEQ(stream)) {
-            uint32_t delta = stream->last_ack - stream->base_seq;
+        const uint32_t delta = GetAckDelta(stream);
+        if (delta > 0) {
             /* get max absolute offset */
             uint64_t max_offset = STREAM_BASE_OFFSET(stream) + delta;
 
@@ -765,8 +850,8 @@ static int StreamTcpReassembleRawCheckLimit(const TcpSession *ssn,
             }
         }
     } else {
-        if (STREAM_LASTACK_GT_BASESEQ(stream)) {
-            uint32_t delta = stream->last_ack - stream->base_seq;
+        const uint32_t delta = GetAckDelta(stream);
+        if (delta > 0) {
             /* get max absolute offset */
             uint64_t max_offset = STREAM_BASE_OFFSET(stream) + delta;
 
@@ -824,7 +909,7 @@ int StreamNeedsReassembly(const TcpSession *ssn, uint8_t direction)
         use_raw = 0;
     }
 
-    uint64_t right_edge = STREAM_BASE_OFFSET(stream) + stream->sb.buf_offset;
+    uint64_t right_edge = STREAM_BUFFER_RIGHT_EDGE(stream);
 
     SCLogDebug("%s: app %"PRIu64" (use: %s), raw %"PRIu64" (use: %s). Stream right edge: %"PRIu64,
             dirstr,
@@ -941,9 +1026,10 @@ static inline bool CheckGap(TcpSession *ssn, TcpStream *stream, Packet *p)
     const uint64_t app_progress = STREAM_APP_PROGRESS(stream);
     uint64_t last_ack_abs = STREAM_BASE_OFFSET(stream);
 
-    if (STREAM_LASTACK_GT_BASESEQ(stream)) {
-        /* get window of data that is acked */
-        const uint32_t delta = stream->last_ack - stream->base_seq;
+    /* get window of data that is acked */
+    const uint32_t delta = GetAckDelta(stream);
+    if (delta > 0) {
+        const uint32_t ack = stream->base_seq + delta;
         DEBUG_VALIDATE_BUG_ON(delta > 10000000ULL && delta > stream->window);
         /* get max absolute offset */
         last_ack_abs += delta;
@@ -951,7 +1037,7 @@ static inline bool CheckGap(TcpSession *ssn, TcpStream *stream, Packet *p)
         const int ackadded = (ssn->state >= TCP_FIN_WAIT1) ? 1 : 0;
         last_ack_abs -= ackadded;
 
-        SCLogDebug("last_ack %u abs %"PRIu64, stream->last_ack, last_ack_abs);
+        SCLogDebug("ack %u abs %"PRIu64, ack, last_ack_abs);
         SCLogDebug("next_seq %u", stream->next_seq);
 
         /* if last_ack_abs is beyond the app_progress data that we haven't seen
@@ -960,11 +1046,11 @@ static inline bool CheckGap(TcpSession *ssn, TcpStream *stream, Packet *p)
             /* however, we can accept ACKs a bit too liberally. If last_ack
              * is beyond next_seq, we only consider it a gap now if we do
              * already have data beyond the gap. */
-            if (SEQ_GT(stream->last_ack, stream->next_seq)) {
+            if (SEQ_GT(ack, stream->next_seq)) {
                 if (RB_EMPTY(&stream->sb.sbb_tree)) {
                     SCLogDebug("packet %"PRIu64": no GAP. "
-                            "next_seq %u < last_ack %u, but no data in list",
-                            p->pcap_cnt, stream->next_seq, stream->last_ack);
+                            "next_seq %u < ack %u, but no data in list",
+                            p->pcap_cnt, stream->next_seq, ack);
                     return false;
                 } else {
                     const uint64_t next_seq_abs = STREAM_BASE_OFFSET(stream) + (stream->next_seq - stream->base_seq);
@@ -972,8 +1058,8 @@ static inline bool CheckGap(TcpSession *ssn, TcpStream *stream, Packet *p)
                     if (blk->offset > next_seq_abs && blk->offset < last_ack_abs) {
                         /* ack'd data after the gap */
                         SCLogDebug("packet %"PRIu64": GAP. "
-                                "next_seq %u < last_ack %u, but ACK'd data beyond gap.",
-                                p->pcap_cnt, stream->next_seq, stream->last_ack);
+                                "next_seq %u < ack %u, but ACK'd data beyond gap.",
+                                p->pcap_cnt, stream->next_seq, ack);
                         return true;
                     }
                 }
@@ -1014,13 +1100,19 @@ static int ReassembleUpdateAppLayer (ThreadVars *tv,
         if (mydata == NULL && mydata_len > 0 && CheckGap(ssn, stream, p)) {
             SCLogDebug("sending GAP to app-layer (size: %u)", mydata_len);
 
+            FlowCost *fcost = FlowCostGet(p->flow);
+            FLOW_COST_START_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
             int r = AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
                     NULL, mydata_len,
                     StreamGetAppLayerFlags(ssn, stream, p, dir)|STREAM_GAP);
+            FLOW_COST_END_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
             AppLayerProfilingStore(ra_ctx->app_tctx, p);
 
             StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEQ_GAP);
             StatsIncr(tv, ra_ctx->counter_tcp_reass_gap);
+            SCTrace2(stream_gap, p->flow, mydata_len);
+            if (StreamTcpSackGetAckEdge(stream) != stream->last_ack)
+                StatsIncr(tv, ra_ctx->counter_tcp_reass_sack_gap);
 
             stream->app_progress_rel += mydata_len;
             app_progress += mydata_len;
@@ -1047,9 +1139,9 @@ static int ReassembleUpdateAppLayer (ThreadVars *tv,
             // fall through, we use all available data
         } else {
             uint64_t last_ack_abs = app_progress; /* absolute right edge of ack'd data */
-            if (STREAM_LASTACK_GT_BASESEQ(stream)) {
-                /* get window of data that is acked */
-                uint32_t delta = stream->last_ack - stream->base_seq;
+            /* get window of data that is acked */
+            const uint32_t delta = GetAckDelta(stream);
+            if (delta > 0) {
                 DEBUG_VALIDATE_BUG_ON(delta > 10000000ULL && delta > stream->window);
                 /* get max absolute offset */
                 last_ack_abs += delta;
@@ -1066,10 +1158,14 @@ static int ReassembleUpdateAppLayer (ThreadVars *tv,
         }
     }
 
-    /* update the app-layer */
+    /* update the app-layer. It may reassemble the opposing stream itself,
+     * so the app-layer ticks counted in there are excluded here. */
+    FlowCost *fcost = FlowCostGet(p->flow);
+    FLOW_COST_START_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
     int r = AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
             (uint8_t *)mydata, mydata_len,
             StreamGetAppLayerFlags(ssn, stream, p, dir));
+    FLOW_COST_END_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
     AppLayerProfilingStore(ra_ctx->app_tctx, p);
 
     /* see if we can update the progress */
@@ -1127,9 +1223,12 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         if (ssn->state >= TCP_CLOSING || (p->flags & PKT_PSEUDO_STREAM_END)) {
             SCLogDebug("sending empty eof message");
             /* send EOF to app layer */
+            FlowCost *fcost = FlowCostGet(p->flow);
+            FLOW_COST_START_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
             AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
                                   NULL, 0,
                                   StreamGetAppLayerFlags(ssn, stream, p, dir));
+            FLOW_COST_END_EXCL(fcost, FLOW_COST_APPLAYER, FLOW_COST_APPLAYER);
             AppLayerProfilingStore(ra_ctx->app_tctx, p);
 
             SCReturnInt(0);
@@ -1231,7 +1330,7 @@ bool StreamReassembleRawHasDataReady(TcpSession *ssn, Packet *p)
         return false;
 
     if (StreamTcpInlineMode() == FALSE) {
-        if ((STREAM_RAW_PROGRESS(stream) == STREAM_BASE_OFFSET(stream) + stream->sb.buf_offset)) {
+        if ((STREAM_RAW_PROGRESS(stream) == STREAM_BUFFER_RIGHT_EDGE(stream))) {
             return false;
         }
         if (StreamTcpReassembleRawCheckLimit(ssn, stream, p) == 1) {
@@ -1298,7 +1397,7 @@ void StreamReassembleRawUpdateProgress(TcpSession *ssn, Packet *p, uint64_t prog
     /* app is dead */
     } else if (progress == 0) {
         uint64_t tcp_window = stream->window;
-        uint64_t stream_right_edge = STREAM_BASE_OFFSET(stream) + stream->sb.buf_offset;
+        uint64_t stream_right_edge = STREAM_BUFFER_RIGHT_EDGE(stream);
         if (tcp_window < stream_right_edge) {
             uint64_t new_raw = stream_right_edge - tcp_window;
             if (new_raw > STREAM_RAW_PROGRESS(stream)) {
@@ -1469,7 +1568,7 @@ static int StreamReassembleRawInline(TcpSession *ssn, const Packet *p,
     }
 
     /* run the callback */
-    r = Callback(cb_data, mydata, mydata_len);
+    r = Callback(cb_data, mydata, mydata_len, mydata_offset);
     BUG_ON(r < 0);
 
     if (return_progress) {
@@ -1481,8 +1580,8 @@ static int StreamReassembleRawInline(TcpSession *ssn, const Packet *p,
          *   our block.
          */
         uint64_t last_ack_abs = STREAM_BASE_OFFSET(stream);
-        if (STREAM_LASTACK_GT_BASESEQ(stream)) {
-            uint32_t delta = stream->last_ack - stream->base_seq;
+        const uint32_t delta = GetAckDelta(stream);
+        if (delta > 0) {
             DEBUG_VALIDATE_BUG_ON(delta > 10000000ULL && delta > stream->window);
             /* get max absolute offset */
             last_ack_abs += delta;
@@ -1569,9 +1668,9 @@ static int StreamReassembleRawDo(TcpSession *ssn, TcpStream *stream,
     SCLogDebug("progress %"PRIu64", min inspect depth %u %s", progress, stream->min_inspect_depth, stream->flags & STREAMTCP_STREAM_FLAG_TRIGGER_RAW ? "STREAMTCP_STREAM_FLAG_TRIGGER_RAW":"(no trigger)");
 
     /* get window of data that is acked */
-    if (STREAM_LASTACK_GT_BASESEQ(stream)) {
+    const uint32_t delta = GetAckDelta(stream);
+    if (delta > 0) {
         SCLogDebug("last_ack %u, base_seq %u", stream->last_ack, stream->base_seq);
-        uint32_t delta = stream->last_ack - stream->base_seq;
         DEBUG_VALIDATE_BUG_ON(delta > 10000000ULL && delta > stream->window);
         /* get max absolute offset */
         last_ack_abs += delta;
@@ -1623,7 +1722,7 @@ static int StreamReassembleRawDo(TcpSession *ssn, TcpStream *stream,
         SCLogDebug("data %p len %u", mydata, mydata_len);
 
         /* we have data. */
-        r = Callback(cb_data, mydata, mydata_len);
+        r = Callback(cb_data, mydata, mydata_len, mydata_offset);
         BUG_ON(r < 0);
 
         if (mydata_offset == progress) {
@@ -2856,15 +2955,15 @@ static int StreamTcpReassembleTest40 (void)
 static int StreamTcpReassembleTest44(void)
 {
     StreamTcpInitConfig(TRUE);
-    uint32_t memuse = SC_ATOMIC_GET(ra_memuse);
+    uint32_t memuse = MemcapCounterGet(&ra_memuse);
     StreamTcpReassembleIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != (memuse+500));
+    FAIL_IF(MemcapCounterGet(&ra_memuse) != (memuse+500));
     StreamTcpReassembleDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != memuse);
+    FAIL_IF(MemcapCounterGet(&ra_memuse) != memuse);
     FAIL_IF(StreamTcpReassembleCheckMemcap(500) != 1);
     FAIL_IF(StreamTcpReassembleCheckMemcap((1 + memuse + SC_ATOMIC_GET(stream_config.reassembly_memcap))) != 0);
     StreamTcpFreeConfig(TRUE);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != 0);
+    FAIL_IF(MemcapCounterGet(&ra_memuse) != 0);
     PASS;
 }
 
@@ -68,6 +68,8 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_stream_depth;
     /** count number of streams with a unrecoverable stream gap (missing pkts) */
     uint16_t counter_tcp_reass_gap;
+    /** of those, gaps reported early because the receiver SACK'd past them */
+    uint16_t counter_tcp_reass_sack_gap;
 
     /** count packet data overlaps */
     uint16_t counter_tcp_reass_overlap;
@@ -77,6 +79,10 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_reass_data_normal_fail;
     uint16_t counter_tcp_reass_data_overlap_fail;
     uint16_t counter_tcp_reass_list_fail;
+    /** count packets of which the data was added to the previous segment */
+    uint16_t counter_tcp_reass_coalesced;
+    /** bytes not reassembled as the app layer lowered the depth */
+    uint16_t counter_tcp_reass_depth_limited;
 } TcpReassemblyThreadCtx;
 
 #define OS_POLICY_DEFAULT   OS_POLICY_BSD
@@ -103,6 +109,7 @@ void StreamTcpSetOSPolicy(TcpStream *, Packet *);
 int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         TcpSession *ssn, TcpStream *stream, Packet *p);
 int StreamTcpReassembleInsertSegment(ThreadVars *, TcpReassemblyThreadCtx *, TcpStream *, TcpSegment *, Packet *, uint32_t pkt_seq, uint8_t *pkt_data, uint16_t pkt_datalen);
+int StreamTcpReassembleCoalesceSegment(TcpStream *, Packet *, uint16_t);
 TcpSegment *StreamTcpGetSegment(ThreadVars *, TcpReassemblyThreadCtx *);
 
 void StreamTcpReturnStreamSegments(TcpStream *);
@@ -111,6 +118,7 @@ void StreamTcpSegmentReturntoPool(TcpSegment *);
 void StreamTcpReassembleTriggerRawReassembly(TcpSession *, int direction);
 
 void StreamTcpPruneSession(Flow *, uint8_t);
+void StreamTcpCompactSession(Flow *);
 int StreamTcpReassembleDepthReached(Packet *p);
 
 void StreamTcpReassembleIncrMemuse(uint64_t size);
@@ -246,6 +246,50 @@ static int StreamTcpSackInsertRange(TcpStream *stream, uint32_t le, uint32_t re)
  *  \retval -1 error
  *  \retval 0 ok
  */
+/**
+ *  \brief track how long the receiver keeps SACK'ing past last_ack
+ *
+ *  A sender retransmits a hole after a few duplicate ACKs. If the receiver
+ *  still SACKs past the same last_ack long after that, we most likely
+ *  missed the retransmission, so there is no point in waiting for it.
+ */
+static void StreamTcpSackUpdateHole(TcpStream *stream)
+{
+    if (RB_EMPTY(&stream->sack_tree)) {
+        stream->sack_hole_acks = 0;
+    } else if (stream->sack_hole_acks > 0 &&
+            SEQ_EQ(stream->sack_hole_ack, stream->last_ack)) {
+        if (stream->sack_hole_acks < UINT16_MAX)
+            stream->sack_hole_acks++;
+    } else {
+        stream->sack_hole_ack = stream->last_ack;
+        stream->sack_hole_acks = 1;
+    }
+}
+
+/**
+ *  \brief get the right edge of the data the receiver has
+ *
+ *  Normally that is last_ack. If the receiver SACK'd past the same
+ *  last_ack in stream.reassembly.sack-gap-acks packets, the hole is
+ *  considered lost and the right edge of the first SACK range is used,
+ *  so the reassembly can report the gap instead of waiting for an ACK.
+ *
+ *  \retval ack last_ack or the right edge of the first SACK range
+ */
+uint32_t StreamTcpSackGetAckEdge(const TcpStream *stream)
+{
+    if (stream_config.sack_gap_acks == 0 ||
+            stream->sack_hole_acks < stream_config.sack_gap_acks ||
+            !SEQ_EQ(stream->sack_hole_ack, stream->last_ack))
+        return stream->last_ack;
+
+    const StreamTcpSackRecord *rec = RB_MIN(TCPSACK, (struct TCPSACK *)&stream->sack_tree);
+    if (rec == NULL || SEQ_LEQ(rec->re, stream->last_ack))
+        return stream->last_ack;
+    return rec->re;
+}
+
 int StreamTcpSackUpdatePacket(TcpStream *stream, Packet *p)
 {
     const int records = TCP_GET_SACK_CNT(p);
@@ -288,6 +332,7 @@ int StreamTcpSackUpdatePacket(TcpStream *stream, Packet *p)
         sack_rec++;
     }
     StreamTcpSackPruneList(stream);
+    StreamTcpSackUpdateHole(stream);
 #ifdef DEBUG
     StreamTcpSackPrintList(stream);
 #endif
@@ -799,6 +844,44 @@ static int StreamTcpSackTest14 (void) {
     PASS;
 }
 
+/**
+ *  \test lost hole detection
+ */
+static int StreamTcpSackTest15 (void)
+{
+    TcpStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.last_ack = 1000;
+    stream.window = 2000;
+    const uint16_t sack_gap_acks = stream_config.sack_gap_acks;
+    stream_config.sack_gap_acks = 3;
+
+    StreamTcpSackInsertRange(&stream, 1500, 1600);
+    StreamTcpSackUpdateHole(&stream);
+    StreamTcpSackUpdateHole(&stream);
+    FAIL_IF(StreamTcpSackGetAckEdge(&stream) != 1000);
+    StreamTcpSackInsertRange(&stream, 1600, 1700);
+    StreamTcpSackUpdateHole(&stream);
+    FAIL_IF(StreamTcpSackGetAckEdge(&stream) != 1700);
+
+    /* ack moved, start over */
+    stream.last_ack = 1200;
+    StreamTcpSackPruneList(&stream);
+    StreamTcpSackUpdateHole(&stream);
+    FAIL_IF(StreamTcpSackGetAckEdge(&stream) != 1200);
+
+    /* ack beyond the SACK ranges */
+    stream.last_ack = 1800;
+    StreamTcpSackPruneList(&stream);
+    StreamTcpSackUpdateHole(&stream);
+    FAIL_IF(stream.sack_hole_acks != 0);
+    FAIL_IF(StreamTcpSackGetAckEdge(&stream) != 1800);
+
+    stream_config.sack_gap_acks = sack_gap_acks;
+    StreamTcpSackFreeList(&stream);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpSackRegisterTests (void)
@@ -822,5 +905,6 @@ void StreamTcpSackRegisterTests (void)
                    StreamTcpSackTest13);
     UtRegisterTest("StreamTcpSackTest14 -- Insertion out of window",
                    StreamTcpSackTest14);
+    UtRegisterTest("StreamTcpSackTest15 -- Lost hole", StreamTcpSackTest15);
 #endif
 }
@@ -35,6 +35,7 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-snapshot.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -45,6 +46,8 @@
 
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-memcap.h"
+#include "util-time.h"
 #include "util-checksum.h"
 #include "util-unittest.h"
 #include "util-print.h"
@@ -74,6 +77,7 @@
 #include "util-validate.h"
 #include "util-runmodes.h"
 #include "util-random.h"
+#include "util-trace.h"
 
 #include "source-pcap-file.h"
 
@@ -118,16 +122,16 @@ static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex *
 #endif
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
-SC_ATOMIC_DECLARE(uint64_t, st_memuse);
+static MemcapCounter st_memuse;
 
 void StreamTcpInitMemuse(void)
 {
-    SC_ATOMIC_INIT(st_memuse);
+    MemcapCounterInit(&st_memuse, 0);
 }
 
 void StreamTcpIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(st_memuse, size);
+    MemcapCounterIncr(&st_memuse, size);
     SCLogDebug("STREAM %"PRIu64", incr %"PRIu64, StreamTcpMemuseCounter(), size);
     return;
 }
@@ -135,17 +139,17 @@ void StreamTcpIncrMemuse(uint64_t size)
 void StreamTcpDecrMemuse(uint64_t size)
 {
 #ifdef DEBUG_VALIDATION
-    uint64_t presize = SC_ATOMIC_GET(st_memuse);
+    uint64_t presize = MemcapCounterGet(&st_memuse);
     if (RunmodeIsUnittests()) {
         BUG_ON(presize > UINT_MAX);
     }
 #endif
 
-    (void) SC_ATOMIC_SUB(st_memuse, size);
+    MemcapCounterDecr(&st_memuse, size);
 
 #ifdef DEBUG_VALIDATION
     if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(st_memuse);
+        uint64_t postsize = MemcapCounterGet(&st_memuse);
         BUG_ON(postsize > presize);
     }
 #endif
@@ -155,7 +159,7 @@ void StreamTcpDecrMemuse(uint64_t size)
 
 uint64_t StreamTcpMemuseCounter(void)
 {
-    uint64_t memusecopy = SC_ATOMIC_GET(st_memuse);
+    uint64_t memusecopy = MemcapCounterGet(&st_memuse);
     return memusecopy;
 }
 
@@ -168,8 +172,9 @@ uint64_t StreamTcpMemuseCounter(void)
 int StreamTcpCheckMemcap(uint64_t size)
 {
     uint64_t memcapcopy = SC_ATOMIC_GET(stream_config.memcap);
-    if (memcapcopy == 0 || size + SC_ATOMIC_GET(st_memuse) <= memcapcopy)
+    if (memcapcopy == 0 || MemcapCounterCheck(&st_memuse, size, memcapcopy))
         return 1;
+    SCTrace2(memcap_hit, "stream", memcapcopy);
     return 0;
 }
 
@@ -180,7 +185,7 @@ int StreamTcpCheckMemcap(uint64_t size)
  */
 int StreamTcpSetMemcap(uint64_t size)
 {
-    if (size == 0 || (uint64_t)SC_ATOMIC_GET(st_memuse) < size) {
+    if (size == 0 || (uint64_t)MemcapCounterGet(&st_memuse) < size) {
         SC_ATOMIC_SET(stream_config.memcap, size);
         return 1;
     }
@@ -205,6 +210,11 @@ void StreamTcpStreamCleanup(TcpStream *stream)
         StreamTcpSackFreeList(stream);
         StreamTcpReturnStreamSegments(stream);
         StreamingBufferClear(&stream->sb);
+        if (stream->mpm_state != NULL) {
+            SCFree(stream->mpm_state);
+            stream->mpm_state = NULL;
+            StreamTcpDecrMemuse((uint64_t)sizeof(MpmStreamState));
+        }
     }
 }
 
@@ -886,6 +896,108 @@ static int StreamTcpPacketIsRetransmission(TcpStream *stream, Packet *p)
     SCReturnInt(0);
 }
 
+/** a packet continues a session of the snapshot if its sequence numbers are
+ *  at most this far beyond where the session was when it was written */
+#define STREAMTCP_RESTORE_MAX_SEQ_DIFF  (1U << 30)
+
+/**
+ *  \internal
+ *  \brief  Pick up a session that was established when the engine was
+ *          stopped, as found in the flow snapshot.
+ *
+ *  Like a midstream pickup, but it works without stream.midstream, gets
+ *  the direction of the session right and uses the window scaling, SACK
+ *  setting and app-layer protocol of the session.
+ *
+ *  \retval 1 session restored
+ *  \retval 0 not in the snapshot
+ *  \retval -1 error
+ */
+static int StreamTcpPacketRestoreSession(ThreadVars *tv, Packet *p,
+        StreamTcpThread *stt, PacketQueue *pq)
+{
+    int toserver = 0;
+    const FlowSnapshotRecord *r = FlowSnapshotLookup(p, &toserver);
+    if (r == NULL)
+        return 0;
+
+    /* random ISNs make a new session on the same tuple fail this */
+    const uint32_t snd_next = toserver ? r->client_next_seq : r->server_next_seq;
+    const uint32_t rcv_next = toserver ? r->server_next_seq : r->client_next_seq;
+    if (SEQ_LT(TCP_GET_SEQ(p), snd_next) ||
+            TCP_GET_SEQ(p) - snd_next > STREAMTCP_RESTORE_MAX_SEQ_DIFF ||
+            SEQ_LT(TCP_GET_ACK(p), rcv_next) ||
+            TCP_GET_ACK(p) - rcv_next > STREAMTCP_RESTORE_MAX_SEQ_DIFF)
+        return 0;
+
+    TcpSession *ssn = StreamTcpNewSession(p, stt->ssn_pool_id);
+    if (ssn == NULL) {
+        StatsIncr(tv, stt->counter_tcp_ssn_memcap);
+        return -1;
+    }
+    StatsIncr(tv, stt->counter_tcp_sessions);
+    StatsIncr(tv, stt->counter_tcp_restored);
+
+    if (!toserver) {
+        SCLogDebug("reversing flow and packet");
+        PacketSwap(p);
+        FlowSwap(p->flow);
+    }
+
+    StreamTcpPacketSetState(p, ssn, TCP_ESTABLISHED);
+    SCLogDebug("ssn %p: =~ restored ssn state is now TCP_ESTABLISHED", ssn);
+    /* the windows are still unknown */
+    ssn->flags = STREAMTCP_FLAG_MIDSTREAM;
+    ssn->flags |= STREAMTCP_FLAG_MIDSTREAM_ESTABLISHED;
+    if (r->flags & FLOW_SNAPSHOT_SACKOK)
+        ssn->flags |= STREAMTCP_FLAG_SACKOK;
+    ssn->client.wscale = r->client_wscale;
+    ssn->server.wscale = r->server_wscale;
+
+    TcpStream *snd = toserver ? &ssn->client : &ssn->server;
+    TcpStream *rcv = toserver ? &ssn->server : &ssn->client;
+
+    /* from here on we see the session for the first time */
+    snd->isn = TCP_GET_SEQ(p) - 1;
+    STREAMTCP_SET_RA_BASE_SEQ(snd, snd->isn);
+    snd->next_seq = TCP_GET_SEQ(p) + p->payload_len;
+    snd->window = TCP_GET_WINDOW(p) << snd->wscale;
+    snd->last_ack = TCP_GET_SEQ(p);
+    snd->next_win = snd->last_ack + snd->window;
+
+    rcv->isn = TCP_GET_ACK(p) - 1;
+    STREAMTCP_SET_RA_BASE_SEQ(rcv, rcv->isn);
+    rcv->next_seq = rcv->isn + 1;
+    rcv->last_ack = TCP_GET_ACK(p);
+    rcv->next_win = rcv->last_ack;
+
+    if (TCP_HAS_TS(p)) {
+        snd->last_ts = TCP_GET_TSVAL(p);
+        rcv->last_ts = TCP_GET_TSECR(p);
+        ssn->flags |= STREAMTCP_FLAG_TIMESTAMP;
+        snd->last_pkt_ts = p->ts.tv_sec;
+        if (rcv->last_ts == 0)
+            rcv->flags |= STREAMTCP_STREAM_FLAG_ZERO_TIMESTAMP;
+        if (snd->last_ts == 0)
+            snd->flags |= STREAMTCP_STREAM_FLAG_ZERO_TIMESTAMP;
+    }
+
+    /* no need to detect the protocol again */
+    if (r->alproto != ALPROTO_UNKNOWN) {
+        Flow *f = p->flow;
+        f->alproto = f->alproto_ts = f->alproto_tc = r->alproto;
+        FLOW_SET_PM_DONE(f, STREAM_TOSERVER);
+        FLOW_SET_PM_DONE(f, STREAM_TOCLIENT);
+        FLOW_SET_PP_DONE(f, STREAM_TOSERVER);
+        FLOW_SET_PP_DONE(f, STREAM_TOCLIENT);
+        StreamTcpSetStreamFlagAppProtoDetectionCompleted(&ssn->client);
+        StreamTcpSetStreamFlagAppProtoDetectionCompleted(&ssn->server);
+    }
+
+    StreamTcpReassembleHandleSegment(tv, stt->ra_ctx, ssn, snd, p, pq);
+    return 1;
+}
+
 /**
  *  \internal
  *  \brief  Function to handle the TCP_CLOSED or NONE state. The function handles
@@ -1064,6 +1176,11 @@ static int StreamTcpPacketStateNone(ThreadVars *tv, Packet *p,
                 ssn->client.last_ack);
 
     } else if (p->tcph->th_flags & TH_ACK) {
+        if (ssn == NULL) {
+            int r = StreamTcpPacketRestoreSession(tv, p, stt, pq);
+            if (r != 0)
+                return r < 0 ? -1 : 0;
+        }
         if (stream_config.midstream == FALSE)
             return 0;
 
@@ -4683,6 +4800,13 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
     /* assign the thread id to the flow */
     if (unlikely(p->flow->thread_id == 0)) {
         p->flow->thread_id = (FlowThreadId)tv->id;
+    } else if (unlikely((FlowThreadId)tv->id != p->flow->thread_id &&
+                !TmThreadsIsRegistered((int)p->flow->thread_id))) {
+        /* the worker that had the flow was retired at runtime, take
+         * over its flows as the capture hands them to us */
+        SCLogDebug("flow moves from retired thread %u to %d",
+                p->flow->thread_id, tv->id);
+        p->flow->thread_id = (FlowThreadId)tv->id;
     } else if (unlikely((FlowThreadId)tv->id != p->flow->thread_id)) {
         SCLogDebug("wrong thread: flow has %u, we are %d", p->flow->thread_id, tv->id);
         if (p->pkt_src == PKT_SRC_WIRE) {
@@ -5128,6 +5252,21 @@ TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         }
     } else {
         p->flags |= PKT_IGNORE_CHECKSUM; //TODO check that this is set at creation
+
+        /* time the flow manager's pseudo packet spent queued, p->ts was
+         * set from TimeGet() when it was created */
+        if (p->pkt_src == PKT_SRC_FFR) {
+            struct timeval now;
+            TimeGet(&now);
+            uint64_t usec = 0;
+            if (timercmp(&now, &p->ts, >)) {
+                struct timeval diff;
+                timersub(&now, &p->ts, &diff);
+                usec = (uint64_t)diff.tv_sec * 1000000 + (uint64_t)diff.tv_usec;
+            }
+            StatsAddUI64(tv, stt->counter_tcp_timeout_flush_latency_avg, usec);
+            StatsSetUI64(tv, stt->counter_tcp_timeout_flush_latency_max, usec);
+        }
     }
     AppLayerProfilingReset(stt->ra_ctx->app_tctx);
 
@@ -5157,7 +5296,12 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_synack = StatsRegisterCounter("tcp.synack", tv);
     stt->counter_tcp_rst = StatsRegisterCounter("tcp.rst", tv);
     stt->counter_tcp_midstream_pickups = StatsRegisterCounter("tcp.midstream_pickups", tv);
+    stt->counter_tcp_restored = StatsRegisterCounter("tcp.restored_sessions", tv);
     stt->counter_tcp_wrong_thread = StatsRegisterCounter("tcp.pkt_on_wrong_thread", tv);
+    stt->counter_tcp_timeout_flush_latency_avg =
+        StatsRegisterAvgCounter("tcp.timeout_flush_latency_avg", tv);
+    stt->counter_tcp_timeout_flush_latency_max =
+        StatsRegisterMaxCounter("tcp.timeout_flush_latency_max", tv);
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -5167,12 +5311,15 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_tcp_segment_memcap = StatsRegisterCounter("tcp.segment_memcap_drop", tv);
     stt->ra_ctx->counter_tcp_stream_depth = StatsRegisterCounter("tcp.stream_depth_reached", tv);
     stt->ra_ctx->counter_tcp_reass_gap = StatsRegisterCounter("tcp.reassembly_gap", tv);
+    stt->ra_ctx->counter_tcp_reass_sack_gap = StatsRegisterCounter("tcp.reassembly_sack_gap", tv);
     stt->ra_ctx->counter_tcp_reass_overlap = StatsRegisterCounter("tcp.overlap", tv);
     stt->ra_ctx->counter_tcp_reass_overlap_diff_data = StatsRegisterCounter("tcp.overlap_diff_data", tv);
 
     stt->ra_ctx->counter_tcp_reass_data_normal_fail = StatsRegisterCounter("tcp.insert_data_normal_fail", tv);
     stt->ra_ctx->counter_tcp_reass_data_overlap_fail = StatsRegisterCounter("tcp.insert_data_overlap_fail", tv);
     stt->ra_ctx->counter_tcp_reass_list_fail = StatsRegisterCounter("tcp.insert_list_fail", tv);
+    stt->ra_ctx->counter_tcp_reass_coalesced = StatsRegisterCounter("tcp.segment_coalesced", tv);
+    stt->ra_ctx->counter_tcp_reass_depth_limited = StatsRegisterCounter("tcp.reassembly_depth_limited_bytes", tv);
 
 
     SCLogDebug("StreamTcp thread specific ctx online at %p, reassembly ctx %p",
@@ -6045,6 +6192,7 @@ static void StreamTcpPseudoPacketCreateDetectLogFlush(ThreadVars *tv,
     np->vlan_id[0] = f->vlan_id[0];
     np->vlan_id[1] = f->vlan_id[1];
     np->vlan_idx = f->vlan_idx;
+    np->domain_id = f->domain_id;
     np->livedev = (struct LiveDevice_ *)f->livedev;
 
     if (f->flags & FLOW_NOPACKET_INSPECTION) {
@@ -6298,6 +6446,52 @@ void TcpSessionSetReassemblyDepth(TcpSession *ssn, uint32_t size)
     return;
 }
 
+/**
+ *  \brief Set the reassembly depth for a rule
+ *
+ *  Like TcpSessionSetReassemblyDepth, but the app layer can't lower the
+ *  depth of the session anymore.
+ */
+void TcpSessionRequireReassemblyDepth(TcpSession *ssn, uint32_t size)
+{
+    ssn->flags |= STREAMTCP_FLAG_DEPTH_REQUIRED;
+    TcpSessionSetReassemblyDepth(ssn, size);
+}
+
+/**
+ *  \brief Lower the reassembly depth of a session
+ *
+ *  Used by the app layer once it no longer needs the data, e.g. when TLS
+ *  goes encrypted. The depth becomes the data seen so far in either
+ *  direction plus size. It's never raised by this, and not lowered if a
+ *  rule needs the session reassembled. Data after the depth is reached is
+ *  lost, even if a rule raises the depth later.
+ *
+ *  \param size bytes to still reassemble
+ */
+void TcpSessionLimitReassemblyDepth(TcpSession *ssn, uint32_t size)
+{
+    if (ssn->flags & STREAMTCP_FLAG_DEPTH_REQUIRED)
+        return;
+
+    uint64_t seen = 0;
+    if (STREAM_HAS_SEEN_DATA(&ssn->client))
+        seen = STREAM_RIGHT_EDGE(&ssn->client);
+    if (STREAM_HAS_SEEN_DATA(&ssn->server))
+        seen = MAX(seen, STREAM_RIGHT_EDGE(&ssn->server));
+
+    const uint64_t depth = seen + size;
+    if (depth > UINT32_MAX)
+        return;
+    if (ssn->reassembly_depth != 0 && depth >= ssn->reassembly_depth)
+        return;
+
+    SCLogDebug("ssn %p: reassembly depth lowered from %u to %"PRIu64,
+            ssn, ssn->reassembly_depth, depth);
+    ssn->reassembly_depth = (uint32_t)depth;
+    ssn->flags |= STREAMTCP_FLAG_DEPTH_LIMITED;
+}
+
 #ifdef UNITTESTS
 
 #define SET_ISN(stream, setseq)             \
@@ -8626,7 +8820,7 @@ static int StreamTcpTest23(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(MemcapCounterGet(&st_memuse) > 0);
     PASS;
 }
 
@@ -8692,7 +8886,7 @@ static int StreamTcpTest24(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(MemcapCounterGet(&st_memuse) > 0);
     PASS;
 }
 
@@ -8983,13 +9177,13 @@ static int StreamTcpTest28(void)
     StreamTcpThread stt;
     StreamTcpUTInit(&stt.ra_ctx);
 
-    uint32_t memuse = SC_ATOMIC_GET(st_memuse);
+    uint32_t memuse = MemcapCounterGet(&st_memuse);
 
     StreamTcpIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != (memuse+500));
+    FAIL_IF(MemcapCounterGet(&st_memuse) != (memuse+500));
 
     StreamTcpDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != memuse);
+    FAIL_IF(MemcapCounterGet(&st_memuse) != memuse);
 
     FAIL_IF(StreamTcpCheckMemcap(500) != 1);
 
@@ -8997,7 +9191,7 @@ static int StreamTcpTest28(void)
 
     StreamTcpUTDeinit(stt.ra_ctx);
 
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != 0);
+    FAIL_IF(MemcapCounterGet(&st_memuse) != 0);
     PASS;
 }
 
@@ -55,6 +55,8 @@ typedef struct TcpStreamCnf_ {
 
     uint32_t prealloc_sessions; /**< ssns to prealloc per stream thread */
     uint32_t prealloc_segments; /**< segments to prealloc per stream thread */
+    uint16_t segment_coalesce_size; /**< max size of a segment in order data
+                                     *   is added to, 0 to disable */
     int midstream;
     int async_oneside;
     uint32_t reassembly_depth;  /**< Depth until when we reassemble the stream */
@@ -63,6 +65,10 @@ typedef struct TcpStreamCnf_ {
     uint16_t reassembly_toclient_chunk_size;
 
     bool streaming_log_api;
+    bool memcap_evict;          /**< free the reassembly data of the biggest
+                                 *   sessions when near the reassembly memcap */
+    uint16_t sack_gap_acks;     /**< packets SACK'ing past the same hole after
+                                 *   which we consider it lost, 0 to disable */
 
     StreamingBufferConfig sbcnf;
 } TcpStreamCnf;
@@ -96,8 +102,13 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_rst;
     /** midstream pickups */
     uint16_t counter_tcp_midstream_pickups;
+    /** sessions picked up from the flow snapshot */
+    uint16_t counter_tcp_restored;
     /** wrong thread */
     uint16_t counter_tcp_wrong_thread;
+    /** usec between creating a flow timeout pseudo packet and handling it */
+    uint16_t counter_tcp_timeout_flush_latency_avg;
+    uint16_t counter_tcp_timeout_flush_latency_max;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
@@ -126,8 +137,12 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag,
                         void *data);
 void StreamTcpReassembleConfigEnableOverlapCheck(void);
 void TcpSessionSetReassemblyDepth(TcpSession *ssn, uint32_t size);
+void TcpSessionRequireReassemblyDepth(TcpSession *ssn, uint32_t size);
+void TcpSessionLimitReassemblyDepth(TcpSession *ssn, uint32_t size);
 
-typedef int (*StreamReassembleRawFunc)(void *data, const uint8_t *input, const uint32_t input_len);
+/** \param offset stream offset of the first byte of input */
+typedef int (*StreamReassembleRawFunc)(void *data, const uint8_t *input,
+        const uint32_t input_len, const uint64_t offset);
 
 int StreamReassembleLog(TcpSession *ssn, TcpStream *stream,
         StreamReassembleRawFunc Callback, void *cb_data,
@@ -176,6 +176,10 @@
 #include <sys/random.h>
 #endif
 
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #if HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif
@@ -438,6 +442,7 @@ typedef enum {
     LOGGER_JSON_IKEV2,
     LOGGER_JSON_KRB5,
     LOGGER_JSON_DHCP,
+    LOGGER_JSON_QUIC,
     LOGGER_JSON_TEMPLATE_RUST,
     LOGGER_JSON_TEMPLATE,
 
@@ -56,13 +56,17 @@
 #include "util-running-modes.h"
 
 #include "detect-engine.h"
+#include "detect-engine-offload.h"
 #include "detect-parse.h"
 #include "detect-fast-pattern.h"
 #include "detect-engine-tag.h"
+#include "datasets.h"
 #include "detect-engine-threshold.h"
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-record.h"
+#include "detect-engine-rule-sample.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -92,6 +96,8 @@
 #include "source-napatech.h"
 
 #include "source-af-packet.h"
+#include "source-af-xdp.h"
+#include "source-dpdk.h"
 #include "source-netmap.h"
 
 #include "source-windivert.h"
@@ -103,6 +109,8 @@
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-bypass.h"
+#include "flow-snapshot.h"
+#include "flow-cost.h"
 #include "flow-var.h"
 #include "flow-bit.h"
 #include "pkt-var.h"
@@ -142,8 +150,11 @@
 #include "util-threshold-config.h"
 #include "util-reference-config.h"
 #include "util-profiling.h"
+#include "util-latency.h"
 #include "util-magic.h"
 #include "util-signal.h"
+#include "util-startup.h"
+#include "util-pages.h"
 
 #include "util-coredump-config.h"
 
@@ -152,7 +163,10 @@
 #include "defrag.h"
 
 #include "runmodes.h"
+#include "runmode-unix-socket.h"
+#include "util-runmodes.h"
 #include "runmode-unittests.h"
+#include "util-bench.h"
 
 #include "util-decode-asn1.h"
 #include "util-debug.h"
@@ -160,8 +174,10 @@
 #include "util-daemon.h"
 #include "util-byte.h"
 #include "reputation.h"
+#include "util-geoip.h"
 
 #include "output.h"
+#include "output-filestore.h"
 
 #include "util-privs.h"
 
@@ -170,6 +186,7 @@
 #include "util-proto-name.h"
 #include "util-mpm-hs.h"
 #include "util-storage.h"
+#include "util-early-filter.h"
 #include "host-storage.h"
 
 #include "util-lua.h"
@@ -321,6 +338,10 @@ uint8_t print_mem_flag = 1;
 #endif
 #endif
 
+#ifdef UNITTESTS
+__thread uint64_t sc_mem_alloc_cnt = 0;
+#endif
+
 void GlobalsInitPreConfig(void)
 {
     memset(trans_q, 0, sizeof(trans_q));
@@ -365,10 +386,17 @@ static void GlobalsDestroy(SCInstance *suri)
         DetectEngineDeReference(&de_ctx);
     }
     DetectEnginePruneFreeList();
+    DetectBufferRecordDeinit();
+    DatasetsDestroy();
+    SRepDestroy();
+    GeoipDestroy();
+    ThresholdDestroy();
 
     AppLayerDeSetup();
 
     TagDestroyCtx();
+    EarlyFilterDestroy();
+    DecodeMPLSConfigFree();
 
     LiveDeviceListClean();
     OutputDeregisterAll();
@@ -612,6 +640,20 @@ static void PrintUsage(const char *progname)
     printf("\t--list-unittests                     : list unit tests\n");
     printf("\t--fatal-unittests                    : enable fatal failure on unittest error\n");
     printf("\t--unittests-coverage                 : display unittest coverage report\n");
+    printf("\t--bench=<mode>                       : run a benchmark and exit, mode is decode, stream,\n");
+    printf("\t                                       mime, dns, app-layer, detect, mpm, checksum,\n");
+    printf("\t                                       flow-hash or spm\n");
+    printf("\t--bench-input=<file>                 : input of the benchmark, a pcap, file or directory\n");
+    printf("\t--bench-iterations=<n>               : loop the input n times (default 10)\n");
+    printf("\t--bench-max-ns=<ns>                  : fail if the average is above ns per unit of input\n");
+    printf("\t--bench-flow                         : decode: include the flow worker\n");
+    printf("\t--bench-batch=<n>                    : decode: decode n packets, then prefetch their flows\n");
+    printf("\t--bench-proto=<proto>                : app-layer: protocol of the parser\n");
+    printf("\t--bench-baseline=<file>              : app-layer: compare the results to a baseline file\n");
+    printf("\t--bench-baseline-update              : app-layer: store the results in the baseline file\n");
+    printf("\t--bench-tolerance=<pct>              : app-layer: allowed regression (default 10)\n");
+    printf("\t--bench-rules=<file>                 : detect: rules to run over the buffer recording\n");
+    printf("\t--bench-mpm-data=<file>              : mpm: data to search (default generated)\n");
 #endif /* UNITTESTS */
     printf("\t--list-app-layer-protos              : list supported app layer protocols\n");
     printf("\t--list-keywords[=all|csv|<kword>]    : list keywords implemented by the engine\n");
@@ -625,6 +667,7 @@ static void PrintUsage(const char *progname)
     printf("\t--pidfile <file>                     : write pid to this file\n");
     printf("\t--init-errors-fatal                  : enable fatal failure on signature init error\n");
     printf("\t--disable-detection                  : disable detection engine\n");
+    printf("\t--rules-artifact <dir>               : share the compiled rule databases in dir with other processes\n");
     printf("\t--dump-config                        : show the running configuration\n");
     printf("\t--build-info                         : display build information\n");
     printf("\t--pcap[=<dev>]                       : run in pcap mode, no value select interfaces from suricata.yaml\n");
@@ -636,6 +679,12 @@ static void PrintUsage(const char *progname)
 #ifdef HAVE_AF_PACKET
     printf("\t--af-packet[=<dev>]                  : run in af-packet mode, no value select interfaces from suricata.yaml\n");
 #endif
+#ifdef HAVE_AF_XDP
+    printf("\t--af-xdp[=<dev>]                     : run in af-xdp mode, no value select interfaces from suricata.yaml\n");
+#endif
+#ifdef HAVE_DPDK
+    printf("\t--dpdk[=<dev>]                       : run in dpdk mode, no value select interfaces from suricata.yaml\n");
+#endif
 #ifdef HAVE_NETMAP
     printf("\t--netmap[=<dev>]                     : run in netmap mode, no value select interfaces from suricata.yaml\n");
 #endif
@@ -650,7 +699,7 @@ static void PrintUsage(const char *progname)
     printf("\t--user <user>                        : run suricata as this user after init\n");
     printf("\t--group <group>                      : run suricata as this group after init\n");
 #endif /* HAVE_LIBCAP_NG */
-    printf("\t--erf-in <path>                      : process an ERF file\n");
+    printf("\t--erf-in <path>[,<path>...]          : process ERF files, merged in timestamp order\n");
 #ifdef HAVE_DAG
     printf("\t--dag <dagX:Y>                       : process ERF records from DAG interface X, stream Y\n");
 #endif
@@ -711,6 +760,12 @@ static void PrintBuildInfo(void)
 #ifdef HAVE_AF_PACKET
     strlcat(features, "AF_PACKET ", sizeof(features));
 #endif
+#ifdef HAVE_AF_XDP
+    strlcat(features, "AF_XDP ", sizeof(features));
+#endif
+#ifdef HAVE_DPDK
+    strlcat(features, "DPDK ", sizeof(features));
+#endif
 #ifdef HAVE_NETMAP
     strlcat(features, "NETMAP ", sizeof(features));
 #endif
@@ -890,6 +945,12 @@ void RegisterAllModules(void)
     /* af-packet */
     TmModuleReceiveAFPRegister();
     TmModuleDecodeAFPRegister();
+    /* af-xdp */
+    TmModuleReceiveAFXDPRegister();
+    TmModuleDecodeAFXDPRegister();
+    /* dpdk */
+    TmModuleReceiveDPDKRegister();
+    TmModuleDecodeDPDKRegister();
     /* netmap */
     TmModuleReceiveNetmapRegister();
     TmModuleDecodeNetmapRegister();
@@ -908,6 +969,10 @@ void RegisterAllModules(void)
 
     /* flow worker */
     TmModuleFlowWorkerRegister();
+    /* detect offload helpers */
+    TmModuleDetectOffloadRegister();
+    /* filestore writers */
+    TmModuleFilestoreWriterRegister();
     /* respond-reject */
     TmModuleRespondRejectRegister();
 
@@ -933,6 +998,9 @@ static TmEcode LoadYamlConfig(SCInstance *suri)
     if (suri->conf_filename == NULL)
         suri->conf_filename = DEFAULT_CONF_FILE;
 
+    if (DetectFileDigest(suri->conf_filename, &suri->conf_digest) != 0)
+        suri->conf_digest = 0;
+
     if (ConfYamlLoadFile(suri->conf_filename) != 0) {
         /* Error already displayed. */
         SCReturnInt(TM_ECODE_FAILED);
@@ -982,6 +1050,38 @@ static TmEcode ParseInterfacesList(const int runmode, char *pcap_dev)
             }
         }
 #endif
+#ifdef HAVE_AF_XDP
+    } else if (runmode == RUNMODE_AFXDP_DEV) {
+        /* iface has been set on command line */
+        if (strlen(pcap_dev)) {
+            if (ConfSetFinal("af-xdp.live-interface", pcap_dev) != 1) {
+                SCLogError(SC_ERR_INITIALIZATION, "Failed to set af-xdp.live-interface");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        } else {
+            int ret = LiveBuildDeviceList("af-xdp");
+            if (ret == 0) {
+                SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for af-xdp");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        }
+#endif
+#ifdef HAVE_DPDK
+    } else if (runmode == RUNMODE_DPDK) {
+        /* iface has been set on command line */
+        if (strlen(pcap_dev)) {
+            if (ConfSetFinal("dpdk.live-interface", pcap_dev) != 1) {
+                SCLogError(SC_ERR_INITIALIZATION, "Failed to set dpdk.live-interface");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        } else {
+            int ret = LiveBuildDeviceList("dpdk.interfaces");
+            if (ret == 0) {
+                SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for dpdk");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        }
+#endif
 #ifdef HAVE_NETMAP
     } else if (runmode == RUNMODE_NETMAP) {
         /* iface has been set on command line */
@@ -1124,6 +1224,67 @@ static int ParseCommandLineAfpacket(SCInstance *suri, const char *in_arg)
 #endif
 }
 
+static int ParseCommandLineAfxdp(SCInstance *suri, const char *in_arg)
+{
+#ifdef HAVE_AF_XDP
+    if (suri->run_mode == RUNMODE_UNKNOWN) {
+        suri->run_mode = RUNMODE_AFXDP_DEV;
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+            memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
+            strlcpy(suri->pcap_dev, in_arg, sizeof(suri->pcap_dev));
+        }
+    } else if (suri->run_mode == RUNMODE_AFXDP_DEV) {
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+        } else {
+            SCLogInfo("Multiple af-xdp option without interface on each is useless");
+        }
+    } else {
+        SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                "has been specified");
+        PrintUsage(suri->progname);
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+#else
+    SCLogError(SC_ERR_NO_AF_XDP,"AF_XDP not enabled. On Linux "
+            "host, make sure to pass --enable-af-packet and --enable-ebpf "
+            "to configure when building.");
+    return TM_ECODE_FAILED;
+#endif
+}
+
+static int ParseCommandLineDpdk(SCInstance *suri, const char *in_arg)
+{
+#ifdef HAVE_DPDK
+    if (suri->run_mode == RUNMODE_UNKNOWN) {
+        suri->run_mode = RUNMODE_DPDK;
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+            memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
+            strlcpy(suri->pcap_dev, in_arg, sizeof(suri->pcap_dev));
+        }
+    } else if (suri->run_mode == RUNMODE_DPDK) {
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+        } else {
+            SCLogInfo("Multiple dpdk option without interface on each is useless");
+        }
+    } else {
+        SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                "has been specified");
+        PrintUsage(suri->progname);
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+#else
+    SCLogError(SC_ERR_NO_DPDK,"DPDK not enabled. Make sure to pass "
+            "--enable-dpdk to configure when building.");
+    return TM_ECODE_FAILED;
+#endif
+}
+
 static int ParseCommandLinePcapLive(SCInstance *suri, const char *in_arg)
 {
     memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
@@ -1438,6 +1599,8 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pfring-cluster-id", required_argument, 0, 0},
         {"pfring-cluster-type", required_argument, 0, 0},
         {"af-packet", optional_argument, 0, 0},
+        {"af-xdp", optional_argument, 0, 0},
+        {"dpdk", optional_argument, 0, 0},
         {"netmap", optional_argument, 0, 0},
         {"pcap", optional_argument, 0, 0},
         {"pcap-file-continuous", 0, 0, 0},
@@ -1506,8 +1669,21 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pidfile", required_argument, 0, 0},
         {"init-errors-fatal", 0, 0, 0},
         {"disable-detection", 0, 0, 0},
+        {"rules-artifact", required_argument, 0, 0},
         {"fatal-unittests", 0, 0, 0},
         {"unittests-coverage", 0, &coverage_unittests, 1},
+        {"bench", required_argument, 0, 0},
+        {"bench-input", required_argument, 0, 0},
+        {"bench-iterations", required_argument, 0, 0},
+        {"bench-max-ns", required_argument, 0, 0},
+        {"bench-flow", 0, 0, 0},
+        {"bench-batch", required_argument, 0, 0},
+        {"bench-proto", required_argument, 0, 0},
+        {"bench-baseline", required_argument, 0, 0},
+        {"bench-baseline-update", 0, 0, 0},
+        {"bench-tolerance", required_argument, 0, 0},
+        {"bench-rules", required_argument, 0, 0},
+        {"bench-mpm-data", required_argument, 0, 0},
         {"user", required_argument, 0, 0},
         {"group", required_argument, 0, 0},
         {"erf-in", required_argument, 0, 0},
@@ -1582,6 +1758,14 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                 if (ParseCommandLineAfpacket(suri, optarg) != TM_ECODE_OK) {
                     return TM_ECODE_FAILED;
                 }
+            } else if (strcmp((long_opts[option_index]).name , "af-xdp") == 0) {
+                if (ParseCommandLineAfxdp(suri, optarg) != TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
+            } else if (strcmp((long_opts[option_index]).name , "dpdk") == 0) {
+                if (ParseCommandLineDpdk(suri, optarg) != TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
             } else if (strcmp((long_opts[option_index]).name , "netmap") == 0){
 #ifdef HAVE_NETMAP
                 if (suri->run_mode == RUNMODE_UNKNOWN) {
@@ -1702,12 +1886,50 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
             else if(strcmp((long_opts[option_index]).name, "disable-detection") == 0) {
                 g_detect_disabled = suri->disabled_detect = 1;
             }
+            else if(strcmp((long_opts[option_index]).name, "rules-artifact") == 0) {
+                if (ConfSetFinal("detect.sgh-mpm-caching", "yes") != 1 ||
+                    ConfSetFinal("detect.sgh-mpm-caching-path", optarg) != 1 ||
+                    ConfSetFinal("detect.sgh-mpm-caching-shared", "yes") != 1) {
+                    fprintf(stderr, "ERROR: Failed to set the rules artifact directory.\n");
+                    return TM_ECODE_FAILED;
+                }
+            }
             else if(strcmp((long_opts[option_index]).name, "fatal-unittests") == 0) {
 #ifdef UNITTESTS
                 unittests_fatal = 1;
 #else
                 fprintf(stderr, "ERROR: Unit tests not enabled. Make sure to pass --enable-unittests to configure when building.\n");
                 return TM_ECODE_FAILED;
+#endif /* UNITTESTS */
+            }
+            else if (strcmp((long_opts[option_index]).name, "bench") == 0) {
+#ifdef UNITTESTS
+                if (suri->run_mode != RUNMODE_UNKNOWN) {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                            "has been specified");
+                    PrintUsage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+                suri->run_mode = RUNMODE_BENCH;
+                if (ConfSetFinal("bench.mode", optarg) != 1)
+                    return TM_ECODE_FAILED;
+#else
+                fprintf(stderr, "ERROR: Unit tests not enabled. Make sure to pass --enable-unittests to configure when building.\n");
+                return TM_ECODE_FAILED;
+#endif /* UNITTESTS */
+            }
+            else if (strncmp((long_opts[option_index]).name, "bench-", 6) == 0) {
+#ifdef UNITTESTS
+                /* --bench-<option> is bench.<option>, the switches are
+                 * set to yes */
+                char name[64];
+                snprintf(name, sizeof(name), "bench.%s",
+                        (long_opts[option_index]).name + 6);
+                if (ConfSetFinal(name, optarg ? optarg : "yes") != 1)
+                    return TM_ECODE_FAILED;
+#else
+                fprintf(stderr, "ERROR: Unit tests not enabled. Make sure to pass --enable-unittests to configure when building.\n");
+                return TM_ECODE_FAILED;
 #endif /* UNITTESTS */
             }
             else if(strcmp((long_opts[option_index]).name, "user") == 0) {
@@ -2238,6 +2460,7 @@ void PreRunInit(const int runmode)
         return;
 
     StatsInit();
+    LatencyInitConfig();
 #ifdef PROFILING
     SCProfilingRulesGlobalInit();
     SCProfilingKeywordsGlobalInit();
@@ -2251,6 +2474,7 @@ void PreRunInit(const int runmode)
     StreamTcpInitConfig(STREAM_VERBOSE);
     AppLayerParserPostStreamSetup();
     AppLayerRegisterGlobalCounters();
+    PageHugeRegisterCounters();
 }
 
 /* tasks we need to run before packets start flowing,
@@ -2284,6 +2508,8 @@ void PostRunDeinit(const int runmode, struct timeval *start_time)
     FlowForceReassembly();
     TmThreadDisablePacketThreads();
     SCPrintElapsedTime(start_time);
+    /* before the flows are flushed from the flow tables */
+    FlowSnapshotWrite();
     FlowDisableFlowRecyclerThread();
 
     /* kill the stats threads */
@@ -2342,6 +2568,8 @@ static int StartInternalRunMode(SCInstance *suri, int argc, char **argv)
             RunUnittests(1, suri->regex_arg);
         case RUNMODE_UNITTEST:
             RunUnittests(0, suri->regex_arg);
+        case RUNMODE_BENCH:
+            RunBench();
 #ifdef OS_WIN32
         case RUNMODE_INSTALL_SERVICE:
             if (SCServiceInstall(argc, argv)) {
@@ -2416,6 +2644,7 @@ static void SetupDelayedDetect(SCInstance *suri)
 
 static int LoadSignatures(DetectEngineCtx *de_ctx, SCInstance *suri)
 {
+    de_ctx->conf_digest = suri->conf_digest;
     if (SigLoadSignatures(de_ctx, suri->sig_file, suri->sig_file_exclusive) < 0) {
         SCLogError(SC_ERR_NO_RULES_LOADED, "Loading signatures failed.");
         if (de_ctx->failure_fatal)
@@ -2472,6 +2701,7 @@ static int ConfigGetCaptureValue(SCInstance *suri)
                 /* fall through */
             case RUNMODE_PCAP_DEV:
             case RUNMODE_AFP_DEV:
+            case RUNMODE_AFXDP_DEV:
             case RUNMODE_PFRING:
                 nlive = LiveGetDeviceCount();
                 for (lthread = 0; lthread < nlive; lthread++) {
@@ -2546,6 +2776,9 @@ static void PostConfLoadedDetectSetup(SCInstance *suri)
     if (!suri->disabled_detect) {
         SCClassConfInit();
         SCReferenceConfInit();
+        if (suri->run_mode != RUNMODE_CONF_TEST && DetectBufferRecordSetup() < 0)
+            exit(EXIT_FAILURE);
+        DetectRuleSampleGlobalInit();
         SetupDelayedDetect(suri);
         int mt_enabled = 0;
         (void)ConfGetBool("multi-detect.enabled", &mt_enabled);
@@ -2701,10 +2934,13 @@ static int PostConfLoadedSetup(SCInstance *suri)
     }
 
     StorageInit();
+    PageHugeInitConfig();
 #ifdef HAVE_PACKET_EBPF
     EBPFRegisterExtension();
 #endif
+    uint64_t phase = StartupPhaseBegin();
     AppLayerSetup();
+    StartupPhaseEnd("app-layer", phase);
 
     /* Suricata will use this umask if provided. By default it will use the
        umask passed on from the shell. */
@@ -2763,6 +2999,13 @@ static int PostConfLoadedSetup(SCInstance *suri)
     ThresholdInit();
     HostBitInitCtx();
     IPPairBitInitCtx();
+    FlowCostInitConfig();
+    GeoipInitConfig();
+
+    if (DatasetsInit() != 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "failed to set up datasets");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
 
     if (DetectAddressTestConfVars() < 0) {
         SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
@@ -2806,7 +3049,9 @@ static int PostConfLoadedSetup(SCInstance *suri)
         (void)ConfSetFinal("stream.reassembly.raw", "false");
     }
 
+    phase = StartupPhaseBegin();
     HostInitConfig(HOST_VERBOSE);
+    StartupPhaseEnd("host", phase);
 #ifdef HAVE_MAGIC
     if (MagicInit() != 0)
         SCReturnInt(TM_ECODE_FAILED);
@@ -2827,7 +3072,10 @@ static int PostConfLoadedSetup(SCInstance *suri)
     /* hostmode depends on engine mode being set */
     PostConfLoadedSetupHostMode();
 
+    StartupTasksInitConfig();
+    phase = StartupPhaseBegin();
     PreRunInit(suri->run_mode);
+    StartupPhaseEnd("pre-run", phase);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -2876,12 +3124,15 @@ static void SuricataMainLoop(SCInstance *suri)
             }
         }
 
+        RunModeWorkersSync();
+
         usleep(10* 1000);
     }
 }
 
 int main(int argc, char **argv)
 {
+    StartupProfileInit();
     SCInstanceInit(&suricata, argv[0]);
 
 #ifdef HAVE_RUST
@@ -2954,9 +3205,11 @@ int main(int argc, char **argv)
     GlobalsInitPreConfig();
 
     /* Load yaml configuration file if provided. */
+    uint64_t phase = StartupPhaseBegin();
     if (LoadYamlConfig(&suricata) != TM_ECODE_OK) {
         exit(EXIT_FAILURE);
     }
+    StartupPhaseEnd("config", phase);
 
     if (suricata.run_mode == RUNMODE_DUMP_CONFIG) {
         ConfDump();
@@ -2981,9 +3234,17 @@ int main(int argc, char **argv)
     }
 
     SCDropMainThreadCaps(suricata.userid, suricata.groupid);
+    phase = StartupPhaseBegin();
     PreRunPostPrivsDropInit(suricata.run_mode);
+    StartupPhaseEnd("outputs", phase);
 
+    phase = StartupPhaseBegin();
     PostConfLoadedDetectSetup(&suricata);
+    StartupPhaseEnd("detect", phase);
+
+    /* tasks started during the setup, like the flow hash, have to be
+     * done before the threads start or the engine shuts down */
+    StartupTasksWait();
     if (suricata.run_mode == RUNMODE_ENGINE_ANALYSIS) {
         goto out;
     } else if (suricata.run_mode == RUNMODE_CONF_TEST){
@@ -2992,6 +3253,7 @@ int main(int argc, char **argv)
     }
 
     SCSetStartTime(&suricata);
+    phase = StartupPhaseBegin();
     RunModeDispatch(suricata.run_mode, suricata.runmode_custom_mode);
     if (suricata.run_mode != RUNMODE_UNIX_SOCKET) {
         UnixManagerThreadSpawnNonRunmode();
@@ -3003,12 +3265,14 @@ int main(int argc, char **argv)
                    "aborting...");
         exit(EXIT_FAILURE);
     }
+    StartupPhaseEnd("threads", phase);
 
     (void) SC_ATOMIC_CAS(&engine_stage, SURICATA_INIT, SURICATA_RUNTIME);
     PacketPoolPostRunmodes();
 
     /* Un-pause all the paused threads */
     TmThreadContinueThreads();
+    StartupProfileReport();
 
     PostRunStartedDetectSetup(&suricata);
 
@@ -3026,6 +3290,7 @@ int main(int argc, char **argv)
     (void) SC_ATOMIC_CAS(&engine_stage, SURICATA_RUNTIME, SURICATA_DEINIT);
 
     UnixSocketKillSocketThread();
+    UnixSocketPcapPipelinesStop();
     PostRunDeinit(suricata.run_mode, &suricata.start_time);
     /* kill remaining threads */
     TmThreadKillThreads();
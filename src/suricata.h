@@ -166,6 +166,7 @@ typedef struct SCInstance_ {
     const char *log_dir;
     const char *progname; /**< pointer to argv[0] */
     const char *conf_filename;
+    uint64_t conf_digest;   /**< digest of conf_filename at load time */
 } SCInstance;
 
 
@@ -58,6 +58,43 @@
 #define TEST_FOOTER     \
     PASS
 
+/* run the content inspection through the fast path 'ci' picked for the
+ * rule and again through the generic code, results should be the same */
+#define TEST_RUN_FAST(buf, buflen, sig, ci, match)                                          \
+{                                                                                           \
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();                                        \
+    FAIL_IF_NULL(de_ctx);                                                                   \
+    DetectEngineThreadCtx *det_ctx = NULL;                                                  \
+    char rule[2048];                                                                        \
+    snprintf(rule, sizeof(rule), "alert tcp any any -> any any (%s sid:1; rev:1;)", (sig)); \
+    Signature *s = DetectEngineAppendSig(de_ctx, rule);                                     \
+    FAIL_IF_NULL(s);                                                                        \
+    SigGroupBuild(de_ctx);                                                                  \
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);                       \
+    FAIL_IF_NULL(det_ctx);                                                                  \
+    SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_PMATCH];                                \
+    FAIL_IF_NULL(smd);                                                                      \
+    FAIL_IF_NOT(smd->ci_fast == (ci));                                                      \
+    int r = DetectEngineContentInspection(de_ctx, det_ctx,                                  \
+                s, smd, NULL, &f, (uint8_t *)(buf), (buflen), 0, DETECT_CI_FLAGS_SINGLE,    \
+                DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD);                             \
+    FAIL_IF_NOT(r == (match));                                                              \
+    uint32_t steps = det_ctx->inspection_recursion_counter;                                 \
+    uint32_t offset = det_ctx->buffer_offset;                                               \
+    det_ctx->inspection_recursion_counter = 0;                                              \
+    det_ctx->buffer_offset = 0;                                                             \
+    det_ctx->discontinue_matching = 0;                                                      \
+    smd->ci_fast = DETECT_CI_FAST_NONE;                                                     \
+    r = DetectEngineContentInspection(de_ctx, det_ctx,                                      \
+                s, smd, NULL, &f, (uint8_t *)(buf), (buflen), 0, DETECT_CI_FLAGS_SINGLE,    \
+                DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD);                             \
+    FAIL_IF_NOT(r == (match));                                                              \
+    FAIL_IF_NOT(det_ctx->inspection_recursion_counter == steps);                            \
+    FAIL_IF_NOT(det_ctx->buffer_offset == offset);                                          \
+    DetectEngineThreadCtxDeinit(&tv, det_ctx);                                              \
+    DetectEngineCtxFree(de_ctx);                                                            \
+}
+
 /** \test simple match with distance */
 static int DetectEngineContentInspectionTest01(void) {
     TEST_HEADER;
@@ -263,6 +300,27 @@ static int DetectEngineContentInspectionTest13(void) {
     TEST_FOOTER;
 }
 
+/** \test content only fast paths against the generic inspection */
+static int DetectEngineContentInspectionTest14(void) {
+    TEST_HEADER;
+    TEST_RUN_FAST("ab", 2, "content:\"b\";", DETECT_CI_FAST_SINGLE, true);
+    TEST_RUN_FAST("ab", 2, "content:\"c\";", DETECT_CI_FAST_SINGLE, false);
+    TEST_RUN_FAST("abab", 4, "content:\"ab\"; endswith;", DETECT_CI_FAST_SINGLE, true);
+    TEST_RUN_FAST("abcabc", 6, "content:\"abc\"; offset:1; depth:5;", DETECT_CI_FAST_SINGLE, false);
+    TEST_RUN_FAST("ababcd", 6, "content:\"ab\"; content:\"c\"; within:1;", DETECT_CI_FAST_CHAIN, true);
+    TEST_RUN_FAST("ababxd", 6, "content:\"ab\"; content:\"c\"; within:1;", DETECT_CI_FAST_CHAIN, false);
+    TEST_RUN_FAST("aaaaaaab", 8, "content:\"a\"; content:\"a\"; distance:0; content:\"b\"; within:1;",
+            DETECT_CI_FAST_CHAIN, true);
+    TEST_RUN_FAST("aaaaaaac", 8, "content:\"a\"; content:\"a\"; distance:0; content:\"b\"; within:1;",
+            DETECT_CI_FAST_CHAIN, false);
+    TEST_RUN_FAST("xayb", 4, "content:\"a\"; content:\"b\"; distance:-1; within:3;", DETECT_CI_FAST_CHAIN, true);
+    TEST_RUN_FAST("ab", 2, "content:\"a\"; content:\"c\";", DETECT_CI_FAST_CHAIN, false);
+    /* negation and pcre use the generic code */
+    TEST_RUN_FAST("ab", 2, "content:\"a\"; content:!\"c\";", DETECT_CI_FAST_NONE, true);
+    TEST_RUN_FAST("ab", 2, "content:\"a\"; pcre:\"/b/R\";", DETECT_CI_FAST_NONE, true);
+    TEST_FOOTER;
+}
+
 void DetectEngineContentInspectionRegisterTests(void)
 {
     UtRegisterTest("DetectEngineContentInspectionTest01",
@@ -291,8 +349,11 @@ void DetectEngineContentInspectionRegisterTests(void)
                    DetectEngineContentInspectionTest12);
     UtRegisterTest("DetectEngineContentInspectionTest13 mix startswith/endswith",
                    DetectEngineContentInspectionTest13);
+    UtRegisterTest("DetectEngineContentInspectionTest14 fast paths",
+                   DetectEngineContentInspectionTest14);
 }
 
 #undef TEST_HEADER
 #undef TEST_RUN
+#undef TEST_RUN_FAST
 #undef TEST_FOOTER
@@ -2311,6 +2311,98 @@ end:
     return result;
 }
 
+/** \test http_method and http.protocol prefiltered as a batch */
+static int DetectHttpMethodSigTest05(void)
+{
+    Flow f;
+    uint8_t httpbuf1[] = "GET / HTTP/1.0\r\n"
+                         "Host: foo.bar.tld\r\n"
+                         "\r\n";
+    uint32_t httplen1 = sizeof(httpbuf1) - 1; /* minus the \0 */
+    TcpSession ssn;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+
+    p->flow = &f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flowflags |= FLOW_PKT_ESTABLISHED;
+    p->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->prefilter_batch = true;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"GET\"; http_method; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(http.protocol; content:\"HTTP/1.0\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"POST\"; http_method; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(http.protocol; content:\"HTTP/1.1\"; sid:4;)"));
+    /* the depth is not part of the batch mpm, but is inspected */
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(http.protocol; content:\"1.0\"; depth:3; sid:5;)"));
+
+    SigGroupBuild(de_ctx);
+
+    const MpmStore *batch = NULL;
+    for (HashListTableBucket *htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb)) {
+        const MpmStore *ms = HashListTableGetListData(htb);
+        if (ms->batch != NULL)
+            batch = ms;
+    }
+    FAIL_IF_NULL(batch);
+    FAIL_IF_NULL(batch->mpm_ctx);
+    FAIL_IF_NOT(batch->mpm_ctx->pattern_cnt == 5);
+    FAIL_IF_NOT(batch->mpm_ctx->flags & MPMCTX_FLAGS_VECTOR);
+
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    FLOWLOCK_WRLOCK(&f);
+    int r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
+                                STREAM_TOSERVER, httpbuf1, httplen1);
+    FLOWLOCK_UNLOCK(&f);
+    FAIL_IF(r != 0);
+    FAIL_IF_NULL(f.alstate);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p, 2));
+    FAIL_IF(PacketAlertCheck(p, 3));
+    FAIL_IF(PacketAlertCheck(p, 4));
+    FAIL_IF(PacketAlertCheck(p, 5));
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
 static int DetectHttpMethodIsdataatParseTest(void)
 {
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
@@ -2355,6 +2447,7 @@ void DetectHttpMethodRegisterTests(void)
     UtRegisterTest("DetectHttpMethodSigTest02", DetectHttpMethodSigTest02);
     UtRegisterTest("DetectHttpMethodSigTest03", DetectHttpMethodSigTest03);
     UtRegisterTest("DetectHttpMethodSigTest04", DetectHttpMethodSigTest04);
+    UtRegisterTest("DetectHttpMethodSigTest05", DetectHttpMethodSigTest05);
 
     UtRegisterTest("DetectHttpMethodIsdataatParseTest",
             DetectHttpMethodIsdataatParseTest);
@@ -28,6 +28,7 @@
 #include "../decode.h"
 #include "../flow.h"
 #include "../detect.h"
+#include "../util-file-decompression.h"
 
 /**
  * \test Test parser accepting valid rules and rejecting invalid rules
@@ -5398,6 +5399,229 @@ libhtp:\n\
     PASS;
 }
 
+/** \brief fill buf with data that zlib can't compress much */
+static void SwfTestFillData(uint8_t *buf, uint32_t len)
+{
+    uint32_t x = 12345;
+    for (uint32_t i = 0; i < len; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = (uint8_t)(x >> 16);
+    }
+}
+
+/** \brief build a zlib compressed swf file of plain */
+static uint32_t SwfTestBuildZlib(uint8_t *out, uint32_t out_size,
+        const uint8_t *plain, uint32_t plain_len)
+{
+    uLongf len = out_size - 8;
+    if (compress(out + 8, &len, plain, plain_len) != Z_OK)
+        return 0;
+    /* CWS, version 10, uncompressed length including the 8 byte header */
+    const uint32_t swf_len = plain_len + 8;
+    out[0] = 'C';
+    out[1] = 'W';
+    out[2] = 'S';
+    out[3] = 10;
+    out[4] = swf_len & 0xff;
+    out[5] = (swf_len >> 8) & 0xff;
+    out[6] = (swf_len >> 16) & 0xff;
+    out[7] = (swf_len >> 24) & 0xff;
+    return (uint32_t)len + 8;
+}
+
+/**
+ * \test a zlib swf decompressed as it arrives in two parts matches the
+ *       decompression of the whole file at once
+ */
+static int DetectEngineHttpServerBodyFileDataTest30(void)
+{
+    uint8_t plain[4000];
+    uint8_t swf[4200];
+    SwfTestFillData(plain, sizeof(plain));
+    const uint32_t swf_len = SwfTestBuildZlib(swf, sizeof(swf), plain, sizeof(plain));
+    FAIL_IF(swf_len < 1000);
+
+    ThreadVars th_v;
+    memset(&th_v, 0, sizeof(th_v));
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    InspectionBuffer one;
+    memset(&one, 0, sizeof(one));
+    FAIL_IF_NOT(FileSwfDecompression(swf, swf_len, det_ctx, &one,
+                HTTP_SWF_COMPRESSION_ZLIB, 0, 0) == 1);
+    FAIL_IF_NOT(one.inspect_len >= sizeof(plain) + 8);
+    FAIL_IF_NOT(memcmp(one.inspect, "FWS", 3) == 0);
+    FAIL_IF_NOT(memcmp(one.inspect + 8, plain, sizeof(plain)) == 0);
+
+    InspectionBuffer two;
+    memset(&two, 0, sizeof(two));
+    FileSwfStream *stream = NULL;
+    /* the first part ends in the middle of the compressed data */
+    FAIL_IF_NOT(FileSwfDecompressionStream(&stream, swf, swf_len / 2, det_ctx,
+                &two, HTTP_SWF_COMPRESSION_ZLIB, 0, 0) == 1);
+    FAIL_IF_NULL(stream);
+    FAIL_IF_NOT(two.inspect_len == one.inspect_len);
+    FAIL_IF(memcmp(two.inspect, one.inspect, one.inspect_len) == 0);
+
+    /* the whole file, only the second half is new */
+    FAIL_IF_NOT(FileSwfDecompressionStream(&stream, swf, swf_len, det_ctx,
+                &two, HTTP_SWF_COMPRESSION_ZLIB, 0, 0) == 1);
+    FAIL_IF_NOT(two.inspect_len == one.inspect_len);
+    FAIL_IF_NOT(memcmp(two.inspect, one.inspect, one.inspect_len) == 0);
+
+    FileSwfDecompressionStreamFree(stream);
+    InspectionBufferFree(&one);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/**
+ * \test the swf decompression kept with the response body is freed once
+ *       the file_data inspection window moves past the start of the body
+ */
+static int DetectEngineHttpServerBodyFileDataTest31(void)
+{
+    char input[] = "\
+%YAML 1.1\n\
+---\n\
+libhtp:\n\
+\n\
+  default-config:\n\
+    response-body-minimal-inspect-size: 32\n\
+    response-body-inspect-window: 16\n\
+\n\
+    swf-decompression:\n\
+      enabled: yes\n\
+      type: zlib\n\
+      compress-depth: 0\n\
+      decompress-depth: 0\n\
+";
+
+    ConfCreateContextBackup();
+    ConfInit();
+    HtpConfigCreateBackup();
+    ConfYamlLoadString(input, strlen(input));
+    HTPConfigure();
+
+    uint8_t plain[2000];
+    uint8_t swf[2200];
+    SwfTestFillData(plain, sizeof(plain));
+    const uint32_t swf_len = SwfTestBuildZlib(swf, sizeof(swf), plain, sizeof(plain));
+    FAIL_IF(swf_len < 1000);
+
+    uint8_t http_buf1[] =
+        "GET /file.swf HTTP/1.0\r\n"
+        "Host: www.openinfosecfoundation.org\r\n"
+        "\r\n";
+    uint32_t http_len1 = sizeof(http_buf1) - 1;
+    /* headers and the first 200 bytes of the body */
+    uint8_t http_buf2[512];
+    int hlen = snprintf((char *)http_buf2, sizeof(http_buf2),
+            "HTTP/1.1 200 ok\r\n"
+            "Content-Length: %u\r\n"
+            "Content-Type: application/x-shockwave-flash\r\n"
+            "\r\n", swf_len);
+    FAIL_IF(hlen <= 0 || hlen + 200 > (int)sizeof(http_buf2));
+    memcpy(http_buf2 + hlen, swf, 200);
+    uint32_t http_len2 = (uint32_t)hlen + 200;
+
+    TcpSession ssn;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p1 = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    Packet *p2 = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    Packet *p3 = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+
+    p1->flow = &f;
+    p1->flowflags |= FLOW_PKT_TOSERVER;
+    p1->flowflags |= FLOW_PKT_ESTABLISHED;
+    p1->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p2->flow = &f;
+    p2->flowflags |= FLOW_PKT_TOCLIENT;
+    p2->flowflags |= FLOW_PKT_ESTABLISHED;
+    p2->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p3->flow = &f;
+    p3->flowflags |= FLOW_PKT_TOCLIENT;
+    p3->flowflags |= FLOW_PKT_ESTABLISHED;
+    p3->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx,"alert tcp any any -> any any "
+                               "(flow:established,from_server; "
+                               "file_data; content:\"FWS\"; "
+                               "sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    int r = AppLayerParserParse(&th_v, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf1, http_len1);
+    FAIL_IF(r != 0);
+    HtpState *http_state = f.alstate;
+    FAIL_IF_NULL(http_state);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    FAIL_IF(PacketAlertCheck(p1, 1));
+
+    r = AppLayerParserParse(&th_v, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOCLIENT, http_buf2, http_len2);
+    FAIL_IF(r != 0);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 1));
+
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    FAIL_IF_NULL(tx);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(htud);
+    /* the window started at the body, so the decompression is kept */
+    FAIL_IF_NULL(htud->response_body.swf);
+
+    r = AppLayerParserParse(&th_v, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOCLIENT,
+            swf + 200, swf_len - 200);
+    FAIL_IF(r != 0);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p3);
+    /* the window no longer starts at the body, so it's gone */
+    FAIL_IF_NOT_NULL(htud->response_body.swf);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+
+    HTPFreeConfig();
+    HtpConfigRestoreBackup();
+    ConfRestoreContextBackup();
+
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    UTHFreePackets(&p3, 1);
+    PASS;
+}
+
 /**
  * \test Test that a signature containting a http_server_body is correctly parsed
  *       and the keyword is registered.
@@ -9252,4 +9476,8 @@ void DetectHttpServerBodyRegisterTests(void)
                   DetectEngineHttpServerBodyFileDataTest28);
     UtRegisterTest("DetectEngineHttpServerBodyFileDataTest29",
                   DetectEngineHttpServerBodyFileDataTest29);
+    UtRegisterTest("DetectEngineHttpServerBodyFileDataTest30",
+                  DetectEngineHttpServerBodyFileDataTest30);
+    UtRegisterTest("DetectEngineHttpServerBodyFileDataTest31",
+                  DetectEngineHttpServerBodyFileDataTest31);
 }
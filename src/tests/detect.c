@@ -4454,6 +4454,92 @@ static int SigTestDetectAlertCounter(void)
     PASS;
 }
 
+/** \test more alerts than fit in the packet: the ones with the highest
+ *        priority are kept, the rest is counted */
+static int SigTestDetectAlertQueue01(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    memset(&tv, 0, sizeof(tv));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    /* sigs are prepended to the list, so sid 1 ends up with num 0 */
+    for (int i = PACKET_ALERT_MAX + 5; i > 0; i--) {
+        char sig[128];
+        snprintf(sig, sizeof(sig), "alert tcp any any -> any any "
+                "(content:\"boo\"; sid:%d;)", i);
+        FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sig));
+    }
+    SigGroupBuild(de_ctx);
+    strlcpy(tv.name, "detect_test", sizeof(tv.name));
+    DetectEngineThreadCtxInit(&tv, de_ctx, (void *)&det_ctx);
+    StatsSetupPrivate(&tv);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"boo", strlen("boo"), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    Detect(&tv, p, det_ctx, NULL, NULL);
+    FAIL_IF_NOT(p->alerts.cnt == PACKET_ALERT_MAX);
+    FAIL_IF_NOT(p->alerts.discarded == 5);
+    for (int i = 0; i < PACKET_ALERT_MAX; i++) {
+        FAIL_IF_NOT(p->alerts.alerts[i].num == (SigIntId)i);
+        FAIL_IF_NOT(p->alerts.alerts[i].s->id == (uint32_t)i + 1);
+    }
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, det_ctx->counter_alerts) == PACKET_ALERT_MAX);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, det_ctx->counter_alerts_overflow) == 5);
+    FAIL_IF_NOT(det_ctx->alert_queue_size == 0);
+    UTHFreePackets(&p, 1);
+
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test over the inspection budget only the high priority rules are
+ *        inspected and the packet gets the engine event */
+static int SigTestDetectBudget01(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    memset(&tv, 0, sizeof(tv));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->budget_enabled = true;
+    de_ctx->budget_rules = 1;
+    de_ctx->budget_priority = 1;
+    de_ctx->budget_policy = DETECT_BUDGET_POLICY_EVENT;
+
+    /* sigs are prepended to the list, so sid 1 ends up with num 0 */
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"boo\"; priority:1; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"boo\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"boo\"; sid:1;)"));
+    SigGroupBuild(de_ctx);
+    strlcpy(tv.name, "detect_test", sizeof(tv.name));
+    DetectEngineThreadCtxInit(&tv, de_ctx, (void *)&det_ctx);
+    StatsSetupPrivate(&tv);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"boo", strlen("boo"), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    Detect(&tv, p, det_ctx, NULL, NULL);
+    FAIL_IF_NOT(p->alerts.cnt == 2);
+    FAIL_IF_NOT(p->alerts.alerts[0].s->id == 1);
+    FAIL_IF_NOT(p->alerts.alerts[1].s->id == 3);
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p, DETECT_INSPECTION_BUDGET_EXCEEDED));
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, det_ctx->counter_budget_exceeded) == 1);
+    UTHFreePackets(&p, 1);
+
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 /** \test test if the engine set flag to drop pkts of a flow that
  *        triggered a drop action on IPS mode */
 static int SigTestDropFlow01(void)
@@ -5413,6 +5499,8 @@ void SigRegisterTests(void)
     UtRegisterTest("SigTestDepthOffset01", SigTestDepthOffset01);
 
     UtRegisterTest("SigTestDetectAlertCounter", SigTestDetectAlertCounter);
+    UtRegisterTest("SigTestDetectAlertQueue01", SigTestDetectAlertQueue01);
+    UtRegisterTest("SigTestDetectBudget01", SigTestDetectBudget01);
 
     UtRegisterTest("SigTestDropFlow01", SigTestDropFlow01);
     UtRegisterTest("SigTestDropFlow02", SigTestDropFlow02);
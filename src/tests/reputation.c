@@ -27,14 +27,15 @@
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp.h"
 #include "util-unittest-helper.h"
+#include "util-fmemopen.h"
 
 #define TEST_INIT                                                       \
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();                    \
     FAIL_IF(de_ctx == NULL);                                            \
     SRepInit(de_ctx);                                                   \
                                                                         \
-    Address a;                                                          \
-    uint8_t cat = 0, value = 0;
+    SRepEntry e;                                                        \
+    memset(&e, 0, sizeof(e));
 
 #define TEST_INIT_WITH_PACKET(ip)                                       \
     uint8_t *buf = (uint8_t *)"Hi all!";                                \
@@ -42,26 +43,40 @@
     Packet *p = UTHBuildPacket((uint8_t *)buf, buflen, IPPROTO_TCP);    \
     FAIL_IF(p == NULL);                                                 \
     p->src.addr_data32[0] = UTHSetIPv4Address(ip);                      \
-    TEST_INIT
+    TEST_INIT                                                           \
+    SRepReader *reader = SRepReaderRegister();                          \
+    FAIL_IF_NULL(reader);
 
 #define TEST_CLEANUP                                                    \
     DetectEngineCtxFree(de_ctx);
 
 #define TEST_CLEANUP_WITH_PACKET                                        \
+    SRepReaderDeregister(reader);                                       \
+    SRepDestroy();                                                      \
     UTHFreePacket(p);                                                   \
     TEST_CLEANUP
 
+/** \brief look up the src of the packet like the iprep keyword does */
+static uint8_t SRepTestLookup(SRepReader *reader, Packet *p, uint8_t cat)
+{
+    const SRepCIDRTree *cidr_ctx = SRepReadBegin(reader);
+    uint8_t val = SRepCIDRGetIPRepSrc(cidr_ctx, p, cat);
+    SRepReadEnd(reader);
+    return val;
+}
+
 static int SRepTest01(void)
 {
     TEST_INIT;
 
     char ipstr[16];
     char str[] = "1.2.3.4,1,2";
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) != 0);
-    PrintInet(AF_INET, (const void *)&a.address, ipstr, sizeof(ipstr));
+    FAIL_IF(SRepSplitLine(str, &e) != 0);
+    PrintInet(AF_INET, (const void *)&e.addr, ipstr, sizeof(ipstr));
     FAIL_IF(strcmp(ipstr, "1.2.3.4") != 0);
-    FAIL_IF(cat != 1);
-    FAIL_IF(value != 2);
+    FAIL_IF(e.netmask != 32);
+    FAIL_IF(e.cat != 1);
+    FAIL_IF(e.value != 2);
 
     TEST_CLEANUP;
     PASS;
@@ -72,7 +87,7 @@ static int SRepTest02(void)
     TEST_INIT;
 
     char str[] = "1.1.1.1,";
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) == 0);
+    FAIL_IF(SRepSplitLine(str, &e) == 0);
 
     TEST_CLEANUP;
     PASS;
@@ -96,7 +111,12 @@ static int SRepTest04(void)
     TEST_INIT;
 
     char str[] = "10.0.0.0/16,1,2";
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(str, &e) != 0);
+    FAIL_IF(e.family != AF_INET);
+    FAIL_IF(e.netmask != 16);
+
+    char bad[] = "10.0.0.0/33,1,2";
+    FAIL_IF(SRepSplitLine(bad, &e) != -1);
 
     TEST_CLEANUP;
     PASS;
@@ -107,10 +127,11 @@ static int SRepTest05(void)
     TEST_INIT_WITH_PACKET("10.0.0.1");
 
     char str[] = "10.0.0.0/16,1,20";
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(str, &e) != 0);
+    FAIL_IF(SRepUpdate(&e, 1) != 0);
 
-    cat = 1;
-    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, cat, 0) != 20);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 20);
+    FAIL_IF(SRepTestLookup(reader, p, 2) != 0);
 
     TEST_CLEANUP_WITH_PACKET;
     PASS;
@@ -124,10 +145,10 @@ static int SRepTest06(void)
         "0.0.0.0/0,1,10\n"
         "192.168.0.0/16,2,127";
 
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(str, &e) != 0);
+    FAIL_IF(SRepUpdate(&e, 1) != 0);
 
-    cat = 1;
-    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, cat, 0) != 10);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 10);
 
     TEST_CLEANUP_WITH_PACKET;
     PASS;
@@ -137,12 +158,73 @@ static int SRepTest07(void) {
     TEST_INIT;
 
     char str[] = "2000:0000:0000:0000:0000:0000:0000:0001,";
-    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str, &a, &cat, &value) == 0);
+    FAIL_IF(SRepSplitLine(str, &e) == 0);
 
     TEST_CLEANUP;
     PASS;
 }
 
+/** \test updates change both copies, a host entry beats its netblock and
+ *        removing it uncovers the netblock again */
+static int SRepTest08(void)
+{
+    TEST_INIT_WITH_PACKET("10.0.0.1");
+
+    char net[] = "10.0.0.0/8,1,20";
+    char host[] = "10.0.0.1,1,100";
+    SRepEntry u[2];
+    FAIL_IF(SRepSplitLine(net, &u[0]) != 0);
+    FAIL_IF(SRepSplitLine(host, &u[1]) != 0);
+    FAIL_IF(SRepUpdate(u, 2) != 0);
+    /* the same after every update, whichever copy is in use */
+    for (int i = 0; i < 3; i++) {
+        FAIL_IF(SRepTestLookup(reader, p, 1) != 100);
+        FAIL_IF(SRepUpdate(NULL, 0) != 0);
+    }
+
+    /* updating an entry replaces its value */
+    u[1].value = 50;
+    FAIL_IF(SRepUpdate(&u[1], 1) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 50);
+    FAIL_IF(SRepUpdate(NULL, 0) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 50);
+
+    u[1].remove = true;
+    FAIL_IF(SRepUpdate(&u[1], 1) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 20);
+    FAIL_IF(SRepUpdate(NULL, 0) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 20);
+
+    /* the reader is idle between lookups */
+    FAIL_IF(SC_ATOMIC_GET(reader->gen) != 0);
+
+    TEST_CLEANUP_WITH_PACKET;
+    PASS;
+}
+
+/** \test loading a file replaces all entries */
+static int SRepTest09(void)
+{
+    TEST_INIT_WITH_PACKET("10.0.0.1");
+
+    char host[] = "10.0.0.1,1,100";
+    FAIL_IF(SRepSplitLine(host, &e) != 0);
+    FAIL_IF(SRepUpdate(&e, 1) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 100);
+
+    const char *buffer = "# comment\n10.0.0.0/24,2,30\n2001:db8::/32,1,40\n";
+    FILE *fp = SCFmemopen((void *)buffer, strlen(buffer), "r");
+    FAIL_IF_NULL(fp);
+    FAIL_IF(SRepLoadFileFromFD(fp) != 0);
+    fclose(fp);
+
+    FAIL_IF(SRepTestLookup(reader, p, 1) != 0);
+    FAIL_IF(SRepTestLookup(reader, p, 2) != 30);
+
+    TEST_CLEANUP_WITH_PACKET;
+    PASS;
+}
+
 /** Register the following unittests for the Reputation module */
 void SCReputationRegisterTests(void)
 {
@@ -153,4 +235,6 @@ void SCReputationRegisterTests(void)
     UtRegisterTest("SRepTest05", SRepTest05);
     UtRegisterTest("SRepTest06", SRepTest06);
     UtRegisterTest("SRepTest07", SRepTest07);
+    UtRegisterTest("SRepTest08", SRepTest08);
+    UtRegisterTest("SRepTest09", SRepTest09);
 }
@@ -146,6 +146,37 @@ static int StreamTcpInlineTest08(void)
     INLINE_END;
 }
 
+#define INLINE_STEP_MODIFIED(rseq, seg, seglen, packet, packetlen, modified) \
+    p = UTHBuildPacketReal((uint8_t *)(seg), (seglen), IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);    \
+    FAIL_IF(p == NULL); \
+    p->tcph->th_seq = htonl(stream->isn + (rseq)); \
+    p->tcph->th_ack = htonl(31);  \
+    FAIL_IF (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, stream, p) < 0);   \
+    FAIL_IF (memcmp(p->payload, packet, MIN((packetlen),p->payload_len)) != 0); \
+    FAIL_IF (((p->flags & PKT_STREAM_MODIFIED) != 0) != (modified)); \
+    UTHFreePacket(p);
+
+/** \test only packets with different data are rewritten */
+static int StreamTcpInlineTest09(void)
+{
+    INLINE_START(0);
+    INLINE_STEP_MODIFIED(1, "0123456789abcdefghijklmnopqrstuvwxyzABCD", 40,
+            "0123456789abcdefghijklmnopqrstuvwxyzABCD", 40, false);
+    /* same data again */
+    INLINE_STEP_MODIFIED(1, "0123456789abcdefghijklmnopqrstuvwxyzABCD", 40,
+            "0123456789abcdefghijklmnopqrstuvwxyzABCD", 40, false);
+    /* one byte in the 2nd block and one in the last, partial, block */
+    INLINE_STEP_MODIFIED(1, "0123456789abcdefghijXlmnopqrstuvwxyzABXD", 40,
+            "0123456789abcdefghijklmnopqrstuvwxyzABCD", 40, true);
+    /* partial overlap, same data */
+    INLINE_STEP_MODIFIED(31, "uvwxyzABCDEFGH", 14, "uvwxyzABCDEFGH", 14, false);
+    /* partial overlap, different data */
+    INLINE_STEP_MODIFIED(35, "XXXXXXXXXXXX", 12, "yzABCDEFGHXX", 12, true);
+    FAIL_IF(!(VALIDATE(stream,
+            (uint8_t *)"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHXX", 46)));
+    INLINE_END;
+}
+
 void StreamTcpInlineRegisterTests(void)
 {
     UtRegisterTest("StreamTcpInlineTest01", StreamTcpInlineTest01);
@@ -156,4 +187,5 @@ void StreamTcpInlineRegisterTests(void)
     UtRegisterTest("StreamTcpInlineTest06", StreamTcpInlineTest06);
     UtRegisterTest("StreamTcpInlineTest07", StreamTcpInlineTest07);
     UtRegisterTest("StreamTcpInlineTest08", StreamTcpInlineTest08);
+    UtRegisterTest("StreamTcpInlineTest09", StreamTcpInlineTest09);
 }
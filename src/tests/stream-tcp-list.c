@@ -708,6 +708,60 @@ static int StreamTcpReassembleTest32(void)
     OVERLAP_END;
 }
 
+/** \test in order segments are appended at the tail, an out of order one
+ *        after them still goes through the tree and the overlap checks */
+static int StreamTcpReassembleTest33(void)
+{
+    OVERLAP_START(UINT_MAX - 5, OS_POLICY_BSD);
+    OVERLAP_STEP(1, "AAA", 3, "AAA", 3);
+    FAIL_IF(stream->seg_tail == NULL || stream->seg_tail->seq != stream->isn + 1);
+    OVERLAP_STEP(4, "BBB", 3, "AAABBB", 6);
+    OVERLAP_STEP(7, "CCC", 3, "AAABBBCCC", 9);
+    FAIL_IF(stream->seg_tail == NULL || stream->seg_tail->seq != stream->isn + 7);
+    OVERLAP_STEP(13, "EEE", 3, "AAABBBCCC\0\0\0EEE", 15);
+    OVERLAP_STEP(9, "xDDD", 4, "AAABBBCCCDDDEEE", 15);
+    FAIL_IF(stream->seg_tail == NULL || stream->seg_tail->seq != stream->isn + 13);
+
+    uint32_t cnt = 0;
+    TcpSegment *seg = NULL, *prev = NULL;
+    RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+        FAIL_IF(prev != NULL && SEQ_LEQ(seg->seq, prev->seq));
+        prev = seg;
+        cnt++;
+    }
+    FAIL_IF(cnt != 5);
+    FAIL_IF(RB_MAX(TCPSEG, &stream->seg_tree) != stream->seg_tail);
+    OVERLAP_END;
+}
+
+/** \test small in order segments are coalesced with the FIRST policy, an
+ *        overlap with a coalesced segment still keeps the old data */
+static int StreamTcpReassembleTest34(void)
+{
+    OVERLAP_START(9, OS_POLICY_FIRST);
+    stream_config.segment_coalesce_size = 8;
+    OVERLAP_STEP(1, "AA", 2, "AA", 2);
+    OVERLAP_STEP(3, "BBB", 3, "AABBB", 5);
+    OVERLAP_STEP(6, "CC", 2, "AABBBCC", 7);
+    /* too big for the coalesced segment */
+    OVERLAP_STEP(8, "DDD", 3, "AABBBCCDDD", 10);
+
+    uint32_t cnt = 0;
+    TcpSegment *seg = NULL;
+    RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+        cnt++;
+    }
+    FAIL_IF(cnt != 2);
+    seg = RB_MIN(TCPSEG, &stream->seg_tree);
+    FAIL_IF(TCP_SEG_LEN(seg) != 7);
+    FAIL_IF(seg->sbseg.segment_len != 7);
+    FAIL_IF(stream->segs_right_edge != stream->isn + 11);
+
+    OVERLAP_STEP(4, "xxxx", 4, "AABBBCCDDD", 10);
+    stream_config.segment_coalesce_size = 0;
+    OVERLAP_END;
+}
+
 void StreamTcpListRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleTest01 -- BSD policy",
@@ -729,5 +783,9 @@ void StreamTcpListRegisterTests(void)
             StreamTcpReassembleTest31);
     UtRegisterTest("StreamTcpReassembleTest32",
             StreamTcpReassembleTest32);
+    UtRegisterTest("StreamTcpReassembleTest33",
+            StreamTcpReassembleTest33);
+    UtRegisterTest("StreamTcpReassembleTest34",
+            StreamTcpReassembleTest34);
 
 }
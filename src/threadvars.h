@@ -30,6 +30,7 @@
 #include "threads.h"
 
 struct TmSlot_;
+struct LatencyThreadCtx_;
 
 /** Thread flags set and read by threads to control the threads */
 #define THV_USE       1 /** thread is in use */
@@ -103,6 +104,9 @@ typedef struct ThreadVars_ {
     /** private counter store: counter updates modify this */
     StatsPrivateThreadContext perf_private_ctx;
 
+    /** sampled latency histograms, NULL if not enabled */
+    struct LatencyThreadCtx_ *latency;
+
     SCCtrlMutex *ctrl_mutex;
     SCCtrlCondT *ctrl_cond;
 
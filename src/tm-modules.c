@@ -224,12 +224,18 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_RECEIVEAFP);
         CASE_CODE (TMM_ALERTPCAPINFO);
         CASE_CODE (TMM_DECODEAFP);
+        CASE_CODE (TMM_RECEIVEAFXDP);
+        CASE_CODE (TMM_DECODEAFXDP);
+        CASE_CODE (TMM_RECEIVEDPDK);
+        CASE_CODE (TMM_DECODEDPDK);
         CASE_CODE (TMM_STATSLOGGER);
         CASE_CODE (TMM_FLOWMANAGER);
         CASE_CODE (TMM_FLOWRECYCLER);
         CASE_CODE (TMM_BYPASSEDFLOWMANAGER);
         CASE_CODE (TMM_UNIXMANAGER);
         CASE_CODE (TMM_DETECTLOADER);
+        CASE_CODE (TMM_DETECTOFFLOAD);
+        CASE_CODE (TMM_FILESTOREWRITER);
         CASE_CODE (TMM_RECEIVENETMAP);
         CASE_CODE (TMM_DECODENETMAP);
         CASE_CODE (TMM_RECEIVEWINDIVERT);
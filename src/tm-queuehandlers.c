@@ -34,6 +34,7 @@
 #include "tmqh-nfq.h"
 #include "tmqh-packetpool.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
 
 void TmqhSetup (void)
 {
@@ -43,11 +44,15 @@ void TmqhSetup (void)
     TmqhNfqRegister();
     TmqhPacketpoolRegister();
     TmqhFlowRegister();
+    TmqhRingRegister();
 }
 
 /** \brief Clean up registration time allocs */
 void TmqhCleanup(void)
 {
+    TmqhRingCleanup();
+    TmqhFlowCleanup();
+    TmqhPacketpoolCleanup();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(const char *name)
@@ -51,6 +51,10 @@ typedef enum {
     TMM_DECODEERFDAG,
     TMM_RECEIVEAFP,
     TMM_DECODEAFP,
+    TMM_RECEIVEAFXDP,
+    TMM_DECODEAFXDP,
+    TMM_RECEIVEDPDK,
+    TMM_DECODEDPDK,
     TMM_RECEIVENETMAP,
     TMM_DECODENETMAP,
     TMM_ALERTPCAPINFO,
@@ -67,6 +71,8 @@ typedef enum {
     TMM_FLOWRECYCLER,
     TMM_BYPASSEDFLOWMANAGER,
     TMM_DETECTLOADER,
+    TMM_DETECTOFFLOAD,
+    TMM_FILESTOREWRITER,
 
     TMM_UNIXMANAGER,
 
@@ -34,12 +34,14 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-ring.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-cpu.h"
 #include "util-optimize.h"
 #include "util-profiling.h"
+#include "util-latency.h"
 #include "util-signal.h"
 #include "queue.h"
 
@@ -81,6 +83,10 @@ ThreadVars *tv_root[TVT_MAX] = { NULL };
 /* lock to protect tv_root */
 SCMutex tv_root_lock = SCMUTEX_INITIALIZER;
 
+/* packet threads stopped at runtime, freed at shutdown. Protected by
+ * tv_root_lock. */
+static ThreadVars *tv_retired = NULL;
+
 /**
  * \brief Check if a thread flag is set.
  *
@@ -123,6 +129,7 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     for (s = slot; s != NULL; s = s->slot_next) {
         TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
         PACKET_PROFILING_TMM_START(p, s->tm_id);
+        LATENCY_SLOT_START(tv, s);
 
         if (unlikely(s->id == 0)) {
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, &s->slot_post_pq);
@@ -130,6 +137,7 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, NULL);
         }
 
+        LATENCY_SLOT_END(tv, s);
         PACKET_PROFILING_TMM_END(p, s->tm_id);
 
         /* handle error */
@@ -319,6 +327,8 @@ static void *TmThreadsSlotPktAcqLoop(void *td)
         }
     }
 
+    PacketPoolRegisterCounters(tv);
+    LatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -354,6 +364,7 @@ static void *TmThreadsSlotPktAcqLoop(void *td)
     TmThreadWaitForFlag(tv, THV_DEINIT);
 
     PacketPoolDestroy();
+    LatencyThreadDeinit(tv);
 
     for (slot = s; slot != NULL; slot = slot->slot_next) {
         if (slot->SlotThreadExitPrintStats != NULL) {
@@ -445,6 +456,8 @@ static void *TmThreadsSlotPktAcqLoopAFL(void *td)
         }
     }
 
+    PacketPoolRegisterCounters(tv);
+    LatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -472,6 +485,7 @@ static void *TmThreadsSlotPktAcqLoopAFL(void *td)
     TmThreadsSetFlag(tv, THV_RUNNING_DONE);
 
     PacketPoolDestroy();
+    LatencyThreadDeinit(tv);
 
     for (slot = s; slot != NULL; slot = slot->slot_next) {
         if (slot->SlotThreadExitPrintStats != NULL) {
@@ -562,6 +576,8 @@ static void *TmThreadsSlotVar(void *td)
         }
     }
 
+    PacketPoolRegisterCounters(tv);
+    LatencyThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -632,6 +648,7 @@ static void *TmThreadsSlotVar(void *td)
     TmThreadWaitForFlag(tv, THV_DEINIT);
 
     PacketPoolDestroy();
+    LatencyThreadDeinit(tv);
 
     s = (TmSlot *)tv->tm_slots;
 
@@ -1446,7 +1463,7 @@ static int TmThreadKillThread(ThreadVars *tv)
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
             PacketQueue *q = &trans_q[tv->inq->id];
-            if (q->len != 0) {
+            if (q->len != 0 || TmqhRingQueueLen(tv->inq->id) != 0) {
                 return 0;
             }
         }
@@ -1493,6 +1510,59 @@ static int TmThreadKillThread(ThreadVars *tv)
     return 1;
 }
 
+/**
+ * \brief Stop a packet thread while the engine keeps running.
+ *
+ * The thread is taken out of the thread list first, so a rule reload
+ * doesn't pick it up anymore, and unregistered so the flow manager no
+ * longer injects pseudo packets into it. Then its capture loop is broken
+ * off, the pseudo packets it already has are processed and the thread is
+ * joined. The ThreadVars are kept until shutdown, as the stats thread
+ * still reads its counters.
+ *
+ * \param tv packet thread with a receive module
+ */
+void TmThreadRetire(ThreadVars *tv)
+{
+    TmThreadRemove(tv, TVT_PPT);
+    TmThreadsUnregisterThread(tv->id);
+
+    /* a thread that failed its init has closed already */
+    if (!TmThreadsCheckFlag(tv, THV_CLOSED)) {
+        TmSlot *slot = tv->tm_slots;
+        TmModule *tm = TmModuleGetById(slot->tm_id);
+        if (tm->PktAcqBreakLoop != NULL) {
+            tm->PktAcqBreakLoop(tv, SC_ATOMIC_GET(slot->slot_data));
+        }
+        TmThreadsSetFlag(tv, THV_KILL_PKTACQ);
+        while (!TmThreadsCheckFlag(tv, THV_FLOW_LOOP)) {
+            SleepMsec(1);
+        }
+
+        TmThreadsSetFlag(tv, THV_KILL);
+        while (!TmThreadsCheckFlag(tv, THV_RUNNING_DONE)) {
+            SleepMsec(1);
+        }
+
+        TmThreadsSetFlag(tv, THV_DEINIT);
+        while (!TmThreadsCheckFlag(tv, THV_CLOSED)) {
+            SleepMsec(1);
+        }
+    }
+    pthread_join(tv->t, NULL);
+    TmThreadsSetFlag(tv, THV_DEAD);
+    SCLogDebug("thread %s retired", tv->name);
+
+    /* the id may be handed out again already, don't unregister it twice */
+    tv->id = 0;
+
+    SCMutexLock(&tv_root_lock);
+    tv->prev = NULL;
+    tv->next = tv_retired;
+    tv_retired = tv;
+    SCMutexUnlock(&tv_root_lock);
+}
+
 /** \internal
  *
  *  \brief make sure that all packet threads are done processing their
@@ -1525,7 +1595,7 @@ again:
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
                 PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (q->len != 0 || TmqhRingQueueLen(tv->inq->id) != 0) {
                     SCMutexUnlock(&tv_root_lock);
 
                     /* sleep outside lock */
@@ -1597,7 +1667,7 @@ again:
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
                     PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (q->len != 0 || TmqhRingQueueLen(tv->inq->id) != 0) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         SleepMsec(1);
@@ -1856,6 +1926,16 @@ void TmThreadClearThreadsFamily(int family)
         TmThreadFree(ptv);
     }
     tv_root[family] = NULL;
+
+    if (family == TVT_PPT) {
+        tv = tv_retired;
+        while (tv) {
+            ptv = tv;
+            tv = tv->next;
+            TmThreadFree(ptv);
+        }
+        tv_retired = NULL;
+    }
     SCMutexUnlock(&tv_root_lock);
 }
 
@@ -2381,16 +2461,23 @@ void TmreadsGetMinimalTimestamp(struct timeval *ts)
  */
 int TmThreadsInjectPacketsById(Packet **packets, const int id)
 {
-    if (id <= 0 || id > (int)thread_store.threads_size)
+    /* held while queueing, so a thread that is retired at runtime gets
+     * no packets after it has been unregistered */
+    SCMutexLock(&thread_store_lock);
+    if (id <= 0 || id > (int)thread_store.threads_size) {
+        SCMutexUnlock(&thread_store_lock);
         return 0;
+    }
 
     int idx = id - 1;
 
     Thread *t = &thread_store.threads[idx];
     ThreadVars *tv = t->tv;
 
-    if (tv == NULL || tv->stream_pq == NULL)
+    if (t->in_use == 0 || tv == NULL || tv->stream_pq == NULL) {
+        SCMutexUnlock(&thread_store_lock);
         return 0;
+    }
 
     SCMutexLock(&tv->stream_pq->mutex_q);
     while (*packets != NULL) {
@@ -2398,6 +2485,7 @@ int TmThreadsInjectPacketsById(Packet **packets, const int id)
         packets++;
     }
     SCMutexUnlock(&tv->stream_pq->mutex_q);
+    SCMutexUnlock(&thread_store_lock);
 
     /* wake up listening thread(s) if necessary */
     if (tv->inq != NULL) {
@@ -2405,3 +2493,33 @@ int TmThreadsInjectPacketsById(Packet **packets, const int id)
     }
     return 1;
 }
+
+/** \brief get the number of injected packets a thread hasn't handled yet
+ *
+ *  Read without the queue lock, so it's only an indication.
+ */
+/**
+ *  \retval 1 if a thread is registered with this id, 0 if it is not or
+ *          it was retired
+ */
+int TmThreadsIsRegistered(const int id)
+{
+    int r = 0;
+    SCMutexLock(&thread_store_lock);
+    if (id > 0 && id <= (int)thread_store.threads_size) {
+        r = thread_store.threads[id - 1].in_use;
+    }
+    SCMutexUnlock(&thread_store_lock);
+    return r;
+}
+
+uint32_t TmThreadsInjectQueueLenById(const int id)
+{
+    if (id <= 0 || id > (int)thread_store.threads_size)
+        return 0;
+
+    ThreadVars *tv = thread_store.threads[id - 1].tv;
+    if (tv == NULL || tv->stream_pq == NULL)
+        return 0;
+    return tv->stream_pq->len;
+}
@@ -28,6 +28,7 @@
 #include "tmqh-packetpool.h"
 #include "tm-threads-common.h"
 #include "tm-modules.h"
+#include "util-trace.h"
 
 #ifdef OS_WIN32
 static inline void SleepUsec(uint64_t usec)
@@ -114,6 +115,7 @@ void TmThreadKillThreads(void);
 void TmThreadClearThreadsFamily(int family);
 void TmThreadAppend(ThreadVars *, int);
 void TmThreadRemove(ThreadVars *, int);
+void TmThreadRetire(ThreadVars *);
 void TmThreadSetGroupName(ThreadVars *tv, const char *name);
 
 TmEcode TmThreadSetCPUAffinity(ThreadVars *, uint16_t);
@@ -154,6 +156,8 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
 {
     TmEcode r = TM_ECODE_OK;
 
+    SCTrace2(packet_acquire, p, GET_PKT_LEN(p));
+
     if (s == NULL) {
         tv->tmqh_out(tv, p);
         return r;
@@ -232,7 +236,9 @@ static inline void TmThreadsCaptureInjectPacket(ThreadVars *tv, TmSlot *slot, Pa
 void TmThreadsListThreads(void);
 int TmThreadsRegisterThread(ThreadVars *tv, const int type);
 void TmThreadsUnregisterThread(const int id);
+int TmThreadsIsRegistered(const int id);
 int TmThreadsInjectPacketsById(Packet **, int id);
+uint32_t TmThreadsInjectQueueLenById(const int id);
 
 void TmThreadsSetThreadTimestamp(const int id, const struct timeval *ts);
 void TmreadsGetMinimalTimestamp(struct timeval *ts);
@@ -33,6 +33,7 @@
 #include "threads.h"
 #include "threadvars.h"
 #include "tmqh-flow.h"
+#include "tmqh-ring.h"
 
 #include "tm-queuehandlers.h"
 
@@ -40,11 +41,37 @@
 #include "util-unittest.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
-void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
-void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
-void *TmqhOutputFlowSetupCtx(const char *queue_str);
-void TmqhOutputFlowFreeCtx(void *ctx);
-void TmqhFlowRegisterTests(void);
+
+/** Flow to queue assignments of the active-packets scheduler. Shared by
+ *  all capture threads so both directions of a flow end up at the same
+ *  worker. Entries are indexed by flow hash and hold the full hash, the
+ *  queue index and the low bits of the time the flow was last seen:
+ *  [ hash:32 | queue:16 | ts:16 ] */
+#define BALANCE_TABLE_SIZE      (1 << 20)
+/** assignments not seen for this long (in seconds) are expired */
+#define BALANCE_ENTRY_TIMEOUT   60
+
+static uint64_t *balance_table = NULL;
+
+#define BALANCE_ENTRY(hash, qid, ts) \
+    (((uint64_t)(hash) << 32) | ((uint64_t)(qid) << 16) | ((ts) & 0xffff))
+#define BALANCE_ENTRY_HASH(e)   (uint32_t)((e) >> 32)
+#define BALANCE_ENTRY_QID(e)    (uint16_t)(((e) >> 16) & 0xffff)
+#define BALANCE_ENTRY_TS(e)     (uint16_t)((e) & 0xffff)
+
+static void TmqhFlowBalanceInit(void)
+{
+    if (balance_table != NULL)
+        return;
+
+    balance_table = SCMallocAligned(BALANCE_TABLE_SIZE * sizeof(uint64_t), CLS);
+    if (unlikely(balance_table == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc the autofp "
+                   "active-packets table. Killing engine.");
+        exit(EXIT_FAILURE);
+    }
+    memset(balance_table, 0, BALANCE_TABLE_SIZE * sizeof(uint64_t));
+}
 
 void TmqhFlowRegister(void)
 {
@@ -60,8 +87,8 @@ void TmqhFlowRegister(void)
             SCLogNotice("using flow hash instead of round robin");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
-            SCLogNotice("using flow hash instead of active packets");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            TmqhFlowBalanceInit();
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
@@ -87,8 +114,35 @@ void TmqhFlowPrintAutofpHandler(void)
 
     PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhOutputFlowActivePackets, "ActivePackets");
 
 #undef PRINT_IF_FUNC
+
+    if (strcmp(TmqhAutofpGetHandlerName(), "ring") == 0)
+        SCLogConfig("AutoFP mode using lock-free ring queues");
+}
+
+/**
+ * \brief get the name of the queue handler autofp runmodes should use
+ *        between the capture threads and the workers
+ *
+ * Set by 'autofp-queue-type': 'mutex' (default) for the mutex protected
+ * packet queues of the "flow" handler or 'ring' for the lock-free rings
+ * of the "ring" handler.
+ */
+const char *TmqhAutofpGetHandlerName(void)
+{
+    const char *type = NULL;
+
+    if (ConfGet("autofp-queue-type", &type) == 1 && type != NULL) {
+        if (strcasecmp(type, "ring") == 0) {
+            return "ring";
+        } else if (strcasecmp(type, "mutex") != 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                         "for autofp-queue-type, using \"mutex\"", type);
+        }
+    }
+    return "flow";
 }
 
 /* same as 'simple' */
@@ -214,6 +268,11 @@ void TmqhOutputFlowFreeCtx(void *ctx)
 
     SCLogPerf("AutoFP - Total flow handler queues - %" PRIu16,
               fctx->size);
+    if (fctx->balanced_flows > 0) {
+        SCLogPerf("AutoFP - flows assigned to the least loaded queue - %" PRIu64
+                  ", to the hash queue - %" PRIu64,
+                  fctx->balanced_flows, fctx->hashed_flows);
+    }
     SCFree(fctx->queues);
     SCFree(fctx);
 
@@ -222,19 +281,8 @@ void TmqhOutputFlowFreeCtx(void *ctx)
 
 void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
-    int16_t qid = 0;
-
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
-    if (p->flags & PKT_WANTS_FLOW) {
-        uint32_t hash = p->flow_hash;
-        qid = hash % ctx->size;
-    } else {
-        qid = ctx->last++;
-
-        if (ctx->last == ctx->size)
-            ctx->last = 0;
-    }
+    uint16_t qid = TmqhFlowHashQueueId(ctx, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -253,23 +301,130 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
  */
 void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
 {
-    int16_t qid = 0;
-    uint32_t addr_hash = 0;
-    int i;
-
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowIPPairQueueId(ctx, p);
+
+    PacketQueue *q = ctx->queues[qid].q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+
+    return;
+}
+
+/** \brief free the active-packets table */
+void TmqhFlowCleanup(void)
+{
+    if (balance_table != NULL) {
+        SCFreeAligned(balance_table);
+        balance_table = NULL;
+    }
+}
 
-    if (p->src.family == AF_INET6) {
-        for (i = 0; i < 4; i++) {
-            addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
+/** \brief get the index of the queue with the least packets waiting
+ *
+ *  Queue depths are read without locking, so this is a best effort. Ties
+ *  are broken round robin.
+ */
+static uint16_t TmqhFlowLeastLoadedQueueId(TmqhFlowCtx *ctx)
+{
+    uint16_t best = ctx->last;
+    uint32_t best_len = UINT32_MAX;
+
+    for (uint16_t i = 0; i < ctx->size; i++) {
+        uint16_t qid = (ctx->last + i) % ctx->size;
+        PacketQueue *q = ctx->queues[qid].q;
+        /* injected packets use the PacketQueue, the rest is in the ring
+         * if autofp-queue-type is 'ring' */
+        uint32_t len = q->len + TmqhRingQueueLen((uint16_t)(q - trans_q));
+        if (len < best_len) {
+            best = qid;
+            best_len = len;
+            if (len == 0)
+                break;
         }
-    } else {
-        addr_hash = p->src.addr_data32[0] + p->dst.addr_data32[0];
     }
 
-    /* we don't have to worry about possible overflow, since
-     * ctx->size will be lesser than 2 ** 31 for sure */
-    qid = addr_hash % ctx->size;
+    ctx->last = (best + 1) % ctx->size;
+    return best;
+}
+
+/** \brief get the output queue of a packet for the active-packets scheduler
+ *
+ *  The first packet of a flow picks the queue with the least packets
+ *  waiting. The assignment is kept in the balance table and reused for
+ *  the rest of the flow, so the flow stays with its worker. Assignments
+ *  expire after BALANCE_ENTRY_TIMEOUT seconds without packets, at which
+ *  point no packets of the flow can be queued anymore.
+ *
+ *  If the slot is taken by another active flow the packet falls back to
+ *  the flow hash queue. TCP packets that don't start a session also use
+ *  the hash queue when claiming a slot, as they may already have been
+ *  queued through that fallback.
+ */
+uint16_t TmqhFlowActivePacketsQueueId(TmqhFlowCtx *ctx, const Packet *p)
+{
+    if (!(p->flags & PKT_WANTS_FLOW))
+        return TmqhFlowHashQueueId(ctx, p);
+
+    const uint32_t hash = p->flow_hash;
+    const uint16_t ts = (uint16_t)p->ts.tv_sec;
+    uint64_t *slot = &balance_table[hash & (BALANCE_TABLE_SIZE - 1)];
+    uint64_t e = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    while (1) {
+        const int expired = (e == 0 ||
+                (uint16_t)(ts - BALANCE_ENTRY_TS(e)) > BALANCE_ENTRY_TIMEOUT);
+
+        if (!expired && BALANCE_ENTRY_QID(e) < ctx->size) {
+            if (BALANCE_ENTRY_HASH(e) != hash) {
+                /* slot in use by another flow */
+                return hash % ctx->size;
+            }
+            /* refresh at most once per second to limit the cache line
+             * bouncing between capture threads */
+            if (BALANCE_ENTRY_TS(e) != ts) {
+                __atomic_store_n(slot, BALANCE_ENTRY(hash, BALANCE_ENTRY_QID(e), ts),
+                        __ATOMIC_RELAXED);
+            }
+            return BALANCE_ENTRY_QID(e);
+        }
+
+        uint16_t qid;
+        const int balance = !(PKT_IS_TCP(p) &&
+                (p->tcph->th_flags & (TH_SYN|TH_ACK)) != TH_SYN);
+        if (balance) {
+            qid = TmqhFlowLeastLoadedQueueId(ctx);
+        } else {
+            qid = hash % ctx->size;
+        }
+
+        uint64_t n = BALANCE_ENTRY(hash, qid, ts);
+        if (__atomic_compare_exchange_n(slot, &e, n, false,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            if (balance)
+                ctx->balanced_flows++;
+            else
+                ctx->hashed_flows++;
+            return qid;
+        }
+        /* another capture thread updated the slot, 'e' now holds its
+         * value: check again */
+    }
+}
+
+/**
+ * \brief select the queue to output to based on the queue depths, keeping
+ *        flows on the queue they started on.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowActivePacketsQueueId(ctx, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -418,6 +573,64 @@ end:
     return retval;
 }
 
+/** \test active-packets: new flows go to the least loaded queue and
+ *        keep it */
+static int TmqhFlowActivePacketsTest01(void)
+{
+    TmqResetQueues();
+    TmqhFlowBalanceInit();
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2,queue3");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF_NOT(fctx->size == 3);
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flags |= PKT_WANTS_FLOW;
+    p->flow_hash = 1234;
+    p->ts.tv_sec = 100;
+
+    trans_q[0].len = 5;
+    trans_q[1].len = 10;
+    trans_q[2].len = 0;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == 2);
+
+    /* flow keeps its queue when that queue fills up */
+    trans_q[2].len = 50;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == 2);
+
+    /* a new flow goes to the least loaded queue */
+    p->flow_hash = 5678;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == 0);
+
+    /* slot taken by an active flow: fall back to the hash */
+    p->flow_hash = 1234 + BALANCE_TABLE_SIZE;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == p->flow_hash % 3);
+
+    /* tcp packet not starting a session uses the hash */
+    TCPHdr tcph;
+    memset(&tcph, 0, sizeof(tcph));
+    tcph.th_flags = TH_ACK;
+    p->tcph = &tcph;
+    p->flow_hash = 1000;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == 1000 % 3);
+    p->tcph = NULL;
+
+    /* expired assignment is balanced again */
+    p->flow_hash = 1234;
+    p->ts.tv_sec = 100 + BALANCE_ENTRY_TIMEOUT + 1;
+    FAIL_IF_NOT(TmqhFlowActivePacketsQueueId(fctx, p) == 0);
+
+    trans_q[0].len = 0;
+    trans_q[1].len = 0;
+    trans_q[2].len = 0;
+    PacketFree(p);
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqhFlowCleanup();
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +642,8 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowActivePacketsTest01",
+                   TmqhFlowActivePacketsTest01);
 #endif
 
     return;
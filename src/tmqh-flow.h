@@ -35,12 +35,62 @@ typedef struct TmqhFlowCtx_ {
     uint16_t size;
     uint16_t last;
 
+    /* active-packets scheduler stats */
+    uint64_t balanced_flows;
+    uint64_t hashed_flows;
+
     TmqhFlowMode *queues;
 } TmqhFlowCtx;
 
+/** \brief get the output queue of a packet based on its flow hash */
+static inline uint16_t TmqhFlowHashQueueId(TmqhFlowCtx *ctx, const Packet *p)
+{
+    uint16_t qid;
+
+    if (p->flags & PKT_WANTS_FLOW) {
+        uint32_t hash = p->flow_hash;
+        qid = hash % ctx->size;
+    } else {
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+    return qid;
+}
+
+/** \brief get the output queue of a packet based on its IP address pair */
+static inline uint16_t TmqhFlowIPPairQueueId(const TmqhFlowCtx *ctx, const Packet *p)
+{
+    uint32_t addr_hash = 0;
+    int i;
+
+    if (p->src.family == AF_INET6) {
+        for (i = 0; i < 4; i++) {
+            addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
+        }
+    } else {
+        addr_hash = p->src.addr_data32[0] + p->dst.addr_data32[0];
+    }
+
+    /* we don't have to worry about possible overflow, since
+     * ctx->size will be lesser than 2 ** 31 for sure */
+    return addr_hash % ctx->size;
+}
+
 void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
+void TmqhFlowCleanup(void);
+
+uint16_t TmqhFlowActivePacketsQueueId(TmqhFlowCtx *ctx, const Packet *p);
+
+void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
+void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
+void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
+void *TmqhOutputFlowSetupCtx(const char *queue_str);
+void TmqhOutputFlowFreeCtx(void *ctx);
 
 void TmqhFlowPrintAutofpHandler(void);
+const char *TmqhAutofpGetHandlerName(void);
 
 #endif /* __TMQH_FLOW_H__ */
@@ -49,11 +49,20 @@
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-pages.h"
+#include "util-trace.h"
+#include "counters.h"
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
 
 /* Number of freed packet to save for one pool before freeing them. */
 #define MAX_PENDING_RETURN_PACKETS 32
 static uint32_t max_pending_return_packets = MAX_PENDING_RETURN_PACKETS;
 
+static void PacketPoolFlushAllPending(PktPool *my_pool);
+
 #ifdef TLS
 __thread PktPool thread_pkt_pool;
 
@@ -150,6 +159,10 @@ void PacketPoolWait(void)
     PktPool *my_pool = GetThreadPacketPool();
 
     if (PacketPoolIsEmpty(my_pool)) {
+        /* don't hold on to other pools' packets while we wait for
+         * ours to come back */
+        PacketPoolFlushAllPending(my_pool);
+
         SCMutexLock(&my_pool->return_stack.mutex);
         SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
         SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
@@ -225,13 +238,31 @@ static void PacketPoolStorePacket(Packet *p)
     PacketPoolReturnPacket(p);
 }
 
+static void PacketPoolUpdateCounters(PktPool *pool)
+{
+    ThreadVars *tv = pool->tv;
+    /* counters can only be updated once the thread's stats are set up */
+    if (tv == NULL || tv->perf_private_ctx.initialized == 0)
+        return;
+
+    StatsSetUI64(tv, pool->counter_remote_returns, pool->remote_returns);
+    StatsSetUI64(tv, pool->counter_remote_return_batches, pool->remote_return_batches);
+    StatsSetUI64(tv, pool->counter_remote_received, pool->remote_received);
+}
+
 static void PacketPoolGetReturnedPackets(PktPool *pool)
 {
     SCMutexLock(&pool->return_stack.mutex);
     /* Move all the packets from the locked return stack to the local stack. */
     pool->head = pool->return_stack.head;
     pool->return_stack.head = NULL;
+    uint64_t returned = pool->return_stack.returned;
     SCMutexUnlock(&pool->return_stack.mutex);
+
+    if (returned != pool->remote_received) {
+        pool->remote_received = returned;
+        PacketPoolUpdateCounters(pool);
+    }
 }
 
 /** \brief Get a new packet from the packet pool
@@ -278,8 +309,47 @@ Packet *PacketPoolGetPacket(void)
     return NULL;
 }
 
+/** \brief Hand a list of pending packets back to the pool they belong to
+ *
+ *  The whole list is put on the owner's return stack under a single lock.
+ */
+static void PacketPoolFlushPending(PktPool *my_pool, PktPoolPending *pending)
+{
+    PktPool *pool = pending->pool;
+
+    SCMutexLock(&pool->return_stack.mutex);
+    pending->tail->next = pool->return_stack.head;
+    pool->return_stack.head = pending->head;
+    pool->return_stack.returned += pending->count;
+    SC_ATOMIC_RESET(pool->return_stack.sync_now);
+    SCMutexUnlock(&pool->return_stack.mutex);
+    SCCondSignal(&pool->return_stack.cond);
+
+    my_pool->remote_returns += pending->count;
+    my_pool->remote_return_batches++;
+    PacketPoolUpdateCounters(my_pool);
+
+    /* Clear the list of pending packets to return. */
+    pending->pool = NULL;
+    pending->head = NULL;
+    pending->tail = NULL;
+    pending->count = 0;
+}
+
+/** \brief Return all pending packets to their pools */
+static void PacketPoolFlushAllPending(PktPool *my_pool)
+{
+    for (int i = 0; i < MAX_PENDING_RETURN_POOLS; i++) {
+        if (my_pool->pending[i].pool != NULL)
+            PacketPoolFlushPending(my_pool, &my_pool->pending[i]);
+    }
+}
+
 /** \brief Return packet to Packet pool
  *
+ *  Packets that belong to another thread's pool are collected per
+ *  owner pool and returned in batches of max_pending_return_packets. A
+ *  batch is returned early if its owner is waiting for packets.
  */
 void PacketPoolReturnPacket(Packet *p)
 {
@@ -303,44 +373,167 @@ void PacketPoolReturnPacket(Packet *p)
         /* Push back onto this thread's own stack, so no locking. */
         p->next = my_pool->head;
         my_pool->head = p;
+        return;
+    }
+
+    PktPoolPending *pending = NULL;
+    PktPoolPending *free_slot = NULL;
+    PktPoolPending *largest = NULL;
+    for (int i = 0; i < MAX_PENDING_RETURN_POOLS; i++) {
+        PktPoolPending *e = &my_pool->pending[i];
+        if (e->pool == pool) {
+            pending = e;
+        } else if (e->pool == NULL) {
+            if (free_slot == NULL)
+                free_slot = e;
+        } else if (SC_ATOMIC_GET(e->pool->return_stack.sync_now)) {
+            /* owner is waiting for packets, don't sit on them */
+            PacketPoolFlushPending(my_pool, e);
+            if (free_slot == NULL)
+                free_slot = e;
+        } else if (largest == NULL || e->count > largest->count) {
+            largest = e;
+        }
+    }
+
+    if (pending == NULL) {
+        if (free_slot == NULL) {
+            /* All slots are in use, so make room by returning the
+             * largest list. */
+            PacketPoolFlushPending(my_pool, largest);
+            free_slot = largest;
+        }
+        /* No pending packet for this pool, so store the current packet. */
+        p->next = NULL;
+        free_slot->pool = pool;
+        free_slot->head = p;
+        free_slot->tail = p;
+        free_slot->count = 1;
+        pending = free_slot;
     } else {
-        PktPool *pending_pool = my_pool->pending_pool;
-        if (pending_pool == NULL) {
-            /* No pending packet, so store the current packet. */
-            p->next = NULL;
-            my_pool->pending_pool = pool;
-            my_pool->pending_head = p;
-            my_pool->pending_tail = p;
-            my_pool->pending_count = 1;
-        } else if (pending_pool == pool) {
-            /* Another packet for the pending pool list. */
-            p->next = my_pool->pending_head;
-            my_pool->pending_head = p;
-            my_pool->pending_count++;
-            if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
-                /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
-                /* Clear the list of pending packets to return. */
-                my_pool->pending_pool = NULL;
-                my_pool->pending_head = NULL;
-                my_pool->pending_tail = NULL;
-                my_pool->pending_count = 0;
-            }
-        } else {
-            /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
-            p->next = pool->return_stack.head;
-            pool->return_stack.head = p;
-            SC_ATOMIC_RESET(pool->return_stack.sync_now);
-            SCMutexUnlock(&pool->return_stack.mutex);
-            SCCondSignal(&pool->return_stack.cond);
+        /* Another packet for the pending pool list. */
+        p->next = pending->head;
+        pending->head = p;
+        pending->count++;
+    }
+
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now) || pending->count > max_pending_return_packets) {
+        /* Return the entire list of pending packets. */
+        PacketPoolFlushPending(my_pool, pending);
+    }
+}
+
+/** \brief Find the NUMA node the calling thread runs on
+ *
+ *  If libnuma is available the thread's memory policy is also set to
+ *  prefer that node, so that the packets allocated for the pool end up
+ *  close to the capture thread using them.
+ *
+ *  \retval node numa node or -1 if unknown
+ */
+static int PacketPoolSetupNuma(void)
+{
+    int node = -1;
+#if defined(HAVE_LIBNUMA) && defined(__linux__)
+    if (numa_available() == -1)
+        return -1;
+    if (numa_max_node() == 0)
+        return 0;
+
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        return -1;
+    node = numa_node_of_cpu(cpu);
+    if (node >= 0)
+        numa_set_preferred(node);
+#endif
+    return node;
+}
+
+/** Pool packets preallocated in one block from PageAllocTable(), when
+ *  huge pages are enabled. A pool's packets can still be on the pending
+ *  lists of other threads when its own thread is done, so the blocks
+ *  are only unmapped at exit. Pools set up later, like those of the
+ *  next pcap in unix socket mode, reuse the blocks no longer in use. */
+typedef struct PacketBlock_ {
+    uint8_t *mem;
+    size_t size;
+    bool in_use;
+    struct PacketBlock_ *next;
+} PacketBlock;
+
+static PacketBlock *packet_blocks = NULL;
+static SCMutex packet_blocks_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief get a zeroed block of cnt packets of stride bytes */
+static PacketBlock *PacketBlockGet(size_t cnt, size_t stride)
+{
+    const size_t size = cnt * stride;
+
+    SCMutexLock(&packet_blocks_lock);
+    for (PacketBlock *b = packet_blocks; b != NULL; b = b->next) {
+        if (!b->in_use && b->size == size) {
+            b->in_use = true;
+            SCMutexUnlock(&packet_blocks_lock);
+            memset(b->mem, 0, size);
+            return b;
         }
     }
+    SCMutexUnlock(&packet_blocks_lock);
+
+    PacketBlock *b = SCCalloc(1, sizeof(*b));
+    if (unlikely(b == NULL))
+        return NULL;
+    b->mem = PageAllocTable(size);
+    if (b->mem == NULL) {
+        SCFree(b);
+        return NULL;
+    }
+    b->size = size;
+    b->in_use = true;
+
+    SCMutexLock(&packet_blocks_lock);
+    b->next = packet_blocks;
+    packet_blocks = b;
+    SCMutexUnlock(&packet_blocks_lock);
+    return b;
+}
+
+/** \internal
+ *  \brief free a packet, leaving the memory of packets from a block */
+static void PacketPoolFreePacket(Packet *p)
+{
+    bool in_block = false;
+    SCMutexLock(&packet_blocks_lock);
+    for (PacketBlock *b = packet_blocks; b != NULL; b = b->next) {
+        if ((uint8_t *)p >= b->mem && (uint8_t *)p < b->mem + b->size) {
+            in_block = true;
+            break;
+        }
+    }
+    SCMutexUnlock(&packet_blocks_lock);
+
+    if (in_block) {
+        PACKET_DESTRUCTOR(p);
+    } else {
+        PacketFree(p);
+    }
+}
+
+/** \brief unmap the packet blocks, once all packet threads are gone */
+void TmqhPacketpoolCleanup(void)
+{
+    SCMutexLock(&packet_blocks_lock);
+    PacketBlock *b = packet_blocks;
+    while (b != NULL) {
+        PacketBlock *next = b->next;
+        PageFreeTable(b->mem, b->size);
+        SCFree(b);
+        b = next;
+    }
+    packet_blocks = NULL;
+    SCMutexUnlock(&packet_blocks_lock);
 }
 
 void PacketPoolInitEmpty(void)
@@ -360,6 +553,7 @@ void PacketPoolInitEmpty(void)
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
+    my_pool->numa_node = -1;
 }
 
 void PacketPoolInit(void)
@@ -382,9 +576,29 @@ void PacketPoolInit(void)
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 
+    /* Packets are allocated and first touched by this thread. Thread
+     * affinity has been applied at this point, so place them on the
+     * node we run on. */
+    my_pool->numa_node = PacketPoolSetupNuma();
+
     /* pre allocate packets */
-    SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
-               (uintmax_t)SIZE_OF_PACKET);
+    SCLogDebug("preallocating packets... packet size %" PRIuMAX " numa node %d",
+               (uintmax_t)SIZE_OF_PACKET, my_pool->numa_node);
+    if (PageHugeEnabled()) {
+        const size_t stride = ((SIZE_OF_PACKET + CLS - 1) / CLS) * CLS;
+        PacketBlock *b = PacketBlockGet(max_pending_packets, stride);
+        if (b != NULL) {
+            for (intmax_t i = 0; i < max_pending_packets; i++) {
+                Packet *p = (Packet *)(b->mem + i * stride);
+                PACKET_INITIALIZE(p);
+                PACKET_PROFILING_START(p);
+                PacketPoolStorePacket(p);
+            }
+            my_pool->block = b;
+            return;
+        }
+    }
+
     int i = 0;
     for (i = 0; i < max_pending_packets; i++) {
         Packet *p = PacketGetFromAlloc();
@@ -408,27 +622,38 @@ void PacketPoolDestroy(void)
     BUG_ON(my_pool->destroyed);
 #endif /* DEBUG_VALIDATION */
 
-    if (my_pool && my_pool->pending_pool != NULL) {
-        p = my_pool->pending_head;
+    for (int i = 0; my_pool && i < MAX_PENDING_RETURN_POOLS; i++) {
+        PktPoolPending *pending = &my_pool->pending[i];
+        if (pending->pool == NULL)
+            continue;
+
+        p = pending->head;
         while (p) {
             Packet *next_p = p->next;
-            PacketFree(p);
+            PacketPoolFreePacket(p);
             p = next_p;
-            my_pool->pending_count--;
+            pending->count--;
         }
 #ifdef DEBUG_VALIDATION
-        BUG_ON(my_pool->pending_count);
+        BUG_ON(pending->count);
 #endif /* DEBUG_VALIDATION */
-        my_pool->pending_pool = NULL;
-        my_pool->pending_head = NULL;
-        my_pool->pending_tail = NULL;
+        pending->pool = NULL;
+        pending->head = NULL;
+        pending->tail = NULL;
     }
 
     while ((p = PacketPoolGetPacket()) != NULL) {
-        PacketFree(p);
+        PacketPoolFreePacket(p);
+    }
+    if (my_pool->block != NULL) {
+        SCMutexLock(&packet_blocks_lock);
+        my_pool->block->in_use = false;
+        SCMutexUnlock(&packet_blocks_lock);
+        my_pool->block = NULL;
     }
 
     SC_ATOMIC_DESTROY(my_pool->return_stack.sync_now);
+    my_pool->tv = NULL;
 
 #ifdef DEBUG_VALIDATION
     my_pool->initialized = 0;
@@ -436,6 +661,23 @@ void PacketPoolDestroy(void)
 #endif /* DEBUG_VALIDATION */
 }
 
+/** \brief Register the cross thread return counters of this thread's pool
+ *
+ *  Needs to be called before StatsSetupPrivate() for the thread.
+ */
+void PacketPoolRegisterCounters(ThreadVars *tv)
+{
+    PktPool *my_pool = GetThreadPacketPool();
+
+    my_pool->counter_remote_returns =
+        StatsRegisterCounter("packetpool.remote_returns", tv);
+    my_pool->counter_remote_return_batches =
+        StatsRegisterCounter("packetpool.remote_return_batches", tv);
+    my_pool->counter_remote_received =
+        StatsRegisterCounter("packetpool.remote_received", tv);
+    my_pool->tv = tv;
+}
+
 Packet *TmqhInputPacketpool(ThreadVars *tv)
 {
     return PacketPoolGetPacket();
@@ -447,6 +689,7 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
 
     SCEnter();
     SCLogDebug("Packet %p, p->root %p, alloced %s", p, p->root, p->flags & PKT_ALLOC ? "true" : "false");
+    SCTrace1(packet_release, p);
 
     if (IS_TUNNEL_PKT(p)) {
         SCLogDebug("Packet %p is a tunnel packet: %s",
@@ -35,22 +35,49 @@ typedef struct PktPoolLockedStack_{
     SCCondT cond;
     SC_ATOMIC_DECLARE(int, sync_now);
     Packet *head;
+    /* number of packets other threads pushed onto this stack. Protected
+     * by the mutex. */
+    uint64_t returned;
 } __attribute__((aligned(CLS))) PktPoolLockedStack;
 
+/* Number of other pools a thread keeps pending packet lists for. */
+#define MAX_PENDING_RETURN_POOLS 8
+
+/* List of packets waiting (pending) to be returned to another pool. */
+typedef struct PktPoolPending_ {
+    struct PktPool_ *pool;
+    Packet *head;
+    Packet *tail;
+    uint32_t count;
+} PktPoolPending;
+
 typedef struct PktPool_ {
     /* link listed of free packets local to this thread.
      * No mutex is needed.
      */
     Packet *head;
-    /* Packets waiting (pending) to be returned to the given Packet
-     * Pool. Accumulate packets for the same pool until a theshold is
+    /* Packets waiting (pending) to be returned to other Packet
+     * Pools. Accumulate packets per pool until a theshold is
      * reached, then return them all at once.  Keep the head and tail
      * to fast insertion of the entire list onto a return stack.
      */
-    struct PktPool_ *pending_pool;
-    Packet *pending_head;
-    Packet *pending_tail;
-    uint32_t pending_count;
+    PktPoolPending pending[MAX_PENDING_RETURN_POOLS];
+
+    /* NUMA node the packets of this pool were allocated on, -1 if
+     * unknown. */
+    int numa_node;
+
+    /* block the packets were preallocated in, if any */
+    struct PacketBlock_ *block;
+
+    /* cross thread return stats, synced to the counters of 'tv' */
+    ThreadVars *tv;
+    uint64_t remote_returns;
+    uint64_t remote_return_batches;
+    uint64_t remote_received;
+    uint16_t counter_remote_returns;
+    uint16_t counter_remote_return_batches;
+    uint16_t counter_remote_received;
 
 #ifdef DEBUG_VALIDATION
     int initialized;
@@ -78,6 +105,8 @@ void PacketPoolReturnPacket(Packet *p);
 void PacketPoolInit(void);
 void PacketPoolInitEmpty(void);
 void PacketPoolDestroy(void);
+void PacketPoolRegisterCounters(ThreadVars *tv);
 void PacketPoolPostRunmodes(void);
+void TmqhPacketpoolCleanup(void);
 
 #endif /* __TMQH_PACKETPOOL_H__ */
@@ -0,0 +1,493 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock-free ring queue handler for autofp
+ *
+ * Same flow distribution as the "flow" handler, but the packets are
+ * passed to the workers through a bounded multi producer / single
+ * consumer ring attached to each queue instead of the mutex protected
+ * PacketQueue. The ring uses a sequence number per slot: producers
+ * reserve a slot with a CAS on the tail and publish it by updating the
+ * slot sequence, the consumer reads the published slots in batches.
+ *
+ * The consumer spins for a while when the ring is empty and then sleeps
+ * on the condition of the PacketQueue. Producers only take the queue
+ * mutex to wake it up. The PacketQueue itself is still used for the
+ * packets injected by the other parts of the engine (flow timeout
+ * pseudo packets, detect reload) and is checked by the consumer too.
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tmqh-flow.h"
+#include "tmqh-ring.h"
+
+#include "tm-queuehandlers.h"
+
+#include "conf.h"
+#include "util-debug.h"
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+#define TMQH_RING_SIZE_DEFAULT  4096
+/** number of packets the consumer takes from the ring at once */
+#define TMQH_RING_BATCH         32
+/** number of empty polls before the consumer goes to sleep */
+#define TMQH_RING_SPIN          1000
+
+/** hint the cpu we are spinning */
+#if defined(__x86_64__) || defined(__i386__)
+#define TmqhRingPause() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define TmqhRingPause() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define TmqhRingPause() cc_barrier()
+#endif
+
+typedef struct PacketRingSlot_ {
+    uint32_t seq;
+    Packet *p;
+} PacketRingSlot;
+
+typedef struct PacketRing_ {
+    PacketRingSlot *slots;
+    uint32_t size;
+    uint32_t mask;
+
+    /** next slot to reserve, shared by the producers */
+    uint32_t tail __attribute__((aligned(CLS)));
+
+    /** consumer side: next slot to read and packets already read */
+    uint32_t head __attribute__((aligned(CLS)));
+    /** set while the consumer sleeps on the queue condition */
+    uint32_t waiting;
+    uint16_t stash_idx;
+    uint16_t stash_cnt;
+    Packet *stash[TMQH_RING_BATCH];
+} PacketRing;
+
+/** rings indexed by queue id, allocated when an output ctx is set up */
+static PacketRing *rings[256];
+static uint32_t ring_size = TMQH_RING_SIZE_DEFAULT;
+
+Packet *TmqhInputRing(ThreadVars *tv);
+void TmqhInputRingShutdownHandler(ThreadVars *tv);
+void TmqhOutputRingFlowHash(ThreadVars *tv, Packet *p);
+void TmqhOutputRingIPPair(ThreadVars *tv, Packet *p);
+void TmqhOutputRingActivePackets(ThreadVars *tv, Packet *p);
+void *TmqhOutputRingSetupCtx(const char *queue_str);
+
+void TmqhRingRegister(void)
+{
+    tmqh_table[TMQH_RING].name = "ring";
+    tmqh_table[TMQH_RING].InHandler = TmqhInputRing;
+    tmqh_table[TMQH_RING].InShutdownHandler = TmqhInputRingShutdownHandler;
+    tmqh_table[TMQH_RING].OutHandlerCtxSetup = TmqhOutputRingSetupCtx;
+    tmqh_table[TMQH_RING].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+    tmqh_table[TMQH_RING].RegisterTests = TmqhRingRegisterTests;
+
+    /* follow the autofp-scheduler selected by the flow handler */
+    if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowIPPair) {
+        tmqh_table[TMQH_RING].OutHandler = TmqhOutputRingIPPair;
+    } else if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowActivePackets) {
+        tmqh_table[TMQH_RING].OutHandler = TmqhOutputRingActivePackets;
+    } else {
+        tmqh_table[TMQH_RING].OutHandler = TmqhOutputRingFlowHash;
+    }
+
+    intmax_t value = 0;
+    if (ConfGetInt("autofp-ring-size", &value) == 1) {
+        if (value < TMQH_RING_BATCH || value > (1 << 20)) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value %" PRIdMAX
+                       " for autofp-ring-size, using %u", value, ring_size);
+        } else {
+            /* round up to a power of 2 so the slot is a mask away */
+            ring_size = 1;
+            while (ring_size < (uint32_t)value)
+                ring_size <<= 1;
+        }
+    }
+}
+
+static PacketRing *PacketRingAlloc(uint32_t size)
+{
+    PacketRing *r = SCMallocAligned(sizeof(PacketRing), CLS);
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0, sizeof(PacketRing));
+
+    r->slots = SCMallocAligned(size * sizeof(PacketRingSlot), CLS);
+    if (unlikely(r->slots == NULL)) {
+        SCFreeAligned(r);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        r->slots[i].seq = i;
+        r->slots[i].p = NULL;
+    }
+    r->size = size;
+    r->mask = size - 1;
+    return r;
+}
+
+static void PacketRingFree(PacketRing *r)
+{
+    SCFreeAligned(r->slots);
+    SCFreeAligned(r);
+}
+
+/**
+ * \brief add a packet to the ring, can be called by several threads
+ *
+ * \retval 0 on success, -1 if the ring is full
+ */
+static int PacketRingEnqueue(PacketRing *r, Packet *p)
+{
+    uint32_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    PacketRingSlot *slot;
+
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (SCAtomicCompareAndSwap(&r->tail, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* slot still used by the consumer */
+            return -1;
+        }
+        pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+
+    slot->p = p;
+    /* seq_cst so the publication is ordered before the check of the
+     * consumer waiting flag done by the caller */
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/**
+ * \brief take up to max packets from the ring, consumer only
+ *
+ * The new head is returned in pos, the caller publishes it.
+ *
+ * \retval number of packets stored in out
+ */
+static uint16_t PacketRingDequeueBatch(PacketRing *r, Packet **out, uint16_t max,
+                                       uint32_t *head)
+{
+    uint32_t pos = r->head;
+    uint16_t n = 0;
+
+    while (n < max) {
+        PacketRingSlot *slot = &r->slots[pos & r->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+        out[n++] = slot->p;
+        /* slot can be reused by the producers on the next lap */
+        __atomic_store_n(&slot->seq, pos + r->size, __ATOMIC_RELEASE);
+        pos++;
+    }
+    *head = pos;
+    return n;
+}
+
+static inline int PacketRingIsEmpty(PacketRing *r)
+{
+    PacketRingSlot *slot = &r->slots[r->head & r->mask];
+    return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != r->head + 1;
+}
+
+/**
+ * \brief number of packets waiting in the ring of a queue
+ *
+ * Includes the packets already taken from the ring by the consumer but
+ * not yet processed. Used at shutdown to check if the queue is drained.
+ */
+uint32_t TmqhRingQueueLen(uint16_t id)
+{
+    PacketRing *r = rings[id];
+    if (r == NULL)
+        return 0;
+
+    /* head is published after the stash, so reading it first can only
+     * over estimate the length */
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    uint16_t stashed = __atomic_load_n(&r->stash_cnt, __ATOMIC_ACQUIRE) -
+                       __atomic_load_n(&r->stash_idx, __ATOMIC_ACQUIRE);
+    return (tail - head) + stashed;
+}
+
+static inline Packet *TmqhRingGetStashed(PacketRing *r)
+{
+    if (r->stash_idx < r->stash_cnt) {
+        Packet *p = r->stash[r->stash_idx];
+        __atomic_store_n(&r->stash_idx, r->stash_idx + 1, __ATOMIC_RELEASE);
+        return p;
+    }
+    return NULL;
+}
+
+static inline Packet *TmqhRingFill(PacketRing *r)
+{
+    uint32_t head;
+    uint16_t n = PacketRingDequeueBatch(r, r->stash, TMQH_RING_BATCH, &head);
+    if (n == 0)
+        return NULL;
+    __atomic_store_n(&r->stash_cnt, n, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->stash_idx, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    return TmqhRingGetStashed(r);
+}
+
+/** \brief get a packet added to the queue by the mutex based path */
+static inline Packet *TmqhRingGetQueued(PacketQueue *q)
+{
+    Packet *p = NULL;
+
+    /* unlocked check, the writers signal the queue anyway */
+    if (q->len > 0) {
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+    return p;
+}
+
+Packet *TmqhInputRing(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    PacketRing *r = rings[tv->inq->id];
+    Packet *p;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    if (unlikely(r == NULL)) {
+        /* no ring writer for this queue, same as 'simple' */
+        SCMutexLock(&q->mutex_q);
+        if (q->len == 0)
+            SCCondWait(&q->cond_q, &q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+        return p;
+    }
+
+    if ((p = TmqhRingGetStashed(r)) != NULL)
+        return p;
+
+    for (int i = 0; i < TMQH_RING_SPIN; i++) {
+        if ((p = TmqhRingGetQueued(q)) != NULL)
+            return p;
+        if ((p = TmqhRingFill(r)) != NULL)
+            return p;
+        if (TmThreadsCheckFlag(tv, THV_KILL))
+            return NULL;
+        TmqhRingPause();
+    }
+
+    /* nothing for a while: sleep until a producer or the engine wakes us */
+    SCMutexLock(&q->mutex_q);
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    if (q->len == 0 && PacketRingIsEmpty(r) && !TmThreadsCheckFlag(tv, THV_KILL)) {
+        SCCondWait(&q->cond_q, &q->mutex_q);
+    }
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+    p = PacketDequeue(q);
+    SCMutexUnlock(&q->mutex_q);
+
+    if (p == NULL)
+        p = TmqhRingFill(r);
+    /* return NULL if we have no pkt. Should only happen on signals. */
+    return p;
+}
+
+void TmqhInputRingShutdownHandler(ThreadVars *tv)
+{
+    int i;
+
+    if (tv == NULL || tv->inq == NULL) {
+        return;
+    }
+
+    for (i = 0; i < (tv->inq->reader_cnt + tv->inq->writer_cnt); i++)
+        SCCondSignal(&trans_q[tv->inq->id].cond_q);
+}
+
+/**
+ * \brief setup the ctx and the rings of the output queues
+ *
+ * \param queue_str comma separated string with output queue names
+ */
+void *TmqhOutputRingSetupCtx(const char *queue_str)
+{
+    TmqhFlowCtx *ctx = TmqhOutputFlowSetupCtx(queue_str);
+    if (ctx == NULL)
+        return NULL;
+
+    for (uint16_t i = 0; i < ctx->size; i++) {
+        uint16_t id = (uint16_t)(ctx->queues[i].q - trans_q);
+        if (rings[id] == NULL) {
+            rings[id] = PacketRingAlloc(ring_size);
+            if (rings[id] == NULL) {
+                TmqhOutputFlowFreeCtx(ctx);
+                return NULL;
+            }
+            SCLogDebug("ring of %u slots for queue %u", ring_size, id);
+        }
+    }
+    return ctx;
+}
+
+static inline void TmqhOutputRing(PacketQueue *q, Packet *p)
+{
+    PacketRing *r = rings[q - trans_q];
+
+    /* the ring is full, the worker is behind: wait for it instead of
+     * reordering the packets of the flow */
+    uint32_t spins = 0;
+    while (PacketRingEnqueue(r, p) != 0) {
+        if (++spins < TMQH_RING_SPIN) {
+            TmqhRingPause();
+        } else {
+            SleepUsec(10);
+        }
+    }
+
+    if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST)) {
+        SCMutexLock(&q->mutex_q);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+}
+
+void TmqhOutputRingFlowHash(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowHashQueueId(ctx, p);
+
+    TmqhOutputRing(ctx->queues[qid].q, p);
+}
+
+void TmqhOutputRingIPPair(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowIPPairQueueId(ctx, p);
+
+    TmqhOutputRing(ctx->queues[qid].q, p);
+}
+
+void TmqhOutputRingActivePackets(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid = TmqhFlowActivePacketsQueueId(ctx, p);
+
+    TmqhOutputRing(ctx->queues[qid].q, p);
+}
+
+/** \brief free the rings, queues must be empty */
+void TmqhRingCleanup(void)
+{
+    for (int i = 0; i < 256; i++) {
+        if (rings[i] != NULL) {
+            PacketRingFree(rings[i]);
+            rings[i] = NULL;
+        }
+    }
+}
+
+#ifdef UNITTESTS
+
+/** \test packets come out in order and the ring reports full */
+static int TmqhRingTest01(void)
+{
+    Packet pkts[8];
+    Packet *out[8];
+
+    PacketRing *r = PacketRingAlloc(4);
+    FAIL_IF_NULL(r);
+
+    for (int i = 0; i < 4; i++) {
+        FAIL_IF(PacketRingEnqueue(r, &pkts[i]) != 0);
+    }
+    FAIL_IF(PacketRingEnqueue(r, &pkts[4]) != -1);
+
+    uint32_t head;
+    FAIL_IF(PacketRingDequeueBatch(r, out, 2, &head) != 2);
+    r->head = head;
+    FAIL_IF(out[0] != &pkts[0]);
+    FAIL_IF(out[1] != &pkts[1]);
+
+    /* freed slots are reused on the next lap */
+    FAIL_IF(PacketRingEnqueue(r, &pkts[4]) != 0);
+    FAIL_IF(PacketRingEnqueue(r, &pkts[5]) != 0);
+    FAIL_IF(PacketRingEnqueue(r, &pkts[6]) != -1);
+
+    FAIL_IF(PacketRingDequeueBatch(r, out, 8, &head) != 4);
+    r->head = head;
+    FAIL_IF(out[0] != &pkts[2]);
+    FAIL_IF(out[3] != &pkts[5]);
+    FAIL_IF(!PacketRingIsEmpty(r));
+    FAIL_IF(PacketRingDequeueBatch(r, out, 8, &head) != 0);
+
+    PacketRingFree(r);
+    PASS;
+}
+
+/** \test queue length accounts for the packets stashed by the consumer */
+static int TmqhRingTest02(void)
+{
+    Packet pkts[4];
+
+    rings[0] = PacketRingAlloc(8);
+    FAIL_IF_NULL(rings[0]);
+    PacketRing *r = rings[0];
+
+    for (int i = 0; i < 4; i++) {
+        FAIL_IF(PacketRingEnqueue(r, &pkts[i]) != 0);
+    }
+    FAIL_IF(TmqhRingQueueLen(0) != 4);
+
+    FAIL_IF(TmqhRingFill(r) != &pkts[0]);
+    FAIL_IF(TmqhRingQueueLen(0) != 3);
+    FAIL_IF(TmqhRingGetStashed(r) != &pkts[1]);
+    FAIL_IF(TmqhRingGetStashed(r) != &pkts[2]);
+    FAIL_IF(TmqhRingGetStashed(r) != &pkts[3]);
+    FAIL_IF(TmqhRingQueueLen(0) != 0);
+    FAIL_IF(TmqhRingGetStashed(r) != NULL);
+
+    TmqhRingCleanup();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhRingRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhRingTest01", TmqhRingTest01);
+    UtRegisterTest("TmqhRingTest02", TmqhRingTest02);
+#endif
+}
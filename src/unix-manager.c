@@ -25,8 +25,13 @@
 #include "suricata.h"
 #include "unix-manager.h"
 #include "detect-engine.h"
+#include "detect-engine-fpstats.h"
+#include "detect-engine-rule-sample.h"
+#include "datasets.h"
+#include "reputation.h"
 #include "tm-threads.h"
 #include "runmodes.h"
+#include "util-runmodes.h"
 #include "conf.h"
 
 #include "output-json-stats.h"
@@ -34,6 +39,9 @@
 #include "util-privs.h"
 #include "util-debug.h"
 #include "util-device.h"
+#include "util-latency.h"
+#include "stream-tcp-memuse.h"
+#include "flow-cost.h"
 #include "util-ebpf.h"
 #include "util-signal.h"
 #include "util-buffer.h"
@@ -80,17 +88,48 @@ typedef struct UnixClient_ {
     int fd;
     MemBuffer *mbuf; /**< buffer for response construction */
     int version;
+    bool busy;       /**< slow command in flight: the client is not polled
+                      *   until its reply is sent, so replies stay in order */
     TAILQ_ENTRY(UnixClient_) next;
 } UnixClient;
 
+/** slow command handed to the worker threads */
+typedef struct UnixJob_ {
+    UnixClient *client;
+    Command *cmd;
+    json_t *jsoncmd;    /**< parsed command, owns args */
+    json_t *args;
+    json_t *server_msg;
+    int ret;
+    TAILQ_ENTRY(UnixJob_) next;
+} UnixJob;
+
+/** number of threads running the UNIX_CMD_SLOW commands */
+#define UNIX_CMD_WORKERS 2
+#define UNIX_LISTEN_BACKLOG 64
+
 typedef struct UnixCommand_ {
     time_t start_timestamp;
     int socket;
     struct sockaddr_un client_addr;
-    int select_max;
     TAILQ_HEAD(, Command_) commands;
     TAILQ_HEAD(, Task_) tasks;
     TAILQ_HEAD(, UnixClient_) clients;
+
+    /* poll set, rebuilt on each UnixMain() call */
+    struct pollfd *pfds;
+    UnixClient **pclients;
+    uint32_t pfds_size;
+
+    /* worker pool for the slow commands */
+    SCMutex jobs_lock;
+    SCCondT jobs_cond;
+    TAILQ_HEAD(, UnixJob_) jobs;    /**< waiting for a worker */
+    TAILQ_HEAD(, UnixJob_) done;    /**< run, reply not sent yet */
+    int wakeup[2];                  /**< pipe telling UnixMain() jobs are done */
+    bool workers_stop;
+    int nworkers;
+    pthread_t workers[UNIX_CMD_WORKERS];
 } UnixCommand;
 
 /**
@@ -109,11 +148,15 @@ static int UnixNew(UnixCommand * this)
 
     this->start_timestamp = time(NULL);
     this->socket = -1;
-    this->select_max = 0;
+    this->wakeup[0] = this->wakeup[1] = -1;
 
     TAILQ_INIT(&this->commands);
     TAILQ_INIT(&this->tasks);
     TAILQ_INIT(&this->clients);
+    TAILQ_INIT(&this->jobs);
+    TAILQ_INIT(&this->done);
+    SCMutexInit(&this->jobs_lock, NULL);
+    SCCondInit(&this->jobs_cond, NULL);
 
     int check_dir = 0;
     if (ConfGet("unix-command.filename", &socketname) == 1) {
@@ -168,7 +211,6 @@ static int UnixNew(UnixCommand * this)
                      addr.sun_path, strerror(errno));
         return 0;
     }
-    this->select_max = this->socket + 1;
 
     /* set reuse option */
     ret = setsockopt(this->socket, SOL_SOCKET, SO_REUSEADDR,
@@ -202,7 +244,7 @@ static int UnixNew(UnixCommand * this)
 #endif
 
     /* listen */
-    if (listen(this->socket, 1) == -1) {
+    if (listen(this->socket, UNIX_LISTEN_BACKLOG) == -1) {
         SCLogWarning(SC_ERR_INITIALIZATION,
                      "Command server: UNIX socket listen() error: %s",
                      strerror(errno));
@@ -211,23 +253,6 @@ static int UnixNew(UnixCommand * this)
     return 1;
 }
 
-static void UnixCommandSetMaxFD(UnixCommand *this)
-{
-    UnixClient *item;
-
-    if (this == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Unix command is NULL, warn devel");
-        return;
-    }
-
-    this->select_max = this->socket + 1;
-    TAILQ_FOREACH(item, &this->clients, next) {
-        if (item->fd >= this->select_max) {
-            this->select_max = item->fd + 1;
-        }
-    }
-}
-
 static UnixClient *UnixClientAlloc(void)
 {
     UnixClient *uclient = SCMalloc(sizeof(UnixClient));
@@ -235,6 +260,7 @@ static UnixClient *UnixClientAlloc(void)
         SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate new client");
         return NULL;
     }
+    uclient->busy = false;
     uclient->mbuf = MemBufferCreateNew(CLIENT_BUFFER_SIZE);
     if (uclient->mbuf == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate new client send buffer");
@@ -275,7 +301,6 @@ static void UnixCommandClose(UnixCommand  *this, int fd)
     TAILQ_REMOVE(&this->clients, item, next);
 
     close(item->fd);
-    UnixCommandSetMaxFD(this);
     UnixClientFree(item);
 }
 
@@ -437,7 +462,6 @@ static int UnixCommandAccept(UnixCommand *this)
     /* client connected */
     SCLogDebug("Unix socket: client connected");
     TAILQ_INSERT_TAIL(&this->clients, uclient, next);
-    UnixCommandSetMaxFD(this);
     return 1;
 }
 
@@ -455,9 +479,209 @@ static int UnixCommandBackgroundTasks(UnixCommand* this)
     return ret;
 }
 
+/**
+ * \brief Send the result of a command to the client
+ *
+ * The client is closed if the reply can't be sent.
+ *
+ * \retval ret, or 0 if the reply couldn't be sent
+ */
+static int UnixCommandReply(UnixCommand *this, UnixClient *client,
+        json_t *server_msg, int ret)
+{
+    switch (ret) {
+        case 0:
+            json_object_set_new(server_msg, "return", json_string("NOK"));
+            break;
+        case 1:
+            json_object_set_new(server_msg, "return", json_string("OK"));
+            break;
+    }
+
+    if (UnixCommandSendJSONToClient(client, server_msg) != 0) {
+        UnixCommandClose(this, client->fd);
+        return 0;
+    }
+    return ret;
+}
+
+static void UnixJobFree(UnixJob *job)
+{
+    json_decref(job->jsoncmd);
+    json_decref(job->server_msg);
+    SCFree(job);
+}
+
+/**
+ * \brief Worker thread running the slow commands
+ *
+ * Finished jobs are moved to the done list and UnixMain() is woken up
+ * through the pipe to send the replies, so the sockets are only ever
+ * used by the unix manager thread.
+ */
+static void *UnixCommandWorker(void *arg)
+{
+    UnixCommand *this = (UnixCommand *)arg;
+
+    (void)SCSetThreadName("UnixCmdWorker");
+
+    SCMutexLock(&this->jobs_lock);
+    while (1) {
+        while (!this->workers_stop && TAILQ_EMPTY(&this->jobs)) {
+            SCCondWait(&this->jobs_cond, &this->jobs_lock);
+        }
+        if (this->workers_stop)
+            break;
+
+        UnixJob *job = TAILQ_FIRST(&this->jobs);
+        TAILQ_REMOVE(&this->jobs, job, next);
+        SCMutexUnlock(&this->jobs_lock);
+
+        TmEcode fret = job->cmd->Func(job->args, job->server_msg,
+                job->cmd->data);
+        job->ret = (fret == TM_ECODE_OK) ? 1 : 0;
+
+        SCMutexLock(&this->jobs_lock);
+        TAILQ_INSERT_TAIL(&this->done, job, next);
+        /* pipe is non-blocking: if it is full a wake up is pending anyway */
+        if (write(this->wakeup[1], "j", 1) < 0) {
+            SCLogDebug("wakeup write failed: %s", strerror(errno));
+        }
+    }
+    SCMutexUnlock(&this->jobs_lock);
+    return NULL;
+}
+
+/**
+ * \brief Start the threads running the slow commands
+ *
+ * If this fails the slow commands are run from the unix manager
+ * thread like the other ones.
+ */
+static void UnixCommandStartWorkers(UnixCommand *this)
+{
+    if (pipe(this->wakeup) != 0) {
+        SCLogWarning(SC_ERR_INITIALIZATION, "Unix socket: unable to create "
+                "worker pipe: %s", strerror(errno));
+        this->wakeup[0] = this->wakeup[1] = -1;
+        return;
+    }
+    (void)fcntl(this->wakeup[0], F_SETFL, O_NONBLOCK);
+    (void)fcntl(this->wakeup[1], F_SETFL, O_NONBLOCK);
+
+    this->workers_stop = false;
+    for (int i = 0; i < UNIX_CMD_WORKERS; i++) {
+        if (pthread_create(&this->workers[i], NULL, UnixCommandWorker,
+                    this) != 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "Unix socket: unable to "
+                    "create command worker: %s", strerror(errno));
+            break;
+        }
+        this->nworkers++;
+    }
+    SCLogDebug("%d unix socket command workers", this->nworkers);
+}
+
+/**
+ * \brief Stop the workers and drop the jobs that didn't get a reply
+ *
+ * A worker running a command is waited for.
+ */
+static void UnixCommandStopWorkers(UnixCommand *this)
+{
+    UnixJob *job;
+
+    SCMutexLock(&this->jobs_lock);
+    this->workers_stop = true;
+    pthread_cond_broadcast(&this->jobs_cond);
+    SCMutexUnlock(&this->jobs_lock);
+
+    for (int i = 0; i < this->nworkers; i++) {
+        pthread_join(this->workers[i], NULL);
+    }
+    this->nworkers = 0;
+
+    while ((job = TAILQ_FIRST(&this->jobs)) != NULL) {
+        TAILQ_REMOVE(&this->jobs, job, next);
+        UnixJobFree(job);
+    }
+    while ((job = TAILQ_FIRST(&this->done)) != NULL) {
+        TAILQ_REMOVE(&this->done, job, next);
+        UnixJobFree(job);
+    }
+
+    if (this->wakeup[0] != -1) {
+        close(this->wakeup[0]);
+        close(this->wakeup[1]);
+        this->wakeup[0] = this->wakeup[1] = -1;
+    }
+}
+
+/**
+ * \brief Hand a slow command to the workers
+ *
+ * On success the job owns jsoncmd and server_msg, and the client is
+ * busy until UnixCommandReplyJobs() sends the reply.
+ *
+ * \retval 0 if queued, -1 if the command has to be run inline
+ */
+static int UnixCommandQueueJob(UnixCommand *this, UnixClient *client,
+        Command *cmd, json_t *jsoncmd, json_t *args, json_t *server_msg)
+{
+    if (this->nworkers == 0)
+        return -1;
+
+    UnixJob *job = SCCalloc(1, sizeof(*job));
+    if (unlikely(job == NULL))
+        return -1;
+    job->client = client;
+    job->cmd = cmd;
+    job->jsoncmd = jsoncmd;
+    job->args = args;
+    job->server_msg = server_msg;
+    client->busy = true;
+
+    SCMutexLock(&this->jobs_lock);
+    TAILQ_INSERT_TAIL(&this->jobs, job, next);
+    SCCondSignal(&this->jobs_cond);
+    SCMutexUnlock(&this->jobs_lock);
+    return 0;
+}
+
+/**
+ * \brief Send the replies of the slow commands run by the workers
+ */
+static void UnixCommandReplyJobs(UnixCommand *this)
+{
+    char buf[64];
+    UnixJob *job;
+
+    if (this->wakeup[0] == -1)
+        return;
+
+    while (read(this->wakeup[0], buf, sizeof(buf)) > 0)
+        ;
+
+    SCMutexLock(&this->jobs_lock);
+    while ((job = TAILQ_FIRST(&this->done)) != NULL) {
+        TAILQ_REMOVE(&this->done, job, next);
+        SCMutexUnlock(&this->jobs_lock);
+
+        job->client->busy = false;
+        UnixCommandReply(this, job->client, job->server_msg, job->ret);
+        UnixJobFree(job);
+
+        SCMutexLock(&this->jobs_lock);
+    }
+    SCMutexUnlock(&this->jobs_lock);
+}
+
 /**
  * \brief Command dispatcher
  *
+ * Commands registered with UNIX_CMD_SLOW are handed to the worker
+ * threads, their reply is sent later by UnixCommandReplyJobs().
+ *
  * \param this a UnixCommand:: structure
  * \param command a string containing a json formatted
  * command
@@ -503,6 +727,11 @@ static int UnixCommandExecute(UnixCommand * this, char *command, UnixClient *cli
                     goto error_cmd;
                 }
             }
+            if ((lcmd->flags & UNIX_CMD_SLOW) &&
+                    UnixCommandQueueJob(this, client, lcmd, jsoncmd, cmd,
+                        server_msg) == 0) {
+                return 1;
+            }
             fret = lcmd->Func(cmd, server_msg, lcmd->data);
             if (fret != TM_ECODE_OK) {
                 ret = 0;
@@ -516,18 +745,7 @@ static int UnixCommandExecute(UnixCommand * this, char *command, UnixClient *cli
         ret = 0;
     }
 
-    switch (ret) {
-        case 0:
-            json_object_set_new(server_msg, "return", json_string("NOK"));
-            break;
-        case 1:
-            json_object_set_new(server_msg, "return", json_string("OK"));
-            break;
-    }
-
-    if (UnixCommandSendJSONToClient(client, server_msg) != 0) {
-        goto error;
-    }
+    ret = UnixCommandReply(this, client, server_msg, ret);
 
     json_decref(jsoncmd);
     json_decref(server_msg);
@@ -588,17 +806,12 @@ static void UnixCommandRun(UnixCommand * this, UnixClient *client)
                 buffer[ret-1] = 0;
                 cmd_over = 1;
             } else {
-                struct timeval tv;
-                fd_set select_set;
+                struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
                 offset += ret;
                 do {
-                    FD_ZERO(&select_set);
-                    FD_SET(client->fd, &select_set);
-                    tv.tv_sec = 0;
-                    tv.tv_usec = 200 * 1000;
                     try++;
-                    ret = select(client->fd, &select_set, NULL, NULL, &tv);
-                    /* catch select() error */
+                    ret = poll(&pfd, 1, 200);
+                    /* catch poll() error */
                     if (ret == -1) {
                         /* Signal was caught: just ignore it */
                         if (errno != EINTR) {
@@ -625,42 +838,89 @@ static void UnixCommandRun(UnixCommand * this, UnixClient *client)
 }
 
 /**
- * \brief Select function
+ * \brief Make room for n entries in the poll set
+ *
+ * \retval 0 in case of error, 1 in case of success
+ */
+static int UnixPollSetGrow(UnixCommand *this, uint32_t n)
+{
+    if (n <= this->pfds_size)
+        return 1;
+
+    uint32_t size = MAX(n, this->pfds_size * 2);
+    struct pollfd *pfds = SCRealloc(this->pfds, size * sizeof(*pfds));
+    if (pfds == NULL)
+        return 0;
+    this->pfds = pfds;
+    UnixClient **pclients = SCRealloc(this->pclients, size * sizeof(*pclients));
+    if (pclients == NULL)
+        return 0;
+    this->pclients = pclients;
+    this->pfds_size = size;
+    return 1;
+}
+
+/**
+ * \brief Poll function
+ *
+ * Waits on the listening socket, the worker pipe and the clients
+ * that have no slow command in flight.
  *
  * \retval 0 in case of error, 1 in case of success
  */
 static int UnixMain(UnixCommand * this)
 {
-    struct timeval tv;
     int ret;
-    fd_set select_set;
+    uint32_t n = 0;
     UnixClient *uclient;
     UnixClient *tclient;
 
-    /* Wait activity on the socket */
-    FD_ZERO(&select_set);
-    FD_SET(this->socket, &select_set);
     TAILQ_FOREACH(uclient, &this->clients, next) {
-        FD_SET(uclient->fd, &select_set);
+        n++;
+    }
+    if (!UnixPollSetGrow(this, n + 2)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Command server: can't allocate poll set");
+        return 0;
+    }
+
+    /* Wait activity on the sockets */
+    this->pfds[0].fd = this->socket;
+    this->pfds[0].events = POLLIN;
+    this->pfds[0].revents = 0;
+    /* ignored by poll() if there are no workers */
+    this->pfds[1].fd = this->wakeup[0];
+    this->pfds[1].events = POLLIN;
+    this->pfds[1].revents = 0;
+    n = 2;
+    TAILQ_FOREACH(uclient, &this->clients, next) {
+        if (uclient->busy)
+            continue;
+        this->pfds[n].fd = uclient->fd;
+        this->pfds[n].events = POLLIN;
+        this->pfds[n].revents = 0;
+        this->pclients[n] = uclient;
+        n++;
     }
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 200 * 1000;
-    ret = select(this->select_max, &select_set, NULL, NULL, &tv);
+    ret = poll(this->pfds, n, 200);
 
-    /* catch select() error */
+    /* catch poll() error */
     if (ret == -1) {
         /* Signal was caught: just ignore it */
         if (errno == EINTR) {
             return 1;
         }
-        SCLogError(SC_ERR_SOCKET, "Command server: select() fatal error: %s", strerror(errno));
+        SCLogError(SC_ERR_SOCKET, "Command server: poll() fatal error: %s", strerror(errno));
         return 0;
     }
 
+    UnixCommandReplyJobs(this);
+
     if (suricata_ctl_flags & SURICATA_STOP) {
+        /* busy clients are closed once their command is done */
         TAILQ_FOREACH_SAFE(uclient, &this->clients, next, tclient) {
-            UnixCommandClose(this, uclient->fd);
+            if (!uclient->busy)
+                UnixCommandClose(this, uclient->fd);
         }
         return 1;
     }
@@ -670,12 +930,14 @@ static int UnixMain(UnixCommand * this)
         return 1;
     }
 
-    TAILQ_FOREACH_SAFE(uclient, &this->clients, next, tclient) {
-        if (FD_ISSET(uclient->fd, &select_set)) {
-            UnixCommandRun(this, uclient);
+    /* a client run can only close itself, so the other entries
+     * stay valid */
+    for (uint32_t i = 2; i < n; i++) {
+        if (this->pfds[i].revents != 0) {
+            UnixCommandRun(this, this->pclients[i]);
         }
     }
-    if (FD_ISSET(this->socket, &select_set)) {
+    if (this->pfds[0].revents & POLLIN) {
         if (!UnixCommandAccept(this))
             return 1;
     }
@@ -960,7 +1222,10 @@ static UnixCommand command;
  * \param keyword name of the command
  * \param Func function to run when command is received
  * \param data a pointer to data that are passed to Func when it is run
- * \param flags a flag now used to tune the command type
+ * \param flags UNIX_CMD_TAKE_ARGS if the command has arguments,
+ *        UNIX_CMD_SLOW to run it on the worker threads so it doesn't
+ *        block the other clients. Such a command must not use the
+ *        UnixCommand state.
  * \retval TM_ECODE_OK in case of success, TM_ECODE_FAILED in case of failure
  */
 TmEcode UnixManagerRegisterCommand(const char * keyword,
@@ -1069,13 +1334,20 @@ int UnixManagerInit(void)
     UnixManagerRegisterCommand("running-mode", UnixManagerRunningModeCommand, &command, 0);
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
-    UnixManagerRegisterCommand("dump-counters", StatsOutputCounterSocket, NULL, 0);
-    UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
-    UnixManagerRegisterCommand("ruleset-reload-rules", UnixManagerReloadRules, NULL, 0);
+    UnixManagerRegisterCommand("dump-counters", StatsOutputCounterSocket, NULL, UNIX_CMD_SLOW);
+    UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, UNIX_CMD_SLOW);
+    UnixManagerRegisterCommand("ruleset-reload-rules", UnixManagerReloadRules, NULL, UNIX_CMD_SLOW);
     UnixManagerRegisterCommand("ruleset-reload-nonblocking", UnixManagerNonBlockingReloadRules, NULL, 0);
     UnixManagerRegisterCommand("ruleset-reload-time", UnixManagerReloadTimeCommand, NULL, 0);
     UnixManagerRegisterCommand("ruleset-stats", UnixManagerRulesetStatsCommand, NULL, 0);
     UnixManagerRegisterCommand("ruleset-failed-rules", UnixManagerShowFailedRules, NULL, 0);
+    UnixManagerRegisterCommand("fast-pattern-stats", DetectFPStatsCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("ruleset-profile-sample", DetectRuleSampleCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("ruleset-profile-sample-top", DetectRuleSampleTopCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("dataset-reload", DatasetReloadCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("iprep-update", SRepUpdateCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("iprep-reload", SRepReloadCommand, NULL, UNIX_CMD_SLOW);
+    UnixManagerRegisterCommand("iprep-lookup", SRepLookupCommand, NULL, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS);
@@ -1125,6 +1397,9 @@ static TmEcode UnixManager(ThreadVars *th_v, void *thread_data)
     th_v->cap_flags = 0;
     SCDropCaps(th_v);
 
+    /* started after dropping the caps so the workers don't keep them */
+    UnixCommandStartWorkers(&command);
+
     TmThreadsSetFlag(th_v, THV_INIT_DONE);
     while (1) {
         ret = UnixMain(&command);
@@ -1135,10 +1410,17 @@ static TmEcode UnixManager(ThreadVars *th_v, void *thread_data)
         if ((ret == 0) || (TmThreadsCheckFlag(th_v, THV_KILL))) {
             UnixClient *item;
             UnixClient *titem;
+            UnixCommandStopWorkers(&command);
             TAILQ_FOREACH_SAFE(item, &(&command)->clients, next, titem) {
                 close(item->fd);
-                SCFree(item);
+                UnixClientFree(item);
             }
+            TAILQ_INIT(&(&command)->clients);
+            SCFree(command.pfds);
+            SCFree(command.pclients);
+            command.pfds = NULL;
+            command.pclients = NULL;
+            command.pfds_size = 0;
             StatsSyncCounters(th_v);
             break;
         }
@@ -1188,8 +1470,17 @@ void UnixManagerThreadSpawnNonRunmode(void)
     if (unix_socket == 1) {
         if (UnixManagerInit() == 0) {
             UnixManagerRegisterCommand("iface-stat", LiveDeviceIfaceStat, NULL,
-                    UNIX_CMD_TAKE_ARGS);
+                    UNIX_CMD_TAKE_ARGS|UNIX_CMD_SLOW);
             UnixManagerRegisterCommand("iface-list", LiveDeviceIfaceList, NULL, 0);
+            UnixManagerRegisterCommand("latency-histograms", LatencyHistogramsDump, NULL, 0);
+            UnixManagerRegisterCommand("stream-memuse-top", StreamTcpMemuseTopCommand,
+                    NULL, UNIX_CMD_TAKE_ARGS|UNIX_CMD_SLOW);
+            UnixManagerRegisterCommand("flow-cost-top", FlowCostTopCommand,
+                    NULL, UNIX_CMD_TAKE_ARGS|UNIX_CMD_SLOW);
+            UnixManagerRegisterCommand("worker-add", RunModeWorkerAddCommand,
+                    NULL, UNIX_CMD_TAKE_ARGS);
+            UnixManagerRegisterCommand("worker-remove", RunModeWorkerRemoveCommand,
+                    NULL, UNIX_CMD_TAKE_ARGS);
             UnixManagerThreadSpawn(0);
 #ifdef HAVE_PACKET_EBPF
             UnixManagerRegisterCommand("ebpf-bypassed-stats", EBPFGetBypassedStats, NULL, 0);
@@ -29,6 +29,9 @@
 #endif
 
 #define UNIX_CMD_TAKE_ARGS 1
+/** command may block: it is run on a worker thread and replied to
+ *  asynchronously */
+#define UNIX_CMD_SLOW       2
 
 SCCtrlCondT unix_manager_ctrl_cond;
 SCCtrlMutex unix_manager_ctrl_mutex;
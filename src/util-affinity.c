@@ -30,6 +30,8 @@
 #include "threads.h"
 #include "queue.h"
 #include "runmodes.h"
+#include "util-device.h"
+#include "util-ioctl.h"
 
 ThreadsAffinityType thread_affinity[MAX_CPU_SET] = {
     {
@@ -60,6 +62,7 @@ ThreadsAffinityType thread_affinity[MAX_CPU_SET] = {
 };
 
 int thread_affinity_init_done = 0;
+static int thread_affinity_auto = 0;
 
 /**
  * \brief find affinity by its name
@@ -290,6 +293,226 @@ void AffinitySetupLoadFromConfig()
 #endif /* OS_WIN32 and __OpenBSD__ */
 }
 
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+#ifdef __linux__
+/**
+ * \brief Parse a kernel cpu list ("0-3,8-11") into a cpu set
+ * \retval 0 on success, -1 on parse error
+ */
+static int AffinityParseCpuList(char *str, cpu_set_t *cs)
+{
+    char *saveptr = NULL;
+    CPU_ZERO(cs);
+    for (char *tok = strtok_r(str, ",\n", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",\n", &saveptr))
+    {
+        char *end;
+        long a = strtol(tok, &end, 10);
+        long b = a;
+        if (end == tok)
+            return -1;
+        if (*end == '-') {
+            b = strtol(end + 1, &end, 10);
+        }
+        if (a < 0 || b < a)
+            return -1;
+        for (long i = a; i <= b && i < CPU_SETSIZE; i++) {
+            CPU_SET(i, cs);
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Get the cpus of a NUMA node from sysfs
+ * \retval 0 on success, -1 if the node is unknown
+ */
+static int AffinityGetNodeCpus(int node, cpu_set_t *cs)
+{
+    char path[PATH_MAX];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    char *r = fgets(buf, sizeof(buf), fp);
+    fclose(fp);
+    if (r == NULL || AffinityParseCpuList(buf, cs) != 0)
+        return -1;
+    return CPU_COUNT(cs) > 0 ? 0 : -1;
+}
+#endif /* __linux__ */
+
+static void AffinityCpusetToStr(const cpu_set_t *cs, char *str, size_t size)
+{
+    int max = UtilCpuGetNumProcessorsOnline();
+    size_t off = 0;
+    str[0] = '\0';
+    for (int i = 0; i < max && off < size; i++) {
+        if (!CPU_ISSET(i, cs))
+            continue;
+        int j = i;
+        while (j + 1 < max && CPU_ISSET(j + 1, cs))
+            j++;
+        int r;
+        if (j > i)
+            r = snprintf(str + off, size - off, "%s%d-%d", off ? "," : "", i, j);
+        else
+            r = snprintf(str + off, size - off, "%s%d", off ? "," : "", i);
+        if (r < 0)
+            break;
+        off += r;
+        i = j;
+    }
+}
+#endif /* OS_WIN32 and __OpenBSD__ */
+
+/**
+ * \brief Build the cpu affinity layout from the system topology
+ *
+ * Used for 'threading.set-cpu-affinity: auto'. Threads are kept on the
+ * NUMA node the capture NICs are attached to: the first cpu of the node
+ * is used for the management threads, the others for the receive and
+ * worker threads. In autofp, the receive threads get one cpu per RSS
+ * queue (leaving at least one cpu for the workers) and the worker thread
+ * count is set to the remaining cpus.
+ */
+void AffinitySetupAuto(void)
+{
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+    if (thread_affinity_init_done == 0) {
+        AffinitySetupInit();
+        thread_affinity_init_done = 1;
+    }
+    thread_affinity_auto = 1;
+
+    int ncpu = UtilCpuGetNumProcessorsOnline();
+    int node = -1;
+    int rss_queues = 0;
+    cpu_set_t node_cpus;
+
+    int nlive = LiveGetDeviceCount();
+    for (int i = 0; i < nlive; i++) {
+        const char *dev = LiveGetDeviceName(i);
+        if (dev == NULL)
+            continue;
+        int q = GetIfaceRSSQueuesNum(dev);
+        if (q > 0)
+            rss_queues += q;
+        int n = GetIfaceNumaNode(dev);
+        if (n < 0)
+            continue;
+        if (node == -1) {
+            node = n;
+        } else if (n != node) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "interface %s is on NUMA "
+                    "node %d, but threads are placed on node %d", dev, n, node);
+        }
+    }
+
+#ifdef __linux__
+    if (node < 0 || AffinityGetNodeCpus(node, &node_cpus) != 0)
+#endif
+    {
+        CPU_ZERO(&node_cpus);
+        for (int i = 0; i < ncpu; i++) {
+            CPU_SET(i, &node_cpus);
+        }
+        node = -1;
+    }
+
+    int mgmt_cpu = 0;
+    while (mgmt_cpu < ncpu && !CPU_ISSET(mgmt_cpu, &node_cpus))
+        mgmt_cpu++;
+    if (mgmt_cpu == ncpu) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "no online cpu on NUMA node %d, "
+                "not setting cpu affinity", node);
+        return;
+    }
+
+    cpu_set_t work_cpus = node_cpus;
+    if (CPU_COUNT(&work_cpus) > 1) {
+        CPU_CLR(mgmt_cpu, &work_cpus);
+    }
+
+    ThreadsAffinityType *mgmt = &thread_affinity[MANAGEMENT_CPU_SET];
+    ThreadsAffinityType *verdict = &thread_affinity[VERDICT_CPU_SET];
+    ThreadsAffinityType *recv = &thread_affinity[RECEIVE_CPU_SET];
+    ThreadsAffinityType *worker = &thread_affinity[WORKER_CPU_SET];
+
+    CPU_ZERO(&mgmt->cpu_set);
+    CPU_SET(mgmt_cpu, &mgmt->cpu_set);
+    mgmt->mode_flag = BALANCED_AFFINITY;
+    CPU_ZERO(&verdict->cpu_set);
+    CPU_SET(mgmt_cpu, &verdict->cpu_set);
+    verdict->mode_flag = BALANCED_AFFINITY;
+
+    recv->cpu_set = work_cpus;
+    recv->mode_flag = EXCLUSIVE_AFFINITY;
+    worker->cpu_set = work_cpus;
+    worker->mode_flag = EXCLUSIVE_AFFINITY;
+
+    const char *runmode = RunmodeGetActive();
+    int nwork = CPU_COUNT(&work_cpus);
+    if (runmode != NULL && strcmp(runmode, "autofp") == 0 && nwork > 1) {
+        int nrecv = rss_queues > 0 ? rss_queues : 1;
+        if (nrecv > nwork / 2)
+            nrecv = nwork / 2;
+
+        CPU_ZERO(&recv->cpu_set);
+        for (int i = 0; i < ncpu && nrecv > 0; i++) {
+            if (CPU_ISSET(i, &worker->cpu_set)) {
+                CPU_SET(i, &recv->cpu_set);
+                CPU_CLR(i, &worker->cpu_set);
+                nrecv--;
+            }
+        }
+        worker->nb_threads = CPU_COUNT(&worker->cpu_set);
+    }
+
+    char str[256];
+    SCLogConfig("cpu affinity auto: NUMA node %d, %d RSS queue(s)",
+            node, rss_queues);
+    AffinityCpusetToStr(&mgmt->cpu_set, str, sizeof(str));
+    SCLogConfig("cpu affinity auto: management and verdict cpus: %s", str);
+    AffinityCpusetToStr(&recv->cpu_set, str, sizeof(str));
+    SCLogConfig("cpu affinity auto: receive cpus: %s", str);
+    AffinityCpusetToStr(&worker->cpu_set, str, sizeof(str));
+    SCLogConfig("cpu affinity auto: worker cpus: %s", str);
+#else
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "cpu affinity is not supported "
+            "on this platform");
+#endif /* OS_WIN32 and __OpenBSD__ */
+}
+
+/**
+ * \brief Check if the cpu affinity layout was set up by AffinitySetupAuto()
+ */
+int AffinityIsAuto(void)
+{
+    return thread_affinity_auto;
+}
+
+/**
+ * \brief Return the number of cpus in the cpu set of a thread family
+ * \retval number of cpus, 0 if affinity is not supported
+ */
+uint16_t UtilAffinityGetAffinedCPUNum(ThreadsAffinityType *taf)
+{
+    uint16_t ncpu = 0;
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+    int max_cpus = UtilCpuGetNumProcessorsOnline();
+    SCMutexLock(&taf->taf_mutex);
+    for (int cpu = 0; cpu < max_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &taf->cpu_set))
+            ncpu++;
+    }
+    SCMutexUnlock(&taf->taf_mutex);
+#endif /* OS_WIN32 and __OpenBSD__ */
+    return ncpu;
+}
+
 /**
  * \brief Return next cpu to use for a given thread family
  * \retval the cpu to used given by its id
@@ -83,9 +83,12 @@ extern ThreadsAffinityType thread_affinity[MAX_CPU_SET];
 #endif
 
 void AffinitySetupLoadFromConfig(void);
+void AffinitySetupAuto(void);
+int AffinityIsAuto(void);
 ThreadsAffinityType * GetAffinityTypeFromName(const char *name);
 
 int AffinityGetNextCPU(ThreadsAffinityType *taf);
+uint16_t UtilAffinityGetAffinedCPUNum(ThreadsAffinityType *taf);
 
 void BuildCpusetWithCallback(const char *name, ConfNode *node,
                              void (*Callback)(int i, void * data),
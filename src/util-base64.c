@@ -24,6 +24,10 @@
 
 #include "util-base64.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
 /* Constants */
 #define BASE64_TABLE_MAX  122
 
@@ -77,6 +81,61 @@ static inline void DecodeBase64Block(uint8_t ascii[ASCII_BLOCK], uint8_t b64[B64
     ascii[2] = (uint8_t) (b64[2] << 6) | (b64[3]);
 }
 
+#if defined(__SSSE3__)
+
+/** \internal
+ *  \brief decode 16 base64 chars into 12 bytes
+ *
+ *  Translates the chars to their 6 bit values with nibble lookups and
+ *  packs 4 of them into 3 bytes per 32 bit lane.
+ *
+ *  \retval 1 decoded
+ *  \retval 0 block contains a char outside the base64 alphabet ('='
+ *            included), nothing written
+ */
+static inline int DecodeBase64BlockSSSE3(uint8_t *dest, const uint8_t *src)
+{
+    const __m128i in = _mm_loadu_si128((const __m128i *)src);
+
+    /* a char is valid if its high and low nibble lookups share no bit */
+    const __m128i lut_lo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    /* offset to add per high nibble, '/' gets its own */
+    const __m128i lut_roll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_0f = _mm_set1_epi8(0x0f);
+    const __m128i slash = _mm_set1_epi8('/');
+
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_0f);
+    const __m128i lo_nibbles = _mm_and_si128(in, mask_0f);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                    _mm_setzero_si128())) != 0xffff)
+        return 0;
+
+    const __m128i eq_slash = _mm_cmpeq_epi8(in, slash);
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_slash, hi_nibbles));
+    const __m128i vals = _mm_add_epi8(in, roll);
+
+    /* 00aaaaaa 00bbbbbb 00cccccc 00dddddd -> aaaaaabb bbbbcccc ccdddddd */
+    const __m128i ab_cd = _mm_maddubs_epi16(vals, _mm_set1_epi32(0x01400140));
+    const __m128i abcd = _mm_madd_epi16(ab_cd, _mm_set1_epi32(0x00011000));
+    const __m128i out = _mm_shuffle_epi8(abcd, _mm_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    uint8_t tmp[16];
+    _mm_storeu_si128((__m128i *)tmp, out);
+    memcpy(dest, tmp, 12);
+    return 1;
+}
+#endif /* __SSSE3__ */
+
 /**
  * \brief Decodes a base64-encoded string buffer into an ascii-encoded byte buffer
  *
@@ -92,12 +151,23 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     int strict)
 {
     int val;
-    uint32_t padding = 0, numDecoded = 0, bbidx = 0, valid = 1, i;
+    uint32_t padding = 0, numDecoded = 0, bbidx = 0, valid = 1, i = 0;
     uint8_t *dptr = dest;
     uint8_t b64[B64_BLOCK] = { 0,0,0,0 };
 
+#if defined(__SSSE3__)
+    /* whole blocks of alphabet chars first, the first block with anything
+     * else and the tail are left to the loop below */
+    for ( ; i + 16 <= len; i += 16) {
+        if (!DecodeBase64BlockSSSE3(dptr, src + i))
+            break;
+        dptr += 12;
+        numDecoded += 12;
+    }
+#endif
+
     /* Traverse through each alpha-numeric letter in the source array */
-    for(i = 0; i < len && src[i] != 0; i++) {
+    for( ; i < len && src[i] != 0; i++) {
 
         /* Get decimal representation */
         val = GetBase64Value(src[i]);
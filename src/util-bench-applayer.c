@@ -0,0 +1,571 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * App-layer parser benchmark, 'suricata --bench=app-layer
+ * --bench-input=<pcap> --bench-proto=<proto>'.
+ *
+ * The TCP and UDP payloads of each connection in the pcap are loaded
+ * once, TCP data in sequence order with retransmissions and data after
+ * a gap left out. Each iteration passes them through
+ * AppLayerParserParse() in pcap order as the given protocol, without
+ * capture, decoding, stream reassembly or protocol detection, so all
+ * connections in the pcap should be of that protocol. The sender of the
+ * SYN, or else of the first packet, is the client. At the end of the
+ * iteration the transactions are counted and the flows cleaned up.
+ *
+ * Reported are the throughput, the transactions per second and the
+ * allocations per transaction, the parsing and the cleanup included.
+ * Allocations are counted by the SCMalloc family in util-mem.h and by
+ * the rust allocator of --enable-unittests builds; those of libhtp are
+ * not seen.
+ *
+ * With --bench-baseline=<file> the results are compared to those stored
+ * for the protocol in the file, and the run fails if the throughput is
+ * lower or the allocations per transaction higher than the baseline by
+ * more than --bench-tolerance percent (default 10). With
+ * --bench-baseline-update the results are stored in the file instead.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "flow.h"
+#include "flow-util.h"
+#include "stream.h"
+#include "stream-tcp.h"
+#include "app-layer-parser.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-hashlist.h"
+
+#ifdef UNITTESTS
+
+#ifdef HAVE_RUST
+#include "rust-mem-gen.h"
+#endif
+
+#define BENCH_DEFAULT_TOLERANCE     10
+#define BENCH_MAX_FLOWS             65536
+
+typedef struct BenchAppMsg_ {
+    uint32_t flow;          /**< index in BenchAppCtx::conns */
+    uint8_t flags;          /**< direction and STREAM_START */
+    uint32_t len;
+    uint8_t *buf;
+} BenchAppMsg;
+
+/** connection in the pcap, its first bytes are the hash key */
+typedef struct BenchAppConn_ {
+    struct {
+        Address client;
+        Address server;
+        Port cp;
+        Port sp;
+        uint8_t proto;
+    } key;
+    uint32_t flow;
+    /** next expected TCP sequence number per direction, 0 toserver */
+    uint32_t next_seq[2];
+    bool seq_set[2];
+    bool started[2];
+} BenchAppConn;
+
+typedef struct BenchAppCtx_ {
+    AppProto alproto;
+
+    BenchAppMsg *msgs;
+    uint32_t msgs_cnt;
+    uint32_t msgs_size;
+    uint64_t bytes;
+    uint64_t skipped;
+
+    /** the key of each connection, to set up its flow */
+    BenchAppConn **conns;
+    uint32_t conns_cnt;
+    Flow *flows;
+    TcpSession *ssns;
+    AppLayerParserThreadCtx *alp_tctx;
+
+    /* per iteration results, to check that the work was done */
+    uint64_t txs;
+    uint64_t errors;
+    uint64_t allocs;
+} BenchAppCtx;
+
+typedef struct BenchAppResult_ {
+    double mib_per_sec;
+    double allocs_per_tx;
+} BenchAppResult;
+
+static uint64_t BenchAllocCount(void)
+{
+    uint64_t cnt = sc_mem_alloc_cnt;
+#ifdef HAVE_RUST
+    cnt += rs_mem_alloc_count();
+#endif
+    return cnt;
+}
+
+static int BenchAddMsg(BenchAppCtx *ctx, uint32_t flow, uint8_t flags,
+        const uint8_t *data, uint32_t len)
+{
+    if (ctx->msgs_cnt == ctx->msgs_size) {
+        uint32_t size = ctx->msgs_size ? ctx->msgs_size * 2 : 1024;
+        BenchAppMsg *msgs = SCRealloc(ctx->msgs, size * sizeof(*msgs));
+        if (msgs == NULL)
+            return -1;
+        ctx->msgs = msgs;
+        ctx->msgs_size = size;
+    }
+
+    uint8_t *buf = SCMalloc(len);
+    if (buf == NULL)
+        return -1;
+    memcpy(buf, data, len);
+
+    BenchAppMsg *m = &ctx->msgs[ctx->msgs_cnt++];
+    m->flow = flow;
+    m->flags = flags;
+    m->buf = buf;
+    m->len = len;
+    ctx->bytes += len;
+    return 0;
+}
+
+/** \retval conn connection of the packet, NULL if the flow limit is hit or
+ *          on error, toserver set to the direction of the packet */
+static BenchAppConn *BenchGetConn(BenchAppCtx *ctx, HashListTable *conns,
+        const Packet *p, bool *toserver)
+{
+    BenchAppConn key;
+    memset(&key, 0, sizeof(key));
+    COPY_ADDRESS(&p->src, &key.key.client);
+    COPY_ADDRESS(&p->dst, &key.key.server);
+    key.key.cp = p->sp;
+    key.key.sp = p->dp;
+    key.key.proto = p->proto;
+
+    BenchAppConn *c = HashListTableLookup(conns, &key, sizeof(key.key));
+    if (c != NULL) {
+        *toserver = true;
+        return c;
+    }
+
+    BenchAppConn rkey;
+    memset(&rkey, 0, sizeof(rkey));
+    COPY_ADDRESS(&p->dst, &rkey.key.client);
+    COPY_ADDRESS(&p->src, &rkey.key.server);
+    rkey.key.cp = p->dp;
+    rkey.key.sp = p->sp;
+    rkey.key.proto = p->proto;
+    c = HashListTableLookup(conns, &rkey, sizeof(rkey.key));
+    if (c != NULL) {
+        *toserver = false;
+        return c;
+    }
+
+    if (ctx->conns_cnt == BENCH_MAX_FLOWS)
+        return NULL;
+    if ((ctx->conns_cnt % 1024) == 0) {
+        BenchAppConn **a = SCRealloc(ctx->conns,
+                (ctx->conns_cnt + 1024) * sizeof(*a));
+        if (a == NULL)
+            return NULL;
+        ctx->conns = a;
+    }
+
+    /* a SYN/ACK as first packet is from the server */
+    const bool from_server = PKT_IS_TCP(p) && TCP_ISSET_FLAG_SYN(p) &&
+        TCP_ISSET_FLAG_ACK(p);
+    c = SCMalloc(sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    *c = from_server ? rkey : key;
+    c->flow = ctx->conns_cnt;
+    if (HashListTableAdd(conns, c, sizeof(c->key)) != 0) {
+        SCFree(c);
+        return NULL;
+    }
+    ctx->conns[ctx->conns_cnt++] = c;
+    *toserver = !from_server;
+    return c;
+}
+
+typedef struct BenchAppPcap_ {
+    BenchAppCtx *ctx;
+    /** the connections are owned by ctx->conns */
+    HashListTable *conns;
+} BenchAppPcap;
+
+static int BenchAddPacket(void *data, Packet *p)
+{
+    BenchAppPcap *pcap = data;
+    BenchAppCtx *ctx = pcap->ctx;
+
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p)) ||
+            (p->payload_len == 0 && !(PKT_IS_TCP(p) &&
+                TCP_ISSET_FLAG_SYN(p))))
+        return 0;
+
+    bool toserver = true;
+    BenchAppConn *c = BenchGetConn(ctx, pcap->conns, p, &toserver);
+    if (c == NULL)
+        return ctx->conns_cnt == BENCH_MAX_FLOWS ? 0 : -1;
+    const int d = toserver ? 0 : 1;
+
+    if (PKT_IS_TCP(p)) {
+        uint32_t seq = TCP_GET_SEQ(p);
+        if (TCP_ISSET_FLAG_SYN(p)) {
+            c->next_seq[d] = seq + 1;
+            c->seq_set[d] = true;
+            return 0;
+        }
+        if (!c->seq_set[d]) {
+            c->next_seq[d] = seq;
+            c->seq_set[d] = true;
+        }
+        /* only new data in order, the parsers don't get gaps here */
+        if (seq != c->next_seq[d]) {
+            ctx->skipped += p->payload_len;
+            return 0;
+        }
+        c->next_seq[d] += p->payload_len;
+    }
+
+    uint8_t flags = toserver ? STREAM_TOSERVER : STREAM_TOCLIENT;
+    if (!c->started[d]) {
+        flags |= STREAM_START;
+        c->started[d] = true;
+    }
+    return BenchAddMsg(ctx, c->flow, flags, p->payload, p->payload_len);
+}
+
+static int BenchLoadPcap(BenchAppCtx *ctx, const char *file)
+{
+    BenchAppPcap pcap = { ctx, NULL };
+    pcap.conns = HashListTableInit(4096, HashListTableGenericHash,
+            HashListTableDefaultCompare, NULL);
+    if (pcap.conns == NULL)
+        return -1;
+
+    int ret = BenchPcapDecode(file, BenchAddPacket, &pcap);
+    if (ret == 0 && ctx->msgs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no TCP or UDP data in %s", file);
+        ret = -1;
+    }
+    if (ret == 0) {
+        ctx->flows = SCCalloc(ctx->conns_cnt, sizeof(Flow));
+        ctx->ssns = SCCalloc(ctx->conns_cnt, sizeof(TcpSession));
+        if (ctx->flows == NULL || ctx->ssns == NULL)
+            ret = -1;
+    }
+
+    HashListTableFree(pcap.conns);
+    return ret;
+}
+
+static void BenchSetupFlows(BenchAppCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->conns_cnt; i++) {
+        const BenchAppConn *c = ctx->conns[i];
+        Flow *f = &ctx->flows[i];
+
+        memset(f, 0, sizeof(*f));
+        FLOW_INITIALIZE(f);
+        f->proto = c->key.proto;
+        f->sp = c->key.cp;
+        f->dp = c->key.sp;
+        memcpy(&f->src.address, &c->key.client.address, sizeof(f->src.address));
+        memcpy(&f->dst.address, &c->key.server.address, sizeof(f->dst.address));
+        f->flags |= (c->key.client.family == AF_INET6) ? FLOW_IPV6 : FLOW_IPV4;
+        f->alproto = ctx->alproto;
+        if (f->proto == IPPROTO_TCP) {
+            memset(&ctx->ssns[i], 0, sizeof(TcpSession));
+            f->protoctx = &ctx->ssns[i];
+        }
+    }
+}
+
+static void BenchClearFlows(BenchAppCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->conns_cnt; i++) {
+        Flow *f = &ctx->flows[i];
+        if (f->alstate != NULL)
+            ctx->txs += AppLayerParserGetTxCnt(f, f->alstate);
+        FLOW_DESTROY(f);
+    }
+}
+
+static uint64_t BenchIteration(BenchAppCtx *ctx)
+{
+    uint64_t ticks = 0;
+
+    ctx->txs = 0;
+    ctx->errors = 0;
+    BenchSetupFlows(ctx);
+
+    const uint64_t allocs = BenchAllocCount();
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++) {
+        const BenchAppMsg *m = &ctx->msgs[i];
+        Flow *f = &ctx->flows[m->flow];
+
+        const uint64_t start = UtilCpuGetTicks();
+        int r = AppLayerParserParse(NULL, ctx->alp_tctx, f, ctx->alproto,
+                m->flags, m->buf, m->len);
+        ticks += UtilCpuGetTicks() - start;
+        if (r < 0)
+            ctx->errors++;
+    }
+
+    const uint64_t start = UtilCpuGetTicks();
+    BenchClearFlows(ctx);
+    ticks += UtilCpuGetTicks() - start;
+    ctx->allocs = BenchAllocCount() - allocs;
+    return ticks;
+}
+
+static void BenchRun(BenchAppCtx *ctx, uint32_t iterations,
+        BenchAppResult *res)
+{
+    /* warm up the caches */
+    (void)BenchIteration(ctx);
+
+    uint64_t ticks = 0;
+    uint64_t txs = 0;
+    uint64_t allocs = 0;
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < iterations; i++) {
+        ticks += BenchIteration(ctx);
+        txs += ctx->txs;
+        allocs += ctx->allocs;
+    }
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+    const uint64_t bytes = ctx->bytes * iterations;
+    const double secs = (double)ticks * ns_per_tick / 1e9;
+
+    res->mib_per_sec = secs > 0 ? bytes / secs / (1024 * 1024) : 0;
+    res->allocs_per_tx = txs ? (double)allocs / txs : (double)allocs;
+
+    printf("%12"PRIu64" %10.1f %12.1f %12.1f %10"PRIu64" %10"PRIu64"\n",
+            bytes, res->mib_per_sec, secs > 0 ? txs / secs : 0,
+            res->allocs_per_tx, ctx->txs, ctx->errors);
+}
+
+static void BenchFree(BenchAppCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++)
+        SCFree(ctx->msgs[i].buf);
+    SCFree(ctx->msgs);
+    for (uint32_t i = 0; i < ctx->conns_cnt; i++)
+        SCFree(ctx->conns[i]);
+    SCFree(ctx->conns);
+    SCFree(ctx->flows);
+    SCFree(ctx->ssns);
+    if (ctx->alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(ctx->alp_tctx);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/*
+ * Baselines
+ *
+ * A text file with a line per protocol: the protocol name, the MiB/s and
+ * the allocations per transaction. Lines starting with '#' are comments.
+ */
+
+#define BENCH_BASELINE_LINE_MAX 256
+
+/** \retval 1 found, 0 not found, -1 error */
+static int BenchBaselineGet(const char *file, const char *proto,
+        BenchAppResult *base)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+
+    int r = 0;
+    char line[BENCH_BASELINE_LINE_MAX];
+    while (r == 0 && fgets(line, sizeof(line), fp) != NULL) {
+        char name[64];
+        BenchAppResult res;
+        if (line[0] == '#' || sscanf(line, "%63s %lf %lf", name,
+                    &res.mib_per_sec, &res.allocs_per_tx) != 3)
+            continue;
+        if (strcmp(name, proto) == 0) {
+            *base = res;
+            r = 1;
+        }
+    }
+    fclose(fp);
+    return r;
+}
+
+/** \brief store the results of the protocol, keeping the other lines */
+static int BenchBaselineUpdate(const char *file, const char *proto,
+        const BenchAppResult *res)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp))
+        return -1;
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+
+    FILE *in = fopen(file, "r");
+    if (in != NULL) {
+        char line[BENCH_BASELINE_LINE_MAX];
+        while (fgets(line, sizeof(line), in) != NULL) {
+            char name[64];
+            if (line[0] != '#' && sscanf(line, "%63s", name) == 1 &&
+                    strcmp(name, proto) == 0)
+                continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    } else {
+        fprintf(out, "# protocol MiB/s allocs/tx\n");
+    }
+    fprintf(out, "%s %.1f %.2f\n", proto, res->mib_per_sec, res->allocs_per_tx);
+
+    if (fclose(out) != 0 || rename(tmp, file) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to write %s: %s", file, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    printf("baseline for %s stored in %s\n", proto, file);
+    return 0;
+}
+
+/** \retval 0 within the tolerance of the baseline, -1 regression */
+static int BenchBaselineCheck(const char *proto, const BenchAppResult *base,
+        const BenchAppResult *res, uint64_t tolerance)
+{
+    int r = 0;
+    const double min = base->mib_per_sec * (100 - tolerance) / 100;
+    const double max = base->allocs_per_tx * (100 + tolerance) / 100;
+
+    printf("baseline %s: %.1f MiB/s, %.2f allocs/tx\n", proto,
+            base->mib_per_sec, base->allocs_per_tx);
+    if (res->mib_per_sec < min) {
+        printf("FAILED: %.1f MiB/s is more than %"PRIu64"%% below the "
+                "baseline\n", res->mib_per_sec, tolerance);
+        r = -1;
+    }
+    if (res->allocs_per_tx > max) {
+        printf("FAILED: %.2f allocs/tx is more than %"PRIu64"%% above the "
+                "baseline\n", res->allocs_per_tx, tolerance);
+        r = -1;
+    }
+    return r;
+}
+
+/**
+ * \brief app-layer parser benchmark, --bench=app-layer
+ */
+int BenchModeAppLayer(const BenchConfig *cfg)
+{
+    const char *proto = NULL;
+    const char *baseline = NULL;
+    int update = 0;
+    uint64_t tolerance = BENCH_DEFAULT_TOLERANCE;
+
+    if (BenchGetUint("bench.tolerance", &tolerance) < 0 || tolerance > 100)
+        return -1;
+    if (ConfGet("bench.proto", &proto) != 1 || proto == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "--bench=app-layer needs "
+                "--bench-proto=<proto>");
+        return -1;
+    }
+    (void)ConfGet("bench.baseline", &baseline);
+    (void)ConfGetBool("bench.baseline-update", &update);
+    if (update && baseline == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "--bench-baseline-update needs "
+                "--bench-baseline=<file>");
+        return -1;
+    }
+
+    StreamTcpInitConfig(TRUE);
+
+    BenchAppCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int r = 0;
+    ctx.alproto = StringToAppProto(proto);
+    if (ctx.alproto == ALPROTO_UNKNOWN) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unknown app-layer protocol %s",
+                proto);
+        r = -1;
+    }
+    if (r == 0) {
+        ctx.alp_tctx = AppLayerParserThreadCtxAlloc();
+        if (ctx.alp_tctx == NULL)
+            r = -1;
+    }
+    if (r == 0)
+        r = BenchLoadPcap(&ctx, cfg->input);
+    for (uint32_t i = 0; r == 0 && i < ctx.conns_cnt; i++) {
+        if (!AppLayerParserProtoIsRegistered(ctx.conns[i]->key.proto,
+                    ctx.alproto)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "no %s parser for ipproto %u",
+                    proto, ctx.conns[i]->key.proto);
+            r = -1;
+        }
+    }
+
+    if (r == 0) {
+        printf("%s: %s, %u connections, %u messages, %"PRIu64" bytes, "
+                "%"PRIu64" bytes out of order or retransmitted, "
+                "%u iterations\n", cfg->input, proto, ctx.conns_cnt,
+                ctx.msgs_cnt, ctx.bytes, ctx.skipped, cfg->iterations);
+        printf("%12s %10s %12s %12s %10s %10s\n", "bytes", "MiB/s", "txs/s",
+                "allocs/tx", "txs", "errors");
+
+        BenchAppResult res;
+        BenchRun(&ctx, cfg->iterations, &res);
+
+        if (baseline != NULL && update) {
+            r = BenchBaselineUpdate(baseline, proto, &res);
+        } else if (baseline != NULL) {
+            BenchAppResult base;
+            int found = BenchBaselineGet(baseline, proto, &base);
+            if (found < 0) {
+                r = -1;
+            } else if (found == 0) {
+                printf("no baseline for %s in %s\n", proto, baseline);
+            } else {
+                r = BenchBaselineCheck(proto, &base, &res, tolerance);
+            }
+        }
+    }
+    BenchFree(&ctx);
+    StreamTcpFreeConfig(TRUE);
+    return r;
+}
+
+#endif /* UNITTESTS */
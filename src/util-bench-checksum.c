@@ -0,0 +1,96 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * TCP/UDP payload checksum benchmark, 'suricata --bench=checksum'.
+ *
+ * Compares the old 16 bit at a time loop with the scalar and the runtime
+ * selected vector implementation of util-checksum-simd.c, on buffers of
+ * a few packet sizes. The work per size is fixed, --bench-iterations and
+ * --bench-max-ns don't apply.
+ */
+
+#include "suricata-common.h"
+#include "util-bench.h"
+#include "util-checksum-simd.h"
+#include "util-debug.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_CHECKSUM_BUF_SIZE     65536
+
+static uint64_t BenchSum16(const uint8_t *buf, uint32_t len)
+{
+    const uint16_t *pkt = (const uint16_t *)buf;
+    uint32_t csum = 0;
+    while (len > 1) {
+        csum += *pkt++;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *(const uint8_t *)pkt;
+        csum += pad;
+    }
+    return csum;
+}
+
+static void BenchRun(const char *name, ChecksumSumFunc f, const uint8_t *buf,
+        uint32_t len, uint32_t iters)
+{
+    volatile uint64_t sink = 0;
+    const uint64_t start = BenchNow();
+    for (uint32_t i = 0; i < iters; i++) {
+        sink += f(buf, len);
+    }
+    const uint64_t ns = BenchNow() - start;
+    printf("  %-8s %8.2f ns/call %8.2f GB/s (%04x)\n", name,
+            (double)ns / iters, ns ? (double)len * iters / ns : 0,
+            ChecksumFold64(sink));
+}
+
+/**
+ * \brief checksum benchmark, --bench=checksum
+ */
+int BenchModeChecksum(const BenchConfig *cfg)
+{
+    static const uint32_t sizes[] = { 64, 256, 576, 1460, 9000, 65535 };
+    uint8_t *buf = SCMalloc(BENCH_CHECKSUM_BUF_SIZE);
+    if (buf == NULL)
+        return -1;
+    for (int i = 0; i < BENCH_CHECKSUM_BUF_SIZE; i++)
+        buf[i] = (uint8_t)(i * 31 + 7);
+
+    /* resolve the runtime selected implementation before timing */
+    const char *impl = ChecksumSumImplName();
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const uint32_t len = sizes[s];
+        const uint32_t iters = (uint32_t)(2000000000ULL / (len + 64));
+        printf("%u bytes:\n", len);
+        BenchRun("16bit", BenchSum16, buf, len, iters);
+        BenchRun("scalar", ChecksumSumScalar, buf, len, iters);
+        BenchRun(impl, checksum_sum_func, buf, len, iters);
+    }
+
+    SCFree(buf);
+    return 0;
+}
+
+#endif /* UNITTESTS */
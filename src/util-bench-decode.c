@@ -0,0 +1,391 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Decoder benchmark, 'suricata --bench=decode --bench-input=<pcap>'.
+ *
+ * The pcap is loaded into memory and looped through the decoder chain
+ * for its link type, and optionally the flow worker, for a number of
+ * iterations. The time is reported per protocol stack in ns and cpu
+ * ticks per packet, --bench-max-ns applies to the average over all
+ * packets.
+ *
+ * With --bench-batch packets are decoded by batch before the flow worker
+ * runs on them, with their flow hash rows prefetched for the whole batch
+ * like the capture does. Comparing with a batch of 1 on a pcap with many
+ * flows shows what hiding the memory latency of the lookups brings. The
+ * time of a batch is spread evenly over its packets.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "defrag.h"
+#include "flow.h"
+#include "flow-hash.h"
+#include "pkt-var.h"
+#include "stream-tcp.h"
+#include "tm-modules.h"
+#include "tmqh-packetpool.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_MAX_STACKS            64
+#define BENCH_MAX_BATCH             256
+
+typedef struct BenchPacket_ {
+    uint8_t *data;
+    uint32_t len;
+    struct timeval ts;
+    /** index in BenchCtx::stacks, set on the first iteration */
+    int stack;
+} BenchPacket;
+
+typedef struct BenchStack_ {
+    char name[64];
+    uint64_t pkts;
+    uint64_t ticks;
+} BenchStack;
+
+typedef struct BenchCtx_ {
+    int datalink;
+    Decoder decoder;
+
+    BenchPacket *pkts;
+    uint32_t pkts_cnt;
+    uint32_t pkts_size;
+
+    BenchStack stacks[BENCH_MAX_STACKS];
+    int stacks_cnt;
+
+    ThreadVars tv;
+    DecodeThreadVars *dtv;
+    /** flow worker thread data, NULL if only decoding */
+    void *fw;
+    /** packets decoded before running the flow worker on them */
+    uint32_t batch;
+    PacketQueue pq;
+} BenchCtx;
+
+static int BenchAddPacket(void *data, const struct pcap_pkthdr *h,
+        const uint8_t *pkt)
+{
+    BenchCtx *ctx = data;
+
+    if (ctx->pkts_cnt == ctx->pkts_size) {
+        uint32_t size = ctx->pkts_size ? ctx->pkts_size * 2 : 1024;
+        BenchPacket *pkts = SCRealloc(ctx->pkts, size * sizeof(BenchPacket));
+        if (pkts == NULL)
+            return -1;
+        ctx->pkts = pkts;
+        ctx->pkts_size = size;
+    }
+    BenchPacket *bp = &ctx->pkts[ctx->pkts_cnt];
+    bp->data = SCMalloc(h->caplen);
+    if (bp->data == NULL)
+        return -1;
+    memcpy(bp->data, pkt, h->caplen);
+    bp->len = h->caplen;
+    bp->ts = h->ts;
+    bp->stack = -1;
+    ctx->pkts_cnt++;
+    return 0;
+}
+
+static int BenchLoadPcap(BenchCtx *ctx, const char *file)
+{
+    if (BenchPcapRead(file, &ctx->datalink, &ctx->decoder, BenchAddPacket,
+                ctx) < 0)
+        return -1;
+    if (ctx->pkts_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no packets in %s", file);
+        return -1;
+    }
+    return 0;
+}
+
+static const char *BenchLinkName(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            return "eth";
+        case LINKTYPE_LINUX_SLL:
+            return "sll";
+        case LINKTYPE_PPP:
+            return "ppp";
+        case LINKTYPE_NULL:
+            return "null";
+        default:
+            return "raw";
+    }
+}
+
+static const char *BenchProtoName(uint8_t proto)
+{
+    switch (proto) {
+        case IPPROTO_TCP:
+            return "tcp";
+        case IPPROTO_UDP:
+            return "udp";
+        case IPPROTO_ICMP:
+            return "icmp";
+        case IPPROTO_ICMPV6:
+            return "icmp6";
+        case IPPROTO_SCTP:
+            return "sctp";
+        case IPPROTO_GRE:
+            return "gre";
+        default:
+            return "other";
+    }
+}
+
+/** \internal
+ *  \brief find or add the stack of a decoded packet, like "eth/vlan/ipv4/tcp"
+ *  \param tunnels number of tunnel or reassembled packets it produced */
+static int BenchStackIndex(BenchCtx *ctx, const Packet *p, uint32_t tunnels)
+{
+    char name[sizeof(ctx->stacks[0].name)];
+    size_t off = 0;
+
+    off += snprintf(name + off, sizeof(name) - off, "%s", BenchLinkName(ctx->datalink));
+    for (uint8_t i = 0; i < p->vlan_idx && off < sizeof(name); i++)
+        off += snprintf(name + off, sizeof(name) - off, "/vlan");
+    if (off < sizeof(name) && PKT_IS_IPV4(p))
+        off += snprintf(name + off, sizeof(name) - off, "/ipv4");
+    else if (off < sizeof(name) && PKT_IS_IPV6(p))
+        off += snprintf(name + off, sizeof(name) - off, "/ipv6");
+    if (off < sizeof(name) && (p->flags & PKT_IS_FRAGMENT))
+        off += snprintf(name + off, sizeof(name) - off, "/frag");
+    else if (off < sizeof(name) && (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)))
+        off += snprintf(name + off, sizeof(name) - off, "/%s", BenchProtoName(p->proto));
+    if (off < sizeof(name) && (tunnels > 0 || (p->flags & PKT_TUNNEL_IN_PLACE)))
+        off += snprintf(name + off, sizeof(name) - off, "+tunnel");
+    if (off < sizeof(name) && (p->flags & PKT_IS_INVALID))
+        off += snprintf(name + off, sizeof(name) - off, " (invalid)");
+
+    for (int i = 0; i < ctx->stacks_cnt; i++) {
+        if (strcmp(ctx->stacks[i].name, name) == 0)
+            return i;
+    }
+    if (ctx->stacks_cnt == BENCH_MAX_STACKS) {
+        /* the last one collects the rest */
+        strlcpy(ctx->stacks[BENCH_MAX_STACKS - 1].name, "...",
+                sizeof(ctx->stacks[0].name));
+        return BENCH_MAX_STACKS - 1;
+    }
+    strlcpy(ctx->stacks[ctx->stacks_cnt].name, name, sizeof(ctx->stacks[0].name));
+    return ctx->stacks_cnt++;
+}
+
+/** \internal
+ *  \brief run the flow worker on 'p' and release what it queued */
+static void BenchFlowWorker(BenchCtx *ctx, Packet *p)
+{
+    PacketQueue preq;
+    memset(&preq, 0, sizeof(preq));
+
+    tmm_modules[TMM_FLOWWORKER].Func(&ctx->tv, p, ctx->fw, &preq, NULL);
+
+    Packet *x;
+    while ((x = PacketDequeue(&preq)) != NULL)
+        PacketFreeOrRelease(x);
+}
+
+/** \internal
+ *  \brief one pass over all packets, 'p' holds ctx->batch packets */
+static void BenchIteration(BenchCtx *ctx, Packet **p)
+{
+    uint32_t tunnels[BENCH_MAX_BATCH];
+
+    for (uint32_t i = 0; i < ctx->pkts_cnt; i += ctx->batch) {
+        const uint32_t n = MIN(ctx->batch, ctx->pkts_cnt - i);
+
+        const uint64_t start = UtilCpuGetTicks();
+
+        for (uint32_t j = 0; j < n; j++) {
+            BenchPacket *bp = &ctx->pkts[i + j];
+
+            PacketSetData(p[j], bp->data, bp->len);
+            p[j]->datalink = ctx->datalink;
+            p[j]->ts = bp->ts;
+
+            DecodeUpdatePacketCounters(&ctx->tv, ctx->dtv, p[j]);
+            ctx->decoder(&ctx->tv, ctx->dtv, p[j], GET_PKT_DATA(p[j]),
+                    GET_PKT_LEN(p[j]), &ctx->pq);
+            PacketDecodeFinalize(&ctx->tv, ctx->dtv, p[j]);
+
+            tunnels[j] = ctx->pq.len;
+            Packet *x;
+            while ((x = PacketDequeue(&ctx->pq)) != NULL) {
+                if (ctx->fw != NULL)
+                    BenchFlowWorker(ctx, x);
+                PacketFreeOrRelease(x);
+            }
+        }
+        if (ctx->fw != NULL) {
+            if (n > 1)
+                FlowHashPrefetch(ctx->dtv, p, n);
+            for (uint32_t j = 0; j < n; j++)
+                BenchFlowWorker(ctx, p[j]);
+        }
+
+        const uint64_t ticks = (UtilCpuGetTicks() - start) / n;
+
+        for (uint32_t j = 0; j < n; j++) {
+            BenchPacket *bp = &ctx->pkts[i + j];
+            if (unlikely(bp->stack < 0))
+                bp->stack = BenchStackIndex(ctx, p[j], tunnels[j]);
+            ctx->stacks[bp->stack].pkts++;
+            ctx->stacks[bp->stack].ticks += ticks;
+
+            PACKET_RECYCLE(p[j]);
+        }
+    }
+}
+
+static int BenchRun(BenchCtx *ctx, const BenchConfig *cfg)
+{
+    Packet *p[BENCH_MAX_BATCH];
+    for (uint32_t i = 0; i < ctx->batch; i++) {
+        p[i] = PacketGetFromAlloc();
+        if (p[i] == NULL) {
+            while (i-- > 0)
+                PacketFree(p[i]);
+            return -1;
+        }
+    }
+
+    /* warm up the caches, hashes and pools, and set the stacks */
+    BenchIteration(ctx, p);
+    for (int i = 0; i < ctx->stacks_cnt; i++) {
+        ctx->stacks[i].pkts = 0;
+        ctx->stacks[i].ticks = 0;
+    }
+
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < cfg->iterations; i++)
+        BenchIteration(ctx, p);
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+
+    for (uint32_t i = 0; i < ctx->batch; i++)
+        PacketFree(p[i]);
+
+    uint64_t pkts = 0, ticks = 0;
+
+    printf("%-40s %12s %10s %12s\n", "stack", "packets", "ns/pkt", "ticks/pkt");
+    for (int i = 0; i < ctx->stacks_cnt; i++) {
+        const BenchStack *s = &ctx->stacks[i];
+        if (s->pkts == 0)
+            continue;
+        printf("%-40s %12"PRIu64" %10.1f %12.1f\n", s->name, s->pkts,
+                (double)s->ticks * ns_per_tick / s->pkts,
+                (double)s->ticks / s->pkts);
+        pkts += s->pkts;
+        ticks += s->ticks;
+    }
+    if (pkts == 0)
+        return -1;
+
+    const double avg_ns = (double)ticks * ns_per_tick / pkts;
+    printf("%-40s %12"PRIu64" %10.1f %12.1f\n", "total", pkts, avg_ns,
+            (double)ticks / pkts);
+    printf("%u iterations in %.3f s, %.0f packets/s\n", cfg->iterations,
+            total_ns / 1e9, total_ns ? pkts * 1e9 / total_ns : 0);
+
+    return BenchCheckMaxNs(cfg, avg_ns, "pkt");
+}
+
+/**
+ * \brief decoder benchmark, --bench=decode
+ */
+int BenchModeDecode(const BenchConfig *cfg)
+{
+    uint64_t batch = 1;
+    int flow = 0;
+
+    if (BenchGetUint("bench.batch", &batch) < 0)
+        return -1;
+    if (batch == 0 || batch > BENCH_MAX_BATCH) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "bench batch must be between 1 "
+                "and %u", BENCH_MAX_BATCH);
+        return -1;
+    }
+    (void)ConfGetBool("bench.flow", &flow);
+
+    extern intmax_t max_pending_packets;
+    max_pending_packets = 128;
+    PacketPoolInit();
+    DefragInit();
+    if (flow) {
+        FlowInitConfig(FLOW_QUIET);
+        StreamTcpInitConfig(TRUE);
+    }
+
+    int r = -1;
+    BenchCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        goto end;
+    ctx->batch = (uint32_t)batch;
+    strlcpy(ctx->tv.name, "BenchDecode", sizeof(ctx->tv.name));
+    if (BenchLoadPcap(ctx, cfg->input) < 0)
+        goto end;
+
+    ctx->dtv = DecodeThreadVarsAlloc(&ctx->tv);
+    if (ctx->dtv == NULL)
+        goto end;
+    DecodeRegisterPerfCounters(ctx->dtv, &ctx->tv);
+    if (flow && tmm_modules[TMM_FLOWWORKER].ThreadInit(&ctx->tv, NULL,
+                &ctx->fw) != TM_ECODE_OK) {
+        goto end;
+    }
+
+    printf("%s: %u packets, link type %d, %u iterations, batch %u%s\n",
+            cfg->input, ctx->pkts_cnt, ctx->datalink, cfg->iterations,
+            ctx->batch, flow ? ", with flow worker" : "");
+    r = BenchRun(ctx, cfg);
+
+end:
+    if (ctx != NULL) {
+        if (ctx->fw != NULL)
+            tmm_modules[TMM_FLOWWORKER].ThreadDeinit(&ctx->tv, ctx->fw);
+        if (ctx->dtv != NULL)
+            DecodeThreadVarsFree(&ctx->tv, ctx->dtv);
+        for (uint32_t i = 0; i < ctx->pkts_cnt; i++)
+            SCFree(ctx->pkts[i].data);
+        SCFree(ctx->pkts);
+        SCFree(ctx);
+    }
+    if (flow) {
+        FlowShutdown();
+        StreamTcpFreeConfig(TRUE);
+    }
+    DefragDestroy();
+    PacketPoolDestroy();
+    return r;
+}
+
+#endif /* UNITTESTS */
@@ -0,0 +1,380 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Detection only benchmark, 'suricata --bench=detect
+ * --bench-input=<recording> --bench-rules=<rules>'.
+ *
+ * The recording is made by a normal run with 'detect.record-buffers'
+ * set, see detect-engine-record.c. It holds the app-layer inspection
+ * buffers of each tx, so only the buffers used by the ruleset of that
+ * run are in it.
+ *
+ * Each iteration replays the txs through the app-layer inspection engines
+ * of the rules: for every rule of the tx's protocol and direction, each
+ * of its engines in that direction gets the recorded buffers of its list,
+ * applies its transforms and runs the content inspection on them. A rule
+ * matches a tx if all those engines match. There is no prefilter, no tx
+ * progress and no stored state, and packet or flow keywords of the rules
+ * are not evaluated. Rules with an engine on a buffer that is not in the
+ * recording at all, like file or stream inspection, are skipped.
+ *
+ * Reported are the ns and cpu ticks per tx, the inspections and matches
+ * per iteration and the rules that took most of the time. --bench-max-ns
+ * applies to the average per tx.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-build.h"
+#include "detect-engine-content-inspection.h"
+#include "detect-engine-record.h"
+#include "flow.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_TOP_RULES             10
+#define BENCH_RULE_MAX_LEN          65536
+
+typedef struct BenchDetectEngine_ {
+    uint16_t name_id;
+    uint8_t dir;            /**< 0 toserver, 1 toclient */
+    AppProto alproto;
+    const DetectEngineTransforms *transforms;
+    const SigMatchData *smd;
+} BenchDetectEngine;
+
+typedef struct BenchDetectRule_ {
+    const Signature *s;
+    BenchDetectEngine *engines;
+    uint32_t engines_cnt;
+
+    uint64_t ticks;
+    uint64_t matches;
+} BenchDetectRule;
+
+typedef struct BenchDetectCtx_ {
+    DetectBufferRecording rec;
+    DetectEngineCtx *de_ctx;
+    DetectEngineThreadCtx *det_ctx;
+    ThreadVars tv;
+    InspectionBuffer buffer;
+
+    BenchDetectRule *rules;
+    uint32_t rules_cnt;
+    uint32_t rules_skipped;
+
+    /* per iteration results, to check that the work was done */
+    uint64_t inspections;
+    uint64_t matches;
+} BenchDetectCtx;
+
+static int BenchLoadRules(BenchDetectCtx *ctx, const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+    char *line = SCMalloc(BENCH_RULE_MAX_LEN);
+    if (line == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    uint32_t good = 0, bad = 0;
+    while (fgets(line, BENCH_RULE_MAX_LEN, fp) != NULL) {
+        char *rule = line;
+        while (isspace((unsigned char)*rule))
+            rule++;
+        if (*rule == '\0' || *rule == '#')
+            continue;
+        if (DetectEngineAppendSig(ctx->de_ctx, rule) != NULL) {
+            good++;
+        } else {
+            bad++;
+        }
+    }
+    SCFree(line);
+    fclose(fp);
+
+    SCLogInfo("%s: %u rules loaded, %u failed", file, good, bad);
+    if (good == 0)
+        return -1;
+    return SigGroupBuild(ctx->de_ctx);
+}
+
+/** \internal
+ *  \brief get the recording's name id for a list
+ *  \retval id or -1 if the list has no buffers in the recording */
+static int BenchGetNameId(BenchDetectCtx *ctx, const int list_id)
+{
+    if (list_id < DETECT_SM_LIST_DYNAMIC_START ||
+            (uint32_t)list_id >= ctx->de_ctx->buffer_type_map_elements)
+        return -1;
+    const char *name = DetectBufferTypeGetNameById(ctx->de_ctx, list_id);
+    if (name == NULL)
+        return -1;
+    for (uint16_t i = 0; i < ctx->rec.names_cnt; i++) {
+        if (strcmp(ctx->rec.names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int BenchSetupRules(BenchDetectCtx *ctx)
+{
+    ctx->rules = SCCalloc(ctx->de_ctx->sig_array_len, sizeof(BenchDetectRule));
+    if (ctx->rules == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < ctx->de_ctx->sig_array_len; i++) {
+        const Signature *s = ctx->de_ctx->sig_array[i];
+        if (s == NULL || s->app_inspect == NULL)
+            continue;
+
+        uint32_t cnt = 0;
+        for (const DetectEngineAppInspectionEngine *e = s->app_inspect; e != NULL; e = e->next)
+            cnt++;
+        BenchDetectRule *r = &ctx->rules[ctx->rules_cnt];
+        r->s = s;
+        r->engines = SCCalloc(cnt, sizeof(BenchDetectEngine));
+        if (r->engines == NULL)
+            return -1;
+
+        for (const DetectEngineAppInspectionEngine *e = s->app_inspect; e != NULL; e = e->next) {
+            const int name_id = BenchGetNameId(ctx, e->sm_list);
+            if (name_id < 0 || e->smd == NULL)
+                break;
+            BenchDetectEngine *be = &r->engines[r->engines_cnt++];
+            be->name_id = (uint16_t)name_id;
+            be->dir = e->dir;
+            be->alproto = e->alproto;
+            be->transforms = e->v2.transforms;
+            be->smd = e->smd;
+        }
+        if (r->engines_cnt != cnt) {
+            SCLogDebug("sid %u: skipped, not all its buffers are recorded", s->id);
+            SCFree(r->engines);
+            memset(r, 0, sizeof(*r));
+            ctx->rules_skipped++;
+            continue;
+        }
+        ctx->rules_cnt++;
+    }
+    if (ctx->rules_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "none of the rules inspect "
+                "buffers that are in the recording");
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief inspect the recorded buffers of an engine
+ *  \retval true if one of them matched */
+static bool BenchInspectEngine(BenchDetectCtx *ctx, const BenchDetectEngine *be,
+        const Signature *s, const DetectRecordedTx *tx, Flow *f)
+{
+    DetectEngineThreadCtx *det_ctx = ctx->det_ctx;
+    InspectionBuffer *buffer = &ctx->buffer;
+
+    for (uint32_t i = 0; i < tx->buffers_cnt; i++) {
+        const DetectRecordedBuffer *rb = &ctx->rec.buffers[tx->buffers_idx + i];
+        if (rb->name_id != be->name_id)
+            continue;
+
+        InspectionBufferSetup(buffer, rb->data, rb->len);
+        buffer->flags = 0;
+        buffer->inspect_offset = 0;
+        InspectionBufferApplyTransforms(buffer, be->transforms);
+
+        det_ctx->discontinue_matching = 0;
+        det_ctx->buffer_offset = 0;
+        det_ctx->inspection_recursion_counter = 0;
+        ctx->inspections++;
+
+        const uint8_t ci_flags = DETECT_CI_FLAGS_SINGLE|buffer->flags;
+        if (DetectEngineContentInspection(ctx->de_ctx, det_ctx, s, be->smd,
+                    NULL, f, (uint8_t *)buffer->inspect, buffer->inspect_len, 0,
+                    ci_flags, DETECT_ENGINE_CONTENT_INSPECTION_MODE_STATE) == 1)
+            return true;
+    }
+    return false;
+}
+
+static uint64_t BenchIteration(BenchDetectCtx *ctx)
+{
+    uint64_t ticks = 0;
+
+    ctx->inspections = 0;
+    ctx->matches = 0;
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+
+    for (uint32_t t = 0; t < ctx->rec.txs_cnt; t++) {
+        const DetectRecordedTx *tx = &ctx->rec.txs[t];
+        const uint8_t dir = (tx->flow_flags & STREAM_TOSERVER) ? 0 : 1;
+        f.proto = tx->ipproto;
+        f.alproto = tx->alproto;
+
+        const uint64_t tx_start = UtilCpuGetTicks();
+        for (uint32_t i = 0; i < ctx->rules_cnt; i++) {
+            BenchDetectRule *r = &ctx->rules[i];
+            if (!(r->s->alproto == tx->alproto || r->s->alproto == ALPROTO_UNKNOWN))
+                continue;
+
+            const uint64_t start = UtilCpuGetTicks();
+            bool inspected = false;
+            bool match = true;
+            for (uint32_t e = 0; e < r->engines_cnt && match; e++) {
+                const BenchDetectEngine *be = &r->engines[e];
+                if (be->dir != dir || (be->alproto != 0 && be->alproto != tx->alproto))
+                    continue;
+                inspected = true;
+                match = BenchInspectEngine(ctx, be, r->s, tx, &f);
+            }
+            if (inspected && match) {
+                r->matches++;
+                ctx->matches++;
+            }
+            r->ticks += UtilCpuGetTicks() - start;
+        }
+        ticks += UtilCpuGetTicks() - tx_start;
+    }
+    return ticks;
+}
+
+static int BenchRuleCompare(const void *a, const void *b)
+{
+    const BenchDetectRule *ra = a;
+    const BenchDetectRule *rb = b;
+    if (ra->ticks == rb->ticks)
+        return 0;
+    return ra->ticks < rb->ticks ? 1 : -1;
+}
+
+/** \retval avg_ns average ns per tx */
+static double BenchRun(BenchDetectCtx *ctx, uint32_t iterations)
+{
+    /* warm up the caches */
+    (void)BenchIteration(ctx);
+    for (uint32_t i = 0; i < ctx->rules_cnt; i++) {
+        ctx->rules[i].ticks = 0;
+        ctx->rules[i].matches = 0;
+    }
+
+    uint64_t ticks = 0;
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < iterations; i++)
+        ticks += BenchIteration(ctx);
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+    const uint64_t txs = (uint64_t)ctx->rec.txs_cnt * iterations;
+    const double avg_ns = (double)ticks * ns_per_tick / txs;
+
+    printf("%10"PRIu64" %12.1f %12.1f %12"PRIu64" %10"PRIu64"\n",
+            txs, avg_ns, (double)ticks / txs, ctx->inspections, ctx->matches);
+
+    qsort(ctx->rules, ctx->rules_cnt, sizeof(BenchDetectRule), BenchRuleCompare);
+    printf("\n%10s %8s %12s %10s\n", "sid", "time %", "ns/tx", "matches");
+    for (uint32_t i = 0; i < ctx->rules_cnt && i < BENCH_TOP_RULES; i++) {
+        const BenchDetectRule *r = &ctx->rules[i];
+        printf("%10u %8.2f %12.1f %10"PRIu64"\n", r->s->id,
+                ticks ? (double)r->ticks * 100 / ticks : 0,
+                (double)r->ticks * ns_per_tick / txs, r->matches / iterations);
+    }
+    return avg_ns;
+}
+
+static void BenchFree(BenchDetectCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->rules_cnt; i++)
+        SCFree(ctx->rules[i].engines);
+    SCFree(ctx->rules);
+    InspectionBufferFree(&ctx->buffer);
+    if (ctx->det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&ctx->tv, (void *)ctx->det_ctx);
+    if (ctx->de_ctx != NULL)
+        DetectEngineCtxFree(ctx->de_ctx);
+    DetectBufferRecordingFree(&ctx->rec);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static int BenchSetup(BenchDetectCtx *ctx, const char *input, const char *rules)
+{
+    if (DetectBufferRecordingLoad(input, &ctx->rec) < 0)
+        return -1;
+    if (ctx->rec.txs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no transactions in %s", input);
+        return -1;
+    }
+
+    ctx->de_ctx = DetectEngineCtxInit();
+    if (ctx->de_ctx == NULL || BenchLoadRules(ctx, rules) < 0 ||
+            BenchSetupRules(ctx) < 0)
+        return -1;
+
+    DetectEngineThreadCtxInit(&ctx->tv, (void *)ctx->de_ctx, (void *)&ctx->det_ctx);
+    if (ctx->det_ctx == NULL)
+        return -1;
+    InspectionBufferInit(&ctx->buffer, 4096);
+    return 0;
+}
+
+/**
+ * \brief detection benchmark, --bench=detect
+ */
+int BenchModeDetect(const BenchConfig *cfg)
+{
+    const char *rules = NULL;
+    if (ConfGet("bench.rules", &rules) != 1 || rules == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "--bench=detect needs "
+                "--bench-rules=<file>");
+        return -1;
+    }
+
+    BenchDetectCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int r = BenchSetup(&ctx, cfg->input, rules);
+    if (r == 0) {
+        printf("%s: %u txs, %u buffers, %u rules (%u skipped), %u "
+                "iterations\n", cfg->input, ctx.rec.txs_cnt,
+                ctx.rec.buffers_cnt, ctx.rules_cnt, ctx.rules_skipped,
+                cfg->iterations);
+        printf("%10s %12s %12s %12s %10s\n", "txs", "ns/tx", "ticks/tx",
+                "inspections", "matches");
+
+        double avg_ns = BenchRun(&ctx, cfg->iterations);
+        r = BenchCheckMaxNs(cfg, avg_ns, "tx");
+    }
+    BenchFree(&ctx);
+    return r;
+}
+
+#endif /* UNITTESTS */
@@ -0,0 +1,202 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DNS parser benchmark, 'suricata --bench=dns --bench-input=<pcap>'.
+ *
+ * The UDP payloads to or from port 53 are loaded from the pcap once, then
+ * each iteration passes them through the rust DNS parser in pcap order,
+ * in a single parser state, without capture, decoding, flow handling or
+ * the app-layer around it. Messages to port 53 are parsed as requests,
+ * the others as responses. After each message its transaction is freed,
+ * as the app-layer does once it has been inspected and logged.
+ *
+ * Reported are the ns and cpu ticks per message, the throughput and the
+ * number of transactions and parse errors per iteration. --bench-max-ns
+ * applies to the average per message. Needs rust.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+
+#if defined(UNITTESTS) && defined(HAVE_RUST)
+
+#include "rust-dns-dns-gen.h"
+
+#define BENCH_DNS_PORT              53
+
+typedef struct BenchDnsMsg_ {
+    uint8_t *buf;
+    uint32_t len;
+    bool request;
+} BenchDnsMsg;
+
+typedef struct BenchDnsCtx_ {
+    BenchDnsMsg *msgs;
+    uint32_t msgs_cnt;
+    uint32_t msgs_size;
+    uint64_t bytes;
+
+    /* per iteration results, to check that the work was done */
+    uint64_t txs;
+    uint64_t errors;
+} BenchDnsCtx;
+
+static int BenchAddMsg(BenchDnsCtx *ctx, const uint8_t *data, uint16_t len,
+        bool request)
+{
+    if (ctx->msgs_cnt == ctx->msgs_size) {
+        uint32_t size = ctx->msgs_size ? ctx->msgs_size * 2 : 1024;
+        BenchDnsMsg *msgs = SCRealloc(ctx->msgs, size * sizeof(*msgs));
+        if (msgs == NULL)
+            return -1;
+        ctx->msgs = msgs;
+        ctx->msgs_size = size;
+    }
+
+    uint8_t *buf = SCMalloc(len);
+    if (buf == NULL)
+        return -1;
+    memcpy(buf, data, len);
+
+    BenchDnsMsg *m = &ctx->msgs[ctx->msgs_cnt++];
+    m->buf = buf;
+    m->len = len;
+    m->request = request;
+    ctx->bytes += len;
+    return 0;
+}
+
+static int BenchAddPacket(void *data, Packet *p)
+{
+    BenchDnsCtx *ctx = data;
+
+    if (!PKT_IS_UDP(p) || p->payload_len == 0 ||
+            (p->dp != BENCH_DNS_PORT && p->sp != BENCH_DNS_PORT))
+        return 0;
+    return BenchAddMsg(ctx, p->payload, p->payload_len,
+            p->dp == BENCH_DNS_PORT);
+}
+
+static int BenchLoadPcap(BenchDnsCtx *ctx, const char *file)
+{
+    if (BenchPcapDecode(file, BenchAddPacket, ctx) < 0)
+        return -1;
+    if (ctx->msgs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no DNS messages in %s", file);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t BenchIteration(BenchDnsCtx *ctx)
+{
+    uint64_t ticks = 0;
+
+    ctx->txs = 0;
+    ctx->errors = 0;
+
+    void *state = rs_dns_state_new();
+    if (state == NULL)
+        return 0;
+
+    uint64_t tx_id = 0;
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++) {
+        const BenchDnsMsg *m = &ctx->msgs[i];
+        const uint64_t start = UtilCpuGetTicks();
+        int r;
+        if (m->request) {
+            r = rs_dns_parse_request(NULL, state, NULL, m->buf, m->len, NULL);
+        } else {
+            r = rs_dns_parse_response(NULL, state, NULL, m->buf, m->len, NULL);
+        }
+        const uint64_t cnt = rs_dns_state_get_tx_count(state);
+        for ( ; tx_id < cnt; tx_id++)
+            rs_dns_state_tx_free(state, tx_id);
+        ticks += UtilCpuGetTicks() - start;
+
+        if (r < 0)
+            ctx->errors++;
+    }
+    ctx->txs = tx_id;
+
+    rs_dns_state_free(state);
+    return ticks;
+}
+
+/** \retval avg_ns average ns per message */
+static double BenchRun(BenchDnsCtx *ctx, uint32_t iterations)
+{
+    /* warm up the caches */
+    (void)BenchIteration(ctx);
+
+    uint64_t ticks = 0;
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < iterations; i++)
+        ticks += BenchIteration(ctx);
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+    const uint64_t msgs = (uint64_t)ctx->msgs_cnt * iterations;
+    const uint64_t bytes = ctx->bytes * iterations;
+    const double avg_ns = (double)ticks * ns_per_tick / msgs;
+    const double secs = (double)ticks * ns_per_tick / 1e9;
+
+    printf("%10"PRIu64" %12"PRIu64" %12.1f %12.1f %10.1f %10"PRIu64" %10"PRIu64"\n",
+            msgs, bytes, avg_ns, (double)ticks / msgs,
+            secs > 0 ? bytes / secs / (1024 * 1024) : 0,
+            ctx->txs, ctx->errors);
+    return avg_ns;
+}
+
+static void BenchFree(BenchDnsCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++)
+        SCFree(ctx->msgs[i].buf);
+    SCFree(ctx->msgs);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/**
+ * \brief DNS parser benchmark, --bench=dns
+ */
+int BenchModeDns(const BenchConfig *cfg)
+{
+    BenchDnsCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int r = BenchLoadPcap(&ctx, cfg->input);
+    if (r == 0) {
+        printf("%s: %u messages, %u iterations\n", cfg->input, ctx.msgs_cnt,
+                cfg->iterations);
+        printf("%10s %12s %12s %12s %10s %10s %10s\n", "messages", "bytes",
+                "ns/msg", "ticks/msg", "MiB/s", "txs", "errors");
+
+        double avg_ns = BenchRun(&ctx, cfg->iterations);
+        r = BenchCheckMaxNs(cfg, avg_ns, "message");
+    }
+    BenchFree(&ctx);
+    return r;
+}
+
+#endif /* UNITTESTS && HAVE_RUST */
@@ -0,0 +1,184 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Flow hash function benchmark, 'suricata --bench=flow-hash', for
+ * flow.hash-function.
+ *
+ * Hashes a synthetic flow mix laid out like FlowHashKey4/FlowHashKey6 in
+ * flow-hash.c: clients in a /16 and a /48, a few hundred servers, mostly
+ * web and DNS ports, 20% IPv6. Prints the cost per hash and how evenly
+ * the flows spread over the buckets of a 64k and a 1M flow table, and
+ * over the 16 bit tags of flow.bucket-tags (the top of the hash). The
+ * work is fixed, --bench-iterations and --bench-max-ns don't apply.
+ */
+
+#include "suricata-common.h"
+#include "util-bench.h"
+#include "util-debug.h"
+#include "util-hash-lookup3.h"
+#include "util-hash-crc32c.h"
+#include "util-hash-siphash.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_FLOWS     (1 << 20)
+
+typedef struct BenchFlowKey_ {
+    uint32_t w[13];
+    uint32_t n;
+} BenchFlowKey;
+
+static const uint64_t bench_sip_key[2] = {
+    0x0123456789abcdefULL, 0xfedcba9876543210ULL };
+static const uint32_t bench_seed = 0x5eed;
+
+static uint32_t BenchHashLookup3(const uint32_t *k, size_t n)
+{
+    return hashword(k, n, bench_seed);
+}
+
+static uint32_t BenchHashCrc32c(const uint32_t *k, size_t n)
+{
+    return HashCrc32cWords(k, n, bench_seed);
+}
+
+static uint32_t BenchHashSip(const uint32_t *k, size_t n)
+{
+    return HashSipWords(k, n, bench_sip_key);
+}
+
+static uint32_t BenchRand(void)
+{
+    static uint64_t s = 88172645463325252ULL;
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return (uint32_t)s;
+}
+
+static void BenchMakeFlows(BenchFlowKey *keys)
+{
+    static const uint16_t sports[] = { 80, 443, 443, 443, 53, 53, 25, 8080 };
+    for (uint32_t i = 0; i < BENCH_FLOWS; i++) {
+        BenchFlowKey *k = &keys[i];
+        memset(k, 0, sizeof(*k));
+        uint32_t r = BenchRand();
+        uint16_t sp = (uint16_t)(32768 + BenchRand() % 28232);
+        uint16_t dp = sports[r & 7];
+        uint16_t proto = (dp == 53) ? 17 : 6;
+        uint16_t ports[2] = { sp < dp ? sp : dp, sp < dp ? dp : sp };
+
+        if ((r >> 8) % 5 == 0) {
+            /* client 2001:db8:1::/48, server one of 256 */
+            uint32_t cli[4] = { htonl(0x20010db8),
+                htonl(0x00010000 | (BenchRand() & 0xffff)),
+                BenchRand(), BenchRand() };
+            uint32_t srv[4] = { htonl(0x2a001450), htonl(0x40010000), 0,
+                htonl(0x1000 + (BenchRand() & 0xff)) };
+            memcpy(&k->w[0], srv, 16);
+            memcpy(&k->w[4], cli, 16);
+            memcpy(&k->w[8], ports, 4);
+            k->w[9] = proto;
+            k->n = 13;
+        } else {
+            /* client 10.0.0.0/16, server one of 512 in 192.0.2.0/23 */
+            uint32_t cli = htonl(0x0a000000 | (BenchRand() & 0xffff));
+            uint32_t srv = htonl(0xc0000200 | (BenchRand() & 0x1ff));
+            k->w[0] = cli < srv ? cli : srv;
+            k->w[1] = cli < srv ? srv : cli;
+            memcpy(&k->w[2], ports, 4);
+            k->w[3] = proto;
+            k->n = 7;
+        }
+    }
+}
+
+/** \internal
+ *  \brief chi-square of the bucket counts divided by its expected value,
+ *         the number of buckets - 1: close to 1.0 is as good as random
+ *  \retval spread or < 0 on error */
+static double BenchSpread(const uint32_t *hashes, uint32_t size, int shift)
+{
+    uint32_t *cnt = SCCalloc(size, sizeof(uint32_t));
+    if (cnt == NULL)
+        return -1;
+    for (uint32_t i = 0; i < BENCH_FLOWS; i++)
+        cnt[(hashes[i] >> shift) % size]++;
+
+    const double expect = (double)BENCH_FLOWS / size;
+    double chi = 0;
+    for (uint32_t i = 0; i < size; i++)
+        chi += (cnt[i] - expect) * (cnt[i] - expect) / expect;
+    SCFree(cnt);
+    return chi / (size - 1);
+}
+
+static void BenchRun(const char *name, uint32_t (*f)(const uint32_t *, size_t),
+        const BenchFlowKey *keys, uint32_t *hashes)
+{
+    /* time the first 4k keys, so they are in the cache like the key of
+     * the packet being handled would be */
+    const int rounds = 2560;
+    volatile uint32_t sink = 0;
+    const uint64_t start = BenchNow();
+    for (int r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < 4096; i++)
+            sink += f(keys[i].w, keys[i].n);
+    }
+    const uint64_t ns = BenchNow() - start;
+
+    for (uint32_t i = 0; i < BENCH_FLOWS; i++)
+        hashes[i] = f(keys[i].w, keys[i].n);
+
+    printf("  %-8s %6.2f ns/hash  spread 64k %5.3f  1M %5.3f  tags %5.3f\n",
+            name, (double)ns / ((double)rounds * 4096),
+            BenchSpread(hashes, 65536, 0), BenchSpread(hashes, 1 << 20, 0),
+            BenchSpread(hashes, 65536, 16));
+    (void)sink;
+}
+
+/**
+ * \brief flow hash benchmark, --bench=flow-hash
+ */
+int BenchModeFlowHash(const BenchConfig *cfg)
+{
+    BenchFlowKey *keys = SCMalloc(BENCH_FLOWS * sizeof(BenchFlowKey));
+    uint32_t *hashes = SCMalloc(BENCH_FLOWS * sizeof(uint32_t));
+    if (keys == NULL || hashes == NULL) {
+        SCFree(keys);
+        SCFree(hashes);
+        return -1;
+    }
+    BenchMakeFlows(keys);
+
+    printf("%u flows:\n", BENCH_FLOWS);
+    BenchRun("lookup3", BenchHashLookup3, keys, hashes);
+    if (HashCrc32cAvailable())
+        BenchRun("crc32c", BenchHashCrc32c, keys, hashes);
+    else
+        printf("  crc32c   not supported by this cpu\n");
+    BenchRun("siphash", BenchHashSip, keys, hashes);
+
+    SCFree(keys);
+    SCFree(hashes);
+    return 0;
+}
+
+#endif /* UNITTESTS */
@@ -0,0 +1,224 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * MIME decoder benchmark, 'suricata --bench=mime --bench-input=<eml|dir>'.
+ *
+ * Each message is a file in RFC 5322 format, such as a .eml export of a
+ * mail client or a message saved by the SMTP file store. A directory is
+ * read as a corpus of messages, one per regular file. The messages are
+ * loaded once, then each iteration passes every message through
+ * MimeDecParseFullMsg() with the global MIME config, so header parsing,
+ * boundary handling, base64 / quoted-printable decoding and URL
+ * extraction are measured, without the SMTP state machine around it.
+ *
+ * Reported are the ns and cpu ticks per message, the throughput and the
+ * number of decoded bytes and urls per iteration. --bench-max-ns applies
+ * to the average per message.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-decode-mime.h"
+
+#ifdef UNITTESTS
+
+/** messages above this size are skipped */
+#define BENCH_MAX_MSG_SIZE          (64 * 1024 * 1024)
+
+typedef struct BenchMimeMsg_ {
+    uint8_t *buf;
+    uint32_t len;
+} BenchMimeMsg;
+
+typedef struct BenchMimeCtx_ {
+    BenchMimeMsg *msgs;
+    uint32_t msgs_cnt;
+    uint32_t msgs_size;
+    uint64_t bytes;
+
+    /* per iteration results, to check that the work was done */
+    uint64_t decoded;
+    uint64_t urls;
+} BenchMimeCtx;
+
+static int BenchDataChunk(const uint8_t *chunk, uint32_t len,
+        MimeDecParseState *state)
+{
+    BenchMimeCtx *ctx = state->data;
+    ctx->decoded += len;
+    return MIME_DEC_OK;
+}
+
+static int BenchLoadFile(BenchMimeCtx *ctx, const char *file)
+{
+    uint8_t *buf = NULL;
+    uint32_t len = 0;
+    int r = BenchReadFile(file, BENCH_MAX_MSG_SIZE, &buf, &len);
+    if (r < 0)
+        return -1;
+    if (r > 0) {
+        SCLogWarning(SC_WARN_UNCOMMON, "skipping %s: empty or too large", file);
+        return 0;
+    }
+
+    if (ctx->msgs_cnt == ctx->msgs_size) {
+        uint32_t new_size = ctx->msgs_size ? ctx->msgs_size * 2 : 64;
+        BenchMimeMsg *msgs = SCRealloc(ctx->msgs, new_size * sizeof(*msgs));
+        if (msgs == NULL) {
+            SCFree(buf);
+            return -1;
+        }
+        ctx->msgs = msgs;
+        ctx->msgs_size = new_size;
+    }
+    ctx->msgs[ctx->msgs_cnt].buf = buf;
+    ctx->msgs[ctx->msgs_cnt].len = len;
+    ctx->msgs_cnt++;
+    ctx->bytes += len;
+    return 0;
+}
+
+static int BenchLoad(BenchMimeCtx *ctx, const char *input)
+{
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: %s", input, strerror(errno));
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return BenchLoadFile(ctx, input);
+
+    DIR *dir = opendir(input);
+    if (dir == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: %s", input, strerror(errno));
+        return -1;
+    }
+    int r = 0;
+    struct dirent *de;
+    while (r == 0 && (de = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", input, de->d_name) >=
+                (int)sizeof(path))
+            continue;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        r = BenchLoadFile(ctx, path);
+    }
+    closedir(dir);
+    return r;
+}
+
+/** urls are kept on the entity they were found in */
+static uint64_t BenchCountUrls(const MimeDecEntity *e)
+{
+    uint64_t cnt = 0;
+    for ( ; e != NULL; e = e->next) {
+        for (const MimeDecUrl *url = e->url_list; url != NULL; url = url->next)
+            cnt++;
+        cnt += BenchCountUrls(e->child);
+    }
+    return cnt;
+}
+
+static uint64_t BenchIteration(BenchMimeCtx *ctx)
+{
+    uint64_t ticks = 0;
+
+    ctx->decoded = 0;
+    ctx->urls = 0;
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++) {
+        const uint64_t start = UtilCpuGetTicks();
+        MimeDecEntity *msg = MimeDecParseFullMsg(ctx->msgs[i].buf,
+                ctx->msgs[i].len, ctx, BenchDataChunk);
+        ticks += UtilCpuGetTicks() - start;
+        if (msg == NULL)
+            continue;
+
+        ctx->urls += BenchCountUrls(msg);
+        MimeDecFreeEntity(msg);
+    }
+    return ticks;
+}
+
+/** \retval avg_ns average ns per message */
+static double BenchRun(BenchMimeCtx *ctx, uint32_t iterations)
+{
+    /* warm up the caches */
+    (void)BenchIteration(ctx);
+
+    uint64_t ticks = 0;
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < iterations; i++)
+        ticks += BenchIteration(ctx);
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+    const uint64_t msgs = (uint64_t)ctx->msgs_cnt * iterations;
+    const uint64_t bytes = ctx->bytes * iterations;
+    const double avg_ns = (double)ticks * ns_per_tick / msgs;
+    const double secs = (double)ticks * ns_per_tick / 1e9;
+
+    printf("%10"PRIu64" %12"PRIu64" %12.1f %12.1f %10.1f %12"PRIu64" %10"PRIu64"\n",
+            msgs, bytes, avg_ns, (double)ticks / msgs,
+            secs > 0 ? bytes / secs / (1024 * 1024) : 0,
+            ctx->decoded, ctx->urls);
+    return avg_ns;
+}
+
+static void BenchFree(BenchMimeCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->msgs_cnt; i++)
+        SCFree(ctx->msgs[i].buf);
+    SCFree(ctx->msgs);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/**
+ * \brief MIME decoder benchmark, --bench=mime
+ */
+int BenchModeMime(const BenchConfig *cfg)
+{
+    BenchMimeCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int r = BenchLoad(&ctx, cfg->input);
+    if (r == 0 && ctx.msgs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no messages found in %s",
+                cfg->input);
+        r = -1;
+    }
+
+    if (r == 0) {
+        printf("%s: %u messages, %u iterations\n", cfg->input, ctx.msgs_cnt,
+                cfg->iterations);
+        printf("%10s %12s %12s %12s %10s %12s %10s\n", "messages", "bytes",
+                "ns/msg", "ticks/msg", "MiB/s", "decoded", "urls");
+
+        double avg_ns = BenchRun(&ctx, cfg->iterations);
+        r = BenchCheckMaxNs(cfg, avg_ns, "message");
+    }
+    BenchFree(&ctx);
+    return r;
+}
+
+#endif /* UNITTESTS */
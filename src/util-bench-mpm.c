@@ -0,0 +1,286 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Multi pattern matcher benchmark, 'suricata --bench=mpm
+ * --bench-input=<patterns>'.
+ *
+ * The patterns file has one pattern per line, in the syntax of the
+ * content keyword without the quotes, e.g. 'GET /|20|'. A line starting
+ * with 'nocase ' adds the rest of it as a case insensitive pattern. Empty
+ * lines and lines starting with '#' are skipped.
+ *
+ * The data is read from --bench-mpm-data, or else generated: text and
+ * random bytes with one of the patterns every 4k. It is searched in
+ * chunks of BENCH_MPM_CHUNK bytes, about the payload of a packet.
+ *
+ * Every registered matcher is built with all the patterns and reports
+ * its memory use, build time, ns per byte and throughput, and the number
+ * of matches and matched sids per iteration. These should be the same
+ * for all matchers.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect-content.h"
+#include "util-bench.h"
+#include "util-debug.h"
+#include "util-mpm.h"
+#include "util-prefilter.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_MPM_CHUNK             1460
+/** size of the generated data */
+#define BENCH_MPM_DATA_SIZE         (4 * 1024 * 1024)
+/** data files above this size are refused */
+#define BENCH_MAX_DATA_SIZE         (1024 * 1024 * 1024)
+
+typedef struct BenchMpmPattern_ {
+    uint8_t *pat;
+    uint16_t len;
+    bool nocase;
+} BenchMpmPattern;
+
+typedef struct BenchMpmCtx_ {
+    BenchMpmPattern *pats;
+    uint32_t pats_cnt;
+    uint32_t pats_size;
+
+    uint8_t *data;
+    uint32_t data_len;
+} BenchMpmCtx;
+
+static int BenchLoadPatterns(BenchMpmCtx *ctx, const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+
+    int r = 0;
+    char line[8192];
+    uint32_t line_no = 0;
+    while (r == 0 && fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        BenchMpmPattern p = { NULL, 0, false };
+        const char *content = line;
+        if (strncmp(line, "nocase ", 7) == 0) {
+            p.nocase = true;
+            content += 7;
+        }
+        if (DetectContentDataParse("bench-mpm", content, &p.pat, &p.len) != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "%s:%u: invalid pattern",
+                    file, line_no);
+            r = -1;
+            break;
+        }
+
+        if (ctx->pats_cnt == ctx->pats_size) {
+            uint32_t new_size = ctx->pats_size ? ctx->pats_size * 2 : 256;
+            BenchMpmPattern *pats = SCRealloc(ctx->pats, new_size * sizeof(*pats));
+            if (pats == NULL) {
+                SCFree(p.pat);
+                r = -1;
+                break;
+            }
+            ctx->pats = pats;
+            ctx->pats_size = new_size;
+        }
+        ctx->pats[ctx->pats_cnt++] = p;
+    }
+    fclose(fp);
+    return r;
+}
+
+static int BenchLoadData(BenchMpmCtx *ctx, const char *file)
+{
+    int r = BenchReadFile(file, BENCH_MAX_DATA_SIZE, &ctx->data, &ctx->data_len);
+    if (r > 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is empty or too large", file);
+        return -1;
+    }
+    return r;
+}
+
+static uint32_t BenchRand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/** \internal
+ *  \brief mostly text with some binary, and a pattern every 4k */
+static int BenchGenerateData(BenchMpmCtx *ctx)
+{
+    static const char text[] = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0\r\nAccept: */*\r\nContent-Length: 1234\r\n\r\n"
+        "<html><head><title>example</title></head><body>lorem ipsum dolor "
+        "sit amet, consectetur adipiscing elit</body></html>\r\n";
+    uint32_t seed = 1;
+
+    ctx->data = SCMalloc(BENCH_MPM_DATA_SIZE);
+    if (ctx->data == NULL)
+        return -1;
+    ctx->data_len = BENCH_MPM_DATA_SIZE;
+
+    uint32_t i = 0;
+    while (i < ctx->data_len) {
+        uint32_t len = 64 + BenchRand(&seed) % 512;
+        if (len > ctx->data_len - i)
+            len = ctx->data_len - i;
+        if (BenchRand(&seed) % 4 == 0) {
+            for (uint32_t x = 0; x < len; x++)
+                ctx->data[i + x] = (uint8_t)BenchRand(&seed);
+        } else {
+            const uint32_t start = BenchRand(&seed) % (sizeof(text) - 1);
+            for (uint32_t x = 0; x < len; x++)
+                ctx->data[i + x] = text[(start + x) % (sizeof(text) - 1)];
+        }
+        i += len;
+    }
+
+    for (i = 0; i + 4096 <= ctx->data_len; i += 4096) {
+        const BenchMpmPattern *p = &ctx->pats[BenchRand(&seed) % ctx->pats_cnt];
+        const uint32_t len = MIN(p->len, 4096);
+        const uint32_t at = i + BenchRand(&seed) % (4096 - len + 1);
+        memcpy(ctx->data + at, p->pat, len);
+    }
+    return 0;
+}
+
+static uint64_t BenchIteration(const BenchMpmCtx *ctx, const MpmCtx *mpm_ctx,
+        MpmThreadCtx *mpm_thread_ctx, PrefilterRuleStore *pmq, uint64_t *sids)
+{
+    uint64_t matches = 0;
+    for (uint32_t i = 0; i < ctx->data_len; i += BENCH_MPM_CHUNK) {
+        const uint32_t len = MIN(BENCH_MPM_CHUNK, ctx->data_len - i);
+        matches += mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, mpm_thread_ctx,
+                pmq, ctx->data + i, len);
+        *sids += pmq->rule_id_array_cnt;
+        PmqReset(pmq);
+    }
+    return matches;
+}
+
+static int BenchRun(const BenchMpmCtx *ctx, uint16_t matcher, uint32_t iterations)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(&mpm_thread_ctx, 0, sizeof(mpm_thread_ctx));
+    if (PmqSetup(&pmq) != 0)
+        return -1;
+
+    const uint64_t build_start = BenchNow();
+    MpmInitCtx(&mpm_ctx, matcher);
+    for (uint32_t i = 0; i < ctx->pats_cnt; i++) {
+        const BenchMpmPattern *p = &ctx->pats[i];
+        if (p->nocase)
+            MpmAddPatternCI(&mpm_ctx, p->pat, p->len, 0, 0, i, i, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, p->pat, p->len, 0, 0, i, i, 0);
+    }
+    if (mpm_table[matcher].Prepare(&mpm_ctx) != 0) {
+        printf("%-12s failed to build\n", mpm_table[matcher].name);
+        mpm_table[matcher].DestroyCtx(&mpm_ctx);
+        PmqFree(&pmq);
+        return 0;
+    }
+    const uint64_t build_ns = BenchNow() - build_start;
+    MpmInitThreadCtx(&mpm_thread_ctx, matcher);
+
+    /* warm up the caches */
+    uint64_t sids = 0;
+    (void)BenchIteration(ctx, &mpm_ctx, &mpm_thread_ctx, &pmq, &sids);
+
+    uint64_t matches = 0;
+    sids = 0;
+    const uint64_t start = BenchNow();
+    for (uint32_t i = 0; i < iterations; i++)
+        matches += BenchIteration(ctx, &mpm_ctx, &mpm_thread_ctx, &pmq, &sids);
+    const uint64_t total_ns = BenchNow() - start;
+
+    const uint64_t bytes = (uint64_t)ctx->data_len * iterations;
+    printf("%-12s %12u %10.1f %10.3f %10.1f %12"PRIu64" %12"PRIu64"\n",
+            mpm_table[matcher].name, mpm_ctx.memory_size, build_ns / 1e6,
+            (double)total_ns / bytes,
+            total_ns ? bytes / (total_ns / 1e9) / (1024 * 1024) : 0,
+            matches / iterations, sids / iterations);
+
+    mpm_table[matcher].DestroyCtx(&mpm_ctx);
+    mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return 0;
+}
+
+static void BenchFree(BenchMpmCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->pats_cnt; i++)
+        SCFree(ctx->pats[i].pat);
+    SCFree(ctx->pats);
+    SCFree(ctx->data);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/**
+ * \brief multi pattern matcher benchmark, --bench=mpm
+ */
+int BenchModeMpm(const BenchConfig *cfg)
+{
+    const char *data = NULL;
+    (void)ConfGet("bench.mpm-data", &data);
+
+    BenchMpmCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int r = BenchLoadPatterns(&ctx, cfg->input);
+    if (r == 0 && ctx.pats_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no patterns found in %s",
+                cfg->input);
+        r = -1;
+    }
+    if (r == 0)
+        r = data ? BenchLoadData(&ctx, data) : BenchGenerateData(&ctx);
+
+    if (r == 0) {
+        printf("%s: %u patterns, %u bytes of %s, %u iterations\n",
+                cfg->input, ctx.pats_cnt, ctx.data_len,
+                data ? data : "generated data", cfg->iterations);
+        printf("%-12s %12s %10s %10s %10s %12s %12s\n", "mpm", "memory",
+                "build ms", "ns/byte", "MiB/s", "matches", "sids");
+
+        for (uint16_t u = 0; r == 0 && u < MPM_TABLE_SIZE; u++) {
+            if (mpm_table[u].name == NULL || mpm_table[u].Search == NULL)
+                continue;
+            r = BenchRun(&ctx, u, cfg->iterations);
+        }
+    }
+    BenchFree(&ctx);
+    return r;
+}
+
+#endif /* UNITTESTS */
@@ -0,0 +1,207 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher benchmark, 'suricata --bench=spm', for spm-algo.
+ *
+ * Scans HTTP like buffers of a few sizes for needles of 1 to 32 bytes with
+ * Boyer-Moore, the memmem matcher and libc memmem, case sensitive and
+ * nocase. The needles are mostly not in the buffers, as most content
+ * inspection fails, so the numbers are mostly the cost of a full pass.
+ * Prints ns per scan and the cost of building a context, which is where
+ * the SPM_MEMMEM_AUTO_MAXLEN cut over of spm-algo auto comes from. The
+ * run fails if the matchers don't find the same matches. The work is
+ * fixed, --bench-iterations and --bench-max-ns don't apply.
+ */
+
+#include "suricata-common.h"
+#include "util-bench.h"
+#include "util-debug.h"
+#include "util-spm.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_NBUF       256
+#define BENCH_NNEEDLE    16
+
+static const uint32_t bench_buf_sizes[] = { 64, 300, 1460 };
+static const uint16_t bench_needle_lens[] = { 1, 2, 3, 4, 6, 8, 12, 16, 20, 24, 32 };
+
+static uint32_t BenchRand(void)
+{
+    static uint64_t s = 88172645463325252ULL;
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return (uint32_t)s;
+}
+
+static void BenchMakeBuffer(uint8_t *buf, uint32_t len)
+{
+    static const char *lines[] = {
+        "GET /index.html HTTP/1.1\r\n", "Host: www.example.com\r\n",
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n",
+        "Accept: text/html,application/xhtml+xml\r\n",
+        "Accept-Encoding: gzip, deflate\r\n", "Connection: keep-alive\r\n",
+        "Cookie: session=4f1c2a9b77e0d3\r\n", "Content-Type: text/plain\r\n",
+    };
+    static const char text[] = "abcdefghijklmnopqrstuvwxyz"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ,.;:/-=<>\"";
+    uint32_t i = 0;
+    while (i < len) {
+        if (BenchRand() % 3 == 0) {
+            const char *l = lines[BenchRand() % (sizeof(lines) / sizeof(lines[0]))];
+            for ( ; *l != '\0' && i < len; l++)
+                buf[i++] = (uint8_t)*l;
+        } else {
+            buf[i++] = (uint8_t)text[BenchRand() % (sizeof(text) - 1)];
+        }
+    }
+}
+
+/* ns per scan of the needles over all buffers, sums the match offsets
+ * into *check so the matchers can be compared */
+static double BenchRunSpm(uint16_t matcher, uint8_t **bufs, uint32_t len,
+        uint8_t needles[BENCH_NNEEDLE][32], uint16_t nlen, int nocase, uint64_t *check)
+{
+    SpmGlobalThreadCtx *g = spm_table[matcher].InitGlobalThreadCtx();
+    SpmThreadCtx *t = spm_table[matcher].MakeThreadCtx(g);
+    SpmCtx *ctx[BENCH_NNEEDLE];
+    for (int n = 0; n < BENCH_NNEEDLE; n++)
+        ctx[n] = spm_table[matcher].InitCtx(needles[n], nlen, nocase, g);
+
+    const int rounds = 1 + (int)(20000000 / ((uint64_t)len * BENCH_NBUF * BENCH_NNEEDLE));
+    uint64_t sum = 0;
+    const uint64_t start = BenchNow();
+    for (int r = 0; r < rounds; r++) {
+        for (int n = 0; n < BENCH_NNEEDLE; n++) {
+            for (int b = 0; b < BENCH_NBUF; b++) {
+                const uint8_t *found = spm_table[matcher].Scan(ctx[n], t, bufs[b], len);
+                sum += found ? (uint64_t)(found - bufs[b]) + 1 : 0;
+            }
+        }
+    }
+    const uint64_t ns = BenchNow() - start;
+    *check = sum / rounds;
+
+    for (int n = 0; n < BENCH_NNEEDLE; n++)
+        spm_table[matcher].DestroyCtx(ctx[n]);
+    spm_table[matcher].DestroyThreadCtx(t);
+    spm_table[matcher].DestroyGlobalThreadCtx(g);
+    return (double)ns / ((double)rounds * BENCH_NNEEDLE * BENCH_NBUF);
+}
+
+static double BenchRunLibc(uint8_t **bufs, uint32_t len,
+        uint8_t needles[BENCH_NNEEDLE][32], uint16_t nlen, uint64_t *check)
+{
+    const int rounds = 1 + (int)(20000000 / ((uint64_t)len * BENCH_NBUF * BENCH_NNEEDLE));
+    uint64_t sum = 0;
+    const uint64_t start = BenchNow();
+    for (int r = 0; r < rounds; r++) {
+        for (int n = 0; n < BENCH_NNEEDLE; n++) {
+            for (int b = 0; b < BENCH_NBUF; b++) {
+                const uint8_t *found = memmem(bufs[b], len, needles[n], nlen);
+                sum += found ? (uint64_t)(found - bufs[b]) + 1 : 0;
+            }
+        }
+    }
+    const uint64_t ns = BenchNow() - start;
+    *check = sum / rounds;
+    return (double)ns / ((double)rounds * BENCH_NNEEDLE * BENCH_NBUF);
+}
+
+/* ns to build and free a context */
+static double BenchRunInit(uint16_t matcher, uint8_t needles[BENCH_NNEEDLE][32],
+        uint16_t nlen, int nocase)
+{
+    SpmGlobalThreadCtx *g = spm_table[matcher].InitGlobalThreadCtx();
+    const int rounds = 20000;
+    const uint64_t start = BenchNow();
+    for (int r = 0; r < rounds; r++) {
+        SpmCtx *ctx = spm_table[matcher].InitCtx(needles[r % BENCH_NNEEDLE], nlen, nocase, g);
+        spm_table[matcher].DestroyCtx(ctx);
+    }
+    const uint64_t ns = BenchNow() - start;
+    spm_table[matcher].DestroyGlobalThreadCtx(g);
+    return (double)ns / rounds;
+}
+
+/**
+ * \brief single pattern matcher benchmark, --bench=spm
+ *
+ * \retval 0 or -1 if the matchers don't agree on the matches
+ */
+int BenchModeSpm(const BenchConfig *cfg)
+{
+    const uint32_t max_len = bench_buf_sizes[sizeof(bench_buf_sizes) / sizeof(bench_buf_sizes[0]) - 1];
+    uint8_t *bufs[BENCH_NBUF];
+    for (int b = 0; b < BENCH_NBUF; b++) {
+        bufs[b] = SCMalloc(max_len);
+        if (bufs[b] == NULL) {
+            while (b-- > 0)
+                SCFree(bufs[b]);
+            return -1;
+        }
+    }
+
+    int r = 0;
+    for (size_t s = 0; s < sizeof(bench_buf_sizes) / sizeof(bench_buf_sizes[0]); s++) {
+        const uint32_t len = bench_buf_sizes[s];
+        for (int b = 0; b < BENCH_NBUF; b++)
+            BenchMakeBuffer(bufs[b], len);
+
+        printf("%u byte buffers, ns per scan:\n", len);
+        printf("  len      bm  memmem    libc   bm/nc  mm/nc   init bm  mm\n");
+        for (size_t l = 0; l < sizeof(bench_needle_lens) / sizeof(bench_needle_lens[0]); l++) {
+            const uint16_t nlen = bench_needle_lens[l];
+            uint8_t needles[BENCH_NNEEDLE][32];
+            for (int n = 0; n < BENCH_NNEEDLE; n++) {
+                /* a quarter are cut from a buffer, so there are matches */
+                if (n % 4 == 0 && nlen < len) {
+                    memcpy(needles[n], bufs[BenchRand() % BENCH_NBUF] +
+                            BenchRand() % (len - nlen), nlen);
+                } else {
+                    BenchMakeBuffer(needles[n], nlen);
+                }
+            }
+
+            uint64_t c_bm, c_mm, c_libc, c_bm_nc, c_mm_nc;
+            double bm = BenchRunSpm(SPM_BM, bufs, len, needles, nlen, 0, &c_bm);
+            double mm = BenchRunSpm(SPM_MEMMEM, bufs, len, needles, nlen, 0, &c_mm);
+            double libc = BenchRunLibc(bufs, len, needles, nlen, &c_libc);
+            double bm_nc = BenchRunSpm(SPM_BM, bufs, len, needles, nlen, 1, &c_bm_nc);
+            double mm_nc = BenchRunSpm(SPM_MEMMEM, bufs, len, needles, nlen, 1, &c_mm_nc);
+            const bool mismatch = (c_bm != c_mm || c_bm != c_libc ||
+                    c_bm_nc != c_mm_nc);
+            printf("  %3u %7.1f %7.1f %7.1f %7.1f %7.1f   %5.0f %3.0f%s\n",
+                    nlen, bm, mm, libc, bm_nc, mm_nc,
+                    BenchRunInit(SPM_BM, needles, nlen, 0),
+                    BenchRunInit(SPM_MEMMEM, needles, nlen, 0),
+                    mismatch ? "  MISMATCH" : "");
+            if (mismatch)
+                r = -1;
+        }
+    }
+
+    for (int b = 0; b < BENCH_NBUF; b++)
+        SCFree(bufs[b]);
+    return r;
+}
+
+#endif /* UNITTESTS */
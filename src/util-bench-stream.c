@@ -0,0 +1,487 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * TCP reassembly benchmark, 'suricata --bench=stream
+ * [--bench-input=<scenario|pcap>]'.
+ *
+ * Segments are fed straight into StreamTcpReassembleHandleSegment() and
+ * StreamReassembleRaw(), without capture, decoding, flow handling or the
+ * app-layer, so only the cost of the reassembly itself is measured. The
+ * receiver is assumed to ACK each segment right away.
+ *
+ * The scenarios generate a 1MiB stream of 1460 byte segments:
+ * - inorder: all segments in order
+ * - reorder: every other pair of segments swapped
+ * - overlap: every 4th segment followed by a retransmission overlapping
+ *            it and the previous segment
+ * - gap:     every 16th segment missing
+ * - all:     each of the above, the default
+ *
+ * Anything else is read as a pcap. Its TCP segments with data are
+ * replayed per direction of each connection, in pcap order, with the
+ * lowest sequence number seen as the start of the stream.
+ *
+ * Reported are the ns and cpu ticks per segment, the throughput, the
+ * number and size of the streaming buffer allocations and the peak
+ * reassembly memuse. --bench-max-ns applies to the average per segment
+ * over all inputs.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "defrag.h"
+#include "flow.h"
+#include "stream-tcp.h"
+#include "stream-tcp-private.h"
+#include "stream-tcp-reassemble.h"
+#include "stream-tcp-util.h"
+#include "tmqh-packetpool.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-hashlist.h"
+#include "util-unittest-helper.h"
+
+#ifdef UNITTESTS
+
+#define BENCH_STREAM_SIZE           (1024 * 1024)
+#define BENCH_SEGMENT_SIZE          1460
+#define BENCH_MAX_SESSIONS          65536
+
+typedef struct BenchSegment_ {
+    uint32_t ssn;           /**< index in BenchStreamCtx::ssns */
+    uint32_t flags;         /**< p->flags to restore before each replay */
+    Packet *p;
+} BenchSegment;
+
+typedef struct BenchStreamCtx_ {
+    const char *name;
+
+    BenchSegment *segs;
+    uint32_t segs_cnt;
+    uint32_t segs_size;
+    uint64_t bytes;
+
+    /** isn of each session */
+    uint32_t *isns;
+    uint32_t ssns_cnt;
+    TcpSession *ssns;
+    Flow *flows;
+
+    ThreadVars tv;
+    TcpReassemblyThreadCtx *ra_ctx;
+    uint64_t raw_bytes;
+    uint64_t memuse_peak;
+} BenchStreamCtx;
+
+/* streaming buffer allocations, counted by wrapping the functions of
+ * stream_config.sbcnf */
+static uint64_t bench_allocs = 0;
+static uint64_t bench_alloc_bytes = 0;
+static void *(*BenchOrigMalloc)(size_t size);
+static void *(*BenchOrigCalloc)(size_t n, size_t size);
+static void *(*BenchOrigRealloc)(void *ptr, size_t orig_size, size_t size);
+
+static void *BenchMalloc(size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    return BenchOrigMalloc(size);
+}
+
+static void *BenchCalloc(size_t n, size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += n * size;
+    return BenchOrigCalloc(n, size);
+}
+
+static void *BenchRealloc(void *ptr, size_t orig_size, size_t size)
+{
+    bench_allocs++;
+    if (size > orig_size)
+        bench_alloc_bytes += size - orig_size;
+    return BenchOrigRealloc(ptr, orig_size, size);
+}
+
+static int BenchAddSegment(BenchStreamCtx *ctx, uint32_t ssn, uint32_t seq,
+        const uint8_t *data, uint16_t len)
+{
+    if (ctx->segs_cnt == ctx->segs_size) {
+        uint32_t size = ctx->segs_size ? ctx->segs_size * 2 : 1024;
+        BenchSegment *segs = SCRealloc(ctx->segs, size * sizeof(BenchSegment));
+        if (segs == NULL)
+            return -1;
+        ctx->segs = segs;
+        ctx->segs_size = size;
+    }
+
+    Packet *p = UTHBuildPacketReal((uint8_t *)data, len, IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL)
+        return -1;
+    p->tcph->th_seq = htonl(seq);
+    p->tcph->th_ack = htonl(1);
+    p->tcph->th_flags = TH_ACK;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    BenchSegment *s = &ctx->segs[ctx->segs_cnt++];
+    s->ssn = ssn;
+    s->flags = p->flags;
+    s->p = p;
+    ctx->bytes += len;
+    return 0;
+}
+
+static inline uint8_t BenchByte(uint32_t offset)
+{
+    return (uint8_t)(offset * 31 + 7);
+}
+
+static int BenchLoadScenario(BenchStreamCtx *ctx, const char *scenario)
+{
+    uint8_t data[BENCH_SEGMENT_SIZE];
+    const uint32_t nsegs = BENCH_STREAM_SIZE / BENCH_SEGMENT_SIZE;
+    const uint32_t isn = 1000;
+
+    ctx->name = scenario;
+    ctx->ssns_cnt = 1;
+    ctx->isns = SCCalloc(1, sizeof(uint32_t));
+    if (ctx->isns == NULL)
+        return -1;
+    ctx->isns[0] = isn;
+
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uint32_t idx = i;
+        if (strcmp(scenario, "reorder") == 0 && (i % 4) < 2)
+            idx = i ^ 1;
+        else if (strcmp(scenario, "gap") == 0 && (i % 16) == 15)
+            continue;
+
+        uint32_t offset = idx * BENCH_SEGMENT_SIZE;
+        for (uint32_t o = 0; o < BENCH_SEGMENT_SIZE; o++)
+            data[o] = BenchByte(offset + o);
+        if (BenchAddSegment(ctx, 0, isn + 1 + offset, data, BENCH_SEGMENT_SIZE) < 0)
+            return -1;
+
+        if (strcmp(scenario, "overlap") == 0 && (i % 4) == 3) {
+            offset -= BENCH_SEGMENT_SIZE / 2;
+            for (uint32_t o = 0; o < BENCH_SEGMENT_SIZE; o++)
+                data[o] = BenchByte(offset + o);
+            if (BenchAddSegment(ctx, 0, isn + 1 + offset, data, BENCH_SEGMENT_SIZE) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/** connection direction in the pcap, its first bytes are the hash key */
+typedef struct BenchTuple_ {
+    struct {
+        Address src;
+        Address dst;
+        Port sp;
+        Port dp;
+    } key;
+    uint32_t ssn;
+    uint32_t min_seq;
+} BenchTuple;
+
+static void BenchTupleFree(void *data)
+{
+    SCFree(data);
+}
+
+typedef struct BenchStreamPcap_ {
+    BenchStreamCtx *ctx;
+    HashListTable *tuples;
+} BenchStreamPcap;
+
+static int BenchAddPacket(void *data, Packet *p)
+{
+    BenchStreamPcap *pcap = data;
+    BenchStreamCtx *ctx = pcap->ctx;
+
+    if (!PKT_IS_TCP(p) || p->payload_len == 0)
+        return 0;
+
+    BenchTuple key;
+    memset(&key, 0, sizeof(key));
+    COPY_ADDRESS(&p->src, &key.key.src);
+    COPY_ADDRESS(&p->dst, &key.key.dst);
+    key.key.sp = p->sp;
+    key.key.dp = p->dp;
+
+    const uint32_t seq = TCP_GET_SEQ(p);
+    BenchTuple *t = HashListTableLookup(pcap->tuples, &key, sizeof(key.key));
+    if (t == NULL) {
+        if (ctx->ssns_cnt == BENCH_MAX_SESSIONS)
+            return 0;
+        t = SCMalloc(sizeof(*t));
+        if (t == NULL)
+            return -1;
+        *t = key;
+        t->ssn = ctx->ssns_cnt++;
+        t->min_seq = seq;
+        if (HashListTableAdd(pcap->tuples, t, sizeof(t->key)) != 0) {
+            SCFree(t);
+            return -1;
+        }
+    } else if (SEQ_LT(seq, t->min_seq)) {
+        t->min_seq = seq;
+    }
+
+    return BenchAddSegment(ctx, t->ssn, seq, p->payload, p->payload_len);
+}
+
+static int BenchLoadPcap(BenchStreamCtx *ctx, const char *file)
+{
+    BenchStreamPcap pcap = { ctx, NULL };
+    pcap.tuples = HashListTableInit(4096, HashListTableGenericHash,
+            HashListTableDefaultCompare, BenchTupleFree);
+    if (pcap.tuples == NULL)
+        return -1;
+
+    ctx->name = "pcap";
+    int ret = BenchPcapDecode(file, BenchAddPacket, &pcap);
+    if (ret == 0 && ctx->segs_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "no TCP data in %s", file);
+        ret = -1;
+    }
+    if (ret == 0) {
+        ctx->isns = SCCalloc(ctx->ssns_cnt, sizeof(uint32_t));
+        if (ctx->isns == NULL) {
+            ret = -1;
+        } else {
+            HashListTableBucket *b = HashListTableGetListHead(pcap.tuples);
+            for ( ; b != NULL; b = HashListTableGetListNext(b)) {
+                const BenchTuple *t = HashListTableGetListData(b);
+                ctx->isns[t->ssn] = t->min_seq - 1;
+            }
+        }
+    }
+
+    HashListTableFree(pcap.tuples);
+    return ret;
+}
+
+static int BenchRawCallback(void *data, const uint8_t *input,
+        const uint32_t input_len, const uint64_t offset)
+{
+    uint64_t *bytes = data;
+    *bytes += input_len;
+    return 0;
+}
+
+static void BenchSetupSessions(BenchStreamCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->ssns_cnt; i++) {
+        TcpSession *ssn = &ctx->ssns[i];
+        StreamTcpUTSetupSession(ssn);
+        StreamTcpUTSetupStream(&ssn->client, ctx->isns[i]);
+        StreamTcpUTSetupStream(&ssn->server, 0);
+        ssn->state = TCP_ESTABLISHED;
+        ssn->flags |= STREAMTCP_FLAG_APP_LAYER_DISABLED;
+        ssn->client.window = UINT16_MAX << 8;
+        ssn->client.last_ack = ctx->isns[i] + 1;
+
+        Flow *f = &ctx->flows[i];
+        memset(f, 0, sizeof(*f));
+        f->proto = IPPROTO_TCP;
+        f->protoctx = ssn;
+    }
+}
+
+static void BenchClearSessions(BenchStreamCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->ssns_cnt; i++)
+        StreamTcpUTClearSession(&ctx->ssns[i]);
+}
+
+/** \internal
+ *  \brief one pass over all segments
+ *  \retval ticks cpu ticks spent in the reassembly */
+static uint64_t BenchIteration(BenchStreamCtx *ctx)
+{
+    uint64_t ticks = 0;
+
+    BenchSetupSessions(ctx);
+    for (uint32_t i = 0; i < ctx->segs_cnt; i++) {
+        BenchSegment *s = &ctx->segs[i];
+        TcpSession *ssn = &ctx->ssns[s->ssn];
+        Packet *p = s->p;
+        p->flags = s->flags;
+        p->flow = &ctx->flows[s->ssn];
+
+        const uint64_t start = UtilCpuGetTicks();
+
+        (void)StreamTcpReassembleHandleSegment(&ctx->tv, ctx->ra_ctx, ssn,
+                &ssn->client, p, NULL);
+        /* the receiver ACKs it all right away */
+        if (SEQ_GT(ssn->client.segs_right_edge, ssn->client.last_ack))
+            ssn->client.last_ack = ssn->client.segs_right_edge;
+
+        uint64_t progress = 0;
+        (void)StreamReassembleRaw(ssn, p, BenchRawCallback, &ctx->raw_bytes,
+                &progress, false);
+        StreamReassembleRawUpdateProgress(ssn, p, progress);
+        StreamTcpPruneSession(p->flow, STREAM_TOSERVER);
+
+        ticks += UtilCpuGetTicks() - start;
+
+        const uint64_t memuse = StreamTcpReassembleMemuseGlobalCounter();
+        if (memuse > ctx->memuse_peak)
+            ctx->memuse_peak = memuse;
+        p->flow = NULL;
+    }
+    BenchClearSessions(ctx);
+    return ticks;
+}
+
+/** \retval avg_ns average ns per segment, < 0 on error */
+static double BenchRun(BenchStreamCtx *ctx, uint32_t iterations)
+{
+    ctx->ssns = SCCalloc(ctx->ssns_cnt, sizeof(TcpSession));
+    ctx->flows = SCCalloc(ctx->ssns_cnt, sizeof(Flow));
+    if (ctx->ssns == NULL || ctx->flows == NULL)
+        return -1;
+
+    /* warm up the caches and the segment pool */
+    (void)BenchIteration(ctx);
+    ctx->raw_bytes = 0;
+    ctx->memuse_peak = 0;
+    bench_allocs = 0;
+    bench_alloc_bytes = 0;
+
+    uint64_t ticks = 0;
+    BenchTimer timer;
+    BenchTimerStart(&timer);
+    for (uint32_t i = 0; i < iterations; i++)
+        ticks += BenchIteration(ctx);
+    uint64_t total_ns;
+    const double ns_per_tick = BenchTimerStop(&timer, &total_ns);
+    const uint64_t segs = (uint64_t)ctx->segs_cnt * iterations;
+    const uint64_t bytes = ctx->bytes * iterations;
+    const double avg_ns = (double)ticks * ns_per_tick / segs;
+    const double secs = (double)ticks * ns_per_tick / 1e9;
+
+    printf("%-10s %10"PRIu64" %10.1f %12.1f %10.1f %10"PRIu64" %12"PRIu64" %12"PRIu64"\n",
+            ctx->name, segs, avg_ns, (double)ticks / segs,
+            secs > 0 ? bytes / secs / (1024 * 1024) : 0,
+            bench_allocs / iterations, bench_alloc_bytes / iterations,
+            ctx->memuse_peak);
+    if (ctx->raw_bytes < bytes / 2) {
+        SCLogWarning(SC_WARN_UNCOMMON, "%s: only %"PRIu64" of %"PRIu64" bytes "
+                "were reassembled", ctx->name, ctx->raw_bytes, bytes);
+    }
+    return avg_ns;
+}
+
+static void BenchFree(BenchStreamCtx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->segs_cnt; i++)
+        UTHFreePacket(ctx->segs[i].p);
+    SCFree(ctx->segs);
+    SCFree(ctx->isns);
+    SCFree(ctx->ssns);
+    SCFree(ctx->flows);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static bool BenchIsScenario(const char *name)
+{
+    return (strcmp(name, "inorder") == 0 || strcmp(name, "reorder") == 0 ||
+            strcmp(name, "overlap") == 0 || strcmp(name, "gap") == 0);
+}
+
+/**
+ * \brief TCP reassembly benchmark, --bench=stream
+ */
+int BenchModeStream(const BenchConfig *cfg)
+{
+    static const char *all[] = { "inorder", "reorder", "overlap", "gap", NULL };
+    const char *input = cfg->input ? cfg->input : "all";
+
+    extern intmax_t max_pending_packets;
+    max_pending_packets = 128;
+    PacketPoolInit();
+    DefragInit();
+
+    BenchStreamCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    StreamTcpUTInit(&ctx.ra_ctx);
+    stream_config.reassembly_toserver_chunk_size = BENCH_SEGMENT_SIZE;
+
+    BenchOrigMalloc = stream_config.sbcnf.Malloc;
+    BenchOrigCalloc = stream_config.sbcnf.Calloc;
+    BenchOrigRealloc = stream_config.sbcnf.Realloc;
+    stream_config.sbcnf.Malloc = BenchMalloc;
+    stream_config.sbcnf.Calloc = BenchCalloc;
+    stream_config.sbcnf.Realloc = BenchRealloc;
+
+    const char *one[] = { input, NULL };
+    const char **inputs = strcmp(input, "all") == 0 ? all : one;
+
+    printf("%u iterations\n", cfg->iterations);
+    printf("%-10s %10s %10s %12s %10s %10s %12s %12s\n", "input", "segments",
+            "ns/seg", "ticks/seg", "MiB/s", "allocs", "alloc bytes",
+            "peak memuse");
+
+    int r = 0;
+    double total_ns = 0;
+    int runs = 0;
+    for (int i = 0; r == 0 && inputs[i] != NULL; i++) {
+        TcpReassemblyThreadCtx *ra_ctx = ctx.ra_ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.ra_ctx = ra_ctx;
+        strlcpy(ctx.tv.name, "BenchStream", sizeof(ctx.tv.name));
+
+        if (BenchIsScenario(inputs[i]))
+            r = BenchLoadScenario(&ctx, inputs[i]);
+        else
+            r = BenchLoadPcap(&ctx, inputs[i]);
+        if (r == 0) {
+            double avg_ns = BenchRun(&ctx, cfg->iterations);
+            if (avg_ns < 0) {
+                r = -1;
+            } else {
+                total_ns += avg_ns;
+                runs++;
+            }
+        }
+        BenchFree(&ctx);
+        ctx.ra_ctx = ra_ctx;
+    }
+
+    if (r == 0 && runs > 0)
+        r = BenchCheckMaxNs(cfg, total_ns / runs, "segment");
+
+    stream_config.sbcnf.Malloc = BenchOrigMalloc;
+    stream_config.sbcnf.Calloc = BenchOrigCalloc;
+    stream_config.sbcnf.Realloc = BenchOrigRealloc;
+    StreamTcpUTDeinit(ctx.ra_ctx);
+    DefragDestroy();
+    PacketPoolDestroy();
+    return r;
+}
+
+#endif /* UNITTESTS */
@@ -0,0 +1,337 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Benchmarks, 'suricata --bench=<mode> [--bench-input=<input>]' or
+ * 'make bench-mode BENCH_MODE=<mode> [BENCH_INPUT=<input>]'.
+ *
+ * Each mode takes the parts of the engine it measures out of the
+ * pipeline and loops them over its input, a pcap, a corpus or generated
+ * data, for --bench-iterations passes after a warm up pass. Where a mode
+ * supports it, --bench-max-ns makes the run fail if the average is above
+ * the given value, so it can be used to catch regressions.
+ *
+ * Only available in --enable-unittests builds, the modes use the same
+ * global setup as the unittests.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "pkt-var.h"
+#include "tmqh-packetpool.h"
+#include "runmode-unittests.h"
+#include "util-bench.h"
+#include "util-byte.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+#ifdef UNITTESTS
+
+typedef struct BenchMode_ {
+    const char *name;
+    int (*Func)(const BenchConfig *cfg);
+    /** what --bench-input is, NULL if the mode has no input */
+    const char *input;
+    /** the mode runs without --bench-input */
+    bool input_optional;
+} BenchMode;
+
+static const BenchMode bench_modes[] = {
+    { "decode", BenchModeDecode, "pcap", false },
+    { "stream", BenchModeStream, "inorder|reorder|overlap|gap|all|pcap", true },
+    { "mime", BenchModeMime, "eml|dir", false },
+#ifdef HAVE_RUST
+    { "dns", BenchModeDns, "pcap", false },
+#endif
+    { "app-layer", BenchModeAppLayer, "pcap", false },
+    { "detect", BenchModeDetect, "recording", false },
+    { "mpm", BenchModeMpm, "patterns", false },
+    { "checksum", BenchModeChecksum, NULL, true },
+    { "flow-hash", BenchModeFlowHash, NULL, true },
+    { "spm", BenchModeSpm, NULL, true },
+    { NULL, NULL, NULL, false },
+};
+
+uint64_t BenchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void BenchTimerStart(BenchTimer *t)
+{
+    t->ns = BenchNow();
+    t->ticks = UtilCpuGetTicks();
+}
+
+/**
+ * \brief stop a timed loop
+ *
+ * The per packet or per message times of the modes are cpu ticks, which
+ * are scaled with the wall clock of the whole loop.
+ *
+ * \param total_ns set to the wall clock time of the loop
+ * \retval ns_per_tick 0 if no ticks passed
+ */
+double BenchTimerStop(const BenchTimer *t, uint64_t *total_ns)
+{
+    *total_ns = BenchNow() - t->ns;
+    const uint64_t total_ticks = UtilCpuGetTicks() - t->ticks;
+    return total_ticks ? (double)*total_ns / total_ticks : 0;
+}
+
+/** \retval 1 set, 0 not set, -1 invalid */
+int BenchGetUint(const char *name, uint64_t *res)
+{
+    const char *str = NULL;
+    if (ConfGet(name, &str) != 1 || str == NULL)
+        return 0;
+    if (ByteExtractStringUint64(res, 10, strlen(str), str) != (int)strlen(str)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid value for %s: %s", name, str);
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * \brief check an average against --bench-max-ns
+ * \param unit what the average is per, like "pkt" or "message"
+ * \retval 0 ok or no limit set, -1 above the limit
+ */
+int BenchCheckMaxNs(const BenchConfig *cfg, double avg_ns, const char *unit)
+{
+    if (cfg->max_ns > 0 && avg_ns > (double)cfg->max_ns) {
+        printf("FAILED: %.1f ns/%s is above the limit of %"PRIu64" ns/%s\n",
+                avg_ns, unit, cfg->max_ns, unit);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief read a whole file into memory
+ * \param buf set to the SCMalloc'd contents on success
+ * \retval 0 ok, 1 empty or larger than max_size, -1 error
+ */
+int BenchReadFile(const char *file, uint32_t max_size, uint8_t **buf,
+        uint32_t *len)
+{
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+
+    int r = -1;
+    uint8_t *data = NULL;
+    if (fseek(fp, 0, SEEK_END) != 0)
+        goto end;
+    long size = ftell(fp);
+    if (size < 0 || fseek(fp, 0, SEEK_SET) != 0)
+        goto end;
+    if (size == 0 || size > (long)max_size) {
+        r = 1;
+        goto end;
+    }
+
+    data = SCMalloc(size);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t)size)
+        goto end;
+    *buf = data;
+    *len = (uint32_t)size;
+    data = NULL;
+    r = 0;
+end:
+    if (r < 0)
+        SCLogError(SC_ERR_FOPEN, "failed to read %s", file);
+    SCFree(data);
+    fclose(fp);
+    return r;
+}
+
+/**
+ * \brief pass the packets of a pcap to Func as they are read
+ *
+ * Packets without data are skipped. Reading stops at the first packet
+ * for which Func returns < 0.
+ *
+ * \param datalink set to the link type of the pcap
+ * \param decoder set to the decoder of the link type, before the first
+ *                call to Func
+ */
+int BenchPcapRead(const char *file, int *datalink, Decoder *decoder,
+        BenchPcapRawFunc Func, void *data)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    pcap_t *pcap = pcap_open_offline(file, errbuf);
+    if (pcap == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, errbuf);
+        return -1;
+    }
+    *datalink = pcap_datalink(pcap);
+    if (ValidateLinkType(*datalink, decoder) != TM_ECODE_OK) {
+        pcap_close(pcap);
+        return -1;
+    }
+
+    int ret = 0;
+    struct pcap_pkthdr *h;
+    const u_char *pkt;
+    int r;
+    while ((r = pcap_next_ex(pcap, &h, &pkt)) == 1) {
+        if (h->caplen == 0)
+            continue;
+        if (Func(data, h, pkt) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    if (r == -1) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "failed to read %s: %s", file,
+                pcap_geterr(pcap));
+        ret = -1;
+    }
+    pcap_close(pcap);
+    return ret;
+}
+
+typedef struct BenchPcapDecodeCtx_ {
+    int datalink;
+    Decoder decoder;
+    ThreadVars tv;
+    DecodeThreadVars *dtv;
+    Packet *p;
+    PacketQueue pq;
+
+    BenchPcapPacketFunc Func;
+    void *data;
+} BenchPcapDecodeCtx;
+
+static int BenchPcapDecodePacket(void *data, const struct pcap_pkthdr *h,
+        const uint8_t *pkt)
+{
+    BenchPcapDecodeCtx *ctx = data;
+    Packet *p = ctx->p;
+
+    PacketSetData(p, (uint8_t *)pkt, h->caplen);
+    p->datalink = ctx->datalink;
+    ctx->decoder(&ctx->tv, ctx->dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p),
+            &ctx->pq);
+    Packet *x;
+    while ((x = PacketDequeue(&ctx->pq)) != NULL)
+        PacketFreeOrRelease(x);
+
+    const int r = ctx->Func(ctx->data, p);
+    PACKET_RECYCLE(p);
+    return r;
+}
+
+/**
+ * \brief decode the packets of a pcap and pass them to Func
+ *
+ * The packet is only valid during the call, tunnel packets are dropped.
+ */
+int BenchPcapDecode(const char *file, BenchPcapPacketFunc Func, void *data)
+{
+    BenchPcapDecodeCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.Func = Func;
+    ctx.data = data;
+
+    ctx.dtv = DecodeThreadVarsAlloc(&ctx.tv);
+    ctx.p = PacketGetFromAlloc();
+    int r = -1;
+    if (ctx.dtv != NULL && ctx.p != NULL) {
+        DecodeRegisterPerfCounters(ctx.dtv, &ctx.tv);
+        r = BenchPcapRead(file, &ctx.datalink, &ctx.decoder,
+                BenchPcapDecodePacket, &ctx);
+    }
+
+    if (ctx.p != NULL)
+        PacketFree(ctx.p);
+    if (ctx.dtv != NULL)
+        DecodeThreadVarsFree(&ctx.tv, ctx.dtv);
+    return r;
+}
+
+static void BenchPrintModes(void)
+{
+    fprintf(stderr, "bench modes:\n");
+    for (const BenchMode *m = bench_modes; m->name != NULL; m++) {
+        if (m->input == NULL)
+            fprintf(stderr, "  %s\n", m->name);
+        else
+            fprintf(stderr, "  %s --bench-input=%s%s\n", m->name, m->input,
+                    m->input_optional ? " (optional)" : "");
+    }
+}
+
+#endif /* UNITTESTS */
+
+/**
+ * \brief run the benchmark configured from the command line
+ *
+ * This function is terminal and will call exit after being called.
+ */
+void RunBench(void)
+{
+#ifdef UNITTESTS
+    const char *name = NULL;
+    uint64_t iterations = BENCH_DEFAULT_ITERATIONS;
+    BenchConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+
+    if (ConfGet("bench.mode", &name) != 1 || name == NULL ||
+            BenchGetUint("bench.iterations", &iterations) < 0 ||
+            BenchGetUint("bench.max-ns", &cfg.max_ns) < 0 ||
+            iterations == 0 || iterations > UINT32_MAX) {
+        exit(EXIT_FAILURE);
+    }
+    cfg.iterations = (uint32_t)iterations;
+    (void)ConfGet("bench.input", &cfg.input);
+
+    const BenchMode *mode = bench_modes;
+    while (mode->name != NULL && strcmp(mode->name, name) != 0)
+        mode++;
+    if (mode->name == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unknown bench mode %s", name);
+        BenchPrintModes();
+        exit(EXIT_FAILURE);
+    }
+    if (mode->input != NULL && !mode->input_optional && cfg.input == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "bench mode %s needs "
+                "--bench-input=<%s>", mode->name, mode->input);
+        exit(EXIT_FAILURE);
+    }
+
+    RunUnittestsInit();
+
+    int r = mode->Func(&cfg);
+
+    exit(r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+#else
+    fprintf(stderr, "ERROR: the benchmarks need a build with "
+            "--enable-unittests.\n");
+    exit(EXIT_FAILURE);
+#endif /* UNITTESTS */
+}
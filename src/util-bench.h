@@ -0,0 +1,84 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Benchmarks, 'suricata --bench=<mode>'. The modes are implemented in
+ * util-bench-<mode>.c on top of the helpers here.
+ */
+
+#ifndef __UTIL_BENCH_H__
+#define __UTIL_BENCH_H__
+
+#ifdef UNITTESTS
+
+#include "decode.h"
+#include "source-pcap-file-helper.h"
+
+#define BENCH_DEFAULT_ITERATIONS    10
+
+/** options common to all modes */
+typedef struct BenchConfig_ {
+    /** --bench-input, NULL if not set */
+    const char *input;
+    uint32_t iterations;
+    /** --bench-max-ns, 0 if not set */
+    uint64_t max_ns;
+} BenchConfig;
+
+/** wall clock and cpu ticks at the start of a timed loop */
+typedef struct BenchTimer_ {
+    uint64_t ns;
+    uint64_t ticks;
+} BenchTimer;
+
+uint64_t BenchNow(void);
+void BenchTimerStart(BenchTimer *t);
+double BenchTimerStop(const BenchTimer *t, uint64_t *total_ns);
+int BenchGetUint(const char *name, uint64_t *res);
+int BenchCheckMaxNs(const BenchConfig *cfg, double avg_ns, const char *unit);
+int BenchReadFile(const char *file, uint32_t max_size, uint8_t **buf,
+        uint32_t *len);
+
+typedef int (*BenchPcapRawFunc)(void *data, const struct pcap_pkthdr *h,
+        const uint8_t *pkt);
+typedef int (*BenchPcapPacketFunc)(void *data, Packet *p);
+
+int BenchPcapRead(const char *file, int *datalink, Decoder *decoder,
+        BenchPcapRawFunc Func, void *data);
+int BenchPcapDecode(const char *file, BenchPcapPacketFunc Func, void *data);
+
+int BenchModeDecode(const BenchConfig *cfg);
+int BenchModeStream(const BenchConfig *cfg);
+int BenchModeMime(const BenchConfig *cfg);
+#ifdef HAVE_RUST
+int BenchModeDns(const BenchConfig *cfg);
+#endif
+int BenchModeAppLayer(const BenchConfig *cfg);
+int BenchModeDetect(const BenchConfig *cfg);
+int BenchModeMpm(const BenchConfig *cfg);
+int BenchModeChecksum(const BenchConfig *cfg);
+int BenchModeFlowHash(const BenchConfig *cfg);
+int BenchModeSpm(const BenchConfig *cfg);
+
+#endif /* UNITTESTS */
+
+__attribute__((noreturn))
+void RunBench(void);
+
+#endif /* __UTIL_BENCH_H__ */
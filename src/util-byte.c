@@ -420,6 +420,212 @@ int ByteExtractStringInt8(int8_t *res, int base, uint16_t len, const char *str)
     return ret;
 }
 
+/* Extractors for the byte keywords. These are picked once at rule setup
+ * by ByteExtractGetFunc() and ByteExtractStringGetFunc() so that the
+ * per packet path doesn't check size, endianness or base, and doesn't
+ * copy string values into a temporary buffer. */
+
+static int ByteExtractFunc1(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = bytes[0];
+    return 1;
+}
+
+static int ByteExtractFuncBE2(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[0] << 8) | (uint64_t)bytes[1];
+    return 2;
+}
+
+static int ByteExtractFuncLE2(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+    return 2;
+}
+
+static int ByteExtractFuncBE4(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[0] << 24) | ((uint64_t)bytes[1] << 16) |
+           ((uint64_t)bytes[2] << 8) | (uint64_t)bytes[3];
+    return 4;
+}
+
+static int ByteExtractFuncLE4(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[3] << 24) | ((uint64_t)bytes[2] << 16) |
+           ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+    return 4;
+}
+
+static int ByteExtractFuncBE8(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+           ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+           ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+           ((uint64_t)bytes[6] << 8) | (uint64_t)bytes[7];
+    return 8;
+}
+
+static int ByteExtractFuncLE8(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    *res = ((uint64_t)bytes[7] << 56) | ((uint64_t)bytes[6] << 48) |
+           ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[4] << 32) |
+           ((uint64_t)bytes[3] << 24) | ((uint64_t)bytes[2] << 16) |
+           ((uint64_t)bytes[1] << 8) | (uint64_t)bytes[0];
+    return 8;
+}
+
+/* odd sizes (3, 5, 6, 7) are rare enough for a plain loop */
+static int ByteExtractFuncBE(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    uint64_t v = 0;
+    for (uint16_t i = 0; i < len; i++)
+        v = (v << 8) | bytes[i];
+    *res = v;
+    return len;
+}
+
+static int ByteExtractFuncLE(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    uint64_t v = 0;
+    for (uint16_t i = len; i > 0; i--)
+        v = (v << 8) | bytes[i - 1];
+    *res = v;
+    return len;
+}
+
+ByteExtractFunc ByteExtractGetFunc(int e, uint16_t len)
+{
+    if ((e != BYTE_BIG_ENDIAN) && (e != BYTE_LITTLE_ENDIAN))
+        return NULL;
+
+    switch (len) {
+        case 1:
+            return ByteExtractFunc1;
+        case 2:
+            return (e == BYTE_BIG_ENDIAN) ? ByteExtractFuncBE2 : ByteExtractFuncLE2;
+        case 4:
+            return (e == BYTE_BIG_ENDIAN) ? ByteExtractFuncBE4 : ByteExtractFuncLE4;
+        case 8:
+            return (e == BYTE_BIG_ENDIAN) ? ByteExtractFuncBE8 : ByteExtractFuncLE8;
+        case 3:
+        case 5:
+        case 6:
+        case 7:
+            return (e == BYTE_BIG_ENDIAN) ? ByteExtractFuncBE : ByteExtractFuncLE;
+        default:
+            return NULL;
+    }
+}
+
+static inline int ByteDigitValue(const uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 10;
+    return 36;
+}
+
+/** \internal
+ *  \brief parse a number directly from the buffer
+ *
+ *  Follows strtoull() on the first len bytes of the buffer: leading
+ *  whitespace and a sign are skipped, a "0x" prefix is accepted for
+ *  base 16 and base 0 selects the base from the prefix.
+ *
+ *  \retval n number of bytes consumed
+ *  \retval -1 no digits or value out of range. *res is 0 in the first
+ *             case and UINT64_MAX in the second, like strtoull().
+ */
+static inline int ByteExtractStringBase(uint64_t *res, int base,
+        uint16_t len, const uint8_t *bytes)
+{
+    uint16_t i = 0;
+    while (i < len && (bytes[i] == ' ' || (bytes[i] >= '\t' && bytes[i] <= '\r')))
+        i++;
+
+    bool neg = false;
+    if (i < len && (bytes[i] == '+' || bytes[i] == '-')) {
+        neg = (bytes[i] == '-');
+        i++;
+    }
+
+    if ((base == 0 || base == 16) && i + 2 < len && bytes[i] == '0' &&
+            (bytes[i + 1] | 0x20) == 'x' && ByteDigitValue(bytes[i + 2]) < 16) {
+        base = 16;
+        i += 2;
+    } else if (base == 0) {
+        base = (i < len && bytes[i] == '0') ? 8 : 10;
+    }
+
+    const uint16_t start = i;
+    const uint64_t cutoff = UINT64_MAX / (uint64_t)base;
+    const int cutlim = (int)(UINT64_MAX % (uint64_t)base);
+    bool overflow = false;
+    uint64_t v = 0;
+    for ( ; i < len; i++) {
+        const int d = ByteDigitValue(bytes[i]);
+        if (d >= base)
+            break;
+        if (v > cutoff || (v == cutoff && d > cutlim))
+            overflow = true;
+        else
+            v = v * base + d;
+    }
+
+    if (i == start) {
+        SCLogDebug("no numeric value");
+        *res = 0;
+        return -1;
+    }
+    if (overflow) {
+        SCLogDebug("numeric value out of range");
+        *res = UINT64_MAX;
+        return -1;
+    }
+    *res = neg ? -v : v;
+    return i;
+}
+
+static int ByteExtractFuncString(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    return ByteExtractStringBase(res, 0, len, bytes);
+}
+
+static int ByteExtractFuncStringOct(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    return ByteExtractStringBase(res, 8, len, bytes);
+}
+
+static int ByteExtractFuncStringDec(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    return ByteExtractStringBase(res, 10, len, bytes);
+}
+
+static int ByteExtractFuncStringHex(uint64_t *res, uint16_t len, const uint8_t *bytes)
+{
+    return ByteExtractStringBase(res, 16, len, bytes);
+}
+
+ByteExtractFunc ByteExtractStringGetFunc(int base)
+{
+    switch (base) {
+        case 0:
+            return ByteExtractFuncString;
+        case 8:
+            return ByteExtractFuncStringOct;
+        case 10:
+            return ByteExtractFuncStringDec;
+        case 16:
+            return ByteExtractFuncStringHex;
+        default:
+            return NULL;
+    }
+}
+
 /* UNITTESTS */
 #ifdef UNITTESTS
 
@@ -648,6 +854,41 @@ static int ByteTest16 (void)
     return 0;
 }
 
+/** \test extractors selected per size, endianness and base */
+static int ByteTest17 (void)
+{
+    const uint8_t bytes[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+    uint64_t val = 0;
+    uint64_t ref = 0;
+
+    for (uint16_t len = 1; len <= 8; len++) {
+        FAIL_IF(ByteExtractGetFunc(BYTE_BIG_ENDIAN, len)(&val, len, bytes) != len);
+        FAIL_IF(ByteExtractUint64(&ref, BYTE_BIG_ENDIAN, len, bytes) != len);
+        FAIL_IF(val != ref);
+        FAIL_IF(ByteExtractGetFunc(BYTE_LITTLE_ENDIAN, len)(&val, len, bytes) != len);
+        FAIL_IF(ByteExtractUint64(&ref, BYTE_LITTLE_ENDIAN, len, bytes) != len);
+        FAIL_IF(val != ref);
+    }
+    FAIL_IF_NOT_NULL(ByteExtractGetFunc(BYTE_BIG_ENDIAN, 9));
+    FAIL_IF_NOT_NULL(ByteExtractStringGetFunc(26));
+
+    /* parsing stops at the length, not at a nul byte */
+    const uint8_t str[] = " 0x1fz99";
+    FAIL_IF(ByteExtractStringGetFunc(16)(&val, 4, str) != 4);
+    FAIL_IF(val != 0x1);
+    FAIL_IF(ByteExtractStringGetFunc(0)(&val, 6, str) != 5);
+    FAIL_IF(val != 0x1f);
+    FAIL_IF(ByteExtractStringGetFunc(10)(&val, 6, str) != 2);
+    FAIL_IF(val != 0);
+    FAIL_IF(ByteExtractStringGetFunc(8)(&val, 3, (const uint8_t *)"-17") != 3);
+    FAIL_IF(val != (uint64_t)-15);
+    FAIL_IF(ByteExtractStringGetFunc(10)(&val, 3, (const uint8_t *)"abc") != -1);
+    FAIL_IF(val != 0);
+    FAIL_IF(ByteExtractStringGetFunc(10)(&val, 20, (const uint8_t *)"18446744073709551616") != -1);
+    FAIL_IF(val != UINT64_MAX);
+    PASS;
+}
+
 void ByteRegisterTests(void)
 {
     UtRegisterTest("ByteTest01", ByteTest01);
@@ -666,6 +907,7 @@ void ByteRegisterTests(void)
     UtRegisterTest("ByteTest14", ByteTest14);
     UtRegisterTest("ByteTest15", ByteTest15);
     UtRegisterTest("ByteTest16", ByteTest16);
+    UtRegisterTest("ByteTest17", ByteTest17);
 }
 #endif /* UNITTESTS */
 
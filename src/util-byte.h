@@ -253,6 +253,36 @@ int ByteExtractStringInt16(int16_t *res, int base, uint16_t len, const char *str
  */
 int ByteExtractStringInt8(int8_t *res, int base, uint16_t len, const char *str);
 
+/**
+ * Extractor for a fixed number of bytes, see ByteExtractGetFunc() and
+ * ByteExtractStringGetFunc(). The caller makes sure len bytes are
+ * available.
+ *
+ * \return n Number of bytes extracted on success
+ * \return -1 On error
+ */
+typedef int (*ByteExtractFunc)(uint64_t *res, uint16_t len, const uint8_t *bytes);
+
+/**
+ * Get the extractor for len (1-8) bytes of binary data.
+ *
+ * \param e endianness (BYTE_BIG_ENDIAN or BYTE_LITTLE_ENDIAN)
+ * \param len Number of bytes to extract
+ *
+ * \return extractor or NULL if e or len are not supported
+ */
+ByteExtractFunc ByteExtractGetFunc(int e, uint16_t len);
+
+/**
+ * Get the extractor for a string encoded value. It parses the number in
+ * place like strtoull() would, without copying it first.
+ *
+ * \param base Base of the number to extract: 0 (automatic), 8, 10 or 16
+ *
+ * \return extractor or NULL if the base is not supported
+ */
+ByteExtractFunc ByteExtractStringGetFunc(int base);
+
 #ifdef UNITTESTS
 void ByteRegisterTests(void);
 #endif /* UNITTESTS */
@@ -0,0 +1,286 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Scalar, SSE2, AVX2 and NEON implementations of the one's complement
+ * sum used by the TCP and UDP checksums.
+ *
+ * SSE2 and NEON are part of the x86_64 and aarch64 base instruction sets
+ * so they are selected at compile time. AVX2 is selected at runtime if
+ * the cpu supports it. In all cases the data is loaded as 32 bit words
+ * and added into 64 bit lanes, so no carries are lost.
+ */
+
+#include "suricata-common.h"
+#include "util-checksum-simd.h"
+#include "util-cpu.h"
+#include "util-unittest.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define CHECKSUM_HAVE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define CHECKSUM_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define CHECKSUM_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+static uint64_t ChecksumSumResolve(const uint8_t *buf, uint32_t len);
+
+/** set to the best implementation on first use */
+ChecksumSumFunc checksum_sum_func = ChecksumSumResolve;
+static const char *checksum_sum_name = "scalar";
+
+uint64_t ChecksumSumScalar(const uint8_t *buf, uint32_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        uint32_t w[4];
+        memcpy(w, buf, sizeof(w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        buf += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+        buf += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *buf;
+        sum += pad;
+    }
+    return sum;
+}
+
+#ifdef CHECKSUM_HAVE_SSE2
+static uint64_t ChecksumSumSSE2(const uint8_t *buf, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+
+    while (len >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)buf);
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+        buf += 32;
+        len -= 32;
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + ChecksumSumScalar(buf, len);
+}
+#endif /* CHECKSUM_HAVE_SSE2 */
+
+#ifdef CHECKSUM_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint64_t ChecksumSumAVX2(const uint8_t *buf, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero;
+    __m256i acc1 = zero;
+
+    while (len >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(buf + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+        buf += 64;
+        len -= 64;
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        ChecksumSumScalar(buf, len);
+}
+#endif /* CHECKSUM_HAVE_AVX2 */
+
+#ifdef CHECKSUM_HAVE_NEON
+static uint64_t ChecksumSumNEON(const uint8_t *buf, uint32_t len)
+{
+    uint64x2_t acc0 = vdupq_n_u64(0);
+    uint64x2_t acc1 = vdupq_n_u64(0);
+
+    while (len >= 32) {
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(buf)));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(buf + 16)));
+        buf += 32;
+        len -= 32;
+    }
+
+    uint64x2_t acc = vaddq_u64(acc0, acc1);
+    return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) +
+        ChecksumSumScalar(buf, len);
+}
+#endif /* CHECKSUM_HAVE_NEON */
+
+static void ChecksumSumSelect(void)
+{
+#ifdef CHECKSUM_HAVE_AVX2
+    if (UtilCpuHasAVX2()) {
+        checksum_sum_name = "avx2";
+        checksum_sum_func = ChecksumSumAVX2;
+        return;
+    }
+#endif
+#if defined(CHECKSUM_HAVE_SSE2)
+    checksum_sum_name = "sse2";
+    checksum_sum_func = ChecksumSumSSE2;
+#elif defined(CHECKSUM_HAVE_NEON)
+    checksum_sum_name = "neon";
+    checksum_sum_func = ChecksumSumNEON;
+#else
+    checksum_sum_name = "scalar";
+    checksum_sum_func = ChecksumSumScalar;
+#endif
+}
+
+/** \internal
+ *  \brief initial value of checksum_sum_func. Selecting is idempotent,
+ *         so threads racing through here is harmless. */
+static uint64_t ChecksumSumResolve(const uint8_t *buf, uint32_t len)
+{
+    ChecksumSumSelect();
+    return checksum_sum_func(buf, len);
+}
+
+/** \brief name of the implementation in use, for logging and benches */
+const char *ChecksumSumImplName(void)
+{
+    if (checksum_sum_func == ChecksumSumResolve)
+        ChecksumSumSelect();
+    return checksum_sum_name;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief reference sum, 16 bits at a time like the old code did */
+static uint32_t ChecksumRef(const uint8_t *buf, uint32_t len)
+{
+    uint32_t csum = 0;
+    while (len > 1) {
+        uint16_t w;
+        memcpy(&w, buf, sizeof(w));
+        csum += w;
+        buf += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *buf;
+        csum += pad;
+    }
+    while (csum >> 16)
+        csum = (csum & 0xffff) + (csum >> 16);
+    return csum;
+}
+
+/** \test all implementations agree with the reference for all lengths
+ *        and alignments */
+static int ChecksumSimdTest01(void)
+{
+    uint8_t *buf = SCMalloc(2048 + 16);
+    FAIL_IF_NULL(buf);
+
+    /* high bytes so the carries get exercised */
+    for (int i = 0; i < 2048 + 16; i++)
+        buf[i] = (uint8_t)(0xff - (i * 7) % 13);
+
+    for (uint32_t off = 0; off < 4; off++) {
+        for (uint32_t len = 0; len <= 2048; len++) {
+            const uint8_t *b = buf + off;
+            uint32_t ref = ChecksumRef(b, len);
+
+            FAIL_IF(ChecksumFold64(ChecksumSumScalar(b, len)) != ref);
+#ifdef CHECKSUM_HAVE_SSE2
+            FAIL_IF(ChecksumFold64(ChecksumSumSSE2(b, len)) != ref);
+#endif
+#ifdef CHECKSUM_HAVE_AVX2
+            if (UtilCpuHasAVX2()) {
+                FAIL_IF(ChecksumFold64(ChecksumSumAVX2(b, len)) != ref);
+            }
+#endif
+#ifdef CHECKSUM_HAVE_NEON
+            FAIL_IF(ChecksumFold64(ChecksumSumNEON(b, len)) != ref);
+#endif
+            /* only even offsets are valid for the uint16_t api */
+            if ((off & 1) == 0) {
+                uint32_t p = ChecksumPartial((const uint16_t *)b, len);
+                while (p >> 16)
+                    p = (p & 0xffff) + (p >> 16);
+                FAIL_IF(p != ref);
+            }
+        }
+    }
+
+    SCFree(buf);
+    PASS;
+}
+
+/** \test all 0xff, the worst case for carries, at the maximum ip
+ *        payload size */
+static int ChecksumSimdTest02(void)
+{
+    const uint32_t len = 65535;
+    uint8_t *buf = SCMalloc(len);
+    FAIL_IF_NULL(buf);
+    memset(buf, 0xff, len);
+
+    uint32_t ref = ChecksumRef(buf, len);
+    FAIL_IF(ChecksumFold64(checksum_sum_func(buf, len)) != ref);
+    FAIL_IF(ChecksumFold64(ChecksumSumScalar(buf, len)) != ref);
+
+    SCFree(buf);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void ChecksumSimdRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumSimdTest01", ChecksumSimdTest01);
+    UtRegisterTest("ChecksumSimdTest02", ChecksumSimdTest02);
+#endif /* UNITTESTS */
+}
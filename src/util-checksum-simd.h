@@ -0,0 +1,81 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * One's complement sum over packet payloads for the TCP and UDP
+ * checksums.
+ *
+ * The one's complement sum doesn't depend on byte order (RFC 1071), so
+ * the data is summed as 32 bit words into 64 bit accumulators and only
+ * folded back to 16 bits at the end. Buffers of CHECKSUM_VECTOR_MIN_LEN
+ * and up go through a vector implementation selected at runtime.
+ */
+
+#ifndef __UTIL_CHECKSUM_SIMD_H__
+#define __UTIL_CHECKSUM_SIMD_H__
+
+/** below this the call overhead is larger than the gain */
+#define CHECKSUM_VECTOR_MIN_LEN 64
+
+typedef uint64_t (*ChecksumSumFunc)(const uint8_t *buf, uint32_t len);
+
+extern ChecksumSumFunc checksum_sum_func;
+
+uint64_t ChecksumSumScalar(const uint8_t *buf, uint32_t len);
+const char *ChecksumSumImplName(void);
+void ChecksumSimdRegisterTests(void);
+
+/** \brief fold a 64 bit sum to 16 bits with end around carry */
+static inline uint32_t ChecksumFold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint32_t)sum;
+}
+
+/**
+ * \brief one's complement sum of a buffer of 'len' bytes
+ *
+ * An odd trailing byte is padded with a zero byte.
+ *
+ * \retval sum folded to at most 0xffff, so it can be added to a 32 bit
+ *         running sum
+ */
+static inline uint32_t ChecksumPartial(const uint16_t *pkt, uint32_t len)
+{
+    if (len >= CHECKSUM_VECTOR_MIN_LEN)
+        return ChecksumFold64(checksum_sum_func((const uint8_t *)pkt, len));
+
+    uint32_t csum = 0;
+    while (len > 1) {
+        csum += *pkt++;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = (*(const uint8_t *)pkt);
+        csum += pad;
+    }
+    return csum;
+}
+
+#endif /* __UTIL_CHECKSUM_SIMD_H__ */
@@ -222,3 +222,53 @@ uint64_t UtilCpuGetTicks(void)
 #endif
     return val;
 }
+
+/**
+ * \brief Check if the cpu we're running on supports AVX2, for selecting
+ *        vector code paths at runtime.
+ *
+ * \retval 1 supported
+ * \retval 0 not supported or unknown
+ */
+int UtilCpuHasAVX2(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64) || defined(_X86_64_) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief Check if the cpu we're running on supports SSE4.2, which has the
+ *        CRC32C instruction.
+ *
+ * \retval 1 supported
+ * \retval 0 not supported or unknown
+ */
+int UtilCpuHasSSE42(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64) || defined(_X86_64_) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief Check if the cpu we're running on has the POPCNT instruction.
+ *
+ * \retval 1 supported
+ * \retval 0 not supported or unknown
+ */
+int UtilCpuHasPOPCNT(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64) || defined(_X86_64_) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt") ? 1 : 0;
+#else
+    return 0;
+#endif
+}
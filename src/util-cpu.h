@@ -36,4 +36,8 @@ void UtilCpuPrintSummary(void);
 
 uint64_t UtilCpuGetTicks(void);
 
+int UtilCpuHasAVX2(void);
+int UtilCpuHasSSE42(void);
+int UtilCpuHasPOPCNT(void);
+
 #endif /* __UTIL_CPU_H__ */
@@ -31,6 +31,10 @@
 #include "util-memcmp.h"
 #include "util-print.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Character constants */
 #ifndef CR
 #define CR  13
@@ -79,7 +83,7 @@
 #define MAX_IP6_CHARS  39
 
 /* Globally hold configuration data */
-static MimeDecConfig mime_dec_config = { 1, 1, 1, 0, MAX_HEADER_VALUE };
+static MimeDecConfig mime_dec_config = { 1, 1, 1, 0, MAX_HEADER_VALUE, 0 };
 
 /* Mime Parser String translation */
 static const char *StateFlags[] = { "NONE",
@@ -672,6 +676,24 @@ static uint8_t * GetFullValue(DataValue *dv, uint32_t *len)
     return val;
 }
 
+/**
+ * \brief Case insensitive compare of two buffers of the same length
+ *
+ * \param s1 The first buffer
+ * \param s2 The second buffer
+ * \param n The number of bytes to compare
+ *
+ * \return 0 if equal, otherwise 1
+ */
+static inline int MemcmpNocase(const uint8_t *s1, const uint8_t *s2, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (u8_tolower(s1[i]) != u8_tolower(s2[i]))
+            return 1;
+    }
+    return 0;
+}
+
 /**
  * \brief Find a string while searching up to N characters within a source
  *        buffer
@@ -685,8 +707,68 @@ static uint8_t * GetFullValue(DataValue *dv, uint32_t *len)
  */
 static inline uint8_t * FindBuffer(const uint8_t *src, uint32_t len, const uint8_t *find, uint32_t find_len)
 {
+#ifdef __SSE2__
+    if (find_len == 0 || find_len > len)
+        return NULL;
+
+    /* compare 16 candidate start positions at a time against both cases
+     * of the first byte, only verify the rest where that matched */
+    const __m128i lo = _mm_set1_epi8((char)u8_tolower(find[0]));
+    const __m128i up = _mm_set1_epi8((char)toupper(find[0]));
+    const uint32_t starts = len - find_len + 1;
+    uint32_t i = 0;
+    for ( ; i + 16 <= starts; i += 16) {
+        const __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(b, lo), _mm_cmpeq_epi8(b, up)));
+        while (mask != 0) {
+            const uint32_t j = i + __builtin_ctz(mask);
+            if (MemcmpNocase(src + j + 1, find + 1, find_len - 1) == 0)
+                return (uint8_t *)src + j;
+            mask &= mask - 1;
+        }
+    }
+    for ( ; i < starts; i++) {
+        if (u8_tolower(src[i]) == u8_tolower(find[0]) &&
+                MemcmpNocase(src + i + 1, find + 1, find_len - 1) == 0)
+            return (uint8_t *)src + i;
+    }
+    return NULL;
+#else
     /* Use utility search function */
     return BasicSearchNocase(src, len, find, find_len);
+#endif
+}
+
+/**
+ * \brief Find the first line delimiter (CR or LF) or null byte in a buffer
+ *
+ * \param buf The input buffer
+ * \param len The length of the input buffer
+ *
+ * \return Offset of the delimiter, or len if there is none
+ */
+static inline uint32_t FindLineDelim(const uint8_t *buf, uint32_t len)
+{
+    uint32_t i = 0;
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8(CR);
+    const __m128i lf = _mm_set1_epi8(LF);
+    const __m128i nul = _mm_setzero_si128();
+    for ( ; i + 16 <= len; i += 16) {
+        const __m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, cr),
+                        _mm_cmpeq_epi8(b, lf)), _mm_cmpeq_epi8(b, nul)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for ( ; i < len; i++) {
+        if (buf[i] == CR || buf[i] == LF || buf[i] == 0)
+            break;
+    }
+    return i;
 }
 
 /**
@@ -717,23 +799,19 @@ static uint8_t * GetLine(uint8_t *buf, uint32_t blen, uint8_t **remainPtr,
     tok = buf;
 
     /* length must be specified */
-    for (i = 0; i < blen && buf[i] != 0; i++) {
+    i = FindLineDelim(buf, blen);
 
-        /* Found delimiter */
-        if (buf[i] == CR || buf[i] == LF) {
+    /* Found delimiter */
+    if (i < blen && buf[i] != 0) {
 
-            /* Add another if we find either CRLF or LFCR */
-            *remainPtr += (i + 1);
-            if ((i + 1 < blen) && buf[i] != buf[i + 1] &&
-                    (buf[i + 1] == CR || buf[i + 1] == LF)) {
-                (*remainPtr)++;
-            }
-            break;
+        /* Add another if we find either CRLF or LFCR */
+        *remainPtr += (i + 1);
+        if ((i + 1 < blen) && buf[i] != buf[i + 1] &&
+                (buf[i + 1] == CR || buf[i + 1] == LF)) {
+            (*remainPtr)++;
         }
-    }
-
-    /* If no delimiter found, then point to end of buffer */
-    if (buf == *remainPtr) {
+    } else {
+        /* If no delimiter found, then point to end of buffer */
         (*remainPtr) += i;
     }
 
@@ -1125,10 +1203,29 @@ static int ProcessDecodedDataChunk(const uint8_t *chunk, uint32_t len,
     int ret = MIME_DEC_OK;
     uint8_t *remainPtr, *tok;
     uint32_t tokLen;
+    MimeDecConfig *mdcfg = MimeDecGetConfig();
+
+    /* Enforce the per message output limit. Past it only the begin and
+     * end of a body are still passed on, without data, so the callback
+     * can open and close its files. */
+    if (mdcfg != NULL && mdcfg->decoded_limit > 0 &&
+            state->decoded_len + len > mdcfg->decoded_limit)
+    {
+        len = state->decoded_len < mdcfg->decoded_limit ?
+            (uint32_t)(mdcfg->decoded_limit - state->decoded_len) : 0;
+        if (state->stack != NULL && state->stack->top != NULL &&
+                state->stack->top->data != NULL) {
+            state->stack->top->data->anomaly_flags |= ANOM_DECODED_LIMIT;
+        }
+        state->msg->anomaly_flags |= ANOM_DECODED_LIMIT;
+        if (len == 0 && !state->body_begin && !state->body_end) {
+            goto end;
+        }
+    }
+    state->decoded_len += len;
 
     if ((state->stack != NULL) && (state->stack->top != NULL) &&
         (state->stack->top->data != NULL)) {
-        MimeDecConfig *mdcfg = MimeDecGetConfig();
         if (mdcfg != NULL && mdcfg->extract_urls) {
             MimeDecEntity *entity = (MimeDecEntity *) state->stack->top->data;
             /* If plain text or html, then look for URLs */
@@ -1185,6 +1282,7 @@ static int ProcessDecodedDataChunk(const uint8_t *chunk, uint32_t len,
         ret = MIME_DEC_ERR_DATA;
     }
 
+end:
     /* Reset data chunk buffer */
     state->data_chunk_len = 0;
 
@@ -2273,11 +2371,18 @@ static int ProcessMimeBody(const uint8_t *buf, uint32_t len,
                 return MIME_DEC_ERR_PARSE;
             }
 
-            memcpy(temp, "--", 2);
-            memcpy(temp + 2, node->bdef, node->bdef_len);
+            /* The line starts with "--", so a boundary is almost always
+             * right behind it. Only search the rest of the line if not. */
+            if (len >= tlen &&
+                    MemcmpNocase(buf + 2, node->bdef, node->bdef_len) == 0) {
+                bstart = (uint8_t *)buf;
+            } else {
+                memcpy(temp, "--", 2);
+                memcpy(temp + 2, node->bdef, node->bdef_len);
 
-            /* Find either next boundary or end boundary */
-            bstart = FindBuffer((const uint8_t *)buf, len, temp, tlen);
+                /* Find either next boundary or end boundary */
+                bstart = FindBuffer((const uint8_t *)buf, len, temp, tlen);
+            }
             if (bstart != NULL) {
                 ret = ProcessMimeBoundary(buf, len, node->bdef_len, state);
                 if (ret != MIME_DEC_OK) {
@@ -2972,6 +3077,41 @@ static int MimeBase64DecodeTest01(void)
     return ret;
 }
 
+static int TestDataChunkSumCallback(const uint8_t *chunk, uint32_t len,
+        MimeDecParseState *state)
+{
+    uint32_t *total = (uint32_t *) state->data;
+    *total += len;
+    return MIME_DEC_OK;
+}
+
+/* Test that the decoded body output stops at decoded_limit */
+static int MimeDecParseDecodedLimitTest01(void)
+{
+    uint32_t total = 0;
+
+    char msg[] = "From: Sender1\r\n"
+            "To: Recipient1\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Transfer-Encoding: base64\r\n"
+            "\r\n"
+            "YWJjZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXpBQkNERUZHSElKS0xNTk9Q\r\n"
+            "UVJTVFVWV1hZWjEyMzQ1Njc4OTBAIyQlXiYqKCktPV8rLC4vOydbXTw+\r\n";
+
+    MimeDecGetConfig()->decode_base64 = 1;
+    MimeDecGetConfig()->decoded_limit = 10;
+    MimeDecEntity *entity = MimeDecParseFullMsg((uint8_t *)msg, strlen(msg), &total,
+            TestDataChunkSumCallback);
+    MimeDecGetConfig()->decoded_limit = 0;
+
+    FAIL_IF_NULL(entity);
+    FAIL_IF_NOT(entity->anomaly_flags & ANOM_DECODED_LIMIT);
+    FAIL_IF_NOT(total == 10);
+
+    MimeDecFreeEntity(entity);
+    PASS;
+}
+
 static int MimeIsExeURLTest01(void)
 {
     int ret = 0;
@@ -3035,6 +3175,63 @@ static int MimeIsIpv6HostTest01(void)
 }
 #undef TEST
 
+/**
+ * \test Test the vector line and string scanning against the byte by byte
+ *       search, with matches and delimiters at every offset of a block.
+ */
+static int MimeFindBufferLineTest01(void)
+{
+    uint8_t buf[80];
+    const uint8_t *needle = (const uint8_t *)"--BoUnDaRy";
+    const uint32_t needle_len = strlen((const char *)needle);
+
+    for (uint32_t off = 0; off < sizeof(buf); off++) {
+        memset(buf, 'b', sizeof(buf));
+        if (off + needle_len <= sizeof(buf))
+            memcpy(buf + off, "--boundary", needle_len);
+        /* partial match just before it */
+        if (off >= 4)
+            memcpy(buf + off - 4, "--bo", 4);
+
+        for (uint32_t len = 0; len <= sizeof(buf); len++) {
+            FAIL_IF(FindBuffer(buf, len, needle, needle_len) !=
+                    BasicSearchNocase(buf, len, needle, needle_len));
+        }
+
+        memset(buf, 'a', sizeof(buf));
+        const uint8_t delims[] = { CR, LF, 0 };
+        for (uint32_t d = 0; d < sizeof(delims); d++) {
+            buf[off] = delims[d];
+            for (uint32_t len = 0; len <= sizeof(buf); len++) {
+                uint8_t *rem = NULL;
+                uint32_t tok_len = 0;
+                FAIL_IF(GetLine(buf, len, &rem, &tok_len) != buf);
+                FAIL_IF(tok_len != (off < len ? off : len));
+                if (off < len && delims[d] != 0)
+                    FAIL_IF(rem != buf + off + 1);
+                else
+                    FAIL_IF(rem != buf + tok_len);
+            }
+        }
+    }
+
+    /* CRLF and LFCR count as one delimiter, CRCR as two */
+    uint8_t *rem = NULL;
+    uint32_t tok_len = 0;
+    memcpy(buf, "0123456789abcdefghij\r\nx", 23);
+    FAIL_IF(GetLine(buf, 23, &rem, &tok_len) != buf);
+    FAIL_IF(tok_len != 20 || rem != buf + 22);
+    buf[20] = LF;
+    buf[21] = CR;
+    FAIL_IF(GetLine(buf, 23, &rem, &tok_len) != buf);
+    FAIL_IF(tok_len != 20 || rem != buf + 22);
+    buf[20] = CR;
+    FAIL_IF(GetLine(buf, 23, &rem, &tok_len) != buf);
+    FAIL_IF(tok_len != 20 || rem != buf + 21);
+
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void MimeDecRegisterTests(void)
@@ -3045,8 +3242,11 @@ void MimeDecRegisterTests(void)
     UtRegisterTest("MimeDecParseFullMsgTest01", MimeDecParseFullMsgTest01);
     UtRegisterTest("MimeDecParseFullMsgTest02", MimeDecParseFullMsgTest02);
     UtRegisterTest("MimeBase64DecodeTest01", MimeBase64DecodeTest01);
+    UtRegisterTest("MimeDecParseDecodedLimitTest01",
+            MimeDecParseDecodedLimitTest01);
     UtRegisterTest("MimeIsExeURLTest01", MimeIsExeURLTest01);
     UtRegisterTest("MimeIsIpv4HostTest01", MimeIsIpv4HostTest01);
     UtRegisterTest("MimeIsIpv6HostTest01", MimeIsIpv6HostTest01);
+    UtRegisterTest("MimeFindBufferLineTest01", MimeFindBufferLineTest01);
 #endif /* UNITTESTS */
 }
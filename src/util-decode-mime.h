@@ -60,6 +60,7 @@
 #define ANOM_LONG_ENC_LINE      32  /* Lines that exceed 76 octets */
 #define ANOM_MALFORMED_MSG      64  /* Misc msg format errors found */
 #define ANOM_LONG_BOUNDARY     128  /* Boundary too long */
+#define ANOM_DECODED_LIMIT     256  /* Body output exceeded decoded_limit */
 
 /* Publicly exposed size constants */
 #define DATA_CHUNK_SIZE  3072  /* Should be divisible by 3 */
@@ -98,6 +99,8 @@ typedef struct MimeDecConfig {
     int body_md5;  /**< Compute md5 sum of body */
     uint32_t header_value_depth;  /**< Depth of which to store header values
                                        (Default is 2000) */
+    uint32_t decoded_limit;  /**< Max decoded body bytes passed on per
+                                  message, 0 for no limit */
 } MimeDecConfig;
 
 /**
@@ -202,6 +205,7 @@ typedef struct MimeDecParseState {
 #endif
     uint8_t state_flag;  /**<  Flag representing current state of parser */
     uint32_t data_chunk_len;  /**< Length of data chunk */
+    uint64_t decoded_len;  /**< Decoded body bytes passed on so far */
     int found_child;  /**< Flag indicating a child entity was found */
     int body_begin;  /**< Currently at beginning of body */
     int body_end;  /**< Currently at end of body */
@@ -0,0 +1,55 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DPDK headers and compatibility between DPDK versions
+ */
+
+#ifndef __UTIL_DPDK_H__
+#define __UTIL_DPDK_H__
+
+#ifdef HAVE_DPDK
+
+#include <rte_eal.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_version.h>
+
+/* ethdev and mbuf flags got a RTE_ prefix in 21.11 */
+#ifndef RTE_ETH_RSS_IP
+#define RTE_ETH_RSS_IP                  ETH_RSS_IP
+#define RTE_ETH_MQ_RX_RSS               ETH_MQ_RX_RSS
+#define RTE_ETH_MQ_RX_NONE              ETH_MQ_RX_NONE
+#define RTE_ETH_RX_OFFLOAD_CHECKSUM     DEV_RX_OFFLOAD_CHECKSUM
+#endif
+
+#ifndef RTE_MBUF_F_RX_IP_CKSUM_MASK
+#define RTE_MBUF_F_RX_IP_CKSUM_MASK     PKT_RX_IP_CKSUM_MASK
+#define RTE_MBUF_F_RX_IP_CKSUM_GOOD     PKT_RX_IP_CKSUM_GOOD
+#define RTE_MBUF_F_RX_L4_CKSUM_MASK     PKT_RX_L4_CKSUM_MASK
+#define RTE_MBUF_F_RX_L4_CKSUM_GOOD     PKT_RX_L4_CKSUM_GOOD
+#endif
+
+#endif /* HAVE_DPDK */
+
+#endif /* __UTIL_DPDK_H__ */
@@ -0,0 +1,858 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Early packet filter, see util-early-filter.h.
+ *
+ * Supported primitives, combined with 'and', 'or', 'not' (or '&&', '||',
+ * '!') and parentheses:
+ *
+ *   [src|dst] host <ip>
+ *   [src|dst] net <ip>/<prefix>
+ *   [src|dst] port <port>
+ *   [src|dst] portrange <low>-<high>
+ *   tcp|udp|sctp|icmp|icmp6 [[src|dst] port|portrange ...]
+ *   proto <name or number>
+ *   ip|ip6
+ *   vlan [<id>]
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "conf.h"
+#include "conf-yaml-loader.h"
+#include "counters.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-early-filter.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+/** upper limits per rule, keeps the recursion in the evaluation bounded */
+#define EARLY_FILTER_MAX_NODES  256
+#define EARLY_FILTER_MAX_DEPTH  32
+
+enum EarlyFilterNodeType {
+    EF_NODE_AND = 0,
+    EF_NODE_OR,
+    EF_NODE_NOT,
+    EF_NODE_NET,
+    EF_NODE_PORT,
+    EF_NODE_PROTO,
+    EF_NODE_FAMILY,
+    EF_NODE_VLAN,
+};
+
+enum EarlyFilterDir {
+    EF_DIR_ANY = 0,
+    EF_DIR_SRC,
+    EF_DIR_DST,
+};
+
+typedef struct EarlyFilterNode_ {
+    uint8_t type;
+    uint8_t dir;
+    /** operands of and, or and not: indexes in EarlyFilterRule::nodes */
+    uint16_t left;
+    uint16_t right;
+    union {
+        struct {
+            uint8_t family;
+            /** network byte order, addr is already masked */
+            uint32_t addr[4];
+            uint32_t mask[4];
+        } net;
+        struct {
+            uint16_t lo;
+            uint16_t hi;
+        } port;
+        uint8_t proto;
+        uint8_t family;
+        struct {
+            bool any;
+            uint16_t id;
+        } vlan;
+    } v;
+} EarlyFilterNode;
+
+typedef struct EarlyFilterRule_ {
+    char *name;
+    /** "early_filter.<name>", the stats api keeps the pointer */
+    char *counter_name;
+    uint8_t action;
+    uint16_t root;
+    uint16_t nnodes;
+    EarlyFilterNode *nodes;
+} EarlyFilterRule;
+
+typedef struct EarlyFilterParser_ {
+    const char *str;
+    const char *pos;
+    /** current token, not consumed yet. Empty at the end. */
+    char tok[64];
+    int depth;
+    uint16_t nnodes;
+    EarlyFilterNode *nodes;
+} EarlyFilterParser;
+
+int g_early_filter_enabled = 0;
+
+static EarlyFilterRule *early_filter_rules = NULL;
+static uint16_t early_filter_rules_cnt = 0;
+
+static int EarlyFilterParseOr(EarlyFilterParser *ep);
+
+/** \internal
+ *  \brief read the next token into EarlyFilterParser::tok
+ *  \retval 0 ok, -1 token too long */
+static int EarlyFilterNext(EarlyFilterParser *ep)
+{
+    const char *s = ep->pos;
+    while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+        s++;
+
+    size_t len = 0;
+    if (*s == '(' || *s == ')' || *s == '!') {
+        len = 1;
+    } else if ((s[0] == '&' && s[1] == '&') || (s[0] == '|' && s[1] == '|')) {
+        len = 2;
+    } else {
+        while (s[len] != '\0' && strchr(" \t\r\n()!&|", s[len]) == NULL)
+            len++;
+        /* a lone '&' or '|' */
+        if (len == 0 && *s != '\0')
+            len = 1;
+    }
+    if (len >= sizeof(ep->tok)) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: token "
+                "too long in \"%s\"", ep->str);
+        return -1;
+    }
+    memcpy(ep->tok, s, len);
+    ep->tok[len] = '\0';
+    ep->pos = s + len;
+    return 0;
+}
+
+static bool EarlyFilterIs(const EarlyFilterParser *ep, const char *a,
+        const char *b)
+{
+    return strcmp(ep->tok, a) == 0 || (b != NULL && strcmp(ep->tok, b) == 0);
+}
+
+static int EarlyFilterUnexpected(const EarlyFilterParser *ep)
+{
+    if (ep->tok[0] == '\0') {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: unexpected "
+                "end of \"%s\"", ep->str);
+    } else {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: unexpected "
+                "\"%s\" in \"%s\"", ep->tok, ep->str);
+    }
+    return -1;
+}
+
+/** \internal
+ *  \retval idx index of the new node or -1 if the rule is too large */
+static int EarlyFilterNewNode(EarlyFilterParser *ep, uint8_t type)
+{
+    if (ep->nnodes >= EARLY_FILTER_MAX_NODES) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: \"%s\" "
+                "is too complex", ep->str);
+        return -1;
+    }
+    EarlyFilterNode *n = &ep->nodes[ep->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    return ep->nnodes++;
+}
+
+static int EarlyFilterNewOp(EarlyFilterParser *ep, uint8_t type,
+        int left, int right)
+{
+    int idx = EarlyFilterNewNode(ep, type);
+    if (idx < 0)
+        return -1;
+    ep->nodes[idx].left = (uint16_t)left;
+    ep->nodes[idx].right = (uint16_t)right;
+    return idx;
+}
+
+static int EarlyFilterParseUint16(const char *str, uint16_t *res)
+{
+    size_t len = strlen(str);
+    if (len == 0 || len > 5 ||
+            ByteExtractStringUint16(res, 10, len, str) != (int)len)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief parse an address with an optional prefix length
+ *  \param allow_prefix 0 for 'host', 1 for 'net' */
+static int EarlyFilterParseNet(EarlyFilterParser *ep, EarlyFilterNode *n,
+        int allow_prefix)
+{
+    char buf[sizeof(ep->tok)];
+    strlcpy(buf, ep->tok, sizeof(buf));
+
+    char *slash = strchr(buf, '/');
+    if (slash != NULL) {
+        if (!allow_prefix)
+            return EarlyFilterUnexpected(ep);
+        *slash = '\0';
+    }
+
+    int maxbits;
+    if (inet_pton(AF_INET, buf, n->v.net.addr) == 1) {
+        n->v.net.family = AF_INET;
+        maxbits = 32;
+    } else if (inet_pton(AF_INET6, buf, n->v.net.addr) == 1) {
+        n->v.net.family = AF_INET6;
+        maxbits = 128;
+    } else {
+        return EarlyFilterUnexpected(ep);
+    }
+
+    uint16_t bits = maxbits;
+    if (slash != NULL) {
+        if (EarlyFilterParseUint16(slash + 1, &bits) < 0 || bits > maxbits)
+            return EarlyFilterUnexpected(ep);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int b = (int)bits - i * 32;
+        if (b >= 32)
+            n->v.net.mask[i] = 0xffffffff;
+        else if (b <= 0)
+            n->v.net.mask[i] = 0;
+        else
+            n->v.net.mask[i] = htonl(0xffffffffU << (32 - b));
+        n->v.net.addr[i] &= n->v.net.mask[i];
+    }
+    return 0;
+}
+
+static int EarlyFilterParseProtoName(const char *name, uint8_t *proto)
+{
+    if (strcmp(name, "tcp") == 0)
+        *proto = IPPROTO_TCP;
+    else if (strcmp(name, "udp") == 0)
+        *proto = IPPROTO_UDP;
+    else if (strcmp(name, "sctp") == 0)
+        *proto = IPPROTO_SCTP;
+    else if (strcmp(name, "icmp") == 0)
+        *proto = IPPROTO_ICMP;
+    else if (strcmp(name, "icmp6") == 0)
+        *proto = IPPROTO_ICMPV6;
+    else
+        return -1;
+    return 0;
+}
+
+static int EarlyFilterParsePrimitive(EarlyFilterParser *ep)
+{
+    uint8_t dir = EF_DIR_ANY;
+    if (EarlyFilterIs(ep, "src", NULL)) {
+        dir = EF_DIR_SRC;
+    } else if (EarlyFilterIs(ep, "dst", NULL)) {
+        dir = EF_DIR_DST;
+    }
+    if (dir != EF_DIR_ANY && EarlyFilterNext(ep) < 0)
+        return -1;
+
+    int idx;
+    if (EarlyFilterIs(ep, "host", "net")) {
+        const int is_net = EarlyFilterIs(ep, "net", NULL);
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_NET)) < 0)
+            return -1;
+        if (EarlyFilterParseNet(ep, &ep->nodes[idx], is_net) < 0)
+            return -1;
+
+    } else if (EarlyFilterIs(ep, "port", "portrange")) {
+        const int is_range = EarlyFilterIs(ep, "portrange", NULL);
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_PORT)) < 0)
+            return -1;
+        EarlyFilterNode *n = &ep->nodes[idx];
+
+        char buf[sizeof(ep->tok)];
+        strlcpy(buf, ep->tok, sizeof(buf));
+        char *dash = is_range ? strchr(buf, '-') : NULL;
+        if (is_range && dash == NULL)
+            return EarlyFilterUnexpected(ep);
+        if (dash != NULL)
+            *dash = '\0';
+        if (EarlyFilterParseUint16(buf, &n->v.port.lo) < 0)
+            return EarlyFilterUnexpected(ep);
+        n->v.port.hi = n->v.port.lo;
+        if (dash != NULL) {
+            if (EarlyFilterParseUint16(dash + 1, &n->v.port.hi) < 0 ||
+                    n->v.port.hi < n->v.port.lo)
+                return EarlyFilterUnexpected(ep);
+        }
+
+    } else if (dir != EF_DIR_ANY) {
+        /* direction only applies to the above */
+        return EarlyFilterUnexpected(ep);
+
+    } else if (EarlyFilterIs(ep, "proto", NULL)) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_PROTO)) < 0)
+            return -1;
+        uint16_t proto;
+        if (EarlyFilterParseProtoName(ep->tok, &ep->nodes[idx].v.proto) == 0) {
+            /* done */
+        } else if (EarlyFilterParseUint16(ep->tok, &proto) == 0 && proto <= 255) {
+            ep->nodes[idx].v.proto = (uint8_t)proto;
+        } else {
+            return EarlyFilterUnexpected(ep);
+        }
+
+    } else if (EarlyFilterIs(ep, "ip", "ip6")) {
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_FAMILY)) < 0)
+            return -1;
+        ep->nodes[idx].v.family = EarlyFilterIs(ep, "ip", NULL) ? AF_INET : AF_INET6;
+
+    } else if (EarlyFilterIs(ep, "vlan", NULL)) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_VLAN)) < 0)
+            return -1;
+        EarlyFilterNode *n = &ep->nodes[idx];
+        if (isdigit((unsigned char)ep->tok[0])) {
+            if (EarlyFilterParseUint16(ep->tok, &n->v.vlan.id) < 0 ||
+                    n->v.vlan.id > 4095)
+                return EarlyFilterUnexpected(ep);
+        } else {
+            /* no id, the token is not ours */
+            n->v.vlan.any = true;
+            return idx;
+        }
+
+    } else {
+        uint8_t proto;
+        if (EarlyFilterParseProtoName(ep->tok, &proto) < 0)
+            return EarlyFilterUnexpected(ep);
+        if ((idx = EarlyFilterNewNode(ep, EF_NODE_PROTO)) < 0)
+            return -1;
+        ep->nodes[idx].v.proto = proto;
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+
+        /* 'tcp port 80' is 'tcp and port 80' */
+        if (EarlyFilterIs(ep, "src", "dst") || EarlyFilterIs(ep, "port", "portrange")) {
+            int port = EarlyFilterParsePrimitive(ep);
+            if (port < 0)
+                return -1;
+            return EarlyFilterNewOp(ep, EF_NODE_AND, idx, port);
+        }
+        return idx;
+    }
+
+    ep->nodes[idx].dir = dir;
+    if (EarlyFilterNext(ep) < 0)
+        return -1;
+    return idx;
+}
+
+static int EarlyFilterParseNot(EarlyFilterParser *ep)
+{
+    if (++ep->depth > EARLY_FILTER_MAX_DEPTH) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: \"%s\" "
+                "is nested too deep", ep->str);
+        return -1;
+    }
+
+    int idx;
+    if (EarlyFilterIs(ep, "not", "!")) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        int child = EarlyFilterParseNot(ep);
+        if (child < 0)
+            return -1;
+        idx = EarlyFilterNewOp(ep, EF_NODE_NOT, child, child);
+    } else if (EarlyFilterIs(ep, "(", NULL)) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        idx = EarlyFilterParseOr(ep);
+        if (idx < 0)
+            return -1;
+        if (!EarlyFilterIs(ep, ")", NULL))
+            return EarlyFilterUnexpected(ep);
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+    } else {
+        idx = EarlyFilterParsePrimitive(ep);
+    }
+
+    ep->depth--;
+    return idx;
+}
+
+static int EarlyFilterParseAnd(EarlyFilterParser *ep)
+{
+    int left = EarlyFilterParseNot(ep);
+    while (left >= 0 && EarlyFilterIs(ep, "and", "&&")) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        int right = EarlyFilterParseNot(ep);
+        if (right < 0)
+            return -1;
+        left = EarlyFilterNewOp(ep, EF_NODE_AND, left, right);
+    }
+    return left;
+}
+
+static int EarlyFilterParseOr(EarlyFilterParser *ep)
+{
+    int left = EarlyFilterParseAnd(ep);
+    while (left >= 0 && EarlyFilterIs(ep, "or", "||")) {
+        if (EarlyFilterNext(ep) < 0)
+            return -1;
+        int right = EarlyFilterParseAnd(ep);
+        if (right < 0)
+            return -1;
+        left = EarlyFilterNewOp(ep, EF_NODE_OR, left, right);
+    }
+    return left;
+}
+
+/** \internal
+ *  \brief compile 'str' into the nodes of 'r'
+ *  \retval 0 ok, -1 error */
+static int EarlyFilterCompile(EarlyFilterRule *r, const char *str)
+{
+    EarlyFilterParser ep;
+    memset(&ep, 0, sizeof(ep));
+    ep.str = str;
+    ep.pos = str;
+    ep.nodes = SCCalloc(EARLY_FILTER_MAX_NODES, sizeof(EarlyFilterNode));
+    if (ep.nodes == NULL)
+        return -1;
+
+    int root = -1;
+    if (EarlyFilterNext(&ep) == 0)
+        root = EarlyFilterParseOr(&ep);
+    if (root >= 0 && ep.tok[0] != '\0')
+        root = EarlyFilterUnexpected(&ep);
+    if (root < 0) {
+        SCFree(ep.nodes);
+        return -1;
+    }
+
+    /* shrink to what is used */
+    r->nodes = SCMalloc(ep.nnodes * sizeof(EarlyFilterNode));
+    if (r->nodes == NULL) {
+        SCFree(ep.nodes);
+        return -1;
+    }
+    memcpy(r->nodes, ep.nodes, ep.nnodes * sizeof(EarlyFilterNode));
+    r->nnodes = ep.nnodes;
+    r->root = (uint16_t)root;
+    SCFree(ep.nodes);
+    return 0;
+}
+
+static bool EarlyFilterMatchAddr(const EarlyFilterNode *n, const Address *a)
+{
+    if (a->family != n->v.net.family)
+        return false;
+    if (n->v.net.family == AF_INET)
+        return (a->addr_data32[0] & n->v.net.mask[0]) == n->v.net.addr[0];
+    for (int i = 0; i < 4; i++) {
+        if ((a->addr_data32[i] & n->v.net.mask[i]) != n->v.net.addr[i])
+            return false;
+    }
+    return true;
+}
+
+static bool EarlyFilterEval(const EarlyFilterRule *r, uint16_t idx,
+        const Packet *p)
+{
+    const EarlyFilterNode *n = &r->nodes[idx];
+
+    switch (n->type) {
+        case EF_NODE_AND:
+            return EarlyFilterEval(r, n->left, p) && EarlyFilterEval(r, n->right, p);
+        case EF_NODE_OR:
+            return EarlyFilterEval(r, n->left, p) || EarlyFilterEval(r, n->right, p);
+        case EF_NODE_NOT:
+            return !EarlyFilterEval(r, n->left, p);
+        case EF_NODE_NET:
+            if (n->dir == EF_DIR_SRC)
+                return EarlyFilterMatchAddr(n, &p->src);
+            if (n->dir == EF_DIR_DST)
+                return EarlyFilterMatchAddr(n, &p->dst);
+            return EarlyFilterMatchAddr(n, &p->src) || EarlyFilterMatchAddr(n, &p->dst);
+        case EF_NODE_PORT:
+            if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p) || p->sctph != NULL))
+                return false;
+            if (n->dir != EF_DIR_DST &&
+                    p->sp >= n->v.port.lo && p->sp <= n->v.port.hi)
+                return true;
+            if (n->dir != EF_DIR_SRC &&
+                    p->dp >= n->v.port.lo && p->dp <= n->v.port.hi)
+                return true;
+            return false;
+        case EF_NODE_PROTO:
+            return (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)) && p->proto == n->v.proto;
+        case EF_NODE_FAMILY:
+            return n->v.family == AF_INET ? PKT_IS_IPV4(p) : PKT_IS_IPV6(p);
+        case EF_NODE_VLAN:
+            if (n->v.vlan.any)
+                return p->vlan_idx > 0;
+            for (uint8_t i = 0; i < p->vlan_idx; i++) {
+                if (p->vlan_id[i] == n->v.vlan.id)
+                    return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+static int EarlyFilterParseAction(const char *str, uint8_t *action)
+{
+    if (strcmp(str, "bypass") == 0)
+        *action = EARLY_FILTER_BYPASS;
+    else if (strcmp(str, "drop") == 0)
+        *action = EARLY_FILTER_DROP;
+    else if (strcmp(str, "no-stream") == 0)
+        *action = EARLY_FILTER_NO_STREAM;
+    else if (strcmp(str, "no-detect") == 0)
+        *action = EARLY_FILTER_NO_DETECT;
+    else
+        return -1;
+    return 0;
+}
+
+static void EarlyFilterRuleFree(EarlyFilterRule *r)
+{
+    if (r->name != NULL)
+        SCFree(r->name);
+    if (r->counter_name != NULL)
+        SCFree(r->counter_name);
+    if (r->nodes != NULL)
+        SCFree(r->nodes);
+    memset(r, 0, sizeof(*r));
+}
+
+/** \internal
+ *  \brief add a rule to the list
+ *  \retval 0 ok, -1 error, the rule is not added */
+static int EarlyFilterAddRule(const char *name, const char *filter,
+        const char *action)
+{
+    EarlyFilterRule r;
+    memset(&r, 0, sizeof(r));
+
+    if (EarlyFilterParseAction(action, &r.action) < 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: rule \"%s\" "
+                "has invalid action \"%s\"", name, action);
+        return -1;
+    }
+    if (EarlyFilterCompile(&r, filter) < 0) {
+        return -1;
+    }
+
+    r.name = SCStrdup(name);
+    size_t len = strlen("early_filter.") + strlen(name) + 1;
+    r.counter_name = SCMalloc(len);
+    if (r.name == NULL || r.counter_name == NULL) {
+        EarlyFilterRuleFree(&r);
+        return -1;
+    }
+    snprintf(r.counter_name, len, "early_filter.%s", name);
+
+    EarlyFilterRule *rules = SCRealloc(early_filter_rules,
+            (early_filter_rules_cnt + 1) * sizeof(EarlyFilterRule));
+    if (rules == NULL) {
+        EarlyFilterRuleFree(&r);
+        return -1;
+    }
+    early_filter_rules = rules;
+    early_filter_rules[early_filter_rules_cnt++] = r;
+    return 0;
+}
+
+void EarlyFilterInitConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("early-filter.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    ConfNode *rules = ConfGetNode("early-filter.rules");
+    if (rules == NULL) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter is enabled "
+                "but has no rules");
+        return;
+    }
+
+    ConfNode *rule;
+    TAILQ_FOREACH(rule, &rules->head, next) {
+        const char *name = ConfNodeLookupChildValue(rule, "name");
+        const char *filter = ConfNodeLookupChildValue(rule, "filter");
+        const char *action = ConfNodeLookupChildValue(rule, "action");
+        if (name == NULL || filter == NULL || action == NULL) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: rules "
+                    "need a name, a filter and an action, skipping");
+            continue;
+        }
+        if (early_filter_rules_cnt == UINT16_MAX ||
+                EarlyFilterAddRule(name, filter, action) < 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "early-filter: skipping "
+                    "rule \"%s\"", name);
+            continue;
+        }
+        SCLogConfig("early-filter: rule \"%s\": %s -> %s", name, filter, action);
+    }
+
+    g_early_filter_enabled = (early_filter_rules_cnt > 0);
+}
+
+void EarlyFilterDestroy(void)
+{
+    for (uint16_t i = 0; i < early_filter_rules_cnt; i++) {
+        EarlyFilterRuleFree(&early_filter_rules[i]);
+    }
+    if (early_filter_rules != NULL)
+        SCFree(early_filter_rules);
+    early_filter_rules = NULL;
+    early_filter_rules_cnt = 0;
+    g_early_filter_enabled = 0;
+}
+
+void EarlyFilterRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    if (early_filter_rules_cnt == 0)
+        return;
+
+    dtv->counter_early_filter = SCCalloc(early_filter_rules_cnt, sizeof(uint16_t));
+    if (dtv->counter_early_filter == NULL)
+        return;
+    for (uint16_t i = 0; i < early_filter_rules_cnt; i++) {
+        dtv->counter_early_filter[i] =
+            StatsRegisterCounter(early_filter_rules[i].counter_name, tv);
+    }
+}
+
+/**
+ * \brief run the rules on a decoded packet and apply the action of the
+ *        first one that matches
+ */
+void EarlyFilterPacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
+{
+    for (uint16_t i = 0; i < early_filter_rules_cnt; i++) {
+        const EarlyFilterRule *r = &early_filter_rules[i];
+        if (!EarlyFilterEval(r, r->root, p))
+            continue;
+
+        SCLogDebug("packet %"PRIu64" matches early-filter rule %s",
+                p->pcap_cnt, r->name);
+        if (dtv->counter_early_filter != NULL)
+            StatsIncr(tv, dtv->counter_early_filter[i]);
+
+        p->early_filter = r->action;
+        switch (r->action) {
+            case EARLY_FILTER_DROP:
+                PACKET_DROP(p);
+                break;
+            case EARLY_FILTER_NO_DETECT:
+                DecodeSetNoPacketInspectionFlag(p);
+                DecodeSetNoPayloadInspectionFlag(p);
+                break;
+        }
+        return;
+    }
+}
+
+#ifdef UNITTESTS
+
+static int EarlyFilterTestMatch(const char *filter, Packet *p)
+{
+    EarlyFilterRule r;
+    memset(&r, 0, sizeof(r));
+    if (EarlyFilterCompile(&r, filter) < 0)
+        return -1;
+    int ret = EarlyFilterEval(&r, r.root, p) ? 1 : 0;
+    EarlyFilterRuleFree(&r);
+    return ret;
+}
+
+/** \test parsing of valid and invalid expressions */
+static int EarlyFilterTest01(void)
+{
+    static const char *good[] = {
+        "host 10.0.0.1",
+        "src net 10.0.0.0/8 and dst port 873",
+        "tcp port 80 or udp dst portrange 53-54",
+        "not (net 2001:db8::/32 || vlan 10) && !icmp",
+        "proto 47",
+        "ip6 and vlan",
+        "((((tcp))))",
+    };
+    static const char *bad[] = {
+        "",
+        "host",
+        "host 10.0.0.0/8",
+        "net 10.0.0.0/33",
+        "port 65536",
+        "portrange 80",
+        "portrange 90-80",
+        "src tcp",
+        "tcp and",
+        "(tcp",
+        "tcp)",
+        "vlan 4096",
+        "proto 256",
+        "foo",
+        "tcp & udp",
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        EarlyFilterRule r;
+        memset(&r, 0, sizeof(r));
+        FAIL_IF(EarlyFilterCompile(&r, good[i]) != 0);
+        EarlyFilterRuleFree(&r);
+    }
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        EarlyFilterRule r;
+        memset(&r, 0, sizeof(r));
+        FAIL_IF(EarlyFilterCompile(&r, bad[i]) == 0);
+    }
+
+    /* nesting is limited */
+    char deep[EARLY_FILTER_MAX_DEPTH * 2 + 8];
+    memset(deep, '(', EARLY_FILTER_MAX_DEPTH + 1);
+    strlcpy(deep + EARLY_FILTER_MAX_DEPTH + 1, "tcp", 4);
+    memset(deep + EARLY_FILTER_MAX_DEPTH + 4, ')', EARLY_FILTER_MAX_DEPTH + 1);
+    deep[2 * EARLY_FILTER_MAX_DEPTH + 5] = '\0';
+    FAIL_IF(EarlyFilterTestMatch(deep, NULL) != -1);
+    PASS;
+}
+
+/** \test matching */
+static int EarlyFilterTest02(void)
+{
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+            "10.1.2.3", "192.168.0.1", 41424, 873);
+    FAIL_IF_NULL(p);
+
+    FAIL_IF(EarlyFilterTestMatch("host 10.1.2.3", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("dst host 10.1.2.3", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("src net 10.0.0.0/8", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("net 10.1.2.3/16", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("net 10.2.0.0/16", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("net 2001:db8::/32", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("tcp dst port 873", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("udp port 873", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("src port 873", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("portrange 40000-50000", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("ip and not ip6", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("proto 6 and net 0.0.0.0/0", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("vlan", p) != 0);
+    FAIL_IF(EarlyFilterTestMatch("icmp or host 1.1.1.1 or dst net 192.168.0.0/24", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("not tcp or host 1.1.1.1", p) != 0);
+
+    p->vlan_id[0] = 10;
+    p->vlan_idx = 1;
+    FAIL_IF(EarlyFilterTestMatch("vlan 10 and tcp", p) != 1);
+    FAIL_IF(EarlyFilterTestMatch("vlan 11", p) != 0);
+
+    UTHFreePacket(p);
+    PASS;
+}
+
+/** \test config loading and actions */
+static int EarlyFilterTest03(void)
+{
+    const char conf[] = "\
+%YAML 1.1\n\
+---\n\
+early-filter:\n\
+  enabled: yes\n\
+  rules:\n\
+    - name: backup\n\
+      filter: \"tcp port 873\"\n\
+      action: bypass\n\
+    - name: broken\n\
+      filter: \"tcp port\"\n\
+      action: drop\n\
+    - name: dns\n\
+      filter: \"udp port 53\"\n\
+      action: drop\n\
+    - name: bogus-action\n\
+      filter: \"udp\"\n\
+      action: pass\n\
+";
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(conf, strlen(conf));
+
+    EarlyFilterInitConfig();
+    FAIL_IF_NOT(g_early_filter_enabled);
+    FAIL_IF(early_filter_rules_cnt != 2);
+
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+            "10.1.2.3", "192.168.0.1", 41424, 873);
+    FAIL_IF_NULL(p1);
+    EarlyFilterPacket(NULL, &dtv, p1);
+    FAIL_IF(p1->early_filter != EARLY_FILTER_BYPASS);
+    FAIL_IF_NOT(EARLY_FILTER_SKIP_PIPELINE(p1));
+    FAIL_IF(PACKET_TEST_ACTION(p1, ACTION_DROP));
+
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP,
+            "10.1.2.3", "192.168.0.1", 41424, 53);
+    FAIL_IF_NULL(p2);
+    EarlyFilterPacket(NULL, &dtv, p2);
+    FAIL_IF(p2->early_filter != EARLY_FILTER_DROP);
+    FAIL_IF_NOT(PACKET_TEST_ACTION(p2, ACTION_DROP));
+
+    Packet *p3 = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP,
+            "10.1.2.3", "192.168.0.1", 41424, 54);
+    FAIL_IF_NULL(p3);
+    EarlyFilterPacket(NULL, &dtv, p3);
+    FAIL_IF(p3->early_filter != EARLY_FILTER_NONE);
+    FAIL_IF(EARLY_FILTER_SKIP_PIPELINE(p3));
+
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+    UTHFreePacket(p3);
+    EarlyFilterDestroy();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void EarlyFilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("EarlyFilterTest01", EarlyFilterTest01);
+    UtRegisterTest("EarlyFilterTest02", EarlyFilterTest02);
+    UtRegisterTest("EarlyFilterTest03", EarlyFilterTest03);
+#endif /* UNITTESTS */
+}
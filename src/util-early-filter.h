@@ -0,0 +1,60 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Early packet filter.
+ *
+ * Runs at the end of decoding, before the flow worker. The rules from the
+ * 'early-filter' section use a small BPF like language over addresses,
+ * ports, protocol and vlan id, compiled to an expression tree per rule.
+ * The first rule that matches decides what happens to the packet.
+ */
+
+#ifndef __UTIL_EARLY_FILTER_H__
+#define __UTIL_EARLY_FILTER_H__
+
+#include "decode.h"
+
+/** values of Packet::early_filter */
+enum EarlyFilterAction {
+    EARLY_FILTER_NONE = 0,
+    /** skip flow, stream, detect and output, pass the packet */
+    EARLY_FILTER_BYPASS,
+    /** skip flow, stream, detect and output, drop the packet */
+    EARLY_FILTER_DROP,
+    /** no stream or app layer for the packet */
+    EARLY_FILTER_NO_STREAM,
+    /** no detection on the packet */
+    EARLY_FILTER_NO_DETECT,
+};
+
+extern int g_early_filter_enabled;
+
+void EarlyFilterInitConfig(void);
+void EarlyFilterDestroy(void);
+void EarlyFilterRegisterCounters(ThreadVars *tv, DecodeThreadVars *dtv);
+void EarlyFilterPacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p);
+void EarlyFilterRegisterTests(void);
+
+/** \brief skip the flow worker completely for this packet */
+#define EARLY_FILTER_SKIP_PIPELINE(p) \
+    ((p)->early_filter == EARLY_FILTER_BYPASS || \
+     (p)->early_filter == EARLY_FILTER_DROP)
+
+#endif /* __UTIL_EARLY_FILTER_H__ */
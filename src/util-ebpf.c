@@ -47,6 +47,7 @@
 
 #include "device-storage.h"
 #include "flow-storage.h"
+#include "runmodes.h"
 
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
@@ -57,8 +58,27 @@
 
 #define BYPASSED_FLOW_TIMEOUT   60
 
+/** number of entries read from a flow table per batch syscall */
+#define BPF_BATCH_SIZE  256
+
+/* kernel internal error code returned for map types without batch ops */
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
 static int g_livedev_storage_id = -1;
 static int g_flow_storage_id = -1;
+static unsigned int g_nr_cpus = 0;
+#if defined(HAVE_BPF_MAP_LOOKUP_BATCH) && defined(HAVE_BPF_MAP_DELETE_BATCH)
+/* cleared if the kernel turns out not to support batched operations */
+static int g_batch_lookup = 1;
+#endif
+#ifdef HAVE_BPF_MAP_UPDATE_BATCH
+static int g_batch_update = 1;
+#endif
+
+typedef int (*EBPFFlowTimeoutFunc)(int fd, void *key, struct pair *value,
+                                   struct timespec *curtime);
 
 struct bpf_map_item {
     char * name;
@@ -69,6 +89,9 @@ struct bpf_maps_info {
     struct bpf_map_item array[BPF_MAP_MAX_COUNT];
     SC_ATOMIC_DECLARE(uint64_t, ipv4_hash_count);
     SC_ATOMIC_DECLARE(uint64_t, ipv6_hash_count);
+    /** sockets that joined the lb_rebalance.bpf fanout group */
+    SC_ATOMIC_DECLARE(uint32_t, lb_members);
+    uint32_t lb_sockets;
     int last;
 };
 
@@ -248,6 +271,7 @@ int EBPFLoadFile(const char *iface, const char *path, const char * section,
     }
     SC_ATOMIC_INIT(bpf_map_data->ipv4_hash_count);
     SC_ATOMIC_INIT(bpf_map_data->ipv6_hash_count);
+    SC_ATOMIC_INIT(bpf_map_data->lb_members);
 
     /* Store the maps in bpf_maps_info:: */
     bpf_map__for_each(map, bpfobj) {
@@ -330,9 +354,12 @@ int EBPFSetupXDP(const char *iface, int fd, uint8_t flags)
  * \param curtime the current time
  * \return 1 if timeouted 0 if not
  */
-static int EBPFBypassedFlowV4Timeout(int fd, struct flowv4_keys *key,
+static int EBPFBypassedFlowV4Timeout(int fd, void *data,
                                      struct pair *value, struct timespec *curtime)
 {
+#ifdef DEBUG
+    struct flowv4_keys *key = data;
+#endif
     SCLogDebug("Got curtime %" PRIu64 " and value %" PRIu64 " (sp:%d, dp:%d) %u",
                curtime->tv_sec, value->time / 1000000000,
                key->port16[0], key->port16[1], key->ip_proto
@@ -364,9 +391,12 @@ static int EBPFBypassedFlowV4Timeout(int fd, struct flowv4_keys *key,
  * \param curtime the current time
  * \return 1 if timeouted 0 if not
  */
-static int EBPFBypassedFlowV6Timeout(int fd, struct flowv6_keys *key,
+static int EBPFBypassedFlowV6Timeout(int fd, void *data,
                                      struct pair *value, struct timespec *curtime)
 {
+#ifdef DEBUG
+    struct flowv6_keys *key = data;
+#endif
     SCLogDebug("Got curtime %" PRIu64 " and value %" PRIu64 " (sp:%d, dp:%d)",
                curtime->tv_sec, value->time / 1000000000,
                key->port16[0], key->port16[1]
@@ -380,6 +410,121 @@ static int EBPFBypassedFlowV6Timeout(int fd, struct flowv6_keys *key,
     return 0;
 }
 
+#if defined(HAVE_BPF_MAP_LOOKUP_BATCH) || defined(HAVE_BPF_MAP_UPDATE_BATCH)
+static int EBPFBatchUnsupported(int err)
+{
+    return (err == EINVAL || err == ENOTSUPP || err == EOPNOTSUPP || err == ENOSYS);
+}
+#endif
+
+#if defined(HAVE_BPF_MAP_LOOKUP_BATCH) && defined(HAVE_BPF_MAP_DELETE_BATCH)
+/**
+ * Bypassed flows cleaning using batched map operations
+ *
+ * Reads the table BPF_BATCH_SIZE entries per syscall instead of doing a
+ * get_next_key and a lookup for each entry, and deletes the timeouted
+ * entries of each batch in one syscall.
+ *
+ * \param key_size size of the keys of the table
+ * \param Timeout per-CPU timeout check for an entry of the table
+ * \param hash_cnt set to the number of entries seen
+ * 
+eturn 1 if a flow was timeouted, 0 if not and -1 if the kernel doesn't
+ *         support batched operations on the table
+ */
+static int EBPFForEachFlowTableBatch(LiveDevice *dev, int mapfd, size_t key_size,
+                                     EBPFFlowTimeoutFunc Timeout,
+                                     struct flows_stats *flowstats,
+                                     struct timespec *ctime, uint64_t *hash_cnt)
+{
+    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+        .elem_flags = 0,
+        .flags = 0,
+    );
+    const size_t values_size = sizeof(struct pair) * g_nr_cpus;
+    uint8_t *keys = SCMalloc(BPF_BATCH_SIZE * key_size * 2);
+    struct pair *values = SCMalloc(BPF_BATCH_SIZE * values_size);
+    if (keys == NULL || values == NULL) {
+        SCFree(keys);
+        SCFree(values);
+        return -1;
+    }
+    uint8_t *del_keys = keys + BPF_BATCH_SIZE * key_size;
+    /* opaque position in the table, a bucket index for hash maps */
+    uint64_t in_batch = 0, out_batch = 0;
+    int first = 1;
+    int found = 0;
+
+    while (1) {
+        uint32_t count = BPF_BATCH_SIZE;
+        int res = bpf_map_lookup_batch(mapfd, first ? NULL : &in_batch, &out_batch,
+                                       keys, values, &count, &opts);
+        int err = errno;
+        if (res < 0 && err != ENOENT) {
+            if (first && count == 0 && EBPFBatchUnsupported(err)) {
+                SCLogInfo("batched eBPF map operations not supported, "
+                          "walking flow tables per entry");
+                g_batch_lookup = 0;
+                found = -1;
+                break;
+            }
+            /* ENOSPC if a bucket has more than BPF_BATCH_SIZE entries, the
+             * rest is checked on the next run */
+            SCLogDebug("batch lookup of flow table failed: %s", strerror(err));
+            if (count == 0)
+                break;
+        }
+
+        uint32_t del_cnt = 0;
+        for (uint32_t e = 0; e < count; e++) {
+            void *key = keys + e * key_size;
+            struct pair *values_array = (struct pair *)((uint8_t *)values + e * values_size);
+            uint64_t pkts_cnt = 0;
+            uint64_t bytes_cnt = 0;
+            bool purge = true;
+            unsigned int i;
+
+            (*hash_cnt)++;
+            for (i = 0; i < g_nr_cpus; i++) {
+                if (Timeout(mapfd, key, &values_array[i], ctime)) {
+                    pkts_cnt += values_array[i].packets;
+                    bytes_cnt += values_array[i].bytes;
+                } else {
+                    purge = false;
+                    break;
+                }
+            }
+            if (purge) {
+                flowstats->count++;
+                flowstats->packets += pkts_cnt;
+                flowstats->bytes += bytes_cnt;
+                SC_ATOMIC_ADD(dev->bypassed, pkts_cnt);
+                found = 1;
+                memcpy(del_keys + del_cnt * key_size, key, key_size);
+                del_cnt++;
+            }
+        }
+        if (del_cnt) {
+            uint32_t n = del_cnt;
+            if (bpf_map_delete_batch(mapfd, del_keys, &n, &opts) < 0) {
+                /* an entry can be gone already, delete the rest one by one */
+                for (uint32_t e = n + 1; e < del_cnt; e++) {
+                    EBPFDeleteKey(mapfd, del_keys + e * key_size);
+                }
+            }
+        }
+        if (res < 0)
+            break;
+        in_batch = out_batch;
+        first = 0;
+    }
+
+    SCFree(keys);
+    SCFree(values);
+    return found;
+}
+#endif
+
 /**
  * Bypassed flows cleaning for IPv4
  *
@@ -394,13 +539,28 @@ static int EBPFForEachFlowV4Table(LiveDevice *dev, const char *name,
     struct flowv4_keys key = {}, next_key;
     int found = 0;
     unsigned int i;
-    unsigned int nr_cpus = UtilCpuGetNumProcessorsConfigured();
+    unsigned int nr_cpus = g_nr_cpus;
     if (nr_cpus == 0) {
         SCLogWarning(SC_ERR_INVALID_VALUE, "Unable to get CPU count");
         return 0;
     }
+    struct bpf_maps_info *bpfdata = LiveDevGetStorageById(dev, g_livedev_storage_id);
 
     uint64_t hash_cnt = 0;
+#if defined(HAVE_BPF_MAP_LOOKUP_BATCH) && defined(HAVE_BPF_MAP_DELETE_BATCH)
+    if (g_batch_lookup) {
+        found = EBPFForEachFlowTableBatch(dev, mapfd, sizeof(key),
+                                          EBPFBypassedFlowV4Timeout,
+                                          flowstats, ctime, &hash_cnt);
+        if (found >= 0) {
+            if (bpfdata) {
+                SC_ATOMIC_SET(bpfdata->ipv4_hash_count, hash_cnt);
+            }
+            return found;
+        }
+        found = 0;
+    }
+#endif
     while (bpf_map_get_next_key(mapfd, &key, &next_key) == 0) {
         bool purge = true;
         uint64_t pkts_cnt = 0;
@@ -444,7 +604,6 @@ static int EBPFForEachFlowV4Table(LiveDevice *dev, const char *name,
         key = next_key;
     }
 
-    struct bpf_maps_info *bpfdata = LiveDevGetStorageById(dev, g_livedev_storage_id);
     if (bpfdata) {
         SC_ATOMIC_SET(bpfdata->ipv4_hash_count, hash_cnt);
     }
@@ -466,13 +625,28 @@ static int EBPFForEachFlowV6Table(LiveDevice *dev, const char *name,
     struct flowv6_keys key = {}, next_key;
     int found = 0;
     unsigned int i;
-    unsigned int nr_cpus = UtilCpuGetNumProcessorsConfigured();
+    unsigned int nr_cpus = g_nr_cpus;
     if (nr_cpus == 0) {
         SCLogWarning(SC_ERR_INVALID_VALUE, "Unable to get CPU count");
         return 0;
     }
+    struct bpf_maps_info *bpfdata = LiveDevGetStorageById(dev, g_livedev_storage_id);
 
     uint64_t hash_cnt = 0;
+#if defined(HAVE_BPF_MAP_LOOKUP_BATCH) && defined(HAVE_BPF_MAP_DELETE_BATCH)
+    if (g_batch_lookup) {
+        found = EBPFForEachFlowTableBatch(dev, mapfd, sizeof(key),
+                                          EBPFBypassedFlowV6Timeout,
+                                          flowstats, ctime, &hash_cnt);
+        if (found >= 0) {
+            if (bpfdata) {
+                SC_ATOMIC_SET(bpfdata->ipv6_hash_count, hash_cnt);
+            }
+            return found;
+        }
+        found = 0;
+    }
+#endif
     while (bpf_map_get_next_key(mapfd, &key, &next_key) == 0) {
         bool purge = true;
         uint64_t pkts_cnt = 0;
@@ -507,7 +681,6 @@ static int EBPFForEachFlowV6Table(LiveDevice *dev, const char *name,
         key = next_key;
     }
 
-    struct bpf_maps_info *bpfdata = LiveDevGetStorageById(dev, g_livedev_storage_id);
     if (bpfdata) {
         SC_ATOMIC_SET(bpfdata->ipv6_hash_count, hash_cnt);
     }
@@ -590,7 +763,357 @@ TmEcode EBPFGetBypassedStats(json_t *cmd, json_t *answer, void *data)
 void EBPFRegisterExtension(void)
 {
     g_livedev_storage_id = LiveDevStorageRegister("bpfmap", sizeof(void *), NULL, BpfMapsInfoFree);
-    g_flow_storage_id = FlowStorageRegister("bypassedlist", sizeof(void *), NULL, BypassedListFree);
+    g_flow_storage_id = FlowStorageRegister("bypassedlist", sizeof(void *), NULL,
+            BypassedListFree, 0);
+    /* per-CPU map values are sized on the possible CPUs, which can be more
+     * than the configured ones */
+#ifdef HAVE_LIBBPF_NUM_POSSIBLE_CPUS
+    int possible = libbpf_num_possible_cpus();
+    if (possible > 0) {
+        g_nr_cpus = possible;
+    } else {
+        g_nr_cpus = UtilCpuGetNumProcessorsConfigured();
+    }
+#else
+    g_nr_cpus = UtilCpuGetNumProcessorsConfigured();
+#endif
+}
+
+/**
+ * Insert a half flow in the kernel bypass table
+ *
+ * \param mapfd file descriptor of the protocol bypass table
+ * \param key data to use as key in the table
+ * \param inittime time of creation of the entry (in monotonic clock)
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFInsertHalfFlow(int mapd, void *key, uint64_t inittime)
+{
+    if (mapd == -1 || g_nr_cpus == 0) {
+        return 0;
+    }
+
+    struct pair value[g_nr_cpus];
+    unsigned int i;
+
+    /* We use a per CPU structure so we have to set an array of values as the kernel
+     * is not duplicating the data on each CPU by itself. */
+    for (i = 0; i < g_nr_cpus; i++) {
+        value[i].time = inittime;
+        value[i].packets = 0;
+        value[i].bytes = 0;
+    }
+    SCLogDebug("Inserting element in eBPF mapping: %lu", inittime);
+    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
+        switch (errno) {
+            /* no more place in the hash */
+            case E2BIG:
+                return 0;
+            /* if we already have the key then bypass is a success */
+            case EEXIST:
+                return 1;
+            /* Not supposed to be there so issue a error */
+            default:
+                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
+                        strerror(errno),
+                        errno);
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Insert the two half flows of a flow in the kernel bypass table
+ *
+ * Both entries are added with a single batched update when the kernel
+ * supports it.
+ *
+ * \param mapfd file descriptor of the protocol bypass table
+ * \param keys array of the two keys to use in the table
+ * \param key_size size of a key
+ * \param inittime time of creation of the entries (in monotonic clock)
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFInsertFlow(int mapd, void *keys, size_t key_size, uint64_t inittime)
+{
+    uint32_t done = 0;
+
+    if (mapd == -1 || g_nr_cpus == 0) {
+        return 0;
+    }
+
+#ifdef HAVE_BPF_MAP_UPDATE_BATCH
+    if (g_batch_update) {
+        DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+            .elem_flags = BPF_NOEXIST,
+            .flags = 0,
+        );
+        struct pair value[2 * g_nr_cpus];
+        unsigned int i;
+
+        for (i = 0; i < 2 * g_nr_cpus; i++) {
+            value[i].time = inittime;
+            value[i].packets = 0;
+            value[i].bytes = 0;
+        }
+        uint32_t count = 2;
+        if (bpf_map_update_batch(mapd, keys, value, &count, &opts) == 0) {
+            return 1;
+        }
+        switch (errno) {
+            case E2BIG:
+                return 0;
+            /* half flow already there, carry on with the next one */
+            case EEXIST:
+                done = count + 1;
+                break;
+            default:
+                if (count == 0 && EBPFBatchUnsupported(errno)) {
+                    SCLogInfo("batched eBPF map update not supported, "
+                              "inserting half flows one by one");
+                    g_batch_update = 0;
+                } else {
+                    done = count;
+                }
+                break;
+        }
+    }
+#endif
+
+    for ( ; done < 2; done++) {
+        if (EBPFInsertHalfFlow(mapd, (uint8_t *)keys + done * key_size, inittime) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* busy flag of a socket is set over this ring fill, in percent */
+#define EBPF_LB_BUSY_HIGH   75
+/* and cleared under this one */
+#define EBPF_LB_BUSY_LOW    25
+/* packets per vote on the hot flow of a busy socket */
+#define EBPF_LB_SAMPLE      64
+
+void EBPFLbSocketInit(EBPFLbSocket *lbs)
+{
+    memset(lbs, 0, sizeof(*lbs));
+    lbs->busy_fd = -1;
+    lbs->flows_fd = -1;
+}
+
+/**
+ * Set up the flow rebalancing of the lb_rebalance.bpf load balancer
+ *
+ * \param iface interface the load balancer was loaded for
+ * \param nb_sockets number of sockets in the fanout group
+ * \return 0 on success, -1 if the file has no rebalancing maps
+ */
+int EBPFLbSetup(const char *iface, uint32_t nb_sockets)
+{
+    struct bpf_maps_info *bpf_maps = EBPFGetBpfMap(iface);
+    int cfgfd = EBPFGetMapFDByName(iface, "lb_config");
+    if (bpf_maps == NULL || cfgfd < 0 ||
+            EBPFGetMapFDByName(iface, "lb_busy") < 0 ||
+            EBPFGetMapFDByName(iface, "lb_flows") < 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "eBPF lb file for '%s' has no "
+                "rebalancing maps, use lb_rebalance.bpf", iface);
+        return -1;
+    }
+    if (nb_sockets > EBPF_LB_MAX_SOCKETS) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "eBPF lb rebalancing supports "
+                "up to %d threads, '%s' has %u", EBPF_LB_MAX_SOCKETS,
+                iface, nb_sockets);
+        return -1;
+    }
+
+    uint32_t key = 0;
+    int ret = bpf_map_update_elem(cfgfd, &key, &nb_sockets, BPF_ANY);
+    if (ret) {
+        SCLogError(SC_ERR_BPF, "Unable to set lb_config (err:%d)", ret);
+        return -1;
+    }
+    bpf_maps->lb_sockets = nb_sockets;
+    SCLogConfig("eBPF lb rebalancing enabled for '%s' over %u sockets",
+            iface, nb_sockets);
+    return 0;
+}
+
+/**
+ * Register a socket that joined the fanout group
+ *
+ * The kernel puts a new member at the end of the group, so as the capture
+ * threads open their sockets in turn the count is the socket's index. A
+ * socket that is reopened comes back at another index, so it no longer
+ * takes part in the rebalancing.
+ *
+ * \return 0 on success, -1 if the socket is not rebalanced
+ */
+int EBPFLbJoin(const char *iface, EBPFLbSocket *lbs)
+{
+    struct bpf_maps_info *bpf_maps = EBPFGetBpfMap(iface);
+    if (bpf_maps == NULL || bpf_maps->lb_sockets == 0)
+        return -1;
+
+    const uint32_t idx = SC_ATOMIC_ADD(bpf_maps->lb_members, 1) - 1;
+    if (idx >= bpf_maps->lb_sockets) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "socket rejoined the fanout "
+                "group of '%s', not rebalancing it anymore", iface);
+        lbs->busy_fd = -1;
+        return -1;
+    }
+
+    lbs->busy_fd = EBPFGetMapFDByName(iface, "lb_busy");
+    lbs->flows_fd = EBPFGetMapFDByName(iface, "lb_flows");
+    lbs->idx = idx;
+    lbs->nb_sockets = bpf_maps->lb_sockets;
+    lbs->busy = false;
+    SCLogDebug("socket %u of %u in the fanout group", idx, lbs->nb_sockets);
+    return 0;
+}
+
+static void EBPFLbSetBusy(EBPFLbSocket *lbs, bool busy)
+{
+    uint32_t val = busy;
+    if (bpf_map_update_elem(lbs->busy_fd, &lbs->idx, &val, BPF_ANY) != 0)
+        return;
+    lbs->busy = busy;
+    lbs->cand_cnt = 0;
+    lbs->sample_cnt = 0;
+}
+
+/** \brief clear the busy flag when the socket goes down */
+void EBPFLbLeave(EBPFLbSocket *lbs)
+{
+    if (lbs->busy_fd >= 0 && lbs->busy)
+        EBPFLbSetBusy(lbs, false);
+}
+
+/**
+ * Update the busy flag of a socket from the fill level of its ring
+ *
+ * New TCP sessions for a busy socket go to another one. The hysteresis
+ * keeps the flag from flapping with every read.
+ */
+void EBPFLbUpdate(EBPFLbSocket *lbs, uint32_t ring_used, uint32_t ring_size)
+{
+    if (lbs->busy_fd < 0 || ring_size == 0)
+        return;
+
+    const uint64_t fill = (uint64_t)ring_used * 100 / ring_size;
+    if (!lbs->busy && fill >= EBPF_LB_BUSY_HIGH) {
+        EBPFLbSetBusy(lbs, true);
+    } else if (lbs->busy && fill <= EBPF_LB_BUSY_LOW) {
+        EBPFLbSetBusy(lbs, false);
+    }
+}
+
+static inline uint32_t EBPFLbRead32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t EBPFLbRead16(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+/**
+ * Flow hash of lb_rebalance.bpf for an ethernet frame
+ *
+ * Symmetric over the 5-tuple, computed on the host order values the eBPF
+ * load_word() and load_half() give.
+ *
+ * \return 0 on success, -1 if the frame is not balanced per flow
+ */
+int EBPFLbFlowHash(const uint8_t *pkt, uint32_t len, uint32_t *hash)
+{
+    if (len < ETHERNET_HEADER_LEN)
+        return -1;
+    const uint32_t type = EBPFLbRead16(pkt + 12);
+    const uint8_t *ip = pkt + ETHERNET_HEADER_LEN;
+    len -= ETHERNET_HEADER_LEN;
+
+    uint32_t pair = 0, proto;
+    uint32_t l4off;
+    if (type == ETHERNET_TYPE_IP) {
+        if (len < 20)
+            return -1;
+        /* only the first fragment has the ports */
+        if (EBPFLbRead16(ip + 6) & 0x3fff)
+            return -1;
+        pair = EBPFLbRead32(ip + 12) + EBPFLbRead32(ip + 16);
+        proto = ip[9];
+        l4off = (ip[0] & 0x0f) << 2;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        if (len < 40)
+            return -1;
+        for (int i = 0; i < 8; i++)
+            pair += EBPFLbRead32(ip + 8 + 4 * i);
+        proto = ip[6];
+        l4off = 40;
+    } else {
+        return -1;
+    }
+    if ((proto != IPPROTO_TCP && proto != IPPROTO_UDP) || len < l4off + 4)
+        return -1;
+
+    const uint32_t ports = EBPFLbRead16(ip + l4off) + EBPFLbRead16(ip + l4off + 2);
+    uint32_t h = pair + ports + (proto << 24);
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    *hash = h;
+    return 0;
+}
+
+/** \brief steer a flow to the next socket that is not busy */
+static int EBPFLbMoveFlow(EBPFLbSocket *lbs, uint32_t hash)
+{
+    for (uint32_t i = 1; i < lbs->nb_sockets; i++) {
+        uint32_t idx = (lbs->idx + i) % lbs->nb_sockets;
+        uint32_t busy = 0;
+        if (bpf_map_lookup_elem(lbs->busy_fd, &idx, &busy) != 0 || busy)
+            continue;
+        if (bpf_map_update_elem(lbs->flows_fd, &hash, &idx, BPF_ANY) != 0)
+            return -1;
+        SCLogDebug("moved flow %08x from socket %u to %u", hash, lbs->idx, idx);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Look for a hot flow in the packets of a busy socket
+ *
+ * A majority vote over EBPF_LB_SAMPLE packets: a flow that has more than
+ * 5/8 of them is moved to the next socket that isn't busy. The moved
+ * flow is picked up midstream by the worker of that socket.
+ *
+ * \retval true if a flow was moved
+ */
+bool EBPFLbSample(EBPFLbSocket *lbs, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t hash;
+    if (EBPFLbFlowHash(pkt, len, &hash) == 0) {
+        if (lbs->cand_cnt == 0) {
+            lbs->cand = hash;
+            lbs->cand_cnt = 1;
+        } else if (lbs->cand == hash) {
+            lbs->cand_cnt++;
+        } else {
+            lbs->cand_cnt--;
+        }
+    }
+    if (++lbs->sample_cnt < EBPF_LB_SAMPLE)
+        return false;
+
+    const bool hot = lbs->cand_cnt >= EBPF_LB_SAMPLE / 4;
+    lbs->cand_cnt = 0;
+    lbs->sample_cnt = 0;
+    return hot && EBPFLbMoveFlow(lbs, lbs->cand) == 0;
 }
 
 
@@ -693,6 +1216,46 @@ int EBPFSetPeerIface(const char *iface, const char *out_iface)
     return 0;
 }
 
+/**
+ * Check that the eBPF and XDP filters see the tuple of a packet
+ *
+ * The filters decapsulate one level of GRE version 0 (IP, IPv6,
+ * transparent ethernet bridging or ERSPAN type II payload) or of VXLAN on
+ * port EBPF_VXLAN_PORT, and use the inner tuple for the bypass keys and
+ * the load balancing. The flows inside other tunnels, and the tunnels
+ * themselves, can't be bypassed.
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \return true if the filters build the same key as Suricata
+ */
+bool EBPFBypassTupleSupported(const Packet *p)
+{
+    if (!IS_TUNNEL_PKT(p))
+        return true;
+    /* root of a tunnel, or nested tunnel */
+    if (p->root == NULL || p->recursion_level != 1)
+        return false;
+
+    const Packet *rp = p->root;
+    if (rp->greh != NULL) {
+        if (GRE_GET_VERSION(rp->greh) != GRE_VERSION_0 ||
+                GRE_FLAG_ISSET_ROUTE(rp->greh))
+            return false;
+        switch (GRE_GET_PROTO(rp->greh)) {
+            case ETHERNET_TYPE_IP:
+            case ETHERNET_TYPE_IPV6:
+            case ETHERNET_TYPE_BRIDGE:
+            case ETHERNET_TYPE_ERSPAN:
+                return true;
+            default:
+                return false;
+        }
+    }
+    if (rp->udph != NULL)
+        return UDP_GET_DST_PORT(rp) == EBPF_VXLAN_PORT;
+    return false;
+}
+
 int EBPFUpdateFlow(Flow *f, Packet *p)
 {
     BypassedIfaceList *ifl = (BypassedIfaceList *)FlowGetStorageById(f, g_flow_storage_id);
@@ -727,6 +1290,269 @@ int EBPFUpdateFlow(Flow *f, Packet *p)
     return 1;
 }
 
+/**
+ * Bypass a flow in the XDP flow tables
+ *
+ * This function creates two half flows in the maps shared with the XDP
+ * filter. Byte order of the keys matches the one seen by the XDP filter
+ * which parses the packet itself.
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \param v4_map_fd file descriptor of the IPv4 flow table
+ * \param v6_map_fd file descriptor of the IPv6 flow table
+ * \return 0 if unable to bypass, 1 if success
+ */
+int EBPFXDPBypassFlow(Packet *p, int v4_map_fd, int v6_map_fd)
+{
+    /* Only bypass TCP and UDP */
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    /* the XDP filter only decapsulates some tunnels */
+    if (!EBPFBypassTupleSupported(p)) {
+        return 0;
+    }
+    struct timespec curtime;
+    uint64_t inittime = 0;
+    /* In eBPF, the function that we have use to get time return the
+     * monotonic clock (the time since start of the computer). So we
+     * can't use the timestamp of the packet. */
+    if (clock_gettime(CLOCK_MONOTONIC, &curtime) == 0) {
+        inittime = curtime.tv_sec * 1000000000;
+    }
+    if (PKT_IS_IPV4(p)) {
+        struct flowv4_keys key[2];
+        if (v4_map_fd == -1) {
+            return 0;
+        }
+        memset(key, 0, sizeof(key));
+        key[0].src = GET_IPV4_SRC_ADDR_U32(p);
+        key[0].dst = GET_IPV4_DST_ADDR_U32(p);
+        /* In the XDP filter we get port from parsing of packet and not from skb
+         * (as in eBPF filter) so we need to pass from host to network order */
+        key[0].port16[0] = htons(GET_TCP_SRC_PORT(p));
+        key[0].port16[1] = htons(GET_TCP_DST_PORT(p));
+        key[0].ip_proto = IPV4_GET_IPPROTO(p);
+        key[1].src = GET_IPV4_DST_ADDR_U32(p);
+        key[1].dst = GET_IPV4_SRC_ADDR_U32(p);
+        key[1].port16[0] = htons(GET_TCP_DST_PORT(p));
+        key[1].port16[1] = htons(GET_TCP_SRC_PORT(p));
+        key[1].ip_proto = IPV4_GET_IPPROTO(p);
+        return EBPFInsertFlow(v4_map_fd, key, sizeof(key[0]), inittime);
+    }
+    /* For IPv6 case we don't handle extended header in eBPF */
+    if (PKT_IS_IPV6(p) &&
+        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
+        SCLogDebug("add an IPv6");
+        if (v6_map_fd == -1) {
+            return 0;
+        }
+        int i;
+        struct flowv6_keys key[2];
+        memset(key, 0, sizeof(key));
+        for (i = 0; i < 4; i++) {
+            key[0].src[i] = GET_IPV6_SRC_ADDR(p)[i];
+            key[0].dst[i] = GET_IPV6_DST_ADDR(p)[i];
+            key[1].src[i] = GET_IPV6_DST_ADDR(p)[i];
+            key[1].dst[i] = GET_IPV6_SRC_ADDR(p)[i];
+        }
+        key[0].port16[0] = htons(GET_TCP_SRC_PORT(p));
+        key[0].port16[1] = htons(GET_TCP_DST_PORT(p));
+        key[0].ip_proto = IPV6_GET_NH(p);
+        key[1].port16[0] = htons(GET_TCP_DST_PORT(p));
+        key[1].port16[1] = htons(GET_TCP_SRC_PORT(p));
+        key[1].ip_proto = IPV6_GET_NH(p);
+        return EBPFInsertFlow(v6_map_fd, key, sizeof(key[0]), inittime);
+    }
+    return 0;
+}
+
+/**
+ * Attach an AF_XDP socket to a RX queue of the XDP filter
+ *
+ * The socket is added to the 'xsks_map' and the queue is flagged in
+ * 'xsks_queues' so the filter starts redirecting non bypassed packets.
+ *
+ * \param iface interface the XDP filter is attached to
+ * \param queue RX queue index
+ * \param fd AF_XDP socket, -1 to detach the queue
+ * \return 0 on success, -1 on error
+ */
+int EBPFSetXSKSocket(const char *iface, uint32_t queue, int fd)
+{
+    int xsksfd = EBPFGetMapFDByName(iface, "xsks_map");
+    if (xsksfd < 0) {
+        SCLogError(SC_ERR_INVALID_VALUE,
+                   "Unable to find 'xsks_map' map");
+        return -1;
+    }
+    int queuesfd = EBPFGetMapFDByName(iface, "xsks_queues");
+    if (queuesfd < 0) {
+        SCLogError(SC_ERR_INVALID_VALUE,
+                   "Unable to find 'xsks_queues' map");
+        return -1;
+    }
+
+    uint32_t active = 0;
+    int ret;
+    if (fd == -1) {
+        /* stop redirection before removing the socket */
+        ret = bpf_map_update_elem(queuesfd, &queue, &active, BPF_ANY);
+        if (ret) {
+            SCLogError(SC_ERR_BPF, "Unable to disable queue %u (err:%d)",
+                       queue, ret);
+            return -1;
+        }
+        bpf_map_delete_elem(xsksfd, &queue);
+        return 0;
+    }
+
+    ret = bpf_map_update_elem(xsksfd, &queue, &fd, BPF_ANY);
+    if (ret) {
+        SCLogError(SC_ERR_BPF, "Unable to add socket for queue %u (err:%d)",
+                   queue, ret);
+        return -1;
+    }
+    active = 1;
+    ret = bpf_map_update_elem(queuesfd, &queue, &active, BPF_ANY);
+    if (ret) {
+        SCLogError(SC_ERR_BPF, "Unable to enable queue %u (err:%d)",
+                   queue, ret);
+        return -1;
+    }
+    return 0;
+}
+
+static const BypassedCheckCounters drop_v4_counters = {
+    "ebpf_drop.ipv4.expired", "ebpf_drop.ipv4.pkts", "ebpf_drop.ipv4.bytes"
+};
+static const BypassedCheckCounters drop_v6_counters = {
+    "ebpf_drop.ipv6.expired", "ebpf_drop.ipv6.pkts", "ebpf_drop.ipv6.bytes"
+};
+
+/**
+ * Remove the timeouted sources of a drop map of all interfaces
+ *
+ * The packets and bytes dropped for a source are accounted when it is
+ * removed, as for the bypassed flows.
+ *
+ * \param name drop_src_v4 or drop_src_v6
+ * \param key_size size of the keys of the map
+ * \return 1 if a source was removed, 0 if not
+ */
+static int EBPFForEachDropTable(const char *name, size_t key_size,
+                                struct flows_stats *dropstats,
+                                struct timespec *curtime)
+{
+    const uint64_t now = (uint64_t)curtime->tv_sec * 1000000000ULL +
+                         (uint64_t)curtime->tv_nsec;
+    LiveDevice *ldev = NULL, *ndev;
+    int found = 0;
+
+    while (LiveDeviceForEach(&ldev, &ndev)) {
+        int mapfd = EBPFGetMapFDByName(ldev->dev, name);
+        if (mapfd < 0)
+            continue;
+
+        uint8_t key[key_size], next_key[key_size];
+        int has_key = (bpf_map_get_next_key(mapfd, NULL, key) == 0);
+        while (has_key) {
+            /* get the next key first as the current one may be deleted */
+            has_key = (bpf_map_get_next_key(mapfd, key, next_key) == 0);
+
+            struct drop_info value;
+            if (bpf_map_lookup_elem(mapfd, key, &value) == 0 &&
+                    now - value.time >= value.timeout) {
+                dropstats->count++;
+                dropstats->packets += value.packets;
+                dropstats->bytes += value.bytes;
+                EBPFDeleteKey(mapfd, key);
+                found = 1;
+            }
+            memcpy(key, next_key, key_size);
+        }
+    }
+    return found;
+}
+
+static int EBPFCheckDropTimeoutV4(struct flows_stats *dropstats,
+                                  struct timespec *curtime)
+{
+    return EBPFForEachDropTable("drop_src_v4", sizeof(uint32_t),
+                                dropstats, curtime);
+}
+
+static int EBPFCheckDropTimeoutV6(struct flows_stats *dropstats,
+                                  struct timespec *curtime)
+{
+    return EBPFForEachDropTable("drop_src_v6", 4 * sizeof(uint32_t),
+                                dropstats, curtime);
+}
+
+/**
+ * Enable the expiry of the sources added by EBPFDropAddress()
+ *
+ * The bypassed flow manager removes the timeouted entries of the
+ * drop_src_v4 and drop_src_v6 maps and counts them in the ebpf_drop
+ * counters.
+ */
+void EBPFDropRegister(void)
+{
+    RunModeEnablesBypassManager();
+    BypassedFlowManagerRegisterCheckFuncCounters(EBPFCheckDropTimeoutV4,
+                                                 &drop_v4_counters);
+    BypassedFlowManagerRegisterCheckFuncCounters(EBPFCheckDropTimeoutV6,
+                                                 &drop_v6_counters);
+}
+
+/**
+ * Drop or rate limit the packets of a source in the XDP filter
+ *
+ * A source that is already in the map gets the new timeout and rate,
+ * its counters are kept.
+ *
+ * \param iface interface the XDP filter is loaded on
+ * \param addr source address
+ * \param timeout seconds before the source is removed
+ * \param rate packets per second still let through, 0 to drop all
+ * \return 1 if the source is in the map, 0 if not
+ */
+int EBPFDropAddress(const char *iface, const Address *addr,
+                    uint32_t timeout, uint32_t rate)
+{
+    const char *name;
+    if (addr->family == AF_INET) {
+        name = "drop_src_v4";
+    } else if (addr->family == AF_INET6) {
+        name = "drop_src_v6";
+    } else {
+        return 0;
+    }
+    int mapfd = EBPFGetMapFDByName(iface, name);
+    if (mapfd < 0)
+        return 0;
+
+    struct timespec curtime;
+    if (clock_gettime(CLOCK_MONOTONIC, &curtime) != 0)
+        return 0;
+
+    struct drop_info value;
+    if (bpf_map_lookup_elem(mapfd, addr->addr_data32, &value) != 0) {
+        memset(&value, 0, sizeof(value));
+    }
+    value.time = (uint64_t)curtime.tv_sec * 1000000000ULL + curtime.tv_nsec;
+    value.timeout = (uint64_t)timeout * 1000000000ULL;
+    value.rate = rate;
+
+    if (bpf_map_update_elem(mapfd, addr->addr_data32, &value, BPF_ANY) != 0) {
+        SCLogDebug("Can't update eBPF map %s: %s (%d)", name,
+                   strerror(errno), errno);
+        return 0;
+    }
+    return 1;
+}
+
 #endif /* HAVE_PACKET_XDP */
 
 #endif
@@ -59,6 +59,20 @@ struct pair {
     uint64_t bytes;
 } __attribute__((__aligned__(8)));
 
+/** value of the drop_src_v4 and drop_src_v6 maps of xdp_filter.bpf */
+struct drop_info {
+    uint64_t time;          /**< insertion, monotonic clock in ns */
+    uint64_t timeout;       /**< ns */
+    uint64_t rate;          /**< packets per second let through, 0 for none */
+    uint64_t window_start;
+    uint64_t window_pkts;
+    uint64_t packets;       /**< dropped */
+    uint64_t bytes;
+} __attribute__((__aligned__(8)));
+
+/** VXLAN port the eBPF and XDP filters decapsulate */
+#define EBPF_VXLAN_PORT     4789
+
 #define EBPF_SOCKET_FILTER  (1<<0)
 #define EBPF_XDP_CODE       (1<<1)
 
@@ -72,11 +86,47 @@ int EBPFCheckBypassedFlowTimeout(struct flows_stats *bypassstats,
 
 void EBPFRegisterExtension(void);
 
+int EBPFInsertHalfFlow(int mapd, void *key, uint64_t inittime);
+int EBPFInsertFlow(int mapd, void *keys, size_t key_size, uint64_t inittime);
+
 void EBPFBuildCPUSet(ConfNode *node, char *iface);
 
 int EBPFSetPeerIface(const char *iface, const char *out_iface);
 
+bool EBPFBypassTupleSupported(const Packet *p);
 int EBPFUpdateFlow(Flow *f, Packet *p);
+
+int EBPFXDPBypassFlow(Packet *p, int v4_map_fd, int v6_map_fd);
+
+int EBPFSetXSKSocket(const char *iface, uint32_t queue, int fd);
+
+void EBPFDropRegister(void);
+int EBPFDropAddress(const char *iface, const Address *addr,
+                    uint32_t timeout, uint32_t rate);
+
+/** sockets the 'lb_busy' map of lb_rebalance.bpf has room for */
+#define EBPF_LB_MAX_SOCKETS     64
+
+/** a socket of a fanout group balanced by lb_rebalance.bpf */
+typedef struct EBPFLbSocket_ {
+    int busy_fd;            /**< 'lb_busy' map, -1 if not rebalancing */
+    int flows_fd;           /**< 'lb_flows' map */
+    uint32_t idx;           /**< index of the socket in the fanout group */
+    uint32_t nb_sockets;
+    bool busy;
+    /* majority vote over the flows read while busy */
+    uint32_t cand;
+    uint32_t cand_cnt;
+    uint32_t sample_cnt;
+} EBPFLbSocket;
+
+void EBPFLbSocketInit(EBPFLbSocket *lbs);
+int EBPFLbSetup(const char *iface, uint32_t nb_sockets);
+int EBPFLbJoin(const char *iface, EBPFLbSocket *lbs);
+void EBPFLbLeave(EBPFLbSocket *lbs);
+void EBPFLbUpdate(EBPFLbSocket *lbs, uint32_t ring_used, uint32_t ring_size);
+bool EBPFLbSample(EBPFLbSocket *lbs, const uint8_t *pkt, uint32_t len);
+int EBPFLbFlowHash(const uint8_t *pkt, uint32_t len, uint32_t *hash);
   
 #ifdef BUILD_UNIX_SOCKET
 TmEcode EBPFGetBypassedStats(json_t *cmd, json_t *answer, void *data);
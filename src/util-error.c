@@ -360,6 +360,16 @@ const char * SCErrorToString(SCError err)
         CASE_CODE (SC_WARN_RUST_NOT_AVAILABLE);
         CASE_CODE (SC_WARN_DEFAULT_WILL_CHANGE);
         CASE_CODE (SC_WARN_EVE_MISSING_EVENTS);
+        CASE_CODE (SC_ERR_AFXDP_CREATE);
+        CASE_CODE (SC_ERR_AFXDP_READ);
+        CASE_CODE (SC_ERR_NO_AF_XDP);
+        CASE_CODE (SC_ERR_DPDK_CREATE);
+        CASE_CODE (SC_ERR_DPDK_READ);
+        CASE_CODE (SC_ERR_NO_DPDK);
+        CASE_CODE (SC_WARN_FLOW_THREAD_LOCAL);
+        CASE_CODE (SC_ERR_KAFKA);
+        CASE_CODE (SC_ERR_KAFKA_CONFIG);
+        CASE_CODE (SC_WARN_PCAP_LOG_PREALLOC);
 
         CASE_CODE (SC_ERR_MAX);
     }
@@ -350,6 +350,16 @@ typedef enum {
     SC_WARN_DEFAULT_WILL_CHANGE,
     SC_WARN_EVE_MISSING_EVENTS,
     SC_ERR_PLEDGE_FAILED,
+    SC_ERR_AFXDP_CREATE,
+    SC_ERR_AFXDP_READ,
+    SC_ERR_NO_AF_XDP,
+    SC_ERR_DPDK_CREATE,
+    SC_ERR_DPDK_READ,
+    SC_ERR_NO_DPDK,
+    SC_WARN_FLOW_THREAD_LOCAL,
+    SC_ERR_KAFKA,
+    SC_ERR_KAFKA_CONFIG,
+    SC_WARN_PCAP_LOG_PREALLOC,
 
     SC_ERR_MAX,
 } SCError;
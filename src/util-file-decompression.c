@@ -29,6 +29,7 @@
 
 #include "detect-engine.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-mem.h"
 
 #include "util-file-decompression.h"
 #include "util-file-swf-decompression.h"
@@ -54,39 +55,31 @@ int FileIsSwfFile(const uint8_t *buffer, uint32_t buffer_len)
     return FILE_IS_NOT_SWF;
 }
 
-/**
- * \brief This function decompresses a buffer with zlib/lzma algorithm
+/** \internal
+ *  \brief check the header of a compressed swf file
  *
- * \param buffer compressed buffer
- * \param buffer_len compressed buffer length
- * \param decompressed_buffer buffer that store decompressed data
- * \param decompressed_buffer_len decompressesd data length
- * \param swf_type decompression algorithm to use
- * \param decompress_depth how much decompressed data we want to store
- * \param compress_depth how much compressed data we want to decompress
+ *  \param[out] compression_type FILE_SWF_ZLIB_COMPRESSION or
+ *              FILE_SWF_LZMA_COMPRESSION
+ *  \param[out] swf_version version from the header
  *
- * \retval 1 if decompression works
- * \retval 0 an error occured, and event set
+ *  \retval offset of the compressed data
+ *  \retval 0 not a compressed swf file, or invalid and event set
  */
-int FileSwfDecompression(const uint8_t *buffer, uint32_t buffer_len,
-                         DetectEngineThreadCtx *det_ctx,
-                         InspectionBuffer *out_buffer,
-                         int swf_type,
-                         uint32_t decompress_depth,
-                         uint32_t compress_depth)
+static uint32_t FileSwfCheckHeader(const uint8_t *buffer, uint32_t buffer_len,
+                                   DetectEngineThreadCtx *det_ctx,
+                                   int *compression_type, uint8_t *swf_version)
 {
-    int r = 0;
-
-    int compression_type = FileIsSwfFile(buffer, buffer_len);
-    if (compression_type == FILE_SWF_NO_COMPRESSION) {
+    *compression_type = FileIsSwfFile(buffer, buffer_len);
+    if (*compression_type == FILE_SWF_NO_COMPRESSION ||
+        *compression_type == FILE_IS_NOT_SWF) {
         return 0;
     }
 
     uint32_t offset = 0;
-    if (compression_type == FILE_SWF_ZLIB_COMPRESSION) {
+    if (*compression_type == FILE_SWF_ZLIB_COMPRESSION) {
         /* compressed data start from the 4th bytes */
         offset = 8;
-    } else if (compression_type == FILE_SWF_LZMA_COMPRESSION) {
+    } else if (*compression_type == FILE_SWF_LZMA_COMPRESSION) {
         /* compressed data start from the 17th bytes */
         offset = 17;
     }
@@ -96,29 +89,77 @@ int FileSwfDecompression(const uint8_t *buffer, uint32_t buffer_len,
         return 0;
     }
 
-    uint32_t compressed_data_len = 0;
-    if (buffer_len > offset && compress_depth == 0) {
-        compressed_data_len = buffer_len - offset;
-    } else if (compress_depth > 0 && compress_depth <= buffer_len) {
-        compressed_data_len = compress_depth;
-    } else if (compress_depth > 0 && compress_depth > buffer_len) {
-        compressed_data_len = buffer_len;
-    }
-
     /* get swf version */
-    uint8_t swf_version = FileGetSwfVersion(buffer, buffer_len);
-    if (compression_type == FILE_SWF_ZLIB_COMPRESSION &&
-        swf_version < SWF_ZLIB_MIN_VERSION)
+    *swf_version = FileGetSwfVersion(buffer, buffer_len);
+    if (*compression_type == FILE_SWF_ZLIB_COMPRESSION &&
+        *swf_version < SWF_ZLIB_MIN_VERSION)
     {
         DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_INVALID_SWF_VERSION);
         return 0;
     }
-    if (compression_type == FILE_SWF_LZMA_COMPRESSION &&
-        swf_version < SWF_LZMA_MIN_VERSION)
+    if (*compression_type == FILE_SWF_LZMA_COMPRESSION &&
+        *swf_version < SWF_LZMA_MIN_VERSION)
     {
         DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_INVALID_SWF_VERSION);
         return 0;
     }
+    return offset;
+}
+
+/** \internal
+ *  \brief set up the FWS header in front of the decompressed data
+ *
+ *  FWS format
+ *  | 4 bytes         | 4 bytes    | n bytes |
+ *  | 'FWS' + version | script len | data    |
+ */
+static void FileSwfSetFwsHeader(uint8_t *out, uint8_t swf_version,
+                                uint32_t decompressed_swf_len)
+{
+    out[0] = 'F';
+    out[1] = 'W';
+    out[2] = 'S';
+    out[3] = swf_version;
+    memcpy(out + 4, &decompressed_swf_len, 4);
+}
+
+/**
+ * \brief This function decompresses a buffer with zlib/lzma algorithm
+ *
+ * \param buffer compressed buffer
+ * \param buffer_len compressed buffer length
+ * \param decompressed_buffer buffer that store decompressed data
+ * \param decompressed_buffer_len decompressesd data length
+ * \param swf_type decompression algorithm to use
+ * \param decompress_depth how much decompressed data we want to store
+ * \param compress_depth how much compressed data we want to decompress
+ *
+ * \retval 1 if decompression works
+ * \retval 0 an error occured, and event set
+ */
+int FileSwfDecompression(const uint8_t *buffer, uint32_t buffer_len,
+                         DetectEngineThreadCtx *det_ctx,
+                         InspectionBuffer *out_buffer,
+                         int swf_type,
+                         uint32_t decompress_depth,
+                         uint32_t compress_depth)
+{
+    int r = 0;
+
+    int compression_type;
+    uint8_t swf_version = 0;
+    uint32_t offset = FileSwfCheckHeader(buffer, buffer_len, det_ctx,
+                                         &compression_type, &swf_version);
+    if (offset == 0) {
+        return 0;
+    }
+
+    /* compress_depth counts from the start of the compressed data, so
+     * cap it to what is left of the buffer from there */
+    uint32_t compressed_data_len = buffer_len - offset;
+    if (compress_depth > 0 && compress_depth < compressed_data_len) {
+        compressed_data_len = compress_depth;
+    }
 
     /* get flash decompressed file length */
     uint32_t decompressed_swf_len = FileGetSwfDecompressedLen(buffer, buffer_len);
@@ -138,16 +179,7 @@ int FileSwfDecompression(const uint8_t *buffer, uint32_t buffer_len,
     }
     out_buffer->len = decompressed_data_len;
 
-    /*
-     * FWS format
-     * | 4 bytes         | 4 bytes    | n bytes |
-     * | 'FWS' + version | script len | data    |
-     */
-    out_buffer->buf[0] = 'F';
-    out_buffer->buf[1] = 'W';
-    out_buffer->buf[2] = 'S';
-    out_buffer->buf[3] = swf_version;
-    memcpy(out_buffer->buf + 4, &decompressed_swf_len, 4);
+    FileSwfSetFwsHeader(out_buffer->buf, swf_version, decompressed_swf_len);
     memset(out_buffer->buf + 8, 0, decompressed_data_len - 8);
 
     if ((swf_type == HTTP_SWF_COMPRESSION_ZLIB || swf_type == HTTP_SWF_COMPRESSION_BOTH) &&
@@ -205,3 +237,110 @@ int FileSwfDecompression(const uint8_t *buffer, uint32_t buffer_len,
 error:
     return 0;
 }
+
+/**
+ * \brief decompress a swf file as it arrives
+ *
+ * Unlike FileSwfDecompression() the decompression is kept in *stream, so
+ * each call only decompresses the data added since the previous one. The
+ * stream is charged to the http memcap, if that is reached this falls back
+ * to FileSwfDecompression().
+ *
+ * \param stream decompression of the file, set up by the first call, free
+ *        with FileSwfDecompressionStreamFree()
+ * \param buffer the file from its start, as much as there is of it so far
+ *
+ * \retval 1 out_buffer inspects the decompressed data
+ * \retval 0 not decompressed, event set on errors
+ */
+int FileSwfDecompressionStream(FileSwfStream **stream,
+                               const uint8_t *buffer, uint32_t buffer_len,
+                               DetectEngineThreadCtx *det_ctx,
+                               InspectionBuffer *out_buffer,
+                               int swf_type,
+                               uint32_t decompress_depth,
+                               uint32_t compress_depth)
+{
+    FileSwfStream *s = *stream;
+    if (s == NULL) {
+        int compression_type;
+        uint8_t swf_version = 0;
+        uint32_t offset = FileSwfCheckHeader(buffer, buffer_len, det_ctx,
+                                             &compression_type, &swf_version);
+        if (offset == 0) {
+            return 0;
+        }
+        if (compression_type == FILE_SWF_ZLIB_COMPRESSION &&
+            swf_type != HTTP_SWF_COMPRESSION_ZLIB &&
+            swf_type != HTTP_SWF_COMPRESSION_BOTH) {
+            return 0;
+        }
+        if (compression_type == FILE_SWF_LZMA_COMPRESSION) {
+#ifndef HAVE_LIBLZMA
+            return 0;
+#else
+            if (swf_type != HTTP_SWF_COMPRESSION_LZMA &&
+                swf_type != HTTP_SWF_COMPRESSION_BOTH) {
+                return 0;
+            }
+#endif
+        }
+
+        uint32_t decompressed_swf_len = FileGetSwfDecompressedLen(buffer, buffer_len);
+        if (decompressed_swf_len == 0) {
+            decompressed_swf_len = MIN_SWF_LEN;
+        }
+        uint32_t size = (decompress_depth == 0) ? decompressed_swf_len : decompress_depth;
+        size += 8;
+
+        s = HTPCalloc(1, sizeof(*s));
+        if (s != NULL) {
+            s->buf = HTPMalloc(size);
+            if (s->buf == NULL) {
+                HTPFree(s, sizeof(*s));
+                s = NULL;
+            }
+        }
+        if (s == NULL) {
+            return FileSwfDecompression(buffer, buffer_len, det_ctx, out_buffer,
+                                        swf_type, decompress_depth, compress_depth);
+        }
+        s->size = size;
+        FileSwfSetFwsHeader(s->buf, swf_version, decompressed_swf_len);
+        memset(s->buf + 8, 0, size - 8);
+        s->compression_type = compression_type;
+        s->in_offset = offset;
+        s->in_end = (compress_depth == 0) ? UINT64_MAX : (uint64_t)offset + compress_depth;
+        *stream = s;
+
+        if (FileSwfStreamInit(det_ctx, s, buffer) == 0) {
+            s->failed = true;
+        }
+    }
+
+    if (s->failed) {
+        return 0;
+    }
+    if (!s->done && buffer_len > s->in_offset && s->in_offset < s->in_end) {
+        const uint64_t end = MIN((uint64_t)buffer_len, s->in_end);
+        if (FileSwfStreamDecompress(det_ctx, s, buffer + s->in_offset,
+                                    (uint32_t)(end - s->in_offset)) == 0) {
+            s->failed = true;
+            return 0;
+        }
+        s->in_offset = end;
+    }
+
+    out_buffer->inspect = s->buf;
+    out_buffer->inspect_len = s->size;
+    return 1;
+}
+
+void FileSwfDecompressionStreamFree(FileSwfStream *stream)
+{
+    if (stream == NULL)
+        return;
+    FileSwfStreamEnd(stream);
+    HTPFree(stream->buf, stream->size);
+    HTPFree(stream, sizeof(*stream));
+}
@@ -81,11 +81,31 @@ uint8_t FileGetSwfVersion(const uint8_t *buffer, const uint32_t buffer_len)
  * | 4 bytes         | 4 bytes    | n bytes         |
  * | 'CWS' + version | script len | compressed data |
  */
+static int FileSwfZlibResult(DetectEngineThreadCtx *det_ctx, int result)
+{
+    switch(result) {
+        case Z_STREAM_END:
+        case Z_OK:
+            return 1;
+        case Z_DATA_ERROR:
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_DATA_ERROR);
+            return 0;
+        case Z_STREAM_ERROR:
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_STREAM_ERROR);
+            return 0;
+        case Z_BUF_ERROR:
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_BUF_ERROR);
+            return 0;
+        default:
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_UNKNOWN_ERROR);
+            return 0;
+    }
+}
+
 int FileSwfZlibDecompression(DetectEngineThreadCtx *det_ctx,
                              uint8_t *compressed_data, uint32_t compressed_data_len,
                              uint8_t *decompressed_data, uint32_t decompressed_data_len)
 {
-    int ret = 1;
     z_stream infstream;
     infstream.zalloc = Z_NULL;
     infstream.zfree = Z_NULL;
@@ -98,28 +118,7 @@ int FileSwfZlibDecompression(DetectEngineThreadCtx *det_ctx,
 
     inflateInit(&infstream);
     int result = inflate(&infstream, Z_NO_FLUSH);
-    switch(result) {
-        case Z_STREAM_END:
-            break;
-        case Z_OK:
-            break;
-        case Z_DATA_ERROR:
-            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_DATA_ERROR);
-            ret = 0;
-            break;
-        case Z_STREAM_ERROR:
-            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_STREAM_ERROR);
-            ret = 0;
-            break;
-        case Z_BUF_ERROR:
-            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_BUF_ERROR);
-            ret = 0;
-            break;
-        default:
-            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_Z_UNKNOWN_ERROR);
-            ret = 0;
-            break;
-    }
+    int ret = FileSwfZlibResult(det_ctx, result);
     inflateEnd(&infstream);
 
     return ret;
@@ -131,56 +130,158 @@ int FileSwfZlibDecompression(DetectEngineThreadCtx *det_ctx,
  * | 'ZWS' + version | script len | compressed len | LZMA props | LZMA data | LZMA end marker |
  */
 #ifdef HAVE_LIBLZMA
-int FileSwfLzmaDecompression(DetectEngineThreadCtx *det_ctx,
-                             uint8_t *compressed_data, uint32_t compressed_data_len,
-                             uint8_t *decompressed_data, uint32_t decompressed_data_len)
+static int FileSwfLzmaResult(DetectEngineThreadCtx *det_ctx, lzma_ret result)
 {
-    int ret = 1;
-    lzma_stream strm = LZMA_STREAM_INIT;
-    lzma_ret result = lzma_alone_decoder(&strm, UINT64_MAX /* memlimit */);
-    if (result != LZMA_OK) {
-        DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_DECODER_ERROR);
-        return 0;
-    }
-
-    strm.avail_in = compressed_data_len;
-    strm.next_in = compressed_data;
-    strm.avail_out = decompressed_data_len;
-    strm.next_out = decompressed_data;
-
-    result = lzma_code(&strm, LZMA_RUN);
     switch(result) {
         case LZMA_STREAM_END:
-            break;
         case LZMA_OK:
-            break;
+            return 1;
         case LZMA_MEMLIMIT_ERROR:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_MEMLIMIT_ERROR);
-            ret = 0;
-            break;
+            return 0;
         case LZMA_OPTIONS_ERROR:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_OPTIONS_ERROR);
-            ret = 0;
-            break;
+            return 0;
         case LZMA_FORMAT_ERROR:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_FORMAT_ERROR);
-            ret = 0;
-            break;
+            return 0;
         case LZMA_DATA_ERROR:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_DATA_ERROR);
-            ret = 0;
-            break;
+            return 0;
         case LZMA_BUF_ERROR:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_BUF_ERROR);
-            ret = 0;
-            break;
+            return 0;
         default:
             DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_UNKNOWN_ERROR);
-            ret = 0;
-            break;
+            return 0;
     }
+}
+
+int FileSwfLzmaDecompression(DetectEngineThreadCtx *det_ctx,
+                             uint8_t *compressed_data, uint32_t compressed_data_len,
+                             uint8_t *decompressed_data, uint32_t decompressed_data_len)
+{
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_ret result = lzma_alone_decoder(&strm, UINT64_MAX /* memlimit */);
+    if (result != LZMA_OK) {
+        DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_DECODER_ERROR);
+        return 0;
+    }
+
+    strm.avail_in = compressed_data_len;
+    strm.next_in = compressed_data;
+    strm.avail_out = decompressed_data_len;
+    strm.next_out = decompressed_data;
+
+    result = lzma_code(&strm, LZMA_RUN);
+    int ret = FileSwfLzmaResult(det_ctx, result);
 
     lzma_end(&strm);
     return ret;
 }
 #endif /* HAVE_LIBLZMA */
+
+/**
+ * \brief start the decompression of a swf file that continues as more of
+ *        the file arrives
+ *
+ * The output goes to s->buf after the 8 byte FWS header. For lzma the
+ * header lzma_alone_decoder() expects is put together from the properties
+ * in the ZWS header, see 'ZWS format' above.
+ *
+ * \param s stream with compression_type, buf and size set
+ * \param buffer start of the file, with the complete ZWS header for lzma
+ *
+ * \retval 1 ok
+ * \retval 0 error, event set
+ */
+int FileSwfStreamInit(DetectEngineThreadCtx *det_ctx, FileSwfStream *s,
+                      const uint8_t *buffer)
+{
+    if (s->compression_type == FILE_SWF_ZLIB_COMPRESSION) {
+        memset(&s->zs, 0, sizeof(s->zs));
+        s->zs.zalloc = Z_NULL;
+        s->zs.zfree = Z_NULL;
+        s->zs.opaque = Z_NULL;
+        if (inflateInit(&s->zs) != Z_OK) {
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_NO_MEM);
+            return 0;
+        }
+        s->zs.next_out = s->buf + 8;
+        s->zs.avail_out = s->size - 8;
+        s->init = true;
+        return 1;
+    }
+#ifdef HAVE_LIBLZMA
+    if (s->compression_type == FILE_SWF_LZMA_COMPRESSION) {
+        lzma_stream init = LZMA_STREAM_INIT;
+        s->ls = init;
+        if (lzma_alone_decoder(&s->ls, UINT64_MAX /* memlimit */) != LZMA_OK) {
+            DetectEngineSetEvent(det_ctx, FILE_DECODER_EVENT_LZMA_DECODER_ERROR);
+            return 0;
+        }
+        s->init = true;
+        s->ls.next_out = s->buf + 8;
+        s->ls.avail_out = s->size - 8;
+
+        uint8_t header[13];
+        /* put lzma properties */
+        memcpy(header, buffer + 12, 5);
+        /* put lzma end marker */
+        memset(header + 5, 0xFF, 8);
+        s->ls.next_in = header;
+        s->ls.avail_in = sizeof(header);
+        return FileSwfLzmaResult(det_ctx, lzma_code(&s->ls, LZMA_RUN));
+    }
+#endif
+    return 0;
+}
+
+/**
+ * \brief decompress the next part of the compressed data of a file
+ *
+ * Sets s->done once the output is full or the compressed data ended.
+ *
+ * \retval 1 ok
+ * \retval 0 error, event set
+ */
+int FileSwfStreamDecompress(DetectEngineThreadCtx *det_ctx, FileSwfStream *s,
+                            const uint8_t *data, uint32_t data_len)
+{
+    if (s->compression_type == FILE_SWF_ZLIB_COMPRESSION) {
+        s->zs.next_in = (Bytef *)data;
+        s->zs.avail_in = (uInt)data_len;
+        int result = inflate(&s->zs, Z_NO_FLUSH);
+        if (result == Z_STREAM_END || s->zs.avail_out == 0) {
+            s->done = true;
+            return 1;
+        }
+        return FileSwfZlibResult(det_ctx, result);
+    }
+#ifdef HAVE_LIBLZMA
+    if (s->compression_type == FILE_SWF_LZMA_COMPRESSION) {
+        s->ls.next_in = data;
+        s->ls.avail_in = data_len;
+        lzma_ret result = lzma_code(&s->ls, LZMA_RUN);
+        if (result == LZMA_STREAM_END || s->ls.avail_out == 0) {
+            s->done = true;
+            return 1;
+        }
+        return FileSwfLzmaResult(det_ctx, result);
+    }
+#endif
+    return 0;
+}
+
+void FileSwfStreamEnd(FileSwfStream *s)
+{
+    if (!s->init)
+        return;
+    if (s->compression_type == FILE_SWF_ZLIB_COMPRESSION)
+        inflateEnd(&s->zs);
+#ifdef HAVE_LIBLZMA
+    else if (s->compression_type == FILE_SWF_LZMA_COMPRESSION)
+        lzma_end(&s->ls);
+#endif
+    s->init = false;
+}
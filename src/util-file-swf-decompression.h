@@ -28,8 +28,31 @@
 /* If we don't have the decompressed data len,
  * we use a default value.
  */
+#include <zlib.h>
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
 #define MIN_SWF_LEN    2920
 
+/** decompression of a swf file that continues where it stopped as more
+ *  of the file arrives */
+typedef struct FileSwfStream_ {
+    int compression_type;   /**< FILE_SWF_ZLIB_COMPRESSION or
+                             *   FILE_SWF_LZMA_COMPRESSION */
+    bool init;              /**< zs or ls is set up */
+    bool done;              /**< output full or end of the compressed data */
+    bool failed;
+    uint64_t in_offset;     /**< file offset of the next compressed byte */
+    uint64_t in_end;        /**< file offset to stop at, compress-depth */
+    uint8_t *buf;           /**< FWS header and the decompressed data */
+    uint32_t size;
+    z_stream zs;
+#ifdef HAVE_LIBLZMA
+    lzma_stream ls;
+#endif
+} FileSwfStream;
+
 uint8_t FileGetSwfVersion(const uint8_t *buffer, const uint32_t buffer_len);
 uint32_t FileGetSwfDecompressedLen(const uint8_t *buffer, uint32_t buffr_len);
 int FileSwfZlibDecompression(DetectEngineThreadCtx *det_ctx,
@@ -40,5 +63,10 @@ int FileSwfLzmaDecompression(DetectEngineThreadCtx *det_ctx,
                              uint8_t *compressed_data, uint32_t compressed_data_len,
                              uint8_t *decompressed_data, uint32_t decompressed_data_len);
 #endif
+int FileSwfStreamInit(DetectEngineThreadCtx *det_ctx, FileSwfStream *s,
+                      const uint8_t *buffer);
+int FileSwfStreamDecompress(DetectEngineThreadCtx *det_ctx, FileSwfStream *s,
+                            const uint8_t *data, uint32_t data_len);
+void FileSwfStreamEnd(FileSwfStream *s);
 
 #endif /* __UTIL_FILE_SWF_DECOMPRESSION_H__ */
@@ -562,6 +562,50 @@ static int FileStoreNoStoreCheck(File *ff)
     SCReturnInt(0);
 }
 
+#ifdef HAVE_NSS
+/** data is passed to the hashes in blocks of this size, so that a block
+ *  read by the first hash is still in the L1 cache for the others */
+#define FILE_HASH_BLOCK_SIZE    8192
+
+/** \internal
+ *  \brief Update the hashes of a file with a chunk of data
+ *
+ *  With more than one hash the chunk is hashed block by block by each of
+ *  them, instead of each hash reading the whole chunk, which for large
+ *  chunks means reading it from memory again for every hash.
+ *
+ *  \retval 1 if the file has hashes
+ *  \retval 0 otherwise
+ */
+static int FileHashUpdate(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    HASHContext *ctxs[3];
+    int n = 0;
+
+    if (ff->md5_ctx)
+        ctxs[n++] = ff->md5_ctx;
+    if (ff->sha1_ctx)
+        ctxs[n++] = ff->sha1_ctx;
+    if (ff->sha256_ctx)
+        ctxs[n++] = ff->sha256_ctx;
+
+    if (n == 0)
+        return 0;
+    if (n == 1 || data_len <= FILE_HASH_BLOCK_SIZE) {
+        for (int i = 0; i < n; i++)
+            HASH_Update(ctxs[i], data, data_len);
+        return 1;
+    }
+
+    for (uint32_t offset = 0; offset < data_len; offset += FILE_HASH_BLOCK_SIZE) {
+        const uint32_t len = MIN(FILE_HASH_BLOCK_SIZE, data_len - offset);
+        for (int i = 0; i < n; i++)
+            HASH_Update(ctxs[i], data + offset, len);
+    }
+    return 1;
+}
+#endif
+
 static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
 {
     if (StreamingBufferAppendNoTrack(file->sb, data, data_len) != 0) {
@@ -569,15 +613,7 @@ static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
     }
 
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
-    }
-    if (file->sha1_ctx) {
-        HASH_Update(file->sha1_ctx, data, data_len);
-    }
-    if (file->sha256_ctx) {
-        HASH_Update(file->sha256_ctx, data, data_len);
-    }
+    (void)FileHashUpdate(file, data, data_len);
 #endif
     SCReturnInt(0);
 }
@@ -611,22 +647,8 @@ static int FileAppendDataDo(File *ff, const uint8_t *data, uint32_t data_len)
 
     if (FileStoreNoStoreCheck(ff) == 1) {
 #ifdef HAVE_NSS
-        int hash_done = 0;
         /* no storage but forced hashing */
-        if (ff->md5_ctx) {
-            HASH_Update(ff->md5_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha1_ctx) {
-            HASH_Update(ff->sha1_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha256_ctx) {
-            HASH_Update(ff->sha256_ctx, data, data_len);
-            hash_done = 1;
-        }
-
-        if (hash_done)
+        if (FileHashUpdate(ff, data, data_len))
             SCReturnInt(0);
 #endif
         if (g_file_force_tracking || (!(ff->flags & FILE_NOTRACK)))
@@ -896,12 +918,7 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
         if (ff->flags & FILE_NOSTORE) {
 #ifdef HAVE_NSS
             /* no storage but hashing */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
-            if (ff->sha1_ctx)
-                HASH_Update(ff->sha1_ctx, data, data_len);
-            if (ff->sha256_ctx)
-                HASH_Update(ff->sha256_ctx, data, data_len);
+            (void)FileHashUpdate(ff, data, data_len);
 #endif
         } else {
             if (AppendData(ff, data, data_len) != 0) {
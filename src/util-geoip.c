@@ -0,0 +1,253 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * The database is opened with MMDB_MODE_MMAP so the pages are shared
+ * with the page cache and a lookup is a walk of the mapped search tree,
+ * no copies and no locks. The flow storage holds the client and server
+ * country as a value, not a pointer: the low 16 bits are the client's,
+ * the next 16 the server's. Callers hold the flow lock, as for any other
+ * flow storage.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "decode.h"
+#include "flow.h"
+#include "flow-storage.h"
+#include "util-geoip.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_GEOIP
+#include <maxminddb.h>
+
+static MMDB_s geoip_db;
+#endif
+
+static bool geoip_enabled = false;
+static int geoip_flow_id = -1;
+
+static void GeoipFlowFree(void *ptr)
+{
+    /* the storage holds the countries, not a pointer */
+}
+
+static inline GeoipCountry GeoipCacheGet(const uintptr_t v, const bool client)
+{
+    return (GeoipCountry)(client ? (v & 0xffff) : ((v >> 16) & 0xffff));
+}
+
+static inline uintptr_t GeoipCacheSet(const uintptr_t v, const bool client,
+        const GeoipCountry c)
+{
+    if (client)
+        return (v & ~(uintptr_t)0xffff) | c;
+    return (v & ~((uintptr_t)0xffff << 16)) | ((uintptr_t)c << 16);
+}
+
+/** \brief the packet's src or dst is the flow's client */
+static inline bool GeoipPacketSideIsClient(const Packet *p, const bool src)
+{
+    return src == ((p->flowflags & FLOW_PKT_TOSERVER) != 0);
+}
+
+#ifdef HAVE_GEOIP
+static GeoipCountry GeoipLookup(const int family, const uint32_t *addr)
+{
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = addr[0];
+    } else if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, addr, sizeof(sin6->sin6_addr));
+    } else {
+        return GEOIP_COUNTRY_UNKNOWN;
+    }
+
+    int mmdb_error = 0;
+    MMDB_lookup_result_s r = MMDB_lookup_sockaddr(&geoip_db,
+            (struct sockaddr *)&ss, &mmdb_error);
+    if (mmdb_error != MMDB_SUCCESS || !r.found_entry)
+        return GEOIP_COUNTRY_UNKNOWN;
+
+    MMDB_entry_data_s data;
+    int status = MMDB_get_value(&r.entry, &data, "country", "iso_code", NULL);
+    if (status != MMDB_SUCCESS || !data.has_data ||
+            data.type != MMDB_DATA_TYPE_UTF8_STRING || data.data_size != 2)
+        return GEOIP_COUNTRY_UNKNOWN;
+
+    return GEOIP_COUNTRY_CODE(data.utf8_string[0], data.utf8_string[1]);
+}
+#else
+static GeoipCountry GeoipLookup(const int family, const uint32_t *addr)
+{
+    return GEOIP_COUNTRY_UNKNOWN;
+}
+#endif
+
+/**
+ *  \brief open the 'geoip-database' and register the flow storage
+ *
+ *  Called before the storage is finalized. Without the setting the
+ *  geoip keyword can't be used and EVE logs no countries.
+ */
+void GeoipInitConfig(void)
+{
+    const char *filename = NULL;
+    if (ConfGet("geoip-database", &filename) != 1 || filename == NULL)
+        return;
+
+#ifdef HAVE_GEOIP
+    int status = MMDB_open(filename, MMDB_MODE_MMAP, &geoip_db);
+    if (status != MMDB_SUCCESS) {
+        SCLogError(SC_ERR_GEOIP_ERROR, "failed to open geoip-database %s: %s",
+                filename, MMDB_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+
+    geoip_flow_id = FlowStorageRegister("geoip", sizeof(void *), NULL,
+            GeoipFlowFree, 0);
+    if (geoip_flow_id < 0) {
+        SCLogError(SC_ERR_GEOIP_ERROR, "geoip: failed to register the flow "
+                "storage");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogConfig("geoip-database %s loaded, %s built %"PRIu64, filename,
+            geoip_db.metadata.database_type,
+            (uint64_t)geoip_db.metadata.build_epoch);
+    geoip_enabled = true;
+#else
+    SCLogWarning(SC_ERR_NO_GEOIP_SUPPORT, "geoip-database is set, but "
+            "GeoIP support is not built in");
+#endif
+}
+
+void GeoipDestroy(void)
+{
+#ifdef HAVE_GEOIP
+    if (geoip_enabled)
+        MMDB_close(&geoip_db);
+#endif
+    geoip_enabled = false;
+}
+
+bool GeoipEnabled(void)
+{
+    return geoip_enabled;
+}
+
+/**
+ *  \brief country of the flow's client or server, looked up on first use
+ *
+ *  \retval c country or GEOIP_COUNTRY_UNKNOWN
+ */
+GeoipCountry GeoipFlowCountry(Flow *f, const bool client)
+{
+    if (!geoip_enabled)
+        return GEOIP_COUNTRY_UNKNOWN;
+
+    const uintptr_t v = (uintptr_t)FlowGetStorageById(f, geoip_flow_id);
+    GeoipCountry c = GeoipCacheGet(v, client);
+    if (c != 0)
+        return c;
+
+    const FlowAddress *a = client ? &f->src : &f->dst;
+    c = GeoipLookup(FLOW_IS_IPV4(f) ? AF_INET : AF_INET6, a->addr_data32);
+    FlowSetStorageById(f, geoip_flow_id, (void *)GeoipCacheSet(v, client, c));
+    return c;
+}
+
+/**
+ *  \brief country of the packet's source or destination
+ *
+ *  Uses the flow's countries if the packet has a flow, so each side of
+ *  a flow is only looked up once.
+ */
+GeoipCountry GeoipPacketCountry(const Packet *p, const bool src)
+{
+    if (!geoip_enabled)
+        return GEOIP_COUNTRY_UNKNOWN;
+
+    if (p->flow != NULL)
+        return GeoipFlowCountry(p->flow, GeoipPacketSideIsClient(p, src));
+
+    const Address *a = src ? &p->src : &p->dst;
+    return GeoipLookup(a->family, a->addr_data32);
+}
+
+#ifdef UNITTESTS
+/** \test both countries fit in the storage value */
+static int GeoipTest01(void)
+{
+    const GeoipCountry us = GEOIP_COUNTRY_CODE('U', 'S');
+    const GeoipCountry jp = GEOIP_COUNTRY_CODE('J', 'P');
+
+    uintptr_t v = 0;
+    FAIL_IF_NOT(GeoipCacheGet(v, true) == 0);
+    FAIL_IF_NOT(GeoipCacheGet(v, false) == 0);
+
+    v = GeoipCacheSet(v, false, jp);
+    FAIL_IF_NOT(GeoipCacheGet(v, true) == 0);
+    FAIL_IF_NOT(GeoipCacheGet(v, false) == jp);
+
+    v = GeoipCacheSet(v, true, us);
+    FAIL_IF_NOT(GeoipCacheGet(v, true) == us);
+    FAIL_IF_NOT(GeoipCacheGet(v, false) == jp);
+
+    v = GeoipCacheSet(v, true, GEOIP_COUNTRY_UNKNOWN);
+    FAIL_IF_NOT(GeoipCacheGet(v, true) == GEOIP_COUNTRY_UNKNOWN);
+    FAIL_IF_NOT(GeoipCacheGet(v, false) == jp);
+
+    char buf[3];
+    GeoipCountryToString(jp, buf);
+    FAIL_IF_NOT(strcmp(buf, "JP") == 0);
+    PASS;
+}
+
+/** \test the packet's src is the client to the server only */
+static int GeoipTest02(void)
+{
+    Packet p;
+    memset(&p, 0, sizeof(p));
+
+    p.flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF_NOT(GeoipPacketSideIsClient(&p, true));
+    FAIL_IF(GeoipPacketSideIsClient(&p, false));
+
+    p.flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF(GeoipPacketSideIsClient(&p, true));
+    FAIL_IF_NOT(GeoipPacketSideIsClient(&p, false));
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void GeoipRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("GeoipTest01", GeoipTest01);
+    UtRegisterTest("GeoipTest02", GeoipTest02);
+#endif
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * GeoIP country lookups against the MaxMind DB set with 'geoip-database'.
+ *
+ * The database is mapped once at startup and shared read only by all
+ * threads. The country of each side of a flow is looked up once and kept
+ * in the flow storage, so the geoip keyword and the EVE output share it.
+ */
+
+#ifndef __UTIL_GEOIP_H__
+#define __UTIL_GEOIP_H__
+
+#include "decode.h"
+#include "flow.h"
+
+/** a 2 letter country code packed in 16 bits, 0 is not looked up yet */
+typedef uint16_t GeoipCountry;
+
+#define GEOIP_COUNTRY_CODE(a, b)    (GeoipCountry)(((uint8_t)(a) << 8) | (uint8_t)(b))
+/** looked up, but the address is not in the database */
+#define GEOIP_COUNTRY_UNKNOWN       GEOIP_COUNTRY_CODE('-', '-')
+
+/** \brief country code as string, buf is at least 3 bytes */
+static inline void GeoipCountryToString(const GeoipCountry c, char *buf)
+{
+    buf[0] = (char)(c >> 8);
+    buf[1] = (char)(c & 0xff);
+    buf[2] = '\0';
+}
+
+void GeoipInitConfig(void);
+void GeoipDestroy(void);
+bool GeoipEnabled(void);
+
+GeoipCountry GeoipFlowCountry(Flow *f, const bool client);
+GeoipCountry GeoipPacketCountry(const Packet *p, const bool src);
+
+void GeoipRegisterTests(void);
+
+#endif /* __UTIL_GEOIP_H__ */
@@ -0,0 +1,210 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * The key is fed 64 bits at a time into two interleaved CRCs, so the
+ * latency of the instruction is hidden, and the two are combined with
+ * the murmur3 finalizer. A CRC alone is linear: the finalizer spreads
+ * the bits so that any part of the hash can be used as the bucket index,
+ * but it doesn't make the hash hard to flood, for that there is SipHash.
+ *
+ * The instruction is used without checks: callers make sure that
+ * HashCrc32cAvailable() is true. Without hardware support the CRC is
+ * computed bit by bit, which is only good for the tests.
+ */
+
+#include "suricata-common.h"
+#include "util-hash-crc32c.h"
+#include "util-cpu.h"
+#include "util-unittest.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_HAVE_SSE42
+#include <nmmintrin.h>
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_HAVE_ARM
+#include <arm_acle.h>
+#define CRC32C_TARGET
+#endif
+
+static inline uint32_t Crc32cSoftU32(uint32_t crc, uint32_t v)
+{
+    crc ^= v;
+    for (int i = 0; i < 32; i++)
+        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    return crc;
+}
+
+static inline uint32_t Crc32cSoftU64(uint32_t crc, uint64_t v)
+{
+    crc = Crc32cSoftU32(crc, (uint32_t)v);
+    return Crc32cSoftU32(crc, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t Crc32cFinal(uint32_t a, uint32_t b)
+{
+    uint32_t h = a ^ ((b << 16) | (b >> 16));
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* words are loaded in host order, so the hash differs between little and
+ * big endian hosts. That's fine as the seed is random anyway. */
+#define CRC32C_WORDS(StepU32, StepU64)                                      \
+    uint32_t a = seed ^ (uint32_t)n;                                        \
+    uint32_t b = ~seed;                                                     \
+    size_t i = 0;                                                           \
+    for ( ; i + 4 <= n; i += 4) {                                           \
+        uint64_t w0, w1;                                                    \
+        memcpy(&w0, k + i, sizeof(w0));                                     \
+        memcpy(&w1, k + i + 2, sizeof(w1));                                 \
+        a = StepU64(a, w0);                                                 \
+        b = StepU64(b, w1);                                                 \
+    }                                                                       \
+    if (i + 2 <= n) {                                                       \
+        uint64_t w;                                                         \
+        memcpy(&w, k + i, sizeof(w));                                       \
+        a = StepU64(a, w);                                                  \
+        i += 2;                                                             \
+    }                                                                       \
+    if (i < n)                                                              \
+        b = StepU32(b, k[i]);                                               \
+    return Crc32cFinal(a, b);
+
+#if !defined(CRC32C_TARGET) || defined(UNITTESTS)
+static uint32_t HashCrc32cWordsSoft(const uint32_t *k, size_t n, uint32_t seed)
+{
+    CRC32C_WORDS(Crc32cSoftU32, Crc32cSoftU64)
+}
+#endif
+
+#if defined(CRC32C_HAVE_SSE42)
+#define Crc32cHwU32(crc, v) _mm_crc32_u32((crc), (v))
+#define Crc32cHwU64(crc, v) (uint32_t)_mm_crc32_u64((crc), (v))
+#elif defined(CRC32C_HAVE_ARM)
+#define Crc32cHwU32(crc, v) __crc32cw((crc), (v))
+#define Crc32cHwU64(crc, v) __crc32cd((crc), (v))
+#endif
+
+#ifdef CRC32C_TARGET
+CRC32C_TARGET
+static uint32_t HashCrc32cWordsHw(const uint32_t *k, size_t n, uint32_t seed)
+{
+    CRC32C_WORDS(Crc32cHwU32, Crc32cHwU64)
+}
+#endif
+
+/** \brief the cpu has a CRC32C instruction that HashCrc32cWords() uses */
+bool HashCrc32cAvailable(void)
+{
+#if defined(CRC32C_HAVE_SSE42)
+    return UtilCpuHasSSE42() == 1;
+#elif defined(CRC32C_HAVE_ARM)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ *  \brief hash n words of k
+ *
+ *  \warning only call if HashCrc32cAvailable()
+ */
+uint32_t HashCrc32cWords(const uint32_t *k, size_t n, uint32_t seed)
+{
+#ifdef CRC32C_TARGET
+    return HashCrc32cWordsHw(k, n, seed);
+#else
+    return HashCrc32cWordsSoft(k, n, seed);
+#endif
+}
+
+#ifdef UNITTESTS
+/** \test the bit by bit CRC against the RFC 3720 check value */
+static int HashCrc32cTest01(void)
+{
+    /* "123456789" */
+    const uint8_t check[9] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    uint32_t crc = 0xffffffff;
+    for (int i = 0; i < 9; i++) {
+        crc ^= check[i];
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    }
+    FAIL_IF_NOT((crc ^ 0xffffffff) == 0xe3069283);
+
+    /* a word is its 4 bytes, least significant first */
+    const uint32_t w = check[0] | (check[1] << 8) | (check[2] << 16) |
+        ((uint32_t)check[3] << 24);
+    crc = 0xffffffff;
+    for (int i = 0; i < 4; i++) {
+        crc ^= check[i];
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    }
+    FAIL_IF_NOT(Crc32cSoftU32(0xffffffff, w) == crc);
+    PASS;
+}
+
+/** \test the instruction gives the same hash as the bit by bit CRC */
+static int HashCrc32cTest02(void)
+{
+    if (!HashCrc32cAvailable())
+        PASS;
+
+    uint32_t k[13];
+    for (uint32_t i = 0; i < 13; i++)
+        k[i] = 0x9e3779b9 * (i + 1);
+
+    for (size_t n = 0; n <= 13; n++) {
+        FAIL_IF_NOT(HashCrc32cWords(k, n, 0x1234) == HashCrc32cWordsSoft(k, n, 0x1234));
+    }
+    PASS;
+}
+
+/** \test seed, length and every word change the hash */
+static int HashCrc32cTest03(void)
+{
+    uint32_t k[13] = { 0 };
+    const uint32_t h = HashCrc32cWordsSoft(k, 13, 1);
+    FAIL_IF(HashCrc32cWordsSoft(k, 13, 2) == h);
+    FAIL_IF(HashCrc32cWordsSoft(k, 12, 1) == h);
+    for (int i = 0; i < 13; i++) {
+        k[i] = 1;
+        FAIL_IF(HashCrc32cWordsSoft(k, 13, 1) == h);
+        k[i] = 0;
+    }
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void HashCrc32cRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashCrc32cTest01", HashCrc32cTest01);
+    UtRegisterTest("HashCrc32cTest02", HashCrc32cTest02);
+    UtRegisterTest("HashCrc32cTest03", HashCrc32cTest03);
+#endif
+}
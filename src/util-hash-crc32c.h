@@ -0,0 +1,33 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hash of fixed size keys of 32 bit words, using the CRC32C instruction
+ * of SSE4.2 or the ARMv8 CRC extension.
+ */
+
+#ifndef __UTIL_HASH_CRC32C_H__
+#define __UTIL_HASH_CRC32C_H__
+
+bool HashCrc32cAvailable(void);
+uint32_t HashCrc32cWords(const uint32_t *k, size_t n, uint32_t seed);
+
+void HashCrc32cRegisterTests(void);
+
+#endif /* __UTIL_HASH_CRC32C_H__ */
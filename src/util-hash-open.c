@@ -0,0 +1,164 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * The table is generated in util-hash-open.h, these are its tests.
+ */
+
+#include "suricata-common.h"
+#include "util-hash-open.h"
+#include "util-unittest.h"
+
+#ifdef UNITTESTS
+typedef struct OpenHashTestEntry_ {
+    uint32_t id;
+} OpenHashTestEntry;
+
+/* all in one bucket, so every lookup probes */
+#define OpenHashTestCollide(id)     ((void)(id), 7U)
+#define OpenHashTestKey(e)          ((e)->id)
+#define OpenHashTestCmp(a, b)       ((a) == (b))
+
+OPEN_HASH_HEAD(OpenHashTest, OpenHashTestEntry);
+OPEN_HASH_GENERATE(OpenHashTest, OpenHashTestEntry, uint32_t, OpenHashU32,
+        OpenHashTestKey, OpenHashTestCmp)
+
+OPEN_HASH_HEAD(OpenHashTestC, OpenHashTestEntry);
+OPEN_HASH_GENERATE(OpenHashTestC, OpenHashTestEntry, uint32_t, OpenHashTestCollide,
+        OpenHashTestKey, OpenHashTestCmp)
+
+static int OpenHashTestCheck(const OpenHashTestC *t, OpenHashTestEntry *e,
+        const uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        OpenHashTestEntry *r = OpenHashTestCLookup(t, e[i].id);
+        if (e[i].id % 2) {
+            if (r != NULL)
+                return 0;
+        } else if (r != &e[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** \test add, lookup and duplicates, growing from the minimum size */
+static int OpenHashTest01(void)
+{
+    OpenHashTestEntry e[1000];
+    OpenHashTest *t = OpenHashTestInit(0);
+    FAIL_IF_NULL(t);
+    FAIL_IF_NOT(t->mask + 1 == OPEN_HASH_MIN_SIZE);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        e[i].id = i;
+        FAIL_IF_NOT(OpenHashTestAdd(t, &e[i]) == 0);
+    }
+    FAIL_IF_NOT(t->cnt == 1000);
+    FAIL_IF_NOT(t->cnt <= (t->mask + 1) / 4 * 3);
+
+    OpenHashTestEntry dup = { .id = 500 };
+    FAIL_IF_NOT(OpenHashTestAdd(t, &dup) == 1);
+    FAIL_IF_NOT(OpenHashTestLookup(t, 500) == &e[500]);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        FAIL_IF_NOT(OpenHashTestLookup(t, i) == &e[i]);
+    }
+    FAIL_IF_NOT_NULL(OpenHashTestLookup(t, 1000));
+
+    uint32_t cnt = 0;
+    OpenHashTestEntry *var;
+    OPEN_HASH_FOREACH(var, t) {
+        cnt++;
+    }
+    FAIL_IF_NOT(cnt == 1000);
+
+    OpenHashTestFree(t, NULL);
+    PASS;
+}
+
+/** \test removal keeps the rest of the probe run reachable */
+static int OpenHashTest02(void)
+{
+    OpenHashTestEntry e[10];
+    OpenHashTestC *t = OpenHashTestCInit(10);
+    FAIL_IF_NULL(t);
+
+    for (uint32_t i = 0; i < 10; i++) {
+        e[i].id = i;
+        FAIL_IF_NOT(OpenHashTestCAdd(t, &e[i]) == 0);
+    }
+    for (uint32_t i = 1; i < 10; i += 2) {
+        FAIL_IF_NOT(OpenHashTestCRemove(t, i) == &e[i]);
+    }
+    FAIL_IF_NOT_NULL(OpenHashTestCRemove(t, 1));
+    FAIL_IF_NOT(t->cnt == 5);
+    FAIL_IF_NOT(OpenHashTestCheck(t, e, 10));
+
+    /* the run is contiguous again: no holes left in front of entries */
+    uint32_t home = 7 & t->mask;
+    for (uint32_t i = 0; i < 5; i++) {
+        FAIL_IF_NULL(t->slots[(home + i) & t->mask].data);
+    }
+    FAIL_IF_NOT_NULL(t->slots[(home + 5) & t->mask].data);
+
+    OpenHashTestCFree(t, NULL);
+    PASS;
+}
+
+/** \test removal with a run wrapping around the end of the slots */
+static int OpenHashTest03(void)
+{
+    OpenHashTestEntry e[12];
+    OpenHashTest *t = OpenHashTestInit(12);
+    FAIL_IF_NULL(t);
+
+    uint32_t n = 0;
+    /* pick ids with their home in the last slots */
+    for (uint32_t id = 0; n < 12; id++) {
+        if ((OpenHashU32(id) & t->mask) >= t->mask - 1) {
+            e[n].id = id;
+            FAIL_IF_NOT(OpenHashTestAdd(t, &e[n]) == 0);
+            n++;
+        }
+    }
+    FAIL_IF_NOT(t->mask + 1 == 16);
+
+    for (uint32_t i = 0; i < n; i += 3) {
+        FAIL_IF_NOT(OpenHashTestRemove(t, e[i].id) == &e[i]);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        OpenHashTestEntry *r = OpenHashTestLookup(t, e[i].id);
+        FAIL_IF_NOT(r == ((i % 3) ? &e[i] : NULL));
+    }
+    FAIL_IF_NOT(t->cnt == 8);
+
+    OpenHashTestFree(t, NULL);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void OpenHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("OpenHashTest01", OpenHashTest01);
+    UtRegisterTest("OpenHashTest02", OpenHashTest02);
+    UtRegisterTest("OpenHashTest03", OpenHashTest03);
+#endif
+}
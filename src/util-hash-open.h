@@ -0,0 +1,213 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Open addressing hash table, generated per entry type.
+ *
+ * HashTable and HashListTable allocate a bucket per entry and call the
+ * hash and compare functions through pointers on every lookup. This table
+ * is a single array of slots probed linearly. Each slot keeps the hash of
+ * its entry next to the pointer, so most mismatches are rejected without
+ * touching the entry. OPEN_HASH_GENERATE() generates the functions for an
+ * entry type, with its hash, key and compare functions inlined.
+ *
+ * The slot count is a power of 2 and the table grows when it is 3/4 full.
+ * Removal shifts the following entries of the probe run back, so there
+ * are no tombstones. Entries are never NULL. There is no locking.
+ *
+ * Usage:
+ *
+ *     OPEN_HASH_HEAD(FooHash, Foo);
+ *     OPEN_HASH_GENERATE(FooHash, Foo, uint32_t, FooHashFunc, FooKey, FooCmp)
+ *
+ * with FooKey(Foo *) returning the key_type key of an entry, FooHashFunc
+ * taking a key and FooCmp comparing two keys, non-zero if equal. This
+ * generates FooHashInit(), FooHashFree(), FooHashLookup(), FooHashAdd()
+ * and FooHashRemove().
+ */
+
+#ifndef __UTIL_HASH_OPEN_H__
+#define __UTIL_HASH_OPEN_H__
+
+#define OPEN_HASH_MIN_SIZE  16
+
+#define OPEN_HASH_HEAD(name, type)                                          \
+    typedef struct name##Slot_ {                                            \
+        uint32_t hash;                                                      \
+        type *data;                                                         \
+    } name##Slot;                                                           \
+                                                                            \
+    typedef struct name##_ {                                                \
+        name##Slot *slots;                                                  \
+        uint32_t mask;  /**< number of slots - 1 */                         \
+        uint32_t cnt;   /**< number of entries */                           \
+    } name
+
+/** \brief loop over all entries of a table, in slot order */
+#define OPEN_HASH_FOREACH(var, t)                                           \
+    for (uint32_t _oh_i = 0; _oh_i <= (t)->mask; _oh_i++)                   \
+        if (((var) = (t)->slots[_oh_i].data) != NULL)
+
+#define OPEN_HASH_GENERATE(name, type, key_type, HashFunc, KeyFunc, CmpFunc) \
+/** \brief create a table with room for cnt entries before growing */      \
+static inline name *name##Init(uint32_t cnt)                                \
+{                                                                           \
+    uint32_t size = OPEN_HASH_MIN_SIZE;                                     \
+    while (size / 4 * 3 < cnt && size < (1U << 31))                         \
+        size <<= 1;                                                         \
+                                                                            \
+    name *t = SCCalloc(1, sizeof(*t));                                      \
+    if (unlikely(t == NULL))                                                \
+        return NULL;                                                        \
+    t->slots = SCCalloc(size, sizeof(name##Slot));                          \
+    if (unlikely(t->slots == NULL)) {                                       \
+        SCFree(t);                                                          \
+        return NULL;                                                        \
+    }                                                                       \
+    t->mask = size - 1;                                                     \
+    return t;                                                               \
+}                                                                           \
+                                                                            \
+/** \brief free the table, and the entries if FreeFunc is not NULL */       \
+static inline void name##Free(name *t, void (*FreeFunc)(type *))            \
+{                                                                           \
+    if (t == NULL)                                                          \
+        return;                                                             \
+    if (FreeFunc != NULL) {                                                 \
+        for (uint32_t i = 0; i <= t->mask; i++) {                           \
+            if (t->slots[i].data != NULL)                                   \
+                FreeFunc(t->slots[i].data);                                 \
+        }                                                                   \
+    }                                                                       \
+    SCFree(t->slots);                                                       \
+    SCFree(t);                                                              \
+}                                                                           \
+                                                                            \
+static inline type *name##Lookup(const name *t, key_type key)               \
+{                                                                           \
+    const uint32_t hash = HashFunc(key);                                    \
+    for (uint32_t i = hash & t->mask; t->slots[i].data != NULL;             \
+            i = (i + 1) & t->mask) {                                        \
+        if (t->slots[i].hash == hash && CmpFunc(KeyFunc(t->slots[i].data), key)) \
+            return t->slots[i].data;                                        \
+    }                                                                       \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##Place(name##Slot *slots, const uint32_t mask,      \
+        const uint32_t hash, type *data)                                    \
+{                                                                           \
+    uint32_t i = hash & mask;                                               \
+    while (slots[i].data != NULL)                                           \
+        i = (i + 1) & mask;                                                 \
+    slots[i].hash = hash;                                                   \
+    slots[i].data = data;                                                   \
+}                                                                           \
+                                                                            \
+static inline int name##Grow(name *t)                                       \
+{                                                                           \
+    const uint32_t size = (t->mask + 1) * 2;                                \
+    if (size == 0)                                                          \
+        return -1;                                                          \
+    name##Slot *slots = SCCalloc(size, sizeof(name##Slot));                 \
+    if (unlikely(slots == NULL))                                            \
+        return -1;                                                          \
+    for (uint32_t i = 0; i <= t->mask; i++) {                               \
+        if (t->slots[i].data != NULL)                                       \
+            name##Place(slots, size - 1, t->slots[i].hash, t->slots[i].data); \
+    }                                                                       \
+    SCFree(t->slots);                                                       \
+    t->slots = slots;                                                       \
+    t->mask = size - 1;                                                     \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ *  \retval 0 added                                                         \
+ *  \retval 1 an entry with the same key exists, data is not added          \
+ *  \retval -1 error                                                        \
+ */                                                                         \
+static inline int name##Add(name *t, type *data)                            \
+{                                                                           \
+    if (data == NULL)                                                       \
+        return -1;                                                          \
+    if (name##Lookup(t, KeyFunc(data)) != NULL)                             \
+        return 1;                                                           \
+    if (t->cnt + 1 > (t->mask + 1) / 4 * 3 && name##Grow(t) != 0)           \
+        return -1;                                                          \
+    name##Place(t->slots, t->mask, HashFunc(KeyFunc(data)), data);          \
+    t->cnt++;                                                               \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/** \brief remove an entry, it is returned and not freed */                 \
+static inline type *name##Remove(name *t, key_type key)                     \
+{                                                                           \
+    const uint32_t hash = HashFunc(key);                                    \
+    uint32_t i = hash & t->mask;                                            \
+    for ( ; t->slots[i].data != NULL; i = (i + 1) & t->mask) {              \
+        if (t->slots[i].hash == hash && CmpFunc(KeyFunc(t->slots[i].data), key)) \
+            break;                                                          \
+    }                                                                       \
+    type *data = t->slots[i].data;                                          \
+    if (data == NULL)                                                       \
+        return NULL;                                                        \
+                                                                            \
+    /* move back the entries of the run that may take the hole: those      \
+     * whose home slot is not between the hole and themselves */           \
+    uint32_t hole = i;                                                      \
+    for (uint32_t j = (i + 1) & t->mask; t->slots[j].data != NULL;          \
+            j = (j + 1) & t->mask) {                                        \
+        const uint32_t home = t->slots[j].hash & t->mask;                   \
+        if (((j - home) & t->mask) >= ((j - hole) & t->mask)) {             \
+            t->slots[hole] = t->slots[j];                                   \
+            hole = j;                                                       \
+        }                                                                   \
+    }                                                                       \
+    t->slots[hole].data = NULL;                                             \
+    t->slots[hole].hash = 0;                                                \
+    t->cnt--;                                                               \
+    return data;                                                            \
+}
+
+/** \brief hash for integer keys, spreads sequential ids over the low bits */
+static inline uint32_t OpenHashU32(uint32_t v)
+{
+    v ^= v >> 16;
+    v *= 0x7feb352d;
+    v ^= v >> 15;
+    v *= 0x846ca68b;
+    v ^= v >> 16;
+    return v;
+}
+
+/** \brief FNV-1a of a nul terminated string, mixed with a seed */
+static inline uint32_t OpenHashString(const char *s, uint32_t seed)
+{
+    uint32_t h = 2166136261U ^ seed;
+    for ( ; *s != '\0'; s++) {
+        h ^= (uint8_t)*s;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+void OpenHashRegisterTests(void);
+
+#endif /* __UTIL_HASH_OPEN_H__ */
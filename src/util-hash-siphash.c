@@ -0,0 +1,129 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SipHash-2-4 by Jean-Philippe Aumasson and Daniel J. Bernstein. The
+ * input and the key are read as little endian, as in the reference.
+ */
+
+#include "suricata-common.h"
+#include "util-hash-siphash.h"
+#include "util-unittest.h"
+
+#define SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND                                                           \
+    do {                                                                    \
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32);   \
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                          \
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                          \
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32);   \
+    } while (0)
+
+static inline uint64_t SipLoad64(const uint8_t *p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+        ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+        ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+uint64_t SipHash24(const uint8_t *in, size_t len, const uint64_t key[2])
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    const uint8_t *end = in + (len & ~(size_t)7);
+
+    for ( ; in != end; in += 8) {
+        const uint64_t m = SipLoad64(in);
+        v3 ^= m;
+        SIP_ROUND;
+        SIP_ROUND;
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t)len << 56;
+    switch (len & 7) {
+        case 7: b |= (uint64_t)in[6] << 48; /* fall through */
+        case 6: b |= (uint64_t)in[5] << 40; /* fall through */
+        case 5: b |= (uint64_t)in[4] << 32; /* fall through */
+        case 4: b |= (uint64_t)in[3] << 24; /* fall through */
+        case 3: b |= (uint64_t)in[2] << 16; /* fall through */
+        case 2: b |= (uint64_t)in[1] << 8;  /* fall through */
+        case 1: b |= (uint64_t)in[0];       /* fall through */
+        case 0: break;
+    }
+
+    v3 ^= b;
+    SIP_ROUND;
+    SIP_ROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIP_ROUND;
+    SIP_ROUND;
+    SIP_ROUND;
+    SIP_ROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/** \brief hash n words of k, folded to 32 bits */
+uint32_t HashSipWords(const uint32_t *k, size_t n, const uint64_t key[2])
+{
+    const uint64_t h = SipHash24((const uint8_t *)k, n * sizeof(uint32_t), key);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+#ifdef UNITTESTS
+/** \test vectors from the reference implementation: key 00..0f and
+ *        input 00..(len-1) */
+static int HashSipTest01(void)
+{
+    const uint64_t key[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+    uint8_t in[16];
+    for (int i = 0; i < 16; i++)
+        in[i] = (uint8_t)i;
+
+    FAIL_IF_NOT(SipHash24(in, 0, key) == 0x726fdb47dd0e0e31ULL);
+    FAIL_IF_NOT(SipHash24(in, 7, key) == 0xab0200f58b01d137ULL);
+    FAIL_IF_NOT(SipHash24(in, 8, key) == 0x93f5f5799a932462ULL);
+    FAIL_IF_NOT(SipHash24(in, 15, key) == 0xa129ca6149be45e5ULL);
+    PASS;
+}
+
+/** \test the key changes the hash */
+static int HashSipTest02(void)
+{
+    const uint32_t k[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    const uint64_t key1[2] = { 1, 2 };
+    const uint64_t key2[2] = { 1, 3 };
+    FAIL_IF(HashSipWords(k, 7, key1) == HashSipWords(k, 7, key2));
+    FAIL_IF(HashSipWords(k, 7, key1) == HashSipWords(k, 6, key1));
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void HashSipRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashSipTest01", HashSipTest01);
+    UtRegisterTest("HashSipTest02", HashSipTest02);
+#endif
+}
@@ -0,0 +1,32 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SipHash-2-4, a keyed hash that is hard to flood without the key.
+ */
+
+#ifndef __UTIL_HASH_SIPHASH_H__
+#define __UTIL_HASH_SIPHASH_H__
+
+uint64_t SipHash24(const uint8_t *in, size_t len, const uint64_t key[2]);
+uint32_t HashSipWords(const uint32_t *k, size_t n, const uint64_t key[2]);
+
+void HashSipRegisterTests(void);
+
+#endif /* __UTIL_HASH_SIPHASH_H__ */
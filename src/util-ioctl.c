@@ -734,6 +734,39 @@ void RestoreIfaceOffloading(LiveDevice *dev)
     }
 }
 
+/**
+ * \brief Get the NUMA node the NIC of an interface is attached to
+ *
+ * The device can be given as an interface name or, for capture methods
+ * taking over the NIC like DPDK, as a PCI address.
+ *
+ * \retval node id, -1 if unknown or not applicable
+ */
+int GetIfaceNumaNode(const char *dev)
+{
+#ifdef __linux__
+    char path[PATH_MAX];
+    char buf[16];
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", dev);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/numa_node", dev);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            return -1;
+    }
+    if (fgets(buf, sizeof(buf), fp) != NULL) {
+        node = atoi(buf);
+    }
+    fclose(fp);
+    return node;
+#else
+    return -1;
+#endif
+}
+
 int GetIfaceRSSQueuesNum(const char *pcap_dev)
 {
 #if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_GRXRINGS
@@ -32,6 +32,7 @@ int GetIfaceMTU(const char *pcap_dev);
 int GetIfaceMaxPacketSize(const char *pcap_dev);
 int GetIfaceOffloading(const char *dev, int csum, int other);
 int GetIfaceRSSQueuesNum(const char *pcap_dev);
+int GetIfaceNumaNode(const char *dev);
 #ifdef SIOCGIFFLAGS
 int GetIfaceFlags(const char *ifname);
 #endif
@@ -20,233 +20,220 @@
  *
  * \author Mats Klepsland <mats.klepsland@gmail.com>
  *
- * Functions used to generate JA3 fingerprint.
+ * Functions used to generate JA3 and JA3S fingerprints.
+ *
+ * A fingerprint is built in the per thread JA3ThreadCtx: the values of
+ * each field are written as decimal digits to the buffer of that field,
+ * which is kept between hellos. Ja3Finish() joins the fields into a single
+ * allocation, together with the md5 of the string.
  */
 
 #include "suricata-common.h"
 #include "util-validate.h"
 #include "util-ja3.h"
+#include "util-unittest.h"
 
-#define MD5_STRING_LENGTH 33
+/* a uint16_t value is at most 5 digits, plus the '-' separator */
+#define JA3_VALUE_MAX_LEN 6
 
 /**
- * \brief Allocate new buffer.
+ * \brief Allocate the per thread scratch space.
  *
- * \return pointer to buffer on success.
- * \return NULL on failure.
+ * \retval ctx on success.
+ * \retval NULL on failure.
  */
-JA3Buffer *Ja3BufferInit(void)
+JA3ThreadCtx *Ja3ThreadCtxAlloc(void)
 {
-    JA3Buffer *buffer = SCCalloc(1, sizeof(JA3Buffer));
-    if (buffer == NULL) {
+    JA3ThreadCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
         return NULL;
-    }
 
-    return buffer;
+    for (int i = 0; i < JA3_FIELD_MAX; i++) {
+        ctx->fields[i].data = SCMalloc(JA3_FIELD_INITIAL_SIZE);
+        if (ctx->fields[i].data == NULL)
+            goto error;
+        ctx->fields[i].size = JA3_FIELD_INITIAL_SIZE;
+    }
+#ifdef HAVE_NSS
+    ctx->md5_ctx = HASH_Create(HASH_AlgMD5);
+    if (ctx->md5_ctx == NULL)
+        goto error;
+#endif
+    return ctx;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating JA3 thread context");
+    Ja3ThreadCtxFree(ctx);
+    return NULL;
 }
 
 /**
- * \brief Free allocated buffer.
- *
- * \param buffer The buffer to free.
+ * \brief Free the per thread scratch space.
  */
-void Ja3BufferFree(JA3Buffer **buffer)
+void Ja3ThreadCtxFree(JA3ThreadCtx *ctx)
 {
-    DEBUG_VALIDATE_BUG_ON(*buffer == NULL);
+    if (ctx == NULL)
+        return;
 
-    if ((*buffer)->data != NULL) {
-        SCFree((*buffer)->data);
-        (*buffer)->data = NULL;
+    for (int i = 0; i < JA3_FIELD_MAX; i++) {
+        if (ctx->fields[i].data != NULL)
+            SCFree(ctx->fields[i].data);
     }
+#ifdef HAVE_NSS
+    if (ctx->md5_ctx != NULL)
+        HASH_Destroy(ctx->md5_ctx);
+#endif
+    SCFree(ctx);
+}
 
-    SCFree(*buffer);
-    *buffer = NULL;
+/**
+ * \brief Start a new fingerprint.
+ */
+void Ja3Reset(JA3ThreadCtx *ctx)
+{
+    for (int i = 0; i < JA3_FIELD_MAX; i++) {
+        ctx->fields[i].used = 0;
+    }
 }
 
 /**
  * \internal
- * \brief Resize buffer if it is full.
- *
- * \param buffer The buffer.
- * \param len    The length of the data that should fit into the buffer.
+ * \brief Grow a field buffer, only needed for very large hellos.
  *
  * \retval 0 on success.
  * \retval -1 on failure.
  */
-static int Ja3BufferResizeIfFull(JA3Buffer *buffer, uint32_t len)
+static int Ja3FieldGrow(JA3FieldBuffer *field)
 {
-    DEBUG_VALIDATE_BUG_ON(buffer == NULL);
-
-    while (buffer->used + len + 2 > buffer->size)
-    {
-        buffer->size *= 2;
-        char *tmp = SCRealloc(buffer->data, buffer->size * sizeof(char));
-        if (tmp == NULL) {
-            SCLogError(SC_ERR_MEM_ALLOC, "Error resizing JA3 buffer");
-            return -1;
-        }
-        buffer->data = tmp;
+    const uint32_t size = field->size * 2;
+    char *tmp = SCRealloc(field->data, size);
+    if (tmp == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error resizing JA3 buffer");
+        return -1;
     }
-
+    field->data = tmp;
+    field->size = size;
     return 0;
 }
 
 /**
- * \brief Append buffer to buffer.
- *
- * Append the second buffer to the first and then free it.
+ * \brief Add value to a field, '-' separated from the previous one.
  *
- * \param buffer1 The first buffer.
- * \param buffer2 The second buffer.
+ * \param ctx   The thread context.
+ * \param field The field to add the value to.
+ * \param value The value.
  *
  * \retval 0 on success.
  * \retval -1 on failure.
  */
-int Ja3BufferAppendBuffer(JA3Buffer **buffer1, JA3Buffer **buffer2)
+int Ja3AddValue(JA3ThreadCtx *ctx, enum JA3Field field, uint16_t value)
 {
-    if (*buffer1 == NULL || *buffer2 == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Buffers should not be NULL");
-        return -1;
-    }
-
-    /* If buffer1 contains no data, then we just copy the second buffer
-       instead of appending its data. */
-    if ((*buffer1)->data == NULL) {
-        (*buffer1)->data = (*buffer2)->data;
-        (*buffer1)->used = (*buffer2)->used;
-        (*buffer1)->size = (*buffer2)->size;
-        SCFree(*buffer2);
-        return 0;
-    }
+    DEBUG_VALIDATE_BUG_ON(field >= JA3_FIELD_MAX);
 
-    int rc = Ja3BufferResizeIfFull(*buffer1, (*buffer2)->used);
-    if (rc != 0) {
-        Ja3BufferFree(buffer1);
-        Ja3BufferFree(buffer2);
-        return -1;
+    JA3FieldBuffer *f = &ctx->fields[field];
+    if (unlikely(f->size - f->used < JA3_VALUE_MAX_LEN)) {
+        if (Ja3FieldGrow(f) != 0)
+            return -1;
     }
 
-    if ((*buffer2)->used == 0) {
-        (*buffer1)->used += snprintf((*buffer1)->data + (*buffer1)->used,
-                                     (*buffer1)->size - (*buffer1)->used, ",");
-    } else {
-        (*buffer1)->used += snprintf((*buffer1)->data + (*buffer1)->used,
-                                     (*buffer1)->size - (*buffer1)->used, ",%s",
-                                     (*buffer2)->data);
+    char *dst = f->data + f->used;
+    if (f->used != 0)
+        *dst++ = '-';
+
+    /* digits in reverse, then copy them in order */
+    char digits[5];
+    uint32_t n = 0;
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *dst++ = digits[--n];
     }
 
-    Ja3BufferFree(buffer2);
-
+    f->used = dst - f->data;
     return 0;
 }
 
 /**
  * \internal
- * \brief Return number of digits in number.
- *
- * \param num The number.
- *
- * \return digits Number of digits.
+ * \brief Md5 of the JA3 string as hex string.
  */
-static uint32_t NumberOfDigits(uint32_t num)
+static void Ja3Hash(JA3ThreadCtx *ctx, const char *data, uint32_t len,
+                    char *hash)
 {
-    if (num < 10) {
-        return 1;
-    }
+#ifdef HAVE_NSS
+    static const char hex[] = "0123456789abcdef";
+    unsigned char md5[MD5_LENGTH];
+    unsigned int md5_len = 0;
+
+    /* reuse the context, HASH_HashBuf() would create one per call */
+    HASH_Begin(ctx->md5_ctx);
+    HASH_Update(ctx->md5_ctx, (const unsigned char *)data, len);
+    HASH_End(ctx->md5_ctx, md5, &md5_len, sizeof(md5));
 
-    return 1 + NumberOfDigits(num / 10);
+    for (int i = 0; i < MD5_LENGTH; i++) {
+        hash[i * 2] = hex[md5[i] >> 4];
+        hash[i * 2 + 1] = hex[md5[i] & 0x0f];
+    }
+    hash[MD5_LENGTH * 2] = '\0';
+#else
+    hash[0] = '\0';
+#endif /* HAVE_NSS */
 }
 
 /**
- * \brief Add value to buffer.
+ * \brief Join the fields into the JA3 string and generate its hash.
  *
- * \param buffer The buffer.
- * \param value  The value.
+ * \param ctx    The thread context.
+ * \param fields Number of fields to use, JA3_FIELD_MAX or JA3S_FIELD_MAX.
  *
- * \retval 0 on success.
- * \retval -1 on failure.
+ * \retval buffer on success, free with Ja3BufferFree().
+ * \retval NULL on failure.
  */
-int Ja3BufferAddValue(JA3Buffer **buffer, uint32_t value)
+JA3Buffer *Ja3Finish(JA3ThreadCtx *ctx, int fields)
 {
-    if (*buffer == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Buffer should not be NULL");
-        return -1;
-    }
-
-    if ((*buffer)->data == NULL) {
-        (*buffer)->data = SCMalloc(JA3_BUFFER_INITIAL_SIZE * sizeof(char));
-        if ((*buffer)->data == NULL) {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                       "Error allocating memory for JA3 data");
-            Ja3BufferFree(buffer);
-            return -1;
-        }
-        (*buffer)->size = JA3_BUFFER_INITIAL_SIZE;
-    }
-
-    uint32_t value_len = NumberOfDigits(value);
+    DEBUG_VALIDATE_BUG_ON(fields <= 0 || fields > JA3_FIELD_MAX);
 
-    int rc = Ja3BufferResizeIfFull(*buffer, value_len);
-    if (rc != 0) {
-        Ja3BufferFree(buffer);
-        return -1;
+    /* the ',' separators and the terminating NUL */
+    size_t len = fields;
+    for (int i = 0; i < fields; i++) {
+        len += ctx->fields[i].used;
     }
 
-    if ((*buffer)->used == 0) {
-        (*buffer)->used += snprintf((*buffer)->data, (*buffer)->size, "%d",
-                                    value);
+    JA3Buffer *buffer = SCMalloc(sizeof(*buffer) + len);
+    if (buffer == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for JA3 data");
+        return NULL;
     }
-    else {
-        (*buffer)->used += snprintf((*buffer)->data + (*buffer)->used,
-                                    (*buffer)->size - (*buffer)->used, "-%d",
-                                    value);
+    buffer->data = (char *)(buffer + 1);
+    buffer->size = len;
+
+    char *dst = buffer->data;
+    for (int i = 0; i < fields; i++) {
+        if (i != 0)
+            *dst++ = ',';
+        memcpy(dst, ctx->fields[i].data, ctx->fields[i].used);
+        dst += ctx->fields[i].used;
     }
+    *dst = '\0';
+    buffer->used = dst - buffer->data;
 
-    return 0;
+    Ja3Hash(ctx, buffer->data, buffer->used, buffer->hash);
+    return buffer;
 }
 
 /**
- * \brief Generate Ja3 hash string.
- *
- * \param buffer The Ja3 buffer.
+ * \brief Free buffer.
  *
- * \retval pointer to hash string on success.
- * \retval NULL on failure.
+ * \param buffer The buffer to free.
  */
-char *Ja3GenerateHash(JA3Buffer *buffer)
+void Ja3BufferFree(JA3Buffer **buffer)
 {
+    DEBUG_VALIDATE_BUG_ON(*buffer == NULL);
 
-#ifdef HAVE_NSS
-    if (buffer == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Buffer should not be NULL");
-        return NULL;
-    }
-
-    if (buffer->data == NULL) {
-        SCLogError(SC_ERR_INVALID_VALUE, "Buffer data should not be NULL");
-        return NULL;
-    }
-
-    char *ja3_hash = SCMalloc(MD5_STRING_LENGTH * sizeof(char));
-    if (ja3_hash == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC,
-                   "Error allocating memory for JA3 hash");
-        return NULL;
-    }
-
-    unsigned char md5[MD5_LENGTH];
-    HASH_HashBuf(HASH_AlgMD5, md5, (unsigned char *)buffer->data, buffer->used);
-
-    int i, x;
-    for (i = 0, x = 0; x < MD5_LENGTH; x++) {
-        i += snprintf(ja3_hash + i, MD5_STRING_LENGTH - i, "%02x", md5[x]);
-    }
-
-    return ja3_hash;
-#else
-    return NULL;
-#endif /* HAVE_NSS */
-
+    SCFree(*buffer);
+    *buffer = NULL;
 }
 
 /**
@@ -283,3 +270,83 @@ int Ja3IsDisabled(const char *type)
 
     return 0;
 }
+
+#ifdef UNITTESTS
+
+/**
+ * \test JA3 string of a small hello, with empty fields and a field that
+ *       outgrows its initial buffer.
+ */
+static int Ja3Test01(void)
+{
+    JA3ThreadCtx *ctx = Ja3ThreadCtxAlloc();
+    FAIL_IF_NULL(ctx);
+
+    Ja3Reset(ctx);
+    FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_VERSION, 771) != 0);
+    FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_CIPHERS, 49195) != 0);
+    FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_CIPHERS, 0) != 0);
+    FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_CIPHERS, 65535) != 0);
+    FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_POINT_FORMATS, 0) != 0);
+
+    JA3Buffer *buffer = Ja3Finish(ctx, JA3_FIELD_MAX);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(strcmp(buffer->data, "771,49195-0-65535,,,0") != 0);
+    FAIL_IF(buffer->used != strlen(buffer->data));
+    Ja3BufferFree(&buffer);
+
+    /* JA3S only uses the first fields */
+    buffer = Ja3Finish(ctx, JA3S_FIELD_MAX);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(strcmp(buffer->data, "771,49195-0-65535,") != 0);
+    Ja3BufferFree(&buffer);
+
+    Ja3Reset(ctx);
+    for (int i = 0; i < 1000; i++) {
+        FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_EXTENSIONS, 10000) != 0);
+    }
+    buffer = Ja3Finish(ctx, JA3S_FIELD_MAX);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(buffer->used != 2 + 1000 * 6 - 1);
+    FAIL_IF(strncmp(buffer->data, ",,10000-10000-", 14) != 0);
+    Ja3BufferFree(&buffer);
+
+    Ja3ThreadCtxFree(ctx);
+    PASS;
+}
+
+#ifdef HAVE_NSS
+/**
+ * \test Hash of the JA3 string with a reused md5 context.
+ */
+static int Ja3Test02(void)
+{
+    JA3ThreadCtx *ctx = Ja3ThreadCtxAlloc();
+    FAIL_IF_NULL(ctx);
+
+    for (int i = 0; i < 2; i++) {
+        Ja3Reset(ctx);
+        FAIL_IF(Ja3AddValue(ctx, JA3_FIELD_VERSION, 771) != 0);
+        JA3Buffer *buffer = Ja3Finish(ctx, JA3_FIELD_MAX);
+        FAIL_IF_NULL(buffer);
+        /* md5 of "771,,,," */
+        FAIL_IF(strcmp(buffer->hash, "bddda940f9963577c41d7c28b1a5f65f") != 0);
+        Ja3BufferFree(&buffer);
+    }
+
+    Ja3ThreadCtxFree(ctx);
+    PASS;
+}
+#endif /* HAVE_NSS */
+
+#endif /* UNITTESTS */
+
+void Ja3RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("Ja3Test01", Ja3Test01);
+#ifdef HAVE_NSS
+    UtRegisterTest("Ja3Test02", Ja3Test02);
+#endif
+#endif /* UNITTESTS */
+}
@@ -24,20 +24,59 @@
 #ifndef __UTIL_JA3_H__
 #define __UTIL_JA3_H__
 
-#define JA3_BUFFER_INITIAL_SIZE 128
+#ifdef HAVE_NSS
+#include <sechash.h>
+#endif
 
+/** initial size of the per thread field buffers, they grow if needed */
+#define JA3_FIELD_INITIAL_SIZE  256
+/** md5 as hex string, including the terminating NUL */
+#define JA3_HASH_STRLEN         33
+
+/** fields of the JA3 string, in order. JA3S uses the first three: the
+ *  version, the selected cipher and the extensions of the server hello. */
+enum JA3Field {
+    JA3_FIELD_VERSION = 0,
+    JA3_FIELD_CIPHERS,
+    JA3_FIELD_EXTENSIONS,
+    JA3_FIELD_CURVES,
+    JA3_FIELD_POINT_FORMATS,
+
+    JA3_FIELD_MAX,
+};
+#define JA3S_FIELD_MAX  (JA3_FIELD_EXTENSIONS + 1)
+
+/** JA3 string and hash of a hello, 'data' and 'hash' are part of the
+ *  same allocation */
 typedef struct JA3Buffer_ {
     char *data;
     size_t size;
     size_t used;
+    char hash[JA3_HASH_STRLEN];
 } JA3Buffer;
 
-JA3Buffer *Ja3BufferInit(void);
+typedef struct JA3FieldBuffer_ {
+    char *data;
+    uint32_t used;
+    uint32_t size;
+} JA3FieldBuffer;
+
+/** per thread scratch space a fingerprint is built in */
+typedef struct JA3ThreadCtx_ {
+    JA3FieldBuffer fields[JA3_FIELD_MAX];
+#ifdef HAVE_NSS
+    HASHContext *md5_ctx;
+#endif
+} JA3ThreadCtx;
+
+JA3ThreadCtx *Ja3ThreadCtxAlloc(void);
+void Ja3ThreadCtxFree(JA3ThreadCtx *);
+void Ja3Reset(JA3ThreadCtx *);
+int Ja3AddValue(JA3ThreadCtx *, enum JA3Field, uint16_t);
+JA3Buffer *Ja3Finish(JA3ThreadCtx *, int);
 void Ja3BufferFree(JA3Buffer **);
-int Ja3BufferAppendBuffer(JA3Buffer **, JA3Buffer **);
-int Ja3BufferAddValue(JA3Buffer **, uint32_t);
-char *Ja3GenerateHash(JA3Buffer *);
 int Ja3IsDisabled(const char *);
 
-#endif /* __UTIL_JA3_H__ */
+void Ja3RegisterTests(void);
 
+#endif /* __UTIL_JA3_H__ */
@@ -0,0 +1,760 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Append only JSON writer.
+ *
+ * The output is the same as json_dump_callback() gives for the jansson
+ * flags the eve output uses, except that the order of the keys is always
+ * the order in which they were added. Strings that are not valid UTF-8
+ * are not dropped like json_string() does: the invalid bytes are escaped
+ * as \u00XX.
+ *
+ * With the JB_CBOR flag the same calls write a CBOR (RFC 7049) data item
+ * instead. Objects and arrays are indefinite length maps and arrays, so
+ * nothing has to be patched up on close. Invalid UTF-8 bytes become
+ * U+00XX, like the JSON escapes.
+ */
+
+#include "suricata-common.h"
+#include "util-jsonbuilder.h"
+#include "util-unittest.h"
+#include "util-print.h"
+
+#define JB_EXPAND_MIN 4096
+
+/** \internal
+ *  \brief make sure the buffer can take len more bytes and its NUL */
+static inline bool JbReserve(JsonBuilder *jb, uint32_t len)
+{
+    MemBuffer *b = *jb->buffer;
+    if (likely(b->offset + len < b->size))
+        return true;
+
+    uint32_t expand_by = MAX(len + 1, MAX(b->size, JB_EXPAND_MIN));
+    if (MemBufferExpand(jb->buffer, expand_by) < 0) {
+        jb->error = true;
+        return false;
+    }
+    return true;
+}
+
+static inline bool JbWrite(JsonBuilder *jb, const char *data, uint32_t len)
+{
+    if (unlikely(!JbReserve(jb, len)))
+        return false;
+    MemBuffer *b = *jb->buffer;
+    memcpy(b->buffer + b->offset, data, len);
+    b->offset += len;
+    b->buffer[b->offset] = '\0';
+    return true;
+}
+
+static inline bool JbWriteChar(JsonBuilder *jb, const char c)
+{
+    return JbWrite(jb, &c, 1);
+}
+
+/** \internal
+ *  \brief get the length of a valid UTF-8 sequence at s
+ *  \retval len 2-4 or 0 if the sequence is invalid
+ */
+static uint32_t JbUtf8Len(const uint8_t *s, uint32_t len, uint32_t *codepoint)
+{
+    uint32_t n, cp;
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+        cp = s[0] & 0x1f;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        cp = s[0] & 0x0f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        cp = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (n > len)
+        return 0;
+    for (uint32_t i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+    /* overlong encodings, surrogates and out of range */
+    if ((n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000) ||
+            (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+        return 0;
+
+    *codepoint = cp;
+    return n;
+}
+
+static bool JbWriteEscapedString(JsonBuilder *jb, const uint8_t *s, uint32_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const bool ensure_ascii = (jb->flags & JSON_ENSURE_ASCII) != 0;
+    const bool escape_slash = (jb->flags & JSON_ESCAPE_SLASH) != 0;
+
+    if (!JbWriteChar(jb, '"'))
+        return false;
+
+    uint32_t run = 0;
+    uint32_t i = 0;
+    while (i < len) {
+        const uint8_t c = s[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\' &&
+                !(c == '/' && escape_slash)) {
+            i++;
+            continue;
+        }
+
+        uint32_t cp = 0;
+        uint32_t n = 0;
+        if (c >= 0x80) {
+            n = JbUtf8Len(s + i, len - i, &cp);
+            /* valid UTF-8 is copied as is unless we need ASCII */
+            if (n != 0 && !ensure_ascii) {
+                i += n;
+                continue;
+            }
+        }
+
+        /* flush the run of plain bytes before the escape */
+        if (!JbWrite(jb, (const char *)s + run, i - run))
+            return false;
+
+        char esc[16];
+        uint32_t esc_len = 2;
+        esc[0] = '\\';
+        switch (c) {
+            case '"':  esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '/':  esc[1] = '/'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                if (n == 0) {
+                    /* control char or invalid UTF-8 byte */
+                    cp = c;
+                    n = 1;
+                }
+                if (cp >= 0x10000) {
+                    /* surrogate pair */
+                    const uint32_t v = cp - 0x10000;
+                    const uint32_t hi = 0xd800 | (v >> 10);
+                    const uint32_t lo = 0xdc00 | (v & 0x3ff);
+                    snprintf(esc, sizeof(esc), "\\u%04X\\u%04X", hi, lo);
+                    esc_len = 12;
+                } else {
+                    esc[1] = 'u';
+                    esc[2] = hex[(cp >> 12) & 0xf];
+                    esc[3] = hex[(cp >> 8) & 0xf];
+                    esc[4] = hex[(cp >> 4) & 0xf];
+                    esc[5] = hex[cp & 0xf];
+                    esc_len = 6;
+                }
+                break;
+        }
+        if (!JbWrite(jb, esc, esc_len))
+            return false;
+
+        i += (n == 0) ? 1 : n;
+        run = i;
+    }
+    if (!JbWrite(jb, (const char *)s + run, len - run))
+        return false;
+
+    return JbWriteChar(jb, '"');
+}
+
+/** \internal
+ *  \brief write a CBOR major type and argument */
+static bool JbCborHead(JsonBuilder *jb, const uint8_t major, const uint64_t val)
+{
+    uint8_t h[9];
+    uint32_t len;
+    h[0] = major << 5;
+    if (val < 24) {
+        h[0] |= (uint8_t)val;
+        len = 1;
+    } else if (val <= UINT8_MAX) {
+        h[0] |= 24;
+        h[1] = (uint8_t)val;
+        len = 2;
+    } else if (val <= UINT16_MAX) {
+        h[0] |= 25;
+        h[1] = (uint8_t)(val >> 8);
+        h[2] = (uint8_t)val;
+        len = 3;
+    } else if (val <= UINT32_MAX) {
+        h[0] |= 26;
+        for (int i = 0; i < 4; i++)
+            h[1 + i] = (uint8_t)(val >> (24 - 8 * i));
+        len = 5;
+    } else {
+        h[0] |= 27;
+        for (int i = 0; i < 8; i++)
+            h[1 + i] = (uint8_t)(val >> (56 - 8 * i));
+        len = 9;
+    }
+    return JbWrite(jb, (const char *)h, len);
+}
+
+/** \internal
+ *  \brief write a CBOR text string, invalid UTF-8 bytes become U+00XX */
+static bool JbCborWriteString(JsonBuilder *jb, const uint8_t *s, uint32_t len)
+{
+    /* size after replacing the invalid bytes by their 2 byte encoding */
+    uint32_t out_len = 0;
+    for (uint32_t i = 0; i < len; ) {
+        uint32_t cp, n = 1;
+        if (s[i] >= 0x80) {
+            n = JbUtf8Len(s + i, len - i, &cp);
+            if (n == 0) {
+                out_len += 2;
+                i++;
+                continue;
+            }
+        }
+        out_len += n;
+        i += n;
+    }
+
+    if (!JbCborHead(jb, 3, out_len))
+        return false;
+    if (out_len == len)
+        return JbWrite(jb, (const char *)s, len);
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < len; ) {
+        uint32_t cp, n = 1;
+        if (s[i] >= 0x80) {
+            n = JbUtf8Len(s + i, len - i, &cp);
+            if (n == 0) {
+                const char u[2] = { (char)(0xc0 | (s[i] >> 6)),
+                                    (char)(0x80 | (s[i] & 0x3f)) };
+                if (!JbWrite(jb, (const char *)s + run, i - run) ||
+                        !JbWrite(jb, u, 2))
+                    return false;
+                run = ++i;
+                continue;
+            }
+        }
+        i += n;
+    }
+    return JbWrite(jb, (const char *)s + run, len - run);
+}
+
+static bool JbWriteString(JsonBuilder *jb, const uint8_t *s, uint32_t len)
+{
+    if (jb->flags & JB_CBOR)
+        return JbCborWriteString(jb, s, len);
+    return JbWriteEscapedString(jb, s, len);
+}
+
+/** \internal
+ *  \brief write a jansson value as CBOR */
+static bool JbCborWriteJson(JsonBuilder *jb, json_t *val, int depth)
+{
+    if (unlikely(depth > JB_MAX_DEPTH)) {
+        jb->error = true;
+        return false;
+    }
+    switch (json_typeof(val)) {
+        case JSON_OBJECT: {
+            const char *k;
+            json_t *v;
+            if (!JbCborHead(jb, 5, json_object_size(val)))
+                return false;
+            json_object_foreach(val, k, v) {
+                if (!JbCborWriteString(jb, (const uint8_t *)k, strlen(k)) ||
+                        !JbCborWriteJson(jb, v, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+        case JSON_ARRAY: {
+            size_t i;
+            json_t *v;
+            if (!JbCborHead(jb, 4, json_array_size(val)))
+                return false;
+            json_array_foreach(val, i, v) {
+                if (!JbCborWriteJson(jb, v, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+        case JSON_STRING:
+            return JbCborWriteString(jb, (const uint8_t *)json_string_value(val),
+                    json_string_length(val));
+        case JSON_INTEGER: {
+            const json_int_t i = json_integer_value(val);
+            if (i < 0)
+                return JbCborHead(jb, 1, (uint64_t)(-1 - i));
+            return JbCborHead(jb, 0, (uint64_t)i);
+        }
+        case JSON_REAL: {
+            const double d = json_real_value(val);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            uint8_t f[9];
+            f[0] = 0xfb;
+            for (int i = 0; i < 8; i++)
+                f[1 + i] = (uint8_t)(bits >> (56 - 8 * i));
+            return JbWrite(jb, (const char *)f, 9);
+        }
+        case JSON_TRUE:
+            return JbWriteChar(jb, (char)0xf5);
+        case JSON_FALSE:
+            return JbWriteChar(jb, (char)0xf4);
+        case JSON_NULL:
+            return JbWriteChar(jb, (char)0xf6);
+    }
+    return false;
+}
+
+/** \internal
+ *  \brief write the separator and the key of a new item
+ *
+ *  Objects need a key for each item, arrays take items without one.
+ */
+static bool JbStartItem(JsonBuilder *jb, const char *key)
+{
+    if (unlikely(jb->error))
+        return false;
+    if (unlikely(jb->depth == 0)) {
+        jb->error = true;
+        return false;
+    }
+
+    const uint32_t bit = 1U << (jb->depth - 1);
+    const bool in_array = (jb->arrays & bit) != 0;
+    if (unlikely(in_array == (key != NULL))) {
+        jb->error = true;
+        return false;
+    }
+
+    if (jb->flags & JB_CBOR) {
+        jb->items |= bit;
+        if (key != NULL)
+            return JbCborWriteString(jb, (const uint8_t *)key, strlen(key));
+        return true;
+    }
+
+    const bool compact = (jb->flags & JSON_COMPACT) != 0;
+    if (jb->items & bit) {
+        if (!JbWrite(jb, ", ", compact ? 1 : 2))
+            return false;
+    }
+    jb->items |= bit;
+
+    if (key != NULL) {
+        if (!JbWriteEscapedString(jb, (const uint8_t *)key, strlen(key)))
+            return false;
+        if (!JbWrite(jb, ": ", compact ? 1 : 2))
+            return false;
+    }
+    return true;
+}
+
+/** \internal
+ *  \brief the byte that opens an object or array: the JSON bracket or
+ *         the CBOR indefinite length map or array */
+static inline char JbOpenChar(const JsonBuilder *jb, const bool array)
+{
+    if (jb->flags & JB_CBOR)
+        return array ? (char)0x9f : (char)0xbf;
+    return array ? '[' : '{';
+}
+
+static bool JbOpen(JsonBuilder *jb, const char *key, const bool array)
+{
+    if (unlikely(jb->depth == JB_MAX_DEPTH)) {
+        jb->error = true;
+        return false;
+    }
+    if (!JbStartItem(jb, key))
+        return false;
+    if (!JbWriteChar(jb, JbOpenChar(jb, array)))
+        return false;
+
+    const uint32_t bit = 1U << jb->depth;
+    jb->items &= ~bit;
+    if (array)
+        jb->arrays |= bit;
+    else
+        jb->arrays &= ~bit;
+    jb->depth++;
+    return true;
+}
+
+/**
+ *  \brief start a new record as the root object
+ *
+ *  \param buffer buffer to append to, the record starts at its offset
+ *  \param flags jansson dump flags, see LogFileCtx::json_flags, and
+ *         JB_CBOR
+ */
+void JbInit(JsonBuilder *jb, MemBuffer **buffer, size_t flags)
+{
+    jb->buffer = buffer;
+    jb->flags = flags;
+    jb->depth = 1;
+    jb->error = false;
+    jb->arrays = 0;
+    jb->items = 0;
+    JbWriteChar(jb, JbOpenChar(jb, false));
+}
+
+/** \brief open an object, key is NULL for an object in an array */
+bool JbOpenObject(JsonBuilder *jb, const char *key)
+{
+    return JbOpen(jb, key, false);
+}
+
+/** \brief open an array, key is NULL for an array in an array */
+bool JbOpenArray(JsonBuilder *jb, const char *key)
+{
+    return JbOpen(jb, key, true);
+}
+
+/** \brief close the last opened object or array */
+bool JbClose(JsonBuilder *jb)
+{
+    if (unlikely(jb->error))
+        return false;
+    if (unlikely(jb->depth == 0)) {
+        jb->error = true;
+        return false;
+    }
+    jb->depth--;
+    if (jb->flags & JB_CBOR)
+        return JbWriteChar(jb, (char)0xff);
+    return JbWriteChar(jb, (jb->arrays & (1U << jb->depth)) ? ']' : '}');
+}
+
+/** \brief add a string, a NULL val is skipped like json_string(NULL) is */
+bool JbSetString(JsonBuilder *jb, const char *key, const char *val)
+{
+    if (val == NULL)
+        return !jb->error;
+    return JbSetStringFromBytes(jb, key, (const uint8_t *)val, strlen(val));
+}
+
+bool JbSetStringFromBytes(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t val_len)
+{
+    if (!JbStartItem(jb, key))
+        return false;
+    return JbWriteString(jb, val, val_len);
+}
+
+bool JbSetUint(JsonBuilder *jb, const char *key, uint64_t val)
+{
+    if (!JbStartItem(jb, key))
+        return false;
+    if (jb->flags & JB_CBOR)
+        return JbCborHead(jb, 0, val);
+    char str[24];
+    int len = snprintf(str, sizeof(str), "%"PRIu64, val);
+    return JbWrite(jb, str, len);
+}
+
+bool JbSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    if (!JbStartItem(jb, key))
+        return false;
+    if (jb->flags & JB_CBOR) {
+        if (val < 0)
+            return JbCborHead(jb, 1, (uint64_t)(-1 - val));
+        return JbCborHead(jb, 0, (uint64_t)val);
+    }
+    char str[24];
+    int len = snprintf(str, sizeof(str), "%"PRIi64, val);
+    return JbWrite(jb, str, len);
+}
+
+bool JbSetBool(JsonBuilder *jb, const char *key, bool val)
+{
+    if (!JbStartItem(jb, key))
+        return false;
+    if (jb->flags & JB_CBOR)
+        return JbWriteChar(jb, val ? (char)0xf5 : (char)0xf4);
+    return val ? JbWrite(jb, "true", 4) : JbWrite(jb, "false", 5);
+}
+
+/**
+ *  \brief add a jansson value
+ *
+ *  For the parts of a record that are still built as a json_t tree. A
+ *  NULL val is skipped. The caller keeps its reference to val.
+ */
+bool JbSetJson(JsonBuilder *jb, const char *key, json_t *val)
+{
+    if (val == NULL)
+        return !jb->error;
+    if (!JbStartItem(jb, key))
+        return false;
+    if (jb->flags & JB_CBOR)
+        return JbCborWriteJson(jb, val, jb->depth);
+
+    char *str = json_dumps(val, (jb->flags & ~JB_CBOR) | JSON_ENCODE_ANY);
+    if (str == NULL) {
+        jb->error = true;
+        return false;
+    }
+    bool r = JbWrite(jb, str, strlen(str));
+    free(str);
+    return r;
+}
+
+bool JbAppendString(JsonBuilder *jb, const char *val)
+{
+    if (val == NULL)
+        return !jb->error;
+    if (!JbStartItem(jb, NULL))
+        return false;
+    return JbWriteString(jb, (const uint8_t *)val, strlen(val));
+}
+
+bool JbAppendUint(JsonBuilder *jb, uint64_t val)
+{
+    return JbSetUint(jb, NULL, val);
+}
+
+/**
+ *  \brief write a jansson object as a CBOR record
+ *
+ *  For the loggers that build their records as a json_t tree.
+ *
+ *  \param buffer buffer to append to
+ *  \retval true ok
+ *  \retval false error, the record is incomplete
+ */
+bool JbDumpCbor(MemBuffer **buffer, json_t *js)
+{
+    JsonBuilder jb = { .buffer = buffer, .flags = JB_CBOR };
+    return JbCborWriteJson(&jb, js, 0);
+}
+
+#ifdef UNITTESTS
+
+static int JsonBuilderTestCompare(JsonBuilder *jb, const char *expect)
+{
+    const MemBuffer *b = *jb->buffer;
+    if (strlen(expect) != b->offset ||
+            memcmp(b->buffer, expect, b->offset) != 0) {
+        printf("got \"%s\" expected \"%s\": ", b->buffer, expect);
+        return 0;
+    }
+    return 1;
+}
+
+static int JsonBuilderTest01(void)
+{
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+
+    JsonBuilder jb;
+    JbInit(&jb, &b, JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH);
+    FAIL_IF_NOT(JbSetString(&jb, "timestamp", "2019-01-01T00:00:00.000000+0000"));
+    FAIL_IF_NOT(JbSetUint(&jb, "flow_id", 18446744073709551615ULL));
+    FAIL_IF_NOT(JbSetInt(&jb, "age", -1));
+    FAIL_IF_NOT(JbSetString(&jb, "skipped", NULL));
+    FAIL_IF_NOT(JbOpenArray(&jb, "vlan"));
+    FAIL_IF_NOT(JbAppendUint(&jb, 10));
+    FAIL_IF_NOT(JbAppendUint(&jb, 20));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbOpenObject(&jb, "tcp"));
+    FAIL_IF_NOT(JbSetBool(&jb, "syn", true));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbOpenObject(&jb, "empty"));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF(jb.error);
+    FAIL_IF_NOT(JsonBuilderTestCompare(&jb,
+                "{\"timestamp\":\"2019-01-01T00:00:00.000000+0000\","
+                "\"flow_id\":18446744073709551615,\"age\":-1,"
+                "\"vlan\":[10,20],\"tcp\":{\"syn\":true},\"empty\":{}}"));
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test escaping with and without the ascii and slash flags */
+static int JsonBuilderTest02(void)
+{
+    MemBuffer *b = MemBufferCreateNew(64);
+    FAIL_IF_NULL(b);
+
+    /* "/" tab, ctrl-a, e-acute, euro, a 4 byte emoji and a stray byte */
+    const char *s = "\"/\\\t\x01\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xff";
+
+    JsonBuilder jb;
+    JbInit(&jb, &b, JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH);
+    FAIL_IF_NOT(JbSetString(&jb, "s", s));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JsonBuilderTestCompare(&jb,
+                "{\"s\":\"\\\"\\/\\\\\\t\\u0001\\u00E9\\u20AC"
+                "\\uD83D\\uDE00\\u00FF\"}"));
+
+    MemBufferReset(b);
+    JbInit(&jb, &b, 0);
+    FAIL_IF_NOT(JbSetString(&jb, "s", s));
+    FAIL_IF_NOT(JbSetUint(&jb, "n", 1));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JsonBuilderTestCompare(&jb,
+                "{\"s\": \"\\\"/\\\\\\t\\u0001\xc3\xa9\xe2\x82\xac"
+                "\xf0\x9f\x98\x80\\u00FF\", \"n\": 1}"));
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test misuse sets the error flag */
+static int JsonBuilderTest03(void)
+{
+    MemBuffer *b = MemBufferCreateNew(64);
+    FAIL_IF_NULL(b);
+
+    JsonBuilder jb;
+    JbInit(&jb, &b, JSON_COMPACT);
+    FAIL_IF(JbAppendUint(&jb, 1));
+    FAIL_IF_NOT(jb.error);
+
+    MemBufferReset(b);
+    JbInit(&jb, &b, JSON_COMPACT);
+    FAIL_IF_NOT(JbOpenArray(&jb, "a"));
+    FAIL_IF(JbSetUint(&jb, "k", 1));
+    FAIL_IF_NOT(jb.error);
+
+    MemBufferReset(b);
+    JbInit(&jb, &b, JSON_COMPACT);
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF(JbClose(&jb));
+    FAIL_IF_NOT(jb.error);
+
+    MemBufferFree(b);
+    PASS;
+}
+
+/** \test jansson values and nested arrays */
+static int JsonBuilderTest04(void)
+{
+    MemBuffer *b = MemBufferCreateNew(64);
+    FAIL_IF_NULL(b);
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_object_set_new(js, "a", json_integer(1));
+
+    JsonBuilder jb;
+    JbInit(&jb, &b, JSON_COMPACT);
+    FAIL_IF_NOT(JbSetJson(&jb, "metadata", js));
+    FAIL_IF_NOT(JbSetJson(&jb, "skipped", NULL));
+    FAIL_IF_NOT(JbOpenArray(&jb, "aa"));
+    FAIL_IF_NOT(JbOpenArray(&jb, NULL));
+    FAIL_IF_NOT(JbAppendString(&jb, "x"));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbOpenObject(&jb, NULL));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JsonBuilderTestCompare(&jb,
+                "{\"metadata\":{\"a\":1},\"aa\":[[\"x\"],{}]}"));
+
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+
+static int JsonBuilderTestCompareBytes(JsonBuilder *jb, const uint8_t *expect,
+        uint32_t expect_len)
+{
+    const MemBuffer *b = *jb->buffer;
+    if (expect_len != b->offset || memcmp(b->buffer, expect, b->offset) != 0) {
+        PrintRawDataFp(stdout, b->buffer, b->offset);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test CBOR output */
+static int JsonBuilderTest05(void)
+{
+    MemBuffer *b = MemBufferCreateNew(8);
+    FAIL_IF_NULL(b);
+
+    JsonBuilder jb;
+    JbInit(&jb, &b, JSON_COMPACT|JB_CBOR);
+    FAIL_IF_NOT(JbSetString(&jb, "a", "b"));
+    FAIL_IF_NOT(JbSetUint(&jb, "n", 500));
+    FAIL_IF_NOT(JbSetInt(&jb, "m", -1));
+    FAIL_IF_NOT(JbOpenArray(&jb, "v"));
+    FAIL_IF_NOT(JbAppendUint(&jb, 1));
+    FAIL_IF_NOT(JbClose(&jb));
+    FAIL_IF_NOT(JbSetBool(&jb, "t", true));
+    FAIL_IF_NOT(JbSetStringFromBytes(&jb, "x", (const uint8_t *)"\xff", 1));
+    FAIL_IF_NOT(JbClose(&jb));
+    static const uint8_t expect[] = {
+        0xbf, 0x61, 'a', 0x61, 'b', 0x61, 'n', 0x19, 0x01, 0xf4,
+        0x61, 'm', 0x20, 0x61, 'v', 0x9f, 0x01, 0xff, 0x61, 't', 0xf5,
+        0x61, 'x', 0x62, 0xc3, 0xbf, 0xff };
+    FAIL_IF_NOT(JsonBuilderTestCompareBytes(&jb, expect, sizeof(expect)));
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_t *a = json_array();
+    FAIL_IF_NULL(a);
+    json_array_append_new(a, json_integer(1));
+    json_array_append_new(a, json_integer(-2));
+    json_array_append_new(a, json_string("x"));
+    json_object_set_new(js, "a", a);
+    json_object_set_new(js, "b", json_null());
+    json_object_set_new(js, "c", json_real(1.5));
+
+    MemBufferReset(b);
+    FAIL_IF_NOT(JbDumpCbor(&b, js));
+    static const uint8_t expect_js[] = {
+        0xa3, 0x61, 'a', 0x83, 0x01, 0x21, 0x61, 'x', 0x61, 'b', 0xf6,
+        0x61, 'c', 0xfb, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    jb.buffer = &b;
+    FAIL_IF_NOT(JsonBuilderTestCompareBytes(&jb, expect_js, sizeof(expect_js)));
+
+    json_decref(js);
+    MemBufferFree(b);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03);
+    UtRegisterTest("JsonBuilderTest04", JsonBuilderTest04);
+    UtRegisterTest("JsonBuilderTest05", JsonBuilderTest05);
+#endif
+}
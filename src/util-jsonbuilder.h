@@ -0,0 +1,68 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Append only JSON writer. Records are written straight into a
+ * MemBuffer, without building a json_t tree first.
+ */
+
+#ifndef __UTIL_JSONBUILDER_H__
+#define __UTIL_JSONBUILDER_H__
+
+#include "util-buffer.h"
+
+/** max nesting of objects and arrays */
+#define JB_MAX_DEPTH 32
+
+/** JbInit() flag, next to the jansson ones: write CBOR instead of JSON */
+#define JB_CBOR ((size_t)1 << 30)
+
+typedef struct JsonBuilder_ {
+    MemBuffer **buffer;     /**< buffer to write to, expanded as needed */
+    size_t flags;           /**< jansson JSON_COMPACT, JSON_ENSURE_ASCII and
+                             *   JSON_ESCAPE_SLASH dump flags, or JB_CBOR */
+    uint8_t depth;          /**< number of open objects and arrays */
+    bool error;             /**< write failed or builder misuse, the record
+                             *   is incomplete and must not be logged */
+    uint32_t arrays;        /**< bit per depth: container is an array */
+    uint32_t items;         /**< bit per depth: container has an item */
+} JsonBuilder;
+
+void JbInit(JsonBuilder *jb, MemBuffer **buffer, size_t flags);
+
+bool JbOpenObject(JsonBuilder *jb, const char *key);
+bool JbOpenArray(JsonBuilder *jb, const char *key);
+bool JbClose(JsonBuilder *jb);
+
+bool JbSetString(JsonBuilder *jb, const char *key, const char *val);
+bool JbSetStringFromBytes(JsonBuilder *jb, const char *key,
+        const uint8_t *val, uint32_t val_len);
+bool JbSetUint(JsonBuilder *jb, const char *key, uint64_t val);
+bool JbSetInt(JsonBuilder *jb, const char *key, int64_t val);
+bool JbSetBool(JsonBuilder *jb, const char *key, bool val);
+bool JbSetJson(JsonBuilder *jb, const char *key, json_t *val);
+
+bool JbAppendString(JsonBuilder *jb, const char *val);
+bool JbAppendUint(JsonBuilder *jb, uint64_t val);
+
+bool JbDumpCbor(MemBuffer **buffer, json_t *js);
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* __UTIL_JSONBUILDER_H__ */
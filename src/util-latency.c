@@ -0,0 +1,438 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled pipeline latency histograms per thread module slot and per
+ * flow worker stage.
+ */
+
+#include "suricata-common.h"
+#include "threadvars.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "counters.h"
+#include "conf.h"
+
+#include "util-latency.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+#endif
+
+typedef struct LatencyCounterNames_ {
+    char avg[64];
+    char max[64];
+} LatencyCounterNames;
+
+/** counter names have to outlive the threads, so like the app-layer
+ *  counters they are kept in global tables */
+static LatencyCounterNames latency_slot_names[TMM_SIZE];
+static LatencyCounterNames latency_fw_names[PROFILE_FLOWWORKER_SIZE];
+
+static int latency_enabled = 0;
+static uint32_t latency_sample_rate = LATENCY_DEFAULT_SAMPLE_RATE;
+
+/** all active thread contexts, for the unix socket command */
+static LatencyThreadCtx *latency_list = NULL;
+static SCMutex latency_list_lock = SCMUTEX_INITIALIZER;
+
+void LatencyInitConfig(void)
+{
+    ConfNode *node = ConfGetNode("stats.latency");
+    if (node == NULL)
+        return;
+
+    int enabled = 0;
+    if (ConfGetChildValueBool(node, "enabled", &enabled) == 0 || !enabled)
+        return;
+
+    intmax_t rate = 0;
+    if (ConfGetChildValueInt(node, "sample-rate", &rate) == 1) {
+        if (rate < 1 || rate > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "stats.latency.sample-rate "
+                    "%"PRIdMAX" is out of range, using default %u",
+                    rate, LATENCY_DEFAULT_SAMPLE_RATE);
+        } else {
+            latency_sample_rate = (uint32_t)rate;
+        }
+    }
+
+    for (int i = 0; i < TMM_SIZE; i++) {
+        TmModule *tm = TmModuleGetById(i);
+        if (tm == NULL || tm->name == NULL)
+            continue;
+        snprintf(latency_slot_names[i].avg, sizeof(latency_slot_names[i].avg),
+                "latency.%s.avg", tm->name);
+        snprintf(latency_slot_names[i].max, sizeof(latency_slot_names[i].max),
+                "latency.%s.max", tm->name);
+    }
+    for (int i = 0; i < PROFILE_FLOWWORKER_SIZE; i++) {
+        const char *name = ProfileFlowWorkerIdToString(i);
+        snprintf(latency_fw_names[i].avg, sizeof(latency_fw_names[i].avg),
+                "latency.flow_worker.%s.avg", name);
+        snprintf(latency_fw_names[i].max, sizeof(latency_fw_names[i].max),
+                "latency.flow_worker.%s.max", name);
+    }
+
+    latency_enabled = 1;
+    SCLogConfig("latency histograms enabled, sampling 1 in %u packets",
+            latency_sample_rate);
+}
+
+int LatencyEnabled(void)
+{
+    return latency_enabled;
+}
+
+static void LatencyHistogramSetup(ThreadVars *tv, LatencyHistogram *h,
+        const LatencyCounterNames *names, uint32_t sample_rate)
+{
+    h->countdown = sample_rate;
+    h->counter_avg = StatsRegisterAvgCounter(names->avg, tv);
+    h->counter_max = StatsRegisterMaxCounter(names->max, tv);
+}
+
+/**
+ * \brief set up the histograms for a thread
+ *
+ * Needs to be called after the slots are set up but before
+ * StatsSetupPrivate() so the counters are part of the thread's store.
+ */
+void LatencyThreadInit(ThreadVars *tv)
+{
+    if (!latency_enabled)
+        return;
+
+    LatencyThreadCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return;
+    ctx->tv = tv;
+    ctx->sample_rate = latency_sample_rate;
+
+    uint16_t nslots = 0;
+    TmSlot *s;
+    for (s = tv->tm_slots; s != NULL; s = s->slot_next) {
+        nslots++;
+    }
+    if (nslots > 0) {
+        ctx->slots = SCCalloc(nslots, sizeof(LatencyHistogram));
+        ctx->slot_tm_id = SCCalloc(nslots, sizeof(int));
+        if (ctx->slots == NULL || ctx->slot_tm_id == NULL)
+            goto error;
+        ctx->nslots = nslots;
+    }
+
+    int has_fw = 0;
+    for (s = tv->tm_slots; s != NULL; s = s->slot_next) {
+        /* ids are assigned in slot order */
+        if (s->id < 0 || s->id >= nslots)
+            continue;
+        ctx->slot_tm_id[s->id] = s->tm_id;
+        LatencyHistogramSetup(tv, &ctx->slots[s->id],
+                &latency_slot_names[s->tm_id], ctx->sample_rate);
+        if (s->tm_id == TMM_FLOWWORKER)
+            has_fw = 1;
+    }
+
+    if (has_fw) {
+        ctx->fw = SCCalloc(PROFILE_FLOWWORKER_SIZE, sizeof(LatencyHistogram));
+        if (ctx->fw == NULL)
+            goto error;
+        for (int i = 0; i < PROFILE_FLOWWORKER_SIZE; i++) {
+            LatencyHistogramSetup(tv, &ctx->fw[i], &latency_fw_names[i],
+                    ctx->sample_rate);
+        }
+    }
+
+    SCMutexLock(&latency_list_lock);
+    ctx->next = latency_list;
+    latency_list = ctx;
+    SCMutexUnlock(&latency_list_lock);
+
+    tv->latency = ctx;
+    return;
+
+error:
+    SCLogWarning(SC_ERR_MEM_ALLOC, "%s: no memory for latency histograms",
+            tv->name);
+    if (ctx->slots != NULL)
+        SCFree(ctx->slots);
+    if (ctx->slot_tm_id != NULL)
+        SCFree(ctx->slot_tm_id);
+    SCFree(ctx);
+}
+
+void LatencyThreadDeinit(ThreadVars *tv)
+{
+    LatencyThreadCtx *ctx = tv->latency;
+    if (ctx == NULL)
+        return;
+
+    SCMutexLock(&latency_list_lock);
+    LatencyThreadCtx **prev = &latency_list;
+    while (*prev != NULL) {
+        if (*prev == ctx) {
+            *prev = ctx->next;
+            break;
+        }
+        prev = &(*prev)->next;
+    }
+    tv->latency = NULL;
+    SCMutexUnlock(&latency_list_lock);
+
+    if (ctx->slots != NULL)
+        SCFree(ctx->slots);
+    if (ctx->slot_tm_id != NULL)
+        SCFree(ctx->slot_tm_id);
+    if (ctx->fw != NULL)
+        SCFree(ctx->fw);
+    SCFree(ctx);
+}
+
+/** \brief get the histogram bucket for a value in ticks
+ *
+ *  Values below LATENCY_HIST_SUB have their own bucket. Above that the
+ *  bucket is the power of two range of the value, split linearly in
+ *  LATENCY_HIST_SUB sub buckets.
+ */
+uint32_t LatencyHistogramBucket(uint64_t ticks)
+{
+    if (ticks < LATENCY_HIST_SUB)
+        return (uint32_t)ticks;
+
+    uint32_t msb = LATENCY_HIST_SUB_BITS;
+    while (msb < 63 && (ticks >> (msb + 1)) != 0)
+        msb++;
+    if (msb >= LATENCY_HIST_MAX_BITS)
+        return LATENCY_HIST_BUCKETS - 1;
+
+    const uint32_t shift = msb - LATENCY_HIST_SUB_BITS;
+    return LATENCY_HIST_SUB + shift * LATENCY_HIST_SUB +
+        (uint32_t)((ticks >> shift) & (LATENCY_HIST_SUB - 1));
+}
+
+/** \brief get the lowest value in ticks that maps to a bucket */
+uint64_t LatencyHistogramBucketValue(uint32_t idx)
+{
+    if (idx < LATENCY_HIST_SUB)
+        return idx;
+    if (idx >= LATENCY_HIST_BUCKETS)
+        idx = LATENCY_HIST_BUCKETS - 1;
+
+    const uint32_t shift = (idx - LATENCY_HIST_SUB) / LATENCY_HIST_SUB;
+    const uint64_t sub = (idx - LATENCY_HIST_SUB) % LATENCY_HIST_SUB;
+    return (LATENCY_HIST_SUB + sub) << shift;
+}
+
+/** \brief get the value at a percentile (0-100) of the histogram */
+uint64_t LatencyHistogramPercentile(const LatencyHistogram *h, uint32_t pct)
+{
+    if (h->count == 0)
+        return 0;
+    if (pct >= 100)
+        return h->max;
+
+    /* rank of the sample we're looking for, rounded up */
+    const uint64_t rank = (h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            const uint64_t v = LatencyHistogramBucketValue(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void LatencyHistogramRecord(ThreadVars *tv, LatencyHistogram *h, uint64_t ticks)
+{
+    h->buckets[LatencyHistogramBucket(ticks)]++;
+    h->count++;
+    if (ticks > h->max)
+        h->max = ticks;
+
+    if (tv != NULL) {
+        StatsAddUI64(tv, h->counter_avg, ticks);
+        StatsSetUI64(tv, h->counter_max, ticks);
+    }
+}
+
+#ifdef BUILD_UNIX_SOCKET
+static json_t *LatencyHistogramToJson(const LatencyHistogram *h)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+
+    json_object_set_new(js, "count", json_integer(h->count));
+    json_object_set_new(js, "max", json_integer(h->max));
+    json_object_set_new(js, "p50", json_integer(LatencyHistogramPercentile(h, 50)));
+    json_object_set_new(js, "p90", json_integer(LatencyHistogramPercentile(h, 90)));
+    json_object_set_new(js, "p99", json_integer(LatencyHistogramPercentile(h, 99)));
+
+    /* only the used buckets, as [ lowest value, count ] pairs */
+    json_t *jb = json_array();
+    if (jb != NULL) {
+        for (uint32_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+            if (h->buckets[i] == 0)
+                continue;
+            json_t *pair = json_array();
+            if (pair == NULL)
+                break;
+            json_array_append_new(pair, json_integer(LatencyHistogramBucketValue(i)));
+            json_array_append_new(pair, json_integer(h->buckets[i]));
+            json_array_append_new(jb, pair);
+        }
+        json_object_set_new(js, "buckets", jb);
+    }
+    return js;
+}
+
+/**
+ * \brief unix socket command dumping the histograms of all threads
+ *
+ * Values are in cpu ticks. The histograms are read while the threads
+ * keep updating them, so counts in a dump may be slightly inconsistent.
+ */
+TmEcode LatencyHistogramsDump(json_t *cmd, json_t *answer, void *data)
+{
+    if (!latency_enabled) {
+        json_object_set_new(answer, "message",
+                json_string("latency histograms are not enabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(jdata, "sample-rate", json_integer(latency_sample_rate));
+
+    json_t *jthreads = json_object();
+    if (jthreads == NULL) {
+        json_decref(jdata);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCMutexLock(&latency_list_lock);
+    for (LatencyThreadCtx *ctx = latency_list; ctx != NULL; ctx = ctx->next) {
+        json_t *jt = json_object();
+        if (jt == NULL)
+            continue;
+
+        for (uint16_t i = 0; i < ctx->nslots; i++) {
+            TmModule *tm = TmModuleGetById(ctx->slot_tm_id[i]);
+            json_t *jh = LatencyHistogramToJson(&ctx->slots[i]);
+            if (tm != NULL && jh != NULL)
+                json_object_set_new(jt, tm->name, jh);
+            else if (jh != NULL)
+                json_decref(jh);
+        }
+        if (ctx->fw != NULL) {
+            json_t *jfw = json_object();
+            if (jfw != NULL) {
+                for (int i = 0; i < PROFILE_FLOWWORKER_SIZE; i++) {
+                    json_t *jh = LatencyHistogramToJson(&ctx->fw[i]);
+                    if (jh != NULL)
+                        json_object_set_new(jfw, ProfileFlowWorkerIdToString(i), jh);
+                }
+                json_object_set_new(jt, "flow_worker", jfw);
+            }
+        }
+        json_object_set_new(jthreads, ctx->tv->name, jt);
+    }
+    SCMutexUnlock(&latency_list_lock);
+
+    json_object_set_new(jdata, "threads", jthreads);
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+
+/** \test bucket mapping is monotonic and the bucket value maps back to
+ *        the same bucket */
+static int LatencyTest01(void)
+{
+    uint32_t prev = 0;
+    for (uint64_t v = 0; v < 100000; v++) {
+        uint32_t idx = LatencyHistogramBucket(v);
+        FAIL_IF(idx < prev);
+        FAIL_IF(idx > prev + 1);
+        FAIL_IF(LatencyHistogramBucketValue(idx) > v);
+        FAIL_IF(LatencyHistogramBucket(LatencyHistogramBucketValue(idx)) != idx);
+        prev = idx;
+    }
+
+    FAIL_IF(LatencyHistogramBucket(7) != 7);
+    FAIL_IF(LatencyHistogramBucket(8) != 8);
+    FAIL_IF(LatencyHistogramBucket(16) != 16);
+    FAIL_IF(LatencyHistogramBucket(17) != 16);
+    FAIL_IF(LatencyHistogramBucket(UINT64_MAX) != LATENCY_HIST_BUCKETS - 1);
+    FAIL_IF(LatencyHistogramBucket(1ULL << LATENCY_HIST_MAX_BITS) !=
+            LATENCY_HIST_BUCKETS - 1);
+    FAIL_IF(LatencyHistogramBucket((1ULL << LATENCY_HIST_MAX_BITS) - 1) !=
+            LATENCY_HIST_BUCKETS - 1);
+    PASS;
+}
+
+/** \test percentiles */
+static int LatencyTest02(void)
+{
+    LatencyHistogram *h = SCCalloc(1, sizeof(*h));
+    FAIL_IF_NULL(h);
+
+    FAIL_IF(LatencyHistogramPercentile(h, 50) != 0);
+
+    for (uint64_t v = 1; v <= 100; v++)
+        LatencyHistogramRecord(NULL, h, v * 100);
+
+    FAIL_IF(h->count != 100);
+    FAIL_IF(h->max != 10000);
+    FAIL_IF(LatencyHistogramPercentile(h, 100) != 10000);
+
+    /* within the 12.5% bucket resolution, never above the real value */
+    uint64_t p50 = LatencyHistogramPercentile(h, 50);
+    FAIL_IF(p50 > 5000 || p50 < 5000 - 5000 / 8);
+    uint64_t p99 = LatencyHistogramPercentile(h, 99);
+    FAIL_IF(p99 > 9900 || p99 < 9900 - 9900 / 8);
+    FAIL_IF(LatencyHistogramPercentile(h, 0) != LatencyHistogramBucketValue(
+                LatencyHistogramBucket(100)));
+
+    SCFree(h);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void LatencyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LatencyTest01", LatencyTest01);
+    UtRegisterTest("LatencyTest02", LatencyTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,138 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled pipeline latency histograms.
+ *
+ * When enabled, one in 'sample-rate' packets is timed with the cpu tick
+ * counter for each thread module slot and for each flow worker stage.
+ * The samples go into log-linear histograms: 8 sub buckets per power of
+ * two, so any recorded value is off by at most 12.5%.
+ *
+ * Average and maximum are exposed as counters, the full histograms and
+ * percentiles through the 'latency-histograms' unix socket command.
+ */
+
+#ifndef __UTIL_LATENCY_H__
+#define __UTIL_LATENCY_H__
+
+#include "tm-threads-common.h"
+#include "flow-worker.h"
+#include "util-cpu.h"
+
+#define LATENCY_HIST_SUB_BITS   3
+#define LATENCY_HIST_SUB        (1 << LATENCY_HIST_SUB_BITS)
+/** values of 2^LATENCY_HIST_MAX_BITS ticks and more go in the last bucket */
+#define LATENCY_HIST_MAX_BITS   40
+#define LATENCY_HIST_BUCKETS    (LATENCY_HIST_SUB + \
+        (LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS) * LATENCY_HIST_SUB)
+
+#define LATENCY_DEFAULT_SAMPLE_RATE 1024
+
+typedef struct LatencyHistogram_ {
+    /** packets left until the next sample */
+    uint32_t countdown;
+
+    uint16_t counter_avg;
+    uint16_t counter_max;
+
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+} LatencyHistogram;
+
+typedef struct LatencyThreadCtx_ {
+    struct ThreadVars_ *tv;
+    uint32_t sample_rate;
+
+    /** histograms per slot, indexed by TmSlot::id */
+    uint16_t nslots;
+    LatencyHistogram *slots;
+    /** tm_id of the slots, for display */
+    int *slot_tm_id;
+
+    /** flow worker stages, NULL if the thread has no flow worker */
+    LatencyHistogram *fw;
+
+    struct LatencyThreadCtx_ *next;
+} LatencyThreadCtx;
+
+void LatencyInitConfig(void);
+int LatencyEnabled(void);
+
+void LatencyThreadInit(struct ThreadVars_ *tv);
+void LatencyThreadDeinit(struct ThreadVars_ *tv);
+
+uint32_t LatencyHistogramBucket(uint64_t ticks);
+uint64_t LatencyHistogramBucketValue(uint32_t idx);
+uint64_t LatencyHistogramPercentile(const LatencyHistogram *h, uint32_t pct);
+void LatencyHistogramRecord(struct ThreadVars_ *tv, LatencyHistogram *h,
+        uint64_t ticks);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode LatencyHistogramsDump(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void LatencyRegisterTests(void);
+
+/** \brief start a sample if this packet is the one in 'sample_rate'
+ *  \retval ticks start ticks or 0 if this packet is not sampled */
+static inline uint64_t LatencySampleStart(const LatencyThreadCtx *ctx,
+        LatencyHistogram *h)
+{
+    if (likely(--h->countdown != 0))
+        return 0;
+    h->countdown = ctx->sample_rate;
+    return UtilCpuGetTicks();
+}
+
+static inline void LatencySampleEnd(struct ThreadVars_ *tv,
+        LatencyHistogram *h, const uint64_t start)
+{
+    if (likely(start == 0))
+        return;
+    const uint64_t now = UtilCpuGetTicks();
+    LatencyHistogramRecord(tv, h, now > start ? now - start : 0);
+}
+
+#define LATENCY_SLOT_START(tv, s) \
+    uint64_t latency_start = 0; \
+    if (unlikely((tv)->latency != NULL) && (s)->id < (tv)->latency->nslots) { \
+        latency_start = LatencySampleStart((tv)->latency, \
+                &(tv)->latency->slots[(s)->id]); \
+    }
+
+#define LATENCY_SLOT_END(tv, s) \
+    if (unlikely(latency_start != 0)) { \
+        LatencySampleEnd((tv), &(tv)->latency->slots[(s)->id], latency_start); \
+    }
+
+#define LATENCY_FW_START(tv, id) \
+    uint64_t latency_fw_start_##id = 0; \
+    if (unlikely((tv)->latency != NULL) && (tv)->latency->fw != NULL) { \
+        latency_fw_start_##id = LatencySampleStart((tv)->latency, \
+                &(tv)->latency->fw[(id)]); \
+    }
+
+#define LATENCY_FW_END(tv, id) \
+    if (unlikely(latency_fw_start_##id != 0)) { \
+        LatencySampleEnd((tv), &(tv)->latency->fw[(id)], latency_fw_start_##id); \
+    }
+
+#endif /* __UTIL_LATENCY_H__ */
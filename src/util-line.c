@@ -0,0 +1,308 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Line splitting for line based protocols.
+ *
+ * A line that is complete in the current chunk is returned in place. Only
+ * a line spanning chunks is copied, into a buffer that is kept for the
+ * next lines of the direction, so that a flow of fragmented lines doesn't
+ * allocate for each of them. Each byte is only scanned once, by memchr,
+ * which libc vectorizes.
+ */
+
+#include "suricata-common.h"
+#include "util-line.h"
+#include "util-unittest.h"
+
+/** minimal allocation for a partial line */
+#define LINE_BUFFER_MIN_SIZE 256
+/** a buffer grown larger than this is released once its line is done */
+#define LINE_BUFFER_KEEP_SIZE 4096
+
+static void *LineBufferRealloc(const LineBufferConfig *cfg, void *ptr,
+        size_t orig_size, size_t size)
+{
+    if (cfg->Realloc != NULL)
+        return cfg->Realloc(ptr, orig_size, size);
+    return SCRealloc(ptr, size);
+}
+
+static void LineBufferRelease(LineBuffer *lb, const LineBufferConfig *cfg)
+{
+    if (lb->buf != NULL) {
+        if (cfg->Free != NULL)
+            cfg->Free(lb->buf, lb->size);
+        else
+            SCFree(lb->buf);
+    }
+    lb->buf = NULL;
+    lb->size = 0;
+}
+
+/**
+ * \brief add bytes of the current line to the buffer
+ *
+ * The line is stored up to max_len bytes and its delimiter, the bytes
+ * past that are only accounted for.
+ */
+static void LineBufferAppend(LineBuffer *lb, const LineBufferConfig *cfg,
+        const uint8_t *data, uint32_t data_len)
+{
+    if (data_len == 0)
+        return;
+    lb->cr = (data[data_len - 1] == 0x0D);
+    if (lb->dropped)
+        return;
+
+    uint32_t store = data_len;
+    if (cfg->max_len > 0) {
+        uint32_t room = cfg->max_len + 2 - lb->len;
+        if (store > room) {
+            store = room;
+            lb->dropped = true;
+        }
+    }
+    if (store == 0)
+        return;
+
+    if (lb->len + store > lb->size) {
+        uint64_t size = MAX((uint64_t)lb->size * 2, LINE_BUFFER_MIN_SIZE);
+        size = MAX(size, (uint64_t)lb->len + store);
+        if (cfg->max_len > 0)
+            size = MIN(size, (uint64_t)cfg->max_len + 2);
+        if (size > UINT32_MAX) {
+            lb->dropped = true;
+            return;
+        }
+
+        void *ptr = LineBufferRealloc(cfg, lb->buf, lb->size, (size_t)size);
+        if (ptr == NULL) {
+            /* keep what we have, the line is returned truncated */
+            lb->dropped = true;
+            return;
+        }
+        lb->buf = ptr;
+        lb->size = (uint32_t)size;
+    }
+    memcpy(lb->buf + lb->len, data, store);
+    lb->len += store;
+}
+
+/**
+ * \brief get the next line of the input
+ *
+ * \param lb partial line of the direction of the input
+ * \param input in/out, moved past the line returned or the bytes buffered
+ * \param input_len in/out
+ * \param line out, the line
+ *
+ * \retval 0 line returned
+ * \retval -1 the input is consumed without completing a line
+ */
+int LineBufferGetLine(LineBuffer *lb, const LineBufferConfig *cfg,
+        uint8_t **input, int32_t *input_len, LineBufferLine *line)
+{
+    if (lb->returned) {
+        lb->returned = false;
+        lb->len = 0;
+        lb->dropped = false;
+        lb->cr = false;
+        if (lb->size > LINE_BUFFER_KEEP_SIZE)
+            LineBufferRelease(lb, cfg);
+    }
+
+    if (*input_len <= 0)
+        return -1;
+
+    uint8_t *lf_idx = memchr(*input, 0x0a, *input_len);
+    if (lf_idx == NULL) {
+        LineBufferAppend(lb, cfg, *input, (uint32_t)*input_len);
+        *input += *input_len;
+        *input_len = 0;
+        return -1;
+    }
+
+    uint32_t chunk_len = (uint32_t)(lf_idx - *input);
+    uint32_t len;
+    bool cr;
+    bool truncated;
+
+    if (lb->len == 0 && !lb->dropped && !lb->cr) {
+        /* the line is complete in this chunk: no copy */
+        cr = chunk_len > 0 && (*input)[chunk_len - 1] == 0x0D;
+        len = chunk_len - (cr ? 1 : 0);
+        truncated = cfg->max_len > 0 && len > cfg->max_len;
+        if (truncated)
+            len = cfg->max_len;
+        line->line = *input;
+    } else {
+        /* the delimiter is stored too: parsers may use the line with it */
+        LineBufferAppend(lb, cfg, *input, chunk_len);
+        cr = lb->cr;
+        LineBufferAppend(lb, cfg, lf_idx, 1);
+        if (!lb->dropped) {
+            len = lb->len - (cr ? 2 : 1);
+            truncated = false;
+        } else {
+            /* keep delimiter_len bytes after the line, whatever they are */
+            if (lb->len < 2) {
+                /* out of memory: skip the line */
+                lb->returned = true;
+                *input_len -= chunk_len + 1;
+                *input = lf_idx + 1;
+                return LineBufferGetLine(lb, cfg, input, input_len, line);
+            }
+            len = lb->len - 2;
+            truncated = true;
+        }
+        if (cfg->max_len > 0 && len > cfg->max_len)
+            len = cfg->max_len;
+        lb->len = len;
+        lb->returned = true;
+        line->line = lb->buf;
+    }
+
+    line->len = len;
+    line->delimiter_len = cr ? 2 : 1;
+    line->truncated = truncated;
+
+    *input_len -= chunk_len + 1;
+    *input = lf_idx + 1;
+    return 0;
+}
+
+/**
+ * \brief free the partial line
+ */
+void LineBufferFree(LineBuffer *lb, const LineBufferConfig *cfg)
+{
+    LineBufferRelease(lb, cfg);
+    memset(lb, 0, sizeof(*lb));
+}
+
+#ifdef UNITTESTS
+
+static int LineBufferGetAll(LineBuffer *lb, const LineBufferConfig *cfg,
+        const char *str, LineBufferLine *lines, int max)
+{
+    uint8_t *input = (uint8_t *)str;
+    int32_t input_len = (int32_t)strlen(str);
+    int n = 0;
+    while (n < max && LineBufferGetLine(lb, cfg, &input, &input_len, &lines[n]) == 0)
+        n++;
+    return n;
+}
+
+/** \test lines complete in a chunk are returned in place */
+static int LineBufferTest01(void)
+{
+    LineBufferConfig cfg = { 0, NULL, NULL };
+    LineBuffer lb;
+    memset(&lb, 0, sizeof(lb));
+    LineBufferLine lines[4];
+    const char *str = "USER x\r\nPASS y\n\r\n";
+
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, str, lines, 4) == 3);
+    FAIL_IF_NOT(lines[0].line == (uint8_t *)str);
+    FAIL_IF_NOT(lines[0].len == 6);
+    FAIL_IF_NOT(lines[0].delimiter_len == 2);
+    FAIL_IF_NOT(lines[1].len == 6);
+    FAIL_IF_NOT(memcmp(lines[1].line, "PASS y", 6) == 0);
+    FAIL_IF_NOT(lines[1].delimiter_len == 1);
+    FAIL_IF_NOT(lines[2].len == 0);
+    FAIL_IF_NOT(lines[2].delimiter_len == 2);
+    FAIL_IF_NOT(lb.buf == NULL);
+
+    LineBufferFree(&lb, &cfg);
+    PASS;
+}
+
+/** \test line spanning chunks, CR and LF in different chunks */
+static int LineBufferTest02(void)
+{
+    LineBufferConfig cfg = { 0, NULL, NULL };
+    LineBuffer lb;
+    memset(&lb, 0, sizeof(lb));
+    LineBufferLine lines[2];
+
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "RETR ", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "file\r", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "\nQUIT\r\n", lines, 2) == 2);
+    FAIL_IF_NOT(lines[0].line == lb.buf);
+    FAIL_IF_NOT(lines[0].len == 9);
+    FAIL_IF_NOT(memcmp(lines[0].line, "RETR file\r\n", 11) == 0);
+    FAIL_IF_NOT(lines[0].delimiter_len == 2);
+    FAIL_IF_NOT(lines[1].len == 4);
+    FAIL_IF_NOT(memcmp(lines[1].line, "QUIT", 4) == 0);
+
+    /* the buffer is kept for the next partial line */
+    uint8_t *buf = lb.buf;
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "NOOP", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "\n", lines, 2) == 1);
+    FAIL_IF_NOT(lb.buf == buf);
+    FAIL_IF_NOT(lines[0].len == 4);
+    FAIL_IF_NOT(lines[0].delimiter_len == 1);
+
+    LineBufferFree(&lb, &cfg);
+    PASS;
+}
+
+/** \test lines longer than max_len are cut */
+static int LineBufferTest03(void)
+{
+    LineBufferConfig cfg = { 4, NULL, NULL };
+    LineBuffer lb;
+    memset(&lb, 0, sizeof(lb));
+    LineBufferLine lines[2];
+
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "abcdefgh\r\n", lines, 2) == 1);
+    FAIL_IF_NOT(lines[0].len == 4);
+    FAIL_IF_NOT(lines[0].truncated);
+
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "abc", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "defgh", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "\r\n", lines, 2) == 1);
+    FAIL_IF_NOT(lines[0].len == 4);
+    FAIL_IF_NOT(memcmp(lines[0].line, "abcd", 4) == 0);
+    FAIL_IF_NOT(lines[0].truncated);
+    FAIL_IF_NOT(lines[0].delimiter_len == 2);
+    FAIL_IF_NOT(lb.size <= 6);
+
+    /* exactly max_len, the delimiter is stored after the line */
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "wx", lines, 2) == 0);
+    FAIL_IF_NOT(LineBufferGetAll(&lb, &cfg, "yz\r\n", lines, 2) == 1);
+    FAIL_IF_NOT(lines[0].len == 4);
+    FAIL_IF_NOT(memcmp(lines[0].line, "wxyz\r\n", 6) == 0);
+    FAIL_IF(lines[0].truncated);
+
+    LineBufferFree(&lb, &cfg);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void LineBufferRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LineBufferTest01", LineBufferTest01);
+    UtRegisterTest("LineBufferTest02", LineBufferTest02);
+    UtRegisterTest("LineBufferTest03", LineBufferTest03);
+#endif /* UNITTESTS */
+}
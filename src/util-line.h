@@ -0,0 +1,67 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Splitting of a stream of chunks into LF or CRLF terminated lines, for
+ * the parsers of line based protocols.
+ */
+
+#ifndef __UTIL_LINE_H__
+#define __UTIL_LINE_H__
+
+typedef struct LineBufferConfig_ {
+    /** longest line returned, the rest of a longer line is dropped.
+     *  0 for no limit */
+    uint32_t max_len;
+    /** allocator for the partial lines, SCRealloc/SCFree if NULL */
+    void *(*Realloc)(void *ptr, size_t orig_size, size_t size);
+    void (*Free)(void *ptr, size_t size);
+} LineBufferConfig;
+
+/** partial line of a direction, kept until its LF arrives */
+typedef struct LineBuffer_ {
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t size;
+    /** bytes of the line were not stored: too long or out of memory */
+    bool dropped;
+    /** last byte of the line so far is a CR */
+    bool cr;
+    /** buf holds the line last returned */
+    bool returned;
+} LineBuffer;
+
+typedef struct LineBufferLine_ {
+    /** in the input if the line was in a single chunk, else in the
+     *  LineBuffer. Valid until the next call for the LineBuffer */
+    uint8_t *line;
+    /** without the delimiter */
+    uint32_t len;
+    uint8_t delimiter_len;
+    /** the line was cut at LineBufferConfig::max_len */
+    bool truncated;
+} LineBufferLine;
+
+int LineBufferGetLine(LineBuffer *lb, const LineBufferConfig *cfg,
+        uint8_t **input, int32_t *input_len, LineBufferLine *line);
+void LineBufferFree(LineBuffer *lb, const LineBufferConfig *cfg);
+
+void LineBufferRegisterTests(void);
+
+#endif /* __UTIL_LINE_H__ */
@@ -0,0 +1,356 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * File-like output for logging: kafka
+ *
+ * Records are produced to a kafka topic with librdkafka, which does the
+ * batching, compression and delivery in its own threads.
+ */
+
+#include "suricata-common.h" /* errno.h, string.h, etc. */
+#include "util-log-kafka.h"
+#include "util-logopenfile.h"
+#include "counters.h"
+
+#ifdef HAVE_LIBRDKAFKA
+
+static const char *kafka_default_brokers = "127.0.0.1:9092";
+static const char *kafka_default_topic = "suricata";
+
+/** delivery stats of all kafka outputs, exposed as global counters */
+static uint64_t kafka_produced = 0;
+static uint64_t kafka_delivered = 0;
+static uint64_t kafka_delivery_failed = 0;
+static uint64_t kafka_dropped = 0;
+
+static uint64_t KafkaGetProduced(void)
+{
+    return __atomic_load_n(&kafka_produced, __ATOMIC_RELAXED);
+}
+
+static uint64_t KafkaGetDelivered(void)
+{
+    return __atomic_load_n(&kafka_delivered, __ATOMIC_RELAXED);
+}
+
+static uint64_t KafkaGetDeliveryFailed(void)
+{
+    return __atomic_load_n(&kafka_delivery_failed, __ATOMIC_RELAXED);
+}
+
+static uint64_t KafkaGetDropped(void)
+{
+    return __atomic_load_n(&kafka_dropped, __ATOMIC_RELAXED);
+}
+
+static void SCLogKafkaRegisterCounters(void)
+{
+    static bool registered = false;
+    if (registered)
+        return;
+    registered = true;
+
+    StatsRegisterGlobalCounter("kafka.produced", KafkaGetProduced);
+    StatsRegisterGlobalCounter("kafka.delivered", KafkaGetDelivered);
+    StatsRegisterGlobalCounter("kafka.delivery_failed", KafkaGetDeliveryFailed);
+    StatsRegisterGlobalCounter("kafka.dropped", KafkaGetDropped);
+}
+
+/** \brief delivery report callback, called from rd_kafka_poll() */
+static void SCLogKafkaDeliveryCallback(rd_kafka_t *rk,
+        const rd_kafka_message_t *rkmessage, void *opaque)
+{
+    if (rkmessage->err) {
+        SCLogDebug("kafka delivery failed: %s", rd_kafka_err2str(rkmessage->err));
+        __atomic_add_fetch(&kafka_delivery_failed, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&kafka_delivered, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/** \internal
+ *  \brief find the value of a top level key in a eve record
+ *
+ *  The eve header is written before the event data, so the first match
+ *  is the record's own flow_id or community_id.
+ *
+ *  \param key_len set to the length of the value
+ *  \retval value or NULL if not found
+ */
+static const char *KafkaRecordKey(const char *buf, size_t len,
+        enum KafkaPartitionKey key, size_t *key_len)
+{
+    const char *name;
+    size_t name_len;
+    if (key == KAFKA_KEY_FLOW_ID) {
+        name = "\"flow_id\":";
+        name_len = 10;
+    } else if (key == KAFKA_KEY_COMMUNITY_ID) {
+        name = "\"community_id\":";
+        name_len = 15;
+    } else {
+        return NULL;
+    }
+
+    const char *end = buf + len;
+    const char *p = buf;
+    while ((size_t)(end - p) > name_len) {
+        p = memchr(p, '"', end - p - name_len);
+        if (p == NULL)
+            return NULL;
+        if (memcmp(p, name, name_len) != 0) {
+            p++;
+            continue;
+        }
+        p += name_len;
+        while (p < end && *p == ' ')
+            p++;
+
+        const char *v = p;
+        if (key == KAFKA_KEY_FLOW_ID) {
+            while (p < end && *p >= '0' && *p <= '9')
+                p++;
+        } else {
+            if (p == end || *p != '"')
+                return NULL;
+            v = ++p;
+            while (p < end && *p != '"')
+                p++;
+            if (p == end)
+                return NULL;
+        }
+        if (p == v)
+            return NULL;
+        *key_len = p - v;
+        return v;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief producer of the calling thread
+ *
+ *  Threads are spread over the producers in the order they start
+ *  logging, so they don't all contend on the queue of a single producer.
+ */
+static SCLogKafkaProducer *SCLogKafkaGetProducer(SCLogKafkaContext *ctx)
+{
+#ifdef TLS
+    static uint32_t thread_cnt = 0;
+    static __thread uint32_t thread_id = 0;
+    if (unlikely(thread_id == 0)) {
+        thread_id = __atomic_add_fetch(&thread_cnt, 1, __ATOMIC_RELAXED);
+    }
+    return &ctx->producers[(thread_id - 1) % ctx->cnt];
+#else
+    return &ctx->producers[0];
+#endif
+}
+
+/**
+ * \brief LogFileWriteKafka() writes log data to kafka output.
+ * \param lf_ctx Log file context allocated by caller
+ * \param string buffer with data to write
+ * \param string_len data length
+ * \retval 0 on success
+ * \retval -1 if the record was dropped
+ */
+int LogFileWriteKafka(void *lf_ctx, const char *string, size_t string_len)
+{
+    LogFileCtx *log_ctx = lf_ctx;
+    SCLogKafkaContext *ctx = log_ctx->kafka;
+    SCLogKafkaProducer *p = SCLogKafkaGetProducer(ctx);
+
+    size_t key_len = 0;
+    const char *key = KafkaRecordKey(string, string_len,
+            log_ctx->kafka_setup.key, &key_len);
+
+    int r = rd_kafka_produce(p->rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+            (void *)string, string_len, key, key_len, NULL);
+    /* serve the delivery reports */
+    rd_kafka_poll(p->rk, 0);
+    if (r != 0) {
+        SCLogDebug("kafka produce failed: %s",
+                rd_kafka_err2str(rd_kafka_last_error()));
+        __atomic_add_fetch(&kafka_dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch(&kafka_produced, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/** \internal
+ *  \brief set a librdkafka property, error out on failure */
+static void SCLogKafkaConfSet(rd_kafka_conf_t *conf, const char *name,
+        const char *val)
+{
+    char errstr[512];
+    if (rd_kafka_conf_set(conf, name, val, errstr, sizeof(errstr)) !=
+            RD_KAFKA_CONF_OK) {
+        SCLogError(SC_ERR_KAFKA_CONFIG, "invalid kafka option %s: %s",
+                name, errstr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** \brief SCLogFileCloseKafka() Closes kafka output, waiting a limited
+ *         time for queued messages to be delivered
+ *  \param log_ctx Log file context allocated by caller
+ */
+static void SCLogFileCloseKafka(LogFileCtx *log_ctx)
+{
+    SCLogKafkaContext *ctx = log_ctx->kafka;
+    if (ctx == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ctx->cnt; i++) {
+        SCLogKafkaProducer *p = &ctx->producers[i];
+        if (p->rk == NULL)
+            continue;
+        if (rd_kafka_flush(p->rk, 5000) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            SCLogWarning(SC_ERR_KAFKA, "%d kafka messages were not "
+                    "delivered", rd_kafka_outq_len(p->rk));
+        }
+        if (p->rkt != NULL)
+            rd_kafka_topic_destroy(p->rkt);
+        rd_kafka_destroy(p->rk);
+    }
+    SCFree(ctx->producers);
+    SCFree(ctx);
+    log_ctx->kafka = NULL;
+}
+
+/** \brief configure and create the kafka producers
+ *  \param kafka_node Kafka configuration node
+ *  \param lf_ctx Log file context allocated by caller
+ *  \retval 0 on success
+ */
+int SCConfLogOpenKafka(ConfNode *kafka_node, void *lf_ctx)
+{
+    LogFileCtx *log_ctx = lf_ctx;
+    const char *brokers = NULL;
+    const char *compression = NULL;
+    const char *batch_size = NULL;
+    const char *linger = NULL;
+    const char *key = NULL;
+    intmax_t producers = 1;
+
+    if (kafka_node) {
+        brokers = ConfNodeLookupChildValue(kafka_node, "brokers");
+        log_ctx->kafka_setup.topic = ConfNodeLookupChildValue(kafka_node, "topic");
+        compression = ConfNodeLookupChildValue(kafka_node, "compression");
+        batch_size = ConfNodeLookupChildValue(kafka_node, "batch-size");
+        linger = ConfNodeLookupChildValue(kafka_node, "linger");
+        key = ConfNodeLookupChildValue(kafka_node, "partition-key");
+        if (ConfGetChildValueInt(kafka_node, "producers", &producers) &&
+                (producers < 1 || producers > 64)) {
+            SCLogError(SC_ERR_KAFKA_CONFIG, "kafka producers must be "
+                    "between 1 and 64");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!brokers) {
+        brokers = kafka_default_brokers;
+        SCLogInfo("Using default kafka brokers (%s)", brokers);
+    }
+    if (!log_ctx->kafka_setup.topic) {
+        log_ctx->kafka_setup.topic = kafka_default_topic;
+    }
+    log_ctx->kafka_setup.producers = (uint32_t)producers;
+
+    if (key == NULL || strcmp(key, "none") == 0) {
+        log_ctx->kafka_setup.key = KAFKA_KEY_NONE;
+    } else if (strcmp(key, "flow_id") == 0) {
+        log_ctx->kafka_setup.key = KAFKA_KEY_FLOW_ID;
+    } else if (strcmp(key, "community_id") == 0) {
+        log_ctx->kafka_setup.key = KAFKA_KEY_COMMUNITY_ID;
+    } else {
+        SCLogError(SC_ERR_KAFKA_CONFIG, "Invalid kafka partition-key %s, "
+                "expected flow_id, community_id or none", key);
+        exit(EXIT_FAILURE);
+    }
+
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    SCLogKafkaConfSet(conf, "bootstrap.servers", brokers);
+    if (compression)
+        SCLogKafkaConfSet(conf, "compression.codec", compression);
+    if (batch_size)
+        SCLogKafkaConfSet(conf, "batch.num.messages", batch_size);
+    if (linger)
+        SCLogKafkaConfSet(conf, "linger.ms", linger);
+
+    /* other librdkafka producer properties, as is */
+    ConfNode *options = kafka_node ? ConfNodeLookupChild(kafka_node, "options") : NULL;
+    if (options) {
+        ConfNode *opt;
+        TAILQ_FOREACH(opt, &options->head, next) {
+            SCLogKafkaConfSet(conf, opt->name, opt->val);
+        }
+    }
+    rd_kafka_conf_set_dr_msg_cb(conf, SCLogKafkaDeliveryCallback);
+
+    SCLogKafkaContext *ctx = SCCalloc(1, sizeof(SCLogKafkaContext));
+    if (unlikely(ctx == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate kafka context");
+        exit(EXIT_FAILURE);
+    }
+    ctx->producers = SCCalloc(producers, sizeof(SCLogKafkaProducer));
+    if (unlikely(ctx->producers == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate kafka producers");
+        exit(EXIT_FAILURE);
+    }
+    log_ctx->kafka = ctx;
+    log_ctx->Close = SCLogFileCloseKafka;
+
+    for (uint32_t i = 0; i < (uint32_t)producers; i++) {
+        char errstr[512];
+        rd_kafka_conf_t *pconf = rd_kafka_conf_dup(conf);
+        rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, pconf, errstr,
+                sizeof(errstr));
+        if (rk == NULL) {
+            SCLogError(SC_ERR_KAFKA, "failed to create kafka producer: %s",
+                    errstr);
+            rd_kafka_conf_destroy(pconf);
+            rd_kafka_conf_destroy(conf);
+            return -1;
+        }
+        ctx->producers[i].rk = rk;
+        ctx->cnt++;
+
+        ctx->producers[i].rkt = rd_kafka_topic_new(rk,
+                log_ctx->kafka_setup.topic, NULL);
+        if (ctx->producers[i].rkt == NULL) {
+            SCLogError(SC_ERR_KAFKA, "failed to create kafka topic %s: %s",
+                    log_ctx->kafka_setup.topic,
+                    rd_kafka_err2str(rd_kafka_last_error()));
+            rd_kafka_conf_destroy(conf);
+            return -1;
+        }
+    }
+    rd_kafka_conf_destroy(conf);
+
+    SCLogKafkaRegisterCounters();
+    SCLogConfig("kafka output: brokers %s, topic %s, %u producer(s)",
+            brokers, log_ctx->kafka_setup.topic, ctx->cnt);
+    return 0;
+}
+
+#endif /* HAVE_LIBRDKAFKA */
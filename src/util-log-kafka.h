@@ -0,0 +1,60 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * File-like output for logging: kafka
+ */
+
+#ifndef __UTIL_LOG_KAFKA_H__
+#define __UTIL_LOG_KAFKA_H__
+
+#ifdef HAVE_LIBRDKAFKA
+#include <librdkafka/rdkafka.h>
+
+#include "conf.h"            /* ConfNode   */
+
+/** what to use as message key, messages with the same key go to the
+ *  same partition */
+enum KafkaPartitionKey {
+    KAFKA_KEY_NONE,
+    KAFKA_KEY_FLOW_ID,
+    KAFKA_KEY_COMMUNITY_ID,
+};
+
+typedef struct KafkaSetup_ {
+    const char *topic;
+    enum KafkaPartitionKey key;
+    uint32_t producers;
+} KafkaSetup;
+
+typedef struct SCLogKafkaProducer_ {
+    rd_kafka_t *rk;
+    rd_kafka_topic_t *rkt;
+} SCLogKafkaProducer;
+
+typedef struct SCLogKafkaContext_ {
+    uint32_t cnt;
+    SCLogKafkaProducer *producers;
+} SCLogKafkaContext;
+
+int SCConfLogOpenKafka(ConfNode *, void *);
+int LogFileWriteKafka(void *, const char *, size_t);
+
+#endif /* HAVE_LIBRDKAFKA */
+#endif /* __UTIL_LOG_KAFKA_H__ */
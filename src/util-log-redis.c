@@ -26,6 +26,7 @@
 #include "suricata-common.h" /* errno.h, string.h, etc. */
 #include "util-log-redis.h"
 #include "util-logopenfile.h"
+#include "counters.h"
 
 #ifdef HAVE_LIBHIREDIS
 
@@ -36,20 +37,75 @@
 static const char * redis_lpush_cmd = "LPUSH";
 static const char * redis_rpush_cmd = "RPUSH";
 static const char * redis_publish_cmd = "PUBLISH";
+static const char * redis_xadd_cmd = "XADD";
 static const char * redis_default_key = "suricata";
 static const char * redis_default_server = "127.0.0.1";
 
+/** default max async commands waiting for a reply */
+#define REDIS_DEFAULT_MAX_PENDING 100000
+
 static int SCConfLogReopenSyncRedis(LogFileCtx *log_ctx);
 static void SCLogFileCloseRedis(LogFileCtx *log_ctx);
 
+/** stats of all redis outputs, exposed as global counters */
+static uint64_t redis_sent = 0;
+static uint64_t redis_dropped = 0;
+static uint64_t redis_errors = 0;
+
+static uint64_t RedisGetSent(void)
+{
+    return __atomic_load_n(&redis_sent, __ATOMIC_RELAXED);
+}
+
+static uint64_t RedisGetDropped(void)
+{
+    return __atomic_load_n(&redis_dropped, __ATOMIC_RELAXED);
+}
+
+static uint64_t RedisGetErrors(void)
+{
+    return __atomic_load_n(&redis_errors, __ATOMIC_RELAXED);
+}
+
+#define REDIS_STATS_INCR(c) __atomic_add_fetch(&(c), 1, __ATOMIC_RELAXED)
+
 /**
  * \brief SCLogRedisInit() - Initializes global stuff before threads
  */
 void SCLogRedisInit()
 {
+    static bool initialized = false;
+    if (initialized)
+        return;
+    initialized = true;
+
 #ifdef HAVE_LIBEVENT_PTHREADS
     evthread_use_pthreads();
 #endif /* HAVE_LIBEVENT_PTHREADS */
+
+    StatsRegisterGlobalCounter("redis.sent", RedisGetSent);
+    StatsRegisterGlobalCounter("redis.dropped", RedisGetDropped);
+    StatsRegisterGlobalCounter("redis.errors", RedisGetErrors);
+}
+
+/** \brief format the command for a log record
+ *  \param cmd set to the formatted command, free with redisFreeCommand()
+ *  \retval length of the command or -1 on error
+ */
+static int SCLogRedisFormat(LogFileCtx *file_ctx, const char *string,
+        size_t string_len, char **cmd)
+{
+    const RedisSetup *setup = &file_ctx->redis_setup;
+    if (setup->mode == REDIS_STREAM) {
+        if (setup->stream_maxlen > 0) {
+            return redisFormatCommand(cmd, "XADD %s MAXLEN ~ %d * event %b",
+                    setup->key, setup->stream_maxlen, string, string_len);
+        }
+        return redisFormatCommand(cmd, "XADD %s * event %b",
+                setup->key, string, string_len);
+    }
+    return redisFormatCommand(cmd, "%s %s %b", setup->command, setup->key,
+            string, string_len);
 }
 
 /** \brief SCLogRedisContextAlloc() - Allocates and initalizes redis context
@@ -108,13 +164,18 @@ static void SCRedisAsyncCommandCallback(redisAsyncContext *ac, void *r, void *pr
     LogFileCtx *log_ctx = privdata;
     SCLogRedisContext *ctx = log_ctx->redis;
 
+    if (ctx->pending > 0)
+        ctx->pending--;
+
     if (reply == NULL) {
         if (ctx->connected > 0)
             SCLogInfo("Missing reply from redis, disconnected.");
         ctx->connected = 0;
     } else {
+        if (reply->type == REDIS_REPLY_ERROR) {
+            REDIS_STATS_INCR(redis_errors);
+        }
         ctx->connected = 1;
-        event_base_loopbreak(ctx->ev_base);
     }
 }
 
@@ -229,6 +290,8 @@ static int SCConfLogReopenAsyncRedis(LogFileCtx *log_ctx)
     }
 
     redisLibeventAttach(ctx->async, ctx->ev_base);
+    ctx->pending = 0;
+    ctx->batch_count = 0;
 
     log_ctx->redis = ctx;
     log_ctx->Close = SCLogFileCloseRedis;
@@ -237,6 +300,12 @@ static int SCConfLogReopenAsyncRedis(LogFileCtx *log_ctx)
 
 
 /** \brief SCLogRedisWriteAsync() writes string to redis output in async mode
+ *
+ *  Commands are pipelined: they are queued without waiting for replies
+ *  and the connection is only serviced once per pipelining batch-size
+ *  commands. When max-pending commands are waiting for a reply the
+ *  event is dropped.
+ *
  *  \param file_ctx Log file context allocated by caller
  *  \param string Buffer to output
  */
@@ -246,6 +315,7 @@ static int SCLogRedisWriteAsync(LogFileCtx *file_ctx, const char *string, size_t
 
     if (! ctx->connected) {
         if (SCConfLogReopenAsyncRedis(file_ctx) == -1) {
+            REDIS_STATS_INCR(redis_dropped);
             return -1;
         }
         if (ctx->tried == 0) {
@@ -254,23 +324,41 @@ static int SCLogRedisWriteAsync(LogFileCtx *file_ctx, const char *string, size_t
         SCLogAsyncRedisSendEcho(ctx);
     }
 
-    if (!ctx->connected) {
+    if (!ctx->connected || ctx->async == NULL) {
+        REDIS_STATS_INCR(redis_dropped);
         return -1;
     }
 
-    if (ctx->async == NULL) {
-        return -1;
+    if (file_ctx->redis_setup.max_pending > 0 &&
+            ctx->pending >= file_ctx->redis_setup.max_pending) {
+        /* read what replies there are, drop if redis is still behind */
+        event_base_loop(ctx->ev_base, EVLOOP_NONBLOCK);
+        if (ctx->pending >= file_ctx->redis_setup.max_pending) {
+            REDIS_STATS_INCR(redis_dropped);
+            return -1;
+        }
     }
 
-    redisAsyncCommand(ctx->async,
-            SCRedisAsyncCommandCallback,
-            file_ctx,
-            "%s %s %s",
-            file_ctx->redis_setup.command,
-            file_ctx->redis_setup.key,
-            string);
+    char *cmd = NULL;
+    int len = SCLogRedisFormat(file_ctx, string, string_len, &cmd);
+    if (len < 0) {
+        REDIS_STATS_INCR(redis_dropped);
+        return -1;
+    }
+    int r = redisAsyncFormattedCommand(ctx->async, SCRedisAsyncCommandCallback,
+            file_ctx, cmd, len);
+    redisFreeCommand(cmd);
+    if (r != REDIS_OK) {
+        REDIS_STATS_INCR(redis_dropped);
+        return -1;
+    }
+    ctx->pending++;
+    REDIS_STATS_INCR(redis_sent);
 
-    event_base_loop(ctx->ev_base, EVLOOP_NONBLOCK);
+    if (++ctx->batch_count >= file_ctx->redis_setup.batch_size) {
+        ctx->batch_count = 0;
+        event_base_loop(ctx->ev_base, EVLOOP_NONBLOCK);
+    }
 
     return 0;
 }
@@ -314,11 +402,41 @@ static int SCConfLogReopenSyncRedis(LogFileCtx *log_ctx)
     log_ctx->Close = SCLogFileCloseRedis;
     return 0;
 }
+/** \brief check a reply to a log command
+ *  \retval 0 ok
+ *  \retval -1 error reply, the connection is reopened
+ */
+static int SCLogRedisCheckReply(LogFileCtx *file_ctx, redisReply *reply)
+{
+    switch (reply->type) {
+        case REDIS_REPLY_ERROR:
+            SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
+            REDIS_STATS_INCR(redis_errors);
+            SCConfLogReopenSyncRedis(file_ctx);
+            return -1;
+        case REDIS_REPLY_INTEGER:
+            SCLogDebug("Redis integer %lld", reply->integer);
+            return 0;
+        case REDIS_REPLY_STRING:
+        case REDIS_REPLY_STATUS:
+            /* XADD replies with the id of the new entry */
+            SCLogDebug("Redis string %s", reply->str);
+            return 0;
+        default:
+            SCLogError(SC_ERR_INVALID_VALUE,
+                    "Redis default triggered with %d", reply->type);
+            REDIS_STATS_INCR(redis_errors);
+            SCConfLogReopenSyncRedis(file_ctx);
+            return -1;
+    }
+}
+
 /** \brief SCLogRedisWriteSync() writes string to redis output in sync mode
  *  \param file_ctx Log file context allocated by caller
  *  \param string Buffer to output
  */
-static int SCLogRedisWriteSync(LogFileCtx *file_ctx, const char *string)
+static int SCLogRedisWriteSync(LogFileCtx *file_ctx, const char *string,
+        size_t string_len)
 {
     SCLogRedisContext * ctx = file_ctx->redis;
     int ret = -1;
@@ -328,22 +446,32 @@ static int SCLogRedisWriteSync(LogFileCtx *file_ctx, const char *string)
         redis = ctx->sync;
         if (redis == NULL) {
             SCLogDebug("Redis after re-open is not available.");
+            REDIS_STATS_INCR(redis_dropped);
             return -1;
         }
     }
 
+    char *cmd = NULL;
+    int len = SCLogRedisFormat(file_ctx, string, string_len, &cmd);
+    if (len < 0) {
+        REDIS_STATS_INCR(redis_dropped);
+        return -1;
+    }
+    redisAppendFormattedCommand(redis, cmd, len);
+    redisFreeCommand(cmd);
+    REDIS_STATS_INCR(redis_sent);
+
     /* synchronous mode */
     if (file_ctx->redis_setup.batch_size) {
-        redisAppendCommand(redis, "%s %s %s",
-                file_ctx->redis_setup.command,
-                file_ctx->redis_setup.key,
-                string);
         if (ctx->batch_count == file_ctx->redis_setup.batch_size) {
             redisReply *reply;
             int i;
             ctx->batch_count = 0;
             for (i = 0; i <= file_ctx->redis_setup.batch_size; i++) {
                 if (redisGetReply(redis, (void **)&reply) == REDIS_OK) {
+                    if (reply->type == REDIS_REPLY_ERROR) {
+                        REDIS_STATS_INCR(redis_errors);
+                    }
                     freeReplyObject(reply);
                     ret = 0;
                 } else {
@@ -375,29 +503,13 @@ static int SCLogRedisWriteSync(LogFileCtx *file_ctx, const char *string)
             }
         } else {
             ctx->batch_count++;
+            ret = 0;
         }
     } else {
-        redisReply *reply = redisCommand(redis, "%s %s %s",
-                file_ctx->redis_setup.command,
-                file_ctx->redis_setup.key,
-                string);
+        redisReply *reply = NULL;
         /* We may lose the reply if disconnection happens*/
-        if (reply) {
-            switch (reply->type) {
-                case REDIS_REPLY_ERROR:
-                    SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
-                    SCConfLogReopenSyncRedis(file_ctx);
-                    break;
-                case REDIS_REPLY_INTEGER:
-                    SCLogDebug("Redis integer %lld", reply->integer);
-                    ret = 0;
-                    break;
-                default:
-                    SCLogError(SC_ERR_INVALID_VALUE,
-                            "Redis default triggered with %d", reply->type);
-                    SCConfLogReopenSyncRedis(file_ctx);
-                    break;
-            }
+        if (redisGetReply(redis, (void **)&reply) == REDIS_OK && reply) {
+            ret = SCLogRedisCheckReply(file_ctx, reply);
             freeReplyObject(reply);
         } else {
             SCConfLogReopenSyncRedis(file_ctx);
@@ -429,7 +541,7 @@ int LogFileWriteRedis(void *lf_ctx, const char *string, size_t string_len)
 #endif
     /* sync mode */
     if (! file_ctx->redis_setup.is_async) {
-        return SCLogRedisWriteSync(file_ctx, string);
+        return SCLogRedisWriteSync(file_ctx, string, string_len);
     }
     return -1;
 }
@@ -504,6 +616,18 @@ int SCConfLogOpenRedis(ConfNode *redis_node, void *lf_ctx)
         log_ctx->redis_setup.command = redis_rpush_cmd;
     } else if(!strcmp(redis_mode,"channel") || !strcmp(redis_mode,"publish")) {
         log_ctx->redis_setup.command = redis_publish_cmd;
+        log_ctx->redis_setup.mode = REDIS_CHANNEL;
+    } else if(!strcmp(redis_mode,"stream") || !strcmp(redis_mode,"xadd")) {
+        log_ctx->redis_setup.command = redis_xadd_cmd;
+        log_ctx->redis_setup.mode = REDIS_STREAM;
+        intmax_t maxlen = 0;
+        if (redis_node && ConfGetChildValueInt(redis_node, "stream-maxlen", &maxlen)) {
+            if (maxlen < 0 || maxlen > INT_MAX) {
+                SCLogError(SC_ERR_REDIS_CONFIG, "Invalid redis stream-maxlen");
+                exit(EXIT_FAILURE);
+            }
+            log_ctx->redis_setup.stream_maxlen = (int)maxlen;
+        }
     } else {
         SCLogError(SC_ERR_REDIS_CONFIG,"Invalid redis mode");
         exit(EXIT_FAILURE);
@@ -515,14 +639,49 @@ int SCConfLogOpenRedis(ConfNode *redis_node, void *lf_ctx)
         exit(EXIT_FAILURE);
     }
     log_ctx->redis_setup.port = atoi(redis_port);
+
+    log_ctx->redis_setup.max_pending = REDIS_DEFAULT_MAX_PENDING;
+    if (redis_node) {
+        intmax_t val;
+        if (ConfGetChildValueInt(redis_node, "max-pending", &val)) {
+            if (val < 0 || val > INT_MAX) {
+                SCLogError(SC_ERR_REDIS_CONFIG, "Invalid redis max-pending");
+                exit(EXIT_FAILURE);
+            }
+            log_ctx->redis_setup.max_pending = (int)val;
+        }
+    }
+
+    if (log_ctx->threaded) {
+#ifdef TLS
+        /* connections are made by each thread, see SCLogRedisContextInit() */
+        SCLogInfo("Using a redis connection per thread");
+        return 0;
+#else
+        SCLogWarning(SC_ERR_REDIS_CONFIG, "threaded mode needs thread local "
+                "storage support, using a single redis connection");
+        log_ctx->threaded = false;
+#endif
+    }
+    return SCLogRedisContextInit(log_ctx);
+}
+
+/** \brief set up the redis context of a log ctx, connecting right away
+ *         in sync mode and on first write in async mode
+ *  \param lf_ctx Log file context with a configured redis_setup
+ *  \retval 0 on success
+ */
+int SCLogRedisContextInit(void *lf_ctx)
+{
+    LogFileCtx *log_ctx = lf_ctx;
     log_ctx->Close = SCLogFileCloseRedis;
 
 #ifdef HAVE_LIBEVENT
-    if (is_async) {
+    if (log_ctx->redis_setup.is_async) {
         log_ctx->redis = SCLogRedisContextAsyncAlloc();
     }
 #endif /*HAVE_LIBEVENT*/
-    if (! is_async) {
+    if (! log_ctx->redis_setup.is_async) {
         log_ctx->redis = SCLogRedisContextAlloc();
         SCConfLogReopenSyncRedis(log_ctx);
     }
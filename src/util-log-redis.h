@@ -34,7 +34,7 @@
 
 #include "conf.h"            /* ConfNode   */
 
-enum RedisMode { REDIS_LIST, REDIS_CHANNEL };
+enum RedisMode { REDIS_LIST, REDIS_CHANNEL, REDIS_STREAM };
 
 typedef struct RedisSetup_ {
     enum RedisMode mode;
@@ -44,6 +44,11 @@ typedef struct RedisSetup_ {
     int  port;
     int is_async;
     int  batch_size;
+    /** async: max commands waiting for a reply, events are dropped
+     *  beyond this */
+    int max_pending;
+    /** stream: approximate max length of the stream, 0 for no limit */
+    int stream_maxlen;
 } RedisSetup;
 
 typedef struct SCLogRedisContext_ {
@@ -55,10 +60,13 @@ typedef struct SCLogRedisContext_ {
 #endif /* HAVE_LIBEVENT */
     time_t tried;
     int  batch_count;
+    /** async: commands sent that didn't get a reply yet */
+    int pending;
 } SCLogRedisContext;
 
 void SCLogRedisInit(void);
 int SCConfLogOpenRedis(ConfNode *, void *);
+int SCLogRedisContextInit(void *);
 int LogFileWriteRedis(void *, const char *, size_t);
 
 #endif /* HAVE_LIBHIREDIS */
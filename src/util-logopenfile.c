@@ -31,6 +31,7 @@
 #include "util-byte.h"
 #include "util-path.h"
 #include "util-logopenfile.h"
+#include "util-trace.h"
 
 #if defined(HAVE_SYS_UN_H) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_TYPES_H)
 #define BUILD_WITH_UNIXSOCKET
@@ -42,6 +43,9 @@
 #ifdef HAVE_LIBHIREDIS
 #include "util-log-redis.h"
 #endif /* HAVE_LIBHIREDIS */
+#ifdef HAVE_LIBRDKAFKA
+#include "util-log-kafka.h"
+#endif /* HAVE_LIBRDKAFKA */
 
 #ifdef BUILD_WITH_UNIXSOCKET
 /** \brief connect to the indicated local stream socket, logging any errors
@@ -177,14 +181,31 @@ tryagain:
 }
 #endif /* BUILD_WITH_UNIXSOCKET */
 
+/** \brief reopen the log file if rotation was requested or the rotate
+ *         interval passed */
+static void SCLogFileCheckRotation(LogFileCtx *log_ctx)
+{
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+
+    if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
+        time_t now = time(NULL);
+        if (now >= log_ctx->rotate_time) {
+            SCConfLogReopen(log_ctx);
+            log_ctx->rotate_time = now + log_ctx->rotate_interval;
+        }
+    }
+}
+
 /**
  * \brief Write buffer to log file.
  * \retval 0 on failure; otherwise, the return value of fwrite (number of
  * characters successfully written).
  */
-static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+static int SCLogFileWriteNoLock(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
 {
-    SCMutexLock(&log_ctx->fp_mutex);
     int ret = 0;
 
 #ifdef BUILD_WITH_UNIXSOCKET
@@ -193,20 +214,7 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     } else
 #endif
     {
-
-        /* Check for rotation. */
-        if (log_ctx->rotation_flag) {
-            log_ctx->rotation_flag = 0;
-            SCConfLogReopen(log_ctx);
-        }
-
-        if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
-            time_t now = time(NULL);
-            if (now >= log_ctx->rotate_time) {
-                SCConfLogReopen(log_ctx);
-                log_ctx->rotate_time = now + log_ctx->rotate_interval;
-            }
-        }
+        SCLogFileCheckRotation(log_ctx);
 
         if (log_ctx->fp) {
             clearerr(log_ctx->fp);
@@ -215,11 +223,279 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
         }
     }
 
-    SCMutexUnlock(&log_ctx->fp_mutex);
+    return ret;
+}
 
+static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    SCMutexLock(&log_ctx->fp_mutex);
+    int ret = SCLogFileWriteNoLock(buffer, buffer_len, log_ctx);
+    SCMutexUnlock(&log_ctx->fp_mutex);
     return ret;
 }
 
+/** a queued record, the data includes the trailing newline */
+typedef struct LogFileAsyncRecord_ {
+    struct LogFileAsyncRecord_ *next;
+    uint32_t len;
+    char data[];
+} LogFileAsyncRecord;
+
+typedef struct LogFileAsync_ {
+    /** lock free stack of queued records, newest first. Workers push,
+     *  the writer thread takes the whole stack at once. */
+    LogFileAsyncRecord *head;
+    uint64_t memcap;
+    SC_ATOMIC_DECLARE(uint64_t, memuse);
+    SC_ATOMIC_DECLARE(uint64_t, dropped);
+    bool stop;
+    SCCtrlMutex m;
+    SCCtrlCondT cond;
+    pthread_t thread;
+} LogFileAsync;
+
+/** max records per writev */
+#define LOGFILE_ASYNC_IOV 64
+/** ms the writer sleeps when there is nothing to write */
+#define LOGFILE_ASYNC_WAIT_MS 100
+
+/** \internal
+ *  \brief writev all of iov, dealing with partial writes */
+static int LogFileWritev(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t r = writev(fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief write a list of records, oldest first, and free them
+ *
+ *  Regular files are written with writev in batches. Sockets write
+ *  record by record so that datagrams stay separate and the reconnect
+ *  and drop logic of SCLogFileWriteSocket() applies.
+ */
+static void LogFileAsyncWriteList(LogFileCtx *log_ctx, LogFileAsyncRecord *list)
+{
+    LogFileAsync *async = log_ctx->async;
+    struct iovec iov[LOGFILE_ASYNC_IOV];
+
+    SCMutexLock(&log_ctx->fp_mutex);
+    if (!log_ctx->is_sock) {
+        SCLogFileCheckRotation(log_ctx);
+    }
+    while (list != NULL) {
+        LogFileAsyncRecord *batch = list;
+        uint64_t size = 0;
+        int cnt = 0;
+        for ( ; list != NULL && cnt < LOGFILE_ASYNC_IOV; list = list->next) {
+            iov[cnt].iov_base = list->data;
+            iov[cnt].iov_len = list->len;
+            size += sizeof(*list) + list->len;
+            cnt++;
+        }
+
+        if (log_ctx->is_sock) {
+            for (int i = 0; i < cnt; i++) {
+                SCLogFileWriteNoLock(iov[i].iov_base, iov[i].iov_len, log_ctx);
+            }
+        } else if (log_ctx->fp != NULL) {
+            if (LogFileWritev(fileno(log_ctx->fp), iov, cnt) < 0) {
+                SCLogDebug("writev failed: %s", strerror(errno));
+            }
+        }
+
+        while (batch != list) {
+            LogFileAsyncRecord *next = batch->next;
+            SCFree(batch);
+            batch = next;
+        }
+        (void)SC_ATOMIC_SUB(async->memuse, size);
+    }
+    SCMutexUnlock(&log_ctx->fp_mutex);
+}
+
+/** \internal
+ *  \brief take all queued records, in the order they were queued */
+static LogFileAsyncRecord *LogFileAsyncTake(LogFileAsync *async)
+{
+    LogFileAsyncRecord *rec = __atomic_exchange_n(&async->head, NULL,
+            __ATOMIC_ACQUIRE);
+    LogFileAsyncRecord *list = NULL;
+    while (rec != NULL) {
+        LogFileAsyncRecord *next = rec->next;
+        rec->next = list;
+        list = rec;
+        rec = next;
+    }
+    return list;
+}
+
+static void *LogFileAsyncThread(void *data)
+{
+    LogFileCtx *log_ctx = data;
+    LogFileAsync *async = log_ctx->async;
+
+    while (1) {
+        LogFileAsyncRecord *list = LogFileAsyncTake(async);
+        if (list != NULL) {
+            LogFileAsyncWriteList(log_ctx, list);
+            continue;
+        }
+        if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE)) {
+            /* take whatever was queued before the stop */
+            list = LogFileAsyncTake(async);
+            if (list == NULL)
+                break;
+            LogFileAsyncWriteList(log_ctx, list);
+            continue;
+        }
+
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec;
+        ts.tv_nsec = tv.tv_usec * 1000 + LOGFILE_ASYNC_WAIT_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        SCCtrlMutexLock(&async->m);
+        if (__atomic_load_n(&async->head, __ATOMIC_ACQUIRE) == NULL &&
+                !__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE)) {
+            SCCtrlCondTimedwait(&async->cond, &async->m, &ts);
+        }
+        SCCtrlMutexUnlock(&async->m);
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief queue a record for the writer thread
+ *
+ *  The caller's buffer is reused for its next record, so the data is
+ *  copied. If the queue is at its memcap the record is dropped.
+ */
+static int LogFileAsyncEnqueue(LogFileCtx *log_ctx, const char *buffer,
+        uint32_t buffer_len)
+{
+    LogFileAsync *async = log_ctx->async;
+    const uint64_t size = sizeof(LogFileAsyncRecord) + buffer_len;
+
+    if (SC_ATOMIC_ADD(async->memuse, size) > async->memcap) {
+        (void)SC_ATOMIC_SUB(async->memuse, size);
+        (void)SC_ATOMIC_ADD(async->dropped, 1);
+        return -1;
+    }
+    LogFileAsyncRecord *rec = SCMalloc(size);
+    if (unlikely(rec == NULL)) {
+        (void)SC_ATOMIC_SUB(async->memuse, size);
+        (void)SC_ATOMIC_ADD(async->dropped, 1);
+        return -1;
+    }
+    rec->len = buffer_len;
+    memcpy(rec->data, buffer, buffer_len);
+
+    LogFileAsyncRecord *head = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+    do {
+        rec->next = head;
+    } while (!__atomic_compare_exchange_n(&async->head, &head, rec, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* wake up the writer if the queue was empty */
+    if (head == NULL) {
+        SCCtrlMutexLock(&async->m);
+        SCCtrlCondSignal(&async->cond);
+        SCCtrlMutexUnlock(&async->m);
+    }
+    return 0;
+}
+
+/**
+ * \brief write from a dedicated thread
+ *
+ * Records are queued by LogFileWrite() and written by a writer thread,
+ * so a slow disk or a blocked socket does not stall the workers. When
+ * more than memcap bytes are queued records are dropped.
+ *
+ * \param log_ctx opened file or unix socket log ctx
+ * \param memcap max bytes queued
+ * \retval 0 ok
+ * \retval -1 error, the ctx keeps writing directly
+ */
+int LogFileAsyncStart(LogFileCtx *log_ctx, uint64_t memcap)
+{
+    if (log_ctx->threaded) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "async output can't be "
+                "combined with threaded output, using threaded");
+        return -1;
+    }
+
+    LogFileAsync *async = SCCalloc(1, sizeof(*async));
+    if (unlikely(async == NULL))
+        return -1;
+    async->memcap = memcap;
+    SC_ATOMIC_INIT(async->memuse);
+    SC_ATOMIC_INIT(async->dropped);
+    SCCtrlMutexInit(&async->m, NULL);
+    SCCtrlCondInit(&async->cond, NULL);
+    log_ctx->async = async;
+
+    if (pthread_create(&async->thread, NULL, LogFileAsyncThread, log_ctx) != 0) {
+        SCLogWarning(SC_ERR_THREAD_CREATE, "failed to create log writer "
+                "thread: %s", strerror(errno));
+        log_ctx->async = NULL;
+        SCCtrlCondDestroy(&async->cond);
+        SCCtrlMutexDestroy(&async->m);
+        SC_ATOMIC_DESTROY(async->memuse);
+        SC_ATOMIC_DESTROY(async->dropped);
+        SCFree(async);
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief write out the queue and stop the writer thread */
+static void LogFileAsyncStop(LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+
+    SCCtrlMutexLock(&async->m);
+    __atomic_store_n(&async->stop, true, __ATOMIC_RELEASE);
+    SCCtrlCondSignal(&async->cond);
+    SCCtrlMutexUnlock(&async->m);
+    pthread_join(async->thread, NULL);
+
+    const uint64_t dropped = SC_ATOMIC_GET(async->dropped);
+    if (dropped) {
+        SCLogWarning(SC_WARN_EVENT_DROPPED, "%"PRIu64" events were dropped "
+                "because the output queue was full", dropped);
+    }
+
+    log_ctx->async = NULL;
+    SCCtrlCondDestroy(&async->cond);
+    SCCtrlMutexDestroy(&async->m);
+    SC_ATOMIC_DESTROY(async->memuse);
+    SC_ATOMIC_DESTROY(async->dropped);
+    SCFree(async);
+}
+
 /** \brief generate filename based on pattern
  *  \param pattern pattern to use
  *  \retval char* on success
@@ -293,6 +569,211 @@ SCLogOpenFileFp(const char *path, const char *append_setting, uint32_t mode)
     return ret;
 }
 
+/** \internal
+ *  \brief setup a ctx for threaded mode, the per thread files or sockets
+ *         are opened by LogFileGetThreadCtx() on first use
+ *  \retval 0 ok
+ *  \retval -1 threaded mode not supported for the filetype
+ */
+static int LogFileSetupThreaded(LogFileCtx *log_ctx, const char *filetype,
+        const char *append, int rotate)
+{
+#ifndef TLS
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "threaded mode needs thread local "
+            "storage support, using a single %s", filetype);
+    return -1;
+#else
+    if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
+               strcasecmp(filetype, "file") == 0) {
+        log_ctx->is_regular = 1;
+        log_ctx->append = ConfValIsTrue(append);
+        if (rotate) {
+            OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
+        }
+#ifdef BUILD_WITH_UNIXSOCKET
+    } else if (strcasecmp(filetype, "unix_stream") == 0) {
+        log_ctx->is_sock = 1;
+        log_ctx->sock_type = SOCK_STREAM;
+    } else if (strcasecmp(filetype, "unix_dgram") == 0) {
+        log_ctx->is_sock = 1;
+        log_ctx->sock_type = SOCK_DGRAM;
+#endif
+    } else {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "threaded mode not supported "
+                "for filetype %s, using a single output", filetype);
+        return -1;
+    }
+#ifdef BUILD_WITH_UNIXSOCKET
+    if (log_ctx->is_sock && !IsRunModeOffline(RunmodeGetCurrent())) {
+        log_ctx->send_flags |= MSG_DONTWAIT;
+    }
+#endif
+    return 0;
+#endif
+}
+
+#ifdef TLS
+/** \internal
+ *  \brief name of a per thread file: the thread number is added before
+ *         the extension, so eve.json becomes eve.1.json
+ */
+static char *LogFileThreadedFilename(const char *filename, uint32_t thread)
+{
+    char name[PATH_MAX];
+    const char *base = strrchr(filename, '/');
+    const char *ext = strrchr(base ? base : filename, '.');
+    if (ext == NULL || ext == base + 1 || ext == filename) {
+        snprintf(name, sizeof(name), "%s.%u", filename, thread);
+    } else {
+        snprintf(name, sizeof(name), "%.*s.%u%s", (int)(ext - filename),
+                filename, thread, ext);
+    }
+    return SCStrdup(name);
+}
+
+/** \internal
+ *  \brief create and open the ctx for the calling thread
+ *  \note called with the parent's fp_mutex held
+ */
+static LogFileCtx *LogFileNewThreadCtx(LogFileCtx *parent)
+{
+    LogFileCtx *child = LogFileNewCtx();
+    if (child == NULL)
+        return NULL;
+
+    child->Write = SCLogFileWriteNoLock;
+    child->type = parent->type;
+    child->filemode = parent->filemode;
+    child->is_regular = parent->is_regular;
+    child->is_sock = parent->is_sock;
+    child->sock_type = parent->sock_type;
+    child->send_flags = parent->send_flags;
+    child->flags = parent->flags & LOGFILE_ROTATE_INTERVAL;
+    child->rotate_time = parent->rotate_time;
+    child->rotate_interval = parent->rotate_interval;
+    child->cbor = parent->cbor;
+    child->parent = parent;
+    child->rotations_seen = SC_ATOMIC_GET(parent->rotations);
+
+#ifdef HAVE_LIBHIREDIS
+    if (parent->type == LOGFILE_TYPE_REDIS) {
+        child->redis_setup = parent->redis_setup;
+        if (SCLogRedisContextInit(child) < 0) {
+            LogFileFreeCtx(child);
+            return NULL;
+        }
+        goto done;
+    }
+#endif
+
+    if (parent->is_sock) {
+        /* all threads connect to the same socket */
+        child->filename = SCStrdup(parent->filename);
+    } else {
+        child->filename = LogFileThreadedFilename(parent->filename,
+                parent->threads_cnt + 1);
+    }
+    if (child->filename == NULL) {
+        LogFileFreeCtx(child);
+        return NULL;
+    }
+
+#ifdef BUILD_WITH_UNIXSOCKET
+    if (child->is_sock) {
+        /* Don't bail. May be able to connect later. */
+        child->fp = SCLogOpenUnixSocketFp(child->filename, child->sock_type, 1);
+    } else
+#endif
+    {
+        child->fp = SCLogOpenFileFp(child->filename,
+                parent->append ? "yes" : "no", child->filemode);
+        if (child->fp == NULL) {
+            LogFileFreeCtx(child);
+            return NULL;
+        }
+    }
+
+#ifdef HAVE_LIBHIREDIS
+done:
+#endif
+    parent->threads_cnt++;
+    child->next = parent->threads;
+    parent->threads = child;
+    SCLogDebug("thread ctx %u created", parent->threads_cnt);
+    return child;
+}
+
+#define LOGFILE_THREAD_CACHE_SIZE 8
+
+/** per thread lookup of the threaded ctxs this thread writes to. The
+ *  parent id makes sure a stale entry of a freed parent never matches. */
+typedef struct LogFileThreadCacheEntry_ {
+    const LogFileCtx *parent;
+    uint32_t id;
+    LogFileCtx *child;
+} LogFileThreadCacheEntry;
+
+static __thread LogFileThreadCacheEntry logfile_thread_cache[LOGFILE_THREAD_CACHE_SIZE];
+static __thread uint32_t logfile_thread_cache_cnt = 0;
+
+/** \internal
+ *  \brief get the ctx of the calling thread for a threaded parent
+ *
+ *  The first write of a thread creates its file or connection. After
+ *  that the lookup is lock free. A rotation notification for the parent
+ *  is turned into a new generation that each thread picks up to reopen
+ *  its own file.
+ */
+static LogFileCtx *LogFileGetThreadCtx(LogFileCtx *parent)
+{
+    if (unlikely(parent->rotation_flag)) {
+        SCMutexLock(&parent->fp_mutex);
+        if (parent->rotation_flag) {
+            parent->rotation_flag = 0;
+            (void)SC_ATOMIC_ADD(parent->rotations, 1);
+        }
+        SCMutexUnlock(&parent->fp_mutex);
+    }
+
+    LogFileCtx *child = NULL;
+    for (uint32_t i = 0; i < logfile_thread_cache_cnt; i++) {
+        if (logfile_thread_cache[i].parent == parent &&
+                logfile_thread_cache[i].id == parent->id) {
+            child = logfile_thread_cache[i].child;
+            break;
+        }
+    }
+
+    if (unlikely(child == NULL)) {
+        SCMutexLock(&parent->fp_mutex);
+        child = LogFileNewThreadCtx(parent);
+        SCMutexUnlock(&parent->fp_mutex);
+        if (child == NULL)
+            return NULL;
+
+        /* if the cache is full the oldest entry makes room */
+        uint32_t slot = logfile_thread_cache_cnt;
+        if (slot == LOGFILE_THREAD_CACHE_SIZE) {
+            memmove(&logfile_thread_cache[0], &logfile_thread_cache[1],
+                    (LOGFILE_THREAD_CACHE_SIZE - 1) * sizeof(LogFileThreadCacheEntry));
+            slot--;
+        } else {
+            logfile_thread_cache_cnt++;
+        }
+        logfile_thread_cache[slot].parent = parent;
+        logfile_thread_cache[slot].id = parent->id;
+        logfile_thread_cache[slot].child = child;
+    }
+
+    const uint32_t rotations = SC_ATOMIC_GET(parent->rotations);
+    if (unlikely(child->rotations_seen != rotations)) {
+        child->rotations_seen = rotations;
+        child->rotation_flag = 1;
+    }
+    return child;
+}
+#endif /* TLS */
+
 /** \brief open a generic output "log file", which may be a regular file or a socket
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -414,6 +895,22 @@ SCConfLogOpenGeneric(ConfNode *conf,
     }
 #endif /* HAVE_LIBJANSSON */
 
+    if (log_ctx->threaded) {
+        if (LogFileSetupThreaded(log_ctx, filetype, append, rotate) < 0) {
+            log_ctx->threaded = false;
+        } else {
+            log_ctx->filename = SCStrdup(log_path);
+            if (unlikely(log_ctx->filename == NULL)) {
+                SCLogError(SC_ERR_MEM_ALLOC,
+                    "Failed to allocate memory for filename");
+                return -1;
+            }
+            SCLogInfo("%s output device (%s) initialized: %s, a file or "
+                      "connection per thread", conf->name, filetype, filename);
+            return 0;
+        }
+    }
+
     // Now, what have we been asked to open?
     if (strcasecmp(filetype, "unix_stream") == 0) {
 #ifdef BUILD_WITH_UNIXSOCKET
@@ -450,6 +947,15 @@ SCConfLogOpenGeneric(ConfNode *conf,
             return -1;
         }
         log_ctx->type = LOGFILE_TYPE_REDIS;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+    } else if (strcasecmp(filetype, "kafka") == 0) {
+        ConfNode *kafka_node = ConfNodeLookupChild(conf, "kafka");
+        if (SCConfLogOpenKafka(kafka_node, log_ctx) < 0) {
+            SCLogError(SC_ERR_KAFKA, "failed to open kafka output");
+            return -1;
+        }
+        log_ctx->type = LOGFILE_TYPE_KAFKA;
 #endif
     } else {
         SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry for "
@@ -513,6 +1019,9 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
     return 0;
 }
 
+/** give each LogFileCtx a unique id for LogFileGetThreadCtx() */
+static uint32_t g_logfile_id = 0;
+
 /** \brief LogFileNewCtx() Get a new LogFileCtx
  *  \retval LogFileCtx * pointer if succesful, NULL if error
  *  */
@@ -526,6 +1035,8 @@ LogFileCtx *LogFileNewCtx(void)
     memset(lf_ctx, 0, sizeof(LogFileCtx));
 
     SCMutexInit(&lf_ctx->fp_mutex,NULL);
+    SC_ATOMIC_INIT(lf_ctx->rotations);
+    lf_ctx->id = __atomic_add_fetch(&g_logfile_id, 1, __ATOMIC_RELAXED);
 
     // Default Write and Close functions
     lf_ctx->Write = SCLogFileWrite;
@@ -544,13 +1055,26 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    /* write out what is still queued before closing */
+    if (lf_ctx->async != NULL) {
+        LogFileAsyncStop(lf_ctx);
+    }
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
         SCMutexUnlock(&lf_ctx->fp_mutex);
     }
 
+    LogFileCtx *child = lf_ctx->threads;
+    while (child != NULL) {
+        LogFileCtx *next = child->next;
+        LogFileFreeCtx(child);
+        child = next;
+    }
+
     SCMutexDestroy(&lf_ctx->fp_mutex);
+    SC_ATOMIC_DESTROY(lf_ctx->rotations);
 
     if (lf_ctx->prefix != NULL) {
         SCFree(lf_ctx->prefix);
@@ -572,6 +1096,8 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
 
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
 {
+    SCTrace2(log_write, file_ctx->filename, MEMBUFFER_OFFSET(buffer));
+
     if (file_ctx->type == LOGFILE_TYPE_SYSLOG) {
         syslog(file_ctx->syslog_setup.alert_syslog_level, "%s",
                 (const char *)MEMBUFFER_BUFFER(buffer));
@@ -579,19 +1105,51 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
                file_ctx->type == LOGFILE_TYPE_UNIX_DGRAM ||
                file_ctx->type == LOGFILE_TYPE_UNIX_STREAM)
     {
-        /* append \n for files only */
-        MemBufferWriteString(buffer, "\n");
+#ifdef TLS
+        if (file_ctx->threaded) {
+            file_ctx = LogFileGetThreadCtx(file_ctx);
+            if (unlikely(file_ctx == NULL))
+                return -1;
+        }
+#endif
+        /* append \n for files only, CBOR items are self delimiting */
+        if (!file_ctx->cbor) {
+            MemBufferWriteString(buffer, "\n");
+        }
+        if (file_ctx->async != NULL) {
+            return LogFileAsyncEnqueue(file_ctx,
+                    (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer));
+        }
         file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
                         MEMBUFFER_OFFSET(buffer), file_ctx);
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
+#ifdef TLS
+        if (file_ctx->threaded) {
+            file_ctx = LogFileGetThreadCtx(file_ctx);
+            if (unlikely(file_ctx == NULL))
+                return -1;
+            /* the thread's own connection, no need to lock */
+            LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer));
+            return 0;
+        }
+#endif
         SCMutexLock(&file_ctx->fp_mutex);
         LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
                 MEMBUFFER_OFFSET(buffer));
         SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #endif
+#ifdef HAVE_LIBRDKAFKA
+    else if (file_ctx->type == LOGFILE_TYPE_KAFKA) {
+        /* librdkafka producers are thread safe, no need for fp_mutex */
+        LogFileWriteKafka(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                MEMBUFFER_OFFSET(buffer));
+    }
+#endif
 
     return 0;
 }
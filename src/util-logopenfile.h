@@ -31,6 +31,9 @@
 #ifdef HAVE_LIBHIREDIS
 #include "util-log-redis.h"
 #endif /* HAVE_LIBHIREDIS */
+#ifdef HAVE_LIBRDKAFKA
+#include "util-log-kafka.h"
+#endif /* HAVE_LIBRDKAFKA */
 
 
 typedef struct {
@@ -41,7 +44,8 @@ enum LogFileType { LOGFILE_TYPE_FILE,
                    LOGFILE_TYPE_SYSLOG,
                    LOGFILE_TYPE_UNIX_DGRAM,
                    LOGFILE_TYPE_UNIX_STREAM,
-                   LOGFILE_TYPE_REDIS };
+                   LOGFILE_TYPE_REDIS,
+                   LOGFILE_TYPE_KAFKA };
 
 typedef struct SyslogSetup_ {
     int alert_syslog_level;
@@ -55,6 +59,9 @@ typedef struct LogFileCtx_ {
         PcieFile *pcie_fp;
 #ifdef HAVE_LIBHIREDIS
         void *redis;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        void *kafka;
 #endif
     };
 
@@ -62,6 +69,9 @@ typedef struct LogFileCtx_ {
         SyslogSetup syslog_setup;
 #ifdef HAVE_LIBHIREDIS
         RedisSetup redis_setup;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        KafkaSetup kafka_setup;
 #endif
     };
 
@@ -131,6 +141,30 @@ typedef struct LogFileCtx_ {
     /* Socket types may need to drop events to keep from blocking
      * Suricata. */
     uint64_t dropped;
+
+    /** threaded mode: each writing thread gets its own file or socket
+     *  connection, see LogFileWrite() */
+    bool threaded;
+    /** threaded mode: append to existing per thread files */
+    bool append;
+    /** threaded mode parent: unique id, per thread ctxs and their count.
+     *  threads is protected by fp_mutex */
+    uint32_t id;
+    struct LogFileCtx_ *threads;
+    uint32_t threads_cnt;
+    /** threaded mode parent: rotations done so far */
+    SC_ATOMIC_DECLARE(uint32_t, rotations);
+    /** threaded mode child: the parent, rotations seen and the next
+     *  child in the parent's list */
+    struct LogFileCtx_ *parent;
+    uint32_t rotations_seen;
+    struct LogFileCtx_ *next;
+
+    /** async mode: queue and writer thread, see LogFileAsyncStart() */
+    struct LogFileAsync_ *async;
+
+    /** records are CBOR data items instead of lines of JSON text */
+    bool cbor;
 } LogFileCtx;
 
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
@@ -144,6 +178,7 @@ typedef struct LogFileCtx_ {
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int LogFileAsyncStart(LogFileCtx *log_ctx, uint64_t memcap);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogReopen(LogFileCtx *);
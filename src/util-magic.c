@@ -25,12 +25,22 @@
  * Libmagic's API is not thread safe. The data the pointer returned by
  * magic_buffer is overwritten by the next magic_buffer call. This is
  * why we need to lock calls and copy the returned string.
+ *
+ * Libmagic is slow, and the same file is often seen many times. Results
+ * are cached by the length, the hash and the first bytes of the buffer
+ * they were looked up for, so the same buffer gets the same result without
+ * calling into libmagic. The cache is shared by the global and the per
+ * thread lookups and has a fixed size, split in sets of MAGIC_CACHE_WAYS
+ * entries, each with its own lock. A new entry replaces the least recently
+ * used one of its set.
  */
 
 #include "suricata-common.h"
 
 #include "conf.h"
 
+#include "util-hash-lookup3.h"
+#include "util-random.h"
 #include "util-unittest.h"
 #include "util-magic.h"
 
@@ -38,6 +48,172 @@
 static magic_t g_magic_ctx = NULL;
 static SCMutex g_magic_lock;
 
+/** bytes of the buffer stored in the entry, compared on top of the hash */
+#define MAGIC_CACHE_HEAD_LEN    32
+
+typedef struct MagicCacheEntry_ {
+    uint32_t len;
+    uint32_t used;      /**< set tick of last use */
+    uint64_t hash;
+    uint8_t head[MAGIC_CACHE_HEAD_LEN];
+    char *magic;        /**< NULL if unused */
+} MagicCacheEntry;
+
+typedef struct MagicCacheSet_ {
+    SCSpinlock lock;
+    uint32_t tick;
+    MagicCacheEntry e[MAGIC_CACHE_WAYS];
+} MagicCacheSet;
+
+typedef struct MagicCache_ {
+    MagicCacheSet *sets;
+    uint32_t nsets;
+    uint32_t seed;
+} MagicCache;
+
+static MagicCache magic_cache = { NULL, 0, 0 };
+
+SC_ATOMIC_DECLARE(uint64_t, magic_cache_hits);
+SC_ATOMIC_DECLARE(uint64_t, magic_cache_misses);
+
+static void MagicCacheSetup(void)
+{
+    SC_ATOMIC_INIT(magic_cache_hits);
+    SC_ATOMIC_INIT(magic_cache_misses);
+
+    intmax_t size = MAGIC_CACHE_SIZE_DEFAULT;
+    if (ConfGetInt("magic-cache-size", &size) == 1) {
+        if (size < 0 || size > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid value for "
+                    "magic-cache-size: %"PRIdMAX", using default %u",
+                    size, MAGIC_CACHE_SIZE_DEFAULT);
+            size = MAGIC_CACHE_SIZE_DEFAULT;
+        }
+    }
+    if (size == 0)
+        return;
+
+    uint32_t nsets = ((uint32_t)size + MAGIC_CACHE_WAYS - 1) / MAGIC_CACHE_WAYS;
+    MagicCacheSet *sets = SCCalloc(nsets, sizeof(MagicCacheSet));
+    if (sets == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc magic cache, "
+                "running without it");
+        return;
+    }
+    for (uint32_t i = 0; i < nsets; i++) {
+        SCSpinInit(&sets[i].lock, 0);
+    }
+    magic_cache.sets = sets;
+    magic_cache.nsets = nsets;
+    magic_cache.seed = (uint32_t)RandomGet();
+    SCLogConfig("magic cache: %u entries", nsets * MAGIC_CACHE_WAYS);
+}
+
+static void MagicCacheDeSetup(void)
+{
+    if (magic_cache.sets == NULL)
+        return;
+
+    SCLogPerf("magic cache: %"PRIu64" hits, %"PRIu64" misses",
+            SC_ATOMIC_GET(magic_cache_hits), SC_ATOMIC_GET(magic_cache_misses));
+    for (uint32_t i = 0; i < magic_cache.nsets; i++) {
+        for (int w = 0; w < MAGIC_CACHE_WAYS; w++) {
+            if (magic_cache.sets[i].e[w].magic != NULL)
+                SCFree(magic_cache.sets[i].e[w].magic);
+        }
+        SCSpinDestroy(&magic_cache.sets[i].lock);
+    }
+    SCFree(magic_cache.sets);
+    magic_cache.sets = NULL;
+    magic_cache.nsets = 0;
+}
+
+/** \internal
+ *  rief fill the key of a buffer */
+static void MagicCacheKey(const uint8_t *buf, uint32_t buflen,
+        MagicCacheEntry *k)
+{
+    uint32_t h1 = magic_cache.seed, h2 = 0;
+    hashlittle2(buf, buflen, &h1, &h2);
+
+    k->len = buflen;
+    k->hash = ((uint64_t)h2 << 32) | h1;
+    memset(k->head, 0, sizeof(k->head));
+    memcpy(k->head, buf, MIN(buflen, sizeof(k->head)));
+}
+
+static inline bool MagicCacheKeyEqual(const MagicCacheEntry *a,
+        const MagicCacheEntry *b)
+{
+    return a->len == b->len && a->hash == b->hash &&
+        memcmp(a->head, b->head, sizeof(a->head)) == 0;
+}
+
+/** \internal
+ *  rief look up the result for a buffer
+ *  
+etval magic copy of the cached result, NULL if not cached */
+static char *MagicCacheLookup(const MagicCacheEntry *k)
+{
+    MagicCacheSet *set = &magic_cache.sets[k->hash % magic_cache.nsets];
+    char *magic = NULL;
+
+    SCSpinLock(&set->lock);
+    for (int i = 0; i < MAGIC_CACHE_WAYS; i++) {
+        MagicCacheEntry *e = &set->e[i];
+        if (e->magic != NULL && MagicCacheKeyEqual(e, k)) {
+            e->used = ++set->tick;
+            magic = SCStrdup(e->magic);
+            break;
+        }
+    }
+    SCSpinUnlock(&set->lock);
+
+    if (magic != NULL)
+        (void)SC_ATOMIC_ADD(magic_cache_hits, 1);
+    else
+        (void)SC_ATOMIC_ADD(magic_cache_misses, 1);
+    return magic;
+}
+
+/** \internal
+ *  rief store the result for a buffer, replacing the LRU entry */
+static void MagicCacheStore(const MagicCacheEntry *k, const char *magic)
+{
+    char *copy = SCStrdup(magic);
+    if (unlikely(copy == NULL))
+        return;
+
+    MagicCacheSet *set = &magic_cache.sets[k->hash % magic_cache.nsets];
+    char *old = NULL;
+
+    SCSpinLock(&set->lock);
+    MagicCacheEntry *e = &set->e[0];
+    for (int i = 0; i < MAGIC_CACHE_WAYS; i++) {
+        MagicCacheEntry *c = &set->e[i];
+        /* stored by another thread in the meantime */
+        if (c->magic != NULL && MagicCacheKeyEqual(c, k)) {
+            e = c;
+            break;
+        }
+        if (c->magic == NULL) {
+            e = c;
+        } else if (e->magic != NULL && c->used < e->used) {
+            e = c;
+        }
+    }
+    old = e->magic;
+    e->len = k->len;
+    e->hash = k->hash;
+    memcpy(e->head, k->head, sizeof(e->head));
+    e->magic = copy;
+    e->used = ++set->tick;
+    SCSpinUnlock(&set->lock);
+
+    if (old != NULL)
+        SCFree(old);
+}
+
 /**
  *  \brief Initialize the "magic" context.
  */
@@ -53,6 +229,8 @@ int MagicInit(void)
     SCMutexInit(&g_magic_lock, NULL);
     SCMutexLock(&g_magic_lock);
 
+    MagicCacheSetup();
+
     g_magic_ctx = magic_open(0);
     if (g_magic_ctx == NULL) {
         SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s",
@@ -96,6 +274,7 @@ error:
         magic_close(g_magic_ctx);
         g_magic_ctx = NULL;
     }
+    MagicCacheDeSetup();
 
     SCMutexUnlock(&g_magic_lock);
     SCReturnInt(-1);
@@ -113,20 +292,35 @@ char *MagicGlobalLookup(const uint8_t *buf, uint32_t buflen)
 {
     const char *result = NULL;
     char *magic = NULL;
+    MagicCacheEntry key;
+
+    if (buf == NULL || buflen == 0) {
+        SCReturnPtr(NULL, "const char");
+    }
+
+    if (magic_cache.sets != NULL) {
+        MagicCacheKey(buf, buflen, &key);
+        magic = MagicCacheLookup(&key);
+        if (magic != NULL) {
+            SCReturnPtr(magic, "const char");
+        }
+    }
 
     SCMutexLock(&g_magic_lock);
 
-    if (buf != NULL && buflen > 0) {
-        result = magic_buffer(g_magic_ctx, (void *)buf, (size_t)buflen);
-        if (result != NULL) {
-            magic = SCStrdup(result);
-            if (unlikely(magic == NULL)) {
-                SCLogError(SC_ERR_MEM_ALLOC, "Unable to dup magic");
-            }
+    result = magic_buffer(g_magic_ctx, (void *)buf, (size_t)buflen);
+    if (result != NULL) {
+        magic = SCStrdup(result);
+        if (unlikely(magic == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Unable to dup magic");
         }
     }
 
     SCMutexUnlock(&g_magic_lock);
+
+    if (magic != NULL && magic_cache.sets != NULL) {
+        MagicCacheStore(&key, magic);
+    }
     SCReturnPtr(magic, "const char");
 }
 
@@ -142,17 +336,31 @@ char *MagicThreadLookup(magic_t *ctx, const uint8_t *buf, uint32_t buflen)
 {
     const char *result = NULL;
     char *magic = NULL;
+    MagicCacheEntry key;
 
-    if (buf != NULL && buflen > 0) {
-        result = magic_buffer(*ctx, (void *)buf, (size_t)buflen);
-        if (result != NULL) {
-            magic = SCStrdup(result);
-            if (unlikely(magic == NULL)) {
-                SCLogError(SC_ERR_MEM_ALLOC, "Unable to dup magic");
-            }
+    if (buf == NULL || buflen == 0) {
+        SCReturnPtr(NULL, "const char");
+    }
+
+    if (magic_cache.sets != NULL) {
+        MagicCacheKey(buf, buflen, &key);
+        magic = MagicCacheLookup(&key);
+        if (magic != NULL) {
+            SCReturnPtr(magic, "const char");
+        }
+    }
+
+    result = magic_buffer(*ctx, (void *)buf, (size_t)buflen);
+    if (result != NULL) {
+        magic = SCStrdup(result);
+        if (unlikely(magic == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Unable to dup magic");
         }
     }
 
+    if (magic != NULL && magic_cache.sets != NULL) {
+        MagicCacheStore(&key, magic);
+    }
     SCReturnPtr(magic, "const char");
 }
 
@@ -163,6 +371,7 @@ void MagicDeinit(void)
         magic_close(g_magic_ctx);
         g_magic_ctx = NULL;
     }
+    MagicCacheDeSetup();
     SCMutexUnlock(&g_magic_lock);
     SCMutexDestroy(&g_magic_lock);
 }
@@ -655,6 +864,39 @@ end:
     return retval;
 }
 
+/** \test results are cached by buffer, a buffer with the same start but
+ *        a different length is not a hit */
+static int MagicCacheTest01(void)
+{
+    uint8_t buffer[128];
+    memset(buffer, 'A', sizeof(buffer));
+    memcpy(buffer, "GIF89a", 6);
+
+    FAIL_IF(MagicInit() < 0);
+    FAIL_IF_NULL(magic_cache.sets);
+    const uint64_t hits = SC_ATOMIC_GET(magic_cache_hits);
+
+    char *result1 = MagicGlobalLookup(buffer, sizeof(buffer));
+    FAIL_IF_NULL(result1);
+    FAIL_IF(SC_ATOMIC_GET(magic_cache_hits) != hits);
+
+    char *result2 = MagicGlobalLookup(buffer, sizeof(buffer));
+    FAIL_IF_NULL(result2);
+    FAIL_IF(SC_ATOMIC_GET(magic_cache_hits) != hits + 1);
+    FAIL_IF(result1 == result2);
+    FAIL_IF(strcmp(result1, result2) != 0);
+
+    char *result3 = MagicGlobalLookup(buffer, sizeof(buffer) - 1);
+    FAIL_IF_NULL(result3);
+    FAIL_IF(SC_ATOMIC_GET(magic_cache_hits) != hits + 1);
+
+    SCFree(result1);
+    SCFree(result2);
+    SCFree(result3);
+    MagicDeinit();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 #endif
 
@@ -672,6 +914,7 @@ void MagicRegisterTests(void)
     //UtRegisterTest("MagicDetectTest06", MagicDetectTest06, 1);
     UtRegisterTest("MagicDetectTest07", MagicDetectTest07);
     UtRegisterTest("MagicDetectTest08", MagicDetectTest08);
+    UtRegisterTest("MagicCacheTest01", MagicCacheTest01);
     /* fails in valgrind, somehow it returns different pointers then.
     UtRegisterTest("MagicDetectTest09", MagicDetectTest09, 1); */
 
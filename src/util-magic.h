@@ -25,6 +25,11 @@
 #define __UTIL_MAGIC_H__
 
 #ifdef HAVE_MAGIC
+/** entries per set of the result cache, a set is searched linearly and
+ *  evicts its LRU entry */
+#define MAGIC_CACHE_WAYS            4
+#define MAGIC_CACHE_SIZE_DEFAULT    4096
+
 int MagicInit(void);
 void MagicDeinit(void);
 char *MagicGlobalLookup(const uint8_t *, uint32_t);
@@ -49,6 +49,14 @@
 
 SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 
+#ifdef UNITTESTS
+/** number of allocations by this thread, for the benchmarks */
+extern __thread uint64_t sc_mem_alloc_cnt;
+#define SC_MEM_ALLOC_COUNT() sc_mem_alloc_cnt++
+#else
+#define SC_MEM_ALLOC_COUNT()
+#endif
+
 /* Use this only if you want to debug memory allocation and free()
  * It will log a lot of lines more, so think that is a performance killer */
 
@@ -166,6 +174,7 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 #define SCMalloc(a) ({ \
     void *ptrmem = NULL; \
     \
+    SC_MEM_ALLOC_COUNT(); \
     ptrmem = malloc((a)); \
     if (ptrmem == NULL) { \
         if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
@@ -182,6 +191,7 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 #define SCRealloc(x, a) ({ \
     void *ptrmem = NULL; \
     \
+    SC_MEM_ALLOC_COUNT(); \
     ptrmem = realloc((x), (a)); \
     if (ptrmem == NULL) { \
         if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
@@ -197,6 +207,7 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 #define SCCalloc(nm, a) ({ \
     void *ptrmem = NULL; \
     \
+    SC_MEM_ALLOC_COUNT(); \
     ptrmem = calloc((nm), (a)); \
     if (ptrmem == NULL) { \
         if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
@@ -212,6 +223,7 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
 #define SCStrdup(a) ({ \
     char *ptrmem = NULL; \
     \
+    SC_MEM_ALLOC_COUNT(); \
     ptrmem = strdup((a)); \
     if (ptrmem == NULL) { \
         if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
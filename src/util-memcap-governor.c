@@ -0,0 +1,557 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap governor. A management thread checks the memory use of each
+ * subsystem every 'interval' seconds. A subsystem using more than the
+ * high watermark of its memcap, or the flow engine in emergency mode,
+ * gets its memcap raised by 'step' percent. The memory comes from the
+ * unused part of the budget first, then from subsystems using less than
+ * the low watermark of theirs. These are never shrunk below 'floor'
+ * percent of their startup memcap.
+ *
+ * Memcaps set to 0 (unlimited) are left alone. A memcap changed through
+ * the unix socket is taken over as is.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "runmodes.h"
+
+#include "flow.h"
+#include "flow-private.h"
+#include "stream-tcp.h"
+#include "stream-tcp-reassemble.h"
+#include "defrag-hash.h"
+#include "host.h"
+#include "ippair.h"
+#include "app-layer-htp-mem.h"
+
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-privs.h"
+#include "util-unittest.h"
+#include "util-memcap-governor.h"
+
+SC_ATOMIC_EXTERN(unsigned int, flow_flags);
+
+typedef struct MemcapGovernorSubsystem_ {
+    const char *name;
+    const char *counter;        /**< stats counter for the memcap */
+    int (*SetFunc)(uint64_t);
+    uint64_t (*GetFunc)(void);
+    uint64_t (*GetMemuseFunc)(void);
+    /** optional: subsystem is out of memory, whatever its memuse */
+    int (*InEmergency)(void);
+
+    bool managed;               /**< memcap was not unlimited at start */
+    bool denied;                /**< last raise failed for lack of budget */
+    uint64_t min;               /**< never shrunk below this */
+    uint64_t memcap;            /**< memcap as last set or seen */
+} MemcapGovernorSubsystem;
+
+typedef struct MemcapGovernorConfig_ {
+    bool enabled;
+    uint64_t budget;
+    uint32_t interval;          /**< seconds between two checks */
+    uint32_t high;              /**< % of memcap in use to ask for more */
+    uint32_t low;               /**< % of memcap in use to give some away */
+    uint32_t step;              /**< % of memcap added per raise */
+    uint32_t floor;             /**< % of startup memcap always kept */
+} MemcapGovernorConfig;
+
+static int MemcapGovernorFlowEmergency(void)
+{
+    return (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) != 0;
+}
+
+#define MEMCAP_GOVERNOR_SUBSYSTEMS 7
+static MemcapGovernorSubsystem subsystems[MEMCAP_GOVERNOR_SUBSYSTEMS] = {
+    { "flow", "memcap_governor.flow", FlowSetMemcap, FlowGetMemcap,
+        FlowGetMemuse, MemcapGovernorFlowEmergency, false, false, 0, 0 },
+    { "stream", "memcap_governor.stream", StreamTcpSetMemcap,
+        StreamTcpGetMemcap, StreamTcpMemuseCounter, NULL, false, false, 0, 0 },
+    { "stream-reassembly", "memcap_governor.stream_reassembly",
+        StreamTcpReassembleSetMemcap, StreamTcpReassembleGetMemcap,
+        StreamTcpReassembleMemuseGlobalCounter, NULL, false, false, 0, 0 },
+    { "defrag", "memcap_governor.defrag", DefragTrackerSetMemcap,
+        DefragTrackerGetMemcap, DefragTrackerGetMemuse, NULL, false, false, 0, 0 },
+    { "host", "memcap_governor.host", HostSetMemcap, HostGetMemcap,
+        HostGetMemuse, NULL, false, false, 0, 0 },
+    { "ippair", "memcap_governor.ippair", IPPairSetMemcap, IPPairGetMemcap,
+        IPPairGetMemuse, NULL, false, false, 0, 0 },
+    { "applayer-proto-http", "memcap_governor.http", HTPSetMemcap,
+        HTPGetMemcap, HTPMemuseGlobalCounter, NULL, false, false, 0, 0 },
+};
+
+static MemcapGovernorConfig governor_config = {
+    .enabled = false,
+    .budget = 0,
+    .interval = 5,
+    .high = 90,
+    .low = 50,
+    .step = 10,
+    .floor = 50,
+};
+
+SC_ATOMIC_DECLARE(uint64_t, governor_raised);
+SC_ATOMIC_DECLARE(uint64_t, governor_lowered);
+SC_ATOMIC_DECLARE(uint64_t, governor_denied);
+
+static uint64_t MemcapGovernorRaisedCounter(void)
+{
+    return SC_ATOMIC_GET(governor_raised);
+}
+
+static uint64_t MemcapGovernorLoweredCounter(void)
+{
+    return SC_ATOMIC_GET(governor_lowered);
+}
+
+static uint64_t MemcapGovernorDeniedCounter(void)
+{
+    return SC_ATOMIC_GET(governor_denied);
+}
+
+static uint64_t MemcapGovernorBudgetCounter(void)
+{
+    return governor_config.budget;
+}
+
+static uint32_t MemcapGovernorPercent(const char *name, intmax_t dflt)
+{
+    intmax_t val = dflt;
+    char key[64];
+
+    snprintf(key, sizeof(key), "memcap-governor.%s", name);
+    if (ConfGetInt(key, &val) == 1 && (val < 1 || val > 100)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "memcap-governor.%s must be a "
+                "percentage between 1 and 100", name);
+        exit(EXIT_FAILURE);
+    }
+    return (uint32_t)val;
+}
+
+static void MemcapGovernorParseConfig(MemcapGovernorConfig *cfg)
+{
+    int enabled = 0;
+    const char *str = NULL;
+    intmax_t interval = cfg->interval;
+
+    if (ConfGetBool("memcap-governor.enabled", &enabled) != 1 || !enabled)
+        return;
+    cfg->enabled = true;
+
+    if (ConfGet("memcap-governor.budget", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &cfg->budget) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                    "memcap-governor.budget from conf file - %s", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (ConfGetInt("memcap-governor.interval", &interval) == 1) {
+        if (interval < 1 || interval > 3600) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "memcap-governor.interval "
+                    "must be between 1 and 3600 seconds");
+            exit(EXIT_FAILURE);
+        }
+        cfg->interval = (uint32_t)interval;
+    }
+    cfg->high = MemcapGovernorPercent("high-watermark", cfg->high);
+    cfg->low = MemcapGovernorPercent("low-watermark", cfg->low);
+    cfg->step = MemcapGovernorPercent("step", cfg->step);
+    cfg->floor = MemcapGovernorPercent("floor", cfg->floor);
+    if (cfg->low >= cfg->high) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "memcap-governor.low-watermark "
+                "must be below the high-watermark");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool MemcapGovernorUnderPressure(const MemcapGovernorSubsystem *s,
+        uint64_t memuse, const MemcapGovernorConfig *cfg)
+{
+    if (s->InEmergency != NULL && s->InEmergency())
+        return true;
+    return memuse * 100 >= s->memcap * cfg->high;
+}
+
+/**
+ * \brief Take up to 'want' bytes from the subsystems with memory to spare
+ *
+ * \param skip subsystem not to take from, the one asking
+ *
+ * \retval bytes freed from the budget
+ */
+static uint64_t MemcapGovernorReclaim(MemcapGovernorSubsystem *subs,
+        int nsubs, const uint64_t *memuse, const bool *pressure,
+        const MemcapGovernorSubsystem *skip, uint64_t want,
+        const MemcapGovernorConfig *cfg, const char *reason)
+{
+    uint64_t got = 0;
+
+    for (int i = 0; i < nsubs && got < want; i++) {
+        MemcapGovernorSubsystem *d = &subs[i];
+        if (!d->managed || d == skip || pressure[i])
+            continue;
+        if (memuse[i] * 100 >= d->memcap * cfg->low)
+            continue;
+
+        /* keep the memuse below the high watermark */
+        uint64_t floor = MAX(d->min, memuse[i] * 100 / cfg->high + 1);
+        if (d->memcap <= floor)
+            continue;
+        uint64_t give = MIN(d->memcap - floor, want - got);
+        if (d->SetFunc(d->memcap - give) != 1)
+            continue;
+
+        SCLogInfo("memcap-governor: %s memcap lowered from %"PRIu64" to "
+                "%"PRIu64" (memuse %"PRIu64"): %s", d->name, d->memcap,
+                d->memcap - give, memuse[i], reason);
+        d->memcap -= give;
+        got += give;
+        SC_ATOMIC_ADD(governor_lowered, 1);
+    }
+    return got;
+}
+
+/**
+ * \brief One governor round: move memory to the subsystems under pressure
+ *
+ * \retval number of memcaps changed
+ */
+static uint32_t MemcapGovernorRebalance(MemcapGovernorSubsystem *subs,
+        int nsubs, const MemcapGovernorConfig *cfg)
+{
+    uint64_t memuse[nsubs];
+    bool pressure[nsubs];
+    uint64_t total = 0;
+    uint32_t changes = 0;
+
+    for (int i = 0; i < nsubs; i++) {
+        MemcapGovernorSubsystem *s = &subs[i];
+        memuse[i] = 0;
+        pressure[i] = false;
+        if (!s->managed)
+            continue;
+
+        uint64_t memcap = s->GetFunc();
+        if (memcap != s->memcap) {
+            SCLogInfo("memcap-governor: %s memcap changed from %"PRIu64
+                    " to %"PRIu64" outside of the governor", s->name,
+                    s->memcap, memcap);
+            s->memcap = memcap;
+            if (memcap == 0) {
+                s->managed = false;
+                continue;
+            }
+        }
+        memuse[i] = s->GetMemuseFunc();
+        pressure[i] = MemcapGovernorUnderPressure(s, memuse[i], cfg);
+        total += s->memcap;
+    }
+
+    /* the budget may have been exceeded at start or by hand */
+    if (total > cfg->budget) {
+        uint64_t got = MemcapGovernorReclaim(subs, nsubs, memuse, pressure,
+                NULL, total - cfg->budget, cfg, "over budget");
+        total -= got;
+        changes += (got != 0);
+    }
+
+    for (int i = 0; i < nsubs; i++) {
+        MemcapGovernorSubsystem *s = &subs[i];
+        if (!pressure[i]) {
+            s->denied = false;
+            continue;
+        }
+
+        uint64_t want = MAX(s->memcap * cfg->step / 100, 1);
+        uint64_t avail = cfg->budget > total ? cfg->budget - total : 0;
+        if (avail < want) {
+            char reason[64];
+            snprintf(reason, sizeof(reason), "needed by %s", s->name);
+            uint64_t got = MemcapGovernorReclaim(subs, nsubs, memuse,
+                    pressure, s, want - avail, cfg, reason);
+            avail += got;
+            total -= got;
+            changes += (got != 0);
+        }
+
+        uint64_t grant = MIN(want, avail);
+        if (grant == 0 || s->SetFunc(s->memcap + grant) != 1) {
+            /* log the start of a denial, not every round of it */
+            if (!s->denied) {
+                SCLogInfo("memcap-governor: %s memcap %"PRIu64" can't be "
+                        "raised (memuse %"PRIu64"): budget exhausted",
+                        s->name, s->memcap, memuse[i]);
+            }
+            s->denied = true;
+            SC_ATOMIC_ADD(governor_denied, 1);
+            continue;
+        }
+
+        SCLogInfo("memcap-governor: %s memcap raised from %"PRIu64" to "
+                "%"PRIu64" (memuse %"PRIu64"): %s", s->name, s->memcap,
+                s->memcap + grant, memuse[i],
+                (memuse[i] * 100 >= s->memcap * cfg->high) ?
+                "high watermark" : "emergency");
+        s->memcap += grant;
+        s->denied = false;
+        total += grant;
+        changes++;
+        SC_ATOMIC_ADD(governor_raised, 1);
+    }
+    return changes;
+}
+
+/**
+ * \brief Take the startup memcaps as reference
+ *
+ * \retval sum of the managed memcaps
+ */
+static uint64_t MemcapGovernorSetup(MemcapGovernorSubsystem *subs,
+        int nsubs, const MemcapGovernorConfig *cfg)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < nsubs; i++) {
+        MemcapGovernorSubsystem *s = &subs[i];
+        s->memcap = s->GetFunc();
+        s->managed = (s->memcap != 0);
+        s->denied = false;
+        s->min = s->memcap * cfg->floor / 100;
+        total += s->memcap;
+    }
+    return total;
+}
+
+static void *MemcapGovernorThread(void *arg)
+{
+    ThreadVars *tv_local = (ThreadVars *)arg;
+    struct timespec cond_time;
+
+    /* Set the thread name */
+    if (SCSetThreadName(tv_local->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    if (tv_local->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv_local);
+
+    /* Set the threads capability */
+    tv_local->cap_flags = 0;
+
+    SCDropCaps(tv_local);
+
+    TmThreadsSetFlag(tv_local, THV_INIT_DONE);
+    while (!TmThreadsCheckFlag(tv_local, THV_KILL)) {
+        if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
+            TmThreadsSetFlag(tv_local, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv_local);
+            TmThreadsUnsetFlag(tv_local, THV_PAUSED);
+        }
+
+        cond_time.tv_sec = time(NULL) + governor_config.interval;
+        cond_time.tv_nsec = 0;
+
+        /* wait for the set time, or until we are woken up by
+         * the shutdown procedure */
+        SCCtrlMutexLock(tv_local->ctrl_mutex);
+        SCCtrlCondTimedwait(tv_local->ctrl_cond, tv_local->ctrl_mutex, &cond_time);
+        SCCtrlMutexUnlock(tv_local->ctrl_mutex);
+
+        if (TmThreadsCheckFlag(tv_local, THV_KILL))
+            break;
+
+        MemcapGovernorRebalance(subsystems, MEMCAP_GOVERNOR_SUBSYSTEMS,
+                &governor_config);
+    }
+
+    TmThreadsSetFlag(tv_local, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv_local, THV_DEINIT);
+    TmThreadsSetFlag(tv_local, THV_CLOSED);
+    return NULL;
+}
+
+/**
+ * \brief Start the governor if enabled
+ *
+ * Called once all subsystems have their memcap configured.
+ */
+void MemcapGovernorThreadSpawn(void)
+{
+    MemcapGovernorParseConfig(&governor_config);
+    if (!governor_config.enabled)
+        return;
+
+    uint64_t total = MemcapGovernorSetup(subsystems,
+            MEMCAP_GOVERNOR_SUBSYSTEMS, &governor_config);
+    if (governor_config.budget == 0) {
+        governor_config.budget = total;
+    } else if (governor_config.budget < total) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "memcap-governor: memcaps add up "
+                "to %"PRIu64", over the budget of %"PRIu64". Unused memory "
+                "will be reclaimed.", total, governor_config.budget);
+    }
+    SCLogConfig("memcap-governor: budget %"PRIu64", checked every %"PRIu32
+            "s", governor_config.budget, governor_config.interval);
+
+    SC_ATOMIC_INIT(governor_raised);
+    SC_ATOMIC_INIT(governor_lowered);
+    SC_ATOMIC_INIT(governor_denied);
+    StatsRegisterGlobalCounter("memcap_governor.budget",
+            MemcapGovernorBudgetCounter);
+    StatsRegisterGlobalCounter("memcap_governor.raised",
+            MemcapGovernorRaisedCounter);
+    StatsRegisterGlobalCounter("memcap_governor.lowered",
+            MemcapGovernorLoweredCounter);
+    StatsRegisterGlobalCounter("memcap_governor.denied",
+            MemcapGovernorDeniedCounter);
+    for (int i = 0; i < MEMCAP_GOVERNOR_SUBSYSTEMS; i++) {
+        if (subsystems[i].managed)
+            StatsRegisterGlobalCounter(subsystems[i].counter,
+                    subsystems[i].GetFunc);
+    }
+
+    ThreadVars *tv = TmThreadCreateMgmtThread(thread_name_memcap_governor,
+            MemcapGovernorThread, 1);
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread "
+                   "failed");
+        exit(EXIT_FAILURE);
+    }
+    if (TmThreadSpawn(tv) != 0) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
+                   "MemcapGovernorThread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+#ifdef UNITTESTS
+static uint64_t test_memcap[3];
+static uint64_t test_memuse[3];
+
+#define TEST_FUNCS(n)                                               \
+static int TestSet##n(uint64_t v)                                   \
+{                                                                   \
+    if (v < test_memuse[n])                                         \
+        return 0;                                                   \
+    test_memcap[n] = v;                                             \
+    return 1;                                                       \
+}                                                                   \
+static uint64_t TestGet##n(void) { return test_memcap[n]; }         \
+static uint64_t TestMemuse##n(void) { return test_memuse[n]; }
+TEST_FUNCS(0)
+TEST_FUNCS(1)
+TEST_FUNCS(2)
+
+static void MemcapGovernorTestSetup(MemcapGovernorSubsystem *subs)
+{
+    MemcapGovernorSubsystem tmpl[3] = {
+        { "a", "a", TestSet0, TestGet0, TestMemuse0, NULL, false, false, 0, 0 },
+        { "b", "b", TestSet1, TestGet1, TestMemuse1, NULL, false, false, 0, 0 },
+        { "c", "c", TestSet2, TestGet2, TestMemuse2, NULL, false, false, 0, 0 },
+    };
+    memcpy(subs, tmpl, sizeof(tmpl));
+    SC_ATOMIC_INIT(governor_raised);
+    SC_ATOMIC_INIT(governor_lowered);
+    SC_ATOMIC_INIT(governor_denied);
+}
+
+/** \test raise from free budget, then from a donor down to its floor */
+static int MemcapGovernorTest01(void)
+{
+    MemcapGovernorSubsystem subs[3];
+    MemcapGovernorConfig cfg = { true, 0, 1, 90, 50, 10, 50 };
+    MemcapGovernorTestSetup(subs);
+
+    test_memcap[0] = 1000; test_memuse[0] = 950;
+    test_memcap[1] = 1000; test_memuse[1] = 100;
+    test_memcap[2] = 0; test_memuse[2] = 5000;
+    cfg.budget = MemcapGovernorSetup(subs, 3, &cfg) + 50;
+    FAIL_IF(cfg.budget != 2050);
+    FAIL_IF(subs[2].managed);
+
+    /* 'a' under pressure: 50 free, 50 from 'b' */
+    FAIL_IF(MemcapGovernorRebalance(subs, 3, &cfg) != 2);
+    FAIL_IF(test_memcap[0] != 1100);
+    FAIL_IF(test_memcap[1] != 950);
+    FAIL_IF(test_memcap[2] != 0);
+
+    /* 'b' can go down to its floor of 500 only */
+    for (int i = 0; i < 10; i++) {
+        test_memuse[0] = test_memcap[0] - 1;
+        MemcapGovernorRebalance(subs, 3, &cfg);
+    }
+    FAIL_IF(test_memcap[1] != 500);
+    FAIL_IF(test_memcap[0] != 1550);
+    FAIL_IF(test_memcap[0] + test_memcap[1] != cfg.budget);
+
+    /* nothing left */
+    test_memuse[0] = 1540;
+    uint64_t denied = SC_ATOMIC_GET(governor_denied);
+    FAIL_IF(MemcapGovernorRebalance(subs, 3, &cfg) != 0);
+    FAIL_IF(SC_ATOMIC_GET(governor_denied) != denied + 1);
+    FAIL_IF(!subs[0].denied);
+    PASS;
+}
+
+/** \test no donor while busy, over budget and changes by hand */
+static int MemcapGovernorTest02(void)
+{
+    MemcapGovernorSubsystem subs[3];
+    MemcapGovernorConfig cfg = { true, 0, 1, 90, 50, 10, 50 };
+    MemcapGovernorTestSetup(subs);
+
+    test_memcap[0] = 1000; test_memuse[0] = 950;
+    test_memcap[1] = 1000; test_memuse[1] = 600;
+    test_memcap[2] = 1000; test_memuse[2] = 100;
+    cfg.budget = MemcapGovernorSetup(subs, 3, &cfg) - 200;
+
+    /* 'c' is the only donor: 200 over budget, then 100 for 'a' */
+    FAIL_IF(MemcapGovernorRebalance(subs, 3, &cfg) != 3);
+    FAIL_IF(test_memcap[2] != 700);
+    FAIL_IF(test_memcap[0] != 1100);
+    FAIL_IF(test_memcap[1] != 1000);
+
+    /* set by hand: taken over, then trimmed back to the budget with
+     * 'b' kept below the high watermark */
+    test_memcap[1] = 2000;
+    test_memuse[0] = 0;
+    FAIL_IF(MemcapGovernorRebalance(subs, 3, &cfg) != 1);
+    FAIL_IF(test_memcap[0] != 500);
+    FAIL_IF(test_memcap[1] != 1600);
+    FAIL_IF(test_memcap[2] != 700);
+    FAIL_IF(test_memcap[0] + test_memcap[1] + test_memcap[2] != cfg.budget);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void MemcapGovernorRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemcapGovernorTest01", MemcapGovernorTest01);
+    UtRegisterTest("MemcapGovernorTest02", MemcapGovernorTest02);
+#endif
+}
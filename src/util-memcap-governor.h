@@ -0,0 +1,34 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap governor: keeps the sum of the memcaps of the flow, stream,
+ * reassembly, defrag, host, ippair and http subsystems within a global
+ * budget and moves memory to the subsystems that run out of it.
+ */
+
+#ifndef __UTIL_MEMCAP_GOVERNOR_H__
+#define __UTIL_MEMCAP_GOVERNOR_H__
+
+void MemcapGovernorInitConfig(void);
+void MemcapGovernorThreadSpawn(void);
+
+void MemcapGovernorRegisterTests(void);
+
+#endif /* __UTIL_MEMCAP_GOVERNOR_H__ */
@@ -0,0 +1,114 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sharded memory use counters for memcap enforcement.
+ */
+
+#include "suricata-common.h"
+#include "util-memcap.h"
+#include "util-unittest.h"
+
+/**
+ *  \brief init a sharded memuse counter
+ *
+ *  \param mc counter
+ *  \param slack max bytes a shard can hold before folding, 0 for default
+ */
+void MemcapCounterInit(MemcapCounter *mc, uint64_t slack)
+{
+    memset(mc, 0, sizeof(*mc));
+    SC_ATOMIC_INIT(mc->memuse);
+    for (int i = 0; i < MEMCAP_SHARDS; i++) {
+        SC_ATOMIC_INIT(mc->shards[i].delta);
+    }
+    mc->slack = slack ? (int64_t)slack : MEMCAP_DEFAULT_SLACK;
+}
+
+void MemcapCounterDestroy(MemcapCounter *mc)
+{
+    SC_ATOMIC_DESTROY(mc->memuse);
+    for (int i = 0; i < MEMCAP_SHARDS; i++) {
+        SC_ATOMIC_DESTROY(mc->shards[i].delta);
+    }
+}
+
+/**
+ *  \brief get the memory use, summing the shards
+ *
+ *  Cheap enough for the stats and unix socket readers: one read per
+ *  shard, no writes to the shared lines.
+ */
+uint64_t MemcapCounterGet(MemcapCounter *mc)
+{
+    int64_t memuse = SC_ATOMIC_GET(mc->memuse);
+    for (int i = 0; i < MEMCAP_SHARDS; i++) {
+        memuse += SC_ATOMIC_GET(mc->shards[i].delta);
+    }
+    return memuse > 0 ? (uint64_t)memuse : 0;
+}
+
+#ifdef UNITTESTS
+static int MemcapCounterTest01(void)
+{
+    MemcapCounter mc;
+    MemcapCounterInit(&mc, 1000);
+
+    MemcapCounterIncr(&mc, 500);
+    FAIL_IF_NOT(MemcapCounterGet(&mc) == 500);
+    /* below the slack: only the shard was updated */
+    FAIL_IF_NOT(SC_ATOMIC_GET(mc.memuse) == 0);
+
+    MemcapCounterIncr(&mc, 600);
+    FAIL_IF_NOT(MemcapCounterGet(&mc) == 1100);
+    /* slack exceeded: folded */
+    FAIL_IF_NOT(SC_ATOMIC_GET(mc.memuse) == 1100);
+
+    MemcapCounterDecr(&mc, 1100);
+    FAIL_IF_NOT(MemcapCounterGet(&mc) == 0);
+
+    MemcapCounterDestroy(&mc);
+    PASS;
+}
+
+/** \test cap is enforced exactly inside the slack window */
+static int MemcapCounterTest02(void)
+{
+    MemcapCounter mc;
+    MemcapCounterInit(&mc, 1000);
+
+    MemcapCounterIncr(&mc, 900);
+    FAIL_IF_NOT(MemcapCounterCheck(&mc, 100, 1000) == 1);
+    FAIL_IF_NOT(MemcapCounterCheck(&mc, 101, 1000) == 0);
+    FAIL_IF_NOT(MemcapCounterCheck(&mc, 100, UINT64_MAX / 2) == 1);
+    MemcapCounterDecr(&mc, 900);
+    FAIL_IF_NOT(MemcapCounterCheck(&mc, 1000, 1000) == 1);
+
+    MemcapCounterDestroy(&mc);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void MemcapCounterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemcapCounterTest01", MemcapCounterTest01);
+    UtRegisterTest("MemcapCounterTest02", MemcapCounterTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,112 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sharded memory use counters for memcap enforcement.
+ *
+ * Each counter has a shard per cache line that threads add their
+ * allocations to, picked by a hash of the thread id. Once a shard's
+ * delta exceeds the slack it is folded into the shared part of the
+ * counter, so the shared cache line is only written once per 'slack'
+ * bytes instead of on every allocation.
+ *
+ * MemcapCounterCheck() compares the shared part against the memcap and
+ * only sums the shards when the result is within the slack window of
+ * the cap, so the cap is enforced exactly.
+ */
+
+#ifndef __UTIL_MEMCAP_H__
+#define __UTIL_MEMCAP_H__
+
+#include "util-atomic.h"
+
+#define MEMCAP_SHARDS_BITS      6
+#define MEMCAP_SHARDS           (1 << MEMCAP_SHARDS_BITS)
+#define MEMCAP_DEFAULT_SLACK    (64 * 1024)
+
+typedef struct MemcapShard_ {
+    SC_ATOMIC_DECLARE(int64_t, delta);
+    uint8_t pad[CLS - sizeof(int64_t)];
+} MemcapShard;
+
+typedef struct MemcapCounter_ {
+    /** folded part of the memory use */
+    SC_ATOMIC_DECLARE(int64_t, memuse);
+    /** max delta a shard can hold before it's folded */
+    int64_t slack;
+    MemcapShard shards[MEMCAP_SHARDS];
+} MemcapCounter;
+
+void MemcapCounterInit(MemcapCounter *mc, uint64_t slack);
+void MemcapCounterDestroy(MemcapCounter *mc);
+uint64_t MemcapCounterGet(MemcapCounter *mc);
+void MemcapCounterRegisterTests(void);
+
+static inline MemcapShard *MemcapCounterShard(MemcapCounter *mc)
+{
+    uint64_t t = (uint64_t)(uintptr_t)pthread_self();
+    return &mc->shards[(t * 11400714819323198485ULL) >> (64 - MEMCAP_SHARDS_BITS)];
+}
+
+static inline void MemcapCounterFold(MemcapCounter *mc, MemcapShard *s, int64_t delta)
+{
+    if (delta > mc->slack || delta < -mc->slack) {
+        (void) SC_ATOMIC_SUB(s->delta, delta);
+        (void) SC_ATOMIC_ADD(mc->memuse, delta);
+    }
+}
+
+/**
+ *  \brief account an allocation of \a size bytes
+ */
+static inline void MemcapCounterIncr(MemcapCounter *mc, uint64_t size)
+{
+    MemcapShard *s = MemcapCounterShard(mc);
+    int64_t delta = SC_ATOMIC_ADD(s->delta, (int64_t)size);
+    MemcapCounterFold(mc, s, delta);
+}
+
+/**
+ *  \brief account a free of \a size bytes
+ */
+static inline void MemcapCounterDecr(MemcapCounter *mc, uint64_t size)
+{
+    MemcapShard *s = MemcapCounterShard(mc);
+    int64_t delta = SC_ATOMIC_SUB(s->delta, (int64_t)size);
+    MemcapCounterFold(mc, s, delta);
+}
+
+/**
+ *  \brief check if allocating \a size more bytes stays within \a memcap
+ *
+ *  \retval 1 if in bounds
+ *  \retval 0 if not in bounds
+ */
+static inline int MemcapCounterCheck(MemcapCounter *mc, uint64_t size, uint64_t memcap)
+{
+    int64_t memuse = SC_ATOMIC_GET(mc->memuse);
+    uint64_t window = (uint64_t)mc->slack * MEMCAP_SHARDS;
+    if (memuse < 0)
+        memuse = 0;
+    if ((uint64_t)memuse + size + window <= memcap)
+        return 1;
+    return (MemcapCounterGet(mc) + size <= memcap);
+}
+
+#endif /* __UTIL_MEMCAP_H__ */
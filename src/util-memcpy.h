@@ -27,6 +27,10 @@
 #ifndef __UTIL_MEMCPY_H__
 #define __UTIL_MEMCPY_H__
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /**
  * \internal
  * \brief Does a memcpy of the input string to lowercase.
@@ -34,11 +38,25 @@
  * \param d   Pointer to the target area for memcpy.
  * \param s   Pointer to the src string for memcpy.
  * \param len len of the string sent in s.
+ *
+ * \note d and s may be the same for an in place conversion
  */
-static inline void memcpy_tolower(uint8_t *d, const uint8_t *s, uint16_t len)
+static inline void memcpy_tolower(uint8_t *d, const uint8_t *s, uint32_t len)
 {
-    uint16_t i;
-    for (i = 0; i < len; i++)
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i a = _mm_set1_epi8('A' - 1);
+    const __m128i z = _mm_set1_epi8('Z' + 1);
+    const __m128i diff = _mm_set1_epi8('a' - 'A');
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, a), _mm_cmplt_epi8(v, z));
+        v = _mm_add_epi8(v, _mm_and_si128(upper, diff));
+        _mm_storeu_si128((__m128i *)(d + i), v);
+    }
+#endif
+    for ( ; i < len; i++)
         d[i] = u8_tolower(s[i]);
 
     return;
@@ -32,6 +32,10 @@
  *         - This version of the MPM is heavy on memory, but it performs well.
  *           If you can fit the ruleset with this mpm on your box without hitting
  *           swap, this is the MPM to go for.
+ *         - "ac-compact" builds the same automaton, but of each row it only
+ *           keeps the transitions that differ from those of the root. In
+ *           the root state it skips the bytes that can't start a pattern,
+ *           16 at a time with SSSE3 or NEON.
  *
  * \todo - Do a proper analyis of our existing MPMs and suggest a good one based
  *         on the pattern distribution and the expected traffic(say http).
@@ -59,6 +63,21 @@
 #include "util-memcmp.h"
 #include "util-mpm-ac.h"
 #include "util-memcpy.h"
+#include "util-cpu.h"
+
+#if defined(__SSSE3__)
+#define AC_CS_HAVE_SSSE3
+#include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define AC_CS_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/* the lookups count bits, which without the POPCNT instruction is a
+ * library call. Build the scan twice and select one at runtime. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__POPCNT__)
+#define AC_CS_POPCNT_TARGET
+#endif
 
 void SCACInitCtx(MpmCtx *);
 void SCACInitThreadCtx(MpmCtx *, MpmThreadCtx *);
@@ -71,6 +90,11 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+uint32_t SCACSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *st,
+        const uint8_t *buf, uint32_t buflen, uint64_t buf_offset);
+static uint32_t SCACCSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACRegisterTests(void);
@@ -84,6 +108,14 @@ void SCACRegisterTests(void);
 #define AC_PID_MASK     0x7FFFFFFF
 #define AC_CASE_BIT     31
 
+/* a state of the compact table, flagged if it has output */
+#define AC_CS_MATCH         0x80000000
+#define AC_CS_STATE_MASK    0x7FFFFFFF
+
+/* only skip to the next start byte if at most this many of the 256 byte
+ * values can start a pattern, otherwise the skip stops at most bytes */
+#define AC_CS_SKIP_MAX_START 64
+
 static int construct_both_16_and_32_state_tables = 0;
 
 /**
@@ -704,6 +736,138 @@ static inline void SCACInsertCaseSensitiveEntriesForPatterns(MpmCtx *mpm_ctx)
     return;
 }
 
+/**
+ * \internal
+ * \brief Next state in the compact table.
+ */
+static inline uint32_t SCACCSNext(const SCACCSTable *cs, uint32_t state, uint8_t c)
+{
+    const SCACCSRow *r = &cs->rows[state & AC_CS_STATE_MASK];
+    const uint64_t w = r->bits[c >> 6];
+    const uint64_t bit = 1ULL << (c & 63);
+    if (!(w & bit))
+        return cs->root[c];
+    return cs->trans[r->base + r->cnt[c >> 6] + __builtin_popcountll(w & (bit - 1))];
+}
+
+static inline uint32_t SCACCSStateValue(const SCACCtx *ctx, int32_t state)
+{
+    if (ctx->output_table[state].no_of_entries != 0)
+        return (uint32_t)state | AC_CS_MATCH;
+    return (uint32_t)state;
+}
+
+/**
+ * \internal
+ * \brief Create the compact state table, instead of the delta table.
+ *
+ * The rows are built in the same order as the delta table, so the row of
+ * the failure state is complete when it's needed. Most rows differ from
+ * the root row only in the transitions of the state and of the states on
+ * its failure path, so only those are stored.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+static void SCACCSCreateTable(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t row[256];
+    uint32_t trans_alloc = 1024;
+    int ascii_code = 0;
+
+    SCACCSTable *cs = SCMalloc(sizeof(SCACCSTable));
+    if (cs == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(cs, 0, sizeof(SCACCSTable));
+
+    cs->rows = SCMalloc(ctx->state_count * sizeof(SCACCSRow));
+    cs->trans = SCMalloc(trans_alloc * sizeof(uint32_t));
+    if (cs->rows == NULL || cs->trans == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(cs->rows, 0, ctx->state_count * sizeof(SCACCSRow));
+
+    StateQueue q;
+    memset(&q, 0, sizeof(StateQueue));
+
+    for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+        int32_t temp_state = ctx->goto_table[0][ascii_code];
+        cs->root[ascii_code] = SCACCSStateValue(ctx, temp_state);
+        if (temp_state != 0)
+            SCACEnqueue(&q, temp_state);
+    }
+
+    while (!SCACStateQueueIsEmpty(&q)) {
+        int32_t r_state = SCACDequeue(&q);
+        SCACCSRow *r = &cs->rows[r_state];
+
+        for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+            int32_t temp_state = ctx->goto_table[r_state][ascii_code];
+            if (temp_state != SC_AC_FAIL) {
+                SCACEnqueue(&q, temp_state);
+                row[ascii_code] = SCACCSStateValue(ctx, temp_state);
+            } else {
+                row[ascii_code] = SCACCSNext(cs, ctx->failure_table[r_state],
+                        (uint8_t)ascii_code);
+            }
+        }
+
+        if (cs->trans_size + 256 > trans_alloc) {
+            trans_alloc *= 2;
+            void *ptmp = SCRealloc(cs->trans, trans_alloc * sizeof(uint32_t));
+            if (ptmp == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+            cs->trans = ptmp;
+        }
+
+        r->base = cs->trans_size;
+        uint32_t n = 0;
+        for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+            if ((ascii_code & 63) == 0)
+                r->cnt[ascii_code >> 6] = (uint8_t)n;
+            if (row[ascii_code] == cs->root[ascii_code])
+                continue;
+            r->bits[ascii_code >> 6] |= 1ULL << (ascii_code & 63);
+            cs->trans[r->base + n++] = row[ascii_code];
+        }
+        cs->trans_size += n;
+    }
+
+    if (cs->trans_size > 0 && cs->trans_size < trans_alloc) {
+        void *ptmp = SCRealloc(cs->trans, cs->trans_size * sizeof(uint32_t));
+        if (ptmp != NULL)
+            cs->trans = ptmp;
+    }
+
+    /* the input is lowered before the lookup, so an upper case byte can
+     * start a pattern if its lower case one can */
+    uint32_t start_cnt = 0;
+    for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+        if (cs->root[u8_tolower(ascii_code)] == 0)
+            continue;
+        cs->start[ascii_code] = 1;
+        cs->start_lo[ascii_code & 0x0f] |= 1 << ((ascii_code >> 4) & 7);
+        start_cnt++;
+    }
+    for (ascii_code = 0; ascii_code < 16; ascii_code++)
+        cs->start_hi[ascii_code] = 1 << (ascii_code & 7);
+    cs->skip = (start_cnt <= AC_CS_SKIP_MAX_START);
+
+    SCLogDebug("states %u transitions %u start bytes %u", ctx->state_count,
+            cs->trans_size, start_cnt);
+
+    mpm_ctx->memory_cnt += 3;
+    mpm_ctx->memory_size += sizeof(SCACCSTable) +
+        ctx->state_count * sizeof(SCACCSRow) + cs->trans_size * sizeof(uint32_t);
+
+    ctx->cs = cs;
+}
+
 #if 0
 static void SCACPrintDeltaTable(MpmCtx *mpm_ctx)
 {
@@ -742,10 +906,15 @@ static void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     SCACCreateGotoTable(mpm_ctx);
     /* create the failure table */
     SCACCreateFailureTable(mpm_ctx);
-    /* create the final state(delta) table */
-    SCACCreateDeltaTable(mpm_ctx);
-    /* club the output state presence with delta transition entries */
-    SCACClubOutputStatePresenceWithDeltaTable(mpm_ctx);
+    if (mpm_ctx->mpm_type == MPM_AC_COMPACT) {
+        /* create the compact state table */
+        SCACCSCreateTable(mpm_ctx);
+    } else {
+        /* create the final state(delta) table */
+        SCACCreateDeltaTable(mpm_ctx);
+        /* club the output state presence with delta transition entries */
+        SCACClubOutputStatePresenceWithDeltaTable(mpm_ctx);
+    }
 
     /* club nocase entries */
     SCACInsertCaseSensitiveEntriesForPatterns(mpm_ctx);
@@ -985,6 +1154,17 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         mpm_ctx->memory_size -= (ctx->state_count *
                                  sizeof(SC_AC_STATE_TYPE_U32) * 256);
     }
+    if (ctx->cs != NULL) {
+        mpm_ctx->memory_cnt -= 3;
+        mpm_ctx->memory_size -= sizeof(SCACCSTable) +
+            ctx->state_count * sizeof(SCACCSRow) +
+            ctx->cs->trans_size * sizeof(uint32_t);
+
+        SCFree(ctx->cs->rows);
+        SCFree(ctx->cs->trans);
+        SCFree(ctx->cs);
+        ctx->cs = NULL;
+    }
 
     if (ctx->output_table != NULL) {
         uint32_t state_count;
@@ -1147,6 +1327,349 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return matches;
 }
 
+/**
+ * \internal
+ * \brief remember a match of a stream search
+ *
+ * Of patterns without offset and depth only the last match is needed. The
+ * others depend on where the window starts, so all their matches are kept.
+ */
+static inline void SCACStreamRecordMatch(MpmStreamState *st,
+        const SCACPatternList *pat, uint32_t pid, uint64_t offset)
+{
+    if (st->history_full)
+        return;
+
+    if (pat->offset == 0 && pat->depth == 0) {
+        uint16_t x;
+        for (x = 0; x < st->history_cnt; x++) {
+            if (st->history[x].pid == pid) {
+                st->history[x].offset = offset;
+                return;
+            }
+        }
+    }
+    if (st->history_cnt == MPM_STREAM_STATE_HISTORY) {
+        st->history_full = true;
+        return;
+    }
+    st->history[st->history_cnt].pid = pid;
+    st->history[st->history_cnt].offset = offset;
+    st->history_cnt++;
+}
+
+/**
+ * \internal
+ * \brief add the sids of a pattern matching in the window
+ *
+ * \param start offset of the first byte of the match in the window
+ *
+ * \retval 1 match, 0 no match due to the offset or depth of the pattern
+ */
+static inline int SCACStreamAddMatch(const SCACPatternList *pat, uint32_t pid,
+        uint32_t start, PrefilterRuleStore *pmq, uint8_t *bitarray)
+{
+    const uint32_t end = start + pat->patlen - 1;
+    if (start < pat->offset || (pat->depth && end > pat->depth))
+        return 0;
+
+    if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+        bitarray[pid / 8] |= (1 << (pid % 8));
+        PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    }
+    return 1;
+}
+
+/**
+ * \internal
+ * \brief handle a pattern ending at buf[i] in a stream search
+ */
+static inline int SCACStreamHandleMatch(const SCACCtx *ctx, MpmStreamState *st,
+        PrefilterRuleStore *pmq, uint8_t *bitarray, const uint8_t *buf,
+        uint32_t i, uint32_t pid_entry, uint64_t buf_offset)
+{
+    const uint32_t pid = pid_entry & AC_PID_MASK;
+    const SCACPatternList *pat = &ctx->pid_pat_list[pid];
+
+    /* a resumed search sees matches starting before the window */
+    if (i + 1 < pat->patlen)
+        return 0;
+    const uint32_t start = i + 1 - pat->patlen;
+
+    if ((pid_entry & AC_CASE_MASK) &&
+            SCMemcmp(pat->cs, buf + start, pat->patlen) != 0)
+        return 0;
+
+    SCACStreamRecordMatch(st, pat, pid, buf_offset + start);
+    return SCACStreamAddMatch(pat, pid, start, pmq, bitarray);
+}
+
+/**
+ * \internal
+ * \brief Find the next byte that can start a pattern.
+ *
+ * The nibble tables give a superset of the start bytes for 16 bytes at
+ * once, the candidates are checked against the exact set.
+ *
+ * \retval offset of the byte, buflen if there is none
+ */
+static inline uint32_t SCACCSSkip(const SCACCSTable *cs, const uint8_t *buf,
+        uint32_t buflen, uint32_t i)
+{
+#if defined(AC_CS_HAVE_SSSE3)
+    const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)cs->start_lo);
+    const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)cs->start_hi);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    for ( ; i + 16 <= buflen; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        const __m128i l = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(v, nibble));
+        const __m128i h = _mm_shuffle_epi8(hi_tbl,
+                _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        const __m128i none = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+        uint32_t cand = ~(uint32_t)_mm_movemask_epi8(none) & 0xffff;
+        while (cand) {
+            const uint32_t j = i + __builtin_ctz(cand);
+            if (cs->start[buf[j]])
+                return j;
+            cand &= cand - 1;
+        }
+    }
+#elif defined(AC_CS_HAVE_NEON)
+    const uint8x16_t lo_tbl = vld1q_u8(cs->start_lo);
+    const uint8x16_t hi_tbl = vld1q_u8(cs->start_hi);
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
+    for ( ; i + 16 <= buflen; i += 16) {
+        const uint8x16_t v = vld1q_u8(buf + i);
+        const uint8x16_t m = vandq_u8(vqtbl1q_u8(lo_tbl, vandq_u8(v, nibble)),
+                vqtbl1q_u8(hi_tbl, vshrq_n_u8(v, 4)));
+        if (vmaxvq_u8(m) == 0)
+            continue;
+        for (uint32_t j = i; j < i + 16; j++) {
+            if (cs->start[buf[j]])
+                return j;
+        }
+    }
+#endif
+    for ( ; i < buflen; i++) {
+        if (cs->start[buf[i]])
+            return i;
+    }
+    return buflen;
+}
+
+/**
+ * \internal
+ * \brief handle a pattern ending at buf[i], like SCACSearch does
+ */
+static inline int SCACCSHandleMatch(const SCACCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, const uint8_t *buf, uint32_t i, uint32_t pid_entry)
+{
+    const uint32_t pid = pid_entry & AC_PID_MASK;
+    const SCACPatternList *pat = &ctx->pid_pat_list[pid];
+    const int offset = i - pat->patlen + 1;
+
+    if (offset < (int)pat->offset || (pat->depth && i > pat->depth))
+        return 0;
+    if ((pid_entry & AC_CASE_MASK) &&
+            SCMemcmp(pat->cs, buf + offset, pat->patlen) != 0)
+        return 0;
+
+    if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+        bitarray[pid / 8] |= (1 << (pid % 8));
+        PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    }
+    return 1;
+}
+
+/**
+ * \internal
+ * \brief Scan buf from i on, starting in state, for a search or, with st
+ *        set, a stream search.
+ *
+ * Inlined into the builds with and without POPCNT.
+ */
+static inline __attribute__((always_inline)) uint32_t SCACCSScan(
+        const SCACCtx *ctx, PrefilterRuleStore *pmq, uint8_t *bitarray,
+        MpmStreamState *st, const uint8_t *buf, uint32_t buflen,
+        uint64_t buf_offset, uint32_t i, uint32_t *state)
+{
+    const SCACCSTable *cs = ctx->cs;
+    uint32_t s = *state;
+    uint32_t matches = 0;
+
+    for ( ; i < buflen; i++) {
+        if (s == 0 && cs->skip) {
+            i = SCACCSSkip(cs, buf, buflen, i);
+            if (i == buflen)
+                break;
+        }
+        s = SCACCSNext(cs, s, u8_tolower(buf[i]));
+        if (s & AC_CS_MATCH) {
+            const SCACOutputTable *out = &ctx->output_table[s & AC_CS_STATE_MASK];
+            for (uint32_t k = 0; k < out->no_of_entries; k++) {
+                if (st != NULL) {
+                    matches += SCACStreamHandleMatch(ctx, st, pmq, bitarray,
+                            buf, i, out->pids[k], buf_offset);
+                } else {
+                    matches += SCACCSHandleMatch(ctx, pmq, bitarray, buf, i,
+                            out->pids[k]);
+                }
+            }
+        }
+    }
+
+    *state = s;
+    return matches;
+}
+
+typedef uint32_t (*SCACCSScanFunc)(const SCACCtx *, PrefilterRuleStore *,
+        uint8_t *, MpmStreamState *, const uint8_t *, uint32_t, uint64_t,
+        uint32_t, uint32_t *);
+
+static uint32_t SCACCSScanGeneric(const SCACCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, MpmStreamState *st, const uint8_t *buf,
+        uint32_t buflen, uint64_t buf_offset, uint32_t i, uint32_t *state)
+{
+    return SCACCSScan(ctx, pmq, bitarray, st, buf, buflen, buf_offset, i, state);
+}
+
+#ifdef AC_CS_POPCNT_TARGET
+__attribute__((target("popcnt")))
+static uint32_t SCACCSScanPopcnt(const SCACCtx *ctx, PrefilterRuleStore *pmq,
+        uint8_t *bitarray, MpmStreamState *st, const uint8_t *buf,
+        uint32_t buflen, uint64_t buf_offset, uint32_t i, uint32_t *state)
+{
+    return SCACCSScan(ctx, pmq, bitarray, st, buf, buflen, buf_offset, i, state);
+}
+#endif
+
+static SCACCSScanFunc ac_cs_scan = SCACCSScanGeneric;
+
+/**
+ * \brief The search function of ac-compact.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+static uint32_t SCACCSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t state = 0;
+
+    if (ctx->cs == NULL)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    return ac_cs_scan(ctx, pmq, bitarray, NULL, buf, buflen, 0, 0, &state);
+}
+
+/**
+ * \brief The aho corasick search function for stream windows.
+ *
+ * If the window starts within the window of the previous search and covers
+ * its end, the search resumes from the state it ended with, and the
+ * matches in the data scanned before come from the history. Otherwise the
+ * whole window is searched.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param st             Stream scan state.
+ * \param buf            Window to be searched.
+ * \param buflen         Window length.
+ * \param buf_offset     Stream offset of the window.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *st,
+        const uint8_t *buf, uint32_t buflen, uint64_t buf_offset)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    uint32_t state = 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    if (st->mpm_ctx == mpm_ctx && !st->history_full &&
+            buf_offset >= st->window_start &&
+            st->scan_end >= buf_offset && st->scan_end <= buf_offset + buflen)
+    {
+        i = (uint32_t)(st->scan_end - buf_offset);
+        state = st->state;
+
+        /* matches that started before the window are dropped */
+        uint16_t keep = 0;
+        uint16_t x;
+        for (x = 0; x < st->history_cnt; x++) {
+            const MpmStreamMatch m = st->history[x];
+            if (m.offset < buf_offset)
+                continue;
+            st->history[keep++] = m;
+            matches += SCACStreamAddMatch(&ctx->pid_pat_list[m.pid], m.pid,
+                    (uint32_t)(m.offset - buf_offset), pmq, bitarray);
+        }
+        st->history_cnt = keep;
+    } else {
+        MpmStreamStateReset(st);
+        st->mpm_ctx = mpm_ctx;
+    }
+
+    if (ctx->cs != NULL) {
+        matches += ac_cs_scan(ctx, pmq, bitarray, st, buf, buflen, buf_offset,
+                i, &state);
+    } else if (ctx->state_count < 32767) {
+        SC_AC_STATE_TYPE_U16 s = (SC_AC_STATE_TYPE_U16)state;
+        SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
+        for ( ; i < buflen; i++) {
+            s = state_table_u16[s & 0x7FFF][u8_tolower(buf[i])];
+            if (s & 0x8000) {
+                const uint32_t no_of_entries = ctx->output_table[s & 0x7FFF].no_of_entries;
+                const uint32_t *pids = ctx->output_table[s & 0x7FFF].pids;
+                uint32_t k;
+                for (k = 0; k < no_of_entries; k++) {
+                    matches += SCACStreamHandleMatch(ctx, st, pmq, bitarray,
+                            buf, i, pids[k], buf_offset);
+                }
+            }
+        }
+        state = s;
+    } else {
+        SC_AC_STATE_TYPE_U32 s = state;
+        SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
+        for ( ; i < buflen; i++) {
+            s = state_table_u32[s & 0x00FFFFFF][u8_tolower(buf[i])];
+            if (s & 0xFF000000) {
+                const uint32_t no_of_entries = ctx->output_table[s & 0x00FFFFFF].no_of_entries;
+                const uint32_t *pids = ctx->output_table[s & 0x00FFFFFF].pids;
+                uint32_t k;
+                for (k = 0; k < no_of_entries; k++) {
+                    matches += SCACStreamHandleMatch(ctx, st, pmq, bitarray,
+                            buf, i, pids[k], buf_offset);
+                }
+            }
+        }
+        state = s;
+    }
+
+    st->state = state;
+    st->window_start = buf_offset;
+    st->scan_end = buf_offset + buflen;
+    return matches;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1225,6 +1748,10 @@ void SCACPrintInfo(MpmCtx *mpm_ctx)
     printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
     printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
     printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
+    if (ctx->cs != NULL) {
+        printf("Compact table transitions:          %" PRIu32 "\n", ctx->cs->trans_size);
+        printf("Compact table skips to start bytes: %s\n", ctx->cs->skip ? "yes" : "no");
+    }
     printf("\n");
 
     return;
@@ -1247,10 +1774,31 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchStream = SCACSearchStream;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
 
+    /* same automaton, compact state table. The tests are registered
+     * through "ac" */
+    mpm_table[MPM_AC_COMPACT].name = "ac-compact";
+    mpm_table[MPM_AC_COMPACT].InitCtx = SCACInitCtx;
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx = SCACInitThreadCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyCtx = SCACDestroyCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx = SCACDestroyThreadCtx;
+    mpm_table[MPM_AC_COMPACT].AddPattern = SCACAddPatternCS;
+    mpm_table[MPM_AC_COMPACT].AddPatternNocase = SCACAddPatternCI;
+    mpm_table[MPM_AC_COMPACT].Prepare = SCACPreparePatterns;
+    mpm_table[MPM_AC_COMPACT].Search = SCACCSSearch;
+    mpm_table[MPM_AC_COMPACT].SearchStream = SCACSearchStream;
+    mpm_table[MPM_AC_COMPACT].PrintCtx = SCACPrintInfo;
+    mpm_table[MPM_AC_COMPACT].PrintThreadCtx = SCACPrintSearchStats;
+
+#ifdef AC_CS_POPCNT_TARGET
+    if (UtilCpuHasPOPCNT())
+        ac_cs_scan = SCACCSScanPopcnt;
+#endif
+
     return;
 }
 
@@ -2280,6 +2828,177 @@ end:
     return result;
 }
 
+/** \test stream search resumes where the previous one ended */
+static int SCACTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState st;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    memset(&st, 0, sizeof(st));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+    SCACPreparePatterns(&mpm_ctx);
+
+    const uint8_t *stream = (const uint8_t *)"abcdXXwXYzXXXX";
+
+    uint32_t cnt = SCACSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &st,
+            stream, 8, 0);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(st.scan_end == 8);
+
+    /* resumed at offset 8: the match straddling it is found, the one
+     * before the window is not added */
+    PmqReset(&pmq);
+    cnt = SCACSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &st,
+            stream + 4, 8, 4);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array[0] == 1);
+    FAIL_IF_NOT(st.history_cnt == 1);
+
+    /* same window again: all from the history */
+    PmqReset(&pmq);
+    cnt = SCACSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &st,
+            stream + 4, 8, 4);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+
+    /* window starting before the previous one: full search */
+    PmqReset(&pmq);
+    cnt = SCACSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &st,
+            stream, 14, 0);
+    FAIL_IF_NOT(cnt == 2);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+static int SCACSidCompare(const void *a, const void *b)
+{
+    const SigIntId s1 = *(const SigIntId *)a;
+    const SigIntId s2 = *(const SigIntId *)b;
+    return (s1 > s2) - (s1 < s2);
+}
+
+/** \internal
+ *  \brief sorted and unique sids of the pmq */
+static uint32_t SCACSortedSids(PrefilterRuleStore *pmq)
+{
+    if (pmq->rule_id_array_cnt == 0)
+        return 0;
+    qsort(pmq->rule_id_array, pmq->rule_id_array_cnt, sizeof(SigIntId),
+            SCACSidCompare);
+    uint32_t n = 1;
+    for (uint32_t i = 1; i < pmq->rule_id_array_cnt; i++) {
+        if (pmq->rule_id_array[i] != pmq->rule_id_array[n - 1])
+            pmq->rule_id_array[n++] = pmq->rule_id_array[i];
+    }
+    return n;
+}
+
+/**
+ * \test ac-compact finds the same as ac for random patterns and buffers,
+ *       with and without skipping to the start bytes.
+ */
+static int SCACTest31(void)
+{
+    uint32_t seed = 4242;
+#define AC_RAND() (seed = seed * 1103515245 + 12345, (seed >> 16) & 0x7fff)
+
+    for (int round = 0; round < 60; round++) {
+        MpmCtx cs_ctx, ac_ctx;
+        MpmThreadCtx cs_tctx, ac_tctx;
+        PrefilterRuleStore cs_pmq, ac_pmq;
+        MpmStreamState st;
+
+        memset(&cs_ctx, 0, sizeof(MpmCtx));
+        memset(&ac_ctx, 0, sizeof(MpmCtx));
+        memset(&st, 0, sizeof(st));
+        MpmInitCtx(&cs_ctx, MPM_AC_COMPACT);
+        MpmInitCtx(&ac_ctx, MPM_AC);
+        MpmInitThreadCtx(&cs_tctx, MPM_AC_COMPACT);
+        MpmInitThreadCtx(&ac_tctx, MPM_AC);
+        PmqSetup(&cs_pmq);
+        PmqSetup(&ac_pmq);
+
+        /* every third round the patterns use all byte values, so that
+         * the start bytes are too many to skip */
+        const bool any_byte = (round % 3 == 2);
+        const int npats = 1 + (round * 7) % 120;
+        for (int n = 0; n < npats; n++) {
+            uint8_t pat[12];
+            const uint16_t len = 1 + AC_RAND() % 10;
+            for (int x = 0; x < len; x++) {
+                pat[x] = any_byte ? (uint8_t)AC_RAND() :
+                    (uint8_t)"abcdABCD\x00\xff"[AC_RAND() % 10];
+            }
+            const uint16_t offset = (AC_RAND() % 4 == 0) ? AC_RAND() % 64 : 0;
+            const uint16_t depth = (AC_RAND() % 4 == 0) ? offset + len + AC_RAND() % 64 : 0;
+            if (AC_RAND() % 2) {
+                MpmAddPatternCI(&cs_ctx, pat, len, offset, depth, n, n, 0);
+                MpmAddPatternCI(&ac_ctx, pat, len, offset, depth, n, n, 0);
+            } else {
+                MpmAddPatternCS(&cs_ctx, pat, len, offset, depth, n, n, 0);
+                MpmAddPatternCS(&ac_ctx, pat, len, offset, depth, n, n, 0);
+            }
+        }
+        FAIL_IF(mpm_table[MPM_AC_COMPACT].Prepare(&cs_ctx) != 0);
+        FAIL_IF(mpm_table[MPM_AC].Prepare(&ac_ctx) != 0);
+        FAIL_IF_NULL(((SCACCtx *)cs_ctx.ctx)->cs);
+        FAIL_IF(npats > 20 && cs_ctx.memory_size >= ac_ctx.memory_size);
+
+        for (int b = 0; b < 20; b++) {
+            uint8_t buf[300];
+            const uint32_t buflen = AC_RAND() % sizeof(buf);
+            for (uint32_t x = 0; x < buflen; x++) {
+                buf[x] = (b % 2) ? (uint8_t)AC_RAND() :
+                    (uint8_t)"abcdefABCDEF\x00\xff"[AC_RAND() % 14];
+            }
+
+            uint32_t ccnt = mpm_table[MPM_AC_COMPACT].Search(&cs_ctx, &cs_tctx,
+                    &cs_pmq, buf, buflen);
+            uint32_t acnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                    &ac_pmq, buf, buflen);
+            FAIL_IF(ccnt != acnt);
+            const uint32_t csids = SCACSortedSids(&cs_pmq);
+            FAIL_IF(csids != SCACSortedSids(&ac_pmq));
+            FAIL_IF(csids > 0 && memcmp(cs_pmq.rule_id_array,
+                        ac_pmq.rule_id_array, csids * sizeof(SigIntId)) != 0);
+            PmqReset(&cs_pmq);
+
+            /* the stream search of a new window is a full search */
+            MpmStreamStateReset(&st);
+            ccnt = SCACSearchStream(&cs_ctx, &cs_tctx, &cs_pmq, &st,
+                    buf, buflen, 0);
+            FAIL_IF(ccnt != acnt);
+            FAIL_IF(SCACSortedSids(&cs_pmq) != csids);
+            PmqReset(&cs_pmq);
+            PmqReset(&ac_pmq);
+        }
+
+        mpm_table[MPM_AC_COMPACT].DestroyCtx(&cs_ctx);
+        mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+        mpm_table[MPM_AC_COMPACT].DestroyThreadCtx(&cs_ctx, &cs_tctx);
+        mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+        PmqFree(&cs_pmq);
+        PmqFree(&ac_pmq);
+    }
+#undef AC_RAND
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2315,6 +3034,8 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
+    UtRegisterTest("SCACTest31", SCACTest31);
 #endif
 
     return;
@@ -47,6 +47,32 @@ typedef struct SCACOutputTable_ {
     uint32_t no_of_entries;
 } SCACOutputTable;
 
+/* a row of the compact state table: the chars for which the row differs
+ * from the root row are set in bits, their transitions are in trans from
+ * base on. cnt[w] is the number of them in the words before bits[w]. */
+typedef struct SCACCSRow_ {
+    uint64_t bits[4];
+    uint32_t base;
+    uint8_t cnt[4];
+} SCACCSRow;
+
+/* compact state table of the ac-compact matcher */
+typedef struct SCACCSTable_ {
+    /* the root row, in full */
+    uint32_t root[256];
+    /* nibble tables of a superset of the bytes that can start a pattern */
+    uint8_t start_lo[16] __attribute__((aligned(16)));
+    uint8_t start_hi[16] __attribute__((aligned(16)));
+    /* exact set of the bytes that can start a pattern */
+    uint8_t start[256];
+    /* skip ahead to the next start byte in the root state */
+    bool skip;
+
+    uint32_t trans_size;
+    SCACCSRow *rows;
+    uint32_t *trans;
+} SCACCSTable;
+
 typedef struct SCACCtx_ {
     /* pattern arrays.  We need this only during the goto table creation phase */
     MpmPattern **parray;
@@ -60,6 +86,8 @@ typedef struct SCACCtx_ {
     SC_AC_STATE_TYPE_U16 (*state_table_u16)[256];
     /* the all important memory hungry state_table */
     SC_AC_STATE_TYPE_U32 (*state_table_u32)[256];
+    /* replaces the above for ac-compact */
+    SCACCSTable *cs;
 
     /* goto_table, failure table and output table.  Needed to create state_table.
      * Will be freed, once we have created the state_table */
@@ -41,6 +41,7 @@
 #include "util-hash.h"
 #include "util-hash-lookup3.h"
 #include "util-hyperscan.h"
+#include "util-path.h"
 
 #ifdef BUILD_HYPERSCAN
 
@@ -57,13 +58,13 @@ int SCHSAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCHSPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, const uint32_t buflen);
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, const uint8_t **bufs,
+                          const uint32_t *buflens, uint32_t cnt);
 void SCHSPrintInfo(MpmCtx *mpm_ctx);
 void SCHSPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCHSRegisterTests(void);
 
-/* size of the hash table used to speed up pattern insertions initially */
-#define INIT_HASH_SIZE 65536
-
 /* Initial size of the global database hash (used for de-duplication). */
 #define INIT_DB_HASH_SIZE 1000
 
@@ -78,6 +79,20 @@ static SCMutex g_scratch_proto_mutex = SCMUTEX_INITIALIZER;
 static HashTable *g_db_table = NULL;
 static SCMutex g_db_table_mutex = SCMUTEX_INITIALIZER;
 
+/* Default location of the on-disk cache of compiled databases. */
+#define HS_CACHE_DEFAULT_PATH LOCAL_STATE_DIR "/lib/suricata/cache/sgh"
+
+/* Version of the cache file format, part of the file name. */
+#define HS_CACHE_VERSION 1
+
+/* Directory of the on-disk database cache, empty if the cache is disabled.
+ * Set up on first use by SCHSCacheInit(), access is serialised via
+ * g_db_table_mutex. */
+static bool g_cache_init = false;
+static char g_cache_path[PATH_MAX] = "";
+/* Map the cached databases in place, see SCHSCacheMap(). */
+static bool g_cache_shared = false;
+
 /**
  * \internal
  * \brief Wraps SCMalloc (which is a macro) so that it can be passed to
@@ -114,23 +129,27 @@ static void SCHSSetAllocators(void)
 
 /**
  * \internal
- * \brief Creates a hash of the pattern.  We use it for the hashing process
- *        during the initial pattern insertion time, to cull duplicate sigs.
+ * \brief Hash of the pattern's id, offset and depth. We use it during the
+ *        initial pattern insertion time, to cull duplicate sigs.
  *
- * \param pat    Pointer to the pattern.
- * \param patlen Pattern length.
- *
- * \retval hash A 32 bit unsigned hash.
+ *        Since Hyperscan uses offset/depth, we must distinguish between
+ *        patterns with the same ID but different offset/depth here.
  */
-static inline uint32_t SCHSInitHashRaw(uint8_t *pat, uint16_t patlen)
+static inline uint32_t SCHSInitHash(const SCHSPattern *p)
 {
-    uint32_t hash = patlen * pat[0];
-    if (patlen > 1)
-        hash += pat[1];
+    return OpenHashU32(p->id ^ OpenHashU32(((uint32_t)p->offset << 16) | p->depth));
+}
 
-    return (hash % INIT_HASH_SIZE);
+static inline int SCHSInitHashCompare(const SCHSPattern *p1, const SCHSPattern *p2)
+{
+    return (p1->id == p2->id && p1->offset == p2->offset && p1->depth == p2->depth);
 }
 
+#define SCHSInitHashKey(p) (p)
+
+OPEN_HASH_GENERATE(SCHSInitHashTable, SCHSPattern, const SCHSPattern *,
+        SCHSInitHash, SCHSInitHashKey, SCHSInitHashCompare)
+
 /**
  * \internal
  * \brief Looks up a pattern.  We use it for the hashing process during
@@ -141,31 +160,24 @@ static inline uint32_t SCHSInitHashRaw(uint8_t *pat, uint16_t patlen)
  * \param patlen Pattern length.
  * \param flags  Flags.  We don't need this.
  *
- * \retval hash A 32 bit unsigned hash.
+ * \retval p the pattern, or NULL if not found
  */
 static inline SCHSPattern *SCHSInitHashLookup(SCHSCtx *ctx, uint8_t *pat,
                                               uint16_t patlen, uint16_t offset,
                                               uint16_t depth, char flags,
                                               uint32_t pid)
 {
-    uint32_t hash = SCHSInitHashRaw(pat, patlen);
-
     if (ctx->init_hash == NULL) {
         return NULL;
     }
 
-    SCHSPattern *t = ctx->init_hash[hash];
-    for (; t != NULL; t = t->next) {
-        /* Since Hyperscan uses offset/depth, we must distinguish between
-         * patterns with the same ID but different offset/depth here. */
-        if (t->id == pid && t->offset == offset && t->depth == depth) {
-            BUG_ON(t->len != patlen);
-            BUG_ON(SCMemcmp(t->original_pat, pat, patlen) != 0);
-            return t;
-        }
+    const SCHSPattern key = { .id = pid, .offset = offset, .depth = depth };
+    SCHSPattern *t = SCHSInitHashTableLookup(ctx->init_hash, &key);
+    if (t != NULL) {
+        BUG_ON(t->len != patlen);
+        BUG_ON(SCMemcmp(t->original_pat, pat, patlen) != 0);
     }
-
-    return NULL;
+    return t;
 }
 
 /**
@@ -217,39 +229,15 @@ static inline void SCHSFreePattern(MpmCtx *mpm_ctx, SCHSPattern *p)
     }
 }
 
-static inline uint32_t SCHSInitHash(SCHSPattern *p)
-{
-    uint32_t hash = p->len * p->original_pat[0];
-    if (p->len > 1)
-        hash += p->original_pat[1];
-
-    return (hash % INIT_HASH_SIZE);
-}
-
 static inline int SCHSInitHashAdd(SCHSCtx *ctx, SCHSPattern *p)
 {
-    uint32_t hash = SCHSInitHash(p);
-
     if (ctx->init_hash == NULL) {
         return 0;
     }
 
-    if (ctx->init_hash[hash] == NULL) {
-        ctx->init_hash[hash] = p;
-        return 0;
+    if (SCHSInitHashTableAdd(ctx->init_hash, p) < 0) {
+        exit(EXIT_FAILURE);
     }
-
-    SCHSPattern *tt = NULL;
-    SCHSPattern *t = ctx->init_hash[hash];
-
-    /* get the list tail */
-    do {
-        tt = t;
-        t = t->next;
-    } while (t != NULL);
-
-    tt->next = p;
-
     return 0;
 }
 
@@ -275,6 +263,7 @@ static int SCHSAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
 
     if (offset != 0) {
         flags |= MPM_PATTERN_FLAG_OFFSET;
+        mpm_ctx->flags |= MPMCTX_FLAGS_OFFSET;
     }
     if (depth != 0) {
         flags |= MPM_PATTERN_FLAG_DEPTH;
@@ -451,7 +440,12 @@ static void SCHSFreeCompileData(SCHSCompileData *cd)
 typedef struct PatternDatabase_ {
     SCHSPattern **parray;
     hs_database_t *hs_db;
+    /* length of the mapping if hs_db is mapped from the cache, 0 if it's
+     * allocated by Hyperscan */
+    size_t hs_db_map_len;
     uint32_t pattern_cnt;
+    /* compiled for hs_scan_vector, see MPMCTX_FLAGS_VECTOR */
+    bool vectored;
 
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
@@ -496,7 +490,7 @@ static char SCHSPatternCompare(const SCHSPattern *p1, const SCHSPattern *p2)
 static uint32_t PatternDatabaseHash(HashTable *ht, void *data, uint16_t len)
 {
     const PatternDatabase *pd = data;
-    uint32_t hash = 0;
+    uint32_t hash = pd->vectored;
     hash = hashword(&pd->pattern_cnt, 1, hash);
 
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
@@ -513,7 +507,8 @@ static char PatternDatabaseCompare(void *data1, uint16_t len1, void *data2,
     const PatternDatabase *pd1 = data1;
     const PatternDatabase *pd2 = data2;
 
-    if (pd1->pattern_cnt != pd2->pattern_cnt) {
+    if (pd1->pattern_cnt != pd2->pattern_cnt ||
+        pd1->vectored != pd2->vectored) {
         return 0;
     }
 
@@ -542,7 +537,11 @@ static void PatternDatabaseFree(PatternDatabase *pd)
         SCFree(pd->parray);
     }
 
-    hs_free_database(pd->hs_db);
+    if (pd->hs_db_map_len > 0) {
+        munmap(pd->hs_db, pd->hs_db_map_len);
+    } else {
+        hs_free_database(pd->hs_db);
+    }
 
     SCFree(pd);
 }
@@ -576,6 +575,339 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/**
+ * \internal
+ * \brief Read the configuration of the on-disk database cache.
+ *
+ * With detect.sgh-mpm-caching enabled, the compiled databases are
+ * serialized to detect.sgh-mpm-caching-path, so that a restart or a rule
+ * reload only compiles the pattern sets that are not in the cache yet.
+ * With detect.sgh-mpm-caching-shared the databases are also stored ready to
+ * use and mapped, so that processes with the same rules share them.
+ */
+static void SCHSCacheInit(void)
+{
+    g_cache_init = true;
+    g_cache_path[0] = '\0';
+    g_cache_shared = false;
+
+    int enabled = 0;
+    if (ConfGetBool("detect.sgh-mpm-caching", &enabled) != 1 || !enabled)
+        return;
+
+    const char *path = NULL;
+    if (ConfGet("detect.sgh-mpm-caching-path", &path) != 1 || path == NULL)
+        path = HS_CACHE_DEFAULT_PATH;
+
+    if (SCCreateDirectoryTree(path, true) != 0) {
+        SCLogWarning(SC_ERR_CREATE_DIRECTORY, "failed to create Hyperscan "
+                     "cache directory %s: %s, cache disabled", path,
+                     strerror(errno));
+        return;
+    }
+    strlcpy(g_cache_path, path, sizeof(g_cache_path));
+
+    int shared = 0;
+    if (ConfGetBool("detect.sgh-mpm-caching-shared", &shared) == 1 && shared)
+        g_cache_shared = true;
+
+    SCLogConfig("Hyperscan databases are cached in %s%s", g_cache_path,
+                g_cache_shared ? ", and shared between processes" : "");
+}
+
+/**
+ * \internal
+ * \brief Hash the part of a pattern that goes into the compiled database.
+ *
+ * Unlike SCHSPatternHash() this leaves out the sids, so that a pattern set
+ * still matches its cache file after the signatures are renumbered.
+ */
+static uint32_t SCHSPatternCacheHash(const SCHSPattern *p, uint32_t hash)
+{
+    hash = hashlittle_safe(&p->len, sizeof(p->len), hash);
+    hash = hashlittle_safe(&p->flags, sizeof(p->flags), hash);
+    hash = hashlittle_safe(p->original_pat, p->len, hash);
+    hash = hashlittle_safe(&p->offset, sizeof(p->offset), hash);
+    hash = hashlittle_safe(&p->depth, sizeof(p->depth), hash);
+    return hash;
+}
+
+/**
+ * \internal
+ * \brief 64 bit key of a pattern database in the on-disk cache.
+ *
+ * Covers the patterns in order, as the pattern ids are their index, the
+ * scan mode, and the Hyperscan version and platform the database is
+ * compiled for.
+ */
+static uint64_t PatternDatabaseCacheHash(const PatternDatabase *pd)
+{
+    hs_platform_info_t platform;
+    memset(&platform, 0, sizeof(platform));
+    (void)hs_populate_platform(&platform);
+    const char *version = hs_version();
+
+    uint32_t hash[2] = { 0, 0x9e3779b9 };
+    const uint32_t vectored = pd->vectored;
+    for (int j = 0; j < 2; j++) {
+        hash[j] = hashword(&vectored, 1, hash[j]);
+        hash[j] = hashlittle_safe(version, strlen(version), hash[j]);
+        hash[j] = hashlittle_safe(&platform, sizeof(platform), hash[j]);
+        hash[j] = hashword(&pd->pattern_cnt, 1, hash[j]);
+        for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+            hash[j] = SCHSPatternCacheHash(pd->parray[i], hash[j]);
+        }
+    }
+    return ((uint64_t)hash[1] << 32) | hash[0];
+}
+
+static int SCHSCacheFileName(uint64_t hash, char *path, size_t size)
+{
+    int r = snprintf(path, size, "%s/%016" PRIx64 "_v%d.hs", g_cache_path,
+                     hash, HS_CACHE_VERSION);
+    return (r < 0 || (size_t)r >= size) ? -1 : 0;
+}
+
+static int SCHSCacheImageName(uint64_t hash, char *path, size_t size)
+{
+    int r = snprintf(path, size, "%s/%016" PRIx64 "_v%d.hsdb", g_cache_path,
+                     hash, HS_CACHE_VERSION);
+    return (r < 0 || (size_t)r >= size) ? -1 : 0;
+}
+
+/**
+ * \internal
+ * \brief Map the image of a database from the on-disk cache.
+ *
+ * The image is a database as hs_deserialize_database_at() lays it out.
+ * Hyperscan databases don't depend on their address, so the image is used
+ * where it's mapped. The mapping is read only and shared: all processes
+ * that load the same rules share its pages.
+ *
+ * \param[out] map_len length of the mapping, to unmap the database
+ *
+ * \retval db the database, NULL if there is no usable image.
+ */
+static hs_database_t *SCHSCacheMap(uint64_t hash, size_t *map_len)
+{
+    char path[PATH_MAX];
+    if (SCHSCacheImageName(hash, path, sizeof(path)) != 0)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    void *map = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    /* checks the magic and the version of the database */
+    char *info = NULL;
+    if (hs_database_info(map, &info) != HS_SUCCESS) {
+        SCLogDebug("%s is not a usable database", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    SCHSFree(info);
+
+    *map_len = st.st_size;
+    return map;
+}
+
+/**
+ * \internal
+ * \brief Store the image of a database in the on-disk cache and map it.
+ *
+ * Like SCHSCacheSave() the image is written under a temporary name and
+ * renamed, so a mapped image is never changed.
+ *
+ * \param[out] map_len length of the mapping, to unmap the database
+ *
+ * \retval db the mapped copy of db, NULL on failure.
+ */
+static hs_database_t *SCHSCacheShare(uint64_t hash, const hs_database_t *db,
+                                     size_t *map_len)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (SCHSCacheImageName(hash, path, sizeof(path)) != 0)
+        return NULL;
+    int r = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path,
+                     (int)getpid(), SCGetThreadIdLong());
+    if (r < 0 || (size_t)r >= sizeof(tmp_path))
+        return NULL;
+
+    char *bytes = NULL;
+    size_t len = 0;
+    if (hs_serialize_database(db, &bytes, &len) != HS_SUCCESS)
+        return NULL;
+
+    bool ok = false;
+    size_t size = 0;
+    if (hs_serialized_database_size(bytes, len, &size) == HS_SUCCESS) {
+        int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+            if (ftruncate(fd, size) == 0) {
+                void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+                if (map != MAP_FAILED) {
+                    ok = hs_deserialize_database_at(bytes, len, map) ==
+                         HS_SUCCESS;
+                    munmap(map, size);
+                }
+            }
+            ok &= close(fd) == 0;
+        }
+    }
+    SCHSFree(bytes);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to write Hyperscan cache file "
+                     "%s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        return NULL;
+    }
+    return SCHSCacheMap(hash, map_len);
+}
+
+/**
+ * \internal
+ * \brief Load a database from the on-disk cache.
+ *
+ * \retval db the database, NULL if it is not in the cache or if it can't be
+ *         used on this platform.
+ */
+static hs_database_t *SCHSCacheLoad(uint64_t hash)
+{
+    char path[PATH_MAX];
+    if (SCHSCacheFileName(hash, path, sizeof(path)) != 0)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    hs_database_t *db = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            hs_error_t err = hs_deserialize_database(map, st.st_size, &db);
+            if (err != HS_SUCCESS) {
+                SCLogDebug("failed to deserialize %s: %d", path, err);
+                db = NULL;
+            }
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+    return db;
+}
+
+/**
+ * \internal
+ * \brief Store a database in the on-disk cache.
+ *
+ * The file is written under a temporary name and renamed, so that a
+ * concurrent reader never sees a partial database.
+ */
+static void SCHSCacheSave(uint64_t hash, const hs_database_t *db)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (SCHSCacheFileName(hash, path, sizeof(path)) != 0)
+        return;
+    /* mpms are prepared in parallel, the name is unique per thread */
+    int r = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lu.tmp", path,
+                     (int)getpid(), SCGetThreadIdLong());
+    if (r < 0 || (size_t)r >= sizeof(tmp_path))
+        return;
+
+    char *bytes = NULL;
+    size_t len = 0;
+    if (hs_serialize_database(db, &bytes, &len) != HS_SUCCESS)
+        return;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to write Hyperscan cache file "
+                     "%s: %s", tmp_path, strerror(errno));
+        SCHSFree(bytes);
+        return;
+    }
+    bool ok = fwrite(bytes, 1, len, fp) == len;
+    ok &= fclose(fp) == 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to write Hyperscan cache file "
+                     "%s: %s", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    SCHSFree(bytes);
+}
+
+/**
+ * \internal
+ * \brief Compile the patterns of a database.
+ *
+ * \retval 0 on success, -1 on failure.
+ */
+static int SCHSCompileDatabase(PatternDatabase *pd, SCHSCompileData *cd)
+{
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        const SCHSPattern *p = pd->parray[i];
+
+        cd->ids[i] = i;
+        cd->flags[i] = HS_FLAG_SINGLEMATCH;
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            cd->flags[i] |= HS_FLAG_CASELESS;
+        }
+
+        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
+
+        if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
+            cd->ext[i] = SCMalloc(sizeof(hs_expr_ext_t));
+            if (cd->ext[i] == NULL) {
+                return -1;
+            }
+            memset(cd->ext[i], 0, sizeof(hs_expr_ext_t));
+
+            if (p->flags & MPM_PATTERN_FLAG_OFFSET) {
+                cd->ext[i]->flags |= HS_EXT_FLAG_MIN_OFFSET;
+                cd->ext[i]->min_offset = p->offset + p->len;
+            }
+            if (p->flags & MPM_PATTERN_FLAG_DEPTH) {
+                cd->ext[i]->flags |= HS_EXT_FLAG_MAX_OFFSET;
+                cd->ext[i]->max_offset = p->offset + p->depth;
+            }
+        }
+    }
+
+    hs_compile_error_t *compile_err = NULL;
+    hs_error_t err = hs_compile_ext_multi((const char *const *)cd->expressions,
+                               cd->flags, cd->ids,
+                               (const hs_expr_ext_t *const *)cd->ext,
+                               cd->pattern_cnt,
+                               pd->vectored ? HS_MODE_VECTORED : HS_MODE_BLOCK,
+                               NULL,
+                               &pd->hs_db, &compile_err);
+
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
+        if (compile_err) {
+            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        }
+        hs_free_compile_error(compile_err);
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -591,7 +923,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     }
 
     hs_error_t err;
-    hs_compile_error_t *compile_err = NULL;
     SCHSCompileData *cd = NULL;
     PatternDatabase *pd = NULL;
 
@@ -604,24 +935,22 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     if (pd == NULL) {
         goto error;
     }
+    pd->vectored = (mpm_ctx->flags & MPMCTX_FLAGS_VECTOR) != 0;
 
     /* populate the pattern array with the patterns in the hash */
-    for (uint32_t i = 0, p = 0; i < INIT_HASH_SIZE; i++) {
-        SCHSPattern *node = ctx->init_hash[i], *nnode = NULL;
-        while (node != NULL) {
-            nnode = node->next;
-            node->next = NULL;
-            pd->parray[p++] = node;
-            node = nnode;
-        }
+    uint32_t p = 0;
+    SCHSPattern *node;
+    OPEN_HASH_FOREACH(node, ctx->init_hash) {
+        pd->parray[p++] = node;
     }
 
     /* we no longer need the hash, so free its memory */
-    SCFree(ctx->init_hash);
+    SCHSInitHashTableFree(ctx->init_hash, NULL);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* The global table is used to dedupe identical databases. It is not
+     * locked while compiling, so that several mpms can be prepared in
+     * parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -638,7 +967,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     /* Check global hash table to see if we've seen this pattern database
      * before, and reuse the Hyperscan database if so. */
     PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
-
     if (pd_cached != NULL) {
         SCLogDebug("Reusing cached database %p with %" PRIu32
                    " patterns (ref_cnt=%" PRIu32 ")",
@@ -652,53 +980,62 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         return 0;
     }
 
-    BUG_ON(ctx->pattern_db != NULL); /* already built? */
+    if (!g_cache_init) {
+        SCHSCacheInit();
+    }
+    const bool use_cache = (g_cache_path[0] != '\0');
+    const bool use_shared = use_cache && g_cache_shared;
+    SCMutexUnlock(&g_db_table_mutex);
 
-    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
-        const SCHSPattern *p = pd->parray[i];
+    BUG_ON(ctx->pattern_db != NULL); /* already built? */
+    BUG_ON(mpm_ctx->pattern_cnt == 0);
 
-        cd->ids[i] = i;
-        cd->flags[i] = HS_FLAG_SINGLEMATCH;
-        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
-            cd->flags[i] |= HS_FLAG_CASELESS;
+    /* Not built by this process yet, try the on-disk cache before
+     * compiling. */
+    uint64_t cache_hash = 0;
+    if (use_cache) {
+        cache_hash = PatternDatabaseCacheHash(pd);
+        if (use_shared) {
+            pd->hs_db = SCHSCacheMap(cache_hash, &pd->hs_db_map_len);
         }
-
-        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
-
-        if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
-            cd->ext[i] = SCMalloc(sizeof(hs_expr_ext_t));
-            if (cd->ext[i] == NULL) {
-                SCMutexUnlock(&g_db_table_mutex);
-                goto error;
-            }
-            memset(cd->ext[i], 0, sizeof(hs_expr_ext_t));
-
-            if (p->flags & MPM_PATTERN_FLAG_OFFSET) {
-                cd->ext[i]->flags |= HS_EXT_FLAG_MIN_OFFSET;
-                cd->ext[i]->min_offset = p->offset + p->len;
-            }
-            if (p->flags & MPM_PATTERN_FLAG_DEPTH) {
-                cd->ext[i]->flags |= HS_EXT_FLAG_MAX_OFFSET;
-                cd->ext[i]->max_offset = p->offset + p->depth;
-            }
+        if (pd->hs_db == NULL) {
+            pd->hs_db = SCHSCacheLoad(cache_hash);
+        }
+        if (pd->hs_db != NULL) {
+            SCLogDebug("Loaded database with %" PRIu32 " patterns from the "
+                       "cache", pd->pattern_cnt);
         }
     }
 
-    BUG_ON(mpm_ctx->pattern_cnt == 0);
+    if (pd->hs_db == NULL) {
+        if (SCHSCompileDatabase(pd, cd) != 0) {
+            goto error;
+        }
+        if (use_cache) {
+            SCHSCacheSave(cache_hash, pd->hs_db);
+        }
+    }
+    if (use_shared && pd->hs_db_map_len == 0) {
+        hs_database_t *db = SCHSCacheShare(cache_hash, pd->hs_db,
+                                           &pd->hs_db_map_len);
+        if (db != NULL) {
+            hs_free_database(pd->hs_db);
+            pd->hs_db = db;
+        }
+    }
 
-    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
-                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
-                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
-                               &compile_err);
+    SCMutexLock(&g_db_table_mutex);
 
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
-        if (compile_err) {
-            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
-        }
-        hs_free_compile_error(compile_err);
+    /* An identical database may have been added while this one was
+     * compiled, use that one so that the dedupe still holds. */
+    pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached != NULL) {
+        pd_cached->ref_cnt++;
+        ctx->pattern_db = pd_cached;
         SCMutexUnlock(&g_db_table_mutex);
-        goto error;
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
     }
 
     ctx->pattern_db = pd;
@@ -819,11 +1156,10 @@ void SCHSInitCtx(MpmCtx *mpm_ctx)
 
     /* initialize the hash we use to speed up pattern insertions */
     SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
-    ctx->init_hash = SCMalloc(sizeof(SCHSPattern *) * INIT_HASH_SIZE);
+    ctx->init_hash = SCHSInitHashTableInit(0);
     if (ctx->init_hash == NULL) {
         exit(EXIT_FAILURE);
     }
-    memset(ctx->init_hash, 0, sizeof(SCHSPattern *) * INIT_HASH_SIZE);
 }
 
 /**
@@ -864,10 +1200,8 @@ void SCHSDestroyCtx(MpmCtx *mpm_ctx)
         return;
 
     if (ctx->init_hash != NULL) {
-        SCFree(ctx->init_hash);
+        SCHSInitHashTableFree(ctx->init_hash, NULL);
         ctx->init_hash = NULL;
-        mpm_ctx->memory_cnt--;
-        mpm_ctx->memory_size -= (INIT_HASH_SIZE * sizeof(SCHSPattern *));
     }
 
     /* Decrement pattern database ref count, and delete it entirely if the
@@ -946,8 +1280,15 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     BUG_ON(pd->hs_db == NULL);
     BUG_ON(scratch == NULL);
 
-    hs_error_t err = hs_scan(pd->hs_db, (const char *)buf, buflen, 0, scratch,
+    hs_error_t err;
+    if (pd->vectored) {
+        const char *data = (const char *)buf;
+        err = hs_scan_vector(pd->hs_db, &data, &buflen, 1, 0, scratch,
                              SCHSMatchEvent, &cctx);
+    } else {
+        err = hs_scan(pd->hs_db, (const char *)buf, buflen, 0, scratch,
+                      SCHSMatchEvent, &cctx);
+    }
     if (err != HS_SUCCESS) {
         /* An error value (other than HS_SCAN_TERMINATED) from hs_scan()
          * indicates that it was passed an invalid database or scratch region,
@@ -961,6 +1302,53 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return ret;
 }
 
+/**
+ * \brief Search several buffers in one Hyperscan call.
+ *
+ * A database not compiled for it, i.e. of a ctx without
+ * MPMCTX_FLAGS_VECTOR, is scanned buffer by buffer.
+ *
+ * \param bufs    Buffers to be searched.
+ * \param buflens Buffer lengths.
+ * \param cnt     Number of buffers.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PrefilterRuleStore *pmq, const uint8_t **bufs,
+                          const uint32_t *buflens, uint32_t cnt)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+    const PatternDatabase *pd = ctx->pattern_db;
+
+    if (!pd->vectored) {
+        uint32_t ret = 0;
+        for (uint32_t i = 0; i < cnt; i++) {
+            ret += SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, bufs[i], buflens[i]);
+        }
+        return ret;
+    }
+
+    SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0};
+
+    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    BUG_ON(pd->hs_db == NULL);
+    BUG_ON(scratch == NULL);
+
+    /* matches are reported at their offset in the concatenation of the
+     * buffers, which is why the patterns of a vectored ctx have no offset
+     * or depth */
+    hs_error_t err = hs_scan_vector(pd->hs_db, (const char *const *)bufs,
+                                    buflens, cnt, 0, scratch, SCHSMatchEvent,
+                                    &cctx);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+    return cctx.match_count;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1061,6 +1449,7 @@ void MpmHSRegister(void)
     mpm_table[MPM_HS].AddPatternNocase = SCHSAddPatternCI;
     mpm_table[MPM_HS].Prepare = SCHSPreparePatterns;
     mpm_table[MPM_HS].Search = SCHSSearch;
+    mpm_table[MPM_HS].SearchVector = SCHSSearchVector;
     mpm_table[MPM_HS].PrintCtx = SCHSPrintInfo;
     mpm_table[MPM_HS].PrintThreadCtx = SCHSPrintSearchStats;
     mpm_table[MPM_HS].RegisterUnittests = SCHSRegisterTests;
@@ -1090,6 +1479,7 @@ void MpmHSGlobalCleanup(void)
         HashTableFree(g_db_table);
         g_db_table = NULL;
     }
+    g_cache_init = false;
     SCMutexUnlock(&g_db_table_mutex);
 }
 
@@ -2145,6 +2535,76 @@ end:
     return result;
 }
 
+/** \test Compiled databases are stored in the on-disk cache and loaded from
+ *        it by the next mpm with the same patterns. */
+static int SCHSTest30(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("detect.sgh-mpm-caching", "yes");
+    ConfSet("detect.sgh-mpm-caching-path", dir);
+    g_cache_init = false;
+
+    for (int i = 0; i < 2; i++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PrefilterRuleStore pmq;
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        MpmInitCtx(&mpm_ctx, MPM_HS);
+
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+        MpmAddPatternCI(&mpm_ctx, (uint8_t *)"EFGH", 4, 0, 0, 1, 0, 0);
+        PmqSetup(&pmq);
+
+        FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+        SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+        if (i == 0) {
+            SCHSCtx *ctx = (SCHSCtx *)mpm_ctx.ctx;
+            hs_database_t *db =
+                SCHSCacheLoad(PatternDatabaseCacheHash(ctx->pattern_db));
+            FAIL_IF_NULL(db);
+            hs_free_database(db);
+        }
+
+        const char *buf = "abcdefgh";
+        uint32_t cnt = SCHSSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                  (uint8_t *)buf, strlen(buf));
+        FAIL_IF_NOT(cnt == 2);
+
+        SCHSDestroyCtx(&mpm_ctx);
+        SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+
+    int files = 0;
+    DIR *d = opendir(dir);
+    FAIL_IF_NULL(d);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+        files++;
+    }
+    closedir(d);
+    rmdir(dir);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    g_cache_init = false;
+
+    FAIL_IF_NOT(files == 1);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2179,6 +2639,7 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTest30", SCHSTest30);
 #endif
 
     return;
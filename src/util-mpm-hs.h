@@ -27,6 +27,8 @@
 #ifndef __UTIL_MPM_HS__H__
 #define __UTIL_MPM_HS__H__
 
+#include "util-hash-open.h"
+
 typedef struct SCHSPattern_ {
     /* length of the pattern */
     uint16_t len;
@@ -43,15 +45,14 @@ typedef struct SCHSPattern_ {
     /* sid(s) for this pattern */
     uint32_t sids_size;
     SigIntId *sids;
-
-    /* only used at ctx init time, when this structure is part of a hash
-     * table. */
-    struct SCHSPattern_ *next;
 } SCHSPattern;
 
+/* patterns by id, offset and depth, only used at ctx init time */
+OPEN_HASH_HEAD(SCHSInitHashTable, SCHSPattern);
+
 typedef struct SCHSCtx_ {
     /* hash used during ctx initialization */
-    SCHSPattern **init_hash;
+    SCHSInitHashTable *init_hash;
 
     /* pattern database and pattern arrays. */
     void *pattern_db;
@@ -0,0 +1,753 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy: shuffle based multi pattern matcher for small pattern sets.
+ *
+ * The patterns are spread over 8 buckets. For each of the first bytes of
+ * the patterns (up to 3, no more than the shortest pattern), two 16 entry
+ * tables map the low and the high nibble of a byte to the buckets that have
+ * a pattern with a matching nibble at that position. A shuffle looks up 16
+ * (SSSE3) or 32 (AVX2) positions at once. Where the lookups of all bytes
+ * leave a bucket set, the patterns of that bucket are compared.
+ *
+ * There are no state tables, so the matcher stays in a few cache lines.
+ * With many patterns the buckets fill up and most positions need a compare,
+ * so it is only meant for rule groups with a few patterns.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-mpm-teddy.h"
+#include "util-memcpy.h"
+#include "util-cpu.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TEDDY_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSSE3__)
+#define TEDDY_HAVE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/** scans the buffer from *pos as long as a full vector fits, updates *pos
+ *  to where the scalar scan has to continue */
+typedef uint32_t (*TeddyScanFunc)(const SCTeddyCtx *, PrefilterRuleStore *,
+        const uint8_t *, uint32_t, uint32_t *, uint8_t *);
+static TeddyScanFunc teddy_scan = NULL;
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param offset  Pattern offset setting.
+ * \param depth   Pattern depth setting.
+ * \param pid     Pattern id.
+ * \param sid     Signature _internal_ id.
+ * \param flags   Pattern flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param offset  Pattern offset setting.
+ * \param depth   Pattern depth setting.
+ * \param pid     Pattern id.
+ * \param sid     Signature _internal_ id.
+ * \param flags   Pattern flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+typedef struct TeddySortKey_ {
+    uint8_t key[TEDDY_MASK_LEN];
+    uint32_t idx;
+} TeddySortKey;
+
+static int TeddySortKeyCompare(const void *a, const void *b)
+{
+    const TeddySortKey *k1 = a;
+    const TeddySortKey *k2 = b;
+    int r = memcmp(k1->key, k2->key, TEDDY_MASK_LEN);
+    if (r != 0)
+        return r;
+    return (k1->idx > k2->idx) - (k1->idx < k2->idx);
+}
+
+static inline void TeddySetMask(SCTeddyCtx *ctx, int k, uint8_t c, uint8_t bit)
+{
+    ctx->lo[k][c & 0x0f] |= bit;
+    ctx->lo[k][16 + (c & 0x0f)] |= bit;
+    ctx->hi[k][c >> 4] |= bit;
+    ctx->hi[k][16 + (c >> 4)] |= bit;
+}
+
+/** \internal
+ *  \brief spread the patterns over the buckets and build the masks
+ *
+ *  Patterns with the same leading bytes are put in the same bucket, so the
+ *  masks of the other buckets stay selective. */
+static int TeddyBuildBuckets(MpmCtx *mpm_ctx, SCTeddyCtx *ctx)
+{
+    const uint32_t cnt = mpm_ctx->pattern_cnt;
+    TeddySortKey *keys = SCCalloc(cnt, sizeof(*keys));
+    if (keys == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const SCTeddyPattern *p = &ctx->patterns[i];
+        for (int k = 0; k < ctx->mask_len; k++)
+            keys[i].key[k] = u8_tolower(p->pat[k]);
+        keys[i].idx = i;
+    }
+    qsort(keys, cnt, sizeof(*keys), TeddySortKeyCompare);
+
+    uint32_t bucket_of[TEDDY_BUCKETS + 1];
+    memset(bucket_of, 0, sizeof(bucket_of));
+    for (uint32_t r = 0; r < cnt; r++) {
+        bucket_of[(uint64_t)r * TEDDY_BUCKETS / cnt]++;
+    }
+    for (int b = 0; b < TEDDY_BUCKETS; b++) {
+        if (bucket_of[b] == 0)
+            continue;
+        ctx->bucket_pats[b] = SCMalloc(bucket_of[b] * sizeof(uint32_t));
+        if (ctx->bucket_pats[b] == NULL) {
+            SCFree(keys);
+            return -1;
+        }
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += bucket_of[b] * sizeof(uint32_t);
+    }
+
+    for (uint32_t r = 0; r < cnt; r++) {
+        const int b = (int)((uint64_t)r * TEDDY_BUCKETS / cnt);
+        const uint8_t bit = (uint8_t)(1 << b);
+        const SCTeddyPattern *p = &ctx->patterns[keys[r].idx];
+        ctx->bucket_pats[b][ctx->bucket_cnt[b]++] = keys[r].idx;
+
+        for (int k = 0; k < ctx->mask_len; k++) {
+            TeddySetMask(ctx, k, p->pat[k], bit);
+            if (p->nocase)
+                TeddySetMask(ctx, k, (uint8_t)toupper(p->pat[k]), bit);
+        }
+    }
+    SCFree(keys);
+    return 0;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the buckets.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    /* alloc the pattern array */
+    ctx->parray = (MpmPattern **)SCCalloc(mpm_ctx->pattern_cnt,
+                                          sizeof(MpmPattern *));
+    if (ctx->parray == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+
+    /* populate it with the patterns in the hash */
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while(node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            ctx->parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    ctx->patterns = SCCalloc(mpm_ctx->pattern_cnt, sizeof(SCTeddyPattern));
+    if (ctx->patterns == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmPattern *mp = ctx->parray[i];
+        SCTeddyPattern *tp = &ctx->patterns[i];
+
+        tp->nocase = (mp->flags & MPM_PATTERN_FLAG_NOCASE) ? 1 : 0;
+        tp->pat = SCMalloc(mp->len);
+        if (tp->pat == NULL)
+            goto error;
+        memcpy(tp->pat, tp->nocase ? mp->ci : mp->cs, mp->len);
+        tp->len = mp->len;
+        tp->offset = mp->offset;
+        tp->depth = mp->depth;
+        tp->id = mp->id;
+
+        /* SCTeddyPattern now owns this memory */
+        tp->sids_size = mp->sids_size;
+        tp->sids = mp->sids;
+        mp->sids_size = 0;
+        mp->sids = NULL;
+    }
+
+    ctx->mask_len = (uint8_t)MIN(mpm_ctx->minlen, TEDDY_MASK_LEN);
+    if (TeddyBuildBuckets(mpm_ctx, ctx) != 0)
+        goto error;
+
+    /* free all the stored patterns */
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmFreePattern(mpm_ctx, ctx->parray[i]);
+    }
+    SCFree(ctx->parray);
+    ctx->parray = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    return 0;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for teddy");
+    return -1;
+}
+
+/**
+ * \brief Init the mpm thread context, teddy has no per thread data.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMallocAligned(sizeof(SCTeddyCtx), 32);
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+    }
+
+    if (ctx->parray != NULL) {
+        for (uint32_t i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            if (ctx->parray[i] != NULL) {
+                MpmFreePattern(mpm_ctx, ctx->parray[i]);
+            }
+        }
+        SCFree(ctx->parray);
+        ctx->parray = NULL;
+    }
+
+    if (ctx->patterns != NULL) {
+        for (uint32_t i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            if (ctx->patterns[i].pat != NULL)
+                SCFree(ctx->patterns[i].pat);
+            if (ctx->patterns[i].sids != NULL)
+                SCFree(ctx->patterns[i].sids);
+        }
+        SCFree(ctx->patterns);
+    }
+    for (int b = 0; b < TEDDY_BUCKETS; b++) {
+        if (ctx->bucket_pats[b] != NULL)
+            SCFree(ctx->bucket_pats[b]);
+    }
+
+    SCFreeAligned(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+}
+
+/** \internal
+ *  \brief compare the patterns of the buckets that are candidates at pos
+ *
+ *  Uses the same offset and depth checks as the ac matcher. */
+static inline uint32_t TeddyConfirm(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, uint32_t buflen, uint32_t pos, uint32_t buckets,
+        uint8_t *bitarray)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        const int b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        for (uint32_t x = 0; x < ctx->bucket_cnt[b]; x++) {
+            const SCTeddyPattern *p = &ctx->patterns[ctx->bucket_pats[b][x]];
+            if (p->len > buflen - pos)
+                continue;
+            const uint32_t end = pos + p->len - 1;
+            if (pos < p->offset || (p->depth && end > p->depth))
+                continue;
+            if (p->nocase) {
+                if (SCMemcmpLowercase(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(p->pat, buf + pos, p->len) != 0)
+                    continue;
+            }
+
+            if (!(bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+                bitarray[p->id / 8] |= (1 << (p->id % 8));
+                PrefilterAddSids(pmq, p->sids, p->sids_size);
+            }
+            matches++;
+        }
+    }
+    return matches;
+}
+
+static uint32_t TeddyScanScalar(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, uint32_t buflen, uint32_t i, uint8_t *bitarray)
+{
+    uint32_t matches = 0;
+    const uint32_t last = buflen - ctx->mask_len;
+
+    for ( ; i <= last; i++) {
+        uint8_t m = 0xff;
+        for (int k = 0; k < ctx->mask_len && m != 0; k++) {
+            const uint8_t c = buf[i + k];
+            m &= ctx->lo[k][c & 0x0f] & ctx->hi[k][c >> 4];
+        }
+        if (m != 0)
+            matches += TeddyConfirm(ctx, pmq, buf, buflen, i, m, bitarray);
+    }
+    return matches;
+}
+
+#ifdef TEDDY_HAVE_SSSE3
+static uint32_t TeddyScanSSSE3(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, uint32_t buflen, uint32_t *pos, uint8_t *bitarray)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[TEDDY_MASK_LEN], hi[TEDDY_MASK_LEN];
+    for (int k = 0; k < ctx->mask_len; k++) {
+        lo[k] = _mm_load_si128((const __m128i *)ctx->lo[k]);
+        hi[k] = _mm_load_si128((const __m128i *)ctx->hi[k]);
+    }
+
+    uint32_t matches = 0;
+    uint32_t i = *pos;
+    for ( ; i + 16 + ctx->mask_len - 1 <= buflen; i += 16) {
+        __m128i res = _mm_set1_epi8((char)0xff);
+        for (int k = 0; k < ctx->mask_len; k++) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i + k));
+            const __m128i l = _mm_and_si128(v, nibble);
+            const __m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+            res = _mm_and_si128(res, _mm_and_si128(
+                        _mm_shuffle_epi8(lo[k], l), _mm_shuffle_epi8(hi[k], h)));
+        }
+        uint32_t bits = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+        if (bits == 0)
+            continue;
+
+        uint8_t r[16];
+        _mm_storeu_si128((__m128i *)r, res);
+        while (bits != 0) {
+            const int j = __builtin_ctz(bits);
+            bits &= bits - 1;
+            matches += TeddyConfirm(ctx, pmq, buf, buflen, i + j, r[j], bitarray);
+        }
+    }
+    *pos = i;
+    return matches;
+}
+#endif /* TEDDY_HAVE_SSSE3 */
+
+#ifdef TEDDY_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint32_t TeddyScanAVX2(const SCTeddyCtx *ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, uint32_t buflen, uint32_t *pos, uint8_t *bitarray)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo[TEDDY_MASK_LEN], hi[TEDDY_MASK_LEN];
+    for (int k = 0; k < ctx->mask_len; k++) {
+        lo[k] = _mm256_load_si256((const __m256i *)ctx->lo[k]);
+        hi[k] = _mm256_load_si256((const __m256i *)ctx->hi[k]);
+    }
+
+    uint32_t matches = 0;
+    uint32_t i = *pos;
+    for ( ; i + 32 + ctx->mask_len - 1 <= buflen; i += 32) {
+        __m256i res = _mm256_set1_epi8((char)0xff);
+        for (int k = 0; k < ctx->mask_len; k++) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i + k));
+            const __m256i l = _mm256_and_si256(v, nibble);
+            const __m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            res = _mm256_and_si256(res, _mm256_and_si256(
+                        _mm256_shuffle_epi8(lo[k], l), _mm256_shuffle_epi8(hi[k], h)));
+        }
+        uint32_t bits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+        if (bits == 0)
+            continue;
+
+        uint8_t r[32];
+        _mm256_storeu_si256((__m256i *)r, res);
+        while (bits != 0) {
+            const int j = __builtin_ctz(bits);
+            bits &= bits - 1;
+            matches += TeddyConfirm(ctx, pmq, buf, buflen, i + j, r[j], bitarray);
+        }
+    }
+    *pos = i;
+    return matches;
+}
+#endif /* TEDDY_HAVE_AVX2 */
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx->patterns == NULL || buflen < mpm_ctx->minlen)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    if (teddy_scan != NULL)
+        matches = teddy_scan(ctx, pmq, buf, buflen, &i, bitarray);
+    matches += TeddyScanScalar(ctx, pmq, buf, buflen, i, bitarray);
+    return matches;
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Mask length:     %" PRIu32 "\n", ctx->mask_len);
+    printf("\n");
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+
+#if defined(TEDDY_HAVE_AVX2)
+    if (UtilCpuHasAVX2()) {
+        teddy_scan = TeddyScanAVX2;
+        return;
+    }
+#endif
+#if defined(TEDDY_HAVE_SSSE3)
+    teddy_scan = TeddyScanSSSE3;
+#endif
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+#include "util-mpm-ac.h"
+
+static int TeddySidCompare(const void *a, const void *b)
+{
+    const SigIntId s1 = *(const SigIntId *)a;
+    const SigIntId s2 = *(const SigIntId *)b;
+    return (s1 > s2) - (s1 < s2);
+}
+
+/** \internal
+ *  \brief sorted and unique sids of the pmq */
+static uint32_t TeddySortedSids(PrefilterRuleStore *pmq)
+{
+    if (pmq->rule_id_array_cnt == 0)
+        return 0;
+    qsort(pmq->rule_id_array, pmq->rule_id_array_cnt, sizeof(SigIntId),
+            TeddySidCompare);
+    uint32_t n = 1;
+    for (uint32_t i = 1; i < pmq->rule_id_array_cnt; i++) {
+        if (pmq->rule_id_array[i] != pmq->rule_id_array[n - 1])
+            pmq->rule_id_array[n++] = pmq->rule_id_array[i];
+    }
+    return n;
+}
+
+/**
+ * \test Case sensitive, case insensitive and offset limited patterns,
+ *       matches in the vector part and the scalar tail of the buffer.
+ */
+static int SCTeddyTest01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"BcDe", 4, 0, 0, 1, 1, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 2, 2, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"Xyz", 3, 0, 0, 3, 3, 0);
+    /* only after the first 40 bytes */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"qqq", 3, 40, 0, 4, 4, 0);
+    PmqSetup(&pmq);
+    FAIL_IF(SCTeddyPreparePatterns(&mpm_ctx) != 0);
+
+    const char *buf = "qqq-ABCD-bcde-0123456789012345678901234567890123456789-xyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    /* "qqq" is before its offset, "ABCD" doesn't match the case */
+    FAIL_IF(cnt != 2);
+    FAIL_IF(TeddySortedSids(&pmq) != 2);
+    FAIL_IF(pmq.rule_id_array[0] != 1 || pmq.rule_id_array[1] != 2);
+    PmqReset(&pmq);
+
+    /* match at the very end and a buffer shorter than a vector */
+    buf = "abcdXyz";
+    cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                        (uint8_t *)buf, strlen(buf));
+    FAIL_IF(cnt != 2);
+    FAIL_IF(TeddySortedSids(&pmq) != 2);
+    FAIL_IF(pmq.rule_id_array[0] != 0 || pmq.rule_id_array[1] != 3);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/**
+ * \test Same matches as the ac matcher for random patterns and buffers,
+ *       including more patterns than buckets.
+ */
+static int SCTeddyTest02(void)
+{
+    uint32_t seed = 12345;
+#define TEDDY_RAND() (seed = seed * 1103515245 + 12345, (seed >> 16) & 0x7fff)
+
+    for (int round = 0; round < 50; round++) {
+        MpmCtx teddy_ctx, ac_ctx;
+        MpmThreadCtx teddy_tctx, ac_tctx;
+        PrefilterRuleStore teddy_pmq, ac_pmq;
+
+        memset(&teddy_ctx, 0, sizeof(MpmCtx));
+        memset(&ac_ctx, 0, sizeof(MpmCtx));
+        MpmInitCtx(&teddy_ctx, MPM_TEDDY);
+        MpmInitCtx(&ac_ctx, MPM_AC);
+        MpmInitThreadCtx(&teddy_tctx, MPM_TEDDY);
+        MpmInitThreadCtx(&ac_tctx, MPM_AC);
+        PmqSetup(&teddy_pmq);
+        PmqSetup(&ac_pmq);
+
+        const int npats = 1 + round % 24;
+        for (int n = 0; n < npats; n++) {
+            uint8_t pat[8];
+            const uint16_t len = 1 + TEDDY_RAND() % 6;
+            for (int x = 0; x < len; x++)
+                pat[x] = "abcdABCD\x00\xff"[TEDDY_RAND() % 10];
+            const uint16_t offset = (TEDDY_RAND() % 4 == 0) ? TEDDY_RAND() % 64 : 0;
+            const uint16_t depth = (TEDDY_RAND() % 4 == 0) ? offset + len + TEDDY_RAND() % 64 : 0;
+            if (TEDDY_RAND() % 2) {
+                MpmAddPatternCI(&teddy_ctx, pat, len, offset, depth, n, n, 0);
+                MpmAddPatternCI(&ac_ctx, pat, len, offset, depth, n, n, 0);
+            } else {
+                MpmAddPatternCS(&teddy_ctx, pat, len, offset, depth, n, n, 0);
+                MpmAddPatternCS(&ac_ctx, pat, len, offset, depth, n, n, 0);
+            }
+        }
+        FAIL_IF(mpm_table[MPM_TEDDY].Prepare(&teddy_ctx) != 0);
+        FAIL_IF(mpm_table[MPM_AC].Prepare(&ac_ctx) != 0);
+
+        for (int b = 0; b < 20; b++) {
+            uint8_t buf[300];
+            const uint32_t buflen = TEDDY_RAND() % sizeof(buf);
+            for (uint32_t x = 0; x < buflen; x++)
+                buf[x] = "abcdefABCDEF\x00\xff"[TEDDY_RAND() % 14];
+
+            uint32_t tcnt = mpm_table[MPM_TEDDY].Search(&teddy_ctx, &teddy_tctx,
+                    &teddy_pmq, buf, buflen);
+            uint32_t acnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                    &ac_pmq, buf, buflen);
+            FAIL_IF(tcnt != acnt);
+            const uint32_t tsids = TeddySortedSids(&teddy_pmq);
+            FAIL_IF(tsids != TeddySortedSids(&ac_pmq));
+            FAIL_IF(tsids > 0 && memcmp(teddy_pmq.rule_id_array,
+                        ac_pmq.rule_id_array, tsids * sizeof(SigIntId)) != 0);
+            PmqReset(&teddy_pmq);
+            PmqReset(&ac_pmq);
+        }
+
+        mpm_table[MPM_TEDDY].DestroyCtx(&teddy_ctx);
+        mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+        mpm_table[MPM_TEDDY].DestroyThreadCtx(&teddy_ctx, &teddy_tctx);
+        mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+        PmqFree(&teddy_pmq);
+        PmqFree(&ac_pmq);
+    }
+#undef TEDDY_RAND
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02);
+#endif
+}
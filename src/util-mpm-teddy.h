@@ -0,0 +1,73 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy: shuffle based multi pattern matcher for small pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY_H__
+#define __UTIL_MPM_TEDDY_H__
+
+#include "util-mpm.h"
+
+/** number of buckets, one bit each in the bucket masks */
+#define TEDDY_BUCKETS       8
+/** max number of leading pattern bytes the masks are built from */
+#define TEDDY_MASK_LEN      3
+
+typedef struct SCTeddyPattern_ {
+    /* exact pattern for case sensitive patterns, lowercase otherwise */
+    uint8_t *pat;
+    uint16_t len;
+    uint8_t nocase;
+
+    uint16_t offset;
+    uint16_t depth;
+
+    uint32_t id;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* bucket masks per nibble value of byte k of a match, for the low and
+     * the high nibble. Each table is stored twice, for both 128 bit lanes
+     * of an AVX2 shuffle. */
+    uint8_t lo[TEDDY_MASK_LEN][32] __attribute__((aligned(32)));
+    uint8_t hi[TEDDY_MASK_LEN][32] __attribute__((aligned(32)));
+    /* number of leading bytes used, the length of the shortest pattern
+     * up to TEDDY_MASK_LEN */
+    uint8_t mask_len;
+
+    /* pattern arrays.  We need this only during the preparation */
+    MpmPattern **parray;
+
+    SCTeddyPattern *patterns;
+    /* indexes into patterns per bucket */
+    uint32_t *bucket_pats[TEDDY_BUCKETS];
+    uint32_t bucket_cnt[TEDDY_BUCKETS];
+
+    uint32_t pattern_id_bitarray_size;
+} SCTeddyCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY_H__ */
@@ -32,6 +32,7 @@
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-ks.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -264,6 +265,72 @@ void MpmInitCtx (MpmCtx *mpm_ctx, uint16_t matcher)
     mpm_table[matcher].InitCtx(mpm_ctx);
 }
 
+/**
+ *  \brief invalidate a stream scan state, so the next scan starts over
+ */
+void MpmStreamStateReset(MpmStreamState *state)
+{
+    if (state != NULL) {
+        state->mpm_ctx = NULL;
+        state->history_cnt = 0;
+        state->history_full = false;
+    }
+}
+
+/**
+ *  \brief search a window of a stream
+ *
+ *  Uses the stream state if the matcher supports it and it is for this
+ *  ctx, otherwise it's a normal search.
+ *
+ *  \param state stream scan state, can be NULL
+ *  \param de_version version of the detection engine mpm_ctx is part of
+ *  \param offset stream offset of the first byte of buf
+ */
+uint32_t MpmSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *state, uint32_t de_version,
+        const uint8_t *buf, uint32_t buflen, uint64_t offset)
+{
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+    if (state == NULL || m->SearchStream == NULL) {
+        return m->Search(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+    }
+
+    /* a reloaded engine can reuse the address of a freed ctx */
+    if (state->mpm_ctx != mpm_ctx || state->de_version != de_version) {
+        MpmStreamStateReset(state);
+        state->de_version = de_version;
+    }
+    return m->SearchStream(mpm_ctx, mpm_thread_ctx, pmq, state,
+            buf, buflen, offset);
+}
+
+/**
+ *  \brief search several buffers
+ *
+ *  Uses one call of the matcher if it supports it, otherwise searches
+ *  the buffers one by one.
+ *
+ *  \retval cnt number of matches
+ */
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t **bufs, const uint32_t *buflens,
+        uint32_t cnt)
+{
+    const MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+    if (m->SearchVector != NULL) {
+        return m->SearchVector(mpm_ctx, mpm_thread_ctx, pmq, bufs, buflens, cnt);
+    }
+
+    uint32_t matches = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (buflens[i] == 0)
+            continue;
+        matches += m->Search(mpm_ctx, mpm_thread_ctx, pmq, bufs[i], buflens[i]);
+    }
+    return matches;
+}
+
 /* MPM matcher to use by default, i.e. when "mpm-algo" is set to "auto".
  * If Hyperscan is available, use it. Otherwise, use AC. */
 #ifdef BUILD_HYPERSCAN
@@ -281,6 +348,7 @@ void MpmTableSetup(void)
     MpmACRegister();
     MpmACBSRegister();
     MpmACTileRegister();
+    MpmTeddyRegister();
 #ifdef BUILD_HYPERSCAN
     #ifdef HAVE_HS_VALID_PLATFORM
     /* Enable runtime check for SSSE3. Do not use Hyperscan MPM matcher if
@@ -556,6 +624,9 @@ int MpmAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
 
         mpm_ctx->pattern_cnt++;
 
+        if (offset)
+            mpm_ctx->flags |= MPMCTX_FLAGS_OFFSET;
+
         if (!(mpm_ctx->flags & MPMCTX_FLAGS_NODEPTH)) {
             if (depth) {
                 mpm_ctx->maxdepth = MAX(mpm_ctx->maxdepth, depth);
@@ -619,6 +690,46 @@ error:
 /************************************Unittests*********************************/
 
 #ifdef UNITTESTS
+/** \test vectored search of several buffers with all matchers */
+static int MpmSearchVectorTest01(void)
+{
+    for (uint16_t m = 0; m < MPM_TABLE_SIZE; m++) {
+        if (mpm_table[m].Search == NULL)
+            continue;
+
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PrefilterRuleStore pmq;
+        memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+        memset(&mpm_thread_ctx, 0, sizeof(mpm_thread_ctx));
+        memset(&pmq, 0, sizeof(pmq));
+
+        MpmInitCtx(&mpm_ctx, m);
+        mpm_ctx.flags |= MPMCTX_FLAGS_VECTOR;
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"GET", 3, 0, 0, 0, 0, 0);
+        MpmAddPatternCI(&mpm_ctx, (uint8_t *)"http/1.1", 8, 0, 0, 1, 1, 0);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)"Mozilla", 7, 0, 0, 2, 2, 0);
+        FAIL_IF(mpm_table[m].Prepare(&mpm_ctx) != 0);
+        mpm_table[m].InitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        FAIL_IF(PmqSetup(&pmq) != 0);
+
+        const uint8_t *bufs[] = { (uint8_t *)"GET", (uint8_t *)"",
+            (uint8_t *)"HTTP/1.1" };
+        const uint32_t buflens[] = { 3, 0, 8 };
+        uint32_t cnt = MpmSearchVector(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                bufs, buflens, 3);
+        FAIL_IF_NOT(cnt == 2);
+        FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+        for (uint32_t i = 0; i < pmq.rule_id_array_cnt; i++) {
+            FAIL_IF(pmq.rule_id_array[i] == 2);
+        }
+
+        mpm_table[m].DestroyCtx(&mpm_ctx);
+        mpm_table[m].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void MpmRegisterTests(void)
@@ -626,6 +737,8 @@ void MpmRegisterTests(void)
 #ifdef UNITTESTS
     uint16_t i;
 
+    UtRegisterTest("MpmSearchVectorTest01", MpmSearchVectorTest01);
+
     for (i = 0; i < MPM_TABLE_SIZE; i++) {
         if (i == MPM_NOTSET)
             continue;
@@ -35,7 +35,10 @@ enum {
     MPM_AC,
     MPM_AC_BS,
     MPM_AC_KS,
+    MPM_AC_COMPACT,
     MPM_HS,
+    /* small pattern sets */
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -84,6 +87,12 @@ typedef struct MpmPattern_ {
  * one per sgh. */
 #define MPMCTX_FLAGS_GLOBAL     BIT_U8(0)
 #define MPMCTX_FLAGS_NODEPTH    BIT_U8(1)
+/* At least one pattern has an offset, so matches depend on where in the
+ * buffer the search started. */
+#define MPMCTX_FLAGS_OFFSET     BIT_U8(2)
+/* The ctx is searched with MpmSearchVector, several buffers per call.
+ * Set before Prepare, so the matcher can build for that. */
+#define MPMCTX_FLAGS_VECTOR     BIT_U8(3)
 
 typedef struct MpmCtx_ {
     void *ctx;
@@ -124,6 +133,36 @@ typedef struct MpmCtxFactoryContainer_ {
     int32_t no_of_items;
 } MpmCtxFactoryContainer;
 
+/** number of pattern matches a stream scan state remembers */
+#define MPM_STREAM_STATE_HISTORY    32
+
+typedef struct MpmStreamMatch_ {
+    uint32_t pid;
+    /** stream offset of the first byte of the match */
+    uint64_t offset;
+} MpmStreamMatch;
+
+/** \brief scan state kept between the scans of a stream
+ *
+ *  Successive scans of a stream often share most of their data. The
+ *  matcher then resumes the scan where the previous one ended and gets
+ *  the matches in the shared data from the history. */
+typedef struct MpmStreamState_ {
+    /** ctx the state is for, NULL if it is not valid */
+    const struct MpmCtx_ *mpm_ctx;
+    /** version of the detection engine of mpm_ctx */
+    uint32_t de_version;
+    /** matcher state after the last byte scanned */
+    uint32_t state;
+    /** stream offsets of the window the last scan was for */
+    uint64_t window_start;
+    uint64_t scan_end;
+    /** matches in the window, the scan can't be resumed if they didn't fit */
+    bool history_full;
+    uint16_t history_cnt;
+    MpmStreamMatch history[MPM_STREAM_STATE_HISTORY];
+} MpmStreamState;
+
 /** pattern is case insensitive */
 #define MPM_PATTERN_FLAG_NOCASE     0x01
 /** pattern is negated */
@@ -160,6 +199,20 @@ typedef struct MpmTableElmt_ {
     int  (*AddPatternNocase)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, SigIntId, uint8_t);
     int  (*Prepare)(struct MpmCtx_ *);
     uint32_t (*Search)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *, const uint8_t *, uint32_t);
+    /** optional: search a window of a stream, resuming from and updating
+     *  the state of the previous search of the stream
+     *
+     *  \param offset stream offset of the first byte of the buffer */
+    uint32_t (*SearchStream)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *,
+            MpmStreamState *, const uint8_t *, uint32_t, uint64_t);
+    /** optional: search several buffers in one call. A pattern spanning
+     *  two buffers may match, a false positive for the rule inspection.
+     *
+     *  \param bufs buffers to search
+     *  \param buflens their lengths
+     *  \param cnt number of buffers */
+    uint32_t (*SearchVector)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *,
+            const uint8_t **, const uint32_t *, uint32_t);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
     void (*RegisterUnittests)(void);
@@ -188,6 +241,14 @@ void MpmRegisterTests(void);
 void MpmInitCtx(MpmCtx *mpm_ctx, uint16_t matcher);
 void MpmInitThreadCtx(MpmThreadCtx *mpm_thread_ctx, uint16_t);
 
+void MpmStreamStateReset(MpmStreamState *state);
+uint32_t MpmSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *state, uint32_t de_version,
+        const uint8_t *buf, uint32_t buflen, uint64_t offset);
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t **bufs, const uint32_t *buflens,
+        uint32_t cnt);
+
 int MpmAddPatternCS(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, SigIntId sid, uint8_t flags);
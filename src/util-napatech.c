@@ -921,6 +921,119 @@ static uint32_t GetStreamNUMAs(uint32_t stream_id, int stream_numas[])
     return hStat.u.usageData_v0.data.numHostBufferUsed;
 }
 
+/**
+ * \brief get the adapter a port is on
+ *
+ * \retval adapter number or -1 on error
+ */
+int NapatechGetAdapter(uint8_t port)
+{
+    NtInfoStream_t info_stream;
+    NtInfo_t info;
+    int status;
+
+    if ((status = NT_InfoOpen(&info_stream, "SuricataPortInfo")) != NT_SUCCESS) {
+        NAPATECH_ERROR(SC_ERR_NAPATECH_INIT_FAILED, status);
+        return -1;
+    }
+
+    info.cmd = NT_INFO_CMD_READ_PORT_V9;
+    info.u.port_v9.portNo = port;
+    if ((status = NT_InfoRead(info_stream, &info)) != NT_SUCCESS) {
+        NAPATECH_ERROR(SC_ERR_NAPATECH_INIT_FAILED, status);
+        NT_InfoClose(info_stream);
+        return -1;
+    }
+
+    NT_InfoClose(info_stream);
+    return info.u.port_v9.data.adapterNo;
+}
+
+#ifdef NAPATECH_ENABLE_BYPASS
+/* NTPL ids of the key types, key definitions and filters of the
+ * hardware bypass */
+#define BYPASS_NTPL_MAX 6
+static uint32_t bypass_ntpl_ids[BYPASS_NTPL_MAX];
+static int bypass_ntpl_cnt = 0;
+
+static bool NapatechBypassNTPL(NtConfigStream_t hconfig, const char *ntpl_cmd)
+{
+    NtNtplInfo_t ntpl_info;
+    int status;
+
+    if (bypass_ntpl_cnt == BYPASS_NTPL_MAX) {
+        return false;
+    }
+    if ((status = NT_NTPL(hconfig, ntpl_cmd, &ntpl_info,
+            NT_NTPL_PARSER_VALIDATE_NORMAL)) != NT_SUCCESS) {
+        NAPATECH_NTPL_ERROR(ntpl_cmd, ntpl_info, status);
+        return false;
+    }
+    bypass_ntpl_ids[bypass_ntpl_cnt++] = ntpl_info.ntplId;
+    return true;
+}
+
+/**
+ * \brief drop the flows learned by NapatechBypassCallback in the adapter
+ *
+ * Keys are the sorted addresses and ports, so both directions of a flow
+ * match the one entry. Matching packets go to the drop stream, with a
+ * higher priority than the assignment of the traffic to our streams.
+ *
+ * \param ports_spec ports clause of the assignment, "all" for all ports
+ */
+static bool NapatechSetupBypass(NtConfigStream_t hconfig, const char *ports_spec)
+{
+    char ports_cond[80] = "";
+    char ntpl_cmd[512];
+
+    if (strcmp(ports_spec, "all") != 0) {
+        snprintf(ports_cond, sizeof(ports_cond), "%s and ", ports_spec);
+    }
+
+    if (!NapatechBypassNTPL(hconfig, "KeyType[name=KT_SURI_IPV4]={sw_32_32,sw_16_16}") ||
+            !NapatechBypassNTPL(hconfig, "KeyType[name=KT_SURI_IPV6]={sw_128_128,sw_16_16}") ||
+            !NapatechBypassNTPL(hconfig, "KeyDef[name=KDEF_SURI_IPV4;KeyType=KT_SURI_IPV4;"
+                "IpProtocolField=Outer;KeySort=Sorted]="
+                "(Layer3Header[12]/32/32,Layer4Header[0]/16/16)") ||
+            !NapatechBypassNTPL(hconfig, "KeyDef[name=KDEF_SURI_IPV6;KeyType=KT_SURI_IPV6;"
+                "IpProtocolField=Outer;KeySort=Sorted]="
+                "(Layer3Header[8]/128/128,Layer4Header[0]/16/16)")) {
+        goto error;
+    }
+
+    snprintf(ntpl_cmd, sizeof(ntpl_cmd), "assign[priority=0;streamid=drop]="
+            "%sLayer3Protocol==IPV4 and Layer4Protocol==TCP,UDP and "
+            "Key(KDEF_SURI_IPV4,KeyID=%d)==%d", ports_cond,
+            NAPATECH_KEYTYPE_IPV4, NAPATECH_FLOWTYPE_DROP);
+    if (!NapatechBypassNTPL(hconfig, ntpl_cmd)) {
+        goto error;
+    }
+    snprintf(ntpl_cmd, sizeof(ntpl_cmd), "assign[priority=0;streamid=drop]="
+            "%sLayer3Protocol==IPV6 and Layer4Protocol==TCP,UDP and "
+            "Key(KDEF_SURI_IPV6,KeyID=%d)==%d", ports_cond,
+            NAPATECH_KEYTYPE_IPV6, NAPATECH_FLOWTYPE_DROP);
+    if (!NapatechBypassNTPL(hconfig, ntpl_cmd)) {
+        goto error;
+    }
+    return true;
+
+error:
+    NapatechDeleteBypassFilters();
+    return false;
+}
+
+/**
+ * \brief remove the filters of the hardware bypass, newest first
+ */
+void NapatechDeleteBypassFilters(void)
+{
+    while (bypass_ntpl_cnt > 0) {
+        NapatechDeleteFilter(bypass_ntpl_ids[--bypass_ntpl_cnt]);
+    }
+}
+#endif /* NAPATECH_ENABLE_BYPASS */
+
 uint32_t NapatechSetupTraffic(uint32_t first_stream, uint32_t last_stream,
         uint32_t *filter_id, uint32_t *hash_id)
 {
@@ -1004,8 +1117,8 @@ uint32_t NapatechSetupTraffic(uint32_t first_stream, uint32_t last_stream,
         }
     }
 
-    /* Build the NTPL command */
-    snprintf(ntpl_cmd, sizeof(ntpl_cmd), "assign[streamid=(%d..%d)] = %s",
+    /* Build the NTPL command, below the priority of the bypass filters */
+    snprintf(ntpl_cmd, sizeof(ntpl_cmd), "assign[priority=1;streamid=(%d..%d)] = %s",
             first_stream, last_stream, ports_spec);
 
     NtNtplInfo_t ntpl_info;
@@ -1015,6 +1128,14 @@ uint32_t NapatechSetupTraffic(uint32_t first_stream, uint32_t last_stream,
         exit(EXIT_FAILURE);
     }
 
+#ifdef NAPATECH_ENABLE_BYPASS
+    if (NapatechUseHWBypass() && !NapatechSetupBypass(hconfig, ports_spec)) {
+        SCLogError(SC_ERR_NAPATECH_INIT_FAILED,
+                "Failed to set up the Napatech hardware bypass filters.");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     if ((status = NT_NTPL(hconfig, ntpl_cmd, &ntpl_info,
             NT_NTPL_PARSER_VALIDATE_NORMAL)) == NT_SUCCESS) {
         *filter_id = ntpl_info.ntplId;
@@ -32,6 +32,10 @@ typedef struct NapatechPacketVars_ {
     uint64_t stream_id;
     NtNetBuf_t nt_packet_buf;
     ThreadVars *tv;
+#ifdef NAPATECH_ENABLE_BYPASS
+    /* flow stream of the receiving thread, NULL without hardware bypass */
+    NtFlowStream_t *flow_stream;
+#endif
 } NapatechPacketVars;
 
 typedef struct NapatechStreamConfig_ {
@@ -48,6 +52,14 @@ typedef struct NapatechCurrentStats_ {
 
 #define MAX_STREAMS 256
 
+#ifdef NAPATECH_ENABLE_BYPASS
+/* KeyID of the key definitions and key set of the bypassed flows, as
+ * used in the NTPL filters and the learned flows */
+#define NAPATECH_KEYTYPE_IPV4   3
+#define NAPATECH_KEYTYPE_IPV6   4
+#define NAPATECH_FLOWTYPE_DROP  7
+#endif
+
 extern void NapatechStartStats(void);
 
 
@@ -81,5 +93,9 @@ int NapatechGetStreamConfig(NapatechStreamConfig stream_config[]);
 bool NapatechSetupNuma(uint32_t stream, uint32_t numa);
 uint32_t NapatechSetupTraffic(uint32_t first_stream, uint32_t last_stream, uint32_t *filter_id, uint32_t *hash_id);
 bool NapatechDeleteFilter(uint32_t filter_id);
+int NapatechGetAdapter(uint8_t port);
+#ifdef NAPATECH_ENABLE_BYPASS
+void NapatechDeleteBypassFilters(void);
+#endif
 #endif //HAVE_NAPATECH
 #endif /* __UTIL_NAPATECH_H__ */
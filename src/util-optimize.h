@@ -48,5 +48,14 @@
  */
 #define hw_barrier() __sync_synchronize()
 
+/** Hint the CPU that the cache line of addr will be read soon */
+#if CPPCHECK==1
+#define prefetch(addr)
+#else
+#ifndef prefetch
+#define prefetch(addr) __builtin_prefetch((addr), 0, 3)
+#endif
+#endif
+
 #endif /* __UTIL_OPTIMIZE_H__ */
 
@@ -24,7 +24,12 @@
  */
 
 #include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
 #include "util-pages.h"
+#include "util-misc.h"
+#include "util-unittest.h"
 
 #ifndef HAVE_PAGESUPPORTSRWX_AS_MACRO
 
@@ -55,3 +60,251 @@ int PageSupportsRWX(void)
 }
 #endif /* HAVE_PAGESUPPORTSRWX_AS_MACRO */
 
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+#define HAVE_PAGE_HUGETLB 1
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+#endif
+
+#define PAGE_HUGE_2MB   (2UL * 1024 * 1024)
+#define PAGE_HUGE_1GB   (1024UL * 1024 * 1024)
+
+/** huge page mappings, to unmap them with the size they were mapped with */
+#define PAGE_HUGE_TABLES_MAX    64
+
+typedef struct PageHugeTable_ {
+    void *ptr;
+    size_t size;
+} PageHugeTable;
+
+static struct {
+    bool enabled;
+    size_t size;
+    /** the last mapping failed, warned about it */
+    bool warned;
+    uint64_t memuse;
+    uint64_t fallbacks;
+    PageHugeTable tables[PAGE_HUGE_TABLES_MAX];
+} page_huge = { false, PAGE_HUGE_2MB, false, 0, 0, { { NULL, 0 } } };
+static SCMutex page_huge_lock = SCMUTEX_INITIALIZER;
+
+/** \brief set up huge pages from the 'huge-pages' config
+ *
+ *  Has to be called before the first PageAllocTable(). */
+void PageHugeInitConfig(void)
+{
+    int enabled = 0;
+    (void)ConfGetBool("huge-pages.enabled", &enabled);
+    if (!enabled)
+        return;
+
+    const char *str = NULL;
+    if (ConfGet("huge-pages.size", &str) == 1 && str != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(str, &size) < 0 ||
+                (size != PAGE_HUGE_2MB && size != PAGE_HUGE_1GB)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid value for "
+                    "huge-pages.size: %s, should be 2mb or 1gb", str);
+            exit(EXIT_FAILURE);
+        }
+        page_huge.size = (size_t)size;
+    }
+#ifdef HAVE_PAGE_HUGETLB
+    page_huge.enabled = true;
+    SCLogConfig("huge pages of %"PRIuMAX" kB enabled for the flow, host, "
+            "ippair and defrag hashes and the packet pools",
+            (uintmax_t)page_huge.size / 1024);
+#else
+    SCLogWarning(SC_ERR_NOT_SUPPORTED, "huge-pages: not supported on "
+            "this platform, using normal pages");
+#endif
+}
+
+bool PageHugeEnabled(void)
+{
+    return page_huge.enabled;
+}
+
+static uint64_t PageHugeMemuseCounter(void)
+{
+    SCMutexLock(&page_huge_lock);
+    uint64_t memuse = page_huge.memuse;
+    SCMutexUnlock(&page_huge_lock);
+    return memuse;
+}
+
+static uint64_t PageHugeFallbacksCounter(void)
+{
+    SCMutexLock(&page_huge_lock);
+    uint64_t fallbacks = page_huge.fallbacks;
+    SCMutexUnlock(&page_huge_lock);
+    return fallbacks;
+}
+
+void PageHugeRegisterCounters(void)
+{
+    if (!page_huge.enabled)
+        return;
+    StatsRegisterGlobalCounter("memory.huge_pages.memuse",
+            PageHugeMemuseCounter);
+    StatsRegisterGlobalCounter("memory.huge_pages.fallbacks",
+            PageHugeFallbacksCounter);
+}
+
+#ifdef HAVE_PAGE_HUGETLB
+/** \internal
+ *  \brief map a table in huge pages
+ *
+ *  Tables smaller than half a huge page aren't worth the waste. The
+ *  mapping fails if not enough huge pages are reserved, see
+ *  /proc/sys/vm/nr_hugepages.
+ *
+ *  \retval ptr mapping or NULL to fall back to normal pages
+ */
+static void *PageHugeAlloc(size_t size)
+{
+    if (size < page_huge.size / 2)
+        return NULL;
+    const size_t huge_size = (size + page_huge.size - 1) & ~(page_huge.size - 1);
+    const int flags = MAP_ANON|MAP_PRIVATE|MAP_HUGETLB|
+        ((page_huge.size == PAGE_HUGE_1GB ? 30 : 21) << MAP_HUGE_SHIFT);
+
+    SCMutexLock(&page_huge_lock);
+    PageHugeTable *t = NULL;
+    for (int i = 0; i < PAGE_HUGE_TABLES_MAX; i++) {
+        if (page_huge.tables[i].ptr == NULL) {
+            t = &page_huge.tables[i];
+            break;
+        }
+    }
+    void *ptr = MAP_FAILED;
+    if (t != NULL) {
+        ptr = mmap(NULL, huge_size, PROT_READ|PROT_WRITE, flags, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        page_huge.fallbacks++;
+        if (!page_huge.warned) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "huge-pages: mapping %"PRIuMAX
+                    " bytes failed: %s, using normal pages", (uintmax_t)huge_size,
+                    t != NULL ? strerror(errno) : "too many tables");
+            page_huge.warned = true;
+        }
+        SCMutexUnlock(&page_huge_lock);
+        return NULL;
+    }
+    t->ptr = ptr;
+    t->size = huge_size;
+    page_huge.memuse += huge_size;
+    SCMutexUnlock(&page_huge_lock);
+    return ptr;
+}
+
+/** \internal
+ *  \retval true if ptr was a huge page table, it's unmapped */
+static bool PageHugeFree(void *ptr)
+{
+    bool found = false;
+    SCMutexLock(&page_huge_lock);
+    for (int i = 0; i < PAGE_HUGE_TABLES_MAX; i++) {
+        PageHugeTable *t = &page_huge.tables[i];
+        if (t->ptr == ptr) {
+            munmap(t->ptr, t->size);
+            page_huge.memuse -= t->size;
+            t->ptr = NULL;
+            t->size = 0;
+            found = true;
+            break;
+        }
+    }
+    SCMutexUnlock(&page_huge_lock);
+    return found;
+}
+#endif /* HAVE_PAGE_HUGETLB */
+
+/** \brief allocate zeroed memory for a big table
+ *
+ *  Anonymous mappings come zeroed from the kernel and are only backed
+ *  by memory as the pages are touched, so unlike calloc and memset the
+ *  allocation doesn't touch all of the table up front. The memory is
+ *  page aligned.
+ *
+ *  With huge pages enabled the table is mapped in huge pages if it is
+ *  big enough. If that fails, normal pages are used and the kernel is
+ *  asked to back them with transparent huge pages.
+ *
+ *  \param size size in bytes
+ *  \retval ptr zeroed memory or NULL, to be freed with PageFreeTable()
+ */
+void *PageAllocTable(size_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+#ifdef HAVE_PAGE_HUGETLB
+    if (page_huge.enabled) {
+        void *ptr = PageHugeAlloc(size);
+        if (ptr != NULL)
+            return ptr;
+    }
+#endif
+    void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+            MAP_ANON|MAP_PRIVATE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "mmap of %"PRIuMAX" bytes failed: %s",
+                (uintmax_t)size, strerror(errno));
+        return NULL;
+    }
+#if defined(HAVE_PAGE_HUGETLB) && defined(MADV_HUGEPAGE)
+    if (page_huge.enabled) {
+        (void)madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+#else
+    return SCCalloc(1, size);
+#endif
+}
+
+/** \brief free a table allocated by PageAllocTable()
+ *  \param size the size it was allocated with */
+void PageFreeTable(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+#ifdef HAVE_SYS_MMAN_H
+#ifdef HAVE_PAGE_HUGETLB
+    if (page_huge.enabled && PageHugeFree(ptr))
+        return;
+#endif
+    munmap(ptr, size);
+#else
+    SCFree(ptr);
+#endif
+}
+
+#ifdef UNITTESTS
+/** \test tables fall back to normal pages and are zeroed either way */
+static int PageTest01(void)
+{
+    const bool enabled = page_huge.enabled;
+    page_huge.enabled = true;
+
+    const size_t sizes[] = { 4096, PAGE_HUGE_2MB / 2, PAGE_HUGE_2MB + 1 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t *ptr = PageAllocTable(sizes[i]);
+        FAIL_IF_NULL(ptr);
+        FAIL_IF_NOT(ptr[0] == 0 && ptr[sizes[i] - 1] == 0);
+        memset(ptr, 0xff, sizes[i]);
+        PageFreeTable(ptr, sizes[i]);
+    }
+    page_huge.enabled = enabled;
+    FAIL_IF_NOT(PageHugeMemuseCounter() == 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PageRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PageTest01", PageTest01);
+#endif
+}
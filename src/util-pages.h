@@ -41,4 +41,13 @@
     #endif /* HAVE_SYS_MMAN_H */
 #endif
 
+void PageHugeInitConfig(void);
+bool PageHugeEnabled(void);
+void PageHugeRegisterCounters(void);
+
+void *PageAllocTable(size_t size);
+void PageFreeTable(void *ptr, size_t size);
+
+void PageRegisterTests(void);
+
 #endif /* __UTIL_PAGES_H__ */
@@ -35,6 +35,7 @@
 #include "util-byte.h"
 #include "util-profiling.h"
 #include "util-profiling-locks.h"
+#include "util-path.h"
 
 #ifdef PROFILING
 
@@ -81,6 +82,8 @@ extern int profiling_output_to_file;
 int profiling_rules_enabled = 0;
 static char profiling_file_name[PATH_MAX] = "";
 static const char *profiling_file_mode = "a";
+/* cost profile for the rule ordering, see detect.cost-profile */
+static char profiling_cost_file_name[PATH_MAX] = "";
 #ifdef HAVE_LIBJANSSON
 static int profiling_rule_json = 0;
 #endif
@@ -184,6 +187,17 @@ void SCProfilingRulesGlobalInit(void)
 
                 profiling_output_to_file = 1;
             }
+            const char *cost_filename = ConfNodeLookupChildValue(conf, "cost-profile");
+            if (cost_filename != NULL) {
+                if (PathIsAbsolute(cost_filename)) {
+                    strlcpy(profiling_cost_file_name, cost_filename,
+                            sizeof(profiling_cost_file_name));
+                } else {
+                    snprintf(profiling_cost_file_name,
+                            sizeof(profiling_cost_file_name), "%s/%s",
+                            ConfigGetLogDirectory(), cost_filename);
+                }
+            }
             if (ConfNodeChildValueIsTrue(conf, "json")) {
 #ifdef HAVE_LIBJANSSON
                 profiling_rule_json = 1;
@@ -428,6 +442,41 @@ static void DumpText(FILE *fp, SCProfileSummary *summary,
  *
  * \param de_ctx The active DetectEngineCtx, used to get at the loaded rules.
  */
+/**
+ * \brief Write the cost profile, to be used as detect.cost-profile for the
+ *        ordering of the rules by the next detection engine.
+ *
+ * Written to a temporary file that is then renamed, so that an engine
+ * being loaded never reads a partial profile.
+ */
+static void DumpCostProfile(const SCProfileSummary *summary, uint32_t count)
+{
+    char tmp_name[PATH_MAX];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp",
+                profiling_cost_file_name) >= (int)sizeof(tmp_name))
+        return;
+
+    FILE *fp = fopen(tmp_name, "w");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", tmp_name,
+                strerror(errno));
+        return;
+    }
+    fprintf(fp, "# gid sid rev checks matches ticks\n");
+    for (uint32_t i = 0; i < count; i++) {
+        if (summary[i].checks == 0)
+            continue;
+        fprintf(fp, "%"PRIu32" %"PRIu32" %"PRIu32" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+                summary[i].gid, summary[i].sid, summary[i].rev,
+                summary[i].checks, summary[i].matches, summary[i].ticks);
+    }
+    if (fclose(fp) != 0 || rename(tmp_name, profiling_cost_file_name) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to write %s: %s",
+                profiling_cost_file_name, strerror(errno));
+        unlink(tmp_name);
+    }
+}
+
 static void
 SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
 {
@@ -490,6 +539,10 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
         total_ticks += summary[i].ticks;
     }
 
+    if (profiling_cost_file_name[0] != '\0') {
+        DumpCostProfile(summary, count);
+    }
+
     int *order = profiling_rules_sort_orders;
     while (*order != -1) {
         const char *sort_desc = NULL;
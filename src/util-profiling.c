@@ -1311,6 +1311,7 @@ const char * PacketProfileLoggertIdToString(LoggerId id)
         CASE_CODE (LOGGER_JSON_DNP3_TC);
         CASE_CODE (LOGGER_JSON_HTTP);
         CASE_CODE (LOGGER_JSON_DHCP);
+        CASE_CODE (LOGGER_JSON_QUIC);
         CASE_CODE (LOGGER_JSON_KRB5);
         CASE_CODE (LOGGER_JSON_IKEV2);
         CASE_CODE (LOGGER_JSON_TFTP);
@@ -21,6 +21,12 @@
  * \author Anoop Saldanha <anoopsaldanha@gmail.com>
  *
  * Implementation of radix trees
+ *
+ * The tree is a path compressed binary trie of prefixes. All nodes of a
+ * tree live in one array and link to each other by index, and each node
+ * keeps its full prefix as two 64 bit words, so that checking a node is
+ * a couple of word compares instead of a per bit walk. A lookup visits
+ * only the nodes where prefixes of the tree diverge or end.
  */
 
 #include "suricata-common.h"
@@ -31,386 +37,124 @@
 #include "util-unittest.h"
 #include "util-memcmp.h"
 
-/**
- * \brief Allocates and returns a new instance of SCRadixUserData.
- *
- * \param netmask The netmask entry (cidr) that has to be made in the new
- *                SCRadixUserData instance
- * \param user    The user data that has to be set for the above
- *                netmask in the newly created SCRadixUserData instance.
- *
- * \retval user_data Pointer to a new instance of SCRadixUserData.
- */
-static SCRadixUserData *SCRadixAllocSCRadixUserData(uint8_t netmask, void *user)
-{
-    SCRadixUserData *user_data = SCMalloc(sizeof(SCRadixUserData));
-    if (unlikely(user_data == NULL)) {
-        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
-        return NULL;
-    }
-
-    memset(user_data, 0, sizeof(SCRadixUserData));
-
-    user_data->netmask = netmask;
-    user_data->user = user;
-
-    return user_data;
-}
-
-/**
- * \brief Deallocates an instance of SCRadixUserData.
- *
- * \param user_data Pointer to the instance of SCRadixUserData that has to be
- *                  freed.
- */
-static void SCRadixDeAllocSCRadixUserData(SCRadixUserData *user_data)
-{
-    SCFree(user_data);
-
-    return;
-}
-
-/**
- * \brief Appends a user_data instance(SCRadixUserData) to a
- *        user_data(SCRadixUserData) list.  We add the new entry in descending
- *        order with respect to the netmask contained in the SCRadixUserData.
- *
- * \param new  Pointer to the SCRadixUserData to be added to the list.
- * \param list Pointer to the SCRadixUserData list head, to which "new" has to
- *             be appended.
- */
-static void SCRadixAppendToSCRadixUserDataList(SCRadixUserData *new,
-                                               SCRadixUserData **list)
-{
-    SCRadixUserData *temp = NULL;
-    SCRadixUserData *prev = NULL;
-
-    if (new == NULL || list == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS, "new or list supplied as NULL");
-        exit(EXIT_FAILURE);
-    }
-
-    /* add to the list in descending order.  The reason we do this is for
-     * optimizing key retrieval for a ip key under a netblock */
-    prev = temp = *list;
-    while (temp != NULL) {
-        if (new->netmask > temp->netmask)
-            break;
-        prev = temp;
-        temp = temp->next;
-    }
-
-    if (temp == *list) {
-        new->next = *list;
-        *list = new;
-    } else {
-        new->next = prev->next;
-        prev->next = new;
-    }
-
-    return;
-}
-
-/**
- * \brief Creates a new Prefix for a key.  Used internally by the API.
- *
- * \param key_stream Data that has to be wrapped in a SCRadixPrefix instance to
- *                   be processed for insertion/lookup/removal of a node by the
- *                   radix tree
- * \param key_bitlen The bitlen of the the above stream.  For example if the
- *                   stream holds the ipv4 address(4 bytes), bitlen would be 32
- * \param user       Pointer to the user data that has to be associated with
- *                   this key
- *
- * \retval prefix The newly created prefix instance on success; NULL on failure
- */
-static SCRadixPrefix *SCRadixCreatePrefix(uint8_t *key_stream,
-                                          uint16_t key_bitlen, void *user,
-                                          uint8_t netmask)
-{
-    SCRadixPrefix *prefix = NULL;
-
-    if ((key_bitlen % 8 != 0)) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid argument bitlen - %d",
-                   key_bitlen);
-        return NULL;
-    }
-
-    if (key_stream == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "Argument \"stream\" NULL");
-        return NULL;
-    }
-
-    if ( (prefix = SCMalloc(sizeof(SCRadixPrefix))) == NULL)
-        goto error;
-
-    memset(prefix, 0, sizeof(SCRadixPrefix));
-
-    if ( (prefix->stream = SCMalloc(key_bitlen / 8)) == NULL)
-        goto error;
-
-    memset(prefix->stream, 0, key_bitlen / 8);
-
-    memcpy(prefix->stream, key_stream, key_bitlen / 8);
-    prefix->bitlen = key_bitlen;
-
-    prefix->user_data = SCRadixAllocSCRadixUserData(netmask, user);
-    if (prefix->user_data == NULL) {
-        goto error;
-    }
-
-    return prefix;
-
-error:
-    if (prefix != NULL) {
-        if (prefix->stream != NULL) {
-            SCFree(prefix->stream);
-        }
-        SCFree(prefix);
-    }
-
-    return NULL;
-}
+/** initial number of nodes allocated for a tree */
+#define SC_RADIX_NODES_INIT 64
 
 /**
- * \brief Adds a netmask and its user_data for a particular prefix stream.
+ * \brief Load a key into the left aligned two word form used by the nodes
  *
- * \param prefix  The prefix stream to which the netmask and its corresponding
- *                user data has to be added.
- * \param netmask The netmask value (cidr) that has to be added to the prefix.
- * \param user    The pointer to the user data corresponding to the above
- *                netmask.
+ * \param key_stream the key, in network order for IP addresses
+ * \param bytes      length of the key, at most SC_RADIX_KEY_MAX_BYTES
+ * \param key        the loaded key
  */
-static void SCRadixAddNetmaskUserDataToPrefix(SCRadixPrefix *prefix,
-                                              uint8_t netmask,
-                                              void *user)
+static inline void SCRadixKeyLoad(const uint8_t *key_stream, const uint16_t bytes,
+                                  uint64_t key[2])
 {
-    if (prefix == NULL || user == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS, "prefix or user NULL");
-        exit(EXIT_FAILURE);
-    }
-
-    SCRadixAppendToSCRadixUserDataList(SCRadixAllocSCRadixUserData(netmask, user),
-                                       &prefix->user_data);
-
-    return;
+    key[0] = key[1] = 0;
+    for (uint16_t i = 0; i < bytes; i++)
+        key[i / 8] |= (uint64_t)key_stream[i] << (56 - (i % 8) * 8);
 }
 
 /**
- * \brief Removes a particular user_data corresponding to a particular netmask
- *        entry, from a prefix.
- *
- * \param prefix  Pointer to the prefix from which the user_data/netmask entry
- *                has to be removed.
- * \param netmask The netmask value (cidr) whose user_data has to be deleted.
+ * \brief Clear the bits of a key past bitlen
  */
-static void SCRadixRemoveNetmaskUserDataFromPrefix(SCRadixPrefix *prefix,
-                                                   uint8_t netmask)
+static inline void SCRadixKeyMask(uint64_t key[2], const uint8_t bitlen)
 {
-    SCRadixUserData *temp = NULL, *prev = NULL;
-
-    if (prefix == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS, "prefix NULL");
-        exit(EXIT_FAILURE);
+    if (bitlen == 0) {
+        key[0] = key[1] = 0;
+    } else if (bitlen < 64) {
+        key[0] &= ~0ULL << (64 - bitlen);
+        key[1] = 0;
+    } else if (bitlen == 64) {
+        key[1] = 0;
+    } else if (bitlen < 128) {
+        key[1] &= ~0ULL << (128 - bitlen);
     }
-
-    prev = temp = prefix->user_data;
-    while (temp != NULL) {
-        if (temp->netmask == netmask) {
-            if (temp == prefix->user_data)
-                prefix->user_data = temp->next;
-            else
-                prev->next = temp->next;
-
-            SCRadixDeAllocSCRadixUserData(temp);
-            break;
-        }
-        prev = temp;
-        temp = temp->next;
-    }
-
-    return;
 }
 
 /**
- * \brief Indicates if prefix contains an entry for an ip with a specific netmask.
- *
- * \param prefix  Pointer to the ip prefix that is being checked.
- * \param netmask The netmask value (cidr) that has to be checked for
- *                presence in the prefix.
- *
- * \retval 1 On match.
- * \retval 0 On no match.
+ * \brief Number of leading bits two keys have in common
  */
-static int SCRadixPrefixContainNetmask(SCRadixPrefix *prefix, uint8_t netmask)
+static inline uint8_t SCRadixKeyCommonBits(const uint64_t a[2], const uint64_t b[2])
 {
-    SCRadixUserData *user_data = NULL;
-
-    if (prefix == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "prefix is NULL");
-        goto no_match;
-    }
-
-    user_data = prefix->user_data;
-    while (user_data != NULL) {
-        if (user_data->netmask == netmask)
-            return 1;
-        user_data = user_data->next;
-    }
-
- no_match:
-    return 0;
+    uint64_t x = a[0] ^ b[0];
+    if (x != 0)
+        return (uint8_t)__builtin_clzll(x);
+    x = a[1] ^ b[1];
+    if (x != 0)
+        return (uint8_t)(64 + __builtin_clzll(x));
+    return 128;
 }
 
 /**
- * \brief Returns the total netmask count for this prefix.
- *
- * \param prefix Pointer to the prefix
- *
- * \retval count The total netmask count for this prefix.
+ * \brief Value of the bit at position pos, counting from the left
  */
-static int SCRadixPrefixNetmaskCount(SCRadixPrefix *prefix)
+static inline int SCRadixKeyBit(const uint64_t key[2], const uint8_t pos)
 {
-    SCRadixUserData *user_data = NULL;
-    uint32_t count = 0;
-
-    if (prefix == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "prefix is NULL");
-        return 0;
-    }
-
-    user_data = prefix->user_data;
-    while (user_data != NULL) {
-        count++;
-        user_data = user_data->next;
-    }
-
-    return count;
+    if (pos < 64)
+        return (int)((key[0] >> (63 - pos)) & 1);
+    return (int)((key[1] >> (127 - pos)) & 1);
 }
 
 /**
- * \brief Indicates if prefix contains an entry for an ip with a specific netmask
- *        and if it does, it sets the user data field
- *        SCRadixPrefix->user_data_result to the netmask user_data entry.
- *
- * \param prefix      Pointer to the ip prefix that is being checked.
- * \param netmask     The netmask value for which we will have to return the user_data
- * \param exact_match Bool flag which indicates if we should check if the prefix
- *                    holds proper netblock(< 32 for ipv4 and < 128 for ipv6) or not.
+ * \brief Get a node from the free list or the node array, growing the
+ *        array if needed. This may move the array, so node pointers taken
+ *        before the call have to be looked up again.
  *
- * \retval 1 On match.
- * \retval 0 On no match.
+ * \retval idx index of the cleared node, 0 on error
  */
-static int SCRadixPrefixContainNetmaskAndSetUserData(SCRadixPrefix *prefix,
-                                                     uint16_t netmask,
-                                                     int exact_match,
-                                                     void **user_data_result)
+static uint32_t SCRadixNodeAlloc(SCRadixTree *tree)
 {
-    SCRadixUserData *user_data = NULL;
+    uint32_t idx;
 
-    if (prefix == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "prefix is NULL");
-        goto no_match;
-    }
-
-    user_data = prefix->user_data;
-    /* Check if we have a match for an exact ip.  An exact ip as in not a proper
-     * netblock, i.e. an ip with a netmask of 32(ipv4) or 128(ipv6) */
-    if (exact_match) {
-        if (user_data->netmask == netmask) {
-            if (user_data_result)
-                *user_data_result = user_data->user;
-            return 1;
-        } else {
-            goto no_match;
-        }
-    }
-
-    /* Check for the user_data entry for this netmask_value */
-    while (user_data != NULL) {
-        if (user_data->netmask == netmask) {
-            if (user_data_result)
-                *user_data_result = user_data->user;
-            return 1;
-        }
-        user_data = user_data->next;
-    }
-
-no_match:
-    if (user_data_result != NULL)
-        *user_data_result = NULL;
-    return 0;
-}
-
-/**
- * \brief Frees a SCRadixPrefix instance
- *
- * \param prefix Pointer to a prefix instance
- * \param tree   Pointer to the Radix tree to which this prefix belongs
- */
-static void SCRadixReleasePrefix(SCRadixPrefix *prefix, SCRadixTree *tree)
-{
-    SCRadixUserData *user_data_temp1 = NULL;
-    SCRadixUserData *user_data_temp2 = NULL;
-
-    if (prefix != NULL) {
-        if (prefix->stream != NULL)
-            SCFree(prefix->stream);
-
-        user_data_temp1 = prefix->user_data;
-        if (tree->Free != NULL) {
-            while (user_data_temp1 != NULL) {
-                user_data_temp2 = user_data_temp1;
-                user_data_temp1 = user_data_temp1->next;
-                tree->Free(user_data_temp2->user);
-                SCRadixDeAllocSCRadixUserData(user_data_temp2);
+    if (tree->free_list != 0) {
+        idx = tree->free_list;
+        tree->free_list = tree->nodes[idx].child[0];
+    } else {
+        if (tree->nodes_next >= tree->nodes_size) {
+            uint32_t size = tree->nodes_size ? tree->nodes_size * 2 : SC_RADIX_NODES_INIT;
+            if (size <= tree->nodes_size) {
+                SCLogError(SC_ERR_MEM_ALLOC, "radix tree too large");
+                return 0;
+            }
+            SCRadixNode *ptr = SCRealloc(tree->nodes, (size_t)size * sizeof(SCRadixNode));
+            if (ptr == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Fatal error encountered in "
+                        "SCRadixNodeAlloc. Mem not allocated...");
+                return 0;
             }
-        } else if (user_data_temp1 != NULL) {
-            SCFree(user_data_temp1);
+            tree->nodes = ptr;
+            tree->nodes_size = size;
         }
-
-        SCFree(prefix);
+        idx = tree->nodes_next++;
     }
 
-    return;
+    memset(&tree->nodes[idx], 0, sizeof(SCRadixNode));
+    tree->node_cnt++;
+    return idx;
 }
 
 /**
- * \brief Creates a new node for the Radix tree
- *
- * \retval node The newly created node for the radix tree
+ * \brief Put a node on the free list. The user data is not freed.
  */
-static inline SCRadixNode *SCRadixCreateNode(void)
+static void SCRadixNodeFree(SCRadixTree *tree, const uint32_t idx)
 {
-    SCRadixNode *node = NULL;
-
-    if ( (node = SCMalloc(sizeof(SCRadixNode))) == NULL) {
-        SCLogError(SC_ERR_FATAL, "Fatal error encountered in SCRadixCreateNode. Mem not allocated...");
-        return NULL;
-    }
-    memset(node, 0, sizeof(SCRadixNode));
-
-    return node;
+    memset(&tree->nodes[idx], 0, sizeof(SCRadixNode));
+    tree->nodes[idx].child[0] = tree->free_list;
+    tree->free_list = idx;
+    tree->node_cnt--;
 }
 
 /**
- * \brief Frees a Radix tree node
- *
- * \param node Pointer to a Radix tree node
- * \param tree Pointer to the Radix tree to which this node belongs
+ * \brief The link pointing to a node: a child of the parent, or the root
+ *        for the key length if parent is 0
  */
-static void SCRadixReleaseNode(SCRadixNode *node, SCRadixTree *tree)
+static inline uint32_t *SCRadixLink(SCRadixTree *tree, const uint16_t key_bytes,
+                                    const uint32_t parent, const int dir)
 {
-    if (node != NULL) {
-        SCRadixReleasePrefix(node->prefix, tree);
-
-        if (node->netmasks != NULL)
-            SCFree(node->netmasks);
-
-        SCFree(node);
-    }
-
-    return;
+    if (parent == 0)
+        return &tree->root[key_bytes];
+    return &tree->nodes[parent].child[dir];
 }
 
 /**
@@ -433,30 +177,15 @@ SCRadixTree *SCRadixCreateRadixTree(void (*Free)(void*), void (*PrintData)(void*
     }
     memset(tree, 0, sizeof(SCRadixTree));
 
+    /* index 0 is 'no node' */
+    tree->nodes_next = 1;
+
     tree->Free = Free;
     tree->PrintData = PrintData;
 
     return tree;
 }
 
-/**
- * \brief Internal helper function used by SCRadixReleaseRadixTree to free a
- *        subtree
- *
- * \param node Pointer to the root of the subtree that has to be freed
- * \param tree Pointer to the Radix tree to which this subtree belongs
- */
-static void SCRadixReleaseRadixSubtree(SCRadixNode *node, SCRadixTree *tree)
-{
-    if (node != NULL) {
-        SCRadixReleaseRadixSubtree(node->left, tree);
-        SCRadixReleaseRadixSubtree(node->right, tree);
-        SCRadixReleaseNode(node, tree);
-    }
-
-    return;
-}
-
 /**
  * \brief Frees a Radix tree and all its nodes
  *
@@ -467,8 +196,16 @@ void SCRadixReleaseRadixTree(SCRadixTree *tree)
     if (tree == NULL)
         return;
 
-    SCRadixReleaseRadixSubtree(tree->head, tree);
-    tree->head = NULL;
+    /* nodes on the free list have has_user cleared */
+    if (tree->Free != NULL) {
+        for (uint32_t i = 1; i < tree->nodes_next; i++) {
+            if (tree->nodes[i].has_user)
+                tree->Free(tree->nodes[i].user);
+        }
+    }
+
+    if (tree->nodes != NULL)
+        SCFree(tree->nodes);
     SCFree(tree);
     return;
 }
@@ -486,343 +223,130 @@ void SCRadixReleaseRadixTree(SCRadixTree *tree)
  * \param netmask    The netmask (cidr) if we are adding an IP netblock; 255
  *                   if we are not adding an IP netblock
  *
- * \retval node Pointer to the newly created node
+ * \retval node Pointer to the node holding the key. If the key was already
+ *              in the tree its user data is left as it was.
  */
 static SCRadixNode *SCRadixAddKey(uint8_t *key_stream, uint16_t key_bitlen,
                                   SCRadixTree *tree, void *user, uint8_t netmask)
 {
-    SCRadixNode *node = NULL;
-    SCRadixNode *new_node = NULL;
-    SCRadixNode *parent = NULL;
-    SCRadixNode *inter_node = NULL;
-    SCRadixNode *bottom_node = NULL;
-    void *ptmp;
-
-    uint8_t *stream = NULL;
-    uint8_t bitlen = 0;
-
-    int check_bit = 0;
-    int differ_bit = 0;
-
-    int i = 0;
-    int j = 0;
-    int temp = 0;
-
     if (tree == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "Argument \"tree\" NULL");
         return NULL;
     }
+    if (key_stream == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Argument \"stream\" NULL");
+        return NULL;
+    }
+    if (key_bitlen == 0 || key_bitlen % 8 != 0 ||
+            key_bitlen > SC_RADIX_KEY_MAX_BYTES * 8) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid argument bitlen - %d",
+                   key_bitlen);
+        return NULL;
+    }
 
-    /* chop the ip address against a netmask */
-    MaskIPNetblock(key_stream, netmask, key_bitlen);
-
-    /* the very first element in the radix tree */
-    if (tree->head == NULL) {
-        SCRadixPrefix *prefix = NULL;
-        if ( (prefix = SCRadixCreatePrefix(key_stream, key_bitlen, user,
-                        netmask)) == NULL) {
-            SCLogError(SC_ERR_RADIX_TREE_GENERIC, "Error creating prefix");
-            return NULL;
-        }
-        node = SCRadixCreateNode();
-        if (node == NULL) {
-            SCRadixReleasePrefix(prefix, tree);
-            return NULL;
-        }
-        node->prefix = prefix;
-        node->bit = prefix->bitlen;
-        tree->head = node;
-        if (netmask == 255 || (netmask == 32 && key_bitlen == 32) || (netmask == 128 && key_bitlen == 128))
-            return node;
-
-        /* if we have reached here, we are actually having a proper netblock in
-         * our hand(i.e. < 32 for ipv4 and < 128 for ipv6).  Add the netmask for
-         * this node.  The reason we add netmasks other than 32 and 128, is
-         * because we need those netmasks in case of searches for ips contained
-         * in netblocks.  If the netmask is 32 or 128, either ways we will be
-         * having an exact match for that ip value.  If it is not, we start
-         * chopping the incoming search ip key using the netmask values added
-         * into the tree and then verify for a match */
-        node->netmask_cnt++;
-        if ( (ptmp = SCRealloc(node->netmasks, (node->netmask_cnt *
-                                                        sizeof(uint8_t)))) == NULL) {
-            SCFree(node->netmasks);
-            node->netmasks = NULL;
-            SCLogError(SC_ERR_MEM_ALLOC, "Fatal error encountered in SCRadixAddKey. Mem not allocated");
+    uint8_t bitlen = (uint8_t)key_bitlen;
+    if (netmask != 255) {
+        if (netmask > key_bitlen) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid netmask %u for a "
+                    "%u bit key", netmask, key_bitlen);
             return NULL;
         }
-        node->netmasks = ptmp;
-        node->netmasks[0] = netmask;
-        return node;
-    }
-
-    node = tree->head;
-    stream = key_stream;
-    bitlen = key_bitlen;
-
-    /* we walk down the tree only when we satisfy 2 conditions.  The first one
-     * being the incoming prefix is shorter than the differ bit of the current
-     * node.  In case we fail in this aspect, we walk down to the tree, till we
-     * arrive at a node that ends in a prefix */
-    while (node->bit < bitlen || node->prefix == NULL) {
-        /* if the bitlen isn't long enough to handle the bit test, we just walk
-         * down along one of the paths, since either paths should end up with a
-         * node that has a common prefix whose differ bit is greater than the
-         * bitlen of the incoming prefix */
-        if (bitlen <= node->bit) {
-            if (node->right == NULL)
-                break;
-            node = node->right;
-        } else {
-            if (SC_RADIX_BITTEST(stream[node->bit >> 3],
-                                 (0x80 >> (node->bit % 8))) ) {
-                if (node->right == NULL)
-                    break;
-                node = node->right;
-            } else {
-                if (node->left == NULL)
-                    break;
-                node = node->left;
+        /* chop the ip address against the netmask, callers rely on the
+         * key being masked */
+        MaskIPNetblock(key_stream, netmask, key_bitlen);
+        bitlen = netmask;
+    }
+
+    const uint16_t key_bytes = key_bitlen / 8;
+    uint64_t key[2];
+    SCRadixKeyLoad(key_stream, key_bytes, key);
+    SCRadixKeyMask(key, bitlen);
+
+    uint32_t parent = 0;
+    int dir = 0;
+    uint32_t idx = tree->root[key_bytes];
+
+    while (idx != 0) {
+        SCRadixNode *node = &tree->nodes[idx];
+        uint8_t common = SCRadixKeyCommonBits(node->key, key);
+        if (common > node->bitlen)
+            common = node->bitlen;
+        if (common > bitlen)
+            common = bitlen;
+
+        if (common == node->bitlen) {
+            if (node->bitlen == bitlen) {
+                if (node->has_user) {
+                    SCLogDebug("Duplicate entry for this ip address/netblock");
+                } else {
+                    node->has_user = 1;
+                    node->user = user;
+                }
+                return node;
             }
-        }
-    }
-
-    /* we need to keep a reference to the bottom-most node, that actually holds
-     * the prefix */
-    bottom_node = node;
-
-    /* get the first bit position where the ips differ */
-    check_bit = (node->bit < bitlen)? node->bit: bitlen;
-    for (i = 0; (i * 8) < check_bit; i++) {
-        if ((temp = (stream[i] ^ bottom_node->prefix->stream[i])) == 0) {
-            differ_bit = (i + 1) * 8;
+            /* our key is below this node */
+            parent = idx;
+            dir = SCRadixKeyBit(key, node->bitlen);
+            idx = node->child[dir];
             continue;
         }
 
-        /* find out the position where the first bit differs.  This method is
-         * faster, but at the cost of being larger.  But with larger caches
-         * these days we don't have to worry about cache misses */
-        temp = temp * 2;
-        if (temp >= 256)
-            j = 0;
-        else if (temp >= 128)
-            j = 1;
-        else if (temp >= 64)
-            j = 2;
-        else if (temp >= 32)
-            j = 3;
-        else if (temp >= 16)
-            j = 4;
-        else if (temp >= 8)
-            j = 5;
-        else if (temp >= 4)
-            j = 6;
-        else if (temp >= 2)
-            j = 7;
-
-        differ_bit = i * 8 + j;
-        break;
-    }
-    if (check_bit < differ_bit)
-        differ_bit = check_bit;
-
-    /* walk up the tree till we find the position, to fit our new node in */
-    parent = node->parent;
-    while (parent && differ_bit <= parent->bit) {
-        node = parent;
-        parent = node->parent;
-    }
-
-    /* We already have the node in the tree with the same differing bit pstn */
-    if (differ_bit == bitlen && node->bit == bitlen) {
-        if (node->prefix != NULL) {
-            /* Check if we already have this netmask entry covered by this prefix */
-            if (SCRadixPrefixContainNetmask(node->prefix, netmask)) {
-                /* Basically we already have this stream prefix, as well as the
-                 * netblock entry for this.  A perfect duplicate. */
-                SCLogDebug("Duplicate entry for this ip address/netblock");
-            } else {
-                /* Basically we already have this stream prefix, but we don't
-                 * have an entry for this particular netmask value for this
-                 * prefix.  For example, we have an entry for 192.168.0.0 and
-                 * 192.168.0.0/16 and now we are trying to enter 192.168.0.0/20 */
-                SCRadixAddNetmaskUserDataToPrefix(node->prefix, netmask, user);
-
-                /* if we are adding a netmask of 32(for ipv4) or 128(for ipv6)
-                 * it indicates we are adding an exact host ip into the radix
-                 * tree, in which case we don't need to add the netmask value
-                 * into the tree */
-                if (netmask == 255 || (netmask == 32 && bitlen == 32) || (netmask == 128 && bitlen == 128))
-                    return node;
-
-                /* looks like we have a netmask which is != 32 or 128, in which
-                 * case we walk up the tree to insert this netmask value in the
-                 * correct node */
-                parent = node->parent;
-                while (parent != NULL && netmask < (parent->bit + 1)) {
-                    node = parent;
-                    parent = parent->parent;
-                }
-
-                node->netmask_cnt++;
-                new_node = node;
-
-                if ( (ptmp = SCRealloc(node->netmasks, (node->netmask_cnt *
-                                                                sizeof(uint8_t)))) == NULL) {
-                    SCFree(node->netmasks);
-                    node->netmasks = NULL;
-                    SCLogError(SC_ERR_FATAL, "Fatal error encountered in SCRadixAddKey. Mem not allocated...");
-                    return NULL;
-                }
-                node->netmasks = ptmp;
-
-                if (node->netmask_cnt == 1) {
-                    node->netmasks[0] = netmask;
-                    return new_node;
-                }
-
-                node->netmasks[node->netmask_cnt - 1] = netmask;
+        /* the key leaves the path of this node's prefix before its end:
+         * either the key is a prefix of the node's prefix and goes in
+         * its place, or a node splitting both is needed */
+        uint32_t new_idx = SCRadixNodeAlloc(tree);
+        if (new_idx == 0)
+            return NULL;
 
-                for (i = node->netmask_cnt - 2; i >= 0; i--) {
-                    if (netmask < node->netmasks[i]) {
-                        node->netmasks[i + 1] = netmask;
-                        break;
-                    }
+        if (common == bitlen) {
+            SCRadixNode *new_node = &tree->nodes[new_idx];
+            node = &tree->nodes[idx];
+            memcpy(new_node->key, key, sizeof(key));
+            new_node->bitlen = bitlen;
+            new_node->has_user = 1;
+            new_node->user = user;
+            new_node->child[SCRadixKeyBit(node->key, bitlen)] = idx;
 
-                    node->netmasks[i + 1] = node->netmasks[i];
-                    node->netmasks[i] = netmask;
-                }
-            }
-        } else {
-            node->prefix = SCRadixCreatePrefix(key_stream, key_bitlen,
-                                               user, 255);
+            *SCRadixLink(tree, key_bytes, parent, dir) = new_idx;
+            return new_node;
         }
-        return node;
-    }
 
-    /* create the leaf node for the new key */
-    SCRadixPrefix *prefix = NULL;
-    if ( (prefix = SCRadixCreatePrefix(key_stream, key_bitlen, user,
-                    netmask)) == NULL) {
-        SCLogError(SC_ERR_RADIX_TREE_GENERIC, "Error creating prefix");
-        return NULL;
-    }
-    new_node = SCRadixCreateNode();
-    new_node->prefix = prefix;
-    new_node->bit = prefix->bitlen;
-
-    /* indicates that we have got a key that has length that is already covered
-     * by a prefix of some other key in the tree.  We create a new intermediate
-     * node with a single child and stick it in.  We need the if only in the
-     * case of variable length keys */
-    if (differ_bit == bitlen) {
-        if (SC_RADIX_BITTEST(bottom_node->prefix->stream[differ_bit >> 3],
-                             (0x80 >> (differ_bit % 8))) ) {
-            new_node->right = node;
-        } else {
-            new_node->left = node;
-        }
-        new_node->parent = node->parent;
-
-        if (node->parent == NULL)
-            tree->head = new_node;
-        else if (node->parent->right == node)
-            node->parent->right = new_node;
-        else
-            node->parent->left = new_node;
-
-        node->parent = new_node;
-        /* stick our new_node into the tree.  Create a node that holds the
-         * differing bit position and break the branch.  Also handle the
-         * tranfer of netmasks between node and inter_node(explained in more
-         * detail below) */
-    } else {
-        inter_node = SCRadixCreateNode();
-        inter_node->prefix = NULL;
-        inter_node->bit = differ_bit;
-        inter_node->parent = node->parent;
-
-        if (node->netmasks != NULL) {
-            for (i = 0; i < node->netmask_cnt; i++) {
-                if (node->netmasks[i] < differ_bit + 1)
-                    break;
-            }
-
-            if (i < node->netmask_cnt) {
-                if ( (inter_node->netmasks = SCMalloc((node->netmask_cnt - i) *
-                                sizeof(uint8_t))) == NULL) {
-                    SCLogError(SC_ERR_MEM_ALLOC, "Fatal error encountered in SCRadixAddKey. Mem not allocated...");
-                    SCRadixReleaseNode(inter_node, tree);
-                    SCRadixReleaseNode(new_node, tree);
-                    return NULL;
-                }
-
-                for (j = 0; j < (node->netmask_cnt - i); j++)
-                    inter_node->netmasks[j] = node->netmasks[i + j];
-
-                inter_node->netmask_cnt = (node->netmask_cnt - i);
-                node->netmask_cnt = i;
-            }
+        uint32_t leaf_idx = SCRadixNodeAlloc(tree);
+        if (leaf_idx == 0) {
+            SCRadixNodeFree(tree, new_idx);
+            return NULL;
         }
+        SCRadixNode *inter_node = &tree->nodes[new_idx];
+        SCRadixNode *leaf = &tree->nodes[leaf_idx];
+        node = &tree->nodes[idx];
 
-        if (SC_RADIX_BITTEST(stream[differ_bit >> 3],
-                             (0x80 >> (differ_bit % 8))) ) {
-            inter_node->left = node;
-            inter_node->right = new_node;
-        } else {
-            inter_node->left = new_node;
-            inter_node->right = node;
-        }
-        new_node->parent = inter_node;
+        memcpy(inter_node->key, key, sizeof(key));
+        SCRadixKeyMask(inter_node->key, common);
+        inter_node->bitlen = common;
+        inter_node->child[SCRadixKeyBit(node->key, common)] = idx;
+        inter_node->child[SCRadixKeyBit(key, common)] = leaf_idx;
 
-        if (node->parent == NULL)
-            tree->head = inter_node;
-        else if (node->parent->right == node)
-            node->parent->right = inter_node;
-        else
-            node->parent->left = inter_node;
+        memcpy(leaf->key, key, sizeof(key));
+        leaf->bitlen = bitlen;
+        leaf->has_user = 1;
+        leaf->user = user;
 
-        node->parent = inter_node;
+        *SCRadixLink(tree, key_bytes, parent, dir) = new_idx;
+        return leaf;
     }
 
-    /* insert the netmask into the tree */
-    if (netmask != 255 && (netmask != 32 || (netmask == 32 && bitlen != 32)) && netmask != 128) {
-        node = new_node;
-        parent = new_node->parent;
-        while (parent != NULL && netmask < (parent->bit + 1)) {
-            node = parent;
-            parent = parent->parent;
-        }
-
-        node->netmask_cnt++;
-        if ( (ptmp = SCRealloc(node->netmasks, (node->netmask_cnt *
-                                                        sizeof(uint8_t)))) == NULL) {
-            SCFree(node->netmasks);
-            node->netmasks = NULL;
-            SCLogError(SC_ERR_FATAL, "Fatal error encountered in SCRadixAddKey. Exiting...");
-            exit(EXIT_FAILURE);
-        }
-        node->netmasks = ptmp;
-
-        if (node->netmask_cnt == 1) {
-            node->netmasks[0] = netmask;
-            return new_node;
-        }
-
-        node->netmasks[node->netmask_cnt - 1] = netmask;
-
-        for (i = node->netmask_cnt - 2; i >= 0; i--) {
-            if (netmask < node->netmasks[i]) {
-                node->netmasks[i + 1] = netmask;
-                break;
-            }
+    idx = SCRadixNodeAlloc(tree);
+    if (idx == 0)
+        return NULL;
 
-            node->netmasks[i + 1] = node->netmasks[i];
-            node->netmasks[i] = netmask;
-        }
-    }
+    SCRadixNode *node = &tree->nodes[idx];
+    memcpy(node->key, key, sizeof(key));
+    node->bitlen = bitlen;
+    node->has_user = 1;
+    node->user = user;
 
-    return new_node;
+    *SCRadixLink(tree, key_bytes, parent, dir) = idx;
+    return node;
 }
 
 /**
@@ -1019,232 +543,71 @@ SCRadixNode *SCRadixAddKeyIPV6String(const char *str, SCRadixTree *tree, void *u
     return SCRadixAddKey(addr.s6_addr, 128, tree, user, netmask);
 }
 
-static void SCRadixTransferNetmasksBWNodes(SCRadixNode *dest, SCRadixNode *src)
-{
-    int i = 0, j = 0;
-    void *ptmp = NULL;
-
-    if (src == NULL || dest == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS, "src or dest NULL");
-        return;
-    }
-
-    /* no netmasks in the source node, to transfer to the destination node */
-    if (src->netmasks == NULL)
-        return;
-
-    if ( (ptmp = SCRealloc(dest->netmasks,
-                           (src->netmask_cnt + dest->netmask_cnt) *
-                           sizeof(uint8_t))) == NULL) {
-        SCFree(dest->netmasks);
-        dest->netmasks = NULL;
-        return;
-    }
-    dest->netmasks = ptmp;
-
-    for (i = dest->netmask_cnt, j = 0; j < src->netmask_cnt; i++, j++)
-        dest->netmasks[i] = src->netmasks[j];
-
-    return;
-}
-
-/**
- * \brief Removes a netblock entry from an ip node.  The function first
- *        deletes the netblock/user_data entry for the prefix and then
- *        removes the netmask entry that has been made in the tree, by
- *        walking up the tree and deleting the entry from the specific node.
- *
- * \param node    The node from which the netblock entry has to be removed.
- * \param netmask The netmask entry (cidr) that has to be removed.
- */
-static void SCRadixRemoveNetblockEntry(SCRadixNode *node, uint8_t netmask)
-{
-    void *ptmp;
-    SCRadixNode *parent = NULL;
-    int i = 0;
-
-    if (node == NULL) {
-        SCLogError(SC_ERR_INVALID_ARGUMENTS, "Invalid argument.  Node is NULL");
-        return;
-    }
-
-    SCRadixRemoveNetmaskUserDataFromPrefix(node->prefix, netmask);
-
-    if (netmask == 32 || netmask == 128)
-        return;
-
-    parent = node->parent;
-    while (parent != NULL && netmask < (parent->bit + 1)) {
-        parent = parent->parent;
-    }
-
-    for (i = 0; i < node->netmask_cnt; i++) {
-        if (node->netmasks[i] == netmask)
-            break;
-    }
-
-    if (i == node->netmask_cnt) {
-        SCLogDebug("Something's wrong with the tree.  We are unable to find the "
-                   "netmask entry");
-        return;
-    }
-
-    for ( ; i < node->netmask_cnt - 1; i++)
-        node->netmasks[i] = node->netmasks[i + 1];
-
-    node->netmask_cnt--;
-    if (node->netmask_cnt == 0) {
-        SCFree(node->netmasks);
-        node->netmasks = NULL;
-        return;
-    }
-
-    ptmp = SCRealloc(node->netmasks, node->netmask_cnt * sizeof(uint8_t));
-    if (ptmp == NULL) {
-        SCFree(node->netmasks);
-        node->netmasks = NULL;
-        return;
-    }
-    node->netmasks = ptmp;
-
-    return;
-}
-
 /**
- * \brief Removes a key from the Radix tree
+ * \brief Removes a key from the Radix tree. The user data of the key is
+ *        not freed.
  *
  * \param key_stream Data that has to be removed from the Radix tree
  * \param key_bitlen The bitlen of the the above stream.  For example if the
  *                   stream holds an IPV4 address(4 bytes), bitlen would be 32
  * \param tree       Pointer to the Radix tree from which the key has to be
  *                   removed
+ * \param netmask    The netmask (cidr) of the netblock to remove; 255 if
+ *                   the key is not an IP netblock
  */
 static void SCRadixRemoveKey(uint8_t *key_stream, uint16_t key_bitlen,
                              SCRadixTree *tree, uint8_t netmask)
 {
-    SCRadixNode *node = tree->head;
-    SCRadixNode *parent = NULL;
-    SCRadixNode *temp_dest = NULL;
-
-    SCRadixPrefix *prefix = NULL;
-
-    uint32_t mask = 0;
-    int i = 0;
-
-    if (node == NULL)
+    if (tree == NULL || key_stream == NULL || key_bitlen == 0 ||
+            key_bitlen % 8 != 0 || key_bitlen > SC_RADIX_KEY_MAX_BYTES * 8)
         return;
-
-    if ( (prefix = SCRadixCreatePrefix(key_stream, key_bitlen, NULL, 255)) == NULL)
+    if (netmask != 255 && netmask > key_bitlen)
         return;
 
-    while (node->bit < prefix->bitlen) {
-        if (SC_RADIX_BITTEST(prefix->stream[node->bit >> 3],
-                             (0x80 >> (node->bit % 8))) ) {
-            node = node->right;
-        } else {
-            node = node->left;
-        }
+    const uint8_t bitlen = (netmask == 255) ? (uint8_t)key_bitlen : netmask;
+    const uint16_t key_bytes = key_bitlen / 8;
+    uint64_t key[2];
+    SCRadixKeyLoad(key_stream, key_bytes, key);
+    SCRadixKeyMask(key, bitlen);
 
-        if (node == NULL) {
-            SCRadixReleasePrefix(prefix, tree);
+    uint32_t gparent = 0, parent = 0;
+    int gdir = 0, dir = 0;
+    uint32_t idx = tree->root[key_bytes];
+
+    while (idx != 0) {
+        const SCRadixNode *node = &tree->nodes[idx];
+        if (node->bitlen > bitlen || SCRadixKeyCommonBits(node->key, key) < node->bitlen)
             return;
-        }
+        if (node->bitlen == bitlen)
+            break;
+        gparent = parent;
+        gdir = dir;
+        parent = idx;
+        dir = SCRadixKeyBit(key, node->bitlen);
+        idx = node->child[dir];
     }
-
-    if (node->bit != prefix->bitlen || node->prefix == NULL) {
-        SCRadixReleasePrefix(prefix, tree);
+    if (idx == 0 || !tree->nodes[idx].has_user)
         return;
-    }
 
-    i = prefix->bitlen / 8;
-    if (SCMemcmp(node->prefix->stream, prefix->stream, i) == 0) {
-        mask = UINT_MAX << (8 - prefix->bitlen % 8);
+    SCRadixNode *node = &tree->nodes[idx];
+    node->has_user = 0;
+    node->user = NULL;
 
-        if (prefix->bitlen % 8 == 0 ||
-            (node->prefix->stream[i] & mask) == (prefix->stream[i] & mask)) {
-            if (!SCRadixPrefixContainNetmask(node->prefix, netmask)) {
-                SCLogDebug("The ip key exists in the Radix Tree, but this(%d) "
-                           "netblock entry doesn't exist", netmask);
-                SCRadixReleasePrefix(prefix, tree);
-                return;
-            }
-        } else {
-            SCLogDebug("You are trying to remove a key that doesn't exist in "
-                       "the Radix Tree");
-            SCRadixReleasePrefix(prefix, tree);
-            return;
-        }
-    } else {
-        SCLogDebug("You are trying to remove a key that doesn't exist in the "
-                   "Radix Tree");
-        SCRadixReleasePrefix(prefix, tree);
+    /* with both children the node still splits the tree */
+    if (node->child[0] != 0 && node->child[1] != 0)
         return;
-    }
 
-    /* The ip node does exist, and the netblock entry does exist in this node, if
-     * we have reached this point.  If we have more than one netblock entry, it
-     * indicates we have multiple entries for this key.  So we delete that
-     * particular netblock entry, and make our way out of this function */
-    if (SCRadixPrefixNetmaskCount(node->prefix) > 1) {
-        SCRadixRemoveNetblockEntry(node, netmask);
-        SCRadixReleasePrefix(prefix, tree);
-        return;
-    }
+    const uint32_t child = node->child[0] ? node->child[0] : node->child[1];
+    *SCRadixLink(tree, key_bytes, parent, dir) = child;
+    SCRadixNodeFree(tree, idx);
 
-    /* we are deleting the root of the tree.  This would be the only node left
-     * in the tree */
-    if (tree->head == node) {
-        SCRadixReleaseNode(node, tree);
-        tree->head = NULL;
-        SCRadixReleasePrefix(prefix, tree);
-        return;
+    /* a parent without a prefix of its own only existed to split the tree
+     * between the removed node and its other child */
+    if (child == 0 && parent != 0 && !tree->nodes[parent].has_user) {
+        const uint32_t other = tree->nodes[parent].child[!dir];
+        *SCRadixLink(tree, key_bytes, gparent, gdir) = other;
+        SCRadixNodeFree(tree, parent);
     }
-
-    parent = node->parent;
-    /* parent->parent is not the root of the tree */
-    if (parent->parent != NULL) {
-        if (parent->parent->left == parent) {
-            if (node->parent->left == node) {
-                temp_dest = parent->right;
-                parent->parent->left = parent->right;
-                parent->right->parent = parent->parent;
-            } else {
-                temp_dest = parent->left;
-                parent->parent->left = parent->left;
-                parent->left->parent = parent->parent;
-            }
-        } else {
-            if (node->parent->left == node) {
-                temp_dest = parent->right;
-                parent->parent->right = parent->right;
-                parent->right->parent = parent->parent;
-            } else {
-                temp_dest = parent->left;
-                parent->parent->right = parent->left;
-                parent->left->parent = parent->parent;
-            }
-        }
-        /* parent is the root of the tree */
-    } else {
-        if (parent->left == node) {
-            temp_dest = tree->head->right;
-            tree->head->right->parent = NULL;
-            tree->head = tree->head->right;
-        } else {
-            temp_dest = tree->head->left;
-            tree->head->left->parent = NULL;
-            tree->head = tree->head->left;
-        }
-    }
-    /* We need to shift the netmask entries from the node that would be
-     * deleted to its immediate descendant */
-    SCRadixTransferNetmasksBWNodes(temp_dest, parent);
-    /* release the nodes */
-    SCRadixReleaseNode(parent, tree);
-    SCRadixReleaseNode(node, tree);
-    SCRadixReleasePrefix(prefix, tree);
-
-    return;
 }
 
 /**
@@ -1324,135 +687,85 @@ void SCRadixRemoveKeyIPV6(uint8_t *key_stream, SCRadixTree *tree)
     return;
 }
 
+
 /**
- * \brief Checks if an IP prefix falls under a netblock, in the path to the root
- *        of the tree, from the node.  Used internally by SCRadixFindKey()
+ * \brief Checks if a key is present in the tree with exactly this prefix
  *
- * \param prefix Pointer to the prefix that contains the ip address
- * \param node   Pointer to the node from where we have to climb the tree
+ * \param key_stream Data that has to be found in the Radix tree
+ * \param key_bitlen The bitlen of the above stream
+ * \param tree       Pointer to the Radix tree
+ * \param bitlen     Length of the prefix, key_bitlen for a full key
  */
-static inline SCRadixNode *SCRadixFindKeyIPNetblock(uint8_t *key_stream, uint8_t key_bitlen,
-                                                    SCRadixNode *node, void **user_data_result)
+static SCRadixNode *SCRadixFindKeyExact(const uint8_t *key_stream, uint16_t key_bitlen,
+                                        const SCRadixTree *tree, uint8_t bitlen,
+                                        void **user_data_result)
 {
-    SCRadixNode *netmask_node = NULL;
-    uint32_t mask = 0;
-    int bytes = 0;
-    int i = 0;
-    int j = 0;
-
-    while (node != NULL && node->netmasks == NULL)
-        node = node->parent;
+    if (user_data_result != NULL)
+        *user_data_result = NULL;
 
-    if (node == NULL)
+    if (tree == NULL || key_bitlen == 0 || key_bitlen % 8 != 0 ||
+            key_bitlen > SC_RADIX_KEY_MAX_BYTES * 8 || bitlen > key_bitlen)
         return NULL;
-    /* hold the node found containing a netmask.  We will need it when we call
-     * this function recursively */
-    netmask_node = node;
-
-    for (j = 0; j < netmask_node->netmask_cnt; j++) {
-        bytes = key_bitlen / 8;
-        for (i = 0; i < bytes; i++) {
-            mask = UINT_MAX;
-            if ( ((i + 1) * 8) > netmask_node->netmasks[j]) {
-                if ( ((i + 1) * 8 - netmask_node->netmasks[j]) < 8)
-                    mask = UINT_MAX << ((i + 1) * 8 - netmask_node->netmasks[j]);
-                else
-                    mask = 0;
-            }
-            key_stream[i] &= mask;
-        }
 
-        while (node->bit < key_bitlen) {
-            if (SC_RADIX_BITTEST(key_stream[node->bit >> 3],
-                                 (0x80 >> (node->bit % 8))) ) {
-                node = node->right;
-            } else {
-                node = node->left;
-            }
+    const uint16_t key_bytes = key_bitlen / 8;
+    uint64_t key[2];
+    SCRadixKeyLoad(key_stream, key_bytes, key);
+    SCRadixKeyMask(key, bitlen);
 
-            if (node == NULL)
-                return NULL;
-        }
-
-        if (node->bit != key_bitlen || node->prefix == NULL)
+    uint32_t idx = tree->root[key_bytes];
+    while (idx != 0) {
+        SCRadixNode *node = &tree->nodes[idx];
+        if (node->bitlen > bitlen || SCRadixKeyCommonBits(node->key, key) < node->bitlen)
             return NULL;
-
-        if (SCMemcmp(node->prefix->stream, key_stream, bytes) == 0) {
-            mask = UINT_MAX << (8 - key_bitlen % 8);
-
-            if (key_bitlen % 8 == 0 ||
-                (node->prefix->stream[bytes] & mask) == (key_stream[bytes] & mask)) {
-                if (SCRadixPrefixContainNetmaskAndSetUserData(node->prefix, netmask_node->netmasks[j], 0, user_data_result))
-                    return node;
-            }
+        if (node->bitlen == bitlen) {
+            if (!node->has_user)
+                return NULL;
+            if (user_data_result != NULL)
+                *user_data_result = node->user;
+            return node;
         }
+        idx = node->child[SCRadixKeyBit(key, node->bitlen)];
     }
-
-    return SCRadixFindKeyIPNetblock(key_stream, key_bitlen, netmask_node->parent, user_data_result);
+    return NULL;
 }
 
 /**
- * \brief Checks if an IP address key is present in the tree.  The function
- *        apart from handling any normal data, also handles ipv4/ipv6 netblocks
+ * \brief Finds the longest prefix in the tree containing the key
  *
- * \param key_stream  Data that has to be found in the Radix tree
- * \param key_bitlen  The bitlen of the above stream.
- * \param tree        Pointer to the Radix tree
- * \param exact_match The key to be searched is an ip address
+ * \param key_stream Data that has to be found in the Radix tree
+ * \param key_bitlen The bitlen of the above stream
+ * \param tree       Pointer to the Radix tree
  */
-static SCRadixNode *SCRadixFindKey(uint8_t *key_stream, uint16_t key_bitlen,
-                                   SCRadixTree *tree, int exact_match, void **user_data_result)
+static SCRadixNode *SCRadixFindKeyBest(const uint8_t *key_stream, uint16_t key_bitlen,
+                                       const SCRadixTree *tree, void **user_data_result)
 {
-    if (tree == NULL || tree->head == NULL)
-        return NULL;
-
-    SCRadixNode *node = tree->head;
-    uint32_t mask = 0;
-    int bytes = 0;
-    uint8_t tmp_stream[255];
-
-    if (key_bitlen > 255)
-        return NULL;
-
-    memset(tmp_stream, 0, 255);
-    memcpy(tmp_stream, key_stream, key_bitlen / 8);
-
-    while (node->bit < key_bitlen) {
-        if (SC_RADIX_BITTEST(tmp_stream[node->bit >> 3],
-                             (0x80 >> (node->bit % 8))) ) {
-            node = node->right;
-        } else {
-            node = node->left;
-        }
-
-        if (node == NULL) {
-            return NULL;
-        }
-    }
+    if (user_data_result != NULL)
+        *user_data_result = NULL;
 
-    if (node->bit != key_bitlen || node->prefix == NULL) {
+    if (tree == NULL || key_bitlen == 0 || key_bitlen % 8 != 0 ||
+            key_bitlen > SC_RADIX_KEY_MAX_BYTES * 8)
         return NULL;
-    }
 
-    bytes = key_bitlen / 8;
-    if (SCMemcmp(node->prefix->stream, tmp_stream, bytes) == 0) {
-        mask = UINT_MAX << (8 - key_bitlen % 8);
+    const uint16_t key_bytes = key_bitlen / 8;
+    uint64_t key[2];
+    SCRadixKeyLoad(key_stream, key_bytes, key);
 
-        if (key_bitlen % 8 == 0 ||
-            (node->prefix->stream[bytes] & mask) == (tmp_stream[bytes] & mask)) {
-            if (SCRadixPrefixContainNetmaskAndSetUserData(node->prefix, key_bitlen, 1, user_data_result)) {
-                return node;
-            }
-        }
-    }
-
-    /* if you are not an ip key, get out of here */
-    if (exact_match) {
-        return NULL;
+    SCRadixNode *best = NULL;
+    uint32_t idx = tree->root[key_bytes];
+    while (idx != 0) {
+        SCRadixNode *node = &tree->nodes[idx];
+        if (SCRadixKeyCommonBits(node->key, key) < node->bitlen)
+            break;
+        if (node->has_user)
+            best = node;
+        if (node->bitlen >= key_bitlen)
+            break;
+        idx = node->child[SCRadixKeyBit(key, node->bitlen)];
     }
 
-    SCRadixNode *ret = SCRadixFindKeyIPNetblock(tmp_stream, key_bitlen, node, user_data_result);
-    return ret;
+    if (best != NULL && user_data_result != NULL)
+        *user_data_result = best->user;
+    return best;
 }
 
 /**
@@ -1465,7 +778,8 @@ static SCRadixNode *SCRadixFindKey(uint8_t *key_stream, uint16_t key_bitlen,
 SCRadixNode *SCRadixFindKeyGeneric(uint8_t *key_stream, uint16_t key_bitlen,
                                    SCRadixTree *tree, void **user_data_result)
 {
-    return SCRadixFindKey(key_stream, key_bitlen, tree, 1, user_data_result);
+    return SCRadixFindKeyExact(key_stream, key_bitlen, tree, (uint8_t)key_bitlen,
+            user_data_result);
 }
 
 /**
@@ -1477,7 +791,7 @@ SCRadixNode *SCRadixFindKeyGeneric(uint8_t *key_stream, uint16_t key_bitlen,
  */
 SCRadixNode *SCRadixFindKeyIPV4ExactMatch(uint8_t *key_stream, SCRadixTree *tree, void **user_data_result)
 {
-    return SCRadixFindKey(key_stream, 32, tree, 1, user_data_result);
+    return SCRadixFindKeyExact(key_stream, 32, tree, 32, user_data_result);
 }
 
 /**
@@ -1489,7 +803,7 @@ SCRadixNode *SCRadixFindKeyIPV4ExactMatch(uint8_t *key_stream, SCRadixTree *tree
  */
 SCRadixNode *SCRadixFindKeyIPV4BestMatch(uint8_t *key_stream, SCRadixTree *tree, void **user_data_result)
 {
-    return SCRadixFindKey(key_stream, 32, tree, 0, user_data_result);
+    return SCRadixFindKeyBest(key_stream, 32, tree, user_data_result);
 }
 
 /**
@@ -1502,15 +816,7 @@ SCRadixNode *SCRadixFindKeyIPV4BestMatch(uint8_t *key_stream, SCRadixTree *tree,
 SCRadixNode *SCRadixFindKeyIPV4Netblock(uint8_t *key_stream, SCRadixTree *tree,
                                         uint8_t netmask, void **user_data_result)
 {
-    SCRadixNode *node = NULL;
-    node = SCRadixFindKey(key_stream, 32, tree, 0, user_data_result);
-    if (node == NULL)
-        return node;
-
-    if (SCRadixPrefixContainNetmaskAndSetUserData(node->prefix, netmask, 1, user_data_result))
-        return node;
-    else
-        return NULL;
+    return SCRadixFindKeyExact(key_stream, 32, tree, netmask, user_data_result);
 }
 
 /**
@@ -1523,15 +829,7 @@ SCRadixNode *SCRadixFindKeyIPV4Netblock(uint8_t *key_stream, SCRadixTree *tree,
 SCRadixNode *SCRadixFindKeyIPV6Netblock(uint8_t *key_stream, SCRadixTree *tree,
                                         uint8_t netmask, void **user_data_result)
 {
-    SCRadixNode *node = NULL;
-    node = SCRadixFindKey(key_stream, 128, tree, 0, user_data_result);
-    if (node == NULL)
-        return node;
-
-    if (SCRadixPrefixContainNetmaskAndSetUserData(node->prefix, (uint16_t)netmask, 1, user_data_result))
-        return node;
-    else
-        return NULL;
+    return SCRadixFindKeyExact(key_stream, 128, tree, netmask, user_data_result);
 }
 
 /**
@@ -1543,7 +841,7 @@ SCRadixNode *SCRadixFindKeyIPV6Netblock(uint8_t *key_stream, SCRadixTree *tree,
  */
 SCRadixNode *SCRadixFindKeyIPV6ExactMatch(uint8_t *key_stream, SCRadixTree *tree, void **user_data_result)
 {
-    return SCRadixFindKey(key_stream, 128, tree, 1, user_data_result);
+    return SCRadixFindKeyExact(key_stream, 128, tree, 128, user_data_result);
 }
 
 /**
@@ -1555,7 +853,7 @@ SCRadixNode *SCRadixFindKeyIPV6ExactMatch(uint8_t *key_stream, SCRadixTree *tree
  */
 SCRadixNode *SCRadixFindKeyIPV6BestMatch(uint8_t *key_stream, SCRadixTree *tree, void **user_data_result)
 {
-    return SCRadixFindKey(key_stream, 128, tree, 0, user_data_result);
+    return SCRadixFindKeyBest(key_stream, 128, tree, user_data_result);
 }
 
 /**
@@ -1574,41 +872,22 @@ void SCRadixPrintNodeInfo(SCRadixNode *node, int level,  void (*PrintData)(void*
     for (i = 0; i < level; i++)
         printf("   ");
 
-    printf("%d [", node->bit);
-
-    if (node->netmasks == NULL) {
-        printf("%d, ", -1);
-    } else {
-        for (i = 0; i < node->netmask_cnt; i++)
-            printf("%s%d", (0 == i ? "" : ", "), node->netmasks[i]);
+    printf("%d (", node->bitlen);
+    for (i = 0; i * 8 < node->bitlen; i++) {
+        printf("%s%d", (0 == i ? "" : "."),
+                (int)((node->key[i / 8] >> (56 - (i % 8) * 8)) & 0xff));
     }
+    printf(")");
 
-    printf("] (");
-    if (node->prefix != NULL) {
-        for (i = 0; i * 8 < node->prefix->bitlen; i++)
-            printf("%s%d", (0 == i ? "" : "."), node->prefix->stream[i]);
-        printf(")\n");
-
-        SCRadixUserData *ud = NULL;
+    if (node->has_user) {
         if (PrintData != NULL) {
-            do {
-                ud = node->prefix->user_data;
-                printf(" [%d], ", ud->netmask);
-                PrintData(ud->user);
-                ud = ud->next;
-            } while (ud != NULL);
+            printf(" ");
+            PrintData(node->user);
         } else {
-            //ud = node->prefix->user_data;
-            //while (ud != NULL) {
-            //    printf(" [nm %d with data], ", ud->netmask);
-            //    ud = ud->next;
-            //}
-            printf("No print function provided");
+            printf(" No print function provided");
         }
-        printf("\n");
-    } else {
-        printf("NULL)\n");
     }
+    printf("\n");
 
     return;
 }
@@ -1617,15 +896,15 @@ void SCRadixPrintNodeInfo(SCRadixNode *node, int level,  void (*PrintData)(void*
  * \brief Helper function used by SCRadixPrintTree.  Prints the subtree with
  *        node as the root of the subtree
  *
- * \param node  Pointer to the node that is the root of the subtree to be printed
+ * \param idx   Index of the node that is the root of the subtree to be printed
  * \param level Used for indentation purposes
  */
-static void SCRadixPrintRadixSubtree(SCRadixNode *node, int level, void (*PrintData)(void*))
+static void SCRadixPrintRadixSubtree(SCRadixTree *tree, uint32_t idx, int level)
 {
-    if (node != NULL) {
-        SCRadixPrintNodeInfo(node, level, PrintData);
-        SCRadixPrintRadixSubtree(node->left, level + 1, PrintData);
-        SCRadixPrintRadixSubtree(node->right, level + 1, PrintData);
+    if (idx != 0) {
+        SCRadixPrintNodeInfo(&tree->nodes[idx], level, tree->PrintData);
+        SCRadixPrintRadixSubtree(tree, tree->nodes[idx].child[0], level + 1);
+        SCRadixPrintRadixSubtree(tree, tree->nodes[idx].child[1], level + 1);
     }
 
     return;
@@ -1643,9 +922,8 @@ static void SCRadixPrintRadixSubtree(SCRadixNode *node, int level, void (*PrintD
  *                Left_Child_2
  *                Right_Child_2     and so on
  *
- *        Each node printed out holds details on the next bit that differs
- *        amongst its children, and if the node holds a prefix, the perfix is
- *        printed as well.
+ *        Each node printed out holds its prefix length and prefix, and the
+ *        user data if the prefix was added to the tree.
  *
  * \param tree Pointer to the Radix tree that has to be printed
  */
@@ -1653,7 +931,8 @@ void SCRadixPrintTree(SCRadixTree *tree)
 {
     printf("Printing the Radix Tree: \n");
 
-    SCRadixPrintRadixSubtree(tree->head, 0, tree->PrintData);
+    for (int i = 0; i <= SC_RADIX_KEY_MAX_BYTES; i++)
+        SCRadixPrintRadixSubtree(tree, tree->root[i], 0);
 
     return;
 }
@@ -1878,7 +1157,7 @@ static int SCRadixTestIPV4Removal04(void)
         return 0;
     SCRadixRemoveKeyIPV4((uint8_t *)&servaddr.sin_addr, tree);
 
-    result &= (tree->head == NULL);
+    result &= (tree->node_cnt == 0);
 
     SCRadixReleaseRadixTree(tree);
 
@@ -4041,7 +3320,60 @@ this_end:
     return result;
 }
 
-#endif
+/**
+ * \test IPv4 and IPv6 keys in one tree don't match each other, and removed
+ *       nodes are reused
+ */
+static int SCRadixTestIPV4IPV6Mixed27(void)
+{
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+
+    struct in_addr in;
+    struct in6_addr in6;
+    int u4 = 4, u6 = 6;
+    void *user_data = NULL;
+
+    FAIL_IF(inet_pton(AF_INET, "10.0.0.0", &in) <= 0);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4Netblock((uint8_t *)&in, tree, &u4, 8));
+    FAIL_IF(inet_pton(AF_INET6, "a00::", &in6) <= 0);
+    FAIL_IF_NULL(SCRadixAddKeyIPV6Netblock((uint8_t *)&in6, tree, &u6, 16));
+
+    /* 10.1.2.3 and a00:: start with the same byte */
+    FAIL_IF(inet_pton(AF_INET, "10.1.2.3", &in) <= 0);
+    FAIL_IF_NULL(SCRadixFindKeyIPV4BestMatch((uint8_t *)&in, tree, &user_data));
+    FAIL_IF_NOT(user_data == &u4);
+    FAIL_IF(inet_pton(AF_INET6, "a00:1::1", &in6) <= 0);
+    FAIL_IF_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&in6, tree, &user_data));
+    FAIL_IF_NOT(user_data == &u6);
+    FAIL_IF(inet_pton(AF_INET6, "a01::1", &in6) <= 0);
+    FAIL_IF_NOT_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&in6, tree, &user_data));
+    FAIL_IF_NOT_NULL(user_data);
+
+    /* add and remove hosts under the netblock, the nodes are reused */
+    FAIL_IF(inet_pton(AF_INET, "10.1.2.3", &in) <= 0);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4(((uint8_t *)&in), tree, NULL));
+    FAIL_IF(inet_pton(AF_INET, "10.1.2.4", &in) <= 0);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4(((uint8_t *)&in), tree, NULL));
+    const uint32_t node_cnt = tree->node_cnt;
+    const uint32_t nodes_next = tree->nodes_next;
+    SCRadixRemoveKeyIPV4((uint8_t *)&in, tree);
+    FAIL_IF_NOT_NULL(SCRadixFindKeyIPV4ExactMatch((uint8_t *)&in, tree, NULL));
+    FAIL_IF_NOT(tree->node_cnt < node_cnt);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4(((uint8_t *)&in), tree, NULL));
+    FAIL_IF_NOT(tree->node_cnt == node_cnt);
+    FAIL_IF_NOT(tree->nodes_next == nodes_next);
+
+    /* the best match for the removed host is the netblock again */
+    SCRadixRemoveKeyIPV4((uint8_t *)&in, tree);
+    FAIL_IF_NULL(SCRadixFindKeyIPV4BestMatch((uint8_t *)&in, tree, &user_data));
+    FAIL_IF_NOT(user_data == &u4);
+
+    SCRadixReleaseRadixTree(tree);
+    PASS;
+}
+
+#endif /* UNITTESTS */
 
 void SCRadixRegisterTests(void)
 {
@@ -4087,6 +3419,8 @@ void SCRadixRegisterTests(void)
                    SCRadixTestIPV4NetblockInsertion25);
     UtRegisterTest("SCRadixTestIPV4NetblockInsertion26",
                    SCRadixTestIPV4NetblockInsertion26);
+    UtRegisterTest("SCRadixTestIPV4IPV6Mixed27",
+                   SCRadixTestIPV4IPV6Mixed27);
 #endif
 
     return;
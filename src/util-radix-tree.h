@@ -24,68 +24,60 @@
 #ifndef __UTIL_RADIX_TREE_H__
 #define __UTIL_RADIX_TREE_H__
 
-#define SC_RADIX_BITTEST(x, y) ((x) & (y))
-
-/**
- * \brief Structure that hold the user data and the netmask associated with it.
- */
-typedef struct SCRadixUserData_ {
-    /* holds a pointer to the user data associated with the particular netmask */
-    void *user;
-    /* pointer to the next user data in the list */
-    struct SCRadixUserData_ *next;
-    /* holds the netmask value that corresponds to this user data pointer */
-    uint8_t netmask;
-} SCRadixUserData;
-
-/**
- * \brief Structure for the prefix/key in the radix tree
- */
-typedef struct SCRadixPrefix_ {
-    /* length of the stream */
-    uint16_t bitlen;
-
-    /* the key that has been stored in the tree */
-    uint8_t *stream;
-
-    /* any user data that has to be associated with this key.  We need a user
-     * data field for each netblock value possible since one ip can be associated
-     * with any of the the 32 or 128 netblocks.  Also for non-ips, we store the
-     * netmask as 255 in SCRadixUserData->netmask */
-    SCRadixUserData *user_data;
-} SCRadixPrefix;
+/** max key length in bytes, enough for an IPv6 address */
+#define SC_RADIX_KEY_MAX_BYTES 16
 
 /**
  * \brief Structure for the node in the radix tree
+ *
+ * Nodes are stored in a single array per tree and refer to their children
+ * by index, 0 meaning no child. The tree is path compressed: each node
+ * holds its complete prefix, so a lookup compares a whole prefix at once
+ * and the depth is bounded by the number of distinct prefixes on a path
+ * rather than by the key length.
+ *
+ * A pointer to a node is only valid until the next key is added to the
+ * tree, as adding may move the node array.
  */
 typedef struct SCRadixNode_ {
-    /* the bit position where the bits differ in the nodes children.  Used
-     * to determine the path to be taken during a lookup*/
-    uint16_t bit;
+    /* the prefix, left aligned: the first byte of the key is the most
+     * significant byte of key[0]. Bits past bitlen are 0. */
+    uint64_t key[2];
 
-    uint16_t pad0;
+    /* user data for the prefix. Only valid if has_user is set, can be
+     * NULL as keys can be added without user data */
+    void *user;
 
-    /* total no of netmasks that are registered under this node */
-    int netmask_cnt;
-    /* holds a list of netmaks that come under this node in the tree */
-    uint8_t *netmasks;
+    /* the children for the bit following the prefix being 0 or 1 */
+    uint32_t child[2];
 
-    /* holds the prefix that the path to this node holds */
-    SCRadixPrefix *prefix;
+    /* length of the prefix in bits */
+    uint8_t bitlen;
 
-    /* the left and the right children of a node */
-    struct SCRadixNode_ *left, *right;
+    /* set if the prefix was added to the tree. Unset for the nodes that
+     * only split the tree where two prefixes differ. */
+    uint8_t has_user;
 
-    /* the parent node for this tree */
-    struct SCRadixNode_ *parent;
+    uint16_t pad0;
 } SCRadixNode;
 
 /**
  * \brief Structure for the radix tree
  */
 typedef struct SCRadixTree_ {
-    /* the root node in the radix tree */
-    SCRadixNode *head;
+    /* node storage. Index 0 is not used */
+    SCRadixNode *nodes;
+    uint32_t nodes_size;
+    /* first never used index in nodes */
+    uint32_t nodes_next;
+    /* number of nodes in the tree */
+    uint32_t node_cnt;
+    /* removed nodes for reuse, linked by child[0] */
+    uint32_t free_list;
+
+    /* root node per key length in bytes. Keys of different lengths, like
+     * IPv4 and IPv6 addresses, never match each other. */
+    uint32_t root[SC_RADIX_KEY_MAX_BYTES + 1];
 
     /* function pointer that is supplied by the user to free the user data
      * held by the user field of SCRadixNode */
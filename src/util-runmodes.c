@@ -50,6 +50,8 @@
 #include "util-runmodes.h"
 
 #include "flow-hash.h"
+#include "flow-private.h"
+#include "tmqh-flow.h"
 
 /** \brief create a queue string for autofp to pass to
  *         the flow queue handler.
@@ -140,7 +142,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(tname,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, TmqhAutofpGetHandlerName(), "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -207,7 +209,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(tname,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, TmqhAutofpGetHandlerName(), "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -245,7 +247,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhAutofpGetHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -282,6 +284,154 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
 
 /**
  */
+/** \internal
+ *  \brief create and spawn a worker thread for a live device
+ *
+ *  \param number number of the thread in its name, 0 for the single
+ *                runmode
+ *
+ *  \retval tv the spawned thread or NULL on error
+ */
+static ThreadVars *RunModeSpawnLiveCaptureWorker(const char *recv_mod_name,
+        const char *decode_mod_name, const char *thread_name,
+        const char *live_dev, void *aconf, int number)
+{
+    char tname[TM_THREAD_NAME_MAX];
+    ThreadVars *tv = NULL;
+    TmModule *tm_module = NULL;
+    const char *visual_devname = LiveGetShortName(live_dev);
+    char *printable_threadname = SCMalloc(sizeof(char) * (strlen(thread_name)+5+strlen(live_dev)));
+    if (unlikely(printable_threadname == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc printable thread name: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (number == 0) {
+        snprintf(tname, sizeof(tname), "%s#01-%s", thread_name, visual_devname);
+        snprintf(printable_threadname, strlen(thread_name)+5+strlen(live_dev), "%s#01-%s",
+                 thread_name, live_dev);
+    } else {
+        snprintf(tname, sizeof(tname), "%s#%02d-%s", thread_name,
+                 number, visual_devname);
+        snprintf(printable_threadname, strlen(thread_name)+5+strlen(live_dev), "%s#%02d-%s",
+                 thread_name, number, live_dev);
+    }
+    tv = TmThreadCreatePacketHandler(tname,
+            "packetpool", "packetpool",
+            "packetpool", "packetpool",
+            "pktacqloop");
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
+        SCFree(printable_threadname);
+        return NULL;
+    }
+    tv->printable_name = printable_threadname;
+
+    tm_module = TmModuleGetByName(recv_mod_name);
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName failed for %s", recv_mod_name);
+        return NULL;
+    }
+    TmSlotSetFuncAppend(tv, tm_module, aconf);
+
+    tm_module = TmModuleGetByName(decode_mod_name);
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName %s failed", decode_mod_name);
+        return NULL;
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    tm_module = TmModuleGetByName("FlowWorker");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+        return NULL;
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    tm_module = TmModuleGetByName("RespondReject");
+    if (tm_module == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
+        return NULL;
+    }
+    TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+    TmThreadSetCPU(tv, WORKER_CPU_SET);
+
+    if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+        return NULL;
+    }
+    return tv;
+}
+
+/** workers of a device that can be added and removed at runtime */
+typedef struct RunModeWorkersDevice_ {
+    char *live_dev;
+    void *aconf;                /**< capture config, we hold a reference */
+    const char *recv_mod_name;
+    const char *decode_mod_name;
+    const char *thread_name;
+    ThreadVars **tvs;           /**< the running workers, newest last */
+    int cnt;
+    int next_number;            /**< number in the name of the next worker */
+    struct RunModeWorkersDevice_ *next;
+} RunModeWorkersDevice;
+
+/** set by capture methods that support runtime worker changes */
+static ConfigIfaceRefFunc workers_ref_func = NULL;
+/** only built at startup, so it's read without lock */
+static RunModeWorkersDevice *workers_devices = NULL;
+
+/**
+ * \brief Let the workers of the next RunModeSetLiveCaptureWorkers() call
+ *        be added and removed at runtime, see RunModeWorkersSync().
+ *
+ * \param RefFunc takes a reference to the capture config of a device for
+ *        a new worker, or returns NULL if the device's config doesn't
+ *        allow more workers, e.g. without a fanout group.
+ */
+void RunModeEnableWorkersScaling(ConfigIfaceRefFunc RefFunc)
+{
+    workers_ref_func = RefFunc;
+}
+
+static RunModeWorkersDevice *RunModeWorkersDeviceAdd(const char *recv_mod_name,
+        const char *decode_mod_name, const char *thread_name,
+        const char *live_dev, void *aconf, int threads_count)
+{
+    if (workers_ref_func == NULL)
+        return NULL;
+    /* the flows of a worker's own table would go with it */
+    if (flow_config.thread_local)
+        return NULL;
+    /* our own reference keeps the config around once the workers of
+     * the start have released theirs */
+    if (workers_ref_func(aconf) == NULL)
+        return NULL;
+
+    RunModeWorkersDevice *dev = SCCalloc(1, sizeof(*dev));
+    if (unlikely(dev == NULL))
+        return NULL;
+    dev->tvs = SCCalloc(threads_count, sizeof(ThreadVars *));
+    dev->live_dev = SCStrdup(live_dev);
+    if (unlikely(dev->tvs == NULL || dev->live_dev == NULL)) {
+        if (dev->tvs != NULL)
+            SCFree(dev->tvs);
+        if (dev->live_dev != NULL)
+            SCFree(dev->live_dev);
+        SCFree(dev);
+        return NULL;
+    }
+    dev->aconf = aconf;
+    dev->recv_mod_name = recv_mod_name;
+    dev->decode_mod_name = decode_mod_name;
+    dev->thread_name = thread_name;
+    dev->next_number = threads_count + 1;
+    dev->next = workers_devices;
+    workers_devices = dev;
+    return dev;
+}
+
 static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc ModThreadsCount,
                               const char *recv_mod_name,
                               const char *decode_mod_name, const char *thread_name,
@@ -289,84 +439,188 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
                               unsigned char single_mode)
 {
     int threads_count;
+    RunModeWorkersDevice *dev = NULL;
 
     if (single_mode) {
         threads_count = 1;
     } else {
         threads_count = ModThreadsCount(aconf);
         SCLogInfo("Going to use %" PRId32 " thread(s)", threads_count);
+        dev = RunModeWorkersDeviceAdd(recv_mod_name, decode_mod_name,
+                thread_name, live_dev, aconf, threads_count);
     }
 
     /* create the threads */
     for (int thread = 0; thread < threads_count; thread++) {
-        char tname[TM_THREAD_NAME_MAX];
-        ThreadVars *tv = NULL;
-        TmModule *tm_module = NULL;
-        const char *visual_devname = LiveGetShortName(live_dev);
-        char *printable_threadname = SCMalloc(sizeof(char) * (strlen(thread_name)+5+strlen(live_dev)));
-        if (unlikely(printable_threadname == NULL)) {
-            SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc printable thread name: %s", strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-
-        if (single_mode) {
-            snprintf(tname, sizeof(tname), "%s#01-%s", thread_name, visual_devname);
-            snprintf(printable_threadname, strlen(thread_name)+5+strlen(live_dev), "%s#01-%s",
-                     thread_name, live_dev);
-        } else {
-            snprintf(tname, sizeof(tname), "%s#%02d-%s", thread_name,
-                     thread+1, visual_devname);
-            snprintf(printable_threadname, strlen(thread_name)+5+strlen(live_dev), "%s#%02d-%s",
-                     thread_name, thread+1, live_dev);
-        }
-        tv = TmThreadCreatePacketHandler(tname,
-                "packetpool", "packetpool",
-                "packetpool", "packetpool",
-                "pktacqloop");
+        ThreadVars *tv = RunModeSpawnLiveCaptureWorker(recv_mod_name,
+                decode_mod_name, thread_name, live_dev, aconf,
+                single_mode ? 0 : thread + 1);
         if (tv == NULL) {
-            SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
         }
-        tv->printable_name = printable_threadname;
-
-        tm_module = TmModuleGetByName(recv_mod_name);
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName failed for %s", recv_mod_name);
-            exit(EXIT_FAILURE);
+        if (dev != NULL) {
+            dev->tvs[dev->cnt++] = tv;
         }
-        TmSlotSetFuncAppend(tv, tm_module, aconf);
+    }
 
-        tm_module = TmModuleGetByName(decode_mod_name);
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName %s failed", decode_mod_name);
-            exit(EXIT_FAILURE);
-        }
-        TmSlotSetFuncAppend(tv, tm_module, NULL);
+    return 0;
+}
 
-        tm_module = TmModuleGetByName("FlowWorker");
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
-            exit(EXIT_FAILURE);
-        }
-        TmSlotSetFuncAppend(tv, tm_module, NULL);
+/* code to have the main thread add or remove workers, so it doesn't do
+ * so in the middle of a rule reload */
 
-        tm_module = TmModuleGetByName("RespondReject");
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
-            exit(EXIT_FAILURE);
-        }
-        TmSlotSetFuncAppend(tv, tm_module, NULL);
+typedef struct RunModeWorkersSyncer_ {
+    SCMutex m;
+    RunModeWorkersDevice *dev;
+    int delta;      /**< 1 to add a worker, -1 to remove one, 0 if idle */
+    int result;     /**< workers left after the last change, -1 on error */
+} RunModeWorkersSyncer;
 
-        TmThreadSetCPU(tv, WORKER_CPU_SET);
+static RunModeWorkersSyncer workers_sync = { SCMUTEX_INITIALIZER, NULL, 0, 0 };
 
-        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
-            SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
-            exit(EXIT_FAILURE);
-        }
+static int RunModeWorkersAdd(RunModeWorkersDevice *dev)
+{
+    ThreadVars **tvs = SCRealloc(dev->tvs, (dev->cnt + 1) * sizeof(ThreadVars *));
+    if (unlikely(tvs == NULL))
+        return -1;
+    dev->tvs = tvs;
+
+    /* for the new worker, it releases it at its init */
+    void *aconf = workers_ref_func(dev->aconf);
+    if (aconf == NULL)
+        return -1;
+
+    ThreadVars *tv = RunModeSpawnLiveCaptureWorker(dev->recv_mod_name,
+            dev->decode_mod_name, dev->thread_name, dev->live_dev, aconf,
+            dev->next_number);
+    if (tv == NULL)
+        return -1;
+    if (TmThreadsCheckFlag(tv, THV_CLOSED)) {
+        SCLogError(SC_ERR_THREAD_INIT, "%s: new worker %s failed to start",
+                dev->live_dev, tv->name);
+        TmThreadRetire(tv);
+        return -1;
     }
+    TmThreadContinue(tv);
 
-    return 0;
+    dev->tvs[dev->cnt++] = tv;
+    dev->next_number++;
+    SCLogNotice("%s: added worker %s, now %d workers", dev->live_dev,
+            tv->name, dev->cnt);
+    return dev->cnt;
+}
+
+static int RunModeWorkersRemove(RunModeWorkersDevice *dev)
+{
+    if (dev->cnt <= 1) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "%s: not removing the last "
+                "worker", dev->live_dev);
+        return -1;
+    }
+
+    ThreadVars *tv = dev->tvs[--dev->cnt];
+    TmThreadRetire(tv);
+    SCLogNotice("%s: removed worker %s, now %d workers", dev->live_dev,
+            tv->name, dev->cnt);
+    return dev->cnt;
+}
+
+/**
+ * \brief Carry out a pending change of the number of workers. Called by
+ *        the main loop.
+ */
+void RunModeWorkersSync(void)
+{
+    SCMutexLock(&workers_sync.m);
+    RunModeWorkersDevice *dev = workers_sync.dev;
+    const int delta = workers_sync.delta;
+    SCMutexUnlock(&workers_sync.m);
+
+    if (delta == 0)
+        return;
+
+    const int r = delta > 0 ? RunModeWorkersAdd(dev) : RunModeWorkersRemove(dev);
+
+    SCMutexLock(&workers_sync.m);
+    workers_sync.result = r;
+    workers_sync.delta = 0;
+    SCMutexUnlock(&workers_sync.m);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+static TmEcode RunModeWorkersCommand(json_t *cmd, json_t *answer, const int delta)
+{
+    SCEnter();
+    json_t *jarg = json_object_get(cmd, "iface");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("Iface is not a string"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    const char *name = json_string_value(jarg);
+
+    RunModeWorkersDevice *dev = workers_devices;
+    while (dev != NULL && strcmp(dev->live_dev, name) != 0)
+        dev = dev->next;
+    if (dev == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("Iface has no workers that can be added or removed"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    SCMutexLock(&workers_sync.m);
+    if (workers_sync.delta != 0) {
+        SCMutexUnlock(&workers_sync.m);
+        json_object_set_new(answer, "message",
+                json_string("Worker change already in progress"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    workers_sync.dev = dev;
+    workers_sync.delta = delta;
+    SCMutexUnlock(&workers_sync.m);
+
+    int r;
+    while (1) {
+        SCMutexLock(&workers_sync.m);
+        const int done = (workers_sync.delta == 0);
+        r = workers_sync.result;
+        SCMutexUnlock(&workers_sync.m);
+        if (done)
+            break;
+        if (suricata_ctl_flags != 0) {
+            json_object_set_new(answer, "message",
+                    json_string("Engine in shutdown mode"));
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        usleep(1000);
+    }
+
+    if (r < 0) {
+        json_object_set_new(answer, "message",
+                json_string(delta > 0 ? "Unable to add a worker" :
+                    "Unable to remove a worker"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    json_object_set_new(jdata, "workers", json_integer(r));
+    json_object_set_new(answer, "message", jdata);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode RunModeWorkerAddCommand(json_t *cmd, json_t *answer, void *data)
+{
+    return RunModeWorkersCommand(cmd, answer, 1);
+}
+
+TmEcode RunModeWorkerRemoveCommand(json_t *cmd, json_t *answer, void *data)
+{
+    return RunModeWorkersCommand(cmd, answer, -1);
 }
+#endif /* BUILD_UNIX_SOCKET */
 
 int RunModeSetLiveCaptureWorkers(ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -486,7 +740,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
         ThreadVars *tv_receive =
             TmThreadCreatePacketHandler(tname,
                     "packetpool", "packetpool",
-                    queues, "flow", "pktacqloop");
+                    queues, TmqhAutofpGetHandlerName(), "pktacqloop");
         if (tv_receive == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -521,7 +775,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhAutofpGetHandlerName(),
                                         "verdict-queue", "simple",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -29,6 +29,7 @@ int RunmodeGetFlowStreamAsync(void);
 typedef void *(*ConfigIfaceParserFunc) (const char *);
 typedef void *(*ConfigIPSParserFunc) (int);
 typedef int (*ConfigIfaceThreadsCountFunc) (void *);
+typedef void *(*ConfigIfaceRefFunc) (void *);
 
 int RunModeSetLiveCaptureAuto(ConfigIfaceParserFunc configparser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -66,4 +67,11 @@ int RunModeSetIPSWorker(ConfigIPSParserFunc ConfigParser,
 
 char *RunmodeAutoFpCreatePickupQueuesString(int n);
 
+void RunModeEnableWorkersScaling(ConfigIfaceRefFunc RefFunc);
+void RunModeWorkersSync(void);
+#ifdef BUILD_UNIX_SOCKET
+TmEcode RunModeWorkerAddCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode RunModeWorkerRemoveCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
 #endif /* __UTIL_RUNMODES_H__ */
@@ -467,6 +467,18 @@ static uint8_t *BMScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
     }
 }
 
+/* the nocase ctx holds the lowercase needle and its tables, so on a
+ * lowercase haystack the case sensitive search gives the same result
+ * without converting every haystack byte */
+static uint8_t *BMScanLowercase(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                                const uint8_t *haystack, uint32_t haystack_len)
+{
+    const SpmBmCtx *sctx = ctx->ctx;
+
+    return BoyerMoore(sctx->needle, sctx->needle_len, haystack,
+                      haystack_len, sctx->bm_ctx);
+}
+
 static SpmGlobalThreadCtx *BMInitGlobalThreadCtx(void)
 {
     SpmGlobalThreadCtx *global_thread_ctx = SCMalloc(sizeof(SpmGlobalThreadCtx));
@@ -516,4 +528,5 @@ void SpmBMRegister(void)
     spm_table[SPM_BM].InitCtx = BMInitCtx;
     spm_table[SPM_BM].DestroyCtx = BMDestroyCtx;
     spm_table[SPM_BM].Scan = BMScan;
+    spm_table[SPM_BM].ScanLowercase = BMScanLowercase;
 }
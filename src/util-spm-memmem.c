@@ -0,0 +1,350 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher that compares the first and the last byte of the
+ * needle at 16 (SSE2, NEON) or 32 (AVX2) positions at a time and verifies
+ * the candidates with a memcmp. There are no tables to build and no
+ * skips to look up, which for the short needles that most content
+ * keywords are makes it faster than Boyer-Moore. Nocase needles are
+ * stored lowercase: the haystack bytes compared to a letter get 0x20
+ * or'd in, so both cases of it match.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-spm.h"
+#include "util-spm-memmem.h"
+#include "util-memcmp.h"
+#include "util-memcpy.h"
+#include "util-cpu.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MEMMEM_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#define MEMMEM_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define MEMMEM_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct SpmMemmemCtx_ {
+    uint8_t *needle;
+    uint16_t needle_len;
+    int nocase;
+    /* or'd into the haystack bytes compared to the first and the last
+     * needle byte: 0x20 if the needle is nocase and the byte a letter */
+    uint8_t first_mask;
+    uint8_t last_mask;
+} SpmMemmemCtx;
+
+/** scans the haystack from *pos as long as a full vector fits, updates *pos
+ *  to where the scalar scan has to continue */
+typedef uint8_t *(*MemmemScanFunc)(const SpmMemmemCtx *, const uint8_t *,
+        uint32_t, uint32_t *, int);
+static MemmemScanFunc memmem_scan = NULL;
+
+static inline int MemmemVerify(const SpmMemmemCtx *sctx, const uint8_t *p,
+        int nocase)
+{
+    if (nocase)
+        return SCMemcmpLowercase(sctx->needle, p, sctx->needle_len) == 0;
+    return SCMemcmp(sctx->needle, p, sctx->needle_len) == 0;
+}
+
+static uint8_t *MemmemScanScalar(const SpmMemmemCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len, uint32_t i, int nocase)
+{
+    const uint32_t m = sctx->needle_len;
+    const uint8_t first = sctx->needle[0];
+    const uint8_t last = sctx->needle[m - 1];
+    const uint8_t fm = nocase ? sctx->first_mask : 0;
+    const uint8_t lm = nocase ? sctx->last_mask : 0;
+
+    for ( ; i + m <= haystack_len; i++) {
+        if ((haystack[i] | fm) == first && (haystack[i + m - 1] | lm) == last &&
+                MemmemVerify(sctx, haystack + i, nocase))
+            return (uint8_t *)haystack + i;
+    }
+    return NULL;
+}
+
+#ifdef MEMMEM_HAVE_SSE2
+static uint8_t *MemmemScanSSE2(const SpmMemmemCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len, uint32_t *pos, int nocase)
+{
+    const uint32_t m = sctx->needle_len;
+    const __m128i first = _mm_set1_epi8((char)sctx->needle[0]);
+    const __m128i last = _mm_set1_epi8((char)sctx->needle[m - 1]);
+    const __m128i fm = _mm_set1_epi8(nocase ? (char)sctx->first_mask : 0);
+    const __m128i lm = _mm_set1_epi8(nocase ? (char)sctx->last_mask : 0);
+
+    uint32_t i = *pos;
+    for ( ; i + m - 1 + 16 <= haystack_len; i += 16) {
+        const __m128i f = _mm_loadu_si128((const __m128i *)(haystack + i));
+        const __m128i l = _mm_loadu_si128((const __m128i *)(haystack + i + m - 1));
+        const __m128i eq = _mm_and_si128(
+                _mm_cmpeq_epi8(first, _mm_or_si128(f, fm)),
+                _mm_cmpeq_epi8(last, _mm_or_si128(l, lm)));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(eq);
+        while (bits != 0) {
+            const int j = __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (MemmemVerify(sctx, haystack + i + j, nocase))
+                return (uint8_t *)haystack + i + j;
+        }
+    }
+    *pos = i;
+    return NULL;
+}
+#endif /* MEMMEM_HAVE_SSE2 */
+
+#ifdef MEMMEM_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint8_t *MemmemScanAVX2(const SpmMemmemCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len, uint32_t *pos, int nocase)
+{
+    const uint32_t m = sctx->needle_len;
+    const __m256i first = _mm256_set1_epi8((char)sctx->needle[0]);
+    const __m256i last = _mm256_set1_epi8((char)sctx->needle[m - 1]);
+    const __m256i fm = _mm256_set1_epi8(nocase ? (char)sctx->first_mask : 0);
+    const __m256i lm = _mm256_set1_epi8(nocase ? (char)sctx->last_mask : 0);
+
+    uint32_t i = *pos;
+    for ( ; i + m - 1 + 32 <= haystack_len; i += 32) {
+        const __m256i f = _mm256_loadu_si256((const __m256i *)(haystack + i));
+        const __m256i l = _mm256_loadu_si256((const __m256i *)(haystack + i + m - 1));
+        const __m256i eq = _mm256_and_si256(
+                _mm256_cmpeq_epi8(first, _mm256_or_si256(f, fm)),
+                _mm256_cmpeq_epi8(last, _mm256_or_si256(l, lm)));
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(eq);
+        while (bits != 0) {
+            const int j = __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (MemmemVerify(sctx, haystack + i + j, nocase))
+                return (uint8_t *)haystack + i + j;
+        }
+    }
+    *pos = i;
+#ifdef MEMMEM_HAVE_SSE2
+    /* most haystacks are short, do what is left 16 at a time */
+    return MemmemScanSSE2(sctx, haystack, haystack_len, pos, nocase);
+#else
+    return NULL;
+#endif
+}
+#endif /* MEMMEM_HAVE_AVX2 */
+
+#ifdef MEMMEM_HAVE_NEON
+static uint8_t *MemmemScanNEON(const SpmMemmemCtx *sctx,
+        const uint8_t *haystack, uint32_t haystack_len, uint32_t *pos, int nocase)
+{
+    const uint32_t m = sctx->needle_len;
+    const uint8x16_t first = vdupq_n_u8(sctx->needle[0]);
+    const uint8x16_t last = vdupq_n_u8(sctx->needle[m - 1]);
+    const uint8x16_t fm = vdupq_n_u8(nocase ? sctx->first_mask : 0);
+    const uint8x16_t lm = vdupq_n_u8(nocase ? sctx->last_mask : 0);
+
+    uint32_t i = *pos;
+    for ( ; i + m - 1 + 16 <= haystack_len; i += 16) {
+        const uint8x16_t f = vld1q_u8(haystack + i);
+        const uint8x16_t l = vld1q_u8(haystack + i + m - 1);
+        const uint8x16_t eq = vandq_u8(vceqq_u8(first, vorrq_u8(f, fm)),
+                vceqq_u8(last, vorrq_u8(l, lm)));
+        /* narrow to 4 bits per position, there is no movemask */
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+                    vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        bits &= 0x8888888888888888ULL;
+        while (bits != 0) {
+            const int j = __builtin_ctzll(bits) >> 2;
+            bits &= bits - 1;
+            if (MemmemVerify(sctx, haystack + i + j, nocase))
+                return (uint8_t *)haystack + i + j;
+        }
+    }
+    *pos = i;
+    return NULL;
+}
+#endif /* MEMMEM_HAVE_NEON */
+
+static uint8_t *MemmemFind(const SpmMemmemCtx *sctx, const uint8_t *haystack,
+        uint32_t haystack_len, int nocase)
+{
+    if (sctx->needle_len == 0)
+        return (uint8_t *)haystack;
+    if (haystack_len < sctx->needle_len)
+        return NULL;
+
+    uint32_t i = 0;
+    if (memmem_scan != NULL) {
+        uint8_t *found = memmem_scan(sctx, haystack, haystack_len, &i, nocase);
+        if (found != NULL)
+            return found;
+    }
+    return MemmemScanScalar(sctx, haystack, haystack_len, i, nocase);
+}
+
+static SpmCtx *MemmemInitCtx(const uint8_t *needle, uint16_t needle_len,
+                             int nocase, SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmCtx *ctx = SCMalloc(sizeof(SpmCtx));
+    if (ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmCtx.");
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matcher = SPM_MEMMEM;
+
+    SpmMemmemCtx *sctx = SCMalloc(sizeof(SpmMemmemCtx));
+    if (sctx == NULL) {
+        SCLogDebug("Unable to alloc SpmMemmemCtx.");
+        SCFree(ctx);
+        return NULL;
+    }
+    memset(sctx, 0, sizeof(*sctx));
+
+    /* at least one byte, so the first and last byte can always be read */
+    sctx->needle = SCMalloc(needle_len > 0 ? needle_len : 1);
+    if (sctx->needle == NULL) {
+        SCLogDebug("Unable to alloc string.");
+        SCFree(sctx);
+        SCFree(ctx);
+        return NULL;
+    }
+    sctx->needle_len = needle_len;
+    sctx->nocase = nocase ? 1 : 0;
+    if (nocase) {
+        memcpy_tolower(sctx->needle, needle, needle_len);
+        if (needle_len > 0) {
+            const uint8_t f = sctx->needle[0];
+            const uint8_t l = sctx->needle[needle_len - 1];
+            if (f >= 'a' && f <= 'z')
+                sctx->first_mask = 0x20;
+            if (l >= 'a' && l <= 'z')
+                sctx->last_mask = 0x20;
+        }
+    } else {
+        memcpy(sctx->needle, needle, needle_len);
+    }
+
+    ctx->ctx = sctx;
+    return ctx;
+}
+
+static void MemmemDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    SpmMemmemCtx *sctx = ctx->ctx;
+    if (sctx != NULL) {
+        if (sctx->needle != NULL) {
+            SCFree(sctx->needle);
+        }
+        SCFree(sctx);
+    }
+
+    SCFree(ctx);
+}
+
+static uint8_t *MemmemScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                           const uint8_t *haystack, uint32_t haystack_len)
+{
+    const SpmMemmemCtx *sctx = ctx->ctx;
+    return MemmemFind(sctx, haystack, haystack_len, sctx->nocase);
+}
+
+/* the nocase needle is lowercase, so on a lowercase haystack the case
+ * sensitive compare finds the same */
+static uint8_t *MemmemScanLowercase(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                                    const uint8_t *haystack, uint32_t haystack_len)
+{
+    const SpmMemmemCtx *sctx = ctx->ctx;
+    return MemmemFind(sctx, haystack, haystack_len, 0);
+}
+
+static SpmGlobalThreadCtx *MemmemInitGlobalThreadCtx(void)
+{
+    SpmGlobalThreadCtx *global_thread_ctx = SCMalloc(sizeof(SpmGlobalThreadCtx));
+    if (global_thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(global_thread_ctx, 0, sizeof(*global_thread_ctx));
+    global_thread_ctx->matcher = SPM_MEMMEM;
+    return global_thread_ctx;
+}
+
+static void MemmemDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (global_thread_ctx == NULL) {
+        return;
+    }
+    SCFree(global_thread_ctx);
+}
+
+static void MemmemDestroyThreadCtx(SpmThreadCtx *thread_ctx)
+{
+    if (thread_ctx == NULL) {
+        return;
+    }
+    SCFree(thread_ctx);
+}
+
+static SpmThreadCtx *MemmemMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmThreadCtx *thread_ctx = SCMalloc(sizeof(SpmThreadCtx));
+    if (thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(thread_ctx, 0, sizeof(*thread_ctx));
+    thread_ctx->matcher = SPM_MEMMEM;
+    return thread_ctx;
+}
+
+void SpmMemmemRegister(void)
+{
+    spm_table[SPM_MEMMEM].name = "memmem";
+    spm_table[SPM_MEMMEM].InitGlobalThreadCtx = MemmemInitGlobalThreadCtx;
+    spm_table[SPM_MEMMEM].DestroyGlobalThreadCtx = MemmemDestroyGlobalThreadCtx;
+    spm_table[SPM_MEMMEM].MakeThreadCtx = MemmemMakeThreadCtx;
+    spm_table[SPM_MEMMEM].DestroyThreadCtx = MemmemDestroyThreadCtx;
+    spm_table[SPM_MEMMEM].InitCtx = MemmemInitCtx;
+    spm_table[SPM_MEMMEM].DestroyCtx = MemmemDestroyCtx;
+    spm_table[SPM_MEMMEM].Scan = MemmemScan;
+    spm_table[SPM_MEMMEM].ScanLowercase = MemmemScanLowercase;
+
+#if defined(MEMMEM_HAVE_AVX2)
+    if (UtilCpuHasAVX2()) {
+        memmem_scan = MemmemScanAVX2;
+        return;
+    }
+#endif
+#if defined(MEMMEM_HAVE_SSE2)
+    memmem_scan = MemmemScanSSE2;
+#elif defined(MEMMEM_HAVE_NEON)
+    memmem_scan = MemmemScanNEON;
+#endif
+}
@@ -0,0 +1,37 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher that compares the first and the last byte of the
+ * needle at 16 or 32 positions at a time, then verifies the candidates.
+ */
+
+#ifndef __UTIL_SPM_MEMMEM_H__
+#define __UTIL_SPM_MEMMEM_H__
+
+/** needles up to these lengths use memmem under spm-algo auto. Beyond
+ *  them Boyer-Moore skips far enough to win on short buffers, later for
+ *  nocase, as its nocase loop lowercases every byte it looks at. See
+ *  'suricata --bench=spm'. */
+#define SPM_MEMMEM_AUTO_MAXLEN          16
+#define SPM_MEMMEM_AUTO_MAXLEN_NOCASE   32
+
+void SpmMemmemRegister(void);
+
+#endif /* __UTIL_SPM_MEMMEM_H__ */
@@ -54,11 +54,17 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-spm-hs.h"
+#include "util-spm-memmem.h"
 #include "util-clock.h"
+#include "util-memcpy.h"
 #ifdef BUILD_HYPERSCAN
 #include "hs.h"
 #endif
 
+/** set when spm-algo is auto: SpmInitCtx then uses memmem for the short
+ *  needles, whatever the matcher of the global thread ctx is */
+static bool spm_auto_select = false;
+
 /**
  * \brief Returns the single pattern matcher algorithm to be used, based on the
  * spm-algo setting in yaml.
@@ -76,6 +82,7 @@ uint16_t SinglePatternMatchDefaultMatcher(void)
                     continue;
                 }
                 if (strcmp(spm_table[i].name, spm_algo) == 0) {
+                    spm_auto_select = false;
                     return i;
                 }
             }
@@ -89,6 +96,7 @@ uint16_t SinglePatternMatchDefaultMatcher(void)
     }
 
 default_matcher:
+    spm_auto_select = true;
     /* When Suricata is built with Hyperscan support, default to using it for
      * SPM. */
 #ifdef BUILD_HYPERSCAN
@@ -115,8 +123,10 @@ default_matcher:
 void SpmTableSetup(void)
 {
     memset(spm_table, 0, sizeof(spm_table));
+    spm_auto_select = false;
 
     SpmBMRegister();
+    SpmMemmemRegister();
 #ifdef BUILD_HYPERSCAN
     #ifdef HAVE_HS_VALID_PLATFORM
         if (hs_valid_platform() == HS_SUCCESS) {
@@ -168,6 +178,14 @@ SpmCtx *SpmInitCtx(const uint8_t *needle, uint16_t needle_len, int nocase,
 {
     BUG_ON(global_thread_ctx == NULL);
     uint16_t matcher = global_thread_ctx->matcher;
+    /* the needle is found by comparing its first and last bytes many
+     * positions at a time faster than the skip tables or a Hyperscan scan
+     * call can get to it. Its Scan doesn't use the thread ctx, so any
+     * other matcher's will do. */
+    if (spm_auto_select && needle_len <= (nocase ?
+                SPM_MEMMEM_AUTO_MAXLEN_NOCASE : SPM_MEMMEM_AUTO_MAXLEN)) {
+        matcher = SPM_MEMMEM;
+    }
     BUG_ON(spm_table[matcher].InitCtx == NULL);
     return spm_table[matcher].InitCtx(needle, needle_len, nocase,
                                       global_thread_ctx);
@@ -190,6 +208,22 @@ uint8_t *SpmScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
     return spm_table[matcher].Scan(ctx, thread_ctx, haystack, haystack_len);
 }
 
+/**
+ * \brief scan a haystack that was converted to lowercase already
+ *
+ * Only to be used with contexts created with nocase set. Matchers that
+ * can't take advantage of the lowercase haystack do a regular Scan.
+ */
+uint8_t *SpmScanLowercase(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                          const uint8_t *haystack, uint32_t haystack_len)
+{
+    uint16_t matcher = ctx->matcher;
+    if (spm_table[matcher].ScanLowercase != NULL) {
+        return spm_table[matcher].ScanLowercase(ctx, thread_ctx, haystack, haystack_len);
+    }
+    return spm_table[matcher].Scan(ctx, thread_ctx, haystack, haystack_len);
+}
+
 /**
  * Wrappers for building context and searching (Bs2Bm and boyermoore)
  * Use them if you cant store the context
@@ -2663,6 +2697,162 @@ static int SpmSearchTest02(void) {
     return ret;
 }
 
+/** \test nocase scan of a lowercase haystack matches the regular scan */
+static int SpmSearchTest03(void)
+{
+    SpmTableSetup();
+
+    static const char *needles[] = { "a", "FOO", "Suricata", "mIxEd cAsE", "\xff" };
+    static const char *haystack = "foo Foo FOo fOo foO FOO This is a SURIcata "
+        "MIXED case test \xff";
+    const uint32_t haystack_len = strlen(haystack);
+    uint8_t lc[haystack_len];
+    memcpy_tolower(lc, (const uint8_t *)haystack, haystack_len);
+
+    for (uint16_t matcher = 0; matcher < SPM_TABLE_SIZE; matcher++) {
+        if (spm_table[matcher].name == NULL)
+            continue;
+
+        SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+        FAIL_IF_NULL(global_thread_ctx);
+        SpmThreadCtx *thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+        FAIL_IF_NULL(thread_ctx);
+
+        for (uint32_t i = 0; i < sizeof(needles) / sizeof(needles[0]); i++) {
+            SpmCtx *ctx = SpmInitCtx((const uint8_t *)needles[i],
+                    strlen(needles[i]), 1, global_thread_ctx);
+            FAIL_IF_NULL(ctx);
+
+            const uint8_t *found = SpmScan(ctx, thread_ctx,
+                    (const uint8_t *)haystack, haystack_len);
+            const uint8_t *found_lc = SpmScanLowercase(ctx, thread_ctx,
+                    lc, haystack_len);
+            FAIL_IF_NULL(found);
+            FAIL_IF_NULL(found_lc);
+            FAIL_IF(found - (const uint8_t *)haystack != found_lc - lc);
+
+            SpmDestroyCtx(ctx);
+        }
+
+        SpmDestroyThreadCtx(thread_ctx);
+        SpmDestroyGlobalThreadCtx(global_thread_ctx);
+    }
+    PASS;
+}
+
+/** \test every matcher against BasicSearch, for all the needle positions
+ *        around the 16 and 32 byte blocks the memmem matcher works in */
+static int SpmSearchTest04(void)
+{
+    SpmTableSetup();
+
+    uint8_t haystack[80];
+    uint8_t lc[sizeof(haystack)];
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < sizeof(haystack); i++) {
+        seed = seed * 1103515245 + 12345;
+        /* few distinct bytes, so there are many candidates to verify */
+        haystack[i] = "aAbB\x00\xff"[(seed >> 16) % 6];
+    }
+    memcpy_tolower(lc, haystack, sizeof(haystack));
+
+    for (uint16_t matcher = 0; matcher < SPM_TABLE_SIZE; matcher++) {
+        if (spm_table[matcher].name == NULL)
+            continue;
+
+        SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+        FAIL_IF_NULL(global_thread_ctx);
+        SpmThreadCtx *thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+        FAIL_IF_NULL(thread_ctx);
+
+        for (uint16_t len = 1; len <= 40; len++) {
+            for (uint32_t pos = 0; pos + len <= sizeof(haystack); pos += 3) {
+                const uint8_t *needle = haystack + pos;
+                for (int nocase = 0; nocase <= 1; nocase++) {
+                    SpmCtx *ctx = SpmInitCtx(needle, len, nocase, global_thread_ctx);
+                    FAIL_IF_NULL(ctx);
+                    for (uint32_t hlen = len; hlen <= sizeof(haystack); hlen += 7) {
+                        const uint8_t *expect = nocase ?
+                            BasicSearchNocase(haystack, hlen, needle, len) :
+                            BasicSearch(haystack, hlen, needle, len);
+                        const uint8_t *found = SpmScan(ctx, thread_ctx, haystack, hlen);
+                        FAIL_IF(found != expect);
+                        if (nocase) {
+                            found = SpmScanLowercase(ctx, thread_ctx, lc, hlen);
+                            FAIL_IF((found == NULL) != (expect == NULL));
+                            FAIL_IF(found != NULL && found - lc != expect - haystack);
+                        }
+                    }
+                    SpmDestroyCtx(ctx);
+                }
+            }
+        }
+
+        SpmDestroyThreadCtx(thread_ctx);
+        SpmDestroyGlobalThreadCtx(global_thread_ctx);
+    }
+    PASS;
+}
+
+/** \test spm-algo auto uses memmem for the short needles only, an
+ *        explicit spm-algo for all of them */
+static int SpmSearchTest05(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    SpmTableSetup();
+
+    const uint8_t needle[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    const uint8_t haystack[] = "the alphabet 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    FAIL_IF_NOT(ConfSetFinal("spm-algo", "auto"));
+    uint16_t matcher = SinglePatternMatchDefaultMatcher();
+    SpmGlobalThreadCtx *global_thread_ctx = SpmInitGlobalThreadCtx(matcher);
+    FAIL_IF_NULL(global_thread_ctx);
+    SpmThreadCtx *thread_ctx = SpmMakeThreadCtx(global_thread_ctx);
+    FAIL_IF_NULL(thread_ctx);
+
+    SpmCtx *ctx = SpmInitCtx(needle, SPM_MEMMEM_AUTO_MAXLEN, 0, global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ctx->matcher == SPM_MEMMEM);
+    FAIL_IF(SpmScan(ctx, thread_ctx, haystack, sizeof(haystack) - 1) != NULL);
+    SpmDestroyCtx(ctx);
+
+    ctx = SpmInitCtx(needle, SPM_MEMMEM_AUTO_MAXLEN, 1, global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ctx->matcher == SPM_MEMMEM);
+    FAIL_IF_NOT(SpmScan(ctx, thread_ctx, haystack, sizeof(haystack) - 1) == haystack + 13);
+    SpmDestroyCtx(ctx);
+
+    ctx = SpmInitCtx(needle, SPM_MEMMEM_AUTO_MAXLEN + 1, 0, global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ctx->matcher == matcher);
+    SpmDestroyCtx(ctx);
+
+    ctx = SpmInitCtx(needle, SPM_MEMMEM_AUTO_MAXLEN_NOCASE + 1, 1, global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ctx->matcher == matcher);
+    SpmDestroyCtx(ctx);
+
+    SpmDestroyThreadCtx(thread_ctx);
+    SpmDestroyGlobalThreadCtx(global_thread_ctx);
+
+    FAIL_IF_NOT(ConfSetFinal("spm-algo", "bm"));
+    FAIL_IF_NOT(SinglePatternMatchDefaultMatcher() == SPM_BM);
+    global_thread_ctx = SpmInitGlobalThreadCtx(SPM_BM);
+    FAIL_IF_NULL(global_thread_ctx);
+    ctx = SpmInitCtx(needle, 1, 0, global_thread_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NOT(ctx->matcher == SPM_BM);
+    SpmDestroyCtx(ctx);
+    SpmDestroyGlobalThreadCtx(global_thread_ctx);
+
+    SpmTableSetup();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+
 #endif
 
 /* Register unittests */
@@ -2706,6 +2896,9 @@ void UtilSpmSearchRegistertests(void)
     /* new SPM API */
     UtRegisterTest("SpmSearchTest01", SpmSearchTest01);
     UtRegisterTest("SpmSearchTest02", SpmSearchTest02);
+    UtRegisterTest("SpmSearchTest03", SpmSearchTest03);
+    UtRegisterTest("SpmSearchTest04", SpmSearchTest04);
+    UtRegisterTest("SpmSearchTest05", SpmSearchTest05);
 
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */
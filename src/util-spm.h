@@ -31,6 +31,7 @@
 enum {
     SPM_BM, /* Boyer-Moore */
     SPM_HS, /* Hyperscan */
+    SPM_MEMMEM, /* first and last byte compare, SIMD where available */
     /* Other SPM matchers will go here. */
     SPM_TABLE_SIZE
 };
@@ -69,6 +70,9 @@ typedef struct SpmTableElmt_ {
     void (*DestroyCtx)(SpmCtx *);
     uint8_t *(*Scan)(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
                      const uint8_t *haystack, uint32_t haystack_len);
+    /** optional: scan for a nocase needle in a lowercase haystack */
+    uint8_t *(*ScanLowercase)(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                              const uint8_t *haystack, uint32_t haystack_len);
 } SpmTableElmt;
 
 SpmTableElmt spm_table[SPM_TABLE_SIZE];
@@ -91,6 +95,9 @@ void SpmDestroyCtx(SpmCtx *ctx);
 uint8_t *SpmScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
                  const uint8_t *haystack, uint32_t haystack_len);
 
+uint8_t *SpmScanLowercase(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                          const uint8_t *haystack, uint32_t haystack_len);
+
 /** Default algorithm to use: Boyer Moore */
 uint8_t *Bs2bmSearch(const uint8_t *text, uint32_t textlen, const uint8_t *needle, uint16_t needlelen);
 uint8_t *Bs2bmNocaseSearch(const uint8_t *text, uint32_t textlen, const uint8_t *needle, uint16_t needlelen);
@@ -0,0 +1,260 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * The main thread times the phases of the startup with StartupPhaseBegin()
+ * and StartupPhaseEnd(), the times are logged once the engine runs.
+ *
+ * With 'startup.parallel-init' a task passed to StartupTaskRun() runs in
+ * its own thread while the startup goes on, until StartupTasksWait() is
+ * called before the packet threads are started. A task can't depend on
+ * anything set up after it was started and nothing but the task may
+ * touch what it sets up until then. After the startup, or without
+ * parallel init, tasks just run in the calling thread.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "util-startup.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+typedef struct StartupPhase_ {
+    const char *name;
+    /** usecs since StartupProfileInit() */
+    uint64_t begin;
+    uint64_t usecs;
+    /** ran as a task in parallel to the main thread */
+    bool task;
+} StartupPhase;
+
+typedef struct StartupTask_ {
+    const char *name;
+    void (*Func)(void);
+    pthread_t thread;
+} StartupTask;
+
+static uint64_t startup_t0 = 0;
+
+static SCMutex startup_lock = SCMUTEX_INITIALIZER;
+static StartupPhase startup_phases[STARTUP_MAX_PHASES];
+static uint32_t startup_phases_cnt = 0;
+
+/** only used by the main thread */
+static StartupTask startup_tasks[STARTUP_MAX_TASKS];
+static uint32_t startup_tasks_cnt = 0;
+static int startup_parallel = 0;
+
+static uint64_t StartupNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/** \brief start the startup clock, first thing in main() */
+void StartupProfileInit(void)
+{
+    startup_t0 = StartupNow();
+}
+
+/** \retval begin time to pass to StartupPhaseEnd() */
+uint64_t StartupPhaseBegin(void)
+{
+    return StartupNow();
+}
+
+static void StartupPhaseAdd(const char *name, uint64_t begin, bool task)
+{
+    const uint64_t end = StartupNow();
+
+    SCMutexLock(&startup_lock);
+    if (startup_phases_cnt < STARTUP_MAX_PHASES) {
+        StartupPhase *ph = &startup_phases[startup_phases_cnt++];
+        ph->name = name;
+        ph->begin = begin >= startup_t0 ? begin - startup_t0 : 0;
+        ph->usecs = end - begin;
+        ph->task = task;
+    }
+    SCMutexUnlock(&startup_lock);
+}
+
+/** \brief record a phase of the startup
+ *  \param name static string
+ *  \param begin return value of StartupPhaseBegin() */
+void StartupPhaseEnd(const char *name, uint64_t begin)
+{
+    StartupPhaseAdd(name, begin, false);
+}
+
+/** \brief log the startup phases in the order they started */
+void StartupProfileReport(void)
+{
+    SCMutexLock(&startup_lock);
+    StartupPhase phases[STARTUP_MAX_PHASES];
+    const uint32_t cnt = startup_phases_cnt;
+    memcpy(phases, startup_phases, cnt * sizeof(phases[0]));
+    SCMutexUnlock(&startup_lock);
+
+    for (uint32_t i = 1; i < cnt; i++) {
+        StartupPhase ph = phases[i];
+        uint32_t j = i;
+        while (j > 0 && phases[j - 1].begin > ph.begin) {
+            phases[j] = phases[j - 1];
+            j--;
+        }
+        phases[j] = ph;
+    }
+
+    uint64_t tasks = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        const StartupPhase *ph = &phases[i];
+        SCLogPerf("startup: %-20s at %8.1f ms took %8.1f ms%s", ph->name,
+                (double)ph->begin / 1000, (double)ph->usecs / 1000,
+                ph->task ? " (parallel)" : "");
+        if (ph->task)
+            tasks += ph->usecs;
+    }
+    const uint64_t total = StartupNow() - startup_t0;
+    if (tasks > 0) {
+        SCLogInfo("startup took %.1f ms, %.1f ms of it in parallel tasks",
+                (double)total / 1000, (double)tasks / 1000);
+    } else {
+        SCLogInfo("startup took %.1f ms", (double)total / 1000);
+    }
+}
+
+void StartupTasksInitConfig(void)
+{
+    int parallel = 1;
+    (void)ConfGetBool("startup.parallel-init", &parallel);
+    startup_parallel = parallel;
+    SCLogDebug("parallel init %s", parallel ? "enabled" : "disabled");
+}
+
+static void *StartupTaskMain(void *arg)
+{
+    StartupTask *task = arg;
+    (void)SCSetThreadName("StartupTask");
+
+    const uint64_t begin = StartupNow();
+    task->Func();
+    StartupPhaseAdd(task->name, begin, true);
+    return NULL;
+}
+
+/**
+ *  \brief run Func in parallel to the startup, or now
+ *
+ *  \param name static string
+ */
+void StartupTaskRun(const char *name, void (*Func)(void))
+{
+    if (startup_parallel && startup_tasks_cnt < STARTUP_MAX_TASKS) {
+        StartupTask *task = &startup_tasks[startup_tasks_cnt];
+        task->name = name;
+        task->Func = Func;
+        if (pthread_create(&task->thread, NULL, StartupTaskMain, task) == 0) {
+            startup_tasks_cnt++;
+            return;
+        }
+        SCLogWarning(SC_ERR_THREAD_CREATE, "failed to start %s in "
+                "parallel: %s", name, strerror(errno));
+    }
+
+    const uint64_t begin = StartupNow();
+    Func();
+    StartupPhaseAdd(name, begin, false);
+}
+
+/** \brief wait for the tasks to finish, later tasks run right away */
+void StartupTasksWait(void)
+{
+    if (startup_tasks_cnt > 0) {
+        const uint64_t begin = StartupNow();
+        for (uint32_t i = 0; i < startup_tasks_cnt; i++) {
+            pthread_join(startup_tasks[i].thread, NULL);
+        }
+        StartupPhaseAdd("wait for tasks", begin, false);
+    }
+    startup_tasks_cnt = 0;
+    startup_parallel = 0;
+}
+
+#ifdef UNITTESTS
+static int startup_test_cnt = 0;
+
+static void StartupTestTask(void)
+{
+    __atomic_fetch_add(&startup_test_cnt, 1, __ATOMIC_SEQ_CST);
+}
+
+/** \test tasks run in parallel until waited for, then inline */
+static int StartupTest01(void)
+{
+    const uint32_t phases_cnt = startup_phases_cnt;
+    startup_test_cnt = 0;
+
+    startup_parallel = 1;
+    StartupTaskRun("test task 1", StartupTestTask);
+    StartupTaskRun("test task 2", StartupTestTask);
+    FAIL_IF_NOT(startup_tasks_cnt == 2);
+    StartupTasksWait();
+    FAIL_IF_NOT(__atomic_load_n(&startup_test_cnt, __ATOMIC_SEQ_CST) == 2);
+    FAIL_IF_NOT(startup_tasks_cnt == 0);
+    FAIL_IF(startup_parallel);
+
+    /* after the wait tasks run right away */
+    StartupTaskRun("test task 3", StartupTestTask);
+    FAIL_IF_NOT(startup_test_cnt == 3);
+    FAIL_IF_NOT(startup_tasks_cnt == 0);
+
+    /* 2 tasks, the wait and the inline task */
+    FAIL_IF_NOT(startup_phases_cnt == phases_cnt + 4 ||
+            startup_phases_cnt == STARTUP_MAX_PHASES);
+    startup_phases_cnt = phases_cnt;
+    PASS;
+}
+
+/** \test phases are recorded relative to the start */
+static int StartupTest02(void)
+{
+    const uint32_t phases_cnt = startup_phases_cnt;
+    FAIL_IF(phases_cnt >= STARTUP_MAX_PHASES);
+
+    const uint64_t begin = StartupPhaseBegin();
+    StartupPhaseEnd("test phase", begin);
+    FAIL_IF_NOT(startup_phases_cnt == phases_cnt + 1);
+    const StartupPhase *ph = &startup_phases[phases_cnt];
+    FAIL_IF_NOT(strcmp(ph->name, "test phase") == 0);
+    FAIL_IF_NOT(ph->begin == begin - startup_t0);
+    FAIL_IF(ph->task);
+    startup_phases_cnt = phases_cnt;
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void StartupRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StartupTest01", StartupTest01);
+    UtRegisterTest("StartupTest02", StartupTest02);
+#endif
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Startup phase timing and tasks that run in parallel to the rest of
+ * the startup, like preallocating the flow hash while the rules load.
+ */
+
+#ifndef __UTIL_STARTUP_H__
+#define __UTIL_STARTUP_H__
+
+#define STARTUP_MAX_PHASES  32
+#define STARTUP_MAX_TASKS   8
+
+void StartupProfileInit(void);
+uint64_t StartupPhaseBegin(void);
+void StartupPhaseEnd(const char *name, uint64_t begin);
+void StartupProfileReport(void);
+
+void StartupTasksInitConfig(void);
+void StartupTaskRun(const char *name, void (*Func)(void));
+void StartupTasksWait(void);
+
+void StartupRegisterTests(void);
+
+#endif /* __UTIL_STARTUP_H__ */
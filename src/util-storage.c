@@ -58,6 +58,8 @@ static const char *StoragePrintType(StorageEnum type)
             return "ippair";
         case STORAGE_DEVICE:
             return "livedevice";
+        case STORAGE_FLOW_LATE:
+            return "flow-late";
         case STORAGE_MAX:
             return "max";
     }
@@ -31,6 +31,8 @@ typedef enum StorageEnum_ {
     STORAGE_FLOW,
     STORAGE_IPPAIR,
     STORAGE_DEVICE,
+    /** flow storage kept in FlowExt, see FLOW_STORAGE_LATE */
+    STORAGE_FLOW_LATE,
 
     STORAGE_MAX,
 } StorageEnum;
@@ -20,6 +20,7 @@
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-validate.h"
+#include "util-memcmp.h"
 
 /**
  * \file
@@ -41,6 +42,7 @@
     (cfg)->Free ? (cfg)->Free((ptr), (s)) : SCFree((ptr))
 
 static void SBBFree(StreamingBuffer *sb);
+static void RegionsFree(StreamingBuffer *sb);
 
 RB_GENERATE(SBB, StreamingBufferBlock, rb, SBBCompare);
 
@@ -135,6 +137,7 @@ void StreamingBufferClear(StreamingBuffer *sb)
         SCLogDebug("sb->buf_size %u max %u", sb->buf_size, sb->buf_size_max);
 
         SBBFree(sb);
+        RegionsFree(sb);
         if (sb->buf != NULL) {
             FREE(sb->cfg, sb->buf, sb->buf_size);
             sb->buf = NULL;
@@ -427,6 +430,195 @@ static void SBBPrune(StreamingBuffer *sb)
     }
 }
 
+static void RegionFree(StreamingBuffer *sb, StreamingBufferRegion *r)
+{
+    if (r->buf != NULL)
+        FREE(sb->cfg, r->buf, r->buf_size);
+    FREE(sb->cfg, r, sizeof(*r));
+    sb->regions_cnt--;
+}
+
+static void RegionsFree(StreamingBuffer *sb)
+{
+    StreamingBufferRegion *r = sb->regions;
+    while (r != NULL) {
+        StreamingBufferRegion *next = r->next;
+        RegionFree(sb, r);
+        r = next;
+    }
+    sb->regions = NULL;
+}
+
+/** \internal
+ *  \brief get the region holding the data at 'offset'
+ *  \retval r region or NULL if the data isn't in a region
+ */
+static inline const StreamingBufferRegion *GetRegion(const StreamingBuffer *sb,
+        uint64_t offset)
+{
+    const StreamingBufferRegion *r;
+    for (r = sb->regions; r != NULL; r = r->next) {
+        if (offset < r->stream_offset)
+            break;
+        if (offset < r->stream_offset + r->buf_offset)
+            return r;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief size to allocate for a region, in multiples of
+ *         StreamingBufferConfig::buf_size
+ */
+static inline uint32_t RegionSize(const StreamingBuffer *sb, uint32_t size)
+{
+    const uint32_t x = sb->cfg->buf_size ? size % sb->cfg->buf_size : 0;
+    if (x == 0)
+        return size;
+    return size - x + sb->cfg->buf_size;
+}
+
+/** \internal
+ *  \brief grow region 'r' to cover 'start' till 'end'
+ *
+ *  If the region starts later than 'start' a new block is allocated
+ *  and the data is moved to it, otherwise the block is realloc'd.
+ *
+ *  \retval 0 ok
+ *  \retval -1 failed, region unchanged
+ */
+static int RegionGrow(StreamingBuffer *sb, StreamingBufferRegion *r,
+        uint64_t start, uint64_t end)
+{
+    if (end - start > UINT32_MAX)
+        return -1;
+    const uint32_t size = RegionSize(sb, (uint32_t)(end - start));
+
+    if (start < r->stream_offset) {
+        uint8_t *ptr = CALLOC(sb->cfg, 1, size);
+        if (ptr == NULL)
+            return -1;
+        memcpy(ptr + (r->stream_offset - start), r->buf, r->buf_offset);
+        FREE(sb->cfg, r->buf, r->buf_size);
+        r->buf_offset += (r->stream_offset - start);
+        r->stream_offset = start;
+        r->buf = ptr;
+        r->buf_size = size;
+    } else if (size > r->buf_size) {
+        uint8_t *ptr = REALLOC(sb->cfg, r->buf, r->buf_size, size);
+        if (ptr == NULL)
+            return -1;
+        memset(ptr + r->buf_size, 0, size - r->buf_size);
+        r->buf = ptr;
+        r->buf_size = size;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief store data in a region
+ *
+ *  Data within StreamingBufferConfig::region_gap of a region is added to
+ *  it, merging the regions it reaches. Otherwise a new region is set up.
+ *
+ *  \retval 0 ok
+ *  \retval 1 too many regions, use the main block
+ *  \retval -1 error
+ */
+static int RegionInsert(StreamingBuffer *sb, const uint8_t *data,
+        uint32_t data_len, uint64_t offset)
+{
+    const uint32_t gap = sb->cfg->region_gap;
+    const uint64_t end = offset + data_len;
+    StreamingBufferRegion **pr = &sb->regions;
+    StreamingBufferRegion *r;
+
+    while ((r = *pr) != NULL && r->stream_offset + r->buf_offset + gap < offset)
+        pr = &r->next;
+
+    if (r == NULL || end + gap < r->stream_offset) {
+        if (sb->regions_cnt >= STREAMING_BUFFER_REGIONS_MAX)
+            return 1;
+
+        r = CALLOC(sb->cfg, 1, sizeof(*r));
+        if (r == NULL)
+            return -1;
+        r->buf_size = RegionSize(sb, data_len);
+        r->buf = CALLOC(sb->cfg, 1, r->buf_size);
+        if (r->buf == NULL) {
+            FREE(sb->cfg, r, sizeof(*r));
+            return -1;
+        }
+        r->stream_offset = offset;
+        r->buf_offset = data_len;
+        memcpy(r->buf, data, data_len);
+        r->next = *pr;
+        *pr = r;
+        sb->regions_cnt++;
+        SCLogDebug("new region %p at %"PRIu64", len %u", r, offset, data_len);
+        return 0;
+    }
+
+    /* the data reaches r, and maybe the regions after it */
+    uint64_t r_end = MAX(end, r->stream_offset + r->buf_offset);
+    StreamingBufferRegion *n = r->next;
+    while (n != NULL && n->stream_offset <= r_end + gap) {
+        r_end = MAX(r_end, n->stream_offset + n->buf_offset);
+        n = n->next;
+    }
+    const uint64_t start = MIN(offset, r->stream_offset);
+    if (RegionGrow(sb, r, start, r_end) != 0)
+        return -1;
+
+    while (r->next != n) {
+        StreamingBufferRegion *m = r->next;
+        memcpy(r->buf + (m->stream_offset - r->stream_offset), m->buf, m->buf_offset);
+        r->next = m->next;
+        RegionFree(sb, m);
+    }
+    memcpy(r->buf + (offset - r->stream_offset), data, data_len);
+    if (r_end - r->stream_offset > r->buf_offset)
+        r->buf_offset = (uint32_t)(r_end - r->stream_offset);
+    SCLogDebug("region %p now at %"PRIu64", len %u", r, r->stream_offset, r->buf_offset);
+    return 0;
+}
+
+/** \internal
+ *  \brief slide to an offset beyond the main block
+ *
+ *  The main block is dropped, as are the regions before 'offset'. The
+ *  region holding 'offset', if any, becomes the main block.
+ */
+static void SlideToRegion(StreamingBuffer *sb, uint64_t offset)
+{
+    if (sb->buf != NULL)
+        FREE(sb->cfg, sb->buf, sb->buf_size);
+    sb->buf = NULL;
+    sb->buf_size = 0;
+    sb->buf_offset = 0;
+
+    StreamingBufferRegion *r;
+    while ((r = sb->regions) != NULL && r->stream_offset + r->buf_offset <= offset) {
+        sb->regions = r->next;
+        RegionFree(sb, r);
+    }
+
+    if (r != NULL && r->stream_offset <= offset) {
+        const uint32_t slide = offset - r->stream_offset;
+        const uint32_t size = r->buf_offset - slide;
+        SCLogDebug("region %p becomes main, sliding %u forward", r, slide);
+        memmove(r->buf, r->buf + slide, size);
+        sb->buf = r->buf;
+        sb->buf_size = r->buf_size;
+        sb->buf_offset = size;
+        sb->regions = r->next;
+        r->buf = NULL;
+        RegionFree(sb, r);
+    }
+    sb->stream_offset = offset;
+    SBBPrune(sb);
+}
+
 /**
  * \internal
  * \brief move buffer forward by 'slide'
@@ -500,13 +692,45 @@ static int __attribute__((warn_unused_result)) Grow(StreamingBuffer *sb)
     return 0;
 }
 
+/** \internal
+ *  \brief copy the regions into the main block that it reaches once its
+ *         data goes up to 'rel_end'
+ *  \retval 0 ok
+ *  \retval -1 failed to grow the main block
+ */
+static int __attribute__((warn_unused_result))
+AbsorbRegions(StreamingBuffer *sb, uint32_t rel_end)
+{
+    StreamingBufferRegion *r;
+    while ((r = sb->regions) != NULL &&
+            r->stream_offset <= sb->stream_offset +
+                MAX(rel_end, sb->buf_offset) + sb->cfg->region_gap)
+    {
+        const uint32_t r_rel = r->stream_offset - sb->stream_offset;
+        const uint32_t r_end = r_rel + r->buf_offset;
+        if (r_end > sb->buf_size) {
+            if (GrowToSize(sb, r_end) != 0)
+                return -1;
+        }
+        SCLogDebug("region %p at %u moved into the main block", r, r_rel);
+        memcpy(sb->buf + r_rel, r->buf, r->buf_offset);
+        if (r_end > sb->buf_offset)
+            sb->buf_offset = r_end;
+        sb->regions = r->next;
+        RegionFree(sb, r);
+    }
+    return 0;
+}
+
 /**
  *  \brief slide to absolute offset
  *  \todo if sliding beyond window, we could perhaps reset?
  */
 void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
 {
-    if (offset > sb->stream_offset &&
+    if (sb->regions != NULL && offset > sb->stream_offset + sb->buf_offset) {
+        SlideToRegion(sb, offset);
+    } else if (offset > sb->stream_offset &&
         offset <= sb->stream_offset + sb->buf_offset)
     {
         uint32_t slide = offset - sb->stream_offset;
@@ -529,6 +753,54 @@ void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide)
     SBBPrune(sb);
 }
 
+/**
+ *  \brief give back the part of the main block that holds no data
+ *
+ *  The block is shrunk to the smallest size growing it from the
+ *  configured size could give that still holds its data, or freed if
+ *  it holds none. It is set up again when data comes in.
+ */
+void StreamingBufferShrink(StreamingBuffer *sb)
+{
+    if (sb->buf == NULL)
+        return;
+
+    /* with gaps, data may be stored past buf_offset */
+    uint32_t used = sb->buf_offset;
+    StreamingBufferBlock *sbb = RB_MAX(SBB, &sb->sbb_tree);
+    if (sbb != NULL && sbb->offset + sbb->len > sb->stream_offset) {
+        const uint64_t end = sbb->offset + sbb->len - sb->stream_offset;
+        if (end > used)
+            used = (uint32_t)MIN(end, (uint64_t)sb->buf_size);
+    }
+
+    if (used == 0) {
+        SCLogDebug("freeing empty buffer of %u", sb->buf_size);
+        FREE(sb->cfg, sb->buf, sb->buf_size);
+        sb->buf = NULL;
+        sb->buf_size = 0;
+        return;
+    }
+
+    uint32_t size = sb->cfg->buf_size ? sb->cfg->buf_size : used;
+    while (size < used) {
+        if (size > UINT32_MAX / 2) {
+            size = used;
+            break;
+        }
+        size *= 2;
+    }
+    if (size >= sb->buf_size)
+        return;
+
+    void *ptr = REALLOC(sb->cfg, sb->buf, sb->buf_size, size);
+    if (ptr == NULL)
+        return;
+    SCLogDebug("shrunk buffer from %u to %u", sb->buf_size, size);
+    sb->buf = ptr;
+    sb->buf_size = size;
+}
+
 #define DATA_FITS(sb, len) \
     ((sb)->buf_offset + (len) <= (sb)->buf_size)
 
@@ -667,12 +939,40 @@ int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
     if (offset < sb->stream_offset)
         return -1;
 
+    /* data far beyond what we have goes into a region of its own */
+    if (sb->cfg->region_gap &&
+            offset > sb->stream_offset + sb->buf_offset + sb->cfg->region_gap)
+    {
+        const int r = RegionInsert(sb, data, data_len, offset);
+        if (r < 0)
+            return -1;
+        if (r == 0) {
+            seg->stream_offset = offset;
+            seg->segment_len = data_len;
+
+            const uint32_t rel_offset = offset - sb->stream_offset;
+            if (!RB_EMPTY(&sb->sbb_tree)) {
+                SBBUpdate(sb, rel_offset, data_len);
+            } else if (sb->buf_offset) {
+                SBBInit(sb, rel_offset, data_len);
+            } else {
+                SBBInitLeadingGap(sb, offset, data_len);
+            }
+            return 0;
+        }
+        /* too many regions, fall through to the main block */
+    }
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
             return -1;
     }
 
     uint32_t rel_offset = offset - sb->stream_offset;
+    if (sb->regions != NULL) {
+        if (AbsorbRegions(sb, rel_offset + data_len) != 0)
+            return -1;
+    }
     if (!DATA_FITS_AT_OFFSET(sb, data_len, rel_offset)) {
         if (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE) {
             AutoSlide(sb);
@@ -739,11 +1039,57 @@ int StreamingBufferSegmentIsBeforeWindow(const StreamingBuffer *sb,
     return 0;
 }
 
+uint64_t StreamingBufferGetRightEdge(const StreamingBuffer *sb)
+{
+    const StreamingBufferRegion *r = sb->regions;
+    if (r == NULL)
+        return sb->stream_offset + sb->buf_offset;
+    while (r->next != NULL)
+        r = r->next;
+    return r->stream_offset + r->buf_offset;
+}
+
+/**
+ *  \brief get the memory allocated for the buffer, its regions and its
+ *         block tracking. The StreamingBuffer itself is not included.
+ */
+uint64_t StreamingBufferGetMemuse(const StreamingBuffer *sb)
+{
+    uint64_t size = sb->buf_size;
+    for (const StreamingBufferRegion *r = sb->regions; r != NULL; r = r->next)
+        size += sizeof(*r) + r->buf_size;
+
+    StreamingBufferBlock *sbb = NULL;
+    RB_FOREACH(sbb, SBB, (struct SBB *)&sb->sbb_tree) {
+        size += sizeof(*sbb);
+    }
+    return size;
+}
+
+/** \internal
+ *  \brief get the data at 'offset' from region 'r', up to 'len' bytes */
+static inline void RegionGetData(const StreamingBufferRegion *r,
+        uint64_t offset, uint32_t len,
+        const uint8_t **data, uint32_t *data_len)
+{
+    const uint32_t rel = offset - r->stream_offset;
+    *data = r->buf + rel;
+    *data_len = MIN(len, r->buf_offset - rel);
+}
+
 /** \brief get the data for one SBB */
 void StreamingBufferSBBGetData(const StreamingBuffer *sb,
                                const StreamingBufferBlock *sbb,
                                const uint8_t **data, uint32_t *data_len)
 {
+    if (sb->regions != NULL && sbb->offset >= sb->stream_offset) {
+        const StreamingBufferRegion *r = GetRegion(sb, sbb->offset);
+        if (r != NULL) {
+            RegionGetData(r, sbb->offset, sbb->len, data, data_len);
+            return;
+        }
+    }
+
     if (sbb->offset >= sb->stream_offset) {
         uint64_t offset = sbb->offset - sb->stream_offset;
         *data = sb->buf + offset;
@@ -774,6 +1120,14 @@ void StreamingBufferSBBGetDataAtOffset(const StreamingBuffer *sb,
     if (offset >= sbb->offset && offset < (sbb->offset + sbb->len)) {
         uint32_t sbblen = sbb->len - (offset - sbb->offset);
 
+        if (sb->regions != NULL && offset >= sb->stream_offset) {
+            const StreamingBufferRegion *r = GetRegion(sb, offset);
+            if (r != NULL) {
+                RegionGetData(r, offset, sbblen, data, data_len);
+                return;
+            }
+        }
+
         if (offset >= sb->stream_offset) {
             uint64_t data_offset = offset - sb->stream_offset;
             *data = sb->buf + data_offset;
@@ -803,6 +1157,14 @@ void StreamingBufferSegmentGetData(const StreamingBuffer *sb,
                                    const StreamingBufferSegment *seg,
                                    const uint8_t **data, uint32_t *data_len)
 {
+    if (sb->regions != NULL && seg->stream_offset >= sb->stream_offset) {
+        const StreamingBufferRegion *r = GetRegion(sb, seg->stream_offset);
+        if (r != NULL) {
+            RegionGetData(r, seg->stream_offset, seg->segment_len, data, data_len);
+            return;
+        }
+    }
+
     if (likely(sb->buf)) {
         if (seg->stream_offset >= sb->stream_offset) {
             uint64_t offset = seg->stream_offset - sb->stream_offset;
@@ -839,7 +1201,7 @@ int StreamingBufferSegmentCompareRawData(const StreamingBuffer *sb,
     StreamingBufferSegmentGetData(sb, seg, &segdata, &segdata_len);
     if (segdata && segdata_len &&
         segdata_len == rawdata_len &&
-        memcmp(segdata, rawdata, segdata_len) == 0)
+        SCMemcmp(segdata, rawdata, segdata_len) == 0)
     {
         return 1;
     }
@@ -875,11 +1237,16 @@ int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
         *data = sb->buf + skip;
         *data_len = sb->buf_offset - skip;
         return 1;
-    } else {
-        *data = NULL;
-        *data_len = 0;
-        return 0;
+    } else if (sb != NULL && sb->regions != NULL && offset >= sb->stream_offset) {
+        const StreamingBufferRegion *r = GetRegion(sb, offset);
+        if (r != NULL) {
+            RegionGetData(r, offset, UINT32_MAX, data, data_len);
+            return 1;
+        }
     }
+    *data = NULL;
+    *data_len = 0;
+    return 0;
 }
 
 /**
@@ -1472,6 +1839,207 @@ static int StreamingBufferTest10(void)
     PASS;
 }
 
+static uint64_t test_memuse = 0;
+static uint64_t test_memuse_max = 0;
+
+static void TestMemuseAdd(size_t size)
+{
+    test_memuse += size;
+    if (test_memuse > test_memuse_max)
+        test_memuse_max = test_memuse;
+}
+
+static void *TestCalloc(size_t n, size_t size)
+{
+    TestMemuseAdd(n * size);
+    return SCCalloc(n, size);
+}
+
+static void *TestRealloc(void *ptr, size_t orig_size, size_t size)
+{
+    test_memuse -= orig_size;
+    TestMemuseAdd(size);
+    return SCRealloc(ptr, size);
+}
+
+static void TestFree(void *ptr, size_t size)
+{
+    test_memuse -= size;
+    SCFree(ptr);
+}
+
+/** \test data after a large gap goes into a region, which moves into
+ *        the main block once the gap is filled */
+static int StreamingBufferTest11(void)
+{
+    StreamingBufferConfig cfg = { 0, 0, 16, NULL, TestCalloc, TestRealloc, TestFree, 64 };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+    uint8_t fill[1000];
+    memset(fill, 'B', sizeof(fill));
+
+    StreamingBufferSegment seg1;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg1, (const uint8_t *)"AAAAAAAAAAAAAAAA", 16, 0) != 0);
+    StreamingBufferSegment seg2;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg2, (const uint8_t *)"XXXXXXXX", 8, 1000) != 0);
+    FAIL_IF(sb->regions_cnt != 1);
+    FAIL_IF(sb->buf_size != 16);
+    FAIL_IF(StreamingBufferGetRightEdge(sb) != 1008);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(sb, &seg2, (const uint8_t *)"XXXXXXXX", 8) != 1);
+
+    /* close by: added to the region */
+    StreamingBufferSegment seg3;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg3, (const uint8_t *)"YYYY", 4, 1010) != 0);
+    FAIL_IF(sb->regions_cnt != 1);
+    FAIL_IF(StreamingBufferGetRightEdge(sb) != 1014);
+    StreamingBufferSegment seg4;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg4, (const uint8_t *)"ZZZZZZZZ", 8, 5000) != 0);
+    FAIL_IF(sb->regions_cnt != 2);
+
+    StreamingBufferBlock *sbb1 = RB_MIN(SBB, &sb->sbb_tree);
+    FAIL_IF_NULL(sbb1);
+    StreamingBufferBlock *sbb2 = SBB_RB_NEXT(sbb1);
+    FAIL_IF_NULL(sbb2);
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamingBufferSBBGetData(sb, sbb2, &data, &data_len);
+    FAIL_IF(data_len != 8 || memcmp(data, "XXXXXXXX", 8) != 0);
+
+    /* filling the gap moves the first region into the main block */
+    StreamingBufferSegment seg5;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg5, fill, 984, 16) != 0);
+    FAIL_IF(sb->regions_cnt != 1);
+    FAIL_IF(StreamingBufferGetDataAtOffset(sb, &data, &data_len, 0) != 1);
+    FAIL_IF(data_len != 1014);
+    FAIL_IF(memcmp(data + 1000, "XXXXXXXX\0\0YYYY", 14) != 0);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(sb, &seg3, (const uint8_t *)"YYYY", 4) != 1);
+
+    /* slide into the gap and then into the last region */
+    StreamingBufferSlideToOffset(sb, 4000);
+    FAIL_IF(sb->stream_offset != 4000);
+    FAIL_IF(sb->buf != NULL);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(sb, &seg4, (const uint8_t *)"ZZZZZZZZ", 8) != 1);
+    StreamingBufferSlideToOffset(sb, 5002);
+    FAIL_IF(sb->regions_cnt != 0);
+    FAIL_IF(sb->stream_offset != 5002);
+    FAIL_IF(StreamingBufferSegmentCompareRawData(sb, &seg4, (const uint8_t *)"ZZZZZZ", 6) != 1);
+
+    StreamingBufferFree(sb);
+    FAIL_IF(test_memuse != 0);
+    PASS;
+}
+
+/** \internal
+ *  \brief insert 'cnt' segments of 'len' bytes, the first 'ooo' of them
+ *         at the end of the stream and the rest in order from its start
+ *  \retval bytes of memory used at the peak
+ */
+static uint64_t InsertPattern(uint32_t region_gap, uint32_t cnt, uint32_t len,
+        uint32_t ooo)
+{
+    StreamingBufferConfig cfg = { 0, 0, 2048, NULL, TestCalloc, TestRealloc, TestFree, region_gap };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    if (sb == NULL)
+        return 0;
+    uint8_t data[len];
+    memset(data, 'A', len);
+    test_memuse_max = test_memuse;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        uint32_t n = i < ooo ? cnt - ooo + i : i - ooo;
+        StreamingBufferSegment seg;
+        if (StreamingBufferInsertAt(sb, &seg, data, len, (uint64_t)n * len) != 0)
+            break;
+    }
+
+    const uint8_t *mydata = NULL;
+    uint32_t mydata_len = 0;
+    uint64_t mydata_offset = 0;
+    StreamingBufferGetData(sb, &mydata, &mydata_len, &mydata_offset);
+    if (mydata_len != cnt * len || sb->regions != NULL)
+        test_memuse_max = 0;
+
+    StreamingBufferFree(sb);
+    return test_memuse_max;
+}
+
+/** \test memory use of in order and out of order insert patterns,
+ *        with and without regions
+ *
+ *  The out of order pattern sends the last 1/8 of a 2MB stream first.
+ */
+static int StreamingBufferTest12(void)
+{
+    const uint32_t cnt = 2048;
+    const uint32_t len = 1024;
+
+    /* in order: regions are never used */
+    uint64_t in_order = InsertPattern(0, cnt, len, 0);
+    FAIL_IF(in_order == 0);
+    FAIL_IF(InsertPattern(STREAMING_BUFFER_REGION_GAP_DEFAULT, cnt, len, 0) != in_order);
+
+    /* out of order: without regions the whole stream is allocated with the
+     * first segment and grown from there, with regions only the data */
+    const uint32_t ooo = cnt / 8;
+    StreamingBufferConfig cfg = { 0, 0, 2048, NULL, TestCalloc, TestRealloc, TestFree, STREAMING_BUFFER_REGION_GAP_DEFAULT };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF_NULL(sb);
+    uint8_t data[1024];
+    memset(data, 'A', sizeof(data));
+    StreamingBufferSegment seg;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg, data, len, (uint64_t)(cnt - ooo) * len) != 0);
+    FAIL_IF(test_memuse > 2 * 2048 + 256);
+    StreamingBufferFree(sb);
+
+    uint64_t ooo_gap = InsertPattern(0, cnt, len, ooo);
+    uint64_t ooo_region = InsertPattern(STREAMING_BUFFER_REGION_GAP_DEFAULT, cnt, len, ooo);
+    FAIL_IF(ooo_gap == 0 || ooo_region == 0);
+    SCLogDebug("peak memory: in order %"PRIu64", out of order %"PRIu64
+            " (regions %"PRIu64")", in_order, ooo_gap, ooo_region);
+    FAIL_IF(test_memuse != 0);
+    PASS;
+}
+
+/** \test shrink a buffer after sliding, then free it once empty */
+static int StreamingBufferTest13(void)
+{
+    StreamingBufferConfig cfg = { 0, 0, 2048, NULL, TestCalloc, TestRealloc, TestFree, 0 };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF_NULL(sb);
+
+    uint8_t data[5000];
+    memset(data, 'A', sizeof(data));
+    memset(data + 4500, 'B', 500);
+    StreamingBufferSegment seg;
+    FAIL_IF(StreamingBufferAppend(sb, &seg, data, sizeof(data)) != 0);
+    FAIL_IF(sb->buf_size != 8192);
+
+    StreamingBufferSlideToOffset(sb, 4500);
+    StreamingBufferShrink(sb);
+    FAIL_IF(sb->buf_size != 2048);
+    FAIL_IF(test_memuse != sizeof(StreamingBuffer) + 2048);
+
+    const uint8_t *buf = NULL;
+    uint32_t buf_len = 0;
+    uint64_t offset = 0;
+    FAIL_IF(StreamingBufferGetData(sb, &buf, &buf_len, &offset) != 1);
+    FAIL_IF(offset != 4500 || buf_len != 500);
+    FAIL_IF(buf[0] != 'B' || buf[499] != 'B');
+
+    StreamingBufferSlideToOffset(sb, 5000);
+    StreamingBufferShrink(sb);
+    FAIL_IF_NOT_NULL(sb->buf);
+    FAIL_IF(test_memuse != sizeof(StreamingBuffer));
+
+    FAIL_IF(StreamingBufferAppend(sb, &seg, data, 10) != 0);
+    FAIL_IF(StreamingBufferGetData(sb, &buf, &buf_len, &offset) != 1);
+    FAIL_IF(offset != 5000 || buf_len != 10);
+
+    StreamingBufferFree(sb);
+    FAIL_IF(test_memuse != 0);
+    PASS;
+}
+
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -1487,5 +2055,8 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
     UtRegisterTest("StreamingBufferTest09", StreamingBufferTest09);
     UtRegisterTest("StreamingBufferTest10", StreamingBufferTest10);
+    UtRegisterTest("StreamingBufferTest11", StreamingBufferTest11);
+    UtRegisterTest("StreamingBufferTest12", StreamingBufferTest12);
+    UtRegisterTest("StreamingBufferTest13", StreamingBufferTest13);
 #endif
 }
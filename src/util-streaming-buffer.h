@@ -34,6 +34,13 @@
  *
  * Using the segments is optional.
  *
+ * Data that is inserted more than StreamingBufferConfig::region_gap
+ * bytes after the end of the data in the main block is stored in a
+ * StreamingBufferRegion of its own, so that a large gap doesn't have to
+ * be allocated. Once the main block reaches a region, the region is
+ * copied into it. A slide beyond the main block makes the region at the
+ * new offset the main block.
+ *
  *
  * stream_offset            buf_offset          stream_offset + buf_size
  * ^                        ^                   ^
@@ -72,9 +79,26 @@ typedef struct StreamingBufferConfig_ {
     void *(*Calloc)(size_t n, size_t size);
     void *(*Realloc)(void *ptr, size_t orig_size, size_t size);
     void (*Free)(void *ptr, size_t size);
+    uint32_t region_gap;    /**< gap after which data goes into a region
+                             *   of its own, 0 to disable regions */
 } StreamingBufferConfig;
 
-#define STREAMING_BUFFER_CONFIG_INITIALIZER { 0, 0, 0, NULL, NULL, NULL, NULL, }
+#define STREAMING_BUFFER_CONFIG_INITIALIZER { 0, 0, 0, NULL, NULL, NULL, NULL, 0, }
+
+#define STREAMING_BUFFER_REGION_GAP_DEFAULT 262144
+/** max regions next to the main block, beyond it gaps are allocated */
+#define STREAMING_BUFFER_REGIONS_MAX        8
+
+/**
+ *  \brief block of memory for the data after a gap
+ */
+typedef struct StreamingBufferRegion_ {
+    uint64_t stream_offset; /**< offset of the start of the region */
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t buf_offset;    /**< how far we are in buf_size */
+    struct StreamingBufferRegion_ *next;
+} StreamingBufferRegion;
 
 /**
  *  \brief block of continues data
@@ -102,15 +126,18 @@ typedef struct StreamingBuffer_ {
 
     struct SBB sbb_tree;    /**< red black tree of Stream Buffer Blocks */
     StreamingBufferBlock *head; /**< head, should always be the same as RB_MIN */
+
+    StreamingBufferRegion *regions; /**< regions after buf, ordered by offset */
+    uint32_t regions_cnt;
 #ifdef DEBUG
     uint32_t buf_size_max;
 #endif
 } StreamingBuffer;
 
 #ifndef DEBUG
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, };
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, NULL, 0, };
 #else
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, 0 };
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, NULL, 0, 0 };
 #endif
 
 typedef struct StreamingBufferSegment_ {
@@ -124,6 +151,7 @@ void StreamingBufferFree(StreamingBuffer *sb);
 
 void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide);
 void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset);
+void StreamingBufferShrink(StreamingBuffer *sb);
 
 StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb,
         const uint8_t *data, uint32_t data_len) __attribute__((warn_unused_result));
@@ -162,6 +190,9 @@ int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t offset);
 
+uint64_t StreamingBufferGetRightEdge(const StreamingBuffer *sb);
+uint64_t StreamingBufferGetMemuse(const StreamingBuffer *sb);
+
 int StreamingBufferSegmentIsBeforeWindow(const StreamingBuffer *sb,
                                          const StreamingBufferSegment *seg);
 
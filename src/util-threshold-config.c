@@ -39,6 +39,7 @@
 #include "detect-engine.h"
 #include "detect-engine-address.h"
 #include "detect-threshold.h"
+#include "detect-engine-threshold.h"
 #include "detect-parse.h"
 
 #include "conf.h"
@@ -1645,6 +1646,7 @@ static int SCThresholdConfTest09(void)
     memset(&th_v, 0, sizeof(th_v));
 
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset (&ts, 0, sizeof(struct timeval));
@@ -1717,6 +1719,7 @@ static int SCThresholdConfTest09(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -1730,6 +1733,7 @@ static int SCThresholdConfTest09(void)
 static int SCThresholdConfTest10(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset (&ts, 0, sizeof(struct timeval));
@@ -1811,6 +1815,7 @@ static int SCThresholdConfTest10(void)
     UTHFreePacket(p2);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -1824,6 +1829,7 @@ static int SCThresholdConfTest10(void)
 static int SCThresholdConfTest11(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset (&ts, 0, sizeof(struct timeval));
@@ -1920,6 +1926,7 @@ static int SCThresholdConfTest11(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -1933,6 +1940,7 @@ static int SCThresholdConfTest11(void)
 static int SCThresholdConfTest12(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset (&ts, 0, sizeof(struct timeval));
@@ -2029,6 +2037,7 @@ static int SCThresholdConfTest12(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2075,6 +2084,7 @@ static int SCThresholdConfTest13(void)
 static int SCThresholdConfTest14(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     Packet *p1 = UTHBuildPacketReal((uint8_t*)"lalala", 6, IPPROTO_TCP, "192.168.0.10",
                                     "192.168.0.100", 1234, 24);
@@ -2127,6 +2137,7 @@ static int SCThresholdConfTest14(void)
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2140,6 +2151,7 @@ static int SCThresholdConfTest14(void)
 static int SCThresholdConfTest15(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     Packet *p = UTHBuildPacketReal((uint8_t*)"lalala", 6, IPPROTO_TCP, "192.168.0.10",
                                     "192.168.0.100", 1234, 24);
@@ -2179,6 +2191,7 @@ static int SCThresholdConfTest15(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2192,6 +2205,7 @@ static int SCThresholdConfTest15(void)
 static int SCThresholdConfTest16(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     Packet *p = UTHBuildPacketReal((uint8_t*)"lalala", 6, IPPROTO_TCP, "192.168.1.1",
                                     "192.168.0.100", 1234, 24);
@@ -2230,6 +2244,7 @@ static int SCThresholdConfTest16(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2243,6 +2258,7 @@ static int SCThresholdConfTest16(void)
 static int SCThresholdConfTest17(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
 
     Packet *p = UTHBuildPacketReal((uint8_t*)"lalala", 6, IPPROTO_TCP, "192.168.0.10",
                                     "192.168.0.100", 1234, 24);
@@ -2282,6 +2298,7 @@ static int SCThresholdConfTest17(void)
     UTHFreePacket(p);
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2314,6 +2331,7 @@ static FILE *SCThresholdConfGenerateInvalidDummyFD12(void)
 static int SCThresholdConfTest18(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     FAIL_IF_NULL(de_ctx);
     de_ctx->flags |= DE_QUIET;
@@ -2334,6 +2352,7 @@ static int SCThresholdConfTest18(void)
     FAIL_IF_NOT(de->type == TYPE_SUPPRESS && de->track == TRACK_DST);
 
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2366,6 +2385,7 @@ static FILE *SCThresholdConfGenerateInvalidDummyFD13(void)
 static int SCThresholdConfTest19(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     FAIL_IF_NULL(de_ctx);
     de_ctx->flags |= DE_QUIET;
@@ -2383,6 +2403,7 @@ static int SCThresholdConfTest19(void)
     FAIL_IF_NULL(de);
     FAIL_IF_NOT(de->type == TYPE_SUPPRESS && de->track == TRACK_DST);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2416,6 +2437,7 @@ static FILE *SCThresholdConfGenerateValidDummyFD20(void)
 static int SCThresholdConfTest20(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     FAIL_IF_NULL(de_ctx);
     de_ctx->flags |= DE_QUIET;
@@ -2448,6 +2470,7 @@ static int SCThresholdConfTest20(void)
     FAIL_IF_NOT(smd->is_last);
 
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2462,6 +2485,7 @@ static int SCThresholdConfTest20(void)
 static int SCThresholdConfTest21(void)
 {
     HostInitConfig(HOST_QUIET);
+    ThresholdInit();
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     FAIL_IF_NULL(de_ctx);
     de_ctx->flags |= DE_QUIET;
@@ -2493,6 +2517,7 @@ static int SCThresholdConfTest21(void)
     FAIL_IF_NOT(smd->is_last);
 
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     HostShutdown();
     PASS;
 }
@@ -2527,6 +2552,7 @@ static int SCThresholdConfTest22(void)
     memset(&th_v, 0, sizeof(th_v));
 
     IPPairInitConfig(IPPAIR_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset(&ts, 0, sizeof(struct timeval));
@@ -2633,6 +2659,7 @@ static int SCThresholdConfTest22(void)
 
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     IPPairShutdown();
     PASS;
 }
@@ -2668,6 +2695,7 @@ static int SCThresholdConfTest23(void)
     memset(&th_v, 0, sizeof(th_v));
 
     IPPairInitConfig(IPPAIR_QUIET);
+    ThresholdInit();
 
     struct timeval ts;
     memset(&ts, 0, sizeof(struct timeval));
@@ -2718,6 +2746,7 @@ static int SCThresholdConfTest23(void)
 
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
+    ThresholdDestroy();
     IPPairShutdown();
     PASS;
 }
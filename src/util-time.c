@@ -179,6 +179,26 @@ void TimeSetIncrementTime(uint32_t tv_sec)
 void CreateIsoTimeString (const struct timeval *ts, char *str, size_t size)
 {
     time_t time = ts->tv_sec;
+#ifdef TLS
+    /* all records of the same second share the format string, only
+     * the usecs differ */
+    static __thread time_t last_time = 0;
+    static __thread char time_fmt[64] = { 0 };
+
+    if (unlikely(time != last_time || time_fmt[0] == '\0')) {
+        struct tm local_tm;
+        memset(&local_tm, 0, sizeof(local_tm));
+        struct tm *t = (struct tm*)SCLocalTime(time, &local_tm);
+        if (unlikely(t == NULL)) {
+            time_fmt[0] = '\0';
+            snprintf(str, size, "ts-error");
+            return;
+        }
+        strftime(time_fmt, sizeof(time_fmt), "%Y-%m-%dT%H:%M:%S.%%06u%z", t);
+        last_time = time;
+    }
+    snprintf(str, size, time_fmt, (uint32_t)ts->tv_usec);
+#else
     struct tm local_tm;
     memset(&local_tm, 0, sizeof(local_tm));
     struct tm *t = (struct tm*)SCLocalTime(time, &local_tm);
@@ -190,6 +210,7 @@ void CreateIsoTimeString (const struct timeval *ts, char *str, size_t size)
     } else {
         snprintf(str, size, "ts-error");
     }
+#endif
 }
 
 void CreateUtcIsoTimeString (const struct timeval *ts, char *str, size_t size)
@@ -0,0 +1,68 @@
+/* Copyright (C) 2019 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Static tracepoints (USDT) for bpftrace, perf and systemtap.
+ *
+ * With --enable-usdt each SCTrace* site is a single nop in the code and a
+ * note in the binary; a tracer attaching to the probe patches in a trap.
+ * The arguments are only computed at the site, so pass values that are
+ * at hand anyway. Without --enable-usdt the macros compile to nothing.
+ *
+ * The probes of provider "suricata", list them with
+ * `bpftrace -l 'usdt:/path/to/suricata:suricata:*'`:
+ *
+ *  - packet_acquire (Packet *p, uint32_t len)
+ *  - packet_release (Packet *p)
+ *  - flow_new (Flow *f, uint8_t proto)
+ *  - flow_evict (Flow *f, uint8_t proto)
+ *  - stream_gap (Flow *f, uint32_t size)
+ *  - app_detect (Flow *f, AppProto alproto)
+ *  - mpm_scan_start (int list_id, uint32_t len)
+ *  - mpm_scan_done (int list_id, uint32_t matches)
+ *  - rule_match (Packet *p, uint32_t sid)
+ *  - log_write (const char *filename, uint32_t len)
+ *  - memcap_hit (const char *name, uint64_t size)
+ */
+
+#ifndef __UTIL_TRACE_H__
+#define __UTIL_TRACE_H__
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define SCTrace0(name) \
+    DTRACE_PROBE(suricata, name)
+#define SCTrace1(name, a) \
+    DTRACE_PROBE1(suricata, name, (a))
+#define SCTrace2(name, a, b) \
+    DTRACE_PROBE2(suricata, name, (a), (b))
+#define SCTrace3(name, a, b, c) \
+    DTRACE_PROBE3(suricata, name, (a), (b), (c))
+
+#else
+
+#define SCTrace0(name)
+#define SCTrace1(name, a)
+#define SCTrace2(name, a, b)
+#define SCTrace3(name, a, b, c)
+
+#endif /* HAVE_USDT */
+
+#endif /* __UTIL_TRACE_H__ */
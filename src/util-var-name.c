@@ -25,7 +25,7 @@
 
 #include "suricata-common.h"
 #include "detect.h"
-#include "util-hashlist.h"
+#include "util-hash-open.h"
 #include "util-var-name.h"
 
 /* the way this can be used w/o locking lookups:
@@ -38,26 +38,6 @@
  *   be freed.
  */
 
-typedef struct VarNameStore_ {
-    HashListTable *names;
-    HashListTable *ids;
-    uint32_t max_id;
-    uint32_t de_ctx_version;    /**< de_ctx version 'owning' this */
-} VarNameStore;
-
-static int initialized = 0;
-/* currently VarNameStore that is READ ONLY. This way lookups can
- * be done w/o locking or synchronization */
-SC_ATOMIC_DECLARE(VarNameStore *, g_varnamestore_current);
-
-/* old VarNameStore on the way out */
-static VarNameStore *g_varnamestore_old = NULL;
-
-/* new VarNameStore that is being prepared. Multiple DetectLoader threads
- * may be updating it so a lock is used for synchronization. */
-static VarNameStore *g_varnamestore_staging = NULL;
-static SCMutex g_varnamestore_staging_m = SCMUTEX_INITIALIZER;
-
 /** \brief Name2idx mapping structure for flowbits, flowvars and pktvars. */
 typedef struct VariableName_ {
     char *name;
@@ -65,58 +45,58 @@ typedef struct VariableName_ {
     uint32_t idx;
 } VariableName;
 
-static uint32_t VariableNameHash(HashListTable *ht, void *buf, uint16_t buflen)
+static inline uint32_t VariableNameHash(const VariableName *fn)
 {
-     VariableName *fn = (VariableName *)buf;
-     uint32_t hash = strlen(fn->name) + fn->type;
-     uint16_t u;
-
-     for (u = 0; u < buflen; u++) {
-         hash += fn->name[u];
-     }
-
-     return hash;
+    return OpenHashString(fn->name, fn->type);
 }
 
-static char VariableNameCompare(void *buf1, uint16_t len1, void *buf2, uint16_t len2)
+static inline int VariableNameCompare(const VariableName *fn1, const VariableName *fn2)
 {
-    VariableName *fn1 = (VariableName *)buf1;
-    VariableName *fn2 = (VariableName *)buf2;
-
-    if (fn1->type != fn2->type)
-        return 0;
-
-    if (strcmp(fn1->name,fn2->name) == 0)
-        return 1;
-
-    return 0;
+    return (fn1->type == fn2->type && strcmp(fn1->name, fn2->name) == 0);
 }
 
-static uint32_t VariableIdxHash(HashListTable *ht, void *buf, uint16_t buflen)
+static inline uint32_t VariableIdxHash(const VariableName *fn)
 {
-    VariableName *fn = (VariableName *)buf;
-    uint32_t hash = fn->idx + fn->type;
-    return hash;
+    return OpenHashU32(fn->idx ^ ((uint32_t)fn->type << 24));
 }
 
-static char VariableIdxCompare(void *buf1, uint16_t len1, void *buf2, uint16_t len2)
+static inline int VariableIdxCompare(const VariableName *fn1, const VariableName *fn2)
 {
-    VariableName *fn1 = (VariableName *)buf1;
-    VariableName *fn2 = (VariableName *)buf2;
+    return (fn1->type == fn2->type && fn1->idx == fn2->idx);
+}
 
-    if (fn1->type != fn2->type)
-        return 0;
+#define VariableNameKey(fn) (fn)
 
-    if (fn1->idx == fn2->idx)
-        return 1;
+OPEN_HASH_HEAD(VariableNameHashTable, VariableName);
+OPEN_HASH_GENERATE(VariableNameHashTable, VariableName, const VariableName *,
+        VariableNameHash, VariableNameKey, VariableNameCompare)
 
-    return 0;
-}
+OPEN_HASH_HEAD(VariableIdxHashTable, VariableName);
+OPEN_HASH_GENERATE(VariableIdxHashTable, VariableName, const VariableName *,
+        VariableIdxHash, VariableNameKey, VariableIdxCompare)
 
-static void VariableNameFree(void *data)
-{
-    VariableName *fn = (VariableName *)data;
+typedef struct VarNameStore_ {
+    VariableNameHashTable *names;
+    VariableIdxHashTable *ids;
+    uint32_t max_id;
+    uint32_t de_ctx_version;    /**< de_ctx version 'owning' this */
+} VarNameStore;
 
+static int initialized = 0;
+/* currently VarNameStore that is READ ONLY. This way lookups can
+ * be done w/o locking or synchronization */
+SC_ATOMIC_DECLARE(VarNameStore *, g_varnamestore_current);
+
+/* old VarNameStore on the way out */
+static VarNameStore *g_varnamestore_old = NULL;
+
+/* new VarNameStore that is being prepared. Multiple DetectLoader threads
+ * may be updating it so a lock is used for synchronization. */
+static VarNameStore *g_varnamestore_staging = NULL;
+static SCMutex g_varnamestore_staging_m = SCMUTEX_INITIALIZER;
+
+static void VariableNameFree(VariableName *fn)
+{
     if (fn == NULL)
         return;
 
@@ -136,15 +116,15 @@ static VarNameStore *VarNameStoreInit(void)
     if (v == NULL)
         return NULL;
 
-    v->names = HashListTableInit(4096, VariableNameHash, VariableNameCompare, VariableNameFree);
+    v->names = VariableNameHashTableInit(256);
     if (v->names == NULL) {
         SCFree(v);
         return NULL;
     }
 
-    v->ids = HashListTableInit(4096, VariableIdxHash, VariableIdxCompare, NULL);
+    v->ids = VariableIdxHashTableInit(256);
     if (v->ids == NULL) {
-        HashListTableFree(v->names);
+        VariableNameHashTableFree(v->names, NULL);
         SCFree(v);
         return NULL;
     }
@@ -156,8 +136,9 @@ static VarNameStore *VarNameStoreInit(void)
 static void VarNameStoreDoFree(VarNameStore *v)
 {
     if (v) {
-        HashListTableFree(v->names);
-        HashListTableFree(v->ids);
+        /* the entries are shared, ids doesn't own them */
+        VariableIdxHashTableFree(v->ids, NULL);
+        VariableNameHashTableFree(v->names, VariableNameFree);
         SCFree(v);
     }
 }
@@ -184,13 +165,16 @@ static uint32_t VariableNameGetIdx(VarNameStore *v, const char *name, enum VarTy
     if (fn->name == NULL)
         goto error;
 
-    VariableName *lookup_fn = (VariableName *)HashListTableLookup(v->names, (void *)fn, 0);
+    VariableName *lookup_fn = VariableNameHashTableLookup(v->names, fn);
     if (lookup_fn == NULL) {
-        v->max_id++;
-
-        idx = fn->idx = v->max_id;
-        HashListTableAdd(v->names, (void *)fn, 0);
-        HashListTableAdd(v->ids, (void *)fn, 0);
+        fn->idx = v->max_id + 1;
+        if (VariableNameHashTableAdd(v->names, fn) != 0)
+            goto error;
+        if (VariableIdxHashTableAdd(v->ids, fn) != 0) {
+            VariableNameHashTableRemove(v->names, fn);
+            goto error;
+        }
+        idx = ++v->max_id;
         SCLogDebug("new registration %s id %u type %u", fn->name, fn->idx, fn->type);
     } else {
         idx = lookup_fn->idx;
@@ -222,7 +206,7 @@ static char *VariableIdxGetName(VarNameStore *v, uint32_t idx, enum VarTypes typ
     fn->type = type;
     fn->idx = idx;
 
-    VariableName *lookup_fn = (VariableName *)HashListTableLookup(v->ids, (void *)fn, 0);
+    VariableName *lookup_fn = VariableIdxHashTableLookup(v->ids, fn);
     if (lookup_fn != NULL) {
         name = SCStrdup(lookup_fn->name);
         if (unlikely(name == NULL))
@@ -267,22 +251,18 @@ int VarNameStoreSetupStaging(uint32_t de_ctx_version)
     VarNameStore *current = SC_ATOMIC_GET(g_varnamestore_current);
     if (current) {
         /* add all entries from the current hash into this new one. */
-        HashListTableBucket *b = HashListTableGetListHead(current->names);
-        while (b) {
-            VariableName *var = HashListTableGetListData(b);
-
+        VariableName *var;
+        OPEN_HASH_FOREACH(var, current->names) {
             VariableName *newvar = SCCalloc(1, sizeof(*newvar));
             BUG_ON(newvar == NULL);
             memcpy(newvar, var, sizeof(*newvar));
             newvar->name = SCStrdup(var->name);
             BUG_ON(newvar->name == NULL);
 
-            HashListTableAdd(nv->names, (void *)newvar, 0);
-            HashListTableAdd(nv->ids, (void *)newvar, 0);
+            BUG_ON(VariableNameHashTableAdd(nv->names, newvar) != 0);
+            BUG_ON(VariableIdxHashTableAdd(nv->ids, newvar) != 0);
             nv->max_id = MAX(nv->max_id, newvar->idx);
             SCLogDebug("xfer %s id %u type %u", newvar->name, newvar->idx, newvar->type);
-
-            b = HashListTableGetListNext(b);
         }
     }
 
@@ -296,7 +276,7 @@ const char *VarNameStoreLookupById(const uint32_t id, const enum VarTypes type)
     VarNameStore *current = SC_ATOMIC_GET(g_varnamestore_current);
     BUG_ON(current == NULL);
     VariableName lookup = { NULL, type, id };
-    VariableName *found = (VariableName *)HashListTableLookup(current->ids, (void *)&lookup, 0);
+    VariableName *found = VariableIdxHashTableLookup(current->ids, &lookup);
     if (found == NULL) {
         return NULL;
     }
@@ -308,7 +288,7 @@ uint32_t VarNameStoreLookupByName(const char *name, const enum VarTypes type)
     VarNameStore *current = SC_ATOMIC_GET(g_varnamestore_current);
     BUG_ON(current == NULL);
     VariableName lookup = { (char *)name, type, 0 };
-    VariableName *found = (VariableName *)HashListTableLookup(current->names, (void *)&lookup, 0);
+    VariableName *found = VariableNameHashTableLookup(current->names, &lookup);
     if (found == NULL) {
         return 0;
     }
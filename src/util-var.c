@@ -34,14 +34,166 @@
 #include "host-bit.h"
 #include "ippair-bit.h"
 
+#include "util-bloomfilter-counting.h"
+#include "util-hash-lookup3.h"
 #include "util-debug.h"
 
-void XBitFree(XBit *fb)
+/** \brief set a bit, or update its expire time if it's already set
+ *
+ *  \param xbs pointer to the bits, allocated if *xbs is NULL
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int XBitsSet(XBits **xbs, const uint32_t idx, const uint32_t expire)
 {
-    if (fb == NULL)
+    XBits *x = *xbs;
+    if (x == NULL) {
+        x = SCCalloc(1, sizeof(*x));
+        if (unlikely(x == NULL))
+            return -1;
+        *xbs = x;
+    }
+    if (idx >= x->size) {
+        const uint32_t new_size = (idx | 63) + 1;
+        uint64_t *bits = SCRealloc(x->bits, (new_size / 64) * sizeof(uint64_t));
+        if (unlikely(bits == NULL))
+            return -1;
+        x->bits = bits;
+        memset(bits + x->size / 64, 0, ((new_size - x->size) / 64) * sizeof(uint64_t));
+        uint32_t *exp = SCRealloc(x->expire, new_size * sizeof(uint32_t));
+        if (unlikely(exp == NULL))
+            return -1;
+        x->expire = exp;
+        x->size = new_size;
+    }
+    if ((x->bits[idx >> 6] & (1ULL << (idx & 63))) == 0) {
+        x->bits[idx >> 6] |= (1ULL << (idx & 63));
+        x->cnt++;
+    }
+    x->expire[idx] = expire;
+    return 0;
+}
+
+/** \brief unset a bit. Frees the bits and sets *xbs to NULL if it was
+ *         the last one. */
+void XBitsUnset(XBits **xbs, const uint32_t idx)
+{
+    XBits *x = *xbs;
+    if (XBitsGet(x, idx) == NULL)
         return;
 
-    SCFree(fb);
+    x->bits[idx >> 6] &= ~(1ULL << (idx & 63));
+    if (--x->cnt == 0) {
+        XBitsFree(x);
+        *xbs = NULL;
+    }
+}
+
+/** \brief find the next set bit from *idx on
+ *  \retval 1 found, *idx is updated to the bit
+ *  \retval 0 no more bits */
+int XBitsNext(const XBits *xbs, uint32_t *idx)
+{
+    if (xbs == NULL)
+        return 0;
+    for (uint32_t i = *idx; i < xbs->size; ) {
+        const uint64_t word = xbs->bits[i >> 6] >> (i & 63);
+        if (word != 0) {
+            *idx = i + __builtin_ctzll(word);
+            return 1;
+        }
+        i = (i | 63) + 1;
+    }
+    return 0;
+}
+
+void XBitsFree(XBits *xbs)
+{
+    if (xbs == NULL)
+        return;
+
+    if (xbs->bits != NULL)
+        SCFree(xbs->bits);
+    if (xbs->expire != NULL)
+        SCFree(xbs->expire);
+    SCFree(xbs);
+}
+
+/* 64k 32 bit counters: with 2 hashes the filter answers "maybe" for less
+ * than 1% of the addresses while up to a few thousand have bits. The
+ * counters are 32 bit so they can't saturate and then undercount. */
+#define XBITS_FILTER_SIZE   65536
+#define XBITS_FILTER_HASHES 2
+
+struct XBitsFilter_ {
+    BloomFilterCounting *bf;
+    SCMutex m;
+};
+
+static uint32_t XBitsFilterHash(const void *data, uint16_t len, uint8_t iter, uint32_t size)
+{
+    return hashlittle(data, len, iter) % size;
+}
+
+XBitsFilter *XBitsFilterNew(void)
+{
+    XBitsFilter *f = SCCalloc(1, sizeof(*f));
+    if (unlikely(f == NULL))
+        return NULL;
+    f->bf = BloomFilterCountingInit(XBITS_FILTER_SIZE, 4, XBITS_FILTER_HASHES,
+            XBitsFilterHash);
+    if (f->bf == NULL) {
+        SCFree(f);
+        return NULL;
+    }
+    SCMutexInit(&f->m, NULL);
+    return f;
+}
+
+void XBitsFilterFree(XBitsFilter *f)
+{
+    if (f == NULL)
+        return;
+    BloomFilterCountingFree(f->bf);
+    SCMutexDestroy(&f->m);
+    SCFree(f);
+}
+
+/** \brief record that the owner of key got its first bit */
+void XBitsFilterAdd(XBitsFilter *f, const void *key, uint16_t len)
+{
+    if (f == NULL)
+        return;
+    SCMutexLock(&f->m);
+    BloomFilterCountingAdd(f->bf, key, len);
+    SCMutexUnlock(&f->m);
+}
+
+/** \brief record that the owner of key lost its last bit */
+void XBitsFilterRemove(XBitsFilter *f, const void *key, uint16_t len)
+{
+    if (f == NULL)
+        return;
+    SCMutexLock(&f->m);
+    BloomFilterCountingRemove(f->bf, key, len);
+    SCMutexUnlock(&f->m);
+}
+
+/** \brief check if the owner of key may have bits
+ *
+ *  Doesn't take the lock: only adding and removing is serialized. A check
+ *  that races with the first bit of a host being set can go either way,
+ *  just like it could when looking up the host.
+ *
+ *  \retval false the owner has no bits for sure
+ *  \retval true it may have bits, or there is no filter
+ */
+bool XBitsFilterMayHave(XBitsFilter *f, const void *key, uint16_t len)
+{
+    if (f == NULL)
+        return true;
+    return BloomFilterCountingTest(f->bf, key, len) == 1;
 }
 
 void GenericVarFree(GenericVar *gv)
@@ -60,13 +212,6 @@ void GenericVarFree(GenericVar *gv)
             FlowBitFree(fb);
             break;
         }
-        case DETECT_XBITS:
-        {
-            XBit *fb = (XBit *)gv;
-            //printf("GenericVarFree: fb %p, removing\n", fb);
-            XBitFree(fb);
-            break;
-        }
         case DETECT_FLOWVAR:
         {
             FlowVar *fv = (FlowVar *)gv;
@@ -52,15 +52,39 @@ typedef struct GenericVar_ {
     struct GenericVar_ *next;
 } GenericVar;
 
-typedef struct XBit_ {
-    uint8_t type;       /* type, DETECT_XBITS in this case */
-    uint8_t pad[3];
-    uint32_t idx;       /* name idx */
-    GenericVar *next;
-    uint32_t expire;
-} XBit;
-
-void XBitFree(XBit *);
+/** xbits of a host or ippair: a bitmap indexed by the bit's name idx,
+ *  with an expire time per bit */
+typedef struct XBits_ {
+    uint32_t size;      /**< number of bits there is room for, multiple of 64 */
+    uint32_t cnt;       /**< number of bits set */
+    uint64_t *bits;
+    uint32_t *expire;
+} XBits;
+
+/** \brief get the expire time of a bit
+ *  \retval expire pointer to the expire time or NULL if the bit is not set */
+static inline uint32_t *XBitsGet(XBits *xbs, const uint32_t idx)
+{
+    if (xbs == NULL || idx >= xbs->size)
+        return NULL;
+    if ((xbs->bits[idx >> 6] & (1ULL << (idx & 63))) == 0)
+        return NULL;
+    return &xbs->expire[idx];
+}
+
+int XBitsSet(XBits **xbs, const uint32_t idx, const uint32_t expire);
+void XBitsUnset(XBits **xbs, const uint32_t idx);
+int XBitsNext(const XBits *xbs, uint32_t *idx);
+void XBitsFree(XBits *xbs);
+
+/** counting bloom filter of the hosts or ippairs that have xbits */
+typedef struct XBitsFilter_ XBitsFilter;
+
+XBitsFilter *XBitsFilterNew(void);
+void XBitsFilterFree(XBitsFilter *f);
+void XBitsFilterAdd(XBitsFilter *f, const void *key, uint16_t len);
+void XBitsFilterRemove(XBitsFilter *f, const void *key, uint16_t len);
+bool XBitsFilterMayHave(XBitsFilter *f, const void *key, uint16_t len);
 
 // A list of variables we try to resolve while parsing configuration file.
 // Helps to detect recursive declarations.